@@ -0,0 +1,732 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+/* A stand-alone microbenchmark of the containers in src/lib. Every container 
+ * is exercised with the operations that the engine leans on (insertion, 
+ * lookup, deletion, iteration and range queries) at a few realistic sizes, 
+ * and the per-operation cost is reported as the best of a number of 
+ * repetitions. The quadtrees are filled with entity-like records spread over 
+ * a map-sized area, and the priority queues are compared both on raw 
+ * push/pop throughput and on a wavefront expansion over a grid, as done by 
+ * the field integration. All the random choices are made from a seeded 
+ * generator, so runs with the same arguments are repeatable.
+ */
+
+#define SDL_MAIN_HANDLED
+
+#include "../../src/lib/public/khash.h"
+#include "../../src/lib/public/lru_cache.h"
+#include "../../src/lib/public/mpool.h"
+#include "../../src/lib/public/pqueue.h"
+#include "../../src/lib/public/bucket_queue.h"
+#include "../../src/lib/public/quadtree.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+#define MAX_RESULTS         (16)
+#define WORLD_DIM           (1024.0f)
+#define SIGHT_RANGE         (48.0f)
+#define BOX_DIM             (128.0f)
+#define MAX_QUERY_RESULTS   (1024)
+#define STEP_DIST           (2.0f)
+#define LRU_KEYSPACE_MULT   (4)
+#define GRID_MAX_COST       (8)
+#define POSTREE_BUCKET_SZ   (16)
+
+struct payload{
+    uint32_t id;
+    float    vals[7];
+};
+
+struct result{
+    const char *name;
+    size_t      nops;
+    float       best_ms;
+};
+
+struct bench_opts{
+    uint32_t seed;
+    int      reps;
+    int      size;
+};
+
+struct workload{
+    const char *name;
+    void      (*run)(int n);
+};
+
+static inline int u32_key(uint32_t v)
+{
+    return (int)v;
+}
+
+KHASH_MAP_INIT_INT(u32, uint32_t)
+
+LRU_CACHE_TYPE(payload, struct payload)
+LRU_CACHE_PROTOTYPES(static, payload, struct payload)
+LRU_CACHE_IMPL(static, payload, struct payload)
+
+MPOOL_TYPE(flat, struct payload)
+MPOOL_PROTOTYPES(static, flat, struct payload)
+MPOOL_IMPL(static, flat, struct payload)
+
+MPOOL_CHUNKED_TYPE(chunked, struct payload)
+MPOOL_CHUNKED_PROTOTYPES(static, chunked, struct payload)
+MPOOL_CHUNKED_IMPL(static, chunked, struct payload)
+
+PQUEUE_TYPE(heap, uint32_t)
+PQUEUE_PROTOTYPES(static, heap, uint32_t)
+PQUEUE_IMPL(static, heap, uint32_t)
+
+PQUEUE_INDEXED_TYPE(iheap, uint32_t)
+PQUEUE_INDEXED_PROTOTYPES(static, iheap, uint32_t)
+PQUEUE_INDEXED_IMPL(static, iheap, uint32_t, u32_key)
+
+BUCKET_QUEUE_TYPE(radix, uint32_t)
+BUCKET_QUEUE_PROTOTYPES(static, radix, uint32_t)
+BUCKET_QUEUE_IMPL(static, radix, uint32_t)
+
+/* The same instantiation as the entity position tree in game/position.c */
+QUADTREE_LINEAR_TYPE(ent, uint32_t, POSTREE_BUCKET_SZ)
+QUADTREE_LINEAR_PROTOTYPES(static, ent, uint32_t)
+QUADTREE_LINEAR_IMPL(static, ent, uint32_t)
+
+QUADTREE_TYPE(ptr, uint32_t)
+QUADTREE_PROTOTYPES(static, ptr, uint32_t)
+QUADTREE_IMPL(static, ptr, uint32_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static uint32_t          s_rng;
+static struct result     s_results[MAX_RESULTS];
+static size_t            s_nresults;
+/* Written with the results of the timed operations, so that none of */
+/* them are optimized away. */
+static volatile uint64_t s_sink;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint32_t rand_next(void)
+{
+    /* xorshift32 - the same sequence on every platform */
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static float rand_unit(void)
+{
+    return (rand_next() >> 8) / (float)(1 << 24);
+}
+
+/* The trees span [-WORLD_DIM/2, WORLD_DIM/2] along both axes, centered on the origin 
+ * like the map. The coordinates keep clear of the bounds, which are outside the trees. */
+static float clamp_coord(float v)
+{
+    const float half = WORLD_DIM / 2.0f - 1.0f;
+    return MIN(MAX(v, -half), half);
+}
+
+static float rand_coord(void)
+{
+    return clamp_coord((rand_unit() - 0.5f) * WORLD_DIM);
+}
+
+static void shuffle(uint32_t *arr, int n)
+{
+    for(int i = n - 1; i > 0; i--) {
+        int j = rand_next() % (uint32_t)(i + 1);
+        uint32_t tmp = arr[i];
+        arr[i] = arr[j];
+        arr[j] = tmp;
+    }
+}
+
+static float elapsed_ms(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0f / SDL_GetPerformanceFrequency();
+}
+
+static void record(const char *name, size_t nops, float ms)
+{
+    for(int i = 0; i < s_nresults; i++) {
+        if(!strcmp(s_results[i].name, name)) {
+            s_results[i].best_ms = MIN(s_results[i].best_ms, ms);
+            return;
+        }
+    }
+    assert(s_nresults < MAX_RESULTS);
+    s_results[s_nresults++] = (struct result){name, nops, ms};
+}
+
+static void print_results(const char *workload, int n)
+{
+    printf("\n== %s (n = %d)\n", workload, n);
+    printf("  %-20s %9s %10s %10s\n", "(op)", "ops", "ns/op", "Mops/s");
+
+    for(int i = 0; i < s_nresults; i++) {
+        const struct result *res = &s_results[i];
+        double ns = res->best_ms * 1e6 / MAX(res->nops, 1);
+        printf("  %-20s %9zu %10.2f %10.2f\n", res->name, res->nops, ns, 
+            ns > 0.0 ? 1e3 / ns : 0.0);
+    }
+}
+
+static uint32_t *rand_keys(int n)
+{
+    uint32_t *keys = malloc(n * sizeof(uint32_t));
+    if(!keys)
+        return NULL;
+    /* Distinct, but spread out over the whole key range */
+    for(int i = 0; i < n; i++)
+        keys[i] = (rand_next() & ~0xffffu) | (uint32_t)i;
+    shuffle(keys, n);
+    return keys;
+}
+
+static void bench_khash(int n)
+{
+    /* The second half of the keys is never inserted */
+    uint32_t *keys = rand_keys(2 * n);
+    khash_t(u32) *table = kh_init(u32);
+    if(!keys || !table)
+        goto fail;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        int status;
+        khiter_t k = kh_put(u32, table, keys[i], &status);
+        if(status == -1)
+            goto fail;
+        kh_value(table, k) = i;
+    }
+    record("insert", n, elapsed_ms(start));
+
+    uint64_t sum = 0;
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        khiter_t k = kh_get(u32, table, keys[(i * 7919) % n]);
+        sum += kh_value(table, k);
+    }
+    record("lookup (hit)", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        khiter_t k = kh_get(u32, table, keys[n + i]);
+        sum += (k == kh_end(table));
+    }
+    record("lookup (miss)", n, elapsed_ms(start));
+
+    uint32_t key, val;
+    start = SDL_GetPerformanceCounter();
+    kh_foreach(table, key, val, {
+        sum += key ^ val;
+    });
+    record("iterate", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        khiter_t k = kh_get(u32, table, keys[i]);
+        kh_del(u32, table, k);
+    }
+    record("delete", n, elapsed_ms(start));
+    s_sink += sum;
+    goto out;
+
+fail:
+    fprintf(stderr, "%s: failed at n = %d\n", __func__, n);
+out:
+    if(table)
+        kh_destroy(u32, table);
+    free(keys);
+}
+
+/* Both quadtree variants share the same interface, so the same workload is 
+ * instantiated for each of them. */
+#define BENCH_QUADTREE(name)                                                    \
+    static void bench_qt_##name(int n)                                          \
+    {                                                                           \
+        float *xs = malloc(n * sizeof(float));                                  \
+        float *ys = malloc(n * sizeof(float));                                  \
+        uint32_t *out = malloc(MAX_QUERY_RESULTS * sizeof(uint32_t));           \
+        qt(name) tree;                                                          \
+        bool inited = false;                                                    \
+        if(!xs || !ys || !out)                                                  \
+            goto fail;                                                          \
+        if(!qt_##name##_init(&tree, -WORLD_DIM / 2.0f, WORLD_DIM / 2.0f,        \
+            -WORLD_DIM / 2.0f, WORLD_DIM / 2.0f))                               \
+            goto fail;                                                          \
+        inited = true;                                                          \
+                                                                                \
+        for(int i = 0; i < n; i++) {                                            \
+            xs[i] = rand_coord();                                               \
+            ys[i] = rand_coord();                                               \
+        }                                                                       \
+                                                                                \
+        uint64_t start = SDL_GetPerformanceCounter();                           \
+        for(int i = 0; i < n; i++) {                                            \
+            if(!qt_##name##_insert(&tree, xs[i], ys[i], i))                     \
+                goto fail;                                                      \
+        }                                                                       \
+        record("insert", n, elapsed_ms(start));                                 \
+                                                                                \
+        uint64_t sum = 0;                                                       \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            sum += qt_##name##_inrange_circle(&tree, xs[i], ys[i],              \
+                SIGHT_RANGE, out, MAX_QUERY_RESULTS);                           \
+        }                                                                       \
+        record("inrange_circle", n, elapsed_ms(start));                         \
+                                                                                \
+        int nboxes = MAX(n / 16, 1);                                            \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < nboxes; i++) {                                       \
+            float x = xs[i] - BOX_DIM / 2.0f, y = ys[i] - BOX_DIM / 2.0f;       \
+            sum += qt_##name##_inrange_rect(&tree, x, x + BOX_DIM,              \
+                y, y + BOX_DIM, out, MAX_QUERY_RESULTS);                        \
+        }                                                                       \
+        record("inrange_rect", nboxes, elapsed_ms(start));                      \
+                                                                                \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            float nx = clamp_coord(xs[i] + (rand_unit() - 0.5f) * STEP_DIST);   \
+            float ny = clamp_coord(ys[i] + (rand_unit() - 0.5f) * STEP_DIST);   \
+            if(!qt_##name##_move(&tree, xs[i], ys[i], nx, ny, i))               \
+                goto fail;                                                      \
+            xs[i] = nx;                                                         \
+            ys[i] = ny;                                                         \
+        }                                                                       \
+        record("move", n, elapsed_ms(start));                                   \
+                                                                                \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            sum += qt_##name##_delete(&tree, xs[i], ys[i], i);                  \
+        }                                                                       \
+        record("delete", n, elapsed_ms(start));                                 \
+        s_sink += sum;                                                          \
+        goto out;                                                               \
+                                                                                \
+    fail:                                                                       \
+        fprintf(stderr, "%s: failed at n = %d\n", __func__, n);                 \
+    out:                                                                        \
+        if(inited)                                                              \
+            qt_##name##_destroy(&tree);                                         \
+        free(xs);                                                               \
+        free(ys);                                                               \
+        free(out);                                                              \
+    }
+
+BENCH_QUADTREE(ent)
+BENCH_QUADTREE(ptr)
+
+static void bench_lru(int n)
+{
+    /* The cache holds 'n' entries and is referenced with keys drawn from */
+    /* a larger key space, so that the misses cause evictions. */
+    int nkeys = n * LRU_KEYSPACE_MULT;
+    uint32_t *keys = malloc(n * sizeof(uint32_t));
+    lru(payload) cache;
+    bool inited = false;
+    if(!keys)
+        goto fail;
+    if(!lru_payload_init(&cache, n, NULL))
+        goto fail;
+    inited = true;
+
+    for(int i = 0; i < n; i++)
+        keys[i] = rand_next() % nkeys;
+
+    struct payload pl = {0};
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        pl.id = i;
+        lru_payload_put(&cache, i, &pl);
+    }
+    record("put (fill)", n, elapsed_ms(start));
+
+    uint64_t sum = 0;
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        const struct payload *entry = lru_payload_at(&cache, (i * 7919) % n);
+        sum += entry ? entry->id : 0;
+    }
+    record("get (hit)", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        const struct payload *entry = lru_payload_at(&cache, keys[i]);
+        if(entry) {
+            sum += entry->id;
+            continue;
+        }
+        pl.id = keys[i];
+        lru_payload_put(&cache, keys[i], &pl);
+    }
+    record("get/put (mixed)", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++) {
+        pl.id = i;
+        lru_payload_put(&cache, nkeys + i, &pl);
+    }
+    record("put (evict)", n, elapsed_ms(start));
+    s_sink += sum;
+    goto out;
+
+fail:
+    fprintf(stderr, "%s: failed at n = %d\n", __func__, n);
+out:
+    if(inited)
+        lru_payload_destroy(&cache);
+    free(keys);
+}
+
+/* Both pool variants share the same interface, so the same workload is 
+ * instantiated for each of them. */
+#define BENCH_MPOOL(name)                                                       \
+    static void bench_mp_##name(int n)                                          \
+    {                                                                           \
+        uint32_t *order = malloc(n * sizeof(uint32_t));                         \
+        mp_ref_t *refs = malloc(n * sizeof(mp_ref_t));                          \
+        mp(name) pool;                                                          \
+        mp_##name##_init(&pool);                                                \
+        if(!order || !refs)                                                     \
+            goto fail;                                                          \
+                                                                                \
+        for(int i = 0; i < n; i++)                                              \
+            order[i] = i;                                                       \
+        shuffle(order, n);                                                      \
+                                                                                \
+        uint64_t start = SDL_GetPerformanceCounter();                           \
+        for(int i = 0; i < n; i++) {                                            \
+            refs[i] = mp_##name##_alloc(&pool);                                 \
+            if(!refs[i])                                                        \
+                goto fail;                                                      \
+            mp_##name##_entry(&pool, refs[i])->id = i;                          \
+        }                                                                       \
+        record("alloc (grow)", n, elapsed_ms(start));                           \
+                                                                                \
+        uint64_t sum = 0;                                                       \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            sum += mp_##name##_entry(&pool, refs[order[i]])->id;                \
+        }                                                                       \
+        record("entry (random)", n, elapsed_ms(start));                         \
+                                                                                \
+        /* Free the entries in random order, scrambling the free list */        \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            mp_##name##_free(&pool, refs[order[i]]);                            \
+        }                                                                       \
+        record("free", n, elapsed_ms(start));                                   \
+                                                                                \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            refs[i] = mp_##name##_alloc(&pool);                                 \
+            mp_##name##_entry(&pool, refs[i])->id = i;                          \
+        }                                                                       \
+        record("alloc (reuse)", n, elapsed_ms(start));                          \
+                                                                                \
+        start = SDL_GetPerformanceCounter();                                    \
+        for(int i = 0; i < n; i++) {                                            \
+            sum += mp_##name##_entry(&pool, refs[i])->id;                       \
+        }                                                                       \
+        record("entry (alloc order)", n, elapsed_ms(start));                    \
+        s_sink += sum;                                                          \
+        goto out;                                                               \
+                                                                                \
+    fail:                                                                       \
+        fprintf(stderr, "%s: failed at n = %d\n", __func__, n);                 \
+    out:                                                                        \
+        mp_##name##_destroy(&pool);                                             \
+        free(order);                                                            \
+        free(refs);                                                             \
+    }
+
+BENCH_MPOOL(flat)
+BENCH_MPOOL(chunked)
+
+static void bench_queues(int n)
+{
+    uint32_t *prios = malloc(n * sizeof(uint32_t));
+    pq(heap) heap;
+    pq(iheap) iheap;
+    bq(radix) radix;
+    bool iheap_inited = false;
+
+    pq_heap_init(&heap);
+    bq_radix_init(&radix);
+    if(!prios)
+        goto fail;
+    if(!pq_iheap_init(&iheap, n))
+        goto fail;
+    iheap_inited = true;
+
+    for(int i = 0; i < n; i++)
+        prios[i] = rand_next() % (n * GRID_MAX_COST);
+
+    uint32_t out, out_prio;
+    uint64_t sum = 0;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++)
+        pq_heap_push(&heap, prios[i], i);
+    while(pq_heap_pop(&heap, &out))
+        sum += out;
+    record("pqueue push+pop", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++)
+        pq_iheap_push(&iheap, prios[i], i);
+    while(pq_iheap_pop(&iheap, &out))
+        sum += out;
+    record("indexed push+pop", n, elapsed_ms(start));
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < n; i++)
+        bq_radix_push(&radix, prios[i], i);
+    while(bq_radix_pop(&radix, &out, &out_prio))
+        sum += out;
+    record("bucket push+pop", n, elapsed_ms(start));
+    s_sink += sum;
+    goto out;
+
+fail:
+    fprintf(stderr, "%s: failed at n = %d\n", __func__, n);
+out:
+    if(iheap_inited)
+        pq_iheap_destroy(&iheap);
+    pq_heap_destroy(&heap);
+    bq_radix_destroy(&radix);
+    free(prios);
+}
+
+/* A Dijkstra expansion from the center of a square grid of random integer 
+ * costs - the access pattern of the field integration. The plain heap and 
+ * the bucket queue hold duplicate entries for improved cells, which are 
+ * skipped when popped, while the indexed heap decreases keys in place. */
+static void bench_wavefront(int n)
+{
+    int dim = 1;
+    while(dim * dim < n)
+        dim++;
+    int ncells = dim * dim;
+
+    uint8_t *costs = malloc(ncells);
+    uint32_t *dist = malloc(ncells * sizeof(uint32_t));
+    pq(heap) heap;
+    pq(iheap) iheap;
+    bq(radix) radix;
+    bool iheap_inited = false;
+
+    pq_heap_init(&heap);
+    bq_radix_init(&radix);
+    if(!costs || !dist)
+        goto fail;
+    if(!pq_iheap_init(&iheap, ncells))
+        goto fail;
+    iheap_inited = true;
+
+    for(int i = 0; i < ncells; i++)
+        costs[i] = 1 + rand_next() % GRID_MAX_COST;
+
+    const int dr[] = {-1, 1, 0, 0};
+    const int dc[] = {0, 0, -1, 1};
+    const uint32_t src = (dim / 2) * dim + (dim / 2);
+    uint64_t sum = 0;
+
+#define EXPAND(_curr, _push)                                                    \
+    do {                                                                        \
+        int r = (_curr) / dim, c = (_curr) % dim;                               \
+        for(int k = 0; k < ARR_SIZE(dr); k++) {                                 \
+            int nr = r + dr[k], nc = c + dc[k];                                 \
+            if(nr < 0 || nr >= dim || nc < 0 || nc >= dim)                      \
+                continue;                                                       \
+            uint32_t next = nr * dim + nc;                                      \
+            uint32_t nd = dist[(_curr)] + costs[next];                          \
+            if(nd >= dist[next])                                                \
+                continue;                                                       \
+            dist[next] = nd;                                                    \
+            _push;                                                              \
+        }                                                                       \
+    }while(0)
+
+    uint32_t curr, prio;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < ncells; i++)
+        dist[i] = UINT32_MAX;
+    dist[src] = 0;
+    pq_heap_push(&heap, 0, src);
+    while(pq_heap_pop(&heap, &curr)) {
+        EXPAND(curr, pq_heap_push(&heap, nd, next));
+    }
+    record("pqueue wavefront", ncells, elapsed_ms(start));
+    sum += dist[0];
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < ncells; i++)
+        dist[i] = UINT32_MAX;
+    dist[src] = 0;
+    pq_iheap_push(&iheap, 0, src);
+    while(pq_iheap_pop(&iheap, &curr)) {
+        EXPAND(curr, pq_iheap_push_or_decrease(&iheap, nd, next));
+    }
+    record("indexed wavefront", ncells, elapsed_ms(start));
+    sum += dist[0];
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < ncells; i++)
+        dist[i] = UINT32_MAX;
+    dist[src] = 0;
+    bq_radix_push(&radix, 0, src);
+    while(bq_radix_pop(&radix, &curr, &prio)) {
+        if(prio > dist[curr])
+            continue;
+        EXPAND(curr, bq_radix_push(&radix, nd, next));
+    }
+    record("bucket wavefront", ncells, elapsed_ms(start));
+    sum += dist[0];
+    s_sink += sum;
+    goto out;
+
+#undef EXPAND
+
+fail:
+    fprintf(stderr, "%s: failed at n = %d\n", __func__, n);
+out:
+    if(iheap_inited)
+        pq_iheap_destroy(&iheap);
+    pq_heap_destroy(&heap);
+    bq_radix_destroy(&radix);
+    free(costs);
+    free(dist);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-r <seed>] [-i <reps>] [-n <size>]\n", prog);
+    printf("  -r  random seed (default: 1)\n");
+    printf("  -i  repetitions of every workload, of which the best is reported (default: 5)\n");
+    printf("  -n  run only with the given number of elements (default: 1024, 4096 and 16384)\n");
+}
+
+static bool parse_opts(int argc, char **argv, struct bench_opts *out)
+{
+    *out = (struct bench_opts){
+        .seed = 1,
+        .reps = 5,
+        .size = 0,
+    };
+
+    for(int i = 1; i < argc; i++) {
+
+        bool has_arg = (i + 1 < argc);
+        if(!strcmp(argv[i], "-r") && has_arg) {
+            out->seed = strtoul(argv[++i], NULL, 10);
+        }else if(!strcmp(argv[i], "-i") && has_arg) {
+            out->reps = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-n") && has_arg) {
+            out->size = atoi(argv[++i]);
+        }else {
+            return false;
+        }
+    }
+
+    /* The pools address their entries with 16-bit handles */
+    return (out->reps > 0 && out->reps <= 1000)
+        && (out->size >= 0 && out->size <= (1 << 15))
+        && (out->seed != 0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    struct bench_opts opts;
+    if(!parse_opts(argc, argv, &opts)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const struct workload workloads[] = {
+        {"khash",                   bench_khash     },
+        {"quadtree (linear, ent)",  bench_qt_ent    },
+        {"quadtree (pointer)",      bench_qt_ptr    },
+        {"lru cache",               bench_lru       },
+        {"mpool",                   bench_mp_flat   },
+        {"mpool (chunked)",         bench_mp_chunked},
+        {"priority queues",         bench_queues    },
+        {"wavefront",               bench_wavefront },
+    };
+    const int default_sizes[] = {1024, 4096, 16384};
+    const int *sizes = opts.size ? &opts.size : default_sizes;
+    int nsizes = opts.size ? 1 : ARR_SIZE(default_sizes);
+
+    printf("seed: %u, repetitions: %d\n", opts.seed, opts.reps);
+
+    for(int i = 0; i < ARR_SIZE(workloads); i++) {
+        for(int j = 0; j < nsizes; j++) {
+
+            /* Every workload sees the same random sequence at a given size */
+            s_rng = opts.seed;
+            s_nresults = 0;
+            for(int r = 0; r < opts.reps; r++)
+                workloads[i].run(sizes[j]);
+            print_results(workloads[i].name, sizes[j]);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
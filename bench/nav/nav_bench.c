@@ -0,0 +1,649 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+/* A stand-alone benchmark of the navigation subsystem. It builds the 
+ * navigation data for a PF Map (or a generated one) and times a fixed set 
+ * of workloads on it, reporting the percentiles of the whole operations 
+ * as well as of the A*, integration, flow and LOS phases they are made 
+ * up of. All the random choices are made from a seeded generator, so runs 
+ * with the same arguments are repeatable.
+ */
+
+#define SDL_MAIN_HANDLED
+
+#include "nav_bench.h"
+#include "../../src/navigation/public/nav.h"
+#include "../../src/navigation/nav_private.h"
+#include "../../src/map/public/tile.h"
+#include "../../src/entity.h"
+#include "../../src/collision.h"
+#include "../../src/sched.h"
+#include "../../src/perf.h"
+#include "../../src/main.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX_SAMPLES         (1 << 16)
+#define TILES_PER_CHUNK     (TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT)
+#define CHUNK_X_DIM         (X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH)
+#define CHUNK_Z_DIM         (Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT)
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+#define NUM_ENEMIES         (256)
+#define NUM_SEEK_QUERIES    (2000)
+#define NUM_CHURN_TICKS     (600)
+#define NUM_CHURN_BLOCKERS  (128)
+#define NUM_CHURN_PATHS     (4)
+#define NUM_STORMS          (20)
+#define NUM_STORM_OBJECTS   (64)
+#define BLOCKER_RADIUS      (3.0f)
+
+struct samples{
+    size_t n;
+    float  ms[MAX_SAMPLES];
+};
+
+struct bench_map{
+    size_t       width, height; /* in chunks */
+    struct tile *tiles;         /* TILES_PER_CHUNK tiles per chunk, row-major */
+};
+
+struct bench_opts{
+    const char *map_path;
+    int         synth_cols, synth_rows;
+    float       density;
+    uint32_t    seed;
+    int         npaths;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char    *s_phase_names[NAV_PHASE_COUNT] = {
+    [NAV_PHASE_ASTAR]       = "astar",
+    [NAV_PHASE_INTEGRATION] = "integration",
+    [NAV_PHASE_FLOW]        = "flow",
+    [NAV_PHASE_LOS]         = "los",
+};
+
+static SDL_SpinLock   s_phase_lock;
+static struct samples s_phases[NAV_PHASE_COUNT];
+static struct samples s_ops;
+static uint32_t       s_rng;
+
+static const vec3_t   s_map_pos = {0.0f, 0.0f, 0.0f};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint32_t rand_next(void)
+{
+    /* xorshift32 - the same sequence on every platform */
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static int rand_range(int lo, int hi)
+{
+    return lo + (int)(rand_next() % (uint32_t)(hi - lo + 1));
+}
+
+static float rand_unit(void)
+{
+    return (rand_next() >> 8) / (float)(1 << 24);
+}
+
+static float elapsed_ms(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0f / SDL_GetPerformanceFrequency();
+}
+
+static void samples_push(struct samples *s, float ms)
+{
+    if(s->n < MAX_SAMPLES)
+        s->ms[s->n++] = ms;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static void phase_hook(enum nav_phase phase, float ms)
+{
+    SDL_AtomicLock(&s_phase_lock);
+    samples_push(&s_phases[phase], ms);
+    SDL_AtomicUnlock(&s_phase_lock);
+}
+
+static void print_samples(const char *name, struct samples *s)
+{
+    if(s->n == 0) {
+        printf("  %-12s %8d\n", name, 0);
+        return;
+    }
+
+    qsort(s->ms, s->n, sizeof(s->ms[0]), compare_float);
+    double sum = 0.0;
+    for(int i = 0; i < s->n; i++)
+        sum += s->ms[i];
+
+    printf("  %-12s %8zu %9.4f %9.4f %9.4f %9.4f %9.4f\n", name, s->n, 
+        sum / s->n, 
+        s->ms[(s->n - 1) * 50 / 100], 
+        s->ms[(s->n - 1) * 90 / 100], 
+        s->ms[(s->n - 1) * 99 / 100], 
+        s->ms[s->n - 1]);
+}
+
+static void workload_begin(const char *name)
+{
+    printf("\n== %s\n", name);
+    printf("  %-12s %8s %9s %9s %9s %9s %9s\n", "(ms)", "n", "mean", "p50", "p90", "p99", "max");
+
+    N_FC_ClearStats();
+    for(int i = 0; i < NAV_PHASE_COUNT; i++)
+        s_phases[i].n = 0;
+    s_ops.n = 0;
+}
+
+static void workload_end(const char *opname)
+{
+    print_samples(opname, &s_ops);
+    for(int i = 0; i < NAV_PHASE_COUNT; i++)
+        print_samples(s_phase_names[i], &s_phases[i]);
+
+    struct fc_stats stats;
+    N_FC_GetStats(&stats);
+
+    printf("  cache: los %u/%u (%.1f%% hit), flow %u/%u (%.1f%% hit), "
+        "ffid %u/%u (%.1f%% hit), grid path %u/%u (%.1f%% hit)\n",
+        stats.los_used, stats.los_max, stats.los_hit_rate * 100.0f,
+        stats.flow_used, stats.flow_max, stats.flow_hit_rate * 100.0f,
+        stats.ffid_used, stats.ffid_max, stats.ffid_hit_rate * 100.0f,
+        stats.grid_path_used, stats.grid_path_max, stats.grid_path_hit_rate * 100.0f);
+    printf("  cache: %u los and %u flow fields invalidated, %.2f ms saved by hits, "
+        "%u path requests (%.1f%% coalesced)\n",
+        stats.los_invalidated, stats.flow_invalidated,
+        stats.los_time_saved + stats.flow_time_saved + stats.grid_path_time_saved,
+        stats.path_requests, stats.path_coalesce_ratio * 100.0f);
+}
+
+static bool parse_tile(const char *str, struct tile *out)
+{
+    /* Same encoding as in map_asset_load.c */
+    if(strlen(str) != 24)
+        return false;
+
+    char type_hexstr[2] = {str[0], '\0'};
+#define A2I(_a) ((_a) - '0')
+
+    memset(out, 0, sizeof(struct tile));
+    out->type          = (enum tiletype) strtol(type_hexstr, NULL, 16);
+    out->base_height   = (int)           (str[1] == '-' ? -1 : 1) * (10  * A2I(str[2]) + A2I(str[3]));
+    out->ramp_height   = (int)           (10  * A2I(str[4]) + A2I(str[5]));
+    out->top_mat_idx   = (int)           (100 * A2I(str[6]) + 10 * A2I(str[7 ]) + A2I(str[8 ]));
+    out->sides_mat_idx = (int)           (100 * A2I(str[9]) + 10 * A2I(str[10]) + A2I(str[11]));
+    out->pathable      = (bool)          A2I(str[12]);
+    out->blend_mode    = (int)           A2I(str[13]);
+    out->blend_normals = (bool)          A2I(str[14]);
+
+#undef A2I
+    return true;
+}
+
+static bool load_pfmap(const char *path, struct bench_map *out)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return false;
+
+    char line[256];
+    float version;
+    unsigned num_materials, num_rows, num_cols;
+
+    if(!fgets(line, sizeof(line), file) || sscanf(line, "version %f", &version) != 1)
+        goto fail;
+    if(!fgets(line, sizeof(line), file) || sscanf(line, "num_materials %u", &num_materials) != 1)
+        goto fail;
+    if(!fgets(line, sizeof(line), file) || sscanf(line, "num_rows %u", &num_rows) != 1)
+        goto fail;
+    if(!fgets(line, sizeof(line), file) || sscanf(line, "num_cols %u", &num_cols) != 1)
+        goto fail;
+
+    for(int i = 0; i < num_materials; i++) {
+        if(!fgets(line, sizeof(line), file))
+            goto fail;
+    }
+
+    out->width = num_cols;
+    out->height = num_rows;
+    out->tiles = malloc(num_rows * num_cols * TILES_PER_CHUNK * sizeof(struct tile));
+    if(!out->tiles)
+        goto fail;
+
+    for(int i = 0; i < num_rows * num_cols * TILES_PER_CHUNK; i++) {
+
+        char token[32];
+        if(fscanf(file, "%31s", token) != 1 || !parse_tile(token, &out->tiles[i])) {
+            free(out->tiles);
+            goto fail;
+        }
+    }
+
+    fclose(file);
+    return true;
+
+fail:
+    fclose(file);
+    return false;
+}
+
+/* A flat map with rectangular impassable blocks scattered over it, until 
+ * the fraction 'density' of the tiles is covered. */
+static bool gen_synthetic(int cols, int rows, float density, struct bench_map *out)
+{
+    out->width = cols;
+    out->height = rows;
+    out->tiles = malloc(rows * cols * TILES_PER_CHUNK * sizeof(struct tile));
+    if(!out->tiles)
+        return false;
+
+    const size_t ntiles = rows * cols * TILES_PER_CHUNK;
+    for(int i = 0; i < ntiles; i++) {
+        out->tiles[i] = (struct tile){ .pathable = true, .type = TILETYPE_FLAT };
+    }
+
+    const int tiles_w = cols * TILES_PER_CHUNK_WIDTH;
+    const int tiles_h = rows * TILES_PER_CHUNK_HEIGHT;
+    size_t nblocked = 0;
+
+    while(nblocked < ntiles * MIN(density, 0.9f)) {
+
+        int w = rand_range(1, 6), h = rand_range(1, 6);
+        int r0 = rand_range(0, tiles_h - h), c0 = rand_range(0, tiles_w - w);
+
+        for(int r = r0; r < r0 + h; r++) {
+        for(int c = c0; c < c0 + w; c++) {
+
+            int chunk_idx = (r / TILES_PER_CHUNK_HEIGHT) * cols + (c / TILES_PER_CHUNK_WIDTH);
+            int tile_idx = (r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                         + (c % TILES_PER_CHUNK_WIDTH);
+            struct tile *tile = &out->tiles[chunk_idx * TILES_PER_CHUNK + tile_idx];
+
+            if(tile->pathable) {
+                tile->pathable = false;
+                nblocked++;
+            }
+        }}
+    }
+    return true;
+}
+
+static void *build_nav(const struct bench_map *map)
+{
+    const struct tile *chunk_tiles[map->width * map->height];
+    for(int i = 0; i < map->width * map->height; i++) {
+        chunk_tiles[i] = map->tiles + i * TILES_PER_CHUNK;
+    }
+    return N_BuildForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles);
+}
+
+static vec2_t rand_map_pos(const struct bench_map *map)
+{
+    return (vec2_t){
+        s_map_pos.x - rand_unit() * map->width * CHUNK_X_DIM,
+        s_map_pos.z + rand_unit() * map->height * CHUNK_Z_DIM
+    };
+}
+
+static bool inside_map(const struct bench_map *map, vec2_t pos)
+{
+    return (pos.x <= s_map_pos.x && pos.x >= s_map_pos.x - map->width * CHUNK_X_DIM)
+        && (pos.z >= s_map_pos.z && pos.z <= s_map_pos.z + map->height * CHUNK_Z_DIM);
+}
+
+static vec2_t rand_pathable_pos(void *nav, const struct bench_map *map)
+{
+    for(int i = 0; i < 1024; i++) {
+        vec2_t ret = rand_map_pos(map);
+        if(N_PositionPathable(ret, nav, s_map_pos))
+            return ret;
+    }
+    return rand_map_pos(map);
+}
+
+static void bench_paths(void *nav, size_t npaths, const vec2_t srcs[], const vec2_t dsts[], bool cold)
+{
+    workload_begin(cold ? "random paths (cold cache)" : "random paths (warm cache)");
+
+    if(!cold) {
+        for(int i = 0; i < npaths; i++) {
+            dest_id_t id;
+            N_RequestPath(nav, srcs[i], dsts[i], s_map_pos, &id);
+        }
+        N_FC_ClearStats();
+        for(int i = 0; i < NAV_PHASE_COUNT; i++)
+            s_phases[i].n = 0;
+    }
+
+    /* Start a new tick, so that no requests are coalesced with the ones
+     * made before */
+    N_Update(nav);
+
+    for(int i = 0; i < npaths; i++) {
+
+        if(cold)
+            N_FC_ClearAll();
+
+        dest_id_t id;
+        uint64_t start = SDL_GetPerformanceCounter();
+        N_RequestPath(nav, srcs[i], dsts[i], s_map_pos, &id);
+        samples_push(&s_ops, elapsed_ms(start));
+    }
+
+    workload_end("request");
+}
+
+static void bench_enemy_seek(void *nav, const struct bench_map *map)
+{
+    workload_begin("enemy seek fields");
+
+    static struct entity ents[NUM_ENEMIES];
+    static vec2_t positions[NUM_ENEMIES];
+
+    for(int i = 0; i < NUM_ENEMIES; i++) {
+        ents[i] = (struct entity){
+            .uid = i,
+            .flags = ENTITY_FLAG_COMBATABLE,
+            .selection_radius = BLOCKER_RADIUS,
+            .faction_id = 1,
+        };
+        positions[i] = rand_pathable_pos(nav, map);
+    }
+    Bench_SetEntities(ents, positions, NUM_ENEMIES);
+    N_Update(nav);
+
+    for(int i = 0; i < NUM_SEEK_QUERIES; i++) {
+
+        vec2_t pos = rand_pathable_pos(nav, map);
+        uint64_t start = SDL_GetPerformanceCounter();
+        N_DesiredEnemySeekVelocity(pos, nav, s_map_pos, 0);
+        samples_push(&s_ops, elapsed_ms(start));
+    }
+
+    Bench_SetEntities(NULL, NULL, 0);
+    workload_end("query");
+}
+
+static void bench_blocker_churn(void *nav, const struct bench_map *map)
+{
+    workload_begin("blocker churn");
+
+    vec2_t blockers[NUM_CHURN_BLOCKERS];
+    vec2_t srcs[NUM_CHURN_PATHS], dsts[NUM_CHURN_PATHS];
+
+    for(int i = 0; i < NUM_CHURN_BLOCKERS; i++) {
+        blockers[i] = rand_pathable_pos(nav, map);
+        N_BlockersIncref(blockers[i], BLOCKER_RADIUS, s_map_pos, nav);
+    }
+    for(int i = 0; i < NUM_CHURN_PATHS; i++) {
+        srcs[i] = rand_pathable_pos(nav, map);
+        dsts[i] = rand_pathable_pos(nav, map);
+    }
+    N_Update(nav);
+
+    for(int tick = 0; tick < NUM_CHURN_TICKS; tick++) {
+
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        /* Every tick, an eighth of the blockers take a step */
+        for(int i = tick % 8; i < NUM_CHURN_BLOCKERS; i += 8) {
+
+            vec2_t next = (vec2_t){
+                blockers[i].x + (rand_unit() - 0.5f) * 2.0f * BLOCKER_RADIUS,
+                blockers[i].z + (rand_unit() - 0.5f) * 2.0f * BLOCKER_RADIUS,
+            };
+            if(!inside_map(map, next) || !N_PositionPathable(next, nav, s_map_pos))
+                continue;
+
+            N_BlockersBatchDecref(blockers[i], BLOCKER_RADIUS, s_map_pos);
+            N_BlockersBatchIncref(next, BLOCKER_RADIUS, s_map_pos);
+            blockers[i] = next;
+        }
+        N_Update(nav);
+
+        for(int i = 0; i < NUM_CHURN_PATHS; i++) {
+            dest_id_t id;
+            N_RequestPath(nav, srcs[i], dsts[i], s_map_pos, &id);
+        }
+        samples_push(&s_ops, elapsed_ms(start));
+    }
+
+    for(int i = 0; i < NUM_CHURN_BLOCKERS; i++) {
+        N_BlockersDecref(blockers[i], BLOCKER_RADIUS, s_map_pos, nav);
+    }
+    N_Update(nav);
+    workload_end("tick");
+}
+
+static void bench_cutout_storms(void *nav, const struct bench_map *map)
+{
+    workload_begin("static object cutout storms");
+
+    for(int i = 0; i < NUM_STORMS; i++) {
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        for(int j = 0; j < NUM_STORM_OBJECTS; j++) {
+
+            vec2_t center = rand_map_pos(map);
+            float hx = 4.0f + rand_unit() * 8.0f;
+            float hz = 4.0f + rand_unit() * 8.0f;
+
+            /* An axis-aligned box, with the corners in the same order as 
+             * the ones returned by Entity_CurrentOBB */
+            struct obb obb = {
+                .center = (vec3_t){center.x, 0.0f, center.z},
+                .axes = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+                .half_lengths = {hx, 1.0f, hz},
+            };
+            for(int k = 0; k < 8; k++) {
+                obb.corners[k] = (vec3_t){
+                    center.x + ((k & 4) ? hx : -hx),
+                    (k & 2) ? 1.0f : -1.0f,
+                    center.z + ((k & 1) ? hz : -hz),
+                };
+            }
+            N_CutoutStaticObject(nav, s_map_pos, &obb);
+        }
+        N_UpdatePortals(nav);
+        N_UpdateIslandsField(nav);
+        N_Update(nav);
+        samples_push(&s_ops, elapsed_ms(start));
+    }
+
+    workload_end("storm");
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-s <cols>x<rows>] [-d <density>] [-r <seed>] [-n <paths>] [<map.pfmap>]\n", prog);
+    printf("  -s  size of the generated map, in chunks (default: 8x8)\n");
+    printf("  -d  fraction of the generated map's tiles which are impassable (default: 0.15)\n");
+    printf("  -r  random seed (default: 1)\n");
+    printf("  -n  number of random path requests (default: 500)\n");
+}
+
+static bool parse_opts(int argc, char **argv, struct bench_opts *out)
+{
+    *out = (struct bench_opts){
+        .map_path = NULL,
+        .synth_cols = 8,
+        .synth_rows = 8,
+        .density = 0.15f,
+        .seed = 1,
+        .npaths = 500,
+    };
+
+    for(int i = 1; i < argc; i++) {
+
+        bool has_arg = (i + 1 < argc);
+        if(!strcmp(argv[i], "-s") && has_arg) {
+            if(sscanf(argv[++i], "%dx%d", &out->synth_cols, &out->synth_rows) != 2)
+                return false;
+        }else if(!strcmp(argv[i], "-d") && has_arg) {
+            out->density = strtof(argv[++i], NULL);
+        }else if(!strcmp(argv[i], "-r") && has_arg) {
+            out->seed = strtoul(argv[++i], NULL, 10);
+        }else if(!strcmp(argv[i], "-n") && has_arg) {
+            out->npaths = atoi(argv[++i]);
+        }else if(argv[i][0] != '-' && !out->map_path) {
+            out->map_path = argv[i];
+        }else {
+            return false;
+        }
+    }
+
+    return (out->synth_cols > 0 && out->synth_cols <= 64)
+        && (out->synth_rows > 0 && out->synth_rows <= 64)
+        && (out->npaths > 0 && out->npaths <= MAX_SAMPLES)
+        && (out->seed != 0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    struct bench_opts opts;
+
+    if(!parse_opts(argc, argv, &opts)) {
+        usage(argv[0]);
+        goto fail_args;
+    }
+    s_rng = opts.seed;
+    g_main_thread_id = SDL_ThreadID();
+
+    if(!Perf_Init()) {
+        fprintf(stderr, "Failed to initialize the perf module.\n");
+        goto fail_perf;
+    }
+
+    if(!Sched_Init()) {
+        fprintf(stderr, "Failed to initialize the scheduling module.\n");
+        goto fail_sched;
+    }
+
+    if(!N_Init()) {
+        fprintf(stderr, "Failed to initialize the navigation module.\n");
+        goto fail_nav;
+    }
+
+    struct bench_map map;
+    bool loaded = opts.map_path ? load_pfmap(opts.map_path, &map)
+                                : gen_synthetic(opts.synth_cols, opts.synth_rows, opts.density, &map);
+    if(!loaded) {
+        fprintf(stderr, "Failed to load the map.\n");
+        goto fail_map;
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    void *nav = build_nav(&map);
+    if(!nav) {
+        fprintf(stderr, "Failed to build the navigation data.\n");
+        goto fail_build;
+    }
+
+    printf("map: %s (%zux%zu chunks), seed: %u, workers: %zu\n", 
+        opts.map_path ? opts.map_path : "generated", map.width, map.height, 
+        opts.seed, Sched_NumWorkers());
+    printf("navigation data built in %.2f ms\n", elapsed_ms(start));
+
+    vec2_t *srcs = malloc(opts.npaths * sizeof(vec2_t));
+    vec2_t *dsts = malloc(opts.npaths * sizeof(vec2_t));
+    if(!srcs || !dsts) {
+        fprintf(stderr, "Failed to allocate the path endpoints.\n");
+        goto fail_endpoints;
+    }
+
+    for(int i = 0; i < opts.npaths; i++) {
+        srcs[i] = rand_pathable_pos(nav, &map);
+        dsts[i] = rand_pathable_pos(nav, &map);
+    }
+
+    N_SetPhaseHook(phase_hook);
+    bench_paths(nav, opts.npaths, srcs, dsts, true);
+    bench_paths(nav, opts.npaths, srcs, dsts, false);
+    bench_enemy_seek(nav, &map);
+    bench_blocker_churn(nav, &map);
+    /* Last, as it leaves the map covered with obstacles */
+    bench_cutout_storms(nav, &map);
+    N_SetPhaseHook(NULL);
+
+    ret = EXIT_SUCCESS;
+fail_endpoints:
+    free(srcs);
+    free(dsts);
+    N_FreePrivate(nav);
+fail_build:
+    free(map.tiles);
+fail_map:
+    N_Shutdown();
+fail_nav:
+    Sched_Shutdown();
+fail_sched:
+    Perf_Shutdown();
+fail_perf:
+fail_args:
+    exit(ret);
+}
+
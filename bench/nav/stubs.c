@@ -0,0 +1,213 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+/* The navigation code calls into the game simulation for the entity 
+ * positions and the diplomacy states, and into the renderer for debug 
+ * drawing and for generating flow fields on the GPU. The benchmark is linked without either of them, and these 
+ * stand-ins are used in their place.
+ */
+
+#include "nav_bench.h"
+#include "../../src/game/public/game.h"
+#include "../../src/render/public/render.h"
+#include "../../src/render/public/render_ctrl.h"
+#include "../../src/main.h"
+
+#include <assert.h>
+#include <float.h>
+
+
+/*****************************************************************************/
+/* GLOBAL VARIABLES                                                          */
+/*****************************************************************************/
+
+SDL_threadID          g_main_thread_id;
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct entity *s_ents;
+static const vec2_t  *s_positions;
+static size_t         s_nents;
+static vec_pentity_t  s_active;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool in_rect(vec2_t pos, vec2_t xz_min, vec2_t xz_max)
+{
+    return (pos.x >= xz_min.x && pos.x <= xz_max.x)
+        && (pos.z >= xz_min.z && pos.z <= xz_max.z);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void Bench_SetEntities(struct entity *ents, const vec2_t *positions, size_t nents)
+{
+    s_ents = ents;
+    s_positions = positions;
+    s_nents = nents;
+
+    /* The navigation code walks the active entities to find out which 
+     * factions are present in each chunk */
+    vec_pentity_reset(&s_active);
+    for(int i = 0; i < nents; i++) {
+        if(!vec_pentity_push(&s_active, &ents[i]))
+            break;
+    }
+
+    if(nents == 0) {
+        vec_pentity_destroy(&s_active);
+        vec_pentity_init(&s_active);
+    }
+}
+
+void *R_PushArg(const void *src, size_t size)
+{
+    return NULL;
+}
+
+void R_PushCmd(struct rcmd cmd)
+{
+}
+
+void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, const size_t *count, 
+                              mat4x4_t *model, const struct map *map)
+{
+}
+
+void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_t *count,
+                        mat4x4_t *model, const struct map *map)
+{
+}
+
+/* The benchmark measures the CPU path, so the fields are never batched 
+ * for the GPU */
+bool R_NavFieldGPUSupported(void)
+{
+    return false;
+}
+
+struct nav_gpu_batch *R_NavFieldBatchAlloc(size_t nfields, int res)
+{
+    return NULL;
+}
+
+void R_NavFieldBatchFree(struct nav_gpu_batch *batch)
+{
+}
+
+enum nav_gpu_state R_NavFieldBatchPoll(struct nav_gpu_batch *batch)
+{
+    return NAV_GPU_FAILED;
+}
+
+void R_NavFieldBatchAbandon(struct nav_gpu_batch *batch)
+{
+}
+
+void R_GL_NavFieldDispatch(struct nav_gpu_batch *batch)
+{
+}
+
+const struct map *G_GetPrevTickMap(void)
+{
+    return NULL;
+}
+
+bool G_GetDiplomacyState(int fac_id_a, int fac_id_b, enum diplomacy_state *out)
+{
+    *out = (fac_id_a == fac_id_b) ? DIPLOMACY_STATE_PEACE : DIPLOMACY_STATE_WAR;
+    return true;
+}
+
+const vec_pentity_t *G_GetActiveEntities(void)
+{
+    return &s_active;
+}
+
+vec2_t G_Pos_GetXZ(uint32_t uid)
+{
+    assert(uid < s_nents);
+    return s_positions[uid];
+}
+
+int G_Pos_EntsInRectWithPred(vec2_t xz_min, vec2_t xz_max, struct entity **out, size_t maxout,
+                             bool (*predicate)(const struct entity *ent, void *arg), void *arg)
+{
+    int ret = 0;
+    for(int i = 0; i < s_nents && ret < maxout; i++) {
+
+        if(!in_rect(s_positions[i], xz_min, xz_max))
+            continue;
+        if(predicate && !predicate(&s_ents[i], arg))
+            continue;
+        out[ret++] = &s_ents[i];
+    }
+    return ret;
+}
+
+int G_Pos_EntsInRect(vec2_t xz_min, vec2_t xz_max, struct entity **out, size_t maxout)
+{
+    return G_Pos_EntsInRectWithPred(xz_min, xz_max, out, maxout, NULL, NULL);
+}
+
+struct entity *G_Pos_NearestWithPred(vec2_t xz_point, 
+                                     bool (*predicate)(const struct entity *ent, void *arg), void *arg)
+{
+    struct entity *ret = NULL;
+    float best = FLT_MAX;
+
+    for(int i = 0; i < s_nents; i++) {
+
+        if(predicate && !predicate(&s_ents[i], arg))
+            continue;
+
+        vec2_t delta;
+        PFM_Vec2_Sub((vec2_t*)&s_positions[i], &xz_point, &delta);
+        float len = PFM_Vec2_Len(&delta);
+        if(len < best) {
+            best = len;
+            ret = &s_ents[i];
+        }
+    }
+    return ret;
+}
+
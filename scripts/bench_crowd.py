@@ -0,0 +1,310 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018-2020 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+# Crowd movement benchmark. Sweeps over army sizes, formations and types of 
+# engagement, and writes the time spent in the movement, ClearPath, combat 
+# and navigation updates, as well as the frame time, for every tick to a 
+# CSV file. Meant to be run in headless mode, where every frame runs exactly 
+# one simulation tick, so that the results of different builds of the engine 
+# can be compared:
+#
+#     ./bin/pf ./ ./scripts/bench_crowd.py --headless
+#
+# The sweep is configured through the following environment variables:
+#
+#     PF_BENCH_SIZES        comma-separated army sizes    (256,512,1024,2048,4096)
+#     PF_BENCH_FORMATIONS   comma-separated formations    (line,block,column)
+#     PF_BENCH_ENGAGEMENTS  comma-separated engagements   (charge,assault,cross)
+#     PF_BENCH_TICKS        ticks recorded per scenario   (900)
+#     PF_BENCH_SEED         seed for the placement jitter (1)
+#     PF_BENCH_OUT          path of the CSV file          (bench_crowd.csv)
+#
+
+import pf
+import os
+import sys
+import math
+import time
+import random
+
+import rts.units.knight
+import rts.units.berzerker
+import rts.units.anim_combatable as am
+
+
+def env_list(name, default):
+    return [s.strip() for s in os.environ.get(name, default).split(",") if s.strip()]
+
+SIZES = [int(s) for s in env_list("PF_BENCH_SIZES", "256,512,1024,2048,4096")]
+FORMATIONS = env_list("PF_BENCH_FORMATIONS", "line,block,column")
+ENGAGEMENTS = env_list("PF_BENCH_ENGAGEMENTS", "charge,assault,cross")
+TICKS = int(os.environ.get("PF_BENCH_TICKS", "900"))
+SEED = int(os.environ.get("PF_BENCH_SEED", "1"))
+OUT_PATH = os.environ.get("PF_BENCH_OUT", "bench_crowd.csv")
+
+# Ticks to let the spawned units settle before the engagement is started
+SETTLE_TICKS = 10
+
+MAP_HEIGHT = 4 * pf.TILES_PER_CHUNK_HEIGHT * pf.Z_COORDS_PER_TILE
+MAP_WIDTH = 4 * pf.TILES_PER_CHUNK_WIDTH * pf.X_COORDS_PER_TILE
+
+SPACING = 7.0
+JITTER = 1.0
+GAP = 40.0
+MARGIN = 32.0
+
+DIR_RIGHT = (0.0, 1.0/math.sqrt(2.0), 0.0, 1.0/math.sqrt(2.0))
+DIR_LEFT = (0.0, -1.0/math.sqrt(2.0), 0.0, 1.0/math.sqrt(2.0))
+
+# The number of columns (along the Z axis) that an army of the given size 
+# is arranged in for each formation. The ranks extend along the X axis.
+FORMATION_COLS = {
+    "line":   lambda n: min(n, int((MAP_HEIGHT - 2*MARGIN) // SPACING)),
+    "block":  lambda n: int(math.ceil(math.sqrt(2 * n))),
+    "column": lambda n: max(16, int(math.ceil(n / 55.0))),
+}
+
+CSV_COLUMNS = [
+    "army_size", "formation", "engagement", "tick", "red_alive", "blue_alive",
+    "frame_ms", "move_ms", "clearpath_ms", "combat_ms", "nav_ms",
+    "clearpath_computed", "clearpath_skipped",
+]
+
+red_army_units = []
+blue_army_units = []
+
+def setup_scene():
+
+    pf.new_game("assets/maps", "plain.pfmap")
+
+    pf.add_faction("RED", (255, 0, 0, 255))
+    pf.add_faction("BLUE", (0, 0, 255, 255))
+
+    pf.set_diplomacy_state(0, 1, pf.DIPLOMACY_STATE_WAR)
+
+    pf.set_faction_controllable(0, False)
+    pf.set_faction_controllable(1, False)
+
+def setup_armies(size, formation, rng):
+
+    global red_army_units
+    global blue_army_units
+
+    ncols = FORMATION_COLS[formation](size)
+    nrows = int(math.ceil(size / float(ncols)))
+
+    assert (ncols / 2.0) * SPACING < MAP_HEIGHT/2 - MARGIN
+    assert nrows * SPACING + GAP/2 < MAP_WIDTH/2 - MARGIN
+
+    # (0,0) is the center of the map. The armies face each other across 
+    # the Z axis, with the front ranks separated by GAP.
+
+    for i in range(size):
+
+        r, c = i // ncols, i % ncols
+        z = (c - (ncols - 1) / 2.0) * SPACING
+
+        x = GAP/2 + r * SPACING + rng.uniform(-JITTER, JITTER)
+        zj = z + rng.uniform(-JITTER, JITTER)
+        knight = rts.units.knight.Knight("assets/models/knight", "knight.pfobj", "Knight")
+        knight.pos = (x, pf.map_height_at_point(x, zj), zj)
+        knight.rotation = DIR_RIGHT
+        knight.faction_id = 0
+        knight.selection_radius = 3.25
+        knight.activate()
+        knight.hold_position()
+        red_army_units += [knight]
+
+        x = -GAP/2 - r * SPACING + rng.uniform(-JITTER, JITTER)
+        zj = z + rng.uniform(-JITTER, JITTER)
+        berz = rts.units.berzerker.Berzerker("assets/models/berzerker", "berzerker.pfobj", "Berzerker")
+        berz.pos = (x, pf.map_height_at_point(x, zj), zj)
+        berz.rotation = DIR_LEFT
+        berz.faction_id = 1
+        berz.selection_radius = 3.00
+        berz.activate()
+        berz.hold_position()
+        blue_army_units += [berz]
+
+def teardown_armies():
+
+    global red_army_units
+    global blue_army_units
+
+    for unit in red_army_units + blue_army_units:
+        unit.deactivate()
+    red_army_units = []
+    blue_army_units = []
+
+def fixup_anim_combatable():
+
+    def __on_death(self, event):
+        self.play_anim(self.death_anim(), mode=pf.ANIM_MODE_ONCE_HIDE_ON_FINISH)
+        self.register(pf.EVENT_ANIM_CYCLE_FINISHED, 
+            am.AnimCombatable._AnimCombatable__on_death_anim_finish, self)
+
+    def __on_death_anim_finish(self, event):
+        self.unregister(pf.EVENT_ANIM_CYCLE_FINISHED, 
+            am.AnimCombatable._AnimCombatable__on_death_anim_finish)
+        try: 
+            red_army_units.remove(self)
+        except: pass
+        try:
+            blue_army_units.remove(self)
+        except: pass
+
+    am.AnimCombatable._AnimCombatable__on_death = __on_death
+    am.AnimCombatable._AnimCombatable__on_death_anim_finish = __on_death_anim_finish
+
+def start_engagement(engagement):
+
+    red_target = (-(MAP_WIDTH/2 - MARGIN), 0.0)
+    blue_target = (+(MAP_WIDTH/2 - MARGIN), 0.0)
+
+    if engagement == "charge":
+        for unit in red_army_units:
+            unit.attack(red_target)
+        for unit in blue_army_units:
+            unit.attack(blue_target)
+
+    elif engagement == "assault":
+        for unit in blue_army_units:
+            unit.attack(blue_target)
+
+    elif engagement == "cross":
+        for unit in red_army_units:
+            unit.move(red_target)
+        for unit in blue_army_units:
+            unit.move(blue_target)
+
+    else:
+        raise ValueError("Unknown engagement type: %s" % engagement)
+
+def perf_counters():
+
+    move = pf.get_move_perfstats()
+    return {
+        "move_ms":            move["tick_ms"],
+        "clearpath_ms":       move["clearpath_ms"],
+        "combat_ms":          pf.get_combat_perfstats()["tick_ms"],
+        "nav_ms":             pf.get_nav_perfstats()["update_ms"],
+        "clearpath_computed": move["clearpath_computed"],
+        "clearpath_skipped":  move["clearpath_skipped"],
+    }
+
+
+class CrowdBench(object):
+    """
+    Steps through the scenarios, driven by the start of every simulation 
+    tick. The engine's timing counters are cumulative, so the cost of a 
+    tick is the difference between two consecutive samples.
+    """
+
+    def __init__(self, outfile):
+        self.outfile = outfile
+        self.scenarios = [(size, formation, engagement) 
+            for size in SIZES for formation in FORMATIONS for engagement in ENGAGEMENTS]
+        self.scenario = None
+        self.tick = 0
+        self.prev_counters = None
+        self.prev_time = None
+        self.outfile.write(",".join(CSV_COLUMNS) + "\n")
+
+    def begin_scenario(self):
+        self.scenario = self.scenarios.pop(0)
+        size, formation, engagement = self.scenario
+        print("bench_crowd: %d units per army, %s formation, %s" % (size, formation, engagement))
+        sys.stdout.flush()
+
+        setup_armies(size, formation, random.Random(SEED))
+        self.tick = -SETTLE_TICKS
+        self.prev_counters = None
+
+    def end_scenario(self):
+        teardown_armies()
+        self.scenario = None
+        self.outfile.flush()
+
+    def record(self, frame_ms, counters):
+        size, formation, engagement = self.scenario
+        prev = self.prev_counters
+        row = [size, formation, engagement, self.tick, 
+            len(red_army_units), len(blue_army_units), "%.4f" % frame_ms]
+        row += ["%.4f" % (counters[k] - prev[k]) 
+            for k in ("move_ms", "clearpath_ms", "combat_ms", "nav_ms")]
+        row += [counters[k] - prev[k] 
+            for k in ("clearpath_computed", "clearpath_skipped")]
+        self.outfile.write(",".join(str(v) for v in row) + "\n")
+
+    def on_update_start(self, event):
+
+        now = time.time()
+        counters = perf_counters()
+
+        if self.scenario is not None:
+            if self.tick > 0:
+                self.record((now - self.prev_time) * 1000.0, counters)
+            if self.tick == 0:
+                start_engagement(self.scenario[2])
+            if self.tick == TICKS:
+                self.end_scenario()
+            else:
+                self.tick += 1
+
+        if self.scenario is None:
+            if not self.scenarios:
+                self.finish()
+                return
+            self.begin_scenario()
+
+        self.prev_counters = counters
+        self.prev_time = now
+
+    def finish(self):
+        pf.unregister_event_handler(pf.EVENT_UPDATE_START, CrowdBench.on_update_start)
+        self.outfile.close()
+        print("bench_crowd: results written to %s" % OUT_PATH)
+        pf.global_event(pf.SDL_QUIT, None)
+
+
+if not pf.is_headless():
+    print("bench_crowd: not running headless - the frame rate (and the results) "
+        "will not be reproducible")
+
+setup_scene()
+fixup_anim_combatable()
+
+bench = CrowdBench(open(OUT_PATH, "w"))
+pf.register_event_handler(pf.EVENT_UPDATE_START, CrowdBench.on_update_start, bench)
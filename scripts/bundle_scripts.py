@@ -0,0 +1,85 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2017-2020 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+# Compiles the engine scripts into a zip of bytecode files that the engine
+# imports in place of the loose sources when it finds it in the base directory
+# (see 's_sys_path_add_bundle' in src/script/script.c). The paths inside the
+# archive are relative to the scripts directory, so that 'scripts.zip/rts'
+# stands in for 'scripts/rts' and so on. 
+#
+# The bytecode must match the engine's interpreter, so this has to be run 
+# with Python 2.7:
+#     python2.7 bundle_scripts.py <output.zip> <scripts dir> <subdir>...
+
+import imp
+import marshal
+import os
+import struct
+import sys
+import time
+import zipfile
+
+def compile_file(path, arcname):
+    with open(path, "rU") as f:
+        source = f.read()
+    if not source.endswith("\n"):
+        source += "\n"
+    code = compile(source, arcname, "exec")
+    mtime = int(os.stat(path).st_mtime)
+    return imp.get_magic() + struct.pack("<I", mtime & 0xffffffff) + marshal.dumps(code)
+
+def bundle(out_path, root, subdirs):
+    tmp_path = out_path + ".tmp"
+    with zipfile.ZipFile(tmp_path, "w", zipfile.ZIP_DEFLATED) as zf:
+        for subdir in subdirs:
+            for dirpath, dirnames, filenames in os.walk(subdir):
+                dirnames.sort()
+                for name in sorted(filenames):
+                    if not name.endswith(".py"):
+                        continue
+                    path = os.path.join(dirpath, name)
+                    arcname = os.path.relpath(path, root).replace(os.sep, "/")
+                    info = zipfile.ZipInfo(arcname + "c", time.localtime(os.stat(path).st_mtime)[:6])
+                    info.compress_type = zipfile.ZIP_DEFLATED
+                    zf.writestr(info, compile_file(path, arcname))
+    os.rename(tmp_path, out_path)
+
+if __name__ == "__main__":
+    if sys.version_info[:2] != (2, 7):
+        sys.exit("The script bundle must be compiled with Python 2.7")
+    if len(sys.argv) < 4:
+        sys.exit("Usage: python2.7 %s <output.zip> <scripts dir> <subdir>..." % sys.argv[0])
+    bundle(sys.argv[1], sys.argv[2], sys.argv[3:])
+
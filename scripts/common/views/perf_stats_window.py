@@ -37,7 +37,7 @@ import pf
 class PerfStatsWindow(pf.Window):
 
     WIDTH = 600
-    HEIGHT = 440
+    HEIGHT = 470
 
     def __init__(self):
         vresx, vresy = (1920, 1080)
@@ -115,3 +115,61 @@ class PerfStatsWindow(pf.Window):
             .format(used=nav_stats["grid_path_used"], cap=nav_stats["grid_path_max"], hr=nav_stats["grid_path_hit_rate"]), \
             (0, 255, 0))
 
+        self.layout_row_dynamic(10, 1)
+        move_stats = pf.get_move_perfstats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[ClearPath] Computed: {comp:08d}   Skipped: {skip:08d}   Scratch HWM: {hwm} bytes" \
+            .format(comp=move_stats["clearpath_computed"], skip=move_stats["clearpath_skipped"], 
+            hwm=move_stats["clearpath_scratch_hwm"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Movement LOD] Reduced: {red:05d}   Flock: {blob:05d}" \
+            .format(red=move_stats["lod_reduced"], blob=move_stats["lod_blob"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(10, 1)
+        sim_stats = pf.get_sim_perfstats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Simulation] Ticks: {ticks:08d}   Last Frame: {last:d}   Overrun Frames: {over:06d}   Dropped Ticks: {drop:06d}" \
+            .format(ticks=sim_stats["ticks"], last=sim_stats["last_frame_ticks"], 
+            over=sim_stats["overrun_frames"], drop=sim_stats["dropped_ticks"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(10, 1)
+        event_stats = pf.get_event_perfstats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Event Queue] Last Tick: {last:05d}/{cap:05d}   HWM: {hwm:05d}   Filtered: {filt:08d}   Dropped: {drop:06d}" \
+            .format(last=event_stats["last_tick"], cap=event_stats["capacity"], hwm=event_stats["high_water"], 
+            filt=event_stats["filtered"], drop=event_stats["dropped"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(10, 1)
+        script_stats = pf.get_script_perfstats()
+        slowest = max(script_stats["handlers"], key=lambda h: h["total_ms"]) if script_stats["handlers"] else None
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Scripts] Last Tick: {last:.2f} ms   Deferred: {defer:06d}   Slowest: {slow} ({slowms:.1f} ms over {calls} calls)" \
+            .format(last=script_stats["last_tick_ms"], defer=script_stats["deferred"],
+            slow=slowest["name"] if slowest else "-", slowms=slowest["total_ms"] if slowest else 0.0,
+            calls=slowest["calls"] if slowest else 0), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(10, 1)
+        render_stats = pf.get_render_perfstats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Render Commands] Frame: {frame} bytes   HWM: {hwm} bytes   Blocks: {blocks:02d}" \
+            .format(frame=render_stats["frame_bytes"], hwm=render_stats["high_water_bytes"], 
+            blocks=render_stats["blocks"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(20, 1)
+        gpu_ms = render_stats["gpu_ms"]
+        self.label_colored_wrap("[GPU Time (ms)] Scene: {scene:.2f}   Depth: {depth:.2f}   Terrain: {terrain:.2f}   Water: {water:.2f}   Minimap: {minimap:.2f}   UI: {ui:.2f}   Scale: {scale:.2f}" \
+            .format(scale=render_stats["render_scale"], **gpu_ms), \
+            (0, 255, 0))
+
@@ -0,0 +1,230 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2017-2020 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+# Converts PF Object files from the text format written by the exporter into
+# the binary format that the engine loads in place of the text files when it 
+# finds them next to them (see 'struct pfobj_bin_hdr' in src/asset_load.h). 
+# The vertices get packed into the engine's GPU vertex formats here, so the 
+# packing has to be kept in step with src/render/gl_vertex.c. 
+#
+# Runs outside of Blender: 
+#     python3 pfobj_binary.py <input.pfobj> [<output.pfobj.bin>]
+
+import math
+import struct
+import sys
+
+BIN_MAGIC = b"PFOB"
+BIN_VERSION = 1
+BIN_ALIGN = 16
+MAX_ANIM_SETS = 16
+MAX_WEIGHTS = 6
+NAME_LEN = 32
+
+def f32(f):
+    return struct.unpack("<f", struct.pack("<f", f))[0]
+
+def lround(f):
+    return int(math.floor(abs(f) + 0.5)) * (1 if f >= 0.0 else -1)
+
+def clamp(f, lo, hi):
+    return max(lo, min(hi, f))
+
+def pack_half(f):
+    bits, = struct.unpack("<I", struct.pack("<f", f))
+    sign = (bits >> 16) & 0x8000
+    exp = ((bits >> 23) & 0xff) - 127 + 15
+    mant = bits & 0x7fffff
+
+    if ((bits >> 23) & 0xff) == 0xff:
+        return sign | 0x7c00 | (0x200 if mant else 0)
+    if exp >= 31:
+        return sign | 0x7c00
+    if exp < -10:
+        return sign
+
+    if exp <= 0:
+        mant |= 0x800000
+        shift = 14 - exp
+        ret = sign | (mant >> shift)
+        if mant & (1 << (shift - 1)):
+            ret += 1
+        return ret
+
+    ret = sign | (exp << 10) | (mant >> 13)
+    if mant & 0x1000:
+        ret += 1
+    return ret
+
+def pack_normal(normal):
+    ret = 0
+    for i, c in enumerate(normal):
+        c = lround(f32(clamp(c, -1.0, 1.0) * 511.0))
+        ret |= (c & 0x3ff) << (i * 10)
+    return ret
+
+def pack_unorm8(f):
+    return lround(f32(clamp(f, 0.0, 1.0) * 255.0))
+
+def pack_name(name):
+    raw = name.encode("utf-8")
+    if len(raw) >= NAME_LEN:
+        raise ValueError("Name too long: {0}".format(name))
+    return raw
+
+def floats(token, count):
+    ret = [f32(float(c)) for c in token.split("/")]
+    if len(ret) != count:
+        raise ValueError("Expected {0} components: {1}".format(count, token))
+    return ret
+
+def align(buff):
+    buff.extend(b"\0" * (-len(buff) % BIN_ALIGN))
+
+class Reader(object):
+
+    def __init__(self, path):
+        with open(path) as f:
+            self.lines = [l.split() for l in f if l.strip()]
+        self.idx = 0
+
+    def next(self, key=None):
+        line = self.lines[self.idx]
+        self.idx += 1
+        if key is not None and line[0] != key:
+            raise ValueError("Expected '{0}' on line: {1}".format(key, " ".join(line)))
+        return line
+
+    def aabb(self):
+        ret = []
+        for key in ("x_bounds", "y_bounds", "z_bounds"):
+            ret += [float(c) for c in self.next(key)[1:3]]
+        return struct.pack("<6f", *ret)
+
+def convert(in_path, out_path):
+    rd = Reader(in_path)
+
+    rd.next("version")
+    num_verts = int(rd.next("num_verts")[1])
+    num_joints = int(rd.next("num_joints")[1])
+    num_materials = int(rd.next("num_materials")[1])
+    num_as = int(rd.next("num_as")[1])
+    frame_counts = [int(c) for c in rd.next("frame_counts")[1:1 + num_as]]
+    has_collision = int(rd.next("has_collision")[1])
+
+    if num_as > MAX_ANIM_SETS or len(frame_counts) != num_as:
+        raise ValueError("Bad animation set count")
+    if not has_collision:
+        raise ValueError("Imported entities are required to have bounding boxes")
+
+    # Same layouts as 'struct static_vert' and 'struct anim_vert'
+    animated = num_as > 0
+    vert_size = 36 if animated else 24
+
+    verts = bytearray()
+    for i in range(num_verts):
+        pos = [float(c) for c in rd.next("v")[1:4]]
+        uv = [float(c) for c in rd.next("vt")[1:3]]
+        normal = [float(c) for c in rd.next("vn")[1:4]]
+        weights = [w.split("/") for w in rd.next("vw")[1:1 + MAX_WEIGHTS]]
+        mat_idx = int(rd.next("vm")[1])
+
+        vert = struct.pack("<3f2HIB", pos[0], pos[1], pos[2], 
+            pack_half(f32(uv[0])), pack_half(f32(uv[1])), pack_normal(normal), mat_idx)
+        if animated:
+            weights += [("0", "0.0")] * (MAX_WEIGHTS - len(weights))
+            vert += struct.pack("<6B", *[int(j) for j, w in weights])
+            vert += struct.pack("<6B", *[pack_unorm8(float(w)) for j, w in weights])
+        verts += vert + b"\0" * (vert_size - len(vert))
+
+    materials = bytearray()
+    for i in range(num_materials):
+        name = rd.next("material")[1]
+        if name == "__none__":
+            raise ValueError("Materials must not be null")
+        ambient = float(rd.next("ambient")[1])
+        diffuse = [float(c) for c in rd.next("diffuse")[1:4]]
+        specular = [float(c) for c in rd.next("specular")[1:4]]
+        texname = rd.next("texture")[1]
+        materials += struct.pack("<7f32s", ambient, *(diffuse + specular + [pack_name(texname)]))
+
+    joints = bytearray()
+    for i in range(num_joints):
+        line = rd.next("j")
+        bind = floats(line[3], 3) + floats(line[4], 4) + floats(line[5], 3)
+        tip = floats(line[6], 3)
+        joints += struct.pack("<32si13f", pack_name(line[2]), int(line[1]) - 1, *(bind + tip))
+
+    clips = bytearray()
+    for i in range(num_as):
+        line = rd.next("as")
+        if int(line[2]) != frame_counts[i]:
+            raise ValueError("Frame count mismatch for clip: {0}".format(line[1]))
+        clips += struct.pack("<32sI12x", pack_name(line[1]), frame_counts[i])
+
+        aabbs = bytearray()
+        for f in range(frame_counts[i]):
+            for j in range(num_joints):
+                line = rd.next()
+                key = floats(line[1], 3) + floats(line[2], 4) + floats(line[3], 3)
+                clips += struct.pack("<10f", *key)
+            aabbs += rd.aabb()
+
+        clips += aabbs
+        align(clips)
+
+    aabb = rd.aabb()
+
+    # Sections are laid out in the order of the header fields
+    hdr_size = 128
+    out = bytearray(hdr_size)
+    offsets = []
+    for section in (verts, materials, joints, clips, aabb):
+        offsets.append(len(out))
+        out += section
+        align(out)
+
+    struct.pack_into("<4s5I16I7I12x", out, 0, BIN_MAGIC, BIN_VERSION, 
+        num_verts, num_joints, num_materials, num_as, 
+        *(frame_counts + [0] * (MAX_ANIM_SETS - num_as) + [has_collision, vert_size] + offsets))
+
+    with open(out_path, "wb") as f:
+        f.write(out)
+
+if __name__ == "__main__":
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write("Usage: {0} <input.pfobj> [<output.pfobj.bin>]\n".format(sys.argv[0]))
+        sys.exit(1)
+    convert(sys.argv[1], sys.argv[2] if len(sys.argv) == 3 else sys.argv[1] + ".bin")
@@ -1215,6 +1215,21 @@ def test_pickle_exceptions():
 
     print "Exception pickling OK!"
 
+def test_pickle_compressed():
+
+    l1 = [(i, str(i), {"key" : [float(i)] * 3}) for i in range(100000)]
+    s = pf.pickle_object(l1, True)
+    l2 = pf.unpickle_object(s)
+    assert l1 == l2
+    assert len(s) < len(pf.pickle_object(l1))
+
+    i1 = 0x556789
+    s = pf.pickle_object(i1, True)
+    i2 = pf.unpickle_object(s)
+    assert i1 == i2
+
+    print "Compressed pickling OK!"
+
 try:
     test_pickle_int()
     test_pickle_long()
@@ -1269,6 +1284,7 @@ try:
     test_pickle_dictviews()
     test_pickle_iterators()
     test_pickle_exceptions()
+    test_pickle_compressed()
 except Exception as e:
     traceback.print_exc()
 finally:
@@ -0,0 +1,114 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2017-2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 430 core
+
+#define LOCAL_SIZE  (64)
+
+/* One invocation per instance slot. The instances inside the frustum are 
+ * appended to the range of the output which belongs to their mesh, and 
+ * counted in the mesh's indirect draw command. */
+layout(local_size_x = LOCAL_SIZE) in;
+
+struct instance{
+    mat4 model;
+    vec4 sphere;
+    int  mesh;
+    int  pad0;
+    int  pad1;
+    int  pad2;
+};
+
+/* Matches the 'DrawArraysIndirectCommand' layout */
+struct draw_cmd{
+    uint count;
+    uint instance_count;
+    uint first;
+    uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+    instance instances[];
+};
+
+layout(std430, binding = 1) buffer Commands {
+    draw_cmd cmds[];
+};
+
+layout(std430, binding = 2) writeonly buffer Models {
+    mat4 models[];
+};
+
+/* The planes face the inside of the frustum */
+uniform vec4      frustum_planes[6];
+uniform uint      ninstances;
+
+uniform sampler2D fog_tex;
+uniform int       fog_enabled;
+uniform vec4      fog_bounds;
+
+bool explored(vec3 pos)
+{
+    vec2 uv = clamp(vec2(
+        (fog_bounds.x - pos.x) / fog_bounds.z,
+        (pos.z - fog_bounds.y) / fog_bounds.w
+    ), 0.0, 1.0);
+
+    ivec2 size = textureSize(fog_tex, 0);
+    ivec2 texel = min(ivec2(uv * vec2(size)), size - 1);
+    return texelFetch(fog_tex, texel, 0).r > 0.0;
+}
+
+void main()
+{
+    uint idx = gl_GlobalInvocationID.x;
+    if(idx >= ninstances)
+        return;
+
+    instance inst = instances[idx];
+    if(inst.mesh < 0)
+        return;
+
+    for(int i = 0; i < 6; i++) {
+        if(dot(frustum_planes[i].xyz, inst.sphere.xyz) + frustum_planes[i].w < -inst.sphere.w)
+            return;
+    }
+
+    if(fog_enabled != 0 && !explored(inst.sphere.xyz))
+        return;
+
+    uint slot = atomicAdd(cmds[inst.mesh].instance_count, 1u);
+    models[cmds[inst.mesh].base_instance + slot] = inst.model;
+}
@@ -0,0 +1,202 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2017-2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 430 core
+
+/* 'FIELD_RES' is defined by the engine */
+
+#define LOCAL_SIZE           (256)
+#define TILES_PER_INVOCATION ((FIELD_RES * FIELD_RES) / LOCAL_SIZE)
+
+#define INF         (1.0e30)
+#define COST_MASK   (0xffu)
+#define COST_NONE   (0xffu)
+#define SEED_BIT    (0x100u)
+#define UNREACHED   (0xffu)
+
+#define FD_NONE     (0u)
+#define FD_NW       (1u)
+#define FD_N        (2u)
+#define FD_NE       (3u)
+#define FD_W        (4u)
+#define FD_E        (5u)
+#define FD_SW       (6u)
+#define FD_S        (7u)
+#define FD_SE       (8u)
+
+/* One workgroup generates one field */
+layout(local_size_x = LOCAL_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer Tiles {
+    uint tiles[];
+};
+
+layout(std430, binding = 1) writeonly buffer Dirs {
+    uint dirs[];
+};
+
+shared float s_integration[FIELD_RES * FIELD_RES];
+shared bool  s_changed;
+
+float integ_at(int r, int c)
+{
+    return s_integration[r * FIELD_RES + c];
+}
+
+bool relax(int r, int c, float weight)
+{
+    if(weight >= INF)
+        return false;
+
+    int idx = r * FIELD_RES + c;
+    float best = s_integration[idx];
+
+    if(r > 0)
+        best = min(best, s_integration[idx - FIELD_RES] + weight);
+    if(r < FIELD_RES-1)
+        best = min(best, s_integration[idx + FIELD_RES] + weight);
+    if(c > 0)
+        best = min(best, s_integration[idx - 1] + weight);
+    if(c < FIELD_RES-1)
+        best = min(best, s_integration[idx + 1] + weight);
+
+    if(best < s_integration[idx]) {
+        s_integration[idx] = best;
+        return true;
+    }
+    return false;
+}
+
+/* Mirrors 'flow_dir' in field.c, so that the same directions are picked 
+ * when several neighbours have the same cost. 
+ */
+uint flow_dir(int r, int c)
+{
+    float n = (r > 0)           ? integ_at(r-1, c) : INF;
+    float s = (r < FIELD_RES-1) ? integ_at(r+1, c) : INF;
+    float w = (c > 0)           ? integ_at(r, c-1) : INF;
+    float e = (c < FIELD_RES-1) ? integ_at(r, c+1) : INF;
+
+    /* Diagonal directions are allowed only when both the side tiles 
+     * sharing an edge with the corner tile are passable. */
+    float nw = (n < INF && w < INF) ? integ_at(r-1, c-1) : INF;
+    float ne = (n < INF && e < INF) ? integ_at(r-1, c+1) : INF;
+    float sw = (s < INF && w < INF) ? integ_at(r+1, c-1) : INF;
+    float se = (s < INF && e < INF) ? integ_at(r+1, c+1) : INF;
+
+    float min_cost = min(min(min(n, s), min(w, e)), min(min(nw, ne), min(sw, se)));
+    if(min_cost >= INF)
+        return FD_NONE;
+
+    if(r > 0 && n == min_cost)
+        return FD_N;
+    if(r < FIELD_RES-1 && s == min_cost)
+        return FD_S;
+    if(c < FIELD_RES-1 && e == min_cost)
+        return FD_E;
+    if(c > 0 && w == min_cost)
+        return FD_W;
+    if(r > 0 && c > 0 && integ_at(r-1, c-1) == min_cost)
+        return FD_NW;
+    if(r > 0 && c < FIELD_RES-1 && integ_at(r-1, c+1) == min_cost)
+        return FD_NE;
+    if(r < FIELD_RES-1 && c > 0 && integ_at(r+1, c-1) == min_cost)
+        return FD_SW;
+    if(r < FIELD_RES-1 && c < FIELD_RES-1 && integ_at(r+1, c+1) == min_cost)
+        return FD_SE;
+    return FD_NONE;
+}
+
+void main()
+{
+    uint base = gl_WorkGroupID.x * uint(FIELD_RES * FIELD_RES);
+    int first = int(gl_LocalInvocationIndex) * TILES_PER_INVOCATION;
+
+    /* Every invocation owns a run of consecutive tiles of the same row */
+    int r = first / FIELD_RES;
+    int c0 = first % FIELD_RES;
+    float weights[TILES_PER_INVOCATION];
+
+    for(int i = 0; i < TILES_PER_INVOCATION; i++) {
+
+        uint tile = tiles[base + uint(first + i)];
+        uint cost = tile & COST_MASK;
+        weights[i] = (cost == COST_NONE) ? INF : float(cost);
+        s_integration[first + i] = ((tile & SEED_BIT) != 0u) ? 0.0 : INF;
+    }
+
+    /* Relax the tiles in place until none of them can be improved. All 
+     * costs are small integers, so the sums are exact and the result is 
+     * the same as that of the wavefront on the CPU, regardless of the 
+     * order in which the tiles were updated. */
+    while(true) {
+
+        if(gl_LocalInvocationIndex == 0u)
+            s_changed = false;
+        memoryBarrierShared();
+        barrier();
+
+        bool changed = false;
+        for(int i = 0; i < TILES_PER_INVOCATION; i++)
+            changed = relax(r, c0 + i, weights[i]) || changed;
+        for(int i = TILES_PER_INVOCATION-1; i >= 0; i--)
+            changed = relax(r, c0 + i, weights[i]) || changed;
+
+        if(changed)
+            s_changed = true;
+        memoryBarrierShared();
+        barrier();
+
+        bool again = s_changed;
+        barrier();
+        if(!again)
+            break;
+    }
+
+    for(int i = 0; i < TILES_PER_INVOCATION; i++) {
+
+        float cost = s_integration[first + i];
+        uint dir;
+
+        if(cost >= INF)
+            dir = UNREACHED;
+        else if(cost == 0.0)
+            dir = FD_NONE;
+        else
+            dir = flow_dir(r, c0 + i);
+
+        dirs[base + uint(first + i)] = dir;
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out float o_depth;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+/* The level being reduced, which is the only one that can be sampled */
+uniform sampler2D texture0;
+
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
+
+void main()
+{
+    /* Every texel covers a 2x2 block of the level above. At the edges of the 
+     * levels with odd dimensions, the last row or column is sampled twice. */
+    ivec2 last = textureSize(texture0, 0) - ivec2(1);
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+
+    float d0 = texelFetch(texture0, min(base + ivec2(0, 0), last), 0).r;
+    float d1 = texelFetch(texture0, min(base + ivec2(1, 0), last), 0).r;
+    float d2 = texelFetch(texture0, min(base + ivec2(0, 1), last), 0).r;
+    float d3 = texelFetch(texture0, min(base + ivec2(1, 1), last), 0).r;
+
+    o_depth = max(max(d0, d1), max(d2, d3));
+}
+
@@ -59,7 +59,6 @@ in VertexToFrag {
          vec3  world_pos;
          vec3  normal;
     flat int   blend_mode;
-    flat ivec4 adjacent_mat_indices;
 }from_vertex;
 
 /*****************************************************************************/
@@ -72,60 +71,164 @@ layout(location = 0) out vec4 o_frag_color;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform vec3 ambient_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 uniform sampler2DArray tex_array0;
 
+/* The fog of war of the player's factions, one texel per tile. The bounds 
+ * are the X and Z of the map's corner at tile (0, 0), then the map's extent 
+ * along the negative X and the positive Z axes. */
+uniform sampler2D fog_tex;
+uniform int       fog_enabled;
+uniform vec4      fog_bounds;
+
+/* The materials blended at the corners, the edge midpoints and the centers 
+ * of the tiles, 2 texels per tile along each axis plus one. Each texel holds 
+ * 8 packed 4-bit material indices weighing 1/8 each. The bounds are as for 
+ * the fog of war. */
+uniform usampler2D splat_tex;
+uniform int        splat_enabled;
+uniform vec4       splat_bounds;
+
+/* The point lights, binned into the clusters of the camera's view frustum. 
+ * LIGHT_GRID_X/Y/Z are set by the engine when building the program. Every 
+ * light is two texels: its' position and radius, then its' color. Every 
+ * cluster holds the offset of its' first entry in 'light_indices' and its' 
+ * number of lights. 'light_grid_params' holds the scale and bias mapping 
+ * the log of the view depth to a slice, then the number of lights. */
+uniform samplerBuffer  lights;
+uniform usamplerBuffer light_grid;
+uniform usamplerBuffer light_indices;
+uniform mat4           light_grid_vp;
+uniform vec4           light_grid_params;
+
 /*****************************************************************************/
 /* PROGRAM                                                                   */
 /*****************************************************************************/
 
-vec4 texture_val(int mat_idx, vec2 uv)
+/* Sums the diffuse light of the point lights in the fragment's cluster */
+vec3 point_lights(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
 {
-    return texture(tex_array0, vec3(uv, mat_idx));
+    if(light_grid_params.z == 0.0)
+        return vec3(0.0);
+
+    vec4 clip = light_grid_vp * vec4(world_pos, 1.0);
+    if(clip.w <= 0.0)
+        return vec3(0.0);
+
+    vec2 ndc = clip.xy / clip.w;
+    if(any(greaterThan(abs(ndc), vec2(1.0))))
+        return vec3(0.0);
+
+    ivec3 cell = ivec3(
+        int((ndc.x * 0.5 + 0.5) * float(LIGHT_GRID_X)),
+        int((ndc.y * 0.5 + 0.5) * float(LIGHT_GRID_Y)),
+        int(floor(log(clip.w) * light_grid_params.x + light_grid_params.y))
+    );
+    cell = clamp(cell, ivec3(0), ivec3(LIGHT_GRID_X - 1, LIGHT_GRID_Y - 1, LIGHT_GRID_Z - 1));
+
+    int cluster = (cell.z * LIGHT_GRID_Y + cell.y) * LIGHT_GRID_X + cell.x;
+    uvec2 range = texelFetch(light_grid, cluster).rg;
+
+    vec3 ret = vec3(0.0);
+    for(uint i = 0u; i < range.y; i++) {
+
+        int idx = int(texelFetch(light_indices, int(range.x + i)).r);
+        vec4 pos_radius = texelFetch(lights, idx * 2);
+        vec3 color = texelFetch(lights, idx * 2 + 1).rgb;
+
+        vec3 to_light = pos_radius.xyz - world_pos;
+        float dist = length(to_light);
+        if(dist >= pos_radius.w)
+            continue;
+
+        float atten = 1.0 - dist / pos_radius.w;
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += color * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
 }
 
-vec4 mixed_texture_val(int adjacency_mats, vec2 uv)
+float fog_factor(vec3 world_pos)
 {
-    vec4 ret = vec4(0.0f);
-    for(int i = 0; i < 8; i++) {
-        int idx = (adjacency_mats >> (i * 4)) & 0xf;
-        ret += texture_val(idx, uv) * (1.0/8.0);
-    }
-    return ret;
+    if(fog_enabled == 0)
+        return 1.0;
+
+    vec2 uv = vec2(
+        (fog_bounds.x - world_pos.x) / fog_bounds.z,
+        (world_pos.z - fog_bounds.y) / fog_bounds.w
+    );
+    return texture(fog_tex, uv).r;
 }
 
-vec4 bilinear_interp_vec4
-(
-    vec4 q11, vec4 q12, vec4 q21, vec4 q22, 
-    float x1, float x2, 
-    float y1, float y2, 
-    float x, float y
-)
+vec4 texture_val(int mat_idx, vec2 uv)
 {
-    float x2x1, y2y1, x2x, y2y, yy1, xx1;
-
-    x2x1 = x2 - x1;
-    y2y1 = y2 - y1;
-    x2x = x2 - x;
-    y2y = y2 - y;
-    yy1 = y - y1;
-    xx1 = x - x1;
-
-    return 1.0 / (x2x1 * y2y1) * (
-        q11 * x2x * y2y +
-        q21 * xx1 * y2y +
-        q12 * x2x * yy1 +
-        q22 * xx1 * yy1
+    return texture(tex_array0, vec3(uv, mat_idx));
+}
+
+/* The textures of up to 16 materials are mixed by their weights at the 
+ * fragment, which are interpolated from the 4 closest reference points. 
+ * Only the materials with a non-zero weight are sampled, so most fragments 
+ * take a single texture lookup. The gradients are those of the 'uv' in 
+ * uniform control flow. */
+vec4 splat_texture_val(vec3 world_pos, vec2 uv, vec2 uv_dx, vec2 uv_dy)
+{
+    ivec2 size = textureSize(splat_tex, 0);
+    vec2 grid = vec2(
+        (splat_bounds.x - world_pos.x) / splat_bounds.z,
+        (world_pos.z - splat_bounds.y) / splat_bounds.w
+    ) * vec2(size - 1);
+
+    ivec2 base = clamp(ivec2(floor(grid)), ivec2(0), size - 2);
+    vec2 frac = clamp(grid - vec2(base), 0.0, 1.0);
+
+    uint mats[4] = uint[4](
+        texelFetch(splat_tex, base + ivec2(0, 0), 0).r,
+        texelFetch(splat_tex, base + ivec2(1, 0), 0).r,
+        texelFetch(splat_tex, base + ivec2(0, 1), 0).r,
+        texelFetch(splat_tex, base + ivec2(1, 1), 0).r
+    );
+    float corner_weights[4] = float[4](
+        (1.0 - frac.x) * (1.0 - frac.y),
+        frac.x * (1.0 - frac.y),
+        (1.0 - frac.x) * frac.y,
+        frac.x * frac.y
     );
+
+    float weights[16];
+    for(int i = 0; i < 16; i++)
+        weights[i] = 0.0;
+
+    for(int i = 0; i < 4; i++) {
+        for(int j = 0; j < 8; j++) {
+            uint idx = (mats[i] >> uint(j * 4)) & 0xfu;
+            weights[idx] += corner_weights[i] * (1.0/8.0);
+        }
+    }
+
+    vec4 ret = vec4(0.0);
+    for(int i = 0; i < 16; i++) {
+        if(weights[i] > 0.0)
+            ret += textureGrad(tex_array0, vec3(uv, i), uv_dx, uv_dy) * weights[i];
+    }
+    return ret;
 }
 
 void main()
 {
     vec4 tex_color;
+    vec2 uv_dx = dFdx(from_vertex.uv);
+    vec2 uv_dy = dFdy(from_vertex.uv);
 
     switch(from_vertex.blend_mode) {
     case BLEND_MODE_NOBLEND: 
@@ -135,129 +238,25 @@ void main()
 
         /* 
          * This shader will blend this tile's texture(s) with adjacent tiles' textures 
-         * based on adjacency information of neighboring tiles' materials.
-         *
-         * Our top tile faces are made up of 4 triangles in the following configuration:
-         * (Note that the 4 "major" triangles may be further subdivided. In that case, the 
-         * triangles it is subdivided to must inherit the flat adjacency attributes. The
-         * other attributes will be interpolated. This is a detail not discussed further on.)
-         *
-         *  +----+----+
-         *  | \ top / |
-         *  |  \   /  |
-         *  + l -+- r +
-         *  |  /   \  |
-         *  | / bot \ |
-         *  +----+----+
-         *
-         * Each of the 4 triangles has a vertex at the center of the tile. The 'adjacent_mat_indices'
-         * is a 'flat' attribute, so it will be the same for all fragments of a triangle.
-         *
-         * The UV coordinates for a tile go from (0.0, 1.0) to (1.0, 1.0) in the diagonal corner so
-         * we are able to determine which of the 4 triangles this fragment is in by checking 
-         * the interpolated UV coordinate.
+         * based on the materials of the neighboring tiles.
          *
          * For a single tile, there are 9 reference points on the face of the tile: The 4 corners
-         * of the tile, the midpoints of the 4 edges, and the center point.
+         * of the tile, the midpoints of the 4 edges, and the center point. The materials at 
+         * each of them are held by one texel of the splat texture, which is shared with the 
+         * adjacent tiles touching the point. The 4 reference points around the fragment are
+         * interpolated bilinearly, based on its' world position.
          *
          *  +---+---+
          *  | 1 | 2 |
          *  +---+---+
          *  | 4 | 3 |
          *  +---+---+ 
-         *
-         * Based on which quadrant we're in (which can be determined from UV), we will select the closest 
-         * 4 points and use bilinear interpolation to select the texture color for this fragment using 
-         * the UV coordinate.
-         *
-         * The first two elements of 'adjacent_mat_indices' hold the adjacency information for the 
-         * two non-center vertices for this triangle. Each element has 8 4-bit indices packed into the 
-         * least significant 32 bits, resulting in 8 indices for each of the two vertices. Each index
-         * is the material of one of the 8 triangles touching the vertex.
-         *
-         * The next element of 'adjacent_mat_indices' holds the materials for the centers of the 
-         * edges of the tile, with 2 4-bit indices for each edge.
-         * 
-         * The last element of 'adjacent_mat_indices' holds the 2 materials at the central point of 
-         * the tile in the lowest 8 bits. Usually the 2 indices are the same except for some corner tiles
-         * where half of the tile uses a different material.
-         *
          */
-
-        bool bot   = (from_vertex.uv.x > from_vertex.uv.y) && (1.0 - from_vertex.uv.x > from_vertex.uv.y);
-        bool top   = (from_vertex.uv.x < from_vertex.uv.y) && (1.0 - from_vertex.uv.x < from_vertex.uv.y);
-        bool left  = (from_vertex.uv.x < from_vertex.uv.y) && (1.0 - from_vertex.uv.x > from_vertex.uv.y);
-        bool right = (from_vertex.uv.x > from_vertex.uv.y) && (1.0 - from_vertex.uv.x < from_vertex.uv.y);
-
-        bool left_half = from_vertex.uv.x < 0.5f;
-        bool bot_half = from_vertex.uv.y < 0.5f;
-
-        /***********************************************************************
-         * Set the fragment texture color
-         **********************************************************************/
-        vec4 color1 = mixed_texture_val(from_vertex.adjacent_mat_indices[0], from_vertex.uv);
-        vec4 color2 = mixed_texture_val(from_vertex.adjacent_mat_indices[1], from_vertex.uv);
-
-        vec4 tile_color = mix(
-            texture_val((from_vertex.adjacent_mat_indices[3] >> 0) & 0xf, from_vertex.uv), 
-            texture_val((from_vertex.adjacent_mat_indices[3] >> 4) & 0xf, from_vertex.uv), 
-            0.5f
-        );
-        vec4 left_center_color =  mix(
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 0) & 0xf, from_vertex.uv), 
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 4) & 0xf, from_vertex.uv), 
-            0.5f
-        );
-        vec4 bot_center_color = mix(
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 8) & 0xf, from_vertex.uv),
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 12) & 0xf, from_vertex.uv),
-            0.5f
-        );
-        vec4 right_center_color = mix(
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 16) & 0xf, from_vertex.uv), 
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 20) & 0xf, from_vertex.uv), 
-            0.5f
-        );
-        vec4 top_center_color = mix(
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 24) & 0xf, from_vertex.uv), 
-            texture_val((from_vertex.adjacent_mat_indices[2] >> 28) & 0xf, from_vertex.uv), 
-            0.5f
-        );
-
-        if(top){
-
-            if(left_half)
-                tex_color = bilinear_interp_vec4(left_center_color, color1, tile_color, top_center_color,
-                    0.0f, 0.5f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);        
-            else
-                tex_color = bilinear_interp_vec4(tile_color, top_center_color, right_center_color, color2,
-                    0.5f, 1.0f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
-        }else if(bot){
-
-            if(left_half)
-                tex_color = bilinear_interp_vec4(color1, left_center_color, bot_center_color, tile_color,
-                    0.0f, 0.5f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
-            else
-                tex_color = bilinear_interp_vec4(bot_center_color, tile_color, color2, right_center_color,
-                    0.5f, 1.0f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);
-        }else if(left){
-
-            if(bot_half)
-                tex_color = bilinear_interp_vec4(color1, left_center_color, bot_center_color, tile_color,
-                    0.0f, 0.5f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
-            else
-                tex_color = bilinear_interp_vec4(left_center_color, color2, tile_color, top_center_color,
-                    0.0f, 0.5f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
-        }else if(right){
-
-            if(bot_half)
-                tex_color = bilinear_interp_vec4(bot_center_color, tile_color, color1, right_center_color,
-                    0.5f, 1.0f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
-            else
-                tex_color = bilinear_interp_vec4(tile_color, top_center_color, right_center_color, color2,
-                    0.5f, 1.0f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
+        if(splat_enabled == 0) {
+            tex_color = texture_val(from_vertex.mat_idx, from_vertex.uv);
+            break;
         }
-
+        tex_color = splat_texture_val(from_vertex.world_pos, from_vertex.uv, uv_dx, uv_dy);
         break;
     default:
         tex_color = vec4(1.0, 0.0, 1.0, 1.0);
@@ -286,6 +285,9 @@ void main()
     float spec = pow(max(dot(view_dir, reflect_dir), 0.0), SPECULAR_SHININESS);
     vec3 specular = SPECULAR_STRENGTH * light_color * (spec * TERRAIN_SPECULAR);
 
-    o_frag_color = vec4( (ambient + diffuse) * tex_color.xyz, 1.0);
+    vec3 points = point_lights(from_vertex.world_pos, from_vertex.normal, TERRAIN_DIFFUSE);
+
+    float fog = fog_factor(from_vertex.world_pos);
+    o_frag_color = vec4( (ambient + diffuse + points) * tex_color.xyz * fog, 1.0);
 }
 
@@ -53,7 +53,6 @@ in VertexToFrag {
     flat int  mat_idx;
          vec3 world_pos;
          vec3 normal;
-         vec4 light_space_pos;
 }from_vertex;
 
 /*****************************************************************************/
@@ -66,12 +65,23 @@ out vec4 o_frag_color;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform vec3 ambient_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+    /* SHADOW_CASCADES is set by the engine when building the program */
+    mat4 cascade_transforms[SHADOW_CASCADES];
+    vec4 cascade_splits;
+};
 
-uniform sampler2D shadow_map;
+/* One layer per cascade */
+uniform sampler2DArray shadow_map;
 
 uniform sampler2D texture0;
 uniform sampler2D texture1;
@@ -90,22 +100,99 @@ uniform sampler2D texture13;
 uniform sampler2D texture14;
 uniform sampler2D texture15;
 
+/* Used instead of the above when the material's 'atlas_layer' is not -1 */
+uniform sampler2DArray material_atlas;
+
 struct material{
     float ambient_intensity;
+    int   atlas_layer;
     vec3  diffuse_clr;
     vec3  specular_clr;
 };
 
-uniform material materials[MAX_MATERIALS];
+/* Owned by the mesh being drawn. The std140 layout must match 
+ * 'struct gl_material_std140' in gl_render.c */
+layout (std140) uniform materials_block {
+    material materials[MAX_MATERIALS];
+};
+
+/* The point lights, binned into the clusters of the camera's view frustum. 
+ * LIGHT_GRID_X/Y/Z are set by the engine when building the program. Every 
+ * light is two texels: its' position and radius, then its' color. Every 
+ * cluster holds the offset of its' first entry in 'light_indices' and its' 
+ * number of lights. 'light_grid_params' holds the scale and bias mapping 
+ * the log of the view depth to a slice, then the number of lights. */
+uniform samplerBuffer  lights;
+uniform usamplerBuffer light_grid;
+uniform usamplerBuffer light_indices;
+uniform mat4           light_grid_vp;
+uniform vec4           light_grid_params;
 
 /*****************************************************************************/
 /* PROGRAM                                                                   */
 /*****************************************************************************/
 
-float shadow_factor(vec4 light_space_pos)
+/* Sums the diffuse light of the point lights in the fragment's cluster */
+vec3 point_lights(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
+{
+    if(light_grid_params.z == 0.0)
+        return vec3(0.0);
+
+    vec4 clip = light_grid_vp * vec4(world_pos, 1.0);
+    if(clip.w <= 0.0)
+        return vec3(0.0);
+
+    vec2 ndc = clip.xy / clip.w;
+    if(any(greaterThan(abs(ndc), vec2(1.0))))
+        return vec3(0.0);
+
+    ivec3 cell = ivec3(
+        int((ndc.x * 0.5 + 0.5) * float(LIGHT_GRID_X)),
+        int((ndc.y * 0.5 + 0.5) * float(LIGHT_GRID_Y)),
+        int(floor(log(clip.w) * light_grid_params.x + light_grid_params.y))
+    );
+    cell = clamp(cell, ivec3(0), ivec3(LIGHT_GRID_X - 1, LIGHT_GRID_Y - 1, LIGHT_GRID_Z - 1));
+
+    int cluster = (cell.z * LIGHT_GRID_Y + cell.y) * LIGHT_GRID_X + cell.x;
+    uvec2 range = texelFetch(light_grid, cluster).rg;
+
+    vec3 ret = vec3(0.0);
+    for(uint i = 0u; i < range.y; i++) {
+
+        int idx = int(texelFetch(light_indices, int(range.x + i)).r);
+        vec4 pos_radius = texelFetch(lights, idx * 2);
+        vec3 color = texelFetch(lights, idx * 2 + 1).rgb;
+
+        vec3 to_light = pos_radius.xyz - world_pos;
+        float dist = length(to_light);
+        if(dist >= pos_radius.w)
+            continue;
+
+        float atten = 1.0 - dist / pos_radius.w;
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += color * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
+}
+
+/* Pick the cascade whose slice of the view frustum contains the fragment, 
+ * and project the fragment into it. */
+int shadow_cascade(vec3 world_pos, out vec4 light_space_pos)
+{
+    float depth = -(view * vec4(world_pos, 1.0)).z;
+    int ret = SHADOW_CASCADES - 1;
+    for(int i = SHADOW_CASCADES - 2; i >= 0; i--) {
+        if(depth < cascade_splits[i])
+            ret = i;
+    }
+    light_space_pos = cascade_transforms[ret] * vec4(world_pos, 1.0);
+    return ret;
+}
+
+float shadow_factor(vec4 light_space_pos, int cascade)
 {
     vec3 proj_coords = (light_space_pos.xyz / light_space_pos.w) * 0.5 + 0.5;
-    float closest_depth = texture(shadow_map, proj_coords.xy).r;
+    float closest_depth = texture(shadow_map, vec3(proj_coords.xy, cascade)).r;
     float current_depth = proj_coords.z;
     if(current_depth - SHADOW_MAP_BIAS > closest_depth) {
         return 1.0;
@@ -117,24 +204,29 @@ float shadow_factor(vec4 light_space_pos)
 void main()
 {
     vec4 tex_color;
+    int layer = materials[from_vertex.mat_idx].atlas_layer;
 
-    switch(from_vertex.mat_idx) {
-    case 0:  tex_color = texture(texture0,  from_vertex.uv); break;
-    case 1:  tex_color = texture(texture1,  from_vertex.uv); break;
-    case 2:  tex_color = texture(texture2,  from_vertex.uv); break;
-    case 3:  tex_color = texture(texture3,  from_vertex.uv); break;
-    case 4:  tex_color = texture(texture4,  from_vertex.uv); break;
-    case 5:  tex_color = texture(texture5,  from_vertex.uv); break;
-    case 6:  tex_color = texture(texture6,  from_vertex.uv); break;
-    case 7:  tex_color = texture(texture7,  from_vertex.uv); break;
-    case 8:  tex_color = texture(texture8,  from_vertex.uv); break;
-    case 9:  tex_color = texture(texture9,  from_vertex.uv); break;
-    case 10: tex_color = texture(texture10, from_vertex.uv); break;
-    case 11: tex_color = texture(texture11, from_vertex.uv); break;
-    case 12: tex_color = texture(texture12, from_vertex.uv); break;
-    case 13: tex_color = texture(texture13, from_vertex.uv); break;
-    case 14: tex_color = texture(texture14, from_vertex.uv); break;
-    case 15: tex_color = texture(texture15, from_vertex.uv); break;
+    if(layer >= 0) {
+        tex_color = texture(material_atlas, vec3(from_vertex.uv, float(layer)));
+    }else{
+        switch(from_vertex.mat_idx) {
+        case 0:  tex_color = texture(texture0,  from_vertex.uv); break;
+        case 1:  tex_color = texture(texture1,  from_vertex.uv); break;
+        case 2:  tex_color = texture(texture2,  from_vertex.uv); break;
+        case 3:  tex_color = texture(texture3,  from_vertex.uv); break;
+        case 4:  tex_color = texture(texture4,  from_vertex.uv); break;
+        case 5:  tex_color = texture(texture5,  from_vertex.uv); break;
+        case 6:  tex_color = texture(texture6,  from_vertex.uv); break;
+        case 7:  tex_color = texture(texture7,  from_vertex.uv); break;
+        case 8:  tex_color = texture(texture8,  from_vertex.uv); break;
+        case 9:  tex_color = texture(texture9,  from_vertex.uv); break;
+        case 10: tex_color = texture(texture10, from_vertex.uv); break;
+        case 11: tex_color = texture(texture11, from_vertex.uv); break;
+        case 12: tex_color = texture(texture12, from_vertex.uv); break;
+        case 13: tex_color = texture(texture13, from_vertex.uv); break;
+        case 14: tex_color = texture(texture14, from_vertex.uv); break;
+        case 15: tex_color = texture(texture15, from_vertex.uv); break;
+        }
     }
 
     /* Simple alpha test to reject transparent pixels */
@@ -156,11 +248,18 @@ void main()
     vec3 specular = SPECULAR_STRENGTH * light_color * (spec * materials[from_vertex.mat_idx].specular_clr);
 
     vec4 final_color = vec4( (ambient + diffuse + specular) * tex_color.xyz, 1.0);
-    float shadow = shadow_factor(from_vertex.light_space_pos);
+    vec4 light_space_pos;
+    int cascade = shadow_cascade(from_vertex.world_pos, light_space_pos);
+    float shadow = shadow_factor(light_space_pos, cascade);
     if(shadow > 0.0) {
         o_frag_color = vec4(final_color.xyz * SHADOW_MULTIPLIER, 1.0);
     }else{
         o_frag_color = final_color;
     }
+
+    /* The point lights don't cast shadows */
+    vec3 points = point_lights(from_vertex.world_pos, from_vertex.normal, 
+        materials[from_vertex.mat_idx].diffuse_clr);
+    o_frag_color.xyz += points * tex_color.xyz;
 }
 
@@ -56,10 +56,17 @@ out vec4 o_frag_color;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform vec3 ambient_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 uniform sampler2D texture0;
 uniform sampler2D texture1;
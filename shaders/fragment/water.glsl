@@ -74,7 +74,17 @@ uniform float water_move_factor;
 uniform float cam_near;
 uniform float cam_far;
 
-uniform vec3 light_color;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 /*****************************************************************************/
 /* PROGRAM                                                                   */
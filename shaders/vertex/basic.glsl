@@ -38,8 +38,17 @@
 layout (location = 0) in vec3 in_pos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 void main()
 {
@@ -37,7 +37,13 @@
 
 layout (location = 0) in vec3 in_pos;
 
+#ifdef INSTANCED
+/* Per-instance model matrix, occupying locations 8-11 */
+layout (location = 8) in mat4 in_model;
+#define model in_model
+#else
 uniform mat4 model;
+#endif
 uniform mat4 light_space_transform;
 uniform vec4 clip_plane0;
 
@@ -66,19 +66,79 @@ out VertexToGeo {
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
+#ifdef INSTANCED
+/* Per-instance model and normal matrices, occupying locations 8-15 */
+layout (location = 8)  in mat4 in_model;
+layout (location = 12) in mat4 in_normal_mat;
+#define model           in_model
+#define anim_normal_mat in_normal_mat
+
+/* The skinning matrices (pose * inverse bind pose), 4 texels per matrix. 
+ * When 'anim_baked' is set, these are the baked palettes of all the frames 
+ * of the model. 'anim_offsets' then holds, for each instance, the index of 
+ * the first matrix of the current and next frame's palettes and the weight 
+ * of the next one (as float bits). Otherwise, the palettes of the instances 
+ * follow one another, 'anim_njoints' matrices each. */
+uniform samplerBuffer  anim_palette;
+uniform isamplerBuffer anim_offsets;
+uniform int            anim_baked;
+uniform int            anim_njoints;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
 
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+#ifndef INSTANCED
 uniform mat4 anim_curr_pose_mats[MAX_JOINTS];
 uniform mat4 anim_inv_bind_mats [MAX_JOINTS];
 uniform mat4 anim_normal_mat;
-uniform vec4 clip_plane0;
+#endif
 
 /*****************************************************************************/
 /* PROGRAM
 /*****************************************************************************/
 
+#ifdef INSTANCED
+mat4 palette_mat(int base)
+{
+    return mat4(
+        texelFetch(anim_palette, base + 0),
+        texelFetch(anim_palette, base + 1),
+        texelFetch(anim_palette, base + 2),
+        texelFetch(anim_palette, base + 3)
+    );
+}
+#endif
+
+mat4 joint_mat(int joint_idx)
+{
+#ifdef INSTANCED
+    if(anim_baked == 0)
+        return palette_mat((gl_InstanceID * anim_njoints + joint_idx) * 4);
+
+    ivec4 ref = texelFetch(anim_offsets, gl_InstanceID);
+    float blend = intBitsToFloat(ref.z);
+
+    mat4 curr = palette_mat((ref.x + joint_idx) * 4);
+    if(blend == 0.0)
+        return curr;
+    return curr * (1.0 - blend) + palette_mat((ref.y + joint_idx) * 4) * blend;
+#else
+    return anim_curr_pose_mats[joint_idx] * anim_inv_bind_mats[joint_idx];
+#endif
+}
+
 void main()
 {
     to_fragment.uv = in_uv;
@@ -115,15 +175,14 @@ void main()
             int joint_idx = int(w_idx < 3 ? in_joint_indices0[w_idx % 3]
                                           : in_joint_indices1[w_idx % 3]);
 
-            mat4 inv_bind_mat = anim_inv_bind_mats [joint_idx];
-            mat4 pose_mat     = anim_curr_pose_mats[joint_idx];
+            mat4 skin_mat = joint_mat(joint_idx);
 
             float weight = w_idx < 3 ? in_joint_weights0[w_idx % 3]
                                      : in_joint_weights1[w_idx % 3];
             float fraction = weight / tot_weight;
 
-            mat4 bone_mat = fraction * pose_mat * inv_bind_mat;
-            mat3 rot_mat = fraction * mat3(transpose(inverse(pose_mat * inv_bind_mat)));
+            mat4 bone_mat = fraction * skin_mat;
+            mat3 rot_mat = fraction * mat3(transpose(inverse(skin_mat)));
             
             new_pos += (bone_mat * vec4(in_pos, 1.0)).xyz;
             new_normal += rot_mat * in_normal;
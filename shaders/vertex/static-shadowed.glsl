@@ -49,7 +49,6 @@ out VertexToFrag {
     flat int  mat_idx;
          vec3 world_pos;
          vec3 normal;
-         vec4 light_space_pos;
 }to_fragment;
 
 out VertexToGeo {
@@ -60,11 +59,28 @@ out VertexToGeo {
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
+#ifdef INSTANCED
+/* Per-instance model matrix, occupying locations 8-11 */
+layout (location = 8) in mat4 in_model;
+#define model in_model
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
+#endif
+
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+    /* SHADOW_CASCADES is set by the engine when building the program */
+    mat4 cascade_transforms[SHADOW_CASCADES];
+    vec4 cascade_splits;
+};
 
 /*****************************************************************************/
 /* PROGRAM
@@ -76,7 +92,6 @@ void main()
     to_fragment.mat_idx = in_material_idx;
     to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
     to_fragment.normal = normalize(mat3(model) * in_normal);
-    to_fragment.light_space_pos = light_space_transform * vec4(to_fragment.world_pos, 1.0);
 
 #if USE_GEOMETRY
     to_geometry.normal = normalize(mat3(projection * view * model) * in_normal);
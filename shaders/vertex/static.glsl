@@ -59,10 +59,25 @@ out VertexToGeo {
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
+#ifdef INSTANCED
+/* Per-instance model matrix, occupying locations 8-11 */
+layout (location = 8) in mat4 in_model;
+#define model in_model
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec4 clip_plane0;
+#endif
+
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 /*****************************************************************************/
 /* PROGRAM
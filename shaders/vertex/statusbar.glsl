@@ -57,9 +57,18 @@ out VertexToFrag {
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-/* Should be set up for screenspace rendering */
-uniform mat4 view;
-uniform mat4 projection;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c. The view and projection should 
+ * be set up for screenspace rendering. */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 uniform ivec2 curr_res;
 
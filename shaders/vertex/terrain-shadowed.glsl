@@ -40,7 +40,6 @@ layout (location = 1) in vec2  in_uv;
 layout (location = 2) in vec3  in_normal;
 layout (location = 3) in int   in_material_idx;
 layout (location = 4) in int   in_blend_mode;
-layout (location = 5) in ivec4 in_adjacent_mat_indices;
 
 /*****************************************************************************/
 /* OUTPUTS                                                                   */
@@ -52,8 +51,6 @@ out VertexToFrag {
          vec3  world_pos;
          vec3  normal;
     flat int   blend_mode;
-    flat ivec4 adjacent_mat_indices;
-         vec4  light_space_pos;
 }to_fragment;
 
 out VertexToGeo {
@@ -65,10 +62,20 @@ out VertexToGeo {
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+    /* SHADOW_CASCADES is set by the engine when building the program */
+    mat4 cascade_transforms[SHADOW_CASCADES];
+    vec4 cascade_splits;
+};
 
 /*****************************************************************************/
 /* PROGRAM
@@ -81,8 +88,6 @@ void main()
     to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
     to_fragment.normal = normalize(mat3(model) * in_normal);
     to_fragment.blend_mode = in_blend_mode;
-    to_fragment.adjacent_mat_indices = in_adjacent_mat_indices;
-    to_fragment.light_space_pos = light_space_transform * vec4(to_fragment.world_pos, 1.0);
 
     to_geometry.normal = normalize(mat3(projection * view * model) * in_normal);
 
@@ -40,7 +40,6 @@ layout (location = 1) in vec2  in_uv;
 layout (location = 2) in vec3  in_normal;
 layout (location = 3) in int   in_material_idx;
 layout (location = 4) in int   in_blend_mode;
-layout (location = 5) in ivec4 in_adjacent_mat_indices;
 
 /*****************************************************************************/
 /* OUTPUTS                                                                   */
@@ -52,7 +51,6 @@ out VertexToFrag {
          vec3  world_pos;
          vec3  normal;
     flat int   blend_mode;
-    flat ivec4 adjacent_mat_indices;
 }to_fragment;
 
 out VertexToGeo {
@@ -64,9 +62,17 @@ out VertexToGeo {
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec4 clip_plane0;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 /*****************************************************************************/
 /* PROGRAM
@@ -79,7 +85,6 @@ void main()
     to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
     to_fragment.normal = normalize(mat3(model) * in_normal);
     to_fragment.blend_mode = in_blend_mode;
-    to_fragment.adjacent_mat_indices = in_adjacent_mat_indices;
 
     to_geometry.normal = normalize(mat3(projection * view * model) * in_normal);
 
@@ -53,11 +53,17 @@ out VertexToFrag {
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-uniform vec3 view_pos;
-uniform vec3 light_pos;
+/* Shared by all programs, bound once. The std140 layout must match 
+ * 'struct gl_globals' in gl_render.c */
+layout (std140) uniform globals {
+    mat4 view;
+    mat4 projection;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 uniform vec2 water_tiling;
 
@@ -39,6 +39,7 @@
 #include "anim_ctx.h"
 #include "../entity.h"
 #include "../event.h"
+#include "../asset_load.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
 
@@ -46,7 +47,10 @@
 
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -65,6 +69,23 @@ static const struct anim_clip *a_clip_for_name(const struct entity *ent, const c
     return NULL;
 }
 
+/* The palettes of a clip are baked on the first time it's played. They're 
+ * then uploaded for every model that shares the animation data. */
+static void a_bake_clip(const struct entity *ent, const struct anim_clip *clip)
+{
+    if(clip->baked)
+        return;
+
+    struct anim_data *priv = ent->anim_private;
+    struct anim_clip *mut = &priv->anims[clip - priv->anims];
+    A_BakeClip(&priv->skel, mut);
+
+    size_t count;
+    const mat4x4_t *base = A_AL_BakedPalettes(priv, &count);
+    AL_UpdateAnimPalettes(priv, mut->samples[0].skin_mats - base, 
+        mut->num_frames * priv->skel.num_joints);
+}
+
 static void a_mat_from_sqt(const struct SQT *sqt, mat4x4_t *out)
 {
     mat4x4_t rot, trans, scale;
@@ -80,54 +101,68 @@ static void a_mat_from_sqt(const struct SQT *sqt, mat4x4_t *out)
     PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
 }
 
-static void a_make_bind_mat(int joint_idx, const struct skeleton *skel, mat4x4_t *out)
+static quat_t a_unpack_quat(uint64_t packed)
 {
-    mat4x4_t bind_trans;
-    PFM_Mat4x4_Identity(&bind_trans);
-
-    /* Walk up the bone heirarchy, multiplying our bind transform matrix by the parent-relative
-     * transform of each bone we visit. In the end, this the bind matrix will hold a transformation
-     * from the object's space to the current joint's space. Since each joint is positioned at the
-     * origin of its' local space, this gives us the object-space position of this joint in the bind
-     * pose.
-     */
-    while(joint_idx >= 0) {
+    const float range = 1.0f / sqrtf(2.0f);
 
-        struct joint *joint = &skel->joints[joint_idx];
-        struct SQT   *bind_sqt = &skel->bind_sqts[joint_idx];
-        mat4x4_t to_parent, to_curr = bind_trans;
+    int largest = packed & 0x3;
+    packed >>= 2;
 
-        a_mat_from_sqt(bind_sqt, &to_parent);
-        PFM_Mat4x4_Mult4x4(&to_parent, &to_curr, &bind_trans);
+    quat_t ret;
+    float sum = 0.0f;
 
-        joint_idx = joint->parent_idx;
+    for(int i = 0; i < 4; i++) {
+
+        if(i == largest)
+            continue;
+
+        float norm = (float)(packed & QUAT_COMP_MAX) / QUAT_COMP_MAX;
+        ret.raw[i] = (norm * 2.0f - 1.0f) * range;
+        sum += ret.raw[i] * ret.raw[i];
+        packed >>= QUAT_COMP_BITS;
     }
 
-    *out = bind_trans;
+    ret.raw[largest] = sqrtf(MAX(1.0f - sum, 0.0f));
+    return ret;
 }
 
-static void a_make_pose_mat(const struct entity *ent, int joint_idx, const struct skeleton *skel, mat4x4_t *out)
+static void a_make_global_mat(const struct skeleton *skel, const struct SQT *local, 
+                              int joint_idx, bool *done, mat4x4_t *out)
 {
-    struct anim_ctx *ctx = ent->anim_ctx;
-    struct anim_sample *sample = &ctx->active->samples[ctx->curr_frame];
-
-    mat4x4_t pose_trans;
-    PFM_Mat4x4_Identity(&pose_trans);
+    if(done[joint_idx])
+        return;
 
-    /* Same as a_make_bind_mat, except for the current pose. */
-    while(joint_idx >= 0) {
+    mat4x4_t to_parent;
+    a_mat_from_sqt(&local[joint_idx], &to_parent);
 
-        struct joint *joint = &skel->joints[joint_idx];
-        struct SQT   *pose_sqt = &sample->local_joint_poses[joint_idx];
-        mat4x4_t to_parent, to_curr = pose_trans;
+    /* The root's transform is relative to the object's space. The rest of the 
+     * joints are relative to their parent, so chaining the parent's object-space 
+     * transform gives us the transformation from the current joint's space to 
+     * the object's space. Since each joint is positioned at the origin of its'
+     * local space, this gives us the object-space position of the joint. 
+     */
+    int parent_idx = skel->joints[joint_idx].parent_idx;
+    if(parent_idx < 0) {
+        out[joint_idx] = to_parent;
+    }else{
+        a_make_global_mat(skel, local, parent_idx, done, out);
+        PFM_Mat4x4_Mult4x4(&out[parent_idx], &to_parent, &out[joint_idx]);
+    }
+    done[joint_idx] = true;
+}
 
-        a_mat_from_sqt(pose_sqt, &to_parent);
-        PFM_Mat4x4_Mult4x4(&to_parent, &to_curr, &pose_trans);
+/* Makes the object-space transforms of all the joints of the skeleton in a 
+ * single pass, with every joint building on its' parent's transform. The 
+ * joints are not required to come after their parents.
+ */
+static void a_make_global_mats(const struct skeleton *skel, const struct SQT *local, mat4x4_t *out)
+{
+    bool done[skel->num_joints];
+    memset(done, 0, sizeof(done));
 
-        joint_idx = joint->parent_idx;
+    for(int j = 0; j < skel->num_joints; j++) {
+        a_make_global_mat(skel, local, j, done, out);
     }
-
-    *out = pose_trans;
 }
 
 /*****************************************************************************/
@@ -152,26 +187,29 @@ void A_SetActiveClip(const struct entity *ent, const char *name,
 
     const struct anim_clip *clip = a_clip_for_name(ent, name);
     assert(clip);
+    a_bake_clip(ent, clip);
 
     ctx->active = clip;
     ctx->mode = mode;
     ctx->key_fps = key_fps;
     ctx->curr_frame = 0;
     ctx->curr_frame_start_ticks = SDL_GetTicks();
+    ctx->frame_progress = 0.0f;
 }
 
-void A_Update(struct entity *ent)
+void A_Update(struct entity *ent, uint32_t curr_ticks)
 {
     struct anim_ctx *ctx = ent->anim_ctx;
 
     float frame_period_secs = 1.0f/ctx->key_fps;
-    uint32_t curr_ticks = SDL_GetTicks();
     float elapsed_secs = (curr_ticks - ctx->curr_frame_start_ticks)/1000.0f;
+    ctx->frame_progress = MIN(elapsed_secs / frame_period_secs, 1.0f);
 
     if(elapsed_secs > frame_period_secs) {
 
         ctx->curr_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
         ctx->curr_frame_start_ticks = curr_ticks;
+        ctx->frame_progress = 0.0f;
 
         if(ctx->curr_frame == 0) {
             E_Entity_Notify(EVENT_ANIM_CYCLE_FINISHED, ent->uid, NULL, ES_ENGINE);
@@ -194,18 +232,35 @@ void A_Update(struct entity *ent)
     }
 }
 
-void A_GetRenderState(const struct entity *ent, size_t *out_njoints, 
-                      mat4x4_t *out_curr_pose, const mat4x4_t **out_inv_bind_pose)
+void A_GetRenderState(const struct entity *ent, bool interpolate, 
+                      size_t *out_njoints, const mat4x4_t **out_palettes, 
+                      size_t *out_offset, size_t *out_next_offset, 
+                      float *out_blend)
 {
     assert(ent->flags & ENTITY_FLAG_ANIMATED);
     struct anim_data *priv = (struct anim_data*)ent->anim_private;
+    struct anim_ctx *ctx = ent->anim_ctx;
 
-    for(int j = 0; j < priv->skel.num_joints; j++) {
-        a_make_pose_mat(ent, j, &priv->skel, out_curr_pose + j);
-    }
+    size_t count;
+    const mat4x4_t *base = A_AL_BakedPalettes(priv, &count);
 
     *out_njoints = priv->skel.num_joints;
-    *out_inv_bind_pose = priv->skel.inv_bind_poses;
+    *out_palettes = base;
+    *out_offset = ctx->active->samples[ctx->curr_frame].skin_mats - base;
+
+    /* The clips that play only once switch over to the idle clip after the 
+     * last frame, so that one isn't blended into the first. */
+    int next_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
+    bool last = (next_frame == 0) && (ctx->mode != ANIM_MODE_LOOP);
+
+    if(!interpolate || last) {
+        *out_next_offset = *out_offset;
+        *out_blend = 0.0f;
+        return;
+    }
+
+    *out_next_offset = ctx->active->samples[next_frame].skin_mats - base;
+    *out_blend = ctx->frame_progress;
 }
 
 const struct skeleton *A_GetBindSkeleton(const struct entity *ent)
@@ -247,12 +302,19 @@ const struct skeleton *A_GetCurrPoseSkeleton(const struct entity *ent)
 
     ret->inv_bind_poses = (void*)((char*)ret->bind_sqts + num_joints * sizeof(struct SQT));
 
+    struct anim_ctx *ctx = ent->anim_ctx;
+    struct SQT local[num_joints];
+    mat4x4_t pose_mats[num_joints];
+
+    for(int i = 0; i < num_joints; i++) {
+        A_ClipJointSQT(ctx->active, i, ctx->curr_frame, &local[i]);
+    }
+    a_make_global_mats(ret, local, pose_mats);
+
     for(int i = 0; i < ret->num_joints; i++) {
     
         /* Update the inverse bind matrices for the current frame */
-        mat4x4_t pose_mat;
-        a_make_pose_mat(ent, i, ret, &pose_mat);
-        PFM_Mat4x4_Inverse(&pose_mat, &ret->inv_bind_poses[i]);
+        PFM_Mat4x4_Inverse(&pose_mats[i], &ret->inv_bind_poses[i]);
     }
 
     return ret;
@@ -262,14 +324,63 @@ void A_PrepareInvBindMatrices(const struct skeleton *skel)
 {
     assert(skel->inv_bind_poses);
 
+    /* All the bind matrices must be made before any of them is inverted, 
+     * as the children are built from their parent's matrix. */
+    a_make_global_mats(skel, skel->bind_sqts, skel->inv_bind_poses);
+
     for(int i = 0; i < skel->num_joints; i++) {
 
-        mat4x4_t bind_mat;
-        a_make_bind_mat(i, skel, &bind_mat);
+        mat4x4_t bind_mat = skel->inv_bind_poses[i];
         PFM_Mat4x4_Inverse(&bind_mat, &skel->inv_bind_poses[i]);
     }
 }
 
+void A_BakeClip(const struct skeleton *skel, struct anim_clip *clip)
+{
+    struct SQT local[skel->num_joints];
+    mat4x4_t pose_mats[skel->num_joints];
+
+    for(int f = 0; f < clip->num_frames; f++) {
+
+        for(int j = 0; j < skel->num_joints; j++) {
+            A_ClipJointSQT(clip, j, f, &local[j]);
+        }
+
+        struct anim_sample *sample = &clip->samples[f];
+        a_make_global_mats(skel, local, pose_mats);
+
+        /* The shaders only need the product of the two */
+        for(int j = 0; j < skel->num_joints; j++) {
+            PFM_Mat4x4_Mult4x4(&pose_mats[j], &skel->inv_bind_poses[j], 
+                &sample->skin_mats[j]);
+        }
+    }
+    clip->baked = true;
+}
+
+void A_ClipJointSQT(const struct anim_clip *clip, int joint_idx, int frame, struct SQT *out)
+{
+    const struct anim_track *track = &clip->tracks[joint_idx];
+
+    int rot_key   = (track->flags & TRACK_CONST_ROT)   ? 0 : frame;
+    int trans_key = (track->flags & TRACK_CONST_TRANS) ? 0 : frame;
+    int scale_key = (track->flags & TRACK_CONST_SCALE) ? 0 : frame;
+
+    const uint64_t *rots = (void*)(clip->keys + track->rot_off);
+    const vec3_t *trans = (void*)(clip->keys + track->trans_off);
+
+    out->quat_rotation = a_unpack_quat(rots[rot_key]);
+    out->trans = trans[trans_key];
+
+    if(track->flags & TRACK_UNIFORM_SCALE) {
+        const float *scales = (void*)(clip->keys + track->scale_off);
+        out->scale = (vec3_t){scales[scale_key], scales[scale_key], scales[scale_key]};
+    }else{
+        const vec3_t *scales = (void*)(clip->keys + track->scale_off);
+        out->scale = scales[scale_key];
+    }
+}
+
 const struct aabb *A_GetCurrPoseAABB(const struct entity *ent)
 {
     assert(ent->flags & ENTITY_FLAG_COLLISION);
@@ -284,3 +395,48 @@ void A_AddTimeDelta(const struct entity *ent, uint32_t dt)
     ctx->curr_frame_start_ticks += dt;
 }
 
+void A_SaveCtx(const struct entity *ent, struct anim_saved *out)
+{
+    const struct anim_ctx *ctx = ent->anim_ctx;
+    const struct anim_data *priv = ent->anim_private;
+
+    *out = (struct anim_saved){
+        .idle_clip = ctx->idle - priv->anims,
+        .active_clip = ctx->active - priv->anims,
+        .mode = ctx->mode,
+        .key_fps = ctx->key_fps,
+        .curr_frame = ctx->curr_frame,
+        .frame_progress = ctx->frame_progress,
+    };
+}
+
+bool A_RestoreCtx(const struct entity *ent, const struct anim_saved *saved)
+{
+    struct anim_ctx *ctx = ent->anim_ctx;
+    const struct anim_data *priv = ent->anim_private;
+
+    if(saved->idle_clip < 0 || (unsigned)saved->idle_clip >= priv->num_anims)
+        return false;
+    if(saved->active_clip < 0 || (unsigned)saved->active_clip >= priv->num_anims)
+        return false;
+    if(saved->key_fps == 0)
+        return false;
+
+    const struct anim_clip *active = &priv->anims[saved->active_clip];
+    if(saved->curr_frame < 0 || (unsigned)saved->curr_frame >= active->num_frames)
+        return false;
+
+    a_bake_clip(ent, active);
+
+    ctx->idle = &priv->anims[saved->idle_clip];
+    ctx->active = active;
+    ctx->mode = saved->mode;
+    ctx->key_fps = saved->key_fps;
+    ctx->curr_frame = saved->curr_frame;
+    ctx->frame_progress = saved->frame_progress;
+
+    /* Pick up the current frame from where it was left off */
+    uint32_t elapsed = saved->frame_progress * (1000.0f / saved->key_fps);
+    ctx->curr_frame_start_ticks = SDL_GetTicks() - elapsed;
+    return true;
+}
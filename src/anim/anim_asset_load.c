@@ -40,9 +40,27 @@
 
 #include "../asset_load.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/khash.h"
+#include "../mem.h"
 
 #include <string.h>
+#include <math.h>
+#include <assert.h>
 
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))
+#define ALIGNED(size, to)  (((size) + (to) - 1) / (to) * (to))
+/* The largest difference between two keys for a channel to be stored once */
+#define KEY_EPSILON        (1e-6f)
+
+KHASH_MAP_INIT_INT64(anim_data, struct anim_data*)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The animation data in use, by the hash of its' contents */
+static khash_t(anim_data) *s_shared_table;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -93,7 +111,7 @@ fail:
 }
 
 static bool al_read_anim_clip(SDL_RWops *stream, struct anim_clip *out, 
-                              const struct pfobj_hdr *header)
+                              const struct pfobj_hdr *header, struct SQT *out_local)
 {
     char line[MAX_LINE_LEN];
 
@@ -105,7 +123,7 @@ static bool al_read_anim_clip(SDL_RWops *stream, struct anim_clip *out,
         for(int j = 0; j < header->num_joints; j++) {
 
             int joint_idx;  /* unused */
-            struct SQT *curr_joint_trans = &out->samples[f].local_joint_poses[j];
+            struct SQT *curr_joint_trans = &out_local[f * header->num_joints + j];
         
             READ_LINE(stream, line, fail);
             if(!sscanf(line, "%d %f/%f/%f %f/%f/%f/%f %f/%f/%f",
@@ -138,6 +156,205 @@ fail:
     return false;
 }
 
+static uint64_t al_pack_quat(quat_t quat)
+{
+    const float range = 1.0f / sqrtf(2.0f);
+
+    int largest = 0;
+    for(int i = 1; i < 4; i++) {
+        if(fabsf(quat.raw[i]) > fabsf(quat.raw[largest]))
+            largest = i;
+    }
+
+    /* q and -q are the same rotation */
+    float sign = (quat.raw[largest] < 0.0f) ? -1.0f : 1.0f;
+    float mag = sqrtf(quat.x * quat.x + quat.y * quat.y + quat.z * quat.z + quat.w * quat.w);
+
+    uint64_t ret = largest;
+    int shift = 2;
+
+    for(int i = 0; i < 4; i++) {
+
+        if(i == largest)
+            continue;
+
+        float norm = (sign * quat.raw[i] / mag / range + 1.0f) / 2.0f;
+        norm = MAX(MIN(norm, 1.0f), 0.0f);
+
+        ret |= ((uint64_t)lroundf(norm * QUAT_COMP_MAX)) << shift;
+        shift += QUAT_COMP_BITS;
+    }
+    return ret;
+}
+
+static bool al_vec3_equal(const vec3_t *a, const vec3_t *b)
+{
+    return fabsf(a->x - b->x) <= KEY_EPSILON
+        && fabsf(a->y - b->y) <= KEY_EPSILON
+        && fabsf(a->z - b->z) <= KEY_EPSILON;
+}
+
+/* Picks the channels of a joint's track that can be stored with a single 
+ * key, as well as the uniform scales. 'local' holds 'num_joints' SQTs for 
+ * each of the 'num_frames' frames. */
+static uint32_t al_track_flags(const struct SQT *local, size_t num_joints, 
+                               unsigned num_frames, int joint_idx)
+{
+    uint32_t ret = TRACK_CONST_ROT | TRACK_CONST_TRANS | TRACK_CONST_SCALE | TRACK_UNIFORM_SCALE;
+
+    const struct SQT *first = &local[joint_idx];
+    uint64_t first_rot = al_pack_quat(first->quat_rotation);
+
+    for(int f = 0; f < num_frames; f++) {
+
+        const struct SQT *curr = &local[f * num_joints + joint_idx];
+
+        if(al_pack_quat(curr->quat_rotation) != first_rot)
+            ret &= ~TRACK_CONST_ROT;
+        if(!al_vec3_equal(&curr->trans, &first->trans))
+            ret &= ~TRACK_CONST_TRANS;
+        if(!al_vec3_equal(&curr->scale, &first->scale))
+            ret &= ~TRACK_CONST_SCALE;
+        if(fabsf(curr->scale.x - curr->scale.y) > KEY_EPSILON
+        || fabsf(curr->scale.x - curr->scale.z) > KEY_EPSILON)
+            ret &= ~TRACK_UNIFORM_SCALE;
+    }
+    return ret;
+}
+
+/* Lays out the keys of all the tracks of the clip, setting the tracks' offsets. 
+ * Returns the size of the keys, in bytes. */
+static size_t al_layout_keys(struct anim_track *tracks, size_t num_joints, unsigned num_frames)
+{
+    size_t ret = 0;
+
+    for(int j = 0; j < num_joints; j++) {
+        tracks[j].rot_off = ret;
+        ret += ((tracks[j].flags & TRACK_CONST_ROT) ? 1 : num_frames) * sizeof(uint64_t);
+    }
+
+    for(int j = 0; j < num_joints; j++) {
+        tracks[j].trans_off = ret;
+        ret += ((tracks[j].flags & TRACK_CONST_TRANS) ? 1 : num_frames) * sizeof(vec3_t);
+    }
+
+    for(int j = 0; j < num_joints; j++) {
+        tracks[j].scale_off = ret;
+        ret += ((tracks[j].flags & TRACK_CONST_SCALE) ? 1 : num_frames) 
+             * ((tracks[j].flags & TRACK_UNIFORM_SCALE) ? sizeof(float) : sizeof(vec3_t));
+    }
+
+    return ALIGNED(ret, sizeof(uint64_t));
+}
+
+static void al_pack_keys(struct anim_clip *clip, size_t num_joints, const struct SQT *local)
+{
+    for(int j = 0; j < num_joints; j++) {
+
+        const struct anim_track *track = &clip->tracks[j];
+        uint64_t *rots = (void*)(clip->keys + track->rot_off);
+        vec3_t *trans = (void*)(clip->keys + track->trans_off);
+        vec3_t *scales = (void*)(clip->keys + track->scale_off);
+        float *uscales = (void*)(clip->keys + track->scale_off);
+
+        for(int f = 0; f < clip->num_frames; f++) {
+
+            const struct SQT *curr = &local[f * num_joints + j];
+
+            if(f == 0 || !(track->flags & TRACK_CONST_ROT))
+                *rots++ = al_pack_quat(curr->quat_rotation);
+            if(f == 0 || !(track->flags & TRACK_CONST_TRANS))
+                *trans++ = curr->trans;
+            if(f > 0 && (track->flags & TRACK_CONST_SCALE))
+                continue;
+
+            if(track->flags & TRACK_UNIFORM_SCALE)
+                *uscales++ = curr->scale.x;
+            else
+                *scales++ = curr->scale;
+        }
+    }
+}
+
+static uint64_t al_fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* The fields are hashed one by one, so that the padding and the unused 
+ * parts of the names are left out. */
+static uint64_t al_data_hash(const struct anim_data *data)
+{
+    uint64_t ret = 0xcbf29ce484222325ULL;
+    ret = al_fnv1a(ret, &data->num_anims, sizeof(data->num_anims));
+    ret = al_fnv1a(ret, &data->skel.num_joints, sizeof(data->skel.num_joints));
+
+    for(int i = 0; i < data->skel.num_joints; i++) {
+
+        const struct joint *joint = &data->skel.joints[i];
+        ret = al_fnv1a(ret, joint->name, strlen(joint->name));
+        ret = al_fnv1a(ret, &joint->parent_idx, sizeof(joint->parent_idx));
+        ret = al_fnv1a(ret, &joint->tip, sizeof(joint->tip));
+    }
+    ret = al_fnv1a(ret, data->skel.bind_sqts, sizeof(struct SQT) * data->skel.num_joints);
+
+    for(int i = 0; i < data->num_anims; i++) {
+
+        const struct anim_clip *clip = &data->anims[i];
+        ret = al_fnv1a(ret, clip->name, strlen(clip->name));
+        ret = al_fnv1a(ret, &clip->num_frames, sizeof(clip->num_frames));
+
+        for(int f = 0; f < clip->num_frames; f++) {
+            ret = al_fnv1a(ret, &clip->samples[f].sample_aabb, sizeof(struct aabb));
+        }
+    }
+
+    /* The tracks and keys of all the clips are in one zero-padded block */
+    if(data->num_anims > 0) {
+        ret = al_fnv1a(ret, data->anims[0].tracks, data->keys_size);
+    }
+    return ret;
+}
+
+static bool al_data_equal(const struct anim_data *a, const struct anim_data *b)
+{
+    if(a->num_anims != b->num_anims || a->skel.num_joints != b->skel.num_joints)
+        return false;
+    if(a->keys_size != b->keys_size)
+        return false;
+
+    for(int i = 0; i < a->skel.num_joints; i++) {
+
+        const struct joint *ja = &a->skel.joints[i], *jb = &b->skel.joints[i];
+        if(strcmp(ja->name, jb->name) || ja->parent_idx != jb->parent_idx)
+            return false;
+        if(memcmp(&ja->tip, &jb->tip, sizeof(ja->tip)))
+            return false;
+    }
+    if(memcmp(a->skel.bind_sqts, b->skel.bind_sqts, sizeof(struct SQT) * a->skel.num_joints))
+        return false;
+
+    for(int i = 0; i < a->num_anims; i++) {
+
+        const struct anim_clip *ca = &a->anims[i], *cb = &b->anims[i];
+        if(strcmp(ca->name, cb->name) || ca->num_frames != cb->num_frames)
+            return false;
+
+        for(int f = 0; f < ca->num_frames; f++) {
+            if(memcmp(&ca->samples[f].sample_aabb, &cb->samples[f].sample_aabb, sizeof(struct aabb)))
+                return false;
+        }
+    }
+
+    return (a->num_anims == 0) 
+        || !memcmp(a->anims[0].tracks, b->anims[0].tracks, a->keys_size);
+}
+
 size_t al_data_buffsize_from_header(const struct pfobj_hdr *header)
 {
     size_t ret = 0;
@@ -152,16 +369,124 @@ size_t al_data_buffsize_from_header(const struct pfobj_hdr *header)
     /*
      * For each frame of each animation clip, we also require:
      *
-     *    1. a 'struct anim_sample' (for referencing this frame's SQT array)
-     *    2. num_joint number of 'struct SQT's (each joint's transform
+     *    1. a 'struct anim_sample' (for referencing this frame's palette)
+     *    2. num_joint number of 'mat4x4_t's (each joint's skinning matrix
      *       for the current frame)
      */
     for(unsigned as_idx  = 0; as_idx < header->num_as; as_idx++) {
 
         ret += header->frame_counts[as_idx] * 
-               (sizeof(struct anim_sample) + header->num_joints * sizeof(struct SQT));
+               (sizeof(struct anim_sample) + header->num_joints * sizeof(mat4x4_t));
     }
 
+    /* The tracks and keys, which come last, are 8-byte aligned. Their 
+     * size depends on the keys, so they are added on separately. */
+    return ALIGNED(ret, sizeof(uint64_t));
+}
+
+/* Builds the animation data from the joints and from the local SQTs of every
+ * frame of every clip, compressing the latter into tracks. 'clips' holds the 
+ * names, frame counts and per-frame bounding boxes of the clips. 'clip_local' 
+ * has a pointer to each clip's SQTs, 'num_joints' for each frame. */
+static struct anim_data *al_data_build(const struct pfobj_hdr *header, const struct joint *joints,
+                                       const struct SQT *bind_sqts, const struct anim_clip *clips,
+                                       const struct SQT *const *clip_local)
+{
+    const size_t num_joints = header->num_joints;
+    struct anim_track tracks[MAX(header->num_as, 1)][MAX(num_joints, 1)];
+
+    size_t keys_size = 0;
+    for(int i = 0; i < header->num_as; i++) {
+
+        for(int j = 0; j < num_joints; j++) {
+            tracks[i][j].flags = al_track_flags(clip_local[i], num_joints, clips[i].num_frames, j);
+        }
+
+        keys_size += sizeof(struct anim_track) * num_joints;
+        keys_size += al_layout_keys(tracks[i], num_joints, clips[i].num_frames);
+    }
+
+    size_t fixed_size = al_data_buffsize_from_header(header);
+    struct anim_data *ret = Mem_Alloc(MEM_TAG_ANIM, fixed_size + keys_size);
+    if(!ret)
+        return NULL;
+
+    /*-----------------------------------------------------------
+     * Divide up the buffer betwen data members,
+     * set counts and pointers 
+     *-----------------------------------------------------------
+     */
+
+    char *unused_base = (char*)(ret + 1);
+
+    ret->num_anims = header->num_as; 
+    ret->skel.num_joints = num_joints;
+    ret->keys_size = keys_size;
+    ret->refcount = 0;
+
+    ret->skel.bind_sqts = (void*)unused_base;
+    unused_base += sizeof(struct SQT) * num_joints;
+
+    ret->skel.inv_bind_poses = (void*)unused_base;
+    unused_base += sizeof(mat4x4_t) * num_joints;
+
+    ret->skel.joints = (void*)unused_base;
+    unused_base += sizeof(struct joint) * num_joints;
+
+    ret->anims = (void*)unused_base;
+    unused_base += sizeof(struct anim_clip) * header->num_as;
+
+    for(int i = 0; i < header->num_as; i++) {
+
+        ret->anims[i].samples = (void*)unused_base;
+        unused_base += sizeof(struct anim_sample) * header->frame_counts[i];
+    }
+
+    for(int i = 0; i < header->num_as; i++) {
+        for(int f = 0; f < header->frame_counts[i]; f++) {
+
+            ret->anims[i].samples[f].skin_mats = (void*)unused_base;
+            unused_base += sizeof(mat4x4_t) * num_joints;
+        }
+    }
+
+    unused_base = (char*)ret + fixed_size;
+    for(int i = 0; i < header->num_as; i++) {
+
+        ret->anims[i].tracks = (void*)unused_base;
+        unused_base += sizeof(struct anim_track) * num_joints;
+
+        ret->anims[i].keys = (void*)unused_base;
+        unused_base += al_layout_keys(tracks[i], num_joints, header->frame_counts[i]);
+    }
+    assert(unused_base == (char*)ret + fixed_size + keys_size);
+    memset((char*)ret + fixed_size, 0, keys_size);
+
+    /*---------------------------------------------------------------
+     * Then we populate priv members with the file data 
+     *---------------------------------------------------------------
+     */
+    memcpy(ret->skel.joints, joints, sizeof(struct joint) * num_joints);
+    memcpy(ret->skel.bind_sqts, bind_sqts, sizeof(struct SQT) * num_joints);
+    A_PrepareInvBindMatrices(&ret->skel);
+
+    for(int i = 0; i < header->num_as; i++) {
+
+        struct anim_clip *clip = &ret->anims[i];
+        memcpy(clip->name, clips[i].name, sizeof(clip->name));
+        clip->skel = &ret->skel;
+        clip->num_frames = header->frame_counts[i];
+        memcpy(clip->tracks, tracks[i], sizeof(struct anim_track) * num_joints);
+
+        for(int f = 0; f < clip->num_frames; f++) {
+            clip->samples[f].sample_aabb = clips[i].samples[f].sample_aabb;
+        }
+
+        al_pack_keys(clip, num_joints, clip_local[i]);
+        clip->baked = false;
+    }
+
+    ret->hash = al_data_hash(ret);
     return ret;
 }
 
@@ -191,84 +516,251 @@ size_t A_AL_CtxBuffSize(void)
  *  | struct anim_samples[num_as      |
  *  |    * num_frames]                |
  *  +---------------------------------+
- *  | struct SQT[num_as * num_joints] |
- *  |    (stored in clip-major order) |
+ *  | mat4x4_t[num_as * num_joints]   |
+ *  |    (skin, clip-major order,     |
+ *  |     baked on first use)         |
+ *  +---------------------------------+ <-- 8-byte aligned
+ *  | struct anim_track[num_joints]   |
+ *  | keys (see 'struct anim_clip')   |
+ *  |    (repeated for each clip)     |
  *  +---------------------------------+
  *
  */
 
 void *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream)
 {
-    struct anim_data *ret = malloc(al_data_buffsize_from_header(header));
-    if(!ret)
-        goto fail_alloc;
+    const size_t num_joints = header->num_joints;
+
+    struct joint joints[MAX(num_joints, 1)];
+    struct SQT bind_sqts[MAX(num_joints, 1)];
+    struct anim_clip clips[MAX(header->num_as, 1)];
+    const struct SQT *clip_local[MAX(header->num_as, 1)];
 
     /*-----------------------------------------------------------
-     * First divide up the buffer betwen data members,
-     * set counts and pointers 
+     * The clips are first read in full, into scratch buffers, 
+     * to find out how much space the compressed keys take. 
      *-----------------------------------------------------------
      */
+    size_t num_frames = 0;
+    for(int i = 0; i < header->num_as; i++) {
+        num_frames += header->frame_counts[i];
+    }
 
-    char *unused_base = (char*)(ret + 1);
-
-    ret->num_anims = header->num_as; 
-    ret->skel.num_joints = header->num_joints;
+    struct SQT *local = malloc(MAX(num_frames * num_joints, 1) * sizeof(struct SQT));
+    if(!local)
+        goto fail_alloc_local;
 
-    ret->skel.bind_sqts = (void*)unused_base;
-    unused_base += sizeof(struct SQT) * header->num_joints;
+    struct anim_sample *samples = malloc(MAX(num_frames, 1) * sizeof(struct anim_sample));
+    if(!samples)
+        goto fail_alloc_samples;
 
-    ret->skel.inv_bind_poses = (void*)unused_base;
-    unused_base += sizeof(mat4x4_t) * header->num_joints;
+    for(int i = 0; i < num_joints; i++) {
 
-    ret->skel.joints = (void*)unused_base;
-    unused_base += sizeof(struct joint) * header->num_joints;
+        if(!al_read_joint(stream, &joints[i], &bind_sqts[i]))
+            goto fail_parse;
+    }
 
-    ret->anims = (void*)unused_base;
-    unused_base += sizeof(struct anim_clip) * header->num_as;
+    struct SQT *curr_local = local;
+    struct anim_sample *curr_samples = samples;
 
     for(int i = 0; i < header->num_as; i++) {
 
-        ret->anims[i].samples = (void*)unused_base;
-        unused_base += sizeof(struct anim_sample) * header->frame_counts[i];
+        clips[i].num_frames = header->frame_counts[i];
+        clips[i].samples = curr_samples;
+        clip_local[i] = curr_local;
+
+        if(!al_read_anim_clip(stream, &clips[i], header, curr_local))
+            goto fail_parse;
+
+        curr_local += clips[i].num_frames * num_joints;
+        curr_samples += clips[i].num_frames;
     }
 
-    for(int i = 0; i < header->num_as; i++) {
+    struct anim_data *ret = al_data_build(header, joints, bind_sqts, clips, clip_local);
+    if(!ret)
+        goto fail_parse;
 
-        ret->anims[i].skel = &ret->skel;
-        ret->anims[i].num_frames = header->frame_counts[i];
+    free(samples);
+    free(local);
+    return ret;
 
-        for(int f = 0; f < header->frame_counts[i]; f++) {
+fail_parse:
+    free(samples);
+fail_alloc_samples:
+    free(local);
+fail_alloc_local:
+    return NULL;
+}
 
-            ret->anims[i].samples[f].local_joint_poses = (void*)unused_base;
-            unused_base += sizeof(struct SQT) * header->num_joints;
-        }
+void *A_AL_PrivFromBinary(const struct pfobj_hdr *header, const struct pfobj_bin_joint *bin_joints,
+                          const void *bin_clips, size_t bin_clips_size)
+{
+    const size_t num_joints = header->num_joints;
+
+    struct joint joints[MAX(num_joints, 1)];
+    struct SQT bind_sqts[MAX(num_joints, 1)];
+    struct anim_clip clips[MAX(header->num_as, 1)];
+    const struct SQT *clip_local[MAX(header->num_as, 1)];
+
+    size_t num_frames = 0;
+    for(int i = 0; i < header->num_as; i++) {
+        num_frames += header->frame_counts[i];
     }
 
-    /*---------------------------------------------------------------
-     * Then we populate priv members with the file data 
-     *---------------------------------------------------------------
-     */
-    for(int i = 0; i < header->num_joints; i++) {
+    struct anim_sample *samples = malloc(MAX(num_frames, 1) * sizeof(struct anim_sample));
+    if(!samples)
+        goto fail_alloc_samples;
 
-        if(!al_read_joint(stream, &ret->skel.joints[i], &ret->skel.bind_sqts[i]))
+    for(int i = 0; i < num_joints; i++) {
+
+        const struct pfobj_bin_joint *bj = &bin_joints[i];
+        if(bj->parent_idx < -1 || bj->parent_idx >= (int)num_joints)
             goto fail_parse;
+
+        memcpy(joints[i].name, bj->name, sizeof(joints[i].name));
+        joints[i].name[sizeof(joints[i].name)-1] = '\0';
+        joints[i].parent_idx = bj->parent_idx;
+        joints[i].tip = (vec3_t){bj->tip[0], bj->tip[1], bj->tip[2]};
+        memcpy(&bind_sqts[i], &bj->bind, sizeof(struct SQT));
     }
 
+    /* The keys have the same layout as the SQTs, so those are used in place */
+    const char *base = bin_clips;
+    size_t off = 0;
+    struct anim_sample *curr_samples = samples;
+
     for(int i = 0; i < header->num_as; i++) {
-        
-        if(!al_read_anim_clip(stream, &ret->anims[i], header))
+
+        const size_t nframes = header->frame_counts[i];
+        const size_t keys_size = nframes * num_joints * sizeof(struct pfobj_bin_key);
+        const size_t aabbs_size = header->has_collision ? nframes * sizeof(struct aabb) : 0;
+
+        if(off + sizeof(struct pfobj_bin_clip) + keys_size + aabbs_size > bin_clips_size)
+            goto fail_parse;
+
+        const struct pfobj_bin_clip *bc = (void*)(base + off);
+        if(bc->num_frames != nframes)
             goto fail_parse;
+        off += sizeof(struct pfobj_bin_clip);
+
+        memcpy(clips[i].name, bc->name, sizeof(clips[i].name));
+        clips[i].name[sizeof(clips[i].name)-1] = '\0';
+        clips[i].num_frames = nframes;
+        clips[i].samples = curr_samples;
+
+        clip_local[i] = (void*)(base + off);
+        off += keys_size;
+
+        for(int f = 0; f < aabbs_size / sizeof(struct aabb); f++) {
+            memcpy(&curr_samples[f].sample_aabb, base + off, sizeof(struct aabb));
+            off += sizeof(struct aabb);
+        }
+
+        off = ALIGNED(off, PFOBJ_BIN_ALIGN);
+        curr_samples += nframes;
     }
 
-    A_PrepareInvBindMatrices(&ret->skel);
+    struct anim_data *ret = al_data_build(header, joints, bind_sqts, clips, clip_local);
+    if(!ret)
+        goto fail_parse;
+
+    free(samples);
     return ret;
 
 fail_parse:
-    free(ret);
-fail_alloc:
+    free(samples);
+fail_alloc_samples:
     return NULL;
 }
 
+const mat4x4_t *A_AL_BakedPalettes(const void *priv_data, size_t *out_count)
+{
+    const struct anim_data *priv = priv_data;
+
+    /* The skinning matrices of all the frames are allocated in one block 
+     * (see A_AL_PrivFromStream) */
+    size_t nframes = 0;
+    for(int i = 0; i < priv->num_anims; i++) {
+        nframes += priv->anims[i].num_frames;
+    }
+
+    *out_count = nframes * priv->skel.num_joints;
+    return (nframes > 0) ? priv->anims[0].samples[0].skin_mats : NULL;
+}
+
+bool A_AL_ClipPalettes(const void *priv_data, int clip_idx, 
+                       size_t *out_offset, size_t *out_count)
+{
+    const struct anim_data *priv = priv_data;
+    assert(clip_idx >= 0 && clip_idx < priv->num_anims);
+
+    const struct anim_clip *clip = &priv->anims[clip_idx];
+    size_t count;
+    const mat4x4_t *base = A_AL_BakedPalettes(priv, &count);
+
+    *out_offset = clip->samples[0].skin_mats - base;
+    *out_count = clip->num_frames * priv->skel.num_joints;
+    return clip->baked;
+}
+
+void *A_AL_SharePrivate(void *priv_data)
+{
+    struct anim_data *priv = priv_data;
+    assert(priv->refcount == 0);
+
+    khiter_t k = kh_get(anim_data, s_shared_table, priv->hash);
+    if(k != kh_end(s_shared_table)) {
+
+        struct anim_data *shared = kh_value(s_shared_table, k);
+        if(al_data_equal(shared, priv)) {
+            Mem_Free(MEM_TAG_ANIM, priv);
+            shared->refcount++;
+            return shared;
+        }
+        /* A collision. The data is simply not shared. */
+        priv->refcount = 1;
+        return priv;
+    }
+
+    int put_ret;
+    k = kh_put(anim_data, s_shared_table, priv->hash, &put_ret);
+    if(put_ret != -1) {
+        kh_value(s_shared_table, k) = priv;
+    }
+    priv->refcount = 1;
+    return priv;
+}
+
+void A_AL_FreePrivate(void *priv_data)
+{
+    struct anim_data *priv = priv_data;
+    if(priv->refcount > 1) {
+        priv->refcount--;
+        return;
+    }
+
+    /* Data that was never shared may be freed from any thread */
+    if(priv->refcount == 1) {
+
+        khiter_t k = kh_get(anim_data, s_shared_table, priv->hash);
+        if(k != kh_end(s_shared_table) && kh_value(s_shared_table, k) == priv) {
+            kh_del(anim_data, s_shared_table, k);
+        }
+    }
+    Mem_Free(MEM_TAG_ANIM, priv);
+}
+
+bool A_AL_Init(void)
+{
+    s_shared_table = kh_init(anim_data);
+    return (s_shared_table != NULL);
+}
+
+void A_AL_Shutdown(void)
+{
+    kh_destroy(anim_data, s_shared_table);
+}
+
 void A_AL_DumpPrivate(FILE *stream, void *priv_data)
 {
     struct anim_data *priv = priv_data;
@@ -299,7 +791,9 @@ void A_AL_DumpPrivate(FILE *stream, void *priv_data)
         for(int f = 0; f < ac->num_frames; f++) {
             for(int j = 0; j < ac->skel->num_joints; j++) {
 
-                struct SQT *sqt = &ac->samples[f].local_joint_poses[j]; 
+                struct SQT local;
+                A_ClipJointSQT(ac, j, f, &local);
+                struct SQT *sqt = &local;
 
                 float roll, pitch, yaw;
                 PFM_Quat_ToEuler(&sqt->quat_rotation, &roll, &pitch, &yaw);
@@ -45,6 +45,8 @@ struct anim_ctx{
     unsigned                key_fps;
     int                     curr_frame;
     uint32_t                curr_frame_start_ticks;
+    /* How far along the current frame is, in [0, 1] */
+    float                   frame_progress;
 };
 
 #endif
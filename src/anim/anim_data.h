@@ -41,25 +41,69 @@
 #include "../collision.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #define ANIM_NAME_LEN  32
 
+/* Rotations are stored as the 3 smallest components of the unit quaternion, 
+ * each quantized to QUAT_COMP_BITS bits, along with the index of the largest 
+ * one in the lowest 2 bits. The largest component is made positive, so it can 
+ * be recovered from the other 3. */
+#define QUAT_COMP_BITS (20)
+#define QUAT_COMP_MAX  ((1 << QUAT_COMP_BITS) - 1)
+
 struct anim_sample{
-    struct SQT  *local_joint_poses;
+    /* bind pose object space to current pose object space, 
+     * for each joint */
+    mat4x4_t    *skin_mats;
     struct aabb  sample_aabb;
 };
 
+enum track_flags{
+    TRACK_CONST_ROT     = (1 << 0),
+    TRACK_CONST_TRANS   = (1 << 1),
+    TRACK_CONST_SCALE   = (1 << 2),
+    /* The scale keys are a single float instead of a vec3_t */
+    TRACK_UNIFORM_SCALE = (1 << 3),
+};
+
+/* The keys of a single joint over the clip. A channel that doesn't change 
+ * over the clip holds a single key. Otherwise it holds one key per frame. 
+ * The offsets are in bytes, from the clip's 'keys'. */
+struct anim_track{
+    uint32_t flags;
+    uint32_t rot_off;   /* uint64_t packed rotations */
+    uint32_t trans_off; /* vec3_t translations */
+    uint32_t scale_off; /* vec3_t or float scales */
+};
+
 struct anim_clip{
     char                name[ANIM_NAME_LEN];
     struct skeleton    *skel;
     unsigned            num_frames;
     struct anim_sample *samples;
+    /* The local joint poses of the clip. The tracks of all the joints are 
+     * immediately followed by the keys, all the rotations first, then all 
+     * the translations and all the scales, in one contiguous block. */
+    struct anim_track  *tracks;
+    unsigned char      *keys;
+    /* The skinning matrices of the samples are only baked from the keys 
+     * once the clip is first played, as most models have clips that are 
+     * never played in a given session. */
+    bool                baked;
 };
 
 struct anim_data{
     unsigned          num_anims;
     struct skeleton   skel;
     struct anim_clip *anims;
+    /* Models that differ only in their materials (ex. the team-coloured 
+     * variants of a unit) have identical animation data. It's loaded for 
+     * each, but only the first copy is kept and shared by all of them. */
+    uint64_t          hash;
+    size_t            keys_size;
+    int               refcount;
 };
 
 #endif
@@ -37,6 +37,8 @@
 #define ANIM_PRIVATE_H
 
 struct skeleton;
+struct anim_clip;
+struct SQT;
 
 /* Computes the inverse bind matrix for each joint based on the 
  * joint's bind SQT. The inverse bind matrix will be used by the vertex
@@ -48,4 +50,17 @@ struct skeleton;
  */
 void A_PrepareInvBindMatrices(const struct skeleton *skel);
 
+/* Computes the skinning matrices that make up the joint palette of each 
+ * frame of the clip from the joints' parent-relative transforms, which are
+ * decompressed from the clip's keys. The palettes are shared by all the 
+ * entities playing the clip. The matrices will be written to the memory 
+ * pointed to by the samples' 'skin_mats' which is expected to be allocated 
+ * already. Must be called after 'A_PrepareInvBindMatrices'.
+ */
+void A_BakeClip(const struct skeleton *skel, struct anim_clip *clip);
+
+/* Decompresses the local pose of a joint at a frame of the clip.
+ */
+void A_ClipJointSQT(const struct anim_clip *clip, int joint_idx, int frame, struct SQT *out);
+
 #endif
@@ -45,6 +45,7 @@
 #include <SDL.h> /* for SDL_RWops */
 
 struct pfobj_hdr;
+struct pfobj_bin_joint;
 struct entity;
 struct skeleton;
 
@@ -54,6 +55,18 @@ enum anim_mode{
     ANIM_MODE_ONCE_HIDE_ON_FINISH,
 };
 
+/* The animation state of an entity in a form which can be written out and 
+ * restored onto another entity with the same model. The clips are referred 
+ * to by their' index in the model. */
+struct anim_saved{
+    int32_t  idle_clip;
+    int32_t  active_clip;
+    int32_t  mode;
+    uint32_t key_fps;
+    int32_t  curr_frame;
+    float    frame_progress;
+};
+
 
 /*###########################################################################*/
 /* ANIM GENERAL                                                              */
@@ -81,17 +94,30 @@ void                   A_SetActiveClip(const struct entity *ent, const char *nam
 
 /* ---------------------------------------------------------------------------
  * Should be called once per render loop, prior to rendering. Will update the
- * animation context based on the current time.
+ * animation context based on the current time, 'curr_ticks', which is to be
+ * sampled once per frame and shared by all the entities.
  * ---------------------------------------------------------------------------
  */
-void                   A_Update(struct entity *ent);
+void                   A_Update(struct entity *ent, uint32_t curr_ticks);
 
 /* ---------------------------------------------------------------------------
- * Retreive a copy of the state needed to render an animated entity.
+ * Retreive the state needed to render an animated entity. The palette holds
+ * the skinning matrix (current pose times inverse bind pose) of each joint. 
+ * The palettes are baked when the clip is first played and shared by all 
+ * entities showing the same frame of the same clip, so they must not be 
+ * modified or freed. The current palette starts at matrix 'out_offset' of 
+ * 'out_palettes', which holds the palettes of all the frames of the model 
+ * (see A_AL_BakedPalettes).
+ *
+ * 'out_next_offset' is the palette of the frame that follows and 'out_blend' 
+ * is how far along the current frame is, for blending between the two. When 
+ * 'interpolate' is false, or there is no following frame, 'out_blend' is 0.
  * ---------------------------------------------------------------------------
  */
-void                   A_GetRenderState(const struct entity *ent, size_t *out_njoints, 
-                                        mat4x4_t *out_curr_pose, const mat4x4_t **out_inv_bind_pose);
+void                   A_GetRenderState(const struct entity *ent, bool interpolate, 
+                                        size_t *out_njoints, const mat4x4_t **out_palettes, 
+                                        size_t *out_offset, size_t *out_next_offset, 
+                                        float *out_blend);
 
 /* ---------------------------------------------------------------------------
  * Simple utility to get a reference to the skeleton structure in its' default
@@ -125,6 +151,15 @@ const struct aabb     *A_GetCurrPoseAABB(const struct entity *ent);
  */
 void                   A_AddTimeDelta(const struct entity *ent, uint32_t dt);
 
+/* ---------------------------------------------------------------------------
+ * Save the animation state of an entity with an initialized context, and 
+ * restore it onto an entity with the same model. The restoring returns false
+ * if the saved state does not fit the entity's model.
+ * ---------------------------------------------------------------------------
+ */
+void                   A_SaveCtx(const struct entity *ent, struct anim_saved *out);
+bool                   A_RestoreCtx(const struct entity *ent, const struct anim_saved *saved);
+
 
 /*###########################################################################*/
 /* ANIM ASSET LOADING                                                        */
@@ -139,15 +174,62 @@ size_t A_AL_CtxBuffSize(void);
 
 /* ---------------------------------------------------------------------------
  * Consumes lines of the stream and uses them to populate the private data, 
- * which is then returned in a malloc'd buffer.
+ * which is then returned in a buffer to be freed with 'A_AL_FreePrivate'.
  * ---------------------------------------------------------------------------
  */
 void  *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream);
 
+/* ---------------------------------------------------------------------------
+ * Like A_AL_PrivFromStream, but takes the joints and the clips sections of a 
+ * binary PF Object that is already in memory. 'bin_clips_size' is the number
+ * of bytes that the clips section may span. Returns NULL if the section is
+ * malformed. The data is copied and need not outlive the call.
+ * ---------------------------------------------------------------------------
+ */
+void  *A_AL_PrivFromBinary(const struct pfobj_hdr *header, const struct pfobj_bin_joint *bin_joints,
+                           const void *bin_clips, size_t bin_clips_size);
+
 /* ---------------------------------------------------------------------------
  * Dumps private animation data in PF Object format.
  * ---------------------------------------------------------------------------
  */
 void   A_AL_DumpPrivate(FILE *stream, void *priv_data);
 
+/* ---------------------------------------------------------------------------
+ * Returns the skinning matrices of all the frames of all the clips of the 
+ * model, stored one after another. 'out_count' is the total number of
+ * matrices. The buffer lives for as long as the private data. Only the 
+ * matrices of the clips that have been baked hold valid data.
+ * ---------------------------------------------------------------------------
+ */
+const mat4x4_t *A_AL_BakedPalettes(const void *priv_data, size_t *out_count);
+
+/* ---------------------------------------------------------------------------
+ * Gets the range of the matrices returned by 'A_AL_BakedPalettes' that holds 
+ * the palettes of the clip at index 'clip_idx'. Returns false if the clip's 
+ * palettes haven't been baked yet.
+ * ---------------------------------------------------------------------------
+ */
+bool            A_AL_ClipPalettes(const void *priv_data, int clip_idx, 
+                                  size_t *out_offset, size_t *out_count);
+
+/* ---------------------------------------------------------------------------
+ * Swaps the newly loaded private data for an identical copy that's already 
+ * in use, if there is one, in which case the new data is freed. Either way, 
+ * a reference to the returned data is taken. Must be called from the main 
+ * thread.
+ * ---------------------------------------------------------------------------
+ */
+void           *A_AL_SharePrivate(void *priv_data);
+
+/* ---------------------------------------------------------------------------
+ * Drops a reference to the private data, freeing it along with the last 
+ * one. Data that was never shared is freed right away.
+ * ---------------------------------------------------------------------------
+ */
+void            A_AL_FreePrivate(void *priv_data);
+
+bool            A_AL_Init(void);
+void            A_AL_Shutdown(void);
+
 #endif
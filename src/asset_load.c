@@ -42,6 +42,11 @@
 #include "map/public/map.h"
 #include "lib/public/khash.h"
 #include "lib/public/pf_string.h"
+#include "lib/public/vec.h"
+#include "main.h"
+#include "config.h"
+#include "sched.h"
+#include "mem.h"
 
 #include <SDL.h>
 
@@ -52,37 +57,91 @@
 #include <stdlib.h> 
 
 
+#define ALIGNED(size, to)  (((size) + (to) - 1) / (to) * (to))
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))
+
 struct shared_resource{
-    char         key[64];
-    uint32_t     ent_flags;
-    void        *render_private;
-    void        *anim_private;
-    struct aabb  aabb;
+    char          key[64];
+    uint32_t      ent_flags;
+    void         *render_private;
+    void         *anim_private;
+    struct aabb   aabb;
+    /* Every entity using the resource holds a reference to it, as does the 
+     * name table for as long as the resource is cached under its' name. */
+    int           refcount;
+    /* The frame on which the last reference was dropped */
+    unsigned long dead_frame;
+};
+
+/* A PF Object that has been read in, but not yet set up for rendering. 
+ * Producing it touches no engine state, so it's done by a worker thread
+ * for asynchronous loads. */
+struct load_result{
+    bool                             ok;
+    struct pfobj_hdr                 header;
+    void                            *anim_private;
+    const struct pfobj_bin_material *mats;
+    const void                      *verts;
+    size_t                           vert_size;
+    struct aabb                      aabb;
+    /* The buffer that 'mats' and 'verts' point into */
+    void                            *buff;
+};
+
+struct load_request{
+    struct job_counter ctr;
+    al_ticket_t        ticket;
+    enum al_status     status;
+    /* Set once the ticket has been released by its' owner. The request 
+     * is then freed as soon as it's no longer pending. */
+    bool               released;
+    char               key[64];
+    char               base_path[256];
+    /* Written by the loading job */
+    struct load_result result;
 };
 
-KHASH_MAP_INIT_STR(entity_res, struct shared_resource)
+KHASH_MAP_INIT_STR(entity_res, struct shared_resource*)
+KHASH_MAP_INIT_INT64(priv_res, struct shared_resource*)
+
+VEC_TYPE(req, struct load_request*)
+VEC_IMPL(static inline, req, struct load_request*)
+
+VEC_TYPE(res, struct shared_resource*)
+VEC_IMPL(static inline, res, struct shared_resource*)
+
+VEC_TYPE(slab, unsigned char*)
+VEC_IMPL(static inline, slab, unsigned char*)
+
+/* A free entity slot is linked into the free list through its' first bytes */
+struct ent_slot{
+    struct ent_slot *next_free;
+};
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+/* The resources which are currently cached, by PF Object name */
 static khash_t(entity_res) *s_name_resource_table;
+/* All the live resources, by their' render private pointer. This is how an 
+ * entity's resource is found when it's freed. */
+static khash_t(priv_res)   *s_priv_resource_table;
+/* Outstanding asynchronous loads, in the order they were made */
+static vec_req_t            s_requests;
+static al_ticket_t          s_next_ticket = AL_TICKET_INVALID + 1;
+/* Resources with no references left. Their render data is freed by the 
+ * render thread, after which the rest can go too. */
+static vec_res_t            s_dead;
+/* Every entity, followed by its' animation context, takes up a slot in one 
+ * of these slabs of CONFIG_ENTITY_SLAB_SZ. */
+static vec_slab_t           s_ent_slabs;
+static struct ent_slot     *s_ent_free_head;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* A copy of the key string is stored in the 'struct shared_resource' itself. Make the key 
- * (string pointer) be a pointer to that buffer in order to avoid allocating/storing the key 
- * strings separately. All keys must be patched in case rehashing took place. */
-static void kh_update_str_keys(khash_t(entity_res) *table)
-{
-    for(khiter_t k = kh_begin(table); k != kh_end(table); k++) {
-        if(!kh_exist(table, k)) continue;
-        kh_key(table, k) = kh_value(table, k).key;
-    }
-}
-
 static bool al_parse_pfobj_header(SDL_RWops *stream, struct pfobj_hdr *out)
 {
     char line[MAX_LINE_LEN];
@@ -197,9 +256,419 @@ static void al_set_ent_defaults(struct entity *ent)
     ent->max_hp = 0;
     ent->scale = (vec3_t){1.0f, 1.0f, 1.0f};
     ent->rotation = (quat_t){0.0f, 0.0f, 0.0f, 1.0f};
+    Entity_InvalidateModel(ent);
     ent->selection_radius = 0.0f;
     ent->max_speed = 0.0f;
+    ent->vision_range = 0.0f;
     ent->faction_id = 0; 
+    ent->script_obj = NULL;
+}
+
+static size_t al_ent_slot_size(void)
+{
+    /* Keep every slot as aligned as the slab itself */
+    size_t size = sizeof(struct entity) + A_AL_CtxBuffSize();
+    return (size + 15) & ~((size_t)15);
+}
+
+static bool al_ent_slab_grow(void)
+{
+    const size_t slot_size = al_ent_slot_size();
+    unsigned char *slab = malloc(CONFIG_ENTITY_SLAB_SZ * slot_size);
+    if(!slab)
+        return false;
+
+    if(!vec_slab_push(&s_ent_slabs, slab)) {
+        free(slab);
+        return false;
+    }
+
+    for(int i = CONFIG_ENTITY_SLAB_SZ - 1; i >= 0; i--) {
+        struct ent_slot *slot = (struct ent_slot*)(slab + i * slot_size);
+        slot->next_free = s_ent_free_head;
+        s_ent_free_head = slot;
+    }
+    return true;
+}
+
+static struct entity *al_ent_alloc(void)
+{
+    if(!s_ent_free_head && !al_ent_slab_grow())
+        return NULL;
+
+    struct ent_slot *ret = s_ent_free_head;
+    s_ent_free_head = ret->next_free;
+    return (struct entity*)ret;
+}
+
+static void al_ent_release(struct entity *ent)
+{
+    struct ent_slot *slot = (struct ent_slot*)ent;
+    slot->next_free = s_ent_free_head;
+    s_ent_free_head = slot;
+}
+
+static unsigned char *al_read_file(const char *path, size_t *out_size)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return NULL;
+
+    const Sint64 fsize = SDL_RWsize(stream);
+    unsigned char *ret = (fsize > 0) ? malloc(fsize) : NULL;
+    if(!ret) {
+        SDL_RWclose(stream);
+        return NULL;
+    }
+
+    Sint64 read, read_total = 0;
+    while(read_total < fsize) {
+        read = SDL_RWread(stream, ret + read_total, 1, fsize - read_total);
+        if(read == 0)
+            break;
+        read_total += read;
+    }
+    SDL_RWclose(stream);
+
+    if(read_total != fsize) {
+        free(ret);
+        return NULL;
+    }
+    *out_size = fsize;
+    return ret;
+}
+
+static uint64_t al_fnv1a(const unsigned char *data, size_t size)
+{
+    uint64_t ret = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size; i++) {
+        ret ^= data[i];
+        ret *= 0x100000001b3ULL;
+    }
+    return ret;
+}
+
+static struct map *al_map_from_cooked(const char *path, uint64_t src_hash)
+{
+    struct map *ret;
+    struct pfmap_hdr header;
+    size_t size;
+
+    unsigned char *data = al_read_file(path, &size);
+    if(!data)
+        goto fail_read;
+
+    if(!M_AL_CookedHeader(data, size, &header))
+        goto fail_parse;
+
+    if(((struct pfmap_bin_hdr*)data)->src_hash != src_hash)
+        goto fail_parse;
+
+    ret = malloc(M_AL_BuffSizeFromHeader(&header));
+    if(!ret)
+        goto fail_alloc;
+
+    if(!M_AL_InitMapFromCooked(data, ret))
+        goto fail_init;
+
+    return ret;
+
+fail_init:
+    free(ret);
+fail_alloc:
+fail_parse:
+    free(data);
+fail_read:
+    return NULL;
+}
+
+static bool al_load_text(const char *pfobj_path, struct load_result *out)
+{
+    SDL_RWops *stream = SDL_RWFromFile(pfobj_path, "r");
+    if(!stream)
+        goto fail_stream; 
+
+    if(!al_parse_pfobj_header(stream, &out->header))
+        goto fail_parse;
+
+    if(!out->header.has_collision) {
+        fprintf(stderr, "Imported entities required to have bounding boxes.\n");
+        goto fail_parse;
+    }
+
+    size_t mats_size = ALIGNED(out->header.num_materials * sizeof(struct pfobj_bin_material), 
+        PFOBJ_BIN_ALIGN);
+    out->vert_size = R_AL_VertSize(&out->header);
+    out->buff = malloc(MAX(mats_size + out->header.num_verts * out->vert_size, 1));
+    if(!out->buff)
+        goto fail_parse;
+
+    out->mats = out->buff;
+    out->verts = (char*)out->buff + mats_size;
+
+    if(!R_AL_ParseStream(&out->header, stream, out->buff, (char*)out->buff + mats_size))
+        goto fail_render;
+
+    out->anim_private = A_AL_PrivFromStream(&out->header, stream);
+    if(!out->anim_private)
+        goto fail_render;
+
+    if(!AL_ParseAABB(stream, &out->aabb))
+        goto fail_aabb;
+
+    SDL_RWclose(stream);
+    return true;
+
+fail_aabb:
+    A_AL_FreePrivate(out->anim_private);
+fail_render:
+    free(out->buff);
+fail_parse:
+    SDL_RWclose(stream);
+fail_stream:
+    return false;
+}
+
+static bool al_section_valid(size_t size, uint32_t off, size_t len)
+{
+    return (off % PFOBJ_BIN_ALIGN == 0) && off <= size && len <= size - off;
+}
+
+/* The cooked binary file sits next to the text one and is loaded in its' 
+ * place when present. Being laid out the way the engine keeps the data, 
+ * it takes no parsing; the sections are handed off to the render and 
+ * animation loaders directly from the file buffer. */
+static bool al_load_binary(const char *pfobj_path, struct load_result *out)
+{
+    char bin_path[512 + sizeof(".bin")];
+    strcpy(bin_path, pfobj_path);
+    strcat(bin_path, ".bin");
+
+    size_t size;
+    unsigned char *data = al_read_file(bin_path, &size);
+    if(!data)
+        return false;
+
+    const struct pfobj_bin_hdr *hdr = (void*)data;
+    if(size < sizeof(struct pfobj_bin_hdr)
+    || memcmp(hdr->magic, PFOBJ_BIN_MAGIC, sizeof(hdr->magic))
+    || hdr->version != PFOBJ_BIN_VERSION
+    || hdr->num_as > MAX_ANIM_SETS
+    || !hdr->has_collision)
+        goto fail_parse;
+
+    if(!al_section_valid(size, hdr->verts_off, (size_t)hdr->num_verts * hdr->vert_size)
+    || !al_section_valid(size, hdr->materials_off, hdr->num_materials * sizeof(struct pfobj_bin_material))
+    || !al_section_valid(size, hdr->joints_off, hdr->num_joints * sizeof(struct pfobj_bin_joint))
+    || !al_section_valid(size, hdr->clips_off, 0)
+    || !al_section_valid(size, hdr->aabb_off, sizeof(struct aabb))
+    || hdr->aabb_off < hdr->clips_off)
+        goto fail_parse;
+
+    out->header = (struct pfobj_hdr){
+        .version        = PFOBJ_BIN_VERSION,
+        .num_verts      = hdr->num_verts,
+        .num_joints     = hdr->num_joints,
+        .num_materials  = hdr->num_materials,
+        .num_as         = hdr->num_as,
+        .has_collision  = true,
+    };
+    for(int i = 0; i < hdr->num_as; i++) {
+        out->header.frame_counts[i] = hdr->frame_counts[i];
+    }
+
+    /* The vertices are uploaded as they are, so they must have been cooked 
+     * for the vertex format that the engine uses for the model. */
+    if(hdr->vert_size != R_AL_VertSize(&out->header))
+        goto fail_parse;
+
+    out->anim_private = A_AL_PrivFromBinary(&out->header, (void*)(data + hdr->joints_off),
+        data + hdr->clips_off, hdr->aabb_off - hdr->clips_off);
+    if(!out->anim_private)
+        goto fail_parse;
+
+    out->mats = (void*)(data + hdr->materials_off);
+    out->verts = data + hdr->verts_off;
+    out->vert_size = hdr->vert_size;
+    memcpy(&out->aabb, data + hdr->aabb_off, sizeof(struct aabb));
+    out->buff = data;
+    return true;
+
+fail_parse:
+    fprintf(stderr, "Ignoring malformed or stale cooked model: %s\n", bin_path);
+    free(data);
+    return false;
+}
+
+static void al_load(const char *base_path, const char *pfobj_name, struct load_result *out)
+{
+    char pfobj_path[512];
+    assert( strlen(base_path) + strlen(pfobj_name) + 1 < sizeof(pfobj_path) );
+    strcpy(pfobj_path, base_path);
+    strcat(pfobj_path, "/");
+    strcat(pfobj_path, pfobj_name);
+
+    out->ok = al_load_binary(pfobj_path, out) 
+           || al_load_text(pfobj_path, out);
+}
+
+/* Runs on a worker thread */
+static void al_load_job(void *arg)
+{
+    struct load_request *req = arg;
+    al_load(req->base_path, req->key, &req->result);
+}
+
+static struct shared_resource *al_cached(const char *pfobj_name)
+{
+    khiter_t k = kh_get(entity_res, s_name_resource_table, pfobj_name);
+    if(k == kh_end(s_name_resource_table))
+        return NULL;
+    return kh_value(s_name_resource_table, k);
+}
+
+/* Sets up the loaded PF Object for rendering and caches it. The result is 
+ * consumed either way. If the resource got cached in the meantime (ex. by
+ * an earlier request for the same object), that copy is kept instead. */
+static struct shared_resource *al_commit(const char *base_path, const char *pfobj_name, 
+                                         struct load_result *result)
+{
+    struct shared_resource *ret = al_cached(pfobj_name);
+    if(ret || !result->ok)
+        goto out;
+
+    ret = malloc(sizeof(struct shared_resource));
+    if(!ret)
+        goto out;
+
+    ret->render_private = R_AL_PrivFromBinary(base_path, &result->header, 
+        result->mats, result->verts, result->vert_size);
+    if(!ret->render_private) {
+        free(ret);
+        ret = NULL;
+        goto out;
+    }
+
+    assert(strlen(pfobj_name) < sizeof(ret->key));
+    strcpy(ret->key, pfobj_name);
+    ret->anim_private = A_AL_SharePrivate(result->anim_private);
+    ret->aabb = result->aabb;
+    ret->refcount = 1;
+    ret->ent_flags = 0;
+
+    /* Entities with no animation sets are considered static. The palettes
+     * of the clips are uploaded as they get baked. The animation data may 
+     * be shared with a model that has already played some of them. */
+    if(result->header.num_as > 0) {
+
+        size_t npalettes;
+        const mat4x4_t *palettes = A_AL_BakedPalettes(ret->anim_private, &npalettes);
+        R_AL_InitAnimPalettes(ret->render_private, NULL, npalettes);
+
+        for(int i = 0; i < result->header.num_as; i++) {
+
+            size_t offset, count;
+            if(A_AL_ClipPalettes(ret->anim_private, i, &offset, &count))
+                R_AL_UpdateAnimPalettes(ret->render_private, palettes, offset, count);
+        }
+        ret->ent_flags |= ENTITY_FLAG_ANIMATED;
+    }
+    ret->ent_flags |= ENTITY_FLAG_COLLISION;
+
+    int put_ret;
+    khiter_t k = kh_put(entity_res, s_name_resource_table, ret->key, &put_ret);
+    assert(put_ret != -1 && put_ret != 0);
+    kh_value(s_name_resource_table, k) = ret;
+
+    k = kh_put(priv_res, s_priv_resource_table, (uintptr_t)ret->render_private, &put_ret);
+    assert(put_ret != -1 && put_ret != 0);
+    kh_value(s_priv_resource_table, k) = ret;
+
+    free(result->buff);
+    return ret;
+
+out:
+    if(result->ok) {
+        A_AL_FreePrivate(result->anim_private);
+        free(result->buff);
+    }
+    return ret;
+}
+
+static void al_request_commit(struct load_request *req)
+{
+    assert(req->status == AL_PENDING);
+    req->status = al_commit(req->base_path, req->key, &req->result) ? AL_READY : AL_FAILED;
+}
+
+static int al_request_idx(al_ticket_t ticket)
+{
+    for(int i = 0; i < vec_size(&s_requests); i++) {
+        if(vec_AT(&s_requests, i)->ticket == ticket)
+            return i;
+    }
+    return -1;
+}
+
+static struct load_request *al_pending_request(const char *pfobj_name)
+{
+    for(int i = 0; i < vec_size(&s_requests); i++) {
+        struct load_request *curr = vec_AT(&s_requests, i);
+        if(curr->status == AL_PENDING && 0 == strcmp(curr->key, pfobj_name))
+            return curr;
+    }
+    return NULL;
+}
+
+static struct shared_resource *al_get_resource(const char *base_path, const char *pfobj_name)
+{
+    struct shared_resource *ret = al_cached(pfobj_name);
+    if(ret)
+        return ret;
+
+    /* Rather than loading the object a second time, finish the load that's 
+     * already in flight */
+    struct load_request *req = al_pending_request(pfobj_name);
+    if(req) {
+        Sched_Wait(&req->ctr);
+        al_request_commit(req);
+        return al_cached(pfobj_name);
+    }
+
+    struct load_result result;
+    al_load(base_path, pfobj_name, &result);
+    return al_commit(base_path, pfobj_name, &result);
+}
+
+static void al_release(struct shared_resource *res)
+{
+    assert(res->refcount > 0);
+    if(--res->refcount > 0)
+        return;
+
+    khiter_t k = kh_get(priv_res, s_priv_resource_table, (uintptr_t)res->render_private);
+    assert(k != kh_end(s_priv_resource_table));
+    kh_del(priv_res, s_priv_resource_table, k);
+
+    /* The animation data holds the skinning palettes, which the render 
+     * thread reads from until the render data is freed. */
+    R_AL_FreePrivate(res->render_private);
+    res->dead_frame = g_frame_idx;
+    vec_res_push(&s_dead, res);
+}
+
+static void al_free_dead(bool all)
+{
+    for(int i = vec_size(&s_dead) - 1; i >= 0; i--) {
+
+        struct shared_resource *curr = vec_AT(&s_dead, i);
+        if(!all && g_frame_idx <= curr->dead_frame + CONFIG_RENDER_FRAME_LATENCY)
+            continue;
+
+        A_AL_FreePrivate(curr->anim_private);
+        free(curr);
+        vec_res_del(&s_dead, i);
+    }
 }
 
 /*****************************************************************************/
@@ -208,105 +677,186 @@ static void al_set_ent_defaults(struct entity *ent)
 
 struct entity *AL_EntityFromPFObj(const char *base_path, const char *pfobj_name, const char *name)
 {
-    struct shared_resource res;
-    SDL_RWops *stream;
+    if(strlen(name) >= sizeof(((struct entity*)0)->name))
+        goto fail_args;
+    if(strlen(pfobj_name) >= sizeof(((struct entity*)0)->filename))
+        goto fail_args;
 
-    size_t alloc_size = sizeof(struct entity) + A_AL_CtxBuffSize();
-    struct entity *ret = malloc(alloc_size);
+    struct entity *ret = al_ent_alloc();
     if(!ret)
         goto fail_alloc;
 
     al_set_ent_defaults(ret);
     ret->anim_ctx = (void*)(ret + 1);
 
-    if(strlen(name) >= sizeof(ret->name))
-        return NULL;
-    strcpy(ret->name, name);
-
-    if(strlen(name) >= sizeof(ret->name))
-        return NULL;
     strcpy(ret->name, name);
-
-    if(strlen(pfobj_name) >= sizeof(ret->filename))
-        return NULL;
     strcpy(ret->filename, pfobj_name);
 
     assert(strlen(base_path) < sizeof(ret->basedir));
     strcpy(ret->basedir, base_path);
-    strcpy(res.key, pfobj_name);
 
-    khiter_t k = kh_get(entity_res, s_name_resource_table, pfobj_name);
-    if(k != kh_end(s_name_resource_table)) {
+    struct shared_resource *res = al_get_resource(base_path, pfobj_name);
+    if(!res)
+        goto fail_load;
+    res->refcount++;
 
-        res = kh_value(s_name_resource_table, k);
-    }else{
+    ret->flags |= res->ent_flags;
+    ret->render_private = res->render_private;
+    ret->anim_private = res->anim_private;
+    ret->identity_aabb = res->aabb;
+    ret->uid = Entity_NewUID();
 
-        struct pfobj_hdr header;
+    return ret;
 
-        char pfobj_path[256];
-        assert( strlen(base_path) + strlen(pfobj_name) + 1 < sizeof(pfobj_path) );
-        strcpy(pfobj_path, base_path);
-        strcat(pfobj_path, "/");
-        strcat(pfobj_path, pfobj_name);
+fail_load:
+    al_ent_release(ret);
+fail_alloc:
+fail_args:
+    return NULL;
+}
 
-        stream = SDL_RWFromFile(pfobj_path, "r");
-        if(!stream)
-            goto fail_stream; 
+size_t AL_EntitiesFromTemplate(const struct entity *tmpl, size_t count, struct entity **out)
+{
+    khiter_t k = kh_get(priv_res, s_priv_resource_table, (uintptr_t)tmpl->render_private);
+    if(k == kh_end(s_priv_resource_table))
+        return 0;
+    struct shared_resource *res = kh_value(s_priv_resource_table, k);
+
+    const size_t ctx_size = A_AL_CtxBuffSize();
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+
+        struct entity *curr = al_ent_alloc();
+        if(!curr)
+            break;
+
+        memcpy(curr, tmpl, sizeof(struct entity));
+        memcpy(curr + 1, tmpl->anim_ctx, ctx_size);
+        curr->anim_ctx = (void*)(curr + 1);
+        curr->uid = Entity_NewUID();
+        curr->slot = 0;
+        curr->script_obj = NULL;
+        curr->flags &= ~ENTITY_FLAG_ZOMBIE;
+        Entity_InvalidateModel(curr);
+        out[i] = curr;
+    }
 
-        if(!al_parse_pfobj_header(stream, &header))
-            goto fail_parse;
+    res->refcount += i;
+    return i;
+}
 
-        res.ent_flags = 0;
-        res.render_private = R_AL_PrivFromStream(base_path, &header, stream);
-        if(!res.render_private)
-            goto fail_parse;
+void AL_EntityFree(struct entity *entity)
+{
+    khiter_t k = kh_get(priv_res, s_priv_resource_table, (uintptr_t)entity->render_private);
+    if(k != kh_end(s_priv_resource_table)) {
+        al_release(kh_value(s_priv_resource_table, k));
+    }
+    al_ent_release(entity);
+}
 
-        res.anim_private = A_AL_PrivFromStream(&header, stream);
-        if(!res.anim_private)
-            goto fail_parse;
+al_ticket_t AL_EntityLoadAsync(const char *base_path, const char *pfobj_name)
+{
+    struct load_request *req = malloc(sizeof(struct load_request));
+    if(!req)
+        goto fail_alloc;
 
-        /* Entities with no animation sets are considered static. */
-        if(header.num_as > 0) {
-            res.ent_flags |= ENTITY_FLAG_ANIMATED;
-        }
+    if(strlen(pfobj_name) >= sizeof(req->key)
+    || strlen(base_path) >= sizeof(req->base_path))
+        goto fail_args;
 
-        if(!header.has_collision) {
-            fprintf(stderr, "Imported entities required to have bounding boxes.\n");
-            goto fail_parse;
-        }
+    strcpy(req->key, pfobj_name);
+    strcpy(req->base_path, base_path);
+    req->ticket = s_next_ticket++;
+    req->released = false;
+    req->status = AL_PENDING;
 
-        res.ent_flags |= ENTITY_FLAG_COLLISION;
-        if(!AL_ParseAABB(stream, &res.aabb))
-            goto fail_parse;
+    if(!vec_req_push(&s_requests, req))
+        goto fail_args;
 
-        SDL_RWclose(stream);
+    if(al_cached(pfobj_name)) {
+        req->status = AL_READY;
+        return req->ticket;
+    }
+
+    struct job job = (struct job){al_load_job, req};
+    Sched_Submit(&job, 1, &req->ctr);
+    return req->ticket;
+
+fail_args:
+    free(req);
+fail_alloc:
+    return AL_TICKET_INVALID;
+}
+
+enum al_status AL_LoadStatus(al_ticket_t ticket)
+{
+    int idx = al_request_idx(ticket);
+    if(idx < 0)
+        return AL_FAILED;
 
-        int put_ret;
-        k = kh_put(entity_res, s_name_resource_table, pfobj_name, &put_ret);
-        assert(put_ret != -1 && put_ret != 0);
-        kh_value(s_name_resource_table, k) = res;
-        kh_update_str_keys(s_name_resource_table);
+    struct load_request *req = vec_AT(&s_requests, idx);
+    if(req->status == AL_PENDING && Sched_Done(&req->ctr)) {
+        al_request_commit(req);
     }
+    return req->status;
+}
 
-    ret->flags |= res.ent_flags;
-    ret->render_private = res.render_private;
-    ret->anim_private = res.anim_private;
-    ret->identity_aabb = res.aabb;
-    ret->uid = Entity_NewUID();
+void AL_LoadRelease(al_ticket_t ticket)
+{
+    int idx = al_request_idx(ticket);
+    if(idx < 0)
+        return;
 
-    return ret;
+    struct load_request *req = vec_AT(&s_requests, idx);
+    req->released = true;
 
-fail_parse:
-    SDL_RWclose(stream);
-fail_stream:
-    free(ret);
-fail_alloc:
-    return NULL;
+    if(req->status != AL_PENDING) {
+        vec_req_del(&s_requests, idx);
+        free(req);
+    }
 }
 
-void AL_EntityFree(struct entity *entity)
+bool AL_EntityUnload(const char *pfobj_name)
 {
-    free(entity);
+    khiter_t k = kh_get(entity_res, s_name_resource_table, pfobj_name);
+    if(k == kh_end(s_name_resource_table))
+        return false;
+
+    struct shared_resource *res = kh_value(s_name_resource_table, k);
+    kh_del(entity_res, s_name_resource_table, k);
+    al_release(res);
+    return true;
+}
+
+void AL_Update(void)
+{
+    for(int i = vec_size(&s_requests) - 1; i >= 0; i--) {
+
+        struct load_request *curr = vec_AT(&s_requests, i);
+        if(curr->status == AL_PENDING && Sched_Done(&curr->ctr)) {
+            al_request_commit(curr);
+        }
+
+        if(curr->released && curr->status != AL_PENDING) {
+            vec_req_del(&s_requests, i);
+            free(curr);
+        }
+    }
+    al_free_dead(false);
+}
+
+void AL_UpdateAnimPalettes(const void *anim_private, size_t offset, size_t count)
+{
+    size_t npalettes;
+    const mat4x4_t *palettes = A_AL_BakedPalettes(anim_private, &npalettes);
+    assert(offset + count <= npalettes);
+
+    struct shared_resource *curr;
+    kh_foreach_value(s_priv_resource_table, curr, {
+        if(curr->anim_private == anim_private)
+            R_AL_UpdateAnimPalettes(curr->render_private, palettes, offset, count);
+    });
 }
 
 struct map *AL_MapFromPFMap(const char *base_path, const char *pfmap_name)
@@ -320,19 +870,47 @@ struct map *AL_MapFromPFMap(const char *base_path, const char *pfmap_name)
     strcat(pfmap_path, "/");
     strcat(pfmap_path, pfmap_name);
 
-    stream = SDL_RWFromFile(pfmap_path, "r");
-    if(!stream)
+    size_t text_size;
+    unsigned char *text = al_read_file(pfmap_path, &text_size);
+    if(!text)
         goto fail_open;
 
+    /* The cache is optional - it's fine if it doesn't exist or is stale */
+    char navcache_path[256];
+    AL_MapNavCachePath(base_path, pfmap_name, navcache_path, sizeof(navcache_path));
+    M_NavLoadCache(navcache_path);
+
+    /* The cooked map is likewise optional and gets (re-)written whenever 
+     * it's missing or doesn't match the text file. */
+    const uint64_t hash = al_fnv1a(text, text_size);
+    char cooked_path[256];
+    snprintf(cooked_path, sizeof(cooked_path), "%s/%s.bin", base_path, pfmap_name);
+    cooked_path[sizeof(cooked_path)-1] = '\0';
+
+    ret = al_map_from_cooked(cooked_path, hash);
+    if(ret) {
+        free(text);
+        return ret;
+    }
+
+    stream = SDL_RWFromConstMem(text, text_size);
+    if(!stream)
+        goto fail_stream;
+
     ret = al_map_from_stream(base_path, stream);
     if(!ret)
         goto fail_parse;
 
+    M_AL_WriteCooked(ret, hash, cooked_path);
+
     SDL_RWclose(stream);
+    free(text);
     return ret;
 
 fail_parse:
     SDL_RWclose(stream);
+fail_stream:
+    free(text);
 fail_open:
     return NULL;
 }
@@ -355,6 +933,13 @@ fail_parse:
     return NULL;
 }
 
+void AL_MapNavCachePath(const char *base_path, const char *pfmap_name, 
+                        char *out, size_t size)
+{
+    snprintf(out, size, "%s/%s.navcache", base_path, pfmap_name);
+    out[size-1] = '\0';
+}
+
 size_t AL_MapShallowCopySize(const char *base_path, const char *pfmap_name)
 {
     SDL_RWops *stream;
@@ -449,11 +1034,61 @@ fail:
 bool AL_Init(void)
 {
     s_name_resource_table = kh_init(entity_res);
-    return (s_name_resource_table != NULL);
+    if(!s_name_resource_table)
+        goto fail_name_table;
+
+    s_priv_resource_table = kh_init(priv_res);
+    if(!s_priv_resource_table)
+        goto fail_priv_table;
+
+    if(!A_AL_Init())
+        goto fail_anim;
+
+    vec_req_init(&s_requests);
+    vec_res_init(&s_dead);
+    vec_slab_init(&s_ent_slabs);
+    s_ent_free_head = NULL;
+    return true;
+
+fail_anim:
+    kh_destroy(priv_res, s_priv_resource_table);
+fail_priv_table:
+    kh_destroy(entity_res, s_name_resource_table);
+fail_name_table:
+    return false;
 }
 
 void AL_Shutdown(void)
 {
+    /* The worker threads have been shut down already, so all the jobs 
+     * have run to completion. The render data is left to go down with 
+     * the GL context. */
+    for(int i = 0; i < vec_size(&s_requests); i++) {
+
+        struct load_request *curr = vec_AT(&s_requests, i);
+        if(curr->status == AL_PENDING && curr->result.ok) {
+            A_AL_FreePrivate(curr->result.anim_private);
+            free(curr->result.buff);
+        }
+        free(curr);
+    }
+    vec_req_destroy(&s_requests);
+
+    struct shared_resource *curr;
+    kh_foreach_value(s_priv_resource_table, curr, {
+        A_AL_FreePrivate(curr->anim_private);
+        free(curr);
+    });
+    al_free_dead(true);
+    vec_res_destroy(&s_dead);
+
+    for(int i = 0; i < vec_size(&s_ent_slabs); i++)
+        free(vec_AT(&s_ent_slabs, i));
+    vec_slab_destroy(&s_ent_slabs);
+    s_ent_free_head = NULL;
+
+    kh_destroy(priv_res, s_priv_resource_table);
     kh_destroy(entity_res, s_name_resource_table);
+    A_AL_Shutdown();
 }
 
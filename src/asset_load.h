@@ -38,6 +38,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <SDL.h> /* for SDL_RWops */
 
@@ -66,6 +67,75 @@ struct pfobj_hdr{
     bool     has_collision;
 };
 
+/* ---------------------------------------------------------------------------
+ * Binary PF Object format, cooked offline from the text format by 
+ * 'scripts/io_scene_pfobj/pfobj_binary.py' and loaded in its' place when 
+ * present. All values are little-endian. Every section starts at a 16-byte
+ * aligned offset from the start of the file, so that the file can be used
+ * in place once it is in memory. The sections are:
+ *
+ *   verts     - 'num_verts' vertices, already in the GPU vertex format
+ *               ('vert_size' bytes each)
+ *   materials - struct pfobj_bin_material[num_materials]
+ *   joints    - struct pfobj_bin_joint[num_joints]
+ *   clips     - for each of the 'num_as' clips, a struct pfobj_bin_clip, 
+ *               followed by struct pfobj_bin_key[num_frames * num_joints] 
+ *               (frame-major) and, if 'has_collision' is set, by the 6 
+ *               floats of a struct aabb for each frame. The next clip 
+ *               starts at the following 16-byte aligned offset.
+ *   aabb      - the 6 floats of the entity's struct aabb
+ * ---------------------------------------------------------------------------
+ */
+
+#define PFOBJ_BIN_MAGIC    "PFOB"
+#define PFOBJ_BIN_VERSION  1
+#define PFOBJ_BIN_ALIGN    16
+
+struct pfobj_bin_hdr{
+    char     magic[4];
+    uint32_t version;
+    uint32_t num_verts;
+    uint32_t num_joints;
+    uint32_t num_materials;
+    uint32_t num_as;
+    uint32_t frame_counts[MAX_ANIM_SETS];
+    uint32_t has_collision;
+    uint32_t vert_size;
+    uint32_t verts_off;
+    uint32_t materials_off;
+    uint32_t joints_off;
+    uint32_t clips_off;
+    uint32_t aabb_off;
+    uint32_t pad[3];
+};
+
+struct pfobj_bin_material{
+    float    ambient;
+    float    diffuse[3];
+    float    specular[3];
+    char     texname[32];
+};
+
+/* Laid out the same way as a 'struct SQT' */
+struct pfobj_bin_key{
+    float    scale[3];
+    float    rot[4];    /* x, y, z, w */
+    float    trans[3];
+};
+
+struct pfobj_bin_joint{
+    char     name[32];
+    int32_t  parent_idx; /* -1 for the root */
+    struct pfobj_bin_key bind;
+    float    tip[3];
+};
+
+struct pfobj_bin_clip{
+    char     name[32];
+    uint32_t num_frames;
+    uint32_t pad[3];
+};
+
 struct pfmap_hdr{
     float    version;
     unsigned num_materials;
@@ -73,18 +143,93 @@ struct pfmap_hdr{
     unsigned num_cols;
 };
 
+/* ---------------------------------------------------------------------------
+ * Cooked PF Map format. The engine writes it next to a text PF Map after 
+ * loading it, and loads it in place of the text file for as long as the two
+ * match. It holds the tiles and the final terrain vertices of every chunk, in
+ * the engine's own layout, so it is only valid for the build that wrote it. 
+ * Every section starts at a 16-byte aligned offset:
+ *
+ *   materials - char[num_materials][256] texture names
+ *   chunks    - struct pfmap_bin_chunk[num_rows * num_cols], in row-major 
+ *               order, locating the sections of each chunk:
+ *   (tiles)   - struct tile[TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH]
+ *   (verts)   - 'chunk_verts_size' bytes (see R_AL_CookChunk)
+ * ---------------------------------------------------------------------------
+ */
+
+#define PFMAP_BIN_MAGIC    "PFMB"
+#define PFMAP_BIN_VERSION  2
+#define PFMAP_BIN_ALIGN    16
+
+struct pfmap_bin_hdr{
+    char     magic[4];
+    uint32_t version;
+    uint64_t src_hash;          /* of the text file it was cooked from */
+    uint32_t size;
+    uint32_t num_rows;
+    uint32_t num_cols;
+    uint32_t num_materials;
+    uint32_t tile_size;
+    uint32_t chunk_verts_size;
+    uint32_t materials_off;
+    uint32_t chunks_off;
+};
+
+struct pfmap_bin_chunk{
+    uint32_t tiles_off;
+    uint32_t verts_off;
+};
+
+
+typedef uint32_t al_ticket_t;
+
+enum al_status{
+    AL_PENDING,
+    AL_READY,
+    AL_FAILED,
+};
+
+#define AL_TICKET_INVALID (0)
 
 bool           AL_Init(void);
 void           AL_Shutdown(void);
+/* Sets up the objects which have finished loading in the background and
+ * frees the ones that are no longer used. Called once per frame. */
+void           AL_Update(void);
 
+/* The loaded PF Objects are shared by all the entities created from them and
+ * stay cached until they are explicitly unloaded. Unloading drops them from
+ * the cache; they are freed once the last entity using them is freed. */
 struct entity *AL_EntityFromPFObj(const char *base_path, const char *pfobj_name, const char *name);
+/* Makes 'count' copies of an existing entity, sharing its' loaded PF Object, 
+ * each with a UID of its' own. Returns the number of entities written to 'out', 
+ * which is less than 'count' only when running out of memory. */
+size_t         AL_EntitiesFromTemplate(const struct entity *tmpl, size_t count, struct entity **out);
 void           AL_EntityFree(struct entity *entity);
+bool           AL_EntityUnload(const char *pfobj_name);
+
+/* Starts loading a PF Object on the worker threads, so that creating the
+ * first entity from it doesn't stall. The returned ticket is polled with 
+ * 'AL_LoadStatus' and must be released with 'AL_LoadRelease'. The object 
+ * is set up for rendering on the main thread, once the status is polled or 
+ * on the next 'AL_Update'. */
+al_ticket_t    AL_EntityLoadAsync(const char *base_path, const char *pfobj_name);
+enum al_status AL_LoadStatus(al_ticket_t ticket);
+void           AL_LoadRelease(al_ticket_t ticket);
+
+/* Uploads the newly baked palettes of an animation clip for every loaded 
+ * model that shares the animation data. */
+void           AL_UpdateAnimPalettes(const void *anim_private, size_t offset, size_t count);
 
 struct map    *AL_MapFromPFMap(const char *base_path, const char *pfmap_name);
 struct map    *AL_MapFromPFMapString(const char *str);
 void           AL_MapFree(struct map *map);
 size_t         AL_MapShallowCopySize(const char *base_path, const char *pfmap_name);
 size_t         AL_MapShallowCopySizeStr(const char *str);
+/* Path of the side file holding cached navigation data for a PFMap */
+void           AL_MapNavCachePath(const char *base_path, const char *pfmap_name, 
+                                  char *out, size_t size);
 
 bool           AL_ReadLine(SDL_RWops *stream, char *outbuff);
 bool           AL_ParseAABB(SDL_RWops *stream, struct aabb *out);
@@ -60,10 +60,25 @@ struct camera {
 
     uint32_t prev_frame_ts;
 
+    /* The position at the last 'Camera_TickFinishPerspective' and the 
+     * smoothed velocity since, in worldspace units per millisecond */
+    vec3_t   prev_pos;
+    vec3_t   velocity;
+
     /* When 'bounded' is true, the camera position must 
      * always be within the 'bounds' box */
     bool            bounded;
     struct bound_box bounds;
+
+    /* Derived state computed once by 'Camera_TickFinishPerspective'. It 
+     * is dropped as soon as the camera is changed and ignored after the 
+     * drawable is resized. */
+    bool            snap_valid;
+    int             snap_w, snap_h;
+    mat4x4_t        snap_view;
+    mat4x4_t        snap_proj;
+    mat4x4_t        snap_view_proj;
+    struct frustum  snap_frustum;
 };
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -96,6 +111,69 @@ static void camera_move_within_bounds(struct camera *cam)
     cam->pos.z = MIN(cam->pos.z, cam->bounds.z + cam->bounds.h);
 }
 
+static bool camera_snap_current(const struct camera *cam)
+{
+    if(!cam->snap_valid)
+        return false;
+
+    int w, h;
+    Engine_WinDrawableSize(&w, &h);
+    return (w == cam->snap_w && h == cam->snap_h);
+}
+
+static void camera_view_mat(const struct camera *cam, mat4x4_t *out)
+{
+    vec3_t target;
+    PFM_Vec3_Add((vec3_t*)&cam->pos, (vec3_t*)&cam->front, &target);
+    PFM_Mat4x4_MakeLookAt((vec3_t*)&cam->pos, &target, (vec3_t*)&cam->up, out);
+}
+
+static void camera_proj_mat(int w, int h, mat4x4_t *out)
+{
+    PFM_Mat4x4_MakePerspective(CAM_FOV_RAD, ((GLfloat)w)/h, 0.1f, CONFIG_DRAWDIST, out);
+}
+
+static void camera_frustum(const struct camera *cam, int w, int h, struct frustum *out)
+{
+    const float aspect_ratio = ((float)w)/h;
+    C_MakeFrustum(cam->pos, cam->up, cam->front, aspect_ratio, CAM_FOV_RAD, 
+        CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, out);
+}
+
+static void camera_take_snapshot(struct camera *cam, const mat4x4_t *view, int w, int h)
+{
+    cam->snap_view = *view;
+    camera_proj_mat(w, h, &cam->snap_proj);
+    PFM_Mat4x4_Mult4x4(&cam->snap_proj, &cam->snap_view, &cam->snap_view_proj);
+    camera_frustum(cam, w, h, &cam->snap_frustum);
+
+    cam->snap_w = w;
+    cam->snap_h = h;
+    cam->snap_valid = true;
+}
+
+static void camera_update_velocity(struct camera *cam)
+{
+    uint32_t curr = SDL_GetTicks();
+    uint32_t tdelta = curr - cam->prev_frame_ts;
+
+    vec3_t delta;
+    PFM_Vec3_Sub(&cam->pos, &cam->prev_pos, &delta);
+    cam->prev_pos = cam->pos;
+
+    /* Jumps, such as from clicking on the minimap, are not movement */
+    if(!cam->prev_frame_ts || tdelta == 0
+    || PFM_Vec3_Len(&delta) > 2.0f * cam->speed * tdelta) {
+        cam->velocity = (vec3_t){0.0f, 0.0f, 0.0f};
+        return;
+    }
+
+    vec3_t curr_vel;
+    PFM_Vec3_Scale(&delta, 1.0f / tdelta, &curr_vel);
+    PFM_Vec3_Add(&cam->velocity, &curr_vel, &cam->velocity);
+    PFM_Vec3_Scale(&cam->velocity, 0.5f, &cam->velocity);
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -116,6 +194,7 @@ void Camera_Free(struct camera *cam)
 
 void Camera_SetPos(struct camera *cam, vec3_t pos)
 {
+    cam->snap_valid = false;
     cam->pos = pos; 
 
     assert(!cam->bounded || camera_pos_in_bounds(cam));
@@ -123,6 +202,7 @@ void Camera_SetPos(struct camera *cam, vec3_t pos)
 
 void Camera_SetDir(struct camera *cam, vec3_t dir)
 {
+    cam->snap_valid = false;
     PFM_Vec3_Normal(&dir, &dir);
     cam->front = dir;
 
@@ -142,6 +222,7 @@ vec3_t Camera_GetDir(const struct camera *cam)
 
 void Camera_SetPitchAndYaw(struct camera *cam, float pitch, float yaw)
 {
+    cam->snap_valid = false;
     cam->pitch = pitch;
     cam->yaw = yaw;
 
@@ -189,6 +270,7 @@ vec3_t Camera_GetPos(const struct camera *cam)
 
 void Camera_MoveLeftTick(struct camera *cam)
 {
+    cam->snap_valid = false;
     uint32_t tdelta;
     vec3_t   vdelta, right;
     
@@ -210,6 +292,7 @@ void Camera_MoveLeftTick(struct camera *cam)
 
 void Camera_MoveRightTick(struct camera *cam)
 {
+    cam->snap_valid = false;
     uint32_t tdelta;
     vec3_t   vdelta, right;
     
@@ -231,6 +314,7 @@ void Camera_MoveRightTick(struct camera *cam)
 
 void Camera_MoveFrontTick(struct camera *cam)
 {
+    cam->snap_valid = false;
     uint32_t tdelta;
     vec3_t   vdelta;
     
@@ -249,6 +333,7 @@ void Camera_MoveFrontTick(struct camera *cam)
 
 void Camera_MoveBackTick(struct camera *cam)
 {
+    cam->snap_valid = false;
     uint32_t tdelta;
     vec3_t   vdelta;
     
@@ -267,6 +352,7 @@ void Camera_MoveBackTick(struct camera *cam)
 
 void Camera_MoveDirectionTick(struct camera *cam, vec3_t dir)
 {
+    cam->snap_valid = false;
     uint32_t tdelta;
     vec3_t   vdelta;
 
@@ -291,6 +377,7 @@ void Camera_MoveDirectionTick(struct camera *cam, vec3_t dir)
 
 void Camera_ChangeDirection(struct camera *cam, int dx, int dy)
 {
+    cam->snap_valid = false;
     float sdx = dx * cam->sensitivity; 
     float sdy = dy * cam->sensitivity;
 
@@ -341,12 +428,19 @@ void Camera_TickFinishPerspective(struct camera *cam)
         .args = { R_PushArg(&proj, sizeof(proj)) },
     });
 
+    /* The camera is final for this frame - derive everything the other 
+     * subsystems will ask for once. Copies of the camera (such as the 
+     * one handed to the render thread) carry the snapshot with them. */
+    camera_take_snapshot(cam, &view, w, h);
+    camera_update_velocity(cam);
+
     /* Update our last timestamp */
     cam->prev_frame_ts = SDL_GetTicks();
 }
 
 void Camera_TickFinishOrthographic(struct camera *cam, vec2_t bot_left, vec2_t top_right)
 {
+    cam->snap_valid = false;
     mat4x4_t view, proj;
 
     /* Set the view matrix for the vertex shader */
@@ -377,6 +471,7 @@ void Camera_TickFinishOrthographic(struct camera *cam, vec2_t bot_left, vec2_t t
 
 void Camera_RestrictPosWithBox(struct camera *cam, struct bound_box box)
 {
+    cam->snap_valid = false;
     cam->bounded = true;
     cam->bounds = box;
 
@@ -397,25 +492,74 @@ bool Camera_PosIsRestricted(const struct camera *cam)
 
 void Camera_MakeViewMat(const struct camera *cam, mat4x4_t *out)
 {
-    vec3_t target;
-    PFM_Vec3_Add((vec3_t*)&cam->pos, (vec3_t*)&cam->front, &target);
-    PFM_Mat4x4_MakeLookAt((vec3_t*)&cam->pos, &target, (vec3_t*)&cam->up, out);
+    if(cam->snap_valid) {
+        *out = cam->snap_view;
+        return;
+    }
+    camera_view_mat(cam, out);
 }
 
 void Camera_MakeProjMat(const struct camera *cam, mat4x4_t *out)
 {
+    if(camera_snap_current(cam)) {
+        *out = cam->snap_proj;
+        return;
+    }
     int w, h;
     Engine_WinDrawableSize(&w, &h);
-    PFM_Mat4x4_MakePerspective(CAM_FOV_RAD, ((GLfloat)w)/h, 0.1f, CONFIG_DRAWDIST, out);
+    camera_proj_mat(w, h, out);
+}
+
+void Camera_MakeViewProjMat(const struct camera *cam, mat4x4_t *out)
+{
+    if(camera_snap_current(cam)) {
+        *out = cam->snap_view_proj;
+        return;
+    }
+    mat4x4_t view, proj;
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, out);
 }
 
 void Camera_MakeFrustum(const struct camera *cam, struct frustum *out)
+{
+    if(camera_snap_current(cam)) {
+        *out = cam->snap_frustum;
+        return;
+    }
+    int w, h;
+    Engine_WinDrawableSize(&w, &h);
+    camera_frustum(cam, w, h, out);
+}
+
+vec3_t Camera_GetVelocity(const struct camera *cam)
+{
+    return cam->velocity;
+}
+
+vec3_t Camera_PredictPos(const struct camera *cam, uint32_t ahead_ms)
+{
+    vec3_t delta, ret;
+    PFM_Vec3_Scale((vec3_t*)&cam->velocity, ahead_ms, &delta);
+    PFM_Vec3_Add((vec3_t*)&cam->pos, &delta, &ret);
+
+    if(cam->bounded) {
+        ret.x = MIN(ret.x, cam->bounds.x);
+        ret.x = MAX(ret.x, cam->bounds.x - cam->bounds.w);
+        ret.z = MAX(ret.z, cam->bounds.z);
+        ret.z = MIN(ret.z, cam->bounds.z + cam->bounds.h);
+    }
+    return ret;
+}
+
+void Camera_MakePredictedFrustum(const struct camera *cam, uint32_t ahead_ms, struct frustum *out)
 {
     int w, h;
     Engine_WinDrawableSize(&w, &h);
     const float aspect_ratio = ((float)w)/h;
 
-    C_MakeFrustum(cam->pos, cam->up, cam->front, aspect_ratio, CAM_FOV_RAD, 
-        CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, out);
+    C_MakeFrustum(Camera_PredictPos(cam, ahead_ms), cam->up, cam->front, aspect_ratio, 
+        CAM_FOV_RAD, CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, out);
 }
 
@@ -71,6 +71,11 @@ vec3_t         Camera_GetPos       (const struct camera *cam);
 
 void           Camera_MakeViewMat  (const struct camera *cam, mat4x4_t *out);
 void           Camera_MakeProjMat  (const struct camera *cam, mat4x4_t *out);
+/* proj * view. Like the view and projection matrices and the frustum, this 
+ * is served from the snapshot taken by the last 'Camera_TickFinishPerspective' 
+ * while the camera is unchanged since. 
+ */
+void           Camera_MakeViewProjMat(const struct camera *cam, mat4x4_t *out);
 
 void           Camera_RestrictPosWithBox(struct camera *cam, struct bound_box box);
 void           Camera_UnrestrictPos     (struct camera *cam);
@@ -94,4 +99,12 @@ void           Camera_TickFinishOrthographic(struct camera *cam, vec2_t bot_left
 
 void           Camera_MakeFrustum(const struct camera *cam, struct frustum *out);
 
+/* The velocity is measured between consecutive 'Camera_TickFinishPerspective' 
+ * calls, in worldspace units per millisecond. The predicted position assumes 
+ * the camera keeps moving at it for 'ahead_ms'. */
+vec3_t         Camera_GetVelocity(const struct camera *cam);
+vec3_t         Camera_PredictPos(const struct camera *cam, uint32_t ahead_ms);
+void           Camera_MakePredictedFrustum(const struct camera *cam, uint32_t ahead_ms, 
+                                           struct frustum *out);
+
 #endif
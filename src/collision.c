@@ -36,6 +36,13 @@
 #include "collision.h"
 #include <assert.h>
 #include <float.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #define MAX(a, b)     ((a) > (b) ? (a) : (b))
@@ -51,11 +58,52 @@
 
 #define EPSILON (1.0f / 1000000.0f)
 
+#if defined(__AVX__)
+
+#define SIMD_WIDTH      (8)
+typedef __m256 vfloat;
+
+#define VF_LOAD(p)      _mm256_loadu_ps(p)
+#define VF_SET1(x)      _mm256_set1_ps(x)
+#define VF_ADD(a, b)    _mm256_add_ps(a, b)
+#define VF_SUB(a, b)    _mm256_sub_ps(a, b)
+#define VF_MUL(a, b)    _mm256_mul_ps(a, b)
+#define VF_ABS(a)       _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+#define VF_LT(a, b)     _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_GE(a, b)     _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define VF_MOVEMASK(a)  _mm256_movemask_ps(a)
+
+#elif defined(__SSE__)
+
+#define SIMD_WIDTH      (4)
+typedef __m128 vfloat;
+
+#define VF_LOAD(p)      _mm_loadu_ps(p)
+#define VF_SET1(x)      _mm_set1_ps(x)
+#define VF_ADD(a, b)    _mm_add_ps(a, b)
+#define VF_SUB(a, b)    _mm_sub_ps(a, b)
+#define VF_MUL(a, b)    _mm_mul_ps(a, b)
+#define VF_ABS(a)       _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define VF_LT(a, b)     _mm_cmplt_ps(a, b)
+#define VF_GE(a, b)     _mm_cmpge_ps(a, b)
+#define VF_MOVEMASK(a)  _mm_movemask_ps(a)
+
+#else
+
+#define SIMD_WIDTH      (1)
+
+#endif
+
 
 struct range{
     float begin, end;
 };
 
+/* A frustum plane in the form of (n . x) = d */
+struct batch_plane{
+    float nx, ny, nz, d;
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -212,6 +260,130 @@ static bool separating_axis_exists(vec3_t axis, const struct frustum *frustum, c
     return !ranges_overlap(&frust_range, &cuboid_range);
 }
 
+static void frustum_batch_planes(const struct frustum *frustum, struct batch_plane out[static 6])
+{
+    const struct plane *planes[] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                    &frustum->right, &frustum->near, &frustum->far};
+
+    for(int i = 0; i < ARR_SIZE(planes); i++) {
+
+        const vec3_t *n = &planes[i]->normal;
+        out[i] = (struct batch_plane){
+            n->x, n->y, n->z,
+            PFM_Vec3_Dot((vec3_t*)n, (vec3_t*)&planes[i]->point)
+        };
+    }
+}
+
+/* A box is outside a plane when the corner furthest along the normal, at the 
+ * distance of the box's projected radius from the center, is outside of it. 
+ * Likewise, it is inside when the nearest corner is. 'axes' is NULL for 
+ * axis-aligned boxes. */
+static void frusta_batch_test(const struct frustum *const frusta[], uint32_t fmask, 
+                              const float *const center[3], const float *const axes[3][3], 
+                              const float *const half_lengths[3], size_t count, 
+                              uint32_t *out_visible, uint32_t *out_inside)
+{
+    memset(out_visible, 0, count * sizeof(uint32_t));
+    if(out_inside) {
+        memset(out_inside, 0, count * sizeof(uint32_t));
+    }
+
+    for(int f = 0; f < 32; f++) {
+
+        if(!(fmask & (1u << f)))
+            continue;
+
+        struct batch_plane planes[6];
+        frustum_batch_planes(frusta[f], planes);
+        size_t i = 0;
+
+#if SIMD_WIDTH > 1
+        for(; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+
+            vfloat cx = VF_LOAD(center[0] + i);
+            vfloat cy = VF_LOAD(center[1] + i);
+            vfloat cz = VF_LOAD(center[2] + i);
+            vfloat ex = VF_LOAD(half_lengths[0] + i);
+            vfloat ey = VF_LOAD(half_lengths[1] + i);
+            vfloat ez = VF_LOAD(half_lengths[2] + i);
+            vfloat zero = VF_SET1(0.0f);
+
+            int out_bits = 0;
+            int in_bits = (1 << SIMD_WIDTH) - 1;
+
+            for(int p = 0; p < ARR_SIZE(planes); p++) {
+
+                vfloat nx = VF_SET1(planes[p].nx);
+                vfloat ny = VF_SET1(planes[p].ny);
+                vfloat nz = VF_SET1(planes[p].nz);
+
+                vfloat dist = VF_SUB(VF_ADD(VF_ADD(VF_MUL(cx, nx), VF_MUL(cy, ny)), VF_MUL(cz, nz)), 
+                                     VF_SET1(planes[p].d));
+                vfloat radius;
+
+                if(axes) {
+
+                    vfloat proj[3];
+                    for(int j = 0; j < 3; j++) {
+                        vfloat dot = VF_ADD(VF_ADD(
+                            VF_MUL(VF_LOAD(axes[j][0] + i), nx), 
+                            VF_MUL(VF_LOAD(axes[j][1] + i), ny)), 
+                            VF_MUL(VF_LOAD(axes[j][2] + i), nz));
+                        proj[j] = VF_ABS(dot);
+                    }
+                    radius = VF_ADD(VF_ADD(VF_MUL(ex, proj[0]), VF_MUL(ey, proj[1])), VF_MUL(ez, proj[2]));
+                }else{
+                    radius = VF_ADD(VF_ADD(VF_MUL(ex, VF_ABS(nx)), VF_MUL(ey, VF_ABS(ny))), VF_MUL(ez, VF_ABS(nz)));
+                }
+
+                out_bits |= VF_MOVEMASK(VF_LT(VF_ADD(dist, radius), zero));
+                in_bits &= VF_MOVEMASK(VF_GE(VF_SUB(dist, radius), zero));
+            }
+
+            for(int lane = 0; lane < SIMD_WIDTH; lane++) {
+
+                if(!(out_bits & (1 << lane)))
+                    out_visible[i + lane] |= (1u << f);
+                if(out_inside && (in_bits & (1 << lane)))
+                    out_inside[i + lane] |= (1u << f);
+            }
+        }
+#endif
+
+        for(; i < count; i++) {
+
+            bool out = false, in = true;
+            for(int p = 0; p < ARR_SIZE(planes); p++) {
+
+                const struct batch_plane *pl = &planes[p];
+                float dist = center[0][i] * pl->nx + center[1][i] * pl->ny + center[2][i] * pl->nz - pl->d;
+                float radius;
+
+                if(axes) {
+                    radius = 0.0f;
+                    for(int j = 0; j < 3; j++) {
+                        float dot = axes[j][0][i] * pl->nx + axes[j][1][i] * pl->ny + axes[j][2][i] * pl->nz;
+                        radius += half_lengths[j][i] * fabsf(dot);
+                    }
+                }else{
+                    radius = half_lengths[0][i] * fabsf(pl->nx) 
+                           + half_lengths[1][i] * fabsf(pl->ny) 
+                           + half_lengths[2][i] * fabsf(pl->nz);
+                }
+
+                out = out || (dist + radius < 0.0f);
+                in = in && (dist - radius >= 0.0f);
+            }
+
+            if(!out)
+                out_visible[i] |= (1u << f);
+            if(out_inside && in)
+                out_inside[i] |= (1u << f);
+        }
+    }
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -528,6 +700,22 @@ enum volume_intersec_type C_FrustumOBBIntersectionFast(const struct frustum *fru
     return VOLUME_INTERSEC_INSIDE;
 }
 
+void C_FrustaOBBIntersectionBatch(const struct frustum *const frusta[], uint32_t fmask, 
+                                  const struct obb_batch *obbs, size_t count, 
+                                  uint32_t *out_visible, uint32_t *out_inside)
+{
+    frusta_batch_test(frusta, fmask, obbs->center, obbs->axes, obbs->half_lengths, 
+        count, out_visible, out_inside);
+}
+
+void C_FrustaAABBIntersectionBatch(const struct frustum *const frusta[], uint32_t fmask, 
+                                   const struct aabb_batch *aabbs, size_t count, 
+                                   uint32_t *out_visible, uint32_t *out_inside)
+{
+    frusta_batch_test(frusta, fmask, aabbs->center, NULL, aabbs->half_lengths, 
+        count, out_visible, out_inside);
+}
+
 bool C_FrustumAABBIntersectionExact(const struct frustum *frustum, const struct aabb *aabb)
 {
     vec3_t aabb_axes[3] = {
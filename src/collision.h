@@ -38,6 +38,8 @@
 
 #include "pf_math.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct aabb{
     float x_min, x_max;
@@ -73,6 +75,21 @@ enum volume_intersec_type{
     VOLUME_INTERSEC_INTERSECTION,
 };
 
+/* Structure-of-arrays views of a batch of boxes, for the batched frustum 
+ * tests. Every array holds one component of the boxes, so that they can be 
+ * loaded several boxes at a time. 'axes[i][k]' is the k-th (x, y or z) 
+ * component of the i-th axis. */
+struct obb_batch{
+    const float *center[3];
+    const float *axes[3][3];
+    const float *half_lengths[3];
+};
+
+struct aabb_batch{
+    const float *center[3];
+    const float *half_lengths[3];
+};
+
 void C_MakeFrustum(vec3_t pos, vec3_t up, vec3_t front, 
                    GLfloat aspect_ratio, GLfloat fov_rad, 
                    GLfloat near_dist, GLfloat far_dist,
@@ -90,6 +107,18 @@ enum volume_intersec_type C_FrustumPointIntersectionFast(const struct frustum *f
 enum volume_intersec_type C_FrustumAABBIntersectionFast (const struct frustum *frustum, const struct aabb *aabb);
 enum volume_intersec_type C_FrustumOBBIntersectionFast  (const struct frustum *frustum, const struct obb *obb);
 
+/* Batched versions of the fast tests, which test each of the 'count' boxes against every 
+ * frustum with its' bit set in 'fmask'. Bit i of 'out_visible[j]' is set when box j is 
+ * not entirely outside 'frusta[i]', and of 'out_inside[j]' (which may be NULL) when the 
+ * box is entirely inside of it. The boxes are tested against all the planes, so these 
+ * give fewer false positives than the single-box tests. */
+void C_FrustaOBBIntersectionBatch (const struct frustum *const frusta[], uint32_t fmask, 
+                                   const struct obb_batch *obbs, size_t count, 
+                                   uint32_t *out_visible, uint32_t *out_inside);
+void C_FrustaAABBIntersectionBatch(const struct frustum *const frusta[], uint32_t fmask, 
+                                   const struct aabb_batch *aabbs, size_t count, 
+                                   uint32_t *out_visible, uint32_t *out_inside);
+
 bool C_FrustumAABBIntersectionExact(const struct frustum *frustum, const struct aabb *aabb);
 bool C_FrustumOBBIntersectionExact(const struct frustum *frustum, const struct obb *obb);
 
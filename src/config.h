@@ -45,24 +45,287 @@
 #define CONFIG_LOADING_SCREEN       "assets/loading_screens/battle_of_kulikovo.png"
 
 #define CONFIG_SHADOW_MAP_RES       (2048)
-/* Determines the draw distance from the light source when creating the
- * shadow map. Note that a higher drawdistance leads to more peterpanning.
+/* The maximum distance from the camera at which shadows are drawn. The
+ * view frustum up to this distance is split between the shadow cascades.
  */
 #define CONFIG_SHADOW_DRAWDIST      (1536)
-/* This is the half-width of the light source's frustum, in OpenGL coordinates.
- * Increasing the FOV results in lower-quality shadows for the same shadow map 
- * resolution. However, the light frustum needs to be sufficiently large to 
- * contain all shadow casters visible by the RTS camera.
+/* The number of shadow map cascades, each of which gets its own 
+ * CONFIG_SHADOW_MAP_RES layer. No more than 4 are supported.
  */
-#define CONFIG_SHADOW_FOV           (160)
+#define CONFIG_SHADOW_CASCADES      (3)
+/* Cascades starting at this index only contain the terrain and static 
+ * entities. They are cached between frames and only re-rendered when 
+ * the light or camera moves far enough or when their contents change.
+ */
+#define CONFIG_SHADOW_FIRST_CACHED  (2)
+/* The fraction of a cached cascade's radius by which it is enlarged, so
+ * that it still covers its slice after the camera moves a bit.
+ */
+#define CONFIG_SHADOW_CACHE_SLACK   (0.25f)
+/* Skin the animated entities which are drawn in more than one pass (ex. 
+ * the camera and the shadow passes) only once per frame, with transform 
+ * feedback, and draw the skinned vertices in all of the passes.
+ */
+#define CONFIG_PRESKIN              (1)
+/* Keep the static, non-animated, non-selectable and non-combatable entities 
+ * (trees, rocks, ...) in a GPU-resident instance buffer which is culled by a 
+ * compute shader every pass, instead of walking and batching them on the 
+ * CPU. Requires OpenGL 4.3 - the normal path is used when it is missing.
+ */
+#define CONFIG_GPU_SCENERY          (1)
+/* The point lights are binned into a grid of clusters which splits the 
+ * camera's view frustum into X by Y tiles on screen and Z slices in depth 
+ * (exponentially spaced). Every fragment only shades the lights of its' 
+ * cluster. No more than CONFIG_MAX_POINT_LIGHTS lights are drawn.
+ */
+#define CONFIG_LIGHT_GRID_X         (16)
+#define CONFIG_LIGHT_GRID_Y         (9)
+#define CONFIG_LIGHT_GRID_Z         (24)
+#define CONFIG_MAX_POINT_LIGHTS     (1024)
+/* Models with at least CONFIG_ENTITY_LOD_MIN_VERTS vertices get up to 
+ * CONFIG_ENTITY_LODS decimated meshes, generated at load time by merging 
+ * the vertices in every cell of a grid of CONFIG_ENTITY_LOD_GRID cells along 
+ * the model's longest side (halved for each next level). An entity is drawn 
+ * with the first one once it covers less than CONFIG_ENTITY_LOD_SCREEN_SIZE 
+ * of the screen's height and with each next one at half of that. The static 
+ * entities always cast shadows with the coarsest one. 0 disables the LODs.
+ */
+#define CONFIG_ENTITY_LODS          (2)
+#define CONFIG_ENTITY_LOD_MIN_VERTS (300)
+#define CONFIG_ENTITY_LOD_GRID      (24)
+#define CONFIG_ENTITY_LOD_SCREEN_SIZE (0.15f)
+/* The textures of the entities' materials are packed into layers of texture 
+ * arrays shared with all the other textures of the same size, so that the 
+ * meshes in the same array need only one texture binding between them. 
+ * Every array takes up to CONFIG_MATERIAL_ATLAS_BYTES of video memory. 
+ * Models whose textures differ in size, or are only available cooked, keep 
+ * their' textures separate.
+ */
+#define CONFIG_MATERIAL_ATLAS       (1)
+#define CONFIG_MATERIAL_ATLAS_BYTES (16 * 1024 * 1024)
+
+/* The size of each of the regions of the ring buffer holding the vertices 
+ * of the immediate-style draws. The data uploaded by a single draw must fit 
+ * in one region.
+ */
+#define CONFIG_STREAM_REGION_SZ     (1024 * 1024)
+
+/* The render thread time that may be spent uploading textures which have 
+ * finished decoding in the background, per frame, in microseconds. 
+ */
+#define CONFIG_TEX_UPLOAD_BUDGET_US (2000)
+
+/* How far ahead the camera's movement is extrapolated to find the terrain 
+ * chunks which are about to come into view, in milliseconds. Their meshes 
+ * get created ahead of time, within the per-frame render thread budget.
+ */
+#define CONFIG_CAM_PREFETCH_MS      (300)
+#define CONFIG_PREFETCH_BUDGET_US   (1000)
+
+/* The depth buffer is reduced to a grid of maximum depths no wider than 
+ * this, which is read back for the occlusion culling of the next frames.
+ */
+#define CONFIG_HIZ_MAX_WIDTH        (128)
+
+/* The lowest fraction of the window resolution that the 3D scene may be 
+ * rendered at when the dynamic resolution is on. The scale moves in steps 
+ * of CONFIG_DYNRES_STEP, so that the render targets sized by the viewport 
+ * are not re-created every frame.
+ */
+#define CONFIG_DYNRES_MIN_SCALE     (0.5f)
+#define CONFIG_DYNRES_STEP          (1.0f/16.0f)
+
+/* Entities are allocated from slabs holding this many of them each, which 
+ * are only returned to the system on shutdown.
+ */
+#define CONFIG_ENTITY_SLAB_SZ       (256)
 
 #define CONFIG_SETTINGS_FILENAME    "pf.conf"
+#define CONFIG_SHADER_CACHE_FILENAME "pf.shadercache"
 
 #define CONFIG_LOS_CACHE_SZ         (512)
 #define CONFIG_FLOW_CAHCE_SZ        (512)
 #define CONFIG_MAPPING_CACHE_SZ     (512)
 #define CONFIG_GRID_PATH_CACHE_SZ   (8192)
+/* The number of enemy-seeking fields which can be repaired incrementally */
+#define CONFIG_ENEMY_FIELD_CACHE_SZ (64)
+/* The number of portal paths kept for regenerating evicted path fields */
+#define CONFIG_PORTAL_PATH_CACHE_SZ (1024)
+
+/* When set, the field caches favor keeping entries which took longer 
+ * to compute, instead of evicting them purely in LRU order. 
+ */
+#define CONFIG_FIELD_CACHE_COST_AWARE (1)
+
+/* The field cache stats history holds the last CONFIG_FC_HISTORY_LEN windows, 
+ * each spanning CONFIG_FC_HISTORY_WINDOW navigation updates. 
+ */
+#define CONFIG_FC_HISTORY_LEN       (60)
+#define CONFIG_FC_HISTORY_WINDOW    (60)
+
+/* When set, integration fields are computed by repeated vectorized sweeps
+ * over the chunk instead of a priority queue-driven wavefront. The result
+ * is identical, but the memory access pattern is much friendlier. Off 
+ * until it has been measured against the wavefront with the nav benchmark.
+ */
+#define CONFIG_NAV_SWEEP_INTEGRATION (0)
+
+/* When set, LOS fields are propagated one whole ring of the wavefront at a
+ * time using 64-bit row masks, instead of tile-by-tile from a priority queue.
+ */
+#define CONFIG_NAV_BITSET_LOS        (1)
+
+/* When set, the wavefront expansions over the tiles of a chunk are driven by 
+ * a monotone bucket queue keyed on integer costs, instead of a binary heap.
+ */
+#define CONFIG_NAV_BUCKET_QUEUE      (1)
+
+/* When set, a chunk whose tiles only became impassable during a nav update
+ * keeps the cached fields that never lead through the changed region, instead 
+ * of dropping all the fields at the chunk.
+ */
+#define CONFIG_NAV_PARTIAL_INVALIDATION (1)
+
+/* When set, the duration of every A* search, integration field sweep, flow 
+ * field derivation and LOS field propagation is reported to the hook set 
+ * with 'N_SetPhaseHook'. Enabled by the nav benchmark build.
+ */
+#ifndef CONFIG_NAV_PHASE_TIMES
+#define CONFIG_NAV_PHASE_TIMES       (0)
+#endif
+
+/* The number of navigation field tiles along each side of a chunk. It must
+ * be a multiple of the number of terrain tiles along a chunk side and can be
+ * at most 64, as the field rows are processed as 64-bit masks. Coarser fields 
+ * (32) halve the per-field memory and integration work for maps with large 
+ * open areas, at the cost of the precision of pathing around obstacles. 
+ * Set with 'make NAV_FIELD_RES=<res>'.
+ */
+#ifndef CONFIG_NAV_FIELD_RES
+#define CONFIG_NAV_FIELD_RES         (64)
+#endif
+
+/* When set, and the context supports compute shaders (OpenGL 4.3), the flow
+ * fields of asynchronous path requests needing at least CONFIG_NAV_GPU_MIN_FIELDS
+ * fields are generated on the GPU. The CPU remains the fallback.
+ */
+#define CONFIG_NAV_GPU_FIELDS        (1)
+#define CONFIG_NAV_GPU_MIN_FIELDS    (8)
+
+/* Chunks further than this many chunks away from the camera, and more than 
+ * one chunk away from any unit, release their GPU meshes and their portal 
+ * travel index. Both are built again from the map data when next needed.
+ * Set to 0 to keep all chunks resident for the lifetime of the map.
+ */
+#define CONFIG_CHUNK_RESIDENCY_RADIUS (4)
+
+/* Upper bound on the number of worker threads used for offloading 
+ * CPU-bound work (ex. flow field generation) from the main thread. 
+ */
+#define CONFIG_SCHED_MAX_WORKERS    (8)
+
+/* When set, the new velocities of the moving entities are computed on the
+ * worker threads during the movement tick. 
+ */
+#define CONFIG_MOVE_PARALLEL_VELOCITY (1)
+
+/* When set, an entity's last ClearPath velocity is reused for a few ticks 
+ * while its' neighbourhood and desired velocity remain the same.
+ */
+#define CONFIG_MOVE_COHERENCE_CACHE   (1)
+
+/* When set, moving entities away from the camera and from any enemies 
+ * are simulated at a reduced rate, using only the flow field for steering.
+ */
+#define CONFIG_MOVE_LOD               (1)
+
+/* When set, off-screen members of large flocks are steered by a coarse
+ * density field of all the moving entities instead of by ClearPath, once
+ * at least CONFIG_MOVE_CROWD_THRESHOLD entities are moving at once. 
+ */
+#define CONFIG_MOVE_CROWD             (1)
+#define CONFIG_MOVE_CROWD_THRESHOLD   (256)
+
+/* When set, ClearPath finds the permissible velocities by intersecting all
+ * pairs of velocity obstacle sides and testing each point against all the 
+ * obstacles. This is much slower and only kept as a reference for validation.
+ */
+#define CONFIG_CLEARPATH_REFERENCE    (0)
+
+/* When set, the per-entity movement state table is kept in a Swiss table 
+ * instead of a khash map. Entity UIDs are handed out in order, which 
+ * khash's identity hashing maps to distinct buckets, so khash remains 
+ * faster at lookups. The Swiss table is faster at insertion and removal.
+ */
+#define CONFIG_SWISS_STATE_TABLES     (0)
+
+/* The number of frames the main thread may run ahead of the render thread. 
+ * With 1, the main thread simulates a frame while the previous one is being 
+ * rendered. Higher values let either thread absorb a slow frame without 
+ * stalling the other, at the cost of input latency and a render workspace 
+ * (and map snapshot) per extra frame.
+ */
+#define CONFIG_RENDER_FRAME_LATENCY   (1)
+
+/* The maximum number of asynchronous path requests that are planned (and 
+ * handed off to the worker threads) per frame. 
+ */
+#define CONFIG_NAV_ASYNC_PLANS_PER_FRAME (16)
+
+/* When precomputing the fields for a destination, paths are made from all
+ * chunks within this many chunks of it.
+ */
+#define CONFIG_NAV_PRECOMPUTE_RADIUS     (2)
+
+/* The number of events the event queue has room for at startup. 
+ */
+#define CONFIG_EVENT_QUEUE_SZ            (2048)
+
+/* What happens to events queued when the event queue is full: with 
+ * EVENT_OVERFLOW_GROW the queue is resized, with EVENT_OVERFLOW_DROP the 
+ * events destined to entities are dropped. This is the default of the 
+ * 'pf.game.event_queue_overflow' setting.
+ */
+#define CONFIG_EVENT_QUEUE_OVERFLOW      (EVENT_OVERFLOW_GROW)
+
+/* The most time (in milliseconds) script event handlers may take up in one 
+ * tick before the remaining events sent by scripts to entities are put off 
+ * until the next tick. 0 means there is no budget. 
+ */
+#define CONFIG_SCRIPT_TICK_BUDGET_MS     (0)
+
+/* The simulation runs at a fixed rate of 60 ticks per second. When a frame 
+ * takes longer than this many ticks, the simulation is slowed down instead 
+ * of running more ticks to catch up.
+ */
+#define CONFIG_SIM_MAX_TICKS_PER_FRAME   (4)
+
+/* Record the scope markers placed throughout the engine, so that they can
+ * be exported as a Chrome trace. When 0, the markers compile to nothing.
+ */
+#define CONFIG_PERF_TRACE                (1)
+#define CONFIG_PERF_DUMP_FRAMES          (120)
+#define CONFIG_PERF_DUMP_HOTKEY          (SDL_SCANCODE_F11)
+/* When a frame takes longer than the 'pf.video.spike_capture_ms' setting, 
+ * the trace of the frames leading up to it is written out automatically. 
+ * Captures never overlap, and there are at most CONFIG_PERF_SPIKE_MAX_CAPTURES 
+ * of them per session. 
+ */
+#define CONFIG_PERF_SPIKE_FRAMES         (60)
+#define CONFIG_PERF_SPIKE_MAX_CAPTURES   (16)
 
 #define CONFIG_FRAME_STEP_HOTKEY    (SDL_SCANCODE_SPACE)
 
+/* Keep count of the bytes held by each subsystem, as tagged through the 
+ * Mem_* wrappers. When 0, the allocation wrappers are plain calls to the C 
+ * library allocator and no counts are kept.
+ */
+#define CONFIG_MEM_ACCOUNTING            (1)
+
+/* Use the SSE/NEON implementation of the matrix products and inverse in 
+ * pf_math_simd.h instead of the scalar one. It is only used when the target 
+ * has one of these instruction sets. 
+ */
+#define CONFIG_PF_MATH_SIMD              (1)
+
 #endif
@@ -34,16 +34,17 @@
  */
 
 #include "entity.h" 
+#include "main.h"
 #include "game/public/game.h"
 #include "anim/public/anim.h"
 
 #include <assert.h>
 
 /*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
+/* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
+static void entity_make_model(const struct entity *ent, mat4x4_t *out)
 {
     mat4x4_t trans, scale, rot, tmp;
     vec3_t pos = G_Pos_Get(ent->uid);
@@ -56,6 +57,59 @@ void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
     PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
 }
 
+/* The render thread runs alongside the simulation, which owns the cache. 
+ * Anywhere else (the main thread, or workers it is waiting on, each with 
+ * its' own entities), a stale matrix is rebuilt in place. */
+static bool entity_may_update_cache(void)
+{
+    return (SDL_ThreadID() != g_render_thread_id);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
+{
+    if(!ent->model_dirty) {
+        *out = ent->model_cache;
+        return;
+    }
+
+    entity_make_model(ent, out);
+    if(!entity_may_update_cache())
+        return;
+
+    struct entity *mut = (struct entity*)ent;
+    mut->model_cache = *out;
+    mut->model_dirty = false;
+}
+
+void Entity_NormalMatrix(const struct entity *ent, mat4x4_t *out)
+{
+    if(!ent->normal_dirty) {
+        *out = ent->normal_cache;
+        return;
+    }
+
+    mat4x4_t model, inv_model;
+    Entity_ModelMatrix(ent, &model);
+    PFM_Mat4x4_Inverse(&model, &inv_model);
+    PFM_Mat4x4_Transpose(&inv_model, out);
+    if(!entity_may_update_cache())
+        return;
+
+    struct entity *mut = (struct entity*)ent;
+    mut->normal_cache = *out;
+    mut->normal_dirty = false;
+}
+
+void Entity_InvalidateModel(struct entity *ent)
+{
+    ent->model_dirty = true;
+    ent->normal_dirty = true;
+}
+
 uint32_t Entity_NewUID(void)
 {
     static uint32_t uid = 0;
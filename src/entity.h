@@ -71,32 +71,44 @@ struct entity{
     float        selection_radius; /* The radius of the selection circle in OpenGL coordinates */
     float        max_speed;        /* The base movement speed in units of OpenGL coords / second */
     int          faction_id;       /* The faction to which this entity belongs to. */
+    float        vision_range;     /* The range the entity reveals the fog of war in, 0 for none */
     int          max_hp;           /* 0 for 'invulnerable' entities */
+    /* The index of the entity's slot in the game's entity table. Only 
+     * meaningful while the entity is part of the game simulation. */
+    uint32_t     slot;
+    /* A borrowed reference to the scripting object wrapping this entity,
+     * or NULL if there is none. */
+    void        *script_obj;
+    /* The model matrix and its' inverse transpose, for transforming normals. 
+     * They are only rebuilt after the entity's position, rotation or scale 
+     * has changed. G_Pos_Set invalidates them, and Entity_InvalidateModel 
+     * must be called after writing 'rotation' or 'scale'. */
+    mat4x4_t     model_cache;
+    mat4x4_t     normal_cache;
+    bool         model_dirty;
+    bool         normal_dirty;
 };
 
-/* State needed for rendering a static entity */
-struct ent_stat_rstate{
-    void     *render_private;
-    mat4x4_t  model;
-};
-
-/* State needed for rendering an animated entity */
-struct ent_anim_rstate{
-    void           *render_private;
+/* State needed for rendering an entity into the passes set in 'passes'. 
+ * The animation state is only valid when 'palettes' is set, i.e. for the 
+ * animated entities. */
+struct ent_rstate{
+    void           *render_private; /* of the LOD to draw */
+    void           *shadow_private; /* of the LOD to cast shadows with */
+    uint32_t        passes;   /* DRAW_PASS_* mask */
     mat4x4_t        model;
+    mat4x4_t        normal;
     size_t          njoints;
-    const mat4x4_t *inv_bind_pose; /* static, use shallow copy */
-    mat4x4_t        curr_pose[MAX_JOINTS];
+    const mat4x4_t *palettes; /* static, the baked palettes of the model */
+    size_t          palette_offset;
+    size_t          next_palette_offset;
+    float           blend;
 };
 
-VEC_TYPE(rstat, struct ent_stat_rstate)
-VEC_IMPL(static inline, rstat, struct ent_stat_rstate)
-
-VEC_TYPE(ranim, struct ent_anim_rstate)
-VEC_IMPL(static inline, ranim, struct ent_anim_rstate)
-
 
 void     Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out);
+void     Entity_NormalMatrix(const struct entity *ent, mat4x4_t *out);
+void     Entity_InvalidateModel(struct entity *ent);
 uint32_t Entity_NewUID(void);
 void     Entity_CurrentOBB(const struct entity *ent, struct obb *out);
 vec3_t   Entity_TopCenterPointWS(const struct entity *ent);
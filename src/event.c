@@ -38,8 +38,13 @@
 #include "lib/public/vec.h"
 #include "lib/public/queue.h"
 #include "game/public/game.h"
+#include "config.h"
+#include "perf.h"
+
+#include <SDL.h>
 
 #include <assert.h>
+#include <string.h>
 
 
 enum handler_type{
@@ -71,10 +76,39 @@ struct event{
  */
 #define GLOBAL_ID (~((uint32_t)0))
 
+/* The entity events whose types fall in this range are filtered against 
+ * the bitmap of observed event types before being queued. 
+ */
+#define NUM_FILTERED_TYPES (0x30000)
+
 VEC_TYPE(hd, struct handler_desc)
 VEC_IMPL(static inline, hd, struct handler_desc)
 
+VEC_TYPE(uid, uint32_t)
+VEC_IMPL(static inline, uid, uint32_t)
+
+VEC_TYPE(sobj, script_opaque_t)
+VEC_IMPL(static inline, sobj, script_opaque_t)
+
+VEC_TYPE(type, enum eventtype)
+VEC_IMPL(static inline, type, enum eventtype)
+
+VEC_TYPE(event, struct event)
+VEC_IMPL(static inline, event, struct event)
+
+/* The script handlers that get all the events of one type delivered to 
+ * entities in a single call per tick, and the events collected so far 
+ * during this tick. */
+struct batch{
+    vec_hd_t   handlers;
+    vec_uid_t  receivers;
+    /* Owned references to the script representations of the event args */
+    vec_sobj_t args;
+};
+
 KHASH_MAP_INIT_INT64(handler_desc, vec_hd_t)
+KHASH_MAP_INIT_INT(count, int)
+KHASH_MAP_INIT_INT(batch, struct batch*)
 
 QUEUE_TYPE(event, struct event)
 QUEUE_IMPL(static, event, struct event)
@@ -85,6 +119,20 @@ QUEUE_IMPL(static, event, struct event)
 
 static khash_t(handler_desc) *s_event_handler_table;
 static queue(event)           s_event_queue;
+/* The number of entity handlers registered for each event type. An event 
+ * type's bit is set in the bitmap for as long as its' count is non-zero. 
+ */
+static khash_t(count)        *s_entity_handler_counts;
+static uint64_t               s_entity_observed[NUM_FILTERED_TYPES / 64];
+static enum event_overflow    s_overflow_policy = CONFIG_EVENT_QUEUE_OVERFLOW;
+static struct event_stats     s_stats;
+static khash_t(batch)        *s_batch_table;
+/* The event types which have had events collected for batched dispatch 
+ * during this tick, in the order of the first such event */
+static vec_type_t             s_batch_pending;
+/* The script handler time budget for a tick, in performance counter units */
+static uint64_t               s_script_budget;
+static vec_event_t            s_deferred;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -160,17 +208,159 @@ static bool e_unregister_handler(uint64_t key, struct handler_desc *desc)
     return true;
 }
 
+static void e_entity_observe(enum eventtype event, int delta)
+{
+    if(event < 0 || event >= NUM_FILTERED_TYPES)
+        return;
+
+    int ret;
+    khiter_t k = kh_put(count, s_entity_handler_counts, event, &ret);
+    if(ret == -1)
+        return;
+    if(ret != 0)
+        kh_value(s_entity_handler_counts, k) = 0;
+
+    int count = kh_value(s_entity_handler_counts, k) + delta;
+    assert(count >= 0);
+    kh_value(s_entity_handler_counts, k) = count;
+
+    if(count > 0)
+        s_entity_observed[event / 64] |= (((uint64_t)1) << (event % 64));
+    else
+        s_entity_observed[event / 64] &= ~(((uint64_t)1) << (event % 64));
+}
+
+static bool e_entity_observed(enum eventtype event)
+{
+    if(event < 0 || event >= NUM_FILTERED_TYPES)
+        return true;
+    return !!(s_entity_observed[event / 64] & (((uint64_t)1) << (event % 64)));
+}
+
+static void e_drop_event(struct event *event)
+{
+    if(event->source == ES_SCRIPT)
+        S_Release(event->arg);
+}
+
+static void e_queue_push(struct event *event)
+{
+    size_t cap = s_event_queue.capacity;
+    bool full = (queue_size(s_event_queue) == cap);
+
+    if(full && s_overflow_policy == EVENT_OVERFLOW_DROP && event->receiver_id != GLOBAL_ID) {
+        e_drop_event(event);
+        s_stats.dropped++;
+        return;
+    }
+
+    if(!queue_event_push(&s_event_queue, event)) {
+        e_drop_event(event);
+        s_stats.dropped++;
+        return;
+    }
+
+    if(s_event_queue.capacity != cap)
+        s_stats.resized++;
+
+    s_stats.queued++;
+    if(queue_size(s_event_queue) > s_stats.high_water)
+        s_stats.high_water = queue_size(s_event_queue);
+}
+
+static struct batch *e_batch_get(enum eventtype event)
+{
+    if(kh_size(s_batch_table) == 0)
+        return NULL;
+
+    khiter_t k = kh_get(batch, s_batch_table, event);
+    if(k == kh_end(s_batch_table))
+        return NULL;
+    return kh_value(s_batch_table, k);
+}
+
+static void e_batch_free(struct batch *batch)
+{
+    vec_hd_destroy(&batch->handlers);
+    vec_uid_destroy(&batch->receivers);
+    vec_sobj_destroy(&batch->args);
+    free(batch);
+}
+
+/* Returns true if ownership of the event arg has been taken by the batch */
+static bool e_batch_collect(struct event *event)
+{
+    struct batch *batch = e_batch_get(event->type);
+    if(!batch || vec_size(&batch->handlers) == 0)
+        return false;
+
+    if(vec_size(&batch->receivers) == 0)
+        vec_type_push(&s_batch_pending, event->type);
+
+    script_opaque_t arg = (event->source == ES_SCRIPT) ? event->arg
+                        : S_WrapEngineEventArg(event->type, event->arg);
+    vec_uid_push(&batch->receivers, event->receiver_id);
+    vec_sobj_push(&batch->args, arg);
+    return (event->source == ES_SCRIPT);
+}
+
+static void e_batch_dispatch(void)
+{
+    enum simstate ss = G_GetSimState();
+
+    /* The handlers may queue and register new events, so the table can change 
+     * from under us. Entries are only looked up by key. */
+    for(int i = 0; i < vec_size(&s_batch_pending); i++) {
+
+        struct batch *batch = e_batch_get(vec_AT(&s_batch_pending, i));
+        if(!batch)
+            continue;
+
+        size_t nevents = vec_size(&batch->receivers);
+        script_opaque_t list = S_BuildEventBatch(nevents, batch->receivers.array, batch->args.array);
+        vec_uid_reset(&batch->receivers);
+        vec_sobj_reset(&batch->args);
+
+        vec_hd_t handlers;
+        vec_hd_init(&handlers);
+        vec_hd_copy(&handlers, &batch->handlers);
+
+        for(int j = 0; j < vec_size(&handlers); j++) {
+        
+            struct handler_desc *elem = &vec_AT(&handlers, j);
+            if((elem->simmask & ss) == 0)
+                continue;
+            S_RunEventHandler(vec_AT(&s_batch_pending, i), elem->handler.as_script_callable, 
+                S_UnwrapIfWeakref(elem->user_arg), list);
+        }
+
+        vec_hd_destroy(&handlers);
+        S_Release(list);
+    }
+    vec_type_reset(&s_batch_pending);
+}
+
 static void e_handle_event(struct event event)
 {
     khiter_t k;
     uint64_t key = e_key(event.receiver_id, event.type);
     k = kh_get(handler_desc, s_event_handler_table, key);
     enum simstate ss = G_GetSimState();
+
+    bool batched = false;
+    if(event.receiver_id != GLOBAL_ID)
+        batched = e_batch_collect(&event);
     
-    if(k == kh_end(s_event_handler_table))
+    if(k == kh_end(s_event_handler_table)) {
+        if(event.source == ES_SCRIPT && !batched)
+            S_Release(event.arg);
         return; 
+    }
     
     vec_hd_t vec = kh_value(s_event_handler_table, k);
+    /* Engine args are wrapped once, for the first script handler, and the 
+     * wrapper is shared by all the others */
+    script_opaque_t wrapped = NULL;
 
     for(int i = 0; i < vec_size(&vec); i++) {
     
@@ -183,14 +373,19 @@ static void e_handle_event(struct event event)
             elem->handler.as_function(elem->user_arg, event.arg);
         }else if(elem->type == HANDLER_TYPE_SCRIPT) {
 
+            if(event.source != ES_SCRIPT && !wrapped)
+                wrapped = S_WrapEngineEventArg(event.type, event.arg);
+
             script_opaque_t script_arg = (event.source == ES_SCRIPT) ? S_UnwrapIfWeakref(event.arg)
-                : S_WrapEngineEventArg(event.type, event.arg);
+                                                                      : wrapped;
             assert(script_arg);
-            S_RunEventHandler(elem->handler.as_script_callable, S_UnwrapIfWeakref(elem->user_arg), script_arg);
+            S_RunEventHandler(event.type, elem->handler.as_script_callable, 
+                S_UnwrapIfWeakref(elem->user_arg), script_arg);
         }
     }
 
-    if(event.source == ES_SCRIPT)
+    S_Release(wrapped);
+    if(event.source == ES_SCRIPT && !batched)
         S_Release(event.arg);
 }
 
@@ -204,12 +399,30 @@ bool E_Init(void)
     if(!s_event_handler_table)
         goto fail_table;
 
-    if(!queue_event_init(&s_event_queue, 2048))
+    s_entity_handler_counts = kh_init(count);
+    if(!s_entity_handler_counts)
+        goto fail_counts;
+
+    s_batch_table = kh_init(batch);
+    if(!s_batch_table)
+        goto fail_batch;
+
+    if(!queue_event_init(&s_event_queue, CONFIG_EVENT_QUEUE_SZ))
         goto fail_queue;
 
+    vec_type_init(&s_batch_pending);
+    vec_event_init(&s_deferred);
+    E_SetScriptBudget(CONFIG_SCRIPT_TICK_BUDGET_MS);
+    memset(s_entity_observed, 0, sizeof(s_entity_observed));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_overflow_policy = CONFIG_EVENT_QUEUE_OVERFLOW;
     return true;
         
 fail_queue:
+    kh_destroy(batch, s_batch_table);
+fail_batch:
+    kh_destroy(count, s_entity_handler_counts);
+fail_counts:
     kh_destroy(handler_desc, s_event_handler_table);
 fail_table:
     return false;
@@ -228,22 +441,77 @@ void E_Shutdown(void)
     }
 
     kh_destroy(handler_desc, s_event_handler_table);
+    struct batch *batch;
+    kh_foreach_value(s_batch_table, batch, {
+        e_batch_free(batch);
+    });
+    kh_destroy(batch, s_batch_table);
+    vec_type_destroy(&s_batch_pending);
+    vec_event_destroy(&s_deferred);
+
+    kh_destroy(count, s_entity_handler_counts);
     queue_event_destroy(&s_event_queue);
 }
 
 void E_ServiceQueue(void)
 {
+    PERF_ENTER();
     e_handle_event( (struct event){EVENT_UPDATE_START, NULL, ES_ENGINE, GLOBAL_ID} );
 
+    s_stats.last_tick = queue_size(s_event_queue);
+    uint64_t script_start = S_EventHandlerTicks();
+
     struct event event;
     while(queue_event_pop(&s_event_queue, &event)) {
+
+        if(s_script_budget
+        && event.source == ES_SCRIPT
+        && event.receiver_id != GLOBAL_ID
+        && S_EventHandlerTicks() - script_start > s_script_budget) {
+
+            vec_event_push(&s_deferred, event);
+            s_stats.deferred++;
+            continue;
+        }
     
         e_handle_event(event);
         /* event arg already released */
     }
 
+    /* Deferred events go back in the queue ahead of the ones sent 
+     * during the rest of this tick */
+    for(int i = 0; i < vec_size(&s_deferred); i++) {
+        if(!queue_event_push(&s_event_queue, &vec_AT(&s_deferred, i))) {
+            e_drop_event(&vec_AT(&s_deferred, i));
+            s_stats.dropped++;
+        }
+    }
+    vec_event_reset(&s_deferred);
+
+    e_batch_dispatch();
+
     e_handle_event( (struct event){EVENT_UPDATE_UI,  NULL, ES_ENGINE, GLOBAL_ID} );
     e_handle_event( (struct event){EVENT_UPDATE_END, NULL, ES_ENGINE, GLOBAL_ID} );
+
+    s_stats.script_ms = (S_EventHandlerTicks() - script_start) * 1000.0 
+                      / SDL_GetPerformanceFrequency();
+    PERF_RETURN_VOID();
+}
+
+void E_SetScriptBudget(float ms)
+{
+    s_script_budget = ms * SDL_GetPerformanceFrequency() / 1000.0;
+}
+
+void E_SetOverflowPolicy(enum event_overflow policy)
+{
+    s_overflow_policy = policy;
+}
+
+void E_GetStats(struct event_stats *out)
+{
+    *out = s_stats;
+    out->capacity = s_event_queue.capacity;
 }
 
 /*
@@ -253,7 +521,7 @@ void E_ServiceQueue(void)
 void E_Global_Notify(enum eventtype event, void *event_arg, enum event_source source)
 {
     struct event e = (struct event){event, event_arg, source, GLOBAL_ID};
-    queue_event_push(&s_event_queue, &e);
+    e_queue_push(&e);
 }
 
 bool E_Global_Register(enum eventtype event, handler_t handler, void *user_arg, int simmask)
@@ -316,7 +584,10 @@ bool E_Entity_Register(enum eventtype event, uint32_t ent_uid, handler_t handler
     hd.user_arg = user_arg;
     hd.simmask = simmask;
 
-    return e_register_handler(e_key(ent_uid, event), &hd);
+    if(!e_register_handler(e_key(ent_uid, event), &hd))
+        return false;
+    e_entity_observe(event, +1);
+    return true;
 }
 
 bool E_Entity_Unregister(enum eventtype event, uint32_t ent_uid, handler_t handler)
@@ -325,7 +596,10 @@ bool E_Entity_Unregister(enum eventtype event, uint32_t ent_uid, handler_t handl
     hd.type = HANDLER_TYPE_ENGINE;
     hd.handler.as_function = handler;
 
-    return e_unregister_handler(e_key(ent_uid, event), &hd);
+    if(!e_unregister_handler(e_key(ent_uid, event), &hd))
+        return false;
+    e_entity_observe(event, -1);
+    return true;
 }
 
 bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid, 
@@ -337,7 +611,10 @@ bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid,
     hd.user_arg = user_arg;
     hd.simmask = simmask;
 
-    return e_register_handler(e_key(ent_uid, event), &hd);
+    if(!e_register_handler(e_key(ent_uid, event), &hd))
+        return false;
+    e_entity_observe(event, +1);
+    return true;
 }
 
 bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid, 
@@ -347,13 +624,83 @@ bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid,
     hd.type = HANDLER_TYPE_SCRIPT;
     hd.handler.as_script_callable = handler;
 
-    return e_unregister_handler(e_key(ent_uid, event), &hd);
+    if(!e_unregister_handler(e_key(ent_uid, event), &hd))
+        return false;
+    e_entity_observe(event, -1);
+    return true;
 }
 
 void E_Entity_Notify(enum eventtype event, uint32_t ent_uid, void *event_arg, 
                      enum event_source source)
 {
     struct event e = (struct event){event, event_arg, source, ent_uid};
-    queue_event_push(&s_event_queue, &e);
+
+    /* Nobody is listening for this event type on any entity */
+    if(!e_entity_observed(event)) {
+        e_drop_event(&e);
+        s_stats.filtered++;
+        return;
+    }
+    e_queue_push(&e);
 }
 
+
+
+bool E_Entity_ScriptRegisterBatched(enum eventtype event, script_opaque_t handler, 
+                                    script_opaque_t user_arg, int simmask)
+{
+    struct batch *batch = e_batch_get(event);
+    if(!batch) {
+
+        batch = malloc(sizeof(struct batch));
+        if(!batch)
+            return false;
+
+        vec_hd_init(&batch->handlers);
+        vec_uid_init(&batch->receivers);
+        vec_sobj_init(&batch->args);
+
+        int ret;
+        khiter_t k = kh_put(batch, s_batch_table, event, &ret);
+        if(ret == -1) {
+            e_batch_free(batch);
+            return false;
+        }
+        kh_value(s_batch_table, k) = batch;
+    }
+
+    struct handler_desc hd;
+    hd.type = HANDLER_TYPE_SCRIPT;
+    hd.handler.as_script_callable = handler;
+    hd.user_arg = user_arg;
+    hd.simmask = simmask;
+
+    if(!vec_hd_push(&batch->handlers, hd))
+        return false;
+    e_entity_observe(event, +1);
+    return true;
+}
+
+bool E_Entity_ScriptUnregisterBatched(enum eventtype event, script_opaque_t handler)
+{
+    struct batch *batch = e_batch_get(event);
+    if(!batch)
+        return false;
+
+    struct handler_desc hd;
+    hd.type = HANDLER_TYPE_SCRIPT;
+    hd.handler.as_script_callable = handler;
+
+    int idx;
+    vec_hd_indexof(&batch->handlers, hd, handlers_equal, &idx);
+    if(idx == -1)
+        return false;
+
+    struct handler_desc to_del = vec_AT(&batch->handlers, idx);
+    S_Release(to_del.handler.as_script_callable);
+    S_Release(to_del.user_arg); 
+
+    vec_hd_del(&batch->handlers, idx);
+    e_entity_observe(event, -1);
+    return true;
+}
@@ -79,6 +79,7 @@ enum eventtype{
     EVENT_ENTITY_DEATH,
     EVENT_ATTACK_END,
     EVENT_GAME_SIMSTATE_CHANGED,
+    EVENT_PROJECTILE_HITS,
 
     EVENT_ENGINE_LAST = 0x1ffff,
 };
@@ -88,6 +89,36 @@ enum event_source{
     ES_SCRIPT,
 };
 
+/* What happens to an event that is queued when the event queue is full */
+enum event_overflow{
+    /* The queue is resized to fit the event */
+    EVENT_OVERFLOW_GROW,
+    /* Entity events are dropped. Global events (including input) still 
+     * grow the queue. */
+    EVENT_OVERFLOW_DROP,
+};
+
+struct event_stats{
+    /* The number of events the queue currently has room for, the most events 
+     * that were ever queued at once, and the number of events that were queued 
+     * at the start of the last tick */
+    size_t        capacity;
+    size_t        high_water;
+    size_t        last_tick;
+    /* The number of events queued, the number of entity notifications that 
+     * were discarded because no entity has a handler for the event type, the
+     * number of events dropped on overflow and the number of times the queue 
+     * had to be resized */
+    unsigned long queued;
+    unsigned long filtered;
+    unsigned long dropped;
+    unsigned long resized;
+    /* The time spent in script handlers during the last tick, and the number 
+     * of events put off to the following tick for being over the budget */
+    float         script_ms;
+    unsigned long deferred;
+};
+
 typedef void (*handler_t)(void*, void*);
 
 /*###########################################################################*/
@@ -97,6 +128,12 @@ typedef void (*handler_t)(void*, void*);
 bool E_Init(void);
 void E_ServiceQueue(void);
 void E_Shutdown(void);
+void E_SetOverflowPolicy(enum event_overflow policy);
+void E_GetStats(struct event_stats *out);
+/* Once the script handlers have run for 'ms' milliseconds in a tick, the 
+ * remaining events sent by scripts to entities are deferred to the next 
+ * tick. Engine and global events are always handled. 0 disables the budget */
+void E_SetScriptBudget(float ms);
 
 /*###########################################################################*/
 /* EVENT GLOBAL                                                              */
@@ -128,5 +165,13 @@ bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid,
                                script_opaque_t handler);
 void E_Entity_Notify(enum eventtype, uint32_t ent_uid, void *event_arg, enum event_source);
 
+/* Batched handlers are invoked once per tick, after the event queue has been 
+ * serviced, with all the events of the type that were delivered to any entity 
+ * during the tick. They are passed a tuple of (entity, arg) pairs in place of 
+ * the event arg. */
+bool E_Entity_ScriptRegisterBatched(enum eventtype event, script_opaque_t handler, 
+                                    script_opaque_t user_arg, int simmask);
+bool E_Entity_ScriptUnregisterBatched(enum eventtype event, script_opaque_t handler);
+
 #endif
 
@@ -49,6 +49,8 @@
 #include "../collision.h"
 #include "../settings.h"
 #include "../ui.h"
+#include "../main.h"
+#include "../config.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
 #include "../map/public/map.h"
@@ -56,10 +58,68 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 
 #define EPSILON         (1.0/1024)
+
+#if defined(__AVX__)
+
+#define SIMD_WIDTH      (8)
+typedef __m256 vfloat;
+
+#define VF_LOAD(p)      _mm256_loadu_ps(p)
+#define VF_STORE(p, a)  _mm256_storeu_ps(p, a)
+#define VF_SET1(x)      _mm256_set1_ps(x)
+#define VF_ADD(a, b)    _mm256_add_ps(a, b)
+#define VF_SUB(a, b)    _mm256_sub_ps(a, b)
+#define VF_MUL(a, b)    _mm256_mul_ps(a, b)
+#define VF_DIV(a, b)    _mm256_div_ps(a, b)
+#define VF_SQRT(a)      _mm256_sqrt_ps(a)
+#define VF_AND(a, b)    _mm256_and_ps(a, b)
+#define VF_ABS(a)       _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+#define VF_GT(a, b)     _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VF_GE(a, b)     _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define VF_LE(a, b)     _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VF_MOVEMASK(a)  _mm256_movemask_ps(a)
+#define VF_SELECT(m, a, b) _mm256_blendv_ps(b, a, m)
+
+#elif defined(__SSE__)
+
+#define SIMD_WIDTH      (4)
+typedef __m128 vfloat;
+
+#define VF_LOAD(p)      _mm_loadu_ps(p)
+#define VF_STORE(p, a)  _mm_storeu_ps(p, a)
+#define VF_SET1(x)      _mm_set1_ps(x)
+#define VF_ADD(a, b)    _mm_add_ps(a, b)
+#define VF_SUB(a, b)    _mm_sub_ps(a, b)
+#define VF_MUL(a, b)    _mm_mul_ps(a, b)
+#define VF_DIV(a, b)    _mm_div_ps(a, b)
+#define VF_SQRT(a)      _mm_sqrt_ps(a)
+#define VF_AND(a, b)    _mm_and_ps(a, b)
+#define VF_ABS(a)       _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define VF_GT(a, b)     _mm_cmpgt_ps(a, b)
+#define VF_GE(a, b)     _mm_cmpge_ps(a, b)
+#define VF_LE(a, b)     _mm_cmple_ps(a, b)
+#define VF_MOVEMASK(a)  _mm_movemask_ps(a)
+#define VF_SELECT(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+
+#else
+
+#define SIMD_WIDTH      (1)
+
+#endif
 #define MAX_SAVED_VOS   (512)
+#define SCRATCH_ALIGN   (16)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
 
 VEC_TYPE(vec2, vec2_t)
 VEC_IMPL(static inline, vec2, vec2_t)
@@ -82,6 +142,51 @@ struct HRVO{
     vec2_t xz_right_side;
 };
 
+/* The obstacles in a structure-of-arrays layout, for testing a point against 
+ * SIMD_WIDTH of them at a time. */
+struct wedge_soa{
+    size_t n;
+    float *apex_x,  *apex_z;
+    float *left_x,  *left_z;
+    float *right_x, *right_z;
+};
+
+/* A crossing of a ray with a side of another obstacle */
+struct ray_event{
+    float  t;
+    vec2_t point;
+    int    wedge;
+};
+
+/* Working memory for tracing the rays, reused for every ray */
+struct sweep_buffs{
+    struct ray_event *events;
+    int              *cover_after;
+    float            *first_t;
+    bool             *inside;
+    int              *group;
+};
+
+/* All the temporaries of a single velocity computation */
+struct work_buffs{
+    struct HRVO       *hrvos;
+    struct VO         *vos;
+    struct line_2d    *rays;
+    float             *wedge_storage;
+    struct sweep_buffs sweep;
+};
+
+/* The permissible velocities are not buffered. Only the one closest to 
+ * the desired velocity is kept as they are generated. */
+struct candidates{
+    vec2_t      des_v;
+    vec2_t      ent_xz_pos;
+    size_t      count;
+    float       min_dist;
+    vec2_t      best;
+    vec_vec2_t *saved; /* All points are appended here when not NULL */
+};
+
 struct saved_ctx{
     struct cp_ent cpent;
     vec2_t        ent_des_v;
@@ -100,11 +205,65 @@ struct saved_ctx{
 /*****************************************************************************/
 
 static struct saved_ctx s_debug_saved;
+/* The most memory ever used by a single scratch arena in one tick */
+static size_t           s_scratch_high_water = 0;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+/* Allocations are rounded up so that every one of them is suitably aligned 
+ * for any of the types we place in the arena. */
+static void *scratch_alloc(struct cp_scratch *scratch, size_t size)
+{
+    size = (size + (SCRATCH_ALIGN - 1)) & ~(size_t)(SCRATCH_ALIGN - 1);
+    void *ret = sstalloc(&scratch->mem, size);
+    if(ret)
+        scratch->used += size;
+    return ret;
+}
+
+static bool work_buffs_alloc(struct cp_scratch *scratch, size_t n_dyn, size_t n_stat,
+                             struct work_buffs *out)
+{
+    const size_t n_vos = n_dyn + n_stat;
+    const size_t n_rays = n_vos * 2;
+
+    out->hrvos = scratch_alloc(scratch, n_dyn * sizeof(struct HRVO));
+    out->vos = scratch_alloc(scratch, n_stat * sizeof(struct VO));
+    out->rays = scratch_alloc(scratch, n_rays * sizeof(struct line_2d));
+    out->wedge_storage = scratch_alloc(scratch, n_vos * 6 * sizeof(float));
+
+    out->sweep.events = scratch_alloc(scratch, n_rays * sizeof(struct ray_event));
+    out->sweep.cover_after = scratch_alloc(scratch, n_rays * sizeof(int));
+    out->sweep.first_t = scratch_alloc(scratch, n_vos * sizeof(float));
+    out->sweep.inside = scratch_alloc(scratch, n_vos * sizeof(bool));
+    out->sweep.group = scratch_alloc(scratch, n_vos * sizeof(int));
+
+    return out->hrvos && out->vos && out->rays && out->wedge_storage
+        && out->sweep.events && out->sweep.cover_after 
+        && out->sweep.first_t && out->sweep.inside && out->sweep.group;
+}
+
+static void candidates_add(struct candidates *cands, vec2_t point)
+{
+    if(cands->saved)
+        vec_vec2_push(cands->saved, point);
+
+    /* The points are in worldspace coordinates. Convert them to the entity's 
+     * local space to get the adimissible velocities. */
+    vec2_t curr, diff;
+    PFM_Vec2_Sub(&point, &cands->ent_xz_pos, &curr);
+    PFM_Vec2_Sub(&cands->des_v, &curr, &diff);
+
+    float len = PFM_Vec2_Len(&diff);
+    if(len < cands->min_dist) {
+        cands->min_dist = len;
+        cands->best = curr;
+    }
+    cands->count++;
+}
+
 static void compute_vo_edges(struct cp_ent ent, struct cp_ent neighb,
                              vec2_t *out_xz_right, vec2_t *out_xz_left)
 {
@@ -189,12 +348,162 @@ static struct HRVO compute_hrvo(struct cp_ent ent, struct cp_ent neighb)
     return ret;
 }
 
+#if SIMD_WIDTH > 1
+
+/* Computes the unit vectors from the entity to the tangent points on the 
+ * neighbours' (buffered) bounding circles for a batch of SIMD_WIDTH neighbours.
+ * Same as 'compute_vo_edges'. 
+ */
+static void simd_vo_edges(vfloat pos_x, vfloat pos_z, vfloat radius,
+                          vfloat nb_pos_x, vfloat nb_pos_z, vfloat nb_radius,
+                          vfloat *out_right_x, vfloat *out_right_z,
+                          vfloat *out_left_x, vfloat *out_left_z)
+{
+    vfloat to_nb_x = VF_SUB(nb_pos_x, pos_x);
+    vfloat to_nb_z = VF_SUB(nb_pos_z, pos_z);
+    vfloat len = VF_SQRT(VF_ADD(VF_MUL(to_nb_x, to_nb_x), VF_MUL(to_nb_z, to_nb_z)));
+
+    vfloat scale = VF_DIV(VF_ADD(VF_ADD(nb_radius, radius), VF_SET1(CLEARPATH_BUFFER_RADIUS)), len);
+    vfloat right_x = VF_MUL(VF_SUB(VF_SET1(0.0f), to_nb_z), scale);
+    vfloat right_z = VF_MUL(to_nb_x, scale);
+
+    /* The tangents relative to the entity position */
+    vfloat rt_x = VF_ADD(to_nb_x, right_x);
+    vfloat rt_z = VF_ADD(to_nb_z, right_z);
+    vfloat lt_x = VF_SUB(to_nb_x, right_x);
+    vfloat lt_z = VF_SUB(to_nb_z, right_z);
+
+    vfloat rt_len = VF_SQRT(VF_ADD(VF_MUL(rt_x, rt_x), VF_MUL(rt_z, rt_z)));
+    vfloat lt_len = VF_SQRT(VF_ADD(VF_MUL(lt_x, lt_x), VF_MUL(lt_z, lt_z)));
+
+    *out_right_x = VF_DIV(rt_x, rt_len);
+    *out_right_z = VF_DIV(rt_z, rt_len);
+    *out_left_x = VF_DIV(lt_x, lt_len);
+    *out_left_z = VF_DIV(lt_z, lt_len);
+}
+
+/* Transposes the next SIMD_WIDTH neighbours into a structure-of-arrays layout. */
+static void load_neighbs(const struct cp_ent *nbs, vfloat *out_x, vfloat *out_z,
+                         vfloat *out_vel_x, vfloat *out_vel_z, vfloat *out_radius)
+{
+    float x[SIMD_WIDTH], z[SIMD_WIDTH], vx[SIMD_WIDTH], vz[SIMD_WIDTH], r[SIMD_WIDTH];
+    for(int i = 0; i < SIMD_WIDTH; i++) {
+        x[i] = nbs[i].xz_pos.x;
+        z[i] = nbs[i].xz_pos.z;
+        vx[i] = nbs[i].xz_vel.x;
+        vz[i] = nbs[i].xz_vel.z;
+        r[i] = nbs[i].radius;
+    }
+    *out_x = VF_LOAD(x);
+    *out_z = VF_LOAD(z);
+    *out_vel_x = VF_LOAD(vx);
+    *out_vel_z = VF_LOAD(vz);
+    *out_radius = VF_LOAD(r);
+}
+
+static void simd_compute_vos(struct cp_ent ent, const struct cp_ent *nbs, struct VO *out)
+{
+    vfloat nb_x, nb_z, nb_vel_x, nb_vel_z, nb_radius;
+    load_neighbs(nbs, &nb_x, &nb_z, &nb_vel_x, &nb_vel_z, &nb_radius);
+
+    vfloat pos_x = VF_SET1(ent.xz_pos.x), pos_z = VF_SET1(ent.xz_pos.z);
+    vfloat right_x, right_z, left_x, left_z;
+    simd_vo_edges(pos_x, pos_z, VF_SET1(ent.radius), nb_x, nb_z, nb_radius,
+        &right_x, &right_z, &left_x, &left_z);
+
+    float ax[SIMD_WIDTH], az[SIMD_WIDTH];
+    float rx[SIMD_WIDTH], rz[SIMD_WIDTH], lx[SIMD_WIDTH], lz[SIMD_WIDTH];
+
+    VF_STORE(ax, VF_ADD(pos_x, nb_vel_x));
+    VF_STORE(az, VF_ADD(pos_z, nb_vel_z));
+    VF_STORE(rx, right_x);
+    VF_STORE(rz, right_z);
+    VF_STORE(lx, left_x);
+    VF_STORE(lz, left_z);
+
+    for(int i = 0; i < SIMD_WIDTH; i++) {
+        out[i] = (struct VO){
+            .xz_apex = (vec2_t){ax[i], az[i]},
+            .xz_left_side = (vec2_t){lx[i], lz[i]},
+            .xz_right_side = (vec2_t){rx[i], rz[i]},
+        };
+    }
+}
+
+/* Same as 'compute_hrvo' for a batch of SIMD_WIDTH neighbours. The apex is 
+ * found by intersecting one side of the RVO with the opposite side of the VO.
+ */
+static void simd_compute_hrvos(struct cp_ent ent, const struct cp_ent *nbs, struct HRVO *out)
+{
+    vfloat nb_x, nb_z, nb_vel_x, nb_vel_z, nb_radius;
+    load_neighbs(nbs, &nb_x, &nb_z, &nb_vel_x, &nb_vel_z, &nb_radius);
+
+    vfloat pos_x = VF_SET1(ent.xz_pos.x), pos_z = VF_SET1(ent.xz_pos.z);
+    vfloat vel_x = VF_SET1(ent.xz_vel.x), vel_z = VF_SET1(ent.xz_vel.z);
+    vfloat right_x, right_z, left_x, left_z;
+    simd_vo_edges(pos_x, pos_z, VF_SET1(ent.radius), nb_x, nb_z, nb_radius,
+        &right_x, &right_z, &left_x, &left_z);
+
+    vfloat half = VF_SET1(0.5f);
+    vfloat rvo_apex_x = VF_ADD(pos_x, VF_MUL(VF_ADD(vel_x, nb_vel_x), half));
+    vfloat rvo_apex_z = VF_ADD(pos_z, VF_MUL(VF_ADD(vel_z, nb_vel_z), half));
+    vfloat vo_apex_x = VF_ADD(pos_x, nb_vel_x);
+    vfloat vo_apex_z = VF_ADD(pos_z, nb_vel_z);
+
+    /* Which side of the RVO centerline the entity velocity is on */
+    vfloat center_x = VF_ADD(left_x, right_x);
+    vfloat center_z = VF_ADD(left_z, right_z);
+    vfloat det = VF_SUB(VF_MUL(center_x, vel_z), VF_MUL(center_z, vel_x));
+    vfloat is_left = VF_GT(det, VF_SET1(0.0f));
+
+    vfloat d1_x = VF_SELECT(is_left, left_x, right_x);
+    vfloat d1_z = VF_SELECT(is_left, left_z, right_z);
+    vfloat d2_x = VF_SELECT(is_left, right_x, left_x);
+    vfloat d2_z = VF_SELECT(is_left, right_z, left_z);
+
+    vfloat diff_x = VF_SUB(vo_apex_x, rvo_apex_x);
+    vfloat diff_z = VF_SUB(vo_apex_z, rvo_apex_z);
+    vfloat num = VF_SUB(VF_MUL(diff_x, d2_z), VF_MUL(diff_z, d2_x));
+    vfloat den = VF_SUB(VF_MUL(d1_x, d2_z), VF_MUL(d1_z, d2_x));
+    vfloat t = VF_DIV(num, den);
+
+    /* The entity velocity is right on the centerline or the sides are parallel */
+    vfloat use_isec = VF_AND(VF_GT(VF_ABS(det), VF_SET1(EPSILON)), 
+                             VF_GT(VF_ABS(den), VF_SET1(EPSILON)));
+
+    float ax[SIMD_WIDTH], az[SIMD_WIDTH];
+    float rx[SIMD_WIDTH], rz[SIMD_WIDTH], lx[SIMD_WIDTH], lz[SIMD_WIDTH];
+
+    VF_STORE(ax, VF_SELECT(use_isec, VF_ADD(rvo_apex_x, VF_MUL(d1_x, t)), rvo_apex_x));
+    VF_STORE(az, VF_SELECT(use_isec, VF_ADD(rvo_apex_z, VF_MUL(d1_z, t)), rvo_apex_z));
+    VF_STORE(rx, right_x);
+    VF_STORE(rz, right_z);
+    VF_STORE(lx, left_x);
+    VF_STORE(lz, left_z);
+
+    for(int i = 0; i < SIMD_WIDTH; i++) {
+        out[i] = (struct HRVO){
+            .xz_apex = (vec2_t){ax[i], az[i]},
+            .xz_left_side = (vec2_t){lx[i], lz[i]},
+            .xz_right_side = (vec2_t){rx[i], rz[i]},
+        };
+    }
+}
+
+#endif //SIMD_WIDTH > 1
+
 static size_t compute_all_vos(struct cp_ent ent, vec_cp_ent_t stat_neighbs, 
                               struct VO *out)
 {
     size_t ret = 0; 
 
-    for(struct cp_ent *nb = stat_neighbs.array; 
+#if SIMD_WIDTH > 1
+    for(; ret + SIMD_WIDTH <= vec_size(&stat_neighbs); ret += SIMD_WIDTH) {
+        simd_compute_vos(ent, stat_neighbs.array + ret, out + ret);
+    }
+#endif
+
+    for(struct cp_ent *nb = stat_neighbs.array + ret; 
         nb < stat_neighbs.array + vec_size(&stat_neighbs); nb++) {
         
         out[ret++] = compute_vo(ent, *nb);
@@ -208,7 +517,13 @@ static size_t compute_all_hrvos(struct cp_ent ent, vec_cp_ent_t dyn_neighbs,
 {
     size_t ret = 0; 
 
-    for(struct cp_ent *nb = dyn_neighbs.array; 
+#if SIMD_WIDTH > 1
+    for(; ret + SIMD_WIDTH <= vec_size(&dyn_neighbs); ret += SIMD_WIDTH) {
+        simd_compute_hrvos(ent, dyn_neighbs.array + ret, out + ret);
+    }
+#endif
+
+    for(struct cp_ent *nb = dyn_neighbs.array + ret; 
         nb < dyn_neighbs.array + vec_size(&dyn_neighbs); nb++) {
         
         out[ret++] = compute_hrvo(ent, *nb);
@@ -217,46 +532,105 @@ static size_t compute_all_hrvos(struct cp_ent ent, vec_cp_ent_t dyn_neighbs,
     return ret;
 }
 
-/* Points exactly 'on' the boundary will be considered as 'not inside' of the PCR for our purposes. */
-static bool inside_pcr(const struct line_2d *vo_lr_pairs, size_t n_rays, vec2_t test)
+/* Each obstacle is represented by a pair of rays (left side, then right side) 
+ * originating at its' apex. Points exactly 'on' the boundary will be considered 
+ * as 'not inside' of the obstacle for our purposes. The determinants are scaled 
+ * by the distance to the apex rather than normalizing the vector to the test 
+ * point, which gives the same result and is cheaper to vectorize.
+ */
+static bool inside_wedge(const struct wedge_soa *wedges, int wedge, vec2_t test)
 {
-    assert(n_rays % 2 == 0);
-    for(int i = 0; i < n_rays; i+=2) {
+    const float to_test_x = test.x - wedges->apex_x[wedge];
+    const float to_test_z = test.z - wedges->apex_z[wedge];
+    const float eps = EPSILON * sqrtf(to_test_x * to_test_x + to_test_z * to_test_z);
 
-        assert(fabs(PFM_Vec2_Len(&vo_lr_pairs[i + 0].dir) - 1.0f) < EPSILON);
-        const float left_dir_x = vo_lr_pairs[i + 0].dir.raw[0];
-        const float left_dir_z = vo_lr_pairs[i + 0].dir.raw[1];
+    float left_det = (to_test_z * wedges->left_x[wedge]) - (to_test_x * wedges->left_z[wedge]);
+    bool left_of_vo = (left_det < eps);
 
-        vec2_t point_to_test;
-        PFM_Vec2_Sub(&test, (vec2_t*)&vo_lr_pairs[i + 0].point, &point_to_test);
-        PFM_Vec2_Normal(&point_to_test, &point_to_test);
+    if(left_of_vo)
+        return false;
 
-        float left_det = (point_to_test.raw[1] * left_dir_x) - (point_to_test.raw[0] * left_dir_z);
-        bool left_of_vo = (left_det < EPSILON);
+    float right_det = (to_test_z * wedges->right_x[wedge]) - (to_test_x * wedges->right_z[wedge]);
+    bool right_of_vo = (right_det > -eps);
 
-        if(left_of_vo)
-            continue;
+    if(right_of_vo)
+        return false;
 
-        assert(fabs(PFM_Vec2_Len(&vo_lr_pairs[i + 1].dir) - 1.0f) < EPSILON);
-        const float right_dir_x = vo_lr_pairs[i + 1].dir.raw[0];
-        const float right_dir_z = vo_lr_pairs[i + 1].dir.raw[1];
+    assert(!left_of_vo && !right_of_vo);
+    return true;
+}
 
-        PFM_Vec2_Sub(&test, (vec2_t*)&vo_lr_pairs[i + 1].point, &point_to_test);
-        PFM_Vec2_Normal(&point_to_test, &point_to_test);
+static bool inside_pcr(const struct wedge_soa *wedges, vec2_t test)
+{
+    int i = 0;
 
-        float right_det = (point_to_test.raw[1] * right_dir_x) - (point_to_test.raw[0] * right_dir_z);
-        bool right_of_vo = (right_det > -EPSILON);
+#if SIMD_WIDTH > 1
+    const vfloat test_x = VF_SET1(test.x);
+    const vfloat test_z = VF_SET1(test.z);
+    const vfloat eps = VF_SET1(EPSILON);
 
-        if(right_of_vo)
-            continue;
+    for(; i + SIMD_WIDTH <= wedges->n; i += SIMD_WIDTH) {
 
-        assert(!left_of_vo && !right_of_vo);
-        return true;
+        vfloat to_test_x = VF_SUB(test_x, VF_LOAD(wedges->apex_x + i));
+        vfloat to_test_z = VF_SUB(test_z, VF_LOAD(wedges->apex_z + i));
+        vfloat len = VF_SQRT(VF_ADD(VF_MUL(to_test_x, to_test_x), VF_MUL(to_test_z, to_test_z)));
+        vfloat lane_eps = VF_MUL(eps, len);
+
+        vfloat left_det = VF_SUB(VF_MUL(to_test_z, VF_LOAD(wedges->left_x + i)),
+                                 VF_MUL(to_test_x, VF_LOAD(wedges->left_z + i)));
+        vfloat right_det = VF_SUB(VF_MUL(to_test_z, VF_LOAD(wedges->right_x + i)),
+                                  VF_MUL(to_test_x, VF_LOAD(wedges->right_z + i)));
+
+        vfloat inside = VF_AND(VF_GE(left_det, lane_eps), 
+                               VF_LE(right_det, VF_SUB(VF_SET1(0.0f), lane_eps)));
+        if(VF_MOVEMASK(inside))
+            return true;
+    }
+#endif
+
+    for(; i < wedges->n; i++) {
+
+        if(inside_wedge(wedges, i, test))
+            return true;
     }
 
     return false;
 }
 
+/* Transposes the rays into the structure-of-arrays layout used for the 
+ * point-in-PCR tests. 'storage' must hold (n_rays / 2) * 6 floats. 
+ */
+static void wedges_repr(const struct line_2d *rays, size_t n_rays, float *storage,
+                        struct wedge_soa *out)
+{
+    assert(n_rays % 2 == 0);
+    const size_t n = n_rays / 2;
+
+    out->n = n;
+    out->apex_x  = storage + n * 0;
+    out->apex_z  = storage + n * 1;
+    out->left_x  = storage + n * 2;
+    out->left_z  = storage + n * 3;
+    out->right_x = storage + n * 4;
+    out->right_z = storage + n * 5;
+
+    for(int i = 0; i < n; i++) {
+    
+        const struct line_2d *left = &rays[i * 2 + 0];
+        const struct line_2d *right = &rays[i * 2 + 1];
+
+        assert(fabs(PFM_Vec2_Len((vec2_t*)&left->dir) - 1.0f) < EPSILON);
+        assert(fabs(PFM_Vec2_Len((vec2_t*)&right->dir) - 1.0f) < EPSILON);
+
+        out->apex_x[i]  = left->point.x;
+        out->apex_z[i]  = left->point.z;
+        out->left_x[i]  = left->dir.x;
+        out->left_z[i]  = left->dir.z;
+        out->right_x[i] = right->dir.x;
+        out->right_z[i] = right->dir.z;
+    }
+}
+
 static void rays_repr(const struct HRVO *hrvos, size_t n_hrvos,
                       const struct VO *vos, size_t n_vos,
                       struct line_2d *out)
@@ -286,8 +660,10 @@ static void rays_repr(const struct HRVO *hrvos, size_t n_hrvos,
     }
 }
 
+#if CONFIG_CLEARPATH_REFERENCE
+
 static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays,
-                                 vec_vec2_t *inout)
+                                 const struct wedge_soa *wedges, struct candidates *inout)
 {
     size_t ret = 0;
 
@@ -301,10 +677,10 @@ static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays,
             if(!C_RayRayIntersection2D(rays[i], rays[j], &isec_point))
                 continue;
 
-            if(inside_pcr(rays, n_rays, isec_point))
+            if(inside_pcr(wedges, isec_point))
                 continue;
 
-            vec_vec2_push(inout, isec_point);
+            candidates_add(inout, isec_point);
             ret++;
         }
     }
@@ -313,7 +689,8 @@ static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays,
 }
 
 static size_t compute_vdes_proj_points(struct line_2d *rays, size_t n_rays,
-                                       vec2_t des_v, vec_vec2_t *inout)
+                                       const struct wedge_soa *wedges,
+                                       vec2_t des_v, struct candidates *inout)
 {
     vec2_t proj;
     size_t ret = 0;
@@ -326,9 +703,9 @@ static size_t compute_vdes_proj_points(struct line_2d *rays, size_t n_rays,
         PFM_Vec2_Scale(&rays[i].dir, len, &proj);
         PFM_Vec2_Add(&rays[i].point, &proj, &proj);
 
-        if(!inside_pcr(rays, n_rays, proj)) {
+        if(!inside_pcr(wedges, proj)) {
         
-            vec_vec2_push(inout, proj);
+            candidates_add(inout, proj);
             ret++;
         }
     }
@@ -336,30 +713,185 @@ static size_t compute_vdes_proj_points(struct line_2d *rays, size_t n_rays,
     return ret;
 }
 
-static vec2_t compute_vnew(const vec_vec2_t *outside_points, vec2_t des_v, vec2_t ent_xz_pos)
+#else
+
+static int compare_ray_events(const void *a, const void *b)
+{
+    const struct ray_event *ea = a, *eb = b;
+    return (ea->t > eb->t) - (ea->t < eb->t);
+}
+
+static vec2_t ray_point(const struct line_2d *ray, float t)
+{
+    return (vec2_t){ray->point.x + ray->dir.x * t, ray->point.z + ray->dir.z * t};
+}
+
+/* Walk along a single ray, keeping track of which obstacles cover it. The 
+ * coverage by an obstacle can only change where the ray crosses one of its' 
+ * sides, so after sorting the crossings, every crossing point and the 
+ * projection of des_v can be classified without testing it against all the 
+ * obstacles. This makes the cost O(n log n) per ray, as opposed to O(n^2) for 
+ * intersecting the ray with every other ray and testing each point.
+ */
+static size_t sweep_ray(struct line_2d *rays, size_t n_rays, 
+                        const struct wedge_soa *wedges, int idx, vec2_t des_v, 
+                        const struct sweep_buffs *sweep, struct candidates *inout)
 {
-    float min_dist = INFINITY, len;
-    vec2_t ret;
+    const struct line_2d *ray = &rays[idx];
+    const int n_wedges = n_rays / 2;
+    const int own = idx / 2;
+
+    struct ray_event *events = sweep->events;
+    int *cover_after = sweep->cover_after;
+    float *first_t = sweep->first_t;
+    bool *inside = sweep->inside;
+    int *group = sweep->group;
+    size_t nevents = 0, ret = 0;
+
+    for(int i = 0; i < n_rays; i++) {
 
-    for(int i = 0; i < vec_size(outside_points); i++) {
+        if(i / 2 == own)
+            continue;
 
-        /* The points are in worldspace coordinates. Convert them to the entity's 
-         * local space to get the adimissible velocities. */
-        vec2_t curr = vec_AT(outside_points, i), diff;
-        PFM_Vec2_Sub(&curr, &ent_xz_pos, &curr);
+        vec2_t isec_point, diff;
+        if(!C_RayRayIntersection2D(*ray, rays[i], &isec_point))
+            continue;
 
-        PFM_Vec2_Sub(&des_v, &curr, &diff);
-        if((len = PFM_Vec2_Len(&diff)) < min_dist) {
+        PFM_Vec2_Sub(&isec_point, (vec2_t*)&ray->point, &diff);
+        float t = PFM_Vec2_Dot(&diff, (vec2_t*)&ray->dir);
+        events[nevents++] = (struct ray_event){t, isec_point, i / 2};
+    }
+    qsort(events, nevents, sizeof(struct ray_event), compare_ray_events);
+
+    /* Crossings at the very start of the ray (ex. with the sides of obstacles
+     * sharing the same apex) are not considered. The apex point is tested on 
+     * its' own. */
+    int start = 0;
+    while(start < nevents && events[start].t < EPSILON)
+        cover_after[start++] = 0;
+
+    for(int i = 0; i < n_wedges; i++) {
+        first_t[i] = INFINITY;
+        group[i] = -1;
+    }
+    for(int i = nevents-1; i >= start; i--)
+        first_t[events[i].wedge] = events[i].t;
+
+    /* Find out which obstacles cover the start of the ray by testing a point 
+     * before the first crossing with each one. The point is kept close to the 
+     * apex, since the inside test has an angular tolerance which would hide
+     * a side that is almost parallel to the ray further out. */
+    int count = 0;
+    for(int i = 0; i < n_wedges; i++) {
+
+        inside[i] = false;
+        if(i == own)
+            continue;
 
-            min_dist = len;
-            ret = curr;
+        float t = MIN(first_t[i], 1.0f) / 2.0f;
+        inside[i] = inside_wedge(wedges, i, ray_point(ray, t));
+        count += inside[i];
+    }
+    const int start_count = count;
+
+    for(int i = start; i < nevents;) {
+
+        /* Crossings at (nearly) the same point are handled together. The 
+         * crossing points are on the boundaries of all the crossed obstacles 
+         * and so are not inside of any of them. */
+        int end = i, others = count;
+        for(; end < nevents && events[end].t - events[i].t < EPSILON; end++) {
+
+            const int w = events[end].wedge;
+            if(group[w] != i) {
+                group[w] = i;
+                others -= inside[w];
+            }
         }
+
+        for(int j = i; j < end; j++) {
+
+            if(others == 0) {
+                candidates_add(inout, events[j].point);
+                ret++;
+            }
+
+            const int w = events[j].wedge;
+            inside[w] = !inside[w];
+            count += inside[w] ? 1 : -1;
+        }
+
+        for(; i < end; i++)
+            cover_after[i] = count;
     }
 
-    assert(min_dist < INFINITY);
+    /* Same as in compute_vdes_proj_points */
+    float proj_t = PFM_Vec2_Dot((vec2_t*)&ray->dir, &des_v);
+    vec2_t proj = ray_point(ray, proj_t);
+    bool proj_outside;
+
+    if(proj_t < 0.0f) {
+        proj_outside = !inside_pcr(wedges, proj);
+    }else{
+        /* Find the number of crossings before the projected point */
+        int lo = 0, hi = nevents;
+        while(lo < hi) {
+            int mid = (lo + hi) / 2;
+            if(events[mid].t <= proj_t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        proj_outside = (0 == ((lo <= start) ? start_count : cover_after[lo - 1]));
+    }
+
+    if(proj_outside) {
+        candidates_add(inout, proj);
+        ret++;
+    }
+
+    /* The left and right sides of an obstacle meet at its' apex */
+    if(idx % 2 == 0 && !inside_pcr(wedges, ray->point)) {
+        candidates_add(inout, ray->point);
+        ret++;
+    }
     return ret;
 }
 
+#endif //CONFIG_CLEARPATH_REFERENCE
+
+static size_t compute_outside_points(struct line_2d *rays, size_t n_rays,
+                                     const struct wedge_soa *wedges, vec2_t des_v, 
+                                     const struct sweep_buffs *sweep, struct candidates *inout)
+{
+#if CONFIG_CLEARPATH_REFERENCE
+    size_t ret = 0;
+
+    /* The line segments are intersected pairwise and the intersection points 
+     * inside the combined hybrid reciprocal velocity obstacle are discarded. 
+     * The remaining intersection points are permissible new velocities on the 
+     * boundary of the combined hybrid reciprocal velocity obstacle.
+     */
+    ret += compute_vo_xpoints(rays, n_rays, wedges, inout); 
+
+    /* In addition we project the preferred velocity (des_v) on to the line 
+     * segments (xz_left_side and xz_right_side of each hrvo) and also retain 
+     * those points that are outside the combined hybrid reciprocal velocity 
+     * obstacle.
+     */
+    ret += compute_vdes_proj_points(rays, n_rays, wedges, des_v, inout);
+    return ret;
+#else
+    /* The boundary of the combined hybrid reciprocal velocity obstacle is 
+     * traced one ray at a time, yielding the same set of points. */
+    size_t ret = 0;
+    for(int i = 0; i < n_rays; i++) {
+        ret += sweep_ray(rays, n_rays, wedges, i, des_v, sweep, inout);
+    }
+    return ret;
+#endif
+}
+
 static void remove_furthest(vec2_t xz_pos, vec_cp_ent_t *dyn_inout, vec_cp_ent_t *stat_inout)
 {
     float max_dist = -INFINITY;
@@ -393,11 +925,19 @@ static void remove_furthest(vec2_t xz_pos, vec_cp_ent_t *dyn_inout, vec_cp_ent_t
 /* Save the combined HRVO of the first selected entity for debug rendering */
 static bool should_save_debug(uint32_t ent_uid)
 {
-    struct sval setting;
-    ss_e status = Settings_Get("pf.debug.show_first_sel_combined_hrvo", &setting);
-    assert(status == SS_OKAY);
+    /* Velocities may be computed on the worker threads, but the debug 
+     * state is only ever touched from the main thread. */
+    if(SDL_ThreadID() != g_main_thread_id)
+        return false;
 
-    if(!setting.as_bool)
+    /* This is queried for every moving entity - only look up the setting once */
+    static const struct sval *s_show_hrvo = NULL;
+    if(!s_show_hrvo) {
+        s_show_hrvo = Settings_Handle("pf.debug.show_first_sel_combined_hrvo");
+        assert(s_show_hrvo);
+    }
+
+    if(!s_show_hrvo->as_bool)
         return false;
 
     enum selection_type seltype;
@@ -511,19 +1051,21 @@ static void on_render_3d(void *user, void *event)
         },
     });
 
-    radius = 1.0f;
-    width = 1.0f;
+    size_t nxpoints = vec_size(&s_debug_saved.xpoints);
+    struct sel_circle *circles = nxpoints ? R_AllocArg(nxpoints * sizeof(struct sel_circle)) : NULL;
 
-    for(int i = 0; i < vec_size(&s_debug_saved.xpoints); i++) {
+    if(circles) {
+
+        for(int i = 0; i < nxpoints; i++) {
+            circles[i] = (struct sel_circle){vec_AT(&s_debug_saved.xpoints, i), 1.0f, 1.0f, green};
+        }
 
         R_PushCmd((struct rcmd){
-            .func = R_GL_DrawSelectionCircle,
-            .nargs = 5,
+            .func = R_GL_DrawSelectionCircles,
+            .nargs = 3,
             .args = {
-                R_PushArg(&vec_AT(&s_debug_saved.xpoints, i), sizeof(vec_AT(&s_debug_saved.xpoints, 0))),
-                R_PushArg(&radius, sizeof(radius)),
-                R_PushArg(&width, sizeof(width)),
-                R_PushArg(&green, sizeof(green)),
+                circles,
+                R_PushArg(&nxpoints, sizeof(nxpoints)),
                 (void*)G_GetPrevTickMap(),
             },
         });
@@ -542,10 +1084,11 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
                                    vec2_t ent_des_v,
                                    const vec_cp_ent_t dyn_neighbs,
                                    const vec_cp_ent_t stat_neighbs,
+                                   const struct work_buffs *work,
                                    vec2_t *out)
 {
-    struct HRVO dyn_hrvos[vec_size(&dyn_neighbs)];
-    struct VO stat_vos[vec_size(&stat_neighbs)];
+    struct HRVO *dyn_hrvos = work->hrvos;
+    struct VO *stat_vos = work->vos;
 
     size_t n_hrvos = compute_all_hrvos(cpent, dyn_neighbs, dyn_hrvos);
     size_t n_vos = compute_all_vos(cpent, stat_neighbs, stat_vos);
@@ -558,9 +1101,12 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
      * obstacle as a union of line segments. 
      */
     const size_t n_rays = (n_hrvos + n_vos) * 2;
-    struct line_2d rays[n_rays];
+    struct line_2d *rays = work->rays;
     rays_repr(dyn_hrvos, n_hrvos, stat_vos, n_vos, rays);
 
+    struct wedge_soa wedges;
+    wedges_repr(rays, n_rays, work->wedge_storage, &wedges);
+
     if(should_save_debug(ent_uid)) {
 
         size_t nsaved_hrvos = n_hrvos <= MAX_SAVED_VOS ? n_hrvos : MAX_SAVED_VOS;
@@ -581,44 +1127,40 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
 
     vec2_t des_v_ws;
     PFM_Vec2_Add(&cpent.xz_pos, &ent_des_v, &des_v_ws);
-    if(!inside_pcr(rays, n_rays, des_v_ws)) {
+    if(!inside_pcr(&wedges, des_v_ws)) {
 
         s_debug_saved.des_v_in_pcr = false;
         *out = ent_des_v;
         return true;
     }
 
-    vec_vec2_t xpoints;
-    vec_vec2_init(&xpoints);
-
-    /* The line segments are intersected pairwise and the intersection points 
-     * inside the combined hybrid reciprocal velocity obstacle are discarded. 
-     * The remaining intersection points are permissible new velocities on the 
-     * boundary of the combined hybrid reciprocal velocity obstacle.
-     */
-    compute_vo_xpoints(rays, n_rays, &xpoints); 
+    bool save = should_save_debug(ent_uid);
+    struct candidates xpoints = {
+        .des_v = ent_des_v,
+        .ent_xz_pos = cpent.xz_pos,
+        .count = 0,
+        .min_dist = INFINITY,
+        .saved = save ? &s_debug_saved.xpoints : NULL,
+    };
 
-    /* In addition we project the preferred velocity (des_v) on to the line 
-     * segments (xz_left_side and xz_right_side of each hrvo) and also retain 
-     * those points that are outside the combined hybrid reciprocal velocity 
-     * obstacle.
-     */
-    compute_vdes_proj_points(rays, n_rays, ent_des_v, &xpoints);
+    /* Find the permissible new velocities on the boundary of the combined
+     * hybrid reciprocal velocity obstacle, keeping the one that is closest
+     * to the desired velocity. */
+    compute_outside_points(rays, n_rays, &wedges, ent_des_v, &work->sweep, &xpoints);
 
-    if(vec_size(&xpoints) == 0) {
+    if(xpoints.count == 0) {
         return false;    
     }
 
-    vec2_t ret = compute_vnew(&xpoints, ent_des_v, cpent.xz_pos);
+    assert(xpoints.min_dist < INFINITY);
+    vec2_t ret = xpoints.best;
 
-    if(should_save_debug(ent_uid)) {
+    if(save) {
     
-        vec_vec2_copy(&s_debug_saved.xpoints, &xpoints);
         s_debug_saved.v_new = ret;
         s_debug_saved.des_v_in_pcr = true;
     }
 
-    vec_vec2_destroy(&xpoints);
     *out = ret;
     return true;
 }
@@ -640,15 +1182,54 @@ void G_ClearPath_Shutdown(void)
     vec_vec2_destroy(&s_debug_saved.xpoints);
 }
 
+bool G_ClearPath_ScratchInit(struct cp_scratch *scratch)
+{
+    scratch->used = 0;
+    scratch->high_water = 0;
+    return sstalloc_init(&scratch->mem);
+}
+
+void G_ClearPath_ScratchDestroy(struct cp_scratch *scratch)
+{
+    sstalloc_destroy(&scratch->mem);
+}
+
+void G_ClearPath_ScratchReset(struct cp_scratch *scratch)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    scratch->high_water = MAX(scratch->high_water, scratch->used);
+    s_scratch_high_water = MAX(s_scratch_high_water, scratch->high_water);
+    scratch->used = 0;
+    sstalloc_clear(&scratch->mem);
+}
+
+size_t G_ClearPath_ScratchHighWater(void)
+{
+    return s_scratch_high_water;
+}
+
 vec2_t G_ClearPath_NewVelocity(struct cp_ent cpent,
                                uint32_t ent_uid,
                                vec2_t ent_des_v,
                                vec_cp_ent_t dyn_neighbs,
-                               vec_cp_ent_t stat_neighbs)
+                               vec_cp_ent_t stat_neighbs,
+                               struct cp_scratch *scratch)
 {
+    while(vec_size(&dyn_neighbs) + vec_size(&stat_neighbs) > CLEARPATH_MAX_NEIGHBOURS) {
+        remove_furthest(cpent.xz_pos, &dyn_neighbs, &stat_neighbs);
+    }
+
+    /* The neighbour sets only shrink from here on, so the buffers sized for 
+     * the first attempt can be reused for all the subsequent ones. */
+    struct work_buffs work;
+    if(!work_buffs_alloc(scratch, vec_size(&dyn_neighbs), vec_size(&stat_neighbs), &work))
+        return (vec2_t){0.0f, 0.0f};
+
     do{
         vec2_t ret;
-        bool found = clearpath_new_velocity(cpent, ent_uid, ent_des_v, dyn_neighbs, stat_neighbs, &ret);
+        bool found = clearpath_new_velocity(cpent, ent_uid, ent_des_v, 
+            dyn_neighbs, stat_neighbs, &work, &ret);
         if(found)
             return ret;
 
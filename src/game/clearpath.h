@@ -38,6 +38,7 @@
 
 #include "../pf_math.h"
 #include "../lib/public/vec.h"
+#include "../lib/public/stalloc.h"
 
 
 #define CLEARPATH_NEIGHBOUR_RADIUS (10.0f)
@@ -45,6 +46,10 @@
  * and leave this as a buffer between it and the obstacle.
  */
 #define CLEARPATH_BUFFER_RADIUS    (0.0f)
+/* Only this many of the nearest neighbours are considered. This bounds the 
+ * amount of scratch memory needed for a single velocity computation. 
+ */
+#define CLEARPATH_MAX_NEIGHBOURS   (64)
 
 struct map;
 
@@ -57,14 +62,34 @@ struct cp_ent{
 VEC_TYPE(cp_ent, struct cp_ent)
 VEC_IMPL(static inline, cp_ent, struct cp_ent)
 
+/* Bump allocator for the temporaries of the velocity computation. Each thread
+ * computing velocities must use its' own. The memory is only reclaimed when 
+ * the arena is reset. With CLEARPATH_MAX_NEIGHBOURS, one tick's worth of
+ * allocations normally fits in the static part of the memstack.
+ */
+struct cp_scratch{
+    struct smemstack mem;
+    size_t           used;
+    size_t           high_water;
+};
+
 void G_ClearPath_Init(const struct map *map);
 void G_ClearPath_Shutdown(void);
 
+bool   G_ClearPath_ScratchInit(struct cp_scratch *scratch);
+void   G_ClearPath_ScratchDestroy(struct cp_scratch *scratch);
+/* Must be called from the main thread when no velocity computations 
+ * using the arena are in flight. */
+void   G_ClearPath_ScratchReset(struct cp_scratch *scratch);
+/* The most scratch memory (in bytes) used by any arena between resets */
+size_t G_ClearPath_ScratchHighWater(void);
+
 vec2_t G_ClearPath_NewVelocity(struct cp_ent ent,
                                uint32_t ent_uid,
                                vec2_t ent_des_v,
                                vec_cp_ent_t dyn_neighbs,
-                               vec_cp_ent_t stat_neighbs);
+                               vec_cp_ent_t stat_neighbs,
+                               struct cp_scratch *scratch);
 
 #endif
 
@@ -38,18 +38,30 @@
 #include "movement.h"
 #include "../event.h"
 #include "../entity.h"
+#include "../perf.h"
 #include "public/game.h"
-#include "../lib/public/khash.h"
+#include "../lib/public/vec.h"
 
 #include <assert.h>
 #include <float.h>
+#include <stdlib.h>
+#include <SDL.h>
 
 
 #define ENEMY_TARGET_ACQUISITION_RANGE (50.0f)
 #define ENEMY_MELEE_ATTACK_RANGE       (5.0f)
+/* Idle entities look for enemies once every ACQUISITION_PERIOD ticks, spread 
+ * out over the ticks by uid. At most ACQUISITION_BUDGET such searches are 
+ * made per tick - the remaining entities are served on the following ticks. */
+#define ACQUISITION_PERIOD             (4)
+#define ACQUISITION_BUDGET             (256)
+/* The candidates collected for each search of a batch. Searches which fill 
+ * up with them are made again on their own. */
+#define ACQUISITION_MAX_CANDS          (64)
 #define EPSILON                        (1.0f/1024)
 #define MAX(a, b)                      ((a) > (b) ? (a) : (b))
 #define ARR_SIZE(a)                    (sizeof(a)/sizeof(a[0]))
+#define STATE_VERSION                  (2)
 
 /*
  *                    Start
@@ -69,81 +81,252 @@
  *                    [STATE_ATTACK_ANIM_PLAYING]-+
  */
 
-struct combatstats{
-    int   base_dmg;         /* The base damage per hit */
-    float base_armour_pc;   /* Percentage of damage blocked. Valid range: [0.0 - 1.0] */
+/* Only the entities in one of the active sets are visited by the combat tick. 
+ * The rest are idle and unwilling to engage, and are left alone until they 
+ * change state or stance. */
+enum active_set{
+    SET_NONE = -1,
+    /* Not in combat, looking for enemies */
+    SET_ACQUIRING,
+    /* Moving to a target or fighting it */
+    SET_ENGAGED,
+    SET_COUNT,
+};
+
+enum combat_state{
+    STATE_NOT_IN_COMBAT,
+    STATE_MOVING_TO_TARGET,
+    STATE_CAN_ATTACK,
+    STATE_ATTACK_ANIM_PLAYING,
+    STATE_COUNT,
 };
 
 struct combatstate{
-    struct combatstats stats;
-    int                current_hp;
     enum combat_stance stance;
-    enum{
-        STATE_NOT_IN_COMBAT,
-        STATE_MOVING_TO_TARGET,
-        STATE_CAN_ATTACK,
-        STATE_ATTACK_ANIM_PLAYING,
-    }state;
-    struct entity     *target;
+    enum combat_state  state;
+    /* The entity this state belongs to. NULL for unused entries. */
+    const struct entity *owner;
+    ent_handle_t       target;
     /* If the target gained a target while moving, save and restore
      * its' intial move command once it finishes combat. */
     bool               move_cmd_interrupted;
     vec2_t             move_cmd_xz;
+    /* The tick at which the entity will next look for enemies while idle. An 
+     * urgent search (after taking damage or finishing a fight) is not subject 
+     * to the per-tick budget. */
+    unsigned long      next_acquire_tick;
+    bool               acquire_urgent;
+    /* The active set the entity is in, and its' index there */
+    enum active_set    set;
+    int                set_idx;
+};
+
+/* An event raised during the tick, which is held back until its' end */
+struct combat_event{
+    enum eventtype type;
+    uint32_t       uid;
 };
 
-KHASH_MAP_INIT_INT(state, struct combatstate)
+/* The saved combat state of an entity. The target is saved by UID. */
+struct combat_rec{
+    uint32_t uid;
+    int32_t  current_hp;
+    int32_t  stance;
+    int32_t  state;
+    int32_t  base_dmg;
+    float    base_armour_pc;
+    int32_t  has_target;
+    uint32_t target;
+    int32_t  move_cmd_interrupted;
+    vec2_t   move_cmd_xz;
+    /* Relative to the tick at which the state was saved */
+    int32_t  acquire_delay;
+    int32_t  acquire_urgent;
+    /* The hits taken since the last tick, which are yet to be dealt */
+    int32_t  has_hits;
+    float    incoming_dmg;
+};
+
+VEC_TYPE(cstate, struct combatstate)
+VEC_IMPL(static inline, cstate, struct combatstate)
+
+VEC_TYPE(slot, uint32_t)
+VEC_IMPL(static inline, slot, uint32_t)
+
+VEC_TYPE(i32, int32_t)
+VEC_IMPL(static inline, i32, int32_t)
+
+VEC_TYPE(f32, float)
+VEC_IMPL(static inline, f32, float)
+
+VEC_TYPE(u8, uint8_t)
+VEC_IMPL(static inline, u8, uint8_t)
+
+VEC_TYPE(cent, struct entity*)
+VEC_IMPL(static inline, cent, struct entity*)
+
+VEC_TYPE(cevent, struct combat_event)
+VEC_IMPL(static inline, cevent, struct combat_event)
+
+VEC_TYPE(cquery, struct pos_circle_query)
+VEC_IMPL(static inline, cquery, struct pos_circle_query)
+
+VEC_TYPE(flag, bool)
+VEC_IMPL(static inline, flag, bool)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-khash_t(state) *s_entity_state_table;
+/* Indexed by entity slot. */
+static vec_cstate_t        s_entity_states;
+/* The numbers that the damage phase works on are kept in dense arrays of 
+ * their own, indexed by entity slot like 's_entity_states'. */
+static vec_i32_t           s_hp;
+static vec_f32_t           s_armour_pc;    /* Percentage of damage blocked: [0.0 - 1.0] */
+static vec_i32_t           s_damage;       /* The base damage per hit */
+/* The damage of the hits taken since the last tick, before the armour. The 
+ * slots with hits are listed in 's_damaged', in the order of the first hit. */
+static vec_f32_t           s_incoming;
+static vec_u8_t            s_has_hits;
+static vec_slot_t          s_damaged;
+/* The entity slots in each of the active sets, in no particular order */
+static vec_slot_t          s_active[SET_COUNT];
+/* The slots visited by each phase of the current tick, by their state at the 
+ * start of it. The sets may change while the tick is being processed, so 
+ * they are not iterated directly. */
+static vec_slot_t          s_phase_slots[STATE_COUNT];
+/* The acquiring entities due for a search on this tick, and what they found */
+static vec_slot_t          s_due;
+static vec_cent_t          s_found;
+/* The batched searches of the due entities and their results */
+static vec_cquery_t        s_queries;
+static vec_cent_t          s_cands;
+static vec_i32_t           s_cand_offsets;
+static vec_flag_t          s_truncated;
+static vec_cent_t          s_dying;
+static vec_cent_t          s_deselected;
+static vec_cevent_t        s_events;
+static bool                s_in_tick;
+static unsigned long       s_tick;
+static struct combat_stats s_stats;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static enum active_set active_set_for(const struct combatstate *cs)
+{
+    if(cs->owner->flags & ENTITY_FLAG_STATIC)
+        return SET_NONE;
+    if(cs->state != STATE_NOT_IN_COMBAT)
+        return SET_ENGAGED;
+    if(cs->stance != COMBAT_STANCE_NO_ENGAGEMENT)
+        return SET_ACQUIRING;
+    return SET_NONE;
+}
+
+static void active_set_remove(struct combatstate *cs)
+{
+    if(cs->set == SET_NONE)
+        return;
+
+    vec_slot_t *set = &s_active[cs->set];
+    uint32_t last = vec_AT(set, vec_size(set) - 1);
+    vec_AT(set, cs->set_idx) = last;
+    vec_AT(&s_entity_states, last).set_idx = cs->set_idx;
+    vec_slot_pop(set);
+
+    cs->set = SET_NONE;
+    cs->set_idx = -1;
+}
+
+/* Must be called after every change to the state or the stance */
+static void active_set_update(struct combatstate *cs)
+{
+    enum active_set newset = active_set_for(cs);
+    if(newset == cs->set)
+        return;
+
+    active_set_remove(cs);
+    if(newset == SET_NONE)
+        return;
+
+    bool ret = vec_slot_push(&s_active[newset], cs->owner->slot);
+    assert(ret);
+    (void)ret;
+
+    cs->set = newset;
+    cs->set_idx = vec_size(&s_active[newset]) - 1;
+}
+
 /* The returned pointer is guaranteed to be valid to write to for
  * so long as we don't add anything to the table. At that point, there
  * is a case that a 'realloc' might take place. */
 static struct combatstate *combatstate_get(const struct entity *ent)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    if(k == kh_end(s_entity_state_table))
+    if(ent->slot >= vec_size(&s_entity_states))
         return NULL;
 
-    return &kh_value(s_entity_state_table, k);
+    struct combatstate *cs = &vec_AT(&s_entity_states, ent->slot);
+    return (cs->owner == ent) ? cs : NULL;
 }
 
 static void combatstate_set(const struct entity *ent, const struct combatstate *cs)
 {
     assert(ent->flags & ENTITY_FLAG_COMBATABLE);
+    assert(cs->owner == ent);
+
+    while(vec_size(&s_entity_states) <= ent->slot) {
+        bool ret = vec_cstate_push(&s_entity_states, (struct combatstate){0})
+                && vec_i32_push(&s_hp, 0)
+                && vec_f32_push(&s_armour_pc, 0.0f)
+                && vec_i32_push(&s_damage, 0)
+                && vec_f32_push(&s_incoming, 0.0f)
+                && vec_u8_push(&s_has_hits, false);
+        assert(ret);
+        (void)ret;
+    }
 
-    int ret;
-    khiter_t k = kh_put(state, s_entity_state_table, ent->uid, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(s_entity_state_table, k) = *cs;
+    assert(vec_AT(&s_entity_states, ent->slot).owner == NULL);
+    struct combatstate *dst = &vec_AT(&s_entity_states, ent->slot);
+    *dst = *cs;
+    dst->set = SET_NONE;
+    dst->set_idx = -1;
+    active_set_update(dst);
 }
 
 static void combatstate_remove(const struct entity *ent)
 {
     assert(ent->flags & ENTITY_FLAG_COMBATABLE);
 
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    if(k != kh_end(s_entity_state_table))
-        kh_del(state, s_entity_state_table, k);
+    struct combatstate *cs = combatstate_get(ent);
+    if(!cs)
+        return;
+
+    /* The slot may be taken by a new entity before the next tick. Its' 
+     * entry in 's_damaged' is skipped. */
+    vec_AT(&s_incoming, ent->slot) = 0.0f;
+    vec_AT(&s_has_hits, ent->slot) = false;
+
+    active_set_remove(cs);
+    cs->owner = NULL;
 }
 
-static bool enemies(const struct entity *a, const struct entity *b)
+/* Returns NULL if the target is gone from the simulation */
+static struct entity *combatstate_target(const struct combatstate *cs)
 {
-    if(a->faction_id == b->faction_id)
-        return false;
-
-    enum diplomacy_state ds;
-    bool result = G_GetDiplomacyState(a->faction_id, b->faction_id, &ds);
+    return G_EntFromHandle(cs->target);
+}
 
-    assert(result);
-    return (ds == DIPLOMACY_STATE_WAR);
+/* Within the tick, the events are held back until all the phases are done */
+static void notify(enum eventtype type, uint32_t uid)
+{
+    if(s_in_tick) {
+        vec_cevent_push(&s_events, (struct combat_event){type, uid});
+        return;
+    }
+    E_Entity_Notify(type, uid, NULL, ES_ENGINE);
 }
 
 static float ents_distance(const struct entity *a, const struct entity *b)
@@ -157,30 +340,107 @@ static float ents_distance(const struct entity *a, const struct entity *b)
 
 static struct entity *closest_enemy_in_range(const struct entity *ent)
 {
-    float min_dist = FLT_MAX;
-    struct entity *ret = NULL;
+    return G_Pos_NearestEnemy(G_Pos_GetXZ(ent->uid), ent->faction_id, 
+        ENEMY_TARGET_ACQUISITION_RANGE);
+}
+
+static bool enemy_pred(const struct entity *ent, void *arg)
+{
+    const struct entity *self = arg;
+    enum diplomacy_state ds;
 
-    struct entity *near_ents[128];
-    int num_near = G_Pos_EntsInCircle(G_Pos_GetXZ(ent->uid), 
-        ENEMY_TARGET_ACQUISITION_RANGE, near_ents, ARR_SIZE(near_ents));
+    return (ent->flags & ENTITY_FLAG_COMBATABLE)
+        && ent->faction_id != self->faction_id
+        && G_GetDiplomacyState(self->faction_id, ent->faction_id, &ds)
+        && ds == DIPLOMACY_STATE_WAR;
+}
 
-    for(int i = 0; i < num_near; i++) {
+static bool reserve_searches(size_t nqueries)
+{
+    size_t ncands = nqueries * ACQUISITION_MAX_CANDS;
 
-        struct entity *curr = near_ents[i];
-        if(curr == ent)
-            continue;
-        if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
-            continue;
-        if(!enemies(ent, curr))
+    if(s_queries.capacity < nqueries && !vec_cquery_resize(&s_queries, nqueries))
+        return false;
+    if(s_cands.capacity < ncands && !vec_cent_resize(&s_cands, ncands))
+        return false;
+    if(s_cand_offsets.capacity < nqueries + 1 && !vec_i32_resize(&s_cand_offsets, nqueries + 1))
+        return false;
+    if(s_truncated.capacity < nqueries && !vec_flag_resize(&s_truncated, nqueries))
+        return false;
+    return true;
+}
+
+/* Sets 's_found' to the closest enemy in range of each of the 's_due' 
+ * entities, or NULL. All the searches are answered by one batched query. */
+static void find_closest_enemies(void)
+{
+    size_t nqueries = vec_size(&s_due);
+    int ncands = -1;
+    if(nqueries == 0)
+        return;
+
+    if(reserve_searches(nqueries)) {
+
+        for(int i = 0; i < nqueries; i++) {
+            const struct combatstate *cs = &vec_AT(&s_entity_states, vec_AT(&s_due, i));
+            vec_AT(&s_queries, i) = (struct pos_circle_query){
+                .xz_point = G_Pos_GetXZ(cs->owner->uid),
+                .range = ENEMY_TARGET_ACQUISITION_RANGE,
+                .predicate = enemy_pred,
+                .arg = (void*)cs->owner,
+            };
+        }
+        ncands = G_Pos_EntsInCircleBatch(s_queries.array, nqueries, ACQUISITION_MAX_CANDS, 
+            s_cands.array, s_cand_offsets.array, s_truncated.array);
+    }
+
+    for(int i = 0; i < nqueries; i++) {
+
+        const struct combatstate *cs = &vec_AT(&s_entity_states, vec_AT(&s_due, i));
+        if(ncands < 0 || vec_AT(&s_truncated, i)) {
+            vec_cent_push(&s_found, closest_enemy_in_range(cs->owner));
             continue;
-   
-        float dist = ents_distance(ent, curr);
-        if(dist < min_dist) {
-            min_dist = dist; 
-            ret = curr;
         }
+
+        vec2_t xz_pos = G_Pos_GetXZ(cs->owner->uid);
+        float min_dist = FLT_MAX;
+        struct entity *closest = NULL;
+
+        for(int j = vec_AT(&s_cand_offsets, i); j < vec_AT(&s_cand_offsets, i + 1); j++) {
+
+            struct entity *curr = vec_AT(&s_cands, j);
+            vec2_t delta, curr_xz_pos = G_Pos_GetXZ(curr->uid);
+            PFM_Vec2_Sub(&xz_pos, &curr_xz_pos, &delta);
+
+            if(PFM_Vec2_Len(&delta) < min_dist) {
+                min_dist = PFM_Vec2_Len(&delta);
+                closest = curr;
+            }
+        }
+        vec_cent_push(&s_found, closest);
     }
-    return ret;
+}
+
+static void schedule_acquisition_now(struct combatstate *cs)
+{
+    cs->next_acquire_tick = s_tick;
+    cs->acquire_urgent = true;
+}
+
+static bool acquisition_due(struct combatstate *cs, int *inout_budget)
+{
+    if(cs->next_acquire_tick > s_tick)
+        return false;
+
+    if(!cs->acquire_urgent) {
+        if(*inout_budget == 0)
+            return false;
+        --*inout_budget;
+    }
+
+    cs->next_acquire_tick = s_tick + ACQUISITION_PERIOD;
+    cs->acquire_urgent = false;
+    return true;
 }
 
 static quat_t quat_from_vec(vec2_t dir)
@@ -205,6 +465,7 @@ static void entity_turn_to_target(struct entity *ent, const struct entity *targe
     PFM_Vec2_Sub(&tar_pos_xz, &ent_pos_xz, &ent_to_target);
     PFM_Vec2_Normal(&ent_to_target, &ent_to_target);
     ent->rotation = quat_from_vec(ent_to_target);
+    Entity_InvalidateModel(ent);
 }
 
 static void on_death_anim_finish(void *user, void *event)
@@ -215,6 +476,16 @@ static void on_death_anim_finish(void *user, void *event)
     G_Zombiefy(self);
 }
 
+/* The damage is dealt, less the armour, in the damage phase of the next tick */
+static void queue_hit(uint32_t slot, float dmg)
+{
+    if(!vec_AT(&s_has_hits, slot)) {
+        vec_AT(&s_has_hits, slot) = true;
+        vec_slot_push(&s_damaged, slot);
+    }
+    vec_AT(&s_incoming, slot) += dmg;
+}
+
 static void on_attack_anim_finish(void *user, void *event)
 {
     const struct entity *self = user;
@@ -224,161 +495,296 @@ static void on_attack_anim_finish(void *user, void *event)
     struct combatstate *cs = combatstate_get(self);
     assert(cs);
     assert(cs->state == STATE_ATTACK_ANIM_PLAYING);
-    assert(cs->target);
+    assert(cs->target != NULL_HANDLE);
 
     cs->state = STATE_CAN_ATTACK;
+    active_set_update(cs);
 
-    struct combatstate *target_cs = combatstate_get(cs->target);
+    /* The attacker took lethal damage in this tick and is only waiting for
+     * its death to be resolved */
+    if(vec_AT(&s_hp, self->slot) == 0 && self->max_hp > 0)
+        return;
+
+    struct entity *target = combatstate_target(cs);
+    struct combatstate *target_cs = target ? combatstate_get(target) : NULL;
     if(!target_cs)
         return; /* Our target already got 'killed' */
 
-    if(ents_distance(self, cs->target) <= ENEMY_MELEE_ATTACK_RANGE) {
+    if(ents_distance(self, target) <= ENEMY_MELEE_ATTACK_RANGE) {
+        queue_hit(target->slot, vec_AT(&s_damage, self->slot));
+    }
+}
 
-        float dmg = G_Combat_GetBaseDamage(self) * (1.0f - G_Combat_GetBaseArmour(cs->target));
-        target_cs->current_hp = MAX(0.0f, target_cs->current_hp - dmg);
+static void finish_combat(struct entity *curr, struct combatstate *cs)
+{
+    cs->state = STATE_NOT_IN_COMBAT; 
+    cs->target = NULL_HANDLE;
+    schedule_acquisition_now(cs);
+    active_set_update(cs);
 
-        if(target_cs->current_hp == 0.0f && cs->target->max_hp > 0) {
+    if(cs->move_cmd_interrupted) {
+        G_Move_SetDest(curr, cs->move_cmd_xz);
+        cs->move_cmd_interrupted = false;
+    }
+}
 
-            G_Move_Stop(cs->target);
-            G_Combat_RemoveEntity(cs->target);
-            cs->target->flags &= ~ENTITY_FLAG_COMBATABLE;
+/* Sorts the active entities by the phase of the tick which handles them */
+static void phase_gather(void)
+{
+    for(int i = 0; i < STATE_COUNT; i++) {
+        vec_slot_reset(&s_phase_slots[i]);
+    }
 
-            if(cs->target->flags & ENTITY_FLAG_SELECTABLE) {
-                G_Sel_Remove(cs->target);
-                cs->target->flags &= ~ENTITY_FLAG_SELECTABLE;
-            }
+    for(int i = 0; i < SET_COUNT; i++) {
+        for(int j = 0; j < vec_size(&s_active[i]); j++) {
 
-            E_Entity_Notify(EVENT_ENTITY_DEATH, cs->target->uid, NULL, ES_ENGINE);
-            E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, cs->target->uid, on_death_anim_finish,
-                cs->target, G_RUNNING);
+            uint32_t slot = vec_AT(&s_active[i], j);
+            const struct combatstate *cs = &vec_AT(&s_entity_states, slot);
+            vec_slot_push(&s_phase_slots[cs->state], slot);
         }
     }
 }
 
-static void on_30hz_tick(void *user, void *event)
+/* Returns the state of the slot, if it's still in the phase it was gathered 
+ * into. Entities may change state or leave the simulation during the tick. */
+static struct combatstate *phase_state(uint32_t slot, enum combat_state phase)
 {
-    uint32_t key;
-    struct entity *curr;
-    (void)key;
+    struct combatstate *cs = &vec_AT(&s_entity_states, slot);
+    if(!cs->owner || cs->set == SET_NONE || cs->state != phase)
+        return NULL;
+    assert(cs->owner->flags & ENTITY_FLAG_COMBATABLE);
+    return cs;
+}
 
-    kh_foreach(G_GetDynamicEntsSet(), key, curr, {
+/* The searches for the nearest enemy only read the positions, so they are 
+ * all made up front and are independent of one another. Then, the entities 
+ * act on what they found, in order. */
+static void phase_acquire(void)
+{
+    const vec_slot_t *slots = &s_phase_slots[STATE_NOT_IN_COMBAT];
+    int budget = ACQUISITION_BUDGET;
 
-        if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
+    vec_slot_reset(&s_due);
+    vec_cent_reset(&s_found);
+
+    for(int i = 0; i < vec_size(slots); i++) {
+
+        struct combatstate *cs = phase_state(vec_AT(slots, i), STATE_NOT_IN_COMBAT);
+        if(!cs || cs->stance == COMBAT_STANCE_NO_ENGAGEMENT)
             continue;
+        if(!acquisition_due(cs, &budget))
+            continue;
+        vec_slot_push(&s_due, vec_AT(slots, i));
+    }
 
-        struct combatstate *cs = combatstate_get(curr);
-        assert(cs);
+    find_closest_enemies();
 
-        switch(cs->state) {
-        case STATE_NOT_IN_COMBAT: 
-        {
-            if(cs->stance == COMBAT_STANCE_NO_ENGAGEMENT)
-                break;
+    for(int i = 0; i < vec_size(&s_due); i++) {
 
-            /* Make the entity seek enemy units. */
-            struct entity *enemy;
-            if((enemy = closest_enemy_in_range(curr)) != NULL) {
+        struct entity *enemy = vec_AT(&s_found, i);
+        struct combatstate *cs = phase_state(vec_AT(&s_due, i), STATE_NOT_IN_COMBAT);
+        if(!enemy || !cs)
+            continue;
 
-                if(ents_distance(curr, enemy) <= ENEMY_MELEE_ATTACK_RANGE) {
+        /* Make the entity seek enemy units. */
+        struct entity *curr = (struct entity*)cs->owner;
+        if(ents_distance(curr, enemy) <= ENEMY_MELEE_ATTACK_RANGE) {
 
-                    assert(cs->stance == COMBAT_STANCE_AGGRESSIVE 
-                        || cs->stance == COMBAT_STANCE_HOLD_POSITION);
+            assert(cs->stance == COMBAT_STANCE_AGGRESSIVE 
+                || cs->stance == COMBAT_STANCE_HOLD_POSITION);
 
-                    cs->target = enemy;
-                    cs->state = STATE_CAN_ATTACK;
+            cs->target = G_EntHandle(enemy);
+            cs->state = STATE_CAN_ATTACK;
+            active_set_update(cs);
 
-                    entity_turn_to_target(curr, enemy);
-                    E_Entity_Notify(EVENT_ATTACK_START, curr->uid, NULL, ES_ENGINE);
-                
-                }else if(cs->stance == COMBAT_STANCE_AGGRESSIVE) {
+            entity_turn_to_target(curr, enemy);
+            notify(EVENT_ATTACK_START, curr->uid);
+        
+        }else if(cs->stance == COMBAT_STANCE_AGGRESSIVE) {
 
-                    cs->target = enemy;
-                    cs->state = STATE_MOVING_TO_TARGET;
+            cs->target = G_EntHandle(enemy);
+            cs->state = STATE_MOVING_TO_TARGET;
+            active_set_update(cs);
 
-                    vec2_t move_dest_xz;
-                    if(!cs->move_cmd_interrupted && G_Move_GetDest(curr, &move_dest_xz)) {
-                        cs->move_cmd_interrupted = true; 
-                        cs->move_cmd_xz = move_dest_xz;
-                    }
-                    G_Move_SetSeekEnemies(curr);
-                }
+            vec2_t move_dest_xz;
+            if(!cs->move_cmd_interrupted && G_Move_GetDest(curr, &move_dest_xz)) {
+                cs->move_cmd_interrupted = true; 
+                cs->move_cmd_xz = move_dest_xz;
             }
-            break;
+            G_Move_SetSeekEnemies(curr);
         }
-        case STATE_MOVING_TO_TARGET:
-        {
-            assert(cs->target);
+    }
+}
 
-            /* Handle the case where our target dies before we reach it */
-            struct entity *enemy = closest_enemy_in_range(curr);
-            if(!enemy) {
-
-                cs->state = STATE_NOT_IN_COMBAT; 
-                cs->target = NULL;
-
-                if(cs->move_cmd_interrupted) {
-                    G_Move_SetDest(curr, cs->move_cmd_xz);
-                    cs->move_cmd_interrupted = false;
-                }else {
-                    G_Move_Stop(curr);
-                }
-                break;
-
-            /* And the case where a different target becomes even closer */
-            }else if(enemy != cs->target) {
-                cs->target = enemy;
-            }
+static void phase_approach(void)
+{
+    const vec_slot_t *slots = &s_phase_slots[STATE_MOVING_TO_TARGET];
+
+    for(int i = 0; i < vec_size(slots); i++) {
+
+        struct combatstate *cs = phase_state(vec_AT(slots, i), STATE_MOVING_TO_TARGET);
+        if(!cs)
+            continue;
 
-            /* Check if we're within attacking range of our target */
-            if(ents_distance(curr, cs->target) <= ENEMY_MELEE_ATTACK_RANGE) {
+        struct entity *curr = (struct entity*)cs->owner;
+        assert(cs->target != NULL_HANDLE);
 
-                cs->state = STATE_CAN_ATTACK;
+        /* Handle the case where our target dies before we reach it */
+        struct entity *enemy = closest_enemy_in_range(curr);
+        if(!enemy) {
+
+            bool resume = cs->move_cmd_interrupted;
+            finish_combat(curr, cs);
+            if(!resume) {
                 G_Move_Stop(curr);
-                entity_turn_to_target(curr, enemy);
-                E_Entity_Notify(EVENT_ATTACK_START, curr->uid, NULL, ES_ENGINE);
             }
-            break;
+            continue;
+
+        /* And the case where a different target becomes even closer */
+        }else if(enemy != combatstate_target(cs)) {
+            cs->target = G_EntHandle(enemy);
+        }
+
+        /* Check if we're within attacking range of our target */
+        if(ents_distance(curr, enemy) <= ENEMY_MELEE_ATTACK_RANGE) {
+
+            cs->state = STATE_CAN_ATTACK;
+            active_set_update(cs);
+            G_Move_Stop(curr);
+            entity_turn_to_target(curr, enemy);
+            notify(EVENT_ATTACK_START, curr->uid);
         }
-        case STATE_CAN_ATTACK:
-        {
-            /* Perform combat simulation between entities with targets within range */
-            assert(cs->target);
-
-            /* Our target could have 'died' and had its' combatstate removed - check this first. */
-            struct combatstate *target_cs;
-            if((target_cs = combatstate_get(cs->target)) == NULL
-            || ents_distance(curr, cs->target) > ENEMY_MELEE_ATTACK_RANGE) {
-
-                /* First check if there's another suitable target */
-                struct entity *enemy = closest_enemy_in_range(curr);
-                if(enemy && ents_distance(curr, enemy) <= ENEMY_MELEE_ATTACK_RANGE) {
-                    cs->target = enemy;
-                    entity_turn_to_target(curr, cs->target);
-                    break;
-                }
-
-                cs->state = STATE_NOT_IN_COMBAT; 
-                E_Entity_Notify(EVENT_ATTACK_END, curr->uid, NULL, ES_ENGINE);
-
-                if(cs->move_cmd_interrupted) {
-                    G_Move_SetDest(curr, cs->move_cmd_xz);
-                    cs->move_cmd_interrupted = false;
-                }
-
-            }else{
-                cs->state = STATE_ATTACK_ANIM_PLAYING;
-                E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, curr->uid, on_attack_anim_finish, curr, G_RUNNING);
+    }
+}
+
+static void phase_attack(void)
+{
+    const vec_slot_t *slots = &s_phase_slots[STATE_CAN_ATTACK];
+
+    for(int i = 0; i < vec_size(slots); i++) {
+
+        struct combatstate *cs = phase_state(vec_AT(slots, i), STATE_CAN_ATTACK);
+        if(!cs)
+            continue;
+
+        /* Perform combat simulation between entities with targets within range */
+        struct entity *curr = (struct entity*)cs->owner;
+        assert(cs->target != NULL_HANDLE);
+
+        /* Our target could have been removed from the simulation, or 'died' and had 
+         * its' combatstate removed - check this first. */
+        struct entity *target = combatstate_target(cs);
+        if(!target
+        || combatstate_get(target) == NULL
+        || ents_distance(curr, target) > ENEMY_MELEE_ATTACK_RANGE) {
+
+            /* First check if there's another suitable target */
+            struct entity *enemy = closest_enemy_in_range(curr);
+            if(enemy && ents_distance(curr, enemy) <= ENEMY_MELEE_ATTACK_RANGE) {
+                cs->target = G_EntHandle(enemy);
+                entity_turn_to_target(curr, enemy);
+                continue;
             }
 
-            break;
+            finish_combat(curr, cs);
+            notify(EVENT_ATTACK_END, curr->uid);
+
+        }else{
+            cs->state = STATE_ATTACK_ANIM_PLAYING;
+            active_set_update(cs);
+            E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, curr->uid, on_attack_anim_finish, curr, G_RUNNING);
         }
-        case STATE_ATTACK_ANIM_PLAYING:
-            /* No-op */
-            break;
-        default: assert(0);
-        };
-    
-    });
+    }
+}
+
+/* Deals all the hits taken since the last tick. Only the dense arrays are 
+ * touched, except for the (rare) entities that were hit while idle or killed. */
+static void phase_apply_damage(void)
+{
+    vec_cent_reset(&s_dying);
+
+    for(int i = 0; i < vec_size(&s_damaged); i++) {
+
+        uint32_t slot = vec_AT(&s_damaged, i);
+        if(!vec_AT(&s_has_hits, slot))
+            continue;
+
+        float dmg = vec_AT(&s_incoming, slot) * (1.0f - vec_AT(&s_armour_pc, slot));
+        vec_AT(&s_hp, slot) = MAX(0.0f, vec_AT(&s_hp, slot) - dmg);
+        vec_AT(&s_incoming, slot) = 0.0f;
+        vec_AT(&s_has_hits, slot) = false;
+
+        struct combatstate *cs = &vec_AT(&s_entity_states, slot);
+        assert(cs->owner);
+
+        if(cs->state == STATE_NOT_IN_COMBAT)
+            schedule_acquisition_now(cs);
+
+        if(vec_AT(&s_hp, slot) == 0 && cs->owner->max_hp > 0)
+            vec_cent_push(&s_dying, (struct entity*)cs->owner);
+    }
+    vec_slot_reset(&s_damaged);
+}
+
+static void phase_resolve_deaths(void)
+{
+    vec_cent_reset(&s_deselected);
+
+    for(int i = 0; i < vec_size(&s_dying); i++) {
+
+        struct entity *ent = vec_AT(&s_dying, i);
+        G_Move_Stop(ent);
+        G_Combat_RemoveEntity(ent);
+        ent->flags &= ~ENTITY_FLAG_COMBATABLE;
+
+        if(ent->flags & ENTITY_FLAG_SELECTABLE) {
+            vec_cent_push(&s_deselected, ent);
+            ent->flags &= ~ENTITY_FLAG_SELECTABLE;
+        }
+
+        notify(EVENT_ENTITY_DEATH, ent->uid);
+        E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, ent->uid, on_death_anim_finish,
+            ent, G_RUNNING);
+    }
+
+    if(vec_size(&s_deselected)) {
+        G_Sel_RemoveBatch(s_deselected.array, vec_size(&s_deselected));
+    }
+}
+
+static void flush_events(void)
+{
+    for(int i = 0; i < vec_size(&s_events); i++) {
+        const struct combat_event *ev = &vec_AT(&s_events, i);
+        E_Entity_Notify(ev->type, ev->uid, NULL, ES_ENGINE);
+    }
+    vec_cevent_reset(&s_events);
+}
+
+/* The tick is made up of phases, each going over all the entities in one 
+ * state at the start of the tick. The hits are dealt all at once after the 
+ * entities have acted, then the killed entities are taken out of combat. 
+ * The events raised along the way are emitted together at the end. */
+static void on_30hz_tick(void *user, void *event)
+{
+    PERF_ENTER();
+    uint64_t start = SDL_GetPerformanceCounter();
+    s_tick++;
+    s_in_tick = true;
+
+    phase_gather();
+    phase_acquire();
+    phase_approach();
+    phase_attack();
+    phase_apply_damage();
+    phase_resolve_deaths();
+
+    s_in_tick = false;
+    flush_events();
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    s_stats.tick_ms += (elapsed * 1000.0) / SDL_GetPerformanceFrequency();
+    PERF_RETURN_VOID();
 }
 
 /*****************************************************************************/
@@ -387,9 +793,30 @@ static void on_30hz_tick(void *user, void *event)
 
 bool G_Combat_Init(void)
 {
-    if(NULL == (s_entity_state_table = kh_init(state)))
-        return false;
-
+    vec_cstate_init(&s_entity_states);
+    vec_i32_init(&s_hp);
+    vec_f32_init(&s_armour_pc);
+    vec_i32_init(&s_damage);
+    vec_f32_init(&s_incoming);
+    vec_u8_init(&s_has_hits);
+    vec_slot_init(&s_damaged);
+    for(int i = 0; i < SET_COUNT; i++) {
+        vec_slot_init(&s_active[i]);
+    }
+    for(int i = 0; i < STATE_COUNT; i++) {
+        vec_slot_init(&s_phase_slots[i]);
+    }
+    vec_slot_init(&s_due);
+    vec_cent_init(&s_found);
+    vec_cquery_init(&s_queries);
+    vec_cent_init(&s_cands);
+    vec_i32_init(&s_cand_offsets);
+    vec_flag_init(&s_truncated);
+    vec_cent_init(&s_dying);
+    vec_cent_init(&s_deselected);
+    vec_cevent_init(&s_events);
+    s_in_tick = false;
+    s_stats = (struct combat_stats){0};
     E_Global_Register(EVENT_30HZ_TICK, on_30hz_tick, NULL, G_RUNNING);
     return true;
 }
@@ -397,7 +824,28 @@ bool G_Combat_Init(void)
 void G_Combat_Shutdown(void)
 {
     E_Global_Unregister(EVENT_30HZ_TICK, on_30hz_tick);
-    kh_destroy(state, s_entity_state_table);
+    vec_cevent_destroy(&s_events);
+    vec_cent_destroy(&s_deselected);
+    vec_cent_destroy(&s_dying);
+    vec_flag_destroy(&s_truncated);
+    vec_i32_destroy(&s_cand_offsets);
+    vec_cent_destroy(&s_cands);
+    vec_cquery_destroy(&s_queries);
+    vec_cent_destroy(&s_found);
+    vec_slot_destroy(&s_due);
+    for(int i = 0; i < STATE_COUNT; i++) {
+        vec_slot_destroy(&s_phase_slots[i]);
+    }
+    for(int i = 0; i < SET_COUNT; i++) {
+        vec_slot_destroy(&s_active[i]);
+    }
+    vec_slot_destroy(&s_damaged);
+    vec_u8_destroy(&s_has_hits);
+    vec_f32_destroy(&s_incoming);
+    vec_i32_destroy(&s_damage);
+    vec_f32_destroy(&s_armour_pc);
+    vec_i32_destroy(&s_hp);
+    vec_cstate_destroy(&s_entity_states);
 }
 
 void G_Combat_AddEntity(const struct entity *ent, enum combat_stance initial)
@@ -406,14 +854,19 @@ void G_Combat_AddEntity(const struct entity *ent, enum combat_stance initial)
     assert(ent->flags & ENTITY_FLAG_COMBATABLE);
 
     struct combatstate new_cs = (struct combatstate) {
-        .stats = {0},
-        .current_hp = ent->max_hp,
         .stance = initial,
         .state = STATE_NOT_IN_COMBAT,
-        .target = NULL,
-        .move_cmd_interrupted = false
+        .owner = ent,
+        .target = NULL_HANDLE,
+        .move_cmd_interrupted = false,
+        .next_acquire_tick = s_tick + ent->uid % ACQUISITION_PERIOD,
+        .acquire_urgent = false,
     };
     combatstate_set(ent, &new_cs);
+
+    vec_AT(&s_hp, ent->slot) = ent->max_hp;
+    vec_AT(&s_armour_pc, ent->slot) = 0.0f;
+    vec_AT(&s_damage, ent->slot) = 0;
 }
 
 void G_Combat_RemoveEntity(const struct entity *ent)
@@ -429,7 +882,7 @@ void G_Combat_RemoveEntity(const struct entity *ent)
 
     if(cs->state == STATE_ATTACK_ANIM_PLAYING
     || cs->state == STATE_CAN_ATTACK) {
-        E_Entity_Notify(EVENT_ATTACK_END, ent->uid, NULL, ES_ENGINE);
+        notify(EVENT_ATTACK_END, ent->uid);
     }
     combatstate_remove(ent);
 }
@@ -451,11 +904,12 @@ bool G_Combat_SetStance(const struct entity *ent, enum combat_stance stance)
 
         G_Move_RemoveEntity(ent);
         cs->state = STATE_NOT_IN_COMBAT;
-        cs->target = NULL;
+        cs->target = NULL_HANDLE;
         cs->move_cmd_interrupted = false;
     }
 
     cs->stance = stance;
+    active_set_update(cs);
     return true;
 }
 
@@ -478,11 +932,12 @@ void G_Combat_StopAttack(const struct entity *ent)
 
     if(cs->state == STATE_ATTACK_ANIM_PLAYING
     || cs->state == STATE_CAN_ATTACK) {
-        E_Entity_Notify(EVENT_ATTACK_END, ent->uid, NULL, ES_ENGINE);
+        notify(EVENT_ATTACK_END, ent->uid);
     }
 
     cs->state = STATE_NOT_IN_COMBAT;
-    cs->target = NULL;
+    cs->target = NULL_HANDLE;
+    active_set_update(cs);
 
     if(cs->move_cmd_interrupted) {
         G_Move_SetDest(ent, cs->move_cmd_xz);
@@ -496,34 +951,167 @@ int G_Combat_GetCurrentHP(const struct entity *ent)
 
     struct combatstate *cs = combatstate_get(ent);
     assert(cs);
-    return cs->current_hp;
+    (void)cs;
+    return vec_AT(&s_hp, ent->slot);
 }
 
 void G_Combat_SetBaseArmour(const struct entity *ent, float armour_pc)
 {
-    struct combatstate *cs = combatstate_get(ent);
-    assert(cs);
-    cs->stats.base_armour_pc = armour_pc;
+    assert(combatstate_get(ent));
+    vec_AT(&s_armour_pc, ent->slot) = armour_pc;
 }
 
 float G_Combat_GetBaseArmour(const struct entity *ent)
 {
-    struct combatstate *cs = combatstate_get(ent);
-    assert(cs);
-    return cs->stats.base_armour_pc;
+    assert(combatstate_get(ent));
+    return vec_AT(&s_armour_pc, ent->slot);
 }
 
 void G_Combat_SetBaseDamage(const struct entity *ent, int dmg)
 {
-    struct combatstate *cs = combatstate_get(ent);
-    assert(cs);
-    cs->stats.base_dmg = dmg;
+    assert(combatstate_get(ent));
+    vec_AT(&s_damage, ent->slot) = dmg;
 }
 
 int G_Combat_GetBaseDamage(const struct entity *ent)
 {
-    struct combatstate *cs = combatstate_get(ent);
-    assert(cs);
-    return cs->stats.base_dmg;
+    assert(combatstate_get(ent));
+    return vec_AT(&s_damage, ent->slot);
+}
+
+
+void G_Combat_ApplyHits(const struct proj_hit *hits, size_t nhits)
+{
+    for(size_t i = 0; i < nhits; i++) {
+
+        /* The target may have been killed since the hit was made */
+        struct entity *target = G_EntityForUID(hits[i].target);
+        struct combatstate *target_cs = target ? combatstate_get(target) : NULL;
+        if(!target_cs)
+            continue;
+
+        queue_hit(target->slot, hits[i].damage);
+    }
+}
+
+void G_Combat_GetStats(struct combat_stats *out_stats)
+{
+    *out_stats = s_stats;
 }
 
+bool G_Combat_SaveState(SDL_RWops *stream)
+{
+    uint64_t nents = 0;
+    for(int i = 0; i < vec_size(&s_entity_states); i++) {
+        if(vec_AT(&s_entity_states, i).owner)
+            nents++;
+    }
+
+    struct combat_rec *recs = malloc(sizeof(struct combat_rec) * nents + 1);
+    if(!recs)
+        return false;
+
+    size_t n = 0;
+    for(int i = 0; i < vec_size(&s_entity_states); i++) {
+
+        const struct combatstate *cs = &vec_AT(&s_entity_states, i);
+        if(!cs->owner)
+            continue;
+
+        const struct entity *target = combatstate_target(cs);
+        recs[n++] = (struct combat_rec){
+            .uid = cs->owner->uid,
+            .current_hp = vec_AT(&s_hp, i),
+            .stance = cs->stance,
+            .state = cs->state,
+            .base_dmg = vec_AT(&s_damage, i),
+            .base_armour_pc = vec_AT(&s_armour_pc, i),
+            .has_target = (target != NULL),
+            .target = target ? target->uid : 0,
+            .move_cmd_interrupted = cs->move_cmd_interrupted,
+            .move_cmd_xz = cs->move_cmd_xz,
+            .acquire_delay = (cs->next_acquire_tick > s_tick) ? cs->next_acquire_tick - s_tick : 0,
+            .acquire_urgent = cs->acquire_urgent,
+            .has_hits = vec_AT(&s_has_hits, i),
+            .incoming_dmg = vec_AT(&s_incoming, i),
+        };
+    }
+    assert(n == nents);
+
+    uint64_t size = sizeof(nents) + nents * sizeof(struct combat_rec);
+    bool ret = G_WriteSection(stream, STATE_TAG_COMBAT, STATE_VERSION, size)
+            && SDL_RWwrite(stream, &nents, sizeof(nents), 1) == 1
+            && (nents == 0 || SDL_RWwrite(stream, recs, sizeof(struct combat_rec), nents) == nents);
+    free(recs);
+    return ret;
+}
+
+bool G_Combat_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                        const khash_t(entity) *remap)
+{
+    uint64_t nents;
+    if(hdr->version != STATE_VERSION)
+        return false;
+    if(SDL_RWread(stream, &nents, sizeof(nents), 1) != 1)
+        return false;
+    if(nents > hdr->size / sizeof(struct combat_rec))
+        return false;
+
+    struct combat_rec *recs = malloc(sizeof(struct combat_rec) * nents + 1);
+    if(!recs)
+        return false;
+
+    if(nents > 0 && SDL_RWread(stream, recs, sizeof(struct combat_rec), nents) != nents) {
+        free(recs);
+        return false;
+    }
+
+    bool ret = true;
+    for(int i = 0; i < nents; i++) {
+
+        const struct combat_rec *rec = &recs[i];
+        if(rec->state < STATE_NOT_IN_COMBAT || rec->state > STATE_ATTACK_ANIM_PLAYING
+        || rec->stance < COMBAT_STANCE_AGGRESSIVE || rec->stance > COMBAT_STANCE_NO_ENGAGEMENT) {
+            ret = false;
+            break;
+        }
+
+        khiter_t k = kh_get(entity, remap, rec->uid);
+        if(k == kh_end(remap))
+            continue;
+
+        const struct entity *ent = kh_value(remap, k);
+        struct combatstate *cs = combatstate_get(ent);
+        if(!cs)
+            continue;
+
+        vec_AT(&s_hp, ent->slot) = rec->current_hp;
+        vec_AT(&s_damage, ent->slot) = rec->base_dmg;
+        vec_AT(&s_armour_pc, ent->slot) = rec->base_armour_pc;
+        if(rec->has_hits) {
+            queue_hit(ent->slot, rec->incoming_dmg);
+        }
+        cs->stance = rec->stance;
+        cs->move_cmd_interrupted = rec->move_cmd_interrupted;
+        cs->move_cmd_xz = rec->move_cmd_xz;
+        cs->next_acquire_tick = s_tick + rec->acquire_delay;
+        cs->acquire_urgent = rec->acquire_urgent;
+
+        /* The animation event which ends the attack is not saved - the 
+         * attack is resumed from the point where it is started over */
+        cs->state = (rec->state == STATE_ATTACK_ANIM_PLAYING) ? STATE_CAN_ATTACK : rec->state;
+        cs->target = NULL_HANDLE;
+
+        if(rec->has_target && (k = kh_get(entity, remap, rec->target)) != kh_end(remap))
+            cs->target = G_EntHandle(kh_value(remap, k));
+
+        if(cs->target == NULL_HANDLE && cs->state != STATE_NOT_IN_COMBAT) {
+            cs->state = STATE_NOT_IN_COMBAT;
+            schedule_acquisition_now(cs);
+        }
+        active_set_update(cs);
+    }
+
+    free(recs);
+    return ret;
+}
@@ -40,6 +40,8 @@
 #include <stdbool.h>
 
 struct entity;
+struct state_section;
+struct proj_hit;
 
 
 bool G_Combat_Init(void);
@@ -49,6 +51,17 @@ void G_Combat_AddEntity(const struct entity *ent, enum combat_stance initial);
 void G_Combat_RemoveEntity(const struct entity *ent);
 void G_Combat_StopAttack(const struct entity *ent);
 void G_Combat_ClearSavedMoveCmd(const struct entity *ent);
+/* Queues a tick's worth of projectile hits. Their damage is dealt, less the 
+ * armour of each target, in the damage phase of the next combat tick, along 
+ * with the melee hits. Hits on entities that are no longer combatable are 
+ * ignored. */
+void G_Combat_ApplyHits(const struct proj_hit *hits, size_t nhits);
+
+/* Serialize the combat state of all combatable entities, and restore it onto 
+ * the entities that were recreated from the saved ones. */
+bool G_Combat_SaveState(SDL_RWops *stream);
+bool G_Combat_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                        const khash_t(entity) *remap);
 
 #endif
 
@@ -0,0 +1,451 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "fog_of_war.h"
+#include "public/game.h"
+#include "../entity.h"
+#include "../main.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../render/public/render.h"
+#include "../render/public/render_ctrl.h"
+#include "../lib/public/khash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+/* The brightness of the tiles in the fog of war texture */
+#define FOG_VISIBLE     (255)
+#define FOG_EXPLORED    (110)
+#define FOG_UNEXPLORED  (0)
+
+struct vision_src{
+    int   faction_id;
+    float range;
+    /* The tile that the source is currently stamped at */
+    int   r, c;
+};
+
+KHASH_MAP_INIT_INT(vsrc, struct vision_src)
+
+struct fog_faction{
+    /* The number of vision sources that each tile is in range of */
+    uint16_t *visible;
+    uint8_t  *explored;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct{
+    bool               active;
+    vec3_t             map_pos;
+    int                rows, cols;
+    struct fog_faction factions[MAX_FACTIONS];
+    khash_t(vsrc)     *sources;
+    /* The factions whose combined view is shown to the player. The fog is 
+     * disabled when there are none. */
+    uint16_t           player_mask;
+    bool               uploaded;
+    /* The brightness of every tile for the player's factions, and the 
+     * (inclusive) bounds of the tiles which changed since the last upload */
+    uint8_t           *bright;
+    int                dirty_rmin, dirty_rmax;
+    int                dirty_cmin, dirty_cmax;
+}s_fog;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void fog_tile_for_pos(vec2_t xz, int *out_r, int *out_c)
+{
+    int r = floorf((xz.z - s_fog.map_pos.z) / Z_COORDS_PER_TILE);
+    int c = floorf((s_fog.map_pos.x - xz.x) / X_COORDS_PER_TILE);
+    *out_r = MIN(MAX(r, 0), s_fog.rows - 1);
+    *out_c = MIN(MAX(c, 0), s_fog.cols - 1);
+}
+
+static void fog_mark_dirty(int rmin, int rmax, int cmin, int cmax)
+{
+    s_fog.dirty_rmin = MIN(s_fog.dirty_rmin, rmin);
+    s_fog.dirty_rmax = MAX(s_fog.dirty_rmax, rmax);
+    s_fog.dirty_cmin = MIN(s_fog.dirty_cmin, cmin);
+    s_fog.dirty_cmax = MAX(s_fog.dirty_cmax, cmax);
+}
+
+static void fog_clear_dirty(void)
+{
+    s_fog.dirty_rmin = s_fog.rows;
+    s_fog.dirty_rmax = -1;
+    s_fog.dirty_cmin = s_fog.cols;
+    s_fog.dirty_cmax = -1;
+}
+
+static bool fog_faction_grids(int faction_id)
+{
+    struct fog_faction *fac = &s_fog.factions[faction_id];
+    if(fac->visible)
+        return true;
+
+    size_t ntiles = s_fog.rows * s_fog.cols;
+    fac->visible = calloc(ntiles, sizeof(uint16_t));
+    fac->explored = calloc(ntiles, sizeof(uint8_t));
+
+    if(!fac->visible || !fac->explored) {
+        free(fac->visible);
+        free(fac->explored);
+        memset(fac, 0, sizeof(*fac));
+        return false;
+    }
+    return true;
+}
+
+/* Adds or removes a reference to all the tiles with their centers within 
+ * 'range' of the center of the tile at (r, c). The stamp only depends on 
+ * the tile, so moving around inside a tile never touches the grid. */
+static void fog_stamp(int faction_id, int r, int c, float range, int ref_delta)
+{
+    struct fog_faction *fac = &s_fog.factions[faction_id];
+    assert(fac->visible);
+
+    int rad_r = range / Z_COORDS_PER_TILE;
+    int rad_c = range / X_COORDS_PER_TILE;
+    int rmin = MAX(r - rad_r, 0), rmax = MIN(r + rad_r, s_fog.rows - 1);
+    int cmin = MAX(c - rad_c, 0), cmax = MIN(c + rad_c, s_fog.cols - 1);
+
+    for(int i = rmin; i <= rmax; i++) {
+    for(int j = cmin; j <= cmax; j++) {
+
+        float dz = (i - r) * Z_COORDS_PER_TILE;
+        float dx = (j - c) * X_COORDS_PER_TILE;
+        if(dx * dx + dz * dz > range * range)
+            continue;
+
+        size_t idx = i * s_fog.cols + j;
+        assert(ref_delta > 0 || fac->visible[idx] > 0);
+        fac->visible[idx] += ref_delta;
+        fac->explored[idx] = 1;
+    }}
+
+    if(s_fog.player_mask & (1u << faction_id)) {
+        fog_mark_dirty(rmin, rmax, cmin, cmax);
+    }
+}
+
+static bool fog_has_vision(const struct entity *ent)
+{
+    return (ent->vision_range > 0.0f)
+        && (ent->faction_id >= 0 && ent->faction_id < MAX_FACTIONS)
+        && !(ent->flags & ENTITY_FLAG_ZOMBIE);
+}
+
+static uint8_t fog_brightness(size_t idx)
+{
+    uint8_t ret = FOG_UNEXPLORED;
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+
+        if(!(s_fog.player_mask & (1u << i)))
+            continue;
+
+        const struct fog_faction *fac = &s_fog.factions[i];
+        if(!fac->visible)
+            continue;
+
+        if(fac->visible[idx])
+            return FOG_VISIBLE;
+        if(fac->explored[idx])
+            ret = FOG_EXPLORED;
+    }
+    return ret;
+}
+
+static void fog_upload_dirty(void)
+{
+    if(s_fog.dirty_rmax < s_fog.dirty_rmin || s_fog.dirty_cmax < s_fog.dirty_cmin)
+        return;
+
+    int nr = s_fog.dirty_rmax - s_fog.dirty_rmin + 1;
+    int nc = s_fog.dirty_cmax - s_fog.dirty_cmin + 1;
+
+    uint8_t *texels = R_AllocArg(nr * nc);
+    if(!texels)
+        return;
+
+    for(int r = 0; r < nr; r++) {
+    for(int c = 0; c < nc; c++) {
+
+        size_t idx = (s_fog.dirty_rmin + r) * s_fog.cols + (s_fog.dirty_cmin + c);
+        s_fog.bright[idx] = fog_brightness(idx);
+        texels[r * nc + c] = s_fog.bright[idx];
+    }}
+
+    int dims[2] = {s_fog.cols, s_fog.rows};
+    int rect[4] = {s_fog.dirty_cmin, s_fog.dirty_rmin, nc, nr};
+    vec4_t bounds = (vec4_t){
+        s_fog.map_pos.x, 
+        s_fog.map_pos.z, 
+        s_fog.cols * X_COORDS_PER_TILE, 
+        s_fog.rows * Z_COORDS_PER_TILE
+    };
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_FogUpdate,
+        .nargs = 4,
+        .args = {
+            R_PushArg(dims, sizeof(dims)),
+            R_PushArg(rect, sizeof(rect)),
+            R_PushArg(&bounds, sizeof(bounds)),
+            texels,
+        },
+    });
+    s_fog.uploaded = true;
+    fog_clear_dirty();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Fog_Init(const struct map *map)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_fog.active);
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    s_fog.rows = res.chunk_h * res.tile_h;
+    s_fog.cols = res.chunk_w * res.tile_w;
+
+    vec3_t center = M_GetCenterPos(map);
+    s_fog.map_pos = (vec3_t){
+        center.x + (s_fog.cols * X_COORDS_PER_TILE) / 2.0f,
+        center.y,
+        center.z - (s_fog.rows * Z_COORDS_PER_TILE) / 2.0f,
+    };
+
+    s_fog.bright = malloc(s_fog.rows * s_fog.cols);
+    if(!s_fog.bright)
+        goto fail_bright;
+
+    s_fog.sources = kh_init(vsrc);
+    if(!s_fog.sources)
+        goto fail_sources;
+
+    memset(s_fog.factions, 0, sizeof(s_fog.factions));
+    memset(s_fog.bright, FOG_UNEXPLORED, s_fog.rows * s_fog.cols);
+    s_fog.player_mask = 0;
+    s_fog.uploaded = false;
+    fog_clear_dirty();
+
+    s_fog.active = true;
+    return true;
+
+fail_sources:
+    free(s_fog.bright);
+fail_bright:
+    return false;
+}
+
+void G_Fog_Shutdown(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_fog.active)
+        return;
+
+    if(s_fog.uploaded) {
+        R_PushCmd((struct rcmd){ R_GL_FogDisable, 0 });
+    }
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        free(s_fog.factions[i].visible);
+        free(s_fog.factions[i].explored);
+    }
+    kh_destroy(vsrc, s_fog.sources);
+    free(s_fog.bright);
+    memset(&s_fog, 0, sizeof(s_fog));
+}
+
+void G_Fog_AddEntity(const struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_fog.active || !fog_has_vision(ent))
+        return;
+
+    if(!fog_faction_grids(ent->faction_id))
+        return;
+
+    int ret;
+    khiter_t k = kh_put(vsrc, s_fog.sources, ent->uid, &ret);
+    if(ret == -1 || ret == 0)
+        return;
+
+    struct vision_src *src = &kh_value(s_fog.sources, k);
+    src->faction_id = ent->faction_id;
+    src->range = ent->vision_range;
+    fog_tile_for_pos(G_Pos_GetXZ(ent->uid), &src->r, &src->c);
+    fog_stamp(src->faction_id, src->r, src->c, src->range, +1);
+}
+
+void G_Fog_RemoveEntity(const struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_fog.active)
+        return;
+
+    khiter_t k = kh_get(vsrc, s_fog.sources, ent->uid);
+    if(k == kh_end(s_fog.sources))
+        return;
+
+    const struct vision_src *src = &kh_value(s_fog.sources, k);
+    fog_stamp(src->faction_id, src->r, src->c, src->range, -1);
+    kh_del(vsrc, s_fog.sources, k);
+}
+
+void G_Fog_UpdateEntity(const struct entity *ent)
+{
+    G_Fog_RemoveEntity(ent);
+    G_Fog_AddEntity(ent);
+}
+
+void G_Fog_Update(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_fog.active)
+        return;
+
+    for(khiter_t k = kh_begin(s_fog.sources); k != kh_end(s_fog.sources); k++) {
+
+        if(!kh_exist(s_fog.sources, k))
+            continue;
+        uint32_t uid = kh_key(s_fog.sources, k);
+        struct vision_src *src = &kh_value(s_fog.sources, k);
+
+        int r, c;
+        fog_tile_for_pos(G_Pos_GetXZ(uid), &r, &c);
+        if(r == src->r && c == src->c)
+            continue;
+
+        fog_stamp(src->faction_id, r, c, src->range, +1);
+        fog_stamp(src->faction_id, src->r, src->c, src->range, -1);
+        src->r = r;
+        src->c = c;
+    }
+
+    if(s_fog.player_mask) {
+        fog_upload_dirty();
+    }
+}
+
+void G_Fog_SetPlayerFactions(uint16_t faction_mask)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_fog.active || faction_mask == s_fog.player_mask)
+        return;
+
+    s_fog.player_mask = faction_mask;
+    if(!faction_mask) {
+        if(s_fog.uploaded) {
+            R_PushCmd((struct rcmd){ R_GL_FogDisable, 0 });
+            s_fog.uploaded = false;
+        }
+        return;
+    }
+    fog_mark_dirty(0, s_fog.rows - 1, 0, s_fog.cols - 1);
+}
+
+uint16_t G_Fog_GetPlayerFactions(void)
+{
+    return s_fog.player_mask;
+}
+
+bool G_Fog_Visible(int faction_id, vec2_t xz)
+{
+    if(!s_fog.active || faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return false;
+
+    const struct fog_faction *fac = &s_fog.factions[faction_id];
+    if(!fac->visible)
+        return false;
+
+    int r, c;
+    fog_tile_for_pos(xz, &r, &c);
+    return (fac->visible[r * s_fog.cols + c] > 0);
+}
+
+bool G_Fog_Explored(int faction_id, vec2_t xz)
+{
+    if(!s_fog.active || faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return false;
+
+    const struct fog_faction *fac = &s_fog.factions[faction_id];
+    if(!fac->explored)
+        return false;
+
+    int r, c;
+    fog_tile_for_pos(xz, &r, &c);
+    return fac->explored[r * s_fog.cols + c];
+}
+
+bool G_Fog_EntVisible(const struct entity *ent)
+{
+    if(!s_fog.player_mask)
+        return true;
+
+    if(ent->faction_id >= 0 && ent->faction_id < MAX_FACTIONS
+    && (s_fog.player_mask & (1u << ent->faction_id)))
+        return true;
+
+    int r, c;
+    fog_tile_for_pos(G_Pos_GetXZ(ent->uid), &r, &c);
+    uint8_t bright = s_fog.bright[r * s_fog.cols + c];
+
+    if(ent->flags & ENTITY_FLAG_STATIC)
+        return (bright != FOG_UNEXPLORED);
+    return (bright == FOG_VISIBLE);
+}
+
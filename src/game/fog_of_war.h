@@ -0,0 +1,66 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef FOG_OF_WAR_H
+#define FOG_OF_WAR_H
+
+#include <stdbool.h>
+
+struct map;
+struct entity;
+
+bool G_Fog_Init(const struct map *map);
+void G_Fog_Shutdown(void);
+
+/* Entities with a positive 'vision_range' and a valid faction reveal the 
+ * tiles within the range to their faction. They are tracked from when they 
+ * are added, and only re-stamped into the grid when they enter another tile. */
+void G_Fog_AddEntity(const struct entity *ent);
+void G_Fog_RemoveEntity(const struct entity *ent);
+/* Must be called after the faction or the vision range of the entity change */
+void G_Fog_UpdateEntity(const struct entity *ent);
+
+/* Applies the movement of the vision sources since the last call and 
+ * uploads the changed part of the player's fog to the renderer. Called 
+ * once per frame, before the entities are culled. */
+void G_Fog_Update(void);
+
+/* False for entities hidden from the player by the fog of war. Units are 
+ * only shown on the currently visible tiles, while static entities stay 
+ * shown on all the tiles that have been explored. */
+bool G_Fog_EntVisible(const struct entity *ent);
+
+#endif
+
@@ -42,10 +42,16 @@
 #include "combat.h" 
 #include "clearpath.h"
 #include "position.h"
+#include "fog_of_war.h"
+#include "scenery.h"
+#include "projectile.h"
+#include "lights.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
+#include "../render/public/render_al.h"
 #include "../anim/public/anim.h"
 #include "../map/public/map.h"
+#include "../map/public/tile.h"
 #include "../entity.h"
 #include "../camera.h"
 #include "../cam_control.h"
@@ -56,8 +62,13 @@
 #include "../settings.h"
 #include "../main.h"
 #include "../ui.h"
+#include "../perf.h"
 
 #include <assert.h> 
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
 
 
 #define CAM_HEIGHT          175.0f
@@ -66,9 +77,29 @@
 
 #define ACTIVE_CAM          (s_gs.cameras[s_gs.active_cam_idx])
 #define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define CLAMP(a, min, max)  (MIN(MAX((a), (min)), (max)))
+
+/* The frusta which the entities are culled against, as bits of a mask */
+#define CULL_CAM            (0)
+#define CULL_REFLECT        (1)
+#define CULL_CASCADE(i)     (2 + (i))
+#define CULL_NFRUSTA        (2 + CONFIG_SHADOW_CASCADES)
+#define CULL_ALL            ((1u << CULL_NFRUSTA) - 1)
+/* The number of entities tested against the frusta at a time */
+#define CULL_BATCH          (64)
+/* The number of entities handed to a worker at a time by the parallel loops */
+#define PARALLEL_GRAIN      (128)
+
+#define FACTIONS_VERSION    (1)
 
 VEC_IMPL(extern, obb, struct obb)
 __KHASH_IMPL(entity, extern, khint32_t, struct entity*, 1, kh_int_hash_func, kh_int_hash_equal)
+__KHASH_IMPL(entidx, extern, khint32_t, int, 1, kh_int_hash_func, kh_int_hash_equal)
+
+VEC_TYPE(vec3, vec3_t)
+VEC_IMPL(static inline, vec3, vec3_t)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -76,10 +107,155 @@ __KHASH_IMPL(entity, extern, khint32_t, struct entity*, 1, kh_int_hash_func, kh_
 
 static struct gamestate s_gs;
 
+/* Handles to the settings which are read every frame, resolved once on 
+ * initialization to avoid hashing the names on every access. */
+static struct{
+    const struct sval *healthbar_mode;
+    const struct sval *shadows_enabled;
+    const struct sval *terrain_lod_dist;
+    const struct sval *anim_interp_dist;
+    const struct sval *occlusion_culling;
+    const struct sval *water_refraction;
+    const struct sval *water_reflection;
+    const struct sval *water_low_res;
+    const struct sval *water_reuse_frames;
+}s_setts;
+
+/* While a save is being loaded, the entities recreated by the unpickler are 
+ * held back and added to the simulation in bulk once they are all known. 
+ * The saved UIDs are mapped to the recreated entities, so that the native 
+ * sections of the save can be applied to them. */
+static struct{
+    bool             active;
+    khash_t(entity) *remap;
+    vec_pentity_t    ents;
+    vec_vec3_t       pos;
+}s_load;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static bool g_entlist_init(struct entity_list *list)
+{
+    vec_pentity_init(&list->ents);
+    list->index = kh_init(entidx);
+    return (list->index != NULL);
+}
+
+static void g_entlist_destroy(struct entity_list *list)
+{
+    kh_destroy(entidx, list->index);
+    vec_pentity_destroy(&list->ents);
+}
+
+static void g_entlist_clear(struct entity_list *list)
+{
+    kh_clear(entidx, list->index);
+    vec_pentity_reset(&list->ents);
+}
+
+static bool g_entlist_reserve(struct entity_list *list, size_t nents)
+{
+    size_t size = vec_size(&list->ents) + nents;
+    if(list->ents.capacity < size && !vec_pentity_resize(&list->ents, size))
+        return false;
+    return (kh_resize(entidx, list->index, size * 4 / 3 + 1) >= 0);
+}
+
+static bool g_entlist_add(struct entity_list *list, struct entity *ent)
+{
+    if(!vec_pentity_push(&list->ents, ent))
+        return false;
+
+    int status;
+    khiter_t k = kh_put(entidx, list->index, ent->uid, &status);
+    if(status == -1) {
+        vec_pentity_pop(&list->ents);
+        return false;
+    }
+    assert(status != 0);
+    kh_value(list->index, k) = vec_size(&list->ents) - 1;
+    return true;
+}
+
+static void g_entlist_remove(struct entity_list *list, const struct entity *ent)
+{
+    khiter_t k = kh_get(entidx, list->index, ent->uid);
+    assert(k != kh_end(list->index));
+
+    int idx = kh_value(list->index, k);
+    kh_del(entidx, list->index, k);
+    vec_pentity_del(&list->ents, idx);
+
+    if(idx == vec_size(&list->ents))
+        return;
+
+    /* Patch the index of the entity that was moved into the vacated slot */
+    const struct entity *moved = vec_AT(&list->ents, idx);
+    k = kh_get(entidx, list->index, moved->uid);
+    assert(k != kh_end(list->index));
+    kh_value(list->index, k) = idx;
+}
+
+static bool g_slot_alloc(struct entity *ent)
+{
+    int idx = s_gs.free_slot;
+    if(idx >= 0) {
+        s_gs.free_slot = vec_AT(&s_gs.slots, idx).next_free;
+    }else{
+        struct entity_slot slot = (struct entity_slot){NULL, 1, -1};
+        if(!vec_entslot_push(&s_gs.slots, slot))
+            return false;
+        idx = vec_size(&s_gs.slots) - 1;
+    }
+
+    vec_AT(&s_gs.slots, idx).ent = ent;
+    ent->slot = idx;
+    return true;
+}
+
+static void g_slot_free(int idx)
+{
+    struct entity_slot *slot = &vec_AT(&s_gs.slots, idx);
+    assert(slot->ent);
+
+    slot->ent = NULL;
+    /* Generation 0 is reserved for NULL_HANDLE */
+    if(++slot->gen == 0)
+        slot->gen = 1;
+    slot->next_free = s_gs.free_slot;
+    s_gs.free_slot = idx;
+}
+
+static void g_slots_clear(void)
+{
+    for(int i = 0; i < vec_size(&s_gs.slots); i++) {
+        if(vec_AT(&s_gs.slots, i).ent)
+            g_slot_free(i);
+    }
+}
+
+static void g_free_snapshots(void)
+{
+    for(int i = 0; i < NUM_WS; i++) {
+        free((void*)s_gs.prev_tick_map[i]);
+        s_gs.prev_tick_map[i] = NULL;
+    }
+}
+
+static bool g_alloc_snapshots(size_t copysize)
+{
+    for(int i = 0; i < NUM_WS; i++) {
+        s_gs.prev_tick_map[i] = malloc(copysize);
+        if(!s_gs.prev_tick_map[i]) {
+            g_free_snapshots();
+            return false;
+        }
+    }
+    return true;
+}
+
 static vec2_t g_default_minimap_pos(void)
 {
     struct sval res = (struct sval){ 
@@ -95,15 +271,91 @@ static vec2_t g_default_minimap_pos(void)
     };
 }
 
+static void g_cull_grid_init(void)
+{
+    int dim = 1;
+    if(s_gs.map) {
+        struct map_resolution res;
+        M_GetResolution(s_gs.map, &res);
+        while(dim < res.chunk_w || dim < res.chunk_h)
+            dim *= 2;
+    }
+
+    size_t nnodes = 0;
+    for(int d = dim; d > 0; d /= 2)
+        nnodes += d * d;
+
+    s_gs.cull_dim = dim;
+    vec_cullnode_reset(&s_gs.cull_nodes);
+    vec_cullnode_resize(&s_gs.cull_nodes, nnodes);
+}
+
 static void g_reset_camera(struct camera *cam)
 {
     Camera_SetPitchAndYaw(cam, -(90.0f - CAM_TILT_UP_DEGREES), 90.0f + 45.0f);
     Camera_SetPos(cam, (vec3_t){ 0.0f, CAM_HEIGHT, 0.0f }); 
 }
 
+static void g_zombiefy(struct entity *ent)
+{
+    if(!(ent->flags & ENTITY_FLAG_STATIC)) {
+        khiter_t k = kh_get(entity, s_gs.dynamic, ent->uid);
+        assert(k != kh_end(s_gs.dynamic));
+        kh_del(entity, s_gs.dynamic, k);
+    }
+
+    G_Move_RemoveEntity(ent);
+    G_Combat_RemoveEntity(ent);
+    G_Fog_RemoveEntity(ent);
+    G_Scenery_Remove(ent);
+
+    ent->flags &= ~ENTITY_FLAG_SELECTABLE;
+    ent->flags &= ~ENTITY_FLAG_COLLISION;
+    ent->flags &= ~ENTITY_FLAG_COMBATABLE;
+    ent->flags &= ~ENTITY_FLAG_ANIMATED;
+
+    ent->flags |= ENTITY_FLAG_INVISIBLE;
+    ent->flags |= ENTITY_FLAG_STATIC;
+    ent->flags |= ENTITY_FLAG_ZOMBIE;
+}
+
+/* Entities which die in large fights tend to do so in bunches. Turning them 
+ * into zombies all at once lets the selection change be notified once. */
+static void g_sweep_dying(void)
+{
+    size_t ndying = vec_size(&s_gs.dying);
+    if(ndying == 0)
+        return;
+
+    struct entity *selectable[ndying];
+    size_t nselectable = 0;
+
+    for(int i = 0; i < ndying; i++) {
+
+        /* The entity may have been removed in the meantime */
+        struct entity *curr = G_EntFromHandle(vec_AT(&s_gs.dying, i));
+        if(!curr || (curr->flags & ENTITY_FLAG_ZOMBIE))
+            continue;
+        if(curr->flags & ENTITY_FLAG_SELECTABLE)
+            selectable[nselectable++] = curr;
+    }
+    G_Sel_RemoveBatch(selectable, nselectable);
+
+    for(int i = 0; i < ndying; i++) {
+
+        struct entity *curr = G_EntFromHandle(vec_AT(&s_gs.dying, i));
+        if(!curr || (curr->flags & ENTITY_FLAG_ZOMBIE))
+            continue;
+        g_zombiefy(curr);
+    }
+    vec_handle_reset(&s_gs.dying);
+}
+
 static void g_reset(void)
 {
     G_Sel_Clear();
+    G_Scenery_Clear();
+    G_Lights_Clear();
 
     uint32_t key;
     struct entity *curr;
@@ -115,9 +367,14 @@ static void g_reset(void)
 
     kh_clear(entity, s_gs.active);
     kh_clear(entity, s_gs.dynamic);
+    vec_handle_reset(&s_gs.dying);
+    g_entlist_clear(&s_gs.active_list);
+    g_slots_clear();
     vec_pentity_reset(&s_gs.visible);
-    vec_pentity_reset(&s_gs.light_visible);
+    vec_drawent_reset(&s_gs.drawn);
     vec_obb_reset(&s_gs.visible_obbs);
+    s_gs.shadow_cache_valid = false;
+    R_HiZInvalidate();
 
     if(s_gs.map) {
 
@@ -125,14 +382,17 @@ static void g_reset(void)
         M_FreeMinimap(s_gs.map);
         AL_MapFree(s_gs.map);
         G_Move_Shutdown();
+        G_Proj_Shutdown();
         G_Combat_Shutdown();
         G_ClearPath_Shutdown();
+        G_Fog_Shutdown();
         G_Pos_Shutdown();
 
         s_gs.map = NULL;
-        free((void*)s_gs.prev_tick_map);
-        s_gs.prev_tick_map = NULL;
+        g_free_snapshots();
+        g_cull_grid_init();
     }
+    s_gs.navcache_path[0] = '\0';
 
     for(int i = 0; i < NUM_CAMERAS; i++) {
         g_reset_camera(s_gs.cameras[i]);
@@ -166,124 +426,365 @@ static void g_init_map(void)
     M_InitMinimap(s_gs.map, g_default_minimap_pos());
     G_Move_Init(s_gs.map);
     G_Combat_Init();
+    G_Proj_Init(s_gs.map);
     G_ClearPath_Init(s_gs.map);
     G_Pos_Init(s_gs.map);
+    G_Fog_Init(s_gs.map);
     N_FC_ClearAll();
     N_FC_ClearStats();
+    g_cull_grid_init();
+
+    /* From here on, only the changes get copied into the snapshots */
+    for(int i = 0; i < NUM_WS; i++) {
+        M_AL_ShallowCopy((struct map*)s_gs.prev_tick_map[i], s_gs.map);
+    }
 }
 
-static void g_shadow_pass(const struct camera *cam, const struct map *map, 
-                          vec_rstat_t stat_ents, vec_ranim_t anim_ents)
+static int g_compare_priv(const void *a, const void *b)
 {
-    vec3_t pos = Camera_GetPos(cam);
-    vec3_t dir = Camera_GetDir(cam);
+    uintptr_t pa = (uintptr_t)(*(const struct ent_rstate**)a)->render_private;
+    uintptr_t pb = (uintptr_t)(*(const struct ent_rstate**)b)->render_private;
+    return (pa > pb) - (pa < pb);
+}
 
-    R_PushCmd((struct rcmd){ 
-        .func = R_GL_DepthPassBegin, 
-        .nargs = 3,
-        .args = { 
-            R_PushArg(&s_gs.light_pos, sizeof(s_gs.light_pos)),
-            R_PushArg(&pos, sizeof(pos)),
-            R_PushArg(&dir, sizeof(dir)),
-        },
-    });
+static int g_compare_shadow_priv(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t)(*(const struct ent_rstate**)a)->shadow_private;
+    uintptr_t pb = (uintptr_t)(*(const struct ent_rstate**)b)->shadow_private;
+    return (pa > pb) - (pa < pb);
+}
+
+static const void *g_pass_priv(const struct ent_rstate *rstate, bool shadow)
+{
+    return shadow ? rstate->shadow_private : rstate->render_private;
+}
+
+/* Gathers the static or animated entities drawn in 'pass', sorted by their 
+ * 'render_private' (or 'shadow_private' when 'shadow' is set). Returns the 
+ * count. */
+static size_t g_gather_pass(const struct ent_rstate *ents, size_t nents, uint32_t pass, 
+                            bool animated, bool shadow, const struct ent_rstate **out)
+{
+    size_t ret = 0;
+    for(int i = 0; i < nents; i++) {
 
-    if(map) {
-        M_RenderVisibleMap(map, cam, true, RENDER_PASS_DEPTH);
+        if(!(ents[i].passes & pass))
+            continue;
+        if(!!ents[i].palettes != animated)
+            continue;
+        out[ret++] = &ents[i];
     }
+    qsort(out, ret, sizeof(out[0]), shadow ? g_compare_shadow_priv : g_compare_priv);
+    return ret;
+}
+
+/* Entities sharing a 'render_private' (i.e. the same mesh) are drawn with a 
+ * single instanced command. 'type' is one of RCMD_DRAW_INSTANCED or 
+ * RCMD_RENDER_DEPTH_MAP_INSTANCED. The depth maps are drawn with the shadow 
+ * proxies. */
+static void g_push_stat_instances(const struct ent_rstate *ents, size_t nents, 
+                                  uint32_t pass, enum rcmd_type type)
+{
+    if(nents == 0)
+        return;
+
+    const bool shadow = (type == RCMD_RENDER_DEPTH_MAP_INSTANCED);
+    const struct ent_rstate *sorted[nents];
+    nents = g_gather_pass(ents, nents, pass, false, shadow, sorted);
+
+    size_t end;
+    for(size_t begin = 0; begin < nents; begin = end) {
+
+        const void *priv = g_pass_priv(sorted[begin], shadow);
+        for(end = begin + 1; end < nents && g_pass_priv(sorted[end], shadow) == priv; end++)
+            ;
+        const size_t count = end - begin;
+
+        mat4x4_t *models = R_AllocArg(sizeof(mat4x4_t) * count);
+        if(!models)
+            continue;
+
+        for(int i = 0; i < count; i++)
+            models[i] = sorted[begin + i]->model;
 
-    for(int i = 0; i < vec_size(&stat_ents); i++) {
-    
-        struct ent_stat_rstate *curr = &vec_AT(&stat_ents, i);
         R_PushCmd((struct rcmd){
-            .func = R_GL_RenderDepthMap,
-            .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&curr->model, sizeof(curr->model)),
+            .type = type,
+            .as_draw_instanced = {
+                .render_private = priv,
+                .models = models,
+                .count = count,
             },
         });
     }
+}
 
-    for(int i = 0; i < vec_size(&anim_ents); i++) {
-    
-        struct ent_anim_rstate *curr = &vec_AT(&anim_ents, i);
+/* Fills in the instanced command for the animated entities in 'sorted', which 
+ * all share the same 'render_private'. When 'skin_first' is set, the 
+ * instances refer to their' slots in it by their index in 'ents'. */
+static bool g_make_anim_instances(const struct ent_rstate **sorted, size_t count, 
+                                  const struct ent_rstate *ents, int *skin_first,
+                                  struct rcmd_draw_instanced *out)
+{
+    const size_t njoints = sorted[0]->njoints;
+
+    mat4x4_t *models = R_AllocArg(sizeof(mat4x4_t) * count);
+    mat4x4_t *normals = R_AllocArg(sizeof(mat4x4_t) * count);
+    struct rcmd_palette_ref *refs = R_AllocArg(sizeof(struct rcmd_palette_ref) * count);
+    int *slots = skin_first ? R_AllocArg(sizeof(int) * count) : NULL;
+    if(!models || !normals || !refs || (skin_first && !slots))
+        return false;
+
+    for(int i = 0; i < count; i++) {
+
+        const struct ent_rstate *curr = sorted[i];
+        assert(curr->njoints == njoints && curr->palettes == sorted[0]->palettes);
+
+        models[i] = curr->model;
+        normals[i] = curr->normal;
+
+        refs[i] = (struct rcmd_palette_ref){
+            .curr = curr->palette_offset,
+            .next = curr->next_palette_offset,
+            .blend = curr->blend,
+        };
+
+        if(slots) {
+            slots[i] = curr - ents;
+        }
+    }
+
+    *out = (struct rcmd_draw_instanced){
+        .render_private = sorted[0]->render_private,
+        .models = models,
+        .normals = normals,
+        .palettes = sorted[0]->palettes,
+        .palette_refs = refs,
+        .count = count,
+        .njoints = njoints,
+        .skin_slots = slots,
+        .skin_first = skin_first,
+    };
+    return true;
+}
+
+static void g_push_anim_instances(const struct ent_rstate *ents, size_t nents, int *skin_first,
+                                  uint32_t pass, enum rcmd_type type)
+{
+    if(nents == 0)
+        return;
+
+    const struct ent_rstate *sorted[nents];
+    size_t ndrawn = g_gather_pass(ents, nents, pass, true, false, sorted);
+
+    size_t end;
+    for(size_t begin = 0; begin < ndrawn; begin = end) {
+
+        const void *priv = sorted[begin]->render_private;
+        for(end = begin + 1; end < ndrawn && sorted[end]->render_private == priv; end++)
+            ;
+
+        struct rcmd cmd = (struct rcmd){ .type = type };
+        if(!g_make_anim_instances(sorted + begin, end - begin, ents, skin_first, &cmd.as_draw_instanced))
+            continue;
+        R_PushCmd(cmd);
+    }
+}
+
+/* The animated entities drawn in more than one pass are skinned once, up 
+ * front, into a buffer which all the passes then draw them from. The ones 
+ * drawn in a single pass are still skinned by it. */
+static void g_preskin(struct render_input *in)
+{
+    in->skin_first = NULL;
+    if(in->nents == 0)
+        return;
+
+    const struct ent_rstate *sorted[in->nents];
+    size_t nskinned = 0;
+
+    for(int i = 0; i < in->nents; i++) {
+
+        const struct ent_rstate *curr = &in->ents[i];
+        if(!curr->palettes)
+            continue;
+        if(!(curr->passes & (curr->passes - 1)))
+            continue;
+        sorted[nskinned++] = curr;
+    }
+
+    if(nskinned == 0)
+        return;
+    qsort(sorted, nskinned, sizeof(sorted[0]), g_compare_priv);
+
+    int *skin_first = R_AllocArg(sizeof(int) * in->nents);
+    if(!skin_first)
+        return;
+    for(int i = 0; i < in->nents; i++)
+        skin_first[i] = -1;
+
+    R_PushCmd((struct rcmd){ R_GL_SkinBegin, 0 });
 
-        mat4x4_t model, normal;
-        PFM_Mat4x4_Inverse(&curr->model, &model);
-        PFM_Mat4x4_Transpose(&model, &normal);
+    size_t end;
+    for(size_t begin = 0; begin < nskinned; begin = end) {
+
+        const void *priv = sorted[begin]->render_private;
+        for(end = begin + 1; end < nskinned && sorted[end]->render_private == priv; end++)
+            ;
+
+        struct rcmd_draw_instanced *inst = R_AllocArg(sizeof(*inst));
+        if(!inst || !g_make_anim_instances(sorted + begin, end - begin, in->ents, skin_first, inst))
+            continue;
 
         R_PushCmd((struct rcmd){
-            .func = R_GL_SetAnimUniforms,
-            .nargs = 4,
-            .args = {
-                (void*)curr->inv_bind_pose, 
-                R_PushArg(curr->curr_pose, sizeof(curr->curr_pose)),
-                R_PushArg(&normal, sizeof(normal)),
-                R_PushArg(&curr->njoints, sizeof(curr->njoints)),
-            },
+            .func = R_GL_SkinInstances,
+            .nargs = 1,
+            .args = { inst },
         });
+    }
+    in->skin_first = skin_first;
+}
 
-        R_PushCmd((struct rcmd){
-            .func = R_GL_RenderDepthMap,
+static void g_shadow_pass(struct render_input *in)
+{
+    mat4x4_t transforms[CONFIG_SHADOW_CASCADES];
+    float splits[CONFIG_SHADOW_CASCADES];
+
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++) {
+
+        transforms[i] = in->cascades[i].light_space_trans;
+        splits[i] = in->cascades[i].split;
+
+        if(!in->cascade_dirty[i])
+            continue;
+
+        R_PushCmd((struct rcmd){ 
+            .func = R_GL_DepthPassBegin, 
             .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&curr->model, sizeof(curr->model)),
+            .args = { 
+                R_PushArg(&in->cascades[i].light_space_trans, sizeof(mat4x4_t)),
+                R_PushArg(&i, sizeof(i)),
             },
         });
+
+        if(in->map) {
+            M_RenderMapInFrustum(in->map, &in->cascades[i].frustum, Camera_GetPos(in->cam), 
+                true, in->terrain_lod_dist, RENDER_PASS_DEPTH);
+        }
+
+        g_push_stat_instances(in->ents, in->nents, DRAW_PASS_LIGHT(i), RCMD_RENDER_DEPTH_MAP_INSTANCED);
+        g_push_anim_instances(in->ents, in->nents, in->skin_first, DRAW_PASS_LIGHT(i), 
+            RCMD_RENDER_DEPTH_MAP_INSTANCED);
+        if(in->scenery) {
+            G_Scenery_Render(&in->cascades[i].frustum, true);
+        }
+
+        R_PushCmd((struct rcmd){ R_GL_DepthPassEnd, 0 });
     }
 
-    R_PushCmd((struct rcmd){ R_GL_DepthPassEnd, 0 });
+    R_PushCmd((struct rcmd){ 
+        .func = R_GL_SetShadowCascades, 
+        .nargs = 2,
+        .args = { 
+            R_PushArg(transforms, sizeof(transforms)),
+            R_PushArg(splits, sizeof(splits)),
+        },
+    });
 }
 
-static void g_draw_pass(const struct camera *cam, const struct map *map, 
-                        bool shadows, vec_rstat_t stat_ents, vec_ranim_t anim_ents)
+static void g_draw_pass(const struct render_input *in)
 {
-    if(map) {
-        M_RenderVisibleMap(map, cam, shadows, RENDER_PASS_REGULAR);
+    if(in->map) {
+        M_RenderVisibleMap(in->map, in->cam, in->shadows, in->terrain_lod_dist, RENDER_PASS_REGULAR);
     }
 
-    for(int i = 0; i < vec_size(&stat_ents); i++) {
-    
-        struct ent_stat_rstate *curr = &vec_AT(&stat_ents, i);
-        R_PushCmd((struct rcmd){
-            .func = R_GL_Draw,
-            .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&curr->model, sizeof(curr->model)),
-            },
-        });
+    g_push_stat_instances(in->ents, in->nents, in->cam_pass, RCMD_DRAW_INSTANCED);
+    g_push_anim_instances(in->ents, in->nents, in->skin_first, in->cam_pass, RCMD_DRAW_INSTANCED);
+    G_Proj_Render();
+
+    if(in->scenery) {
+        struct frustum frustum;
+        Camera_MakeFrustum(in->cam, &frustum);
+        G_Scenery_Render(&frustum, false);
+    }
+}
+
+/* Extrapolates the camera's movement to get the chunks that are about to 
+ * come into view ready ahead of time, instead of creating their meshes on 
+ * the frame they first get drawn. */
+static void g_prefetch_chunks(const struct render_input *in)
+{
+    if(!in->map)
+        return;
+
+    vec3_t velocity = Camera_GetVelocity(in->cam);
+    if(PFM_Vec3_Len(&velocity) == 0.0f)
+        return;
+
+    struct frustum frustum;
+    Camera_MakePredictedFrustum(in->cam, CONFIG_CAM_PREFETCH_MS, &frustum);
+    M_PrefetchMapInFrustum(in->map, &frustum, 
+        Camera_PredictPos(in->cam, CONFIG_CAM_PREFETCH_MS), in->terrain_lod_dist);
+}
+
+/* The units are read straight from the position index into the render 
+ * workspace, so that they cost no extra copies on their way to the GPU. 
+ */
+static const struct minimap_unit *g_minimap_units(size_t *out_count)
+{
+    const vec_pentity_t *ents = &s_gs.active_list.ents;
+    struct minimap_unit *ret = R_AllocArg(vec_size(ents) * sizeof(struct minimap_unit));
+    size_t count = 0;
+
+    if(!ret) {
+        *out_count = 0;
+        return NULL;
     }
 
-    for(int i = 0; i < vec_size(&anim_ents); i++) {
+    for(int i = 0; i < vec_size(ents); i++) {
+
+        const struct entity *curr = vec_AT(ents, i);
+        if(!(curr->flags & ENTITY_FLAG_SELECTABLE))
+            continue;
+        if(curr->flags & (ENTITY_FLAG_INVISIBLE | ENTITY_FLAG_ZOMBIE))
+            continue;
+        if(curr->faction_id < 0 || curr->faction_id >= s_gs.num_factions)
+            continue;
+        if(!G_Fog_EntVisible(curr))
+            continue;
+
+        vec3_t color = s_gs.factions[curr->faction_id].color;
+        PFM_Vec3_Scale(&color, 1.0f/255.0f, &color);
+        ret[count++] = (struct minimap_unit){G_Pos_GetXZ(curr->uid), color};
+    }
+
+    *out_count = count;
+    return ret;
+}
+
+struct healthbar_ctx{
+    GLfloat *health_pc;
+    vec3_t  *top_pos_ws;
+};
+
+/* The entities which are not combatable are given a negative health */
+static void g_healthbars_range(size_t begin, size_t end, void *arg)
+{
+    struct healthbar_ctx *ctx = arg;
+
+    for(size_t i = begin; i < end; i++) {
     
-        struct ent_anim_rstate *curr = &vec_AT(&anim_ents, i);
+        struct entity *curr = vec_AT(&s_gs.visible, i);
 
-        mat4x4_t model, normal;
-        PFM_Mat4x4_Inverse(&curr->model, &model);
-        PFM_Mat4x4_Transpose(&model, &normal);
+        if(!(curr->flags & ENTITY_FLAG_COMBATABLE)) {
+            ctx->health_pc[i] = -1.0f;
+            continue;
+        }
 
-        R_PushCmd((struct rcmd){
-            .func = R_GL_SetAnimUniforms,
-            .nargs = 4,
-            .args = {
-                (void*)curr->inv_bind_pose, 
-                R_PushArg(curr->curr_pose, sizeof(curr->curr_pose)),
-                R_PushArg(&normal, sizeof(normal)),
-                R_PushArg(&curr->njoints, sizeof(curr->njoints)),
-            },
-        });
+        int max_health = curr->max_hp;
+        int curr_health = G_Combat_GetCurrentHP(curr);
 
-        R_PushCmd((struct rcmd){
-            .func = R_GL_Draw,
-            .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&curr->model, sizeof(curr->model)),
-            },
-        });
+        ctx->top_pos_ws[i] = Entity_TopCenterPointWS(curr);
+        ctx->health_pc[i] = ((GLfloat)curr_health)/max_health;
     }
 }
 
@@ -295,19 +796,16 @@ static void g_render_healthbars(void)
     GLfloat ent_health_pc[max_ents];
     vec3_t ent_top_pos_ws[max_ents];
 
+    struct healthbar_ctx ctx = (struct healthbar_ctx){ent_health_pc, ent_top_pos_ws};
+    Sched_ParallelFor(max_ents, PARALLEL_GRAIN, g_healthbars_range, &ctx);
+
     for(int i = 0; i < max_ents; i++) {
-    
-        struct entity *curr = vec_AT(&s_gs.visible, i);
 
-        if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
+        if(ent_health_pc[i] < 0.0f)
             continue;
 
-        int max_health = curr->max_hp;
-        int curr_health = G_Combat_GetCurrentHP(curr);
-
-        ent_top_pos_ws[num_combat_visible] = Entity_TopCenterPointWS(curr);
-        ent_health_pc[num_combat_visible] = ((GLfloat)curr_health)/max_health;
-
+        ent_top_pos_ws[num_combat_visible] = ent_top_pos_ws[i];
+        ent_health_pc[num_combat_visible] = ent_health_pc[i];
         num_combat_visible++;
     }
 
@@ -323,80 +821,618 @@ static void g_render_healthbars(void)
     });
 }
 
-static void g_make_draw_list(vec_pentity_t ents, vec_rstat_t *out_stat, vec_ranim_t *out_anim)
+static bool g_obb_clipped(const struct obb *obb, vec4_t plane)
+{
+    for(int i = 0; i < ARR_SIZE(obb->corners); i++) {
+
+        const vec3_t *c = &obb->corners[i];
+        if(c->x * plane.x + c->y * plane.y + c->z * plane.z + plane.w >= 0.0f)
+            return false;
+    }
+    return true;
+}
+
+struct draw_list_ctx{
+    struct ent_rstate   *out;
+    float                interp_dist;
+    vec3_t               cam_pos;
+};
+
+/* Picks the most detailed LOD of the entity's model that still covers more 
+ * of the screen than the threshold of its' level. */
+static int g_select_lod(const struct entity *ent, vec3_t render_pos, vec3_t cam_pos)
+{
+    const int nlods = R_AL_NumLODs(ent->render_private);
+    if(nlods == 0)
+        return 0;
+
+    const struct aabb *box = &ent->identity_aabb;
+    vec3_t half = (vec3_t){
+        (box->x_max - box->x_min) / 2.0f,
+        (box->y_max - box->y_min) / 2.0f,
+        (box->z_max - box->z_min) / 2.0f,
+    };
+    float scale = MAX(fabs(ent->scale.x), MAX(fabs(ent->scale.y), fabs(ent->scale.z)));
+    float radius = PFM_Vec3_Len(&half) * scale;
+
+    vec3_t delta;
+    PFM_Vec3_Sub(&render_pos, &cam_pos, &delta);
+    float dist = PFM_Vec3_Len(&delta);
+    if(dist <= radius)
+        return 0;
+
+    /* The fraction of the screen's height taken by the bounding sphere */
+    float size = radius / (dist * tanf(CAM_FOV_RAD / 2.0f));
+    float thresh = CONFIG_ENTITY_LOD_SCREEN_SIZE;
+
+    int ret = 0;
+    while(ret < nlods && size < thresh) {
+        ret++;
+        thresh /= 2.0f;
+    }
+    return ret;
+}
+
+static void g_draw_list_range(size_t begin, size_t end, void *arg)
 {
-    for(int i = 0; i < vec_size(&ents); i++) {
+    const struct draw_list_ctx *ctx = arg;
+
+    for(size_t i = begin; i < end; i++) {
 
-        const struct entity *curr = vec_AT(&ents, i);
+        const struct draw_ent *de = &vec_AT(&s_gs.draw_scratch, i);
+        const struct entity *curr = de->ent;
+        struct ent_rstate *rstate = &ctx->out[i];
 
+        /* Draw the entity between its' last two simulated positions */
         mat4x4_t model;
         Entity_ModelMatrix(curr, &model);
+        vec3_t render_pos = G_Pos_GetRender(curr->uid);
+        model.cols[3][0] = render_pos.x;
+        model.cols[3][1] = render_pos.y;
+        model.cols[3][2] = render_pos.z;
+
+        int lod = g_select_lod(curr, render_pos, ctx->cam_pos);
+        rstate->render_private = R_AL_LODPriv(curr->render_private, lod);
+        rstate->passes = de->passes;
+        rstate->model = model;
+        rstate->palettes = NULL;
 
         if(curr->flags & ENTITY_FLAG_ANIMATED) {
+
+            /* The normal matrix doesn't depend on the translation */
+            Entity_NormalMatrix(curr, &rstate->normal);
+
+            vec3_t delta;
+            PFM_Vec3_Sub(&render_pos, (vec3_t*)&ctx->cam_pos, &delta);
+            bool interpolate = PFM_Vec3_Dot(&delta, &delta) < ctx->interp_dist * ctx->interp_dist;
         
-            struct ent_anim_rstate rstate = (struct ent_anim_rstate){curr->render_private, model};
-            A_GetRenderState(curr, &rstate.njoints, rstate.curr_pose, &rstate.inv_bind_pose);
-            vec_ranim_push(out_anim, rstate);
+            A_GetRenderState(curr, interpolate, &rstate->njoints, &rstate->palettes, 
+                &rstate->palette_offset, &rstate->next_palette_offset, &rstate->blend);
+        }
+
+        /* The animated entities may be skinned once for all the passes, so 
+         * they cast shadows with the same mesh as they are drawn with */
+        if(rstate->palettes) {
+            rstate->shadow_private = rstate->render_private;
         }else{
-        
-            struct ent_stat_rstate rstate = (struct ent_stat_rstate){curr->render_private, model};
-            vec_rstat_push(out_stat, rstate);
+            int coarsest = R_AL_NumLODs(curr->render_private);
+            rstate->shadow_private = R_AL_LODPriv(curr->render_private, coarsest);
         }
     }
 }
 
-static void g_create_render_input(struct render_input *out)
+/* Builds the render states of the entities drawn into any of the passes in 
+ * 'mask', once, straight into the render workspace. The animated entities 
+ * within 'interp_dist' of the camera are blended between their' keyframes. 
+ * The rest step from one keyframe to the next. */
+static struct ent_rstate *g_make_draw_list(uint32_t mask, float interp_dist, size_t *out_count)
 {
-    struct sval shadows_setting;
-    ss_e status = Settings_Get("pf.video.shadows_enabled", &shadows_setting);
-    assert(status == SS_OKAY);
+    *out_count = 0;
+    vec_drawent_reset(&s_gs.draw_scratch);
 
-    out->cam = ACTIVE_CAM;
-    out->map = s_gs.map;
-    out->shadows = shadows_setting.as_bool;
+    for(int i = 0; i < vec_size(&s_gs.drawn); i++) {
+
+        struct draw_ent de = vec_AT(&s_gs.drawn, i);
+        de.passes &= mask;
+        if(de.passes && !vec_drawent_push(&s_gs.draw_scratch, de))
+            return NULL;
+    }
 
-    vec_rstat_init(&out->cam_vis_stat);
-    vec_ranim_init(&out->cam_vis_anim);
+    size_t nents = vec_size(&s_gs.draw_scratch);
+    if(nents == 0)
+        return NULL;
 
-    vec_rstat_init(&out->light_vis_stat);
-    vec_ranim_init(&out->light_vis_anim);
+    struct ent_rstate *ret = R_AllocArg(nents * sizeof(struct ent_rstate));
+    if(!ret)
+        return NULL;
 
-    g_make_draw_list(s_gs.visible, &out->cam_vis_stat, &out->cam_vis_anim);
-    g_make_draw_list(s_gs.light_visible, &out->light_vis_stat, &out->light_vis_anim);
+    struct draw_list_ctx ctx = (struct draw_list_ctx){ret, interp_dist, Camera_GetPos(ACTIVE_CAM)};
+    Sched_ParallelFor(nents, PARALLEL_GRAIN, g_draw_list_range, &ctx);
 
-    assert(vec_size(&out->cam_vis_stat) + vec_size(&out->cam_vis_anim) == vec_size(&s_gs.visible));
-    assert(vec_size(&out->light_vis_stat) + vec_size(&out->light_vis_anim) == vec_size(&s_gs.light_visible));
+    *out_count = nents;
+    return ret;
 }
 
-static void g_destroy_render_input(struct render_input *rinput)
+static uint64_t g_caster_hash(const struct entity *ent, const struct obb *obb)
 {
-    vec_rstat_destroy(&rinput->cam_vis_stat);
-    vec_ranim_destroy(&rinput->cam_vis_anim);
+    unsigned char bytes[sizeof(ent->uid) + sizeof(obb->center)];
+    memcpy(bytes, &ent->uid, sizeof(ent->uid));
+    memcpy(bytes + sizeof(ent->uid), &obb->center, sizeof(obb->center));
+
+    /* FNV-1a. The per-entity hashes are summed, so that the order in which 
+     * the casters are visited doesn't matter. */
+    uint64_t ret = 14695981039346656037ull;
+    for(int i = 0; i < sizeof(bytes); i++) {
+        ret ^= bytes[i];
+        ret *= 1099511628211ull;
+    }
+    return ret;
+}
+
+static int g_cull_cell_for_pos(vec3_t pos)
+{
+    if(!s_gs.map)
+        return 0;
 
-    vec_rstat_destroy(&rinput->light_vis_stat);
-    vec_ranim_destroy(&rinput->light_vis_anim);
+    struct map_resolution res;
+    M_GetResolution(s_gs.map, &res);
+    vec3_t center = M_GetCenterPos(s_gs.map);
+
+    /* The chunk columns go along the negative X direction */
+    float chunk_x_dim = res.tile_w * X_COORDS_PER_TILE;
+    float chunk_z_dim = res.tile_h * Z_COORDS_PER_TILE;
+    float x_max = center.x + (res.chunk_w * chunk_x_dim) / 2.0f;
+    float z_min = center.z - (res.chunk_h * chunk_z_dim) / 2.0f;
+
+    int c = CLAMP((int)((x_max - pos.x) / chunk_x_dim), 0, res.chunk_w - 1);
+    int r = CLAMP((int)((pos.z - z_min) / chunk_z_dim), 0, res.chunk_h - 1);
+    return r * s_gs.cull_dim + c;
 }
 
-static void *g_push_render_input(struct render_input in)
+static void g_cull_node_grow(struct cull_node *node, const struct aabb *aabb)
 {
-    struct render_input *ret = R_PushArg(&in, sizeof(in));
+    if(node->empty) {
+        node->aabb = *aabb;
+        node->empty = false;
+        return;
+    }
+    node->aabb.x_min = MIN(node->aabb.x_min, aabb->x_min);
+    node->aabb.x_max = MAX(node->aabb.x_max, aabb->x_max);
+    node->aabb.y_min = MIN(node->aabb.y_min, aabb->y_min);
+    node->aabb.y_max = MAX(node->aabb.y_max, aabb->y_max);
+    node->aabb.z_min = MIN(node->aabb.z_min, aabb->z_min);
+    node->aabb.z_max = MAX(node->aabb.z_max, aabb->z_max);
+}
 
-    ret->cam = R_PushArg(in.cam, g_sizeof_camera);
+static struct aabb g_obb_bounds(const struct obb *obb)
+{
+    struct aabb ret = (struct aabb){
+        FLT_MAX, -FLT_MAX,
+        FLT_MAX, -FLT_MAX,
+        FLT_MAX, -FLT_MAX,
+    };
+    for(int i = 0; i < ARR_SIZE(obb->corners); i++) {
+
+        const vec3_t *c = &obb->corners[i];
+        ret.x_min = MIN(ret.x_min, c->x);
+        ret.x_max = MAX(ret.x_max, c->x);
+        ret.y_min = MIN(ret.y_min, c->y);
+        ret.y_max = MAX(ret.y_max, c->y);
+        ret.z_min = MIN(ret.z_min, c->z);
+        ret.z_max = MAX(ret.z_max, c->z);
+    }
+    return ret;
+}
+
+/* The entities that can't be drawn are left without an 'ent' */
+static void g_cull_gather_range(size_t begin, size_t end, void *arg)
+{
+    for(size_t i = begin; i < end; i++) {
+
+        struct entity *curr = vec_AT(&s_gs.active_list.ents, i);
+        struct cull_ent *ce = &vec_AT(&s_gs.cull_scratch, i);
+        ce->ent = NULL;
+
+        if(!(curr->flags & ENTITY_FLAG_COLLISION))
+            continue;
+
+        if(curr->flags & ENTITY_FLAG_INVISIBLE)
+            continue;
+
+        /* Culled and drawn on the GPU */
+        if(G_Scenery_Contains(curr))
+            continue;
+
+        *ce = (struct cull_ent){ .ent = curr, .mask = CULL_ALL };
+        Entity_CurrentOBB(curr, &ce->obb);
+
+        /* Animated entities change their pose every frame, so they 
+         * can't be cached even if they don't move */
+        if(!(curr->flags & ENTITY_FLAG_STATIC) || (curr->flags & ENTITY_FLAG_ANIMATED)) {
+            for(int j = CONFIG_SHADOW_FIRST_CACHED; j < CONFIG_SHADOW_CASCADES; j++)
+                ce->mask &= ~(1u << CULL_CASCADE(j));
+        }
+
+        ce->cell = g_cull_cell_for_pos(ce->obb.center);
+    }
+}
+
+/* Bins the entities which can be drawn into the cells of the grid and builds 
+ * the levels of the quadtree above them. The nodes of each level are stored 
+ * after those of the level below, in row-major order. The entities are sorted 
+ * by their cell, and their boxes are copied out in SoA form for the batched
+ * frustum tests. */
+static void g_cull_build(void)
+{
+    vec_cullent_reset(&s_gs.cull_scratch);
+    vec_cullent_reset(&s_gs.cull_ents);
+    vec_cullnode_reset(&s_gs.cull_nodes);
+
+    for(int d = s_gs.cull_dim; d > 0; d /= 2) {
+    for(int i = 0; i < d * d; i++) {
+        vec_cullnode_push(&s_gs.cull_nodes, (struct cull_node){ .empty = true });
+    }}
+
+    size_t nactive = vec_size(&s_gs.active_list.ents);
+    if(nactive > s_gs.cull_scratch.capacity && !vec_cullent_resize(&s_gs.cull_scratch, nactive))
+        return;
+    s_gs.cull_scratch.size = nactive;
+
+    /* The boxes are computed by the workers, then binned in order */
+    Sched_ParallelFor(nactive, PARALLEL_GRAIN, g_cull_gather_range, NULL);
+
+    size_t nkept = 0;
+    for(int i = 0; i < nactive; i++) {
+
+        const struct cull_ent ce = vec_AT(&s_gs.cull_scratch, i);
+        if(!ce.ent)
+            continue;
+
+        struct cull_node *cell = &vec_AT(&s_gs.cull_nodes, ce.cell);
+        struct aabb bounds = g_obb_bounds(&ce.obb);
+        g_cull_node_grow(cell, &bounds);
+
+        cell->count++;
+        vec_AT(&s_gs.cull_scratch, nkept++) = ce;
+    }
+    s_gs.cull_scratch.size = nkept;
+
+    size_t nents = vec_size(&s_gs.cull_scratch);
+    int ncells = s_gs.cull_dim * s_gs.cull_dim;
+
+    int begin = 0;
+    for(int i = 0; i < ncells; i++) {
+        struct cull_node *cell = &vec_AT(&s_gs.cull_nodes, i);
+        cell->begin = begin;
+        begin += cell->count;
+        cell->count = 0;
+    }
+
+    if(nents > s_gs.cull_ents.capacity && !vec_cullent_resize(&s_gs.cull_ents, nents))
+        return;
+    if(nents * CULL_SOA_FIELDS > s_gs.cull_soa.capacity 
+    && !vec_float_resize(&s_gs.cull_soa, nents * CULL_SOA_FIELDS))
+        return;
+    s_gs.cull_ents.size = nents;
+    s_gs.cull_soa.size = nents * CULL_SOA_FIELDS;
+
+    for(int i = 0; i < nents; i++) {
+
+        const struct cull_ent *ce = &vec_AT(&s_gs.cull_scratch, i);
+        struct cull_node *cell = &vec_AT(&s_gs.cull_nodes, ce->cell);
+        int idx = cell->begin + cell->count++;
+        vec_AT(&s_gs.cull_ents, idx) = *ce;
+
+        float *soa = s_gs.cull_soa.array;
+        for(int j = 0; j < 3; j++) {
+            soa[(CULL_SOA_CENTER + j) * nents + idx] = ce->obb.center.raw[j];
+            soa[(CULL_SOA_HALF_LENGTHS + j) * nents + idx] = ce->obb.half_lengths[j];
+        for(int k = 0; k < 3; k++) {
+            soa[(CULL_SOA_AXES + j * 3 + k) * nents + idx] = ce->obb.axes[j].raw[k];
+        }}
+    }
+
+    size_t below = 0, level = ncells;
+    for(int d = s_gs.cull_dim / 2; d > 0; d /= 2) {
+
+        for(int r = 0; r < d; r++) {
+        for(int c = 0; c < d; c++) {
+
+            struct cull_node *parent = &vec_AT(&s_gs.cull_nodes, level + r * d + c);
+            for(int i = 0; i < 4; i++) {
+
+                int cr = r * 2 + (i / 2), cc = c * 2 + (i % 2);
+                const struct cull_node *child = &vec_AT(&s_gs.cull_nodes, below + cr * (d * 2) + cc);
+                if(!child->empty)
+                    g_cull_node_grow(parent, &child->aabb);
+            }
+        }}
+        below = level;
+        level += d * d;
+    }
+}
+
+static void g_cull_obb_batch(size_t first, struct obb_batch *out)
+{
+    size_t nents = vec_size(&s_gs.cull_ents);
+    const float *soa = s_gs.cull_soa.array;
+
+    for(int j = 0; j < 3; j++) {
+        out->center[j] = soa + (CULL_SOA_CENTER + j) * nents + first;
+        out->half_lengths[j] = soa + (CULL_SOA_HALF_LENGTHS + j) * nents + first;
+    for(int k = 0; k < 3; k++) {
+        out->axes[j][k] = soa + (CULL_SOA_AXES + j * 3 + k) * nents + first;
+    }}
+}
+
+struct cull_ctx{
+    const struct frustum *frusta[CULL_NFRUSTA];
+    vec4_t                refract_plane;
+    vec4_t                reflect_plane;
+    uint64_t              casters[CONFIG_SHADOW_CASCADES];
+};
+
+static void g_cull_accept(struct cull_ctx *ctx, const struct cull_ent *ce, uint32_t vis)
+{
+    uint32_t passes = 0;
+
+    /* The enemies hidden by the fog of war don't even cast shadows */
+    if(!G_Fog_EntVisible(ce->ent))
+        return;
+
+    if(vis & (1u << CULL_CAM)) {
+
+        vec_pentity_push(&s_gs.visible, ce->ent);
+        vec_obb_push(&s_gs.visible_obbs, ce->obb);
+        passes |= DRAW_PASS_CAMERA;
+
+        if(!g_obb_clipped(&ce->obb, ctx->refract_plane))
+            passes |= DRAW_PASS_REFRACT;
+    }
+
+    if((vis & (1u << CULL_REFLECT)) && !g_obb_clipped(&ce->obb, ctx->reflect_plane)) {
+        passes |= DRAW_PASS_REFLECT;
+    }
+
+    for(int j = 0; j < CONFIG_SHADOW_CASCADES; j++) {
+
+        if(!(vis & (1u << CULL_CASCADE(j))))
+            continue;
+
+        passes |= DRAW_PASS_LIGHT(j);
+        if(j >= CONFIG_SHADOW_FIRST_CACHED) {
+            ctx->casters[j] += g_caster_hash(ce->ent, &ce->obb);
+        }
+    }
+
+    if(passes) {
+        vec_drawent_push(&s_gs.drawn, (struct draw_ent){ce->ent, passes});
+    }
+}
 
-    if(in.cam_vis_stat.size) {
-        ret->cam_vis_stat.array = R_PushArg(in.cam_vis_stat.array, in.cam_vis_stat.size * sizeof(struct ent_stat_rstate));
+/* Tests the up to 4 nodes against the frusta in 'partial', which their parent 
+ * has not yet been found to be entirely inside or outside of. */
+static void g_cull_classify(struct cull_ctx *ctx, const struct cull_node *nodes[], int n, 
+                            uint32_t partial, uint32_t out_vis[], uint32_t out_inside[])
+{
+    float center[3][4], half_lengths[3][4];
+    for(int i = 0; i < n; i++) {
+
+        const struct aabb *aabb = &nodes[i]->aabb;
+        center[0][i] = (aabb->x_min + aabb->x_max) / 2.0f;
+        center[1][i] = (aabb->y_min + aabb->y_max) / 2.0f;
+        center[2][i] = (aabb->z_min + aabb->z_max) / 2.0f;
+        half_lengths[0][i] = (aabb->x_max - aabb->x_min) / 2.0f;
+        half_lengths[1][i] = (aabb->y_max - aabb->y_min) / 2.0f;
+        half_lengths[2][i] = (aabb->z_max - aabb->z_min) / 2.0f;
+    }
+
+    struct aabb_batch batch = (struct aabb_batch){
+        .center = {center[0], center[1], center[2]},
+        .half_lengths = {half_lengths[0], half_lengths[1], half_lengths[2]},
+    };
+    C_FrustaAABBIntersectionBatch(ctx->frusta, partial, &batch, n, out_vis, out_inside);
+}
+
+/* The node has already been found to be entirely inside the frusta in 
+ * 'inside' and to overlap the ones in 'partial'. Its' children are tested 
+ * against just the latter, all 4 at a time, and the subtrees which are 
+ * outside all the frusta are rejected. */
+static void g_cull_node(struct cull_ctx *ctx, size_t offset, int dim, int r, int c, 
+                        uint32_t partial, uint32_t inside)
+{
+    const struct cull_node *node = &vec_AT(&s_gs.cull_nodes, offset + r * dim + c);
+
+    if(dim < s_gs.cull_dim) {
+
+        /* The level below is twice as wide and comes before this one */
+        int cdim = dim * 2;
+        size_t coffset = offset - cdim * cdim;
+
+        const struct cull_node *children[4];
+        int cr[4], cc[4], n = 0;
+
+        for(int i = 0; i < 4; i++) {
+
+            cr[n] = r * 2 + (i / 2);
+            cc[n] = c * 2 + (i % 2);
+            children[n] = &vec_AT(&s_gs.cull_nodes, coffset + cr[n] * cdim + cc[n]);
+            if(!children[n]->empty)
+                n++;
+        }
+
+        uint32_t vis[4], in[4];
+        g_cull_classify(ctx, children, n, partial, vis, in);
+
+        for(int i = 0; i < n; i++) {
+
+            uint32_t cpartial = partial & vis[i] & ~in[i];
+            uint32_t cinside = inside | (partial & in[i]);
+            if(cpartial | cinside)
+                g_cull_node(ctx, coffset, cdim, cr[i], cc[i], cpartial, cinside);
+        }
+        return;
+    }
+
+    /* Note that there may be some false positives due to using the fast 
+     * frustum cull. */
+    for(int base = 0; base < node->count; base += CULL_BATCH) {
+
+        int n = MIN(CULL_BATCH, node->count - base);
+        struct obb_batch batch;
+        g_cull_obb_batch(node->begin + base, &batch);
+
+        uint32_t vis[CULL_BATCH];
+        C_FrustaOBBIntersectionBatch(ctx->frusta, partial, &batch, n, vis, NULL);
+
+        for(int i = 0; i < n; i++) {
+
+            const struct cull_ent *ce = &vec_AT(&s_gs.cull_ents, node->begin + base + i);
+            uint32_t mask = (vis[i] | inside) & ce->mask;
+            if(mask)
+                g_cull_accept(ctx, ce, mask);
+        }
+    }
+}
+
+/* The root is classified on its' own, before descending */
+static void g_cull_traverse(struct cull_ctx *ctx)
+{
+    size_t top = vec_size(&s_gs.cull_nodes) - 1;
+    const struct cull_node *root = &vec_AT(&s_gs.cull_nodes, top);
+    if(root->empty)
+        return;
+
+    uint32_t vis, in;
+    g_cull_classify(ctx, &root, 1, CULL_ALL, &vis, &in);
+
+    uint32_t partial = vis & ~in;
+    if(partial | in)
+        g_cull_node(ctx, top, 1, 0, 0, partial, in);
+}
+
+/* Drops the entities hidden behind the terrain or other entities in a recent 
+ * frame from the camera's visible set. The sets seen from the light and the 
+ * water are left as they are, since they are rendered from elsewhere.
+ */
+static void g_cull_occluded(void)
+{
+    size_t nvis = 0, ivis = 0;
+    for(int i = 0; i < vec_size(&s_gs.drawn); i++) {
+
+        struct draw_ent *curr = &vec_AT(&s_gs.drawn, i);
+        if(!(curr->passes & DRAW_PASS_CAMERA))
+            continue;
+
+        assert(vec_AT(&s_gs.visible, ivis) == curr->ent);
+        const struct obb *obb = &vec_AT(&s_gs.visible_obbs, ivis++);
+
+        if(R_HiZOccludedOBB(obb)) {
+            curr->passes &= ~DRAW_PASS_CAMERA;
+            continue;
+        }
+
+        vec_AT(&s_gs.visible, nvis) = curr->ent;
+        vec_AT(&s_gs.visible_obbs, nvis) = *obb;
+        nvis++;
     }
-    if(in.cam_vis_anim.size) {
-        ret->cam_vis_anim.array = R_PushArg(in.cam_vis_anim.array, in.cam_vis_anim.size * sizeof(struct ent_anim_rstate));
+    assert(ivis == vec_size(&s_gs.visible));
+    s_gs.visible.size = nvis;
+    s_gs.visible_obbs.size = nvis;
+}
+
+static void g_update_cascades(void)
+{
+    struct shadow_cascade fresh[CONFIG_SHADOW_CASCADES];
+    R_ShadowCascades(s_gs.light_pos, ACTIVE_CAM, fresh);
+
+    bool light_moved = memcmp(&s_gs.light_pos, &s_gs.cascade_light_pos, sizeof(vec3_t));
+    s_gs.cascade_light_pos = s_gs.light_pos;
+
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++) {
+
+        if(i >= CONFIG_SHADOW_FIRST_CACHED
+        && s_gs.shadow_cache_valid
+        && !light_moved
+        && R_ShadowCascadeCovers(&s_gs.cascades[i], &fresh[i])) {
+
+            /* Keep sampling the cached layer with the transform it was 
+             * rendered with, but hand over to it at the current split */
+            s_gs.cascades[i].split = fresh[i].split;
+            s_gs.cascade_dirty[i] = false;
+            continue;
+        }
+
+        s_gs.cascades[i] = fresh[i];
+        s_gs.cascade_dirty[i] = true;
     }
+    s_gs.shadow_cache_valid = true;
+}
+
+static bool g_init_setting_handles(void)
+{
+    const struct{
+        const char         *name;
+        const struct sval **out;
+    }handles[] = {
+        {"pf.game.healthbar_mode",          &s_setts.healthbar_mode     },
+        {"pf.video.shadows_enabled",        &s_setts.shadows_enabled    },
+        {"pf.video.terrain_lod_distance",   &s_setts.terrain_lod_dist   },
+        {"pf.video.anim_interp_distance",   &s_setts.anim_interp_dist   },
+        {"pf.video.occlusion_culling",      &s_setts.occlusion_culling  },
+        {"pf.video.water_refraction",       &s_setts.water_refraction   },
+        {"pf.video.water_reflection",       &s_setts.water_reflection   },
+        {"pf.video.water_low_res",          &s_setts.water_low_res      },
+        {"pf.video.water_reuse_frames",     &s_setts.water_reuse_frames },
+    };
 
-    if(in.light_vis_stat.size) {
-        ret->light_vis_stat.array = R_PushArg(in.light_vis_stat.array, in.light_vis_stat.size * sizeof(struct ent_stat_rstate));
+    for(int i = 0; i < ARR_SIZE(handles); i++) {
+        *handles[i].out = Settings_Handle(handles[i].name);
+        if(!*handles[i].out)
+            return false;
     }
-    if(in.light_vis_anim.size) {
-        ret->light_vis_anim.array = R_PushArg(in.light_vis_anim.array, in.light_vis_anim.size * sizeof(struct ent_anim_rstate));
+    return true;
+}
+
+static void g_on_shadows_changed(const struct sval *new_val, void *user)
+{
+    /* Nothing is rendered into the cached cascades while shadows are off */
+    s_gs.shadow_cache_valid = false;
+}
+
+static void g_create_render_input(struct render_input *out)
+{
+    out->cam = ACTIVE_CAM;
+    out->map = s_gs.map;
+    out->shadows = s_setts.shadows_enabled->as_bool;
+    out->terrain_lod_dist = s_setts.terrain_lod_dist->as_float;
+    const float interp_dist = s_setts.anim_interp_dist->as_float;
+
+    out->cam_pass = DRAW_PASS_CAMERA;
+    out->skin_first = NULL;
+    out->scenery = G_Scenery_Active();
+    uint32_t mask = DRAW_PASS_CAMERA | DRAW_PASS_REFRACT | DRAW_PASS_REFLECT;
+
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++) {
+
+        out->cascades[i] = s_gs.cascades[i];
+        out->cascade_dirty[i] = s_gs.cascade_dirty[i];
+
+        /* The casters of the cached cascades are only needed when they 
+         * are re-rendered */
+        if(out->shadows && out->cascade_dirty[i])
+            mask |= DRAW_PASS_LIGHT(i);
     }
 
+    out->ents = g_make_draw_list(mask, interp_dist, &out->nents);
+}
+
+/* The render states already live in the render workspace and are shared 
+ * as they are. */
+static void *g_push_render_input(struct render_input in)
+{
+    struct render_input *ret = R_PushArg(&in, sizeof(in));
+    ret->cam = R_PushArg(in.cam, g_sizeof_camera);
     return ret;
 }
 
@@ -405,6 +1441,11 @@ static bool bool_val_validate(const struct sval *new_val)
     return (new_val->type == ST_TYPE_BOOL);
 }
 
+static bool interp_dist_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_FLOAT && new_val->as_float >= 0.0f);
+}
+
 static bool faction_id_validate(const struct sval *new_val)
 {
     if(new_val->type != ST_TYPE_INT)
@@ -428,17 +1469,89 @@ static void shadows_en_commit(const struct sval *new_val)
     struct entity *curr;
     (void)key;
 
-    kh_foreach(s_gs.active, key, curr, {
+    kh_foreach(s_gs.active, key, curr, {
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_SetShadowsEnabled,
+            .nargs = 2,
+            .args = {
+                curr->render_private,
+                R_PushArg(&on, sizeof(on)),
+            },
+        });
+    });
+}
+
+static bool g_save_factions(SDL_RWops *stream)
+{
+    uint64_t nfacs = s_gs.num_factions;
+    uint64_t size = sizeof(nfacs) + sizeof(s_gs.factions) + sizeof(s_gs.diplomacy_table);
+
+    return G_WriteSection(stream, STATE_TAG_FACTIONS, FACTIONS_VERSION, size)
+        && SDL_RWwrite(stream, &nfacs, sizeof(nfacs), 1) == 1
+        && SDL_RWwrite(stream, s_gs.factions, sizeof(s_gs.factions), 1) == 1
+        && SDL_RWwrite(stream, s_gs.diplomacy_table, sizeof(s_gs.diplomacy_table), 1) == 1;
+}
+
+static bool g_load_factions(SDL_RWops *stream, const struct state_section *hdr)
+{
+    uint64_t nfacs;
+    if(hdr->version != FACTIONS_VERSION)
+        return false;
+    if(hdr->size != sizeof(nfacs) + sizeof(s_gs.factions) + sizeof(s_gs.diplomacy_table))
+        return false;
+    if(SDL_RWread(stream, &nfacs, sizeof(nfacs), 1) != 1 || nfacs > MAX_FACTIONS)
+        return false;
+
+    if(SDL_RWread(stream, s_gs.factions, sizeof(s_gs.factions), 1) != 1
+    || SDL_RWread(stream, s_gs.diplomacy_table, sizeof(s_gs.diplomacy_table), 1) != 1)
+        return false;
+
+    s_gs.num_factions = nfacs;
+    for(int i = 0; i < nfacs; i++) {
+        s_gs.factions[i].name[sizeof(s_gs.factions[i].name) - 1] = '\0';
+    }
+    return true;
+}
+
+/* Makes the load let go of an entity which will not be in the simulation */
+static bool g_load_forget(const struct entity *ent)
+{
+    uint32_t key;
+    struct entity *curr;
+    kh_foreach(s_load.remap, key, curr, {
+        if(curr == ent) {
+            kh_del(entity, s_load.remap, kh_get(entity, s_load.remap, key));
+            break;
+        }
+    });
+
+    for(int i = 0; i < vec_size(&s_load.ents); i++) {
+        if(vec_AT(&s_load.ents, i) != ent)
+            continue;
+        vec_pentity_del(&s_load.ents, i);
+        vec_vec3_del(&s_load.pos, i);
+        return true;
+    }
+    return false;
+}
+
+/* Adds all the entities held back by the load so far */
+static bool g_load_flush(void)
+{
+    size_t nents = vec_size(&s_load.ents);
+    size_t added = G_AddEntities(s_load.ents.array, s_load.pos.array, nents);
+    bool ret = (added == nents);
 
-        R_PushCmd((struct rcmd){
-            .func = R_GL_SetShadowsEnabled,
-            .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&on, sizeof(on)),
-            },
-        });
-    });
+    vec_pentity_t failed = s_load.ents;
+    vec_pentity_init(&s_load.ents);
+    vec_vec3_reset(&s_load.pos);
+
+    for(int i = added; i < nents; i++) {
+        g_load_forget(vec_AT(&failed, i));
+    }
+    vec_pentity_destroy(&failed);
+    return ret;
 }
 
 /*****************************************************************************/
@@ -450,9 +1563,19 @@ bool G_Init(void)
     ASSERT_IN_MAIN_THREAD();
 
     vec_pentity_init(&s_gs.visible);
-    vec_pentity_init(&s_gs.light_visible);
+    vec_drawent_init(&s_gs.drawn);
     vec_obb_init(&s_gs.visible_obbs);
-    vec_pentity_init(&s_gs.deleted);
+    vec_cullent_init(&s_gs.cull_scratch);
+    vec_drawent_init(&s_gs.draw_scratch);
+    vec_cullent_init(&s_gs.cull_ents);
+    vec_cullnode_init(&s_gs.cull_nodes);
+    vec_float_init(&s_gs.cull_soa);
+    g_cull_grid_init();
+    for(int i = 0; i < NUM_WS; i++)
+        vec_pentity_init(&s_gs.deleted[i]);
+    vec_handle_init(&s_gs.dying);
+    vec_entslot_init(&s_gs.slots);
+    s_gs.free_slot = -1;
 
     s_gs.active = kh_init(entity);
     if(!s_gs.active)
@@ -462,17 +1585,30 @@ bool G_Init(void)
     if(!s_gs.dynamic)
         goto fail_dynamic;
 
+    if(!g_entlist_init(&s_gs.active_list))
+        goto fail_active_list;
+
     if(!g_init_cameras())
         goto fail_cams; 
 
-    if(!R_InitWS(&s_gs.ws[0]))
-        goto fail_ws;
-
-    if(!R_InitWS(&s_gs.ws[1])) {
-        R_DestroyWS(&s_gs.ws[0]);
-        goto fail_ws;
+    for(int i = 0; i < NUM_WS; i++) {
+        if(!R_InitWS(&s_gs.ws[i])) {
+            while(i--)
+                R_DestroyWS(&s_gs.ws[i]);
+            goto fail_ws;
+        }
     }
 
+    if(!g_init_setting_handles())
+        goto fail_setts;
+
+    if(Settings_AddListener("pf.video.shadows_enabled", g_on_shadows_changed, NULL) != SS_OKAY)
+        goto fail_setts;
+
+    if(!G_Lights_Init())
+        goto fail_lights;
+
+    G_Scenery_Init();
     g_reset();
     G_Sel_Init();
     G_Sel_Enable();
@@ -506,6 +1642,18 @@ bool G_Init(void)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.video.anim_interp_distance",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 256.0f
+        },
+        .prio = 0,
+        .validate = interp_dist_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.debug.show_navigation_cost_base",
         .val = (struct sval) {
@@ -597,6 +1745,17 @@ bool G_Init(void)
         .commit = NULL,
     });
 
+    status = Settings_Create((struct setting){
+        .name = "pf.debug.show_field_churn",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false 
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+
     status = Settings_Create((struct setting){
         .name = "pf.debug.show_chunk_boundaries",
         .val = (struct sval) {
@@ -608,21 +1767,31 @@ bool G_Init(void)
         .commit = NULL,
     });
 
-    s_gs.prev_tick_map = NULL;
+    for(int i = 0; i < NUM_WS; i++)
+        s_gs.prev_tick_map[i] = NULL;
     s_gs.curr_ws_idx = 0;
+    s_gs.render_ws_idx = 0;
     s_gs.light_pos = (vec3_t){120.0f, 150.0f, 120.0f};
     s_gs.ss = G_RUNNING;
 
     return true;
 
+fail_lights:
+    Settings_RemoveListener("pf.video.shadows_enabled", g_on_shadows_changed);
+fail_setts:
+    for(int i = 0; i < NUM_WS; i++)
+        R_DestroyWS(&s_gs.ws[i]);
 fail_ws:
     for(int i = 0; i < NUM_CAMERAS; i++)
         Camera_Free(s_gs.cameras[i]);
 fail_cams:
+    g_entlist_destroy(&s_gs.active_list);
+fail_active_list:
     kh_destroy(entity, s_gs.dynamic);
 fail_dynamic:
     kh_destroy(entity, s_gs.active);
 fail_active:
+    vec_entslot_destroy(&s_gs.slots);
     return false;
 }
 
@@ -633,13 +1802,12 @@ bool G_NewGameWithMapString(const char *mapstr)
     g_reset();
 
     size_t copysize = AL_MapShallowCopySizeStr(mapstr);
-    s_gs.prev_tick_map = malloc(copysize);
-    if(!s_gs.prev_tick_map)
+    if(!g_alloc_snapshots(copysize))
         return false;
 
     s_gs.map = AL_MapFromPFMapString(mapstr);
     if(!s_gs.map) {
-        free((void*)s_gs.prev_tick_map);
+        g_free_snapshots();
         return false;
     }
 
@@ -656,15 +1824,15 @@ bool G_NewGameWithMap(const char *dir, const char *pfmap)
     g_reset();
 
     size_t copysize = AL_MapShallowCopySize(dir, pfmap);
-    s_gs.prev_tick_map = malloc(copysize);
-    if(!s_gs.prev_tick_map)
+    if(!g_alloc_snapshots(copysize))
         return false;
 
     s_gs.map = AL_MapFromPFMap(dir, pfmap);
     if(!s_gs.map) {
-        free((void*)s_gs.prev_tick_map);
+        g_free_snapshots();
         return false;
     }
+    AL_MapNavCachePath(dir, pfmap, s_gs.navcache_path, sizeof(s_gs.navcache_path));
 
     g_init_map();
     E_Global_Notify(EVENT_NEW_GAME, NULL, ES_ENGINE);
@@ -747,6 +1915,25 @@ bool G_PointInsideMap(vec2_t xz)
     return M_PointInsideMap(s_gs.map, xz);
 }
 
+bool G_MapChunkTileData(int chunk_r, int chunk_c, float *out_heights, int32_t *out_mats)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return false;
+    return M_ChunkTileData(s_gs.map, chunk_r, chunk_c, out_heights, out_mats);
+}
+
+bool G_MapChunkTileStates(int chunk_r, int chunk_c, uint8_t *out_pathable, 
+                          uint8_t *out_blocked, uint16_t *out_islands)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return false;
+    return M_NavChunkTileStates(s_gs.map, chunk_r, chunk_c, out_pathable, out_blocked, out_islands);
+}
+
 void G_BakeNavDataForScene(void)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -766,8 +1953,23 @@ void G_BakeNavDataForScene(void)
         M_NavCutoutStaticObject(s_gs.map, &obb);
     });
 
-    M_NavUpdatePortals(s_gs.map);
+    bool ok = M_NavUpdatePortals(s_gs.map);
     M_NavUpdateIslandsField(s_gs.map);
+
+    /* The indices that could not be built are missing from the cache */
+    if(!ok)
+        fprintf(stderr, "Ran out of memory baking the navigation data.\n");
+    else if(s_gs.navcache_path[0])
+        M_NavSaveCache(s_gs.map, s_gs.navcache_path);
+}
+
+void G_PrecomputeNavFields(size_t ndests, const vec2_t xz_dests[])
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return;
+    M_NavPrecomputeFields(s_gs.map, ndests, xz_dests);
 }
 
 bool G_UpdateMinimapChunk(int chunk_r, int chunk_c)
@@ -800,134 +2002,191 @@ void G_Shutdown(void)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    G_Lockstep_Stop();
+    G_Replay_Stop();
     g_reset();
+    Settings_RemoveListener("pf.video.shadows_enabled", g_on_shadows_changed);
 
-    R_DestroyWS(&s_gs.ws[0]);
-    R_DestroyWS(&s_gs.ws[1]);
+    for(int i = 0; i < NUM_WS; i++)
+        R_DestroyWS(&s_gs.ws[i]);
 
     R_PushCmd((struct rcmd){ R_GL_WaterShutdown, 0 });
     G_Timer_Shutdown();
     G_Sel_Shutdown();
+    G_Scenery_Shutdown();
+    G_Lights_Shutdown();
 
     for(int i = 0; i < NUM_CAMERAS; i++)
         Camera_Free(s_gs.cameras[i]);
 
     kh_destroy(entity, s_gs.active);
     kh_destroy(entity, s_gs.dynamic);
-    vec_pentity_destroy(&s_gs.light_visible);
+    g_entlist_destroy(&s_gs.active_list);
+    vec_drawent_destroy(&s_gs.drawn);
     vec_pentity_destroy(&s_gs.visible);
     vec_obb_destroy(&s_gs.visible_obbs);
-    vec_pentity_destroy(&s_gs.deleted);
+    vec_cullent_destroy(&s_gs.cull_scratch);
+    vec_drawent_destroy(&s_gs.draw_scratch);
+    vec_cullent_destroy(&s_gs.cull_ents);
+    vec_cullnode_destroy(&s_gs.cull_nodes);
+    vec_float_destroy(&s_gs.cull_soa);
+    for(int i = 0; i < NUM_WS; i++)
+        vec_pentity_destroy(&s_gs.deleted[i]);
+    vec_handle_destroy(&s_gs.dying);
+    vec_entslot_destroy(&s_gs.slots);
 }
 
 void G_Update(void)
 {
+    PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
 
+    g_sweep_dying();
+
     if(s_gs.map) {
         M_Update(s_gs.map);
+        M_UpdateResidency(s_gs.map, Camera_GetPos(ACTIVE_CAM));
     }
 
     vec_pentity_reset(&s_gs.visible);
-    vec_pentity_reset(&s_gs.light_visible);
+    vec_drawent_reset(&s_gs.drawn);
     vec_obb_reset(&s_gs.visible_obbs);
 
-    vec3_t pos = Camera_GetPos(ACTIVE_CAM);
-    vec3_t dir = Camera_GetDir(ACTIVE_CAM);
-
     struct frustum cam_frust;
     Camera_MakeFrustum(ACTIVE_CAM, &cam_frust);
 
-    struct frustum light_frust;
-    R_LightFrustum(s_gs.light_pos, pos, dir, &light_frust);
-
-    uint32_t key;
-    struct entity *curr;
-    (void)key;
+    if(G_Scenery_Flush()) {
+        s_gs.shadow_cache_valid = false;
+    }
+    g_update_cascades();
 
-    kh_foreach(s_gs.active, key, curr, {
+    struct cull_ctx ctx = {0};
+    R_WaterClipPlanes(&ctx.refract_plane, &ctx.reflect_plane);
 
-        if(s_gs.ss == G_RUNNING && curr->flags & ENTITY_FLAG_ANIMATED)
-            A_Update(curr);
+    DECL_CAMERA_STACK(reflect_cam);
+    R_WaterReflectionCam(ACTIVE_CAM, (struct camera*)reflect_cam);
 
-        if(!(curr->flags & ENTITY_FLAG_COLLISION))
-            continue;
+    struct frustum reflect_frust;
+    Camera_MakeFrustum((struct camera*)reflect_cam, &reflect_frust);
 
-        if(curr->flags & ENTITY_FLAG_INVISIBLE)
-            continue;
+    ctx.frusta[CULL_CAM] = &cam_frust;
+    ctx.frusta[CULL_REFLECT] = &reflect_frust;
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++)
+        ctx.frusta[CULL_CASCADE(i)] = &s_gs.cascades[i].frustum;
 
-        struct obb obb;
-        Entity_CurrentOBB(curr, &obb);
+    if(s_gs.ss == G_RUNNING) {
 
-        /* Build the set of currently visible entities. Note that there may be some 
-         * false positives due to using the fast frustum cull. 
-         */
-        if(C_FrustumOBBIntersectionFast(&cam_frust, &obb) != VOLUME_INTERSEC_OUTSIDE) {
+        /* Advancing the clocks is all there is to animating an entity, as 
+         * the palettes of all the frames are baked. */
+        uint32_t curr_ticks = SDL_GetTicks();
+        for(int i = 0; i < vec_size(&s_gs.active_list.ents); i++) {
 
-            vec_pentity_push(&s_gs.visible, curr);
-            vec_obb_push(&s_gs.visible_obbs, obb);
+            struct entity *curr = vec_AT(&s_gs.active_list.ents, i);
+            if(curr->flags & ENTITY_FLAG_ANIMATED)
+                A_Update(curr, curr_ticks);
         }
+    }
 
-        if(C_FrustumOBBIntersectionFast(&light_frust, &obb) != VOLUME_INTERSEC_OUTSIDE) {
+    G_Fog_Update();
 
-            vec_pentity_push(&s_gs.light_visible, curr);
-        }
-    });
+    /* Build the sets of entities visible from the camera, its' reflection and 
+     * the light in a single traversal of the culling quadtree. */
+    g_cull_build();
+    g_cull_traverse(&ctx);
+
+    /* Entities being added, removed or moved around inside a cached 
+     * cascade still cause it to be re-rendered. */
+    for(int i = CONFIG_SHADOW_FIRST_CACHED; i < CONFIG_SHADOW_CASCADES; i++) {
+
+        if(ctx.casters[i] != s_gs.cascade_casters[i])
+            s_gs.cascade_dirty[i] = true;
+        s_gs.cascade_casters[i] = ctx.casters[i];
+    }
 
-    /* Next, update the set of currently selected entities. */
+    /* Next, update the set of currently selected entities. The occluded 
+     * entities still remain selectable. */
     G_Sel_Update(ACTIVE_CAM, &s_gs.visible, &s_gs.visible_obbs);
+
+    const bool occlusion = s_setts.occlusion_culling->as_bool;
+    R_HiZUpdate(occlusion);
+    if(occlusion) {
+        g_cull_occluded();
+    }
+    PERF_RETURN_VOID();
 }
 
 void G_Render(void)
 {
+    PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
-    ss_e status;
-    (void)status;
 
     R_PushCmd((struct rcmd){ R_GL_BeginFrame, 0 });
+    G_Lights_Render(ACTIVE_CAM);
 
     struct render_input in;
     g_create_render_input(&in);
+#if CONFIG_PRESKIN
+    g_preskin(&in);
+#endif
     G_RenderMapAndEntities(in);
+    g_prefetch_chunks(&in);
 
-    struct sval refract_setting;
-    status = Settings_Get("pf.video.water_refraction", &refract_setting);
-    assert(status == SS_OKAY);
+    /* Keep the depth of the opaque scene for culling the following frames */
+    if(s_gs.map && s_setts.occlusion_culling->as_bool) {
 
-    struct sval reflect_setting;
-    status = Settings_Get("pf.video.water_reflection", &reflect_setting);
-    assert(status == SS_OKAY);
+        mat4x4_t view_proj;
+        Camera_MakeViewProjMat(ACTIVE_CAM, &view_proj);
+        uint32_t epoch = R_HiZEpoch();
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_HiZCapture,
+            .nargs = 2,
+            .args = {
+                R_PushArg(&view_proj, sizeof(view_proj)),
+                R_PushArg(&epoch, sizeof(epoch)),
+            },
+        });
+    }
 
     if(s_gs.map) {
         R_PushCmd((struct rcmd){
             .func = R_GL_DrawWater,
-            .nargs = 3,
+            .nargs = 5,
             .args = { 
                 g_push_render_input(in),
-                R_PushArg(&refract_setting.as_bool, sizeof(int)),
-                R_PushArg(&reflect_setting.as_bool, sizeof(int)),
+                R_PushArg(&s_setts.water_refraction->as_bool, sizeof(int)),
+                R_PushArg(&s_setts.water_reflection->as_bool, sizeof(int)),
+                R_PushArg(&s_setts.water_low_res->as_bool, sizeof(int)),
+                R_PushArg(&s_setts.water_reuse_frames->as_int, sizeof(int)),
             },
         });
     }
-    g_destroy_render_input(&in);
 
     enum selection_type sel_type;
     const vec_pentity_t *selected = G_Sel_Get(&sel_type);
-    for(int i = 0; i < vec_size(selected); i++) {
+    size_t nsel = vec_size(selected);
+    struct sel_circle *circles = nsel ? R_AllocArg(nsel * sizeof(struct sel_circle)) : NULL;
 
-        struct entity *curr = vec_AT(selected, i);
-        vec2_t curr_pos = G_Pos_GetXZ(curr->uid);
-        const float width = 0.4f;
+    if(circles) {
+
+        for(int i = 0; i < nsel; i++) {
+
+            struct entity *curr = vec_AT(selected, i);
+            circles[i] = (struct sel_circle){
+                .xz = G_Pos_GetXZ(curr->uid),
+                .radius = curr->selection_radius,
+                .width = 0.4f,
+                .color = g_seltype_color_map[sel_type],
+            };
+        }
 
         R_PushCmd((struct rcmd){
-            .func = R_GL_DrawSelectionCircle,
-            .nargs = 5,
+            .func = R_GL_DrawSelectionCircles,
+            .nargs = 3,
             .args = {
-                R_PushArg(&curr_pos, sizeof(curr_pos)),
-                R_PushArg(&curr->selection_radius, sizeof(curr->selection_radius)),
-                R_PushArg(&width, sizeof(width)),
-                R_PushArg(&g_seltype_color_map[sel_type], sizeof(g_seltype_color_map[0])),
-                (void*)s_gs.prev_tick_map,
+                circles,
+                R_PushArg(&nsel, sizeof(nsel)),
+                (void*)s_gs.prev_tick_map[s_gs.curr_ws_idx],
             },
         });
     }
@@ -936,25 +2195,41 @@ void G_Render(void)
     R_PushCmd((struct rcmd) { R_GL_SetScreenspaceDrawMode, 0 });
     E_Global_NotifyImmediate(EVENT_RENDER_UI, NULL, ES_ENGINE);
 
-    struct sval hb_setting;
-    status = Settings_Get("pf.game.healthbar_mode", &hb_setting);
-    assert(status == SS_OKAY);
-
-    if(hb_setting.as_bool) {
+    if(s_setts.healthbar_mode->as_bool) {
         g_render_healthbars();
     }
 
     if(s_gs.map) {
-        M_RenderMinimap(s_gs.map, ACTIVE_CAM);
+        size_t nunits;
+        const struct minimap_unit *units = g_minimap_units(&nunits);
+        M_RenderMinimap(s_gs.map, ACTIVE_CAM, nunits, units);
     }
+    PERF_RETURN_VOID();
 }
 
 void G_RenderMapAndEntities(struct render_input in)
 {
     if(in.shadows) {
-        g_shadow_pass(in.cam, in.map, in.light_vis_stat, in.light_vis_anim);
+        g_shadow_pass(&in);
+    }
+    g_draw_pass(&in);
+}
+
+void G_RenderMapAndEntitiesClipped(struct render_input in, vec4_t clip_plane)
+{
+    if(in.map) {
+        M_RenderVisibleMapClipped(in.map, in.cam, in.shadows, in.terrain_lod_dist, 
+            RENDER_PASS_REGULAR, clip_plane);
+    }
+
+    g_push_stat_instances(in.ents, in.nents, in.cam_pass, RCMD_DRAW_INSTANCED);
+    g_push_anim_instances(in.ents, in.nents, in.skin_first, in.cam_pass, RCMD_DRAW_INSTANCED);
+
+    if(in.scenery) {
+        struct frustum frustum;
+        Camera_MakeFrustum(in.cam, &frustum);
+        G_Scenery_Render(&frustum, false);
     }
-    g_draw_pass(in.cam, in.map, in.shadows, in.cam_vis_stat, in.cam_vis_anim);
 }
 
 bool G_AddEntity(struct entity *ent, vec3_t pos)
@@ -969,10 +2244,22 @@ bool G_AddEntity(struct entity *ent, vec3_t pos)
         return false;
     kh_value(s_gs.active, k) = ent;
 
+    if(!g_entlist_add(&s_gs.active_list, ent)) {
+        kh_del(entity, s_gs.active, k);
+        return false;
+    }
+
+    if(!g_slot_alloc(ent)) {
+        g_entlist_remove(&s_gs.active_list, ent);
+        kh_del(entity, s_gs.active, k);
+        return false;
+    }
+
     if(ent->flags & ENTITY_FLAG_COMBATABLE)
         G_Combat_AddEntity(ent, COMBAT_STANCE_AGGRESSIVE);
 
     G_Pos_Set(ent->uid, pos);
+    G_Fog_AddEntity(ent);
     if(ent->flags & ENTITY_FLAG_STATIC)
         return true;
 
@@ -984,14 +2271,45 @@ bool G_AddEntity(struct entity *ent, vec3_t pos)
     return true;
 }
 
+size_t G_AddEntities(struct entity *const *ents, const vec3_t *pos, size_t count)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    /* Grow all the tables up front. This is only an optimization - the 
+     * entities are still added one at a time below. */
+    size_t ndynamic = 0;
+    for(int i = 0; i < count; i++) {
+        if(!(ents[i]->flags & ENTITY_FLAG_STATIC))
+            ndynamic++;
+    }
+
+    kh_resize(entity, s_gs.active, (kh_size(s_gs.active) + count) * 4 / 3 + 1);
+    kh_resize(entity, s_gs.dynamic, (kh_size(s_gs.dynamic) + ndynamic) * 4 / 3 + 1);
+    g_entlist_reserve(&s_gs.active_list, count);
+    if(s_gs.slots.capacity < vec_size(&s_gs.slots) + count)
+        vec_entslot_resize(&s_gs.slots, vec_size(&s_gs.slots) + count);
+    G_Pos_Reserve(count);
+
+    size_t i;
+    for(i = 0; i < count; i++) {
+        if(!G_AddEntity(ents[i], pos[i]))
+            break;
+    }
+    return i;
+}
+
 bool G_RemoveEntity(struct entity *ent)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    if(s_load.active && g_load_forget(ent))
+        return true;
+
     khiter_t k = kh_get(entity, s_gs.active, ent->uid);
     if(k == kh_end(s_gs.active))
         return false;
     kh_del(entity, s_gs.active, k);
+    g_entlist_remove(&s_gs.active_list, ent);
 
     if(ent->flags & ENTITY_FLAG_SELECTABLE)
         G_Sel_Remove(ent);
@@ -1004,7 +2322,10 @@ bool G_RemoveEntity(struct entity *ent)
 
     G_Move_RemoveEntity(ent);
     G_Combat_RemoveEntity(ent);
+    G_Fog_RemoveEntity(ent);
+    G_Scenery_Remove(ent);
     G_Pos_Delete(ent->uid);
+    g_slot_free(ent->slot);
     return true;
 }
 
@@ -1022,7 +2343,7 @@ void G_StopEntity(const struct entity *ent)
 void G_SafeFree(struct entity *ent)
 {
     ASSERT_IN_MAIN_THREAD();
-    vec_pentity_push(&s_gs.deleted, ent);
+    vec_pentity_push(&s_gs.deleted[s_gs.curr_ws_idx], ent);
 }
 
 bool G_AddFaction(const char *name, vec3_t color)
@@ -1059,21 +2380,18 @@ bool G_RemoveFaction(int faction_id)
     if(faction_id < 0 || faction_id >= s_gs.num_factions)
         return false;
 
-    /* Remove all entities belonging to the faction. There is no problem
-     * with deleting an entry while iterating - the table bin simply gets 
-     * marked as 'deleted'. 
+    /* Remove all entities belonging to the faction. The list is walked 
+     * backwards, so that the entity moved into a removed entity's slot 
+     * has always been visited already. 
      * Also, patch the faction_ids (which are used to index 's_gs.factions' 
      * to account for the shift in entries in this array. */
-    for(khiter_t k = kh_begin(s_gs.active); k != kh_end(s_gs.active); k++) {
-
-        if(!kh_exist(s_gs.active, k))
-            continue;
+    for(int i = vec_size(&s_gs.active_list.ents) - 1; i >= 0; i--) {
 
-        struct entity *curr = kh_value(s_gs.active, k);
+        struct entity *curr = vec_AT(&s_gs.active_list.ents, i);
         if(curr->faction_id == faction_id)
             G_RemoveEntity(curr);
         else if(curr->faction_id > faction_id) 
-            --curr->faction_id;
+            G_SetFactionID(curr, curr->faction_id - 1);
     }
 
     /* Reflect the faction_id changes in the diplomacy table */
@@ -1158,6 +2476,26 @@ bool G_GetDiplomacyState(int fac_id_a, int fac_id_b, enum diplomacy_state *out)
     return true;
 }
 
+void G_SetFactionID(struct entity *ent, int faction_id)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    ent->faction_id = faction_id;
+    G_Pos_UpdateFaction(ent);
+
+    if(kh_get(entity, s_gs.active, ent->uid) != kh_end(s_gs.active))
+        G_Fog_UpdateEntity(ent);
+}
+
+void G_SetVisionRange(struct entity *ent, float vision_range)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    ent->vision_range = vision_range;
+    if(kh_get(entity, s_gs.active, ent->uid) != kh_end(s_gs.active))
+        G_Fog_UpdateEntity(ent);
+}
+
 bool G_ActivateCamera(int idx, enum cam_mode mode)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -1205,9 +2543,26 @@ bool G_UpdateTile(const struct tile_desc *desc, const struct tile *tile)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    s_gs.shadow_cache_valid = false;
     return M_AL_UpdateTile(s_gs.map, desc, tile);
 }
 
+bool G_UpdateTiles(size_t ntiles, const struct tile_desc *descs, const struct tile *tiles)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    s_gs.shadow_cache_valid = false;
+    if(!M_AL_UpdateTiles(s_gs.map, ntiles, descs, tiles))
+        return false;
+
+    /* Marking an already dirty minimap chunk does nothing */
+    for(int i = 0; i < ntiles; i++) {
+        if(!M_UpdateMinimapChunk(s_gs.map, descs[i].chunk_r, descs[i].chunk_c))
+            return false;
+    }
+    return true;
+}
+
 const khash_t(entity) *G_GetDynamicEntsSet(void)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -1222,6 +2577,28 @@ const khash_t(entity) *G_GetAllEntsSet(void)
     return s_gs.active;
 }
 
+struct entity *G_EntityForUID(uint32_t uid)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    khiter_t k = kh_get(entity, s_gs.active, uid);
+    if(k == kh_end(s_gs.active))
+        return NULL;
+    return kh_value(s_gs.active, k);
+}
+
+const vec_pentity_t *G_GetActiveEntities(void)
+{
+    return G_GetAllEntsList();
+}
+
+const vec_pentity_t *G_GetAllEntsList(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    return &s_gs.active_list.ents;
+}
+
 void G_SetSimState(enum simstate ss)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -1271,27 +2648,30 @@ enum simstate G_GetSimState(void)
 void G_Zombiefy(struct entity *ent)
 {
     ASSERT_IN_MAIN_THREAD();
+    vec_handle_push(&s_gs.dying, G_EntHandle(ent));
+}
 
-    if(ent->flags & ENTITY_FLAG_SELECTABLE)
-        G_Sel_Remove(ent);
+ent_handle_t G_EntHandle(const struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(vec_AT(&s_gs.slots, ent->slot).ent == ent);
 
-    if(!(ent->flags & ENTITY_FLAG_STATIC)) {
-        khiter_t k = kh_get(entity, s_gs.dynamic, ent->uid);
-        assert(k != kh_end(s_gs.dynamic));
-        kh_del(entity, s_gs.dynamic, k);
-    }
+    uint64_t gen = vec_AT(&s_gs.slots, ent->slot).gen;
+    return (gen << 32) | ent->slot;
+}
 
-    G_Move_RemoveEntity(ent);
-    G_Combat_RemoveEntity(ent);
+struct entity *G_EntFromHandle(ent_handle_t handle)
+{
+    ASSERT_IN_MAIN_THREAD();
 
-    ent->flags &= ~ENTITY_FLAG_SELECTABLE;
-    ent->flags &= ~ENTITY_FLAG_COLLISION;
-    ent->flags &= ~ENTITY_FLAG_COMBATABLE;
-    ent->flags &= ~ENTITY_FLAG_ANIMATED;
+    uint32_t idx = handle & 0xffffffff;
+    uint32_t gen = handle >> 32;
 
-    ent->flags |= ENTITY_FLAG_INVISIBLE;
-    ent->flags |= ENTITY_FLAG_STATIC;
-    ent->flags |= ENTITY_FLAG_ZOMBIE;
+    if(idx >= vec_size(&s_gs.slots))
+        return NULL;
+
+    const struct entity_slot *slot = &vec_AT(&s_gs.slots, idx);
+    return (slot->gen == gen) ? slot->ent : NULL;
 }
 
 struct render_workspace *G_GetSimWS(void)
@@ -1305,7 +2685,14 @@ struct render_workspace *G_GetRenderWS(void)
 {
     ASSERT_IN_RENDER_THREAD();;
 
-    return &s_gs.ws[(s_gs.curr_ws_idx + 1) % 2];
+    return &s_gs.ws[s_gs.render_ws_idx];
+}
+
+void G_ReleaseRenderWS(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    s_gs.render_ws_idx = (s_gs.render_ws_idx + 1) % NUM_WS;
 }
 
 void G_SwapBuffers(void)
@@ -1313,27 +2700,173 @@ void G_SwapBuffers(void)
     ASSERT_IN_MAIN_THREAD();
 
     int sim_idx = s_gs.curr_ws_idx;
-    int render_idx = (sim_idx + 1) % 2;
+    int next_idx = (sim_idx + 1) % NUM_WS;
 
     if(s_gs.map)
-        M_AL_ShallowCopy((struct map*)s_gs.prev_tick_map, s_gs.map);
+        M_AL_SyncSnapshot((struct map*)s_gs.prev_tick_map[sim_idx], s_gs.map);
 
-    for(int i = 0; i < vec_size(&s_gs.deleted); i++) {
+    /* The render thread is done with the oldest workspace, and thereby with 
+     * all the entities that were deleted while it was being filled. */
+    vec_pentity_t *deleted = &s_gs.deleted[next_idx];
+    for(int i = 0; i < vec_size(deleted); i++) {
 
-        struct entity *curr = vec_AT(&s_gs.deleted, i);
+        struct entity *curr = vec_AT(deleted, i);
         AL_EntityFree(curr);
     }
-    vec_pentity_reset(&s_gs.deleted);
+    vec_pentity_reset(deleted);
+
+    assert(queue_size(s_gs.ws[next_idx].commands) == 0);
+    R_ClearWS(&s_gs.ws[next_idx]);
+
+    /* The render thread is not touching either workspace at this point */
+    const struct memstack_stats *cleared = &s_gs.ws[next_idx].args.stats;
+    const struct memstack_stats *filled = &s_gs.ws[sim_idx].args.stats;
+    s_gs.ws_stats = (struct memstack_stats){
+        .bytes      = filled->bytes,
+        .last_bytes = cleared->last_bytes,
+        .high_water = MAX(cleared->high_water, filled->high_water),
+        .nblocks    = cleared->nblocks + filled->nblocks,
+        .noversized = filled->noversized,
+        .ntrimmed   = cleared->ntrimmed + filled->ntrimmed,
+    };
+    s_gs.curr_ws_idx = next_idx;
+}
 
-    assert(queue_size(s_gs.ws[render_idx].commands) == 0);
-    R_ClearWS(&s_gs.ws[render_idx]);
-    s_gs.curr_ws_idx = render_idx;
+void G_GetWSStats(struct memstack_stats *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    *out = s_gs.ws_stats;
 }
 
 const struct map *G_GetPrevTickMap(void)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    return s_gs.prev_tick_map;
+    return s_gs.prev_tick_map[s_gs.curr_ws_idx];
+}
+
+bool G_WriteSection(SDL_RWops *stream, uint32_t tag, uint32_t version, uint64_t size)
+{
+    struct state_section hdr = (struct state_section){
+        .tag = tag,
+        .version = version,
+        .size = size,
+    };
+    return (SDL_RWwrite(stream, &hdr, sizeof(hdr), 1) == 1);
+}
+
+bool G_SaveState(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    return g_save_factions(stream)
+        && G_SaveSimState(stream);
+}
+
+bool G_SaveSimState(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return true;
+
+    return G_Pos_SaveState(stream)
+        && G_Move_SaveState(stream)
+        && G_Combat_SaveState(stream);
+}
+
+bool G_LoadBegin(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_load.active);
+
+    if(!(s_load.remap = kh_init(entity)))
+        return false;
+    vec_pentity_init(&s_load.ents);
+    vec_vec3_init(&s_load.pos);
+    s_load.active = true;
+    return true;
+}
+
+bool G_LoadDeferEntity(uint32_t saved_uid, struct entity *ent, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_load.active)
+        return false;
+
+    int ret;
+    khiter_t k = kh_put(entity, s_load.remap, saved_uid, &ret);
+    if(ret == -1 || ret == 0)
+        return false;
+
+    if(!vec_pentity_push(&s_load.ents, ent)) {
+        kh_del(entity, s_load.remap, k);
+        return false;
+    }
+    if(!vec_vec3_push(&s_load.pos, pos)) {
+        vec_pentity_pop(&s_load.ents);
+        kh_del(entity, s_load.remap, k);
+        return false;
+    }
+
+    kh_value(s_load.remap, k) = ent;
+    return true;
+}
+
+bool G_LoadState(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_load.active);
+
+    if(!g_load_flush())
+        return false;
+
+    struct state_section hdr;
+    while(SDL_RWread(stream, &hdr, sizeof(hdr), 1) == 1) {
+
+        int64_t begin = SDL_RWseek(stream, 0, RW_SEEK_CUR);
+        bool ret = true;
+
+        switch(hdr.tag) {
+        case STATE_TAG_FACTIONS:
+            ret = g_load_factions(stream, &hdr);
+            break;
+        case STATE_TAG_POSITION:
+            ret = !s_gs.map || G_Pos_LoadState(stream, &hdr, s_load.remap);
+            break;
+        case STATE_TAG_MOVEMENT:
+            ret = !s_gs.map || G_Move_LoadState(stream, &hdr, s_load.remap);
+            break;
+        case STATE_TAG_COMBAT:
+            ret = !s_gs.map || G_Combat_LoadState(stream, &hdr, s_load.remap);
+            break;
+        default:
+            /* Sections written by newer versions are skipped */
+            break;
+        }
+
+        if(!ret)
+            return false;
+        if(SDL_RWseek(stream, begin + hdr.size, RW_SEEK_SET) < 0)
+            return false;
+    }
+    return true;
 }
 
+void G_LoadEnd(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_load.active)
+        return;
+
+    /* The state failed to load, but the entities were still recreated */
+    g_load_flush();
+
+    kh_destroy(entity, s_load.remap);
+    vec_pentity_destroy(&s_load.ents);
+    vec_vec3_destroy(&s_load.pos);
+    s_load.active = false;
+}
@@ -40,10 +40,51 @@
 
 struct camera;
 
+/* A generational reference to an entity: the slot index in the low 32 bits 
+ * and the slot generation in the high 32 bits. A handle goes stale as soon 
+ * as its' entity is removed from the simulation, even if the slot is then 
+ * reused. Generations start at 1, so a zero handle never resolves. */
+typedef uint64_t ent_handle_t;
+#define NULL_HANDLE ((ent_handle_t)0)
+
 const khash_t(entity) *G_GetDynamicEntsSet(void);
 const khash_t(entity) *G_GetAllEntsSet(void);
+const vec_pentity_t   *G_GetAllEntsList(void);
 const struct camera   *G_GetActiveCamera(void);
+/* The entity is taken out of the simulation, but stays around as long as 
+ * it's referenced by a script. This takes effect at the start of the next 
+ * 'G_Update', together with all the other entities that died in the tick. */
 void                   G_Zombiefy(struct entity *ent);
 
+ent_handle_t           G_EntHandle(const struct entity *ent);
+/* Returns NULL if the handle is stale */
+struct entity         *G_EntFromHandle(ent_handle_t handle);
+
+/* Every subsystem's part of a saved simulation state is a section starting 
+ * with this header. The payload format is private to the subsystem, which 
+ * checks the version on load. Sections with an unknown tag are skipped. */
+struct state_section{
+    uint32_t tag;
+    uint32_t version;
+    /* The size of the payload that follows */
+    uint64_t size;
+};
+
+#define STATE_TAG(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define STATE_TAG_FACTIONS    STATE_TAG('F', 'A', 'C', 'T')
+#define STATE_TAG_POSITION    STATE_TAG('P', 'O', 'S', 'N')
+#define STATE_TAG_MOVEMENT    STATE_TAG('M', 'O', 'V', 'E')
+#define STATE_TAG_COMBAT      STATE_TAG('C', 'M', 'B', 'T')
+
+bool                   G_WriteSection(SDL_RWops *stream, uint32_t tag, uint32_t version, uint64_t size);
+/* Writes only the sections which are the same for all the peers of a 
+ * lockstep match, leaving out the per-player faction settings */
+bool                   G_SaveSimState(SDL_RWops *stream);
+/* Issues a command in the replay encoding, recording it if a replay is 
+ * being recorded. Returns false if the payload is malformed. */
+bool                   G_Replay_Issue(int type, const void *payload, size_t size);
+
 #endif
 
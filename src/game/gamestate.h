@@ -41,10 +41,81 @@
 #include "../render/public/render_ctrl.h"
 #include "faction.h"
 #include "selection.h"
+#include "../entity.h"
+#include "../config.h"
 
 #include <stdint.h>
 
 #define NUM_CAMERAS  2
+#define NUM_WS       (CONFIG_RENDER_FRAME_LATENCY + 1)
+
+KHASH_DECLARE(entidx, khint32_t, int)
+
+/* A packed array of entities, to be iterated in memory order, with a table 
+ * mapping each entity's uid to its' index in the array. Deletion moves the 
+ * last entity into the vacated position. */
+struct entity_list{
+    vec_pentity_t     ents;
+    khash_t(entidx)  *index;
+};
+
+/* A slot of the entity table. The generation is bumped every time the 
+ * slot is vacated, invalidating all handles to its' previous occupant. */
+struct entity_slot{
+    struct entity    *ent;
+    uint32_t          gen;
+    int               next_free;
+};
+
+VEC_TYPE(entslot, struct entity_slot)
+VEC_IMPL(static inline, entslot, struct entity_slot)
+
+/* An entity and the mask of the passes that it's drawn into */
+struct draw_ent{
+    struct entity    *ent;
+    uint32_t          passes;
+};
+
+VEC_TYPE(drawent, struct draw_ent)
+VEC_IMPL(static inline, drawent, struct draw_ent)
+
+/* The arrays of the culled entities' boxes, in SoA form. There are 3 for the 
+ * center, 9 for the axes and 3 for the half lengths. */
+#define CULL_SOA_CENTER        (0)
+#define CULL_SOA_AXES          (3)
+#define CULL_SOA_HALF_LENGTHS  (12)
+#define CULL_SOA_FIELDS        (15)
+
+/* An entity binned into a cell of the culling grid. 'mask' has a bit set for 
+ * every culling frustum that the entity can be drawn into. */
+struct cull_ent{
+    struct entity    *ent;
+    struct obb        obb;
+    uint32_t          mask;
+    int               cell;
+};
+
+/* A node of the culling quadtree, bounding all the entities below it */
+struct cull_node{
+    struct aabb       aabb;
+    bool              empty;
+    /* The range of the cell's entities, for the nodes at the lowest level */
+    int               begin;
+    int               count;
+};
+
+VEC_TYPE(cullent, struct cull_ent)
+VEC_IMPL(static inline, cullent, struct cull_ent)
+
+VEC_TYPE(cullnode, struct cull_node)
+VEC_IMPL(static inline, cullnode, struct cull_node)
+
+VEC_TYPE(float, float)
+VEC_IMPL(static inline, float, float)
+
+/* Holds 'ent_handle_t's */
+VEC_TYPE(handle, uint64_t)
+VEC_IMPL(static inline, handle, uint64_t)
 
 struct gamestate{
     enum simstate           ss;
@@ -81,22 +152,74 @@ struct gamestate{
      *-------------------------------------------------------------------------
      */
     khash_t(entity)        *dynamic;
+    /*-------------------------------------------------------------------------
+     * Dense copy of the 'active' set, for the per-frame and per-tick 
+     * loops. The set is still used for lookups by uid.
+     *-------------------------------------------------------------------------
+     */
+    struct entity_list      active_list;
+    /*-------------------------------------------------------------------------
+     * Every active entity occupies a slot of this table until it is removed. 
+     * Vacated slots are chained into a free list, starting at 'free_slot' 
+     * (-1 when empty). Subsystems can keep per-entity state in dense arrays 
+     * indexed by the slot.
+     *-------------------------------------------------------------------------
+     */
+    vec_entslot_t           slots;
+    int                     free_slot;
     /*-------------------------------------------------------------------------
      * The set of entities potentially visible by the active camera.
      *-------------------------------------------------------------------------
      */
     vec_pentity_t           visible;
     /*-------------------------------------------------------------------------
-     * The set of entities that should be rendered from the light's point of 
-     * view (for creating the shadow depth map).
+     * Every entity that should be rendered into any of the passes, once, 
+     * along with the mask of the DRAW_PASS_* passes it's rendered into. 
+     * These are the entities visible from the active camera, from the light's 
+     * point of view in each cascade of the shadow depth map, and the ones 
+     * that are not entirely clipped by the water surface and are visible 
+     * from the active camera (refraction) or from its reflection. The 
+     * camera-visible entities come in the same order as in 'visible'.
+     *-------------------------------------------------------------------------
+     */
+    vec_drawent_t           drawn;
+    /*-------------------------------------------------------------------------
+     * The shadow map cascades for the current frame. The cascades starting at
+     * CONFIG_SHADOW_FIRST_CACHED keep the volume that was last rendered into 
+     * them for as long as it still covers their slice of the view frustum, 
+     * their casters stay the same and the cache is not invalidated. Only the 
+     * 'dirty' cascades are re-rendered.
      *-------------------------------------------------------------------------
      */
-    vec_pentity_t           light_visible;
+    struct shadow_cascade   cascades[CONFIG_SHADOW_CASCADES];
+    bool                    cascade_dirty[CONFIG_SHADOW_CASCADES];
+    uint64_t                cascade_casters[CONFIG_SHADOW_CASCADES];
+    vec3_t                  cascade_light_pos;
+    bool                    shadow_cache_valid;
     /*-------------------------------------------------------------------------
      * Cache of current-frame OBBs for visible entities.
      *-------------------------------------------------------------------------
      */
     vec_obb_t               visible_obbs;
+    /*-------------------------------------------------------------------------
+     * Scratch state of the per-frame visibility culling. The entities are 
+     * binned by the map chunk they are in, and a quadtree of aggregate AABBs 
+     * is built over the chunks, level by level, starting with the cells. The 
+     * grid is 'cull_dim' cells wide, which is a power of two. 'cull_ents' 
+     * is sorted by cell and 'cull_soa' holds the SoA copies of their OBBs.
+     *-------------------------------------------------------------------------
+     */
+    vec_cullent_t           cull_scratch;
+    vec_cullent_t           cull_ents;
+    vec_float_t             cull_soa;
+    vec_cullnode_t          cull_nodes;
+    int                     cull_dim;
+    /*-------------------------------------------------------------------------
+     * The entities of 'drawn' that are rendered into any of this frame's 
+     * passes, whose render states are filled in by the workers.
+     *-------------------------------------------------------------------------
+     */
+    vec_drawent_t           draw_scratch;
     /*-------------------------------------------------------------------------
      * The state of the factions in the current game.
      *-------------------------------------------------------------------------
@@ -110,26 +233,41 @@ struct gamestate{
      */
     enum diplomacy_state    diplomacy_table[MAX_FACTIONS][MAX_FACTIONS];
     /*-------------------------------------------------------------------------
-     * The index indo the 'ws' field, where the rendering commands are stored.
-     * The previous frame workspace is owned by the render thread. The render
-     * and simulatino workspaces are swapped at the end of every frame.
+     * The render workspaces, which are used in ring order. The main thread 
+     * stores the current frame's rendering commands at 'curr_ws_idx'. The 
+     * render thread executes the up to CONFIG_RENDER_FRAME_LATENCY earlier 
+     * workspaces, starting at 'render_ws_idx', which only it may touch.
      *-------------------------------------------------------------------------
      */
     int                     curr_ws_idx;
-    struct render_workspace ws[2];
+    int                     render_ws_idx;
+    struct render_workspace ws[NUM_WS];
+    struct memstack_stats   ws_stats;
+    /*-------------------------------------------------------------------------
+     * A readonly snapshot (copy) of the map for every workspace, taken when the 
+     * workspace is handed to the render thread. This is used by the render 
+     * thread for making certain queries like size, height at a point, etc.
+     *-------------------------------------------------------------------------
+     */
+    const struct map       *prev_tick_map[NUM_WS];
+    /*-------------------------------------------------------------------------
+     * Entities scheduled for deletion while each workspace was being filled. 
+     * They are safe to delete once the render thread is done with it.
+     *-------------------------------------------------------------------------
+     */
+    vec_pentity_t           deleted[NUM_WS];
     /*-------------------------------------------------------------------------
-     * A readonly snapshot (copy) of the map from the previous simulation tick. 
-     * This is used by the render thread for making certain queries like size,
-     * height at a point, etc.
+     * Handles to the entities that died during the current tick. They are 
+     * turned into zombies together, at the start of the next update.
      *-------------------------------------------------------------------------
      */
-    const struct map       *prev_tick_map;
+    vec_handle_t            dying;
     /*-------------------------------------------------------------------------
-     * Entities currently scheduled for deletion. They are safe to delete once
-     * the render thread has finished its' work.
+     * Path of the file where the map's navigation data is cached. Empty if 
+     * the map was not loaded from a file.
      *-------------------------------------------------------------------------
      */
-    vec_pentity_t           deleted;
+    char                    navcache_path[256];
 };
 
 #endif
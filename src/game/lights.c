@@ -0,0 +1,220 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "lights.h"
+#include "public/game.h"
+#include "../camera.h"
+#include "../main.h"
+#include "../config.h"
+#include "../render/public/render.h"
+#include "../render/public/render_ctrl.h"
+#include "../lib/public/vec.h"
+#include "../lib/public/khash.h"
+
+#include <assert.h>
+
+KHASH_MAP_INIT_INT(light, int)
+
+VEC_TYPE(light, struct point_light)
+VEC_IMPL(static inline, light, struct point_light)
+
+VEC_TYPE(lid, uint32_t)
+VEC_IMPL(static inline, lid, uint32_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The lights are kept packed, so that they can be handed to the renderer 
+ * in a single copy. 'ids' runs parallel to 'lights', and 'index' maps an 
+ * ID to the position of the light. */
+static vec_light_t      s_lights;
+static vec_lid_t        s_ids;
+static khash_t(light)  *s_index;
+static uint32_t         s_next_id = 1;
+/* Set when the renderer still has lights from the previous frame */
+static bool             s_drawn;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static struct point_light *light_for_id(uint32_t id)
+{
+    khiter_t k = kh_get(light, s_index, id);
+    if(k == kh_end(s_index))
+        return NULL;
+    return &vec_AT(&s_lights, kh_value(s_index, k));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Lights_Init(void)
+{
+    if(!(s_index = kh_init(light)))
+        return false;
+
+    vec_light_init(&s_lights);
+    vec_lid_init(&s_ids);
+    s_drawn = false;
+    return true;
+}
+
+void G_Lights_Shutdown(void)
+{
+    vec_lid_destroy(&s_ids);
+    vec_light_destroy(&s_lights);
+    kh_destroy(light, s_index);
+}
+
+void G_Lights_Clear(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    vec_light_reset(&s_lights);
+    vec_lid_reset(&s_ids);
+    kh_clear(light, s_index);
+}
+
+void G_Lights_Render(const struct camera *cam)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    size_t count = vec_size(&s_lights);
+    if(count == 0 && !s_drawn)
+        return;
+
+    mat4x4_t view, proj;
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_LightsUpdate,
+        .nargs = 4,
+        .args = {
+            R_PushArg(s_lights.array, count * sizeof(struct point_light)),
+            R_PushArg(&count, sizeof(count)),
+            R_PushArg(&view, sizeof(view)),
+            R_PushArg(&proj, sizeof(proj)),
+        },
+    });
+    s_drawn = (count > 0);
+}
+
+uint32_t G_Light_AddPoint(vec3_t pos, vec3_t color, float radius)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(radius <= 0.0f)
+        return 0;
+
+    uint32_t id = s_next_id;
+    int ret;
+    khiter_t k = kh_put(light, s_index, id, &ret);
+    if(ret == -1)
+        return 0;
+
+    struct point_light light = (struct point_light){
+        .pos = pos,
+        .radius = radius,
+        .color = color,
+    };
+    if(!vec_light_push(&s_lights, light))
+        goto fail_light;
+    if(!vec_lid_push(&s_ids, id))
+        goto fail_id;
+
+    kh_value(s_index, k) = vec_size(&s_lights) - 1;
+    /* 0 is never handed out */
+    if(++s_next_id == 0)
+        s_next_id = 1;
+    return id;
+
+fail_id:
+    vec_light_pop(&s_lights);
+fail_light:
+    kh_del(light, s_index, k);
+    return 0;
+}
+
+bool G_Light_Remove(uint32_t id)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    khiter_t k = kh_get(light, s_index, id);
+    if(k == kh_end(s_index))
+        return false;
+
+    /* Move the last light into the hole */
+    int idx = kh_value(s_index, k);
+    kh_del(light, s_index, k);
+
+    int last = vec_size(&s_lights) - 1;
+    if(idx != last) {
+
+        uint32_t moved = vec_AT(&s_ids, last);
+        khiter_t mk = kh_get(light, s_index, moved);
+        assert(mk != kh_end(s_index));
+        kh_value(s_index, mk) = idx;
+    }
+
+    vec_light_del(&s_lights, idx);
+    vec_lid_del(&s_ids, idx);
+    return true;
+}
+
+bool G_Light_SetPos(uint32_t id, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct point_light *light = light_for_id(id);
+    if(!light)
+        return false;
+    light->pos = pos;
+    return true;
+}
+
+bool G_Light_SetColor(uint32_t id, vec3_t color)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct point_light *light = light_for_id(id);
+    if(!light)
+        return false;
+    light->color = color;
+    return true;
+}
@@ -0,0 +1,901 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* For getaddrinfo, which is left out by -std=c99 */
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "lockstep.h"
+#include "game_private.h"
+#include "timer_events.h"
+#include "public/game.h"
+#include "../lib/public/vec.h"
+#include "../lib/public/SDL_vec_rwops.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#if defined(_WIN32)
+typedef SOCKET sock_t;
+#define SOCK_NONE           INVALID_SOCKET
+#define sock_close(_s)      closesocket(_s)
+#define sock_would_block()  (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+typedef int sock_t;
+#define SOCK_NONE           (-1)
+#define sock_close(_s)      close(_s)
+#define sock_would_block()  (errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+
+/* The peers are connected in a star: every client is connected only to 
+ * the host, which relays the clients' turns to one another. Every message 
+ * is a fixed-size header, followed by a payload of 'size' bytes. All the 
+ * fields are in host byte order, like in the replay files. */
+#define LOCKSTEP_VERSION    (1)
+#define MSG_HDR_SIZE        (sizeof(uint8_t) + sizeof(uint32_t))
+#define MAX_MSG_SIZE        (1u << 20)
+
+/* A turn is run every TURN_TICKS base ticks. The commands issued during a 
+ * turn take effect INPUT_DELAY turns later, which hides the round trip to 
+ * the other peers. The hashes of the simulation state are compared every 
+ * HASH_TURNS turns. */
+#define TURN_TICKS          (6)
+#define INPUT_DELAY         (3)
+#define HASH_TURNS          (10)
+#define MAX_PEERS           (8)
+
+/* A peer can run at most INPUT_DELAY turns ahead of the slowest peer, so 
+ * the turns received from it are never more than twice as far ahead */
+#define TURN_RING           (2 * INPUT_DELAY + 2)
+#define HASH_RING           (INPUT_DELAY / HASH_TURNS + 2)
+
+enum msg_type{
+    /* uint32_t version */
+    MSG_HELLO = 0,
+    /* uint32_t version, uint8_t peer_id, uint8_t npeers */
+    MSG_START,
+    /* uint32_t turn, uint8_t peer_id, uint32_t hash_turn, uint64_t hash, 
+     * uint32_t ncmds, followed by 'ncmds' commands of the form 
+     * (uint8_t type, uint32_t size, payload) */
+    MSG_TURN,
+};
+
+#define TURN_FIXED_SIZE \
+    (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+
+enum lockstep_state{
+    LOCKSTEP_NONE,
+    /* The host is waiting for all the clients to connect */
+    LOCKSTEP_LISTENING,
+    /* The client is waiting for the host to start the match */
+    LOCKSTEP_JOINING,
+    LOCKSTEP_RUNNING,
+};
+
+VEC_TYPE(byte, unsigned char)
+VEC_IMPL(static inline, byte, unsigned char)
+
+struct conn{
+    sock_t     fd;
+    int        peer_id;
+    bool       hello;
+    vec_byte_t in;
+    vec_byte_t out;
+};
+
+struct turn_slot{
+    uint32_t   turn;
+    /* A mask of the peers whose commands for the turn have arrived */
+    uint32_t   have;
+    uint32_t   hash_turn[MAX_PEERS];
+    uint64_t   hash[MAX_PEERS];
+    uint32_t   ncmds[MAX_PEERS];
+    vec_byte_t cmds[MAX_PEERS];
+};
+
+struct hash_entry{
+    uint32_t turn;
+    uint64_t hash;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static enum lockstep_state     s_state = LOCKSTEP_NONE;
+static bool                    s_host;
+static sock_t                  s_listen = SOCK_NONE;
+/* The host has a connection to every client, the clients only to the host */
+static struct conn             s_conns[MAX_PEERS - 1];
+static size_t                  s_nconns;
+static int                     s_peer_id;
+static int                     s_npeers;
+/* The next turn to be run */
+static uint32_t                s_turn;
+/* The local commands issued since the start of the current turn */
+static vec_byte_t              s_pending;
+static uint32_t                s_npending;
+static struct turn_slot        s_turns[TURN_RING];
+static struct hash_entry       s_hashes[HASH_RING];
+static struct lockstep_status  s_status;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool append(vec_byte_t *buff, const void *data, size_t size)
+{
+    if(buff->capacity - buff->size < size) {
+        size_t new_cap = buff->capacity ? buff->capacity : 256;
+        while(new_cap - buff->size < size)
+            new_cap *= 2;
+        if(!vec_byte_resize(buff, new_cap))
+            return false;
+    }
+    memcpy(buff->array + buff->size, data, size);
+    buff->size += size;
+    return true;
+}
+
+static unsigned char *put(unsigned char *out, const void *val, size_t size)
+{
+    memcpy(out, val, size);
+    return out + size;
+}
+
+static const unsigned char *get(const unsigned char *in, void *out, size_t size)
+{
+    memcpy(out, in, size);
+    return in + size;
+}
+
+static uint64_t fnv1a(const unsigned char *data, size_t size, uint64_t hash)
+{
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool sock_configure(sock_t fd)
+{
+#if defined(_WIN32)
+    u_long nonblock = 1;
+    if(ioctlsocket(fd, FIONBIO, &nonblock) != 0)
+        return false;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return false;
+#endif
+    /* The turns are small and latency-bound */
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    return true;
+}
+
+static bool net_init(void)
+{
+#if defined(_WIN32)
+    WSADATA data;
+    return (WSAStartup(MAKEWORD(2, 2), &data) == 0);
+#else
+    return true;
+#endif
+}
+
+static void net_shutdown(void)
+{
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+static void conn_init(struct conn *conn, sock_t fd, int peer_id)
+{
+    conn->fd = fd;
+    conn->peer_id = peer_id;
+    conn->hello = false;
+    vec_byte_init(&conn->in);
+    vec_byte_init(&conn->out);
+}
+
+static void conn_destroy(struct conn *conn)
+{
+    sock_close(conn->fd);
+    vec_byte_destroy(&conn->in);
+    vec_byte_destroy(&conn->out);
+}
+
+static bool conn_flush(struct conn *conn)
+{
+    size_t sent = 0;
+    while(sent < conn->out.size) {
+
+        int ret = send(conn->fd, (const char*)conn->out.array + sent, conn->out.size - sent, 0);
+        if(ret < 0 && sock_would_block())
+            break;
+        if(ret <= 0)
+            return false;
+        sent += ret;
+    }
+
+    memmove(conn->out.array, conn->out.array + sent, conn->out.size - sent);
+    conn->out.size -= sent;
+    s_status.bytes_sent += sent;
+    return true;
+}
+
+/* Returns false if the connection has been closed */
+static bool conn_recv(struct conn *conn)
+{
+    unsigned char buff[4096];
+    while(true) {
+
+        int ret = recv(conn->fd, (char*)buff, sizeof(buff), 0);
+        if(ret < 0 && sock_would_block())
+            return true;
+        if(ret <= 0)
+            return false;
+        if(!append(&conn->in, buff, ret))
+            return false;
+        s_status.bytes_received += ret;
+    }
+}
+
+static bool conn_send(struct conn *conn, enum msg_type type, const void *payload, size_t size)
+{
+    uint8_t type8 = type;
+    uint32_t size32 = size;
+    return append(&conn->out, &type8, sizeof(type8))
+        && append(&conn->out, &size32, sizeof(size32))
+        && (size == 0 || append(&conn->out, payload, size));
+}
+
+static void fail(const char *reason)
+{
+    fprintf(stderr, "Lockstep: %s. The match has been stopped.\n", reason);
+    G_Lockstep_Stop();
+}
+
+static struct turn_slot *slot_for_turn(uint32_t turn)
+{
+    struct turn_slot *slot = &s_turns[turn % TURN_RING];
+    if(slot->turn != turn) {
+        slot->turn = turn;
+        slot->have = 0;
+        for(int i = 0; i < MAX_PEERS; i++) {
+            vec_byte_reset(&slot->cmds[i]);
+        }
+    }
+    return slot;
+}
+
+static uint32_t all_peers_mask(void)
+{
+    return (1u << s_npeers) - 1;
+}
+
+static void start(int peer_id, int npeers)
+{
+    s_peer_id = peer_id;
+    s_npeers = npeers;
+    s_turn = 1;
+    for(int i = 0; i < TURN_RING; i++) {
+        s_turns[i].turn = 0;
+        s_turns[i].have = 0;
+    }
+    memset(s_hashes, 0, sizeof(s_hashes));
+    vec_byte_reset(&s_pending);
+    s_npending = 0;
+
+    /* The lower-rate ticks are delivered based on the base tick count, so 
+     * all the peers must count from the same point */
+    G_Timer_ResetTicks();
+    s_state = LOCKSTEP_RUNNING;
+}
+
+/* Returns false if the message is malformed */
+static bool store_turn(const unsigned char *payload, size_t size, int expected_peer)
+{
+    uint32_t turn, hash_turn, ncmds;
+    uint8_t peer;
+    uint64_t hash;
+
+    if(size < TURN_FIXED_SIZE)
+        return false;
+    payload = get(payload, &turn, sizeof(turn));
+    payload = get(payload, &peer, sizeof(peer));
+    payload = get(payload, &hash_turn, sizeof(hash_turn));
+    payload = get(payload, &hash, sizeof(hash));
+    payload = get(payload, &ncmds, sizeof(ncmds));
+
+    if(peer >= s_npeers || peer == s_peer_id)
+        return false;
+    if(expected_peer >= 0 && peer != expected_peer)
+        return false;
+    if(turn < s_turn || turn >= s_turn + TURN_RING)
+        return false;
+
+    struct turn_slot *slot = slot_for_turn(turn);
+    if(slot->have & (1u << peer))
+        return false;
+
+    vec_byte_reset(&slot->cmds[peer]);
+    if(!append(&slot->cmds[peer], payload, size - TURN_FIXED_SIZE))
+        return false;
+
+    slot->hash_turn[peer] = hash_turn;
+    slot->hash[peer] = hash;
+    slot->ncmds[peer] = ncmds;
+    slot->have |= (1u << peer);
+    return true;
+}
+
+/* Returns false if the match has been stopped */
+static bool handle_msg(struct conn *conn, uint8_t type, const unsigned char *payload, size_t size)
+{
+    uint32_t version;
+
+    switch(type) {
+    case MSG_HELLO:
+        if(!s_host || conn->hello || size != sizeof(version))
+            goto fail_malformed;
+        get(payload, &version, sizeof(version));
+        if(version != LOCKSTEP_VERSION) {
+            fail("A client has an incompatible version");
+            return false;
+        }
+        conn->hello = true;
+        return true;
+
+    case MSG_START: {
+
+        uint8_t peer_id, npeers;
+        if(s_host || s_state != LOCKSTEP_JOINING)
+            goto fail_malformed;
+        if(size != sizeof(version) + sizeof(peer_id) + sizeof(npeers))
+            goto fail_malformed;
+        payload = get(payload, &version, sizeof(version));
+        payload = get(payload, &peer_id, sizeof(peer_id));
+        payload = get(payload, &npeers, sizeof(npeers));
+        if(version != LOCKSTEP_VERSION) {
+            fail("The host has an incompatible version");
+            return false;
+        }
+        if(npeers > MAX_PEERS || peer_id == 0 || peer_id >= npeers)
+            goto fail_malformed;
+        start(peer_id, npeers);
+        return true;
+    }
+    case MSG_TURN:
+        if(s_state != LOCKSTEP_RUNNING)
+            goto fail_malformed;
+        if(!store_turn(payload, size, s_host ? conn->peer_id : -1))
+            goto fail_malformed;
+
+        if(s_host) {
+            for(int i = 0; i < s_nconns; i++) {
+                if(&s_conns[i] == conn)
+                    continue;
+                if(!conn_send(&s_conns[i], MSG_TURN, payload, size)) {
+                    fail("Out of memory");
+                    return false;
+                }
+            }
+        }
+        return true;
+
+    default:
+        goto fail_malformed;
+    }
+
+fail_malformed:
+    fail("Received a malformed message");
+    return false;
+}
+
+/* Returns false if the match has been stopped */
+static bool conn_process(struct conn *conn)
+{
+    /* The messages that arrived before the connection was closed are 
+     * still handled, as they can complete the turns we are waiting on */
+    bool open = conn_flush(conn) && conn_recv(conn);
+
+    size_t offset = 0;
+    while(conn->in.size - offset >= MSG_HDR_SIZE) {
+
+        uint8_t type;
+        uint32_t size;
+        const unsigned char *cursor = conn->in.array + offset;
+        cursor = get(cursor, &type, sizeof(type));
+        cursor = get(cursor, &size, sizeof(size));
+
+        if(size > MAX_MSG_SIZE) {
+            fail("Received a malformed message");
+            return false;
+        }
+        if(conn->in.size - offset - MSG_HDR_SIZE < size)
+            break;
+        if(!handle_msg(conn, type, cursor, size))
+            return false;
+        offset += MSG_HDR_SIZE + size;
+    }
+
+    memmove(conn->in.array, conn->in.array + offset, conn->in.size - offset);
+    conn->in.size -= offset;
+
+    if(!open) {
+        fail("Lost the connection to a peer");
+        return false;
+    }
+    return true;
+}
+
+static void host_accept(void)
+{
+    while(s_nconns < s_npeers - 1) {
+
+        sock_t fd = accept(s_listen, NULL, NULL);
+        if(fd == SOCK_NONE)
+            return;
+        if(!sock_configure(fd)) {
+            sock_close(fd);
+            continue;
+        }
+        conn_init(&s_conns[s_nconns], fd, s_nconns + 1);
+        s_nconns++;
+    }
+}
+
+/* Once all the clients have said hello, every one of them is told its' 
+ * peer id and the match is started */
+static bool host_try_start(void)
+{
+    if(s_nconns < s_npeers - 1)
+        return true;
+    for(int i = 0; i < s_nconns; i++) {
+        if(!s_conns[i].hello)
+            return true;
+    }
+
+    for(int i = 0; i < s_nconns; i++) {
+
+        uint32_t version = LOCKSTEP_VERSION;
+        uint8_t peer_id = s_conns[i].peer_id, npeers = s_npeers;
+        unsigned char buff[sizeof(version) + sizeof(peer_id) + sizeof(npeers)], *cursor = buff;
+        cursor = put(cursor, &version, sizeof(version));
+        cursor = put(cursor, &peer_id, sizeof(peer_id));
+        cursor = put(cursor, &npeers, sizeof(npeers));
+
+        if(!conn_send(&s_conns[i], MSG_START, buff, sizeof(buff))
+        || !conn_flush(&s_conns[i])) {
+            fail("Could not start the match");
+            return false;
+        }
+    }
+
+    sock_close(s_listen);
+    s_listen = SOCK_NONE;
+    start(0, s_npeers);
+    return true;
+}
+
+/* The hash covers only the state which is the same for all the peers */
+static bool state_hash(uint64_t *out)
+{
+    SDL_RWops *vops = PFSDL_VectorRWOps();
+    if(!vops)
+        return false;
+
+    bool ret = false;
+    unsigned char *data = NULL;
+    if(!G_SaveSimState(vops))
+        goto out;
+
+    size_t size = vops->size(vops);
+    if(!(data = malloc(size ? size : 1)))
+        goto out;
+    vops->seek(vops, 0, RW_SEEK_SET);
+    if(size && SDL_RWread(vops, data, size, 1) != 1)
+        goto out;
+
+    *out = fnv1a(data, size, 14695981039346656037ull);
+    ret = true;
+
+out:
+    free(data);
+    SDL_RWclose(vops);
+    return ret;
+}
+
+static void check_hash(int peer, uint32_t turn, uint64_t hash)
+{
+    const struct hash_entry *entry = &s_hashes[(turn / HASH_TURNS) % HASH_RING];
+    if(entry->turn != turn || entry->hash == hash)
+        return;
+    if(s_status.desync)
+        return;
+
+    fprintf(stderr, "Lockstep: the state of peer %d differs from ours at turn %u. "
+        "The peers may be running different builds of the engine, or on platforms "
+        "whose math libraries give different results.\n", peer, turn);
+    s_status.desync = true;
+    s_status.desync_turn = turn;
+}
+
+/* Returns false if the match has been stopped */
+static bool run_turn(struct turn_slot *slot)
+{
+    assert(slot->turn == s_turn && slot->have == all_peers_mask());
+
+    for(int peer = 0; peer < s_npeers; peer++) {
+
+        if(peer != s_peer_id && slot->hash_turn[peer])
+            check_hash(peer, slot->hash_turn[peer], slot->hash[peer]);
+
+        const unsigned char *cursor = slot->cmds[peer].array;
+        size_t left = slot->cmds[peer].size;
+
+        for(int i = 0; i < slot->ncmds[peer]; i++) {
+
+            uint8_t type;
+            uint32_t size;
+            if(left < MSG_HDR_SIZE)
+                goto fail_malformed;
+            cursor = get(cursor, &type, sizeof(type));
+            cursor = get(cursor, &size, sizeof(size));
+            left -= MSG_HDR_SIZE;
+            if(left < size)
+                goto fail_malformed;
+
+            if(!G_Replay_Issue(type, cursor, size))
+                goto fail_malformed;
+            cursor += size;
+            left -= size;
+        }
+    }
+    return true;
+
+fail_malformed:
+    fail("Received a malformed command");
+    return false;
+}
+
+/* Returns false if the match has been stopped */
+static bool send_turn(uint32_t turn, uint32_t hash_turn, uint64_t hash)
+{
+    uint8_t peer = s_peer_id;
+    unsigned char hdr[TURN_FIXED_SIZE], *cursor = hdr;
+    cursor = put(cursor, &turn, sizeof(turn));
+    cursor = put(cursor, &peer, sizeof(peer));
+    cursor = put(cursor, &hash_turn, sizeof(hash_turn));
+    cursor = put(cursor, &hash, sizeof(hash));
+    cursor = put(cursor, &s_npending, sizeof(s_npending));
+
+    /* Our own commands are run from the same slots as everyone else's */
+    struct turn_slot *slot = slot_for_turn(turn);
+    vec_byte_reset(&slot->cmds[peer]);
+    if(!append(&slot->cmds[peer], s_pending.array, s_pending.size))
+        goto fail_nomem;
+    slot->hash_turn[peer] = hash_turn;
+    slot->hash[peer] = hash;
+    slot->ncmds[peer] = s_npending;
+    slot->have |= (1u << peer);
+
+    vec_byte_t msg;
+    vec_byte_init(&msg);
+    if(!append(&msg, hdr, sizeof(hdr))
+    || !append(&msg, s_pending.array, s_pending.size)) {
+        vec_byte_destroy(&msg);
+        goto fail_nomem;
+    }
+
+    for(int i = 0; i < s_nconns; i++) {
+        if(!conn_send(&s_conns[i], MSG_TURN, msg.array, msg.size)) {
+            vec_byte_destroy(&msg);
+            goto fail_nomem;
+        }
+    }
+    vec_byte_destroy(&msg);
+
+    vec_byte_reset(&s_pending);
+    s_npending = 0;
+    return true;
+
+fail_nomem:
+    fail("Out of memory");
+    return false;
+}
+
+static void lockstep_begin(bool host, int npeers)
+{
+    s_host = host;
+    s_npeers = npeers;
+    s_peer_id = 0;
+    s_nconns = 0;
+    memset(&s_status, 0, sizeof(s_status));
+    vec_byte_init(&s_pending);
+    s_npending = 0;
+    for(int i = 0; i < TURN_RING; i++) {
+        s_turns[i].turn = 0;
+        s_turns[i].have = 0;
+        for(int j = 0; j < MAX_PEERS; j++) {
+            vec_byte_init(&s_turns[i].cmds[j]);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Lockstep_Host(uint16_t port, int npeers)
+{
+    if(s_state != LOCKSTEP_NONE || G_Replay_IsRecording() || G_Replay_IsPlaying())
+        return false;
+    if(npeers < 1 || npeers > MAX_PEERS)
+        return false;
+    if(!net_init())
+        goto fail_init;
+
+    s_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if(s_listen == SOCK_NONE)
+        goto fail_socket;
+
+    int reuse = 1;
+    setsockopt(s_listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if(bind(s_listen, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        goto fail_listen;
+    if(listen(s_listen, MAX_PEERS) != 0)
+        goto fail_listen;
+    if(!sock_configure(s_listen))
+        goto fail_listen;
+
+    lockstep_begin(true, npeers);
+    s_state = LOCKSTEP_LISTENING;
+    host_try_start();
+    return true;
+
+fail_listen:
+    sock_close(s_listen);
+    s_listen = SOCK_NONE;
+fail_socket:
+    net_shutdown();
+fail_init:
+    return false;
+}
+
+bool G_Lockstep_Join(const char *host, uint16_t port)
+{
+    if(s_state != LOCKSTEP_NONE || G_Replay_IsRecording() || G_Replay_IsPlaying())
+        return false;
+    if(!net_init())
+        goto fail_init;
+
+    char service[16];
+    snprintf(service, sizeof(service), "%u", (unsigned)port);
+
+    struct addrinfo hints = {0}, *result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, service, &hints, &result) != 0)
+        goto fail_resolve;
+
+    /* The connection is made synchronously. Only the match itself is 
+     * serviced without blocking. */
+    sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == SOCK_NONE)
+        goto fail_socket;
+    if(connect(fd, result->ai_addr, result->ai_addrlen) != 0)
+        goto fail_connect;
+    if(!sock_configure(fd))
+        goto fail_connect;
+    freeaddrinfo(result);
+
+    lockstep_begin(false, MAX_PEERS);
+    conn_init(&s_conns[0], fd, 0);
+    s_nconns = 1;
+    s_state = LOCKSTEP_JOINING;
+
+    uint32_t version = LOCKSTEP_VERSION;
+    if(!conn_send(&s_conns[0], MSG_HELLO, &version, sizeof(version))) {
+        G_Lockstep_Stop();
+        return false;
+    }
+    return true;
+
+fail_connect:
+    sock_close(fd);
+fail_socket:
+    freeaddrinfo(result);
+fail_resolve:
+    net_shutdown();
+fail_init:
+    return false;
+}
+
+void G_Lockstep_Stop(void)
+{
+    if(s_state == LOCKSTEP_NONE)
+        return;
+
+    for(int i = 0; i < s_nconns; i++) {
+        conn_destroy(&s_conns[i]);
+    }
+    s_nconns = 0;
+
+    if(s_listen != SOCK_NONE) {
+        sock_close(s_listen);
+        s_listen = SOCK_NONE;
+    }
+
+    vec_byte_destroy(&s_pending);
+    for(int i = 0; i < TURN_RING; i++) {
+        for(int j = 0; j < MAX_PEERS; j++) {
+            vec_byte_destroy(&s_turns[i].cmds[j]);
+        }
+    }
+
+    net_shutdown();
+    s_state = LOCKSTEP_NONE;
+}
+
+void G_Lockstep_GetStatus(struct lockstep_status *out)
+{
+    *out = s_status;
+    out->active = (s_state != LOCKSTEP_NONE);
+    out->running = (s_state == LOCKSTEP_RUNNING);
+    out->peer_id = s_peer_id;
+    out->npeers = (s_state == LOCKSTEP_JOINING) ? 0 : s_npeers;
+    out->turn = (s_state == LOCKSTEP_RUNNING) ? s_turn : 0;
+    out->input_delay = INPUT_DELAY;
+    out->turn_ticks = TURN_TICKS;
+}
+
+bool G_Lockstep_Active(void)
+{
+    return (s_state != LOCKSTEP_NONE);
+}
+
+void G_Lockstep_Submit(int type, const void *payload, size_t size)
+{
+    assert(s_state != LOCKSTEP_NONE);
+
+    uint8_t type8 = type;
+    uint32_t size32 = size;
+    if(!append(&s_pending, &type8, sizeof(type8))
+    || !append(&s_pending, &size32, sizeof(size32))
+    || (size && !append(&s_pending, payload, size))) {
+        fail("Out of memory");
+        return;
+    }
+    s_npending++;
+}
+
+void G_Lockstep_Poll(void)
+{
+    if(s_state == LOCKSTEP_NONE)
+        return;
+
+    if(s_state == LOCKSTEP_LISTENING)
+        host_accept();
+
+    for(int i = 0; i < s_nconns; i++) {
+        if(!conn_process(&s_conns[i]))
+            return;
+    }
+
+    if(s_state == LOCKSTEP_LISTENING)
+        host_try_start();
+}
+
+bool G_Lockstep_TickReady(unsigned long long tick)
+{
+    if(s_state == LOCKSTEP_NONE)
+        return true;
+    if(s_state != LOCKSTEP_RUNNING)
+        return false;
+    if(tick % TURN_TICKS)
+        return true;
+
+    uint32_t turn = tick / TURN_TICKS;
+    if(turn <= INPUT_DELAY)
+        return true;
+
+    const struct turn_slot *slot = &s_turns[turn % TURN_RING];
+    if(slot->turn == turn && slot->have == all_peers_mask())
+        return true;
+
+    s_status.stalled_frames++;
+    return false;
+}
+
+void G_Lockstep_OnTick(unsigned long long tick)
+{
+    if(s_state != LOCKSTEP_RUNNING)
+        return;
+    if(tick % TURN_TICKS)
+        return;
+
+    assert(tick / TURN_TICKS == s_turn);
+
+    uint32_t hash_turn = 0;
+    uint64_t hash = 0;
+    if(s_turn % HASH_TURNS == 0 && state_hash(&hash)) {
+        hash_turn = s_turn;
+        s_hashes[(s_turn / HASH_TURNS) % HASH_RING] = (struct hash_entry){s_turn, hash};
+    }
+
+    if(s_turn > INPUT_DELAY && !run_turn(&s_turns[s_turn % TURN_RING]))
+        return;
+    if(!send_turn(s_turn + INPUT_DELAY, hash_turn, hash))
+        return;
+
+    s_turn++;
+    for(int i = 0; i < s_nconns; i++) {
+        if(!conn_flush(&s_conns[i])) {
+            fail("Lost the connection to a peer");
+            return;
+        }
+    }
+}
+
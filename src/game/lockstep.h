@@ -0,0 +1,59 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* True from the moment a match is hosted or joined until it's stopped, 
+ * including while waiting for the other peers to connect */
+bool G_Lockstep_Active(void);
+/* Buffers a command in the replay encoding, to be sent to all the peers 
+ * and issued by all of them on the same turn */
+void G_Lockstep_Submit(int type, const void *payload, size_t size);
+/* Services the connections. Called once per frame, before the ticks are queued. */
+void G_Lockstep_Poll(void);
+/* Returns false if the base tick cannot be run yet because some peer's 
+ * commands for the turn starting at it have not yet arrived */
+bool G_Lockstep_TickReady(unsigned long long tick);
+/* Called by the timer at the start of every base tick, before the lower-rate 
+ * ticks are delivered. Issues the commands of the turn starting at the tick. */
+void G_Lockstep_OnTick(unsigned long long tick);
+
+#endif
+
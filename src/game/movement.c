@@ -37,6 +37,8 @@
 #include "game_private.h"
 #include "combat.h"
 #include "clearpath.h"
+#include "timer_events.h"
+#include "lockstep.h"
 #include "public/game.h"
 #include "../config.h"
 #include "../camera.h"
@@ -47,14 +49,19 @@
 #include "../cursor.h"
 #include "../settings.h"
 #include "../ui.h"
+#include "../sched.h"
+#include "../perf.h"
 #include "../script/public/script.h"
 #include "../render/public/render.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
 #include "../lib/public/vec.h"
+#include "../lib/public/swiss_map.h"
 #include "../anim/public/anim.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <math.h>
 #include <SDL.h>
 
 
@@ -66,10 +73,12 @@
 
 #define SIGNUM(x)    (((x) > 0) - ((x) < 0))
 #define MIN(a, b)    ((a) < (b) ? (a) : (b))
+#define MAX(a, b)    ((a) > (b) ? (a) : (b))
 #define ARR_SIZE(a)  (sizeof(a)/sizeof(a[0]))
 #define STR(a)       #a
 
 #define VEL_HIST_LEN (14)
+#define STATE_VERSION (1)
 
 enum arrival_state{
     /* Entity is moving towards the flock's destination point */
@@ -83,36 +92,219 @@ enum arrival_state{
     STATE_WAITING,
 };
 
-struct movestate{
-    enum arrival_state state;
+/* The movement state of all the dynamic entities, stored as parallel arrays 
+ * indexed by a compact per-entity slot. The slots are kept dense: removing 
+ * an entity moves the state in the last slot into the vacated one. */
+enum move_lod{
+    /* Full steering and collision avoidance every tick */
+    MOVE_LOD_FULL,
+    /* Only following the flow field, at a reduced tick rate */
+    MOVE_LOD_REDUCED,
+    /* Like MOVE_LOD_REDUCED, but the whole flock shares a single 
+     * desired velocity */
+    MOVE_LOD_BLOB,
+};
+
+struct movestate_pool{
+    size_t                size;
+    size_t                capacity;
+    /* The slots of the entities which are not in the 'ARRIVED' state, so that 
+     * the movement tick only visits those */
+    size_t                nactive;
+    int                  *active;
+    struct entity       **ent;
+    enum arrival_state   *state;
     /* The desired velocity returned by the navigation system */
-    vec2_t             vdes;
+    vec2_t               *vdes;
     /* The newly computed velocity (the desired velocity constrained by flocking forces) */
-    vec2_t             vnew;
+    vec2_t               *vnew;
     /* The current velocity */
-    vec2_t             velocity;
+    vec2_t               *velocity;
+    /* The position at the start of the current movement tick */
+    vec2_t               *xz_pos;
     /* Flag to track whether the entiy is currently acting as a 
      * navigation blocker, and the last position where it became a blocker. */
-    bool               blocking;
-    vec2_t             last_stop_pos;
+    bool                 *blocking;
+    vec2_t               *last_stop_pos;
     /* Information for waking up from the 'WAITING' state */
-    enum arrival_state wait_prev;
-    int                wait_ticks_left;
+    enum arrival_state   *wait_prev;
+    int                  *wait_ticks_left;
     /* History of the previous ticks' velocities. Used for velocity smoothing. */
-    vec2_t             vel_hist[VEL_HIST_LEN];
-    int                vel_hist_idx;
+    vec2_t              (*vel_hist)[VEL_HIST_LEN];
+    int                  *vel_hist_idx;
+    /* Whether the entity's position was visible from its' destination at the
+     * start of the current movement tick */
+    bool                 *dest_los;
+    /* The inputs and result of the last ClearPath computation. The result is 
+     * reused for up to 'cp_reuse_left' ticks while the inputs stay the same. */
+    struct cp_signature  *cp_sig;
+    vec2_t               *cp_vnew;
+    int                  *cp_reuse_left;
+    /* The level of detail of the entity's movement simulation, and whether
+     * there were any enemies close to it when last checked */
+    enum move_lod        *lod;
+    bool                 *near_enemy;
+    /* The flock that the entity is a member of, if any */
+    struct flock        **flock;
+    /* The index of the slot in 'active', or -1 */
+    int                  *active_idx;
+    /* The flow field the entity was last following */
+    struct nav_cursor    *nav_cursor;
+};
+
+/* A summary of everything that the ClearPath velocity of an entity depends on. 
+ * The neighbour positions and velocities are only kept as sums relative to the
+ * entity, which stay the same for the units of a flock moving in formation. */
+struct cp_signature{
+    uint32_t nb_hash;
+    int      nb_count;
+    vec2_t   rel_pos_sum;
+    vec2_t   rel_vel_sum;
+    vec2_t   vpref;
+    vec2_t   velocity;
 };
 
-KHASH_MAP_INIT_INT(state, struct movestate)
+#if CONFIG_SWISS_STATE_TABLES
+SWISS_MAP_TYPE(slot, uint32_t, int)
+SWISS_MAP_IMPL(static, slot, uint32_t, int, sm_hash_int, sm_int_equal)
+#else
+KHASH_MAP_INIT_INT(slot, int)
+#endif
+
+/* A coarse grid over the members of a flock, rebuilt every movement tick. 
+ * Each cell keeps the sum of its' members' positions, so that distant parts 
+ * of the flock can be treated as point masses. The member slots are sorted 
+ * by cell. */
+struct flock_cell{
+    vec2_t pos_sum;
+    int    count;
+    int    begin;
+};
+
+struct flock_grid{
+    vec2_t             origin;
+    float              cell_sz;
+    int                nrows, ncols;
+    int                nmembers;
+    size_t             cells_cap;
+    size_t             members_cap;
+    struct flock_cell *cells;
+    int               *members;
+};
 
+/* Flocks are allocated individually, so that pointers to them stay valid 
+ * for as long as they exist */
 struct flock{
+    /* The flock's index in 's_flocks' */
+    int              idx;
     khash_t(entity) *ents;
     vec2_t           target_xz; 
     dest_id_t        dest_id;
+    /* Set while the fields for the flock's path are being generated in the 
+     * background. The flock's members are held in place until then. */
+    path_ticket_t    path;
+    /* Set when none of the flock's members are relevant to the player. The
+     * desired velocity is then only queried once per tick for the flock. */
+    bool             blob;
+    bool             blob_vdes_valid;
+    vec2_t           blob_vdes;
+    struct flock_grid grid;
+    /* Whether the members may be steered by the crowd density field */
+    enum move_crowd_mode crowd;
+};
+
+VEC_TYPE(pflock, struct flock*)
+VEC_IMPL(static inline, pflock, struct flock*)
+
+KHASH_MAP_INIT_INT(dflock, struct flock*)
+
+/* A snapshot of the dynamic entities' state at the start of the movement 
+ * tick, sorted by the cell that they fall into. Each array holds one entry 
+ * per movement state slot. */
+struct neighbour_grid{
+    size_t  capacity;
+    /* Scratch for sorting the slots by cell */
+    struct grid_key{
+        uint64_t cell;
+        uint32_t uid;
+        int      slot;
+    }      *keys;
+    int    *slot;
+    vec2_t *xz_pos;
+    vec2_t *xz_vel;
+    float  *radius;
+    bool   *still;
+};
+
+/* The range of the sorted grid entities falling in a single cell */
+struct cell_range{
+    int begin, end;
+};
+
+KHASH_MAP_INIT_INT64(cell, struct cell_range)
+
+/* A coarse grid over the whole map, with a fixed number of cells per chunk,
+ * into which the density and the velocity of the dynamic entities are 
+ * splatted every movement tick. A cell is reset when it is first written 
+ * to during a tick, so that only the occupied cells are ever touched. */
+struct crowd_cell{
+    uint32_t tick;
+    float    density;
+    vec2_t   vel_sum;
+};
+
+struct crowd_grid{
+    vec2_t             origin;
+    int                nrows, ncols;
+    struct crowd_cell *cells;
 };
 
-VEC_TYPE(flock, struct flock)
-VEC_IMPL(static inline, flock, struct flock)
+/* An entity whose new velocity is computed during the movement tick */
+struct move_work{
+    struct entity *ent;
+    int            slot;
+    struct flock  *flock;
+    /* Steer by the crowd density field instead of by ClearPath */
+    bool           crowd;
+};
+
+VEC_TYPE(work, struct move_work)
+VEC_IMPL(static inline, work, struct move_work)
+
+/* A contiguous slice of the work, along with the scratch buffers of the
+ * thread processing it */
+struct move_job{
+    const struct move_work *items;
+    size_t                  nitems;
+    vec_cp_ent_t            dyn;
+    vec_cp_ent_t            stat;
+    struct cp_scratch       scratch;
+    unsigned                cp_computed;
+    unsigned                cp_skipped;
+    unsigned                crowd_steered;
+};
+
+/* The saved movement state of an entity. Only the state which persists 
+ * across movement ticks is saved - the rest is recomputed on the first tick 
+ * after loading. */
+struct move_rec{
+    uint32_t uid;
+    int32_t  state;
+    int32_t  wait_prev;
+    int32_t  wait_ticks_left;
+    int32_t  vel_hist_idx;
+    int32_t  blocking;
+    vec2_t   velocity;
+    vec2_t   last_stop_pos;
+    vec2_t   vel_hist[VEL_HIST_LEN];
+};
+
+/* A saved flock, followed by the UIDs of its' 'nmembers' members */
+struct flock_rec{
+    vec2_t   target_xz;
+    int32_t  crowd;
+    uint32_t nmembers;
+};
 
 /* Parameters controlling steering/flocking behaviours */
 #define SEPARATION_FORCE_SCALE          (0.6f)
@@ -124,11 +316,34 @@ VEC_IMPL(static inline, flock, struct flock)
 #define ARRIVE_SLOWING_RADIUS           (10.0f)
 #define ADJACENCY_SEP_DIST              (5.0f)
 #define ALIGN_NEIGHBOUR_RADIUS          (10.0f)
+#define FLOCK_GRID_MIN_CELL_SZ          (ALIGN_NEIGHBOUR_RADIUS)
+#define FLOCK_GRID_MAX_RES              (8)
 #define SEPARATION_NEIGHB_RADIUS        (30.0f)
 
+/* Tolerances for reusing the last tick's ClearPath velocity */
+#define COHERENCE_MAX_TICKS             (5)
+#define COHERENCE_POS_TOLERANCE         (0.05f)
+#define COHERENCE_VEL_TOLERANCE         (0.005f)
+
+/* Parameters of the movement level of detail policy */
+#define LOD_REDUCED_PERIOD              (4)
+#define LOD_ENEMY_CHECK_PERIOD          (10)
+#define LOD_VIEW_MARGIN                 (50.0f)
+#define LOD_ENEMY_RADIUS                (75.0f)
+#define LOD_TARGET_RADIUS               (2.0f * ARRIVE_SLOWING_RADIUS)
+
 #define COLLISION_MAX_SEE_AHEAD         (10.0f)
+#define NEIGHBOUR_GRID_CELL_SZ          (CLEARPATH_NEIGHBOUR_RADIUS)
 #define WAIT_TICKS                      (60)
 
+#define CROWD_CELLS_PER_CHUNK           (16)
+#define CROWD_CELL_SZ                   ((float)(TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE) / CROWD_CELLS_PER_CHUNK)
+#define CROWD_MIN_FLOCK_SIZE            (16)
+#define CROWD_DENSITY_MIN               (1.0f)
+#define CROWD_DENSITY_MAX               (4.0f)
+#define CROWD_DISCOMFORT_WEIGHT         (0.5f)
+#define CROWD_MIN_SPEED_FRAC            (0.1f)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -138,13 +353,56 @@ static bool                    s_attack_on_lclick = false;
 static bool                    s_move_on_lclick = false;
 
 static vec_pentity_t           s_move_markers;
-static vec_flock_t             s_flocks;
-static khash_t(state)         *s_entity_state_table;
+static vec_pflock_t            s_flocks;
+/* key: (dest_id) - the flock moving towards that destination. There is at 
+ * most one, as flocks with the same destination get merged. */
+static khash_t(dflock)        *s_dest_flocks;
+static struct movestate_pool   s_ms;
+/* key: (entity UID) - movement state slot */
+#if CONFIG_SWISS_STATE_TABLES
+static sm(slot)                s_slot_table;
+#else
+static khash_t(slot)          *s_slot_table;
+#endif
+
+/* A uniform grid of the dynamic entities, rebuilt every movement tick. The
+ * entities are kept sorted by cell, so that neighbour queries are contiguous
+ * scans over a few cells instead of quadtree traversals. Together with the
+ * positions saved in the movement state, the grid is a read-only snapshot 
+ * that is safe to query from the worker threads. */
+static struct neighbour_grid   s_grid;
+static khash_t(cell)          *s_grid_cells;
+
+/* The density field used for steering the entities of large engagements. 
+ * It is allocated on first use and follows the same snapshot rules as the 
+ * neighbour grid. */
+static struct crowd_grid       s_crowd;
+/* The view frustum of the current movement tick */
+static struct frustum          s_tick_view;
+
+static vec_work_t              s_move_work;
+static struct move_job         s_move_jobs[CONFIG_SCHED_MAX_WORKERS + 1];
+
+static struct move_stats       s_move_stats;
+static uint32_t                s_move_tick = 0;
 
 /* Store the most recently issued move command location for debug rendering */
 static bool                    s_last_cmd_dest_valid = false;
 static dest_id_t               s_last_cmd_dest;
 
+/* Handles to the debug settings polled on every frame */
+static struct{
+    const struct sval *last_cmd_flow_field;
+    const struct sval *first_sel_movestate;
+    const struct sval *enemy_seek_fields;
+    const struct sval *enemy_seek_faction;
+    const struct sval *nav_blockers;
+    const struct sval *nav_portals;
+    const struct sval *field_churn;
+    const struct sval *nav_cost_base;
+    const struct sval *chunk_boundaries;
+}s_debug_setts;
+
 static const char *s_state_str[] = {
     [STATE_MOVING]       = STR(STATE_MOVING),
     [STATE_ARRIVED]      = STR(STATE_ARRIVED),
@@ -156,22 +414,248 @@ static const char *s_state_str[] = {
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* The returned pointer is guaranteed to be valid to write to for
- * so long as we don't add anything to the table. At that point, there
- * is a case that a 'realloc' might take place. */
-static struct movestate *movestate_get(const struct entity *ent)
+/* The returned slot remains valid for so long as no entity is removed. 
+ * At that point, the state in the last slot might be moved. */
+static int movestate_slot(const struct entity *ent)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    if(k == kh_end(s_entity_state_table))
-        return NULL;
-    return &kh_value(s_entity_state_table, k);
+#if CONFIG_SWISS_STATE_TABLES
+    int *slot = sm_slot_get(&s_slot_table, ent->uid);
+    return slot ? *slot : -1;
+#else
+    khiter_t k = kh_get(slot, s_slot_table, ent->uid);
+    if(k == kh_end(s_slot_table))
+        return -1;
+    return kh_value(s_slot_table, k);
+#endif
+}
+
+static bool slot_table_set(uint32_t uid, int slot)
+{
+#if CONFIG_SWISS_STATE_TABLES
+    return sm_slot_put(&s_slot_table, uid, slot);
+#else
+    int ret;
+    khiter_t k = kh_put(slot, s_slot_table, uid, &ret);
+    if(ret == -1)
+        return false;
+    kh_value(s_slot_table, k) = slot;
+    return true;
+#endif
+}
+
+static void slot_table_remove(uint32_t uid)
+{
+#if CONFIG_SWISS_STATE_TABLES
+    bool ret = sm_slot_del(&s_slot_table, uid);
+    assert(ret);
+    (void)ret;
+#else
+    khiter_t k = kh_get(slot, s_slot_table, uid);
+    assert(k != kh_end(s_slot_table));
+    kh_del(slot, s_slot_table, k);
+#endif
+}
+
+#define REALLOC_ARRAY(ptr, n) \
+    ((tmp = realloc((ptr), sizeof(*(ptr)) * (n))) ? ((ptr) = tmp, true) : false)
+
+static bool movestate_pool_reserve(size_t capacity)
+{
+    if(capacity <= s_ms.capacity)
+        return true;
+
+    void *tmp;
+    size_t newcap = MAX(capacity, s_ms.capacity * 2);
+
+    if(!REALLOC_ARRAY(s_ms.ent,             newcap)
+    || !REALLOC_ARRAY(s_ms.state,           newcap)
+    || !REALLOC_ARRAY(s_ms.vdes,            newcap)
+    || !REALLOC_ARRAY(s_ms.vnew,            newcap)
+    || !REALLOC_ARRAY(s_ms.velocity,        newcap)
+    || !REALLOC_ARRAY(s_ms.xz_pos,          newcap)
+    || !REALLOC_ARRAY(s_ms.blocking,        newcap)
+    || !REALLOC_ARRAY(s_ms.last_stop_pos,   newcap)
+    || !REALLOC_ARRAY(s_ms.wait_prev,       newcap)
+    || !REALLOC_ARRAY(s_ms.wait_ticks_left, newcap)
+    || !REALLOC_ARRAY(s_ms.vel_hist,        newcap)
+    || !REALLOC_ARRAY(s_ms.vel_hist_idx,    newcap)
+    || !REALLOC_ARRAY(s_ms.dest_los,        newcap)
+    || !REALLOC_ARRAY(s_ms.cp_sig,          newcap)
+    || !REALLOC_ARRAY(s_ms.cp_vnew,         newcap)
+    || !REALLOC_ARRAY(s_ms.cp_reuse_left,   newcap)
+    || !REALLOC_ARRAY(s_ms.lod,             newcap)
+    || !REALLOC_ARRAY(s_ms.near_enemy,      newcap)
+    || !REALLOC_ARRAY(s_ms.flock,           newcap)
+    || !REALLOC_ARRAY(s_ms.active,          newcap)
+    || !REALLOC_ARRAY(s_ms.active_idx,      newcap)
+    || !REALLOC_ARRAY(s_ms.nav_cursor,      newcap))
+        return false;
+    s_ms.capacity = newcap;
+
+    if(!REALLOC_ARRAY(s_grid.keys,   newcap)
+    || !REALLOC_ARRAY(s_grid.slot,   newcap)
+    || !REALLOC_ARRAY(s_grid.xz_pos, newcap)
+    || !REALLOC_ARRAY(s_grid.xz_vel, newcap)
+    || !REALLOC_ARRAY(s_grid.radius, newcap)
+    || !REALLOC_ARRAY(s_grid.still,  newcap))
+        return false;
+    s_grid.capacity = newcap;
+
+    return true;
+}
+
+#undef REALLOC_ARRAY
+
+static void movestate_pool_destroy(void)
+{
+    free(s_ms.ent);
+    free(s_ms.state);
+    free(s_ms.vdes);
+    free(s_ms.vnew);
+    free(s_ms.velocity);
+    free(s_ms.xz_pos);
+    free(s_ms.blocking);
+    free(s_ms.last_stop_pos);
+    free(s_ms.wait_prev);
+    free(s_ms.wait_ticks_left);
+    free(s_ms.vel_hist);
+    free(s_ms.vel_hist_idx);
+    free(s_ms.dest_los);
+    free(s_ms.cp_sig);
+    free(s_ms.cp_vnew);
+    free(s_ms.cp_reuse_left);
+    free(s_ms.lod);
+    free(s_ms.near_enemy);
+    free(s_ms.flock);
+    free(s_ms.active);
+    free(s_ms.active_idx);
+    free(s_ms.nav_cursor);
+    memset(&s_ms, 0, sizeof(s_ms));
+
+    free(s_grid.keys);
+    free(s_grid.slot);
+    free(s_grid.xz_pos);
+    free(s_grid.xz_vel);
+    free(s_grid.radius);
+    free(s_grid.still);
+    memset(&s_grid, 0, sizeof(s_grid));
+}
+
+static int movestate_add(const struct entity *ent)
+{
+    if(!movestate_pool_reserve(s_ms.size + 1))
+        return -1;
+
+    assert(movestate_slot(ent) < 0);
+    int slot = s_ms.size;
+    if(!slot_table_set(ent->uid, slot))
+        return -1;
+    s_ms.size++;
+
+    s_ms.ent[slot] = (struct entity*)ent;
+    s_ms.state[slot] = STATE_ARRIVED;
+    s_ms.vdes[slot] = (vec2_t){0.0f};
+    s_ms.vnew[slot] = (vec2_t){0.0f};
+    s_ms.velocity[slot] = (vec2_t){0.0f};
+    s_ms.xz_pos[slot] = G_Pos_GetXZ(ent->uid);
+    s_ms.blocking[slot] = false;
+    s_ms.last_stop_pos[slot] = G_Pos_GetXZ(ent->uid);
+    s_ms.wait_prev[slot] = STATE_ARRIVED;
+    s_ms.wait_ticks_left[slot] = 0;
+    memset(s_ms.vel_hist[slot], 0, sizeof(s_ms.vel_hist[slot]));
+    s_ms.vel_hist_idx[slot] = 0;
+    s_ms.dest_los[slot] = false;
+    memset(&s_ms.cp_sig[slot], 0, sizeof(s_ms.cp_sig[slot]));
+    s_ms.cp_vnew[slot] = (vec2_t){0.0f};
+    s_ms.cp_reuse_left[slot] = 0;
+    s_ms.lod[slot] = MOVE_LOD_FULL;
+    s_ms.near_enemy[slot] = true;
+    s_ms.flock[slot] = NULL;
+    s_ms.active_idx[slot] = -1;
+    memset(&s_ms.nav_cursor[slot], 0, sizeof(s_ms.nav_cursor[slot]));
+
+    return slot;
+}
+
+static void movestate_set_state(int slot, enum arrival_state state)
+{
+    s_ms.state[slot] = state;
+    bool active = (state != STATE_ARRIVED);
+
+    if(active && s_ms.active_idx[slot] < 0) {
+
+        s_ms.active_idx[slot] = s_ms.nactive;
+        s_ms.active[s_ms.nactive++] = slot;
+
+    }else if(!active && s_ms.active_idx[slot] >= 0) {
+
+        int idx = s_ms.active_idx[slot];
+        int last = s_ms.active[--s_ms.nactive];
+        s_ms.active[idx] = last;
+        s_ms.active_idx[last] = idx;
+        s_ms.active_idx[slot] = -1;
+
+        /* Idle entities are no longer visited by 'update_lods', so give them 
+         * the level of detail that it would */
+        if(s_ms.lod[slot] != MOVE_LOD_FULL) {
+            s_ms.cp_reuse_left[slot] = 0;
+            s_ms.near_enemy[slot] = true;
+            s_ms.lod[slot] = MOVE_LOD_FULL;
+        }
+    }
 }
 
-static void flock_try_remove(struct flock *flock, const struct entity *ent)
+static void movestate_remove(int slot)
 {
-    khiter_t k;
-    if((k = kh_get(entity, flock->ents, ent->uid)) != kh_end(flock->ents))
-        kh_del(entity, flock->ents, k);
+    assert(slot >= 0 && slot < s_ms.size);
+
+    movestate_set_state(slot, STATE_ARRIVED);
+    slot_table_remove(s_ms.ent[slot]->uid);
+
+    int last = --s_ms.size;
+    if(slot == last)
+        return;
+
+    s_ms.ent[slot] = s_ms.ent[last];
+    s_ms.state[slot] = s_ms.state[last];
+    s_ms.vdes[slot] = s_ms.vdes[last];
+    s_ms.vnew[slot] = s_ms.vnew[last];
+    s_ms.velocity[slot] = s_ms.velocity[last];
+    s_ms.xz_pos[slot] = s_ms.xz_pos[last];
+    s_ms.blocking[slot] = s_ms.blocking[last];
+    s_ms.last_stop_pos[slot] = s_ms.last_stop_pos[last];
+    s_ms.wait_prev[slot] = s_ms.wait_prev[last];
+    s_ms.wait_ticks_left[slot] = s_ms.wait_ticks_left[last];
+    memcpy(s_ms.vel_hist[slot], s_ms.vel_hist[last], sizeof(s_ms.vel_hist[slot]));
+    s_ms.vel_hist_idx[slot] = s_ms.vel_hist_idx[last];
+    s_ms.dest_los[slot] = s_ms.dest_los[last];
+    s_ms.cp_sig[slot] = s_ms.cp_sig[last];
+    s_ms.cp_vnew[slot] = s_ms.cp_vnew[last];
+    s_ms.cp_reuse_left[slot] = s_ms.cp_reuse_left[last];
+    s_ms.lod[slot] = s_ms.lod[last];
+    s_ms.near_enemy[slot] = s_ms.near_enemy[last];
+    s_ms.flock[slot] = s_ms.flock[last];
+    s_ms.active_idx[slot] = s_ms.active_idx[last];
+    s_ms.nav_cursor[slot] = s_ms.nav_cursor[last];
+    if(s_ms.active_idx[slot] >= 0) {
+        s_ms.active[s_ms.active_idx[slot]] = slot;
+    }
+
+    /* Overwriting an existing key never allocates */
+    bool ret = slot_table_set(s_ms.ent[slot]->uid, slot);
+    assert(ret);
+    (void)ret;
+}
+
+static void flock_remove(struct flock *flock, const struct entity *ent)
+{
+    khiter_t k = kh_get(entity, flock->ents, ent->uid);
+    assert(k != kh_end(flock->ents));
+    kh_del(entity, flock->ents, k);
+
+    int slot = movestate_slot(ent);
+    assert(slot >= 0 && s_ms.flock[slot] == flock);
+    s_ms.flock[slot] = NULL;
 }
 
 static void flock_add(struct flock *flock, const struct entity *ent)
@@ -180,56 +664,150 @@ static void flock_add(struct flock *flock, const struct entity *ent)
     khiter_t k = kh_put(entity, flock->ents, ent->uid, &ret);
     assert(ret != -1 && ret != 0);
     kh_value(flock->ents, k) = (struct entity*)ent;
+
+    int slot = movestate_slot(ent);
+    assert(slot >= 0 && !s_ms.flock[slot]);
+    s_ms.flock[slot] = flock;
 }
 
-static bool flock_contains(const struct flock *flock, const struct entity *ent)
+static struct flock *flock_new(vec2_t target_xz, dest_id_t dest_id)
 {
-    khiter_t k = kh_get(entity, flock->ents, ent->uid);
-    if(k != kh_end(flock->ents))
-        return true;
-    return false;
+    struct flock *ret = malloc(sizeof(struct flock));
+    if(!ret)
+        return NULL;
+
+    *ret = (struct flock) {
+        .idx = -1,
+        .ents = kh_init(entity),
+        .target_xz = target_xz,
+        .dest_id = dest_id,
+        .path = PATH_TICKET_INVALID,
+        .crowd = MOVE_CROWD_AUTO,
+    };
+
+    if(!ret->ents) {
+        free(ret);
+        return NULL;
+    }
+    return ret;
 }
 
-static struct flock *flock_for_ent(const struct entity *ent)
+static void flock_free(struct flock *flock)
 {
-    for(int i = 0; i < vec_size(&s_flocks); i++) {
+    if(flock->path != PATH_TICKET_INVALID)
+        M_NavPathRelease(flock->path);
+    kh_destroy(entity, flock->ents);
+    free(flock->grid.cells);
+    free(flock->grid.members);
+    free(flock);
+}
+
+static bool flock_register(struct flock *flock)
+{
+    int ret;
+    khiter_t k = kh_put(dflock, s_dest_flocks, flock->dest_id, &ret);
+    if(ret == -1)
+        return false;
+    assert(ret != 0);
 
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);            
-        if(flock_contains(curr_flock, ent))
-            return curr_flock;
+    if(!vec_pflock_push(&s_flocks, flock)) {
+        kh_del(dflock, s_dest_flocks, k);
+        return false;
     }
-    return NULL;
+
+    kh_value(s_dest_flocks, k) = flock;
+    flock->idx = vec_size(&s_flocks) - 1;
+    return true;
 }
 
-static struct flock *flock_for_dest(dest_id_t id)
+/* Removes the flock in constant time, apart from releasing its' members */
+static void flock_disband(struct flock *flock)
 {
-    for(int i = 0; i < vec_size(&s_flocks); i++) {
+    assert(flock->idx >= 0 && vec_AT(&s_flocks, flock->idx) == flock);
+
+    khiter_t k = kh_get(dflock, s_dest_flocks, flock->dest_id);
+    assert(k != kh_end(s_dest_flocks) && kh_value(s_dest_flocks, k) == flock);
+    kh_del(dflock, s_dest_flocks, k);
+
+    struct flock *last = vec_AT(&s_flocks, vec_size(&s_flocks) - 1);
+    vec_AT(&s_flocks, flock->idx) = last;
+    last->idx = flock->idx;
+    vec_pflock_pop(&s_flocks);
+
+    uint32_t key;
+    struct entity *curr;
+    (void)key;
+
+    kh_foreach(flock->ents, key, curr, {
+        int slot = movestate_slot(curr);
+        assert(slot >= 0 && s_ms.flock[slot] == flock);
+        s_ms.flock[slot] = NULL;
+    });
+    flock_free(flock);
+}
+
+static bool flock_path_pending(const struct flock *flock)
+{
+    return (flock->path != PATH_TICKET_INVALID);
+}
+
+/* A replay must play out the same way every time it is played back, and 
+ * the peers of a lockstep match must stay in sync. So the simulation may not
+ * depend on the camera or on how long the worker threads or the GPU take: 
+ * every entity is fully simulated and the paths are found synchronously, 
+ * on the CPU. */
+static bool sim_deterministic(void)
+{
+    return G_Replay_IsPlaying() || G_Lockstep_Active();
+}
 
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);            
-        if(curr_flock->dest_id == id)
-            return curr_flock;
+/* Returns the ticket of the asynchronous request, or PATH_TICKET_INVALID if 
+ * the path is not pending. The fields that are missing are then generated 
+ * on-demand. */
+static path_ticket_t flock_request_path(const vec2_t *srcs, size_t nsrcs, vec2_t target_xz)
+{
+    if(sim_deterministic()) {
+        dest_id_t dest_id;
+        M_NavRequestPath(s_map, srcs[0], target_xz, &dest_id);
+        return PATH_TICKET_INVALID;
     }
-    return NULL;
+    return M_NavRequestGroupPathAsync(s_map, srcs, nsrcs, target_xz);
+}
+
+static struct flock *flock_for_ent(const struct entity *ent)
+{
+    int slot = movestate_slot(ent);
+    if(slot < 0)
+        return NULL;
+    return s_ms.flock[slot];
+}
+
+static struct flock *flock_for_dest(dest_id_t id)
+{
+    khiter_t k = kh_get(dflock, s_dest_flocks, id);
+    if(k == kh_end(s_dest_flocks))
+        return NULL;
+    return kh_value(s_dest_flocks, k);
 }
 
 static void entity_block(const struct entity *ent)
 {
-    M_NavBlockersIncref(G_Pos_GetXZ(ent->uid), ent->selection_radius, s_map);
+    M_NavBlockersBatchIncref(G_Pos_GetXZ(ent->uid), ent->selection_radius, s_map);
 
-    struct movestate *ms = movestate_get(ent);
-    assert(!ms->blocking);
+    int slot = movestate_slot(ent);
+    assert(slot >= 0 && !s_ms.blocking[slot]);
 
-    ms->blocking = true;
-    ms->last_stop_pos = G_Pos_GetXZ(ent->uid);
+    s_ms.blocking[slot] = true;
+    s_ms.last_stop_pos[slot] = G_Pos_GetXZ(ent->uid);
 }
 
 static void entity_unblock(const struct entity *ent)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms->blocking);
+    int slot = movestate_slot(ent);
+    assert(slot >= 0 && s_ms.blocking[slot]);
 
-    M_NavBlockersDecref(ms->last_stop_pos, ent->selection_radius, s_map);
-    ms->blocking = false;
+    M_NavBlockersBatchDecref(s_ms.last_stop_pos[slot], ent->selection_radius, s_map);
+    s_ms.blocking[slot] = false;
 }
 
 static bool stationary(const struct entity *ent)
@@ -251,9 +829,9 @@ static void vec2_truncate(vec2_t *inout, float max_len)
     }
 }
 
-static bool ent_still(const struct movestate *ms)
+static bool ent_still(int slot)
 {
-    return (ms->state == STATE_ARRIVED || ms->state == STATE_WAITING);
+    return (s_ms.state[slot] == STATE_ARRIVED || s_ms.state[slot] == STATE_WAITING);
 }
 
 static void entity_finish_moving(const struct entity *ent, enum arrival_state newstate)
@@ -262,20 +840,20 @@ static void entity_finish_moving(const struct entity *ent, enum arrival_state ne
     if(ent->flags & ENTITY_FLAG_COMBATABLE)
         G_Combat_SetStance(ent, COMBAT_STANCE_AGGRESSIVE);
 
-    struct movestate *ms = movestate_get(ent);
-    assert(!ent_still(ms));
+    int slot = movestate_slot(ent);
+    assert(slot >= 0 && !ent_still(slot));
 
     if(newstate == STATE_WAITING) {
-        ms->wait_prev = ms->state;
-        ms->wait_ticks_left = WAIT_TICKS;
+        s_ms.wait_prev[slot] = s_ms.state[slot];
+        s_ms.wait_ticks_left[slot] = WAIT_TICKS;
     }
 
-    ms->state = newstate;
-    ms->velocity = (vec2_t){0.0f, 0.0f};
-    ms->vnew = (vec2_t){0.0f, 0.0f};
+    movestate_set_state(slot, newstate);
+    s_ms.velocity[slot] = (vec2_t){0.0f, 0.0f};
+    s_ms.vnew[slot] = (vec2_t){0.0f, 0.0f};
 
     entity_block(ent);
-    assert(ent_still(ms));
+    assert(ent_still(slot));
 }
 
 static void on_marker_anim_finish(void *user, void *event)
@@ -307,19 +885,13 @@ static bool same_chunk_as_any_in_set(struct tile_desc desc, const struct tile_de
 
 static void remove_from_flocks(const struct entity *ent)
 {
-    /* Remove any flocks which may have become empty. Iterate vector in backwards order 
-     * so that we can delete while iterating, since the last element in the vector takes
-     * the place of the deleted one. 
-     */
-    for(int i = vec_size(&s_flocks)-1; i >= 0; i--) {
-
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);
-        flock_try_remove(curr_flock, ent);
+    struct flock *flock = flock_for_ent(ent);
+    if(!flock)
+        return;
 
-        if(kh_size(curr_flock->ents) == 0) {
-            kh_destroy(entity, curr_flock->ents);
-            vec_flock_del(&s_flocks, i);
-        }
+    flock_remove(flock, ent);
+    if(kh_size(flock->ents) == 0) {
+        flock_disband(flock);
     }
     assert(NULL == flock_for_ent(ent));
 }
@@ -345,12 +917,8 @@ static bool make_flock_from_selection(const vec_pentity_t *sel, vec2_t target_xz
         remove_from_flocks(curr_ent);
     }
 
-    struct flock new_flock = (struct flock) {
-        .ents = kh_init(entity),
-        .target_xz = target_xz,
-    };
-
-    if(!new_flock.ents)
+    struct flock *new_flock = flock_new(target_xz, M_NavDestIDForPos(s_map, target_xz));
+    if(!new_flock)
         return false;
 
     for(int i = 0; i < vec_size(sel); i++) {
@@ -359,47 +927,64 @@ static bool make_flock_from_selection(const vec_pentity_t *sel, vec2_t target_xz
         if(stationary(curr_ent))
             continue;
 
-        struct movestate *ms = movestate_get(curr_ent);
-        assert(ms);
+        int slot = movestate_slot(curr_ent);
+        assert(slot >= 0);
 
-        if(ent_still(ms)) {
+        if(ent_still(slot)) {
             entity_unblock(curr_ent); 
             E_Entity_Notify(EVENT_MOTION_START, curr_ent->uid, NULL, ES_ENGINE);
         }
 
-        flock_add(&new_flock, curr_ent);
-        ms->state = STATE_MOVING;
+        flock_add(new_flock, curr_ent);
+        movestate_set_state(slot, STATE_MOVING);
     }
 
-    /* The flow fields will be computed on-demand during the next movement update tick */
-    new_flock.target_xz = target_xz;
-    new_flock.dest_id = M_NavDestIDForPos(s_map, target_xz);
-
-    if(kh_size(new_flock.ents) > 0) {
-
-        /* If there is another flock with the same dest_id, then we merge the two flocks. */
-        struct flock *merge_flock = flock_for_dest(new_flock.dest_id);
-        if(merge_flock) {
+    if(kh_size(new_flock->ents) == 0) {
+        flock_free(new_flock);
+        return false;
+    }
 
-            uint32_t key;
-            struct entity *curr;
-            (void)key;
+    uint32_t key;
+    struct entity *curr;
+    (void)key;
 
-            kh_foreach(new_flock.ents, key, curr, { flock_add(merge_flock, curr); });
-            kh_destroy(entity, new_flock.ents);
-        
-        }else{
-            vec_flock_push(&s_flocks, new_flock);
-        }
+    /* If there is another flock with the same dest_id, then we merge the two flocks. */
+    struct flock *merge_flock = flock_for_dest(new_flock->dest_id);
+    if(merge_flock) {
 
-        s_last_cmd_dest_valid = true;
-        s_last_cmd_dest = new_flock.dest_id;
+        kh_foreach(new_flock->ents, key, curr, { 
+            flock_remove(new_flock, curr);
+            flock_add(merge_flock, curr); 
+        });
+        flock_free(new_flock);
 
-        return true;
     }else{
-        kh_destroy(entity, new_flock.ents);
-        return false;
+
+        /* The flow fields are generated in the background, without stalling the 
+         * current tick. Should the request fail, or the fields get evicted, they
+         * will be computed on-demand during the movement update tick instead. */
+        vec2_t srcs[kh_size(new_flock->ents) + 1];
+        size_t nsrcs = 0;
+        srcs[nsrcs++] = first_ent_pos_xz;
+
+        /* Plan the fields for the whole group at once */
+        kh_foreach(new_flock->ents, key, curr, { srcs[nsrcs++] = G_Pos_GetXZ(curr->uid); });
+        new_flock->path = flock_request_path(srcs, nsrcs, target_xz);
+
+        if(!flock_register(new_flock)) {
+
+            kh_foreach(new_flock->ents, key, curr, { 
+                int slot = movestate_slot(curr);
+                s_ms.flock[slot] = NULL;
+            });
+            flock_free(new_flock);
+            return false;
+        }
     }
+
+    s_last_cmd_dest_valid = true;
+    s_last_cmd_dest = M_NavDestIDForPos(s_map, target_xz);
+    return true;
 }
 
 size_t adjacent_flock_members(const struct entity *ent, const struct flock *flock, 
@@ -442,6 +1027,7 @@ static void move_marker_add(vec3_t pos, bool attack)
     G_AddEntity(ent, pos);
 
     ent->scale = (vec3_t){2.0f, 2.0f, 2.0f};
+    Entity_InvalidateModel(ent);
     E_Entity_Register(EVENT_ANIM_FINISHED, ent->uid, on_marker_anim_finish, ent, G_RUNNING);
 
     A_InitCtx(ent, "Converge", 48);
@@ -480,53 +1066,54 @@ static void on_mousedown(void *user, void *event)
     enum selection_type sel_type;
     const vec_pentity_t *sel = G_Sel_Get(&sel_type);
     if(vec_size(sel) > 0 && sel_type == SELECTION_TYPE_PLAYER) {
+        G_Replay_CmdOrder(sel, mouse_coord, attack);
+    }
+}
 
-        for(int i = 0; i < vec_size(sel); i++) {
-
-            const struct entity *curr = vec_AT(sel, i);
-            if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
-                continue;
-
-            if(curr->flags & ENTITY_FLAG_COMBATABLE) {
-                G_Combat_ClearSavedMoveCmd(curr);
-                G_Combat_SetStance(curr, attack ? COMBAT_STANCE_AGGRESSIVE : COMBAT_STANCE_NO_ENGAGEMENT);
-            }
-        }
+static bool init_debug_settings(void)
+{
+    const struct{
+        const char         *name;
+        const struct sval **out;
+    }handles[] = {
+        {"pf.debug.show_last_cmd_flow_field",       &s_debug_setts.last_cmd_flow_field  },
+        {"pf.debug.show_first_sel_movestate",       &s_debug_setts.first_sel_movestate  },
+        {"pf.debug.show_enemy_seek_fields",         &s_debug_setts.enemy_seek_fields    },
+        {"pf.debug.enemy_seek_fields_faction_id",   &s_debug_setts.enemy_seek_faction   },
+        {"pf.debug.show_navigation_blockers",       &s_debug_setts.nav_blockers         },
+        {"pf.debug.show_navigation_portals",        &s_debug_setts.nav_portals          },
+        {"pf.debug.show_field_churn",               &s_debug_setts.field_churn          },
+        {"pf.debug.show_navigation_cost_base",      &s_debug_setts.nav_cost_base        },
+        {"pf.debug.show_chunk_boundaries",          &s_debug_setts.chunk_boundaries     },
+    };
 
-        move_marker_add(mouse_coord, attack);
-        make_flock_from_selection(sel, (vec2_t){mouse_coord.x, mouse_coord.z}, attack);
+    for(int i = 0; i < ARR_SIZE(handles); i++) {
+        *handles[i].out = Settings_Handle(handles[i].name);
+        if(!*handles[i].out)
+            return false;
     }
+    return true;
 }
 
 static void on_render_3d(void *user, void *event)
 {
     const struct camera *cam = G_GetActiveCamera();
 
-    struct sval setting;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.show_last_cmd_flow_field", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool && s_last_cmd_dest_valid)
+    if(s_debug_setts.last_cmd_flow_field->as_bool && s_last_cmd_dest_valid)
         M_NavRenderVisiblePathFlowField(s_map, cam, s_last_cmd_dest);
 
-    status = Settings_Get("pf.debug.show_first_sel_movestate", &setting);
-    assert(status == SS_OKAY);
-
     enum selection_type seltype;
     const vec_pentity_t *sel = G_Sel_Get(&seltype);
 
-    if(setting.as_bool && vec_size(sel) > 0) {
+    if(s_debug_setts.first_sel_movestate->as_bool && vec_size(sel) > 0) {
     
         const struct entity *ent = vec_AT(sel, 0);
-        struct movestate *ms = movestate_get(ent);
-        if(ms) {
+        int slot = movestate_slot(ent);
+        if(slot >= 0) {
 
             char strbuff[256];
             snprintf(strbuff, ARR_SIZE(strbuff), "Arrival State: %s Velocity: (%f, %f)", 
-                s_state_str[ms->state], ms->velocity.x, ms->velocity.z);
+                s_state_str[s_ms.state[slot]], s_ms.velocity[slot].x, s_ms.velocity[slot].z);
             strbuff[ARR_SIZE(strbuff)-1] = '\0';
             struct rgba text_color = (struct rgba){255, 0, 0, 255};
             UI_DrawText(strbuff, (struct rect){5,5,450,50}, text_color);
@@ -534,7 +1121,7 @@ static void on_render_3d(void *user, void *event)
             const struct camera *cam = G_GetActiveCamera();
             struct flock *flock = flock_for_ent(ent);
 
-            switch(ms->state) {
+            switch(s_ms.state[slot]) {
             case STATE_MOVING:
                 assert(flock);
                 M_NavRenderVisiblePathFlowField(s_map, cam, flock->dest_id);
@@ -550,39 +1137,22 @@ static void on_render_3d(void *user, void *event)
         }
     }
 
-    status = Settings_Get("pf.debug.show_enemy_seek_fields", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool) {
-
-        status = Settings_Get("pf.debug.enemy_seek_fields_faction_id", &setting);
-        assert(status == SS_OKAY);
-    
-        M_NavRenderVisibleEnemySeekField(s_map, cam, setting.as_int);
-    }
-
-    status = Settings_Get("pf.debug.show_navigation_blockers", &setting);
-    assert(status == SS_OKAY);
+    if(s_debug_setts.enemy_seek_fields->as_bool)
+        M_NavRenderVisibleEnemySeekField(s_map, cam, s_debug_setts.enemy_seek_faction->as_int);
 
-    if(setting.as_bool)
+    if(s_debug_setts.nav_blockers->as_bool)
         M_NavRenderNavigationBlockers(s_map, cam);
 
-    status = Settings_Get("pf.debug.show_navigation_portals", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool)
+    if(s_debug_setts.nav_portals->as_bool)
         M_NavRenderNavigationPortals(s_map, cam);
 
-    status = Settings_Get("pf.debug.show_navigation_cost_base", &setting);
-    assert(status == SS_OKAY);
+    if(s_debug_setts.field_churn->as_bool)
+        M_NavRenderFieldChurn(s_map, cam);
 
-    if(setting.as_bool)
+    if(s_debug_setts.nav_cost_base->as_bool)
         M_RenderVisiblePathableLayer(s_map, cam);
 
-    status = Settings_Get("pf.debug.show_chunk_boundaries", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool)
+    if(s_debug_setts.chunk_boundaries->as_bool)
         M_RenderChunkBoundaries(s_map, cam);
 }
 
@@ -599,154 +1169,537 @@ static quat_t dir_quat_from_velocity(vec2_t velocity)
     };
 }
 
-static vec2_t ent_desired_velocity(const struct entity *ent)
+static int grid_coord(float val)
 {
-    struct movestate *ms = movestate_get(ent);
-    vec2_t pos_xz = G_Pos_GetXZ(ent->uid);
-    struct flock *fl = flock_for_ent(ent);
-
-    switch(ms->state) {
-    case STATE_SEEK_ENEMIES: 
-        return M_NavDesiredEnemySeekVelocity(s_map, pos_xz, ent->faction_id);
-    default:
-        assert(fl);
-        return M_NavDesiredPointSeekVelocity(s_map, fl->dest_id, pos_xz, fl->target_xz);
-    }
+    return (int)floorf(val / NEIGHBOUR_GRID_CELL_SZ);
 }
 
-/* Seek behaviour makes the entity target and approach a particular destination point.
- */
-static vec2_t seek_force(const struct entity *ent, vec2_t target_xz)
+static uint64_t grid_cell_key(int x, int z)
 {
-    vec2_t ret, desired_velocity;
-    vec2_t pos_xz = G_Pos_GetXZ(ent->uid);
-
-    PFM_Vec2_Sub(&target_xz, &pos_xz, &desired_velocity);
-    PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
-    PFM_Vec2_Scale(&desired_velocity, ent->max_speed / MOVE_TICK_RES, &desired_velocity);
-
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
+    return (((uint64_t)(uint32_t)z) << 32) | ((uint64_t)(uint32_t)x);
+}
 
-    PFM_Vec2_Sub(&desired_velocity, &ms->velocity, &ret);
-    return ret;
+static int compare_grid_keys(const void *a, const void *b)
+{
+    const struct grid_key *ga = a, *gb = b;
+    if(ga->cell != gb->cell)
+        return (ga->cell < gb->cell) ? -1 : 1;
+    return (ga->uid < gb->uid) ? -1 : (ga->uid > gb->uid);
 }
 
-/* Arrival behaviour is like 'seek' but the entity decelerates and comes to a halt when it is 
- * within a threshold radius of the destination point.
- * 
- * When not within line of sight of the destination, this will steer the entity along the 
- * flow field.
- */
-static vec2_t arrive_force(const struct entity *ent, dest_id_t dest_id, vec2_t target_xz)
+static void build_neighbour_grid(void)
 {
-    assert(0 == (ent->flags & ENTITY_FLAG_STATIC));
-    vec2_t ret, desired_velocity;
-    vec2_t pos_xz = G_Pos_GetXZ(ent->uid);
-    float distance;
+    kh_clear(cell, s_grid_cells);
 
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
+    for(int i = 0; i < s_ms.size; i++) {
 
-    if(M_NavHasDestLOS(s_map, dest_id, pos_xz)) {
+        vec2_t xz_pos = G_Pos_GetXZ(s_ms.ent[i]->uid);
+        s_ms.xz_pos[i] = xz_pos;
+        s_grid.keys[i] = (struct grid_key){
+            .cell = grid_cell_key(grid_coord(xz_pos.x), grid_coord(xz_pos.z)),
+            .uid  = s_ms.ent[i]->uid,
+            .slot = i
+        };
+    }
 
-        PFM_Vec2_Sub(&target_xz, &pos_xz, &desired_velocity);
-        distance = PFM_Vec2_Len(&desired_velocity);
-        PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
-        PFM_Vec2_Scale(&desired_velocity, ent->max_speed / MOVE_TICK_RES, &desired_velocity);
+    qsort(s_grid.keys, s_ms.size, sizeof(struct grid_key), compare_grid_keys);
 
-        if(distance < ARRIVE_SLOWING_RADIUS) {
-            PFM_Vec2_Scale(&desired_velocity, distance / ARRIVE_SLOWING_RADIUS, &desired_velocity);
-        }
+    for(int i = 0; i < s_ms.size; i++) {
 
-    }else{
+        int slot = s_grid.keys[i].slot;
+        s_grid.slot[i] = slot;
+        s_grid.xz_pos[i] = s_ms.xz_pos[slot];
+        s_grid.xz_vel[i] = s_ms.velocity[slot];
+        s_grid.radius[i] = s_ms.ent[slot]->selection_radius;
+        s_grid.still[i] = ent_still(slot);
+    }
+
+    for(int i = 0; i < s_ms.size;) {
 
-        PFM_Vec2_Scale(&ms->vdes, ent->max_speed / MOVE_TICK_RES, &desired_velocity);
+        int begin = i;
+        uint64_t cell = s_grid.keys[i].cell;
+        while(i < s_ms.size && s_grid.keys[i].cell == cell)
+            i++;
+
+        int ret;
+        khiter_t k = kh_put(cell, s_grid_cells, cell, &ret);
+        assert(ret != -1 && ret != 0);
+        kh_value(s_grid_cells, k) = (struct cell_range){begin, i};
     }
+}
 
-    PFM_Vec2_Sub(&desired_velocity, &ms->velocity, &ret);
-    vec2_truncate(&ret, MAX_FORCE);
-    return ret;
+static void flock_grid_cell(const struct flock_grid *grid, vec2_t xz_pos, int *out_r, int *out_c)
+{
+    int r = (xz_pos.z - grid->origin.z) / grid->cell_sz;
+    int c = (xz_pos.x - grid->origin.x) / grid->cell_sz;
+    *out_r = MAX(0, MIN(grid->nrows - 1, r));
+    *out_c = MAX(0, MIN(grid->ncols - 1, c));
 }
 
-/* Alignment is a behaviour that causes a particular agent to line up with agents close by.
- */
-static vec2_t alignment_force(const struct entity *ent, const struct flock *flock)
+static bool flock_grid_build(struct flock *flock)
 {
-    vec2_t ret = (vec2_t){0.0f};
-    size_t neighbour_count = 0;
+    struct flock_grid *grid = &flock->grid;
+    const int nmembers = kh_size(flock->ents);
+    int slots[nmembers];
+    int cell_idx[nmembers];
 
     uint32_t key;
     struct entity *curr;
     (void)key;
 
-    kh_foreach(flock->ents, key, curr, {
+    vec2_t min = (vec2_t){INFINITY, INFINITY};
+    vec2_t max = (vec2_t){-INFINITY, -INFINITY};
+    int n = 0;
 
-        if(curr == ent)
-            continue;
+    kh_foreach(flock->ents, key, curr, {
 
-        vec2_t diff;
-        vec2_t ent_xz_pos = G_Pos_GetXZ(ent->uid);
-        vec2_t curr_xz_pos = G_Pos_GetXZ(curr->uid);
+        int slot = movestate_slot(curr);
+        assert(slot >= 0);
 
-        PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
-        if(PFM_Vec2_Len(&diff) < ALIGN_NEIGHBOUR_RADIUS) {
+        vec2_t xz_pos = s_ms.xz_pos[slot];
+        min = (vec2_t){MIN(min.x, xz_pos.x), MIN(min.z, xz_pos.z)};
+        max = (vec2_t){MAX(max.x, xz_pos.x), MAX(max.z, xz_pos.z)};
+        slots[n++] = slot;
+    });
 
-            struct movestate *ms = movestate_get(ent);
-            assert(ms);
+    float extent = MAX(max.x - min.x, max.z - min.z);
+    grid->origin = min;
+    grid->cell_sz = MAX(FLOCK_GRID_MIN_CELL_SZ, extent / FLOCK_GRID_MAX_RES);
+    grid->nrows = (nmembers > 0) ? (max.z - min.z) / grid->cell_sz + 1 : 0;
+    grid->ncols = (nmembers > 0) ? (max.x - min.x) / grid->cell_sz + 1 : 0;
+    grid->nmembers = nmembers;
+
+    const size_t ncells = grid->nrows * grid->ncols;
+    if(ncells > grid->cells_cap) {
+        void *tmp = realloc(grid->cells, ncells * sizeof(grid->cells[0]));
+        if(!tmp)
+            return false;
+        grid->cells = tmp;
+        grid->cells_cap = ncells;
+    }
+    if(nmembers > grid->members_cap) {
+        void *tmp = realloc(grid->members, nmembers * sizeof(grid->members[0]));
+        if(!tmp)
+            return false;
+        grid->members = tmp;
+        grid->members_cap = nmembers;
+    }
 
-            if(PFM_Vec2_Len(&ms->velocity) < EPSILON)
-                continue; 
+    memset(grid->cells, 0, ncells * sizeof(grid->cells[0]));
+    for(int i = 0; i < nmembers; i++) {
 
-            PFM_Vec2_Add(&ret, &ms->velocity, &ret);
-            neighbour_count++;
-        }
-    });
+        int r, c;
+        vec2_t xz_pos = s_ms.xz_pos[slots[i]];
+        flock_grid_cell(grid, xz_pos, &r, &c);
 
-    if(0 == neighbour_count)
-        return (vec2_t){0.0f};
+        struct flock_cell *cell = &grid->cells[r * grid->ncols + c];
+        PFM_Vec2_Add(&cell->pos_sum, &xz_pos, &cell->pos_sum);
+        cell->count++;
+        cell_idx[i] = r * grid->ncols + c;
+    }
 
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
+    int begin = 0;
+    for(int i = 0; i < ncells; i++) {
+        grid->cells[i].begin = begin;
+        begin += grid->cells[i].count;
+    }
 
-    PFM_Vec2_Scale(&ret, 1.0f / neighbour_count, &ret);
-    PFM_Vec2_Sub(&ret, &ms->velocity, &ret);
-    vec2_truncate(&ret, MAX_FORCE);
-    return ret;
+    int fill[ncells];
+    memset(fill, 0, sizeof(fill));
+    for(int i = 0; i < nmembers; i++) {
+        struct flock_cell *cell = &grid->cells[cell_idx[i]];
+        grid->members[cell->begin + fill[cell_idx[i]]++] = slots[i];
+    }
+    return true;
 }
 
-/* Cohesion is a behaviour that causes agents to steer towards the center of mass of nearby agents.
- */
-static vec2_t cohesion_force(const struct entity *ent, const struct flock *flock)
+/* Must be called after the positions have been saved for the tick */
+static void build_flock_grids(void)
 {
-    vec2_t COM = (vec2_t){0.0f};
-    size_t neighbour_count = 0;
-    vec2_t ent_xz_pos = G_Pos_GetXZ(ent->uid);
+    for(int i = 0; i < vec_size(&s_flocks); i++) {
 
-    uint32_t key;
-    struct entity *curr;
-    (void)key;
+        struct flock *curr_flock = vec_AT(&s_flocks, i);
+        if(!flock_grid_build(curr_flock))
+            curr_flock->grid.nmembers = 0;
+    }
+}
 
-    kh_foreach(flock->ents, key, curr, {
+static bool crowd_grid_init(void)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    vec3_t center = M_GetCenterPos(s_map);
+
+    float width = res.chunk_w * res.tile_w * X_COORDS_PER_TILE;
+    float height = res.chunk_h * res.tile_h * Z_COORDS_PER_TILE;
+
+    s_crowd.nrows = res.chunk_h * CROWD_CELLS_PER_CHUNK;
+    s_crowd.ncols = res.chunk_w * CROWD_CELLS_PER_CHUNK;
+    s_crowd.origin = (vec2_t){center.x + width / 2.0f, center.z - height / 2.0f};
+    s_crowd.cells = calloc(s_crowd.nrows * s_crowd.ncols, sizeof(struct crowd_cell));
+    return (s_crowd.cells != NULL);
+}
 
-        if(curr == ent)
+/* The cell whose center is the top-left corner of the 4 cells that the 
+ * position is interpolated between, and the position's offset from it. The 
+ * X axis of the map points in the direction of decreasing columns. */
+static void crowd_cell_coords(vec2_t xz_pos, int *out_r, int *out_c, float *out_tr, float *out_tc)
+{
+    float fr = (xz_pos.z - s_crowd.origin.z) / CROWD_CELL_SZ - 0.5f;
+    float fc = (s_crowd.origin.x - xz_pos.x) / CROWD_CELL_SZ - 0.5f;
+    *out_r = floorf(fr);
+    *out_c = floorf(fc);
+    *out_tr = fr - *out_r;
+    *out_tc = fc - *out_c;
+}
+
+static struct crowd_cell *crowd_cell_at(int r, int c)
+{
+    if(r < 0 || r >= s_crowd.nrows || c < 0 || c >= s_crowd.ncols)
+        return NULL;
+    return &s_crowd.cells[r * s_crowd.ncols + c];
+}
+
+static void crowd_splat(vec2_t xz_pos, vec2_t xz_vel)
+{
+    int r, c;
+    float tr, tc;
+    crowd_cell_coords(xz_pos, &r, &c, &tr, &tc);
+
+    for(int dr = 0; dr < 2; dr++) {
+    for(int dc = 0; dc < 2; dc++) {
+
+        struct crowd_cell *cell = crowd_cell_at(r + dr, c + dc);
+        if(!cell)
             continue;
 
-        vec2_t diff;
-        vec2_t curr_xz_pos = G_Pos_GetXZ(curr->uid);
-        PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
+        if(cell->tick != s_move_tick) {
+            *cell = (struct crowd_cell){.tick = s_move_tick};
+        }
 
-        float t = (PFM_Vec2_Len(&diff) - COHESION_NEIGHBOUR_RADIUS*0.75) / COHESION_NEIGHBOUR_RADIUS;
-        float scale = exp(-6.0f * t);
+        float w = (dr ? tr : 1.0f - tr) * (dc ? tc : 1.0f - tc);
+        cell->density += w;
+        cell->vel_sum.x += w * xz_vel.x;
+        cell->vel_sum.z += w * xz_vel.z;
+    }}
+}
 
-        PFM_Vec2_Scale(&curr_xz_pos, scale, &curr_xz_pos);
-        PFM_Vec2_Add(&COM, &curr_xz_pos, &COM);
-        neighbour_count++;
-    });
+/* Must be called after the positions have been saved for the tick */
+static bool build_crowd_grid(void)
+{
+    if(!s_crowd.cells && !crowd_grid_init())
+        return false;
+
+    for(int i = 0; i < s_ms.size; i++) {
+        crowd_splat(s_ms.xz_pos[i], s_ms.velocity[i]);
+    }
+    return true;
+}
+
+/* The density and the velocity sum at a point, interpolated between the 4 
+ * closest cells. What the entity in 'slot' splatted itself is left out. */
+static float crowd_sample(vec2_t xz_pos, int slot, vec2_t *out_vel_sum)
+{
+    int r, c, sr, sc;
+    float tr, tc, str, stc;
+    crowd_cell_coords(xz_pos, &r, &c, &tr, &tc);
+    crowd_cell_coords(s_ms.xz_pos[slot], &sr, &sc, &str, &stc);
+
+    const vec2_t self_vel = s_ms.velocity[slot];
+    float density = 0.0f;
+    vec2_t vel_sum = (vec2_t){0.0f, 0.0f};
+
+    for(int dr = 0; dr < 2; dr++) {
+    for(int dc = 0; dc < 2; dc++) {
+
+        const struct crowd_cell *cell = crowd_cell_at(r + dr, c + dc);
+        if(!cell || cell->tick != s_move_tick)
+            continue;
+
+        float self_w = 0.0f;
+        int sdr = r + dr - sr, sdc = c + dc - sc;
+        if(sdr >= 0 && sdr < 2 && sdc >= 0 && sdc < 2)
+            self_w = (sdr ? str : 1.0f - str) * (sdc ? stc : 1.0f - stc);
+
+        float w = (dr ? tr : 1.0f - tr) * (dc ? tc : 1.0f - tc);
+        density += w * (cell->density - self_w);
+        vel_sum.x += w * (cell->vel_sum.x - self_w * self_vel.x);
+        vel_sum.z += w * (cell->vel_sum.z - self_w * self_vel.z);
+    }}
+
+    if(out_vel_sum)
+        *out_vel_sum = vel_sum;
+    return MAX(density, 0.0f);
+}
+
+/* Returns the indices of the grid entries within the circle */
+static size_t snapshot_ents_in_circle(vec2_t xz_pos, float range, int *out, size_t maxout)
+{
+    size_t ret = 0;
+
+    for(int z = grid_coord(xz_pos.z - range); z <= grid_coord(xz_pos.z + range); z++) {
+    for(int x = grid_coord(xz_pos.x - range); x <= grid_coord(xz_pos.x + range); x++) {
+
+        khiter_t k = kh_get(cell, s_grid_cells, grid_cell_key(x, z));
+        if(k == kh_end(s_grid_cells))
+            continue;
+
+        struct cell_range cr = kh_value(s_grid_cells, k);
+        for(int i = cr.begin; i < cr.end; i++) {
+
+            float dx = s_grid.xz_pos[i].x - xz_pos.x;
+            float dz = s_grid.xz_pos[i].z - xz_pos.z;
+            if(dx * dx + dz * dz > range * range)
+                continue;
+
+            out[ret++] = i;
+            if(ret == maxout)
+                return ret;
+        }
+    }}
+    return ret;
+}
+
+/* The neighbours are also summarized in 'out_sig', so that it can be cheaply
+ * checked if the neighbourhood has changed since the last tick. */
+static void find_neighbours(int slot, vec_cp_ent_t *out_dyn, vec_cp_ent_t *out_stat,
+                            struct cp_signature *out_sig)
+{
+    /* For the ClearPath algorithm, we only consider entities without
+     * ENTITY_FLAG_STATIC set, as they are the only ones that may need
+     * to be avoided during moving. Here, 'static' entites refer
+     * to those entites that are not currently in a 'moving' state,
+     * meaning they will not perform collision avoidance maneuvers of
+     * their own. */
+
+    int near_ents[512];
+    size_t num_near = snapshot_ents_in_circle(s_ms.xz_pos[slot], 
+        CLEARPATH_NEIGHBOUR_RADIUS, near_ents, ARR_SIZE(near_ents));
+
+    const vec2_t pos = s_ms.xz_pos[slot];
+    const vec2_t vel = s_ms.velocity[slot];
+    *out_sig = (struct cp_signature){0};
+
+    for(int i = 0; i < num_near; i++) {
+        int idx = near_ents[i];
+
+        if(s_grid.slot[idx] == slot)
+            continue;
+
+        if(s_grid.radius[idx] == 0.0f)
+            continue;
+
+        struct cp_ent newdesc = (struct cp_ent) {
+            .xz_pos = s_grid.xz_pos[idx],
+            .xz_vel = s_grid.xz_vel[idx],
+            .radius = s_grid.radius[idx]
+        };
+
+        if(s_grid.still[idx])
+            vec_cp_ent_push(out_stat, newdesc);
+        else
+            vec_cp_ent_push(out_dyn, newdesc);
+
+        /* The neighbours are returned in no particular order, so the 
+         * summary must not depend on it */
+        uint32_t h = s_grid.keys[idx].uid * 2654435761u;
+        out_sig->nb_hash += (h ^ (h >> 16)) | s_grid.still[idx];
+        out_sig->nb_count++;
+        out_sig->rel_pos_sum.x += newdesc.xz_pos.x - pos.x;
+        out_sig->rel_pos_sum.z += newdesc.xz_pos.z - pos.z;
+        out_sig->rel_vel_sum.x += newdesc.xz_vel.x - vel.x;
+        out_sig->rel_vel_sum.z += newdesc.xz_vel.z - vel.z;
+    }
+}
+
+static bool vec2_near(vec2_t a, vec2_t b, float tolerance)
+{
+    return fabs(a.x - b.x) <= tolerance
+        && fabs(a.z - b.z) <= tolerance;
+}
+
+/* Returns true if the ClearPath velocity computed for the 'prev' inputs may 
+ * be used in place of computing it for the 'curr' inputs. */
+static bool cp_signature_match(const struct cp_signature *prev, 
+                               const struct cp_signature *curr)
+{
+    if(prev->nb_hash != curr->nb_hash || prev->nb_count != curr->nb_count)
+        return false;
+
+    const int n = curr->nb_count;
+    return vec2_near(prev->rel_pos_sum, curr->rel_pos_sum, COHERENCE_POS_TOLERANCE * n)
+        && vec2_near(prev->rel_vel_sum, curr->rel_vel_sum, COHERENCE_VEL_TOLERANCE * n)
+        && vec2_near(prev->vpref, curr->vpref, COHERENCE_VEL_TOLERANCE)
+        && vec2_near(prev->velocity, curr->velocity, COHERENCE_VEL_TOLERANCE);
+}
+
+static vec2_t ent_desired_velocity(const struct entity *ent, int slot)
+{
+    vec2_t pos_xz = G_Pos_GetXZ(ent->uid);
+    struct flock *fl = flock_for_ent(ent);
+
+    switch(s_ms.state[slot]) {
+    case STATE_SEEK_ENEMIES: 
+        return M_NavDesiredEnemySeekVelocity(s_map, pos_xz, ent->faction_id);
+    default:
+        assert(fl);
+        return M_NavDesiredPointSeekVelocity(s_map, fl->dest_id, pos_xz, fl->target_xz, 
+            &s_ms.nav_cursor[slot]);
+    }
+}
+
+/* Seek behaviour makes the entity target and approach a particular destination point.
+ */
+static vec2_t seek_force(const struct entity *ent, int slot, vec2_t target_xz)
+{
+    vec2_t ret, desired_velocity;
+    vec2_t pos_xz = G_Pos_GetXZ(ent->uid);
+
+    PFM_Vec2_Sub(&target_xz, &pos_xz, &desired_velocity);
+    PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
+    PFM_Vec2_Scale(&desired_velocity, ent->max_speed / MOVE_TICK_RES, &desired_velocity);
+
+    PFM_Vec2_Sub(&desired_velocity, &s_ms.velocity[slot], &ret);
+    return ret;
+}
+
+/* Arrival behaviour is like 'seek' but the entity decelerates and comes to a halt when it is 
+ * within a threshold radius of the destination point.
+ * 
+ * When not within line of sight of the destination, this will steer the entity along the 
+ * flow field.
+ */
+static vec2_t arrive_force(const struct entity *ent, int slot, vec2_t target_xz)
+{
+    assert(0 == (ent->flags & ENTITY_FLAG_STATIC));
+    vec2_t ret, desired_velocity;
+    vec2_t pos_xz = s_ms.xz_pos[slot];
+    float distance;
+
+    if(s_ms.dest_los[slot]) {
+
+        PFM_Vec2_Sub(&target_xz, &pos_xz, &desired_velocity);
+        distance = PFM_Vec2_Len(&desired_velocity);
+        PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
+        PFM_Vec2_Scale(&desired_velocity, ent->max_speed / MOVE_TICK_RES, &desired_velocity);
+
+        if(distance < ARRIVE_SLOWING_RADIUS) {
+            PFM_Vec2_Scale(&desired_velocity, distance / ARRIVE_SLOWING_RADIUS, &desired_velocity);
+        }
+
+    }else{
+
+        PFM_Vec2_Scale(&s_ms.vdes[slot], ent->max_speed / MOVE_TICK_RES, &desired_velocity);
+    }
+
+    PFM_Vec2_Sub(&desired_velocity, &s_ms.velocity[slot], &ret);
+    vec2_truncate(&ret, MAX_FORCE);
+    return ret;
+}
+
+/* Alignment is a behaviour that causes a particular agent to line up with agents close by.
+ */
+static vec2_t alignment_force(const struct entity *ent, int slot, const struct flock *flock)
+{
+    vec2_t ret = (vec2_t){0.0f};
+    size_t neighbour_count = 0;
+    vec2_t ent_xz_pos = s_ms.xz_pos[slot];
+
+    /* The cells are at least as large as the neighbour radius, so all the 
+     * neighbours are found in the adjacent cells */
+    const struct flock_grid *grid = &flock->grid;
+    if(grid->nmembers == 0)
+        return (vec2_t){0.0f};
+
+    int r0, c0;
+    flock_grid_cell(grid, ent_xz_pos, &r0, &c0);
+
+    for(int r = MAX(0, r0 - 1); r <= MIN(grid->nrows - 1, r0 + 1); r++) {
+    for(int c = MAX(0, c0 - 1); c <= MIN(grid->ncols - 1, c0 + 1); c++) {
+
+        const struct flock_cell *cell = &grid->cells[r * grid->ncols + c];
+        for(int i = cell->begin; i < cell->begin + cell->count; i++) {
+
+            int curr = grid->members[i];
+            if(curr == slot)
+                continue;
+
+            vec2_t diff;
+            PFM_Vec2_Sub(&s_ms.xz_pos[curr], &ent_xz_pos, &diff);
+            if(PFM_Vec2_Len(&diff) < ALIGN_NEIGHBOUR_RADIUS) {
+
+                if(PFM_Vec2_Len(&s_ms.velocity[curr]) < EPSILON)
+                    continue; 
+
+                PFM_Vec2_Add(&ret, &s_ms.velocity[curr], &ret);
+                neighbour_count++;
+            }
+        }
+    }}
 
     if(0 == neighbour_count)
         return (vec2_t){0.0f};
 
+    PFM_Vec2_Scale(&ret, 1.0f / neighbour_count, &ret);
+    PFM_Vec2_Sub(&ret, &s_ms.velocity[slot], &ret);
+    vec2_truncate(&ret, MAX_FORCE);
+    return ret;
+}
+
+static float cohesion_weight(vec2_t ent_xz_pos, vec2_t xz_pos)
+{
+    vec2_t diff;
+    PFM_Vec2_Sub(&xz_pos, &ent_xz_pos, &diff);
+
+    float t = (PFM_Vec2_Len(&diff) - COHESION_NEIGHBOUR_RADIUS*0.75) / COHESION_NEIGHBOUR_RADIUS;
+    return exp(-6.0f * t);
+}
+
+/* Cohesion is a behaviour that causes agents to steer towards the center of mass of nearby agents.
+ * The members in the adjacent cells are weighted individually. The further cells are each treated 
+ * as a single mass at their' centroid.
+ */
+static vec2_t cohesion_force(const struct entity *ent, int slot, const struct flock *flock)
+{
+    vec2_t COM = (vec2_t){0.0f};
+    vec2_t ent_xz_pos = s_ms.xz_pos[slot];
+
+    const struct flock_grid *grid = &flock->grid;
+    size_t neighbour_count = MAX(grid->nmembers - 1, 0);
+    if(0 == neighbour_count)
+        return (vec2_t){0.0f};
+
+    int r0, c0;
+    flock_grid_cell(grid, ent_xz_pos, &r0, &c0);
+
+    for(int r = 0; r < grid->nrows; r++) {
+    for(int c = 0; c < grid->ncols; c++) {
+
+        const struct flock_cell *cell = &grid->cells[r * grid->ncols + c];
+        if(cell->count == 0)
+            continue;
+
+        if(abs(r - r0) > 1 || abs(c - c0) > 1) {
+
+            vec2_t centroid;
+            PFM_Vec2_Scale((vec2_t*)&cell->pos_sum, 1.0f / cell->count, &centroid);
+            PFM_Vec2_Scale(&centroid, cohesion_weight(ent_xz_pos, centroid) * cell->count, &centroid);
+            PFM_Vec2_Add(&COM, &centroid, &COM);
+            continue;
+        }
+
+        for(int i = cell->begin; i < cell->begin + cell->count; i++) {
+
+            int curr = grid->members[i];
+            if(curr == slot)
+                continue;
+
+            vec2_t curr_xz_pos = s_ms.xz_pos[curr];
+            PFM_Vec2_Scale(&curr_xz_pos, cohesion_weight(ent_xz_pos, curr_xz_pos), &curr_xz_pos);
+            PFM_Vec2_Add(&COM, &curr_xz_pos, &COM);
+        }
+    }}
+
     vec2_t ret;
     PFM_Vec2_Scale(&COM, 1.0f / neighbour_count, &COM);
     PFM_Vec2_Sub(&COM, &ent_xz_pos, &ret);
@@ -756,26 +1709,27 @@ static vec2_t cohesion_force(const struct entity *ent, const struct flock *flock
 
 /* Separation is a behaviour that causes agents to steer away from nearby agents.
  */
-static vec2_t separation_force(const struct entity *ent, float buffer_dist)
+static vec2_t separation_force(const struct entity *ent, int slot, float buffer_dist)
 {
     vec2_t ret = (vec2_t){0.0f};
-    struct entity *near_ents[128];
-    int num_near = G_Pos_EntsInCircle(G_Pos_GetXZ(ent->uid), 
+    vec2_t ent_xz_pos = s_ms.xz_pos[slot];
+
+    /* Only the dynamic entities are in the snapshot, which are exactly 
+     * the ones without ENTITY_FLAG_STATIC set. */
+    int near_ents[128];
+    size_t num_near = snapshot_ents_in_circle(ent_xz_pos, 
         SEPARATION_NEIGHB_RADIUS, near_ents, ARR_SIZE(near_ents));
 
     for(int i = 0; i < num_near; i++) {
 
-        struct entity *curr = near_ents[i];
-        if(curr == ent)
-            continue;
-        if(curr->flags & ENTITY_FLAG_STATIC)
+        int idx = near_ents[i];
+        if(s_grid.slot[idx] == slot)
             continue;
 
         vec2_t diff;
-        vec2_t ent_xz_pos = G_Pos_GetXZ(ent->uid);
-        vec2_t curr_xz_pos = G_Pos_GetXZ(curr->uid);
+        vec2_t curr_xz_pos = s_grid.xz_pos[idx];
 
-        float radius = ent->selection_radius + curr->selection_radius + buffer_dist;
+        float radius = ent->selection_radius + s_grid.radius[idx] + buffer_dist;
         PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
 
         /* Exponential decay with y=1 when diff = radius*0.85 
@@ -797,21 +1751,18 @@ static vec2_t separation_force(const struct entity *ent, float buffer_dist)
     return ret;
 }
 
-static vec2_t point_seek_total_force(const struct entity *ent, const struct flock *flock)
+static vec2_t point_seek_total_force(const struct entity *ent, int slot, const struct flock *flock)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
-
-    vec2_t arrive = arrive_force(ent, flock->dest_id, flock->target_xz);
-    vec2_t cohesion = cohesion_force(ent, flock);
-    vec2_t separation = separation_force(ent, SEPARATION_BUFFER_DIST);
+    vec2_t arrive = arrive_force(ent, slot, flock->target_xz);
+    vec2_t cohesion = cohesion_force(ent, slot, flock);
+    vec2_t separation = separation_force(ent, slot, SEPARATION_BUFFER_DIST);
 
     PFM_Vec2_Scale(&arrive,     MOVE_ARRIVE_FORCE_SCALE,   &arrive);
     PFM_Vec2_Scale(&cohesion,   MOVE_COHESION_FORCE_SCALE, &cohesion);
     PFM_Vec2_Scale(&separation, SEPARATION_FORCE_SCALE,    &separation);
 
     vec2_t ret = (vec2_t){0.0f};
-    assert(!ent_still(ms));
+    assert(!ent_still(slot));
 
     PFM_Vec2_Add(&ret, &arrive, &ret);
     PFM_Vec2_Add(&ret, &separation, &ret);
@@ -821,13 +1772,10 @@ static vec2_t point_seek_total_force(const struct entity *ent, const struct floc
     return ret;
 }
 
-static vec2_t enemy_seek_total_force(const struct entity *ent)
+static vec2_t enemy_seek_total_force(const struct entity *ent, int slot)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
-
-    vec2_t arrive = arrive_force(ent, DEST_ID_INVALID, (vec2_t){0.0f, 0.0f});
-    vec2_t separation = separation_force(ent, SEPARATION_BUFFER_DIST);
+    vec2_t arrive = arrive_force(ent, slot, (vec2_t){0.0f, 0.0f});
+    vec2_t separation = separation_force(ent, slot, SEPARATION_BUFFER_DIST);
 
     PFM_Vec2_Scale(&arrive,     MOVE_ARRIVE_FORCE_SCALE,   &arrive);
     PFM_Vec2_Scale(&separation, SEPARATION_FORCE_SCALE,    &separation);
@@ -840,25 +1788,27 @@ static vec2_t enemy_seek_total_force(const struct entity *ent)
     return ret;
 }
 
-static vec2_t new_pos_for_vel(const struct entity *ent, vec2_t velocity)
+static vec2_t new_pos_for_vel(const struct entity *ent, vec2_t velocity, int nticks)
 {
     vec2_t xz_pos = G_Pos_GetXZ(ent->uid);
     vec2_t new_pos;
 
+    PFM_Vec2_Scale(&velocity, nticks, &velocity);
     PFM_Vec2_Add(&xz_pos, &velocity, &new_pos);
     return new_pos;
 }
 
 /* Nullify the components of the force which would guide
  * the entity towards an impassable tile. */
-static void nullify_impass_components(const struct entity *ent, vec2_t *inout_force)
+static void nullify_impass_components(int slot, vec2_t *inout_force)
 {
     vec2_t nt_dims = N_TileDims();
+    vec2_t xz_pos = s_ms.xz_pos[slot];
 
-    vec2_t left =  (vec2_t){G_Pos_Get(ent->uid).x + nt_dims.x, G_Pos_Get(ent->uid).z};
-    vec2_t right = (vec2_t){G_Pos_Get(ent->uid).x - nt_dims.x, G_Pos_Get(ent->uid).z};
-    vec2_t top =   (vec2_t){G_Pos_Get(ent->uid).x, G_Pos_Get(ent->uid).z + nt_dims.z};
-    vec2_t bot =   (vec2_t){G_Pos_Get(ent->uid).x, G_Pos_Get(ent->uid).z - nt_dims.z};
+    vec2_t left =  (vec2_t){xz_pos.x + nt_dims.x, xz_pos.z};
+    vec2_t right = (vec2_t){xz_pos.x - nt_dims.x, xz_pos.z};
+    vec2_t top =   (vec2_t){xz_pos.x, xz_pos.z + nt_dims.z};
+    vec2_t bot =   (vec2_t){xz_pos.x, xz_pos.z - nt_dims.z};
 
     if((inout_force->x > 0 && !M_NavPositionPathable(s_map, left))
     || (inout_force->x < 0 && !M_NavPositionPathable(s_map, right)))
@@ -869,21 +1819,18 @@ static void nullify_impass_components(const struct entity *ent, vec2_t *inout_fo
         inout_force->z = 0.0f;
 }
 
-static vec2_t point_seek_vpref(const struct entity *ent, const struct flock *flock)
+static vec2_t point_seek_vpref(const struct entity *ent, int slot, const struct flock *flock)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
-
     vec2_t steer_force;
     for(int prio = 0; prio < 3; prio++) {
 
         switch(prio) {
-        case 0: steer_force = point_seek_total_force(ent, flock); break;
-        case 1: steer_force = separation_force(ent, SEPARATION_BUFFER_DIST); break;
-        case 2: steer_force = arrive_force(ent, flock->dest_id, flock->target_xz); break;
+        case 0: steer_force = point_seek_total_force(ent, slot, flock); break;
+        case 1: steer_force = separation_force(ent, slot, SEPARATION_BUFFER_DIST); break;
+        case 2: steer_force = arrive_force(ent, slot, flock->target_xz); break;
         }
 
-        nullify_impass_components(ent, &steer_force);
+        nullify_impass_components(slot, &steer_force);
         if(PFM_Vec2_Len(&steer_force) > MAX_FORCE * 0.01)
             break;
     }
@@ -891,91 +1838,91 @@ static vec2_t point_seek_vpref(const struct entity *ent, const struct flock *flo
     vec2_t accel, new_vel; 
     PFM_Vec2_Scale(&steer_force, 1.0f / ENTITY_MASS, &accel);
 
-    PFM_Vec2_Add(&ms->velocity, &accel, &new_vel);
+    PFM_Vec2_Add(&s_ms.velocity[slot], &accel, &new_vel);
     vec2_truncate(&new_vel, ent->max_speed / MOVE_TICK_RES);
 
     return new_vel;
 }
 
-static vec2_t enemy_seek_vpref(const struct entity *ent)
+static vec2_t enemy_seek_vpref(const struct entity *ent, int slot)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
-
-    vec2_t steer_force = enemy_seek_total_force(ent);
+    vec2_t steer_force = enemy_seek_total_force(ent, slot);
 
     vec2_t accel, new_vel; 
     PFM_Vec2_Scale(&steer_force, 1.0f / ENTITY_MASS, &accel);
 
-    PFM_Vec2_Add(&ms->velocity, &accel, &new_vel);
+    PFM_Vec2_Add(&s_ms.velocity[slot], &accel, &new_vel);
     vec2_truncate(&new_vel, ent->max_speed / MOVE_TICK_RES);
 
     return new_vel;
 }
 
-static void update_vel_hist(struct movestate *ms, vec2_t vnew)
+static void update_vel_hist(int slot, vec2_t vnew)
 {
-    assert(ms->vel_hist >= 0 && ms->vel_hist_idx < VEL_HIST_LEN);
-    ms->vel_hist[ms->vel_hist_idx] = vnew;
-    ms->vel_hist_idx = ((ms->vel_hist_idx+1) % VEL_HIST_LEN);
+    assert(s_ms.vel_hist_idx[slot] >= 0 && s_ms.vel_hist_idx[slot] < VEL_HIST_LEN);
+    s_ms.vel_hist[slot][s_ms.vel_hist_idx[slot]] = vnew;
+    s_ms.vel_hist_idx[slot] = ((s_ms.vel_hist_idx[slot]+1) % VEL_HIST_LEN);
 }
 
 /* Simple Moving Average */
-static vec2_t vel_sma(const struct movestate *ms)
+static vec2_t vel_sma(int slot)
 {
-    vec2_t ret = {0};
-    for(int i = 0; i < VEL_HIST_LEN; i++)
-        PFM_Vec2_Add(&ret, (vec2_t*)&ms->vel_hist[i], &ret); 
-    PFM_Vec2_Scale(&ret, 1.0f/VEL_HIST_LEN, &ret);
-    return ret;
+    const vec2_t *hist = s_ms.vel_hist[slot];
+    float x = 0.0f, z = 0.0f;
+
+    for(int i = 0; i < VEL_HIST_LEN; i++) {
+        x += hist[i].x;
+        z += hist[i].z;
+    }
+    return (vec2_t){x / VEL_HIST_LEN, z / VEL_HIST_LEN};
 }
 
 /* Weighted Moving Average */
-static vec2_t vel_wma(const struct movestate *ms)
+static vec2_t vel_wma(int slot)
 {
-    vec2_t ret = {0};
-    float denom = 0.0f;
+    const vec2_t *hist = s_ms.vel_hist[slot];
+    float x = 0.0f, z = 0.0f;
+    const float denom = VEL_HIST_LEN * (VEL_HIST_LEN + 1) / 2.0f;
 
     for(int i = 0; i < VEL_HIST_LEN; i++) {
-
-        vec2_t term = ms->vel_hist[i];
-        PFM_Vec2_Scale(&term, VEL_HIST_LEN-i, &term);
-        PFM_Vec2_Add(&ret, &term, &ret);
-        denom += (VEL_HIST_LEN-i);
+        x += hist[i].x * (VEL_HIST_LEN-i);
+        z += hist[i].z * (VEL_HIST_LEN-i);
     }
-
-    PFM_Vec2_Scale(&ret, 1.0f/denom, &ret);
-    return ret;
+    return (vec2_t){x / denom, z / denom};
 }
 
-static void entity_update(struct entity *ent, vec2_t new_vel)
+/* 'nticks' is the number of movement ticks' worth of distance to travel */
+static void entity_update(struct entity *ent, int slot, vec2_t new_vel, int nticks)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
+    vec2_t new_pos_xz = new_pos_for_vel(ent, new_vel, nticks);
 
-    vec2_t new_pos_xz = new_pos_for_vel(ent, new_vel);
+    /* A longer step could cut through impassable terrain which the flow
+     * field would have guided the entity around */
+    if(nticks > 1 && !M_NavPositionPathable(s_map, new_pos_xz))
+        new_pos_xz = new_pos_for_vel(ent, new_vel, 1);
 
     if(PFM_Vec2_Len(&new_vel) > 0
     && M_NavPositionPathable(s_map, new_pos_xz)) {
     
         vec3_t new_pos = (vec3_t){new_pos_xz.x, M_HeightAtPoint(s_map, new_pos_xz), new_pos_xz.z};
-        G_Pos_Set(ent->uid, new_pos);
-        ms->velocity = new_vel;
+        G_Pos_Step(ent->uid, new_pos, nticks * (TIMER_HZ / MOVE_TICK_RES));
+        s_ms.velocity[slot] = new_vel;
 
         /* Use a weighted average of past velocities ot set the entity's orientation. This means that 
          * the entity's visible orientation lags behind its' true orientation slightly. However, this 
          * greatly smooths the turning of the entity, giving a more natural look to the movemment. 
          */
-        vec2_t wma = vel_wma(ms);
+        vec2_t wma = vel_wma(slot);
         if(PFM_Vec2_Len(&wma) > EPSILON) {
             ent->rotation = dir_quat_from_velocity(wma);
+            Entity_InvalidateModel(ent);
         }
     }else{
-        ms->velocity = (vec2_t){0.0f, 0.0f}; 
+        s_ms.velocity[slot] = (vec2_t){0.0f, 0.0f}; 
     }
 
     assert(M_NavPositionPathable(s_map, G_Pos_GetXZ(ent->uid)));
-    switch(ms->state) {
+    switch(s_ms.state[slot]) {
     case STATE_MOVING: {
 
         vec2_t diff_to_target;
@@ -999,10 +1946,10 @@ static void entity_update(struct entity *ent, vec2_t new_vel)
         bool done = false;
         for(int j = 0; j < num_adj; j++) {
 
-            struct movestate *adj_ms = movestate_get(adjacent[j]);
-            assert(adj_ms);
+            int adj_slot = movestate_slot(adjacent[j]);
+            assert(adj_slot >= 0);
 
-            if(adj_ms->state == STATE_ARRIVED) {
+            if(s_ms.state[adj_slot] == STATE_ARRIVED) {
 
                 entity_finish_moving(ent, STATE_ARRIVED);
                 done = true;
@@ -1018,7 +1965,7 @@ static void entity_update(struct entity *ent, vec2_t new_vel)
          * the entity any closer to its' goal. Stop and wait, re-requesting the  path 
          * after some time. 
          */
-        if(PFM_Vec2_Len(&ms->vdes) < EPSILON) {
+        if(PFM_Vec2_Len(&s_ms.vdes[slot]) < EPSILON) {
 
             assert(flock_for_ent(ent));
             entity_finish_moving(ent, STATE_WAITING);
@@ -1028,7 +1975,7 @@ static void entity_update(struct entity *ent, vec2_t new_vel)
     }
     case STATE_SEEK_ENEMIES: {
 
-        if(PFM_Vec2_Len(&ms->vdes) < EPSILON) {
+        if(PFM_Vec2_Len(&s_ms.vdes[slot]) < EPSILON) {
 
             entity_finish_moving(ent, STATE_WAITING);
         }
@@ -1036,16 +1983,16 @@ static void entity_update(struct entity *ent, vec2_t new_vel)
     }
     case STATE_WAITING: {
 
-        assert(ms->wait_ticks_left > 0);
-        ms->wait_ticks_left--;
-        if(ms->wait_ticks_left == 0) {
+        assert(s_ms.wait_ticks_left[slot] > 0);
+        s_ms.wait_ticks_left[slot]--;
+        if(s_ms.wait_ticks_left[slot] == 0) {
 
-            assert(ms->wait_prev == STATE_MOVING 
-                || ms->wait_prev == STATE_SEEK_ENEMIES);
+            assert(s_ms.wait_prev[slot] == STATE_MOVING 
+                || s_ms.wait_prev[slot] == STATE_SEEK_ENEMIES);
 
             entity_unblock(ent);
             E_Entity_Notify(EVENT_MOTION_START, ent->uid, NULL, ES_ENGINE);
-            ms->state = ms->wait_prev;
+            movestate_set_state(slot, s_ms.wait_prev[slot]);
         }
         break;
     }
@@ -1056,144 +2003,576 @@ static void entity_update(struct entity *ent, vec2_t new_vel)
     }
 }
 
-static void find_neighbours(const struct entity *ent,
-                            vec_cp_ent_t *out_dyn,
-                            vec_cp_ent_t *out_stat)
+static void disband_empty_flocks(void)
 {
-    /* For the ClearPath algorithm, we only consider entities without
-     * ENTITY_FLAG_STATIC set, as they are the only ones that may need
-     * to be avoided during moving. Here, 'static' entites refer
-     * to those entites that are not currently in a 'moving' state,
-     * meaning they will not perform collision avoidance maneuvers of
-     * their own. */
+    uint32_t key;
+    struct entity *curr;
+    (void)key;
 
-    struct entity *near_ents[512];
-    int num_near = G_Pos_EntsInCircle(G_Pos_GetXZ(ent->uid), 
-        CLEARPATH_NEIGHBOUR_RADIUS, near_ents, ARR_SIZE(near_ents));
+    /* Iterate vector backwards so we can delete entries while iterating. */
+    for(int i = vec_size(&s_flocks)-1; i >= 0; i--) {
 
-    for(int i = 0; i < num_near; i++) {
-        struct entity *curr = near_ents[i];
+        /* First, decide if we can disband this flock */
+        bool disband = true;
+        kh_foreach(vec_AT(&s_flocks, i)->ents, key, curr, {
 
-        if(curr->uid == ent->uid)
-            continue;
+            int slot = movestate_slot(curr);
+            assert(slot >= 0);
+
+            if(s_ms.state[slot] != STATE_ARRIVED) {
+                disband = false;
+                break;
+            }
+        });
+
+        if(disband) {
+            flock_disband(vec_AT(&s_flocks, i));
+        }
+    }
+}
+
+static void update_pending_flocks(void)
+{
+    for(int i = 0; i < vec_size(&s_flocks); i++) {
 
-        if(curr->flags & ENTITY_FLAG_STATIC)
+        struct flock *curr_flock = vec_AT(&s_flocks, i);
+        if(!flock_path_pending(curr_flock))
             continue;
 
-        if(curr->selection_radius == 0.0f)
+        if(M_NavPathStatus(curr_flock->path, NULL) == PATH_PENDING)
             continue;
 
-        struct movestate *ms = movestate_get(curr);
-        assert(ms);
+        M_NavPathRelease(curr_flock->path);
+        curr_flock->path = PATH_TICKET_INVALID;
+    }
+}
 
-        vec2_t curr_xz_pos = G_Pos_GetXZ(curr->uid);
-        struct cp_ent newdesc = (struct cp_ent) {
-            .xz_pos = curr_xz_pos,
-            .xz_vel = ms->velocity,
-            .radius = curr->selection_radius
-        };
+static bool ent_near_enemy(const struct entity *ent, vec2_t xz_pos)
+{
+    return (G_Pos_NearestEnemy(xz_pos, ent->faction_id, LOD_ENEMY_RADIUS) != NULL);
+}
 
-        if(ent_still(ms))
-            vec_cp_ent_push(out_stat, newdesc);
-        else
-            vec_cp_ent_push(out_dyn, newdesc);
-    }
+static bool ent_in_view(vec2_t xz_pos, const struct frustum *view)
+{
+    float height = M_HeightAtPoint(s_map, xz_pos);
+    struct aabb box = (struct aabb){
+        .x_min = xz_pos.x - LOD_VIEW_MARGIN, .x_max = xz_pos.x + LOD_VIEW_MARGIN,
+        .y_min = height - LOD_VIEW_MARGIN,   .y_max = height + LOD_VIEW_MARGIN,
+        .z_min = xz_pos.z - LOD_VIEW_MARGIN, .z_max = xz_pos.z + LOD_VIEW_MARGIN,
+    };
+    return (C_FrustumAABBIntersectionFast(view, &box) != VOLUME_INTERSEC_OUTSIDE);
 }
 
-static void disband_empty_flocks(void)
+/* Entities that the player might be looking at or that might soon get into a 
+ * fight, as well as those about to arrive, are always fully simulated. The 
+ * rest only follow the flow field at a reduced rate. 
+ */
+static enum move_lod ent_lod(const struct entity *ent, int slot, const struct frustum *view)
 {
-    uint32_t key;
-    struct entity *curr;
-    (void)key;
+    if(!CONFIG_MOVE_LOD || sim_deterministic() || s_ms.state[slot] != STATE_MOVING)
+        return MOVE_LOD_FULL;
 
-    /* Iterate vector backwards so we can delete entries while iterating. */
-    for(int i = vec_size(&s_flocks)-1; i >= 0; i--) {
+    const struct flock *flock = flock_for_ent(ent);
+    vec2_t xz_pos = G_Pos_GetXZ(ent->uid);
+    vec2_t diff;
 
-        /* First, decide if we can disband this flock */
-        bool disband = true;
-        kh_foreach(vec_AT(&s_flocks, i).ents, key, curr, {
+    PFM_Vec2_Sub((vec2_t*)&flock->target_xz, &xz_pos, &diff);
+    if(PFM_Vec2_Len(&diff) < LOD_TARGET_RADIUS)
+        return MOVE_LOD_FULL;
 
-            struct movestate *ms = movestate_get(curr);
-            assert(ms);
+    if(ent_in_view(xz_pos, view))
+        return MOVE_LOD_FULL;
 
-            if(ms->state != STATE_ARRIVED) {
-                disband = false;
+    /* Querying for nearby enemies is more expensive, so it is only done 
+     * every few ticks, staggered between the entities */
+    if((s_move_tick + ent->uid) % LOD_ENEMY_CHECK_PERIOD == 0)
+        s_ms.near_enemy[slot] = ent_near_enemy(ent, xz_pos);
+
+    if(s_ms.near_enemy[slot])
+        return MOVE_LOD_FULL;
+
+    return MOVE_LOD_REDUCED;
+}
+
+static void update_lods(void)
+{
+    Camera_MakeFrustum(G_GetActiveCamera(), &s_tick_view);
+
+    for(int i = 0; i < s_ms.nactive; i++) {
+
+        int slot = s_ms.active[i];
+        enum move_lod lod = ent_lod(s_ms.ent[slot], slot, &s_tick_view);
+        if(lod == MOVE_LOD_FULL && s_ms.lod[slot] != MOVE_LOD_FULL) {
+            /* The saved ClearPath result may be arbitrarily old */
+            s_ms.cp_reuse_left[slot] = 0;
+            s_ms.near_enemy[slot] = true;
+        }
+        s_ms.lod[slot] = lod;
+    }
+
+    /* Flocks with no relevant members at all are simulated as a whole */
+    for(int i = 0; i < vec_size(&s_flocks); i++) {
+
+        struct flock *curr_flock = vec_AT(&s_flocks, i);
+        curr_flock->blob = CONFIG_MOVE_LOD && !sim_deterministic();
+        curr_flock->blob_vdes_valid = false;
+
+        uint32_t key;
+        struct entity *curr;
+        (void)key;
+
+        kh_foreach(curr_flock->ents, key, curr, {
+
+            int slot = movestate_slot(curr);
+            assert(slot >= 0);
+
+            if(s_ms.lod[slot] == MOVE_LOD_FULL) {
+                curr_flock->blob = false;
                 break;
             }
         });
 
-        if(disband) {
+        if(!curr_flock->blob)
+            continue;
+
+        kh_foreach(curr_flock->ents, key, curr, {
+
+            int slot = movestate_slot(curr);
+            s_ms.lod[slot] = MOVE_LOD_BLOB;
+        });
+    }
 
-            kh_destroy(entity, vec_AT(&s_flocks, i).ents);
-            vec_flock_del(&s_flocks, i);
+    s_move_stats.lod_reduced = 0;
+    s_move_stats.lod_blob = 0;
+    for(int i = 0; i < s_ms.nactive; i++) {
+        int slot = s_ms.active[i];
+        s_move_stats.lod_reduced += (s_ms.lod[slot] == MOVE_LOD_REDUCED);
+        s_move_stats.lod_blob += (s_ms.lod[slot] == MOVE_LOD_BLOB);
+    }
+}
+
+/* Reduced detail entities are moved on one out of every LOD_REDUCED_PERIOD
+ * ticks, covering the distance of all of them at once */
+static bool lod_skip_tick(int slot)
+{
+    if(s_ms.lod[slot] == MOVE_LOD_FULL)
+        return false;
+    return ((s_move_tick + s_ms.ent[slot]->uid) % LOD_REDUCED_PERIOD != 0);
+}
+
+static int lod_nticks(int slot)
+{
+    return (s_ms.lod[slot] == MOVE_LOD_FULL) ? 1 : LOD_REDUCED_PERIOD;
+}
+
+/* The cheap steering for reduced detail entities: just follow the flow field */
+static vec2_t lod_velocity(const struct entity *ent, int slot, struct flock *flock)
+{
+    /* Members which got stuck following the flock's velocity steer 
+     * by their own flow field until they are moving again */
+    bool stuck = (PFM_Vec2_Len(&s_ms.velocity[slot]) < EPSILON);
+
+    vec2_t vdes;
+    if(s_ms.lod[slot] == MOVE_LOD_BLOB && !stuck) {
+
+        if(!flock->blob_vdes_valid) {
+            flock->blob_vdes = ent_desired_velocity(ent, slot);
+            flock->blob_vdes_valid = true;
         }
+        vdes = flock->blob_vdes;
+    }else{
+        vdes = ent_desired_velocity(ent, slot);
     }
+
+    s_ms.vdes[slot] = vdes;
+    vec2_t ret;
+    PFM_Vec2_Scale(&vdes, ent->max_speed / MOVE_TICK_RES, &ret);
+    return ret;
 }
 
-static void on_20hz_tick(void *user, void *event)
+/* Continuum crowd style steering: the preferred velocity is deflected down 
+ * the density gradient and, where it is crowded ahead, the speed is limited 
+ * to that of the crowd in the direction of travel. Unlike with ClearPath, 
+ * the cost does not grow with the number of neighbours. */
+static vec2_t crowd_velocity(int slot, vec2_t vpref)
 {
-    vec_cp_ent_t dyn, stat;
-    vec_cp_ent_init(&dyn);
-    vec_cp_ent_init(&stat);
+    const float h = CROWD_CELL_SZ / 2.0f;
+    const vec2_t xz_pos = s_ms.xz_pos[slot];
+
+    float pref_speed = PFM_Vec2_Len(&vpref);
+    if(pref_speed < EPSILON)
+        return vpref;
+
+    float left  = crowd_sample((vec2_t){xz_pos.x + h, xz_pos.z}, slot, NULL);
+    float right = crowd_sample((vec2_t){xz_pos.x - h, xz_pos.z}, slot, NULL);
+    float top   = crowd_sample((vec2_t){xz_pos.x, xz_pos.z + h}, slot, NULL);
+    float bot   = crowd_sample((vec2_t){xz_pos.x, xz_pos.z - h}, slot, NULL);
+
+    /* The gradient in units of density per cell */
+    vec2_t away = (vec2_t){
+        -(left - right) * CROWD_DISCOMFORT_WEIGHT,
+        -(top - bot) * CROWD_DISCOMFORT_WEIGHT
+    };
+    vec2_truncate(&away, 1.0f);
+
+    vec2_t dir;
+    PFM_Vec2_Normal(&vpref, &dir);
+    PFM_Vec2_Add(&dir, &away, &dir);
+    nullify_impass_components(slot, &dir);
+    if(PFM_Vec2_Len(&dir) < EPSILON)
+        return (vec2_t){0.0f, 0.0f};
+    PFM_Vec2_Normal(&dir, &dir);
+
+    vec2_t ahead, vel_sum;
+    PFM_Vec2_Scale(&dir, CROWD_CELL_SZ, &ahead);
+    PFM_Vec2_Add((vec2_t*)&xz_pos, &ahead, &ahead);
+    float density = crowd_sample(ahead, slot, &vel_sum);
+
+    float speed = pref_speed;
+    if(density > CROWD_DENSITY_MIN) {
+
+        float flow_speed = MAX(0.0f, PFM_Vec2_Dot(&vel_sum, &dir) / density);
+        flow_speed = MAX(flow_speed, pref_speed * CROWD_MIN_SPEED_FRAC);
+        float t = MIN(1.0f, (density - CROWD_DENSITY_MIN) / (CROWD_DENSITY_MAX - CROWD_DENSITY_MIN));
+        speed = pref_speed + t * (MIN(flow_speed, pref_speed) - pref_speed);
+    }
 
-    uint32_t key;
-    struct entity *curr;
+    vec2_t ret;
+    PFM_Vec2_Scale(&dir, speed, &ret);
+    return ret;
+}
 
-    disband_empty_flocks();
+static vec2_t clearpath_velocity(struct move_job *job, const struct entity *ent, int slot, vec2_t vpref)
+{
+    struct cp_ent curr_cp = (struct cp_ent) {
+        .xz_pos = s_ms.xz_pos[slot],
+        .xz_vel = s_ms.velocity[slot],
+        .radius = ent->selection_radius,
+    };
 
-    kh_foreach(G_GetDynamicEntsSet(), key, curr, {
+    struct cp_signature sig;
+    vec_cp_ent_reset(&job->dyn);
+    vec_cp_ent_reset(&job->stat);
+    find_neighbours(slot, &job->dyn, &job->stat, &sig);
 
-        struct movestate *ms = movestate_get(curr);
-        assert(ms);
+    sig.vpref = vpref;
+    sig.velocity = s_ms.velocity[slot];
 
-        if(ent_still(ms))
-            continue;
+    if(CONFIG_MOVE_COHERENCE_CACHE
+    && s_ms.cp_reuse_left[slot] > 0
+    && cp_signature_match(&s_ms.cp_sig[slot], &sig)) {
 
-        struct flock *flock = flock_for_ent(curr);
-        vec2_t vpref = (vec2_t){-1,-1};
-        ms->vdes = ent_desired_velocity(curr);
+        s_ms.cp_reuse_left[slot]--;
+        job->cp_skipped++;
+        return s_ms.cp_vnew[slot];
+    }
 
-        switch(ms->state) {
+    vec2_t vnew = G_ClearPath_NewVelocity(curr_cp, ent->uid, vpref, job->dyn, job->stat, &job->scratch);
+    s_ms.cp_sig[slot] = sig;
+    s_ms.cp_vnew[slot] = vnew;
+    s_ms.cp_reuse_left[slot] = COHERENCE_MAX_TICKS;
+    job->cp_computed++;
+    return vnew;
+}
+
+static void move_job_run(void *arg)
+{
+    struct move_job *job = arg;
+
+    for(int i = 0; i < job->nitems; i++) {
+
+        struct entity *curr = job->items[i].ent;
+        struct flock *flock = job->items[i].flock;
+        int slot = job->items[i].slot;
+
+        vec2_t vpref = (vec2_t){-1,-1};
+        switch(s_ms.state[slot]) {
         case STATE_SEEK_ENEMIES: 
             assert(!flock);
-            vpref = enemy_seek_vpref(curr);
+            vpref = enemy_seek_vpref(curr, slot);
             break;
         default:
             assert(flock);
-            vpref = point_seek_vpref(curr, flock);
+            vpref = point_seek_vpref(curr, slot, flock);
         }
         assert(vpref.x != -1 || vpref.z != -1);
 
-        struct cp_ent curr_cp = (struct cp_ent) {
-            .xz_pos = G_Pos_GetXZ(curr->uid),
-            .xz_vel = ms->velocity,
-            .radius = curr->selection_radius,
-        };
+        vec2_t vnew;
+        if(job->items[i].crowd) {
+            vnew = crowd_velocity(slot, vpref);
+            /* The saved ClearPath result goes stale in the meantime */
+            s_ms.cp_reuse_left[slot] = 0;
+            job->crowd_steered++;
+        }else{
+            vnew = clearpath_velocity(job, curr, slot, vpref);
+        }
+        update_vel_hist(slot, vnew);
 
-        vec_cp_ent_reset(&dyn);
-        vec_cp_ent_reset(&stat);
-        find_neighbours(curr, &dyn, &stat);
+        vec2_t vel_diff;
+        PFM_Vec2_Sub(&vnew, &s_ms.velocity[slot], &vel_diff);
 
-        ms->vnew = G_ClearPath_NewVelocity(curr_cp, key, vpref, dyn, stat);
-        update_vel_hist(ms, ms->vnew);
+        PFM_Vec2_Add(&s_ms.velocity[slot], &vel_diff, &vnew);
+        vec2_truncate(&vnew, curr->max_speed / MOVE_TICK_RES);
+        s_ms.vnew[slot] = vnew;
+    }
+}
 
-        vec2_t vel_diff;
-        PFM_Vec2_Sub(&ms->vnew, &ms->velocity, &vel_diff);
+/* Entities that the player might be looking at and the members of small
+ * groups always get full collision avoidance. Entities seeking enemies are
+ * not part of any flock, but only do so as part of an engagement. */
+static bool use_crowd_steering(const struct entity *ent, const struct flock *flock)
+{
+    if(!CONFIG_MOVE_CROWD)
+        return false;
+    if(flock && flock->crowd == MOVE_CROWD_NEVER)
+        return false;
+    if(ent_in_view(G_Pos_GetXZ(ent->uid), &s_tick_view))
+        return false;
+    if(flock && flock->crowd == MOVE_CROWD_ALWAYS)
+        return true;
+    if(s_ms.nactive < CONFIG_MOVE_CROWD_THRESHOLD)
+        return false;
+    return (!flock || kh_size(flock->ents) >= CROWD_MIN_FLOCK_SIZE);
+}
 
-        PFM_Vec2_Add(&ms->velocity, &vel_diff, &ms->vnew);
-        vec2_truncate(&ms->vnew, curr->max_speed / MOVE_TICK_RES);
-    });
+static double elapsed_ms(uint64_t start)
+{
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    return (elapsed * 1000.0) / SDL_GetPerformanceFrequency();
+}
+
+static void compute_new_velocities(void)
+{
+    size_t nwork = vec_size(&s_move_work);
+    if(nwork == 0)
+        return;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    size_t njobs = 1;
+    if(CONFIG_MOVE_PARALLEL_VELOCITY)
+        njobs = MIN(Sched_NumWorkers() + 1, ARR_SIZE(s_move_jobs));
+    njobs = MIN(njobs, nwork);
+
+    struct job jobs[njobs];
+    for(int i = 0; i < njobs; i++) {
+
+        size_t begin = i * nwork / njobs;
+        size_t end = (i + 1) * nwork / njobs;
+
+        s_move_jobs[i].items = s_move_work.array + begin;
+        s_move_jobs[i].nitems = end - begin;
+        s_move_jobs[i].cp_computed = 0;
+        s_move_jobs[i].cp_skipped = 0;
+        s_move_jobs[i].crowd_steered = 0;
+        G_ClearPath_ScratchReset(&s_move_jobs[i].scratch);
+        jobs[i] = (struct job){move_job_run, &s_move_jobs[i]};
+    }
+
+    if(njobs == 1) {
+        move_job_run(&s_move_jobs[0]);
+    }else{
+        struct job_counter ctr;
+        Sched_Submit(jobs, njobs, &ctr);
+        Sched_Wait(&ctr);
+    }
+
+    for(int i = 0; i < njobs; i++) {
+        s_move_stats.cp_computed += s_move_jobs[i].cp_computed;
+        s_move_stats.cp_skipped += s_move_jobs[i].cp_skipped;
+        s_move_stats.crowd_steered += s_move_jobs[i].crowd_steered;
+    }
+    s_move_stats.clearpath_ms += elapsed_ms(start);
+}
 
-    kh_foreach(G_GetDynamicEntsSet(), key, curr, {
+static void on_20hz_tick(void *user, void *event)
+{
+    PERF_ENTER();
+    uint64_t start = SDL_GetPerformanceCounter();
+    disband_empty_flocks();
+    update_pending_flocks();
+
+    s_move_tick++;
+    update_lods();
+    M_NavEnemySeekTickBegin(s_map);
+
+    /* Anything that needs the navigation system or the position table is
+     * queried up front on the main thread. After this, the new velocities 
+     * of the entities only depend on the snapshot and may be computed in 
+     * parallel. */
+    vec_work_reset(&s_move_work);
+    size_t ncrowd = 0;
+    for(int i = 0; i < s_ms.nactive; i++) {
+
+        int slot = s_ms.active[i];
+        struct entity *curr = s_ms.ent[slot];
+        if(ent_still(slot))
+            continue;
+
+        struct flock *flock = flock_for_ent(curr);
+        if(flock && flock_path_pending(flock)) {
+            s_ms.velocity[slot] = (vec2_t){0.0f, 0.0f};
+            continue;
+        }
+
+        if(lod_skip_tick(slot))
+            continue;
+
+        if(s_ms.lod[slot] != MOVE_LOD_FULL) {
+            vec2_t vnew = lod_velocity(curr, slot, flock);
+            update_vel_hist(slot, vnew);
+            s_ms.vnew[slot] = vnew;
+            continue;
+        }
+
+        s_ms.vdes[slot] = ent_desired_velocity(curr, slot);
+
+        vec2_t pos_xz = G_Pos_GetXZ(curr->uid);
+        dest_id_t dest_id = (s_ms.state[slot] == STATE_SEEK_ENEMIES) ? DEST_ID_INVALID : flock->dest_id;
+        s_ms.dest_los[slot] = M_NavHasDestLOS(s_map, dest_id, pos_xz);
+
+        bool crowd = use_crowd_steering(curr, flock);
+        ncrowd += crowd;
+        vec_work_push(&s_move_work, (struct move_work){curr, slot, flock, crowd});
+    }
+
+    build_neighbour_grid();
+    build_flock_grids();
+
+    /* Without the density field, everyone falls back to ClearPath */
+    if(ncrowd > 0 && !build_crowd_grid()) {
+        for(int i = 0; i < vec_size(&s_move_work); i++)
+            vec_AT(&s_move_work, i).crowd = false;
+    }
+    compute_new_velocities();
+
+    /* Entities leave the active set as they arrive. Iterating backwards, the 
+     * slot taking the place of a removed one has already been visited. */
+    for(int i = s_ms.nactive - 1; i >= 0; i--) {
+
+        if(i >= s_ms.nactive)
+            continue;
     
-        struct movestate *ms = movestate_get(curr);
-        assert(ms);
+        int slot = s_ms.active[i];
+        struct entity *curr = s_ms.ent[slot];
+        struct flock *flock = flock_for_ent(curr);
+        if(flock && flock_path_pending(flock))
+            continue;
 
-        entity_update(curr, ms->vnew);
-    });
+        if(lod_skip_tick(slot))
+            continue;
 
-    vec_cp_ent_destroy(&dyn);
-    vec_cp_ent_destroy(&stat);
+        entity_update(curr, slot, s_ms.vnew[slot], lod_nticks(slot));
+    }
+
+    /* The entities that stopped or started moving during the tick have their
+     * blocker changes applied in one go, with each tile touched once */
+    M_NavBlockersFlush(s_map);
+
+    s_move_stats.tick_ms += elapsed_ms(start);
+    PERF_RETURN_VOID();
+}
+
+static const struct entity *remapped(const khash_t(entity) *remap, uint32_t uid)
+{
+    khiter_t k = kh_get(entity, remap, uid);
+    if(k == kh_end(remap))
+        return NULL;
+    return kh_value(remap, k);
+}
+
+/* Brings a moving entity which could not be put back into its' flock to a halt */
+static void movestate_settle(const struct entity *ent, int slot)
+{
+    if(ent_still(slot))
+        return;
+
+    movestate_set_state(slot, STATE_ARRIVED);
+    s_ms.velocity[slot] = (vec2_t){0.0f, 0.0f};
+    s_ms.vnew[slot] = (vec2_t){0.0f, 0.0f};
+    entity_block(ent);
+}
+
+static bool movestate_restore(const struct entity *ent, int slot, const struct move_rec *rec)
+{
+    if(rec->state < STATE_MOVING || rec->state > STATE_WAITING)
+        return false;
+    if(rec->wait_prev < STATE_MOVING || rec->wait_prev > STATE_WAITING)
+        return false;
+    if(rec->vel_hist_idx < 0 || rec->vel_hist_idx >= VEL_HIST_LEN)
+        return false;
+
+    /* The entity became a blocker at the position it was added at */
+    if(s_ms.blocking[slot])
+        entity_unblock(ent);
+
+    s_ms.velocity[slot] = rec->velocity;
+    s_ms.vnew[slot] = rec->velocity;
+    s_ms.wait_prev[slot] = rec->wait_prev;
+    s_ms.wait_ticks_left[slot] = rec->wait_ticks_left;
+    memcpy(s_ms.vel_hist[slot], rec->vel_hist, sizeof(s_ms.vel_hist[slot]));
+    s_ms.vel_hist_idx[slot] = rec->vel_hist_idx;
+    movestate_set_state(slot, rec->state);
+
+    if(rec->blocking) {
+        M_NavBlockersBatchIncref(rec->last_stop_pos, ent->selection_radius, s_map);
+        s_ms.blocking[slot] = true;
+        s_ms.last_stop_pos[slot] = rec->last_stop_pos;
+    }
+    return true;
+}
+
+static void flock_restore(const struct flock_rec *rec, const uint32_t *uids, 
+                          const khash_t(entity) *remap)
+{
+    struct entity *members[rec->nmembers + 1];
+    size_t nmembers = 0;
+
+    for(int i = 0; i < rec->nmembers; i++) {
+
+        const struct entity *ent = remapped(remap, uids[i]);
+        if(!ent || movestate_slot(ent) < 0 || flock_for_ent(ent))
+            continue;
+        members[nmembers++] = (struct entity*)ent;
+    }
+    if(nmembers == 0)
+        return;
+
+    dest_id_t dest_id = M_NavDestIDForPos(s_map, rec->target_xz);
+    struct flock *flock = flock_for_dest(dest_id);
+
+    /* There is only one flock per destination in a saved state, but the 
+     * state may be loaded on top of entities which are already moving */
+    if(flock) {
+        for(int i = 0; i < nmembers; i++) {
+            flock_add(flock, members[i]);
+        }
+        return;
+    }
+
+    if((flock = flock_new(rec->target_xz, dest_id))) {
+
+        vec2_t srcs[nmembers];
+        flock->crowd = rec->crowd;
+
+        for(int i = 0; i < nmembers; i++) {
+            flock_add(flock, members[i]);
+            srcs[i] = G_Pos_GetXZ(members[i]->uid);
+        }
+        flock->path = flock_request_path(srcs, nmembers, rec->target_xz);
+
+        if(flock_register(flock))
+            return;
+
+        for(int i = 0; i < nmembers; i++) {
+            s_ms.flock[movestate_slot(members[i])] = NULL;
+        }
+        flock_free(flock);
+    }
+
+    for(int i = 0; i < nmembers; i++) {
+        movestate_settle(members[i], movestate_slot(members[i]));
+    }
 }
 
 /*****************************************************************************/
@@ -1203,11 +2582,42 @@ static void on_20hz_tick(void *user, void *event)
 bool G_Move_Init(const struct map *map)
 {
     assert(map);
-    if(NULL == (s_entity_state_table = kh_init(state))) {
+    if(!init_debug_settings())
+        return false;
+
+#if CONFIG_SWISS_STATE_TABLES
+    sm_slot_init(&s_slot_table);
+#else
+    if(NULL == (s_slot_table = kh_init(slot))) {
+        return false;
+    }
+#endif
+    if(NULL == (s_grid_cells = kh_init(cell))) {
+#if CONFIG_SWISS_STATE_TABLES
+        sm_slot_destroy(&s_slot_table);
+#else
+        kh_destroy(slot, s_slot_table);
+#endif
+        return false;
+    }
+    if(NULL == (s_dest_flocks = kh_init(dflock))) {
+        kh_destroy(cell, s_grid_cells);
+#if CONFIG_SWISS_STATE_TABLES
+        sm_slot_destroy(&s_slot_table);
+#else
+        kh_destroy(slot, s_slot_table);
+#endif
         return false;
     }
     vec_pentity_init(&s_move_markers);
-    vec_flock_init(&s_flocks);
+    vec_pflock_init(&s_flocks);
+    vec_work_init(&s_move_work);
+
+    for(int i = 0; i < ARR_SIZE(s_move_jobs); i++) {
+        vec_cp_ent_init(&s_move_jobs[i].dyn);
+        vec_cp_ent_init(&s_move_jobs[i].stat);
+        G_ClearPath_ScratchInit(&s_move_jobs[i].scratch);
+    }
 
     E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mousedown, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_3D, on_render_3d, NULL, G_RUNNING | G_PAUSED_FULL | G_PAUSED_UI_RUNNING);
@@ -1217,6 +2627,22 @@ bool G_Move_Init(const struct map *map)
     return true;
 }
 
+void G_Move_SetCrowdMode(const struct entity *ent, enum move_crowd_mode mode)
+{
+    if(!s_map)
+        return;
+
+    struct flock *flock = flock_for_ent(ent);
+    if(flock)
+        flock->crowd = mode;
+}
+
+void G_Move_GetStats(struct move_stats *out_stats)
+{
+    *out_stats = s_move_stats;
+    out_stats->cp_scratch_high_water = G_ClearPath_ScratchHighWater();
+}
+
 void G_Move_Shutdown(void)
 {
     s_map = NULL;
@@ -1231,53 +2657,61 @@ void G_Move_Shutdown(void)
         G_SafeFree(vec_AT(&s_move_markers, i));
     }
 
-    vec_flock_destroy(&s_flocks);
+    for(int i = 0; i < ARR_SIZE(s_move_jobs); i++) {
+        vec_cp_ent_destroy(&s_move_jobs[i].dyn);
+        vec_cp_ent_destroy(&s_move_jobs[i].stat);
+        G_ClearPath_ScratchDestroy(&s_move_jobs[i].scratch);
+    }
+
+    vec_work_destroy(&s_move_work);
+    kh_destroy(cell, s_grid_cells);
+    free(s_crowd.cells);
+    s_crowd = (struct crowd_grid){0};
+    for(int i = 0; i < vec_size(&s_flocks); i++) {
+        flock_free(vec_AT(&s_flocks, i));
+    }
+    vec_pflock_destroy(&s_flocks);
+    kh_destroy(dflock, s_dest_flocks);
     vec_pentity_destroy(&s_move_markers);
-    kh_destroy(state, s_entity_state_table);
+    movestate_pool_destroy();
+#if CONFIG_SWISS_STATE_TABLES
+    sm_slot_destroy(&s_slot_table);
+#else
+    kh_destroy(slot, s_slot_table);
+#endif
 }
 
 void G_Move_AddEntity(const struct entity *ent)
 {
-    struct movestate new_ms = (struct movestate) {
-        .velocity = {0.0f}, 
-        .blocking = false,
-        .last_stop_pos = G_Pos_GetXZ(ent->uid),
-        .state = STATE_ARRIVED,
-        .vel_hist_idx = 0,
-    };
-    memset(new_ms.vel_hist, 0, sizeof(new_ms.vel_hist));
-
-    int ret;
-    khiter_t k = kh_put(state, s_entity_state_table, ent->uid, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(s_entity_state_table, k) = new_ms;
+    int slot = movestate_add(ent);
+    assert(slot >= 0);
+    (void)slot;
 
     entity_block(ent);
 }
 
 void G_Move_RemoveEntity(const struct entity *ent)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    if(k == kh_end(s_entity_state_table))
+    if(movestate_slot(ent) < 0)
         return;
 
     G_Move_Stop(ent);
     entity_unblock(ent);
 
-    kh_del(state, s_entity_state_table, k);
+    movestate_remove(movestate_slot(ent));
 }
 
 void G_Move_Stop(const struct entity *ent)
 {
-    struct movestate *ms = movestate_get(ent);
-    if(!ms)
+    int slot = movestate_slot(ent);
+    if(slot < 0)
         return;
 
-    if(!ent_still(ms))
+    if(!ent_still(slot))
         entity_finish_moving(ent, STATE_ARRIVED);
 
     remove_from_flocks(ent);
-    ms->state = STATE_ARRIVED;
+    movestate_set_state(slot, STATE_ARRIVED);
 }
 
 bool G_Move_GetDest(const struct entity *ent, vec2_t *out_xz)
@@ -1310,13 +2744,13 @@ void G_Move_SetDest(const struct entity *ent, vec2_t dest_xz)
         remove_from_flocks(ent);
         flock_add(fl, ent);
 
-        struct movestate *ms = movestate_get(ent);
-        assert(ms);
-        if(ent_still(ms)) {
+        int slot = movestate_slot(ent);
+        assert(slot >= 0);
+        if(ent_still(slot)) {
             entity_unblock(ent);
             E_Entity_Notify(EVENT_MOTION_START, ent->uid, NULL, ES_ENGINE);
         }
-        ms->state = STATE_MOVING;
+        movestate_set_state(slot, STATE_MOVING);
         assert(flock_for_ent(ent));
         return;
     }
@@ -1345,29 +2779,156 @@ void G_Move_SetAttackOnLeftClick(void)
     Cursor_SetRTSPointer(CURSOR_TARGET);
 }
 
-void G_Move_SetSeekEnemies(const struct entity *ent)
+void G_Move_Order(const vec_pentity_t *sel, vec3_t target, bool attack)
 {
-    struct movestate *ms = movestate_get(ent);
-    assert(ms);
+    if(vec_size(sel) == 0)
+        return;
 
-    /* Remove this entity from any existing flocks */
-    for(int i = vec_size(&s_flocks)-1; i >= 0; i--) {
+    for(int i = 0; i < vec_size(sel); i++) {
 
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);
-        flock_try_remove(curr_flock, ent);
+        const struct entity *curr = vec_AT(sel, i);
+        if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
+            continue;
 
-        if(kh_size(curr_flock->ents) == 0) {
-            kh_destroy(entity, curr_flock->ents);
-            vec_flock_del(&s_flocks, i);
-        }
+        G_Combat_ClearSavedMoveCmd(curr);
+        G_Combat_SetStance(curr, attack ? COMBAT_STANCE_AGGRESSIVE : COMBAT_STANCE_NO_ENGAGEMENT);
     }
-    assert(NULL == flock_for_ent(ent));
 
-    if(ent_still(ms)) {
+    move_marker_add(target, attack);
+    make_flock_from_selection(sel, (vec2_t){target.x, target.z}, attack);
+}
+
+void G_Move_SetSeekEnemies(const struct entity *ent)
+{
+    int slot = movestate_slot(ent);
+    assert(slot >= 0);
+
+    remove_from_flocks(ent);
+
+    if(ent_still(slot)) {
         entity_unblock(ent);
         E_Entity_Notify(EVENT_MOTION_START, ent->uid, NULL, ES_ENGINE);
     }
 
-    ms->state = STATE_SEEK_ENEMIES;
+    movestate_set_state(slot, STATE_SEEK_ENEMIES);
+}
+
+bool G_Move_SaveState(SDL_RWops *stream)
+{
+    uint64_t nents = s_ms.size;
+    uint64_t nflocks = vec_size(&s_flocks);
+
+    uint64_t size = sizeof(nents) + nents * sizeof(struct move_rec) + sizeof(nflocks);
+    for(int i = 0; i < nflocks; i++) {
+        size += sizeof(struct flock_rec) + kh_size(vec_AT(&s_flocks, i)->ents) * sizeof(uint32_t);
+    }
+
+    struct move_rec *recs = malloc(sizeof(struct move_rec) * nents + 1);
+    if(!recs)
+        return false;
+
+    for(int i = 0; i < nents; i++) {
+
+        recs[i] = (struct move_rec){
+            .uid = s_ms.ent[i]->uid,
+            .state = s_ms.state[i],
+            .wait_prev = s_ms.wait_prev[i],
+            .wait_ticks_left = s_ms.wait_ticks_left[i],
+            .vel_hist_idx = s_ms.vel_hist_idx[i],
+            .blocking = s_ms.blocking[i],
+            .velocity = s_ms.velocity[i],
+            .last_stop_pos = s_ms.last_stop_pos[i],
+        };
+        memcpy(recs[i].vel_hist, s_ms.vel_hist[i], sizeof(recs[i].vel_hist));
+    }
+
+    bool ret = G_WriteSection(stream, STATE_TAG_MOVEMENT, STATE_VERSION, size)
+            && SDL_RWwrite(stream, &nents, sizeof(nents), 1) == 1
+            && (nents == 0 || SDL_RWwrite(stream, recs, sizeof(struct move_rec), nents) == nents)
+            && SDL_RWwrite(stream, &nflocks, sizeof(nflocks), 1) == 1;
+    free(recs);
+
+    for(int i = 0; ret && i < nflocks; i++) {
+
+        const struct flock *curr = vec_AT(&s_flocks, i);
+        struct flock_rec rec = (struct flock_rec){
+            .target_xz = curr->target_xz,
+            .crowd = curr->crowd,
+            .nmembers = kh_size(curr->ents),
+        };
+
+        uint32_t uids[rec.nmembers + 1];
+        size_t nmembers = 0;
+        uint32_t key;
+        struct entity *ent;
+        (void)ent;
+
+        kh_foreach(curr->ents, key, ent, { uids[nmembers++] = key; });
+        ret = SDL_RWwrite(stream, &rec, sizeof(rec), 1) == 1
+           && (nmembers == 0 || SDL_RWwrite(stream, uids, sizeof(uint32_t), nmembers) == nmembers);
+    }
+    return ret;
 }
 
+bool G_Move_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                      const khash_t(entity) *remap)
+{
+    uint64_t nents;
+    if(hdr->version != STATE_VERSION)
+        return false;
+    if(SDL_RWread(stream, &nents, sizeof(nents), 1) != 1)
+        return false;
+    if(nents > hdr->size / sizeof(struct move_rec))
+        return false;
+
+    struct move_rec *recs = malloc(sizeof(struct move_rec) * nents + 1);
+    if(!recs)
+        return false;
+
+    if(nents > 0 && SDL_RWread(stream, recs, sizeof(struct move_rec), nents) != nents) {
+        free(recs);
+        return false;
+    }
+
+    bool ret = true;
+    for(int i = 0; ret && i < nents; i++) {
+
+        const struct entity *ent = remapped(remap, recs[i].uid);
+        if(!ent || movestate_slot(ent) < 0)
+            continue;
+        ret = movestate_restore(ent, movestate_slot(ent), &recs[i]);
+    }
+    free(recs);
+
+    uint64_t nflocks;
+    if(!ret || SDL_RWread(stream, &nflocks, sizeof(nflocks), 1) != 1)
+        return false;
+
+    for(int i = 0; i < nflocks; i++) {
+
+        struct flock_rec rec;
+        if(SDL_RWread(stream, &rec, sizeof(rec), 1) != 1)
+            return false;
+        if(rec.nmembers > hdr->size / sizeof(uint32_t))
+            return false;
+
+        uint32_t *uids = malloc(sizeof(uint32_t) * rec.nmembers + 1);
+        if(!uids)
+            return false;
+
+        if(rec.nmembers > 0 
+        && SDL_RWread(stream, uids, sizeof(uint32_t), rec.nmembers) != rec.nmembers) {
+            free(uids);
+            return false;
+        }
+        flock_restore(&rec, uids, remap);
+        free(uids);
+    }
+
+    /* Every moving entity is a member of some flock */
+    for(int i = 0; i < s_ms.size; i++) {
+        if(s_ms.state[i] == STATE_MOVING && !s_ms.flock[i])
+            movestate_settle(s_ms.ent[i], i);
+    }
+    return true;
+}
@@ -37,12 +37,14 @@
 #define MOVEMENT_H
 
 #include "../pf_math.h"
+#include "public/game.h"
 #include <stdbool.h>
 
 #define MOVE_TICK_RES (20)
 
 struct map;
 struct entity;
+struct state_section;
 
 bool G_Move_Init(const struct map *map);
 void G_Move_Shutdown(void);
@@ -54,6 +56,17 @@ void G_Move_Stop(const struct entity *ent);
 bool G_Move_GetDest(const struct entity *ent, vec2_t *out_xz);
 
 void G_Move_SetSeekEnemies(const struct entity *ent);
+/* Sends the entities to the target in a single flock, the way the player's 
+ * move and attack orders are carried out. */
+void G_Move_Order(const vec_pentity_t *sel, vec3_t target, bool attack);
+
+/* Writes the movement states and flocks of the entities as a state section. 
+ * On load, the saved UIDs are mapped to the recreated entities with 'remap', 
+ * which must already be in the simulation. The navigation blockers are 
+ * restored along with the entities' states. */
+bool G_Move_SaveState(SDL_RWops *stream);
+bool G_Move_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                      const khash_t(entity) *remap);
 
 #endif
 
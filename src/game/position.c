@@ -35,6 +35,7 @@
 
 #include "game_private.h"
 #include "public/game.h"
+#include "timer_events.h"
 #include "../main.h"
 #include "../pf_math.h"
 #include "../lib/public/quadtree.h"
@@ -42,20 +43,41 @@
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
 
+#include <SDL.h>
+
 #include <assert.h>
 #include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 
+#define POSTREE_BUCKET_SZ (16)
 
-QUADTREE_TYPE(ent, uint32_t)
-QUADTREE_PROTOTYPES(static, ent, uint32_t)
-QUADTREE_IMPL(static, ent, uint32_t)
+QUADTREE_LINEAR_TYPE(ent, uint32_t, POSTREE_BUCKET_SZ)
+QUADTREE_LINEAR_PROTOTYPES(static, ent, uint32_t)
+QUADTREE_LINEAR_IMPL(static, ent, uint32_t)
 
 KHASH_MAP_INIT_INT(pos, vec3_t)
+KHASH_MAP_INIT_INT(faction, int)
+
+/* An entity that was stepped from 'from' to its' current position at the 
+ * simulation tick 'tick', to be drawn in between for the following 'nticks' */
+struct pos_interp{
+    vec3_t             from;
+    unsigned long long tick;
+    int                nticks;
+};
+
+KHASH_MAP_INIT_INT(interp, struct pos_interp)
 
 #define POSBUF_INIT_SIZE (16384)
 #define MAX_SEARCH_ENTS  (8192)
-#define MAX(a, b)        ((a) < (b) ? (a) : (b))
+#define ENEMY_SEARCH_MIN (8.0f)
+#define MAX(a, b)        ((a) > (b) ? (a) : (b))
+#define MIN(a, b)        ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)      (sizeof(a)/sizeof(a[0]))
+#define STATE_VERSION    (1)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -64,6 +86,17 @@ KHASH_MAP_INIT_INT(pos, vec3_t)
 static khash_t(pos) *s_postable;
 /* The quadtree is always synchronized with the postable, at function call boundaries */
 static qt_ent_t      s_postree;
+/* Each faction's entities are additionally kept in a quadtree of their own, 
+ * so that the queries for hostile entities never visit allied ones. The 
+ * factiontable holds the faction under which each entity was inserted. */
+static khash_t(faction) *s_factiontable;
+static qt_ent_t          s_faction_postrees[MAX_FACTIONS];
+static khash_t(interp)  *s_interptable;
+/* A sphere of this radius about its' position bounds the (bind pose) volume 
+ * of every entity that was placed, and all the positions lie between these 
+ * heights. The bounds only ever grow. */
+static float             s_vol_radius;
+static float             s_min_y = FLT_MAX, s_max_y = -FLT_MAX;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -74,25 +107,108 @@ static bool any_ent(const struct entity *ent, void *arg)
     return true;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+static struct entity *ent_for_uid(uint32_t uid)
+{
+    const khash_t(entity) *ents = G_GetAllEntsSet();
+    khiter_t k = kh_get(entity, ents, uid);
+    if(k == kh_end(ents))
+        return NULL;
+    return kh_val(ents, k);
+}
 
-bool G_Pos_Set(uint32_t uid, vec3_t pos)
+static void faction_tree_delete(uint32_t uid, vec3_t pos)
 {
-    ASSERT_IN_MAIN_THREAD();
+    khiter_t k = kh_get(faction, s_factiontable, uid);
+    if(k == kh_end(s_factiontable))
+        return;
 
-    khiter_t k = kh_get(pos, s_postable, uid);
-    bool overwrite = (k != kh_end(s_postable));
+    int faction_id = kh_val(s_factiontable, k);
+    kh_del(faction, s_factiontable, k);
 
-    if(overwrite) {
-        vec3_t old_pos = kh_val(s_postable, k);
-        bool ret = qt_ent_delete(&s_postree, old_pos.x, old_pos.z, uid);
+    bool ret = qt_ent_delete(&s_faction_postrees[faction_id], pos.x, pos.z, uid);
+    assert(ret);
+    (void)ret;
+}
+
+static bool faction_tree_insert(uint32_t uid, vec3_t pos, int faction_id)
+{
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return true;
+
+    if(!qt_ent_insert(&s_faction_postrees[faction_id], pos.x, pos.z, uid))
+        return false;
+
+    int status;
+    khiter_t k = kh_put(faction, s_factiontable, uid, &status);
+    if(status == -1) {
+        qt_ent_delete(&s_faction_postrees[faction_id], pos.x, pos.z, uid);
+        return false;
+    }
+    kh_val(s_factiontable, k) = faction_id;
+    return true;
+}
+
+/* Moves the entity's record within its' faction's quadtree. Entities which are 
+ * not yet in one are added under their current faction.
+ */
+static bool faction_tree_update(uint32_t uid, vec3_t old_pos, vec3_t new_pos)
+{
+    khiter_t k = kh_get(faction, s_factiontable, uid);
+    if(k != kh_end(s_factiontable)) {
+
+        int faction_id = kh_val(s_factiontable, k);
+        qt_ent_t *tree = &s_faction_postrees[faction_id];
+
+        if(qt_ent_move(tree, old_pos.x, old_pos.z, new_pos.x, new_pos.z, uid))
+            return true;
+
+        bool ret = qt_ent_delete(tree, old_pos.x, old_pos.z, uid);
         assert(ret);
+        (void)ret;
+
+        kh_del(faction, s_factiontable, k);
+        return false;
     }
 
-    if(!qt_ent_insert(&s_postree, pos.x, pos.z, uid))
+    const struct entity *ent = ent_for_uid(uid);
+    if(!ent)
+        return true;
+    return faction_tree_insert(uid, new_pos, ent->faction_id);
+}
+
+static void interp_clear(uint32_t uid)
+{
+    khiter_t k = kh_get(interp, s_interptable, uid);
+    if(k != kh_end(s_interptable))
+        kh_del(interp, s_interptable, k);
+}
+
+static void vol_bounds_grow(const struct entity *ent, vec3_t pos)
+{
+    const struct aabb *aabb = &ent->identity_aabb;
+    float x = fmaxf(fabsf(aabb->x_min), fabsf(aabb->x_max));
+    float y = fmaxf(fabsf(aabb->y_min), fabsf(aabb->y_max));
+    float z = fmaxf(fabsf(aabb->z_min), fabsf(aabb->z_max));
+    float scale = fmaxf(fabsf(ent->scale.x), fmaxf(fabsf(ent->scale.y), fabsf(ent->scale.z)));
+
+    s_vol_radius = fmaxf(s_vol_radius, sqrtf(x*x + y*y + z*z) * scale);
+    s_min_y = fminf(s_min_y, pos.y);
+    s_max_y = fmaxf(s_max_y, pos.y);
+}
+
+static bool pos_set(uint32_t uid, vec3_t pos)
+{
+    khiter_t k = kh_get(pos, s_postable, uid);
+    bool overwrite = (k != kh_end(s_postable));
+
+    vec3_t old_pos = overwrite ? kh_val(s_postable, k) : pos;
+    if(overwrite) {
+        /* On failure, the entity is left at its' old position */
+        if(!qt_ent_move(&s_postree, old_pos.x, old_pos.z, pos.x, pos.z, uid))
+            return false;
+    }else if(!qt_ent_insert(&s_postree, pos.x, pos.z, uid)) {
         return false;
+    }
 
     if(!overwrite) {
         int ret;
@@ -106,12 +222,86 @@ bool G_Pos_Set(uint32_t uid, vec3_t pos)
 
     kh_val(s_postable, k) = pos;
     assert(kh_size(s_postable) == s_postree.nrecs);
+
+    struct entity *ent = ent_for_uid(uid);
+    if(ent) {
+        Entity_InvalidateModel(ent);
+        vol_bounds_grow(ent, pos);
+        G_Scenery_Update(ent);
+    }
+
+    /* The faction index is only an acceleration structure. An entity that is 
+     * missing from it is merely not found by the enemy queries. */
+    faction_tree_update(uid, old_pos, pos);
     return true; 
 }
 
-vec3_t G_Pos_Get(uint32_t uid)
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Pos_Set(uint32_t uid, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!pos_set(uid, pos))
+        return false;
+    interp_clear(uid);
+    return true;
+}
+
+bool G_Pos_Step(uint32_t uid, vec3_t pos, int nticks)
 {
     ASSERT_IN_MAIN_THREAD();
+    assert(nticks > 0);
+
+    khiter_t k = kh_get(pos, s_postable, uid);
+    if(k == kh_end(s_postable))
+        return G_Pos_Set(uid, pos);
+
+    /* Start from where the entity is currently drawn, so that a step taken 
+     * before the previous one has been fully drawn does not jump ahead */
+    vec3_t from = G_Pos_GetRender(uid);
+    if(!pos_set(uid, pos))
+        return false;
+
+    int ret;
+    k = kh_put(interp, s_interptable, uid, &ret);
+    if(ret == -1)
+        return true; /* The entity is just not interpolated */
+
+    kh_val(s_interptable, k) = (struct pos_interp){
+        .from = from,
+        .tick = G_Timer_Ticks(),
+        .nticks = nticks,
+    };
+    return true;
+}
+
+vec3_t G_Pos_GetRender(uint32_t uid)
+{
+    ASSERT_MAIN_THREAD_READ();
+
+    vec3_t pos = G_Pos_Get(uid);
+    khiter_t k = kh_get(interp, s_interptable, uid);
+    if(k == kh_end(s_interptable))
+        return pos;
+
+    const struct pos_interp *pi = &kh_val(s_interptable, k);
+    float alpha = ((G_Timer_Ticks() - pi->tick) + G_Timer_Alpha()) / pi->nticks;
+    if(alpha >= 1.0f)
+        return pos;
+
+    vec3_t delta, ret;
+    PFM_Vec3_Sub(&pos, (vec3_t*)&pi->from, &delta);
+    PFM_Vec3_Scale(&delta, alpha, &delta);
+    PFM_Vec3_Add((vec3_t*)&pi->from, &delta, &ret);
+    return ret;
+}
+
+vec3_t G_Pos_Get(uint32_t uid)
+{
+    ASSERT_MAIN_THREAD_READ();
 
     khiter_t k = kh_get(pos, s_postable, uid);
     assert(k != kh_end(s_postable));
@@ -120,7 +310,7 @@ vec3_t G_Pos_Get(uint32_t uid)
 
 vec2_t G_Pos_GetXZ(uint32_t uid)
 {
-    ASSERT_IN_MAIN_THREAD();
+    ASSERT_MAIN_THREAD_READ();
 
     khiter_t k = kh_get(pos, s_postable, uid);
     assert(k != kh_end(s_postable));
@@ -141,6 +331,22 @@ void G_Pos_Delete(uint32_t uid)
     bool ret = qt_ent_delete(&s_postree, pos.x, pos.z, uid);
     assert(ret);
     assert(kh_size(s_postable) == s_postree.nrecs);
+
+    faction_tree_delete(uid, pos);
+    interp_clear(uid);
+}
+
+bool G_Pos_UpdateFaction(const struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    khiter_t k = kh_get(pos, s_postable, ent->uid);
+    if(k == kh_end(s_postable))
+        return true;
+
+    vec3_t pos = kh_val(s_postable, k);
+    faction_tree_delete(ent->uid, pos);
+    return faction_tree_insert(ent->uid, pos, ent->faction_id);
 }
 
 bool G_Pos_Init(const struct map *map)
@@ -163,22 +369,159 @@ bool G_Pos_Init(const struct map *map)
     float zmax = center.z + (res.tile_h * res.chunk_h * Z_COORDS_PER_TILE) / 2.0f;
 
     qt_ent_init(&s_postree, xmin, xmax, zmin, zmax);
-    if(!qt_ent_reserve(&s_postree, POSBUF_INIT_SIZE)) {
-        kh_destroy(pos, s_postable);
-        return false;
-    }
+    s_vol_radius = 0.0f;
+    s_min_y = FLT_MAX;
+    s_max_y = -FLT_MAX;
+
+    if(!qt_ent_reserve(&s_postree, POSBUF_INIT_SIZE))
+        goto fail_postree;
+
+    if(NULL == (s_factiontable = kh_init(faction)))
+        goto fail_factiontable;
+
+    if(NULL == (s_interptable = kh_init(interp)))
+        goto fail_interptable;
+
+    for(int i = 0; i < MAX_FACTIONS; i++)
+        qt_ent_init(&s_faction_postrees[i], xmin, xmax, zmin, zmax);
 
     return true;
+
+fail_interptable:
+    kh_destroy(faction, s_factiontable);
+fail_factiontable:
+    qt_ent_destroy(&s_postree);
+fail_postree:
+    kh_destroy(pos, s_postable);
+    return false;
+}
+
+bool G_Pos_Reserve(size_t nents)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    /* Size the tables to stay below their' load factor with the new entries */
+    khint_t postable_size = (kh_size(s_postable) + nents) * 4 / 3 + 1;
+    khint_t factiontable_size = (kh_size(s_factiontable) + nents) * 4 / 3 + 1;
+
+    if(kh_resize(pos, s_postable, postable_size) < 0)
+        return false;
+    if(kh_resize(faction, s_factiontable, factiontable_size) < 0)
+        return false;
+    return qt_ent_reserve(&s_postree, s_postree.nrecs + nents);
 }
 
 void G_Pos_Shutdown(void)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    for(int i = 0; i < MAX_FACTIONS; i++)
+        qt_ent_destroy(&s_faction_postrees[i]);
+    kh_destroy(faction, s_factiontable);
+    kh_destroy(interp, s_interptable);
+
     kh_destroy(pos, s_postable);
     qt_ent_destroy(&s_postree);
 }
 
+bool G_Pos_SaveState(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    bool ret = false;
+    uint64_t nents = kh_size(s_postable);
+    uint32_t *uids = malloc(sizeof(uint32_t) * nents + 1);
+    vec3_t *pos = malloc(sizeof(vec3_t) * nents + 1);
+    if(!uids || !pos)
+        goto out;
+
+    size_t i = 0;
+    uint32_t key;
+    vec3_t curr;
+
+    kh_foreach(s_postable, key, curr, {
+        uids[i] = key;
+        pos[i] = curr;
+        i++;
+    });
+
+    uint64_t size = sizeof(nents) + nents * (sizeof(uint32_t) + sizeof(vec3_t));
+    ret = G_WriteSection(stream, STATE_TAG_POSITION, STATE_VERSION, size)
+       && SDL_RWwrite(stream, &nents, sizeof(nents), 1) == 1
+       && (nents == 0 
+           || (SDL_RWwrite(stream, uids, sizeof(uint32_t), nents) == nents
+            && SDL_RWwrite(stream, pos, sizeof(vec3_t), nents) == nents));
+
+out:
+    free(uids);
+    free(pos);
+    return ret;
+}
+
+bool G_Pos_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                     const khash_t(entity) *remap)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    uint64_t nents;
+    if(hdr->version != STATE_VERSION)
+        return false;
+    if(SDL_RWread(stream, &nents, sizeof(nents), 1) != 1)
+        return false;
+    if(nents > hdr->size
+    || hdr->size != sizeof(nents) + nents * (sizeof(uint32_t) + sizeof(vec3_t)))
+        return false;
+
+    bool ret = false;
+    uint32_t *uids = malloc(sizeof(uint32_t) * nents + 1);
+    vec3_t *pos = malloc(sizeof(vec3_t) * nents + 1);
+    if(!uids || !pos)
+        goto out;
+
+    if(nents > 0
+    && (SDL_RWread(stream, uids, sizeof(uint32_t), nents) != nents
+     || SDL_RWread(stream, pos, sizeof(vec3_t), nents) != nents))
+        goto out;
+
+    for(size_t i = 0; i < nents; i++) {
+
+        /* Some entities, such as the move markers, are not recreated */
+        khiter_t k = kh_get(entity, remap, uids[i]);
+        if(k == kh_end(remap))
+            continue;
+
+        const struct entity *ent = kh_value(remap, k);
+        khiter_t p = kh_get(pos, s_postable, ent->uid);
+        if(p == kh_end(s_postable))
+            continue;
+
+        /* The entities are usually added at their' saved positions already */
+        vec3_t curr = kh_val(s_postable, p);
+        if(0 == memcmp(&curr, &pos[i], sizeof(vec3_t)))
+            continue;
+
+        if(!pos_set(ent->uid, pos[i]))
+            goto out;
+    }
+    ret = true;
+
+out:
+    free(uids);
+    free(pos);
+    return ret;
+}
+
+bool G_Pos_VolumeBounds(float *out_radius, float *out_min_y, float *out_max_y)
+{
+    if(s_min_y > s_max_y)
+        return false;
+
+    *out_radius = s_vol_radius;
+    *out_min_y = s_min_y;
+    *out_max_y = s_max_y;
+    return true;
+}
+
 int G_Pos_EntsInRect(vec2_t xz_min, vec2_t xz_max, struct entity **out, size_t maxout)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -233,6 +576,62 @@ int G_Pos_EntsInCircle(vec2_t xz_point, float range, struct entity **out, size_t
     return ret;
 }
 
+int G_Pos_EntsInCircleBatch(const struct pos_circle_query *queries, size_t nqueries, 
+                            size_t maxout_per_query, struct entity **out, int *out_offsets,
+                            bool *out_truncated)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    int ret = -1;
+    struct qt_circle_query *qt_queries = malloc(nqueries * sizeof(struct qt_circle_query));
+    uint32_t *ent_ids = malloc(nqueries * maxout_per_query * sizeof(uint32_t));
+    int *counts = malloc(nqueries * sizeof(int));
+
+    if(!qt_queries || !ent_ids || !counts)
+        goto fail;
+
+    for(int i = 0; i < nqueries; i++) {
+        qt_queries[i] = (struct qt_circle_query){
+            queries[i].xz_point.x, 
+            queries[i].xz_point.z, 
+            queries[i].range
+        };
+    }
+
+    if(!qt_ent_inrange_circle_batch(&s_postree, qt_queries, nqueries, ent_ids, 
+        maxout_per_query, counts))
+        goto fail;
+
+    /* Compact the per-query results, applying the predicates */
+    ret = 0;
+    for(int i = 0; i < nqueries; i++) {
+
+        out_offsets[i] = ret;
+        if(out_truncated)
+            out_truncated[i] = (counts[i] == maxout_per_query);
+
+        bool (*predicate)(const struct entity*, void*) = queries[i].predicate 
+                                                       ? queries[i].predicate 
+                                                       : any_ent;
+
+        for(int j = 0; j < counts[i]; j++) {
+
+            struct entity *curr = ent_for_uid(ent_ids[i * maxout_per_query + j]);
+            assert(curr);
+            if(!predicate(curr, queries[i].arg))
+                continue;
+            out[ret++] = curr;
+        }
+    }
+    out_offsets[nqueries] = ret;
+
+fail:
+    free(qt_queries);
+    free(ent_ids);
+    free(counts);
+    return ret;
+}
+
 struct entity *G_Pos_NearestWithPred(vec2_t xz_point, 
                                      bool (*predicate)(const struct entity *ent, void *arg), 
                                      void *arg)
@@ -282,3 +681,64 @@ struct entity *G_Pos_Nearest(vec2_t xz_point)
     return G_Pos_NearestWithPred(xz_point, any_ent, NULL);
 }
 
+struct entity *G_Pos_NearestEnemy(vec2_t xz_point, int faction_id, float max_range)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    uint32_t ent_ids[MAX_SEARCH_ENTS];
+    bool hostile[MAX_FACTIONS] = {0};
+    bool any_hostile = false;
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+
+        enum diplomacy_state ds;
+        if(i == faction_id || s_faction_postrees[i].nrecs == 0)
+            continue;
+        if(!G_GetDiplomacyState(faction_id, i, &ds) || ds != DIPLOMACY_STATE_WAR)
+            continue;
+        hostile[i] = any_hostile = true;
+    }
+
+    if(!any_hostile)
+        return NULL;
+
+    /* Grow the search radius until there is a hit, so that the nearest enemy 
+     * is not lost to the result buffer getting filled up */
+    float len = MIN(ENEMY_SEARCH_MIN, max_range);
+    while(true) {
+
+        float min_dist = FLT_MAX;
+        struct entity *ret = NULL;
+
+        for(int i = 0; i < MAX_FACTIONS; i++) {
+
+            if(!hostile[i])
+                continue;
+
+            int num_cands = qt_ent_inrange_circle(&s_faction_postrees[i], 
+                xz_point.x, xz_point.z, len, ent_ids, ARR_SIZE(ent_ids));
+
+            for(int j = 0; j < num_cands; j++) {
+
+                struct entity *curr = ent_for_uid(ent_ids[j]);
+                assert(curr);
+                if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
+                    continue;
+
+                vec2_t delta, can_pos_xz = G_Pos_GetXZ(curr->uid);
+                PFM_Vec2_Sub(&xz_point, &can_pos_xz, &delta);
+
+                if(PFM_Vec2_Len(&delta) < min_dist) {
+                    min_dist = PFM_Vec2_Len(&delta);
+                    ret = curr;
+                }
+            }
+        }
+
+        if(ret || len >= max_range)
+            return ret;
+
+        len = MIN(len * 2.0f, max_range);
+    }
+}
+
@@ -36,11 +36,32 @@
 #ifndef POSITION_H
 #define POSITION_H
 
+#include "public/game.h"
+
 struct map;
+struct entity;
+struct state_section;
 
 bool G_Pos_Init(const struct map *map);
 void G_Pos_Shutdown(void);
 void G_Pos_Delete(uint32_t uid);
+/* Makes room for 'nents' more entities in the position index at once, 
+ * rather than growing it as they are added one at a time */
+bool G_Pos_Reserve(size_t nents);
+/* Must be called after an entity's faction_id changes */
+bool G_Pos_UpdateFaction(const struct entity *ent);
+/* Returns bounds for the volumes of all the entities placed since G_Pos_Init: 
+ * every entity is within 'out_radius' of its' position, and the positions 
+ * lie between 'out_min_y' and 'out_max_y'. This lets the queries on the 
+ * entities' volumes be narrowed down with the position index. The bounds 
+ * are conservative and never shrink. Returns false if no entity was placed. */
+bool G_Pos_VolumeBounds(float *out_radius, float *out_min_y, float *out_max_y);
+/* Writes the positions of all the entities as a state section. On load, the 
+ * entities are looked up by their' saved UIDs in 'remap', and the ones 
+ * which are in the simulation are moved to their' saved positions. */
+bool G_Pos_SaveState(SDL_RWops *stream);
+bool G_Pos_LoadState(SDL_RWops *stream, const struct state_section *hdr, 
+                     const khash_t(entity) *remap);
 
 #endif
 
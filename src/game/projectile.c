@@ -0,0 +1,550 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "projectile.h"
+#include "combat.h"
+#include "game_private.h"
+#include "position.h"
+#include "public/game.h"
+#include "../entity.h"
+#include "../event.h"
+#include "../main.h"
+#include "../perf.h"
+#include "../collision.h"
+#include "../pf_math.h"
+#include "../map/public/map.h"
+#include "../render/public/render.h"
+#include "../render/public/render_ctrl.h"
+#include "../lib/public/vec.h"
+#include "../lib/public/khash.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+
+#define TICK_HZ             (30)
+#define TICK_DT             (1.0f / TICK_HZ)
+#define GRAVITY             (9.81f)
+/* The side of the cells of the broadphase grid, in OpenGL coordinates. The 
+ * cells should be large compared to the distance a projectile covers in a 
+ * tick, so that most cells get many projectiles per position query. */
+#define CELL_SIZE           (16.0f)
+#define MAX_CANDIDATES      (1024)
+#define MAX_MODELS          (UINT16_MAX)
+#define EPSILON             (1.0f/1024)
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+struct proj_model{
+    const void *render_private;
+    vec3_t      scale;
+};
+
+/* The projectiles in flight are kept packed, with one array per attribute, 
+ * so that the integration and the broadphase only touch what they use. 
+ * Dead projectiles are swapped out with the last one. */
+struct proj_pool{
+    size_t    size;
+    size_t    capacity;
+    uint32_t *id;
+    vec3_t   *pos;
+    vec3_t   *prev_pos;
+    vec3_t   *vel;
+    float    *radius;
+    int      *ticks_left;
+    int      *damage;
+    int      *faction_id;
+    uint32_t *shooter;
+    uint16_t *model;
+};
+
+/* Maps a cell of the broadphase grid to the first projectile in it. The 
+ * rest are chained through 's_cell_next'. */
+KHASH_MAP_INIT_INT64(cell, int)
+
+VEC_TYPE(pmodel, struct proj_model)
+VEC_IMPL(static inline, pmodel, struct proj_model)
+
+VEC_TYPE(idx, int)
+VEC_IMPL(static inline, idx, int)
+
+VEC_TYPE(hit, struct proj_hit)
+VEC_IMPL(static inline, hit, struct proj_hit)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const struct map  *s_map;
+static struct proj_pool   s_pool;
+static vec_pmodel_t       s_models;
+static uint32_t           s_next_id = 1;
+
+static khash_t(cell)     *s_cells;
+static vec_idx_t          s_cell_next;
+static vec_hit_t          s_hits;
+static struct proj_stats  s_stats;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool pool_reserve(size_t capacity)
+{
+    if(s_pool.capacity >= capacity)
+        return true;
+
+    size_t newcap = MAX(capacity, MAX(s_pool.capacity * 2, 64));
+
+#define GROW(_field)                                                                \
+    do{                                                                             \
+        void *_new = realloc(s_pool._field, newcap * sizeof(*s_pool._field));       \
+        if(!_new)                                                                   \
+            return false;                                                           \
+        s_pool._field = _new;                                                       \
+    }while(0)
+
+    GROW(id);
+    GROW(pos);
+    GROW(prev_pos);
+    GROW(vel);
+    GROW(radius);
+    GROW(ticks_left);
+    GROW(damage);
+    GROW(faction_id);
+    GROW(shooter);
+    GROW(model);
+#undef GROW
+
+    s_pool.capacity = newcap;
+    return true;
+}
+
+static void pool_free(void)
+{
+    free(s_pool.id);
+    free(s_pool.pos);
+    free(s_pool.prev_pos);
+    free(s_pool.vel);
+    free(s_pool.radius);
+    free(s_pool.ticks_left);
+    free(s_pool.damage);
+    free(s_pool.faction_id);
+    free(s_pool.shooter);
+    free(s_pool.model);
+    s_pool = (struct proj_pool){0};
+}
+
+static void pool_remove(size_t idx)
+{
+    size_t last = --s_pool.size;
+    if(idx == last)
+        return;
+
+    s_pool.id[idx] = s_pool.id[last];
+    s_pool.pos[idx] = s_pool.pos[last];
+    s_pool.prev_pos[idx] = s_pool.prev_pos[last];
+    s_pool.vel[idx] = s_pool.vel[last];
+    s_pool.radius[idx] = s_pool.radius[last];
+    s_pool.ticks_left[idx] = s_pool.ticks_left[last];
+    s_pool.damage[idx] = s_pool.damage[last];
+    s_pool.faction_id[idx] = s_pool.faction_id[last];
+    s_pool.shooter[idx] = s_pool.shooter[last];
+    s_pool.model[idx] = s_pool.model[last];
+}
+
+static int model_index(const struct entity *model)
+{
+    for(int i = 0; i < vec_size(&s_models); i++) {
+        const struct proj_model *curr = &vec_AT(&s_models, i);
+        if(curr->render_private == model->render_private
+        && 0 == memcmp(&curr->scale, &model->scale, sizeof(vec3_t)))
+            return i;
+    }
+
+    if(vec_size(&s_models) == MAX_MODELS)
+        return -1;
+    if(!vec_pmodel_push(&s_models, (struct proj_model){model->render_private, model->scale}))
+        return -1;
+    return vec_size(&s_models) - 1;
+}
+
+static uint64_t cell_key(int x, int z)
+{
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+}
+
+static void cell_coords(uint64_t key, int *out_x, int *out_z)
+{
+    *out_x = (int32_t)(key >> 32);
+    *out_z = (int32_t)(key & 0xffffffff);
+}
+
+static bool is_target(const struct entity *ent, void *arg)
+{
+    return (ent->flags & ENTITY_FLAG_COMBATABLE);
+}
+
+static bool hostile(int faction_a, int faction_b)
+{
+    enum diplomacy_state ds;
+    if(faction_a == faction_b)
+        return false;
+    if(!G_GetDiplomacyState(faction_a, faction_b, &ds))
+        return false;
+    return (ds == DIPLOMACY_STATE_WAR);
+}
+
+/* Returns true if the path the projectile travelled this tick crosses the 
+ * entity's bounding box grown by the projectile's radius. The hit is placed 
+ * at the point of entry. */
+static bool proj_hits_ent(size_t idx, const struct obb *ent_obb, float *out_t)
+{
+    vec3_t delta;
+    PFM_Vec3_Sub(&s_pool.pos[idx], &s_pool.prev_pos[idx], &delta);
+    float len = PFM_Vec3_Len(&delta);
+    if(len < EPSILON)
+        return false;
+
+    vec3_t dir;
+    PFM_Vec3_Scale(&delta, 1.0f / len, &dir);
+
+    struct obb obb = *ent_obb;
+    for(int i = 0; i < 3; i++)
+        obb.half_lengths[i] += s_pool.radius[idx];
+
+    float t;
+    if(!C_RayIntersectsOBB(s_pool.prev_pos[idx], dir, obb, &t) || t > len)
+        return false;
+    *out_t = t / len;
+    return true;
+}
+
+static void integrate(void)
+{
+    for(size_t i = 0; i < s_pool.size; i++) {
+
+        s_pool.prev_pos[i] = s_pool.pos[i];
+        s_pool.vel[i].y -= GRAVITY * TICK_DT;
+
+        vec3_t step;
+        PFM_Vec3_Scale(&s_pool.vel[i], TICK_DT, &step);
+        PFM_Vec3_Add(&s_pool.pos[i], &step, &s_pool.pos[i]);
+        s_pool.ticks_left[i]--;
+    }
+}
+
+static float build_cells(void)
+{
+    float max_reach = 0.0f;
+
+    kh_clear(cell, s_cells);
+    if(s_cell_next.capacity < s_pool.size
+    && !vec_idx_resize(&s_cell_next, s_pool.capacity))
+        return -1.0f;
+    s_cell_next.size = s_pool.size;
+
+    for(size_t i = 0; i < s_pool.size; i++) {
+
+        vec3_t delta;
+        PFM_Vec3_Sub(&s_pool.pos[i], &s_pool.prev_pos[i], &delta);
+        max_reach = MAX(max_reach, PFM_Vec3_Len(&delta) + s_pool.radius[i]);
+
+        int x = floorf(s_pool.pos[i].x / CELL_SIZE);
+        int z = floorf(s_pool.pos[i].z / CELL_SIZE);
+
+        int ret;
+        khiter_t k = kh_put(cell, s_cells, cell_key(x, z), &ret);
+        if(ret == -1)
+            return -1.0f;
+
+        vec_AT(&s_cell_next, i) = (ret == 0) ? kh_value(s_cells, k) : -1;
+        kh_value(s_cells, k) = i;
+    }
+    return max_reach;
+}
+
+/* The entities near a cell are looked up once for all the projectiles in 
+ * it, and then tested against each of them. */
+static void collide_cell(uint64_t key, int head, float margin)
+{
+    int cx, cz;
+    cell_coords(key, &cx, &cz);
+
+    vec2_t xz_min = (vec2_t){cx * CELL_SIZE - margin, cz * CELL_SIZE - margin};
+    vec2_t xz_max = (vec2_t){(cx + 1) * CELL_SIZE + margin, (cz + 1) * CELL_SIZE + margin};
+
+    struct entity *ents[MAX_CANDIDATES];
+    int nents = G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, ARR_SIZE(ents), is_target, NULL);
+    if(nents == 0)
+        return;
+
+    struct obb obbs[nents];
+    for(int i = 0; i < nents; i++) {
+        Entity_CurrentOBB(ents[i], &obbs[i]);
+    }
+
+    for(int idx = head; idx >= 0; idx = vec_AT(&s_cell_next, idx)) {
+
+        if(s_pool.ticks_left[idx] < 0)
+            continue;
+
+        int best = -1;
+        float best_t = FLT_MAX;
+
+        for(int i = 0; i < nents; i++) {
+
+            if(ents[i]->uid == s_pool.shooter[idx])
+                continue;
+            if(!hostile(s_pool.faction_id[idx], ents[i]->faction_id))
+                continue;
+
+            float t;
+            if(proj_hits_ent(idx, &obbs[i], &t) && t < best_t) {
+                best = i;
+                best_t = t;
+            }
+        }
+
+        if(best < 0)
+            continue;
+
+        vec3_t delta, hit_pos;
+        PFM_Vec3_Sub(&s_pool.pos[idx], &s_pool.prev_pos[idx], &delta);
+        PFM_Vec3_Scale(&delta, best_t, &delta);
+        PFM_Vec3_Add(&s_pool.prev_pos[idx], &delta, &hit_pos);
+
+        vec_hit_push(&s_hits, (struct proj_hit){
+            .target = ents[best]->uid,
+            .shooter = s_pool.shooter[idx],
+            .damage = s_pool.damage[idx],
+            .pos = hit_pos,
+        });
+        /* Marks the projectile as spent */
+        s_pool.ticks_left[idx] = -1;
+    }
+}
+
+static bool grounded(size_t idx)
+{
+    vec2_t xz = (vec2_t){s_pool.pos[idx].x, s_pool.pos[idx].z};
+    if(!M_PointInsideMap(s_map, xz))
+        return true;
+    return (s_pool.pos[idx].y < M_HeightAtPoint(s_map, xz));
+}
+
+static void on_30hz_tick(void *user, void *event)
+{
+    if(s_pool.size == 0)
+        return;
+
+    PERF_ENTER();
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    integrate();
+    vec_hit_reset(&s_hits);
+
+    float reach = build_cells();
+    float ent_radius, ent_min_y, ent_max_y;
+
+    if(reach >= 0.0f && G_Pos_VolumeBounds(&ent_radius, &ent_min_y, &ent_max_y)) {
+
+        uint64_t key;
+        int head;
+        kh_foreach(s_cells, key, head, {
+            collide_cell(key, head, reach + ent_radius);
+        });
+    }
+
+    for(int i = s_pool.size - 1; i >= 0; i--) {
+        if(s_pool.ticks_left[i] <= 0 || grounded(i))
+            pool_remove(i);
+    }
+
+    s_stats.live = s_pool.size;
+    s_stats.hits += vec_size(&s_hits);
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    s_stats.tick_ms += (elapsed * 1000.0) / SDL_GetPerformanceFrequency();
+
+    if(vec_size(&s_hits) > 0) {
+
+        G_Combat_ApplyHits(s_hits.array, vec_size(&s_hits));
+        struct proj_hits arg = (struct proj_hits){vec_size(&s_hits), s_hits.array};
+        E_Global_NotifyImmediate(EVENT_PROJECTILE_HITS, &arg, ES_ENGINE);
+    }
+    PERF_RETURN_VOID();
+}
+
+static void make_model(size_t idx, const struct proj_model *pm, mat4x4_t *out)
+{
+    const vec3_t vel = s_pool.vel[idx];
+    float yaw = atan2f(vel.x, vel.z);
+    float pitch = -atan2f(vel.y, sqrtf(vel.x * vel.x + vel.z * vel.z));
+
+    mat4x4_t trans, rot_y, rot_x, rot, scale, tmp;
+    PFM_Mat4x4_MakeTrans(s_pool.pos[idx].x, s_pool.pos[idx].y, s_pool.pos[idx].z, &trans);
+    PFM_Mat4x4_MakeRotY(yaw, &rot_y);
+    PFM_Mat4x4_MakeRotX(pitch, &rot_x);
+    PFM_Mat4x4_MakeScale(pm->scale.x, pm->scale.y, pm->scale.z, &scale);
+
+    PFM_Mat4x4_Mult4x4(&rot_y, &rot_x, &rot);
+    PFM_Mat4x4_Mult4x4(&rot, &scale, &tmp);
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Proj_Init(const struct map *map)
+{
+    assert(map);
+    if(!(s_cells = kh_init(cell)))
+        return false;
+
+    s_map = map;
+    s_pool = (struct proj_pool){0};
+    s_stats = (struct proj_stats){0};
+    vec_pmodel_init(&s_models);
+    vec_idx_init(&s_cell_next);
+    vec_hit_init(&s_hits);
+    E_Global_Register(EVENT_30HZ_TICK, on_30hz_tick, NULL, G_RUNNING);
+    return true;
+}
+
+void G_Proj_Shutdown(void)
+{
+    if(!s_map)
+        return;
+
+    E_Global_Unregister(EVENT_30HZ_TICK, on_30hz_tick);
+    vec_hit_destroy(&s_hits);
+    vec_idx_destroy(&s_cell_next);
+    vec_pmodel_destroy(&s_models);
+    kh_destroy(cell, s_cells);
+    pool_free();
+    s_map = NULL;
+}
+
+uint32_t G_Proj_Launch(const struct proj_desc *desc)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_map || !desc->model || !desc->model->render_private)
+        return 0;
+    if(!pool_reserve(s_pool.size + 1))
+        return 0;
+
+    int model = model_index(desc->model);
+    if(model < 0)
+        return 0;
+
+    size_t idx = s_pool.size++;
+    uint32_t id = s_next_id++;
+
+    s_pool.id[idx] = id;
+    s_pool.pos[idx] = desc->pos;
+    s_pool.prev_pos[idx] = desc->pos;
+    s_pool.vel[idx] = desc->vel;
+    s_pool.radius[idx] = MAX(desc->radius, 0.0f);
+    s_pool.ticks_left[idx] = MAX(ceilf(desc->lifetime * TICK_HZ), 1);
+    s_pool.damage[idx] = desc->damage;
+    s_pool.faction_id[idx] = desc->faction_id;
+    s_pool.shooter[idx] = desc->shooter;
+    s_pool.model[idx] = model;
+
+    s_stats.live = s_pool.size;
+    s_stats.launched++;
+    return id;
+}
+
+void G_Proj_GetStats(struct proj_stats *out_stats)
+{
+    *out_stats = s_stats;
+    out_stats->live = s_pool.size;
+}
+
+void G_Proj_Render(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_pool.size == 0)
+        return;
+
+    /* Bucket the projectiles by model, so that each model is drawn with a 
+     * single instanced command */
+    size_t nmodels = vec_size(&s_models);
+    size_t counts[nmodels + 1];
+    memset(counts, 0, sizeof(counts));
+
+    for(size_t i = 0; i < s_pool.size; i++)
+        counts[s_pool.model[i] + 1]++;
+    for(size_t i = 1; i <= nmodels; i++)
+        counts[i] += counts[i - 1];
+
+    mat4x4_t *models = R_AllocArg(sizeof(mat4x4_t) * s_pool.size);
+    if(!models)
+        return;
+
+    for(size_t i = 0; i < s_pool.size; i++) {
+        uint16_t model = s_pool.model[i];
+        make_model(i, &vec_AT(&s_models, model), &models[counts[model]++]);
+    }
+
+    /* 'counts' now holds the end of each bucket */
+    size_t begin = 0;
+    for(size_t i = 0; i < nmodels; i++) {
+
+        size_t end = counts[i];
+        if(end == begin)
+            continue;
+
+        R_PushCmd((struct rcmd){
+            .type = RCMD_DRAW_INSTANCED,
+            .as_draw_instanced = {
+                .render_private = vec_AT(&s_models, i).render_private,
+                .models = models + begin,
+                .count = end - begin,
+            },
+        });
+        begin = end;
+    }
+}
+
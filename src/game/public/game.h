@@ -40,6 +40,8 @@
 #include "../../map/public/map.h"
 #include "../../lib/public/vec.h"
 #include "../../lib/public/khash.h"
+#include "../../render/public/render_ctrl.h"
+#include "../../config.h"
 
 #include <stdbool.h>
 #include <SDL.h>
@@ -54,6 +56,7 @@ struct tile_desc;
 struct tile;
 struct faction;
 struct render_workspace;
+struct memstack_stats;
 struct nk_context;
 
 
@@ -79,17 +82,39 @@ enum simstate{
     G_PAUSED_UI_RUNNING = (1 << 2),
 };
 
+/* The passes that an entity can be drawn into. The entities of the light 
+ * passes are 'visible' from the light source PoV in a shadow map cascade, 
+ * and the ones of the water passes are not entirely clipped by the water 
+ * surface. */
+#define DRAW_PASS_CAMERA    (1u << 0)
+#define DRAW_PASS_REFRACT   (1u << 1)
+#define DRAW_PASS_REFLECT   (1u << 2)
+#define DRAW_PASS_LIGHT(i)  (1u << (3 + (i)))
+
 struct render_input{
     const struct camera *cam;
     const struct map    *map;
     bool                 shadows;
-    /* The visible entities to render */
-    vec_rstat_t         cam_vis_stat;
-    vec_ranim_t         cam_vis_anim;
-    /* The entities 'visible' from the light source PoV. They are 
-     * used for rendering the shadow map. */
-    vec_rstat_t         light_vis_stat;
-    vec_ranim_t         light_vis_anim;
+    /* Distance at which the terrain chunks drop to the next level of 
+     * detail, 0 to always draw the full meshes */
+    float                terrain_lod_dist;
+    /* The render states of all the entities drawn this frame, built once 
+     * and shared by all the passes. Each pass draws the entities which have 
+     * its' bit set. 'cam_pass' is the pass drawn from 'cam'. */
+    const struct ent_rstate *ents;
+    size_t               nents;
+    uint32_t             cam_pass;
+    /* Where each of 'ents' starts in the buffer of vertices skinned up front 
+     * this frame, filled in by the render thread. NULL if the animated 
+     * entities are skinned by every pass that draws them. */
+    int                 *skin_first;
+    /* Whether the GPU-culled static scenery is drawn along with 'ents' */
+    bool                 scenery;
+    /* The shadow map cascades, and whether each is rendered this frame. Only 
+     * the dirty cascades are rendered, the rest keep the contents of the 
+     * shadow map from an earlier frame. */
+    struct shadow_cascade cascades[CONFIG_SHADOW_CASCADES];
+    bool                cascade_dirty[CONFIG_SHADOW_CASCADES];
 };
 
 
@@ -104,12 +129,20 @@ void   G_Shutdown(void);
 
 void   G_Update(void);
 void   G_Render(void);
+/* Hands the current render workspace off for rendering and recycles the 
+ * oldest one. The render thread must be done with the oldest workspace, 
+ * i.e. have at most CONFIG_RENDER_FRAME_LATENCY-1 workspaces left to render. 
+ */
 void   G_SwapBuffers(void);
 
 /* This does not have any side effects besides  making draw calls, 
  * so it is safe to invoke from the render thread. 
  */
 void   G_RenderMapAndEntities(struct render_input in);
+/* Renders the map and the 'cam_vis' entities from the point of view of 'in.cam', 
+ * reusing the current shadow map. Map chunks lying entirely on the negative side 
+ * of the clipping plane are skipped. Used for the water passes. */
+void   G_RenderMapAndEntitiesClipped(struct render_input in, vec4_t clip_plane);
 
 void   G_GetMinimapPos(float *out_x, float *out_y);
 void   G_SetMinimapPos(float x, float y);
@@ -119,16 +152,42 @@ void   G_SetMinimapResizeMask(int mask);
 bool   G_MouseOverMinimap(void);
 bool   G_MapHeightAtPoint(vec2_t xz, float *out_height);
 bool   G_PointInsideMap(vec2_t xz);
+/* Bulk queries of the terrain and of the navigation data of a single chunk
+ * (see M_ChunkTileData and M_NavChunkTileStates). They return false when 
+ * there is no map or when the chunk is outside of it. */
+bool   G_MapChunkTileData(int chunk_r, int chunk_c, float *out_heights, int32_t *out_mats);
+bool   G_MapChunkTileStates(int chunk_r, int chunk_c, uint8_t *out_pathable, 
+                            uint8_t *out_blocked, uint16_t *out_islands);
 
 void   G_BakeNavDataForScene(void);
+void   G_PrecomputeNavFields(size_t ndests, const vec2_t xz_dests[]);
 
 bool   G_AddEntity(struct entity *ent, vec3_t pos);
+/* Adds the entities in order, with the tables grown once for all of them. 
+ * Returns the number added, which stops short of 'count' at the first 
+ * entity that could not be added. */
+size_t G_AddEntities(struct entity *const *ents, const vec3_t *pos, size_t count);
 bool   G_RemoveEntity(struct entity *ent);
 void   G_StopEntity(const struct entity *ent);
 
 /* Wrapper around AL_EntityFree to defer the call until the render thread 
  * (which owns some part of entity resources) finishes its' work. */
 void   G_SafeFree(struct entity *ent);
+/* Returns NULL if there is no active entity with the UID */
+struct entity *G_EntityForUID(uint32_t uid);
+const vec_pentity_t *G_GetActiveEntities(void);
+
+/* Writes the native state of the simulation (factions, positions, movement
+ * and combat) as a sequence of tagged sections. */
+bool   G_SaveState(SDL_RWops *stream);
+/* Loading a save is bracketed by 'G_LoadBegin' and 'G_LoadEnd'. In between, 
+ * the recreated entities are handed to 'G_LoadDeferEntity' with the UIDs they 
+ * were saved with, and are added to the simulation all at once by 'G_LoadState', 
+ * which then applies the saved sections to them. */
+bool   G_LoadBegin(void);
+bool   G_LoadDeferEntity(uint32_t saved_uid, struct entity *ent, vec3_t pos);
+bool   G_LoadState(SDL_RWops *stream);
+void   G_LoadEnd(void);
 
 bool   G_AddFaction(const char *name, vec3_t color);
 bool   G_RemoveFaction(int faction_id);
@@ -136,6 +195,8 @@ bool   G_UpdateFaction(int faction_id, const char *name, vec3_t color, bool cont
 int    G_GetFactions(char out_names[][MAX_FAC_NAME_LEN], vec3_t *out_colors, bool *out_ctrl);
 bool   G_SetDiplomacyState(int fac_id_a, int fac_id_b, enum diplomacy_state ds);
 bool   G_GetDiplomacyState(int fac_id_a, int fac_id_b, enum diplomacy_state *out);
+void   G_SetFactionID(struct entity *ent, int faction_id);
+void   G_SetVisionRange(struct entity *ent, float vision_range);
 
 bool   G_ActivateCamera(int idx, enum cam_mode mode);
 void   G_MoveActiveCamera(vec2_t xz_ground_pos);
@@ -144,6 +205,9 @@ vec3_t G_ActiveCamDir(void);
 
 bool   G_UpdateMinimapChunk(int chunk_r, int chunk_c);
 bool   G_UpdateTile(const struct tile_desc *desc, const struct tile *tile);
+/* Updates all the tiles and the minimap chunks they are in, re-building 
+ * the affected render data only once */
+bool   G_UpdateTiles(size_t ntiles, const struct tile_desc *descs, const struct tile *tiles);
 
 void          G_SetSimState(enum simstate ss);
 enum simstate G_GetSimState(void);
@@ -151,7 +215,13 @@ void          G_SetLightPos(vec3_t pos);
 
 struct render_workspace *G_GetSimWS(void);
 struct render_workspace *G_GetRenderWS(void);
+/* Called by the render thread once it is done with its' current workspace */
+void                     G_ReleaseRenderWS(void);
 const struct map        *G_GetPrevTickMap(void);
+/* Allocation counters of the render workspaces' argument stacks, combined 
+ * for the workspaces that were just handed off and just recycled, sampled at 
+ * the last buffer swap. */
+void                     G_GetWSStats(struct memstack_stats *out);
 
 /*###########################################################################*/
 /* GAME SELECTION                                                            */
@@ -169,6 +239,9 @@ void                  G_Sel_Disable(void);
 void                  G_Sel_Clear(void);
 void                  G_Sel_Add(struct entity *ent);
 void                  G_Sel_Remove(struct entity *ent);
+/* Same as calling G_Sel_Remove for each, but the selection change is 
+ * only notified once */
+void                  G_Sel_RemoveBatch(struct entity *const *ents, size_t nents);
 const vec_pentity_t  *G_Sel_Get(enum selection_type *out_type);
 
 
@@ -176,9 +249,41 @@ const vec_pentity_t  *G_Sel_Get(enum selection_type *out_type);
 /* GAME MOVEMENT                                                             */
 /*###########################################################################*/
 
+enum move_crowd_mode{
+    /* Off-screen members of large flocks are steered by the crowd density 
+     * once enough entities are moving at the same time */
+    MOVE_CROWD_AUTO,
+    /* All off-screen members are steered by the crowd density */
+    MOVE_CROWD_ALWAYS,
+    /* All members get full ClearPath collision avoidance */
+    MOVE_CROWD_NEVER,
+};
+
+struct move_stats{
+    /* The number of ClearPath velocity computations performed, and the number 
+     * of times the previous tick's result was reused instead */
+    unsigned long cp_computed;
+    unsigned long cp_skipped;
+    /* The most scratch memory (in bytes) needed by one worker in one tick */
+    size_t        cp_scratch_high_water;
+    /* The number of entities simulated at a reduced level of detail during 
+     * the last tick, individually and as part of a whole flock */
+    unsigned      lod_reduced;
+    unsigned      lod_blob;
+    /* The number of velocities computed from the crowd density field 
+     * instead of by ClearPath */
+    unsigned long crowd_steered;
+    /* Total time (in milliseconds) spent in the movement ticks, and in the 
+     * ClearPath velocity computations that are a part of them */
+    double        tick_ms;
+    double        clearpath_ms;
+};
+
 void G_Move_SetMoveOnLeftClick(void);
 void G_Move_SetAttackOnLeftClick(void);
 void G_Move_SetDest(const struct entity *ent, vec2_t dest_xz);
+void G_Move_SetCrowdMode(const struct entity *ent, enum move_crowd_mode mode);
+void G_Move_GetStats(struct move_stats *out_stats);
 
 
 /*###########################################################################*/
@@ -196,6 +301,11 @@ enum combat_stance{
     COMBAT_STANCE_NO_ENGAGEMENT,
 };
 
+struct combat_stats{
+    /* Total time (in milliseconds) spent in the combat ticks */
+    double tick_ms;
+};
+
 /* Can only be called with entities that have 'ENTITY_FLAG_COMBATABLE' set */
 bool  G_Combat_SetStance(const struct entity *ent, enum combat_stance stance);
 int   G_Combat_GetCurrentHP(const struct entity *ent);
@@ -204,13 +314,203 @@ void  G_Combat_SetBaseArmour(const struct entity *ent, float armour_pc);
 float G_Combat_GetBaseArmour(const struct entity *ent);
 void  G_Combat_SetBaseDamage(const struct entity *ent, int dmg);
 int   G_Combat_GetBaseDamage(const struct entity *ent);
+void  G_Combat_GetStats(struct combat_stats *out_stats);
+
+
+/*###########################################################################*/
+/* GAME PROJECTILE                                                           */
+/*###########################################################################*/
+
+#define PROJ_NO_SHOOTER (~(uint32_t)0)
+
+struct proj_desc{
+    /* The projectile is drawn with the mesh and scale of this entity, 
+     * which need not be part of the simulation, pointing its' +Z axis
+     * along the direction of flight. Must outlive the projectile. */
+    const struct entity *model;
+    /* UID of the entity that launched the projectile, or PROJ_NO_SHOOTER. 
+     * A projectile never hits its' shooter or the factions at peace with 
+     * 'faction_id'. */
+    uint32_t             shooter;
+    int                  faction_id;
+    int                  damage;
+    float                radius;
+    /* In seconds. Projectiles which hit nothing are also dropped when they 
+     * hit the ground or leave the map. */
+    float                lifetime;
+    vec3_t               pos;
+    vec3_t               vel;
+};
+
+struct proj_hit{
+    uint32_t target;
+    uint32_t shooter;
+    int      damage;
+    vec3_t   pos;
+};
+
+/* The argument of EVENT_PROJECTILE_HITS, which is sent once per tick with 
+ * all the hits of the tick, after the damage has been dealt. */
+struct proj_hits{
+    size_t                 nhits;
+    const struct proj_hit *hits;
+};
+
+struct proj_stats{
+    size_t        live;
+    unsigned long launched;
+    unsigned long hits;
+    /* Total time (in milliseconds) spent in the projectile ticks */
+    double        tick_ms;
+};
+
+/* Returns the ID of the new projectile, or 0 on failure */
+uint32_t G_Proj_Launch(const struct proj_desc *desc);
+void     G_Proj_GetStats(struct proj_stats *out_stats);
+
+
+/*###########################################################################*/
+/* GAME TIMER                                                                */
+/*###########################################################################*/
+
+struct timer_stats{
+    /* The number of simulation ticks run in all, and during the last frame */
+    unsigned long long ticks;
+    unsigned           last_frame_ticks;
+    /* The number of frames which fell behind by more than the maximum number 
+     * of ticks per frame, and the number of ticks that were skipped as a result */
+    unsigned long      overrun_frames;
+    unsigned long long dropped_ticks;
+};
+
+/* Queues the fixed-rate simulation ticks for the time that has elapsed since 
+ * the last call, up to CONFIG_SIM_MAX_TICKS_PER_FRAME. Called once per frame, 
+ * before the event queue is serviced. Returns the number of ticks queued. */
+int    G_Timer_Update(void);
+/* Queues exactly one tick, regardless of the time that has elapsed. Used to 
+ * run the simulation faster than real time, as in headless mode. */
+int    G_Timer_Step(void);
+void   G_Timer_GetStats(struct timer_stats *out);
+
+/*###########################################################################*/
+/* GAME REPLAY                                                               */
+/*###########################################################################*/
+
+/* The player's and the scripts' commands enter the simulation through the 
+ * 'G_Replay_Cmd' calls, so that they can be recorded along with the tick 
+ * they were issued at. During playback, the recorded commands are issued 
+ * again at the same ticks, and the live ones are dropped. Playbacks of the 
+ * same replay play out identically: the movement level of detail is turned 
+ * off and the paths are found synchronously while one is running. The 
+ * recording session itself ticks in real time, so it may differ. */
+bool   G_Replay_StartRecording(const char *path);
+bool   G_Replay_StartPlayback(const char *path);
+/* Finishes the recording or the playback, if there is one */
+void   G_Replay_Stop(void);
+bool   G_Replay_IsRecording(void);
+bool   G_Replay_IsPlaying(void);
+
+void   G_Replay_CmdMove(const struct entity *ent, vec2_t dest_xz);
+void   G_Replay_CmdStop(const struct entity *ent);
+void   G_Replay_CmdStance(const struct entity *ent, enum combat_stance stance);
+/* A move or attack order for a group of entities, as given with the mouse */
+void   G_Replay_CmdOrder(const vec_pentity_t *sel, vec3_t target, bool attack);
+/* The arguments of script events are recorded as opaque blobs, which are 
+ * encoded and decoded by the scripting module. Returns false if the live 
+ * event is to be dropped. */
+bool   G_Replay_CmdScriptEvent(int event, const void *data, size_t size);
+
+/*###########################################################################*/
+/* GAME LOCKSTEP                                                             */
+/*###########################################################################*/
+
+struct lockstep_status{
+    /* Set from the moment a match is hosted or joined until it's stopped */
+    bool          active;
+    /* Set once all the peers have connected and the turns have started */
+    bool          running;
+    int           peer_id;
+    int           npeers;
+    /* The next turn to be run */
+    uint32_t      turn;
+    /* The number of turns before a command takes effect, and the number 
+     * of base ticks in a turn */
+    int           input_delay;
+    int           turn_ticks;
+    /* The number of frames in which the simulation waited for a peer */
+    unsigned long stalled_frames;
+    uint64_t      bytes_sent;
+    uint64_t      bytes_received;
+    /* Set when a peer's state hash differed from ours. The simulations are 
+     * not brought back in sync. */
+    bool          desync;
+    uint32_t      desync_turn;
+};
+
+/* In a lockstep match, the commands given through the 'G_Replay_Cmd' calls 
+ * are not issued right away, but are sent to all the peers, which issue 
+ * them on the same tick. Only the commands travel over the network, so the 
+ * simulations must start from the same state (such as right after loading 
+ * the same map) and stay deterministic. The peers are expected to run the 
+ * same build of the engine: the simulation is built without FMA contraction
+ * or host-specific instructions, but the platform's math library may still 
+ * round differently. A mismatch is caught by comparing the hashes of the 
+ * states and is reported as a desync. As during a replay's playback, the 
+ * movement level of detail is turned off and the paths are found 
+ * synchronously for the duration of the match. The simulation is held back 
+ * until all the peers have connected. Fails while a replay is being recorded
+ * or played back. */
+bool   G_Lockstep_Host(uint16_t port, int npeers);
+bool   G_Lockstep_Join(const char *host, uint16_t port);
+void   G_Lockstep_Stop(void);
+void   G_Lockstep_GetStatus(struct lockstep_status *out);
+
+/*###########################################################################*/
+/* GAME FOG OF WAR                                                           */
+/*###########################################################################*/
 
+/* Every faction has its' own grid of the tiles that are currently visible 
+ * to it and of the tiles that it has explored, revealed by the entities 
+ * with a 'vision_range'. The fog of the player's factions (a mask of faction 
+ * IDs) is drawn over the map and the enemy entities outside of their view 
+ * are hidden. A mask of 0 (the default) disables the fog. */
+void     G_Fog_SetPlayerFactions(uint16_t faction_mask);
+uint16_t G_Fog_GetPlayerFactions(void);
+bool     G_Fog_Visible(int faction_id, vec2_t xz);
+bool     G_Fog_Explored(int faction_id, vec2_t xz);
+
+/*###########################################################################*/
+/* GAME SCENERY                                                              */
+/*###########################################################################*/
+
+/* Must be called after the transform or the flags of an entity that is 
+ * part of the simulation change, so that it is moved into or out of the 
+ * GPU-culled static scenery. */
+void   G_Scenery_Update(struct entity *ent);
+
+/*###########################################################################*/
+/* GAME LIGHTS                                                               */
+/*###########################################################################*/
+
+/* Point lights, which light up the terrain and the entities within their 
+ * radius in addition to the global light. Only the first 
+ * CONFIG_MAX_POINT_LIGHTS lights are drawn. Adding returns the ID of the 
+ * new light, or 0 on failure. All lights are removed with the map. */
+uint32_t G_Light_AddPoint(vec3_t pos, vec3_t color, float radius);
+bool     G_Light_Remove(uint32_t id);
+bool     G_Light_SetPos(uint32_t id, vec3_t pos);
+bool     G_Light_SetColor(uint32_t id, vec3_t color);
 
 /*###########################################################################*/
 /* GAME POSITION                                                             */
 /*###########################################################################*/
 
 bool   G_Pos_Set(uint32_t uid, vec3_t pos);
+/* Same as G_Pos_Set, but the move is rendered gradually over the next 'nticks' 
+ * simulation ticks, instead of the entity jumping to its' new position. */
+bool   G_Pos_Step(uint32_t uid, vec3_t pos, int nticks);
+/* The position where the entity is drawn in the current frame */
+vec3_t G_Pos_GetRender(uint32_t uid);
 vec3_t G_Pos_Get(uint32_t uid);
 vec2_t G_Pos_GetXZ(uint32_t uid);
 
@@ -219,9 +519,31 @@ int    G_Pos_EntsInRectWithPred(vec2_t xz_min, vec2_t xz_max, struct entity **ou
                                 bool (*predicate)(const struct entity *ent, void *arg), void *arg);
 int    G_Pos_EntsInCircle(vec2_t xz_point, float range, struct entity **out, size_t maxout);
 
+struct pos_circle_query{
+    vec2_t xz_point;
+    float  range;
+    /* May be NULL to accept every entity */
+    bool (*predicate)(const struct entity *ent, void *arg);
+    void  *arg;
+};
+
+/* Answers many circle queries with a single traversal of the position tree. 
+ * 'out' must hold 'nqueries * maxout_per_query' entities and 'out_offsets' 
+ * 'nqueries + 1' elements. Query 'i' gets the results from 'out[out_offsets[i]]' 
+ * up to (but excluding) 'out[out_offsets[i+1]]'. If non-NULL, 'out_truncated' 
+ * is set for the queries which found 'maxout_per_query' entities before their 
+ * predicate was applied, and so may be missing some results. Returns the total 
+ * number of results or -1 on failure. */
+int    G_Pos_EntsInCircleBatch(const struct pos_circle_query *queries, size_t nqueries, 
+                               size_t maxout_per_query, struct entity **out, int *out_offsets,
+                               bool *out_truncated);
+
 struct entity *G_Pos_Nearest(vec2_t xz_point);
 struct entity *G_Pos_NearestWithPred(vec2_t xz_point, 
                                      bool (*predicate)(const struct entity *ent, void *arg), void *arg);
+/* Returns the closest combatable entity, within the range, belonging to a faction 
+ * that is at war with the specified faction. NULL if there is none. */
+struct entity *G_Pos_NearestEnemy(vec2_t xz_point, int faction_id, float max_range);
 
 #endif
 
@@ -0,0 +1,511 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018-2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/game.h"
+#include "game_private.h"
+#include "movement.h"
+#include "timer_events.h"
+#include "lockstep.h"
+#include "../event.h"
+#include "../entity.h"
+#include "../script/public/script.h"
+#include "../lib/public/vec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* The file starts with the magic and the version, followed by the 
+ * commands in the order they were issued. Each command is a fixed-size 
+ * header, followed by a payload of 'size' bytes. All the fields are in 
+ * host byte order. */
+#define REPLAY_MAGIC    "PFRP"
+#define REPLAY_VERSION  (1)
+
+enum replay_cmd_type{
+    /* uint32_t uid, float x, float z */
+    REPLAY_CMD_MOVE = 0,
+    /* uint32_t uid */
+    REPLAY_CMD_STOP,
+    /* uint32_t uid, uint8_t stance */
+    REPLAY_CMD_STANCE,
+    /* float x, float y, float z, uint8_t attack, uint32_t nents, uint32_t uids[nents] */
+    REPLAY_CMD_ORDER,
+    /* int32_t event, script-encoded argument */
+    REPLAY_CMD_SCRIPT_EVENT,
+};
+
+struct cmd_hdr{
+    uint32_t tick;
+    uint8_t  type;
+    uint32_t size;
+};
+
+#define HDR_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t))
+
+enum replay_mode{
+    REPLAY_NONE,
+    REPLAY_RECORDING,
+    REPLAY_PLAYING,
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static enum replay_mode s_mode = REPLAY_NONE;
+static FILE            *s_out;
+/* The whole file being played back, and the offset of the next command */
+static unsigned char   *s_data;
+static size_t           s_size;
+static size_t           s_offset;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static unsigned char *put(unsigned char *out, const void *val, size_t size)
+{
+    memcpy(out, val, size);
+    return out + size;
+}
+
+static const unsigned char *get(const unsigned char *in, void *out, size_t size)
+{
+    memcpy(out, in, size);
+    return in + size;
+}
+
+static void record(enum replay_cmd_type type, const void *payload, size_t size)
+{
+    assert(s_mode == REPLAY_RECORDING);
+
+    unsigned char hdr[HDR_SIZE], *cursor = hdr;
+    uint32_t tick = G_Timer_Ticks();
+    uint8_t type8 = type;
+    uint32_t size32 = size;
+    cursor = put(cursor, &tick, sizeof(tick));
+    cursor = put(cursor, &type8, sizeof(type8));
+    cursor = put(cursor, &size32, sizeof(size32));
+
+    if(fwrite(hdr, sizeof(hdr), 1, s_out) != 1
+    || (size && fwrite(payload, size, 1, s_out) != 1)) {
+        fprintf(stderr, "Failed to write replay command. Recording stopped.\n");
+        G_Replay_Stop();
+    }
+}
+
+/* The commands are only encoded when they are to be recorded or sent to 
+ * the peers of a lockstep match */
+static bool encoding(void)
+{
+    return (s_mode == REPLAY_RECORDING) || G_Lockstep_Active();
+}
+
+/* Returns true if the command is to be issued right away. In a lockstep 
+ * match, it is issued later, on the same turn as on all the other peers. */
+static bool dispatch(enum replay_cmd_type type, const void *payload, size_t size)
+{
+    if(G_Lockstep_Active()) {
+        G_Lockstep_Submit(type, payload, size);
+        return false;
+    }
+    if(s_mode == REPLAY_RECORDING) {
+        record(type, payload, size);
+    }
+    return true;
+}
+
+static struct entity *ent_for_uid(uint32_t uid)
+{
+    const khash_t(entity) *ents = G_GetAllEntsSet();
+    khiter_t k = kh_get(entity, ents, uid);
+    if(k == kh_end(ents))
+        return NULL;
+    return kh_value(ents, k);
+}
+
+static bool peek_hdr(struct cmd_hdr *out)
+{
+    if(s_size - s_offset < HDR_SIZE)
+        return false;
+
+    const unsigned char *cursor = s_data + s_offset;
+    cursor = get(cursor, &out->tick, sizeof(out->tick));
+    cursor = get(cursor, &out->type, sizeof(out->type));
+    cursor = get(cursor, &out->size, sizeof(out->size));
+    return (s_size - s_offset - HDR_SIZE >= out->size);
+}
+
+/* Returns false if the payload is malformed */
+static bool issue(const struct cmd_hdr *hdr, const unsigned char *payload)
+{
+    uint32_t uid;
+    struct entity *ent;
+
+    switch(hdr->type) {
+    case REPLAY_CMD_MOVE: {
+
+        vec2_t dest;
+        if(hdr->size != sizeof(uid) + 2 * sizeof(float))
+            return false;
+        payload = get(payload, &uid, sizeof(uid));
+        payload = get(payload, &dest.x, sizeof(float));
+        payload = get(payload, &dest.z, sizeof(float));
+
+        if((ent = ent_for_uid(uid)) && !(ent->flags & ENTITY_FLAG_STATIC))
+            G_Move_SetDest(ent, dest);
+        return true;
+    }
+    case REPLAY_CMD_STOP: {
+
+        if(hdr->size != sizeof(uid))
+            return false;
+        get(payload, &uid, sizeof(uid));
+
+        if((ent = ent_for_uid(uid)) && !(ent->flags & ENTITY_FLAG_STATIC))
+            G_StopEntity(ent);
+        return true;
+    }
+    case REPLAY_CMD_STANCE: {
+
+        uint8_t stance;
+        if(hdr->size != sizeof(uid) + sizeof(stance))
+            return false;
+        payload = get(payload, &uid, sizeof(uid));
+        payload = get(payload, &stance, sizeof(stance));
+
+        if((ent = ent_for_uid(uid)) && (ent->flags & ENTITY_FLAG_COMBATABLE))
+            G_Combat_SetStance(ent, stance);
+        return true;
+    }
+    case REPLAY_CMD_ORDER: {
+
+        vec3_t target;
+        uint8_t attack;
+        uint32_t nents;
+        const size_t fixed = 3 * sizeof(float) + sizeof(attack) + sizeof(nents);
+
+        if(hdr->size < fixed)
+            return false;
+        payload = get(payload, &target.x, sizeof(float));
+        payload = get(payload, &target.y, sizeof(float));
+        payload = get(payload, &target.z, sizeof(float));
+        payload = get(payload, &attack, sizeof(attack));
+        payload = get(payload, &nents, sizeof(nents));
+        if(hdr->size != fixed + nents * sizeof(uid))
+            return false;
+
+        /* Entities which have died since the recording was made (which 
+         * can only happen when the builds differ) are left out */
+        vec_pentity_t sel;
+        vec_pentity_init(&sel);
+        for(int i = 0; i < nents; i++) {
+            payload = get(payload, &uid, sizeof(uid));
+            if((ent = ent_for_uid(uid)))
+                vec_pentity_push(&sel, ent);
+        }
+        G_Move_Order(&sel, target, attack);
+        vec_pentity_destroy(&sel);
+        return true;
+    }
+    case REPLAY_CMD_SCRIPT_EVENT: {
+
+        int32_t event;
+        if(hdr->size < sizeof(event))
+            return false;
+        payload = get(payload, &event, sizeof(event));
+        return S_NotifyEncodedEvent(event, payload, hdr->size - sizeof(event));
+    }
+    default:
+        return false;
+    }
+}
+
+static void on_update_start(void *user, void *event)
+{
+    assert(s_mode == REPLAY_PLAYING);
+    unsigned long long now = G_Timer_Ticks();
+
+    struct cmd_hdr hdr;
+    while(peek_hdr(&hdr) && hdr.tick <= now) {
+
+        if(!issue(&hdr, s_data + s_offset + HDR_SIZE)) {
+            fprintf(stderr, "Malformed replay command at offset %zu. Playback stopped.\n", s_offset);
+            G_Replay_Stop();
+            return;
+        }
+        s_offset += HDR_SIZE + hdr.size;
+    }
+
+    /* Once all the commands have been issued, the playback carries on 
+     * (dropping the live commands) until the replay is stopped */
+    if(s_offset < s_size && !peek_hdr(&hdr)) {
+        fprintf(stderr, "Truncated replay command at offset %zu. Playback stopped.\n", s_offset);
+        G_Replay_Stop();
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Replay_StartRecording(const char *path)
+{
+    if(s_mode != REPLAY_NONE)
+        return false;
+
+    s_out = fopen(path, "wb");
+    if(!s_out)
+        goto fail_open;
+
+    uint32_t version = REPLAY_VERSION;
+    if(fwrite(REPLAY_MAGIC, strlen(REPLAY_MAGIC), 1, s_out) != 1)
+        goto fail_write;
+    if(fwrite(&version, sizeof(version), 1, s_out) != 1)
+        goto fail_write;
+
+    s_mode = REPLAY_RECORDING;
+    return true;
+
+fail_write:
+    fclose(s_out);
+    s_out = NULL;
+fail_open:
+    return false;
+}
+
+bool G_Replay_StartPlayback(const char *path)
+{
+    if(s_mode != REPLAY_NONE)
+        return false;
+
+    FILE *in = fopen(path, "rb");
+    if(!in)
+        goto fail_open;
+
+    if(fseek(in, 0, SEEK_END) != 0)
+        goto fail_read;
+    long size = ftell(in);
+    if(size < 0 || fseek(in, 0, SEEK_SET) != 0)
+        goto fail_read;
+
+    s_data = malloc(size ? size : 1);
+    if(!s_data)
+        goto fail_read;
+    if(size && fread(s_data, size, 1, in) != 1)
+        goto fail_data;
+
+    uint32_t version;
+    const size_t magic_len = strlen(REPLAY_MAGIC);
+    if(size < magic_len + sizeof(version))
+        goto fail_data;
+    if(memcmp(s_data, REPLAY_MAGIC, magic_len))
+        goto fail_data;
+    memcpy(&version, s_data + magic_len, sizeof(version));
+    if(version != REPLAY_VERSION)
+        goto fail_data;
+
+    s_size = size;
+    s_offset = magic_len + sizeof(version);
+    fclose(in);
+
+    E_Global_Register(EVENT_UPDATE_START, on_update_start, NULL, G_RUNNING);
+    s_mode = REPLAY_PLAYING;
+    return true;
+
+fail_data:
+    free(s_data);
+    s_data = NULL;
+fail_read:
+    fclose(in);
+fail_open:
+    return false;
+}
+
+void G_Replay_Stop(void)
+{
+    switch(s_mode) {
+    case REPLAY_RECORDING:
+        fclose(s_out);
+        s_out = NULL;
+        break;
+    case REPLAY_PLAYING:
+        E_Global_Unregister(EVENT_UPDATE_START, on_update_start);
+        free(s_data);
+        s_data = NULL;
+        s_size = s_offset = 0;
+        break;
+    default:
+        break;
+    }
+    s_mode = REPLAY_NONE;
+}
+
+bool G_Replay_IsRecording(void)
+{
+    return (s_mode == REPLAY_RECORDING);
+}
+
+bool G_Replay_IsPlaying(void)
+{
+    return (s_mode == REPLAY_PLAYING);
+}
+
+bool G_Replay_Issue(int type, const void *payload, size_t size)
+{
+    struct cmd_hdr hdr = (struct cmd_hdr){
+        .tick = G_Timer_Ticks(),
+        .type = type,
+        .size = size,
+    };
+
+    if(s_mode == REPLAY_RECORDING) {
+        record(type, payload, size);
+    }
+    return issue(&hdr, payload);
+}
+
+void G_Replay_CmdMove(const struct entity *ent, vec2_t dest_xz)
+{
+    if(s_mode == REPLAY_PLAYING)
+        return;
+
+    if(encoding()) {
+        unsigned char buff[sizeof(uint32_t) + 2 * sizeof(float)], *cursor = buff;
+        cursor = put(cursor, &ent->uid, sizeof(ent->uid));
+        cursor = put(cursor, &dest_xz.x, sizeof(float));
+        cursor = put(cursor, &dest_xz.z, sizeof(float));
+        if(!dispatch(REPLAY_CMD_MOVE, buff, sizeof(buff)))
+            return;
+    }
+    G_Move_SetDest(ent, dest_xz);
+}
+
+void G_Replay_CmdStop(const struct entity *ent)
+{
+    if(s_mode == REPLAY_PLAYING)
+        return;
+
+    if(encoding() && !dispatch(REPLAY_CMD_STOP, &ent->uid, sizeof(ent->uid)))
+        return;
+    G_StopEntity(ent);
+}
+
+void G_Replay_CmdStance(const struct entity *ent, enum combat_stance stance)
+{
+    if(s_mode == REPLAY_PLAYING)
+        return;
+
+    if(encoding()) {
+        uint8_t stance8 = stance;
+        unsigned char buff[sizeof(uint32_t) + sizeof(uint8_t)], *cursor = buff;
+        cursor = put(cursor, &ent->uid, sizeof(ent->uid));
+        cursor = put(cursor, &stance8, sizeof(stance8));
+        if(!dispatch(REPLAY_CMD_STANCE, buff, sizeof(buff)))
+            return;
+    }
+    G_Combat_SetStance(ent, stance);
+}
+
+void G_Replay_CmdOrder(const vec_pentity_t *sel, vec3_t target, bool attack)
+{
+    if(s_mode == REPLAY_PLAYING)
+        return;
+
+    if(encoding()) {
+
+        uint8_t attack8 = attack;
+        uint32_t nents = vec_size(sel);
+        size_t size = 3 * sizeof(float) + sizeof(attack8) + sizeof(nents) 
+                    + nents * sizeof(uint32_t);
+
+        unsigned char *buff = malloc(size), *cursor = buff;
+        if(!buff && G_Lockstep_Active()) {
+            fprintf(stderr, "Failed to allocate lockstep command. The order is dropped.\n");
+            return;
+        }
+        if(!buff) {
+            fprintf(stderr, "Failed to allocate replay command. Recording stopped.\n");
+            G_Replay_Stop();
+            goto issue;
+        }
+
+        cursor = put(cursor, &target.x, sizeof(float));
+        cursor = put(cursor, &target.y, sizeof(float));
+        cursor = put(cursor, &target.z, sizeof(float));
+        cursor = put(cursor, &attack8, sizeof(attack8));
+        cursor = put(cursor, &nents, sizeof(nents));
+        for(int i = 0; i < nents; i++) {
+            cursor = put(cursor, &vec_AT(sel, i)->uid, sizeof(uint32_t));
+        }
+        bool local = dispatch(REPLAY_CMD_ORDER, buff, size);
+        free(buff);
+        if(!local)
+            return;
+    }
+issue:
+    G_Move_Order(sel, target, attack);
+}
+
+bool G_Replay_CmdScriptEvent(int event, const void *data, size_t size)
+{
+    if(s_mode == REPLAY_PLAYING)
+        return false;
+
+    if(encoding()) {
+
+        int32_t event32 = event;
+        unsigned char *buff = malloc(sizeof(event32) + size);
+        if(!buff && G_Lockstep_Active()) {
+            fprintf(stderr, "Failed to allocate lockstep command. The event is dropped.\n");
+            return false;
+        }
+        if(!buff) {
+            fprintf(stderr, "Failed to allocate replay command. Recording stopped.\n");
+            G_Replay_Stop();
+            return true;
+        }
+
+        memcpy(buff, &event32, sizeof(event32));
+        memcpy(buff + sizeof(event32), data, size);
+        bool local = dispatch(REPLAY_CMD_SCRIPT_EVENT, buff, sizeof(event32) + size);
+        free(buff);
+        return local;
+    }
+    return true;
+}
+
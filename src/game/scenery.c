@@ -0,0 +1,268 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "scenery.h"
+#include "public/game.h"
+#include "../entity.h"
+#include "../main.h"
+#include "../collision.h"
+#include "../pf_math.h"
+#include "../config.h"
+#include "../render/public/render.h"
+#include "../render/public/render_ctrl.h"
+#include "../lib/public/vec.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define SCENERY_REQUIRED    (ENTITY_FLAG_STATIC | ENTITY_FLAG_COLLISION)
+#define SCENERY_EXCLUDED    (ENTITY_FLAG_ANIMATED | ENTITY_FLAG_SELECTABLE | ENTITY_FLAG_COMBATABLE \
+                           | ENTITY_FLAG_INVISIBLE | ENTITY_FLAG_ZOMBIE)
+
+struct scenery_ent{
+    const struct entity *ent;
+    /* Set when the entity's instance must be (re-)uploaded */
+    bool                 pending;
+};
+
+VEC_TYPE(sent, struct scenery_ent)
+VEC_IMPL(static inline, sent, struct scenery_ent)
+
+VEC_TYPE(uint, uint32_t)
+VEC_IMPL(static inline, uint, uint32_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Indexed by the entity slot */
+static vec_sent_t   s_ents;
+/* Slots of the entities with a pending upload */
+static vec_uint_t   s_pending;
+static size_t       s_count;
+/* Set when an entity has been removed since the last flush */
+static bool         s_removed;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool eligible(const struct entity *ent)
+{
+    return ((ent->flags & SCENERY_REQUIRED) == SCENERY_REQUIRED)
+        && !(ent->flags & SCENERY_EXCLUDED)
+        && ent->render_private;
+}
+
+static bool ents_reserve(size_t nslots)
+{
+    size_t old = vec_size(&s_ents);
+    if(old >= nslots)
+        return true;
+
+    if(s_ents.capacity < nslots
+    && !vec_sent_resize(&s_ents, MAX(nslots, s_ents.capacity * 2)))
+        return false;
+    memset(&vec_AT(&s_ents, old), 0, (nslots - old) * sizeof(struct scenery_ent));
+    s_ents.size = nslots;
+    return true;
+}
+
+static void scenery_update_push(uint32_t slot, const struct entity *ent, 
+                                struct scenery_update *out)
+{
+    struct obb obb;
+    Entity_CurrentOBB(ent, &obb);
+
+    vec3_t half = (vec3_t){obb.half_lengths[0], obb.half_lengths[1], obb.half_lengths[2]};
+    out->slot = slot;
+    out->render_private = ent->render_private;
+    Entity_ModelMatrix(ent, &out->model);
+    out->sphere = (vec4_t){obb.center.x, obb.center.y, obb.center.z, PFM_Vec3_Len(&half)};
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void G_Scenery_Init(void)
+{
+    vec_sent_init(&s_ents);
+    vec_uint_init(&s_pending);
+    s_count = 0;
+    s_removed = false;
+}
+
+void G_Scenery_Shutdown(void)
+{
+    vec_uint_destroy(&s_pending);
+    vec_sent_destroy(&s_ents);
+}
+
+void G_Scenery_Clear(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_count > 0 || vec_size(&s_pending) > 0) {
+        R_PushCmd((struct rcmd){ R_GL_SceneryClear, 0 });
+    }
+    vec_sent_reset(&s_ents);
+    vec_uint_reset(&s_pending);
+    s_count = 0;
+    s_removed = false;
+}
+
+void G_Scenery_Update(struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    bool member = G_Scenery_Contains(ent);
+    if(!member && !eligible(ent))
+        return;
+
+    if(!member) {
+        /* The slot is only meaningful for entities in the simulation */
+        if(!CONFIG_GPU_SCENERY || !R_SceneryGPUSupported())
+            return;
+        if(G_EntityForUID(ent->uid) != ent)
+            return;
+    }
+
+    if(!eligible(ent)) {
+        G_Scenery_Remove(ent);
+        return;
+    }
+
+    if(!member) {
+        if(!ents_reserve(ent->slot + 1))
+            return;
+        vec_AT(&s_ents, ent->slot) = (struct scenery_ent){ent, false};
+        s_count++;
+    }
+
+    struct scenery_ent *sent = &vec_AT(&s_ents, ent->slot);
+    if(sent->pending)
+        return;
+    if(!vec_uint_push(&s_pending, ent->slot))
+        return;
+    sent->pending = true;
+}
+
+void G_Scenery_Remove(const struct entity *ent)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!G_Scenery_Contains(ent))
+        return;
+
+    /* The render private data may be freed right after the entity is 
+     * removed, so the slot is emptied without waiting for the flush */
+    struct scenery_update *upd = R_AllocArg(sizeof(struct scenery_update));
+    if(upd) {
+        *upd = (struct scenery_update){ .slot = ent->slot, .render_private = NULL };
+        size_t count = 1;
+        R_PushCmd((struct rcmd){
+            .func = R_GL_SceneryUpdate,
+            .nargs = 2,
+            .args = { upd, R_PushArg(&count, sizeof(count)) },
+        });
+    }
+
+    vec_AT(&s_ents, ent->slot) = (struct scenery_ent){0};
+    s_count--;
+    s_removed = true;
+}
+
+bool G_Scenery_Contains(const struct entity *ent)
+{
+    return (ent->slot < vec_size(&s_ents))
+        && (vec_AT(&s_ents, ent->slot).ent == ent);
+}
+
+bool G_Scenery_Flush(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    bool ret = s_removed;
+    s_removed = false;
+
+    if(vec_size(&s_pending) == 0)
+        return ret;
+
+    struct scenery_update *updates = R_AllocArg(vec_size(&s_pending) * sizeof(struct scenery_update));
+    size_t count = 0;
+
+    for(int i = 0; i < vec_size(&s_pending); i++) {
+
+        uint32_t slot = vec_AT(&s_pending, i);
+        struct scenery_ent *sent = &vec_AT(&s_ents, slot);
+        /* Removed, or pushed twice after the slot got re-used */
+        if(!sent->pending)
+            continue;
+        sent->pending = false;
+        if(updates) {
+            scenery_update_push(slot, sent->ent, &updates[count++]);
+        }
+    }
+    vec_uint_reset(&s_pending);
+
+    if(count == 0)
+        return ret;
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_SceneryUpdate,
+        .nargs = 2,
+        .args = { updates, R_PushArg(&count, sizeof(count)) },
+    });
+    return true;
+}
+
+bool G_Scenery_Active(void)
+{
+    return (s_count > 0);
+}
+
+void G_Scenery_Render(const struct frustum *frustum, bool depth)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_SceneryDraw,
+        .nargs = 2,
+        .args = {
+            R_PushArg(frustum, sizeof(*frustum)),
+            R_PushArg(&depth, sizeof(depth)),
+        },
+    });
+}
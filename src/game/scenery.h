@@ -0,0 +1,66 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SCENERY_H
+#define SCENERY_H
+
+#include <stdbool.h>
+
+struct entity;
+struct frustum;
+
+void G_Scenery_Init(void);
+void G_Scenery_Shutdown(void);
+/* Drops all the scenery entities, on the CPU and GPU side */
+void G_Scenery_Clear(void);
+
+/* Scenery entities are static, non-animated, non-selectable and 
+ * non-combatable entities which are kept in a GPU-resident instance 
+ * buffer. They are culled and drawn entirely on the GPU and skipped by 
+ * the CPU-side culling. 'G_Scenery_Update' must be called whenever the 
+ * transform or the flags of an entity change. It is a no-op for entities 
+ * that are not (and are not becoming) scenery. */
+void G_Scenery_Remove(const struct entity *ent);
+bool G_Scenery_Contains(const struct entity *ent);
+
+/* Uploads the scenery entities that were added or transformed since the 
+ * last call. Returns true if the set of scenery instances has changed. */
+bool G_Scenery_Flush(void);
+/* True when there are scenery instances to draw */
+bool G_Scenery_Active(void);
+/* Pushes a draw of all the scenery instances inside the frustum */
+void G_Scenery_Render(const struct frustum *frustum, bool depth);
+
+#endif
@@ -35,6 +35,7 @@
 
 #include "selection.h"
 #include "public/game.h"
+#include "position.h"
 #include "../pf_math.h"
 #include "../event.h"
 #include "../render/public/render.h"
@@ -42,16 +43,24 @@
 #include "../config.h"
 #include "../camera.h"
 #include "../main.h"
+#include "../lib/public/khash.h"
 
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 
 #include <SDL.h>
 
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #define MAX(a, b)     ((a) > (b) ? (a) : (b))
+#define ARR_SIZE(a)   (sizeof(a)/sizeof(a[0]))
+#define EPSILON       (1.0f/1024)
+
+#define MAX_SEL_CANDIDATES (4096)
+
+KHASH_MAP_INIT_INT(selidx, int)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -81,6 +90,9 @@ static struct selection_ctx{
 }s_ctx;
 
 static vec_pentity_t s_selected;
+/* The index of every selected entity in 's_selected', by UID. This makes 
+ * finding out if an entity is selected, and unselecting it, O(1). */
+static khash_t(selidx) *s_selected_index;
 
 /*****************************************************************************/
 /* GLOBAL VARIABLES                                                          */
@@ -156,6 +168,15 @@ static void on_render_ui(void *user, void *event)
     });
 }
 
+/* The same entities as are in the visible set, i.e. the ones which can be 
+ * drawn, are considered */
+static bool sel_candidate_pred(const struct entity *ent, void *arg)
+{
+    return (ent->flags & ENTITY_FLAG_SELECTABLE)
+        && (ent->flags & ENTITY_FLAG_COLLISION)
+        && !(ent->flags & ENTITY_FLAG_INVISIBLE);
+}
+
 static vec3_t sel_unproject_mouse_coords(struct camera *cam, vec2_t mouse_coords, float ndc_z)
 {
     int w, h;
@@ -167,11 +188,9 @@ static vec3_t sel_unproject_mouse_coords(struct camera *cam, vec2_t mouse_coords
     vec4_t clip = (vec4_t){ndc.x, ndc.y, ndc.z, 1.0f};
 
     mat4x4_t view_proj_inverse; 
-    mat4x4_t view, proj, tmp;
+    mat4x4_t tmp;
 
-    Camera_MakeViewMat(cam, &view);
-    Camera_MakeProjMat(cam, &proj);
-    PFM_Mat4x4_Mult4x4(&proj, &view, &tmp);
+    Camera_MakeViewProjMat(cam, &tmp);
     PFM_Mat4x4_Inverse(&tmp, &view_proj_inverse); 
 
     vec4_t ret_homo;
@@ -238,9 +257,140 @@ static void sel_make_frustum(struct camera *cam, vec2_t mouse_down, vec2_t mouse
     PFM_Vec3_Normal(&out->left.normal, &out->left.normal);
 }
 
-static bool pentities_equal(struct entity *const *a, struct entity *const *b)
+static bool sel_push(struct entity *ent)
+{
+    int status;
+    khiter_t k = kh_put(selidx, s_selected_index, ent->uid, &status);
+    if(status == -1)
+        return false;
+
+    if(!vec_pentity_push(&s_selected, ent)) {
+        kh_del(selidx, s_selected_index, k);
+        return false;
+    }
+    kh_value(s_selected_index, k) = vec_size(&s_selected) - 1;
+    return true;
+}
+
+static void sel_del(int idx)
+{
+    khiter_t k = kh_get(selidx, s_selected_index, vec_AT(&s_selected, idx)->uid);
+    assert(k != kh_end(s_selected_index));
+    kh_del(selidx, s_selected_index, k);
+    vec_pentity_del(&s_selected, idx);
+
+    if(idx == vec_size(&s_selected))
+        return;
+
+    /* Patch the index of the entity that was moved into the vacated slot */
+    k = kh_get(selidx, s_selected_index, vec_AT(&s_selected, idx)->uid);
+    assert(k != kh_end(s_selected_index));
+    kh_value(s_selected_index, k) = idx;
+}
+
+static void sel_reset(void)
+{
+    vec_pentity_reset(&s_selected);
+    kh_clear(selidx, s_selected_index);
+}
+
+static int sel_index(const struct entity *ent)
 {
-    return ((*a) == (*b));
+    khiter_t k = kh_get(selidx, s_selected_index, ent->uid);
+    if(k == kh_end(s_selected_index))
+        return -1;
+    return kh_value(s_selected_index, k);
+}
+
+static void sel_test_ray(vec3_t origin, vec3_t dir, struct entity *ent, const struct obb *obb, 
+                         float *inout_t_min, bool *inout_empty)
+{
+    float t;
+    if(!C_RayIntersectsOBB(origin, dir, *obb, &t))
+        return;
+
+    *inout_empty = false;
+    if(t < *inout_t_min) {
+        *inout_t_min = t;
+        sel_reset();
+        sel_push(ent);
+    }
+}
+
+static void sel_test_frustum(const struct frustum *frust, struct entity *ent, const struct obb *obb, 
+                             bool *inout_empty)
+{
+    if(!C_FrustumOBBIntersectionExact(frust, obb))
+        return;
+
+    if(*inout_empty) {
+        sel_reset();
+        *inout_empty = false;
+    }
+    sel_push(ent);
+}
+
+/* Grows the XZ bounds by the part of the segment from 'a' to 'b' which lies 
+ * between the heights 'min_y' and 'max_y', if any. */
+static void sel_grow_by_segment(vec3_t a, vec3_t b, float min_y, float max_y, 
+                                vec2_t *inout_min, vec2_t *inout_max)
+{
+    float t0 = 0.0f, t1 = 1.0f;
+    float dy = b.y - a.y;
+
+    if(fabsf(dy) < EPSILON) {
+        if(a.y < min_y || a.y > max_y)
+            return;
+    }else{
+        float ta = (min_y - a.y) / dy;
+        float tb = (max_y - a.y) / dy;
+        t0 = MAX(t0, MIN(ta, tb));
+        t1 = MIN(t1, MAX(ta, tb));
+        if(t0 > t1)
+            return;
+    }
+
+    const float ts[2] = {t0, t1};
+    for(int i = 0; i < 2; i++) {
+
+        float x = a.x + (b.x - a.x) * ts[i];
+        float z = a.z + (b.z - a.z) * ts[i];
+        inout_min->x = MIN(inout_min->x, x);
+        inout_min->z = MIN(inout_min->z, z);
+        inout_max->x = MAX(inout_max->x, x);
+        inout_max->z = MAX(inout_max->z, z);
+    }
+}
+
+/* Finds the selectable entities which may intersect the volume bounded by the 
+ * segments in 'edges' using the position index. The part of the volume 
+ * that is at the heights where entities can be found is projected onto the 
+ * ground plane and padded by the largest entity's extent. Returns -1 when 
+ * there are too many candidates to hold, in which case the caller should 
+ * fall back to testing all the visible entities. */
+static int sel_candidates(const vec3_t (*edges)[2], size_t nedges, struct entity **out, size_t maxout)
+{
+    float radius, min_y, max_y;
+    if(!G_Pos_VolumeBounds(&radius, &min_y, &max_y))
+        return 0;
+
+    min_y -= radius;
+    max_y += radius;
+
+    vec2_t xz_min = (vec2_t){ FLT_MAX,  FLT_MAX};
+    vec2_t xz_max = (vec2_t){-FLT_MAX, -FLT_MAX};
+    for(int i = 0; i < nedges; i++) {
+        sel_grow_by_segment(edges[i][0], edges[i][1], min_y, max_y, &xz_min, &xz_max);
+    }
+
+    if(xz_min.x > xz_max.x)
+        return 0;
+
+    xz_min = (vec2_t){xz_min.x - radius, xz_min.z - radius};
+    xz_max = (vec2_t){xz_max.x + radius, xz_max.z + radius};
+
+    int ret = G_Pos_EntsInRectWithPred(xz_min, xz_max, out, maxout, sel_candidate_pred, NULL);
+    return (ret == maxout) ? -1 : ret;
 }
 
 static bool allied_to_player_controllabe(const bool *controllable,
@@ -311,11 +461,11 @@ static void sel_filter_and_set_type(void)
         const struct entity *curr = vec_AT(&s_selected, i);
         if(has_player && !controllable[curr->faction_id]) {
 
-            vec_pentity_del(&s_selected, i);
+            sel_del(i);
         }else if(!has_player && has_allied
         && !allied_to_player_controllabe(controllable, num_facs, curr->faction_id)) {
 
-            vec_pentity_del(&s_selected, i);
+            sel_del(i);
         }
     }
 }
@@ -326,6 +476,10 @@ static void sel_filter_and_set_type(void)
 
 bool G_Sel_Init(void)
 {
+    s_selected_index = kh_init(selidx);
+    if(!s_selected_index)
+        return false;
+
     vec_pentity_init(&s_selected);
     return true;
 }
@@ -334,6 +488,7 @@ void G_Sel_Shutdown(void)
 {
     G_Sel_Disable();
     vec_pentity_destroy(&s_selected);
+    kh_destroy(selidx, s_selected_index);
 }
 
 void G_Sel_Enable(void)
@@ -361,14 +516,19 @@ void G_Sel_Disable(void)
 }
 
 /* Note that the selection is only changed if there is at least one entity in the new selection. Otherwise
- * (ex. if the player is left-clicking on an empty part of the map), the previous selection is kept. */
+ * (ex. if the player is left-clicking on an empty part of the map), the previous selection is kept. 
+ *
+ * The exact tests are only run on the candidates found via the position index. The visible set is 
+ * only scanned as a fallback, when there are more candidates than can be held. */
 void G_Sel_Update(struct camera *cam, const vec_pentity_t *visible, const vec_obb_t *visible_obbs)
 {
     if(s_ctx.state != STATE_MOUSE_SEL_RELEASED)
         return;
     s_ctx.state = STATE_MOUSE_SEL_UP;
 
+    struct entity *cands[MAX_SEL_CANDIDATES];
     bool sel_empty = true;
+
     if(s_ctx.mouse_down_coord.x == s_ctx.mouse_up_coord.x && s_ctx.mouse_down_coord.y && s_ctx.mouse_up_coord.y) {
 
         /* Case 1: The mouse is pressed and released in the same spot, meaning we can use a single ray
@@ -378,27 +538,31 @@ void G_Sel_Update(struct camera *cam, const vec_pentity_t *visible, const vec_ob
          * OBBs intersect with the mouse ray. We pick the one with the closest intersection point.
          */
         vec3_t ray_origin = sel_unproject_mouse_coords(cam, s_ctx.mouse_up_coord, -1.0f);
+        vec3_t ray_end = sel_unproject_mouse_coords(cam, s_ctx.mouse_up_coord, 1.0f);
         vec3_t ray_dir;
 
         vec3_t cam_pos = Camera_GetPos(cam);
         PFM_Vec3_Sub(&ray_origin, &cam_pos, &ray_dir);
         PFM_Vec3_Normal(&ray_dir, &ray_dir);
 
+        const vec3_t edges[][2] = {{ray_origin, ray_end}};
+        int ncands = sel_candidates(edges, ARR_SIZE(edges), cands, ARR_SIZE(cands));
         float t_min = FLT_MAX;
-        for(int i = 0; i < vec_size(visible_obbs); i++) {
 
-            if(!(vec_AT(visible, i)->flags & ENTITY_FLAG_SELECTABLE))
-                continue;
-        
-            float t;
-            if(C_RayIntersectsOBB(ray_origin, ray_dir, vec_AT(visible_obbs, i), &t)) {
-
-                sel_empty = false;
-                if(t < t_min) {
-                    t_min = t;
-                    vec_pentity_reset(&s_selected);                
-                    vec_pentity_push(&s_selected, vec_AT(visible, i));
-                }
+        if(ncands >= 0) {
+            for(int i = 0; i < ncands; i++) {
+
+                struct obb obb;
+                Entity_CurrentOBB(cands[i], &obb);
+                sel_test_ray(ray_origin, ray_dir, cands[i], &obb, &t_min, &sel_empty);
+            }
+        }else{
+            for(int i = 0; i < vec_size(visible_obbs); i++) {
+
+                if(!(vec_AT(visible, i)->flags & ENTITY_FLAG_SELECTABLE))
+                    continue;
+                sel_test_ray(ray_origin, ray_dir, vec_AT(visible, i), &vec_AT(visible_obbs, i), 
+                    &t_min, &sel_empty);
             }
         }
 
@@ -409,18 +573,26 @@ void G_Sel_Update(struct camera *cam, const vec_pentity_t *visible, const vec_ob
         struct frustum frust;
         sel_make_frustum(cam, s_ctx.mouse_down_coord, s_ctx.mouse_up_coord, &frust);
 
-        for(int i = 0; i < vec_size(visible_obbs); i++) {
+        const vec3_t edges[][2] = {
+            {frust.ntl, frust.ftl}, {frust.ntr, frust.ftr}, {frust.nbl, frust.fbl}, {frust.nbr, frust.fbr},
+            {frust.ntl, frust.ntr}, {frust.ntr, frust.nbr}, {frust.nbr, frust.nbl}, {frust.nbl, frust.ntl},
+            {frust.ftl, frust.ftr}, {frust.ftr, frust.fbr}, {frust.fbr, frust.fbl}, {frust.fbl, frust.ftl},
+        };
+        int ncands = sel_candidates(edges, ARR_SIZE(edges), cands, ARR_SIZE(cands));
 
-            if(!(vec_AT(visible, i)->flags & ENTITY_FLAG_SELECTABLE))
-                continue;
+        if(ncands >= 0) {
+            for(int i = 0; i < ncands; i++) {
 
-            if(C_FrustumOBBIntersectionExact(&frust, &vec_AT(visible_obbs, i))) {
+                struct obb obb;
+                Entity_CurrentOBB(cands[i], &obb);
+                sel_test_frustum(&frust, cands[i], &obb, &sel_empty);
+            }
+        }else{
+            for(int i = 0; i < vec_size(visible_obbs); i++) {
 
-                if(sel_empty) {
-                    vec_pentity_reset(&s_selected);
-                    sel_empty = false;
-                }
-                vec_pentity_push(&s_selected, vec_AT(visible, i));
+                if(!(vec_AT(visible, i)->flags & ENTITY_FLAG_SELECTABLE))
+                    continue;
+                sel_test_frustum(&frust, vec_AT(visible, i), &vec_AT(visible_obbs, i), &sel_empty);
             }
         }
     }
@@ -437,29 +609,39 @@ void G_Sel_Clear(void)
     memset(&s_ctx, 0, sizeof(s_ctx));
     s_ctx.installed = installed;
 
-    vec_pentity_reset(&s_selected);
+    sel_reset();
 }
 
 void G_Sel_Add(struct entity *ent)
 {
     assert(ent->flags & ENTITY_FLAG_SELECTABLE);
 
-    int idx;
-    vec_pentity_indexof(&s_selected, ent, pentities_equal, &idx);
-    if(idx == -1) {
-        vec_pentity_push(&s_selected, ent);
+    if(sel_index(ent) == -1) {
+        sel_push(ent);
         sel_filter_and_set_type();
     }
 }
 
 void G_Sel_Remove(struct entity *ent)
 {
-    assert(ent->flags & ENTITY_FLAG_SELECTABLE);
+    G_Sel_RemoveBatch(&ent, 1);
+}
+
+void G_Sel_RemoveBatch(struct entity *const *ents, size_t nents)
+{
+    bool changed = false;
+    for(int i = 0; i < nents; i++) {
+
+        assert(ents[i]->flags & ENTITY_FLAG_SELECTABLE);
+        int idx = sel_index(ents[i]);
+        if(idx == -1)
+            continue;
+
+        sel_del(idx);
+        changed = true;
+    }
 
-    int idx;
-    vec_pentity_indexof(&s_selected, ent, pentities_equal, &idx);
-    if(idx != -1) {
-        vec_pentity_del(&s_selected, idx);
+    if(changed) {
         E_Global_Notify(EVENT_UNIT_SELECTION_CHANGED, NULL, ES_ENGINE);
     }
 }
@@ -35,73 +35,54 @@
 
 #include "public/game.h"
 #include "timer_events.h"
+#include "lockstep.h"
 #include "../event.h"
+#include "../config.h"
 
 #include <math.h>
 #include <assert.h>
 #include <SDL.h>
+#include <string.h>
 
-#define TIMER_INTERVAL  (1000.0f/60.0f)
+#define TIMER_INTERVAL  (1.0/TIMER_HZ)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static unsigned long long s_num_60hz_ticks;
-static SDL_TimerID        s_60hz_timer;
+/* The simulation time (in seconds) that has elapsed, but not yet been ticked */
+static double             s_accum;
+static uint64_t           s_last_count;
+static struct timer_stats s_stats;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* Timer callback gets called from another thread. In the callback, push 
- * a user event (threadsafe) with the code '0' and handle the 'EVENT_60HZ_TICK' 
- * event in the main thread.
+/* The lower-rate ticks are delivered immediately, so that all the work of 
+ * one tick is done before the next tick starts, no matter how many ticks 
+ * are run in the same frame. 
  */
-static uint32_t timer_callback(uint32_t interval, void *param)
-{
-    static double s_error = 0.0f;
-    s_error += (TIMER_INTERVAL - interval);
-
-    double intpart, fracpart;
-    fracpart = modf(s_error, &intpart);
-    (void)fracpart;
-
-    s_error -= intpart;
-    interval = ((int)TIMER_INTERVAL) + intpart;
-
-    SDL_Event event = (SDL_Event) {
-        .type = SDL_USEREVENT,
-        .user = (SDL_UserEvent) {
-            .type = SDL_USEREVENT,
-            .code = 0,
-            .data1 = NULL,
-            .data2 = NULL,
-        },
-    };
-
-    SDL_PushEvent(&event);
-    return interval;
-}
-
 static void timer_60hz_handler(void *unused1, void *unused2)
 {
     s_num_60hz_ticks++;
+    G_Lockstep_OnTick(s_num_60hz_ticks);
 
     if(s_num_60hz_ticks % 2 == 0)
-        E_Global_Notify(EVENT_30HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_30HZ_TICK, NULL, ES_ENGINE);
 
     if(s_num_60hz_ticks % 3 == 0)
-        E_Global_Notify(EVENT_20HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_20HZ_TICK, NULL, ES_ENGINE);
 
     if(s_num_60hz_ticks % 4 == 0)
-        E_Global_Notify(EVENT_15HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_15HZ_TICK, NULL, ES_ENGINE);
 
     if(s_num_60hz_ticks % 6 == 0)
-        E_Global_Notify(EVENT_10HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_10HZ_TICK, NULL, ES_ENGINE);
 
     if(s_num_60hz_ticks % 60 == 0)
-        E_Global_Notify(EVENT_1HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_1HZ_TICK, NULL, ES_ENGINE);
 }
 
 /*****************************************************************************/
@@ -110,9 +91,10 @@ static void timer_60hz_handler(void *unused1, void *unused2)
 
 bool G_Timer_Init(void)
 {
-    s_60hz_timer = SDL_AddTimer(TIMER_INTERVAL, timer_callback, NULL);
-    if(0 == s_60hz_timer)
-        return false;
+    s_num_60hz_ticks = 0;
+    s_accum = 0.0;
+    s_last_count = SDL_GetPerformanceCounter();
+    memset(&s_stats, 0, sizeof(s_stats));
 
     /* We will still generate timer events while the simulation is paused.
      * Most handlers should be masked out, however. */
@@ -124,6 +106,79 @@ bool G_Timer_Init(void)
 void G_Timer_Shutdown(void)
 {
     E_Global_Unregister(EVENT_60HZ_TICK, timer_60hz_handler);
-    SDL_RemoveTimer(s_60hz_timer);
+}
+
+int G_Timer_Update(void)
+{
+    uint64_t curr_count = SDL_GetPerformanceCounter();
+    s_accum += (double)(curr_count - s_last_count) / SDL_GetPerformanceFrequency();
+    s_last_count = curr_count;
+    G_Lockstep_Poll();
+
+    int nticks = 0;
+    while(s_accum >= TIMER_INTERVAL && nticks < CONFIG_SIM_MAX_TICKS_PER_FRAME) {
+
+        /* In a lockstep match, the time spent waiting for the other peers 
+         * is not caught up on afterwards */
+        if(!G_Lockstep_TickReady(s_num_60hz_ticks + nticks + 1)) {
+            s_accum = fmin(s_accum, TIMER_INTERVAL);
+            break;
+        }
+        E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+        s_accum -= TIMER_INTERVAL;
+        nticks++;
+    }
+
+    /* We could not keep up. Rather than running ever more ticks to catch up, 
+     * which makes the frames longer still, the simulation is slowed down. */
+    if(nticks == CONFIG_SIM_MAX_TICKS_PER_FRAME && s_accum >= TIMER_INTERVAL) {
+
+        unsigned long dropped = floor(s_accum / TIMER_INTERVAL);
+        s_accum -= dropped * TIMER_INTERVAL;
+        s_stats.overrun_frames++;
+        s_stats.dropped_ticks += dropped;
+    }
+
+    s_stats.ticks += nticks;
+    s_stats.last_frame_ticks = nticks;
+    return nticks;
+}
+
+int G_Timer_Step(void)
+{
+    s_accum = 0.0;
+    s_last_count = SDL_GetPerformanceCounter();
+
+    G_Lockstep_Poll();
+    if(!G_Lockstep_TickReady(s_num_60hz_ticks + 1)) {
+        s_stats.last_frame_ticks = 0;
+        return 0;
+    }
+    E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+
+    s_stats.ticks++;
+    s_stats.last_frame_ticks = 1;
+    return 1;
+}
+
+void G_Timer_ResetTicks(void)
+{
+    s_num_60hz_ticks = 0;
+    s_accum = 0.0;
+}
+
+unsigned long long G_Timer_Ticks(void)
+{
+    return s_num_60hz_ticks;
+}
+
+float G_Timer_Alpha(void)
+{
+    return s_accum / TIMER_INTERVAL;
+}
+
+void G_Timer_GetStats(struct timer_stats *out)
+{
+    *out = s_stats;
 }
 
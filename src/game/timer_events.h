@@ -38,9 +38,18 @@
 
 #include <stdbool.h>
 
+/* The rate of the base simulation tick */
+#define TIMER_HZ (60)
 
 bool G_Timer_Init(void);
 void G_Timer_Shutdown(void);
+/* Restarts the count of base ticks from zero, so that the lower-rate ticks 
+ * are delivered on the same ticks as on a lockstep match's other peers */
+void               G_Timer_ResetTicks(void);
+/* The number of base ticks that have been run so far, and the fraction of 
+ * the next tick's interval that has elapsed */
+unsigned long long G_Timer_Ticks(void);
+float              G_Timer_Alpha(void);
 
 #endif
 
@@ -0,0 +1,190 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* A monotone priority queue for integer priorities (a radix heap). The priority 
+ * of every pushed element must be no smaller than that of the last popped one, 
+ * which holds for wavefront expansions with non-negative edge costs. Elements are 
+ * kept in buckets by the highest bit in which their priority differs from that 
+ * of the last popped element. Pushes are O(1) and every element is moved between 
+ * buckets at most 32 times in total. Unlike the heap in pqueue.h, elements with 
+ * equal priorities are popped in no particular order.
+ */
+
+#define BQ_NUM_BUCKETS (33)
+
+/***********************************************************************************************/
+
+#define BUCKET_QUEUE_TYPE(name, type)                                                           \
+                                                                                                \
+    typedef struct bq_##name##_node_s {                                                         \
+        uint32_t priority;                                                                      \
+        type data;                                                                              \
+    } bq_##name##_node_t;                                                                       \
+                                                                                                \
+    typedef struct bq_##name##_bucket_s {                                                       \
+        bq_##name##_node_t *nodes;                                                              \
+        size_t capacity;                                                                        \
+        size_t size;                                                                            \
+    } bq_##name##_bucket_t;                                                                     \
+                                                                                                \
+    typedef struct bq_##name##_s {                                                              \
+        bq_##name##_bucket_t buckets[BQ_NUM_BUCKETS];                                           \
+        /* The priority of the last popped element */                                           \
+        uint32_t last;                                                                          \
+        size_t size;                                                                            \
+    } bq_##name##_t;                                                                            \
+
+/***********************************************************************************************/
+
+#define bq(name)                                                                                \
+    bq_##name##_t
+
+/***********************************************************************************************/
+
+#define bq_size(bqueue)                                                                         \
+    ((bqueue)->size)
+
+/***********************************************************************************************/
+
+#define BUCKET_QUEUE_PROTOTYPES(scope, name, type)                                              \
+                                                                                                \
+    scope void bq_##name##_init    (bq(name) *bqueue);                                          \
+    scope void bq_##name##_destroy (bq(name) *bqueue);                                          \
+    scope bool bq_##name##_push    (bq(name) *bqueue, uint32_t in_prio, type in);               \
+    scope bool bq_##name##_pop     (bq(name) *bqueue, type *out, uint32_t *out_prio);
+
+/***********************************************************************************************/
+
+#define BUCKET_QUEUE_IMPL(scope, name, type)                                                    \
+                                                                                                \
+    static int _bq_##name##_bucket_idx(uint32_t last, uint32_t prio)                            \
+    {                                                                                           \
+        uint32_t diff = prio ^ last;                                                            \
+        int ret = 0;                                                                            \
+        while(diff) {                                                                           \
+            diff >>= 1;                                                                         \
+            ret++;                                                                              \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    static bool _bq_##name##_bucket_push(bq_##name##_bucket_t *bucket, bq_##name##_node_t node) \
+    {                                                                                           \
+        if(bucket->size == bucket->capacity) {                                                  \
+                                                                                                \
+            size_t new_cap = bucket->capacity ? bucket->capacity * 2 : 16;                      \
+            bq_##name##_node_t *new_nodes = realloc(bucket->nodes,                              \
+                new_cap * sizeof(bq_##name##_node_t));                                          \
+            if(!new_nodes)                                                                      \
+                return false;                                                                   \
+            bucket->nodes = new_nodes;                                                          \
+            bucket->capacity = new_cap;                                                         \
+        }                                                                                       \
+        bucket->nodes[bucket->size++] = node;                                                   \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void bq_##name##_init(bq(name) *bqueue)                                               \
+    {                                                                                           \
+        memset(bqueue, 0, sizeof(*bqueue));                                                     \
+    }                                                                                           \
+                                                                                                \
+    scope void bq_##name##_destroy(bq(name) *bqueue)                                            \
+    {                                                                                           \
+        for(int i = 0; i < BQ_NUM_BUCKETS; i++)                                                 \
+            free(bqueue->buckets[i].nodes);                                                     \
+    }                                                                                           \
+                                                                                                \
+    scope bool bq_##name##_push(bq(name) *bqueue, uint32_t in_prio, type in)                    \
+    {                                                                                           \
+        assert(in_prio >= bqueue->last);                                                        \
+        int idx = _bq_##name##_bucket_idx(bqueue->last, in_prio);                               \
+        if(!_bq_##name##_bucket_push(&bqueue->buckets[idx], (bq_##name##_node_t){in_prio, in})) \
+            return false;                                                                       \
+        bqueue->size++;                                                                         \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool bq_##name##_pop(bq(name) *bqueue, type *out, uint32_t *out_prio)                 \
+    {                                                                                           \
+        if(bqueue->size == 0)                                                                   \
+            return false;                                                                       \
+                                                                                                \
+        if(bqueue->buckets[0].size == 0) {                                                      \
+                                                                                                \
+            /* Advance to the smallest element in the first non-empty bucket.  */               \
+            /* Relative to it, all the bucket's elements fall in lower buckets. */              \
+            int i = 1;                                                                          \
+            while(bqueue->buckets[i].size == 0)                                                 \
+                i++;                                                                            \
+                                                                                                \
+            bq_##name##_bucket_t *src = &bqueue->buckets[i];                                    \
+            uint32_t min = src->nodes[0].priority;                                              \
+            for(int j = 1; j < src->size; j++) {                                                \
+                if(src->nodes[j].priority < min)                                                \
+                    min = src->nodes[j].priority;                                               \
+            }                                                                                   \
+                                                                                                \
+            bqueue->last = min;                                                                 \
+            for(int j = 0; j < src->size; j++) {                                                \
+                int idx = _bq_##name##_bucket_idx(min, src->nodes[j].priority);                 \
+                assert(idx < i);                                                                \
+                if(!_bq_##name##_bucket_push(&bqueue->buckets[idx], src->nodes[j]))             \
+                    return false;                                                               \
+            }                                                                                   \
+            src->size = 0;                                                                      \
+        }                                                                                       \
+                                                                                                \
+        bq_##name##_bucket_t *first = &bqueue->buckets[0];                                      \
+        bq_##name##_node_t node = first->nodes[--first->size];                                  \
+        *out = node.data;                                                                       \
+        if(out_prio)                                                                            \
+            *out_prio = node.priority;                                                          \
+        bqueue->size--;                                                                         \
+        return true;                                                                            \
+    }                                                                                           \
+
+#endif
+
@@ -42,6 +42,21 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* The replacement policy of the cache. With LRU_POLICY_RECENCY, the least recently used 
+ * entry is always evicted. With LRU_POLICY_COST, the entries are aged in GreedyDual 
+ * fashion: the victim is chosen among the least recently used entries as the one with
+ * the lowest priority, where an entry's priority is set to the sum of the cost of 
+ * (re)creating it and the priority of the last victim when it is referenced. 
+ * Expensive entries thus outlive cheap ones, but everything will eventually age out.
+ */
+enum lru_policy{
+    LRU_POLICY_RECENCY,
+    LRU_POLICY_COST,
+};
+
+/* The number of least recently used entries considered for eviction under LRU_POLICY_COST */
+#define LRU_COST_SAMPLES (8)
+
 /***********************************************************************************************/
 
 #define LRU_CACHE_TYPE(name, type)                                                              \
@@ -50,10 +65,12 @@
         mp_ref_t next;                                                                          \
         mp_ref_t prev;                                                                          \
         khint64_t key;                                                                          \
+        float cost;                                                                             \
+        float priority;                                                                         \
         type entry;                                                                             \
     } lru_##name##_node_t;                                                                      \
                                                                                                 \
-    MPOOL_TYPE(name, lru_##name##_node_t)                                                       \
+    MPOOL_CHUNKED_TYPE(name, lru_##name##_node_t)                                               \
 	__KHASH_TYPE(name, khint64_t, mp_ref_t) 								                    \
                                                                                                 \
     typedef struct lru_##name##_s {                                                             \
@@ -63,6 +80,8 @@
         mp_ref_t       ilru_tail;                                                               \
         khash_t(name) *key_node_table;                                                          \
         mp(name)       node_pool;                                                               \
+        enum lru_policy policy;                                                                 \
+        float          inflation;                                                               \
         /* Optional hook to clean up entries' resources before eviction */                      \
         void           (*on_evict)(type *victim);                                               \
     } lru_##name##_t;
@@ -94,34 +113,46 @@
 
 #define LRU_CACHE_PROTOTYPES(scope, name, type)                                                 \
                                                                                                 \
-    MPOOL_PROTOTYPES(scope, name, lru_node(name))                                               \
+    MPOOL_CHUNKED_PROTOTYPES(scope, name, lru_node(name))                                       \
 	__KHASH_PROTOTYPES(name, khint64_t, mp_ref_t)                                               \
                                                                                                 \
     static void _lru_##name##_reference(lru(name) *lru, mp_ref_t ref);                          \
+    static mp_ref_t _lru_##name##_victim(lru(name) *lru);                                       \
     scope  bool  lru_##name##_init     (lru(name) *lru, size_t capacity,                        \
                                         void (*on_evict)(type *victim));                        \
     scope  void  lru_##name##_destroy  (lru(name) *lru);                                        \
     scope  void  lru_##name##_clear    (lru(name) *lru);                                        \
     scope  bool  lru_##name##_get      (lru(name) *lru, uint64_t key, type *out);               \
-    /* Returned pointer is invalidated when new entries are added; it should not be cached  */  \
+    /* Returned pointer is invalidated when the entry is evicted or overwritten, which may  */  \
+    /* happen whenever new entries are added; it should not be cached                       */  \
     scope  const type *lru_##name##_at (lru(name) *lru, uint64_t key);                          \
     scope  bool  lru_##name##_contains (lru(name) *lru, uint64_t key);                          \
+    /* Same as the above, but without referencing the entry */                                  \
+    scope  const type *lru_##name##_peek(lru(name) *lru, uint64_t key);                         \
     scope  void  lru_##name##_put      (lru(name) *lru, uint64_t key, const type *in);          \
+    /* Only affects the eviction order under LRU_POLICY_COST */                                 \
+    scope  void  lru_##name##_put_cost (lru(name) *lru, uint64_t key, const type *in,           \
+                                        float cost);                                            \
+    /* Returns the cost of the entry (0 if there is none), without referencing it */            \
+    scope  float lru_##name##_cost     (lru(name) *lru, uint64_t key);                          \
+    scope  void  lru_##name##_set_policy(lru(name) *lru, enum lru_policy policy);               \
     scope  bool  lru_##name##_remove   (lru(name) *lru, uint64_t key);                          \
 
 /***********************************************************************************************/
 
 #define LRU_CACHE_IMPL(scope, name, type)                                                       \
                                                                                                 \
-    MPOOL_IMPL(static, name, lru_node(name))                                                    \
+    MPOOL_CHUNKED_IMPL(static, name, lru_node(name))                                            \
     __KHASH_IMPL(name, extern, khint64_t, mp_ref_t, 1, kh_int_hash_func, kh_int_hash_equal)     \
                                                                                                 \
     static void _lru_##name##_reference(lru(name) *lru, mp_ref_t ref)                           \
     {                                                                                           \
+        lru_node(name) *node = mp_##name##_entry(&lru->node_pool, ref);                         \
+        node->priority = lru->inflation + node->cost;                                           \
+                                                                                                \
         if(ref == lru->ilru_head)                                                               \
             return;                                                                             \
                                                                                                 \
-        lru_node(name) *node = mp_##name##_entry(&lru->node_pool, ref);                         \
         lru_node(name) *prev = node->prev ? mp_##name##_entry(&lru->node_pool, node->prev)      \
                                           : NULL;                                               \
         lru_node(name) *next = node->next ? mp_##name##_entry(&lru->node_pool, node->next)      \
@@ -148,6 +179,28 @@
         }                                                                                       \
     }                                                                                           \
                                                                                                 \
+    static mp_ref_t _lru_##name##_victim(lru(name) *lru)                                        \
+    {                                                                                           \
+        if(lru->policy == LRU_POLICY_RECENCY)                                                   \
+            return lru->ilru_tail;                                                              \
+                                                                                                \
+        mp_ref_t ret = lru->ilru_tail;                                                          \
+        float min_prio = mp_##name##_entry(&lru->node_pool, ret)->priority;                     \
+        mp_ref_t curr = mp_##name##_entry(&lru->node_pool, ret)->prev;                          \
+                                                                                                \
+        for(int i = 1; curr && i < LRU_COST_SAMPLES; i++) {                                     \
+            lru_node(name) *node = mp_##name##_entry(&lru->node_pool, curr);                    \
+            if(node->priority < min_prio) {                                                     \
+                min_prio = node->priority;                                                      \
+                ret = curr;                                                                     \
+            }                                                                                   \
+            curr = node->prev;                                                                  \
+        }                                                                                       \
+                                                                                                \
+        lru->inflation = min_prio;                                                              \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
     scope bool lru_##name##_init(lru(name) *lru, size_t capacity,                               \
                                      void (*on_evict)(type *victim))                            \
     {                                                                                           \
@@ -157,13 +210,12 @@
             return false;                                                                       \
         kh_resize(name, lru->key_node_table, capacity);                                         \
                                                                                                 \
+        /* The nodes are allocated on demand, in chunks that never move */                      \
         mp_##name##_init(&lru->node_pool);                                                      \
-        if(!mp_##name##_reserve(&lru->node_pool, capacity)) {                                   \
-            kh_destroy(name, lru->key_node_table);                                              \
-            return false;                                                                       \
-        }                                                                                       \
         lru->capacity = capacity;                                                               \
         lru->on_evict = on_evict;                                                               \
+        lru->policy = LRU_POLICY_RECENCY;                                                       \
+        lru->inflation = 0.0f;                                                                  \
         return true;                                                                            \
     }                                                                                           \
                                                                                                 \
@@ -184,14 +236,16 @@
             (void)key;                                                                          \
             if(!lru->on_evict)                                                                  \
                 continue;                                                                       \
-            lru_node(name) *vict = &lru->node_pool.pool[curr].entry;                            \
+            lru_node(name) *vict = mp_##name##_entry(&lru->node_pool, curr);                    \
             lru->on_evict(&vict->entry);                                                        \
         });                                                                                     \
                                                                                                 \
         kh_clear(name, lru->key_node_table);                                                    \
+        mp_##name##_clear(&lru->node_pool);                                                     \
         lru->ilru_head = 0;                                                                     \
         lru->ilru_tail = 0;                                                                     \
         lru->used = 0;                                                                          \
+        lru->inflation = 0.0f;                                                                  \
     }                                                                                           \
                                                                                                 \
     scope bool lru_##name##_get(lru(name) *lru, uint64_t key, type *out)                        \
@@ -221,12 +275,43 @@
         return &mpn->entry;                                                                     \
     }                                                                                           \
                                                                                                 \
+    scope const type *lru_##name##_peek(lru(name) *lru, uint64_t key)                           \
+    {                                                                                           \
+        khiter_t k;                                                                             \
+        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table))         \
+            return NULL;                                                                        \
+                                                                                                \
+        mp_ref_t ref = kh_val(lru->key_node_table, k);                                          \
+        return &mp_##name##_entry(&lru->node_pool, ref)->entry;                                 \
+    }                                                                                           \
+                                                                                                \
     scope bool lru_##name##_contains(lru(name) *lru, uint64_t key)                              \
     {                                                                                           \
         return (lru_##name##_at(lru, key) != NULL);                                             \
     }                                                                                           \
                                                                                                 \
     scope void lru_##name##_put(lru(name) *lru, uint64_t key, const type *in)                   \
+    {                                                                                           \
+        lru_##name##_put_cost(lru, key, in, 1.0f);                                              \
+    }                                                                                           \
+                                                                                                \
+    scope float lru_##name##_cost(lru(name) *lru, uint64_t key)                                 \
+    {                                                                                           \
+        khiter_t k;                                                                             \
+        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table))         \
+            return 0.0f;                                                                        \
+                                                                                                \
+        mp_ref_t ref = kh_val(lru->key_node_table, k);                                          \
+        return mp_##name##_entry(&lru->node_pool, ref)->cost;                                   \
+    }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_set_policy(lru(name) *lru, enum lru_policy policy)                  \
+    {                                                                                           \
+        lru->policy = policy;                                                                   \
+    }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_put_cost(lru(name) *lru, uint64_t key, const type *in,              \
+                                     float cost)                                                \
     {                                                                                           \
         khiter_t k;                                                                             \
         if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table)) {       \
@@ -234,18 +319,25 @@
                                                                                                 \
             mp_ref_t new_ref = 0;                                                               \
             lru_node(name) *new_node = NULL;                                                    \
-            if(lru->used == 0) {                                                                \
-                                                                                                \
+            if(lru->used < lru->capacity)                                                       \
                 new_ref = mp_##name##_alloc(&lru->node_pool);                                   \
+                                                                                                \
+            /* When a node could not be allocated, recycle the victim's */                      \
+            if(!new_ref && lru->used == 0)                                                      \
+                return;                                                                         \
+                                                                                                \
+            if(new_ref && lru->used == 0) {                                                     \
+                                                                                                \
                 new_node = mp_##name##_entry(&lru->node_pool, new_ref);                         \
                 new_node->prev = 0;                                                             \
                 new_node->next = 0;                                                             \
                 lru->ilru_head = lru->ilru_tail = new_ref;                                      \
                 ++(lru->used);                                                                  \
                                                                                                 \
-            }else if(lru->used == lru->capacity) {                                              \
+            }else if(!new_ref) {                                                                \
                                                                                                 \
-                lru_node(name) *vict = mp_##name##_entry(&lru->node_pool, lru->ilru_tail);      \
+                mp_ref_t vict_ref = _lru_##name##_victim(lru);                                  \
+                lru_node(name) *vict = mp_##name##_entry(&lru->node_pool, vict_ref);            \
                 if(lru->on_evict)                                                               \
                     lru->on_evict(&vict->entry);                                                \
                                                                                                 \
@@ -253,13 +345,12 @@
                 k = kh_get(name, lru->key_node_table, vict->key);                               \
                 kh_del(name, lru->key_node_table, k);                                           \
                                                                                                 \
-                new_ref = lru->ilru_tail;                                                       \
+                new_ref = vict_ref;                                                             \
                 new_node = vict;                                                                \
                 _lru_##name##_reference(lru, new_ref);                                          \
                                                                                                 \
             }else {                                                                             \
                                                                                                 \
-                new_ref = mp_##name##_alloc(&lru->node_pool);                                   \
                 new_node = mp_##name##_entry(&lru->node_pool, new_ref);                         \
                 lru_node(name) *old_head = mp_##name##_entry(&lru->node_pool, lru->ilru_head);  \
                                                                                                 \
@@ -272,6 +363,8 @@
                                                                                                 \
             new_node->entry = *in;                                                              \
             new_node->key = key;                                                                \
+            new_node->cost = cost;                                                              \
+            new_node->priority = lru->inflation + cost;                                         \
                                                                                                 \
             int ret;                                                                            \
             k = kh_put(name, lru->key_node_table, key, &ret);                                   \
@@ -287,6 +380,7 @@
                 lru->on_evict(&mpn->entry);                                                     \
                                                                                                 \
             mpn->entry = *in;                                                                   \
+            mpn->cost = cost;                                                                   \
             _lru_##name##_reference(lru, ref);                                                  \
         }                                                                                       \
     }                                                                                           \
@@ -0,0 +1,255 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef LRU_CACHE_TS_H
+#define LRU_CACHE_TS_H
+
+/* A thread-safe LRU cache. The keys are distributed between a number of
+ * independent shards, each one being a regular 'lru' with its' own lock.
+ * Threads accessing entries in different shards never contend, and 
+ * eviction is performed per-shard, in LRU order of the shard's entries. 
+ */
+
+#include "lru_cache.h"
+
+#include <SDL_atomic.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TS_LRU_NUM_SHARDS (16) /* Must be a power of 2 */
+
+/***********************************************************************************************/
+
+#define TS_LRU_CACHE_TYPE(name, type)                                                           \
+                                                                                                \
+    LRU_CACHE_TYPE(name, type)                                                                  \
+                                                                                                \
+    typedef struct ts_lru_##name##_shard_s {                                                    \
+        SDL_SpinLock   lock;                                                                    \
+        lru(name)      lru;                                                                     \
+    } ts_lru_##name##_shard_t;                                                                  \
+                                                                                                \
+    typedef struct ts_lru_##name##_s {                                                          \
+        ts_lru_##name##_shard_t shards[TS_LRU_NUM_SHARDS];                                      \
+    } ts_lru_##name##_t;
+
+/***********************************************************************************************/
+
+#define ts_lru(name)                                                                            \
+    ts_lru_##name##_t
+
+/* Iteration does not take any locks - the caller must make sure no other 
+ * thread is accessing the cache. The body may remove entries from the cache. */
+#define TS_LRU_FOREACH_SAFE_REMOVE(name, _lru, _key, _val, ...)                                 \
+    do{                                                                                         \
+        for(int _shard = 0; _shard < TS_LRU_NUM_SHARDS; _shard++) {                             \
+            LRU_FOREACH_SAFE_REMOVE(name, &(_lru)->shards[_shard].lru, _key, _val,              \
+                __VA_ARGS__                                                                     \
+            );                                                                                  \
+        }                                                                                       \
+    }while(0)
+
+/***********************************************************************************************/
+
+#define TS_LRU_CACHE_PROTOTYPES(scope, name, type)                                              \
+                                                                                                \
+    LRU_CACHE_PROTOTYPES(static, name, type)                                                    \
+                                                                                                \
+    static ts_lru_##name##_shard_t *_ts_lru_##name##_shard(ts_lru(name) *lru, uint64_t key);   \
+    scope  bool   ts_lru_##name##_init     (ts_lru(name) *lru, size_t capacity,                 \
+                                            void (*on_evict)(type *victim));                    \
+    scope  void   ts_lru_##name##_destroy  (ts_lru(name) *lru);                                 \
+    scope  void   ts_lru_##name##_clear    (ts_lru(name) *lru);                                 \
+    scope  bool   ts_lru_##name##_get      (ts_lru(name) *lru, uint64_t key, type *out);        \
+    /* Returned pointer is invalidated when new entries are added to the same shard. It     */  \
+    /* is only safe to use when no other thread may be concurrently writing to the cache.   */  \
+    scope  const type *ts_lru_##name##_at  (ts_lru(name) *lru, uint64_t key);                   \
+    scope  const type *ts_lru_##name##_peek(ts_lru(name) *lru, uint64_t key);                   \
+    scope  bool   ts_lru_##name##_contains (ts_lru(name) *lru, uint64_t key);                   \
+    scope  void   ts_lru_##name##_put      (ts_lru(name) *lru, uint64_t key, const type *in);   \
+    scope  void   ts_lru_##name##_put_cost (ts_lru(name) *lru, uint64_t key, const type *in,    \
+                                            float cost);                                        \
+    scope  float  ts_lru_##name##_cost     (ts_lru(name) *lru, uint64_t key);                   \
+    scope  void   ts_lru_##name##_set_policy(ts_lru(name) *lru, enum lru_policy policy);        \
+    scope  bool   ts_lru_##name##_remove   (ts_lru(name) *lru, uint64_t key);                   \
+    scope  size_t ts_lru_##name##_used     (ts_lru(name) *lru);                                 \
+    scope  size_t ts_lru_##name##_capacity (ts_lru(name) *lru);                                 \
+
+/***********************************************************************************************/
+
+#define TS_LRU_CACHE_IMPL(scope, name, type)                                                    \
+                                                                                                \
+    LRU_CACHE_IMPL(static, name, type)                                                          \
+                                                                                                \
+    static ts_lru_##name##_shard_t *_ts_lru_##name##_shard(ts_lru(name) *lru, uint64_t key)    \
+    {                                                                                           \
+        /* Mix the bits so that structured keys are spread evenly between shards */             \
+        key ^= key >> 33;                                                                       \
+        key *= 0xff51afd7ed558ccdULL;                                                           \
+        key ^= key >> 33;                                                                       \
+        return &lru->shards[key & (TS_LRU_NUM_SHARDS - 1)];                                     \
+    }                                                                                           \
+                                                                                                \
+    scope bool ts_lru_##name##_init(ts_lru(name) *lru, size_t capacity,                         \
+                                    void (*on_evict)(type *victim))                             \
+    {                                                                                           \
+        size_t shard_cap = (capacity + TS_LRU_NUM_SHARDS - 1) / TS_LRU_NUM_SHARDS;              \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+                                                                                                \
+            lru->shards[i].lock = 0;                                                            \
+            if(!lru_##name##_init(&lru->shards[i].lru, shard_cap, on_evict)) {                  \
+                while(i--)                                                                      \
+                    lru_##name##_destroy(&lru->shards[i].lru);                                  \
+                return false;                                                                   \
+            }                                                                                   \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void ts_lru_##name##_destroy(ts_lru(name) *lru)                                       \
+    {                                                                                           \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+            lru_##name##_destroy(&lru->shards[i].lru);                                          \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope void ts_lru_##name##_clear(ts_lru(name) *lru)                                         \
+    {                                                                                           \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+            SDL_AtomicLock(&lru->shards[i].lock);                                               \
+            lru_##name##_clear(&lru->shards[i].lru);                                            \
+            SDL_AtomicUnlock(&lru->shards[i].lock);                                             \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope bool ts_lru_##name##_get(ts_lru(name) *lru, uint64_t key, type *out)                  \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        bool ret = lru_##name##_get(&shard->lru, key, out);                                     \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope const type *ts_lru_##name##_at(ts_lru(name) *lru, uint64_t key)                       \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        const type *ret = lru_##name##_at(&shard->lru, key);                                    \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope const type *ts_lru_##name##_peek(ts_lru(name) *lru, uint64_t key)                     \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        const type *ret = lru_##name##_peek(&shard->lru, key);                                  \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool ts_lru_##name##_contains(ts_lru(name) *lru, uint64_t key)                        \
+    {                                                                                           \
+        return (ts_lru_##name##_at(lru, key) != NULL);                                          \
+    }                                                                                           \
+                                                                                                \
+    scope void ts_lru_##name##_put(ts_lru(name) *lru, uint64_t key, const type *in)             \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        lru_##name##_put(&shard->lru, key, in);                                                 \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+    }                                                                                           \
+                                                                                                \
+    scope void ts_lru_##name##_put_cost(ts_lru(name) *lru, uint64_t key, const type *in,        \
+                                        float cost)                                             \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        lru_##name##_put_cost(&shard->lru, key, in, cost);                                      \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+    }                                                                                           \
+                                                                                                \
+    scope float ts_lru_##name##_cost(ts_lru(name) *lru, uint64_t key)                           \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        float ret = lru_##name##_cost(&shard->lru, key);                                        \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope void ts_lru_##name##_set_policy(ts_lru(name) *lru, enum lru_policy policy)            \
+    {                                                                                           \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+            SDL_AtomicLock(&lru->shards[i].lock);                                               \
+            lru_##name##_set_policy(&lru->shards[i].lru, policy);                               \
+            SDL_AtomicUnlock(&lru->shards[i].lock);                                             \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope bool ts_lru_##name##_remove(ts_lru(name) *lru, uint64_t key)                          \
+    {                                                                                           \
+        ts_lru_##name##_shard_t *shard = _ts_lru_##name##_shard(lru, key);                      \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        bool ret = lru_##name##_remove(&shard->lru, key);                                       \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope size_t ts_lru_##name##_used(ts_lru(name) *lru)                                        \
+    {                                                                                           \
+        size_t ret = 0;                                                                         \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+            SDL_AtomicLock(&lru->shards[i].lock);                                               \
+            ret += lru->shards[i].lru.used;                                                     \
+            SDL_AtomicUnlock(&lru->shards[i].lock);                                             \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope size_t ts_lru_##name##_capacity(ts_lru(name) *lru)                                    \
+    {                                                                                           \
+        size_t ret = 0;                                                                         \
+        for(int i = 0; i < TS_LRU_NUM_SHARDS; i++) {                                            \
+            ret += lru->shards[i].lru.capacity;                                                 \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+
+#endif
+
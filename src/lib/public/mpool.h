@@ -101,19 +101,14 @@ typedef uint16_t mp_ref_t;
         if(!new_entry)                                                                          \
             return false;                                                                       \
                                                                                                 \
-        for(int i = old_cap; i < new_cap; ++i) {                                                \
+        /* Index 0 is used as NULL, so the new nodes are at indices */                          \
+        /* (old_cap, new_cap]. Prepend them to the free list, which  */                         \
+        /* is empty when a full pool is being grown.                 */                         \
+        for(int i = old_cap + 1; i < new_cap; ++i) {                                            \
             new_entry[i].inext_free = i + 1;                                                    \
         }                                                                                       \
-        new_entry[new_cap].inext_free = 0;                                                      \
-                                                                                                \
-        if(!mp->ifree_head) {                                                                   \
-            /* Skip the first node - index 0 is used as NULL */                                 \
-            mp->ifree_head = 1;                                                                 \
-        }else {                                                                                 \
-            /* Append at the front */                                                           \
-            new_entry[new_cap].inext_free = mp->ifree_head;                                     \
-            mp->ifree_head = old_cap + 1;                                                       \
-        }                                                                                       \
+        new_entry[new_cap].inext_free = mp->ifree_head;                                         \
+        mp->ifree_head = old_cap + 1;                                                           \
                                                                                                 \
         mp->pool = new_entry;                                                                   \
         mp->capacity = new_cap;                                                                 \
@@ -171,5 +166,144 @@ typedef uint16_t mp_ref_t;
         mp->pool[mp->capacity].inext_free = 0;                                                  \
     }
 
+/***********************************************************************************************/
+
+/* The chunked pool has the same interface as the above, but it grows by allocating */
+/* additional fixed-size chunks of nodes instead of reallocating a single array. The */
+/* entry pointers thus stay valid for as long as the entry is allocated.              */
+
+#define MP_CHUNK_SZ      (64)
+#define MP_MAX_CAPACITY  ((mp_ref_t)~0)
+
+/***********************************************************************************************/
+
+#define MPOOL_CHUNKED_TYPE(name, type)                                                          \
+                                                                                                \
+    typedef struct mp_##name##_node_s {                                                         \
+        mp_ref_t inext_free;                                                                    \
+        type entry;                                                                             \
+    } mp_##name##_node_t;                                                                       \
+                                                                                                \
+    typedef struct mp_##name##_s {                                                              \
+        size_t capacity;                                                                        \
+        size_t num_allocd;                                                                      \
+        mp_ref_t ifree_head;                                                                    \
+        size_t nchunks;                                                                         \
+        mp_##name##_node_t **chunks;                                                            \
+    } mp_##name##_t;
+
+/***********************************************************************************************/
+
+#define MPOOL_CHUNKED_PROTOTYPES(scope, name, type)                                             \
+                                                                                                \
+    static mp_##name##_node_t *_mp_##name##_node(mp(name) *mp, mp_ref_t ref);                   \
+    MPOOL_PROTOTYPES(scope, name, type)
+
+/***********************************************************************************************/
+
+#define MPOOL_CHUNKED_IMPL(scope, name, type)                                                   \
+                                                                                                \
+    static mp_##name##_node_t *_mp_##name##_node(mp(name) *mp, mp_ref_t ref)                    \
+    {                                                                                           \
+        assert(ref > 0 && ref <= mp->capacity);                                                 \
+        return &mp->chunks[(ref - 1) / MP_CHUNK_SZ][(ref - 1) % MP_CHUNK_SZ];                   \
+    }                                                                                           \
+                                                                                                \
+    scope void mp_##name##_init(mp(name) *mp)                                                   \
+    {                                                                                           \
+        memset(mp, 0, sizeof(*mp));                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool mp_##name##_reserve(mp(name) *mp, size_t new_cap)                                \
+    {                                                                                           \
+        size_t old_cap = mp->capacity;                                                          \
+        if(new_cap <= old_cap)                                                                  \
+            return true;                                                                        \
+        if(new_cap > MP_MAX_CAPACITY)                                                           \
+            return false;                                                                       \
+                                                                                                \
+        size_t new_nchunks = (new_cap + MP_CHUNK_SZ - 1) / MP_CHUNK_SZ;                         \
+        mp_##name##_node_t **new_chunks = realloc(mp->chunks,                                   \
+            new_nchunks * sizeof(mp_##name##_node_t*));                                         \
+        if(!new_chunks)                                                                         \
+            return false;                                                                       \
+        mp->chunks = new_chunks;                                                                \
+                                                                                                \
+        for(size_t i = mp->nchunks; i < new_nchunks; i++) {                                     \
+            mp->chunks[i] = malloc(MP_CHUNK_SZ * sizeof(mp_##name##_node_t));                   \
+            if(!mp->chunks[i]) {                                                                \
+                while(i-- > mp->nchunks)                                                        \
+                    free(mp->chunks[i]);                                                        \
+                return false;                                                                   \
+            }                                                                                   \
+        }                                                                                       \
+                                                                                                \
+        new_cap = new_nchunks * MP_CHUNK_SZ;                                                    \
+        if(new_cap > MP_MAX_CAPACITY)                                                           \
+            new_cap = MP_MAX_CAPACITY;                                                          \
+        mp->nchunks = new_nchunks;                                                              \
+        mp->capacity = new_cap;                                                                 \
+                                                                                                \
+        /* Prepend the new nodes to the free list */                                            \
+        for(int i = old_cap + 1; i < new_cap; ++i) {                                            \
+            _mp_##name##_node(mp, i)->inext_free = i + 1;                                       \
+        }                                                                                       \
+        _mp_##name##_node(mp, new_cap)->inext_free = mp->ifree_head;                            \
+        mp->ifree_head = old_cap + 1;                                                           \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void mp_##name##_destroy(mp(name) *mp)                                                \
+    {                                                                                           \
+        for(size_t i = 0; i < mp->nchunks; i++)                                                 \
+            free(mp->chunks[i]);                                                                \
+        free(mp->chunks);                                                                       \
+        memset(mp, 0, sizeof(*mp));                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope mp_ref_t mp_##name##_alloc(mp(name) *mp)                                              \
+    {                                                                                           \
+        if(mp->num_allocd == mp->capacity) {                                                    \
+            if(!mp_##name##_reserve(mp, mp->capacity + MP_CHUNK_SZ))                            \
+                return 0;                                                                       \
+        }                                                                                       \
+                                                                                                \
+        assert(mp->ifree_head > 0);                                                             \
+        mp_ref_t ret = mp->ifree_head;                                                          \
+                                                                                                \
+        mp->ifree_head = _mp_##name##_node(mp, ret)->inext_free;                                \
+        ++mp->num_allocd;                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope void mp_##name##_free(mp(name) *mp, mp_ref_t ref)                                     \
+    {                                                                                           \
+        if(!ref)                                                                                \
+            return;                                                                             \
+        assert(mp->num_allocd > 0);                                                             \
+                                                                                                \
+        _mp_##name##_node(mp, ref)->inext_free = mp->ifree_head;                                \
+        mp->ifree_head = ref;                                                                   \
+        --mp->num_allocd;                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope type *mp_##name##_entry(mp(name) *mp, mp_ref_t ref)                                   \
+    {                                                                                           \
+        return &_mp_##name##_node(mp, ref)->entry;                                              \
+    }                                                                                           \
+                                                                                                \
+    scope void mp_##name##_clear(mp(name) *mp)                                                  \
+    {                                                                                           \
+        if(mp->capacity == 0)                                                                   \
+            return;                                                                             \
+        mp->num_allocd = 0;                                                                     \
+        mp->ifree_head = 1;                                                                     \
+                                                                                                \
+        for(int i = 1; i < mp->capacity; ++i) {                                                 \
+            _mp_##name##_node(mp, i)->inext_free = i + 1;                                       \
+        }                                                                                       \
+        _mp_##name##_node(mp, mp->capacity)->inext_free = 0;                                    \
+    }
+
 #endif
 
@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 
 /***********************************************************************************************/
 
@@ -159,5 +160,167 @@
         return false;                                                                           \
     }                                                                                           \
 
+/***********************************************************************************************/
+
+/* An indexed variant of the priority queue. Every element maps to a unique  */
+/* key in the range [0, nkeys) through 'key_func'. The heap position of each */
+/* key is tracked, making membership tests O(1) and allowing the priority of */
+/* an element that is already in the queue to be decreased in place.        */
+
+#define PQUEUE_INDEXED_TYPE(name, type)                                                         \
+                                                                                                \
+    typedef struct pq_##name##_node_s {                                                         \
+        float priority;                                                                         \
+        type data;                                                                              \
+    } pq_##name##_node_t;                                                                       \
+                                                                                                \
+    typedef struct pq_##name##_s {                                                              \
+        pq_##name##_node_t *nodes;                                                              \
+        size_t capacity;                                                                        \
+        size_t size;                                                                            \
+        /* The heap index of every key, or 0 for keys not in the queue */                       \
+        int   *index;                                                                           \
+        size_t nkeys;                                                                           \
+    } pq_##name##_t;                                                                            \
+
+/***********************************************************************************************/
+
+#define PQUEUE_INDEXED_PROTOTYPES(scope, name, type)                                            \
+                                                                                                \
+    scope bool pq_##name##_init             (pq(name) *pqueue, size_t nkeys);                   \
+    scope void pq_##name##_destroy          (pq(name) *pqueue);                                 \
+    scope bool pq_##name##_push             (pq(name) *pqueue, float in_prio, type in);         \
+    scope bool pq_##name##_pop              (pq(name) *pqueue, type *out);                      \
+    scope bool pq_##name##_contains         (pq(name) *pqueue, type t);                         \
+    scope bool pq_##name##_decrease_key     (pq(name) *pqueue, float new_prio, type t);         \
+    scope bool pq_##name##_push_or_decrease (pq(name) *pqueue, float in_prio, type in);
+
+/***********************************************************************************************/
+
+#define PQUEUE_INDEXED_IMPL(scope, name, type, key_func)                                        \
+                                                                                                \
+    static void _pq_##name##_place(pq(name) *pqueue, int idx, pq_##name##_node_t node)          \
+    {                                                                                           \
+        pqueue->nodes[idx] = node;                                                              \
+        pqueue->index[key_func(node.data)] = idx;                                               \
+    }                                                                                           \
+                                                                                                \
+    static void _pq_##name##_sift_up(pq(name) *pqueue, int curr_idx, pq_##name##_node_t node)   \
+    {                                                                                           \
+        int parent_idx = curr_idx / 2;                                                          \
+        while(curr_idx > 1 && pqueue->nodes[parent_idx].priority > node.priority) {             \
+            _pq_##name##_place(pqueue, curr_idx, pqueue->nodes[parent_idx]);                    \
+            curr_idx = parent_idx;                                                              \
+            parent_idx = parent_idx / 2;                                                        \
+        }                                                                                       \
+        _pq_##name##_place(pqueue, curr_idx, node);                                             \
+    }                                                                                           \
+                                                                                                \
+    static void _pq_##name##_sift_down(pq(name) *pqueue, int curr_idx, pq_##name##_node_t node) \
+    {                                                                                           \
+        while(true) {                                                                           \
+                                                                                                \
+            int target_idx = curr_idx;                                                          \
+            float target_prio = node.priority;                                                  \
+            int left_child_idx = curr_idx * 2;                                                  \
+            int right_child_idx = left_child_idx + 1;                                           \
+                                                                                                \
+            if(left_child_idx <= pqueue->size                                                   \
+            && pqueue->nodes[left_child_idx].priority < target_prio) {                          \
+                target_idx = left_child_idx;                                                    \
+                target_prio = pqueue->nodes[left_child_idx].priority;                           \
+            }                                                                                   \
+                                                                                                \
+            if(right_child_idx <= pqueue->size                                                  \
+            && pqueue->nodes[right_child_idx].priority < target_prio) {                         \
+                target_idx = right_child_idx;                                                   \
+            }                                                                                   \
+                                                                                                \
+            if(target_idx == curr_idx)                                                          \
+                break;                                                                          \
+                                                                                                \
+            _pq_##name##_place(pqueue, curr_idx, pqueue->nodes[target_idx]);                    \
+            curr_idx = target_idx;                                                              \
+        }                                                                                       \
+        _pq_##name##_place(pqueue, curr_idx, node);                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool pq_##name##_init(pq(name) *pqueue, size_t nkeys)                                 \
+    {                                                                                           \
+        pqueue->nodes = NULL;                                                                   \
+        pqueue->capacity = 0;                                                                   \
+        pqueue->size = 0;                                                                       \
+        pqueue->nkeys = nkeys;                                                                  \
+        pqueue->index = calloc(nkeys, sizeof(int));                                             \
+        return (pqueue->index != NULL);                                                         \
+    }                                                                                           \
+                                                                                                \
+    scope void pq_##name##_destroy(pq(name) *pqueue)                                            \
+    {                                                                                           \
+        free(pqueue->nodes);                                                                    \
+        free(pqueue->index);                                                                    \
+    }                                                                                           \
+                                                                                                \
+    scope bool pq_##name##_push(pq(name) *pqueue, float in_prio, type in)                       \
+    {                                                                                           \
+        assert(key_func(in) >= 0 && key_func(in) < pqueue->nkeys);                              \
+        assert(!pqueue->index[key_func(in)]);                                                   \
+                                                                                                \
+        if(pqueue->size + 1 >= pqueue->capacity) {                                              \
+                                                                                                \
+            size_t new_cap = pqueue->capacity ? pqueue->capacity * 2 : 4;                       \
+            pq_##name##_node_t *new_nodes = realloc(pqueue->nodes,                              \
+                new_cap * sizeof(pq_##name##_node_t));                                          \
+            if(!new_nodes)                                                                      \
+                return false;                                                                   \
+            pqueue->nodes = new_nodes;                                                          \
+            pqueue->capacity = new_cap;                                                         \
+        }                                                                                       \
+                                                                                                \
+        pqueue->size++;                                                                         \
+        _pq_##name##_sift_up(pqueue, pqueue->size, (pq_##name##_node_t){in_prio, in});          \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool pq_##name##_pop(pq(name) *pqueue, type *out)                                     \
+    {                                                                                           \
+        if(pqueue->size == 0)                                                                   \
+            return false;                                                                       \
+                                                                                                \
+        *out = pqueue->nodes[1].data;                                                           \
+        pqueue->index[key_func(*out)] = 0;                                                      \
+                                                                                                \
+        pq_##name##_node_t last = pqueue->nodes[pqueue->size--];                                \
+        if(pqueue->size > 0)                                                                    \
+            _pq_##name##_sift_down(pqueue, 1, last);                                            \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool pq_##name##_contains(pq(name) *pqueue, type t)                                   \
+    {                                                                                           \
+        return (pqueue->index[key_func(t)] != 0);                                               \
+    }                                                                                           \
+                                                                                                \
+    /* Returns false if the element is not in the queue or if the new */                        \
+    /* priority is not lower than its' current one.                   */                        \
+    scope bool pq_##name##_decrease_key(pq(name) *pqueue, float new_prio, type t)               \
+    {                                                                                           \
+        int idx = pqueue->index[key_func(t)];                                                   \
+        if(!idx || !(new_prio < pqueue->nodes[idx].priority))                                   \
+            return false;                                                                       \
+                                                                                                \
+        _pq_##name##_sift_up(pqueue, idx, (pq_##name##_node_t){new_prio, t});                   \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool pq_##name##_push_or_decrease(pq(name) *pqueue, float in_prio, type in)           \
+    {                                                                                           \
+        if(pq_##name##_contains(pqueue, in)) {                                                  \
+            pq_##name##_decrease_key(pqueue, in_prio, in);                                      \
+            return true;                                                                        \
+        }                                                                                       \
+        return pq_##name##_push(pqueue, in_prio, in);                                           \
+    }                                                                                           \
+
 #endif
 
@@ -39,11 +39,20 @@
 #include "mpool.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <math.h>
 #include <assert.h>
 #include <stdio.h>
 
 
+/***********************************************************************************************/
+
+struct qt_circle_query{
+    float x, y;
+    float range;
+};
+
 /***********************************************************************************************/
 
 #define QUADTREE_TYPE(name, type)                                                               \
@@ -97,6 +106,9 @@
 
 #define _MAX(a, b)  ((a) > (b) ? (a) : (b))
 
+#define QT_LINEAR_MAX_DEPTH     (12)
+#define QT_LINEAR_RELAYOUT_MIN  (64)
+
 /***********************************************************************************************/
 
 #define QUADTREE_PROTOTYPES(scope, name, type)                                                  \
@@ -111,6 +123,8 @@
     scope bool qt_##name##_insert(qt(name) *qt, float x, float y, type record);                 \
     scope bool qt_##name##_delete(qt(name) *qt, float x, float y, type record);                 \
     scope bool qt_##name##_delete_all(qt(name) *qt, float x, float y);                          \
+    scope bool qt_##name##_move(qt(name) *qt, float oldx, float oldy,                           \
+                                float newx, float newy, type record);                           \
     scope bool qt_##name##_find(qt(name) *qt, float x, float y, type *out, int maxout);         \
     scope bool qt_##name##_contains(qt(name) *qt, float x, float y);                            \
     scope int  qt_##name##_inrange_circle(qt(name) *qt,                                         \
@@ -120,11 +134,53 @@
                                            float minx, float maxx,                              \
                                            float miny, float maxy,                              \
                                            type *out, int maxout);                              \
+    scope bool qt_##name##_inrange_circle_batch(qt(name) *qt,                                   \
+                                                const struct qt_circle_query *queries,          \
+                                                int nqueries, type *out, int maxout,            \
+                                                int *out_counts);                               \
     scope void qt_##name##_print(qt(name) *qt);                                                 \
     scope bool qt_##name##_reserve(qt(name) *qt, size_t size);
 
 /***********************************************************************************************/
 
+#define _QT_MORTON_IMPL(name)                                                                   \
+                                                                                                \
+    struct _qt_##name##_morton_key{                                                             \
+        uint32_t code;                                                                          \
+        int      idx;                                                                           \
+    };                                                                                          \
+                                                                                                \
+    static uint32_t _qt_##name##_morton_spread(uint32_t v)                                      \
+    {                                                                                           \
+        v &= 0xffff;                                                                            \
+        v = (v | (v << 8)) & 0x00ff00ff;                                                        \
+        v = (v | (v << 4)) & 0x0f0f0f0f;                                                        \
+        v = (v | (v << 2)) & 0x33333333;                                                        \
+        v = (v | (v << 1)) & 0x55555555;                                                        \
+        return v;                                                                               \
+    }                                                                                           \
+                                                                                                \
+    static uint32_t _qt_##name##_morton_code(qt(name) *qt, float x, float y)                    \
+    {                                                                                           \
+        float xlen = _MAX(qt->xmax - qt->xmin, QT_EPSILON);                                     \
+        float ylen = _MAX(qt->ymax - qt->ymin, QT_EPSILON);                                     \
+        float xn = (x - qt->xmin) / xlen;                                                       \
+        float yn = (y - qt->ymin) / ylen;                                                       \
+        uint32_t xi = (uint32_t)(fmin(fmax(xn, 0.0f), 1.0f) * 0xffff);                          \
+        uint32_t yi = (uint32_t)(fmin(fmax(yn, 0.0f), 1.0f) * 0xffff);                          \
+        return _qt_##name##_morton_spread(xi) | (_qt_##name##_morton_spread(yi) << 1);          \
+    }                                                                                           \
+                                                                                                \
+    static int _qt_##name##_compare_morton(const void *a, const void *b)                        \
+    {                                                                                           \
+        const struct _qt_##name##_morton_key *ka = a, *kb = b;                                  \
+        if(ka->code != kb->code)                                                                \
+            return (ka->code < kb->code) ? -1 : 1;                                              \
+        return ka->idx - kb->idx;                                                               \
+    }                                                                                           \
+
+/***********************************************************************************************/
+
 #define QUADTREE_IMPL(scope, name, type)                                                        \
                                                                                                 \
     MPOOL_IMPL(static, name, qt_node(name))                                                     \
@@ -366,13 +422,108 @@
         return (orig_maxout - *inout_maxout);                                                   \
     }                                                                                           \
                                                                                                 \
-    static bool _qt_##name##_node_sib_append(qt(name) *qt, mp_ref_t ref, type record)           \
+    /* The batched query visits each node once for all the queries whose  */                    \
+    /* (extended) bounds overlap it. The indices of the queries that are  */                    \
+    /* still active at every level of the recursion are kept in a single */                     \
+    /* stack, addressed by offset since it may get reallocated.           */                    \
+    struct _qt_##name##_batch_ctx{                                                              \
+        const struct qt_circle_query *queries;                                                  \
+        type *out;                                                                              \
+        int   maxout;                                                                           \
+        int  *counts;                                                                           \
+        int  *active;                                                                           \
+        size_t active_top;                                                                      \
+        size_t active_cap;                                                                      \
+    };                                                                                          \
+                                                                                                \
+    _QT_MORTON_IMPL(name)                                                                       \
+                                                                                                \
+    static bool _qt_##name##_batch_push(struct _qt_##name##_batch_ctx *ctx, int qidx)           \
+    {                                                                                           \
+        if(ctx->active_top == ctx->active_cap) {                                                \
+            size_t new_cap = ctx->active_cap * 2;                                               \
+            int *new_active = realloc(ctx->active, new_cap * sizeof(int));                      \
+            if(!new_active)                                                                     \
+                return false;                                                                   \
+            ctx->active = new_active;                                                           \
+            ctx->active_cap = new_cap;                                                          \
+        }                                                                                       \
+        ctx->active[ctx->active_top++] = qidx;                                                  \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_node_batch(qt(name) *qt, struct _qt_##name##_batch_ctx *ctx,       \
+                                        mp_ref_t ref, float xmin, float xmax,                   \
+                                        float ymin, float ymax, size_t begin, size_t n)         \
     {                                                                                           \
         qt_node(name) *node = mp_##name##_entry(&qt->node_pool, ref);                           \
+        if(_qt_##name##_node_isleaf(node)) {                                                    \
                                                                                                 \
+            if(!node->has_record)                                                               \
+                return true;                                                                    \
+                                                                                                \
+            for(size_t i = begin; i < begin + n; i++) {                                         \
+                                                                                                \
+                int qidx = ctx->active[i];                                                      \
+                const struct qt_circle_query *q = &ctx->queries[qidx];                          \
+                if(ctx->counts[qidx] == ctx->maxout)                                            \
+                    continue;                                                                   \
+                if(_qt_##name##_dist(q->x, q->y, node->x, node->y) > q->range)                  \
+                    continue;                                                                   \
+                ctx->out[qidx * ctx->maxout + ctx->counts[qidx]++] = node->record;              \
+            }                                                                                   \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        const float xmid = (xmax + xmin) / 2.0f;                                                \
+        const float ymid = (ymax + ymin) / 2.0f;                                                \
+        const struct{                                                                           \
+            mp_ref_t ref;                                                                       \
+            float xmin, xmax, ymin, ymax;                                                       \
+        }children[4] = {                                                                        \
+            {node->nw, xmin, xmid, ymid, ymax},                                                 \
+            {node->ne, xmid, xmax, ymid, ymax},                                                 \
+            {node->sw, xmin, xmid, ymin, ymid},                                                 \
+            {node->se, xmid, xmax, ymin, ymid},                                                 \
+        };                                                                                      \
+                                                                                                \
+        for(int c = 0; c < 4; c++) {                                                            \
+                                                                                                \
+            size_t child_begin = ctx->active_top;                                               \
+            for(size_t i = begin; i < begin + n; i++) {                                         \
+                                                                                                \
+                int qidx = ctx->active[i];                                                      \
+                const struct qt_circle_query *q = &ctx->queries[qidx];                          \
+                if(ctx->counts[qidx] == ctx->maxout)                                            \
+                    continue;                                                                   \
+                                                                                                \
+                float cxmin = children[c].xmin, cxmax = children[c].xmax;                       \
+                float cymin = children[c].ymin, cymax = children[c].ymax;                       \
+                _qt_##name##_extend_bounds(&cxmin, &cxmax, &cymin, &cymax, q->range);           \
+                if(!_qt_##name##_point_in_bounds(cxmin, cxmax, cymin, cymax, q->x, q->y))       \
+                    continue;                                                                   \
+                if(!_qt_##name##_batch_push(ctx, qidx))                                         \
+                    return false;                                                               \
+            }                                                                                   \
+                                                                                                \
+            size_t child_n = ctx->active_top - child_begin;                                     \
+            if(child_n > 0 && !_qt_##name##_node_batch(qt, ctx, children[c].ref,                \
+                children[c].xmin, children[c].xmax, children[c].ymin, children[c].ymax,         \
+                child_begin, child_n))                                                          \
+                return false;                                                                   \
+            ctx->active_top = child_begin;                                                      \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_node_sib_append(qt(name) *qt, mp_ref_t ref, type record)           \
+    {                                                                                           \
+        /* Allocating may move the pool, so the node is looked up after */                      \
         mp_ref_t sib = mp_##name##_alloc(&qt->node_pool);                                       \
         _CHK_TRUE_RET(sib, false);                                                              \
                                                                                                 \
+        qt_node(name) *node = mp_##name##_entry(&qt->node_pool, ref);                           \
+                                                                                                \
         qt_node(name) *sib_node = mp_##name##_entry(&qt->node_pool, sib);                       \
         _qt_##name##_node_init(sib_node, 0);                                                    \
         sib_node->x = node->x;                                                                  \
@@ -487,6 +638,13 @@
                                                                                                 \
     static bool _qt_##name##_partition(qt(name) *qt, mp_ref_t ref)                              \
     {                                                                                           \
+        /* Allocating may move the pool, so the node is looked up after */                      \
+        mp_ref_t nw = 0, ne = 0, sw = 0, se = 0;                                                \
+        _CHK_TRUE_JMP((nw = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((ne = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((sw = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((se = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+                                                                                                \
         qt_node(name) *node = mp_##name##_entry(&qt->node_pool, ref);                           \
         qt_node(name) *curr = NULL;                                                             \
                                                                                                 \
@@ -512,10 +670,10 @@
             _qt_##name##_set_divide_coords(qt, parent, ref);                                    \
         }                                                                                       \
                                                                                                 \
-        _CHK_TRUE_JMP((node->nw = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->ne = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->sw = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->se = mp_##name##_alloc(&qt->node_pool)), fail);                    \
+        node->nw = nw;                                                                          \
+        node->ne = ne;                                                                          \
+        node->sw = sw;                                                                          \
+        node->se = se;                                                                          \
                                                                                                 \
         /* NW node */                                                                           \
         curr = mp_##name##_entry(&qt->node_pool, node->nw);                                     \
@@ -553,10 +711,10 @@
         return true;                                                                            \
                                                                                                 \
     fail:                                                                                       \
-        node->nw ? mp_##name##_free(&qt->node_pool, node->nw), 0 : 0;                           \
-        node->ne ? mp_##name##_free(&qt->node_pool, node->ne), 0 : 0;                           \
-        node->sw ? mp_##name##_free(&qt->node_pool, node->sw), 0 : 0;                           \
-        node->se ? mp_##name##_free(&qt->node_pool, node->se), 0 : 0;                           \
+        nw ? mp_##name##_free(&qt->node_pool, nw), 0 : 0;                                       \
+        ne ? mp_##name##_free(&qt->node_pool, ne), 0 : 0;                                       \
+        sw ? mp_##name##_free(&qt->node_pool, sw), 0 : 0;                                       \
+        se ? mp_##name##_free(&qt->node_pool, se), 0 : 0;                                       \
         return false;                                                                           \
     }                                                                                           \
                                                                                                 \
@@ -626,7 +784,7 @@
         qt->xmax = xmax;                                                                        \
         qt->ymin = ymin;                                                                        \
         qt->ymax = ymax;                                                                        \
-        return 0;                                                                               \
+        return true;                                                                            \
     }                                                                                           \
                                                                                                 \
     scope void qt_##name##_destroy(qt(name) *qt)                                                \
@@ -687,6 +845,7 @@
         /* existing point and the new point lie in different quadrants */                       \
         do{                                                                                     \
             _CHK_TRUE_RET(_qt_##name##_partition(qt, curr_ref), false);                         \
+            curr_node = mp_##name##_entry(&qt->node_pool, curr_ref);                            \
             assert(!curr_node->has_record);                                                     \
                                                                                                 \
             curr_ref = _qt_##name##_quadrant(curr_node, x, y);                                  \
@@ -800,6 +959,38 @@
         return qt_##name##_delete(qt, x, y, curr_node->record);                                 \
     }                                                                                           \
                                                                                                 \
+    /* A lone record that stays within the region of its leaf is updated in */                  \
+    /* place. Otherwise, it is re-inserted, and put back at its old position */                 \
+    /* should that fail.                                                     */                 \
+    scope bool qt_##name##_move(qt(name) *qt, float oldx, float oldy,                           \
+                                float newx, float newy, type record)                            \
+    {                                                                                           \
+        mp_ref_t leaf = _qt_##name##_find_leaf(qt, oldx, oldy);                                 \
+        if(!leaf)                                                                               \
+            return false;                                                                       \
+                                                                                                \
+        qt_node(name) *node = mp_##name##_entry(&qt->node_pool, leaf);                          \
+        if(node->has_record && !node->sibling_next                                              \
+        && QT_EQ(node->x, oldx) && QT_EQ(node->y, oldy)                                         \
+        && 0 == memcmp(&record, &node->record, sizeof(record))                                  \
+        && _qt_##name##_find_leaf(qt, newx, newy) == leaf) {                                    \
+                                                                                                \
+            node->x = newx;                                                                     \
+            node->y = newy;                                                                     \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        if(!qt_##name##_delete(qt, oldx, oldy, record))                                         \
+            return false;                                                                       \
+        if(qt_##name##_insert(qt, newx, newy, record))                                          \
+            return true;                                                                        \
+                                                                                                \
+        bool ret = qt_##name##_insert(qt, oldx, oldy, record);                                  \
+        assert(ret);                                                                            \
+        (void)ret;                                                                              \
+        return false;                                                                           \
+    }                                                                                           \
+                                                                                                \
     scope bool qt_##name##_find(qt(name) *qt, float x, float y, type *out, int maxout)          \
     {                                                                                           \
         mp_ref_t curr_ref = _qt_##name##_find_leaf(qt, x, y);                                   \
@@ -843,6 +1034,53 @@
         return _qt_##name##_node_inrange_rect(qt, root, minx, maxx, miny, maxy,out, &maxout);   \
     }                                                                                           \
                                                                                                 \
+    /* Results of query 'i' are written to 'out[i * maxout]' onwards, the   */                  \
+    /* count to 'out_counts[i]'. The results of each query are the same as */                   \
+    /* those of an individual 'inrange_circle' with the same arguments.    */                   \
+    scope bool qt_##name##_inrange_circle_batch(qt(name) *qt,                                   \
+                                                const struct qt_circle_query *queries,          \
+                                                int nqueries, type *out, int maxout,            \
+                                                int *out_counts)                                \
+    {                                                                                           \
+        for(int i = 0; i < nqueries; i++)                                                       \
+            out_counts[i] = 0;                                                                  \
+        if(!qt->root || nqueries == 0 || maxout == 0)                                           \
+            return true;                                                                        \
+                                                                                                \
+        struct _qt_##name##_morton_key *keys = malloc(nqueries * sizeof(*keys));                \
+        if(!keys)                                                                               \
+            return false;                                                                       \
+                                                                                                \
+        for(int i = 0; i < nqueries; i++) {                                                     \
+            keys[i].code = _qt_##name##_morton_code(qt, queries[i].x, queries[i].y);            \
+            keys[i].idx = i;                                                                    \
+        }                                                                                       \
+        qsort(keys, nqueries, sizeof(*keys), _qt_##name##_compare_morton);                      \
+                                                                                                \
+        struct _qt_##name##_batch_ctx ctx = (struct _qt_##name##_batch_ctx){                    \
+            .queries = queries,                                                                 \
+            .out = out,                                                                         \
+            .maxout = maxout,                                                                   \
+            .counts = out_counts,                                                               \
+            .active = malloc(nqueries * 4 * sizeof(int)),                                       \
+            .active_top = 0,                                                                    \
+            .active_cap = nqueries * 4,                                                         \
+        };                                                                                      \
+        if(!ctx.active) {                                                                       \
+            free(keys);                                                                         \
+            return false;                                                                       \
+        }                                                                                       \
+                                                                                                \
+        for(int i = 0; i < nqueries; i++)                                                       \
+            ctx.active[ctx.active_top++] = keys[i].idx;                                         \
+        free(keys);                                                                             \
+                                                                                                \
+        bool ret = _qt_##name##_node_batch(qt, &ctx, qt->root,                                  \
+            qt->xmin, qt->xmax, qt->ymin, qt->ymax, 0, nqueries);                               \
+        free(ctx.active);                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
     scope void qt_##name##_print(qt(name) *qt)                                                  \
     {                                                                                           \
         printf("number of records: %u\n", (unsigned)qt->nrecs);                                 \
@@ -859,5 +1097,794 @@
         return mp_##name##_reserve(&qt->node_pool, new_cap);                                    \
     }
 
+/***********************************************************************************************/
+
+/* A linear variant of the quadtree with the same interface. The nodes are  */
+/* kept in a flat array, with the 4 children of every node stored together, */
+/* and are periodically laid out in Morton order. Each leaf holds a bucket  */
+/* of up to 'bucket_sz' records, which is split once it overflows. As with  */
+/* QUADTREE_TYPE, the records are expected to lie within the tree bounds.   */
+
+#define QUADTREE_LINEAR_TYPE(name, type, bucket_sz)                                             \
+                                                                                                \
+    enum{ _qt_##name##_bucket_sz = (bucket_sz) };                                               \
+                                                                                                \
+    /* The records of a leaf, stored by component. At the maximum depth, */                     \
+    /* records that don't fit are kept in a chain of overflow buckets.   */                     \
+    typedef struct qt_##name##_bucket_s {                                                       \
+        float    x[bucket_sz];                                                                  \
+        float    y[bucket_sz];                                                                  \
+        type     records[bucket_sz];                                                            \
+        int32_t  size;                                                                          \
+        int32_t  next;                                                                          \
+    } qt_##name##_bucket_t;                                                                     \
+                                                                                                \
+    typedef struct qt_##name##_node_s {                                                         \
+        /* For internal nodes, the index of the first of the 4 children, which */               \
+        /* are stored contiguously in Morton order (sw, se, nw, ne). -1 for leaves. */          \
+        int32_t  child;                                                                         \
+        /* For leaves, the index of the first record bucket, or -1 if there is none */          \
+        int32_t  bucket;                                                                        \
+        /* The number of records in this node's subtree */                                      \
+        uint32_t nrecs;                                                                         \
+    } qt_##name##_node_t;                                                                       \
+                                                                                                \
+    typedef struct qt_##name##_s {                                                              \
+        qt_##name##_node_t   *nodes;                                                            \
+        size_t                nodes_size, nodes_cap;                                            \
+        qt_##name##_bucket_t *buckets;                                                          \
+        size_t                buckets_size, buckets_cap;                                        \
+        int32_t               free_block;                                                       \
+        int32_t               free_bucket;                                                      \
+        /* The number of splits and merges since the nodes were last laid out */                \
+        size_t                nchanges;                                                         \
+        size_t                nrecs;                                                            \
+        float xmin, xmax;                                                                       \
+        float ymin, ymax;                                                                       \
+    } qt_##name##_t;
+
+/***********************************************************************************************/
+
+#define QUADTREE_LINEAR_PROTOTYPES(scope, name, type)                                           \
+                                                                                                \
+    scope bool qt_##name##_init(qt(name) *qt,                                                   \
+                                float xmin, float xmax,                                         \
+                                float ymin, float ymax);                                        \
+    scope void qt_##name##_destroy(qt(name) *qt);                                               \
+    scope void qt_##name##_clear(qt(name) *qt);                                                 \
+    scope bool qt_##name##_insert(qt(name) *qt, float x, float y, type record);                 \
+    scope bool qt_##name##_delete(qt(name) *qt, float x, float y, type record);                 \
+    scope bool qt_##name##_delete_all(qt(name) *qt, float x, float y);                          \
+    scope bool qt_##name##_move(qt(name) *qt, float oldx, float oldy,                           \
+                                float newx, float newy, type record);                           \
+    scope bool qt_##name##_find(qt(name) *qt, float x, float y, type *out, int maxout);         \
+    scope bool qt_##name##_contains(qt(name) *qt, float x, float y);                            \
+    scope int  qt_##name##_inrange_circle(qt(name) *qt,                                         \
+                                          float x, float y, float range,                        \
+                                          type *out, int maxout);                               \
+    scope int  qt_##name##_inrange_rect(qt(name) *qt,                                           \
+                                           float minx, float maxx,                              \
+                                           float miny, float maxy,                              \
+                                           type *out, int maxout);                              \
+    scope bool qt_##name##_inrange_circle_batch(qt(name) *qt,                                   \
+                                                const struct qt_circle_query *queries,          \
+                                                int nqueries, type *out, int maxout,            \
+                                                int *out_counts);                               \
+    scope void qt_##name##_print(qt(name) *qt);                                                 \
+    scope bool qt_##name##_reserve(qt(name) *qt, size_t size);
+
+/***********************************************************************************************/
+
+#define QUADTREE_LINEAR_IMPL(scope, name, type)                                                 \
+                                                                                                \
+    _QT_MORTON_IMPL(name)                                                                       \
+                                                                                                \
+    struct _qt_##name##_frame{                                                                  \
+        int32_t node;                                                                           \
+        float   xmin, xmax;                                                                     \
+        float   ymin, ymax;                                                                     \
+    };                                                                                          \
+                                                                                                \
+    static int _qt_##name##_quadrant(float xmin, float xmax, float ymin, float ymax,            \
+                                     float x, float y)                                          \
+    {                                                                                           \
+        int ret = 0;                                                                            \
+        if(x >= (xmin + xmax) / 2.0f)                                                           \
+            ret |= 0x1;                                                                         \
+        if(y >= (ymin + ymax) / 2.0f)                                                           \
+            ret |= 0x2;                                                                         \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_child_bounds(int quadrant, float *inout_xmin, float *inout_xmax,   \
+                                          float *inout_ymin, float *inout_ymax)                 \
+    {                                                                                           \
+        const float xmid = (*inout_xmin + *inout_xmax) / 2.0f;                                  \
+        const float ymid = (*inout_ymin + *inout_ymax) / 2.0f;                                  \
+        if(quadrant & 0x1)                                                                      \
+            *inout_xmin = xmid;                                                                 \
+        else                                                                                    \
+            *inout_xmax = xmid;                                                                 \
+        if(quadrant & 0x2)                                                                      \
+            *inout_ymin = ymid;                                                                 \
+        else                                                                                    \
+            *inout_ymax = ymid;                                                                 \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_grow_nodes(qt(name) *qt, size_t min_cap)                           \
+    {                                                                                           \
+        if(qt->nodes_cap >= min_cap)                                                            \
+            return true;                                                                        \
+        size_t new_cap = _MAX(qt->nodes_cap * 2, _MAX(min_cap, 64));                            \
+        qt_node(name) *new_nodes = realloc(qt->nodes, new_cap * sizeof(*new_nodes));            \
+        if(!new_nodes)                                                                          \
+            return false;                                                                       \
+        qt->nodes = new_nodes;                                                                  \
+        qt->nodes_cap = new_cap;                                                                \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_grow_buckets(qt(name) *qt, size_t min_cap)                         \
+    {                                                                                           \
+        if(qt->buckets_cap >= min_cap)                                                          \
+            return true;                                                                        \
+        size_t new_cap = _MAX(qt->buckets_cap * 2, _MAX(min_cap, 16));                          \
+        qt_##name##_bucket_t *new_buckets = realloc(qt->buckets,                                \
+            new_cap * sizeof(*new_buckets));                                                    \
+        if(!new_buckets)                                                                        \
+            return false;                                                                       \
+        qt->buckets = new_buckets;                                                              \
+        qt->buckets_cap = new_cap;                                                              \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    /* Reserve enough space for the next 'nblocks' blocks of child nodes and */                 \
+    /* 'nbuckets' buckets to be allocated without failing.                   */                 \
+    static bool _qt_##name##_ensure(qt(name) *qt, size_t nblocks, size_t nbuckets)              \
+    {                                                                                           \
+        return _qt_##name##_grow_nodes(qt, qt->nodes_size + nblocks * 4)                        \
+            && _qt_##name##_grow_buckets(qt, qt->buckets_size + nbuckets);                      \
+    }                                                                                           \
+                                                                                                \
+    static int32_t _qt_##name##_alloc_block(qt(name) *qt)                                       \
+    {                                                                                           \
+        int32_t ret;                                                                            \
+        if(qt->free_block >= 0) {                                                               \
+            ret = qt->free_block;                                                               \
+            qt->free_block = qt->nodes[ret].child;                                              \
+        }else{                                                                                  \
+            if(!_qt_##name##_grow_nodes(qt, qt->nodes_size + 4))                                \
+                return -1;                                                                      \
+            ret = qt->nodes_size;                                                               \
+            qt->nodes_size += 4;                                                                \
+        }                                                                                       \
+        for(int i = 0; i < 4; i++)                                                              \
+            qt->nodes[ret + i] = (qt_node(name)){.child = -1, .bucket = -1, .nrecs = 0};        \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_free_block(qt(name) *qt, int32_t block)                            \
+    {                                                                                           \
+        qt->nodes[block].child = qt->free_block;                                                \
+        qt->free_block = block;                                                                 \
+    }                                                                                           \
+                                                                                                \
+    static int32_t _qt_##name##_alloc_bucket(qt(name) *qt)                                      \
+    {                                                                                           \
+        int32_t ret;                                                                            \
+        if(qt->free_bucket >= 0) {                                                              \
+            ret = qt->free_bucket;                                                              \
+            qt->free_bucket = qt->buckets[ret].next;                                            \
+        }else{                                                                                  \
+            if(!_qt_##name##_grow_buckets(qt, qt->buckets_size + 1))                            \
+                return -1;                                                                      \
+            ret = qt->buckets_size++;                                                           \
+        }                                                                                       \
+        qt->buckets[ret].size = 0;                                                              \
+        qt->buckets[ret].next = -1;                                                             \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_free_bucket(qt(name) *qt, int32_t bucket)                          \
+    {                                                                                           \
+        qt->buckets[bucket].next = qt->free_bucket;                                             \
+        qt->free_bucket = bucket;                                                               \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_bucket_append(qt(name) *qt, int32_t leaf,                          \
+                                           float x, float y, type record)                       \
+    {                                                                                           \
+        int32_t tail = qt->nodes[leaf].bucket;                                                  \
+        if(tail < 0) {                                                                          \
+            if((tail = _qt_##name##_alloc_bucket(qt)) < 0)                                      \
+                return false;                                                                   \
+            qt->nodes[leaf].bucket = tail;                                                      \
+        }else{                                                                                  \
+            while(qt->buckets[tail].next >= 0)                                                  \
+                tail = qt->buckets[tail].next;                                                  \
+            if(qt->buckets[tail].size == _qt_##name##_bucket_sz) {                              \
+                int32_t next = _qt_##name##_alloc_bucket(qt);                                   \
+                if(next < 0)                                                                    \
+                    return false;                                                               \
+                qt->buckets[tail].next = next;                                                  \
+                tail = next;                                                                    \
+            }                                                                                   \
+        }                                                                                       \
+        qt_##name##_bucket_t *bucket = &qt->buckets[tail];                                      \
+        bucket->x[bucket->size] = x;                                                            \
+        bucket->y[bucket->size] = y;                                                            \
+        bucket->records[bucket->size] = record;                                                 \
+        bucket->size++;                                                                         \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    /* The hole left by the removed record is filled with the last record */                    \
+    /* of the chain, so that only the tail bucket is ever partially full. */                    \
+    static bool _qt_##name##_bucket_remove(qt(name) *qt, int32_t leaf,                          \
+                                           float x, float y, type record)                       \
+    {                                                                                           \
+        int32_t found = -1, found_idx = 0;                                                      \
+        int32_t prev = -1, tail = -1;                                                           \
+        for(int32_t b = qt->nodes[leaf].bucket; b >= 0; b = qt->buckets[b].next) {              \
+            const qt_##name##_bucket_t *bucket = &qt->buckets[b];                               \
+            for(int i = 0; found < 0 && i < bucket->size; i++) {                                \
+                if(!QT_EQ(bucket->x[i], x) || !QT_EQ(bucket->y[i], y))                          \
+                    continue;                                                                   \
+                if(0 != memcmp(&bucket->records[i], &record, sizeof(record)))                   \
+                    continue;                                                                   \
+                found = b;                                                                      \
+                found_idx = i;                                                                  \
+            }                                                                                   \
+            prev = tail;                                                                        \
+            tail = b;                                                                           \
+        }                                                                                       \
+        if(found < 0)                                                                           \
+            return false;                                                                       \
+                                                                                                \
+        qt_##name##_bucket_t *last = &qt->buckets[tail];                                        \
+        qt_##name##_bucket_t *hole = &qt->buckets[found];                                       \
+        last->size--;                                                                           \
+        hole->x[found_idx] = last->x[last->size];                                               \
+        hole->y[found_idx] = last->y[last->size];                                               \
+        hole->records[found_idx] = last->records[last->size];                                   \
+                                                                                                \
+        if(last->size == 0) {                                                                   \
+            if(prev < 0)                                                                        \
+                qt->nodes[leaf].bucket = -1;                                                    \
+            else                                                                                \
+                qt->buckets[prev].next = -1;                                                    \
+            _qt_##name##_free_bucket(qt, tail);                                                 \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static bool _qt_##name##_split(qt(name) *qt, int32_t leaf,                                  \
+                                   float xmin, float xmax, float ymin, float ymax)              \
+    {                                                                                           \
+        if(!_qt_##name##_ensure(qt, 1, 4))                                                      \
+            return false;                                                                       \
+                                                                                                \
+        int32_t block = _qt_##name##_alloc_block(qt);                                           \
+        int32_t old = qt->nodes[leaf].bucket;                                                   \
+        assert(block >= 0 && old >= 0);                                                         \
+        assert(qt->buckets[old].next < 0);                                                      \
+                                                                                                \
+        qt->nodes[leaf].child = block;                                                          \
+        qt->nodes[leaf].bucket = -1;                                                            \
+                                                                                                \
+        for(int i = 0; i < qt->buckets[old].size; i++) {                                        \
+            const qt_##name##_bucket_t *src = &qt->buckets[old];                                \
+            float x = src->x[i], y = src->y[i];                                                 \
+            int quadrant = _qt_##name##_quadrant(xmin, xmax, ymin, ymax, x, y);                 \
+            bool ret = _qt_##name##_bucket_append(qt, block + quadrant, x, y, src->records[i]); \
+            assert(ret);                                                                        \
+            (void)ret;                                                                          \
+            qt->nodes[block + quadrant].nrecs++;                                                \
+        }                                                                                       \
+        _qt_##name##_free_bucket(qt, old);                                                      \
+        qt->nchanges++;                                                                         \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_gather(qt(name) *qt, int32_t node, int32_t dst)                    \
+    {                                                                                           \
+        int32_t child = qt->nodes[node].child;                                                  \
+        if(child >= 0) {                                                                        \
+            for(int i = 0; i < 4; i++)                                                          \
+                _qt_##name##_gather(qt, child + i, dst);                                        \
+            _qt_##name##_free_block(qt, child);                                                 \
+            return;                                                                             \
+        }                                                                                       \
+                                                                                                \
+        int32_t curr = qt->nodes[node].bucket;                                                  \
+        while(curr >= 0) {                                                                      \
+            qt_##name##_bucket_t *src = &qt->buckets[curr];                                     \
+            qt_##name##_bucket_t *dst_bucket = &qt->buckets[dst];                               \
+            for(int i = 0; i < src->size; i++) {                                                \
+                assert(dst_bucket->size < _qt_##name##_bucket_sz);                              \
+                dst_bucket->x[dst_bucket->size] = src->x[i];                                    \
+                dst_bucket->y[dst_bucket->size] = src->y[i];                                    \
+                dst_bucket->records[dst_bucket->size] = src->records[i];                        \
+                dst_bucket->size++;                                                             \
+            }                                                                                   \
+            int32_t next = src->next;                                                           \
+            _qt_##name##_free_bucket(qt, curr);                                                 \
+            curr = next;                                                                        \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    /* Collapse the subtree of an internal node into a single leaf. The */                      \
+    /* tree is left as is if there is no memory for the new bucket.       */                    \
+    static void _qt_##name##_merge(qt(name) *qt, int32_t node)                                  \
+    {                                                                                           \
+        assert(qt->nodes[node].child >= 0);                                                     \
+        assert(qt->nodes[node].nrecs <= _qt_##name##_bucket_sz);                                \
+                                                                                                \
+        int32_t dst = -1;                                                                       \
+        if(qt->nodes[node].nrecs > 0 && (dst = _qt_##name##_alloc_bucket(qt)) < 0)              \
+            return;                                                                             \
+                                                                                                \
+        int32_t child = qt->nodes[node].child;                                                  \
+        for(int i = 0; i < 4; i++)                                                              \
+            _qt_##name##_gather(qt, child + i, dst);                                            \
+        _qt_##name##_free_block(qt, child);                                                     \
+                                                                                                \
+        qt->nodes[node].child = -1;                                                             \
+        qt->nodes[node].bucket = dst;                                                           \
+        qt->nchanges++;                                                                         \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_relayout_node(const qt(name) *qt, int32_t src_idx,                 \
+                                           qt_node(name) *nodes, size_t *inout_nnodes,          \
+                                           qt_##name##_bucket_t *buckets,                       \
+                                           size_t *inout_nbuckets, int32_t dst_idx)             \
+    {                                                                                           \
+        const qt_node(name) *src = &qt->nodes[src_idx];                                         \
+        qt_node(name) *dst = &nodes[dst_idx];                                                   \
+        *dst = (qt_node(name)){.child = -1, .bucket = -1, .nrecs = src->nrecs};                 \
+                                                                                                \
+        if(src->child >= 0) {                                                                   \
+            int32_t block = *inout_nnodes;                                                      \
+            *inout_nnodes += 4;                                                                 \
+            dst->child = block;                                                                 \
+            for(int i = 0; i < 4; i++) {                                                        \
+                _qt_##name##_relayout_node(qt, src->child + i, nodes, inout_nnodes,             \
+                    buckets, inout_nbuckets, block + i);                                        \
+            }                                                                                   \
+            return;                                                                             \
+        }                                                                                       \
+                                                                                                \
+        int32_t *link = &dst->bucket;                                                           \
+        for(int32_t b = src->bucket; b >= 0; b = qt->buckets[b].next) {                         \
+            int32_t new_idx = (*inout_nbuckets)++;                                              \
+            buckets[new_idx] = qt->buckets[b];                                                  \
+            buckets[new_idx].next = -1;                                                         \
+            *link = new_idx;                                                                    \
+            link = &buckets[new_idx].next;                                                      \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    /* Copy the nodes into new arrays in depth-first order, with the  */                        \
+    /* children of every node in Morton order. This keeps nodes that */                         \
+    /* are close in space close in memory. Failing is harmless.      */                         \
+    static void _qt_##name##_relayout(qt(name) *qt)                                             \
+    {                                                                                           \
+        qt_node(name) *nodes = malloc(qt->nodes_cap * sizeof(*nodes));                          \
+        qt_##name##_bucket_t *buckets = malloc(_MAX(qt->buckets_cap, 1) * sizeof(*buckets));    \
+        if(!nodes || !buckets) {                                                                \
+            free(nodes);                                                                        \
+            free(buckets);                                                                      \
+            return;                                                                             \
+        }                                                                                       \
+                                                                                                \
+        size_t nnodes = 1, nbuckets = 0;                                                        \
+        _qt_##name##_relayout_node(qt, 0, nodes, &nnodes, buckets, &nbuckets, 0);               \
+                                                                                                \
+        free(qt->nodes);                                                                        \
+        free(qt->buckets);                                                                      \
+        qt->nodes = nodes;                                                                      \
+        qt->nodes_size = nnodes;                                                                \
+        qt->buckets = buckets;                                                                  \
+        qt->buckets_size = nbuckets;                                                            \
+        qt->free_block = -1;                                                                    \
+        qt->free_bucket = -1;                                                                   \
+        qt->nchanges = 0;                                                                       \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_maybe_relayout(qt(name) *qt)                                       \
+    {                                                                                           \
+        if(qt->nchanges > QT_LINEAR_RELAYOUT_MIN + qt->nodes_size / 8)                          \
+            _qt_##name##_relayout(qt);                                                          \
+    }                                                                                           \
+                                                                                                \
+    static int32_t _qt_##name##_find_leaf(qt(name) *qt, float x, float y,                       \
+                                          int32_t *out_path, int *out_depth)                    \
+    {                                                                                           \
+        float xmin = qt->xmin, xmax = qt->xmax;                                                 \
+        float ymin = qt->ymin, ymax = qt->ymax;                                                 \
+        int32_t curr = 0;                                                                       \
+        int depth = 0;                                                                          \
+                                                                                                \
+        while(qt->nodes[curr].child >= 0) {                                                     \
+            if(out_path)                                                                        \
+                out_path[depth] = curr;                                                         \
+            int quadrant = _qt_##name##_quadrant(xmin, xmax, ymin, ymax, x, y);                 \
+            _qt_##name##_child_bounds(quadrant, &xmin, &xmax, &ymin, &ymax);                    \
+            curr = qt->nodes[curr].child + quadrant;                                            \
+            depth++;                                                                            \
+        }                                                                                       \
+        if(out_path)                                                                            \
+            out_path[depth] = curr;                                                             \
+        if(out_depth)                                                                           \
+            *out_depth = depth;                                                                 \
+        return curr;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    static void _qt_##name##_node_print(qt(name) *qt, int32_t idx, int indent,                  \
+                                        float xmin, float xmax, float ymin, float ymax)         \
+    {                                                                                           \
+        const qt_node(name) *node = &qt->nodes[idx];                                            \
+        for(int i = 0; i < indent; i++)                                                         \
+            printf("  ");                                                                       \
+        if(indent)                                                                              \
+            printf("|-> ");                                                                     \
+                                                                                                \
+        printf("[%12.6f, %12.6f]", (xmin + xmax) / 2.0f, (ymin + ymax) / 2.0f);                 \
+        printf(" (%u records)\n", (unsigned)node->nrecs);                                       \
+        if(node->child < 0)                                                                     \
+            return;                                                                             \
+                                                                                                \
+        for(int i = 0; i < 4; i++) {                                                            \
+            float cxmin = xmin, cxmax = xmax, cymin = ymin, cymax = ymax;                       \
+            _qt_##name##_child_bounds(i, &cxmin, &cxmax, &cymin, &cymax);                       \
+            _qt_##name##_node_print(qt, node->child + i, indent + 1,                            \
+                cxmin, cxmax, cymin, cymax);                                                    \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_init(qt(name) *qt,                                                   \
+                                float xmin, float xmax,                                         \
+                                float ymin, float ymax)                                         \
+    {                                                                                           \
+        memset(qt, 0, sizeof(*qt));                                                             \
+        qt->free_block = -1;                                                                    \
+        qt->free_bucket = -1;                                                                   \
+        qt->xmin = xmin;                                                                        \
+        qt->xmax = xmax;                                                                        \
+        qt->ymin = ymin;                                                                        \
+        qt->ymax = ymax;                                                                        \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void qt_##name##_destroy(qt(name) *qt)                                                \
+    {                                                                                           \
+        free(qt->nodes);                                                                        \
+        free(qt->buckets);                                                                      \
+        memset(qt, 0, sizeof(*qt));                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope void qt_##name##_clear(qt(name) *qt)                                                  \
+    {                                                                                           \
+        qt->nodes_size = 0;                                                                     \
+        qt->buckets_size = 0;                                                                   \
+        qt->free_block = -1;                                                                    \
+        qt->free_bucket = -1;                                                                   \
+        qt->nchanges = 0;                                                                       \
+        qt->nrecs = 0;                                                                          \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_insert(qt(name) *qt, float x, float y, type record)                  \
+    {                                                                                           \
+        if(qt->nodes_size == 0) {                                                               \
+            _CHK_TRUE_RET(_qt_##name##_grow_nodes(qt, 1), false);                               \
+            qt->nodes[0] = (qt_node(name)){.child = -1, .bucket = -1, .nrecs = 0};              \
+            qt->nodes_size = 1;                                                                 \
+        }                                                                                       \
+                                                                                                \
+        int32_t path[QT_LINEAR_MAX_DEPTH + 1];                                                  \
+        float xmin = qt->xmin, xmax = qt->xmax;                                                 \
+        float ymin = qt->ymin, ymax = qt->ymax;                                                 \
+        int32_t curr = 0;                                                                       \
+        int depth = 0;                                                                          \
+                                                                                                \
+        while(true) {                                                                           \
+                                                                                                \
+            path[depth] = curr;                                                                 \
+            if(qt->nodes[curr].child >= 0) {                                                    \
+                int quadrant = _qt_##name##_quadrant(xmin, xmax, ymin, ymax, x, y);             \
+                _qt_##name##_child_bounds(quadrant, &xmin, &xmax, &ymin, &ymax);                \
+                curr = qt->nodes[curr].child + quadrant;                                        \
+                depth++;                                                                        \
+                continue;                                                                       \
+            }                                                                                   \
+                                                                                                \
+            /* Full leaves are split, unless they are already at the maximum */                 \
+            /* depth, in which case an overflow bucket is chained instead.   */                 \
+            int32_t bucket = qt->nodes[curr].bucket;                                            \
+            if(depth < QT_LINEAR_MAX_DEPTH && bucket >= 0                                       \
+            && qt->buckets[bucket].size == _qt_##name##_bucket_sz) {                            \
+                _CHK_TRUE_RET(_qt_##name##_split(qt, curr, xmin, xmax, ymin, ymax), false);     \
+                continue;                                                                       \
+            }                                                                                   \
+                                                                                                \
+            _CHK_TRUE_RET(_qt_##name##_bucket_append(qt, curr, x, y, record), false);           \
+            break;                                                                              \
+        }                                                                                       \
+                                                                                                \
+        for(int i = 0; i <= depth; i++)                                                         \
+            qt->nodes[path[i]].nrecs++;                                                         \
+        qt->nrecs++;                                                                            \
+                                                                                                \
+        _qt_##name##_maybe_relayout(qt);                                                        \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_delete(qt(name) *qt, float x, float y, type record)                  \
+    {                                                                                           \
+        if(qt->nodes_size == 0)                                                                 \
+            return false;                                                                       \
+                                                                                                \
+        int32_t path[QT_LINEAR_MAX_DEPTH + 1];                                                  \
+        int depth;                                                                              \
+        int32_t leaf = _qt_##name##_find_leaf(qt, x, y, path, &depth);                          \
+        if(!_qt_##name##_bucket_remove(qt, leaf, x, y, record))                                 \
+            return false;                                                                       \
+                                                                                                \
+        for(int i = 0; i <= depth; i++)                                                         \
+            qt->nodes[path[i]].nrecs--;                                                         \
+        qt->nrecs--;                                                                            \
+                                                                                                \
+        /* Merge the topmost ancestor that has become sparse. Waiting until */                  \
+        /* it is half-empty avoids splitting it right back on an insert.  */                    \
+        for(int i = 0; i < depth; i++) {                                                        \
+            if(qt->nodes[path[i]].nrecs <= _qt_##name##_bucket_sz / 2) {                        \
+                _qt_##name##_merge(qt, path[i]);                                                \
+                break;                                                                          \
+            }                                                                                   \
+        }                                                                                       \
+                                                                                                \
+        _qt_##name##_maybe_relayout(qt);                                                        \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_delete_all(qt(name) *qt, float x, float y)                           \
+    {                                                                                           \
+        bool ret = false;                                                                       \
+        type record;                                                                            \
+        while(qt_##name##_find(qt, x, y, &record, 1)) {                                         \
+            bool deleted = qt_##name##_delete(qt, x, y, record);                                \
+            assert(deleted);                                                                    \
+            (void)deleted;                                                                      \
+            ret = true;                                                                         \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    /* The old and new positions are followed down the tree together. If they */                \
+    /* end up in the same leaf, the record is updated in place. Otherwise, it  */               \
+    /* is re-inserted, with the memory for doing so reserved up front.         */               \
+    scope bool qt_##name##_move(qt(name) *qt, float oldx, float oldy,                           \
+                                float newx, float newy, type record)                            \
+    {                                                                                           \
+        if(qt->nodes_size == 0)                                                                 \
+            return false;                                                                       \
+                                                                                                \
+        float xmin = qt->xmin, xmax = qt->xmax;                                                 \
+        float ymin = qt->ymin, ymax = qt->ymax;                                                 \
+        int32_t curr = 0;                                                                       \
+                                                                                                \
+        while(qt->nodes[curr].child >= 0) {                                                     \
+            int quadrant = _qt_##name##_quadrant(xmin, xmax, ymin, ymax, oldx, oldy);           \
+            if(quadrant != _qt_##name##_quadrant(xmin, xmax, ymin, ymax, newx, newy))           \
+                break;                                                                          \
+            _qt_##name##_child_bounds(quadrant, &xmin, &xmax, &ymin, &ymax);                    \
+            curr = qt->nodes[curr].child + quadrant;                                            \
+        }                                                                                       \
+                                                                                                \
+        if(qt->nodes[curr].child < 0) {                                                         \
+                                                                                                \
+            for(int32_t b = qt->nodes[curr].bucket; b >= 0; b = qt->buckets[b].next) {          \
+                qt_##name##_bucket_t *bucket = &qt->buckets[b];                                 \
+                for(int i = 0; i < bucket->size; i++) {                                         \
+                    if(!QT_EQ(bucket->x[i], oldx) || !QT_EQ(bucket->y[i], oldy))                \
+                        continue;                                                               \
+                    if(0 != memcmp(&bucket->records[i], &record, sizeof(record)))               \
+                        continue;                                                               \
+                    bucket->x[i] = newx;                                                        \
+                    bucket->y[i] = newy;                                                        \
+                    return true;                                                                \
+                }                                                                               \
+            }                                                                                   \
+            return false;                                                                       \
+        }                                                                                       \
+                                                                                                \
+        /* Enough for the insertion to split every level and for a merge */                     \
+        _CHK_TRUE_RET(_qt_##name##_ensure(qt, QT_LINEAR_MAX_DEPTH + 1,                          \
+            4 * (QT_LINEAR_MAX_DEPTH + 1) + 1), false);                                         \
+                                                                                                \
+        if(!qt_##name##_delete(qt, oldx, oldy, record))                                         \
+            return false;                                                                       \
+                                                                                                \
+        bool ret = qt_##name##_insert(qt, newx, newy, record);                                  \
+        assert(ret);                                                                            \
+        (void)ret;                                                                              \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_find(qt(name) *qt, float x, float y, type *out, int maxout)          \
+    {                                                                                           \
+        if(qt->nodes_size == 0)                                                                 \
+            return false;                                                                       \
+                                                                                                \
+        int32_t leaf = _qt_##name##_find_leaf(qt, x, y, NULL, NULL);                            \
+        int nfound = 0;                                                                         \
+                                                                                                \
+        for(int32_t b = qt->nodes[leaf].bucket; b >= 0; b = qt->buckets[b].next) {              \
+            const qt_##name##_bucket_t *bucket = &qt->buckets[b];                               \
+            for(int i = 0; i < bucket->size && nfound < maxout; i++) {                          \
+                if(QT_EQ(bucket->x[i], x) && QT_EQ(bucket->y[i], y))                            \
+                    out[nfound++] = bucket->records[i];                                         \
+            }                                                                                   \
+        }                                                                                       \
+        return (nfound > 0);                                                                    \
+    }                                                                                           \
+                                                                                                \
+    scope bool qt_##name##_contains(qt(name) *qt, float x, float y)                             \
+    {                                                                                           \
+        type dummy;                                                                             \
+        return qt_##name##_find(qt, x, y, &dummy, 1);                                           \
+    }                                                                                           \
+                                                                                                \
+    scope int qt_##name##_inrange_circle(qt(name) *qt,                                          \
+                                  float x, float y, float range,                                \
+                                  type *out, int maxout)                                        \
+    {                                                                                           \
+        if(qt->nrecs == 0 || maxout <= 0)                                                       \
+            return 0;                                                                           \
+                                                                                                \
+        struct _qt_##name##_frame stack[3 * QT_LINEAR_MAX_DEPTH + 4];                           \
+        const float range_sq = range * range;                                                   \
+        int top = 0, ret = 0;                                                                   \
+        stack[top++] = (struct _qt_##name##_frame){0, qt->xmin, qt->xmax, qt->ymin, qt->ymax};  \
+                                                                                                \
+        while(top > 0) {                                                                        \
+                                                                                                \
+            struct _qt_##name##_frame curr = stack[--top];                                      \
+            const qt_node(name) *node = &qt->nodes[curr.node];                                  \
+            if(node->nrecs == 0)                                                                \
+                continue;                                                                       \
+                                                                                                \
+            float dx = _MAX(_MAX(curr.xmin - x, x - curr.xmax), 0.0f);                          \
+            float dy = _MAX(_MAX(curr.ymin - y, y - curr.ymax), 0.0f);                          \
+            if(dx * dx + dy * dy > range_sq)                                                    \
+                continue;                                                                       \
+                                                                                                \
+            if(node->child >= 0) {                                                              \
+                /* Pushed in reverse, so that the children are popped in Morton order */        \
+                for(int i = 3; i >= 0; i--) {                                                   \
+                    struct _qt_##name##_frame child = curr;                                     \
+                    child.node = node->child + i;                                               \
+                    _qt_##name##_child_bounds(i, &child.xmin, &child.xmax,                      \
+                        &child.ymin, &child.ymax);                                              \
+                    stack[top++] = child;                                                       \
+                }                                                                               \
+                continue;                                                                       \
+            }                                                                                   \
+                                                                                                \
+            for(int32_t b = node->bucket; b >= 0; b = qt->buckets[b].next) {                    \
+                const qt_##name##_bucket_t *bucket = &qt->buckets[b];                           \
+                for(int i = 0; i < bucket->size; i++) {                                         \
+                    float rx = bucket->x[i] - x;                                                \
+                    float ry = bucket->y[i] - y;                                                \
+                    if(rx * rx + ry * ry > range_sq)                                            \
+                        continue;                                                               \
+                    out[ret++] = bucket->records[i];                                            \
+                    if(ret == maxout)                                                           \
+                        return ret;                                                             \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope int  qt_##name##_inrange_rect(qt(name) *qt,                                           \
+                                        float minx, float maxx,                                 \
+                                        float miny, float maxy,                                 \
+                                        type *out, int maxout)                                  \
+    {                                                                                           \
+        if(qt->nrecs == 0 || maxout <= 0)                                                       \
+            return 0;                                                                           \
+                                                                                                \
+        struct _qt_##name##_frame stack[3 * QT_LINEAR_MAX_DEPTH + 4];                           \
+        int top = 0, ret = 0;                                                                   \
+        stack[top++] = (struct _qt_##name##_frame){0, qt->xmin, qt->xmax, qt->ymin, qt->ymax};  \
+                                                                                                \
+        while(top > 0) {                                                                        \
+                                                                                                \
+            struct _qt_##name##_frame curr = stack[--top];                                      \
+            const qt_node(name) *node = &qt->nodes[curr.node];                                  \
+            if(node->nrecs == 0)                                                                \
+                continue;                                                                       \
+            if(curr.xmax < minx || curr.xmin > maxx || curr.ymax < miny || curr.ymin > maxy)    \
+                continue;                                                                       \
+                                                                                                \
+            if(node->child >= 0) {                                                              \
+                for(int i = 3; i >= 0; i--) {                                                   \
+                    struct _qt_##name##_frame child = curr;                                     \
+                    child.node = node->child + i;                                               \
+                    _qt_##name##_child_bounds(i, &child.xmin, &child.xmax,                      \
+                        &child.ymin, &child.ymax);                                              \
+                    stack[top++] = child;                                                       \
+                }                                                                               \
+                continue;                                                                       \
+            }                                                                                   \
+                                                                                                \
+            for(int32_t b = node->bucket; b >= 0; b = qt->buckets[b].next) {                    \
+                const qt_##name##_bucket_t *bucket = &qt->buckets[b];                           \
+                for(int i = 0; i < bucket->size; i++) {                                         \
+                    if(bucket->x[i] < minx || bucket->x[i] > maxx)                              \
+                        continue;                                                               \
+                    if(bucket->y[i] < miny || bucket->y[i] > maxy)                              \
+                        continue;                                                               \
+                    out[ret++] = bucket->records[i];                                            \
+                    if(ret == maxout)                                                           \
+                        return ret;                                                             \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    /* The queries are answered one after another, but in Morton order, so */                   \
+    /* consecutive queries mostly touch the same nodes and buckets.        */                   \
+    scope bool qt_##name##_inrange_circle_batch(qt(name) *qt,                                   \
+                                                const struct qt_circle_query *queries,          \
+                                                int nqueries, type *out, int maxout,            \
+                                                int *out_counts)                                \
+    {                                                                                           \
+        for(int i = 0; i < nqueries; i++)                                                       \
+            out_counts[i] = 0;                                                                  \
+        if(qt->nrecs == 0 || nqueries == 0 || maxout == 0)                                      \
+            return true;                                                                        \
+                                                                                                \
+        struct _qt_##name##_morton_key *keys = malloc(nqueries * sizeof(*keys));                \
+        if(!keys)                                                                               \
+            return false;                                                                       \
+                                                                                                \
+        for(int i = 0; i < nqueries; i++) {                                                     \
+            keys[i].code = _qt_##name##_morton_code(qt, queries[i].x, queries[i].y);            \
+            keys[i].idx = i;                                                                    \
+        }                                                                                       \
+        qsort(keys, nqueries, sizeof(*keys), _qt_##name##_compare_morton);                      \
+                                                                                                \
+        for(int i = 0; i < nqueries; i++) {                                                     \
+            const struct qt_circle_query *q = &queries[keys[i].idx];                            \
+            out_counts[keys[i].idx] = qt_##name##_inrange_circle(qt, q->x, q->y, q->range,      \
+                out + keys[i].idx * maxout, maxout);                                            \
+        }                                                                                       \
+        free(keys);                                                                             \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void qt_##name##_print(qt(name) *qt)                                                  \
+    {                                                                                           \
+        printf("number of records: %u\n", (unsigned)qt->nrecs);                                 \
+        printf("nodes: %u, buckets: %u\n",                                                      \
+            (unsigned)qt->nodes_size, (unsigned)qt->buckets_size);                              \
+        if(qt->nodes_size == 0) {                                                               \
+            printf("(empty)\n");                                                                \
+            return;                                                                             \
+        }                                                                                       \
+        _qt_##name##_node_print(qt, 0, 0, qt->xmin, qt->xmax, qt->ymin, qt->ymax);              \
+    }                                                                                           \
+                                                                                                \
+    /* Reserves space for roughly 'new_cap' records */                                          \
+    scope bool qt_##name##_reserve(qt(name) *qt, size_t new_cap)                                \
+    {                                                                                           \
+        size_t nbuckets = new_cap / _qt_##name##_bucket_sz * 2 + 1;                             \
+        return _qt_##name##_grow_buckets(qt, nbuckets)                                          \
+            && _qt_##name##_grow_nodes(qt, nbuckets * 2);                                       \
+    }
+
 #endif
 
@@ -51,6 +51,7 @@
  * another one is allocated from the OS and appended to it. The purpose is to 
  * allow arbitrary many allocations without needing to invalidate pointers to
  * prior allocations, which would be required with a 'realloc'-based approach. 
+ * Allocations larger than a memblock are each given a dedicated block.
  *
  * The allocations cannot be freed in arbitrary order. The API provides only a
  * means to clear all the allocations at once. Hence, this allocator is good 
@@ -63,10 +64,35 @@ struct st_mem{
     unsigned char  raw[MEMBLOCK_SZ];
 };
 
+/* Allocations larger than MEMBLOCK_SZ get a dedicated block of their own */
+struct st_bigmem{
+    struct st_bigmem *next;
+    unsigned char     raw[];
+};
+
+struct memstack_stats{
+    size_t bytes;            /* Allocated since the last clear */
+    size_t last_bytes;       /* Allocated between the last two clears */
+    size_t high_water;       /* The most bytes ever allocated between two clears */
+    size_t nblocks;          /* Memblocks currently owned, including the spare ones */
+    size_t noversized;       /* Oversized allocations since the last clear */
+    size_t ntrimmed;         /* Spare memblocks that have been released so far */
+};
+
+/* When cleared, the memstack keeps all its' memblocks for reuse. Memblocks that 
+ * were not needed during STALLOC_TRIM_FRAMES consecutive clears are released.
+ */
+#define STALLOC_TRIM_FRAMES (120)
+
 struct memstack{
-    struct st_mem *head;
-    struct st_mem *tail;
-    void          *top; /* Empty Ascending stack */
+    struct st_mem        *head;
+    struct st_mem        *tail;  /* The memblock holding the top of the stack */
+    void                 *top;   /* Empty Ascending stack */
+    size_t                tail_idx;
+    struct st_bigmem     *oversized;
+    int                   quiet_frames;
+    size_t                quiet_peak_blocks;
+    struct memstack_stats stats;
 };
 
 bool  stalloc_init(struct memstack *st);
@@ -0,0 +1,367 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SWISS_MAP_H
+#define SWISS_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* An open-addressing hash map in the style of Abseil's 'Swiss tables'. Every 
+ * slot has a control byte, holding 7 bits of the key's hash for full slots, 
+ * or a marker for empty and deleted ones. Lookups are done a group of 16 
+ * control bytes at a time, so most misses are rejected without touching the 
+ * slots at all. The control bytes are kept apart from the slots, so that a
+ * whole group fits in a single cache line.
+ */
+
+#define SM_GROUP_SZ         (16)
+#define SM_CTRL_EMPTY       ((int8_t)-128)
+#define SM_CTRL_DELETED     ((int8_t)-2)
+#define SM_H1(hash)         ((hash) >> 7)
+#define SM_H2(hash)         ((int8_t)((hash) & 0x7f))
+#define SM_MAX_LOAD_NUM     (7)
+#define SM_MAX_LOAD_DEN     (8)
+
+#define _SM_MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+/***********************************************************************************************/
+
+#define sm(name)                                                                                \
+    sm_##name##_t
+
+#define sm_size(map)                                                                            \
+    ((map)->size)
+
+#define sm_foreach(map, kvar, vvar, code)                                                       \
+    for(size_t __i = 0; __i < (map)->capacity; __i++) {                                         \
+        if((map)->ctrl[__i] < 0)                                                                \
+            continue;                                                                           \
+        (kvar) = (map)->slots[__i].key;                                                         \
+        (vvar) = (map)->slots[__i].val;                                                         \
+        code;                                                                                   \
+    }
+
+/* The finalizer of MurmurHash3. All bits of the result depend on all bits of 
+ * the key, which matters since the low and high bits are used separately. */
+static inline uint32_t sm_hash_int(uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+#define sm_int_equal(a, b)  ((a) == (b))
+
+/***********************************************************************************************/
+
+/* Returns a mask with bit 'i' set if the 'i'th control byte of the group equals 'ctrl' */
+static inline uint32_t _sm_group_match(const int8_t *group, int8_t ctrl)
+{
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+    uint32_t ret = 0;
+    for(int i = 0; i < SM_GROUP_SZ; i++)
+        ret |= (uint32_t)(group[i] == ctrl) << i;
+    return ret;
+#endif
+}
+
+/* Empty and deleted slots are the ones with the high bit of the control byte set */
+static inline uint32_t _sm_group_match_free(const int8_t *group)
+{
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t ret = 0;
+    for(int i = 0; i < SM_GROUP_SZ; i++)
+        ret |= (uint32_t)(group[i] < 0) << i;
+    return ret;
+#endif
+}
+
+static inline int _sm_lowest_bit(uint32_t mask)
+{
+    assert(mask);
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int ret = 0;
+    while(!(mask & 0x1)) {
+        mask >>= 1;
+        ret++;
+    }
+    return ret;
+#endif
+}
+
+static inline int _sm_trailing_zeros(uint32_t mask)
+{
+    return mask ? _sm_lowest_bit(mask) : SM_GROUP_SZ;
+}
+
+static inline int _sm_leading_zeros(uint32_t mask)
+{
+    int ret = 0;
+    for(int i = SM_GROUP_SZ - 1; i >= 0 && !(mask & (1u << i)); i--)
+        ret++;
+    return ret;
+}
+
+/***********************************************************************************************/
+
+#define SWISS_MAP_TYPE(name, ktype, vtype)                                                      \
+                                                                                                \
+    typedef struct sm_##name##_slot_s {                                                         \
+        ktype    key;                                                                           \
+        vtype    val;                                                                           \
+    } sm_##name##_slot_t;                                                                       \
+                                                                                                \
+    typedef struct sm_##name##_s {                                                              \
+        /* One control byte per slot, followed by a copy of the first group's */                \
+        /* bytes, so that a group can be loaded at any slot without wrapping. */                \
+        int8_t             *ctrl;                                                               \
+        sm_##name##_slot_t *slots;                                                              \
+        size_t              capacity;                                                           \
+        size_t              size;                                                               \
+        size_t              ndeleted;                                                           \
+    } sm_##name##_t;
+
+/***********************************************************************************************/
+
+#define SWISS_MAP_PROTOTYPES(scope, name, ktype, vtype)                                         \
+                                                                                                \
+    scope void   sm_##name##_init(sm(name) *map);                                               \
+    scope void   sm_##name##_destroy(sm(name) *map);                                            \
+    scope void   sm_##name##_clear(sm(name) *map);                                              \
+    scope bool   sm_##name##_reserve(sm(name) *map, size_t size);                               \
+    scope vtype *sm_##name##_get(sm(name) *map, ktype key);                                     \
+    scope bool   sm_##name##_put(sm(name) *map, ktype key, vtype val);                          \
+    scope bool   sm_##name##_del(sm(name) *map, ktype key);
+
+/***********************************************************************************************/
+
+#define SWISS_MAP_IMPL(scope, name, ktype, vtype, hash_func, equal_func)                        \
+                                                                                                \
+    static void _sm_##name##_set_ctrl(sm(name) *map, size_t idx, int8_t ctrl)                   \
+    {                                                                                           \
+        map->ctrl[idx] = ctrl;                                                                  \
+        if(idx < SM_GROUP_SZ)                                                                   \
+            map->ctrl[map->capacity + idx] = ctrl;                                              \
+    }                                                                                           \
+                                                                                                \
+    /* Returns the slot holding the key, or -1 */                                               \
+    static ptrdiff_t _sm_##name##_find(const sm(name) *map, ktype key)                          \
+    {                                                                                           \
+        if(map->capacity == 0)                                                                  \
+            return -1;                                                                          \
+                                                                                                \
+        const uint32_t hash = hash_func(key);                                                   \
+        const size_t mask = map->capacity - 1;                                                  \
+        size_t pos = SM_H1(hash) & mask;                                                        \
+                                                                                                \
+        /* There is always an empty slot, so the probing terminates */                          \
+        for(size_t probe = 1;; probe++) {                                                       \
+                                                                                                \
+            uint32_t match = _sm_group_match(map->ctrl + pos, SM_H2(hash));                     \
+            while(match) {                                                                      \
+                size_t idx = (pos + _sm_lowest_bit(match)) & mask;                              \
+                if(equal_func(map->slots[idx].key, key))                                        \
+                    return idx;                                                                 \
+                match &= match - 1;                                                             \
+            }                                                                                   \
+            if(_sm_group_match(map->ctrl + pos, SM_CTRL_EMPTY))                                 \
+                return -1;                                                                      \
+            pos = (pos + probe * SM_GROUP_SZ) & mask;                                           \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    /* Returns the first empty or deleted slot along the key's probe sequence */                \
+    static size_t _sm_##name##_find_free(const sm(name) *map, uint32_t hash)                    \
+    {                                                                                           \
+        const size_t mask = map->capacity - 1;                                                  \
+        size_t pos = SM_H1(hash) & mask;                                                        \
+                                                                                                \
+        for(size_t probe = 1;; probe++) {                                                       \
+                                                                                                \
+            uint32_t match = _sm_group_match_free(map->ctrl + pos);                             \
+            if(match)                                                                           \
+                return (pos + _sm_lowest_bit(match)) & mask;                                    \
+            pos = (pos + probe * SM_GROUP_SZ) & mask;                                           \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    static bool _sm_##name##_rehash(sm(name) *map, size_t new_cap)                              \
+    {                                                                                           \
+        assert(new_cap >= SM_GROUP_SZ && !(new_cap & (new_cap - 1)));                           \
+        assert(new_cap * SM_MAX_LOAD_NUM / SM_MAX_LOAD_DEN >= map->size);                       \
+                                                                                                \
+        int8_t *ctrl = malloc(new_cap + SM_GROUP_SZ);                                           \
+        sm_##name##_slot_t *slots = malloc(new_cap * sizeof(*slots));                           \
+        if(!ctrl || !slots) {                                                                   \
+            free(ctrl);                                                                         \
+            free(slots);                                                                        \
+            return false;                                                                       \
+        }                                                                                       \
+        memset(ctrl, SM_CTRL_EMPTY, new_cap + SM_GROUP_SZ);                                     \
+                                                                                                \
+        sm(name) old = *map;                                                                    \
+        map->ctrl = ctrl;                                                                       \
+        map->slots = slots;                                                                     \
+        map->capacity = new_cap;                                                                \
+        map->ndeleted = 0;                                                                      \
+                                                                                                \
+        for(size_t i = 0; i < old.capacity; i++) {                                              \
+            if(old.ctrl[i] < 0)                                                                 \
+                continue;                                                                       \
+            uint32_t hash = hash_func(old.slots[i].key);                                        \
+            size_t idx = _sm_##name##_find_free(map, hash);                                     \
+            _sm_##name##_set_ctrl(map, idx, SM_H2(hash));                                       \
+            map->slots[idx] = old.slots[i];                                                     \
+        }                                                                                       \
+                                                                                                \
+        free(old.ctrl);                                                                         \
+        free(old.slots);                                                                        \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void sm_##name##_init(sm(name) *map)                                                  \
+    {                                                                                           \
+        memset(map, 0, sizeof(*map));                                                           \
+    }                                                                                           \
+                                                                                                \
+    scope void sm_##name##_destroy(sm(name) *map)                                               \
+    {                                                                                           \
+        free(map->ctrl);                                                                        \
+        free(map->slots);                                                                       \
+        memset(map, 0, sizeof(*map));                                                           \
+    }                                                                                           \
+                                                                                                \
+    scope void sm_##name##_clear(sm(name) *map)                                                 \
+    {                                                                                           \
+        if(map->capacity)                                                                       \
+            memset(map->ctrl, SM_CTRL_EMPTY, map->capacity + SM_GROUP_SZ);                      \
+        map->size = 0;                                                                          \
+        map->ndeleted = 0;                                                                      \
+    }                                                                                           \
+                                                                                                \
+    scope bool sm_##name##_reserve(sm(name) *map, size_t size)                                  \
+    {                                                                                           \
+        size_t new_cap = _SM_MAX(map->capacity, SM_GROUP_SZ);                                   \
+        while(new_cap * SM_MAX_LOAD_NUM / SM_MAX_LOAD_DEN < size)                               \
+            new_cap *= 2;                                                                       \
+        if(new_cap == map->capacity)                                                            \
+            return true;                                                                        \
+        return _sm_##name##_rehash(map, new_cap);                                               \
+    }                                                                                           \
+                                                                                                \
+    /* The returned pointer is valid until the next insertion */                                \
+    scope vtype *sm_##name##_get(sm(name) *map, ktype key)                                      \
+    {                                                                                           \
+        ptrdiff_t idx = _sm_##name##_find(map, key);                                            \
+        if(idx < 0)                                                                             \
+            return NULL;                                                                        \
+        return &map->slots[idx].val;                                                            \
+    }                                                                                           \
+                                                                                                \
+    /* Inserts the key, or overwrites its' value if it's already present */                     \
+    scope bool sm_##name##_put(sm(name) *map, ktype key, vtype val)                             \
+    {                                                                                           \
+        ptrdiff_t found = _sm_##name##_find(map, key);                                          \
+        if(found >= 0) {                                                                        \
+            map->slots[found].val = val;                                                        \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        /* Tombstones count against the load factor. When there are many of */                  \
+        /* them, rehashing at the same capacity is enough to clear them out. */                 \
+        size_t used = map->size + map->ndeleted + 1;                                            \
+        if(used > map->capacity * SM_MAX_LOAD_NUM / SM_MAX_LOAD_DEN) {                          \
+            size_t new_cap = _SM_MAX(map->capacity, SM_GROUP_SZ);                               \
+            while(new_cap * SM_MAX_LOAD_NUM / SM_MAX_LOAD_DEN < (map->size + 1) * 2)            \
+                new_cap *= 2;                                                                   \
+            if(!_sm_##name##_rehash(map, new_cap))                                              \
+                return false;                                                                   \
+        }                                                                                       \
+                                                                                                \
+        uint32_t hash = hash_func(key);                                                         \
+        size_t idx = _sm_##name##_find_free(map, hash);                                         \
+        if(map->ctrl[idx] == SM_CTRL_DELETED)                                                   \
+            map->ndeleted--;                                                                    \
+        _sm_##name##_set_ctrl(map, idx, SM_H2(hash));                                           \
+        map->slots[idx] = (sm_##name##_slot_t){key, val};                                       \
+        map->size++;                                                                            \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool sm_##name##_del(sm(name) *map, ktype key)                                        \
+    {                                                                                           \
+        ptrdiff_t idx = _sm_##name##_find(map, key);                                            \
+        if(idx < 0)                                                                             \
+            return false;                                                                       \
+                                                                                                \
+        /* A lookup only stops probing at a group with an empty slot. The slot */               \
+        /* may only be emptied if no group could have been full around it.    */                \
+        const size_t mask = map->capacity - 1;                                                  \
+        size_t before = (idx - SM_GROUP_SZ) & mask;                                             \
+        uint32_t empty_after = _sm_group_match(map->ctrl + idx, SM_CTRL_EMPTY);                 \
+        uint32_t empty_before = _sm_group_match(map->ctrl + before, SM_CTRL_EMPTY);             \
+        int full_run = _sm_trailing_zeros(empty_after) + _sm_leading_zeros(empty_before);       \
+                                                                                                \
+        if(full_run < SM_GROUP_SZ) {                                                            \
+            _sm_##name##_set_ctrl(map, idx, SM_CTRL_EMPTY);                                     \
+        }else{                                                                                  \
+            _sm_##name##_set_ctrl(map, idx, SM_CTRL_DELETED);                                   \
+            map->ndeleted++;                                                                    \
+        }                                                                                       \
+        map->size--;                                                                            \
+        return true;                                                                            \
+    }
+
+#endif
+
@@ -39,12 +39,63 @@
 #include <string.h>
 #include <assert.h>
 
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void *stalloc_oversized(struct memstack *st, size_t size)
+{
+    struct st_bigmem *block = malloc(sizeof(struct st_bigmem) + size);
+    if(!block)
+        return NULL;
+
+    block->next = st->oversized;
+    st->oversized = block;
+
+    st->stats.bytes += size;
+    st->stats.noversized++;
+    return block->raw;
+}
+
+static void stalloc_free_oversized(struct memstack *st)
+{
+    struct st_bigmem *curr = st->oversized, *tmp;
+    while(curr) {
+        tmp = curr->next;
+        free(curr);
+        curr = tmp;
+    }
+    st->oversized = NULL;
+    st->stats.noversized = 0;
+}
+
+/* Release the spare memblocks beyond the first 'nkeep' */
+static void stalloc_trim(struct memstack *st, size_t nkeep)
+{
+    assert(nkeep > 0);
+
+    struct st_mem *last = st->head;
+    for(size_t i = 1; i < nkeep; i++)
+        last = last->next;
+
+    struct st_mem *curr = last->next, *tmp;
+    while(curr) {
+        tmp = curr->next;
+        free(curr);
+        curr = tmp;
+        st->stats.nblocks--;
+        st->stats.ntrimmed++;
+    }
+    last->next = NULL;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 bool stalloc_init(struct memstack *st)
 {
+    memset(st, 0, sizeof(*st));
     st->head = malloc(sizeof(struct st_mem));
     if(!st->head)
         return false;
@@ -52,6 +103,7 @@ bool stalloc_init(struct memstack *st)
     st->head->next = NULL;
     st->top = st->head->raw;
     st->tail = st->head;
+    st->stats.nblocks = 1;
     return true;
 }
 
@@ -63,6 +115,7 @@ void stalloc_destroy(struct memstack *st)
         free(curr);
         curr = tmp;
     }
+    stalloc_free_oversized(st);
     memset(st, 0, sizeof(*st));
 }
 
@@ -73,39 +126,62 @@ void *stalloc(struct memstack *st, size_t size)
     assert(curr_left <= MEMBLOCK_SZ);
 
     if(size > MEMBLOCK_SZ)
-        return NULL;
+        return stalloc_oversized(st, size);
 
     if(curr_left >= size) {
         void *ret = st->top;
         st->top = (unsigned char*)st->top + size; 
+        st->stats.bytes += size;
         return ret;
     }
 
-    st->tail->next = malloc(sizeof(struct st_mem));
-    if(!st->tail->next)
-        return NULL;
+    /* Re-use a spare memblock from a prior frame, if there is one */
+    if(!st->tail->next) {
+
+        st->tail->next = malloc(sizeof(struct st_mem));
+        if(!st->tail->next)
+            return NULL;
+        st->tail->next->next = NULL;
+        st->stats.nblocks++;
+    }
 
     st->tail = st->tail->next;
-    st->tail->next = NULL;
+    st->tail_idx++;
 
     void *ret = st->tail->raw;
     st->top = st->tail->raw + size;
+    st->stats.bytes += size;
     return ret;
 }
 
 void stalloc_clear(struct memstack *st)
 {
-    /* Don't free the very first memblock */
-    struct st_mem *curr = st->head->next, *tmp;
-    while(curr) {
-        tmp = curr->next;
-        free(curr);
-        curr = tmp;
+    stalloc_free_oversized(st);
+
+    size_t used_blocks = st->tail_idx + 1;
+    if(used_blocks == st->stats.nblocks) {
+        st->quiet_frames = 0;
+        st->quiet_peak_blocks = 0;
+    }else{
+        st->quiet_frames++;
+        if(used_blocks > st->quiet_peak_blocks)
+            st->quiet_peak_blocks = used_blocks;
     }
 
-    st->head->next = NULL;
+    if(st->quiet_frames == STALLOC_TRIM_FRAMES) {
+        stalloc_trim(st, st->quiet_peak_blocks);
+        st->quiet_frames = 0;
+        st->quiet_peak_blocks = 0;
+    }
+
+    if(st->stats.bytes > st->stats.high_water)
+        st->stats.high_water = st->stats.bytes;
+    st->stats.last_bytes = st->stats.bytes;
+    st->stats.bytes = 0;
+
     st->top = st->head->raw;
     st->tail = st->head;
+    st->tail_idx = 0;
 }
 
 bool sstalloc_init(struct smemstack *st)
@@ -48,10 +48,13 @@
 #include "ui.h"
 #include "pf_math.h"
 #include "settings.h"
+#include "sched.h"
+#include "perf.h"
 
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 
 #if defined(_WIN32)
     #include <windows.h>
@@ -62,6 +65,12 @@
 #define PF_VER_MINOR 43
 #define PF_VER_PATCH 0
 
+/* The screen size reported to the subsystems when there is no window */
+#define HEADLESS_RES_W 1920
+#define HEADLESS_RES_H 1080
+
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
 VEC_TYPE(event, SDL_Event)
 VEC_IMPL(static inline, event, SDL_Event)
 
@@ -72,10 +81,12 @@ VEC_IMPL(static inline, event, SDL_Event)
 const char                *g_basepath; /* write-once - path of the base directory */
 
 unsigned                   g_last_frame_ms = 0;
+float                      g_last_render_wait_ms = 0.0f;
 unsigned long              g_frame_idx = 0;
 
 SDL_threadID               g_main_thread_id;   /* write-once */
 SDL_threadID               g_render_thread_id; /* write-once */
+bool                       g_headless = false; /* write-once */
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -92,6 +103,24 @@ static vec_event_t         s_prev_tick_events;
 
 static SDL_Thread         *s_render_thread;
 static struct render_sync_state s_rstate;
+/* The number of 'ready' posts that the render thread has yet to answer */
+static int                 s_render_in_flight = 0;
+/* The frame rate that the main loop is held to, or 0 for no limit, and the 
+ * performance counter value at which the next frame is due */
+static int                 s_frame_limit = 0;
+static uint64_t            s_next_frame_ts = 0;
+/* The number of ticks per second that a headless run is held to, or 0 for 
+ * running as fast as possible, and the size of the non-existent window */
+static int                 s_headless_tps = 0;
+static int                 s_headless_res[2] = {HEADLESS_RES_W, HEADLESS_RES_H};
+/* The files to record the commands to, or to play them back from */
+static const char         *s_record_path = NULL;
+static const char         *s_replay_path = NULL;
+/* The frame time (in milliseconds) above which a trace is captured, or 0 
+ * when the spike detector is off */
+static int                 s_spike_ms = 0;
+static int                 s_spike_captures = 0;
+static unsigned long       s_last_spike_frame = 0;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -122,11 +151,6 @@ static void process_sdl_events(void)
             }
             break;
 
-        case SDL_USEREVENT:
-            if(event.user.code == 0) {
-                E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE); 
-            }
-            break;
         default: 
             break;
         }
@@ -142,53 +166,38 @@ static void on_user_quit(void *user, void *event)
 
 static bool rstate_init(struct render_sync_state *rstate)
 {
-    rstate->start = false;
-
-    rstate->sq_lock = SDL_CreateMutex();
-    if(!rstate->sq_lock)
-        goto fail_sq_lock;
-        
-    rstate->sq_cond = SDL_CreateCond();
-    if(!rstate->sq_cond)
-        goto fail_sq_cond;
+    SDL_AtomicSet(&rstate->quit, 0);
 
-    rstate->done = false;
+    rstate->ready = SDL_CreateSemaphore(0);
+    if(!rstate->ready)
+        goto fail_ready;
 
-    rstate->done_lock = SDL_CreateMutex();
-    if(!rstate->done_lock)
-        goto fail_done_lock;
-
-    rstate->done_cond = SDL_CreateCond();
-    if(!rstate->done_cond)
-        goto fail_done_cond;
+    rstate->done = SDL_CreateSemaphore(0);
+    if(!rstate->done)
+        goto fail_done;
 
     rstate->swap_buffers = false;
     return true;
 
-fail_done_cond:
-    SDL_DestroyMutex(rstate->done_lock);
-fail_done_lock:
-    SDL_DestroyCond(rstate->sq_cond);
-fail_sq_cond:
-    SDL_DestroyMutex(rstate->sq_lock);
-fail_sq_lock:
+fail_done:
+    SDL_DestroySemaphore(rstate->ready);
+fail_ready:
     return false;
 }
 
 static void rstate_destroy(struct render_sync_state *rstate)
 {
-    SDL_DestroyCond(rstate->done_cond);
-    SDL_DestroyMutex(rstate->done_lock);
-    SDL_DestroyCond(rstate->sq_cond);
-    SDL_DestroyMutex(rstate->sq_lock);
+    SDL_DestroySemaphore(rstate->done);
+    SDL_DestroySemaphore(rstate->ready);
 }
 
 static int render_thread_quit(void)
 {
-    SDL_LockMutex(s_rstate.sq_lock);
-    s_rstate.quit = true;
-    SDL_CondSignal(s_rstate.sq_cond);
-    SDL_UnlockMutex(s_rstate.sq_lock);
+    if(!s_render_thread)
+        return 0;
+
+    SDL_AtomicSet(&s_rstate.quit, 1);
+    SDL_SemPost(s_rstate.ready);
 
     int ret;
     SDL_WaitThread(s_render_thread, &ret);
@@ -197,19 +206,21 @@ static int render_thread_quit(void)
 
 static void render_thread_start_work(void)
 {
-    SDL_LockMutex(s_rstate.sq_lock);
-    s_rstate.start = true;
-    SDL_CondSignal(s_rstate.sq_cond);
-    SDL_UnlockMutex(s_rstate.sq_lock);
+    if(!s_render_thread)
+        return;
+
+    SDL_SemPost(s_rstate.ready);
+    ++s_render_in_flight;
 }
 
-static void wait_render_work_done(void)
+/* Block until the render thread has at most 'max_in_flight' workspaces 
+ * left to process. */
+static void wait_render_work_done(int max_in_flight)
 {
-    SDL_LockMutex(s_rstate.done_lock);
-    while(!s_rstate.done)
-        SDL_CondWait(s_rstate.done_cond, s_rstate.done_lock);
-    s_rstate.done = false;
-    SDL_UnlockMutex(s_rstate.done_lock);
+    while(s_render_in_flight > max_in_flight) {
+        SDL_SemWait(s_rstate.done);
+        --s_render_in_flight;
+    }
 }
 
 static void fs_on_key_press(void *user, void *event)
@@ -220,6 +231,117 @@ static void fs_on_key_press(void *user, void *event)
     s_step_frame = true;
 }
 
+static void perf_on_key_press(void *user, void *event)
+{
+    SDL_KeyboardEvent *key = &((SDL_Event*)event)->key;
+    if(key->keysym.scancode != CONFIG_PERF_DUMP_HOTKEY)
+        return;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/perf_trace.json", g_basepath);
+
+    if(Perf_DumpTrace(path, CONFIG_PERF_DUMP_FRAMES)) {
+        printf("Wrote the trace of the last %d frames to: %s\n", 
+            CONFIG_PERF_DUMP_FRAMES, path);
+    }else{
+        fprintf(stderr, "Failed to write the trace to: %s\n", path);
+    }
+}
+
+static void perf_check_spike(unsigned frame_ms)
+{
+    if(!CONFIG_PERF_TRACE || s_spike_ms == 0 || frame_ms <= s_spike_ms)
+        return;
+
+    if(s_spike_captures == CONFIG_PERF_SPIKE_MAX_CAPTURES)
+        return;
+
+    /* The first frames are dominated by loading. The frames of the previous 
+     * capture (including the slow frame taken up by writing it out) are 
+     * not captured again. */
+    if(g_frame_idx < CONFIG_PERF_SPIKE_FRAMES)
+        return;
+    if(s_spike_captures > 0 && g_frame_idx - s_last_spike_frame <= CONFIG_PERF_SPIKE_FRAMES)
+        return;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/perf_spike_%lu.json", g_basepath, g_frame_idx);
+
+    s_spike_captures++;
+    s_last_spike_frame = g_frame_idx;
+
+    if(Perf_DumpTrace(path, CONFIG_PERF_SPIKE_FRAMES)) {
+        printf("Frame %lu took %u ms. Wrote the trace of the last %d frames to: %s\n", 
+            g_frame_idx, frame_ms, CONFIG_PERF_SPIKE_FRAMES, path);
+    }else{
+        fprintf(stderr, "Failed to write the trace to: %s\n", path);
+    }
+}
+
+/* Accepts '--headless', or '--headless=<ticks per second>' */
+static bool parse_headless_arg(const char *arg)
+{
+    const char *prefix = "--headless";
+    size_t len = strlen(prefix);
+
+    if(strncmp(arg, prefix, len))
+        return false;
+
+    if(arg[len] == '\0') {
+        s_headless_tps = 0;
+        return true;
+    }
+
+    char *end;
+    if(arg[len] != '=' || arg[len + 1] == '\0')
+        return false;
+
+    long tps = strtol(arg + len + 1, &end, 10);
+    if(*end != '\0' || tps < 0 || tps > 100000)
+        return false;
+
+    s_headless_tps = tps;
+    return true;
+}
+
+/* Accepts '--record=<file>' or '--replay=<file>' */
+static bool parse_replay_arg(const char *arg)
+{
+    const char *prefixes[] = {"--record=", "--replay="};
+    const char **paths[] = {&s_record_path, &s_replay_path};
+
+    for(int i = 0; i < ARR_SIZE(prefixes); i++) {
+
+        size_t len = strlen(prefixes[i]);
+        if(strncmp(arg, prefixes[i], len) || arg[len] == '\0')
+            continue;
+        if(*paths[i])
+            return false;
+        *paths[i] = arg + len;
+        return true;
+    }
+    return false;
+}
+
+/* The options following the base directory and the script path, in any order */
+static bool parse_args(int argc, char **argv)
+{
+    if(argc < 3)
+        return false;
+
+    for(int i = 3; i < argc; i++) {
+
+        if(!strncmp(argv[i], "--headless", strlen("--headless"))) {
+            if(g_headless || !parse_headless_arg(argv[i]))
+                return false;
+            g_headless = true;
+        }else if(!parse_replay_arg(argv[i])) {
+            return false;
+        }
+    }
+    return !(s_record_path && s_replay_path);
+}
+
 static bool frame_step_validate(const struct sval *new_val)
 {
     return (new_val->type == ST_TYPE_BOOL);
@@ -235,6 +357,76 @@ static void frame_step_commit(const struct sval *new_val)
     }
 }
 
+static bool frame_limit_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_INT)
+        && (new_val->as_int == 0 || (new_val->as_int >= 10 && new_val->as_int <= 1000));
+}
+
+static void frame_limit_commit(const struct sval *new_val)
+{
+    /* The headless tick rate is set from the command line */
+    if(g_headless)
+        return;
+    s_frame_limit = new_val->as_int;
+    s_next_frame_ts = 0;
+}
+
+static bool spike_capture_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_INT)
+        && (new_val->as_int >= 0 && new_val->as_int <= 10000);
+}
+
+static void spike_capture_commit(const struct sval *new_val)
+{
+    s_spike_ms = new_val->as_int;
+}
+
+static bool event_overflow_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_INT)
+        && (new_val->as_int == EVENT_OVERFLOW_GROW || new_val->as_int == EVENT_OVERFLOW_DROP);
+}
+
+static void event_overflow_commit(const struct sval *new_val)
+{
+    E_SetOverflowPolicy(new_val->as_int);
+}
+
+/* Holds the main loop to a steady rate of 's_frame_limit' frames per second. 
+ * The deadlines are spaced out by the frame period, regardless of when each 
+ * frame finished, so that the short frames make up for the long ones. After 
+ * a stall of more than a frame, the cadence starts over rather than running 
+ * a burst of frames to catch up. 
+ */
+static void pace_frame(void)
+{
+    if(!s_frame_limit)
+        return;
+
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t period = freq / s_frame_limit;
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if(!s_next_frame_ts || now > s_next_frame_ts + period) {
+        s_next_frame_ts = now + period;
+        return;
+    }
+
+    /* The sleeps are only accurate to a couple of milliseconds, so the 
+     * remainder is spun out */
+    while(now < s_next_frame_ts) {
+
+        uint64_t left_ms = (s_next_frame_ts - now) * 1000 / freq;
+        if(left_ms > 2) {
+            SDL_Delay(left_ms - 2);
+        }
+        now = SDL_GetPerformanceCounter();
+    }
+    s_next_frame_ts += period;
+}
+
 /* Fills the framebuffer with the loading screen using SDL's software renderer. 
  * Used to set a loading screen immediately, even before the rendering subsystem 
  * is initialized, */
@@ -303,15 +495,56 @@ static void engine_create_settings(void)
         .commit = frame_step_commit,
     });
     assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.frame_limit",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 0 
+        },
+        .prio = 0,
+        .validate = frame_limit_validate,
+        .commit = frame_limit_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.spike_capture_ms",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 0 
+        },
+        .prio = 0,
+        .validate = spike_capture_validate,
+        .commit = spike_capture_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.event_queue_overflow",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = CONFIG_EVENT_QUEUE_OVERFLOW 
+        },
+        .prio = 0,
+        .validate = event_overflow_validate,
+        .commit = event_overflow_commit,
+    });
+    assert(status == SS_OKAY);
 }
 
 static bool engine_init(char **argv)
 {
     g_main_thread_id = SDL_ThreadID();
 
+    if(!Perf_Init()) {
+        fprintf(stderr, "Failed to initialize the profiler.\n");
+        return false;
+    }
+
     vec_event_init(&s_prev_tick_events);
     if(!vec_event_resize(&s_prev_tick_events, 8192))
-        return false;
+        goto fail_events;
 
     /* Initialize 'Settings' before any subsystem to allow all of them 
      * to register settings. */
@@ -326,16 +559,16 @@ static bool engine_init(char **argv)
             Settings_GetFile(), status);
     }
 
-    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
+    Uint32 sdl_flags = g_headless ? SDL_INIT_TIMER | SDL_INIT_EVENTS 
+                                  : SDL_INIT_VIDEO | SDL_INIT_TIMER;
+    if(SDL_Init(sdl_flags) < 0) {
         fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
         goto fail_sdl;
     }
 
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-
     struct sval setting;
-    int res[2] = {dm.w, dm.h};
+    int res[2];
+    Engine_DesktopRes(&res[0], &res[1]);
 
     if(Settings_Get("pf.video.resolution", &setting) == SS_OKAY) {
         res[0] = (int)setting.as_vec2.x;
@@ -350,15 +583,19 @@ static bool engine_init(char **argv)
         extra_flags = setting.as_bool ? SDL_WINDOW_ALWAYS_ON_TOP : 0;
     }
 
-    s_window = SDL_CreateWindow(
-        "Permafrost Engine",
-        SDL_WINDOWPOS_UNDEFINED, 
-        SDL_WINDOWPOS_UNDEFINED,
-        res[0], 
-        res[1], 
-        SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | wf | extra_flags);
-
-    early_loading_screen();
+    s_headless_res[0] = res[0];
+    s_headless_res[1] = res[1];
+
+    if(!g_headless) {
+        s_window = SDL_CreateWindow(
+            "Permafrost Engine",
+            SDL_WINDOWPOS_UNDEFINED, 
+            SDL_WINDOWPOS_UNDEFINED,
+            res[0], 
+            res[1], 
+            SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | wf | extra_flags);
+        early_loading_screen();
+    }
     stbi_set_flip_vertically_on_load(true);
 
     if(!rstate_init(&s_rstate)) {
@@ -372,31 +609,36 @@ static bool engine_init(char **argv)
         .in_height = res[1],
     };
 
-    s_rstate.arg = &rarg;
-    s_render_thread = R_Run(&s_rstate);
+    if(!g_headless) {
 
-    if(!s_render_thread) {
-        fprintf(stderr, "Failed to start the render thread.\n");
-        goto fail_rthread;
-    }
-    g_render_thread_id = SDL_GetThreadID(s_render_thread);
+        s_rstate.arg = &rarg;
+        s_render_thread = R_Run(&s_rstate);
 
-    render_thread_start_work();
-    wait_render_work_done();
+        if(!s_render_thread) {
+            fprintf(stderr, "Failed to start the render thread.\n");
+            goto fail_rthread;
+        }
+        g_render_thread_id = SDL_GetThreadID(s_render_thread);
+
+        render_thread_start_work();
+        wait_render_work_done(0);
 
-    if(!rarg.out_success)
-        goto fail_render_init;
+        if(!rarg.out_success)
+            goto fail_render_init;
+    }
 
     if(!AL_Init()) {
         fprintf(stderr, "Failed to initialize asset-loading module.\n");
         goto fail_al;
     }
 
-    if(!Cursor_InitAll(argv[1])) {
-        fprintf(stderr, "Failed to initialize cursor module\n");
-        goto fail_cursor;
+    if(!g_headless) {
+        if(!Cursor_InitAll(argv[1])) {
+            fprintf(stderr, "Failed to initialize cursor module\n");
+            goto fail_cursor;
+        }
+        Cursor_SetActive(CURSOR_POINTER);
     }
-    Cursor_SetActive(CURSOR_POINTER);
 
     if(!E_Init()) {
         fprintf(stderr, "Failed to initialize event subsystem\n");
@@ -413,9 +655,13 @@ static bool engine_init(char **argv)
         goto fail_render;
     }
 
-    Cursor_SetRTSMode(true);
+    Cursor_SetRTSMode(!g_headless);
     E_Global_Register(SDL_QUIT, on_user_quit, NULL, 
         G_RUNNING | G_PAUSED_UI_RUNNING | G_PAUSED_FULL);
+    if(CONFIG_PERF_TRACE) {
+        E_Global_Register(SDL_KEYDOWN, perf_on_key_press, NULL, 
+            G_RUNNING | G_PAUSED_UI_RUNNING | G_PAUSED_FULL);
+    }
 
     if(!UI_Init(argv[1], s_window)) {
         fprintf(stderr, "Failed to initialize nuklear\n");
@@ -427,6 +673,11 @@ static bool engine_init(char **argv)
         goto fail_script;
     }
 
+    if(!Sched_Init()) {
+        fprintf(stderr, "Failed to initialize job scheduler\n");
+        goto fail_sched;
+    }
+
     if(!N_Init()) {
         fprintf(stderr, "Failed to intialize navigation subsystem\n");
         goto fail_nav;
@@ -437,6 +688,8 @@ static bool engine_init(char **argv)
     return true;
 
 fail_nav:
+    Sched_Shutdown();
+fail_sched:
     S_Shutdown();
 fail_script:
     UI_Shutdown();
@@ -460,6 +713,9 @@ fail_rstate:
 fail_sdl:
     Settings_Shutdown();
 fail_settings:
+    vec_event_destroy(&s_prev_tick_events);
+fail_events:
+    Perf_Shutdown();
     return false; 
 }
 
@@ -472,7 +728,7 @@ static void engine_shutdown(void)
      * shutdown routines. 
      */
     render_thread_start_work();
-    wait_render_work_done();
+    wait_render_work_done(0);
     render_thread_quit();
 
     /* 'Game' must shut down after 'Scripting'. There are still 
@@ -482,6 +738,7 @@ static void engine_shutdown(void)
      */
     G_Shutdown(); 
     N_Shutdown();
+    Sched_Shutdown();
 
     Cursor_FreeAll();
     AL_Shutdown();
@@ -494,6 +751,7 @@ static void engine_shutdown(void)
     SDL_Quit();
 
     Settings_Shutdown();
+    Perf_Shutdown();
 }
 
 /*****************************************************************************/
@@ -502,6 +760,12 @@ static void engine_shutdown(void)
 
 int Engine_SetRes(int w, int h)
 {
+    if(!s_window) {
+        s_headless_res[0] = w;
+        s_headless_res[1] = h;
+        return 0;
+    }
+
     SDL_DisplayMode dm = (SDL_DisplayMode) {
         .format = SDL_PIXELFORMAT_UNKNOWN,
         .w = w,
@@ -517,6 +781,9 @@ int Engine_SetRes(int w, int h)
 
 void Engine_SetDispMode(enum pf_window_flags wf)
 {
+    if(!s_window)
+        return;
+
     SDL_SetWindowFullscreen(s_window, wf & SDL_WINDOW_FULLSCREEN);
     SDL_SetWindowBordered(s_window, !(wf & (SDL_WINDOW_BORDERLESS | SDL_WINDOW_FULLSCREEN)));
     SDL_SetWindowPosition(s_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
@@ -524,18 +791,34 @@ void Engine_SetDispMode(enum pf_window_flags wf)
 
 void Engine_WinDrawableSize(int *out_w, int *out_h)
 {
+    if(!s_window) {
+        *out_w = s_headless_res[0];
+        *out_h = s_headless_res[1];
+        return;
+    }
     SDL_GL_GetDrawableSize(s_window, out_w, out_h);
 }
 
+void Engine_DesktopRes(int *out_w, int *out_h)
+{
+    SDL_DisplayMode dm;
+    if(g_headless || SDL_GetDesktopDisplayMode(0, &dm) < 0) {
+        *out_w = HEADLESS_RES_W;
+        *out_h = HEADLESS_RES_H;
+        return;
+    }
+    *out_w = dm.w;
+    *out_h = dm.h;
+}
+
 void Engine_FlushRenderWorkQueue(void)
 {
     assert(g_frame_idx == 0);
+    wait_render_work_done(0);
     G_SwapBuffers();
 
     render_thread_start_work();
-    wait_render_work_done();
-
-    G_SwapBuffers();
+    wait_render_work_done(0);
 }
 
 #if defined(_WIN32)
@@ -563,8 +846,9 @@ int main(int argc, char **argv)
     LocalFree(argv_wide);
 #endif
 
-    if(argc != 3) {
-        printf("Usage: %s [base directory path (containing 'assets', 'shaders' and 'scripts' folders)] [script path]\n", argv[0]);
+    if(!parse_args(argc, argv)) {
+        printf("Usage: %s [base directory path (containing 'assets', 'shaders' and 'scripts' folders)] [script path] "
+            "[--headless[=<ticks per second>]] [--record=<replay file> | --replay=<replay file>]\n", argv[0]);
         ret = EXIT_FAILURE;
         goto fail_args;
     }
@@ -576,17 +860,39 @@ int main(int argc, char **argv)
         goto fail_init;
     }
 
+    /* In headless mode, every pass of the main loop runs a single simulation 
+     * tick, as fast as possible or at the requested rate */
+    if(g_headless) {
+        s_frame_limit = s_headless_tps;
+    }
+
+    /* The replay is started before the script runs, so that the commands 
+     * issued while setting up the scene are captured too */
+    if(s_record_path && !G_Replay_StartRecording(s_record_path)) {
+        fprintf(stderr, "Failed to open replay file for recording: %s\n", s_record_path);
+        ret = EXIT_FAILURE;
+        goto fail_replay;
+    }
+    if(s_replay_path && !G_Replay_StartPlayback(s_replay_path)) {
+        fprintf(stderr, "Failed to load replay file: %s\n", s_replay_path);
+        ret = EXIT_FAILURE;
+        goto fail_replay;
+    }
+
     S_RunFile(argv[2]);
 
     /* Run the first frame of the simulation, and prepare the buffers for rendering. */
     G_Update();
-    G_Render();
+    if(!g_headless) {
+        G_Render();
+    }
     UI_Render();
     G_SwapBuffers();
 
     uint32_t last_ts = SDL_GetTicks();
     while(!s_quit) {
 
+        Perf_BeginFrame();
         enum simstate curr_ss = G_GetSimState();
         bool prev_step_frame = s_step_frame;
 
@@ -598,12 +904,29 @@ int main(int argc, char **argv)
         render_thread_start_work();
 
         process_sdl_events();
+        /* A replay is played back on a fixed timestep, so that the recorded 
+         * commands land on the same ticks on every run */
+        if(g_headless || G_Replay_IsPlaying()) {
+            G_Timer_Step();
+        }else{
+            G_Timer_Update();
+        }
         E_ServiceQueue();
+        AL_Update();
         G_Update();
-        G_Render();
+        if(!g_headless) {
+            G_Render();
+        }
         UI_Render();
 
-        wait_render_work_done();
+        /* The workspace that is about to be recycled must have been rendered */
+        uint64_t wait_start = SDL_GetPerformanceCounter();
+        /* AI script workers get to run while the main thread is blocked */
+        S_BeginAllowThreads();
+        wait_render_work_done(CONFIG_RENDER_FRAME_LATENCY - 1);
+        S_EndAllowThreads();
+        g_last_render_wait_ms = (SDL_GetPerformanceCounter() - wait_start) * 1000.0 
+                              / SDL_GetPerformanceFrequency();
 
         G_SwapBuffers();
 
@@ -612,9 +935,14 @@ int main(int argc, char **argv)
             s_step_frame = false;
         }
 
+        S_BeginAllowThreads();
+        pace_frame();
+        S_EndAllowThreads();
+
         uint32_t curr_time = SDL_GetTicks();
         g_last_frame_ms = curr_time - last_ts;
         last_ts = curr_time;
+        perf_check_spike(g_last_frame_ms);
 
         ++g_frame_idx;
     }
@@ -625,6 +953,7 @@ int main(int argc, char **argv)
             Settings_GetFile(), status);
     }
 
+fail_replay:
     engine_shutdown();
 fail_init:
 fail_args:
@@ -36,13 +36,22 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "sched.h"
+
 #include <SDL.h>
+#include <stdbool.h>
 
 extern const char    *g_basepath;      /* readonly */
 extern unsigned       g_last_frame_ms; /* readonly */
+/* The time (in milliseconds) the main thread was blocked waiting for the 
+ * render thread to finish a workspace during the last frame */
+extern float          g_last_render_wait_ms; /* readonly */
 extern unsigned long  g_frame_idx;     /* readonly */
 extern SDL_threadID   g_main_thread_id;   /* readonly */
 extern SDL_threadID   g_render_thread_id; /* readonly */
+/* In headless mode, there is no window, no render thread and all render 
+ * commands are discarded. Only the simulation is run. */
+extern bool           g_headless;         /* readonly */
 
 
 #define ASSERT_IN_RENDER_THREAD() \
@@ -51,6 +60,11 @@ extern SDL_threadID   g_render_thread_id; /* readonly */
 #define ASSERT_IN_MAIN_THREAD() \
     assert(SDL_ThreadID() == g_main_thread_id)
 
+/* For the functions which only read the main thread's state, and so may also 
+ * be called from the jobs of a parallel-for issued by the main thread */
+#define ASSERT_MAIN_THREAD_READ() \
+    assert(SDL_ThreadID() == g_main_thread_id || Sched_MainThreadBlocked())
+
 
 enum pf_window_flags {
 
@@ -65,6 +79,8 @@ enum pf_window_flags {
 int  Engine_SetRes(int w, int h);
 void Engine_SetDispMode(enum pf_window_flags wf);
 void Engine_WinDrawableSize(int *out_w, int *out_h);
+/* The resolution of the desktop, or the virtual resolution in headless mode */
+void Engine_DesktopRes(int *out_w, int *out_h);
 
 /* Execute all the currently queued render commands on the render thread. 
  * Block until it completes. This is used during initialization only to 
@@ -0,0 +1,132 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "map_private.h"
+#include "pfchunk.h"
+#include "public/tile.h"
+
+#include <assert.h>
+
+#define MIN(a, b)    ((a) < (b) ? (a) : (b))
+#define MAX(a, b)    ((a) > (b) ? (a) : (b))
+
+#if TILES_PER_CHUNK_WIDTH != TILES_PER_CHUNK_HEIGHT \
+ || TILES_PER_CHUNK_WIDTH != (1 << (CHUNK_HEIGHT_LEVELS - 1))
+#error "The tile heights quadtree must have a leaf per tile"
+#endif
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t h_level_offset(int level)
+{
+    size_t ret = 0;
+    for(int i = 0; i < level; i++) {
+        int dim = TILES_PER_CHUNK_WIDTH >> i;
+        ret += dim * dim;
+    }
+    return ret;
+}
+
+static struct height_range *h_node(struct pfchunk *chunk, int level, int r, int c)
+{
+    int dim = TILES_PER_CHUNK_WIDTH >> level;
+    assert(r >= 0 && r < dim && c >= 0 && c < dim);
+    return &chunk->heights[h_level_offset(level) + r * dim + c];
+}
+
+static struct height_range h_tile_range(const struct tile *tile)
+{
+    int nw = M_Tile_NWHeight(tile), ne = M_Tile_NEHeight(tile);
+    int sw = M_Tile_SWHeight(tile), se = M_Tile_SEHeight(tile);
+
+    return (struct height_range){
+        MIN(MIN(nw, ne), MIN(sw, se)),
+        MAX(MAX(nw, ne), MAX(sw, se)),
+    };
+}
+
+static void h_merge_children(struct pfchunk *chunk, int level, int r, int c)
+{
+    assert(level > 0);
+    struct height_range ret = *h_node(chunk, level - 1, r * 2, c * 2);
+
+    for(int i = 1; i < 4; i++) {
+
+        const struct height_range *child = h_node(chunk, level - 1, r * 2 + (i / 2), c * 2 + (i % 2));
+        ret.min = MIN(ret.min, child->min);
+        ret.max = MAX(ret.max, child->max);
+    }
+    *h_node(chunk, level, r, c) = ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void M_Heights_BuildChunk(struct pfchunk *chunk)
+{
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+    for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+        *h_node(chunk, 0, r, c) = h_tile_range(&chunk->tiles[r * TILES_PER_CHUNK_WIDTH + c]);
+    }}
+
+    for(int level = 1; level < CHUNK_HEIGHT_LEVELS; level++) {
+
+        int dim = TILES_PER_CHUNK_WIDTH >> level;
+        for(int r = 0; r < dim; r++) {
+        for(int c = 0; c < dim; c++) {
+            h_merge_children(chunk, level, r, c);
+        }}
+    }
+}
+
+/* Only the tile's ancestors are affected */
+void M_Heights_UpdateTile(struct pfchunk *chunk, int tile_r, int tile_c)
+{
+    *h_node(chunk, 0, tile_r, tile_c) = h_tile_range(&chunk->tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c]);
+
+    for(int level = 1; level < CHUNK_HEIGHT_LEVELS; level++) {
+        h_merge_children(chunk, level, tile_r >> level, tile_c >> level);
+    }
+}
+
+struct height_range M_Heights_Node(const struct pfchunk *chunk, int level, int r, int c)
+{
+    return *h_node((struct pfchunk*)chunk, level, r, c);
+}
+
@@ -40,6 +40,7 @@
 #include "../render/public/render_ctrl.h"
 #include "../navigation/public/nav.h"
 #include "../game/public/game.h"
+#include "../entity.h"
 #include "../camera.h"
 #include "../collision.h"
 #include "../settings.h"
@@ -53,11 +54,34 @@
 #define MAX(a, b)           ((a) > (b) ? (a) : (b))
 #define CLAMP(a, min, max)  (MIN(MAX((a), (min)), (max)))
 
+#define RESIDENCY_PERIOD    (60)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static uint32_t s_residency_frame = 0;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+/* Marks the chunks within 'radius' chunks of the point */
+static void m_mark_hot(const struct map *map, bool *hot, vec2_t xz, int radius)
+{
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    struct tile_desc td;
+    if(!M_Tile_DescForPoint2D(res, map->pos, xz, &td))
+        return;
+
+    for(int r = MAX(0, td.chunk_r - radius); r <= MIN((int)map->height - 1, td.chunk_r + radius); r++) {
+    for(int c = MAX(0, td.chunk_c - radius); c <= MIN((int)map->width - 1, td.chunk_c + radius); c++) {
+        hot[r * map->width + c] = true;
+    }}
+}
+
 static void m_aabb_for_chunk(const struct map *map, struct chunkpos p, struct aabb *out)
 {
     size_t chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
@@ -81,6 +105,231 @@ static void m_aabb_for_chunk(const struct map *map, struct chunkpos p, struct aa
     assert(out->z_max >= out->z_min);
 }
 
+/* The chunk AABBs span all the height levels. To clip against a plane, the 
+ * actual height range of the chunk's geometry is needed. This covers the tile 
+ * tops, as well as the sides, which extend down to the lowest adjacent tile 
+ * (or to -1 at the edges of the map).
+ */
+static void m_chunk_height_range(const struct map *map, struct chunkpos p, 
+                                 float *out_min, float *out_max)
+{
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    int min = MAX_HEIGHT_LEVEL, max = -1;
+
+    for(int r = -1; r <= TILES_PER_CHUNK_HEIGHT; r++) {
+    for(int c = -1; c <= TILES_PER_CHUNK_WIDTH;  c++) {
+
+        bool border = (r < 0 || c < 0 || r == TILES_PER_CHUNK_HEIGHT || c == TILES_PER_CHUNK_WIDTH);
+        struct tile_desc td = (struct tile_desc){p.r, p.c, 0, 0};
+        struct tile *tile;
+
+        if(!M_Tile_RelativeDesc(res, &td, c, r) || !M_TileForDesc(map, td, &tile)) {
+            min = MIN(min, -1);
+            continue;
+        }
+        min = MIN(min, tile->base_height);
+
+        if(border)
+            continue;
+
+        max = MAX(max, M_Tile_NWHeight(tile));
+        max = MAX(max, M_Tile_NEHeight(tile));
+        max = MAX(max, M_Tile_SWHeight(tile));
+        max = MAX(max, M_Tile_SEHeight(tile));
+    }}
+
+    *out_min = min * Y_COORDS_PER_TILE;
+    *out_max = max * Y_COORDS_PER_TILE;
+}
+
+static bool m_aabb_clipped(const struct aabb *aabb, vec4_t plane)
+{
+    /* The corner of the box furthest along the plane normal */
+    vec3_t corner = (vec3_t){
+        plane.x > 0.0f ? aabb->x_max : aabb->x_min,
+        plane.y > 0.0f ? aabb->y_max : aabb->y_min,
+        plane.z > 0.0f ? aabb->z_max : aabb->z_min,
+    };
+    return (corner.x * plane.x + corner.y * plane.y + corner.z * plane.z + plane.w) < 0.0f;
+}
+
+/* Picks the mesh of the chunk based on the distance from 'origin' to the 
+ * closest point of its' bounding box. A 'lod_dist' of 0 disables the LODs. */
+static void *m_chunk_mesh(const struct pfchunk *chunk, const struct aabb *aabb, 
+                          vec3_t origin, float lod_dist)
+{
+    if(lod_dist <= 0.0f)
+        return chunk->render_private;
+
+    vec3_t closest = (vec3_t){
+        CLAMP(origin.x, aabb->x_min, aabb->x_max),
+        CLAMP(origin.y, aabb->y_min, aabb->y_max),
+        CLAMP(origin.z, aabb->z_min, aabb->z_max),
+    };
+    vec3_t delta;
+    PFM_Vec3_Sub(&origin, &closest, &delta);
+
+    int lod = MIN((int)(PFM_Vec3_Len(&delta) / lod_dist), CHUNK_LODS);
+    return (lod == 0) ? chunk->render_private : chunk->lod_private[lod - 1];
+}
+
+struct chunk_prefetch{
+    size_t  count;
+    void  **meshes;
+};
+
+struct chunk_render_ctx{
+    const struct frustum *frustum;
+    vec3_t                lod_origin;
+    float                 lod_dist;
+    enum render_pass      pass;
+    const vec4_t         *clip_plane;
+    bool                  occlusion;
+    /* When set, the meshes are collected here instead of being drawn */
+    struct chunk_prefetch *prefetch;
+};
+
+static void m_aabb_for_region(const struct map *map, int r0, int c0, int r1, int c1, 
+                              struct aabb *out)
+{
+    struct aabb last;
+    m_aabb_for_chunk(map, (struct chunkpos) {r0, c0}, out);
+    m_aabb_for_chunk(map, (struct chunkpos) {r1 - 1, c1 - 1}, &last);
+
+    out->x_min = MIN(out->x_min, last.x_min);
+    out->x_max = MAX(out->x_max, last.x_max);
+    out->z_min = MIN(out->z_min, last.z_min);
+    out->z_max = MAX(out->z_max, last.z_max);
+}
+
+static void m_render_chunk(const struct map *map, const struct chunk_render_ctx *ctx, int r, int c)
+{
+    struct aabb chunk_aabb;
+    m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+
+    const struct pfchunk *chunk = &map->chunks[r * map->width + c];
+    void *mesh = m_chunk_mesh(chunk, &chunk_aabb, ctx->lod_origin, ctx->lod_dist);
+
+    if(ctx->prefetch) {
+        ctx->prefetch->meshes[ctx->prefetch->count++] = mesh;
+        return;
+    }
+
+    if(ctx->clip_plane || ctx->occlusion) {
+        m_chunk_height_range(map, (struct chunkpos) {r, c}, &chunk_aabb.y_min, &chunk_aabb.y_max);
+    }
+
+    if(ctx->clip_plane && m_aabb_clipped(&chunk_aabb, *ctx->clip_plane))
+        return;
+
+    if(ctx->occlusion && R_HiZOccludedAABB(&chunk_aabb))
+        return;
+
+    mat4x4_t chunk_model;
+    M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+
+    switch(ctx->pass) {
+    case RENDER_PASS_DEPTH: 
+        R_PushCmd((struct rcmd){
+            .type = RCMD_RENDER_DEPTH_MAP,
+            .as_draw = {mesh, chunk_model},
+        });
+        break;
+    case RENDER_PASS_REGULAR:
+        R_PushCmd((struct rcmd){
+            .type = RCMD_DRAW,
+            .as_draw = {mesh, chunk_model},
+        });
+        break;
+    default: assert(0);
+    }
+}
+
+/* Descends a quadtree over the chunks in the rows [r0, r1) and the columns 
+ * [c0, c1). Whole regions which are outside or inside the frustum are accepted 
+ * or rejected with the fast test. Only the single chunks which straddle the 
+ * boundary of the frustum get the exact test. 
+ */
+static void m_render_region(const struct map *map, const struct chunk_render_ctx *ctx, 
+                            int r0, int c0, int r1, int c1, bool inside)
+{
+    if(r0 >= r1 || c0 >= c1)
+        return;
+
+    if(!inside) {
+
+        struct aabb region_aabb;
+        m_aabb_for_region(map, r0, c0, r1, c1, &region_aabb);
+
+        if(r1 - r0 == 1 && c1 - c0 == 1) {
+
+            /* Due to the nature of the the map (perfect grid), the fast and greedy frustrum 
+             * intersection test will yield too many false positives. As each chunk mesh has 
+             * a high vertex count, this is undesirable. It is absolutely worth it to do the 
+             * precise frustrum intersection test. With it, the map rendering performance
+             * scales great for large maps. */
+            if(C_FrustumAABBIntersectionExact(ctx->frustum, &region_aabb))
+                m_render_chunk(map, ctx, r0, c0);
+            return;
+        }
+
+        switch(C_FrustumAABBIntersectionFast(ctx->frustum, &region_aabb)) {
+        case VOLUME_INTERSEC_OUTSIDE:
+            return;
+        case VOLUME_INTERSEC_INSIDE:
+            inside = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if(inside) {
+
+        for(int r = r0; r < r1; r++) {
+        for(int c = c0; c < c1; c++) {
+            m_render_chunk(map, ctx, r, c);
+        }}
+        return;
+    }
+
+    int rm = (r0 + r1) / 2;
+    int cm = (c0 + c1) / 2;
+
+    m_render_region(map, ctx, r0, c0, rm, cm, false);
+    m_render_region(map, ctx, r0, cm, rm, c1, false);
+    m_render_region(map, ctx, rm, c0, r1, cm, false);
+    m_render_region(map, ctx, rm, cm, r1, c1, false);
+}
+
+static void m_render_visible(const struct map *map, const struct frustum *frustum, 
+                             vec3_t lod_origin, bool shadows, float lod_dist, 
+                             enum render_pass pass, const vec4_t *clip_plane, bool occlusion)
+{
+    R_PushCmd((struct rcmd){ 
+        .func = R_GL_MapBegin, 
+        .nargs = 1, 
+        .args = {
+            R_PushArg(&shadows, sizeof(int)),
+        },
+    });
+
+    struct chunk_render_ctx ctx = (struct chunk_render_ctx){
+        .frustum = frustum,
+        .lod_origin = lod_origin,
+        .lod_dist = lod_dist,
+        .pass = pass,
+        .clip_plane = clip_plane,
+        .occlusion = occlusion,
+    };
+    m_render_region(map, &ctx, 0, 0, map->height, map->width, false);
+
+    R_PushCmd((struct rcmd){ R_GL_MapEnd, 0 });
+}
+
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -90,6 +339,59 @@ void M_Update(const struct map *map)
     N_Update(map->nav_private);
 }
 
+void M_UpdateResidency(const struct map *map, vec3_t cam_pos)
+{
+    if(CONFIG_CHUNK_RESIDENCY_RADIUS <= 0)
+        return;
+    if(++s_residency_frame % RESIDENCY_PERIOD)
+        return;
+
+    const size_t nchunks = map->width * map->height;
+    bool hot[nchunks];
+    memset(hot, 0, sizeof(hot));
+
+    vec2_t cam_xz = M_ClampedMapCoordinate(map, (vec2_t){cam_pos.x, cam_pos.z});
+    m_mark_hot(map, hot, cam_xz, CONFIG_CHUNK_RESIDENCY_RADIUS);
+
+    const vec_pentity_t *ents = G_GetActiveEntities();
+    for(int i = 0; i < vec_size(ents); i++) {
+
+        const struct entity *curr = vec_AT(ents, i);
+        if(curr->flags & ENTITY_FLAG_STATIC)
+            continue;
+        m_mark_hot(map, hot, G_Pos_GetXZ(curr->uid), 1);
+    }
+
+    /* Evicting a mesh which is not resident is a no-op, and chunks which 
+     * have been modified since the map was loaded always stay resident */
+    void **meshes = R_AllocArg(nchunks * (CHUNK_LODS + 1) * sizeof(void*));
+    size_t count = 0;
+
+    for(int i = 0; i < nchunks; i++) {
+
+        if(hot[i])
+            continue;
+
+        meshes[count++] = map->chunks[i].render_private;
+        for(int lod = 0; lod < CHUNK_LODS; lod++) {
+            meshes[count++] = map->chunks[i].lod_private[lod];
+        }
+    }
+
+    if(count > 0) {
+        R_PushCmd((struct rcmd){
+            .func = R_GL_MapEvict,
+            .nargs = 2,
+            .args = {
+                meshes,
+                R_PushArg(&count, sizeof(count)),
+            },
+        });
+    }
+
+    N_UpdateResidency(map->nav_private, hot);
+}
+
 void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *out)
 {
     ssize_t x_offset = -(p.c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
@@ -119,22 +421,14 @@ void M_RenderEntireMap(const struct map *map, bool shadows, enum render_pass pas
         switch(pass) {
         case RENDER_PASS_DEPTH: 
             R_PushCmd((struct rcmd){
-                .func = R_GL_RenderDepthMap,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
+                .type = RCMD_RENDER_DEPTH_MAP,
+                .as_draw = {chunk->render_private, chunk_model},
             });
             break;
         case RENDER_PASS_REGULAR:
             R_PushCmd((struct rcmd){
-                .func = R_GL_Draw,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
+                .type = RCMD_DRAW,
+                .as_draw = {chunk->render_private, chunk_model},
             });
             break;
         default: assert(0);
@@ -145,62 +439,57 @@ void M_RenderEntireMap(const struct map *map, bool shadows, enum render_pass pas
 }
 
 void M_RenderVisibleMap(const struct map *map, const struct camera *cam, 
-                        bool shadows, enum render_pass pass)
+                        bool shadows, float lod_dist, enum render_pass pass)
 {
     struct frustum frustum;
     Camera_MakeFrustum(cam, &frustum);
+    m_render_visible(map, &frustum, Camera_GetPos(cam), shadows, lod_dist, pass, NULL, 
+        pass == RENDER_PASS_REGULAR);
+}
 
-    R_PushCmd((struct rcmd){ 
-        .func = R_GL_MapBegin, 
-        .nargs = 1, 
-        .args = {
-            R_PushArg(&shadows, sizeof(int)),
-        },
-    });
-
-    for(int r = 0; r < map->height; r++) {
-    for(int c = 0; c < map->width;  c++) {
+void M_RenderVisibleMapClipped(const struct map *map, const struct camera *cam, 
+                               bool shadows, float lod_dist, enum render_pass pass, 
+                               vec4_t clip_plane)
+{
+    struct frustum frustum;
+    Camera_MakeFrustum(cam, &frustum);
+    m_render_visible(map, &frustum, Camera_GetPos(cam), shadows, lod_dist, pass, &clip_plane, false);
+}
 
-        struct aabb chunk_aabb;
-        m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+void M_RenderMapInFrustum(const struct map *map, const struct frustum *frustum, 
+                          vec3_t lod_origin, bool shadows, float lod_dist, 
+                          enum render_pass pass)
+{
+    m_render_visible(map, frustum, lod_origin, shadows, lod_dist, pass, NULL, false);
+}
 
-        /* Due to the nature of the the map (perfect grid), the fast and greedy frustrum 
-         * intersection test will yield too many false positives. As each chunk mesh has 
-         * a high vertex count, this is undesirable. It is absolutely worth it to do the 
-         * precise frustrum intersection test. With it, the map rendering performance
-         * scales great for large maps. */
-        if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
-            continue;
+void M_PrefetchMapInFrustum(const struct map *map, const struct frustum *frustum, 
+                            vec3_t lod_origin, float lod_dist)
+{
+    struct chunk_prefetch prefetch = (struct chunk_prefetch){
+        .count = 0,
+        .meshes = R_AllocArg(map->width * map->height * sizeof(void*)),
+    };
+    struct chunk_render_ctx ctx = (struct chunk_render_ctx){
+        .frustum = frustum,
+        .lod_origin = lod_origin,
+        .lod_dist = lod_dist,
+        .pass = RENDER_PASS_REGULAR,
+        .prefetch = &prefetch,
+    };
+    m_render_region(map, &ctx, 0, 0, map->height, map->width, false);
 
-        mat4x4_t chunk_model;
-        const struct pfchunk *chunk = &map->chunks[r * map->width + c];
-        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+    if(prefetch.count == 0)
+        return;
 
-        switch(pass) {
-        case RENDER_PASS_DEPTH: 
-            R_PushCmd((struct rcmd){
-                .func = R_GL_RenderDepthMap,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
-            });
-            break;
-        case RENDER_PASS_REGULAR:
-            R_PushCmd((struct rcmd){
-                .func = R_GL_Draw,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
-            });
-            break;
-        default: assert(0);
-        }
-    }}
-    R_PushCmd((struct rcmd){ R_GL_MapEnd, 0 });
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MapPrefetch,
+        .nargs = 2,
+        .args = {
+            prefetch.meshes,
+            R_PushArg(&prefetch.count, sizeof(prefetch.count)),
+        },
+    });
 }
 
 void M_RenderVisiblePathableLayer(const struct map *map, const struct camera *cam)
@@ -268,6 +557,7 @@ void M_CenterAtOrigin(struct map *map)
     size_t height = map->height * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
 
     map->pos = (vec3_t) {(width / 2.0f), 0.0f, -(height / 2.0f)};
+    M_AL_UpdateSplat(map, 0, 0, -1, -1);
 }
 
 void M_RestrictRTSCamToMap(const struct map *map, struct camera *cam)
@@ -356,7 +646,13 @@ float M_HeightAtPoint(const struct map *map, vec2_t xz)
     assert(tile_frac_width >= 0.0f && tile_frac_width <= 1.0f);
     assert(tile_frac_height >= 0.0f && tile_frac_height <= 1.0f);
 
-    const struct tile *tile = &map->chunks[chunk_r * map->width + chunk_c].tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
+    /* Most tiles are level, which the height quadtree tells apart */
+    const struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
+    struct height_range range = M_Heights_Node(chunk, 0, tile_r, tile_c);
+    if(range.min == range.max)
+        return range.min * Y_COORDS_PER_TILE;
+
+    const struct tile *tile = &chunk->tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
     return M_Tile_HeightAtPos(tile, tile_frac_width, tile_frac_height);
 }
 
@@ -376,9 +672,9 @@ void M_NavCutoutStaticObject(const struct map *map, const struct obb *obb)
     N_CutoutStaticObject(map->nav_private, map->pos, obb);
 }
 
-void M_NavUpdatePortals(const struct map *map)
+bool M_NavUpdatePortals(const struct map *map)
 {
-    N_UpdatePortals(map->nav_private);
+    return N_UpdatePortals(map->nav_private);
 }
 
 void M_NavUpdateIslandsField(const struct map *map)
@@ -392,6 +688,37 @@ bool M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest,
     return N_RequestPath(map->nav_private, xz_src, xz_dest, map->pos, out_dest_id);
 }
 
+path_ticket_t M_NavRequestGroupPathAsync(const struct map *map, const vec2_t *xz_srcs, 
+                                         size_t nsrcs, vec2_t xz_dest)
+{
+    return N_RequestGroupPathAsync(map->nav_private, xz_srcs, nsrcs, xz_dest, map->pos);
+}
+
+enum path_status M_NavPathStatus(path_ticket_t ticket, dest_id_t *out_dest_id)
+{
+    return N_PathStatus(ticket, out_dest_id);
+}
+
+void M_NavPathRelease(path_ticket_t ticket)
+{
+    N_PathRelease(ticket);
+}
+
+bool M_NavLoadCache(const char *path)
+{
+    return N_LoadCache(path);
+}
+
+bool M_NavSaveCache(const struct map *map, const char *path)
+{
+    return N_SaveCache(map->nav_private, path);
+}
+
+void M_NavPrecomputeFields(const struct map *map, size_t ndests, const vec2_t xz_dests[])
+{
+    N_PrecomputeFields(map->nav_private, map->pos, ndests, xz_dests);
+}
+
 void M_NavRenderVisiblePathFlowField(const struct map *map, const struct camera *cam, dest_id_t id)
 {
     struct frustum frustum;
@@ -473,9 +800,35 @@ void M_NavRenderNavigationPortals(const struct map *map, const struct camera *ca
     }}
 }
 
-vec2_t M_NavDesiredPointSeekVelocity(const struct map *map, dest_id_t id, vec2_t curr_pos, vec2_t xz_dest)
+void M_NavRenderFieldChurn(const struct map *map, const struct camera *cam)
+{
+    struct frustum frustum;
+    Camera_MakeFrustum(cam, &frustum);
+
+    for(int r = 0; r < map->height; r++) {
+    for(int c = 0; c < map->width;  c++) {
+
+        struct aabb chunk_aabb;
+        m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+
+        if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
+            continue;
+
+        mat4x4_t chunk_model;
+        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+        N_RenderFieldChurn(map->nav_private, map, &chunk_model, r, c);
+    }}
+}
+
+vec2_t M_NavDesiredPointSeekVelocity(const struct map *map, dest_id_t id, vec2_t curr_pos, 
+                                     vec2_t xz_dest, struct nav_cursor *cursor)
+{
+    return N_DesiredPointSeekVelocity(id, curr_pos, xz_dest, map->nav_private, map->pos, cursor);
+}
+
+void M_NavEnemySeekTickBegin(const struct map *map)
 {
-    return N_DesiredPointSeekVelocity(id, curr_pos, xz_dest, map->nav_private, map->pos);
+    N_EnemySeekTickBegin();
 }
 
 vec2_t M_NavDesiredEnemySeekVelocity(const struct map *map, vec2_t curr_pos, int faction_id)
@@ -503,6 +856,19 @@ bool M_NavPositionPathable(const struct map *map, vec2_t xz_pos)
     return N_PositionPathable(xz_pos, map->nav_private, map->pos);
 }
 
+bool M_NavChunkTileStates(const struct map *map, int chunk_r, int chunk_c, 
+                          uint8_t *out_pathable, uint8_t *out_blocked, 
+                          uint16_t *out_islands)
+{
+    if(chunk_r < 0 || chunk_r >= map->height)
+        return false;
+    if(chunk_c < 0 || chunk_c >= map->width)
+        return false;
+
+    N_ChunkTileStates(map->nav_private, chunk_r, chunk_c, out_pathable, out_blocked, out_islands);
+    return true;
+}
+
 vec2_t M_NavClosestReachableDest(const struct map *map, vec2_t xz_src, vec2_t xz_dst)
 {
     assert(M_NavPositionPathable(map, xz_src));
@@ -519,6 +885,21 @@ void M_NavBlockersDecref(vec2_t xz_pos, float range, const struct map *map)
     N_BlockersDecref(xz_pos, range, map->pos, map->nav_private);
 }
 
+void M_NavBlockersBatchIncref(vec2_t xz_pos, float range, const struct map *map)
+{
+    N_BlockersBatchIncref(xz_pos, range, map->pos);
+}
+
+void M_NavBlockersBatchDecref(vec2_t xz_pos, float range, const struct map *map)
+{
+    N_BlockersBatchDecref(xz_pos, range, map->pos);
+}
+
+void M_NavBlockersFlush(const struct map *map)
+{
+    N_BlockersFlush(map->nav_private);
+}
+
 bool M_TileForDesc(const struct map *map, struct tile_desc desc, struct tile **out)
 {
     if(desc.chunk_r < 0 || desc.chunk_r >= map->height)
@@ -535,6 +916,29 @@ bool M_TileForDesc(const struct map *map, struct tile_desc desc, struct tile **o
     return true;
 }
 
+bool M_ChunkTileData(const struct map *map, int chunk_r, int chunk_c, 
+                     float *out_heights, int32_t *out_mats)
+{
+    if(chunk_r < 0 || chunk_r >= map->height)
+        return false;
+    if(chunk_c < 0 || chunk_c >= map->width)
+        return false;
+
+    const struct tile *tiles = map->chunks[chunk_r * map->width + chunk_c].tiles;
+    for(int i = 0; i < TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH; i++) {
+
+        const struct tile *curr = &tiles[i];
+        if(out_heights) {
+            out_heights[i] = (M_Tile_NWHeight(curr) + M_Tile_NEHeight(curr) 
+                            + M_Tile_SWHeight(curr) + M_Tile_SEHeight(curr)) / 4.0f;
+        }
+        if(out_mats) {
+            out_mats[i] = curr->top_mat_idx;
+        }
+    }
+    return true;
+}
+
 void M_GetResolution(const struct map *map, struct map_resolution *out)
 {
     out->chunk_w = map->width;
@@ -557,6 +961,17 @@ void M_SetShadowsEnabled(struct map *map, bool on)
                 R_PushArg(&on, sizeof(on)),
             },
         });
+
+        for(int i = 0; i < CHUNK_LODS; i++) {
+            R_PushCmd((struct rcmd){
+                .func = R_GL_SetShadowsEnabled,
+                .nargs = 2,
+                .args = {
+                    chunk->lod_private[i],
+                    R_PushArg(&on, sizeof(on)),
+                },
+            });
+        }
     }}
 }
 
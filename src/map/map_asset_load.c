@@ -44,14 +44,29 @@
 #include "../lib/public/pf_string.h"
 #include "map_private.h"
 #include "../ui.h"
+#include "../sched.h"
 
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 
 /* ASCII to integer - argument must be an ascii digit */
 #define A2I(_a) ((_a) - '0')
 #define MINIMAP_DFLT_SZ (256)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define ALIGNED(size, to)  (((size) + (to) - 1) / (to) * (to))
+
+/* The building of a single chunk's vertices, which only depends on the 
+ * tiles of that chunk and its' neighbours and is carried out by a worker 
+ * thread */
+struct cook_job{
+    const struct map *map;
+    int               chunk_r, chunk_c;
+    void             *out;
+    bool              result;
+};
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -137,42 +152,165 @@ fail:
     return false;
 }
 
-static void m_al_patch_adjacency_info(struct map *map)
+static size_t m_al_cooked_size(size_t num_chunks, size_t num_materials)
 {
-    for(int r = 0; r < map->height; r++) {
-    for(int c = 0; c < map->width;  c++) {
+    size_t ret = ALIGNED(sizeof(struct pfmap_bin_hdr), PFMAP_BIN_ALIGN);
+    ret += ALIGNED(num_materials * MAX_LINE_LEN, PFMAP_BIN_ALIGN);
+    ret += ALIGNED(num_chunks * sizeof(struct pfmap_bin_chunk), PFMAP_BIN_ALIGN);
+    ret += num_chunks * ALIGNED(sizeof(((struct pfchunk*)0)->tiles), PFMAP_BIN_ALIGN);
+    ret += num_chunks * ALIGNED(R_AL_ChunkCookedSize(), PFMAP_BIN_ALIGN);
+    return ret;
+}
 
-        void *chunk_rprivate = map->chunks[r * map->width + c].render_private;
-        for(int tile_r = 0; tile_r < TILES_PER_CHUNK_HEIGHT; tile_r++) {
-        for(int tile_c = 0; tile_c < TILES_PER_CHUNK_HEIGHT; tile_c++) {
-        
-            struct tile_desc desc = (struct tile_desc){r, c, tile_r, tile_c};
-            const struct tile *tile = &map->chunks[r * map->width + c].tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
-
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TilePatchVertsBlend,
-                .nargs = 3,
-                .args = {
-                    chunk_rprivate,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&desc, sizeof(desc)),
-                },
-            });
-
-            if(!tile->blend_normals)
-                continue;
+static void m_al_cook_job_run(void *arg)
+{
+    struct cook_job *job = arg;
+    const struct pfchunk *chunk = &job->map->chunks[job->chunk_r * job->map->width + job->chunk_c];
+    job->result = R_AL_CookChunk(job->map, job->chunk_r, job->chunk_c, chunk->tiles, job->out);
+}
 
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TilePatchVertsSmooth,
-                .nargs = 3,
-                .args = {
-                    chunk_rprivate,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&desc, sizeof(desc)),
-                },
-            });
-        }}
+/* Builds the cooked form of a map whose tiles have been set */
+static void *m_al_cook(const struct map *map, size_t num_materials, 
+                       const char texnames[][MAX_LINE_LEN])
+{
+    const size_t num_chunks = map->width * map->height;
+    const size_t size = m_al_cooked_size(num_chunks, num_materials);
+
+    char *ret = calloc(size, 1);
+    if(!ret)
+        return NULL;
+
+    struct pfmap_bin_hdr *hdr = (void*)ret;
+    size_t off = ALIGNED(sizeof(struct pfmap_bin_hdr), PFMAP_BIN_ALIGN);
+
+    memcpy(hdr->magic, PFMAP_BIN_MAGIC, sizeof(hdr->magic));
+    hdr->version = PFMAP_BIN_VERSION;
+    hdr->src_hash = 0;
+    hdr->size = size;
+    hdr->num_rows = map->height;
+    hdr->num_cols = map->width;
+    hdr->num_materials = num_materials;
+    hdr->tile_size = sizeof(struct tile);
+    hdr->chunk_verts_size = R_AL_ChunkCookedSize();
+
+    hdr->materials_off = off;
+    memcpy(ret + off, texnames, num_materials * MAX_LINE_LEN);
+    off += ALIGNED(num_materials * MAX_LINE_LEN, PFMAP_BIN_ALIGN);
+
+    hdr->chunks_off = off;
+    struct pfmap_bin_chunk *dir = (void*)(ret + off);
+    off += ALIGNED(num_chunks * sizeof(struct pfmap_bin_chunk), PFMAP_BIN_ALIGN);
+
+    struct cook_job cjobs[num_chunks];
+    struct job jobs[num_chunks];
+
+    for(int i = 0; i < num_chunks; i++) {
+
+        const struct pfchunk *chunk = &map->chunks[i];
+
+        dir[i].tiles_off = off;
+        memcpy(ret + off, chunk->tiles, sizeof(chunk->tiles));
+        off += ALIGNED(sizeof(chunk->tiles), PFMAP_BIN_ALIGN);
+
+        dir[i].verts_off = off;
+        cjobs[i] = (struct cook_job){map, i / map->width, i % map->width, ret + off, false};
+        jobs[i] = (struct job){m_al_cook_job_run, &cjobs[i]};
+        off += ALIGNED(R_AL_ChunkCookedSize(), PFMAP_BIN_ALIGN);
+    }
+    assert(off == size);
+
+    struct job_counter ctr;
+    Sched_Submit(jobs, num_chunks, &ctr);
+    Sched_Wait(&ctr);
+
+    for(int i = 0; i < num_chunks; i++) {
+        if(!cjobs[i].result) {
+            free(ret);
+            return NULL;
+        }
+    }
+    return ret;
+}
+
+/* Sets up the chunk meshes, the materials and the navigation data of a map 
+ * from its' cooked form, which the map takes ownership of. Its' tiles must
+ * already be set. */
+static bool m_al_init_from_cooked(struct map *map, void *cooked)
+{
+    const struct pfmap_bin_hdr *hdr = cooked;
+    const char *base = cooked;
+    const struct pfmap_bin_chunk *dir = (void*)(base + hdr->chunks_off);
+    map->cooked = cooked;
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MapInit,
+        .nargs = 2,
+        .args = {
+            R_PushArg(base + hdr->materials_off, hdr->num_materials * MAX_LINE_LEN),
+            R_PushArg(&hdr->num_materials, sizeof(hdr->num_materials)),
+        },
+    });
+
+    size_t num_chunks = map->width * map->height;
+    char *unused_base = (char*)(map + 1);
+    unused_base += num_chunks * sizeof(struct pfchunk);
+
+    for(int i = 0; i < num_chunks; i++) {
+    
+        map->chunks[i].render_private = (void*)unused_base;
+        size_t renderbuff_sz = R_AL_PrivBuffSizeForChunk(
+                               TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 0);
+        unused_base += renderbuff_sz;
+
+        R_AL_InitPrivFromCooked(base + dir[i].verts_off, map->chunks[i].render_private);
+
+        for(int lod = 1; lod <= CHUNK_LODS; lod++) {
+            map->chunks[i].lod_private[lod - 1] = R_AL_ChunkLODPriv(map->chunks[i].render_private, lod);
+        }
+        M_Heights_BuildChunk(&map->chunks[i]);
+    }
+
+    /* Build navigation grid */
+    const struct tile *chunk_tiles[map->width * map->height];
+
+    for(int r = 0; r < map->height; r++) {
+    for(int c = 0; c < map->width; c++) {
+        chunk_tiles[r * map->width + c] = map->chunks[r * map->width + c].tiles;
     }}
+
+    map->nav_private = N_BuildForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles);
+    if(!map->nav_private)
+        return false;
+
+    M_AL_UpdateSplat(map, 0, 0, 
+        map->height * TILES_PER_CHUNK_HEIGHT - 1, 
+        map->width * TILES_PER_CHUNK_WIDTH - 1);
+    return true;
+}
+
+static bool m_al_section_valid(size_t size, uint32_t off, size_t len)
+{
+    return (off % PFMAP_BIN_ALIGN == 0) && off <= size && len <= size - off;
+}
+
+static void m_al_mark_dirty(struct map *map, int chunk_idx)
+{
+    map->version++;
+    map->dirty_log[map->version % MAP_DIRTY_LOG_LEN] = chunk_idx;
+}
+
+static int m_al_compare_descs(const void *a, const void *b)
+{
+    const struct tile_desc *da = a, *db = b;
+    int ka[4] = {da->chunk_r, da->chunk_c, da->tile_r, da->tile_c};
+    int kb[4] = {db->chunk_r, db->chunk_c, db->tile_r, db->tile_c};
+
+    for(int i = 0; i < 4; i++) {
+        if(ka[i] != kb[i])
+            return (ka[i] > kb[i]) - (ka[i] < kb[i]);
+    }
+    return 0;
 }
 
 static void set_minimap_defaults(struct map *map)
@@ -197,65 +335,109 @@ bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
     map->width = header->num_cols;
     map->height = header->num_rows;
     map->pos = (vec3_t) {0.0f, 0.0f, 0.0f};
+    map->cooked = NULL;
+    map->version = 0;
     set_minimap_defaults(map);
 
     /* Read materials */
-    char texnames[header->num_materials][256];
+    char texnames[header->num_materials][MAX_LINE_LEN];
     for(int i = 0; i < header->num_materials; i++) {
         if(!m_al_read_material(stream, texnames[i]))
             return false;
     }
 
-    R_PushCmd((struct rcmd){
-        .func = R_GL_MapInit,
-        .nargs = 2,
-        .args = {
-            R_PushArg(texnames, sizeof(texnames)),
-            R_PushArg(&header->num_materials, sizeof(header->num_materials)),
-        },
-    });
-
     /* Read chunks */
     size_t num_chunks = header->num_rows * header->num_cols;
-    char *unused_base = (char*)(map + 1);
-    unused_base += num_chunks * sizeof(struct pfchunk);
-
     for(int i = 0; i < num_chunks; i++) {
 
         if(!m_al_read_pfchunk(stream, map->chunks + i))
             return false;
     }
 
+    /* The map is then set up in the same way as when it's loaded in the cooked 
+     * form, so that it may be saved in that form. */
+    void *cooked = m_al_cook(map, header->num_materials, texnames);
+    if(!cooked)
+        return false;
+
+    if(!m_al_init_from_cooked(map, cooked)) {
+        free(cooked);
+        map->cooked = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool M_AL_CookedHeader(const void *data, size_t size, struct pfmap_hdr *out)
+{
+    const struct pfmap_bin_hdr *hdr = data;
+    if(size < sizeof(struct pfmap_bin_hdr)
+    || memcmp(hdr->magic, PFMAP_BIN_MAGIC, sizeof(hdr->magic))
+    || hdr->version != PFMAP_BIN_VERSION
+    || hdr->size != size
+    || hdr->tile_size != sizeof(struct tile)
+    || hdr->chunk_verts_size != R_AL_ChunkCookedSize())
+        return false;
+
+    const size_t num_chunks = hdr->num_rows * hdr->num_cols;
+    if(num_chunks == 0
+    || !m_al_section_valid(size, hdr->materials_off, hdr->num_materials * MAX_LINE_LEN)
+    || !m_al_section_valid(size, hdr->chunks_off, num_chunks * sizeof(struct pfmap_bin_chunk)))
+        return false;
+
+    const struct pfmap_bin_chunk *dir = (void*)((const char*)data + hdr->chunks_off);
     for(int i = 0; i < num_chunks; i++) {
-    
-        map->chunks[i].render_private = (void*)unused_base;
-        size_t renderbuff_sz = R_AL_PrivBuffSizeForChunk(
-                               TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 0);
-        unused_base += renderbuff_sz;
 
-        if(!R_AL_InitPrivFromTiles(map, i / header->num_cols, i % header->num_cols,
-                                   map->chunks[i].tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT,
-                                   map->chunks[i].render_private, basedir)) {
+        if(!m_al_section_valid(size, dir[i].tiles_off, sizeof(((struct pfchunk*)0)->tiles))
+        || !m_al_section_valid(size, dir[i].verts_off, hdr->chunk_verts_size))
             return false;
-        }
     }
 
-    m_al_patch_adjacency_info(map);
+    *out = (struct pfmap_hdr){
+        .version = PFMAP_BIN_VERSION,
+        .num_materials = hdr->num_materials,
+        .num_rows = hdr->num_rows,
+        .num_cols = hdr->num_cols,
+    };
+    return true;
+}
 
-    /* Build navigation grid */
-    const struct tile *chunk_tiles[map->width * map->height];
+bool M_AL_InitMapFromCooked(void *data, void *outmap)
+{
+    struct map *map = outmap;
+    const struct pfmap_bin_hdr *hdr = data;
+    const struct pfmap_bin_chunk *dir = (void*)((char*)data + hdr->chunks_off);
 
-    for(int r = 0; r < map->height; r++) {
-    for(int c = 0; c < map->width; c++) {
-        chunk_tiles[r * map->width + c] = map->chunks[r * map->width + c].tiles;
-    }}
+    map->width = hdr->num_cols;
+    map->height = hdr->num_rows;
+    map->pos = (vec3_t) {0.0f, 0.0f, 0.0f};
+    map->cooked = NULL;
+    map->version = 0;
+    set_minimap_defaults(map);
 
-    map->nav_private = N_BuildForMapData(map->width, map->height, 
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles);
-    if(!map->nav_private)
+    size_t num_chunks = map->width * map->height;
+    for(int i = 0; i < num_chunks; i++) {
+        memcpy(map->chunks[i].tiles, (char*)data + dir[i].tiles_off, sizeof(map->chunks[i].tiles));
+    }
+
+    return m_al_init_from_cooked(map, data);
+}
+
+bool M_AL_WriteCooked(const struct map *map, uint64_t src_hash, const char *path)
+{
+    if(!map->cooked)
         return false;
 
-    return true;
+    struct pfmap_bin_hdr *hdr = map->cooked;
+    hdr->src_hash = src_hash;
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "wb");
+    if(!stream)
+        return false;
+
+    bool ret = (SDL_RWwrite(stream, map->cooked, hdr->size, 1) == 1);
+    SDL_RWclose(stream);
+    return ret;
 }
 
 size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
@@ -269,43 +451,191 @@ size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
 
 bool M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, const struct tile *tile)
 {
-    if(desc->chunk_r >= map->height || desc->chunk_c >= map->width)
-        return false;
+    return M_AL_UpdateTiles(map, 1, desc, tile);
+}
+
+/* The tiles are written first. Then every tile whose vertices depend on a 
+ * changed one (i.e. the changed tiles and their neighbours) is re-patched 
+ * once, with a single command per chunk, and the decimated meshes of each 
+ * chunk with changed tiles are rebuilt once. The blending only changes at
+ * the reference points of the changed tiles themselves, so only the part of 
+ * the splat texture that they span is re-uploaded. */
+bool M_AL_UpdateTiles(struct map *map, size_t ntiles, const struct tile_desc *descs, 
+                      const struct tile *tiles)
+{
+    for(int i = 0; i < ntiles; i++) {
+        if(descs[i].chunk_r < 0 || descs[i].chunk_r >= map->height
+        || descs[i].chunk_c < 0 || descs[i].chunk_c >= map->width
+        || descs[i].tile_r < 0 || descs[i].tile_r >= TILES_PER_CHUNK_HEIGHT
+        || descs[i].tile_c < 0 || descs[i].tile_c >= TILES_PER_CHUNK_WIDTH)
+            return false;
+    }
 
-    struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
-    chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = *tile;
+    if(ntiles == 0)
+        return true;
+
+    struct tile_desc *patched = malloc(ntiles * 9 * sizeof(struct tile_desc));
+    struct tile_desc *changed = malloc(ntiles * sizeof(struct tile_desc));
+    if(!patched || !changed) {
+        free(patched);
+        free(changed);
+        return false;
+    }
 
     struct map_resolution res;
     M_GetResolution(map, &res);
+    size_t npatched = 0;
+    int rmin = INT_MAX, cmin = INT_MAX, rmax = INT_MIN, cmax = INT_MIN;
 
-    for(int dr = -1; dr <= 1; dr++) {
-    for(int dc = -1; dc <= 1; dc++) {
-    
-        struct tile_desc curr = *desc;
-        int ret = M_Tile_RelativeDesc(res, &curr, dc, dr);
-        if(ret) {
+    for(int i = 0; i < ntiles; i++) {
+
+        const struct tile_desc *desc = &descs[i];
+        struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
+        chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = tiles[i];
+        M_Heights_UpdateTile(chunk, desc->tile_r, desc->tile_c);
+        changed[i] = *desc;
+
+        int r = desc->chunk_r * TILES_PER_CHUNK_HEIGHT + desc->tile_r;
+        int c = desc->chunk_c * TILES_PER_CHUNK_WIDTH + desc->tile_c;
+        rmin = MIN(rmin, r); rmax = MAX(rmax, r);
+        cmin = MIN(cmin, c); cmax = MAX(cmax, c);
+
+        for(int dr = -1; dr <= 1; dr++) {
+        for(int dc = -1; dc <= 1; dc++) {
         
-            struct pfchunk *chunk = &map->chunks[curr.chunk_r * map->width + curr.chunk_c];
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TileUpdate,
-                .nargs = 3,
-                .args = {
-                    chunk->render_private,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&curr, sizeof(curr)),
-                },
-            });
+            struct tile_desc curr = *desc;
+            if(M_Tile_RelativeDesc(res, &curr, dc, dr))
+                patched[npatched++] = curr;
+        }}
+    }
+
+    qsort(patched, npatched, sizeof(struct tile_desc), m_al_compare_descs);
+    qsort(changed, ntiles, sizeof(struct tile_desc), m_al_compare_descs);
+
+    size_t end;
+    for(size_t begin = 0; begin < npatched; begin = end) {
+
+        const struct tile_desc *first = &patched[begin];
+        size_t nunique = 0;
+
+        for(end = begin; end < npatched 
+            && patched[end].chunk_r == first->chunk_r 
+            && patched[end].chunk_c == first->chunk_c; end++) {
+
+            if(nunique && !m_al_compare_descs(&patched[end], &patched[begin + nunique - 1]))
+                continue;
+            patched[begin + nunique++] = patched[end];
         }
-    }}
 
+        struct pfchunk *chunk = &map->chunks[first->chunk_r * map->width + first->chunk_c];
+        R_PushCmd((struct rcmd){
+            .func = R_GL_TileUpdateBatch,
+            .nargs = 4,
+            .args = {
+                chunk->render_private,
+                (void*)G_GetPrevTickMap(),
+                R_PushArg(first, nunique * sizeof(struct tile_desc)),
+                R_PushArg(&nunique, sizeof(nunique)),
+            },
+        });
+    }
+
+    /* The decimated meshes are built only from the chunk's own tiles */
+    for(int i = 0; i < ntiles; i++) {
+
+        if(i > 0 
+        && changed[i].chunk_r == changed[i - 1].chunk_r 
+        && changed[i].chunk_c == changed[i - 1].chunk_c)
+            continue;
+
+        int chunk_idx = changed[i].chunk_r * map->width + changed[i].chunk_c;
+        m_al_mark_dirty(map, chunk_idx);
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_TileUpdateLODs,
+            .nargs = 3,
+            .args = {
+                map->chunks[chunk_idx].render_private,
+                (void*)G_GetPrevTickMap(),
+                R_PushArg(&changed[i], sizeof(struct tile_desc)),
+            },
+        });
+    }
+
+    M_AL_UpdateSplat(map, rmin, cmin, rmax, cmax);
+
+    free(patched);
+    free(changed);
     return true;
 }
 
+void M_AL_UpdateSplat(const struct map *map, int rmin, int cmin, int rmax, int cmax)
+{
+    const int rows = map->height * TILES_PER_CHUNK_HEIGHT;
+    const int cols = map->width * TILES_PER_CHUNK_WIDTH;
+
+    rmin = MAX(rmin, 0); rmax = MIN(rmax, rows - 1);
+    cmin = MAX(cmin, 0); cmax = MIN(cmax, cols - 1);
+
+    int nr = 0, nc = 0;
+    uint32_t *texels = NULL;
+
+    if(rmax >= rmin && cmax >= cmin) {
+
+        nr = 2 * (rmax - rmin + 1) + 1;
+        nc = 2 * (cmax - cmin + 1) + 1;
+        texels = R_AllocArg(nr * nc * sizeof(uint32_t));
+        if(!texels)
+            return;
+    }
+
+    for(int r = rmin; r <= rmax; r++) {
+    for(int c = cmin; c <= cmax; c++) {
+
+        struct tile_desc td = (struct tile_desc){
+            r / TILES_PER_CHUNK_HEIGHT, c / TILES_PER_CHUNK_WIDTH,
+            r % TILES_PER_CHUNK_HEIGHT, c % TILES_PER_CHUNK_WIDTH,
+        };
+        uint32_t points[9];
+        R_TileGetSplat(map, &td, points);
+
+        /* The points on the edges are shared with the adjacent tiles, which
+         * yield the same materials for them */
+        for(int l = 0; l < 3; l++) {
+        for(int k = 0; k < 3; k++) {
+            size_t idx = (2 * (r - rmin) + l) * nc + (2 * (c - cmin) + k);
+            texels[idx] = points[l * 3 + k];
+        }}
+    }}
+
+    int dims[2] = {2 * cols + 1, 2 * rows + 1};
+    int rect[4] = {2 * cmin, 2 * rmin, nc, nr};
+    vec4_t bounds = (vec4_t){
+        map->pos.x, 
+        map->pos.z, 
+        cols * X_COORDS_PER_TILE, 
+        rows * Z_COORDS_PER_TILE
+    };
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_SplatUpdate,
+        .nargs = 4,
+        .args = {
+            R_PushArg(dims, sizeof(dims)),
+            R_PushArg(rect, sizeof(rect)),
+            R_PushArg(&bounds, sizeof(bounds)),
+            texels,
+        },
+    });
+}
+
 void M_AL_FreePrivate(struct map *map)
 {
     //TODO: Clean up OpenGL buffers
+    R_PushCmd((struct rcmd){ R_GL_SplatDisable, 0 });
     assert(map->nav_private);
     N_FreePrivate(map->nav_private);
+    free(map->cooked);
 }
 
 size_t M_AL_ShallowCopySize(size_t nrows, size_t ncols)
@@ -319,3 +649,23 @@ void M_AL_ShallowCopy(struct map *dst, const struct map *src)
     memcpy(dst, src, M_AL_ShallowCopySize(src->width, src->height));
 }
 
+void M_AL_SyncSnapshot(struct map *dst, const struct map *src)
+{
+    assert(dst->width == src->width && dst->height == src->height);
+    assert(dst->version <= src->version);
+
+    /* Past a certain point, copying over the changed chunks one by one is 
+     * no cheaper than copying everything */
+    const uint64_t behind = src->version - dst->version;
+    if(behind > MIN(MAP_DIRTY_LOG_LEN, src->width * src->height)) {
+        M_AL_ShallowCopy(dst, src);
+        return;
+    }
+
+    for(uint64_t v = dst->version + 1; v <= src->version; v++) {
+        int idx = src->dirty_log[v % MAP_DIRTY_LOG_LEN];
+        dst->chunks[idx] = src->chunks[idx];
+    }
+    memcpy(dst, src, sizeof(struct map));
+}
+
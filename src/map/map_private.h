@@ -39,6 +39,10 @@
 #include "pfchunk.h"
 #include "../pf_math.h"
 
+#include <stdint.h>
+
+#define MAP_DIRTY_LOG_LEN (64)
+
 struct map{
     /* ------------------------------------------------------------------------
      * Map dimensions in numbers of chunks.
@@ -77,6 +81,25 @@ struct map{
      * ------------------------------------------------------------------------
      */
     void *nav_private;
+    /* ------------------------------------------------------------------------
+     * The map in the cooked PF Map format, which the chunk meshes are built 
+     * from when they are first drawn. Owned by the map.
+     * ------------------------------------------------------------------------
+     */
+    void *cooked;
+    /* ------------------------------------------------------------------------
+     * Incremented on every change to the contents of a chunk. A snapshot of 
+     * the map holds the version it was last brought up to date with.
+     * ------------------------------------------------------------------------
+     */
+    uint64_t version;
+    /* ------------------------------------------------------------------------
+     * The index of the chunk changed by each of the most recent versions, at
+     * (version % MAP_DIRTY_LOG_LEN). Snapshots that are further behind than
+     * that are copied in full.
+     * ------------------------------------------------------------------------
+     */
+    int dirty_log[MAP_DIRTY_LOG_LEN];
     /* ------------------------------------------------------------------------
      * The map chunks stored in row-major order. In total, there must be 
      * (width * height) number of chunks.
@@ -91,4 +114,13 @@ struct chunkpos{
 
 void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *out);
 
+/* Rebuilds and uploads the part of the splat texture that is spanned by the 
+ * tiles in the (inclusive) range of global rows and columns. An empty range 
+ * only moves the texture along with the map's position. */
+void M_AL_UpdateSplat(const struct map *map, int rmin, int cmin, int rmax, int cmax);
+
+void                M_Heights_BuildChunk(struct pfchunk *chunk);
+void                M_Heights_UpdateTile(struct pfchunk *chunk, int tile_r, int tile_c);
+struct height_range M_Heights_Node(const struct pfchunk *chunk, int level, int r, int c);
+
 #endif
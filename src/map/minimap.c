@@ -47,6 +47,7 @@
 #include <SDL.h>
 
 #include <assert.h>
+#include <stdlib.h>
 
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -61,6 +62,10 @@ struct quad{
 /*****************************************************************************/
 
 static bool s_mouse_down_in_minimap = false;
+/* The chunks whose' tiles changed since the minimap was last rendered. Any 
+ * number of updates to a chunk within a frame cost a single rebake. */
+static bool  *s_dirty_chunks = NULL;
+static size_t s_ndirty = 0;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -264,6 +269,37 @@ static void on_mousemove(void *user, void *event)
     G_MoveActiveCamera(ws_coords);
 }
 
+static void m_flush_dirty_chunks(const struct map *map)
+{
+    if(!s_ndirty)
+        return;
+
+    for(int r = 0; r < map->height; r++) {
+    for(int c = 0; c < map->width;  c++) {
+
+        bool *dirty = &s_dirty_chunks[r * map->width + c];
+        if(!*dirty)
+            continue;
+        *dirty = false;
+
+        mat4x4_t model;
+        M_ModelMatrixForChunk(map, (struct chunkpos){r, c}, &model);
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_MinimapUpdateChunk,
+            .nargs = 5,
+            .args = {
+                (void*)G_GetPrevTickMap(),
+                map->chunks[r * map->width + c].render_private,
+                R_PushArg(&model, sizeof(model)),
+                R_PushArg(&r, sizeof(r)),
+                R_PushArg(&c, sizeof(c)),
+            }
+        });
+    }}
+    s_ndirty = 0;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -273,6 +309,12 @@ bool M_InitMinimap(struct map *map, vec2_t center_pos)
     assert(map);
     map->minimap_center_pos = center_pos;
 
+    free(s_dirty_chunks);
+    s_dirty_chunks = calloc(map->width * map->height, sizeof(bool));
+    s_ndirty = 0;
+    if(!s_dirty_chunks)
+        return false;
+
     void *chunk_rprivates[map->width * map->height];
     mat4x4_t chunk_model_mats[map->width * map->height];
 
@@ -304,20 +346,12 @@ bool M_UpdateMinimapChunk(const struct map *map, int chunk_r, int chunk_c)
     if(chunk_r >= map->height || chunk_c >= map->width)
         return false;
 
-    mat4x4_t model;
-    M_ModelMatrixForChunk(map, (struct chunkpos){chunk_r, chunk_c}, &model);
-
-    R_PushCmd((struct rcmd){
-        .func = R_GL_MinimapUpdateChunk,
-        .nargs = 5,
-        .args = {
-            (void*)G_GetPrevTickMap(),
-            map->chunks[chunk_r * map->width + chunk_c].render_private,
-            R_PushArg(&model, sizeof(model)),
-            R_PushArg(&chunk_r, sizeof(chunk_r)),
-            R_PushArg(&chunk_c, sizeof(chunk_c)),
-        }
-    });
+    assert(s_dirty_chunks);
+    bool *dirty = &s_dirty_chunks[chunk_r * map->width + chunk_c];
+    if(!*dirty) {
+        *dirty = true;
+        s_ndirty++;
+    }
     return true;
 }
 
@@ -328,6 +362,10 @@ void M_FreeMinimap(struct map *map)
 
     R_PushCmd((struct rcmd){ R_GL_MinimapFree, 0 });
     s_mouse_down_in_minimap = false;
+
+    free(s_dirty_chunks);
+    s_dirty_chunks = NULL;
+    s_ndirty = 0;
 }
 
 void M_GetMinimapAdjVres(const struct map *map, vec2_t *out_vres)
@@ -366,9 +404,12 @@ void M_SetMinimapSize(struct map *map, int side_len)
     map->minimap_sz = side_len;
 }
 
-void M_RenderMinimap(const struct map *map, const struct camera *cam)
+void M_RenderMinimap(const struct map *map, const struct camera *cam, 
+                     size_t nunits, const struct minimap_unit *units)
 {
     assert(map);
+    m_flush_dirty_chunks(map);
+
     struct quad curr_bounds = m_curr_bounds(map);
 
     vec2_t center;
@@ -383,12 +424,14 @@ void M_RenderMinimap(const struct map *map, const struct camera *cam)
 
     R_PushCmd((struct rcmd){
         .func = R_GL_MinimapRender,
-        .nargs = 4,
+        .nargs = 6,
         .args = {
             (void*)G_GetPrevTickMap(),
             R_PushArg(cam, g_sizeof_camera),
             R_PushArg(&center, sizeof(center)),
             R_PushArg(&len, sizeof(len)),
+            R_PushArg(&nunits, sizeof(nunits)),
+            (void*)units,
         },
     });
 }
@@ -41,6 +41,19 @@
 #include "../pf_math.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+
+/* The levels of the quadtree over each chunk's tile heights. Level 'n' holds 
+ * the ranges of blocks of (1 << n) x (1 << n) tiles, down to a single node 
+ * for the whole chunk. The levels are stored one after the other, starting 
+ * from the tiles. */
+#define CHUNK_HEIGHT_LEVELS    (6)
+#define CHUNK_HEIGHT_NODES     (32*32 + 16*16 + 8*8 + 4*4 + 2*2 + 1)
+
+/* The range of the heights of the tiles' top faces, in height levels */
+struct height_range{
+    int16_t min, max;
+};
 
 struct pfchunk{
 
@@ -50,6 +63,12 @@ struct pfchunk{
      * ------------------------------------------------------------------------
      */
     void           *render_private;
+    /* ------------------------------------------------------------------------
+     * The render privates of the decimated meshes, in order of decreasing 
+     * detail. Used in place of 'render_private' for far-away chunks.
+     * ------------------------------------------------------------------------
+     */
+    void           *lod_private[CHUNK_LODS];
     /* ------------------------------------------------------------------------
      * Worldspace position of the top left corner. 
      * ------------------------------------------------------------------------
@@ -60,6 +79,13 @@ struct pfchunk{
      * ------------------------------------------------------------------------
      */
     struct tile     tiles[TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH];
+    /* ------------------------------------------------------------------------
+     * The height ranges of the quadtree over the tiles. They let raycasts 
+     * skip the blocks of tiles which the ray passes over. Must be patched 
+     * whenever a tile changes.
+     * ------------------------------------------------------------------------
+     */
+    struct height_range heights[CHUNK_HEIGHT_NODES];
 };
 
 #endif
@@ -54,8 +54,10 @@ struct camera;
 struct tile;
 struct tile_desc;
 struct obb;
+struct frustum;
 enum render_pass;
 struct map_resolution;
+struct minimap_unit;
 
 
 /*###########################################################################*/
@@ -68,6 +70,14 @@ struct map_resolution;
  */
 void   M_Update(const struct map *map);
 
+/* ------------------------------------------------------------------------
+ * Periodically releases the GPU meshes and the navigation travel indices 
+ * of the chunks which are far away from the camera and from any units. 
+ * They are rebuilt on demand when they are next needed.
+ * ------------------------------------------------------------------------
+ */
+void   M_UpdateResidency(const struct map *map, vec3_t cam_pos);
+
 /* ------------------------------------------------------------------------
  * This renders all the chunks at once, which is wasteful when there are 
  * many off-screen chunks. Depending on the 'pass' type, this will perform 
@@ -78,12 +88,47 @@ void   M_RenderEntireMap(const struct map *map, bool shadows, enum render_pass p
 
 /* ------------------------------------------------------------------------
  * Renders the chunks of the map that are currently visible by the specified
- * camera using a frustrum-chunk intersection test. Depending on the 'pass'
- * type, this will perform a different action.
+ * camera using a frustrum-chunk intersection test. The test descends a 
+ * quadtree over the chunks, so that whole regions of the map are rejected 
+ * or accepted at once. Depending on the 'pass'
+ * type, this will perform a different action. Chunks further than 'lod_dist'
+ * from the camera are drawn with a decimated mesh, dropping to the next 
+ * level every 'lod_dist'. A 'lod_dist' of 0 always uses the full meshes.
+ * In the regular pass, the chunks which were hidden in the recent frames' 
+ * depth buffer are skipped as well.
  * ------------------------------------------------------------------------
  */
 void   M_RenderVisibleMap(const struct map *map, const struct camera *cam, 
-                          bool shadows, enum render_pass pass);
+                          bool shadows, float lod_dist, enum render_pass pass);
+
+/* ------------------------------------------------------------------------
+ * Like 'M_RenderVisibleMap', but also culls the chunks that lie entirely 
+ * on the negative side of the clipping plane, given as (a, b, c, d).
+ * ------------------------------------------------------------------------
+ */
+void   M_RenderVisibleMapClipped(const struct map *map, const struct camera *cam, 
+                                 bool shadows, float lod_dist, enum render_pass pass, 
+                                 vec4_t clip_plane);
+
+/* ------------------------------------------------------------------------
+ * Like 'M_RenderVisibleMap', but culls the chunks against an arbitrary 
+ * volume, such as that of a shadow map cascade. The level of detail is 
+ * chosen by the distance from 'lod_origin'.
+ * ------------------------------------------------------------------------
+ */
+void   M_RenderMapInFrustum(const struct map *map, const struct frustum *frustum, 
+                            vec3_t lod_origin, bool shadows, float lod_dist, 
+                            enum render_pass pass);
+
+/* ------------------------------------------------------------------------
+ * Creates the meshes of the chunks in the frustum which are not yet 
+ * resident on the GPU, at the level of detail they would be drawn with 
+ * from 'lod_origin'. Called with a frustum a little ahead of the moving 
+ * camera, so that the chunks coming into view are ready when they do.
+ * ------------------------------------------------------------------------
+ */
+void   M_PrefetchMapInFrustum(const struct map *map, const struct frustum *frustum, 
+                              vec3_t lod_origin, float lod_dist);
 
 /* ------------------------------------------------------------------------
  * Render a layer over the visible map surface showing which regions are 
@@ -122,6 +167,13 @@ void   M_NavRenderNavigationBlockers(const struct map *map, const struct camera
  */
 void   M_NavRenderNavigationPortals(const struct map *map, const struct camera *cam);
 
+/* ------------------------------------------------------------------------
+ * Render a layer over the visible map surface showing how often the cached 
+ * navigation fields of each chunk have been invalidated.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavRenderFieldChurn(const struct map *map, const struct camera *cam);
+
 /* ------------------------------------------------------------------------
  * Centers the map at the worldspace origin.
  * ------------------------------------------------------------------------
@@ -212,9 +264,10 @@ void   M_NavCutoutStaticObject(const struct map *map, const struct obb *obb);
 /* ------------------------------------------------------------------------
  * Update navigation private data after changes to the cost field.
  * (ex. to remove a path in case it was blocked off by a placed object)
+ * Returns false if some of the data could not be allocated.
  * ------------------------------------------------------------------------
  */
-void   M_NavUpdatePortals(const struct map *map);
+bool   M_NavUpdatePortals(const struct map *map);
 
 /* ------------------------------------------------------------------------
  * Update navigation private data (regarding which tile is reachanble from
@@ -232,6 +285,33 @@ void   M_NavUpdateIslandsField(const struct map *map);
 bool   M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
                         dest_id_t *out_dest_id);
 
+/* ------------------------------------------------------------------------
+ * Non-blocking variant of 'M_NavRequestPath', for all the sources of a 
+ * group. The fields are generated in the background and the returned 
+ * ticket can be polled for completion.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t    M_NavRequestGroupPathAsync(const struct map *map, const vec2_t *xz_srcs, 
+                                            size_t nsrcs, vec2_t xz_dest);
+enum path_status M_NavPathStatus(path_ticket_t ticket, dest_id_t *out_dest_id);
+void             M_NavPathRelease(path_ticket_t ticket);
+
+/* ------------------------------------------------------------------------
+ * Load/save the route-independent navigation data from/to a side file. The
+ * cache must be loaded before the map is created in order to be used for
+ * building its' navigation data.
+ * ------------------------------------------------------------------------
+ */
+bool   M_NavLoadCache(const char *path);
+bool   M_NavSaveCache(const struct map *map, const char *path);
+
+/* ------------------------------------------------------------------------
+ * Generate and cache the flow fields for reaching each of the destinations 
+ * from its' surrounding area ahead of time.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavPrecomputeFields(const struct map *map, size_t ndests, const vec2_t xz_dests[]);
+
 /* ------------------------------------------------------------------------
  * Render the flow field that will steer entities towards a particular 
  * destination over the map surface.
@@ -243,11 +323,20 @@ void   M_NavRenderVisiblePathFlowField(const struct map *map, const struct camer
 
 /* ------------------------------------------------------------------------
  * Returns the desired velocity vector for moving with the flow field 
- * to the specified destination.
+ * to the specified destination. The entity's 'cursor' (which may be NULL) 
+ * lets the lookup skip the field cache while it stays in the same chunk.
  * ------------------------------------------------------------------------
  */
 vec2_t M_NavDesiredPointSeekVelocity(const struct map *map, dest_id_t id, 
-                                     vec2_t curr_pos, vec2_t xz_dest);
+                                     vec2_t curr_pos, vec2_t xz_dest, 
+                                     struct nav_cursor *cursor);
+
+/* ------------------------------------------------------------------------
+ * Must be called at the start of every movement tick, before any enemy
+ * seek queries are made, to discard the enemy presence of the last one.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavEnemySeekTickBegin(const struct map *map);
 
 /* ------------------------------------------------------------------------
  * Returns the desired velocity vector for moving with the flow field 
@@ -270,6 +359,16 @@ bool   M_NavHasDestLOS(const struct map *map, dest_id_t id, vec2_t curr_pos);
  */
 bool   M_NavPositionPathable(const struct map *map, vec2_t xz_pos);
 
+/* ------------------------------------------------------------------------
+ * Fills in the pathability, the blockers and the island IDs of all the 
+ * navigation tiles of a chunk (see 'N_ChunkTileStates'). Returns false if
+ * the chunk is outside of the map.
+ * ------------------------------------------------------------------------
+ */
+bool   M_NavChunkTileStates(const struct map *map, int chunk_r, int chunk_c, 
+                            uint8_t *out_pathable, uint8_t *out_blocked, 
+                            uint16_t *out_islands);
+
 /* ------------------------------------------------------------------------
  * Returns the closest position to the destination that is pathable to from
  * the (valid) source position. In the best case, this is the destination
@@ -287,6 +386,16 @@ vec2_t M_NavClosestReachableDest(const struct map *map, vec2_t xz_src, vec2_t xz
 void   M_NavBlockersIncref(vec2_t xz_pos, float range, const struct map *map);
 void   M_NavBlockersDecref(vec2_t xz_pos, float range, const struct map *map);
 
+/* ------------------------------------------------------------------------
+ * Same as the above, but the change is queued and applied, coalesced with
+ * all the other queued changes, by 'M_NavBlockersFlush' or at the start of 
+ * the next map update, whichever comes first.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavBlockersBatchIncref(vec2_t xz_pos, float range, const struct map *map);
+void   M_NavBlockersBatchDecref(vec2_t xz_pos, float range, const struct map *map);
+void   M_NavBlockersFlush(const struct map *map);
+
 /* ------------------------------------------------------------------------
  * Wrapper around navigation APIs.
  * ------------------------------------------------------------------------
@@ -302,6 +411,16 @@ uint32_t M_NavDestIDForPos(const struct map *map, vec2_t xz_pos);
  */
 bool   M_TileForDesc(const struct map *map, struct tile_desc desc, struct tile **out);
 
+/* ------------------------------------------------------------------------
+ * Fills in the heights and the top materials of all the tiles of a chunk, 
+ * in row-major order. The height of a tile is the mean of its' corners'
+ * heights, in the same units as 'base_height'. Either output may be NULL.
+ * Returns false if the chunk is outside of the map.
+ * ------------------------------------------------------------------------
+ */
+bool   M_ChunkTileData(const struct map *map, int chunk_r, int chunk_c, 
+                       float *out_heights, int32_t *out_mats);
+
 /* ------------------------------------------------------------------------
  * Get the resolution (chunks, tiles) of the specified map.
  * ------------------------------------------------------------------------
@@ -333,7 +452,8 @@ bool   M_InitMinimap     (struct map *map, vec2_t center_pos);
 
 /* ------------------------------------------------------------------------
  * Update a chunk-sized region of the minimap texture with the most 
- * up-to-date vertex data.
+ * up-to-date vertex data. The chunk is only marked here, and re-rendered 
+ * once by the next 'M_RenderMinimap', however many times it was marked.
  * ------------------------------------------------------------------------
  */
 bool   M_UpdateMinimapChunk(const struct map *map, int chunk_r, int chunk_c);
@@ -379,10 +499,13 @@ void   M_SetMinimapResizeMask(struct map *map, int resize_mask);
 
 /* ------------------------------------------------------------------------
  * Render the minimap at the location specified by 'M_SetMinimapPos' and 
- * draw a box around the area visible by the specified camera.
+ * draw a box around the area visible by the specified camera. The 'units' 
+ * are drawn as dots and must live until the end of the frame, for instance 
+ * by being allocated with 'R_AllocArg'.
  * ------------------------------------------------------------------------
  */
-void   M_RenderMinimap   (const struct map *map, const struct camera *cam);
+void   M_RenderMinimap   (const struct map *map, const struct camera *cam, 
+                          size_t nunits, const struct minimap_unit *units);
 
 /* ------------------------------------------------------------------------
  * Render the minimap at the location specified by 'M_SetMinimapPos'.
@@ -402,6 +525,27 @@ bool   M_MouseOverMinimap(const struct map *map);
 bool   M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
                               SDL_RWops *stream, void *outmap);
 
+/* ------------------------------------------------------------------------
+ * Validates the cooked PF Map in 'data' and fills in the matching header.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_CookedHeader(const void *data, size_t size, struct pfmap_hdr *out);
+
+/* ------------------------------------------------------------------------
+ * Initialize private map data ('outmap', which is allocated by the caller)
+ * from a cooked PF Map that has been validated with 'M_AL_CookedHeader'. 
+ * The map takes ownership of the malloc'd 'data' on success.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_InitMapFromCooked(void *data, void *outmap);
+
+/* ------------------------------------------------------------------------
+ * Saves the map, as it was loaded, in the cooked PF Map format. 'src_hash' 
+ * identifies the text PF Map it was loaded from.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_WriteCooked(const struct map *map, uint64_t src_hash, const char *path);
+
 /* ------------------------------------------------------------------------
  * Returns the size, in bytes, needed to store the private map data
  * based on the header contents.
@@ -432,6 +576,16 @@ bool   M_AL_UpdateChunkMats(const struct map *map, int chunk_r, int chunk_c,
 bool   M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, 
                        const struct tile *tile);
 
+/* ------------------------------------------------------------------------
+ * Updates many tiles at once. The render data of each affected tile is 
+ * re-patched only once, no matter how many of its' neighbours changed,
+ * and the decimated meshes of each chunk are rebuilt once. Returns false 
+ * without changing anything if any of the descriptors is out of bounds.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_UpdateTiles(struct map *map, size_t ntiles, const struct tile_desc *descs, 
+                        const struct tile *tiles);
+
 /* ------------------------------------------------------------------------
  * The size (in bytes) needed to store a shallow copy of the map.
  * ------------------------------------------------------------------------
@@ -446,6 +600,13 @@ size_t M_AL_ShallowCopySize(size_t nrows, size_t ncols);
  */
 void   M_AL_ShallowCopy(struct map *dst, const struct map *src);
 
+/* ------------------------------------------------------------------------
+ * Bring a shallow copy of the map, previously made with 'M_AL_ShallowCopy',
+ * up to date. Only the chunks which changed since then are copied.
+ * ------------------------------------------------------------------------
+ */
+void   M_AL_SyncSnapshot(struct map *dst, const struct map *src);
+
 
 
 #endif
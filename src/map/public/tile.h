@@ -46,6 +46,11 @@
 #define TILES_PER_CHUNK_HEIGHT 32
 #define TILES_PER_CHUNK_WIDTH  32
 
+/* The number of decimated meshes built for each chunk, in addition to its' 
+ * full-resolution one. Level 'n' merges blocks of (1 << n) x (1 << n) tiles.
+ */
+#define CHUNK_LODS             2
+
 enum tiletype{
     /* TILETYPE_FLAT:
      *                     +----------+
@@ -50,9 +50,12 @@
 #include <SDL.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <float.h>
 
 
-#define MAX_CANDIDATE_TILES 256
+/* Must be a power of two */
+#define TRIMESH_CACHE_SIZE  (256)
 
 struct ray{
     vec3_t origin;
@@ -71,43 +74,125 @@ struct rc_ctx{
     vec3_t            intersec_pos;
 };
 
+/* A tile's triangle mesh in world space, as of a version of the map */
+struct trimesh_entry{
+    bool              valid;
+    uint64_t          version;
+    struct tile_desc  td;
+    int               nverts;
+    vec3_t            verts[VERTS_PER_TILE];
+};
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static struct rc_ctx s_ctx;
+/* Consecutive mouse moves mostly cast rays at the same few tiles. Rebuilding 
+ * their meshes is much slower than testing the ray against them. */
+static struct trimesh_entry s_trimesh_cache[TRIMESH_CACHE_SIZE];
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-struct aabb aabb_for_tile(struct tile_desc desc, const struct map *map)
+/* The box of the block of (1 << level) x (1 << level) tiles at (r, c) of 
+ * the chunk's height quadtree level, down to the bottom of the side faces */
+static struct aabb rc_node_aabb(const struct map *map, struct chunkpos cp, int level, int r, int c)
 {
-    assert(map);
-    assert(desc.chunk_r >= 0 && desc.chunk_r < map->height);
-    assert(desc.chunk_c >= 0 && desc.chunk_c < map->width);
-    assert(desc.tile_r >= 0  && desc.tile_r < TILES_PER_CHUNK_HEIGHT);
-    assert(desc.tile_c >= 0  && desc.tile_c < TILES_PER_CHUNK_HEIGHT);
-
-    const struct pfchunk *chunk = &map->chunks[desc.chunk_r * map->width + desc.chunk_c];
-    const struct tile *tile = &chunk->tiles[desc.tile_r * TILES_PER_CHUNK_WIDTH + desc.tile_c];
-
-    struct map_resolution res = {
-        map->width, map->height,
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
-    };
-    struct box tile_bounds = M_Tile_Bounds(res, map->pos, desc);
+    const struct pfchunk *chunk = &map->chunks[cp.r * map->width + cp.c];
+    struct height_range range = M_Heights_Node(chunk, level, r, c);
+    const int span = 1 << level;
+
+    float x_max = map->pos.x - cp.c * (TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE)
+                             - (c * span) * X_COORDS_PER_TILE;
+    float z_min = map->pos.z + cp.r * (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE)
+                             + (r * span) * Z_COORDS_PER_TILE;
 
     return (struct aabb) {
-        .x_min = tile_bounds.x - tile_bounds.width,
-        .x_max = tile_bounds.x,
+        .x_min = x_max - span * X_COORDS_PER_TILE,
+        .x_max = x_max,
         .y_min = -TILE_DEPTH * Y_COORDS_PER_TILE,
-        .y_max = (tile->base_height + (tile->type == TILETYPE_FLAT ? 0 : tile->ramp_height)) * Y_COORDS_PER_TILE,
-        .z_min = tile_bounds.z,
-        .z_max = tile_bounds.z + tile_bounds.height,
+        .y_max = range.max * Y_COORDS_PER_TILE,
+        .z_min = z_min,
+        .z_max = z_min + span * Z_COORDS_PER_TILE,
     };
 }
 
+static const struct trimesh_entry *rc_tile_trimesh(const struct map *map, struct tile_desc td)
+{
+    size_t key = ((td.chunk_r * map->width + td.chunk_c) * 31u)
+               + (td.tile_r * TILES_PER_CHUNK_WIDTH + td.tile_c);
+    struct trimesh_entry *entry = &s_trimesh_cache[key & (TRIMESH_CACHE_SIZE - 1)];
+
+    if(entry->valid 
+    && entry->version == map->version 
+    && !memcmp(&entry->td, &td, sizeof(td)))
+        return entry;
+
+    mat4x4_t model;
+    M_ModelMatrixForChunk(map, (struct chunkpos){td.chunk_r, td.chunk_c}, &model);
+
+    entry->valid = true;
+    entry->version = map->version;
+    entry->td = td;
+    entry->nverts = R_TileGetTriMesh(map, &td, &model, entry->verts);
+    return entry;
+}
+
+struct rc_hit{
+    float            t;
+    struct tile_desc td;
+};
+
+static int rc_compare_hits(const void *a, const void *b)
+{
+    float ta = ((const struct rc_hit*)a)->t;
+    float tb = ((const struct rc_hit*)b)->t;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Descends the chunk's height quadtree, skipping the blocks of tiles that the 
+ * ray passes over. The children are visited nearest-first, so that the rest 
+ * can be skipped once there is a closer hit than where they begin. 'inout' 
+ * holds the closest hit so far, which is only replaced by a closer one. */
+static bool rc_trace_node(const struct map *map, struct chunkpos cp, int level, int r, int c, 
+                          vec3_t origin, vec3_t dir, struct rc_hit *inout)
+{
+    if(level == 0) {
+
+        struct tile_desc td = (struct tile_desc){cp.r, cp.c, r, c};
+        const struct trimesh_entry *mesh = rc_tile_trimesh(map, td);
+
+        float t;
+        if(!C_RayIntersectsTriMesh(origin, dir, (vec3_t*)mesh->verts, mesh->nverts, &t) || t >= inout->t)
+            return false;
+
+        *inout = (struct rc_hit){t, td};
+        return true;
+    }
+
+    struct rc_hit children[4];
+    int nchildren = 0;
+
+    for(int i = 0; i < 4; i++) {
+
+        int cr = r * 2 + (i / 2), cc = c * 2 + (i % 2);
+        float t;
+        if(!C_RayIntersectsAABB(origin, dir, rc_node_aabb(map, cp, level - 1, cr, cc), &t))
+            continue;
+        children[nchildren++] = (struct rc_hit){t, (struct tile_desc){cp.r, cp.c, cr, cc}};
+    }
+    qsort(children, nchildren, sizeof(children[0]), rc_compare_hits);
+
+    bool ret = false;
+    for(int i = 0; i < nchildren && children[i].t < inout->t; i++) {
+        ret |= rc_trace_node(map, cp, level - 1, children[i].td.tile_r, children[i].td.tile_c, 
+            origin, dir, inout);
+    }
+    return ret;
+}
+
 static vec3_t rc_unproject_mouse_coords(void)
 {
     int mouse_x, mouse_y;
@@ -122,11 +207,9 @@ static vec3_t rc_unproject_mouse_coords(void)
     vec4_t clip = (vec4_t){ndc.x, ndc.y, ndc.z, 1.0f};
 
     mat4x4_t view_proj_inverse; 
-    mat4x4_t view, proj, tmp;
+    mat4x4_t tmp;
 
-    Camera_MakeViewMat(s_ctx.cam, &view);
-    Camera_MakeProjMat(s_ctx.cam, &proj);
-    PFM_Mat4x4_Mult4x4(&proj, &view, &tmp);
+    Camera_MakeViewProjMat(s_ctx.cam, &tmp);
     PFM_Mat4x4_Inverse(&tmp, &view_proj_inverse); 
 
     vec4_t ret_homo;
@@ -134,6 +217,8 @@ static vec3_t rc_unproject_mouse_coords(void)
     return (vec3_t){ret_homo.x/ret_homo.w, ret_homo.y/ret_homo.w, ret_homo.z/ret_homo.w};
 }
 
+/* The chunks are traced in the order that the ray enters them, until the 
+ * closest hit is found */
 static void rc_find_intersection(void)
 {
     vec3_t ray_origin = rc_unproject_mouse_coords();
@@ -145,52 +230,36 @@ static void rc_find_intersection(void)
 
     s_ctx.tile_active = false;
 
-    struct map_resolution res = {
-        s_ctx.map->width, s_ctx.map->height,
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
-    };
+    const struct map *map = s_ctx.map;
+    const int root = CHUNK_HEIGHT_LEVELS - 1;
+    struct rc_hit chunks[map->width * map->height];
+    int nchunks = 0;
 
-    /* Project the ray on the Y=(-TILE_DEPTH*Y_COORDS_PER_TILE) plane between the camera position and where the 
-     * ray intersects the Y=(-TILE_DEPTH*Y_COORDS_PER_TILE) plane. */
-    float t = fabs((ray_origin.y + TILE_DEPTH*Y_COORDS_PER_TILE) / ray_dir.y);
-    struct line_seg_2d y_eq_0_seg = {
-        ray_origin.x, 
-        ray_origin.z,
-        ray_origin.x + t * ray_dir.x, 
-        ray_origin.z + t * ray_dir.z,
-    };
-
-    struct tile_desc cts[MAX_CANDIDATE_TILES];
-    int len = M_Tile_LineSupercoverTilesSorted(res, s_ctx.map->pos, y_eq_0_seg, cts);
-    assert(len <= MAX_CANDIDATE_TILES);
+    for(int r = 0; r < map->height; r++) {
+    for(int c = 0; c < map->width; c++) {
 
-    for(int i = 0; i < len; i++) {
-    
-        struct aabb tile_aabb = aabb_for_tile(cts[i], s_ctx.map);
         float t;
+        if(!C_RayIntersectsAABB(ray_origin, ray_dir, rc_node_aabb(map, (struct chunkpos){r, c}, root, 0, 0), &t))
+            continue;
+        chunks[nchunks++] = (struct rc_hit){t, (struct tile_desc){r, c, 0, 0}};
+    }}
+    qsort(chunks, nchunks, sizeof(chunks[0]), rc_compare_hits);
 
-        /* The first level check is to see if the ray intersects the AABB */
-        if(C_RayIntersectsAABB(ray_origin, ray_dir, tile_aabb, &t)) {
-
-            /* If the ray hits the AABB, perform the second level check:
-             * Check if it intersects the exact triangle mesh of the tile. */
-            vec3_t tile_mesh[VERTS_PER_TILE];
-            mat4x4_t model;
+    struct rc_hit hit = (struct rc_hit){ .t = FLT_MAX };
+    for(int i = 0; i < nchunks && chunks[i].t < hit.t; i++) {
 
-            M_ModelMatrixForChunk(s_ctx.map, (struct chunkpos){cts[i].chunk_r, cts[i].chunk_c}, &model);
-            int num_verts = R_TileGetTriMesh(s_ctx.map, &cts[i], &model, tile_mesh);
+        struct chunkpos cp = (struct chunkpos){chunks[i].td.chunk_r, chunks[i].td.chunk_c};
+        rc_trace_node(map, cp, root, 0, 0, ray_origin, ray_dir, &hit);
+    }
 
-            if(C_RayIntersectsTriMesh(ray_origin, ray_dir, tile_mesh, num_verts, &t)) {
+    if(hit.t == FLT_MAX)
+        return;
 
-                PFM_Vec3_Scale(&ray_dir, t, &ray_dir);
-                PFM_Vec3_Add(&ray_origin, &ray_dir, &s_ctx.intersec_pos);
+    PFM_Vec3_Scale(&ray_dir, hit.t, &ray_dir);
+    PFM_Vec3_Add(&ray_origin, &ray_dir, &s_ctx.intersec_pos);
 
-                s_ctx.intersec_tile = cts[i]; 
-                s_ctx.tile_active = true;
-                break;
-            }
-        }
-    }
+    s_ctx.intersec_tile = hit.td; 
+    s_ctx.tile_active = true;
 }
 
 static void on_mousemove(void *user, void *event)
@@ -272,6 +341,7 @@ int M_Raycast_Install(struct map *map, struct camera *cam)
 {
     s_ctx.map = map; 
     s_ctx.cam = cam;
+    memset(s_trimesh_cache, 0, sizeof(s_trimesh_cache));
 
     E_Global_Register(SDL_MOUSEMOTION, on_mousemove, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_3D, on_render, NULL, G_RUNNING | G_PAUSED_FULL | G_PAUSED_UI_RUNNING);
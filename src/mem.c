@@ -0,0 +1,211 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "mem.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+
+/* Every block handed out by the wrappers is preceded by a header holding 
+ * its' size. The union keeps the block aligned as strictly as 'malloc' does.
+ */
+union mem_hdr{
+    size_t      size;
+    long double _ld;
+    long long   _ll;
+    void       *_ptr;
+};
+
+struct mem_counts{
+    SDL_SpinLock  lock;
+    size_t        live;
+    size_t        peak;
+    size_t        budget;
+    unsigned long nallocs;
+    bool          over_budget;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_tag_names[MEM_TAG_COUNT] = {
+    [MEM_TAG_NAV]           = "nav",
+    [MEM_TAG_FIELDCACHE]    = "fieldcache",
+    [MEM_TAG_RENDER_WS]     = "render_workspace",
+    [MEM_TAG_ANIM]          = "anim",
+    [MEM_TAG_GPU_BUFFERS]   = "gpu_buffers",
+    [MEM_TAG_GPU_TEXTURES]  = "gpu_textures",
+};
+
+static struct mem_counts s_counts[MEM_TAG_COUNT];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void mem_update(enum mem_tag tag, ptrdiff_t delta, bool alloc)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    struct mem_counts *c = &s_counts[tag];
+    bool warn = false;
+
+    SDL_AtomicLock(&c->lock);
+
+    assert(delta >= 0 || (size_t)-delta <= c->live);
+    c->live += delta;
+    if(c->live > c->peak)
+        c->peak = c->live;
+    c->nallocs += !!alloc;
+
+    if(c->budget && c->live > c->budget) {
+        warn = !c->over_budget;
+        c->over_budget = true;
+    }else{
+        c->over_budget = false;
+    }
+    size_t live = c->live, budget = c->budget;
+
+    SDL_AtomicUnlock(&c->lock);
+
+    if(warn) {
+        fprintf(stderr, "Memory budget for '%s' exceeded: %zu bytes live (budget: %zu bytes)\n",
+            s_tag_names[tag], live, budget);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+#if CONFIG_MEM_ACCOUNTING
+
+void *Mem_Alloc(enum mem_tag tag, size_t size)
+{
+    union mem_hdr *hdr = malloc(sizeof(union mem_hdr) + size);
+    if(!hdr)
+        return NULL;
+
+    hdr->size = size;
+    mem_update(tag, size, true);
+    return hdr + 1;
+}
+
+void *Mem_Calloc(enum mem_tag tag, size_t num, size_t size)
+{
+    if(size && num > (SIZE_MAX - sizeof(union mem_hdr)) / size)
+        return NULL;
+
+    void *ret = Mem_Alloc(tag, num * size);
+    if(!ret)
+        return NULL;
+
+    memset(ret, 0, num * size);
+    return ret;
+}
+
+void *Mem_Realloc(enum mem_tag tag, void *ptr, size_t size)
+{
+    if(!ptr)
+        return Mem_Alloc(tag, size);
+
+    union mem_hdr *hdr = ((union mem_hdr*)ptr) - 1;
+    size_t old_size = hdr->size;
+
+    union mem_hdr *ret = realloc(hdr, sizeof(union mem_hdr) + size);
+    if(!ret)
+        return NULL;
+
+    ret->size = size;
+    mem_update(tag, (ptrdiff_t)size - (ptrdiff_t)old_size, false);
+    return ret + 1;
+}
+
+void Mem_Free(enum mem_tag tag, void *ptr)
+{
+    if(!ptr)
+        return;
+
+    union mem_hdr *hdr = ((union mem_hdr*)ptr) - 1;
+    mem_update(tag, -(ptrdiff_t)hdr->size, false);
+    free(hdr);
+}
+
+#endif
+
+void Mem_Track(enum mem_tag tag, ptrdiff_t delta)
+{
+    mem_update(tag, delta, false);
+}
+
+void Mem_SetBudget(enum mem_tag tag, size_t bytes)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    struct mem_counts *c = &s_counts[tag];
+
+    SDL_AtomicLock(&c->lock);
+    c->budget = bytes;
+    c->over_budget = false;
+    SDL_AtomicUnlock(&c->lock);
+
+    /* Report right away if the subsystem is already over the new budget */
+    mem_update(tag, 0, false);
+}
+
+void Mem_GetStats(enum mem_tag tag, struct mem_stats *out)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    struct mem_counts *c = &s_counts[tag];
+
+    SDL_AtomicLock(&c->lock);
+    out->live = c->live;
+    out->peak = c->peak;
+    out->budget = c->budget;
+    out->nallocs = c->nallocs;
+    SDL_AtomicUnlock(&c->lock);
+}
+
+const char *Mem_TagName(enum mem_tag tag)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    return s_tag_names[tag];
+}
+
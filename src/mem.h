@@ -0,0 +1,106 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Per-subsystem memory accounting. Allocations made through the wrappers 
+ * below are tagged with the subsystem that owns them, so that the live and 
+ * peak number of bytes held by each subsystem can be reported. Memory that 
+ * is not allocated through the wrappers (GPU resources, pre-sized caches, 
+ * memory owned by library containers) can still be accounted for by noting 
+ * the changes in its' size with 'Mem_Track'.
+ *
+ * A block must be freed with the same tag it was allocated with.
+ */
+
+enum mem_tag{
+    MEM_TAG_NAV,
+    MEM_TAG_FIELDCACHE,
+    MEM_TAG_RENDER_WS,
+    MEM_TAG_ANIM,
+    MEM_TAG_GPU_BUFFERS,
+    MEM_TAG_GPU_TEXTURES,
+    MEM_TAG_COUNT
+};
+
+struct mem_stats{
+    size_t        live;       /* Bytes currently held */
+    size_t        peak;       /* The most bytes ever held at once */
+    size_t        budget;     /* 0 if there is no budget */
+    unsigned long nallocs;    /* Allocations made through the wrappers so far */
+};
+
+#if CONFIG_MEM_ACCOUNTING
+
+void *Mem_Alloc(enum mem_tag tag, size_t size);
+void *Mem_Calloc(enum mem_tag tag, size_t num, size_t size);
+void *Mem_Realloc(enum mem_tag tag, void *ptr, size_t size);
+void  Mem_Free(enum mem_tag tag, void *ptr);
+
+#else
+
+#define Mem_Alloc(_tag, _size)          malloc(_size)
+#define Mem_Calloc(_tag, _num, _size)   calloc(_num, _size)
+#define Mem_Realloc(_tag, _ptr, _size)  realloc(_ptr, _size)
+#define Mem_Free(_tag, _ptr)            free(_ptr)
+
+#endif
+
+/* ------------------------------------------------------------------------
+ * Note that 'delta' bytes were acquired (or released, when negative) by the 
+ * subsystem without going through the allocation wrappers.
+ * ------------------------------------------------------------------------
+ */
+void        Mem_Track(enum mem_tag tag, ptrdiff_t delta);
+
+/* ------------------------------------------------------------------------
+ * A warning is printed the first time the live byte count of the subsystem 
+ * rises above 'bytes', and again if it rises above it after having dropped 
+ * back below. 0 removes the budget.
+ * ------------------------------------------------------------------------
+ */
+void        Mem_SetBudget(enum mem_tag tag, size_t bytes);
+
+void        Mem_GetStats(enum mem_tag tag, struct mem_stats *out);
+const char *Mem_TagName(enum mem_tag tag);
+
+#endif
+
@@ -39,14 +39,21 @@
 #include "../lib/public/khash.h"
 #include "fieldcache.h"
 
+#include <SDL.h>
+
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+static inline int coord_index(struct coord c)
+{
+    return c.r * FIELD_RES_C + c.c;
+}
+
+PQUEUE_INDEXED_TYPE(coord, struct coord)
+PQUEUE_INDEXED_IMPL(static, coord, struct coord, coord_index)
 
 PQUEUE_TYPE(portal, const struct portal*)
 PQUEUE_IMPL(static, portal, const struct portal*)
@@ -55,6 +62,14 @@ KHASH_MAP_INIT_INT64(key_coord, struct coord)
 KHASH_MAP_INIT_INT64(key_portal, const struct portal*)
 KHASH_MAP_INIT_INT64(key_float, float)
 
+struct portal_tree{
+    const struct portal *finish;
+    /* key: (portal) - the next portal on the shortest path to 'finish' */
+    khash_t(key_portal) *next_hop;
+    /* key: (portal) - the cost of the shortest path to 'finish' */
+    khash_t(key_float)  *cost;
+};
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define kh_put_val(name, table, key, val)               \
     do{                                                 \
@@ -118,30 +133,6 @@ static int neighbours_grid(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], s
     return ret;
 }
 
-static int neighbours_portal_graph(const struct portal *portal,
-                                   const struct portal **out_neighbours, float *out_costs)
-{
-    int ret = 0;
-
-    for(int i = 0; i < portal->num_neighbours; i++) {
-
-        const struct edge *edge = &portal->edges[i];
-        if(edge->es == EDGE_STATE_BLOCKED)
-            continue;
-
-        out_neighbours[ret] = edge->neighbour;
-        out_costs[ret] = edge->cost;
-        ret++;
-    }
-
-    out_neighbours[ret] = portal->connected;
-    out_costs[ret] = 1;
-    ret++;
-
-    assert(ret <= MAX_PORTALS_PER_CHUNK);
-    return ret;
-}
-
 static float heuristic(struct coord a, struct coord b)
 {
     /* Octile Distance:
@@ -157,19 +148,6 @@ static float heuristic(struct coord a, struct coord b)
     return D * (dx + dy) + (D2 - 2 * D) * MIN(dx, dy);
 }
 
-/* Add a constant pentalty to every portal node on top of the existing 
- * cost of the edge between two portals. This will prioritize paths
- * with the fewest number of hops over paths with the shortest distance,
- * unless the pentalty for doing this is significant. If this is increased 
- * such that the edge cost is insignificant in comparison, the pathfinding 
- * will essentially find the path with the fewest number of hops.
- * Since our costs are distances are between portal centers and thus not 
- * precise, this typically gives better behaviour overall.  */
-static float portal_node_penalty(void)
-{
-    return sqrt(pow(FIELD_RES_R, 2.0f) + pow(FIELD_RES_C, 2.0f));
-}
-
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -191,11 +169,13 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
         return true;
     }
 
+    uint64_t start_counter = SDL_GetPerformanceCounter();
     pq_coord_t          frontier;
     khash_t(key_coord) *came_from;
     khash_t(key_float) *running_cost;
     
-    pq_coord_init(&frontier);
+    if(!pq_coord_init(&frontier, FIELD_RES_R * FIELD_RES_C))
+        goto fail_frontier;
     if(NULL == (came_from = kh_init(key_coord)))
         goto fail_came_from;
     if(NULL == (running_cost = kh_init(key_float)))
@@ -228,7 +208,7 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
 
                 kh_put_val(key_float, running_cost, coord_to_key(*next), new_cost);
                 float priority = new_cost + heuristic(finish, *next);
-                pq_coord_push(&frontier, priority, *next);
+                pq_coord_push_or_decrease(&frontier, priority, *next);
                 kh_put_val(key_coord, came_from, coord_to_key(*next), curr);
             }
         }
@@ -270,18 +250,21 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
     gp.exists = true;
     vec_coord_copy(&gp.path, out_path);
     gp.cost = *out_cost;
-    N_FC_PutGridPath(start, finish, chunk, &gp);
+    N_FC_PutGridPath(start, finish, chunk, &gp, N_FC_ElapsedMs(start_counter));
+    NAV_PHASE_END(start_counter, NAV_PHASE_ASTAR);
     return true;
 
 fail_find_path:
     gp.exists = false;
-    N_FC_PutGridPath(start, finish, chunk, &gp);
+    N_FC_PutGridPath(start, finish, chunk, &gp, N_FC_ElapsedMs(start_counter));
+    NAV_PHASE_END(start_counter, NAV_PHASE_ASTAR);
 
-    pq_coord_destroy(&frontier);
     kh_destroy(key_float, running_cost);
 fail_running_cost:
     kh_destroy(key_coord, came_from);
 fail_came_from:
+    pq_coord_destroy(&frontier);
+fail_frontier:
     return false;
 }
 
@@ -289,6 +272,7 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *fin
                            const struct nav_private *priv, 
                            vec_portal_t *out_path, float *out_cost)
 {
+    NAV_PHASE_START(phase_start);
     pq_portal_t          frontier;
     khash_t(key_portal) *came_from;
     khash_t(key_float)  *running_cost;
@@ -312,7 +296,7 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *fin
 
         if(N_PortalReachableFromTile(port, tile_coord, chunk)) {
 
-            float cost = chunk->portal_travel_costs[i][tile_coord.r][tile_coord.c];
+            float cost = N_PortalTravelCost(chunk, i, tile_coord);
             if(cost != FLT_MAX) {
             
                 kh_put_val(key_float, running_cost, portal_to_key(port), cost);
@@ -332,14 +316,14 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *fin
 
         const struct portal *neighbours[MAX_PORTALS_PER_CHUNK];
         float neighbour_costs[MAX_PORTALS_PER_CHUNK];
-        int num_neighbours = neighbours_portal_graph(curr, neighbours, neighbour_costs);
+        int num_neighbours = AStar_PortalNeighbours(curr, neighbours, neighbour_costs);
 
         for(int i = 0; i < num_neighbours; i++) {
 
             const struct portal *next = neighbours[i];
             khiter_t k = kh_get(key_float, running_cost, portal_to_key(curr));
             assert(k != kh_end(running_cost));
-            float new_cost = kh_value(running_cost, k) + neighbour_costs[i] + portal_node_penalty();
+            float new_cost = kh_value(running_cost, k) + neighbour_costs[i] + AStar_PortalNodePenalty();
 
             if((k = kh_get(key_float, running_cost, portal_to_key(next))) == kh_end(running_cost)
             || new_cost < kh_value(running_cost, k)) {
@@ -385,6 +369,7 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *fin
     kh_destroy(key_float, running_cost);
     kh_destroy(key_portal, came_from);
 
+    NAV_PHASE_END(phase_start, NAV_PHASE_ASTAR);
     return true;
 
 fail_find_path:
@@ -393,6 +378,163 @@ fail_find_path:
 fail_running_cost:
     kh_destroy(key_portal, came_from);
 fail_came_from:
+    NAV_PHASE_END(phase_start, NAV_PHASE_ASTAR);
     return false;
 }
 
+struct portal_tree *AStar_PortalTreeBuild(const struct portal *finish)
+{
+    struct portal_tree *tree = malloc(sizeof(struct portal_tree));
+    if(!tree)
+        goto fail_alloc;
+
+    tree->finish = finish;
+    if(NULL == (tree->next_hop = kh_init(key_portal)))
+        goto fail_next_hop;
+    if(NULL == (tree->cost = kh_init(key_float)))
+        goto fail_cost;
+
+    pq_portal_t frontier;
+    pq_portal_init(&frontier);
+
+    kh_put_val(key_float, tree->cost, portal_to_key(finish), 0.0f);
+    pq_portal_push(&frontier, 0.0f, finish);
+
+    /* Every edge in the portal graph has a twin going the other way with 
+     * the same cost and state. Thus, expanding the neighbours of a portal 
+     * gives us all the portals that can step to it. */
+    while(pq_size(&frontier) > 0) {
+
+        const struct portal *curr;
+        pq_portal_pop(&frontier, &curr);
+
+        khiter_t k = kh_get(key_float, tree->cost, portal_to_key(curr));
+        assert(k != kh_end(tree->cost));
+        float curr_cost = kh_value(tree->cost, k);
+
+        const struct portal *neighbours[MAX_PORTALS_PER_CHUNK];
+        float neighbour_costs[MAX_PORTALS_PER_CHUNK];
+        int num_neighbours = AStar_PortalNeighbours(curr, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            const struct portal *prev = neighbours[i];
+            float new_cost = curr_cost + neighbour_costs[i] + AStar_PortalNodePenalty();
+
+            if((k = kh_get(key_float, tree->cost, portal_to_key(prev))) == kh_end(tree->cost)
+            || new_cost < kh_value(tree->cost, k)) {
+
+                kh_put_val(key_float, tree->cost, portal_to_key(prev), new_cost);
+                pq_portal_push(&frontier, new_cost, prev);
+                kh_put_val(key_portal, tree->next_hop, portal_to_key(prev), curr);
+            }
+        }
+    }
+
+    pq_portal_destroy(&frontier);
+    return tree;
+
+fail_cost:
+    kh_destroy(key_portal, tree->next_hop);
+fail_next_hop:
+    free(tree);
+fail_alloc:
+    return NULL;
+}
+
+void AStar_PortalTreeFree(struct portal_tree *tree)
+{
+    kh_destroy(key_portal, tree->next_hop);
+    kh_destroy(key_float, tree->cost);
+    free(tree);
+}
+
+bool AStar_PortalTreePath(const struct portal_tree *tree, struct tile_desc start_tile, 
+                          const struct nav_private *priv, 
+                          vec_portal_t *out_path, float *out_cost)
+{
+    const struct nav_chunk *chunk = &priv->chunks[start_tile.chunk_r * priv->width + start_tile.chunk_c];
+    struct coord tile_coord = (struct coord){start_tile.tile_r, start_tile.tile_c};
+
+    /* Pick the portal in the source chunk with the cheapest total path */
+    const struct portal *first = NULL;
+    float best = FLT_MAX;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(!N_PortalReachableFromTile(port, tile_coord, chunk))
+            continue;
+
+        khiter_t k = kh_get(key_float, tree->cost, portal_to_key(port));
+        if(k == kh_end(tree->cost))
+            continue;
+
+        float cost = N_PortalTravelCost(chunk, i, tile_coord);
+        if(cost == FLT_MAX)
+            continue;
+
+        cost += kh_value(tree->cost, k);
+        if(cost < best) {
+            best = cost;
+            first = port;
+        }
+    }
+
+    if(!first)
+        return false;
+
+    vec_portal_reset(out_path);
+
+    const struct portal *curr = first;
+    while(true) {
+
+        vec_portal_push(out_path, (struct portal*)curr);
+        if(curr == tree->finish)
+            break;
+        khiter_t k = kh_get(key_portal, tree->next_hop, portal_to_key(curr));
+        assert(k != kh_end(tree->next_hop));
+        curr = kh_value(tree->next_hop, k);
+    }
+
+    *out_cost = best;
+    return true;
+}
+
+/* Add a constant pentalty to every portal node on top of the existing 
+ * cost of the edge between two portals. This will prioritize paths
+ * with the fewest number of hops over paths with the shortest distance,
+ * unless the pentalty for doing this is significant. If this is increased 
+ * such that the edge cost is insignificant in comparison, the pathfinding 
+ * will essentially find the path with the fewest number of hops.
+ * Since our costs are distances are between portal centers and thus not 
+ * precise, this typically gives better behaviour overall.  */
+float AStar_PortalNodePenalty(void)
+{
+    return sqrt(pow(FIELD_RES_R, 2.0f) + pow(FIELD_RES_C, 2.0f));
+}
+
+int AStar_PortalNeighbours(const struct portal *portal,
+                           const struct portal **out_neighbours, float *out_costs)
+{
+    int ret = 0;
+
+    for(int i = 0; i < portal->num_neighbours; i++) {
+
+        const struct edge *edge = &portal->edges[i];
+        if(edge->es == EDGE_STATE_BLOCKED)
+            continue;
+
+        out_neighbours[ret] = edge->neighbour;
+        out_costs[ret] = edge->cost;
+        ret++;
+    }
+
+    out_neighbours[ret] = portal->connected;
+    out_costs[ret] = 1;
+    ret++;
+
+    assert(ret <= MAX_PORTALS_PER_CHUNK);
+    return ret;
+}
+
@@ -43,6 +43,7 @@
 #include <stdbool.h>
 
 struct nav_private;
+struct portal_tree;
 
 VEC_TYPE(coord, struct coord)
 VEC_IMPL(static inline, coord, struct coord)
@@ -71,5 +72,39 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *fin
                            const struct nav_private *priv, 
                            vec_portal_t *out_path, float *out_cost);
 
+/* ------------------------------------------------------------------------
+ * Runs a single reverse search from 'finish' over the whole portal graph,
+ * yielding the shortest path to 'finish' from every portal that can reach 
+ * it. Returns NULL on allocation failure. The tree must be freed with 
+ * 'AStar_PortalTreeFree'.
+ * ------------------------------------------------------------------------
+ */
+struct portal_tree *AStar_PortalTreeBuild(const struct portal *finish);
+void                AStar_PortalTreeFree(struct portal_tree *tree);
+
+/* ------------------------------------------------------------------------
+ * Same contract as 'AStar_PortalGraphPath', but the path is read out of 
+ * a tree built for the destination portal rather than searched for.
+ * ------------------------------------------------------------------------
+ */
+bool AStar_PortalTreePath(const struct portal_tree *tree, struct tile_desc start_tile, 
+                          const struct nav_private *priv, 
+                          vec_portal_t *out_path, float *out_cost);
+
+/* ------------------------------------------------------------------------
+ * Fills 'out_neighbours' with the portals that are directly reachable 
+ * from 'portal' (taking blocked edges into account) and 'out_costs' with 
+ * the costs of the respective edges. Returns the number of neighbours.
+ * ------------------------------------------------------------------------
+ */
+int   AStar_PortalNeighbours(const struct portal *portal,
+                             const struct portal **out_neighbours, float *out_costs);
+
+/* ------------------------------------------------------------------------
+ * The constant cost added for every hop through the portal graph.
+ * ------------------------------------------------------------------------
+ */
+float AStar_PortalNodePenalty(void);
+
 #endif
 
@@ -39,19 +39,48 @@
 #include "../map/public/tile.h"
 #include "../game/public/game.h"
 #include "../lib/public/pqueue.h"
+#include "../lib/public/bucket_queue.h"
+#include "../config.h"
 
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <stdbool.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 
 #define MIN(a, b)           ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
 #define MAX_ENTS_PER_CHUNK  (4096)
 #define IDX(r, width, c)    ((r) * (width) + (c))
+/* Must match the shader inputs and outputs (see 'struct nav_gpu_batch') */
+#define GPU_SEED_BIT        (0x100)
+#define GPU_DIR_UNREACHED   (0xff)
+
+static inline int coord_index(struct coord c)
+{
+    return IDX(c.r, FIELD_RES_C, c.c);
+}
+
+#if CONFIG_NAV_BUCKET_QUEUE
+
+/* All wavefront costs are sums of integer tile costs */
+BUCKET_QUEUE_TYPE(coord, struct coord)
+BUCKET_QUEUE_IMPL(static, coord, struct coord)
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+typedef bq_coord_t frontier_t;
+
+#else
+
+PQUEUE_INDEXED_TYPE(coord, struct coord)
+PQUEUE_INDEXED_IMPL(static, coord, struct coord, coord_index)
+
+typedef pq_coord_t frontier_t;
+
+#endif
 
 struct box_xz{
     float x_min, x_max;
@@ -78,6 +107,54 @@ vec2_t g_flow_dir_lookup[9] = {
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+/* The frontier of a wavefront expansion. With the bucket queue, a tile may be 
+ * pushed several times - the caller is expected to skip the stale entries, 
+ * having a priority greater than the tile's current cost, on popping. 
+ */
+static void frontier_init(frontier_t *frontier)
+{
+#if CONFIG_NAV_BUCKET_QUEUE
+    bq_coord_init(frontier);
+#else
+    pq_coord_init(frontier, FIELD_RES_R * FIELD_RES_C);
+#endif
+}
+
+static void frontier_destroy(frontier_t *frontier)
+{
+#if CONFIG_NAV_BUCKET_QUEUE
+    bq_coord_destroy(frontier);
+#else
+    pq_coord_destroy(frontier);
+#endif
+}
+
+static void frontier_push(frontier_t *frontier, float cost, struct coord coord)
+{
+#if CONFIG_NAV_BUCKET_QUEUE
+    assert(cost >= 0.0f && cost == (uint32_t)cost);
+    bq_coord_push(frontier, (uint32_t)cost, coord);
+#else
+    pq_coord_push_or_decrease(frontier, cost, coord);
+#endif
+}
+
+static bool frontier_pop(frontier_t *frontier, struct coord *out, float *out_cost)
+{
+#if CONFIG_NAV_BUCKET_QUEUE
+    uint32_t cost;
+    if(!bq_coord_pop(frontier, out, &cost))
+        return false;
+    *out_cost = cost;
+    return true;
+#else
+    if(pq_size(frontier) == 0)
+        return false;
+    *out_cost = frontier->nodes[1].priority;
+    return pq_coord_pop(frontier, out);
+#endif
+}
+
 static bool tile_passable(const struct nav_chunk *chunk, struct coord tile)
 {
     if(chunk->cost_base[tile.r][tile.c] == COST_IMPASSABLE)
@@ -335,13 +412,102 @@ static void pad_wavefront(struct LOS_field *out_los)
     }}
 }
 
-static void build_integration_field(pq_coord_t *frontier, const struct nav_chunk *chunk, 
-                                    float inout[FIELD_RES_R][FIELD_RES_C])
+/* Relax every tile of a row with the value of the adjacent tile in the 'src' row. 
+ * Returns true if any of the tiles was updated. 
+ */
+static bool relax_row(float *restrict dst, const float *restrict src, const float *restrict weights)
 {
-    while(pq_size(frontier) > 0) {
+#if defined(__SSE__)
+    assert(FIELD_RES_C % 4 == 0);
+    __m128 any = _mm_setzero_ps();
+
+    for(int c = 0; c < FIELD_RES_C; c += 4) {
 
-        struct coord curr;
-        pq_coord_pop(frontier, &curr);
+        __m128 curr = _mm_loadu_ps(dst + c);
+        __m128 cand = _mm_add_ps(_mm_loadu_ps(src + c), _mm_loadu_ps(weights + c));
+        any = _mm_or_ps(any, _mm_cmplt_ps(cand, curr));
+        _mm_storeu_ps(dst + c, _mm_min_ps(curr, cand));
+    }
+    return (_mm_movemask_ps(any) != 0);
+#else
+    bool ret = false;
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        float cand = src[c] + weights[c];
+        if(cand < dst[c]) {
+            dst[c] = cand;
+            ret = true;
+        }
+    }
+    return ret;
+#endif
+}
+
+/* Computes the same field as the wavefront in 'build_integration_field', 
+ * seeded by all the tiles which already have a finite cost. The chunk is 
+ * swept in all 4 directions until no tile can be improved any further. The 
+ * vertical sweeps relax a whole row at a time and are vectorized, while 
+ * the horizontal sweeps have a dependency between adjacent tiles and 
+ * are done one tile at a time. Since all costs are small integers, the 
+ * sums are exact and the result does not depend on the order of updates.
+ */
+static void integration_weights(const struct nav_chunk *chunk, 
+                                float out[FIELD_RES_R][FIELD_RES_C])
+{
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        /* The wavefront never expands into impassable tiles */
+        out[r][c] = tile_passable(chunk, (struct coord){r, c}) ? chunk->cost_base[r][c]
+                                                               : INFINITY;
+    }}
+}
+
+static void build_integration_field_sweep(const struct nav_chunk *chunk, 
+                                          float inout[FIELD_RES_R][FIELD_RES_C])
+{
+    float weights[FIELD_RES_R][FIELD_RES_C];
+    integration_weights(chunk, weights);
+
+    bool changed;
+    do{
+        changed = false;
+
+        for(int r = 1; r < FIELD_RES_R; r++)
+            changed |= relax_row(inout[r], inout[r-1], weights[r]);
+
+        for(int r = FIELD_RES_R-2; r >= 0; r--)
+            changed |= relax_row(inout[r], inout[r+1], weights[r]);
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+
+            for(int c = 1; c < FIELD_RES_C; c++) {
+                float cand = inout[r][c-1] + weights[r][c];
+                if(cand < inout[r][c]) {
+                    inout[r][c] = cand;
+                    changed = true;
+                }
+            }
+            for(int c = FIELD_RES_C-2; c >= 0; c--) {
+                float cand = inout[r][c+1] + weights[r][c];
+                if(cand < inout[r][c]) {
+                    inout[r][c] = cand;
+                    changed = true;
+                }
+            }
+        }
+    }while(changed);
+}
+
+static void build_integration_field_wavefront(frontier_t *frontier, const struct nav_chunk *chunk, 
+                                              float inout[FIELD_RES_R][FIELD_RES_C])
+{
+    struct coord curr;
+    float cost;
+    while(frontier_pop(frontier, &curr, &cost)) {
+
+        if(cost > inout[curr.r][curr.c])
+            continue;
 
         struct coord neighbours[8];
         uint8_t neighbour_costs[8];
@@ -353,23 +519,36 @@ static void build_integration_field(pq_coord_t *frontier, const struct nav_chunk
             if(total_cost < inout[neighbours[i].r][neighbours[i].c]) {
 
                 inout[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(frontier, neighbours[i]))
-                    pq_coord_push(frontier, total_cost, neighbours[i]);
+                frontier_push(frontier, total_cost, neighbours[i]);
             }
         }
     }
 }
 
+static void build_integration_field(frontier_t *frontier, const struct nav_chunk *chunk, 
+                                    float inout[FIELD_RES_R][FIELD_RES_C])
+{
+#if CONFIG_NAV_SWEEP_INTEGRATION
+    /* The frontier tiles are exactly the ones that have been assigned a cost */
+    (void)frontier;
+    build_integration_field_sweep(chunk, inout);
+#else
+    build_integration_field_wavefront(frontier, chunk, inout);
+#endif
+}
+
 /* same as 'build_integration_field' but only impassable tiles 
  * will be added to the frontier 
  */
-static void build_integration_field_nonpass(pq_coord_t *frontier, const struct nav_chunk *chunk, 
+static void build_integration_field_nonpass(frontier_t *frontier, const struct nav_chunk *chunk, 
                                             float inout[FIELD_RES_R][FIELD_RES_C])
 {
-    while(pq_size(frontier) > 0) {
+    struct coord curr;
+    float cost;
+    while(frontier_pop(frontier, &curr, &cost)) {
 
-        struct coord curr;
-        pq_coord_pop(frontier, &curr);
+        if(cost > inout[curr.r][curr.c])
+            continue;
 
         struct coord neighbours[8];
         uint8_t neighbour_costs[8];
@@ -384,8 +563,7 @@ static void build_integration_field_nonpass(pq_coord_t *frontier, const struct n
             if(total_cost < inout[neighbours[i].r][neighbours[i].c]) {
 
                 inout[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(frontier, neighbours[i]))
-                    pq_coord_push(frontier, total_cost, neighbours[i]);
+                frontier_push(frontier, total_cost, neighbours[i]);
             }
         }
     }
@@ -628,46 +806,22 @@ static size_t portal_initial_frontier(const struct portal *port, const struct na
     return ret;
 }
 
+static bool seed_set(const struct enemy_seeds *seeds, int r, int c)
+{
+    return !!(seeds->rows[r] & (((uint64_t)1) << c));
+}
+
 static size_t enemies_initial_frontier(struct enemies_desc *enemies, const struct nav_chunk *chunk, 
                                        const struct nav_private *priv, struct coord *out, size_t maxout)
 {
-    struct box_xz bounds;
-    chunk_bounds(enemies->map_pos, enemies->chunk, &bounds);
-
-    struct entity *ents[MAX_ENTS_PER_CHUNK];
-    size_t num_ents = G_Pos_EntsInRect(
-        (vec2_t){bounds.x_min, bounds.z_min},
-        (vec2_t){bounds.x_max, bounds.z_max},
-        ents, ARR_SIZE(ents)
-    );
-    assert(num_ents);
-
-    bool has_enemy[FIELD_RES_R][FIELD_RES_C] = {0};
-    for(int i = 0; i < num_ents; i++) {
-    
-        struct entity *curr_enemy = ents[i];
-        if(!enemy_ent(enemies->faction_id, curr_enemy))
-            continue;
-
-        struct tile_desc tds[256];
-        int ntds = N_TilesUnderCircle(priv, G_Pos_GetXZ(curr_enemy->uid), 
-            curr_enemy->selection_radius, enemies->map_pos, tds, ARR_SIZE(tds));
-
-        for(int j = 0; j < ntds; j++) {
-
-            struct tile_desc curr_td = tds[j];
-            if(curr_td.chunk_r != enemies->chunk.r
-            || curr_td.chunk_c != enemies->chunk.c)
-                continue;
-            has_enemy[curr_td.tile_r][curr_td.tile_c] = true;
-        }
-    }
+    struct enemy_seeds seeds;
+    N_FlowFieldEnemySeeds(priv, enemies, &seeds);
 
     int ret = 0;
     for(int r = 0; r < FIELD_RES_R; r++) {
     for(int c = 0; c < FIELD_RES_C; c++) {
         
-        if(!has_enemy[r][c])
+        if(!seed_set(&seeds, r, c))
             continue;
 
         out[ret++] = (struct coord){r, c};
@@ -800,6 +954,176 @@ static size_t passable_frontier(const struct nav_chunk *chunk, struct coord star
     return ret;
 }
 
+static bool LOS_chunk_open(const struct nav_chunk *chunk)
+{
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+        if(chunk->cost_base[r][c] > 1 || chunk->blockers[r][c])
+            return false;
+    }}
+    return true;
+}
+
+/* Propagate the visibility from the seed tiles in order of distance, marking 
+ * the tiles behind every LOS corner that is hit as 'wavefront blocked'. */
+static void LOS_propagate_wavefront(struct tile_desc target, struct coord chunk_coord,
+                                    const struct nav_private *priv, vec3_t map_pos,
+                                    const struct coord *seeds, size_t nseeds,
+                                    struct LOS_field *out_los)
+{
+    const struct nav_chunk *chunk = &priv->chunks[chunk_coord.r * priv->width + chunk_coord.c];
+
+    frontier_t frontier;
+    frontier_init(&frontier);
+
+    float integration_field[FIELD_RES_R][FIELD_RES_C];
+    for(int r = 0; r < FIELD_RES_R; r++)
+        for(int c = 0; c < FIELD_RES_C; c++)
+            integration_field[r][c] = INFINITY;
+
+    for(int i = 0; i < nseeds; i++) {
+        frontier_push(&frontier, 0.0f, seeds[i]);
+        integration_field[seeds[i].r][seeds[i].c] = 0.0f;
+    }
+
+    struct coord curr;
+    float cost;
+    while(frontier_pop(&frontier, &curr, &cost)) {
+
+        if(cost > integration_field[curr.r][curr.c])
+            continue;
+
+        struct coord neighbours[8];
+        uint8_t neighbour_costs[8];
+        int num_neighbours = neighbours_grid_LOS(chunk, out_los, curr, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            int nr = neighbours[i].r, nc = neighbours[i].c;
+            if(neighbour_costs[i] > 1) {
+                
+                if(!is_LOS_corner(neighbours[i], chunk->cost_base, chunk->blockers))
+                    continue;
+
+                struct tile_desc src_desc = (struct tile_desc) {
+                    .chunk_r = chunk_coord.r,
+                    .chunk_c = chunk_coord.c,
+                    .tile_r = neighbours[i].r,
+                    .tile_c = neighbours[i].c
+                };
+                create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+            }else{
+
+                float new_cost = integration_field[curr.r][curr.c] + 1;
+                out_los->field[nr][nc].visible = 1;
+
+                if(new_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
+
+                    integration_field[nr][nc] = new_cost;
+                    frontier_push(&frontier, new_cost, neighbours[i]);
+                }
+            }
+        }
+    }
+    frontier_destroy(&frontier);
+}
+
+/* Same as the above, but one whole ring of the wavefront is advanced at a 
+ * time, using a 64-bit mask for every row of the field. */
+static void LOS_propagate_bitset(struct tile_desc target, struct coord chunk_coord,
+                                 const struct nav_private *priv, vec3_t map_pos,
+                                 const struct coord *seeds, size_t nseeds,
+                                 struct LOS_field *out_los)
+{
+    assert(FIELD_RES_C <= 64);
+    const struct nav_chunk *chunk = &priv->chunks[chunk_coord.r * priv->width + chunk_coord.c];
+
+    uint64_t open[FIELD_RES_R] = {0};
+    uint64_t blocked[FIELD_RES_R] = {0};
+    uint64_t reached[FIELD_RES_R] = {0};
+    uint64_t frontier[FIELD_RES_R] = {0};
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        const uint64_t bit = ((uint64_t)1) << c;
+        if(chunk->cost_base[r][c] <= 1 && !chunk->blockers[r][c])
+            open[r] |= bit;
+        if(out_los->field[r][c].wavefront_blocked)
+            blocked[r] |= bit;
+    }}
+
+    for(int i = 0; i < nseeds; i++) {
+        frontier[seeds[i].r] |= ((uint64_t)1) << seeds[i].c;
+        reached[seeds[i].r]  |= ((uint64_t)1) << seeds[i].c;
+    }
+
+    bool more = (nseeds > 0);
+    while(more) {
+
+        uint64_t cand[FIELD_RES_R];
+        bool lines = false;
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+
+            uint64_t adj = (frontier[r] << 1) | (frontier[r] >> 1);
+            if(r > 0)
+                adj |= frontier[r-1];
+            if(r < FIELD_RES_R-1)
+                adj |= frontier[r+1];
+            cand[r] = adj & ~blocked[r];
+        }
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+
+            uint64_t obstructed = cand[r] & ~open[r];
+            if(!obstructed)
+                continue;
+
+            for(int c = 0; c < FIELD_RES_C; c++) {
+
+                if(!(obstructed & (((uint64_t)1) << c)))
+                    continue;
+                if(!is_LOS_corner((struct coord){r, c}, chunk->cost_base, chunk->blockers))
+                    continue;
+
+                struct tile_desc src_desc = (struct tile_desc) {
+                    .chunk_r = chunk_coord.r,
+                    .chunk_c = chunk_coord.c,
+                    .tile_r = r,
+                    .tile_c = c
+                };
+                create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+                lines = true;
+            }
+        }
+
+        more = false;
+        for(int r = 0; r < FIELD_RES_R; r++) {
+
+            uint64_t vis = cand[r] & open[r];
+            for(int c = 0; vis && c < FIELD_RES_C; c++) {
+                if(vis & (((uint64_t)1) << c))
+                    out_los->field[r][c].visible = 1;
+            }
+
+            frontier[r] = vis & ~reached[r];
+            reached[r] |= frontier[r];
+            more = more || frontier[r];
+        }
+
+        if(!lines)
+            continue;
+
+        /* The new lines hide the tiles behind them from the next ring onwards */
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            if(out_los->field[r][c].wavefront_blocked)
+                blocked[r] |= ((uint64_t)1) << c;
+        }}
+    }
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -851,8 +1175,8 @@ void N_FlowFieldUpdate(struct coord chunk_coord, const struct nav_private *priv,
                        struct field_target target, struct flow_field *inout_flow)
 {
     const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    frontier_t frontier;
+    frontier_init(&frontier);
 
     float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++)
@@ -865,39 +1189,261 @@ void N_FlowFieldUpdate(struct coord chunk_coord, const struct nav_private *priv,
     for(int i = 0; i < ninit; i++) {
 
         struct coord curr = init_frontier[i];
-        pq_coord_push(&frontier, 0.0f, curr); 
+        frontier_push(&frontier, 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
     inout_flow->target = target;
+    NAV_PHASE_START(integration_start);
     build_integration_field(&frontier, chunk, integration_field);
+    NAV_PHASE_END(integration_start, NAV_PHASE_INTEGRATION);
+
+    NAV_PHASE_START(flow_start);
     build_flow_field(integration_field, inout_flow);
     fixup_field(target, integration_field, inout_flow, chunk);
+    NAV_PHASE_END(flow_start, NAV_PHASE_FLOW);
+
+    frontier_destroy(&frontier);
+}
+
+void N_FlowFieldGPUInputs(struct coord chunk_coord, const struct nav_private *priv,
+                          struct field_target target, uint32_t out[FIELD_RES_R][FIELD_RES_C])
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        out[r][c] = tile_passable(chunk, (struct coord){r, c}) ? chunk->cost_base[r][c]
+                                                               : COST_IMPASSABLE;
+    }}
+
+    struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
+    size_t ninit = initial_frontier(target, chunk, priv, false, init_frontier, ARR_SIZE(init_frontier));
 
-    pq_coord_destroy(&frontier);
+    for(int i = 0; i < ninit; i++) {
+        struct coord curr = init_frontier[i];
+        out[curr.r][curr.c] |= GPU_SEED_BIT;
+    }
+}
+
+void N_FlowFieldGPUApply(struct coord chunk_coord, const struct nav_private *priv,
+                         struct field_target target, const uint32_t dirs[FIELD_RES_R][FIELD_RES_C],
+                         struct flow_field *inout_flow)
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+
+    /* The integration field itself isn't read back. The fixups only need 
+     * to know which tiles were reached, and which ones are the targets. */
+    float integration_field[FIELD_RES_R][FIELD_RES_C];
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        if(dirs[r][c] == GPU_DIR_UNREACHED) {
+            integration_field[r][c] = INFINITY;
+            continue;
+        }
+        integration_field[r][c] = (dirs[r][c] == FD_NONE) ? 0.0f : 1.0f;
+        inout_flow->field[r][c].dir_idx = dirs[r][c];
+    }}
+
+    inout_flow->target = target;
+    fixup_field(target, integration_field, inout_flow, chunk);
+}
+
+bool N_FlowFieldEnemySeeds(const struct nav_private *priv, const struct enemies_desc *enemies, 
+                           struct enemy_seeds *out)
+{
+    assert(FIELD_RES_C <= 64);
+    memset(out, 0, sizeof(*out));
+
+    struct box_xz bounds;
+    chunk_bounds(enemies->map_pos, enemies->chunk, &bounds);
+
+    struct entity *ents[MAX_ENTS_PER_CHUNK];
+    size_t num_ents = G_Pos_EntsInRect(
+        (vec2_t){bounds.x_min, bounds.z_min},
+        (vec2_t){bounds.x_max, bounds.z_max},
+        ents, ARR_SIZE(ents)
+    );
+
+    bool ret = false;
+    for(int i = 0; i < num_ents; i++) {
+    
+        struct entity *curr_enemy = ents[i];
+        if(!enemy_ent(enemies->faction_id, curr_enemy))
+            continue;
+
+        struct tile_desc tds[256];
+        int ntds = N_TilesUnderCircle(priv, G_Pos_GetXZ(curr_enemy->uid), 
+            curr_enemy->selection_radius, enemies->map_pos, tds, ARR_SIZE(tds));
+
+        for(int j = 0; j < ntds; j++) {
+
+            struct tile_desc curr_td = tds[j];
+            if(curr_td.chunk_r != enemies->chunk.r
+            || curr_td.chunk_c != enemies->chunk.c)
+                continue;
+            out->rows[curr_td.tile_r] |= (((uint64_t)1) << curr_td.tile_c);
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+void N_FlowFieldUpdateEnemies(struct coord chunk_coord, const struct nav_private *priv,
+                              struct field_target target, const struct enemy_seeds *seeds,
+                              struct enemy_field_state *out_state, struct flow_field *inout_flow)
+{
+    assert(target.type == TARGET_ENEMIES);
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+    frontier_t frontier;
+    frontier_init(&frontier);
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        out_state->integration[r][c] = INFINITY;
+        if(!seed_set(seeds, r, c))
+            continue;
+
+        frontier_push(&frontier, 0.0f, (struct coord){r, c}); 
+        out_state->integration[r][c] = 0.0f;
+    }}
+    out_state->seeds = *seeds;
+
+    inout_flow->target = target;
+    NAV_PHASE_START(integration_start);
+    build_integration_field(&frontier, chunk, out_state->integration);
+    NAV_PHASE_END(integration_start, NAV_PHASE_INTEGRATION);
+
+    NAV_PHASE_START(flow_start);
+    build_flow_field(out_state->integration, inout_flow);
+    fixup_field(target, out_state->integration, inout_flow, chunk);
+    NAV_PHASE_END(flow_start, NAV_PHASE_FLOW);
+
+    frontier_destroy(&frontier);
+}
+
+void N_FlowFieldRepairEnemies(struct coord chunk_coord, const struct nav_private *priv,
+                              const struct enemy_seeds *new_seeds, struct enemy_field_state *inout_state,
+                              struct flow_field *inout_flow)
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+    float (*intf)[FIELD_RES_C] = inout_state->integration;
+
+    float weights[FIELD_RES_R][FIELD_RES_C];
+    integration_weights(chunk, weights);
+
+    /* First, find all the tiles whose cost may have been derived from a tile
+     * that is no longer a seed. A tile's cost may have been derived from a 
+     * neighbour's if it is equal to the neighbour's cost plus its' own weight. 
+     */
+    static const struct coord deltas[] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    bool affected[FIELD_RES_R][FIELD_RES_C] = {0};
+    struct coord stack[FIELD_RES_R * FIELD_RES_C];
+    size_t nstack = 0;
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        if(seed_set(&inout_state->seeds, r, c) && !seed_set(new_seeds, r, c)) {
+            affected[r][c] = true;
+            stack[nstack++] = (struct coord){r, c};
+        }
+    }}
+
+    if(nstack == 0 && 0 == memcmp(&inout_state->seeds, new_seeds, sizeof(*new_seeds)))
+        return;
+
+    while(nstack > 0) {
+
+        struct coord curr = stack[--nstack];
+        for(int i = 0; i < ARR_SIZE(deltas); i++) {
+
+            int r = curr.r + deltas[i].r;
+            int c = curr.c + deltas[i].c;
+
+            if(r < 0 || r >= FIELD_RES_R || c < 0 || c >= FIELD_RES_C)
+                continue;
+            if(affected[r][c] || weights[r][c] == INFINITY)
+                continue;
+            if(intf[r][c] != intf[curr.r][curr.c] + weights[r][c])
+                continue;
+
+            affected[r][c] = true;
+            stack[nstack++] = (struct coord){r, c};
+        }
+    }
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+        if(affected[r][c])
+            intf[r][c] = INFINITY;
+    }}
+
+    /* Then, re-expand the wavefront into the affected tiles from their unaffected 
+     * neighbours, as well as from all the new seeds. 
+     */
+    frontier_t frontier;
+    frontier_init(&frontier);
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        if(seed_set(new_seeds, r, c) && !seed_set(&inout_state->seeds, r, c)) {
+            intf[r][c] = 0.0f;
+            frontier_push(&frontier, 0.0f, (struct coord){r, c});
+            continue;
+        }
+
+        if(affected[r][c] || intf[r][c] == INFINITY)
+            continue;
+
+        for(int i = 0; i < ARR_SIZE(deltas); i++) {
+
+            int nr = r + deltas[i].r;
+            int nc = c + deltas[i].c;
+
+            if(nr < 0 || nr >= FIELD_RES_R || nc < 0 || nc >= FIELD_RES_C)
+                continue;
+            if(!affected[nr][nc])
+                continue;
+
+            frontier_push(&frontier, intf[r][c], (struct coord){r, c});
+            break;
+        }
+    }}
+
+    build_integration_field_wavefront(&frontier, chunk, intf);
+    frontier_destroy(&frontier);
+
+    inout_state->seeds = *new_seeds;
+
+    N_FlowFieldInit(chunk_coord, priv, inout_flow);
+    build_flow_field(intf, inout_flow);
+    fixup_field(inout_flow->target, intf, inout_flow, chunk);
 }
 
 void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc target,
                       const struct nav_private *priv, vec3_t map_pos, 
                       struct LOS_field *out_los, const struct LOS_field *prev_los)
 {
+    NAV_PHASE_START(los_start);
     out_los->chunk = chunk_coord;
     memset(out_los->field, 0x00, sizeof(out_los->field));
-
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
     const struct nav_chunk *chunk = &priv->chunks[chunk_coord.r * priv->width + chunk_coord.c];
 
-    float integration_field[FIELD_RES_R][FIELD_RES_C];
-    for(int r = 0; r < FIELD_RES_R; r++)
-        for(int c = 0; c < FIELD_RES_C; c++)
-            integration_field[r][c] = INFINITY;
+    /* The visible tiles from which the LOS is propagated */
+    struct coord seeds[FIELD_RES_R + FIELD_RES_C];
+    size_t nseeds = 0;
+    bool lines = false;
 
     /* Case 1: LOS for the destination chunk */
     if(chunk_coord.r == target.chunk_r && chunk_coord.c == target.chunk_c) {
 
-        pq_coord_push(&frontier, 0.0f, (struct coord){target.tile_r, target.tile_c});
-        integration_field[target.tile_r][target.tile_c] = 0.0f;
+        seeds[nseeds++] = (struct coord){target.tile_r, target.tile_c};
         assert(NULL == prev_los);
 
     /* Case 2: LOS for a chunk other than the destination chunk 
@@ -917,11 +1463,11 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
 
                     struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, 0, c};
                     create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+                    lines = true;
                 }
                 if(out_los->field[0][c].visible) {
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){0, c});
-                    integration_field[0][c] = 0.0f; 
+                    seeds[nseeds++] = (struct coord){0, c};
                 }
             }
         }else if(prev_los->chunk.r > chunk_coord.r) {
@@ -933,11 +1479,11 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
 
                     struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, FIELD_RES_R-1, c};
                     create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+                    lines = true;
                 }
                 if(out_los->field[FIELD_RES_R-1][c].visible) {
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){FIELD_RES_R-1, c});
-                    integration_field[FIELD_RES_R-1][c] = 0.0f;
+                    seeds[nseeds++] = (struct coord){FIELD_RES_R-1, c};
                 }
             }
         }else if(prev_los->chunk.c < chunk_coord.c) {
@@ -949,11 +1495,11 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
 
                     struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, r, 0};
                     create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+                    lines = true;
                 }
                 if(out_los->field[r][0].visible) {
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){r, 0});
-                    integration_field[r][0] = 0.0f;
+                    seeds[nseeds++] = (struct coord){r, 0};
                 }
             }
         }else if(prev_los->chunk.c > chunk_coord.c) {
@@ -965,11 +1511,11 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
 
                     struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, r, FIELD_RES_C-1};
                     create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
+                    lines = true;
                 }
                 if(out_los->field[r][FIELD_RES_C-1].visible) {
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){r, FIELD_RES_C-1});
-                    integration_field[r][FIELD_RES_C-1] = 0.0f;
+                    seeds[nseeds++] = (struct coord){r, FIELD_RES_C-1};
                 }
             }
         }else{
@@ -977,45 +1523,22 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
         }
     }
 
-    while(pq_size(&frontier) > 0) {
-
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
-
-        struct coord neighbours[8];
-        uint8_t neighbour_costs[8];
-        int num_neighbours = neighbours_grid_LOS(chunk, out_los, curr, neighbours, neighbour_costs);
+    /* Fast path: without any obstructions in the chunk or any blocked lines
+     * carried over from the previous one, every tile is visible. */
+    if(!lines && nseeds > 0 && LOS_chunk_open(chunk)) {
 
-        for(int i = 0; i < num_neighbours; i++) {
-
-            int nr = neighbours[i].r, nc = neighbours[i].c;
-            if(neighbour_costs[i] > 1) {
-                
-                if(!is_LOS_corner(neighbours[i], chunk->cost_base, chunk->blockers))
-                    continue;
-
-                struct tile_desc src_desc = (struct tile_desc) {
-                    .chunk_r = chunk_coord.r,
-                    .chunk_c = chunk_coord.c,
-                    .tile_r = neighbours[i].r,
-                    .tile_c = neighbours[i].c
-                };
-                create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-            }else{
-
-                float new_cost = integration_field[curr.r][curr.c] + 1;
-                out_los->field[nr][nc].visible = 1;
-
-                if(new_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
-
-                    integration_field[nr][nc] = new_cost;
-                    if(!pq_coord_contains(&frontier, neighbours[i]))
-                        pq_coord_push(&frontier, new_cost, neighbours[i]);
-                }
-            }
-        }
+        for(int r = 0; r < FIELD_RES_R; r++)
+            for(int c = 0; c < FIELD_RES_C; c++)
+                out_los->field[r][c].visible = 1;
+        NAV_PHASE_END(los_start, NAV_PHASE_LOS);
+        return;
     }
-    pq_coord_destroy(&frontier);
+
+#if CONFIG_NAV_BITSET_LOS
+    LOS_propagate_bitset(target, chunk_coord, priv, map_pos, seeds, nseeds, out_los);
+#else
+    LOS_propagate_wavefront(target, chunk_coord, priv, map_pos, seeds, nseeds, out_los);
+#endif
 
     /* Add a single tile-wide padding of invisible tiles around the wavefront. This is 
      * because we want to be conservative and not mark any tiles visible from which we
@@ -1023,6 +1546,7 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
      * the ray going over impassable terrain. This is a nice property for the movement
      * code. */
     pad_wavefront(out_los);
+    NAV_PHASE_END(los_start, NAV_PHASE_LOS);
 }
 
 void N_FlowFieldUpdateToNearestPathable(const struct nav_chunk *chunk, struct coord start, 
@@ -1031,8 +1555,8 @@ void N_FlowFieldUpdateToNearestPathable(const struct nav_chunk *chunk, struct co
     struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
     size_t ninit = passable_frontier(chunk, start, init_frontier, ARR_SIZE(init_frontier));
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    frontier_t frontier;
+    frontier_init(&frontier);
 
     float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++)
@@ -1042,7 +1566,7 @@ void N_FlowFieldUpdateToNearestPathable(const struct nav_chunk *chunk, struct co
     for(int i = 0; i < ninit; i++) {
 
         struct coord curr = init_frontier[i];
-        pq_coord_push(&frontier, 0.0f, curr); 
+        frontier_push(&frontier, 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
@@ -1058,7 +1582,7 @@ void N_FlowFieldUpdateToNearestPathable(const struct nav_chunk *chunk, struct co
         inout_flow->field[r][c].dir_idx = flow_dir(integration_field, (struct coord){r, c});
     }}
 
-    pq_coord_destroy(&frontier);
+    frontier_destroy(&frontier);
 }
 
 void N_FlowFieldUpdateIslandToNearest(uint16_t local_iid, const struct nav_private *priv,
@@ -1067,8 +1591,8 @@ void N_FlowFieldUpdateIslandToNearest(uint16_t local_iid, const struct nav_priva
     struct coord chunk_coord = inout_flow->chunk;
     const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    frontier_t frontier;
+    frontier_init(&frontier);
 
     struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
     size_t ninit = initial_frontier(inout_flow->target, chunk, priv, false, init_frontier, ARR_SIZE(init_frontier));
@@ -1123,7 +1647,7 @@ void N_FlowFieldUpdateIslandToNearest(uint16_t local_iid, const struct nav_priva
     for(int i = 0; i < new_ninit; i++) {
 
         struct coord curr = new_init_frontier[i];
-        pq_coord_push(&frontier, 0.0f, curr); 
+        frontier_push(&frontier, 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
@@ -1131,6 +1655,6 @@ void N_FlowFieldUpdateIslandToNearest(uint16_t local_iid, const struct nav_priva
     build_flow_field(integration_field, inout_flow);
     fixup_field(inout_flow->target, integration_field, inout_flow, chunk);
 
-    pq_coord_destroy(&frontier);
+    frontier_destroy(&frontier);
 }
 
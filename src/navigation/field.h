@@ -41,6 +41,7 @@
 #include "../pf_math.h"
 #include "../map/public/tile.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef uint64_t ff_id_t;
 struct nav_private;
@@ -94,6 +95,19 @@ enum flow_dir{
     FD_SE
 };
 
+/* The set of tiles occupied by enemies, which seed an enemy-seeking field. 
+ * Each row is a bitmask, with the bit at index 'c' representing column 'c'. */
+struct enemy_seeds{
+    uint64_t rows[FIELD_RES_R];
+};
+
+/* The data needed for repairing an enemy-seeking field in-place when the 
+ * enemies in the chunk move. */
+struct enemy_field_state{
+    struct enemy_seeds seeds;
+    float              integration[FIELD_RES_R][FIELD_RES_C];
+};
+
 extern vec2_t g_flow_dir_lookup[];
 
 ff_id_t N_FlowField_ID(struct coord chunk, struct field_target target);
@@ -101,6 +115,23 @@ void    N_FlowFieldInit(struct coord chunk_coord, const void *nav_private, struc
 void    N_FlowFieldUpdate(struct coord chunk_coord, const struct nav_private *priv,
                           struct field_target target, struct flow_field *inout_flow);
 
+/* ------------------------------------------------------------------------
+ * Fill in the per-tile inputs for generating the field that would be built
+ * by 'N_FlowFieldUpdate' with a compute shader (see 'struct nav_gpu_batch').
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldGPUInputs(struct coord chunk_coord, const struct nav_private *priv,
+                             struct field_target target, uint32_t out[FIELD_RES_R][FIELD_RES_C]);
+
+/* ------------------------------------------------------------------------
+ * Update the field with the directions generated by the compute shader. The
+ * result is the same as that of 'N_FlowFieldUpdate' for the same target.
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldGPUApply(struct coord chunk_coord, const struct nav_private *priv,
+                            struct field_target target, const uint32_t dirs[FIELD_RES_R][FIELD_RES_C],
+                            struct flow_field *inout_flow);
+
 /* ------------------------------------------------------------------------
  * Update all tiles with a specific local island ID from the
  * 'local_islands' field for the chunk. The new directions will guide to
@@ -123,6 +154,34 @@ void    N_FlowFieldUpdateIslandToNearest(uint16_t local_iid, const struct nav_pr
 void    N_FlowFieldUpdateToNearestPathable(const struct nav_chunk *chunk, struct coord start, 
                                            struct flow_field *inout_flow);
 
+/* ------------------------------------------------------------------------
+ * Get the tiles of the target chunk which are currently occupied by enemies 
+ * of the specified faction. Returns false if there are none.
+ * ------------------------------------------------------------------------
+ */
+bool    N_FlowFieldEnemySeeds(const struct nav_private *priv, const struct enemies_desc *enemies, 
+                              struct enemy_seeds *out);
+
+/* ------------------------------------------------------------------------
+ * Same as 'N_FlowFieldUpdate' for a 'TARGET_ENEMIES' target, but also 
+ * saves the state needed for repairing the field with 'N_FlowFieldRepairEnemies'.
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldUpdateEnemies(struct coord chunk_coord, const struct nav_private *priv,
+                                 struct field_target target, const struct enemy_seeds *seeds,
+                                 struct enemy_field_state *out_state, struct flow_field *inout_flow);
+
+/* ------------------------------------------------------------------------
+ * Bring an enemy-seeking field up to date with the new set of enemy-occupied 
+ * tiles. Only the parts of the integration field which depended on a tile 
+ * whose occupancy changed get recomputed. The result is the same as that of 
+ * building the field from scratch with 'N_FlowFieldUpdateEnemies'.
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldRepairEnemies(struct coord chunk_coord, const struct nav_private *priv,
+                                 const struct enemy_seeds *new_seeds, struct enemy_field_state *inout_state,
+                                 struct flow_field *inout_flow);
+
 /* ------------------------------------------------------------------------
  * Create a line of sight field, indicating which tiles in this chunk are 
  * directly visible from the 'target' tile. If the 'target' tile is not in
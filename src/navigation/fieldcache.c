@@ -34,71 +34,143 @@
  */
 
 #include "fieldcache.h"
-#include "../lib/public/lru_cache.h"
+#include "../lib/public/lru_cache_ts.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/vec.h"
 #include "../event.h"
 #include "../config.h"
+#include "../mem.h"
+
+#include <SDL.h>
 
 #include <assert.h>
 
 
-LRU_CACHE_TYPE(los, struct LOS_field)
-LRU_CACHE_PROTOTYPES(static, los, struct LOS_field)
-LRU_CACHE_IMPL(static, los, struct LOS_field)
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+
+TS_LRU_CACHE_TYPE(los, struct LOS_field)
+TS_LRU_CACHE_PROTOTYPES(static, los, struct LOS_field)
+TS_LRU_CACHE_IMPL(static, los, struct LOS_field)
 
-LRU_CACHE_TYPE(flow, struct flow_field)
-LRU_CACHE_PROTOTYPES(static, flow, struct flow_field)
-LRU_CACHE_IMPL(static, flow, struct flow_field)
+TS_LRU_CACHE_TYPE(flow, struct flow_field)
+TS_LRU_CACHE_PROTOTYPES(static, flow, struct flow_field)
+TS_LRU_CACHE_IMPL(static, flow, struct flow_field)
 
-LRU_CACHE_TYPE(ffid, ff_id_t)
-LRU_CACHE_PROTOTYPES(static, ffid, ff_id_t)
-LRU_CACHE_IMPL(static, ffid, ff_id_t)
+TS_LRU_CACHE_TYPE(ffid, ff_id_t)
+TS_LRU_CACHE_PROTOTYPES(static, ffid, ff_id_t)
+TS_LRU_CACHE_IMPL(static, ffid, ff_id_t)
 
-LRU_CACHE_TYPE(grid_path, struct grid_path_desc)
-LRU_CACHE_PROTOTYPES(static, grid_path, struct grid_path_desc)
-LRU_CACHE_IMPL(static, grid_path, struct grid_path_desc)
+TS_LRU_CACHE_TYPE(grid_path, struct grid_path_desc)
+TS_LRU_CACHE_PROTOTYPES(static, grid_path, struct grid_path_desc)
+TS_LRU_CACHE_IMPL(static, grid_path, struct grid_path_desc)
 
 VEC_TYPE(id, uint64_t)
 VEC_PROTOTYPES(static, id, uint64_t)
 VEC_IMPL(static, id, uint64_t)
 
 KHASH_MAP_INIT_INT64(idvec, vec_id_t)
+KHASH_MAP_INIT_INT(chunkstats, struct fc_chunk_stats)
+
+/* The running totals of the counters that the stats history is built from */
+struct fc_totals{
+    int    query[FC_CACHE_COUNT];
+    int    hit[FC_CACHE_COUNT];
+    int    invalidated[FC_CACHE_COUNT];
+    double compute_ms[FC_CACHE_COUNT];
+};
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static lru(los)          s_los_cache;       /* key: (dest_id, chunk coord) */
-static lru(flow)         s_flow_cache;      /* key: (ffid) */
+static ts_lru(los)       s_los_cache;       /* key: (dest_id, chunk coord) */
+static ts_lru(flow)      s_flow_cache;      /* key: (ffid) */
 /* The ffid cache maps a (dest_id, chunk coordinate) tuple to a flow field ID,
  * which could be used to retreive the relevant field from the flow cache. 
  * The reason for this is that the same flow field chunk can be shared between
  * many different paths. */
-static lru(ffid)         s_ffid_cache;      /* key: (dest_id, chunk_coord) */
-static lru(grid_path)    s_grid_path_cache; /* key: (chunk coord, tile start coord, tile dest coord) */
+static ts_lru(ffid)      s_ffid_cache;      /* key: (dest_id, chunk_coord) */
+static ts_lru(grid_path) s_grid_path_cache; /* key: (chunk coord, tile start coord, tile dest coord) */
 
 /* The following structures are maintained for efficient invalidation of entries:*/
 static khash_t(idvec)   *s_chunk_ffield_map; /* key: (chunk coord) */
 static khash_t(idvec)   *s_chunk_lfield_map; /* key: (chunk coord) */
+static SDL_SpinLock      s_field_map_lock;
+/* Bumped whenever a flow field or a mapping is added, replaced or removed. 
+ * Flow field pointers obtained under one generation stay valid for as long 
+ * as it is current. */
+static SDL_atomic_t      s_ff_generation;
 
+/* The cache may be queried from many threads at once */
 static struct priv_fc_stats{
-    unsigned los_query;
-    unsigned los_hit;
-    unsigned los_invalidated;
-    unsigned flow_query;
-    unsigned flow_hit;
-    unsigned flow_invalidated;
-    unsigned ffid_query;
-    unsigned ffid_hit;
-    unsigned grid_path_query;
-    unsigned grid_path_hit;
+    SDL_atomic_t los_query;
+    SDL_atomic_t los_hit;
+    SDL_atomic_t los_invalidated;
+    SDL_atomic_t flow_query;
+    SDL_atomic_t flow_hit;
+    SDL_atomic_t flow_invalidated;
+    SDL_atomic_t ffid_query;
+    SDL_atomic_t ffid_hit;
+    SDL_atomic_t grid_path_query;
+    SDL_atomic_t grid_path_hit;
+    SDL_atomic_t path_query;
+    SDL_atomic_t path_coalesced;
 }s_perfstats = {0};
 
+/* Milliseconds of computation avoided thanks to cache hits */
+static struct fc_time_saved{
+    double los;
+    double flow;
+    double grid_path;
+}s_time_saved = {0};
+/* Milliseconds spent computing the entries that were put into the caches */
+static double            s_compute_ms[FC_CACHE_COUNT];
+/* Protects both 's_time_saved' and 's_compute_ms' */
+static SDL_SpinLock      s_time_saved_lock;
+/* Only touched from the main thread */
+static double            s_update_ms = 0.0;
+static size_t            s_tracked_bytes = 0;
+/* The history is a ring of the last CONFIG_FC_HISTORY_LEN complete windows. 
+ * The counts of the current window are the difference between the running 
+ * totals and their values at the start of the window, plus whatever was 
+ * carried over from before the totals were last reset. */
+static struct fc_window  s_history[CONFIG_FC_HISTORY_LEN];
+static size_t            s_history_head = 0;
+static size_t            s_history_size = 0;
+static int               s_window_updates = 0;
+static struct fc_totals  s_window_base;
+static struct fc_window  s_window_carry;
+/* key: (chunk coord) */
+static khash_t(chunkstats) *s_chunk_stats;
+static unsigned          s_chunk_max_invalidated = 0;
+static SDL_SpinLock      s_chunk_stats_lock;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static void ff_generation_bump(void)
+{
+    /* Zero is never a valid generation */
+    if(SDL_AtomicAdd(&s_ff_generation, 1) == -1)
+        SDL_AtomicAdd(&s_ff_generation, 1);
+}
+
+/* The nodes of the caches are allocated as they are filled, so the memory 
+ * held by them is brought up to date with the accounting periodically. */
+static void fc_track_mem(void)
+{
+    size_t bytes = ts_lru_los_used(&s_los_cache) * sizeof(struct LOS_field)
+                 + ts_lru_flow_used(&s_flow_cache) * sizeof(struct flow_field)
+                 + ts_lru_ffid_used(&s_ffid_cache) * sizeof(ff_id_t)
+                 + ts_lru_grid_path_used(&s_grid_path_cache) * sizeof(struct grid_path_desc);
+
+    Mem_Track(MEM_TAG_FIELDCACHE, (ptrdiff_t)bytes - (ptrdiff_t)s_tracked_bytes);
+    s_tracked_bytes = bytes;
+}
+
 uint32_t key_for_chunk(struct coord chunk)
 {
     return (((uint64_t)chunk.r & 0xffff) << 16) | ((uint64_t)chunk.c & 0xffff);
@@ -133,6 +205,110 @@ uint64_t grid_path_key(struct coord local_start, struct coord local_dest,
          |  (( ((uint64_t)chunk.c)       & 0xffff) << 48));
 }
 
+static struct coord ffid_chunk(ff_id_t ffid)
+{
+    return (struct coord){(ffid >> 8) & 0xff, ffid & 0xff};
+}
+
+static void chunk_stats_note(struct coord chunk, unsigned built, unsigned invalidated)
+{
+    if(!built && !invalidated)
+        return;
+
+    uint32_t key = key_for_chunk(chunk);
+    SDL_AtomicLock(&s_chunk_stats_lock);
+
+    khiter_t k = kh_get(chunkstats, s_chunk_stats, key);
+    if(k == kh_end(s_chunk_stats)) {
+
+        int ret;
+        k = kh_put(chunkstats, s_chunk_stats, key, &ret);
+        if(ret == -1)
+            goto out;
+        kh_val(s_chunk_stats, k) = (struct fc_chunk_stats){chunk.r, chunk.c, 0, 0};
+    }
+
+    struct fc_chunk_stats *stats = &kh_val(s_chunk_stats, k);
+    stats->built += built;
+    stats->invalidated += invalidated;
+    s_chunk_max_invalidated = MAX(s_chunk_max_invalidated, stats->invalidated);
+out:
+    SDL_AtomicUnlock(&s_chunk_stats_lock);
+}
+
+static void add_compute_ms(enum fc_cache cache, float ms)
+{
+    SDL_AtomicLock(&s_time_saved_lock);
+    s_compute_ms[cache] += ms;
+    SDL_AtomicUnlock(&s_time_saved_lock);
+}
+
+static void get_totals(struct fc_totals *out)
+{
+    *out = (struct fc_totals){
+        .query = {
+            [FC_CACHE_LOS]       = SDL_AtomicGet(&s_perfstats.los_query),
+            [FC_CACHE_FLOW]      = SDL_AtomicGet(&s_perfstats.flow_query),
+            [FC_CACHE_FFID]      = SDL_AtomicGet(&s_perfstats.ffid_query),
+            [FC_CACHE_GRID_PATH] = SDL_AtomicGet(&s_perfstats.grid_path_query),
+        },
+        .hit = {
+            [FC_CACHE_LOS]       = SDL_AtomicGet(&s_perfstats.los_hit),
+            [FC_CACHE_FLOW]      = SDL_AtomicGet(&s_perfstats.flow_hit),
+            [FC_CACHE_FFID]      = SDL_AtomicGet(&s_perfstats.ffid_hit),
+            [FC_CACHE_GRID_PATH] = SDL_AtomicGet(&s_perfstats.grid_path_hit),
+        },
+        .invalidated = {
+            [FC_CACHE_LOS]       = SDL_AtomicGet(&s_perfstats.los_invalidated),
+            [FC_CACHE_FLOW]      = SDL_AtomicGet(&s_perfstats.flow_invalidated),
+        },
+    };
+
+    SDL_AtomicLock(&s_time_saved_lock);
+    memcpy(out->compute_ms, s_compute_ms, sizeof(s_compute_ms));
+    SDL_AtomicUnlock(&s_time_saved_lock);
+}
+
+/* The counts of the current window, so far */
+static void window_counts(struct fc_window *out)
+{
+    struct fc_totals curr;
+    get_totals(&curr);
+
+    for(int i = 0; i < FC_CACHE_COUNT; i++) {
+
+        const struct fc_cache_window *carry = &s_window_carry.caches[i];
+        int hits = curr.hit[i] - s_window_base.hit[i];
+        int queries = curr.query[i] - s_window_base.query[i];
+
+        out->caches[i] = (struct fc_cache_window){
+            .hits        = carry->hits + hits,
+            .misses      = carry->misses + (queries - hits),
+            .invalidated = carry->invalidated + (curr.invalidated[i] - s_window_base.invalidated[i]),
+            .compute_ms  = carry->compute_ms + (curr.compute_ms[i] - s_window_base.compute_ms[i]),
+        };
+    }
+}
+
+static void history_advance(void)
+{
+    if(++s_window_updates < CONFIG_FC_HISTORY_WINDOW)
+        return;
+
+    size_t idx = (s_history_head + s_history_size) % CONFIG_FC_HISTORY_LEN;
+    window_counts(&s_history[idx]);
+
+    if(s_history_size < CONFIG_FC_HISTORY_LEN) {
+        s_history_size++;
+    }else{
+        s_history_head = (s_history_head + 1) % CONFIG_FC_HISTORY_LEN;
+    }
+
+    get_totals(&s_window_base);
+    memset(&s_window_carry, 0, sizeof(s_window_carry));
+    s_window_updates = 0;
+}
+
 static void on_grid_path_evict(struct grid_path_desc *victim)
 {
     vec_coord_destroy(&victim->path);
@@ -169,6 +345,13 @@ static void field_map_add(khash_t(idvec) *hash, uint64_t key, uint64_t id)
     }
 }
 
+static void add_time_saved(double *counter, float ms)
+{
+    SDL_AtomicLock(&s_time_saved_lock);
+    *counter += ms;
+    SDL_AtomicUnlock(&s_time_saved_lock);
+}
+
 static bool dest_array_contains(dest_id_t *array, size_t size, dest_id_t item)
 {
     for(int i = 0; i < size; i++) {
@@ -178,22 +361,66 @@ static bool dest_array_contains(dest_id_t *array, size_t size, dest_id_t item)
     return false;
 }
 
+static void invalidate_paths(dest_id_t *paths, size_t npaths)
+{
+    uint64_t key;
+
+    /* Find and remove all the flow fields belonging to the paths */
+    struct flow_field ff_val;
+    TS_LRU_FOREACH_SAFE_REMOVE(flow, &s_flow_cache, key, ff_val, {
+    
+        (void)ff_val;
+        dest_id_t curr_dest = key_dest(key);
+
+        if(dest_array_contains(paths, npaths, curr_dest)) {
+        
+            bool found = ts_lru_flow_remove(&s_flow_cache, key);
+            SDL_AtomicAdd(&s_perfstats.flow_invalidated, !!found);
+            chunk_stats_note(ffid_chunk(key), 0, !!found);
+        }
+    });
+
+    /* And remove all the LOS fields as well */
+    struct LOS_field los_val;
+    TS_LRU_FOREACH_SAFE_REMOVE(los, &s_los_cache, key, los_val, {
+
+        (void)los_val;
+        dest_id_t curr_dest = key_dest(key);
+
+        if(dest_array_contains(paths, npaths, curr_dest)) {
+        
+            bool found = ts_lru_los_remove(&s_los_cache, key);
+            SDL_AtomicAdd(&s_perfstats.los_invalidated, !!found);
+            chunk_stats_note(key_chunk(key), 0, !!found);
+        }
+    });
+}
+
+static bool id_vec_contains(const vec_id_t *vec, uint64_t id)
+{
+    for(int i = 0; i < vec_size(vec); i++) {
+        if(vec_AT(vec, i) == id)
+            return true;
+    }
+    return false;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 bool N_FC_Init(void)
 {
-    if(!lru_los_init(&s_los_cache, CONFIG_LOS_CACHE_SZ, NULL))
+    if(!ts_lru_los_init(&s_los_cache, CONFIG_LOS_CACHE_SZ, NULL))
         goto fail_los;
 
-    if(!lru_flow_init(&s_flow_cache, CONFIG_FLOW_CAHCE_SZ, NULL))
+    if(!ts_lru_flow_init(&s_flow_cache, CONFIG_FLOW_CAHCE_SZ, NULL))
         goto fail_flow;
 
-    if(!lru_ffid_init(&s_ffid_cache, CONFIG_MAPPING_CACHE_SZ, NULL))
+    if(!ts_lru_ffid_init(&s_ffid_cache, CONFIG_MAPPING_CACHE_SZ, NULL))
         goto fail_ffid;
 
-    if(!lru_grid_path_init(&s_grid_path_cache, CONFIG_GRID_PATH_CACHE_SZ, on_grid_path_evict))
+    if(!ts_lru_grid_path_init(&s_grid_path_cache, CONFIG_GRID_PATH_CACHE_SZ, on_grid_path_evict))
         goto fail_grid_path;
 
     if(NULL == (s_chunk_ffield_map = kh_init(idvec)))
@@ -202,161 +429,328 @@ bool N_FC_Init(void)
     if(NULL == (s_chunk_lfield_map = kh_init(idvec)))
         goto fail_chunk_lfield;
 
+    if(NULL == (s_chunk_stats = kh_init(chunkstats)))
+        goto fail_chunk_stats;
+
+#if CONFIG_FIELD_CACHE_COST_AWARE
+    ts_lru_los_set_policy(&s_los_cache, LRU_POLICY_COST);
+    ts_lru_flow_set_policy(&s_flow_cache, LRU_POLICY_COST);
+    ts_lru_grid_path_set_policy(&s_grid_path_cache, LRU_POLICY_COST);
+#endif
+    SDL_AtomicSet(&s_ff_generation, 1);
     return true;
 
+fail_chunk_stats:
+    kh_destroy(idvec, s_chunk_lfield_map);
 fail_chunk_lfield:
     kh_destroy(idvec, s_chunk_ffield_map);
 fail_chunk_ffield:
-    lru_grid_path_destroy(&s_grid_path_cache);
+    ts_lru_grid_path_destroy(&s_grid_path_cache);
 fail_grid_path:
-    lru_ffid_destroy(&s_ffid_cache);
+    ts_lru_ffid_destroy(&s_ffid_cache);
 fail_ffid:
-    lru_flow_destroy(&s_flow_cache);
+    ts_lru_flow_destroy(&s_flow_cache);
 fail_flow:
-    lru_los_destroy(&s_los_cache);
+    ts_lru_los_destroy(&s_los_cache);
 fail_los:
     return false;
 }
 
 void N_FC_Shutdown(void)
 {
-    lru_los_destroy(&s_los_cache);
-    lru_flow_destroy(&s_flow_cache);
-    lru_ffid_destroy(&s_ffid_cache);
-    lru_grid_path_destroy(&s_grid_path_cache);
+    Mem_Track(MEM_TAG_FIELDCACHE, -(ptrdiff_t)s_tracked_bytes);
+    s_tracked_bytes = 0;
+
+    ts_lru_los_destroy(&s_los_cache);
+    ts_lru_flow_destroy(&s_flow_cache);
+    ts_lru_ffid_destroy(&s_ffid_cache);
+    ts_lru_grid_path_destroy(&s_grid_path_cache);
 
     destroy_all_entries(s_chunk_ffield_map);
     kh_destroy(idvec, s_chunk_ffield_map);
 
     destroy_all_entries(s_chunk_lfield_map);
     kh_destroy(idvec, s_chunk_lfield_map);
+
+    kh_destroy(chunkstats, s_chunk_stats);
 }
 
 void N_FC_ClearAll(void)
 {
-    lru_los_clear(&s_los_cache);
-    lru_flow_clear(&s_flow_cache);
-    lru_ffid_clear(&s_ffid_cache);
-    lru_grid_path_clear(&s_grid_path_cache);
+    ff_generation_bump();
+    ts_lru_los_clear(&s_los_cache);
+    ts_lru_flow_clear(&s_flow_cache);
+    ts_lru_ffid_clear(&s_ffid_cache);
+    ts_lru_grid_path_clear(&s_grid_path_cache);
+
+    SDL_AtomicLock(&s_field_map_lock);
 
     destroy_all_entries(s_chunk_ffield_map);
     kh_clear(idvec, s_chunk_ffield_map);
 
     destroy_all_entries(s_chunk_lfield_map);
     kh_clear(idvec, s_chunk_lfield_map);
+
+    SDL_AtomicUnlock(&s_field_map_lock);
+
+    SDL_AtomicLock(&s_chunk_stats_lock);
+    kh_clear(chunkstats, s_chunk_stats);
+    s_chunk_max_invalidated = 0;
+    SDL_AtomicUnlock(&s_chunk_stats_lock);
 }
 
 void N_FC_ClearStats(void)
 {
+    /* Carry the current window's counts over the reset of the totals */
+    window_counts(&s_window_carry);
+    memset(&s_window_base, 0, sizeof(s_window_base));
+
     memset(&s_perfstats, 0, sizeof(s_perfstats));
+
+    SDL_AtomicLock(&s_time_saved_lock);
+    memset(&s_time_saved, 0, sizeof(s_time_saved));
+    memset(&s_compute_ms, 0, sizeof(s_compute_ms));
+    SDL_AtomicUnlock(&s_time_saved_lock);
+    s_update_ms = 0.0;
 }
 
 void N_FC_GetStats(struct fc_stats *out_stats)
 {
-    out_stats->los_used = s_los_cache.used;
-    out_stats->los_max = s_los_cache.capacity;
-    out_stats->los_hit_rate = !s_perfstats.los_query ? 0
-        : ((float)s_perfstats.los_hit) / s_perfstats.los_query;
-    out_stats->los_invalidated = s_perfstats.los_invalidated;
+    struct fc_counts{
+        int los_query, los_hit, los_invalidated;
+        int flow_query, flow_hit, flow_invalidated;
+        int ffid_query, ffid_hit;
+        int grid_path_query, grid_path_hit;
+        int path_query, path_coalesced;
+    }c = {
+        SDL_AtomicGet(&s_perfstats.los_query),
+        SDL_AtomicGet(&s_perfstats.los_hit),
+        SDL_AtomicGet(&s_perfstats.los_invalidated),
+        SDL_AtomicGet(&s_perfstats.flow_query),
+        SDL_AtomicGet(&s_perfstats.flow_hit),
+        SDL_AtomicGet(&s_perfstats.flow_invalidated),
+        SDL_AtomicGet(&s_perfstats.ffid_query),
+        SDL_AtomicGet(&s_perfstats.ffid_hit),
+        SDL_AtomicGet(&s_perfstats.grid_path_query),
+        SDL_AtomicGet(&s_perfstats.grid_path_hit),
+        SDL_AtomicGet(&s_perfstats.path_query),
+        SDL_AtomicGet(&s_perfstats.path_coalesced),
+    };
+
+    out_stats->los_used = ts_lru_los_used(&s_los_cache);
+    out_stats->los_max = ts_lru_los_capacity(&s_los_cache);
+    out_stats->los_hit_rate = !c.los_query ? 0
+        : ((float)c.los_hit) / c.los_query;
+    out_stats->los_invalidated = c.los_invalidated;
+
+    out_stats->flow_used = ts_lru_flow_used(&s_flow_cache);
+    out_stats->flow_max = ts_lru_flow_capacity(&s_flow_cache);
+    out_stats->flow_hit_rate = !c.flow_query ? 0
+        : ((float)c.flow_hit) / c.flow_query;
+    out_stats->flow_invalidated = c.flow_invalidated;
+
+    out_stats->ffid_used = ts_lru_ffid_used(&s_ffid_cache);
+    out_stats->ffid_max = ts_lru_ffid_capacity(&s_ffid_cache);
+    out_stats->ffid_hit_rate = !c.ffid_hit ? 0
+        : ((float)c.ffid_hit) / c.ffid_query;
+
+    out_stats->grid_path_used = ts_lru_grid_path_used(&s_grid_path_cache);
+    out_stats->grid_path_max = ts_lru_grid_path_capacity(&s_grid_path_cache);
+    out_stats->grid_path_hit_rate = !c.grid_path_hit ? 0
+        : ((float)c.grid_path_hit) / c.grid_path_query;
+
+    out_stats->path_requests = c.path_query;
+    out_stats->path_coalesce_ratio = !c.path_query ? 0
+        : ((float)c.path_coalesced) / c.path_query;
+
+    SDL_AtomicLock(&s_time_saved_lock);
+    out_stats->los_time_saved = s_time_saved.los;
+    out_stats->flow_time_saved = s_time_saved.flow;
+    out_stats->grid_path_time_saved = s_time_saved.grid_path;
+    SDL_AtomicUnlock(&s_time_saved_lock);
+
+    out_stats->update_ms = s_update_ms;
+}
+
+void N_FC_NotePathRequest(bool coalesced)
+{
+    SDL_AtomicAdd(&s_perfstats.path_query, 1);
+    SDL_AtomicAdd(&s_perfstats.path_coalesced, !!coalesced);
+}
 
-    out_stats->flow_used = s_flow_cache.used;
-    out_stats->flow_max = s_flow_cache.capacity;
-    out_stats->flow_hit_rate = !s_perfstats.flow_query ? 0
-        : ((float)s_perfstats.flow_hit) / s_perfstats.flow_query;
-    out_stats->flow_invalidated = s_perfstats.flow_invalidated;
+void N_FC_NoteUpdate(float ms)
+{
+    s_update_ms += ms;
+    fc_track_mem();
+    history_advance();
+}
 
-    out_stats->ffid_used = s_ffid_cache.used;
-    out_stats->ffid_max = s_ffid_cache.capacity;
-    out_stats->ffid_hit_rate = !s_perfstats.ffid_hit ? 0
-        : ((float)s_perfstats.ffid_hit) / s_perfstats.ffid_query;
+size_t N_FC_GetHistory(size_t maxout, struct fc_window *out)
+{
+    size_t ret = MIN(maxout, s_history_size);
+    size_t first = s_history_size - ret;
 
-    out_stats->grid_path_used = s_grid_path_cache.used;
-    out_stats->grid_path_max = s_grid_path_cache.capacity;
-    out_stats->grid_path_hit_rate = !s_perfstats.grid_path_hit ? 0
-        : ((float)s_perfstats.grid_path_hit) / s_perfstats.grid_path_query;
+    for(int i = 0; i < ret; i++) {
+        out[i] = s_history[(s_history_head + first + i) % CONFIG_FC_HISTORY_LEN];
+    }
+    return ret;
+}
+
+size_t N_FC_GetChunkStats(size_t maxout, struct fc_chunk_stats *out)
+{
+    size_t ret = 0;
+    uint32_t key;
+    struct fc_chunk_stats curr;
+    (void)key;
+
+    SDL_AtomicLock(&s_chunk_stats_lock);
+    kh_foreach(s_chunk_stats, key, curr, {
+        if(ret == maxout)
+            break;
+        out[ret++] = curr;
+    });
+    SDL_AtomicUnlock(&s_chunk_stats_lock);
+    return ret;
+}
+
+bool N_FC_ChunkStatsAt(struct coord chunk, struct fc_chunk_stats *out, unsigned *out_max_invalidated)
+{
+    bool ret = false;
+    SDL_AtomicLock(&s_chunk_stats_lock);
+
+    khiter_t k = kh_get(chunkstats, s_chunk_stats, key_for_chunk(chunk));
+    if(k != kh_end(s_chunk_stats)) {
+        *out = kh_val(s_chunk_stats, k);
+        *out_max_invalidated = s_chunk_max_invalidated;
+        ret = true;
+    }
+
+    SDL_AtomicUnlock(&s_chunk_stats_lock);
+    return ret;
+}
+
+float N_FC_ElapsedMs(uint64_t start_counter)
+{
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start_counter;
+    return (elapsed * 1000.0) / SDL_GetPerformanceFrequency();
 }
 
 bool N_FC_ContainsLOSField(dest_id_t id, struct coord chunk_coord)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    bool ret = lru_los_contains(&s_los_cache, key);
+    bool ret = ts_lru_los_contains(&s_los_cache, key);
 
-    s_perfstats.los_query++;
-    s_perfstats.los_hit += !!ret;
+    SDL_AtomicAdd(&s_perfstats.los_query, 1);
+    SDL_AtomicAdd(&s_perfstats.los_hit, !!ret);
+    if(ret) {
+        add_time_saved(&s_time_saved.los, ts_lru_los_cost(&s_los_cache, key));
+    }
     return ret;
 }
 
 const struct LOS_field *N_FC_LOSFieldAt(dest_id_t id, struct coord chunk_coord)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    return lru_los_at(&s_los_cache, key);
+    return ts_lru_los_at(&s_los_cache, key);
 }
 
-void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_field *lf)
+void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_field *lf, 
+                      float cost)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    lru_los_put(&s_los_cache, key, lf);
+    ts_lru_los_put_cost(&s_los_cache, key, lf, cost);
+
+    SDL_AtomicLock(&s_field_map_lock);
     field_map_add(s_chunk_lfield_map, key_for_chunk(chunk_coord), key);
+    SDL_AtomicUnlock(&s_field_map_lock);
+
+    add_compute_ms(FC_CACHE_LOS, cost);
+    chunk_stats_note(chunk_coord, 1, 0);
 }
 
 bool N_FC_ContainsFlowField(ff_id_t ffid)
 {
-    bool ret = lru_flow_contains(&s_flow_cache, ffid);
+    bool ret = ts_lru_flow_contains(&s_flow_cache, ffid);
 
-    s_perfstats.flow_query++;
-    s_perfstats.flow_hit += !!ret;
+    SDL_AtomicAdd(&s_perfstats.flow_query, 1);
+    SDL_AtomicAdd(&s_perfstats.flow_hit, !!ret);
+    if(ret) {
+        add_time_saved(&s_time_saved.flow, ts_lru_flow_cost(&s_flow_cache, ffid));
+    }
     return ret;
 }
 
 const struct flow_field *N_FC_FlowFieldAt(ff_id_t ffid)
 {
-    return lru_flow_at(&s_flow_cache, ffid);
+    return ts_lru_flow_at(&s_flow_cache, ffid);
+}
+
+float N_FC_FlowFieldCost(ff_id_t ffid)
+{
+    return ts_lru_flow_cost(&s_flow_cache, ffid);
 }
 
-void N_FC_PutFlowField(ff_id_t ffid, const struct flow_field *ff)
+uint32_t N_FC_FlowFieldGeneration(void)
 {
-    lru_flow_put(&s_flow_cache, ffid, ff);
+    return (uint32_t)SDL_AtomicGet(&s_ff_generation);
+}
+
+void N_FC_PutFlowField(ff_id_t ffid, const struct flow_field *ff, float cost)
+{
+    ff_generation_bump();
+    ts_lru_flow_put_cost(&s_flow_cache, ffid, ff, cost);
 
-    struct coord chunk = (struct coord){(ffid >> 8) & 0xff, ffid & 0xff};
+    struct coord chunk = ffid_chunk(ffid);
+    SDL_AtomicLock(&s_field_map_lock);
     field_map_add(s_chunk_ffield_map, key_for_chunk(chunk), ffid);
+    SDL_AtomicUnlock(&s_field_map_lock);
+
+    add_compute_ms(FC_CACHE_FLOW, cost);
+    chunk_stats_note(chunk, 1, 0);
 }
 
 bool N_FC_GetDestFFMapping(dest_id_t id, struct coord chunk_coord, ff_id_t *out_ff)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    bool ret = lru_ffid_get(&s_ffid_cache, key, out_ff);
+    bool ret = ts_lru_ffid_get(&s_ffid_cache, key, out_ff);
 
-    s_perfstats.ffid_query++;
-    s_perfstats.ffid_hit += !!ret;
+    SDL_AtomicAdd(&s_perfstats.ffid_query, 1);
+    SDL_AtomicAdd(&s_perfstats.ffid_hit, !!ret);
     return ret;
 }
 
 void N_FC_PutDestFFMapping(dest_id_t dest_id, struct coord chunk_coord, ff_id_t ffid)
 {
     uint64_t key = key_for_dest_and_chunk(dest_id, chunk_coord);
-    lru_ffid_put(&s_ffid_cache, key, &ffid);
+    ff_generation_bump();
+    ts_lru_ffid_put(&s_ffid_cache, key, &ffid);
 }
 
 bool N_FC_GetGridPath(struct coord local_start, struct coord local_dest,
                       struct coord chunk, struct grid_path_desc *out)
 {
     uint64_t key = grid_path_key(local_start, local_dest, chunk);
-    bool ret = lru_grid_path_get(&s_grid_path_cache, key, out);
+    bool ret = ts_lru_grid_path_get(&s_grid_path_cache, key, out);
 
-    s_perfstats.grid_path_query++;
-    s_perfstats.grid_path_hit += !!ret;
+    SDL_AtomicAdd(&s_perfstats.grid_path_query, 1);
+    SDL_AtomicAdd(&s_perfstats.grid_path_hit, !!ret);
+    if(ret) {
+        add_time_saved(&s_time_saved.grid_path, ts_lru_grid_path_cost(&s_grid_path_cache, key));
+    }
     return ret;
 }
 
 void N_FC_PutGridPath(struct coord local_start, struct coord local_dest,
-                      struct coord chunk, const struct grid_path_desc *in)
+                      struct coord chunk, const struct grid_path_desc *in, float cost)
 {
     uint64_t key = grid_path_key(local_start, local_dest, chunk);
-    lru_grid_path_put(&s_grid_path_cache, key, in);
+    ts_lru_grid_path_put_cost(&s_grid_path_cache, key, in, cost);
+    add_compute_ms(FC_CACHE_GRID_PATH, cost);
 }
 
 void N_FC_InvalidateAllAtChunk(struct coord chunk)
 {
+    ff_generation_bump();
     /* Note that chunk:field maps simply maintain a list of cache keys for 
      * which entries were set. The entries for these keys may have already 
      * been evicted. As well, keys for which data has been overwritten may
@@ -364,14 +758,17 @@ void N_FC_InvalidateAllAtChunk(struct coord chunk)
      * necessarily be in the caches. */
 
     uint64_t key = key_for_chunk(chunk);
+    unsigned ninvalidated = 0;
+    SDL_AtomicLock(&s_field_map_lock);
 
     khiter_t k = kh_get(idvec, s_chunk_lfield_map, key);
     if(k != kh_end(s_chunk_lfield_map)) {
 
         vec_id_t *keys = &kh_val(s_chunk_lfield_map, k);
         for(int i = 0; i < vec_size(keys); i++) {
-            bool found = lru_los_remove(&s_los_cache, vec_AT(keys, i));
-            s_perfstats.los_invalidated += !!found;
+            bool found = ts_lru_los_remove(&s_los_cache, vec_AT(keys, i));
+            SDL_AtomicAdd(&s_perfstats.los_invalidated, !!found);
+            ninvalidated += !!found;
         }
         vec_id_destroy(keys);
         kh_del(idvec, s_chunk_lfield_map, k);
@@ -382,16 +779,21 @@ void N_FC_InvalidateAllAtChunk(struct coord chunk)
 
         vec_id_t *keys = &kh_val(s_chunk_ffield_map, k);
         for(int i = 0; i < vec_size(keys); i++) {
-            bool found = lru_flow_remove(&s_flow_cache, vec_AT(keys, i));
-            s_perfstats.flow_invalidated += !!found;
+            bool found = ts_lru_flow_remove(&s_flow_cache, vec_AT(keys, i));
+            SDL_AtomicAdd(&s_perfstats.flow_invalidated, !!found);
+            ninvalidated += !!found;
         }
         vec_id_destroy(keys);
         kh_del(idvec, s_chunk_ffield_map, k);
     }
+
+    SDL_AtomicUnlock(&s_field_map_lock);
+    chunk_stats_note(chunk, 0, ninvalidated);
 }
 
 void N_FC_InvalidateAllThroughChunk(struct coord chunk)
 {
+    ff_generation_bump();
     dest_id_t paths[CONFIG_FLOW_CAHCE_SZ];
     size_t npaths = 0;
 
@@ -400,7 +802,7 @@ void N_FC_InvalidateAllThroughChunk(struct coord chunk)
 
     /* Make sure not to actually query the caches, in order to not mess up the age history */
     /* First find all the paths going through the chunk. */
-    LRU_FOREACH_SAFE_REMOVE(ffid, &s_ffid_cache, key, ffid_val, {
+    TS_LRU_FOREACH_SAFE_REMOVE(ffid, &s_ffid_cache, key, ffid_val, {
 
         (void)ffid_val;
         dest_id_t curr_dest = key_dest(key);
@@ -413,33 +815,123 @@ void N_FC_InvalidateAllThroughChunk(struct coord chunk)
         }
     });
 
-    /* Now that we know all the paths, find and remove all the flow 
-     * fields belonging to them */
-    struct flow_field ff_val;
-    LRU_FOREACH_SAFE_REMOVE(flow, &s_flow_cache, key, ff_val, {
-    
-        (void)ff_val;
-        dest_id_t curr_dest = key_dest(key);
+    invalidate_paths(paths, npaths);
+}
 
-        if(dest_array_contains(paths, npaths, curr_dest)) {
-        
-            bool found = lru_flow_remove(&s_flow_cache, key);
-            s_perfstats.flow_invalidated += !!found;
+void N_FC_InvalidateAtChunkIf(struct coord chunk, bool through,
+                              bool (*los_pred)(const struct LOS_field*, void*),
+                              bool (*flow_pred)(const struct flow_field*, void*),
+                              void *arg)
+{
+    ff_generation_bump();
+    dest_id_t paths[CONFIG_FLOW_CAHCE_SZ];
+    size_t npaths = 0;
+
+    vec_id_t removed_flows;
+    vec_id_init(&removed_flows);
+    unsigned ninvalidated = 0;
+
+    /* Peek at the entries so that the age history is not disturbed. Keys 
+     * of entries that are no longer in the cache are dropped from the lists. */
+    uint64_t key = key_for_chunk(chunk);
+    SDL_AtomicLock(&s_field_map_lock);
+
+    khiter_t k = kh_get(idvec, s_chunk_lfield_map, key);
+    if(k != kh_end(s_chunk_lfield_map)) {
+
+        vec_id_t *keys = &kh_val(s_chunk_lfield_map, k);
+        vec_id_t kept;
+        vec_id_init(&kept);
+
+        for(int i = 0; i < vec_size(keys); i++) {
+
+            uint64_t curr = vec_AT(keys, i);
+            const struct LOS_field *lf = ts_lru_los_peek(&s_los_cache, curr);
+            if(!lf)
+                continue;
+
+            if(!los_pred(lf, arg)) {
+                vec_id_push(&kept, curr);
+                continue;
+            }
+
+            bool found = ts_lru_los_remove(&s_los_cache, curr);
+            SDL_AtomicAdd(&s_perfstats.los_invalidated, !!found);
+            ninvalidated += !!found;
+
+            dest_id_t curr_dest = key_dest(curr);
+            if(through 
+            && npaths < ARR_SIZE(paths)
+            && !dest_array_contains(paths, npaths, curr_dest)) {
+                paths[npaths++] = curr_dest;
+            }
         }
-    });
+        vec_id_destroy(keys);
+        if(vec_size(&kept) > 0) {
+            *keys = kept;
+        }else{
+            vec_id_destroy(&kept);
+            kh_del(idvec, s_chunk_lfield_map, k);
+        }
+    }
 
-    /* And remove all the LOS fields as well */
-    struct LOS_field los_val;
-    LRU_FOREACH_SAFE_REMOVE(los, &s_los_cache, key, los_val, {
+    k = kh_get(idvec, s_chunk_ffield_map, key);
+    if(k != kh_end(s_chunk_ffield_map)) {
 
-        (void)los_val;
-        dest_id_t curr_dest = key_dest(key);
+        vec_id_t *keys = &kh_val(s_chunk_ffield_map, k);
+        vec_id_t kept;
+        vec_id_init(&kept);
 
-        if(dest_array_contains(paths, npaths, curr_dest)) {
-        
-            bool found = lru_los_remove(&s_los_cache, key);
-            s_perfstats.los_invalidated += !!found;
+        for(int i = 0; i < vec_size(keys); i++) {
+
+            uint64_t curr = vec_AT(keys, i);
+            const struct flow_field *ff = ts_lru_flow_peek(&s_flow_cache, curr);
+            if(!ff)
+                continue;
+
+            if(!flow_pred(ff, arg)) {
+                vec_id_push(&kept, curr);
+                continue;
+            }
+
+            bool found = ts_lru_flow_remove(&s_flow_cache, curr);
+            SDL_AtomicAdd(&s_perfstats.flow_invalidated, !!found);
+            ninvalidated += !!found;
+            vec_id_push(&removed_flows, curr);
         }
-    });
+        vec_id_destroy(keys);
+        if(vec_size(&kept) > 0) {
+            *keys = kept;
+        }else{
+            vec_id_destroy(&kept);
+            kh_del(idvec, s_chunk_ffield_map, k);
+        }
+    }
+
+    SDL_AtomicUnlock(&s_field_map_lock);
+    chunk_stats_note(chunk, 0, ninvalidated);
+
+    if(through && vec_size(&removed_flows) > 0) {
+
+        /* Find the paths that were routed through one of the damaged fields */
+        ff_id_t ffid_val;
+        TS_LRU_FOREACH_SAFE_REMOVE(ffid, &s_ffid_cache, key, ffid_val, {
+
+            dest_id_t curr_dest = key_dest(key);
+            struct coord curr_chunk = key_chunk(key);
+
+            if(0 == memcmp(&curr_chunk, &chunk, sizeof(chunk))
+            && npaths < ARR_SIZE(paths)
+            && id_vec_contains(&removed_flows, ffid_val)
+            && !dest_array_contains(paths, npaths, curr_dest)) {
+
+                paths[npaths++] = curr_dest;
+            }
+        });
+    }
+
+    if(through)
+        invalidate_paths(paths, npaths);
+    vec_id_destroy(&removed_flows);
 }
 
@@ -42,6 +42,7 @@
 #include "a_star.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 /*###########################################################################*/
@@ -56,10 +57,41 @@ void N_FC_Shutdown(void);
 void N_FC_InvalidateAllAtChunk(struct coord chunk);
 
 /* Invalidate all LOS and Flow fields for paths (identified by the dest_id) which 
- * have at least one field at the specified chunk
+ * have at least one field at the specified chunk. Unlike the other cache operations,
+ * this is not safe to call while other threads may be accessing the cache.
  */
 void N_FC_InvalidateAllThroughChunk(struct coord chunk);
 
+/* Invalidate only those LOS and Flow fields at the chunk for which the 
+ * predicate returns true. When 'through' is set, all the fields of the paths 
+ * that had one of their fields at the chunk invalidated are purged as well. 
+ * The same threading restrictions as for N_FC_InvalidateAllThroughChunk apply.
+ */
+void N_FC_InvalidateAtChunkIf(struct coord chunk, bool through,
+                              bool (*los_pred)(const struct LOS_field*, void*),
+                              bool (*flow_pred)(const struct flow_field*, void*),
+                              void *arg);
+
+/* The time elapsed since the specified performance counter value, in milliseconds. 
+ * Used for measuring the cost of computing the fields that get cached.
+ */
+float N_FC_ElapsedMs(uint64_t start_counter);
+
+/* Record a path request for the stats. 'coalesced' is set when the request was 
+ * served by the result of an earlier request made during the same tick.
+ */
+void N_FC_NotePathRequest(bool coalesced);
+
+/* Record the time taken by one navigation update for the stats. The memory 
+ * accounting of the caches is brought up to date at the same time.
+ */
+void N_FC_NoteUpdate(float ms);
+
+/* The counters of a single chunk, and the most invalidations at any one chunk, 
+ * for the debug rendering. Returns false if no fields were computed at the chunk.
+ */
+bool N_FC_ChunkStatsAt(struct coord chunk, struct fc_chunk_stats *out, unsigned *out_max_invalidated);
+
 /*###########################################################################*/
 /* LOS FIELD CACHING                                                         */
 /*###########################################################################*/
@@ -69,7 +101,8 @@ void N_FC_InvalidateAllThroughChunk(struct coord chunk);
 const struct LOS_field  *N_FC_LOSFieldAt(dest_id_t id, struct coord chunk_coord);
 
 bool N_FC_ContainsLOSField(dest_id_t id, struct coord chunk_coord);
-void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_field *lf);
+void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_field *lf, 
+                      float cost);
 
 
 /*###########################################################################*/
@@ -81,7 +114,13 @@ void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_f
 const struct flow_field *N_FC_FlowFieldAt(ff_id_t ffid);
 
 bool N_FC_ContainsFlowField(ff_id_t ffid);
-void N_FC_PutFlowField(ff_id_t ffid, const struct flow_field *ff);
+void N_FC_PutFlowField(ff_id_t ffid, const struct flow_field *ff, float cost);
+/* The time it took to compute the cached field, in milliseconds */
+float N_FC_FlowFieldCost(ff_id_t ffid);
+/* Changes whenever any flow field or mapping is added, replaced or removed. 
+ * Never zero. While it stays the same, the flow field pointers obtained 
+ * earlier stay valid and the mappings stay the same. */
+uint32_t N_FC_FlowFieldGeneration(void);
 
 bool N_FC_GetDestFFMapping(dest_id_t id, struct coord chunk_coord, ff_id_t *out_ff);
 void N_FC_PutDestFFMapping(dest_id_t dest_id, struct coord chunk_coord, ff_id_t ffid);
@@ -100,7 +139,7 @@ struct grid_path_desc{
 bool N_FC_GetGridPath(struct coord local_start, struct coord local_dest,
                       struct coord chunk, struct grid_path_desc *out);
 void N_FC_PutGridPath(struct coord local_start, struct coord local_dest,
-                      struct coord chunk, const struct grid_path_desc *in);
+                      struct coord chunk, const struct grid_path_desc *in, float cost);
 
 #endif
 
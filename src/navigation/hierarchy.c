@@ -0,0 +1,611 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "hierarchy.h"
+#include "nav_private.h"
+#include "../lib/public/pqueue.h"
+#include "../lib/public/khash.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+
+#define IDX(r, width, c)        ((r) * (width) + (c))
+#define MAX_CLUSTER_PORTALS     (CLUSTER_DIM * CLUSTER_DIM * MAX_PORTALS_PER_CHUNK)
+
+PQUEUE_TYPE(hport, const struct portal*)
+PQUEUE_IMPL(static, hport, const struct portal*)
+
+KHASH_MAP_INIT_INT64(node, int)
+KHASH_MAP_INIT_INT64(hfloat, float)
+KHASH_MAP_INIT_INT64(hportal, const struct portal*)
+
+struct cluster{
+    bool                  dirty;
+    size_t                num_nodes;
+    /* The portals which lead out of the cluster */
+    const struct portal **nodes;
+    /* A 'num_nodes' x 'num_nodes' matrix holding the cost of travelling 
+     * between every pair of nodes without leaving the cluster. Pairs
+     * which are not reachable this way hold FLT_MAX.
+     */
+    float                *costs;
+};
+
+struct hgraph{
+    size_t           width, height;
+    /* Maps every node to its' index within its' cluster */
+    khash_t(node)   *node_idx;
+    struct cluster   clusters[];
+};
+
+/* The result of a search over the portals of a single cluster */
+struct local_search{
+    float                dist[MAX_CLUSTER_PORTALS];
+    const struct portal *prev[MAX_CLUSTER_PORTALS];
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t hg_key(const struct portal *port)
+{
+    return (uint64_t)(uintptr_t)port;
+}
+
+static struct coord hg_cluster_coord(struct coord chunk)
+{
+    return (struct coord){chunk.r / CLUSTER_DIM, chunk.c / CLUSTER_DIM};
+}
+
+static bool hg_same_cluster(struct coord a, struct coord b)
+{
+    struct coord ca = hg_cluster_coord(a);
+    struct coord cb = hg_cluster_coord(b);
+    return (ca.r == cb.r && ca.c == cb.c);
+}
+
+static struct cluster *hg_cluster(const struct hgraph *hg, struct coord cluster)
+{
+    return (struct cluster*)&hg->clusters[IDX(cluster.r, hg->width, cluster.c)];
+}
+
+/* Returns the index of the portal within the cluster, -1 if the portal is
+ * not part of the cluster. */
+static int hg_local_idx(const struct nav_private *priv, struct coord cluster, 
+                        const struct portal *port)
+{
+    int dr = port->chunk.r - cluster.r * CLUSTER_DIM;
+    int dc = port->chunk.c - cluster.c * CLUSTER_DIM;
+
+    if(dr < 0 || dr >= CLUSTER_DIM)
+        return -1;
+    if(dc < 0 || dc >= CLUSTER_DIM)
+        return -1;
+
+    const struct nav_chunk *chunk = &priv->chunks[IDX(port->chunk.r, priv->width, port->chunk.c)];
+    return IDX(dr, CLUSTER_DIM, dc) * MAX_PORTALS_PER_CHUNK + (port - chunk->portals);
+}
+
+static int hg_node_idx(const struct hgraph *hg, const struct portal *port)
+{
+    khiter_t k = kh_get(node, hg->node_idx, hg_key(port));
+    if(k == kh_end(hg->node_idx))
+        return -1;
+    return kh_value(hg->node_idx, k);
+}
+
+/* Dijkstra's algorithm over the portal graph, without leaving the cluster. 
+ * The search stops early once 'target' is reached, if it is non-NULL. 
+ * Returns true if the target has been reached. */
+static bool hg_local_search(const struct nav_private *priv, struct coord cluster,
+                            size_t nseeds, const struct portal *seeds[], 
+                            const float seed_costs[], const struct portal *target,
+                            struct local_search *out)
+{
+    for(int i = 0; i < MAX_CLUSTER_PORTALS; i++) {
+        out->dist[i] = FLT_MAX;
+        out->prev[i] = NULL;
+    }
+
+    pq_hport_t frontier;
+    pq_hport_init(&frontier);
+
+    for(int i = 0; i < nseeds; i++) {
+
+        int idx = hg_local_idx(priv, cluster, seeds[i]);
+        if(idx < 0 || seed_costs[i] >= out->dist[idx])
+            continue;
+
+        out->dist[idx] = seed_costs[i];
+        pq_hport_push(&frontier, seed_costs[i], seeds[i]);
+    }
+
+    bool found = false;
+    while(pq_size(&frontier) > 0) {
+
+        const struct portal *curr;
+        pq_hport_pop(&frontier, &curr);
+
+        if(curr == target) {
+            found = true;
+            break;
+        }
+
+        int curr_idx = hg_local_idx(priv, cluster, curr);
+        assert(curr_idx >= 0);
+
+        const struct portal *neighbours[MAX_PORTALS_PER_CHUNK];
+        float neighbour_costs[MAX_PORTALS_PER_CHUNK];
+        int num_neighbours = AStar_PortalNeighbours(curr, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            int next_idx = hg_local_idx(priv, cluster, neighbours[i]);
+            if(next_idx < 0)
+                continue;
+
+            float new_cost = out->dist[curr_idx] + neighbour_costs[i] + AStar_PortalNodePenalty();
+            if(new_cost < out->dist[next_idx]) {
+
+                out->dist[next_idx] = new_cost;
+                out->prev[next_idx] = curr;
+                pq_hport_push(&frontier, new_cost, neighbours[i]);
+            }
+        }
+    }
+
+    pq_hport_destroy(&frontier);
+    return found;
+}
+
+/* Append the portals leading up to 'last' (inclusive) to the path, 
+ * excluding the portal where the search was started from. */
+static void hg_append_local_path(const struct nav_private *priv, struct coord cluster,
+                                 const struct local_search *ls, const struct portal *last, 
+                                 bool include_first, vec_portal_t *out_path)
+{
+    size_t base = vec_size(out_path);
+    const struct portal *curr = last;
+
+    while(true) {
+
+        int idx = hg_local_idx(priv, cluster, curr);
+        assert(idx >= 0);
+        const struct portal *prev = ls->prev[idx];
+
+        if(!prev && !include_first)
+            break;
+        vec_portal_push(out_path, (struct portal*)curr);
+        if(!prev)
+            break;
+        curr = prev;
+    }
+
+    /* Reverse the portals we just added */
+    for(int i = base, j = vec_size(out_path) - 1; i < j; i++, j--) {
+        struct portal *tmp = vec_AT(out_path, i);
+        vec_AT(out_path, i) = vec_AT(out_path, j);
+        vec_AT(out_path, j) = tmp;
+    }
+}
+
+static void hg_update_cluster(struct hgraph *hg, const struct nav_private *priv, 
+                              struct coord cluster)
+{
+    struct cluster *cl = hg_cluster(hg, cluster);
+    struct local_search *ls = malloc(sizeof(struct local_search));
+    if(!ls)
+        return;
+
+    for(int i = 0; i < cl->num_nodes; i++) {
+
+        const float zero = 0.0f;
+        hg_local_search(priv, cluster, 1, &cl->nodes[i], &zero, NULL, ls);
+
+        for(int j = 0; j < cl->num_nodes; j++) {
+            int idx = hg_local_idx(priv, cluster, cl->nodes[j]);
+            cl->costs[IDX(i, cl->num_nodes, j)] = ls->dist[idx];
+        }
+    }
+
+    free(ls);
+    cl->dirty = false;
+}
+
+/* Lower bound on the cost of travelling from the portal to the target */
+static float hg_heuristic(const struct portal *a, const struct portal *b)
+{
+    float ar = a->chunk.r * FIELD_RES_R + (a->endpoints[0].r + a->endpoints[1].r) / 2.0f;
+    float ac = a->chunk.c * FIELD_RES_C + (a->endpoints[0].c + a->endpoints[1].c) / 2.0f;
+    float br = b->chunk.r * FIELD_RES_R + (b->endpoints[0].r + b->endpoints[1].r) / 2.0f;
+    float bc = b->chunk.c * FIELD_RES_C + (b->endpoints[0].c + b->endpoints[1].c) / 2.0f;
+
+    /* Every chunk boundary that is crossed costs at least one hop */
+    int nhops = abs(a->chunk.r - b->chunk.r) + abs(a->chunk.c - b->chunk.c);
+    return sqrtf((ar - br) * (ar - br) + (ac - bc) * (ac - bc)) 
+         + nhops * AStar_PortalNodePenalty();
+}
+
+static void hg_relax(pq_hport_t *frontier, khash_t(hfloat) *running_cost, 
+                     khash_t(hportal) *came_from, const struct portal *from, 
+                     const struct portal *to, float cost, const struct portal *finish)
+{
+    int ret;
+    khiter_t k = kh_get(hfloat, running_cost, hg_key(to));
+    if(k != kh_end(running_cost) && kh_value(running_cost, k) <= cost)
+        return;
+
+    k = kh_put(hfloat, running_cost, hg_key(to), &ret);
+    assert(ret != -1);
+    kh_value(running_cost, k) = cost;
+
+    k = kh_put(hportal, came_from, hg_key(to), &ret);
+    assert(ret != -1);
+    kh_value(came_from, k) = from;
+
+    pq_hport_push(frontier, cost + hg_heuristic(to, finish), to);
+}
+
+/* Find the sequence of nodes of the coarse graph leading to the finish. The
+ * nodes are appended to 'out_nodes', starting with a node in the source cluster. */
+static bool hg_abstract_path(const struct hgraph *hg, const struct nav_private *priv,
+                             struct coord src_cluster, const struct local_search *src_ls,
+                             struct coord dst_cluster, const struct local_search *dst_ls,
+                             const struct portal *finish, vec_portal_t *out_nodes, 
+                             float *out_cost)
+{
+    bool ret = false;
+    pq_hport_t frontier;
+    khash_t(hfloat) *running_cost;
+    khash_t(hportal) *came_from;
+
+    pq_hport_init(&frontier);
+    if(NULL == (running_cost = kh_init(hfloat)))
+        goto fail_running_cost;
+    if(NULL == (came_from = kh_init(hportal)))
+        goto fail_came_from;
+
+    const struct cluster *src_cl = hg_cluster(hg, src_cluster);
+    for(int i = 0; i < src_cl->num_nodes; i++) {
+
+        const struct portal *node = src_cl->nodes[i];
+        float cost = src_ls->dist[hg_local_idx(priv, src_cluster, node)];
+        if(cost == FLT_MAX)
+            continue;
+
+        int put;
+        khiter_t k = kh_put(hfloat, running_cost, hg_key(node), &put);
+        assert(put != -1);
+        kh_value(running_cost, k) = cost;
+        pq_hport_push(&frontier, cost + hg_heuristic(node, finish), node);
+    }
+
+    while(pq_size(&frontier) > 0) {
+
+        const struct portal *curr;
+        pq_hport_pop(&frontier, &curr);
+
+        if(curr == finish) {
+            ret = true;
+            break;
+        }
+
+        khiter_t k = kh_get(hfloat, running_cost, hg_key(curr));
+        assert(k != kh_end(running_cost));
+        float curr_cost = kh_value(running_cost, k);
+
+        /* The finish is reachable from within its' cluster */
+        if(hg_same_cluster(curr->chunk, finish->chunk)) {
+
+            float cost = dst_ls->dist[hg_local_idx(priv, dst_cluster, curr)];
+            if(cost != FLT_MAX)
+                hg_relax(&frontier, running_cost, came_from, curr, finish, curr_cost + cost, finish);
+        }
+
+        /* Hop into the neighbouring cluster */
+        if(curr->connected && !hg_same_cluster(curr->chunk, curr->connected->chunk)) {
+
+            float cost = curr_cost + 1.0f + AStar_PortalNodePenalty();
+            hg_relax(&frontier, running_cost, came_from, curr, curr->connected, cost, finish);
+        }
+
+        /* Move to another node of the same cluster */
+        int idx = hg_node_idx(hg, curr);
+        assert(idx >= 0);
+        const struct cluster *cl = hg_cluster(hg, hg_cluster_coord(curr->chunk));
+
+        for(int i = 0; i < cl->num_nodes; i++) {
+
+            float cost = cl->costs[IDX(idx, cl->num_nodes, i)];
+            if(i == idx || cost == FLT_MAX)
+                continue;
+            hg_relax(&frontier, running_cost, came_from, curr, cl->nodes[i], curr_cost + cost, finish);
+        }
+    }
+
+    if(!ret)
+        goto fail_find_path;
+
+    size_t base = vec_size(out_nodes);
+    const struct portal *curr = finish;
+    while(true) {
+
+        vec_portal_push(out_nodes, (struct portal*)curr);
+        khiter_t k = kh_get(hportal, came_from, hg_key(curr));
+        if(k == kh_end(came_from))
+            break;
+        curr = kh_value(came_from, k);
+    }
+
+    for(int i = base, j = vec_size(out_nodes) - 1; i < j; i++, j--) {
+        struct portal *tmp = vec_AT(out_nodes, i);
+        vec_AT(out_nodes, i) = vec_AT(out_nodes, j);
+        vec_AT(out_nodes, j) = tmp;
+    }
+
+    khiter_t k = kh_get(hfloat, running_cost, hg_key(finish));
+    assert(k != kh_end(running_cost));
+    *out_cost = kh_value(running_cost, k);
+
+fail_find_path:
+    kh_destroy(hportal, came_from);
+fail_came_from:
+    kh_destroy(hfloat, running_cost);
+fail_running_cost:
+    pq_hport_destroy(&frontier);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_HG_Build(struct nav_private *priv)
+{
+    N_HG_Free(priv);
+
+    size_t width = (priv->width + CLUSTER_DIM - 1) / CLUSTER_DIM;
+    size_t height = (priv->height + CLUSTER_DIM - 1) / CLUSTER_DIM;
+
+    struct hgraph *hg = calloc(1, sizeof(struct hgraph) + width * height * sizeof(struct cluster));
+    if(!hg)
+        goto fail_alloc;
+
+    hg->width = width;
+    hg->height = height;
+
+    if(NULL == (hg->node_idx = kh_init(node)))
+        goto fail_node_idx;
+
+    /* First count the nodes of every cluster */
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+
+        const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+        struct cluster *cl = hg_cluster(hg, hg_cluster_coord((struct coord){chunk_r, chunk_c}));
+
+        for(int i = 0; i < chunk->num_portals; i++) {
+            const struct portal *port = &chunk->portals[i];
+            if(port->connected && !hg_same_cluster(port->chunk, port->connected->chunk))
+                cl->num_nodes++;
+        }
+    }}
+
+    for(int i = 0; i < width * height; i++) {
+
+        struct cluster *cl = &hg->clusters[i];
+        if(cl->num_nodes == 0)
+            continue;
+
+        cl->nodes = malloc(cl->num_nodes * sizeof(const struct portal*));
+        cl->costs = malloc(cl->num_nodes * cl->num_nodes * sizeof(float));
+        if(!cl->nodes || !cl->costs)
+            goto fail_clusters;
+        cl->num_nodes = 0;
+        cl->dirty = true;
+    }
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+
+        const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+        struct cluster *cl = hg_cluster(hg, hg_cluster_coord((struct coord){chunk_r, chunk_c}));
+
+        for(int i = 0; i < chunk->num_portals; i++) {
+
+            const struct portal *port = &chunk->portals[i];
+            if(!port->connected || hg_same_cluster(port->chunk, port->connected->chunk))
+                continue;
+
+            int ret;
+            khiter_t k = kh_put(node, hg->node_idx, hg_key(port), &ret);
+            if(ret == -1)
+                goto fail_clusters;
+            kh_value(hg->node_idx, k) = cl->num_nodes;
+            cl->nodes[cl->num_nodes++] = port;
+        }
+    }}
+
+    priv->hgraph = hg;
+    N_HG_Update(priv);
+    return true;
+
+fail_clusters:
+    for(int i = 0; i < width * height; i++) {
+        free(hg->clusters[i].nodes);
+        free(hg->clusters[i].costs);
+    }
+    kh_destroy(node, hg->node_idx);
+fail_node_idx:
+    free(hg);
+fail_alloc:
+    return false;
+}
+
+void N_HG_Free(struct nav_private *priv)
+{
+    struct hgraph *hg = priv->hgraph;
+    if(!hg)
+        return;
+
+    for(int i = 0; i < hg->width * hg->height; i++) {
+        free(hg->clusters[i].nodes);
+        free(hg->clusters[i].costs);
+    }
+    kh_destroy(node, hg->node_idx);
+    free(hg);
+    priv->hgraph = NULL;
+}
+
+void N_HG_MarkDirty(struct nav_private *priv, struct coord chunk)
+{
+    struct hgraph *hg = priv->hgraph;
+    if(!hg)
+        return;
+    hg_cluster(hg, hg_cluster_coord(chunk))->dirty = true;
+}
+
+void N_HG_Update(struct nav_private *priv)
+{
+    struct hgraph *hg = priv->hgraph;
+    if(!hg)
+        return;
+
+    for(int r = 0; r < hg->height; r++) {
+    for(int c = 0; c < hg->width;  c++) {
+
+        struct cluster *cl = hg_cluster(hg, (struct coord){r, c});
+        if(cl->dirty)
+            hg_update_cluster(hg, priv, (struct coord){r, c});
+    }}
+}
+
+bool N_HG_PortalGraphPath(struct tile_desc start_tile, const struct portal *finish, 
+                          const struct nav_private *priv, 
+                          vec_portal_t *out_path, float *out_cost)
+{
+    const struct hgraph *hg = priv->hgraph;
+    struct coord src_chunk = (struct coord){start_tile.chunk_r, start_tile.chunk_c};
+
+    /* Nearby destinations don't need the coarse graph: the search over the 
+     * full graph will not have to visit many nodes before reaching them. */
+    if(!hg || hg_same_cluster(src_chunk, finish->chunk))
+        return AStar_PortalGraphPath(start_tile, finish, priv, out_path, out_cost);
+
+    bool ret = false;
+    struct coord src_cluster = hg_cluster_coord(src_chunk);
+    struct coord dst_cluster = hg_cluster_coord(finish->chunk);
+
+    struct local_search *src_ls = malloc(sizeof(struct local_search));
+    struct local_search *dst_ls = malloc(sizeof(struct local_search));
+    struct local_search *seg_ls = malloc(sizeof(struct local_search));
+    vec_portal_t nodes;
+    vec_portal_init(&nodes);
+
+    if(!src_ls || !dst_ls || !seg_ls)
+        goto out;
+
+    /* The costs from the source tile to every portal in the source cluster */
+    const struct nav_chunk *chunk = &priv->chunks[IDX(src_chunk.r, priv->width, src_chunk.c)];
+    struct coord tile_coord = (struct coord){start_tile.tile_r, start_tile.tile_c};
+    const struct portal *seeds[MAX_PORTALS_PER_CHUNK];
+    float seed_costs[MAX_PORTALS_PER_CHUNK];
+    size_t nseeds = 0;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(!N_PortalReachableFromTile(port, tile_coord, chunk))
+            continue;
+
+        float cost = N_PortalTravelCost(chunk, i, tile_coord);
+        if(cost == FLT_MAX)
+            continue;
+
+        seeds[nseeds] = port;
+        seed_costs[nseeds] = cost;
+        nseeds++;
+    }
+    hg_local_search(priv, src_cluster, nseeds, seeds, seed_costs, NULL, src_ls);
+
+    /* The costs from every portal in the destination cluster to the finish. The 
+     * graph is treated as undirected here - the refinement step below will use 
+     * the actual edge directions. */
+    const float zero = 0.0f;
+    hg_local_search(priv, dst_cluster, 1, &finish, &zero, NULL, dst_ls);
+
+    if(!hg_abstract_path(hg, priv, src_cluster, src_ls, dst_cluster, dst_ls, finish, 
+        &nodes, out_cost))
+        goto out;
+
+    assert(vec_size(&nodes) >= 2);
+    vec_portal_reset(out_path);
+    hg_append_local_path(priv, src_cluster, src_ls, vec_AT(&nodes, 0), true, out_path);
+
+    for(int i = 1; i < vec_size(&nodes); i++) {
+
+        const struct portal *prev = vec_AT(&nodes, i-1);
+        const struct portal *curr = vec_AT(&nodes, i);
+
+        if(prev->connected == curr && !hg_same_cluster(prev->chunk, curr->chunk)) {
+            vec_portal_push(out_path, (struct portal*)curr);
+            continue;
+        }
+
+        struct coord cluster = hg_cluster_coord(curr->chunk);
+        if(!hg_local_search(priv, cluster, 1, &prev, &zero, curr, seg_ls)) {
+
+            /* Fall back to the search over the full graph */
+            ret = AStar_PortalGraphPath(start_tile, finish, priv, out_path, out_cost);
+            goto out;
+        }
+        hg_append_local_path(priv, cluster, seg_ls, curr, false, out_path);
+    }
+    ret = true;
+
+out:
+    vec_portal_destroy(&nodes);
+    free(seg_ls);
+    free(dst_ls);
+    free(src_ls);
+    return ret;
+}
+
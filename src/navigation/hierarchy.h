@@ -0,0 +1,96 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include "a_star.h"
+#include "../map/public/tile.h"
+
+#include <stdbool.h>
+
+struct nav_private;
+struct portal;
+
+/* The number of chunks along each side of a cluster */
+#define CLUSTER_DIM     (4)
+
+/* ------------------------------------------------------------------------
+ * The portal graph is summarized by a second, coarser, graph. Chunks are 
+ * grouped into square clusters and only portals leading out of a cluster 
+ * are kept as nodes. The costs of travelling between the boundary portals
+ * of every cluster are precomputed. Long-distance queries are first solved
+ * on the coarse graph and then refined one cluster at a time.
+ * ------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * (Re-)build the hierarchical graph from scratch. Must be called after
+ * the portals have changed.
+ * ------------------------------------------------------------------------
+ */
+bool N_HG_Build(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Free the hierarchical graph of the navigation data, if there is one.
+ * ------------------------------------------------------------------------
+ */
+void N_HG_Free(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Flag the cluster containing the chunk for recomputation of its' costs.
+ * This should be done whenever the edge states in the chunk change.
+ * ------------------------------------------------------------------------
+ */
+void N_HG_MarkDirty(struct nav_private *priv, struct coord chunk);
+
+/* ------------------------------------------------------------------------
+ * Recompute the costs of all the dirty clusters.
+ * ------------------------------------------------------------------------
+ */
+void N_HG_Update(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Same contract as 'AStar_PortalGraphPath'. Queries where the source and
+ * the destination are in the same cluster are forwarded to the search
+ * over the full portal graph.
+ * ------------------------------------------------------------------------
+ */
+bool N_HG_PortalGraphPath(struct tile_desc start_tile, const struct portal *finish, 
+                          const struct nav_private *priv, 
+                          vec_portal_t *out_path, float *out_cost);
+
+#endif
+
@@ -37,6 +37,7 @@
 #include "a_star.h"
 #include "field.h"
 #include "fieldcache.h"
+#include "hierarchy.h"
 #include "../map/public/tile.h"
 #include "../game/public/game.h"
 #include "../render/public/render.h"
@@ -46,13 +47,22 @@
 #include "../entity.h"
 #include "../event.h"
 #include "../main.h"
+#include "../config.h"
 #include "../lib/public/queue.h"
+#include "../lib/public/lru_cache.h"
+#include "../lib/public/pqueue.h"
+#include "../sched.h"
+#include "../perf.h"
+#include "../mem.h"
+
+#include <SDL.h>
 
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
 #include <float.h>
+#include <limits.h>
 
 
 #define IDX(r, width, c)   ((r) * (width) + (c))
@@ -64,6 +74,18 @@
 
 #define EPSILON                  (1.0f / 1024)
 #define MAX_TILES_PER_LINE       (128)
+#define MAX_PATH_RETRIES         (2)
+/* Upper bound on the number of horizontal runs of pathable tiles in a chunk */
+#define LOCAL_MAX_RUNS           (FIELD_RES_R * ((FIELD_RES_C + 1) / 2))
+#define LOCAL_MAX_IID            (FIELD_RES_R * FIELD_RES_C)
+/* How many tiles around the changed tiles get relabeled */
+#define LOCAL_RELABEL_MARGIN     (2)
+
+#define NAVCACHE_MAGIC           (0x434e4650) /* 'PFNC' */
+#define NAVCACHE_VERSION         (2)
+/* The number of frames that a travel index must go unused before it may 
+ * be evicted */
+#define TRAVEL_INDEX_IDLE_FRAMES (600)
 
 #define CLAMP(a, min, max)       (MIN(MAX((a), (min)), (max)))
 
@@ -138,6 +160,170 @@ enum edge_type{
 };
 
 KHASH_SET_INIT_INT(coord)
+KHASH_SET_INIT_INT(id)
+
+/* A flow field that is pending generation by a worker thread */
+struct ff_job{
+    const struct nav_private *priv;
+    struct coord              chunk;
+    struct field_target       target;
+    ff_id_t                   id;
+    /* If non-negative, the index of the job whose result this field is 
+     * built on top of. Such jobs are run only once the rest are done. */
+    int                       base;
+    /* If set, 'ff' already holds a field to be updated for the new target */
+    bool                      seeded;
+    struct flow_field         ff;
+    /* Milliseconds spent computing the field */
+    float                     cost;
+};
+
+VEC_TYPE(ffjob, struct ff_job)
+VEC_IMPL(static inline, ffjob, struct ff_job)
+
+/* A LOS field that is a part of a path request. LOS fields must be built 
+ * in order along the path, with each field depending on the previous one. */
+struct los_job{
+    struct coord              chunk;
+    /* If set, the field is already in the cache. It will only be copied 
+     * into 'lf' when the next field in the chain is built on top of it. */
+    bool                      cached;
+    /* If non-negative, the index of the earlier job for the same chunk */
+    int                       dup;
+    struct LOS_field          lf;
+    float                     cost;
+};
+
+VEC_TYPE(losjob, struct los_job)
+VEC_IMPL(static inline, losjob, struct los_job)
+
+struct path_request{
+    struct nav_private       *priv;
+    vec3_t                    map_pos;
+    vec2_t                    xz_src;
+    vec2_t                    xz_dest;
+    dest_id_t                 dest_id;
+    struct tile_desc          dst_desc;
+    vec_ffjob_t               ff_jobs;
+    vec_losjob_t              los_jobs;
+    struct job_counter        ctr;
+    /* The following are only used for asynchronous requests */
+    path_ticket_t             ticket;
+    enum path_status          status;
+    bool                      submitted;
+    /* Set when one of the chunks touched by the request is modified while
+     * its' jobs are still in flight. */
+    bool                      stale;
+    int                       retries;
+    /* If valid, the earlier request from the same tick whose result this
+     * request will share once it completes */
+    path_ticket_t             leader;
+    /* Additional sources (ex. other members of a group) for which fields 
+     * are planned using a single search from the destination */
+    vec2_t                   *group_srcs;
+    size_t                    ngroup_srcs;
+    /* If set, the fields of the jobs which aren't built on top of another 
+     * job are being generated on the GPU, in the order of the jobs */
+    struct nav_gpu_batch     *gpu;
+};
+
+VEC_TYPE(preq, struct path_request*)
+VEC_IMPL(static inline, preq, struct path_request*)
+
+/* A portal travel index that has been loaded from a cache file, but not yet 
+ * claimed by a chunk */
+struct travel_index{
+    size_t      num_portals;
+    uint16_t  (*costs)[FIELD_RES_R][FIELD_RES_C];
+};
+
+KHASH_MAP_INIT_INT64(tindex, struct travel_index)
+
+/* The rebuilding of a single chunk's intra-chunk portal data, which only 
+ * depends on that chunk and is carried out by a worker thread */
+struct portal_job{
+    struct nav_chunk *chunk;
+    bool              result;
+    /* The number of travel indices that had to be built from scratch */
+    size_t            misses;
+};
+
+/* The bounds of the tiles in a chunk whose passability has changed */
+struct tile_rect{
+    int r_min, r_max;
+    int c_min, c_max;
+};
+
+KHASH_MAP_INIT_INT(rect, struct tile_rect)
+
+/* The region of a chunk against which cached fields are tested for damage */
+struct field_damage{
+    const struct nav_chunk *chunk;
+    struct tile_rect        rect;
+};
+
+/* A blocker reference count change that is deferred until the next flush */
+struct blocker_op{
+    vec2_t xz_pos;
+    float  range;
+    vec3_t map_pos;
+    int    ref_delta;
+};
+
+VEC_TYPE(bop, struct blocker_op)
+VEC_IMPL(static inline, bop, struct blocker_op)
+
+KHASH_MAP_INIT_INT64(delta, int)
+
+PQUEUE_TYPE(tile, struct coord)
+PQUEUE_IMPL(static, tile, struct coord)
+
+/* The outcome of a path request made during the current tick. Later requests
+ * for the same destination from the same part of the same chunk share it. */
+struct coalesced_path{
+    bool          found;
+    /* If valid, the asynchronous request whose fields are still in flight */
+    path_ticket_t leader;
+};
+
+KHASH_MAP_INIT_INT64(cpath, struct coalesced_path)
+KHASH_MAP_INIT_INT(emask, uint64_t)
+
+/* The state of a cached enemy-seeking flow field which has been seeded by
+ * the enemies within its' chunk */
+struct enemy_field{
+    /* The nav update during which the enemy positions were last checked */
+    uint32_t                  checked_frame;
+    struct enemy_field_state  state;
+};
+
+typedef struct enemy_field *pefield_t;
+
+LRU_CACHE_TYPE(efield, pefield_t)
+LRU_CACHE_PROTOTYPES(static, efield, pefield_t)
+LRU_CACHE_IMPL(static, efield, pefield_t)
+
+/* The portal sequence found by an earlier search from a local island of
+ * a chunk towards a destination. Fields that are evicted or invalidated 
+ * can then be regenerated without repeating the search. */
+struct portal_path{
+    const struct portal *dst_port;
+    vec_portal_t         path;
+};
+
+typedef struct portal_path *pppath_t;
+
+LRU_CACHE_TYPE(ppath, pppath_t)
+LRU_CACHE_PROTOTYPES(static, ppath, pppath_t)
+LRU_CACHE_IMPL(static, ppath, pppath_t)
+
+/*****************************************************************************/
+/* GLOBAL VARIABLES                                                          */
+/*****************************************************************************/
+
+#if CONFIG_NAV_PHASE_TIMES
+nav_phase_hook_t g_nav_phase_hook = NULL;
+#endif
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -145,6 +331,44 @@ KHASH_SET_INIT_INT(coord)
 
 static khash_t(coord) *s_dirty_chunks;
 static bool            s_local_islands_dirty = false;
+/* key: (chunk coord) */
+static khash_t(rect)  *s_dirty_rects;
+/* Set when the cost field of the dirty chunks has changed */
+static bool            s_islands_dirty = false;
+/* All the asynchronous path requests that have not been released yet */
+static vec_preq_t      s_path_requests;
+static path_ticket_t   s_next_ticket = PATH_TICKET_INVALID + 1;
+/* Travel indices from the cache file, keyed by the hash of the chunk contents */
+static khash_t(tindex) *s_loaded_indices;
+/* The number of travel indices that had to be built from scratch during 
+ * the last portal update */
+static size_t           s_index_misses = 0;
+/* key: (ffid) */
+static lru(efield)      s_enemy_fields;
+static uint32_t         s_nav_frame = 0;
+/* Blocker changes queued during the current tick */
+static vec_bop_t        s_blocker_ops;
+/* key: (chunk coord, tile coord) - scratch for coalescing the queued changes */
+static khash_t(delta)  *s_tile_deltas;
+/* key: (dest ID, source chunk coord, source local island ID) */
+static khash_t(cpath)  *s_coalesced_paths;
+/* key: (dest ID, source chunk coord, source local island ID) */
+static lru(ppath)       s_portal_paths;
+/* key: (chunk coord) - dirty chunks which had at least one tile become passable */
+static khash_t(coord)  *s_lowered_chunks;
+/* key: (global island ID, chunk index) - the bounds of the island's tiles 
+ * within the chunk. Lazily rebuilt after the islands have changed. */
+static khash_t(rect)   *s_island_chunks;
+static bool             s_island_chunks_stale = true;
+/* The set of factions with combatable entities on each chunk. It is gathered 
+ * in a single pass over the entities the first time it's needed in a tick. */
+static uint16_t        *s_chunk_factions;
+static size_t           s_chunk_factions_cap = 0;
+static bool             s_chunk_factions_valid = false;
+/* Bit 'j' of entry 'i' is set when faction 'i' is at war with faction 'j' */
+static uint16_t         s_war_masks[MAX_FACTIONS];
+/* key: (faction ID, chunk index) - enemy seek portal masks of the current tick */
+static khash_t(emask)  *s_enemy_portalmasks;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -445,11 +669,8 @@ static void n_create_portals(struct nav_private *priv)
     assert(n_links == (priv->height)*(priv->width-1) + (priv->width)*(priv->height-1));
 }
 
-static void n_link_chunk_portals(struct nav_chunk *chunk, struct coord chunk_coord)
+static void n_link_chunk_portals(struct nav_chunk *chunk)
 {
-    vec_coord_t path;
-    vec_coord_init(&path);
-
     for(int i = 0; i < chunk->num_portals; i++) {
 
         struct portal *port = &chunk->portals[i];
@@ -459,25 +680,13 @@ static void n_link_chunk_portals(struct nav_chunk *chunk, struct coord chunk_coo
                 continue;
 
             struct portal *link_candidate = &chunk->portals[j];
-            struct coord a = (struct coord){
-                (port->endpoints[0].r + port->endpoints[1].r) / 2,
-                (port->endpoints[0].c + port->endpoints[1].c) / 2,
-            };
-            struct coord b = (struct coord){
-                (link_candidate->endpoints[0].r + link_candidate->endpoints[1].r) / 2,
-                (link_candidate->endpoints[0].c + link_candidate->endpoints[1].c) / 2,
-            };
-
-            float cost;
-            bool has_path = AStar_GridPath(a, b, chunk_coord, chunk->cost_base, &path, &cost);
-            if(has_path) {
+            float cost = chunk->portal_dists[i * chunk->num_portals + j];
+            if(cost != FLT_MAX) {
                 port->edges[port->num_neighbours] = (struct edge){EDGE_STATE_ACTIVE, link_candidate, cost};
                 port->num_neighbours++;    
             }
         }
     }
-
-    vec_coord_destroy(&path);
 }
 
 static void n_visit_portal(struct portal *port, int comp_id)
@@ -497,8 +706,23 @@ static void n_visit_portal(struct portal *port, int comp_id)
     }
 }
 
+static void n_portal_paths_evict(pppath_t *victim)
+{
+    vec_portal_destroy(&(*victim)->path);
+    Mem_Free(MEM_TAG_NAV, *victim);
+}
+
+/* The cached portal paths are only valid for as long as the connectivity 
+ * of the portal graph does not change. */
+static void n_portal_paths_clear(void)
+{
+    lru_ppath_clear(&s_portal_paths);
+}
+
 static void n_update_components(struct nav_private *priv)
 {
+    n_portal_paths_clear();
+
     struct portal *port;
     FOREACH_PORTAL(priv, port,{
         port->component_id = 0;
@@ -508,6 +732,81 @@ static void n_update_components(struct nav_private *priv)
     FOREACH_PORTAL(priv, port, {
         n_visit_portal(port, comp_id++);
     });
+    priv->next_component_id = comp_id;
+}
+
+/* Reset the component ID of every portal with the same ID as 'start' */
+static void n_clear_component(struct portal *start, vec_portal_t *out_cleared)
+{
+    int comp_id = start->component_id;
+    if(comp_id == 0)
+        return;
+
+    vec_portal_t frontier;
+    vec_portal_init(&frontier);
+
+    start->component_id = 0;
+    vec_portal_push(&frontier, start);
+    vec_portal_push(out_cleared, start);
+
+    while(vec_size(&frontier) > 0) {
+
+        struct portal *curr = vec_AT(&frontier, vec_size(&frontier)-1);
+        vec_portal_del(&frontier, vec_size(&frontier)-1);
+
+        /* Blocked edges are followed as well, as they may have been active when 
+         * the component ID was assigned. */
+        struct portal *neighbs[MAX_PORTALS_PER_CHUNK];
+        size_t nneighbs = 0;
+        for(int i = 0; i < curr->num_neighbours; i++)
+            neighbs[nneighbs++] = curr->edges[i].neighbour;
+        neighbs[nneighbs++] = curr->connected;
+
+        for(int i = 0; i < nneighbs; i++) {
+
+            if(!neighbs[i] || neighbs[i]->component_id != comp_id)
+                continue;
+            neighbs[i]->component_id = 0;
+            vec_portal_push(&frontier, neighbs[i]);
+            vec_portal_push(out_cleared, neighbs[i]);
+        }
+    }
+
+    vec_portal_destroy(&frontier);
+}
+
+/* Re-assign the component IDs of only those components which have portals 
+ * in the specified chunks. A portal edge can only change states when one 
+ * of its' chunks is modified, so the rest of the graph is not affected. */
+static void n_update_dirty_components(struct nav_private *priv, const vec_coord_t *chunks)
+{
+    vec_portal_t cleared;
+    vec_portal_init(&cleared);
+
+    for(int i = 0; i < vec_size(chunks); i++) {
+
+        struct coord curr = vec_AT(chunks, i);
+        struct nav_chunk *chunk = &priv->chunks[IDX(curr.r, priv->width, curr.c)];
+
+        for(int j = 0; j < chunk->num_portals; j++) {
+
+            /* The components have never been computed */
+            if(chunk->portals[j].component_id == 0 && vec_size(&cleared) == 0) {
+                vec_portal_destroy(&cleared);
+                n_update_components(priv);
+                return;
+            }
+            n_clear_component(&chunk->portals[j], &cleared);
+        }
+    }
+
+    for(int i = 0; i < vec_size(&cleared); i++) {
+
+        struct portal *curr = vec_AT(&cleared, i);
+        if(curr->component_id == 0)
+            n_visit_portal(curr, priv->next_component_id++);
+    }
+    vec_portal_destroy(&cleared);
 }
 
 /* Two portals are considered reachable from one another if they
@@ -557,6 +856,8 @@ static int n_update_edge_states(struct nav_chunk *chunk)
         }
     }
 
+    if(ret > 0)
+        n_portal_paths_clear();
     return ret;
 }
 
@@ -715,20 +1016,71 @@ static void n_visit_island(struct nav_private *priv, uint16_t id, struct tile_de
     queue_td_destroy(&frontier);
 }
 
-static void n_visit_island_local(struct nav_chunk *chunk, uint16_t id, struct coord start)
+static void n_update_islands_full(struct nav_private *priv)
+{
+    /* We assign a unique ID to each set of tiles that are mutually connected
+     * (i.e. are on the same 'island'). The tile's 'island ID' can then be 
+     * queried from the 'islands' field using the coordinate. 
+     * To build the field, we treat every tile in the cost field as a node in
+     * a graph, with cardinally adjacent pathable tiles being the 'neighbors'. 
+     * Then we solve an instance of the 'coonected components' problem. 
+     */
+    uint16_t island_id = 0;
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+
+        /* Initialize every node as 'unvisited' */
+        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+        memset(curr_chunk->islands, 0xff, sizeof(curr_chunk->islands));
+    }}
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+
+        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+
+        for(int tile_r = 0; tile_r < FIELD_RES_R; tile_r++) {
+        for(int tile_c = 0; tile_c < FIELD_RES_C; tile_c++) {
+
+            if(curr_chunk->islands[tile_r][tile_c] != ISLAND_NONE)
+                continue;
+
+            if(curr_chunk->cost_base[tile_r][tile_c] == COST_IMPASSABLE)
+                continue;
+
+            struct tile_desc td = {chunk_r, chunk_c, tile_r, tile_c};
+            n_visit_island(priv, island_id, td);
+            island_id++;
+        }}
+    }}
+
+    priv->next_island_id = island_id;
+    s_islands_dirty = false;
+    s_island_chunks_stale = true;
+}
+
+/* Set the island ID of every tile with the same island ID as 'start' to
+ * 'ISLAND_NONE'. The cleared tiles are appended to 'out_cleared'. */
+static void n_clear_island(struct nav_private *priv, struct tile_desc start, 
+                           queue_td_t *out_cleared)
 {
     struct map_resolution res = {
-        1, 1, FIELD_RES_C, FIELD_RES_R
-    };
-    struct tile_desc start_td = {
-        0, 0, start.r, start.c
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
     };
 
+    struct nav_chunk *chunk = &priv->chunks[IDX(start.chunk_r, priv->width, start.chunk_c)];
+    uint16_t id = chunk->islands[start.tile_r][start.tile_c];
+    if(id == ISLAND_NONE)
+        return;
+
+    chunk->islands[start.tile_r][start.tile_c] = ISLAND_NONE;
+    queue_td_push(out_cleared, &start);
+
     queue_td_t frontier;
     queue_td_init(&frontier, 1024);
-
-    chunk->local_islands[start.r][start.c] = id;
-    queue_td_push(&frontier, &start_td);
+    queue_td_push(&frontier, &start);
 
     while(queue_size(frontier) > 0) {
     
@@ -748,21 +1100,107 @@ static void n_visit_island_local(struct nav_chunk *chunk, uint16_t id, struct co
             if(!M_Tile_RelativeDesc(res, &neighb, deltas[i].c, deltas[i].r))
                 continue;
 
-            if(chunk->cost_base[neighb.tile_r][neighb.tile_c] == COST_IMPASSABLE)
+            chunk = &priv->chunks[IDX(neighb.chunk_r, priv->width, neighb.chunk_c)];
+            if(chunk->islands[neighb.tile_r][neighb.tile_c] != id)
                 continue;
 
-            if(chunk->blockers[neighb.tile_r][neighb.tile_c] > 0)
+            chunk->islands[neighb.tile_r][neighb.tile_c] = ISLAND_NONE;
+            queue_td_push(&frontier, &neighb);
+            queue_td_push(out_cleared, &neighb);
+        }
+    }
+
+    queue_td_destroy(&frontier);
+}
+
+/* Only the islands which have at least one tile in (or directly adjacent to)
+ * one of the dirty chunks can be split or merged by the changes to the cost
+ * field. These are cleared and flooded anew, leaving the rest intact. */
+static void n_update_dirty_islands(struct nav_private *priv)
+{
+    if(!s_islands_dirty)
+        return;
+
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    queue_td_t cleared;
+    queue_td_init(&cleared, 1024);
+
+    for(int i = kh_begin(s_dirty_chunks); i != kh_end(s_dirty_chunks); i++) {
+
+        if(!kh_exist(s_dirty_chunks, i))
+            continue;
+
+        uint32_t key = kh_key(s_dirty_chunks, i);
+        struct coord curr = (struct coord){ key >> 16, key & 0xffff };
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            struct tile_desc td = {curr.r, curr.c, r, c};
+            n_clear_island(priv, td, &cleared);
+
+            /* Tiles on the chunk border may be adjacent to an island which 
+             * has no tiles within the chunk */
+            if(r > 0 && r < FIELD_RES_R-1 && c > 0 && c < FIELD_RES_C-1)
                 continue;
 
-            if(chunk->local_islands[neighb.tile_r][neighb.tile_c] != ISLAND_NONE)
+            struct coord deltas[] = {
+                { 0, -1},
+                { 0, +1},
+                {-1,  0},
+                {+1,  0},
+            };
+
+            for(int j = 0; j < ARR_SIZE(deltas); j++) {
+
+                struct tile_desc neighb = td;
+                if(!M_Tile_RelativeDesc(res, &neighb, deltas[j].c, deltas[j].r))
+                    continue;
+                n_clear_island(priv, neighb, &cleared);
+            }
+        }}
+
+        /* Newly pathable tiles have no island ID to begin with */
+        struct nav_chunk *chunk = &priv->chunks[IDX(curr.r, priv->width, curr.c)];
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            if(chunk->islands[r][c] != ISLAND_NONE)
+                continue;
+            if(chunk->cost_base[r][c] == COST_IMPASSABLE)
                 continue;
 
-            chunk->local_islands[neighb.tile_r][neighb.tile_c] = id;
-            queue_td_push(&frontier, &neighb);
+            struct tile_desc td = {curr.r, curr.c, r, c};
+            queue_td_push(&cleared, &td);
+        }}
+    }
+
+    while(queue_size(cleared) > 0) {
+
+        struct tile_desc curr;
+        queue_td_pop(&cleared, &curr);
+
+        struct nav_chunk *chunk = &priv->chunks[IDX(curr.chunk_r, priv->width, curr.chunk_c)];
+        if(chunk->islands[curr.tile_r][curr.tile_c] != ISLAND_NONE)
+            continue;
+        if(chunk->cost_base[curr.tile_r][curr.tile_c] == COST_IMPASSABLE)
+            continue;
+
+        /* We've run out of IDs - compact them by starting from scratch */
+        if(priv->next_island_id == ISLAND_NONE) {
+            n_update_islands_full(priv);
+            break;
         }
+        n_visit_island(priv, priv->next_island_id++, curr);
     }
 
-    queue_td_destroy(&frontier);
+    queue_td_destroy(&cleared);
+    s_islands_dirty = false;
+    s_island_chunks_stale = true;
 }
 
 static bool enemy_ent(const struct entity *ent, void *arg)
@@ -780,80 +1218,442 @@ static bool enemy_ent(const struct entity *ent, void *arg)
     return (ds == DIPLOMACY_STATE_WAR);
 }
 
-static void n_update_local_islands(struct nav_chunk *chunk)
+static bool n_tile_pathable_local(const struct nav_chunk *chunk, int r, int c)
+{
+    return (chunk->cost_base[r][c] != COST_IMPASSABLE)
+        && (chunk->blockers[r][c] == 0);
+}
+
+static bool n_tile_newly_blocked(const struct field_damage *dmg, int r, int c)
 {
-    int local_iid = 0;
-    memset(chunk->local_islands, 0xff, sizeof(chunk->local_islands));
+    if(r < dmg->rect.r_min || r > dmg->rect.r_max)
+        return false;
+    if(c < dmg->rect.c_min || c > dmg->rect.c_max)
+        return false;
+    return !n_tile_pathable_local(dmg->chunk, r, c);
+}
 
-    for(int r = 0; r < FIELD_RES_R; r++) {
-    for(int c = 0; c < FIELD_RES_C; c++) {
+/* Fields which only had tiles become impassable stay optimal unless some 
+ * direction leads onto (or cuts the corner of) one of the blocked tiles. 
+ * Directions on the blocked tiles themselves are not considered, since 
+ * entities on impassable tiles are guided off them separately. */
+static bool n_flow_field_damaged(const struct flow_field *ff, void *arg)
+{
+    static const struct coord deltas[] = {
+        [FD_NW] = {-1, -1}, [FD_N] = {-1,  0}, [FD_NE] = {-1, +1},
+        [FD_W]  = { 0, -1},                    [FD_E]  = { 0, +1},
+        [FD_SW] = {+1, -1}, [FD_S] = {+1,  0}, [FD_SE] = {+1, +1},
+    };
+    const struct field_damage *dmg = arg;
 
-        if(chunk->local_islands[r][c] != ISLAND_NONE)
-            continue;
-        if(chunk->cost_base[r][c] == COST_IMPASSABLE)
+    for(int r = MAX(dmg->rect.r_min - 1, 0); r <= MIN(dmg->rect.r_max + 1, FIELD_RES_R-1); r++) {
+    for(int c = MAX(dmg->rect.c_min - 1, 0); c <= MIN(dmg->rect.c_max + 1, FIELD_RES_C-1); c++) {
+
+        unsigned dir = ff->field[r][c].dir_idx;
+        if(dir == FD_NONE || dir >= ARR_SIZE(deltas))
             continue;
-        if(chunk->blockers[r][c] > 0)
+        if(!n_tile_pathable_local(dmg->chunk, r, c))
             continue;
-        n_visit_island_local(chunk, ++local_iid, (struct coord){r, c});
+
+        struct coord d = deltas[dir];
+        if(n_tile_newly_blocked(dmg, r + d.r, c + d.c))
+            return true;
+        if(d.r && d.c
+        && (n_tile_newly_blocked(dmg, r + d.r, c) || n_tile_newly_blocked(dmg, r, c + d.c)))
+            return true;
     }}
+    return false;
 }
 
-static void n_update_dirty_local_islands(void *nav_private)
+/* New obstacles can only shade tiles that were visible from the field's
+ * target, so fields that neither see into nor are padded around the changed 
+ * region remain valid. */
+static bool n_los_field_damaged(const struct LOS_field *lf, void *arg)
 {
-    struct nav_private *priv = nav_private;
-    if(!s_local_islands_dirty)
-        return;
+    const struct field_damage *dmg = arg;
 
-    for(int i = kh_begin(s_dirty_chunks); i != kh_end(s_dirty_chunks); i++) {
+    for(int r = MAX(dmg->rect.r_min - 2, 0); r <= MIN(dmg->rect.r_max + 2, FIELD_RES_R-1); r++) {
+    for(int c = MAX(dmg->rect.c_min - 2, 0); c <= MIN(dmg->rect.c_max + 2, FIELD_RES_C-1); c++) {
 
-        if(!kh_exist(s_dirty_chunks, i))
-            continue;
+        if(lf->field[r][c].wavefront_blocked)
+            return true;
 
-        uint32_t key = kh_key(s_dirty_chunks, i);
-        struct coord curr = (struct coord){ key >> 16, key & 0xffff };
+        bool near = (r >= dmg->rect.r_min - 1 && r <= dmg->rect.r_max + 1)
+                 && (c >= dmg->rect.c_min - 1 && c <= dmg->rect.c_max + 1);
+        if(near && lf->field[r][c].visible)
+            return true;
+    }}
+    return false;
+}
 
-        struct nav_chunk *chunk = &priv->chunks[IDX(curr.r, priv->width, curr.c)];
-        n_update_local_islands(chunk);
+static int n_uf_find(int *parent, int x)
+{
+    while(parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
     }
-    s_local_islands_dirty = false;
+    return x;
 }
 
-static void n_update_blockers(struct nav_private *priv, vec2_t xz_pos, float range, 
-                              vec3_t map_pos, int ref_delta)
+static void n_uf_union(int *parent, int a, int b)
 {
-    struct tile_desc tds[256];
-    int ntds = N_TilesUnderCircle(priv, xz_pos, range, map_pos, tds, ARR_SIZE(tds));
+    a = n_uf_find(parent, a);
+    b = n_uf_find(parent, b);
+    /* Keeping the lower index as the root makes the labeling deterministic */
+    if(a < b)
+        parent[b] = a;
+    else if(b < a)
+        parent[a] = b;
+}
 
-    for(int i = 0; i < ntds; i++) {
-    
-        struct tile_desc curr = tds[i];
-        struct nav_chunk *chunk = &priv->chunks[IDX(curr.chunk_r, priv->width, curr.chunk_c)];
+/* First pass of the labeling: split the pathable tiles within the rectangle 
+ * into horizontal runs, and union each run with the overlapping runs of the 
+ * previous row. The run index of each tile (or -1) is written to 'out_runs'. 
+ * Returns the number of runs. */
+static int n_local_runs(const struct nav_chunk *chunk, struct tile_rect rect,
+                        int16_t out_runs[FIELD_RES_R][FIELD_RES_C], int *parent)
+{
+    int nruns = 0;
+    for(int r = rect.r_min; r <= rect.r_max; r++) {
+    for(int c = rect.c_min; c <= rect.c_max; c++) {
 
-        assert(ref_delta < 0 ? chunk->blockers[curr.tile_r][curr.tile_c] >= -ref_delta : true);
-        assert(ref_delta > 0 ? chunk->blockers[curr.tile_r][curr.tile_c] < 256 - ref_delta : true);
+        if(!n_tile_pathable_local(chunk, r, c)) {
+            out_runs[r][c] = -1;
+            continue;
+        }
 
-        int prev_val = chunk->blockers[curr.tile_r][curr.tile_c];
-        chunk->blockers[curr.tile_r][curr.tile_c] += ref_delta;
+        if(c > rect.c_min && out_runs[r][c-1] >= 0) {
+            out_runs[r][c] = out_runs[r][c-1];
+        }else{
+            parent[nruns] = nruns;
+            out_runs[r][c] = nruns++;
+        }
 
-        int val = chunk->blockers[curr.tile_r][curr.tile_c] += ref_delta;
-        if(!!val != !!prev_val) { /* The tile changed states between occupied/non-occupied */
-            int ret;
-            uint64_t key = ((curr.chunk_r & 0xffff) << 16) | (curr.chunk_c & 0xffff);
-            kh_put(coord, s_dirty_chunks, key, &ret);
-            assert(ret != -1);
+        if(r > rect.r_min && out_runs[r-1][c] >= 0)
+            n_uf_union(parent, out_runs[r][c], out_runs[r-1][c]);
+    }}
+    return nruns;
+}
+
+static void n_update_local_islands(struct nav_chunk *chunk)
+{
+    int16_t runs[FIELD_RES_R][FIELD_RES_C];
+    int parent[LOCAL_MAX_RUNS];
+    uint16_t root_iid[LOCAL_MAX_RUNS];
+
+    const struct tile_rect all = {0, FIELD_RES_R-1, 0, FIELD_RES_C-1};
+    int nruns = n_local_runs(chunk, all, runs, parent);
+    for(int i = 0; i < nruns; i++)
+        root_iid[i] = ISLAND_NONE;
+
+    /* Second pass: assign IDs to the components in the order of their first 
+     * tile, in row-major order */
+    uint16_t local_iid = 0;
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
 
-            s_local_islands_dirty = true;
+        if(runs[r][c] < 0) {
+            chunk->local_islands[r][c] = ISLAND_NONE;
+            continue;
         }
-    }
+
+        int root = n_uf_find(parent, runs[r][c]);
+        if(root_iid[root] == ISLAND_NONE)
+            root_iid[root] = ++local_iid;
+        chunk->local_islands[r][c] = root_iid[root];
+    }}
 }
 
-static int manhattan_dist(struct tile_desc a, struct tile_desc b)
+/* Relabel only the tiles around the rectangle where tiles have changed their
+ * passability. The labels of the tiles outside it are kept as they are. This 
+ * is only possible when no island has been split or merged with another one, 
+ * which is checked by making sure that every island bordering the relabeled 
+ * area is still connected to exactly one component within it, and that no
+ * component within it borders more than one island. Returns false if that 
+ * is not the case, in which case the whole chunk must be relabeled. */
+static bool n_update_local_islands_rect(struct nav_chunk *chunk, struct tile_rect dirty)
 {
-    int dr = abs(
-        (a.chunk_r * TILES_PER_CHUNK_HEIGHT + a.tile_r) 
-      - (b.chunk_r * TILES_PER_CHUNK_HEIGHT + b.tile_r)
-    );
-    int dc = abs(
+    int16_t runs[FIELD_RES_R][FIELD_RES_C];
+    int parent[LOCAL_MAX_RUNS];
+    uint16_t root_iid[LOCAL_MAX_RUNS];
+    int16_t iid_root[LOCAL_MAX_IID + 1];
+
+    struct tile_rect rect = (struct tile_rect){
+        MAX(dirty.r_min - LOCAL_RELABEL_MARGIN, 0),
+        MIN(dirty.r_max + LOCAL_RELABEL_MARGIN, FIELD_RES_R-1),
+        MAX(dirty.c_min - LOCAL_RELABEL_MARGIN, 0),
+        MIN(dirty.c_max + LOCAL_RELABEL_MARGIN, FIELD_RES_C-1),
+    };
+    int area = (rect.r_max - rect.r_min + 1) * (rect.c_max - rect.c_min + 1);
+    if(area * 2 > FIELD_RES_R * FIELD_RES_C)
+        return false;
+
+    int nruns = n_local_runs(chunk, rect, runs, parent);
+    for(int i = 0; i < nruns; i++)
+        root_iid[i] = ISLAND_NONE;
+
+    uint16_t max_iid = 0;
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        uint16_t iid = chunk->local_islands[r][c];
+        if(iid == ISLAND_NONE)
+            continue;
+        if(iid > LOCAL_MAX_IID)
+            return false;
+        max_iid = MAX(max_iid, iid);
+        iid_root[iid] = -1;
+    }}
+
+    static const struct coord deltas[] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for(int r = rect.r_min; r <= rect.r_max; r++) {
+    for(int c = rect.c_min; c <= rect.c_max; c++) {
+
+        if(r != rect.r_min && r != rect.r_max && c != rect.c_min && c != rect.c_max)
+            continue;
+        if(runs[r][c] < 0)
+            continue;
+
+        int root = n_uf_find(parent, runs[r][c]);
+        for(int i = 0; i < ARR_SIZE(deltas); i++) {
+
+            int nr = r + deltas[i].r;
+            int nc = c + deltas[i].c;
+
+            if(nr < 0 || nr >= FIELD_RES_R || nc < 0 || nc >= FIELD_RES_C)
+                continue;
+            if(nr >= rect.r_min && nr <= rect.r_max && nc >= rect.c_min && nc <= rect.c_max)
+                continue;
+
+            uint16_t iid = chunk->local_islands[nr][nc];
+            if(iid == ISLAND_NONE)
+                continue;
+
+            if(root_iid[root] != ISLAND_NONE && root_iid[root] != iid)
+                return false; /* Two islands have been merged */
+            if(iid_root[iid] >= 0 && iid_root[iid] != root)
+                return false; /* The island may have been split */
+
+            root_iid[root] = iid;
+            iid_root[iid] = root;
+        }
+    }}
+
+    for(int r = rect.r_min; r <= rect.r_max; r++) {
+    for(int c = rect.c_min; c <= rect.c_max; c++) {
+
+        if(runs[r][c] < 0) {
+            chunk->local_islands[r][c] = ISLAND_NONE;
+            continue;
+        }
+
+        /* Components which don't border the rest of the chunk are new islands */
+        int root = n_uf_find(parent, runs[r][c]);
+        if(root_iid[root] == ISLAND_NONE) {
+            if(max_iid == LOCAL_MAX_IID)
+                return false;
+            root_iid[root] = ++max_iid;
+        }
+        chunk->local_islands[r][c] = root_iid[root];
+    }}
+    return true;
+}
+
+static void n_mark_local_islands_dirty(struct coord chunk, struct coord tile)
+{
+    int ret;
+    uint32_t key = ((chunk.r & 0xffff) << 16) | (chunk.c & 0xffff);
+    khiter_t k = kh_put(rect, s_dirty_rects, key, &ret);
+    assert(ret != -1);
+
+    if(ret != 0) {
+        kh_value(s_dirty_rects, k) = (struct tile_rect){tile.r, tile.r, tile.c, tile.c};
+    }else{
+        struct tile_rect *rect = &kh_value(s_dirty_rects, k);
+        rect->r_min = MIN(rect->r_min, tile.r);
+        rect->r_max = MAX(rect->r_max, tile.r);
+        rect->c_min = MIN(rect->c_min, tile.c);
+        rect->c_max = MAX(rect->c_max, tile.c);
+    }
+    s_local_islands_dirty = true;
+}
+
+static void n_invalidate_chunk_fields(const struct nav_chunk *chunk, struct coord coord, 
+                                      uint32_t key, bool edges_flipped)
+{
+    khiter_t k = kh_get(rect, s_dirty_rects, key);
+
+    if(!CONFIG_NAV_PARTIAL_INVALIDATION
+    || k == kh_end(s_dirty_rects)
+    || kh_get(coord, s_lowered_chunks, key) != kh_end(s_lowered_chunks)) {
+    
+        N_FC_InvalidateAllAtChunk(coord);
+        if(edges_flipped)
+            N_FC_InvalidateAllThroughChunk(coord);
+        return;
+    }
+
+    /* Only costs were raised within the rect. Fields that never lead through 
+     * it are still optimal, and so are the other fields of their paths. */
+    struct field_damage dmg = (struct field_damage){chunk, kh_value(s_dirty_rects, k)};
+    N_FC_InvalidateAtChunkIf(coord, edges_flipped, n_los_field_damaged, 
+                             n_flow_field_damaged, &dmg);
+}
+
+static void n_update_dirty_local_islands(void *nav_private)
+{
+    struct nav_private *priv = nav_private;
+    if(!s_local_islands_dirty)
+        return;
+
+    for(int i = kh_begin(s_dirty_chunks); i != kh_end(s_dirty_chunks); i++) {
+
+        if(!kh_exist(s_dirty_chunks, i))
+            continue;
+
+        uint32_t key = kh_key(s_dirty_chunks, i);
+        struct coord curr = (struct coord){ key >> 16, key & 0xffff };
+        struct nav_chunk *chunk = &priv->chunks[IDX(curr.r, priv->width, curr.c)];
+
+        khiter_t k = kh_get(rect, s_dirty_rects, key);
+        if(k != kh_end(s_dirty_rects) 
+        && n_update_local_islands_rect(chunk, kh_value(s_dirty_rects, k)))
+            continue;
+
+        n_update_local_islands(chunk);
+    }
+
+    kh_clear(rect, s_dirty_rects);
+    s_local_islands_dirty = false;
+}
+
+static void n_apply_blocker_delta(struct nav_private *priv, struct tile_desc td, int ref_delta)
+{
+    struct nav_chunk *chunk = &priv->chunks[IDX(td.chunk_r, priv->width, td.chunk_c)];
+
+    assert(ref_delta < 0 ? chunk->blockers[td.tile_r][td.tile_c] >= -ref_delta : true);
+    assert(ref_delta > 0 ? chunk->blockers[td.tile_r][td.tile_c] < 256 - ref_delta : true);
+
+    int prev_val = chunk->blockers[td.tile_r][td.tile_c];
+    int val = chunk->blockers[td.tile_r][td.tile_c] += ref_delta;
+
+    if(!!val != !!prev_val) { /* The tile changed states between occupied/non-occupied */
+        int ret;
+        uint64_t key = ((td.chunk_r & 0xffff) << 16) | (td.chunk_c & 0xffff);
+        kh_put(coord, s_dirty_chunks, key, &ret);
+        assert(ret != -1);
+
+        n_mark_local_islands_dirty((struct coord){td.chunk_r, td.chunk_c}, 
+                                   (struct coord){td.tile_r, td.tile_c});
+        kh_clear(cpath, s_coalesced_paths);
+
+        if(!val) {
+            kh_put(coord, s_lowered_chunks, key, &ret);
+            assert(ret != -1);
+        }
+    }
+}
+
+static void n_cutout_tile(struct nav_private *priv, struct tile_desc desc)
+{
+    struct nav_chunk *chunk = &priv->chunks[IDX(desc.chunk_r, priv->width, desc.chunk_c)];
+    if(chunk->cost_base[desc.tile_r][desc.tile_c] == COST_IMPASSABLE)
+        return;
+    chunk->cost_base[desc.tile_r][desc.tile_c] = COST_IMPASSABLE;
+    chunk->portal_dists_hash = 0;
+
+    int ret;
+    uint64_t key = ((desc.chunk_r & 0xffff) << 16) | (desc.chunk_c & 0xffff);
+    kh_put(coord, s_dirty_chunks, key, &ret);
+    assert(ret != -1);
+
+    s_islands_dirty = true;
+    n_mark_local_islands_dirty((struct coord){desc.chunk_r, desc.chunk_c}, 
+                               (struct coord){desc.tile_r, desc.tile_c});
+    kh_clear(cpath, s_coalesced_paths);
+}
+
+static void n_update_blockers(struct nav_private *priv, vec2_t xz_pos, float range, 
+                              vec3_t map_pos, int ref_delta)
+{
+    struct tile_desc tds[256];
+    int ntds = N_TilesUnderCircle(priv, xz_pos, range, map_pos, tds, ARR_SIZE(tds));
+
+    for(int i = 0; i < ntds; i++) {
+        n_apply_blocker_delta(priv, tds[i], ref_delta);
+    }
+}
+
+static uint64_t n_tile_key(struct tile_desc td)
+{
+    return ((uint64_t)(td.chunk_r & 0xffff) << 48)
+         | ((uint64_t)(td.chunk_c & 0xffff) << 32)
+         | ((uint64_t)(td.tile_r  & 0xffff) << 16)
+         | ((uint64_t)(td.tile_c  & 0xffff) <<  0);
+}
+
+static struct tile_desc n_tile_for_key(uint64_t key)
+{
+    return (struct tile_desc){
+        .chunk_r = (key >> 48) & 0xffff,
+        .chunk_c = (key >> 32) & 0xffff,
+        .tile_r  = (key >> 16) & 0xffff,
+        .tile_c  = (key >>  0) & 0xffff,
+    };
+}
+
+static void n_queue_blockers(vec2_t xz_pos, float range, vec3_t map_pos, int ref_delta)
+{
+    struct blocker_op op = (struct blocker_op){xz_pos, range, map_pos, ref_delta};
+    vec_bop_push(&s_blocker_ops, op);
+}
+
+/* Sum up the queued changes for every affected tile, then touch each tile 
+ * once with its' net change. Entities that stop and start again during the 
+ * same tick cancel out and never dirty any chunk. 
+ */
+static void n_flush_blockers(struct nav_private *priv)
+{
+    if(vec_size(&s_blocker_ops) == 0)
+        return;
+
+    for(int i = 0; i < vec_size(&s_blocker_ops); i++) {
+
+        const struct blocker_op *op = &vec_AT(&s_blocker_ops, i);
+        struct tile_desc tds[256];
+        int ntds = N_TilesUnderCircle(priv, op->xz_pos, op->range, op->map_pos, 
+            tds, ARR_SIZE(tds));
+
+        for(int j = 0; j < ntds; j++) {
+
+            int ret;
+            khiter_t k = kh_put(delta, s_tile_deltas, n_tile_key(tds[j]), &ret);
+            assert(ret != -1);
+            if(ret != 0)
+                kh_value(s_tile_deltas, k) = 0;
+            kh_value(s_tile_deltas, k) += op->ref_delta;
+        }
+    }
+
+    uint64_t key;
+    int ref_delta;
+    kh_foreach(s_tile_deltas, key, ref_delta, {
+        if(ref_delta == 0)
+            continue;
+        n_apply_blocker_delta(priv, n_tile_for_key(key), ref_delta);
+    });
+
+    kh_clear(delta, s_tile_deltas);
+    vec_bop_reset(&s_blocker_ops);
+}
+
+static int manhattan_dist(struct tile_desc a, struct tile_desc b)
+{
+    int dr = abs(
+        (a.chunk_r * TILES_PER_CHUNK_HEIGHT + a.tile_r) 
+      - (b.chunk_r * TILES_PER_CHUNK_HEIGHT + b.tile_r)
+    );
+    int dc = abs(
         (a.chunk_c * TILES_PER_CHUNK_HEIGHT + a.tile_c) 
       - (b.chunk_c * TILES_PER_CHUNK_HEIGHT + b.tile_c)
     );
@@ -924,181 +1724,1465 @@ int n_closest_island_tiles(const struct nav_private *priv, struct tile_desc targ
                     goto done;
             }
 
-            visited[neighb.chunk_r][neighb.chunk_c][neighb.tile_r][neighb.tile_c] = true;
-            queue_td_push(&frontier, &neighb);
+            visited[neighb.chunk_r][neighb.chunk_c][neighb.tile_r][neighb.tile_c] = true;
+            queue_td_push(&frontier, &neighb);
+        }
+    }
+
+done:
+    queue_td_destroy(&frontier);
+    return ret; 
+}
+
+static uint32_t n_island_chunk_key(uint16_t global_iid, int chunk_idx)
+{
+    assert(chunk_idx <= 0xffff);
+    return ((uint32_t)global_iid << 16) | (uint32_t)chunk_idx;
+}
+
+static void n_build_island_chunks(const struct nav_private *priv)
+{
+    kh_clear(rect, s_island_chunks);
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+
+        int idx = IDX(chunk_r, priv->width, chunk_c);
+        const struct nav_chunk *chunk = &priv->chunks[idx];
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            uint16_t iid = chunk->islands[r][c];
+            if(iid == ISLAND_NONE)
+                continue;
+
+            int ret;
+            khiter_t k = kh_put(rect, s_island_chunks, n_island_chunk_key(iid, idx), &ret);
+            if(ret == -1)
+                return;
+
+            struct tile_rect *rect = &kh_value(s_island_chunks, k);
+            if(ret != 0) {
+                *rect = (struct tile_rect){r, r, c, c};
+                continue;
+            }
+            rect->r_min = MIN(rect->r_min, r);
+            rect->r_max = MAX(rect->r_max, r);
+            rect->c_min = MIN(rect->c_min, c);
+            rect->c_max = MAX(rect->c_max, c);
+        }}
+    }}
+    s_island_chunks_stale = false;
+}
+
+struct island_candidate{
+    int dist;
+    int chunk_idx;
+    struct tile_rect rect;
+};
+
+static int compare_island_candidates(const void *a, const void *b)
+{
+    return ((const struct island_candidate*)a)->dist 
+         - ((const struct island_candidate*)b)->dist;
+}
+
+static int axis_dist(int x, int lo, int hi)
+{
+    if(x < lo)
+        return lo - x;
+    if(x > hi)
+        return x - hi;
+    return 0;
+}
+
+/* Same as 'n_closest_island_tiles' with 'ignore_blockers' set and a single 
+ * output tile, but rather than flooding outwards from the target tile one 
+ * tile at a time, only the chunks known to hold tiles of the island are 
+ * visited, in the order of their lower-bound distance from the target. */
+static bool n_closest_island_tile(const struct nav_private *priv, struct tile_desc target, 
+                                  uint16_t global_iid, struct tile_desc *out)
+{
+    if(s_island_chunks_stale)
+        n_build_island_chunks(priv);
+
+    const int nchunks = priv->width * priv->height;
+    const int target_r = target.chunk_r * FIELD_RES_R + target.tile_r;
+    const int target_c = target.chunk_c * FIELD_RES_C + target.tile_c;
+
+    struct island_candidate cands[nchunks];
+    int ncands = 0;
+
+    for(int idx = 0; idx < nchunks; idx++) {
+
+        khiter_t k = kh_get(rect, s_island_chunks, n_island_chunk_key(global_iid, idx));
+        if(k == kh_end(s_island_chunks))
+            continue;
+
+        struct tile_rect rect = kh_value(s_island_chunks, k);
+        int base_r = (idx / priv->width) * FIELD_RES_R;
+        int base_c = (idx % priv->width) * FIELD_RES_C;
+
+        cands[ncands++] = (struct island_candidate){
+            .dist = axis_dist(target_r, base_r + rect.r_min, base_r + rect.r_max)
+                  + axis_dist(target_c, base_c + rect.c_min, base_c + rect.c_max),
+            .chunk_idx = idx,
+            .rect = rect
+        };
+    }
+    qsort(cands, ncands, sizeof(struct island_candidate), compare_island_candidates);
+
+    int best = INT_MAX;
+    for(int i = 0; i < ncands && cands[i].dist < best; i++) {
+
+        const struct island_candidate *curr = &cands[i];
+        const struct nav_chunk *chunk = &priv->chunks[curr->chunk_idx];
+        int chunk_r = curr->chunk_idx / priv->width;
+        int chunk_c = curr->chunk_idx % priv->width;
+
+        for(int r = curr->rect.r_min; r <= curr->rect.r_max; r++) {
+        for(int c = curr->rect.c_min; c <= curr->rect.c_max; c++) {
+
+            if(chunk->islands[r][c] != global_iid)
+                continue;
+
+            int dist = abs(chunk_r * FIELD_RES_R + r - target_r)
+                     + abs(chunk_c * FIELD_RES_C + c - target_c);
+            if(dist >= best)
+                continue;
+
+            best = dist;
+            *out = (struct tile_desc){chunk_r, chunk_c, r, c};
+        }}
+    }
+
+    return (best != INT_MAX);
+}
+
+static uint16_t n_quantize_portal_cost(float cost)
+{
+    float scaled = cost * PORTAL_COST_SCALE + 0.5f;
+    if(scaled >= PORTAL_COST_MAX)
+        return PORTAL_COST_MAX;
+    return (uint16_t)scaled;
+}
+
+static uint64_t n_fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t n_chunk_hash(const struct nav_chunk *chunk)
+{
+    uint64_t ret = 0xcbf29ce484222325ULL;
+    ret = n_fnv1a(ret, chunk->cost_base, sizeof(chunk->cost_base));
+    ret = n_fnv1a(ret, &chunk->num_portals, sizeof(chunk->num_portals));
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+        const struct portal *port = &chunk->portals[i];
+        ret = n_fnv1a(ret, port->endpoints, sizeof(port->endpoints));
+    }
+    return ret;
+}
+
+static void n_free_loaded_indices(void)
+{
+    struct travel_index curr;
+    uint64_t key;
+    (void)key;
+
+    kh_foreach(s_loaded_indices, key, curr, {
+        free(curr.costs);
+    });
+    kh_clear(tindex, s_loaded_indices);
+}
+
+static bool n_compute_portal_travel_index(struct nav_chunk *chunk)
+{
+    chunk->portal_travel_costs = Mem_Alloc(MEM_TAG_NAV, chunk->num_portals * sizeof(*chunk->portal_travel_costs));
+    if(!chunk->portal_travel_costs)
+        return false;
+
+    queue_cc_t frontier;
+    queue_cc_init(&frontier, 1024);
+
+    for(int pi = 0; pi < chunk->num_portals; pi++) {
+
+        bool visited[FIELD_RES_R][FIELD_RES_C] = {0};
+        assert(queue_size(frontier) == 0);
+
+        memset(chunk->portal_travel_costs[pi], 0xff, sizeof(chunk->portal_travel_costs[pi]));
+        assert(chunk->portal_travel_costs[pi][0][0] == PORTAL_COST_NONE);
+
+        const struct portal *port = &chunk->portals[pi];
+        for(int r = port->endpoints[0].r; r <= port->endpoints[1].r; r++) {
+        for(int c = port->endpoints[0].c; c <= port->endpoints[1].c; c++) {
+
+            struct cost_coord cc = (struct cost_coord){0.0f, (struct coord){r,c}};
+            queue_cc_push(&frontier, &cc);
+            visited[r][c] = true;
+        }}
+
+        while(queue_size(frontier) > 0) {
+
+            struct cost_coord curr;
+            queue_cc_pop(&frontier, &curr);
+
+            chunk->portal_travel_costs[pi][curr.coord.r][curr.coord.c] = n_quantize_portal_cost(curr.cost);
+
+            struct coord neighbours[8];
+            float costs[8];
+            int num_neighbours = N_GridNeighbours(chunk->cost_base, curr.coord, neighbours, costs);
+
+            for(int i = 0; i < num_neighbours; i++) {
+
+                if(visited[neighbours[i].r][neighbours[i].c])
+                    continue;
+
+                struct cost_coord cc = (struct cost_coord){curr.cost + costs[i], neighbours[i]};
+                queue_cc_push(&frontier, &cc);
+                visited[neighbours[i].r][neighbours[i].c] = true;
+            }
+        }
+    }
+
+    queue_cc_destroy(&frontier);
+    return true;
+}
+
+static bool n_build_portal_travel_index(struct nav_chunk *chunk, size_t *misses)
+{
+    uint64_t hash = n_chunk_hash(chunk);
+    if((chunk->portal_travel_costs || chunk->num_portals == 0) 
+    && chunk->travel_index_hash == hash)
+        return true; /* Already up-to-date */
+
+    Mem_Free(MEM_TAG_NAV, chunk->portal_travel_costs);
+    chunk->portal_travel_costs = NULL;
+    chunk->travel_index_hash = hash;
+
+    if(chunk->num_portals == 0)
+        return true;
+
+    /* Take the index from the cache file, if it has one for this chunk. 
+     * Chunks with identical contents may share the same entry. */
+    khiter_t k = kh_get(tindex, s_loaded_indices, hash);
+    if(k != kh_end(s_loaded_indices) 
+    && kh_value(s_loaded_indices, k).num_portals == chunk->num_portals) {
+
+        size_t size = chunk->num_portals * sizeof(*chunk->portal_travel_costs);
+        chunk->portal_travel_costs = Mem_Alloc(MEM_TAG_NAV, size);
+        if(!chunk->portal_travel_costs) {
+            chunk->travel_index_hash = 0;
+            return false;
+        }
+        memcpy(chunk->portal_travel_costs, kh_value(s_loaded_indices, k).costs, size);
+        return true;
+    }
+
+    (*misses)++;
+    if(!n_compute_portal_travel_index(chunk)) {
+        chunk->travel_index_hash = 0;
+        return false;
+    }
+    return true;
+}
+
+/* An evicted index is taken from the loaded cache or computed again when it 
+ * is next needed. Paths are only ever planned on the main thread, so this is
+ * never racing with any other reader of the chunk's index. */
+static bool n_travel_index_resident(const struct nav_chunk *chunk)
+{
+    struct nav_chunk *mut = (struct nav_chunk*)chunk;
+    mut->travel_index_used = s_nav_frame;
+
+    if(chunk->portal_travel_costs || chunk->num_portals == 0)
+        return true;
+
+    ASSERT_IN_MAIN_THREAD();
+    return n_build_portal_travel_index(mut, &s_index_misses);
+}
+
+static void n_travel_index_evict(struct nav_chunk *chunk)
+{
+    Mem_Free(MEM_TAG_NAV, chunk->portal_travel_costs);
+    chunk->portal_travel_costs = NULL;
+}
+
+static struct coord n_portal_center(const struct portal *port)
+{
+    return (struct coord){
+        (port->endpoints[0].r + port->endpoints[1].r) / 2,
+        (port->endpoints[0].c + port->endpoints[1].c) / 2,
+    };
+}
+
+/* Run a single search over the cost field from the center of every portal, 
+ * rather than a separate search for every pair of portals. */
+static bool n_compute_portal_dists(struct nav_chunk *chunk)
+{
+    const size_t np = chunk->num_portals;
+    chunk->portal_dists = Mem_Alloc(MEM_TAG_NAV, np * np * sizeof(float));
+    if(!chunk->portal_dists)
+        return false;
+
+    pq_tile_t frontier;
+    pq_tile_init(&frontier);
+
+    for(int i = 0; i < np; i++) {
+
+        float best[FIELD_RES_R][FIELD_RES_C];
+        bool settled[FIELD_RES_R][FIELD_RES_C] = {0};
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            best[r][c] = FLT_MAX;
+        }}
+
+        struct coord start = n_portal_center(&chunk->portals[i]);
+        best[start.r][start.c] = 0.0f;
+        pq_tile_push(&frontier, 0.0f, start);
+
+        while(pq_size(&frontier) > 0) {
+
+            struct coord curr;
+            pq_tile_pop(&frontier, &curr);
+
+            if(settled[curr.r][curr.c])
+                continue;
+            settled[curr.r][curr.c] = true;
+
+            struct coord neighbours[8];
+            float costs[8];
+            int num_neighbours = N_GridNeighbours(chunk->cost_base, curr, neighbours, costs);
+
+            for(int j = 0; j < num_neighbours; j++) {
+
+                struct coord next = neighbours[j];
+                float new_cost = best[curr.r][curr.c] + costs[j];
+                if(new_cost < best[next.r][next.c]) {
+                    best[next.r][next.c] = new_cost;
+                    pq_tile_push(&frontier, new_cost, next);
+                }
+            }
+        }
+
+        for(int j = 0; j < np; j++) {
+            struct coord end = n_portal_center(&chunk->portals[j]);
+            chunk->portal_dists[i * np + j] = (i == j) ? 0.0f : best[end.r][end.c];
+        }
+    }
+
+    pq_tile_destroy(&frontier);
+    return true;
+}
+
+static bool n_build_portal_dists(struct nav_chunk *chunk)
+{
+    uint64_t hash = n_chunk_hash(chunk);
+    if((chunk->portal_dists || chunk->num_portals == 0) 
+    && chunk->portal_dists_hash == hash)
+        return true; /* Already up-to-date */
+
+    Mem_Free(MEM_TAG_NAV, chunk->portal_dists);
+    chunk->portal_dists = NULL;
+    chunk->portal_dists_hash = hash;
+
+    if(chunk->num_portals == 0)
+        return true;
+
+    if(!n_compute_portal_dists(chunk)) {
+        chunk->portal_dists_hash = 0;
+        return false;
+    }
+    return true;
+}
+
+static void n_portal_job_run(void *arg)
+{
+    struct portal_job *job = arg;
+
+    job->result = n_build_portal_dists(job->chunk);
+    if(!job->result)
+        return;
+
+    n_link_chunk_portals(job->chunk);
+    job->result = n_build_portal_travel_index(job->chunk, &job->misses);
+}
+
+static void n_efield_evict(pefield_t *victim)
+{
+    Mem_Free(MEM_TAG_NAV, *victim);
+}
+
+/* Returns false if the field must be rebuilt from scratch. Otherwise, the 
+ * cached field is either still valid or has been repaired in-place. */
+static bool n_enemy_field_current(const struct nav_private *priv, ff_id_t ffid, 
+                                  struct field_target target)
+{
+    struct enemy_field *ef;
+    if(!lru_efield_get(&s_enemy_fields, ffid, &ef))
+        return true; /* The field was not seeded by enemies in the chunk */
+
+    if(ef->checked_frame == s_nav_frame)
+        return true;
+
+    struct enemy_seeds seeds;
+    if(!N_FlowFieldEnemySeeds(priv, &target.enemies, &seeds)) {
+        lru_efield_remove(&s_enemy_fields, ffid);
+        Mem_Free(MEM_TAG_NAV, ef);
+        return false;
+    }
+
+    ef->checked_frame = s_nav_frame;
+    if(0 == memcmp(&seeds, &ef->state.seeds, sizeof(seeds)))
+        return true;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    struct flow_field ff = *N_FC_FlowFieldAt(ffid);
+    N_FlowFieldRepairEnemies(target.enemies.chunk, priv, &seeds, &ef->state, &ff);
+    N_FC_PutFlowField(ffid, &ff, N_FC_FlowFieldCost(ffid) + N_FC_ElapsedMs(start));
+    return true;
+}
+
+static void n_enemy_field_forget(ff_id_t ffid)
+{
+    struct enemy_field *ef;
+    if(!lru_efield_get(&s_enemy_fields, ffid, &ef))
+        return;
+    lru_efield_remove(&s_enemy_fields, ffid);
+    Mem_Free(MEM_TAG_NAV, ef);
+}
+
+static const struct portal *n_closest_reachable_portal(const struct nav_chunk *chunk, struct coord start)
+{
+    const struct portal *ret = NULL;
+    uint16_t min_cost = PORTAL_COST_NONE;
+
+    if(!n_travel_index_resident(chunk))
+        return NULL;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *curr = &chunk->portals[i];
+        uint16_t cost = chunk->portal_travel_costs[i][start.r][start.c];
+
+        if(cost < min_cost) {
+            ret = curr;
+            min_cost = cost;
+        }
+    }
+    return ret;
+}
+
+static bool n_chunk_factions_build(const struct nav_private *priv, vec3_t map_pos)
+{
+    const size_t nchunks = priv->width * priv->height;
+    if(nchunks > s_chunk_factions_cap) {
+
+        uint16_t *factions = Mem_Realloc(MEM_TAG_NAV, s_chunk_factions, nchunks * sizeof(uint16_t));
+        if(!factions)
+            return false;
+        s_chunk_factions = factions;
+        s_chunk_factions_cap = nchunks;
+    }
+    memset(s_chunk_factions, 0, nchunks * sizeof(uint16_t));
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+
+        s_war_masks[i] = 0;
+        for(int j = 0; j < MAX_FACTIONS; j++) {
+
+            enum diplomacy_state ds;
+            if(G_GetDiplomacyState(i, j, &ds) && ds == DIPLOMACY_STATE_WAR)
+                s_war_masks[i] |= (1u << j);
+        }
+    }
+
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    const vec_pentity_t *ents = G_GetActiveEntities();
+    for(int i = 0; i < vec_size(ents); i++) {
+
+        const struct entity *curr = vec_AT(ents, i);
+        if(!(curr->flags & ENTITY_FLAG_COMBATABLE))
+            continue;
+        if(curr->faction_id < 0 || curr->faction_id >= MAX_FACTIONS)
+            continue;
+
+        struct tile_desc td;
+        if(!M_Tile_DescForPoint2D(res, map_pos, G_Pos_GetXZ(curr->uid), &td))
+            continue;
+        s_chunk_factions[IDX(td.chunk_r, priv->width, td.chunk_c)] |= (1u << curr->faction_id);
+    }
+
+    s_chunk_factions_valid = true;
+    return true;
+}
+
+static bool n_chunk_has_enemies(const struct nav_private *priv, struct coord chunk, int faction_id)
+{
+    if(chunk.r < 0 || chunk.r >= priv->height)
+        return false;
+    if(chunk.c < 0 || chunk.c >= priv->width)
+        return false;
+    return (s_chunk_factions[IDX(chunk.r, priv->width, chunk.c)] & s_war_masks[faction_id]);
+}
+
+/* Every set bit in the returned value represents the index of a portal 
+ * in the chunk that we can path to to find enemies on the other side. 
+ * All seekers of a faction in the same chunk share the result for the 
+ * remainder of the movement tick.
+ */
+static uint64_t n_enemy_seek_portalmask(const struct nav_private *priv, vec3_t map_pos, 
+                                        struct coord chunk, int faction_id)
+{
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return 0;
+
+    uint32_t key = ((uint32_t)faction_id << 24) | IDX(chunk.r, priv->width, chunk.c);
+    khiter_t k = kh_get(emask, s_enemy_portalmasks, key);
+    if(k != kh_end(s_enemy_portalmasks))
+        return kh_value(s_enemy_portalmasks, k);
+
+    if(!s_chunk_factions_valid && !n_chunk_factions_build(priv, map_pos))
+        return 0;
+
+    bool top   = n_chunk_has_enemies(priv, (struct coord){chunk.r - 1, chunk.c}, faction_id);
+    bool bot   = n_chunk_has_enemies(priv, (struct coord){chunk.r + 1, chunk.c}, faction_id);
+    bool left  = n_chunk_has_enemies(priv, (struct coord){chunk.r, chunk.c - 1}, faction_id);
+    bool right = n_chunk_has_enemies(priv, (struct coord){chunk.r, chunk.c + 1}, faction_id);
+
+    uint64_t ret = 0;
+    const struct nav_chunk *nchunk = &priv->chunks[IDX(chunk.r, priv->width, chunk.c)];
+
+    for(int i = 0; i < nchunk->num_portals; i++) {
+
+        const struct portal *curr = &nchunk->portals[i];
+
+        if(top && curr->endpoints[0].r == 0 
+               && curr->endpoints[1].r == 0)
+            ret |= (((uint64_t)1) << i);
+
+        if(bot && curr->endpoints[0].r == FIELD_RES_R-1 
+               && curr->endpoints[1].r == FIELD_RES_R-1)
+            ret |= (((uint64_t)1) << i);
+
+        if(left && curr->endpoints[0].c == 0 
+                && curr->endpoints[1].c == 0)
+            ret |= (((uint64_t)1) << i);
+
+        if(right && curr->endpoints[0].c == FIELD_RES_C-1 
+                 && curr->endpoints[1].c == FIELD_RES_C-1)
+            ret |= (((uint64_t)1) << i);
+    }
+
+    int status;
+    k = kh_put(emask, s_enemy_portalmasks, key, &status);
+    if(status != -1)
+        kh_value(s_enemy_portalmasks, k) = ret;
+    return ret;
+}
+
+/* Returns true if, in the abscence of any blockers, the tiles would be on the same local island */
+static bool n_normally_reachable(const struct nav_chunk *chunk, struct coord a, struct coord b)
+{
+    if(!n_travel_index_resident(chunk))
+        return false;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+    
+        bool areach = (chunk->portal_travel_costs[i][a.r][a.c] != PORTAL_COST_NONE);
+        bool breach = (chunk->portal_travel_costs[i][b.r][b.c] != PORTAL_COST_NONE);
+        if(areach != breach)
+            return false;
+    }
+    return true;
+}
+
+static void n_push_ff_job(vec_ffjob_t *jobs, const struct nav_private *priv, 
+                          struct coord chunk, struct field_target target, ff_id_t id, 
+                          const struct flow_field *seed, int base)
+{
+    struct ff_job job = (struct ff_job){
+        .priv = priv,
+        .chunk = chunk,
+        .target = target,
+        .id = id,
+        .base = base,
+        .seeded = (seed != NULL),
+    };
+    if(seed) {
+        memcpy(&job.ff, seed, sizeof(struct flow_field));
+    }
+    vec_ffjob_push(jobs, job);
+}
+
+/* Returns the index of the most recent job for the particular chunk, or -1 */
+static int n_pending_ff_job(const vec_ffjob_t *jobs, struct coord chunk)
+{
+    for(int i = vec_size(jobs)-1; i >= 0; i--) {
+
+        const struct ff_job *curr = &vec_AT(jobs, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c)
+            return i;
+    }
+    return -1;
+}
+
+static void n_ff_job_run(void *arg)
+{
+    struct ff_job *job = arg;
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    if(!job->seeded)
+        N_FlowFieldInit(job->chunk, job->priv, &job->ff);
+    N_FlowFieldUpdate(job->chunk, job->priv, job->target, &job->ff);
+    job->cost += N_FC_ElapsedMs(start);
+}
+
+/* Must only be called once all the submitted jobs have completed */
+static void n_commit_ff_jobs(vec_ffjob_t *jobs)
+{
+    for(int i = 0; i < vec_size(jobs); i++) {
+
+        struct ff_job *curr = &vec_AT(jobs, i);
+        if(curr->base >= 0) {
+
+            assert(curr->base < i);
+            memcpy(&curr->ff, &vec_AT(jobs, curr->base).ff, sizeof(struct flow_field));
+            curr->seeded = true;
+            curr->cost = vec_AT(jobs, curr->base).cost;
+            n_ff_job_run(curr);
+        }
+        N_FC_PutFlowField(curr->id, &curr->ff, curr->cost);
+    }
+}
+
+static void n_push_los_job(struct path_request *req, struct coord chunk)
+{
+    struct los_job job = (struct los_job){
+        .chunk = chunk,
+        .cached = false,
+        .dup = -1,
+    };
+
+    for(int i = vec_size(&req->los_jobs)-1; i >= 0; i--) {
+
+        const struct los_job *curr = &vec_AT(&req->los_jobs, i);
+        if(curr->cached || curr->dup >= 0)
+            continue;
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c) {
+            job.dup = i;
+            break;
+        }
+    }
+
+    if(job.dup < 0 && N_FC_ContainsLOSField(req->dest_id, chunk))
+        job.cached = true;
+
+    /* The new field will be built on top of one that is already in the cache */
+    int nprev = vec_size(&req->los_jobs);
+    if(!job.cached && job.dup < 0 && nprev > 0 && vec_AT(&req->los_jobs, nprev-1).cached) {
+
+        struct los_job *prev = &vec_AT(&req->los_jobs, nprev-1);
+        const struct LOS_field *prev_lf = N_FC_LOSFieldAt(req->dest_id, prev->chunk);
+        assert(prev_lf);
+        memcpy(&prev->lf, prev_lf, sizeof(struct LOS_field));
+    }
+
+    vec_losjob_push(&req->los_jobs, job);
+}
+
+static void n_los_job_run(void *arg)
+{
+    struct path_request *req = arg;
+
+    for(int i = 0; i < vec_size(&req->los_jobs); i++) {
+
+        struct los_job *curr = &vec_AT(&req->los_jobs, i);
+        if(curr->cached)
+            continue;
+
+        if(curr->dup >= 0) {
+            assert(curr->dup < i);
+            memcpy(&curr->lf, &vec_AT(&req->los_jobs, curr->dup).lf, sizeof(struct LOS_field));
+            continue;
+        }
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        const struct LOS_field *prev_los = NULL;
+        if(i > 0) {
+            prev_los = &vec_AT(&req->los_jobs, i-1).lf;
+            assert(prev_los->chunk.r == vec_AT(&req->los_jobs, i-1).chunk.r);
+            assert(prev_los->chunk.c == vec_AT(&req->los_jobs, i-1).chunk.c);
+            assert((abs(prev_los->chunk.r - curr->chunk.r) + abs(prev_los->chunk.c - curr->chunk.c)) == 1);
+        }
+        N_LOSFieldCreate(req->dest_id, curr->chunk, req->dst_desc, req->priv, 
+            req->map_pos, &curr->lf, prev_los);
+        curr->cost = N_FC_ElapsedMs(start);
+    }
+}
+
+static void n_path_request_init(struct path_request *req, struct nav_private *priv,
+                                vec2_t xz_src, vec2_t xz_dest, vec3_t map_pos)
+{
+    *req = (struct path_request){
+        .priv = priv,
+        .map_pos = map_pos,
+        .xz_src = xz_src,
+        .xz_dest = xz_dest,
+        .dest_id = DEST_ID_INVALID,
+        .ticket = PATH_TICKET_INVALID,
+        .status = PATH_PENDING,
+        .submitted = false,
+        .stale = false,
+        .retries = 0,
+        .leader = PATH_TICKET_INVALID,
+        .group_srcs = NULL,
+        .ngroup_srcs = 0,
+    };
+    vec_ffjob_init(&req->ff_jobs);
+    vec_losjob_init(&req->los_jobs);
+}
+
+static void n_path_request_release_gpu(struct path_request *req)
+{
+    if(!req->gpu)
+        return;
+    R_NavFieldBatchAbandon(req->gpu);
+    req->gpu = NULL;
+}
+
+static void n_path_request_destroy(struct path_request *req)
+{
+    n_path_request_release_gpu(req);
+    vec_ffjob_destroy(&req->ff_jobs);
+    vec_losjob_destroy(&req->los_jobs);
+    free(req->group_srcs);
+}
+
+/* Discard all the planned jobs, releasing the memory they hold */
+static void n_path_request_clear(struct path_request *req)
+{
+    n_path_request_release_gpu(req);
+    vec_ffjob_destroy(&req->ff_jobs);
+    vec_losjob_destroy(&req->los_jobs);
+    vec_ffjob_init(&req->ff_jobs);
+    vec_losjob_init(&req->los_jobs);
+    req->submitted = false;
+    req->stale = false;
+}
+
+static uint32_t n_local_island_key(struct tile_desc td, const struct nav_chunk *chunk)
+{
+    return (((uint32_t)td.chunk_r & 0xff) << 24)
+         | (((uint32_t)td.chunk_c & 0xff) << 16)
+         | ((uint32_t)chunk->local_islands[td.tile_r][td.tile_c]);
+}
+
+/* Determine which fields need to be generated for a source to follow the 
+ * portal path, as they are not already cached, and queue up jobs for them. */
+static void n_path_request_plan_portals(struct path_request *req, struct tile_desc src_desc,
+                                        const struct portal *dst_port, const vec_portal_t *path)
+{
+    struct nav_private *priv = req->priv;
+    vec_ffjob_t *jobs = &req->ff_jobs;
+    dest_id_t ret = req->dest_id;
+    struct tile_desc dst_desc = req->dst_desc;
+
+    /* Traverse the portal path _backwards_ and determine which fields need to be 
+     * generated, as they are not already cached. */
+    for(int i = vec_size(path)-1; i > 0; i--) {
+
+        const struct portal *curr_node = vec_AT(path, i - 1);
+        const struct portal *next_hop = vec_AT(path, i);
+
+        /* If the very first hop takes us into another chunk, that means that the 'nearest portal'
+         * to the source borders the 'next' chunk already. In this case, we must remember to
+         * still generate a flow field for the current chunk steering to this portal. */
+        if(i == 1 && (next_hop->chunk.r != src_desc.chunk_r || next_hop->chunk.c != src_desc.chunk_c))
+            next_hop = vec_AT(path, 0);
+
+        if(curr_node->connected == next_hop)
+            continue;
+
+        /* Since we are moving from 'closest portal' to 'closest portal', it 
+         * may be possible that the very last hop takes us from another portal in the 
+         * destination chunk to the destination portal. This is not needed and will
+         * overwrite the destination flow field made earlier. */
+        if(curr_node->chunk.r == dst_desc.chunk_r 
+        && curr_node->chunk.c == dst_desc.chunk_c
+        && next_hop == dst_port)
+            continue;
+
+        struct coord chunk_coord = curr_node->chunk;
+        struct field_target target = (struct field_target){
+            .type = TARGET_PORTAL,
+            .port = next_hop
+        };
+
+        ff_id_t new_id = N_FlowField_ID(chunk_coord, target);
+        ff_id_t exist_id;
+        int pending = n_pending_ff_job(jobs, chunk_coord);
+
+        /* This is the edge case when a path to a particular target takes us through
+         * the same chunk more than once. This can happen if a chunk is divided into
+         * 'islands' by unpathable barriers. We set the updated flow field for the new 
+         * (least recently used) key. Since in this case more than one flowfield ID maps 
+         * to the same field but we only keep one of the IDs, it may be possible that the 
+         * same flowfield will be redundantly updated at a later time. However, this is 
+         * largely inconsequential. 
+         */
+        if(pending >= 0) {
+
+            /* The field we are building upon is still to be generated. Since the 
+             * result depends on it, the update will be deferred until it's done. */
+            if(vec_AT(jobs, pending).id != new_id) {
+
+                n_push_ff_job(jobs, priv, chunk_coord, target, new_id, NULL, pending);
+                N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
+            }
+
+        }else if(N_FC_GetDestFFMapping(ret, chunk_coord, &exist_id)
+        && N_FC_ContainsFlowField(exist_id)) {
+
+            /* The exact flow field we need has already been made */
+            if(new_id == exist_id) {
+
+                /* Reference field in the cache */
+                (void)N_FC_FlowFieldAt(new_id);
+            }else{
+
+                const struct flow_field *exist_ff = N_FC_FlowFieldAt(exist_id);
+                n_push_ff_job(jobs, priv, chunk_coord, target, new_id, exist_ff, -1);
+                vec_AT(jobs, vec_size(jobs)-1).cost = N_FC_FlowFieldCost(exist_id);
+                N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
+            }
+
+        }else{
+
+            N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
+            if(!N_FC_ContainsFlowField(new_id)) {
+                n_push_ff_job(jobs, priv, chunk_coord, target, new_id, NULL, -1);
+            }else{
+                /* Reference field in the cache */
+                (void)N_FC_FlowFieldAt(new_id);
+            }
+        }
+
+        n_push_los_job(req, chunk_coord);
+    }
+}
+
+/* Plan the fields for all the additional sources of a group request. Rather 
+ * than searching for a path from each source, a single reverse search is run 
+ * from the destination portal, giving the paths from all the sources at once. 
+ * Sources sharing a local island with an already planned source are skipped, 
+ * as they will be steered by the same field. */
+static void n_path_request_plan_group(struct path_request *req, struct tile_desc src_desc)
+{
+    struct nav_private *priv = req->priv;
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc dst_desc = req->dst_desc;
+    const struct nav_chunk *dst_chunk = &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)];
+    uint16_t dst_iid = dst_chunk->islands[dst_desc.tile_r][dst_desc.tile_c];
+    const struct portal *dst_port = n_closest_reachable_portal(dst_chunk, 
+        (struct coord){dst_desc.tile_r, dst_desc.tile_c});
+
+    /* key: (chunk coord, local island ID) */
+    khash_t(id) *planned = kh_init(id);
+    if(!planned)
+        return;
+
+    struct portal_tree *tree = NULL;
+    vec_portal_t path;
+    vec_portal_init(&path);
+
+    int ret;
+    const struct nav_chunk *src_chunk = &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)];
+    kh_put(id, planned, n_local_island_key(src_desc, src_chunk), &ret);
+
+    for(int i = 0; i < req->ngroup_srcs; i++) {
+
+        struct tile_desc curr;
+        if(!M_Tile_DescForPoint2D(res, req->map_pos, req->group_srcs[i], &curr))
+            continue;
+
+        const struct nav_chunk *chunk = &priv->chunks[IDX(curr.chunk_r, priv->width, curr.chunk_c)];
+        if(chunk->islands[curr.tile_r][curr.tile_c] != dst_iid)
+            continue;
+
+        kh_put(id, planned, n_local_island_key(curr, chunk), &ret);
+        if(ret == 0)
+            continue;
+
+        /* The destination field already steers this source */
+        if(curr.chunk_r == dst_desc.chunk_r && curr.chunk_c == dst_desc.chunk_c
+        && (chunk->local_islands[curr.tile_r][curr.tile_c] == chunk->local_islands[dst_desc.tile_r][dst_desc.tile_c]
+            || n_normally_reachable(chunk, 
+                (struct coord){curr.tile_r, curr.tile_c}, 
+                (struct coord){dst_desc.tile_r, dst_desc.tile_c})))
+            continue;
+
+        if(!dst_port)
+            continue;
+
+        if(!tree && !(tree = AStar_PortalTreeBuild(dst_port)))
+            break;
+
+        float cost;
+        if(!AStar_PortalTreePath(tree, curr, priv, &path, &cost))
+            continue;
+
+        /* Every path starts a new LOS chain from the destination chunk */
+        n_push_los_job(req, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c});
+        n_path_request_plan_portals(req, curr, dst_port, &path);
+    }
+
+    if(tree)
+        AStar_PortalTreeFree(tree);
+    vec_portal_destroy(&path);
+    kh_destroy(id, planned);
+}
+
+/* Find a path between the source and destination, and determine which fields
+ * need to be generated, as they are not already cached. No fields are generated
+ * here. Rather, they are collected into a set of jobs which are later farmed 
+ * out to the worker threads. Returns true if a path exists. */
+static uint64_t n_portal_path_key(const struct nav_private *priv, dest_id_t dest_id, 
+                                  struct tile_desc src_desc)
+{
+    const struct nav_chunk *src_chunk = &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)];
+    uint16_t local_iid = src_chunk->local_islands[src_desc.tile_r][src_desc.tile_c];
+
+    return ((uint64_t)dest_id << 32)
+         | ((uint64_t)(src_desc.chunk_r & 0xff) << 24)
+         | ((uint64_t)(src_desc.chunk_c & 0xff) << 16)
+         | ((uint64_t)local_iid);
+}
+
+/* Find the portal path from the source tile to the destination portal, 
+ * re-using the result of an earlier search from the same local island 
+ * when the graph hasn't changed since. */
+static bool n_portal_path_get(const struct nav_private *priv, dest_id_t dest_id, 
+                              struct tile_desc src_desc, const struct portal *dst_port,
+                              vec_portal_t *out_path)
+{
+    uint64_t key = n_portal_path_key(priv, dest_id, src_desc);
+    const struct nav_chunk *src_chunk = &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)];
+    struct coord src_tile = (struct coord){src_desc.tile_r, src_desc.tile_c};
+
+    pppath_t cached;
+    if(lru_ppath_get(&s_portal_paths, key, &cached)) {
+
+        /* Local island IDs are re-assigned as blockers come and go, so make 
+         * sure that the first hop is still reachable from the source. */
+        if(cached->dst_port == dst_port
+        && vec_size(&cached->path) > 0
+        && N_PortalReachableFromTile(vec_AT(&cached->path, 0), src_tile, src_chunk)
+        && vec_portal_copy(out_path, &cached->path))
+            return true;
+
+        lru_ppath_remove(&s_portal_paths, key);
+        n_portal_paths_evict(&cached);
+    }
+
+    float cost;
+    if(!N_HG_PortalGraphPath(src_desc, dst_port, priv, out_path, &cost))
+        return false;
+
+    pppath_t entry = Mem_Alloc(MEM_TAG_NAV, sizeof(struct portal_path));
+    if(!entry)
+        return true;
+
+    entry->dst_port = dst_port;
+    vec_portal_init(&entry->path);
+    if(!vec_portal_copy(&entry->path, out_path)) {
+        n_portal_paths_evict(&entry);
+        return true;
+    }
+    lru_ppath_put(&s_portal_paths, key, &entry);
+    return true;
+}
+
+static bool n_path_request_plan(struct path_request *req)
+{
+    struct nav_private *priv = req->priv;
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    n_update_dirty_local_islands(priv);
+
+    /* Convert source and destination positions to tile coordinates */
+    bool result;
+    (void)result;
+
+    struct tile_desc src_desc, dst_desc;
+    result = M_Tile_DescForPoint2D(res, req->map_pos, req->xz_src, &src_desc);
+    assert(result);
+    result = M_Tile_DescForPoint2D(res, req->map_pos, req->xz_dest, &dst_desc);
+    assert(result);
+
+    dest_id_t ret = n_dest_id(dst_desc);
+    req->dest_id = ret;
+    req->dst_desc = dst_desc;
+
+    /* Handle the case where no path exists between the source and destination 
+     * (i.e. they are on different 'islands'). 
+     */
+    const struct nav_chunk *src_chunk = &priv->chunks[src_desc.chunk_r * priv->width + src_desc.chunk_c];
+    const struct nav_chunk *dst_chunk = &priv->chunks[dst_desc.chunk_r * priv->width + dst_desc.chunk_c];
+    uint16_t src_iid = src_chunk->islands[src_desc.tile_r][src_desc.tile_c];
+    uint16_t dst_iid = dst_chunk->islands[dst_desc.tile_r][dst_desc.tile_c];
+
+    if(src_iid != dst_iid)
+        return false; 
+
+    bool found = false;
+    vec_ffjob_t *jobs = &req->ff_jobs;
+    vec_portal_t path;
+    vec_portal_init(&path);
+
+    /* Even if a mapping exists, the actual flow field may have been evicted from
+     * the cache, due to space constraints or invalidation. */
+    ff_id_t id;
+    if(!N_FC_GetDestFFMapping(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, &id)
+    || !N_FC_ContainsFlowField(id)) {
+
+        struct field_target target = (struct field_target){
+            .type = TARGET_TILE,
+            .tile = (struct coord){dst_desc.tile_r, dst_desc.tile_c}
+        };
+
+        id = N_FlowField_ID((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, target);
+
+        if(!N_FC_ContainsFlowField(id)) {
+        
+            struct coord chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+            n_push_ff_job(jobs, priv, chunk, target, id, NULL, -1);
+        }
+
+        N_FC_PutDestFFMapping(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, id);
+    }
+
+    /* The LOS field for the destination chunk comes first in the chain */
+    n_push_los_job(req, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c});
+
+    /* Source and destination positions are in the same chunk, and a path exists
+     * between them. In this case, we only need a single flow field. .
+     */
+    if(src_desc.chunk_r == dst_desc.chunk_r && src_desc.chunk_c == dst_desc.chunk_c
+    && src_chunk->local_islands[src_desc.tile_r][src_desc.tile_c] == src_chunk->local_islands[dst_desc.tile_r][dst_desc.tile_c]) {
+
+        found = true;
+        goto done;
+    }
+
+    /* If the source and destination are on the same chunk and, in the absence of blockers,
+     * would be reachable from one another, that means that the destination is blocked in
+     * by blockers. In this case, get as close as possible. 
+     */
+    if((src_desc.chunk_r == dst_desc.chunk_r && src_desc.chunk_c == dst_desc.chunk_c)
+    && n_normally_reachable(src_chunk, 
+        (struct coord){src_desc.tile_r, src_desc.tile_c},
+        (struct coord){dst_desc.tile_r, dst_desc.tile_c})) {
+        
+        found = true;
+        goto done;
+    }
+
+    const struct portal *dst_port = n_closest_reachable_portal(dst_chunk, 
+        (struct coord){dst_desc.tile_r, dst_desc.tile_c});
+
+    if(!dst_port)
+        goto done; 
+
+    if(!n_portal_path_get(priv, ret, src_desc, dst_port, &path))
+        goto done;
+
+    found = true;
+
+    n_path_request_plan_portals(req, src_desc, dst_port, &path);
+
+done:
+    vec_portal_destroy(&path);
+    if(found && req->ngroup_srcs > 0)
+        n_path_request_plan_group(req, src_desc);
+    return found;
+}
+
+/* When a request needs many fields at once, they are generated by a compute 
+ * shader on the render thread and read back a few frames later. Only done 
+ * for asynchronous requests, as the caller can't wait on the render thread.
+ */
+static bool n_path_request_submit_gpu(struct path_request *req)
+{
+    if(!CONFIG_NAV_GPU_FIELDS || req->ticket == PATH_TICKET_INVALID)
+        return false;
+    if(!R_NavFieldGPUSupported())
+        return false;
+
+    size_t nfields = 0;
+    for(int i = 0; i < vec_size(&req->ff_jobs); i++) {
+        if(vec_AT(&req->ff_jobs, i).base < 0)
+            nfields++;
+    }
+    if(nfields < CONFIG_NAV_GPU_MIN_FIELDS)
+        return false;
+
+    struct nav_gpu_batch *batch = R_NavFieldBatchAlloc(nfields, FIELD_RES_R);
+    if(!batch)
+        return false;
+
+    size_t idx = 0;
+    for(int i = 0; i < vec_size(&req->ff_jobs); i++) {
+
+        const struct ff_job *curr = &vec_AT(&req->ff_jobs, i);
+        if(curr->base >= 0)
+            continue;
+        uint32_t (*tiles)[FIELD_RES_C] = (void*)(batch->tiles + (idx++ * FIELD_RES_R * FIELD_RES_C));
+        N_FlowFieldGPUInputs(curr->chunk, curr->priv, curr->target, tiles);
+    }
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_NavFieldDispatch,
+        .nargs = 1,
+        .args = { batch },
+    });
+    req->gpu = batch;
+    return true;
+}
+
+static bool n_path_request_gpu_done(const struct path_request *req)
+{
+    if(!req->gpu)
+        return true;
+    return (R_NavFieldBatchPoll(req->gpu) != NAV_GPU_PENDING);
+}
+
+/* Copy the fields generated on the GPU into the jobs. Should the GPU have 
+ * failed to generate them, they are built on the CPU instead. */
+static void n_path_request_apply_gpu(struct path_request *req)
+{
+    if(!req->gpu)
+        return;
+
+    struct nav_gpu_batch *batch = req->gpu;
+    bool done = (R_NavFieldBatchPoll(batch) == NAV_GPU_DONE);
+    size_t idx = 0;
+
+    for(int i = 0; i < vec_size(&req->ff_jobs); i++) {
+
+        struct ff_job *curr = &vec_AT(&req->ff_jobs, i);
+        if(curr->base >= 0)
+            continue;
+
+        if(!done) {
+            n_ff_job_run(curr);
+            continue;
         }
+
+        const uint32_t (*dirs)[FIELD_RES_C] = (void*)(batch->dirs + (idx++ * FIELD_RES_R * FIELD_RES_C));
+        if(!curr->seeded)
+            N_FlowFieldInit(curr->chunk, curr->priv, &curr->ff);
+        N_FlowFieldGPUApply(curr->chunk, curr->priv, curr->target, dirs, &curr->ff);
+        curr->cost = batch->gpu_ms / batch->nfields;
     }
 
-done:
-    queue_td_destroy(&frontier);
-    return ret; 
+    R_NavFieldBatchFree(batch);
+    req->gpu = NULL;
 }
 
-static void n_build_portal_travel_index(struct nav_chunk *chunk)
+/* Hand off all the jobs of a planned request to the worker threads */
+static void n_path_request_submit(struct path_request *req)
 {
-    queue_cc_t frontier;
-    queue_cc_init(&frontier, 1024);
+    struct job sjobs[vec_size(&req->ff_jobs) + 1];
+    size_t nsjobs = 0;
+    bool gpu = n_path_request_submit_gpu(req);
 
-    for(int pi = 0; pi < chunk->num_portals; pi++) {
+    for(int i = 0; i < vec_size(&req->ff_jobs); i++) {
+    
+        struct ff_job *curr = &vec_AT(&req->ff_jobs, i);
+        if(curr->base >= 0 || gpu)
+            continue;
+        sjobs[nsjobs++] = (struct job){n_ff_job_run, curr};
+    }
 
-        bool visited[FIELD_RES_R][FIELD_RES_C] = {0};
-        assert(queue_size(frontier) == 0);
+    /* The LOS chain is built sequentially by a single job */
+    sjobs[nsjobs++] = (struct job){n_los_job_run, req};
 
-        for(int r = 0; r < FIELD_RES_R; r++) {
-        for(int c = 0; c < FIELD_RES_C; c++) {
+    Sched_Submit(sjobs, nsjobs, &req->ctr);
+    req->submitted = true;
+}
 
-            chunk->portal_travel_costs[pi][r][c] = FLT_MAX;
-        }}
+/* Must only be called once all the submitted jobs (and the GPU batch, if 
+ * any) have completed */
+static void n_path_request_commit(struct path_request *req)
+{
+    n_path_request_apply_gpu(req);
+    n_commit_ff_jobs(&req->ff_jobs);
 
-        const struct portal *port = &chunk->portals[pi];
-        for(int r = port->endpoints[0].r; r <= port->endpoints[1].r; r++) {
-        for(int c = port->endpoints[0].c; c <= port->endpoints[1].c; c++) {
+    for(int i = 0; i < vec_size(&req->los_jobs); i++) {
 
-            struct cost_coord cc = (struct cost_coord){0.0f, (struct coord){r,c}};
-            queue_cc_push(&frontier, &cc);
-            visited[r][c] = true;
-        }}
+        struct los_job *curr = &vec_AT(&req->los_jobs, i);
+        if(curr->cached || curr->dup >= 0)
+            continue;
+        N_FC_PutLOSField(req->dest_id, curr->chunk, &curr->lf, curr->cost);
+    }
+}
 
-        while(queue_size(frontier) > 0) {
+static bool n_path_request_touches(const struct path_request *req, struct coord chunk)
+{
+    for(int i = 0; i < vec_size(&req->ff_jobs); i++) {
+        const struct ff_job *curr = &vec_AT(&req->ff_jobs, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c)
+            return true;
+    }
+    for(int i = 0; i < vec_size(&req->los_jobs); i++) {
+        const struct los_job *curr = &vec_AT(&req->los_jobs, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c)
+            return true;
+    }
+    return false;
+}
 
-            struct cost_coord curr;
-            queue_cc_pop(&frontier, &curr);
+static void n_mark_stale_requests(struct coord chunk)
+{
+    for(int i = 0; i < vec_size(&s_path_requests); i++) {
 
-            chunk->portal_travel_costs[pi][curr.coord.r][curr.coord.c] = curr.cost;
+        struct path_request *curr = vec_AT(&s_path_requests, i);
+        if(curr->status != PATH_PENDING || !curr->submitted)
+            continue;
+        if(n_path_request_touches(curr, chunk))
+            curr->stale = true;
+    }
+}
 
-            struct coord neighbours[8];
-            float costs[8];
-            int num_neighbours = N_GridNeighbours(chunk->cost_base, curr.coord, neighbours, costs);
+static int n_path_request_idx(path_ticket_t ticket)
+{
+    for(int i = 0; i < vec_size(&s_path_requests); i++) {
+        if(vec_AT(&s_path_requests, i)->ticket == ticket)
+            return i;
+    }
+    return -1;
+}
 
-            for(int i = 0; i < num_neighbours; i++) {
+/* Wait for the in-flight jobs of all pending requests for the navigation data 
+ * and discard their results. This must be done before making any structural 
+ * changes to the navigation data which the jobs are reading. If 'fail' is not 
+ * set, the requests will be planned again during a later update. */
+static void n_drain_path_requests(const struct nav_private *priv, bool fail)
+{
+    for(int i = 0; i < vec_size(&s_path_requests); i++) {
 
-                if(visited[neighbours[i].r][neighbours[i].c])
-                    continue;
+        struct path_request *curr = vec_AT(&s_path_requests, i);
+        if(curr->priv != priv || curr->status != PATH_PENDING)
+            continue;
 
-                struct cost_coord cc = (struct cost_coord){curr.cost + costs[i], neighbours[i]};
-                queue_cc_push(&frontier, &cc);
-                visited[neighbours[i].r][neighbours[i].c] = true;
-            }
-        }
-    }
+        if(curr->submitted)
+            Sched_Wait(&curr->ctr);
+        n_path_request_clear(curr);
 
-    queue_cc_destroy(&frontier);
+        if(fail)
+            curr->status = PATH_FAILED;
+    }
 }
 
-static const struct portal *n_closest_reachable_portal(const struct nav_chunk *chunk, struct coord start)
+/* Resolve the destination of the request and return the key under which its'
+ * outcome is shared with other requests made during the same tick. Sources in 
+ * the same local island of a chunk are steered by the same flow field. */
+static uint64_t n_path_request_key(struct path_request *req)
 {
-    const struct portal *ret = NULL;
-    float min_cost = FLT_MAX;
+    struct nav_private *priv = req->priv;
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
 
-    for(int i = 0; i < chunk->num_portals; i++) {
+    n_update_dirty_local_islands(priv);
 
-        const struct portal *curr = &chunk->portals[i];
-        float cost = chunk->portal_travel_costs[i][start.r][start.c];
+    bool result;
+    (void)result;
 
-        if(cost < min_cost) {
-            ret = curr;
-            min_cost = cost;
-        }
-    }
-    return ret;
+    struct tile_desc src_desc, dst_desc;
+    result = M_Tile_DescForPoint2D(res, req->map_pos, req->xz_src, &src_desc);
+    assert(result);
+    result = M_Tile_DescForPoint2D(res, req->map_pos, req->xz_dest, &dst_desc);
+    assert(result);
+
+    req->dest_id = n_dest_id(dst_desc);
+    req->dst_desc = dst_desc;
+
+    const struct nav_chunk *src_chunk = &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)];
+    uint16_t local_iid = src_chunk->local_islands[src_desc.tile_r][src_desc.tile_c];
+
+    return ((uint64_t)req->dest_id << 32)
+         | ((uint64_t)(src_desc.chunk_r & 0xff) << 24)
+         | ((uint64_t)(src_desc.chunk_c & 0xff) << 16)
+         | ((uint64_t)local_iid);
 }
 
-static void chunk_bounds(vec3_t map_pos, struct coord chunk, 
-                         vec2_t *out_xz_min, vec2_t *out_xz_max)
+static bool n_path_request_fields_cached(const struct path_request *req)
 {
-    out_xz_min->x = map_pos.x - (chunk.c + 1) * X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH;
-    out_xz_max->x = map_pos.x - (chunk.c + 0) * X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH;
+    struct nav_private *priv = req->priv;
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc src_desc;
+    bool result = M_Tile_DescForPoint2D(res, req->map_pos, req->xz_src, &src_desc);
+    assert(result);
+    (void)result;
 
-    out_xz_min->z = map_pos.z + (chunk.r + 0) * Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT;
-    out_xz_max->z = map_pos.z + (chunk.r + 1) * Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT;
+    ff_id_t id;
+    return N_FC_GetDestFFMapping(req->dest_id, (struct coord){src_desc.chunk_r, src_desc.chunk_c}, &id)
+        && N_FC_ContainsFlowField(id);
 }
 
-/* Every set bit in the returned value represents the index of a portal 
- * in the chunk that we can path to to find enemies on the other side. 
- */
-static uint64_t n_enemy_seek_portalmask(const struct nav_private *priv, vec3_t map_pos, 
-                                        struct coord chunk, int faction_id)
+static bool n_path_request_pending(path_ticket_t ticket)
 {
-    bool top = false, bot = false, left = false, right = false;
+    if(ticket == PATH_TICKET_INVALID)
+        return false;
+    int idx = n_path_request_idx(ticket);
+    return (idx >= 0) && (vec_AT(&s_path_requests, idx)->status == PATH_PENDING);
+}
 
-    struct entity *ents[1];
-    vec2_t xz_min, xz_max;
-    struct coord curr;
+/* Returns true if the request can be served by an earlier request, setting 
+ * 'out_found' to its' outcome. If the request needs to wait for the fields 
+ * of an earlier asynchronous request, 'out_leader' is set to its' ticket. */
+static bool n_path_request_coalesce(const struct path_request *req, uint64_t key, 
+                                    bool *out_found, path_ticket_t *out_leader)
+{
+    *out_leader = PATH_TICKET_INVALID;
 
-    if(chunk.r > 0) {
+    khiter_t k = kh_get(cpath, s_coalesced_paths, key);
+    if(k == kh_end(s_coalesced_paths))
+        return false;
 
-        curr = (struct coord){chunk.r - 1, chunk.c};
-        chunk_bounds(map_pos, curr, &xz_min, &xz_max);
+    struct coalesced_path entry = kh_value(s_coalesced_paths, k);
+    if(req->ticket != PATH_TICKET_INVALID && entry.leader == req->ticket)
+        return false;
 
-        top = (G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, ARR_SIZE(ents), 
-            enemy_ent, (void*)(uintptr_t)faction_id) > 0);
+    if(!entry.found) {
+        *out_found = false;
+        return true;
     }
 
-    if(chunk.r < FIELD_RES_R-1) {
+    if(n_path_request_pending(entry.leader)) {
+        *out_leader = entry.leader;
+        return false;
+    }
 
-        curr = (struct coord){chunk.r + 1, chunk.c};
-        chunk_bounds(map_pos, curr, &xz_min, &xz_max);
+    /* The fields may have been evicted since */
+    if(!n_path_request_fields_cached(req))
+        return false;
 
-        bot = (G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, ARR_SIZE(ents), 
-            enemy_ent, (void*)(uintptr_t)faction_id) > 0);
-    }
+    *out_found = true;
+    return true;
+}
 
-    if(chunk.c > 0) {
+static void n_path_request_note(uint64_t key, bool found, path_ticket_t leader)
+{
+    int ret;
+    khiter_t k = kh_put(cpath, s_coalesced_paths, key, &ret);
+    if(ret == -1)
+        return;
+    kh_value(s_coalesced_paths, k) = (struct coalesced_path){found, leader};
+}
 
-        curr = (struct coord){chunk.r, chunk.c - 1};
-        chunk_bounds(map_pos, curr, &xz_min, &xz_max);
+static void n_service_path_requests(struct nav_private *priv)
+{
+    int nplanned = 0;
 
-        left = (G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, ARR_SIZE(ents), 
-            enemy_ent, (void*)(uintptr_t)faction_id) > 0);
-    }
+    for(int i = 0; i < vec_size(&s_path_requests); i++) {
 
-    if(chunk.c < FIELD_RES_C-1) {
+        struct path_request *curr = vec_AT(&s_path_requests, i);
+        if(curr->priv != priv || curr->status != PATH_PENDING)
+            continue;
 
-        curr = (struct coord){chunk.r, chunk.c + 1};
-        chunk_bounds(map_pos, curr, &xz_min, &xz_max);
+        /* Wait for the earlier request that this one is sharing fields with. 
+         * Should it be cancelled or fail, plan this request on its' own. */
+        if(curr->leader != PATH_TICKET_INVALID) {
 
-        right = (G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, ARR_SIZE(ents), 
-            enemy_ent, (void*)(uintptr_t)faction_id) > 0);
-    }
+            if(n_path_request_pending(curr->leader))
+                continue;
 
-    uint64_t ret = 0;
-    const struct nav_chunk *nchunk = &priv->chunks[IDX(chunk.r, priv->width, chunk.c)];
+            int idx = n_path_request_idx(curr->leader);
+            curr->leader = PATH_TICKET_INVALID;
 
-    for(int i = 0; i < nchunk->num_portals; i++) {
+            if(idx >= 0 && vec_AT(&s_path_requests, idx)->status == PATH_READY) {
+                curr->status = PATH_READY;
+                continue;
+            }
+        }
 
-        const struct portal *curr = &nchunk->portals[i];
+        if(!curr->submitted) {
 
-        if(top && curr->endpoints[0].r == 0 
-               && curr->endpoints[1].r == 0)
-            ret |= (((uint64_t)1) << i);
+            bool found;
+            path_ticket_t leader;
+            uint64_t key = n_path_request_key(curr);
 
-        if(bot && curr->endpoints[0].r == FIELD_RES_R-1 
-               && curr->endpoints[1].r == FIELD_RES_R-1)
-            ret |= (((uint64_t)1) << i);
+            if(n_path_request_coalesce(curr, key, &found, &leader)) {
+                N_FC_NotePathRequest(true);
+                curr->status = found ? PATH_READY : PATH_FAILED;
+                continue;
+            }
+            if(leader != PATH_TICKET_INVALID) {
+                N_FC_NotePathRequest(true);
+                curr->leader = leader;
+                continue;
+            }
 
-        if(left && curr->endpoints[0].c == 0 
-                && curr->endpoints[1].c == 0)
-            ret |= (((uint64_t)1) << i);
+            if(nplanned == CONFIG_NAV_ASYNC_PLANS_PER_FRAME)
+                continue;
+            nplanned++;
 
-        if(right && curr->endpoints[0].c == FIELD_RES_C-1 
-                 && curr->endpoints[1].c == FIELD_RES_C-1)
-            ret |= (((uint64_t)1) << i);
-    }
+            N_FC_NotePathRequest(false);
+            if(!n_path_request_plan(curr)) {
+                n_path_request_note(key, false, PATH_TICKET_INVALID);
+                n_path_request_clear(curr);
+                curr->status = PATH_FAILED;
+                continue;
+            }
+            n_path_request_note(key, true, curr->ticket);
+            n_path_request_submit(curr);
+            continue;
+        }
 
-    return ret;
-}
+        if(!Sched_Done(&curr->ctr) || !n_path_request_gpu_done(curr))
+            continue;
 
-/* Returns true if, in the abscence of any blockers, the tiles would be on the same local island */
-static bool n_normally_reachable(const struct nav_chunk *chunk, struct coord a, struct coord b)
-{
-    for(int i = 0; i < chunk->num_portals; i++) {
-    
-        bool areach = (chunk->portal_travel_costs[i][a.r][a.c] != FLT_MAX);
-        bool breach = (chunk->portal_travel_costs[i][b.r][b.c] != FLT_MAX);
-        if(areach != breach)
-            return false;
+        /* Some of the fields may have been built from data that has since 
+         * changed. Re-plan the request, unless it has been unlucky too many 
+         * times already. In that case, the missing fields will be generated 
+         * on-demand. */
+        if(curr->stale) {
+
+            n_path_request_clear(curr);
+            if(curr->retries++ < MAX_PATH_RETRIES)
+                continue;
+        }else{
+            n_path_request_commit(curr);
+            n_path_request_clear(curr);
+        }
+        curr->status = PATH_READY;
     }
-    return true;
 }
 
 /*****************************************************************************/
@@ -1113,13 +3197,50 @@ bool N_Init(void)
     if((s_dirty_chunks = kh_init(coord)) == NULL)
         return false;
 
+    if((s_dirty_rects = kh_init(rect)) == NULL)
+        return false;
+
+    if((s_loaded_indices = kh_init(tindex)) == NULL)
+        return false;
+
+    if(!lru_efield_init(&s_enemy_fields, CONFIG_ENEMY_FIELD_CACHE_SZ, n_efield_evict))
+        return false;
+
+    if(!lru_ppath_init(&s_portal_paths, CONFIG_PORTAL_PATH_CACHE_SZ, n_portal_paths_evict))
+        return false;
+
+    if((s_tile_deltas = kh_init(delta)) == NULL)
+        return false;
+
+    if((s_coalesced_paths = kh_init(cpath)) == NULL)
+        return false;
+
+    if((s_lowered_chunks = kh_init(coord)) == NULL)
+        return false;
+
+    if((s_island_chunks = kh_init(rect)) == NULL)
+        return false;
+
+    if((s_enemy_portalmasks = kh_init(emask)) == NULL)
+        return false;
+
+    vec_preq_init(&s_path_requests);
+    vec_bop_init(&s_blocker_ops);
     return true;
 }
 
 void N_Update(void *nav_private)
 {
+    PERF_ENTER();
     struct nav_private *priv = nav_private;
-    bool components_dirty = false;
+    uint64_t start = SDL_GetPerformanceCounter();
+    vec_coord_t flipped;
+    vec_coord_init(&flipped);
+
+    s_nav_frame++;
+    kh_clear(cpath, s_coalesced_paths);
+    n_flush_blockers(priv);
+    n_update_dirty_islands(priv);
 
     for(int i = kh_begin(s_dirty_chunks); i != kh_end(s_dirty_chunks); i++) {
 
@@ -1128,27 +3249,60 @@ void N_Update(void *nav_private)
 
         uint32_t key = kh_key(s_dirty_chunks, i);
         struct coord curr = (struct coord){ key >> 16, key & 0xffff };
-        N_FC_InvalidateAllAtChunk(curr);
-
         struct nav_chunk *chunk = &priv->chunks[IDX(curr.r, priv->width, curr.c)];
+
+        n_mark_stale_requests(curr);
         int nflipped = n_update_edge_states(chunk);
+        n_invalidate_chunk_fields(chunk, curr, key, nflipped > 0);
 
         if(nflipped) {
-            components_dirty = true;
-            N_FC_InvalidateAllThroughChunk(curr);
+            vec_coord_push(&flipped, curr);
+            N_HG_MarkDirty(priv, curr);
         }
     }
 
     n_update_dirty_local_islands(priv);
-    if(components_dirty)
-        n_update_components(priv);
+    if(vec_size(&flipped) > 0) {
+        n_update_dirty_components(priv, &flipped);
+        N_HG_Update(priv);
+    }
 
+    vec_coord_destroy(&flipped);
     kh_clear(coord, s_dirty_chunks);
+    kh_clear(coord, s_lowered_chunks);
+    n_service_path_requests(priv);
+
+    N_FC_NoteUpdate(N_FC_ElapsedMs(start));
+    PERF_RETURN_VOID();
 }
 
 void N_Shutdown(void)
 {
+    for(int i = 0; i < vec_size(&s_path_requests); i++) {
+
+        struct path_request *curr = vec_AT(&s_path_requests, i);
+        if(curr->status == PATH_PENDING && curr->submitted)
+            Sched_Wait(&curr->ctr);
+        n_path_request_destroy(curr);
+        free(curr);
+    }
+    vec_preq_destroy(&s_path_requests);
+    n_free_loaded_indices();
+    kh_destroy(tindex, s_loaded_indices);
     kh_destroy(coord, s_dirty_chunks);
+    kh_destroy(rect, s_dirty_rects);
+    lru_efield_destroy(&s_enemy_fields);
+    lru_ppath_destroy(&s_portal_paths);
+    vec_bop_destroy(&s_blocker_ops);
+    kh_destroy(delta, s_tile_deltas);
+    kh_destroy(cpath, s_coalesced_paths);
+    kh_destroy(coord, s_lowered_chunks);
+    kh_destroy(rect, s_island_chunks);
+    kh_destroy(emask, s_enemy_portalmasks);
+    Mem_Free(MEM_TAG_NAV, s_chunk_factions);
+    s_chunk_factions = NULL;
+    s_chunk_factions_cap = 0;
+    s_chunk_factions_valid = false;
     N_FC_Shutdown();
 }
 
@@ -1159,12 +3313,15 @@ void *N_BuildForMapData(size_t w, size_t h,
     struct nav_private *ret;
     size_t alloc_size = sizeof(struct nav_private) + (w * h * sizeof(struct nav_chunk));
 
-    ret = malloc(alloc_size);
+    ret = Mem_Alloc(MEM_TAG_NAV, alloc_size);
     if(!ret)
         goto fail_alloc;
 
     ret->width = w;
     ret->height = h;
+    ret->hgraph = NULL;
+    ret->next_island_id = 0;
+    ret->next_component_id = 1;
 
     assert(FIELD_RES_R >= chunk_h && FIELD_RES_R % chunk_h == 0);
     assert(FIELD_RES_C >= chunk_w && FIELD_RES_C % chunk_w == 0);
@@ -1176,6 +3333,11 @@ void *N_BuildForMapData(size_t w, size_t h,
         struct nav_chunk *curr_chunk = &ret->chunks[IDX(chunk_r, ret->width, chunk_c)];
         const struct tile *curr_tiles = chunk_tiles[IDX(chunk_r, ret->width, chunk_c)];
         curr_chunk->num_portals = 0;
+        curr_chunk->portal_travel_costs = NULL;
+        curr_chunk->travel_index_hash = 0;
+        curr_chunk->travel_index_used = 0;
+        curr_chunk->portal_dists = NULL;
+        curr_chunk->portal_dists_hash = 0;
 
         for(int tile_r = 0; tile_r < chunk_h; tile_r++) {
         for(int tile_c = 0; tile_c < chunk_w; tile_c++) {
@@ -1187,8 +3349,11 @@ void *N_BuildForMapData(size_t w, size_t h,
     }}
 
     n_make_cliff_edges(ret, chunk_tiles, chunk_w, chunk_h);
-    N_UpdatePortals(ret);
-    N_UpdateIslandsField(ret);
+    if(!N_UpdatePortals(ret)) {
+        N_FreePrivate(ret);
+        return NULL;
+    }
+    n_update_islands_full(ret);
     return ret;
 
 fail_alloc:
@@ -1198,7 +3363,20 @@ fail_alloc:
 void N_FreePrivate(void *nav_private)
 {
     assert(nav_private);
-    free(nav_private);
+    struct nav_private *priv = nav_private;
+    n_drain_path_requests(priv, true);
+    N_HG_Free(priv);
+    vec_bop_reset(&s_blocker_ops);
+    kh_clear(cpath, s_coalesced_paths);
+    n_portal_paths_clear();
+    N_EnemySeekTickBegin();
+    s_island_chunks_stale = true;
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+        Mem_Free(MEM_TAG_NAV, priv->chunks[i].portal_travel_costs);
+        Mem_Free(MEM_TAG_NAV, priv->chunks[i].portal_dists);
+    }
+    Mem_Free(MEM_TAG_NAV, nav_private);
 }
 
 void N_RenderPathableChunk(void *nav_private, mat4x4_t *chunk_model,
@@ -1537,6 +3715,46 @@ void N_RenderNavigationPortals(void *nav_private, const struct map *map,
     vec_coord_destroy(&path);
 }
 
+void N_RenderFieldChurn(void *nav_private, const struct map *map, 
+                        mat4x4_t *chunk_model, int chunk_r, int chunk_c)
+{
+    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    const struct nav_private *priv = nav_private;
+    assert(chunk_r < priv->height);
+    assert(chunk_c < priv->width);
+
+    struct fc_chunk_stats stats;
+    unsigned max_invalidated;
+    if(!N_FC_ChunkStatsAt((struct coord){chunk_r, chunk_c}, &stats, &max_invalidated))
+        return;
+
+    float churn = max_invalidated ? ((float)stats.invalidated) / max_invalidated : 0.0f;
+    vec2_t corners_buff[4] = {
+        (vec2_t){ 0.0f,         0.0f       },
+        (vec2_t){ 0.0f,         chunk_z_dim},
+        (vec2_t){-chunk_x_dim,  chunk_z_dim},
+        (vec2_t){-chunk_x_dim,  0.0f       },
+    };
+    vec3_t colors_buff[1] = {
+        (vec3_t){churn, 1.0f - churn, 0.0f}
+    };
+
+    size_t count = 1;
+    R_PushCmd((struct rcmd){
+        .func = R_GL_DrawMapOverlayQuads,
+        .nargs = 5,
+        .args = {
+            R_PushArg(corners_buff, sizeof(corners_buff)),
+            R_PushArg(colors_buff, sizeof(colors_buff)),
+            R_PushArg(&count, sizeof(count)),
+            R_PushArg(chunk_model, sizeof(*chunk_model)),
+            (void*)G_GetPrevTickMap(),
+        },
+    });
+}
+
 void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *obb)
 {
     struct nav_private *priv = nav_private;
@@ -1544,6 +3762,7 @@ void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *o
         priv->width, priv->height,
         FIELD_RES_C, FIELD_RES_R
     };
+    n_drain_path_requests(priv, false);
 
     /* Corners ordered to make a loop */
     vec3_t bot_corners[4] = {obb->corners[0], obb->corners[1], obb->corners[5], obb->corners[4]};
@@ -1578,8 +3797,7 @@ void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *o
         size_t num_tiles = M_Tile_LineSupercoverTilesSorted(res, map_pos, xz_line_segs[i], descs);
         for(int j = 0; j < num_tiles; j++) {
 
-            priv->chunks[IDX(descs[j].chunk_r, priv->width, descs[j].chunk_c)]
-                .cost_base[descs[j].tile_r][descs[j].tile_c] = COST_IMPASSABLE;
+            n_cutout_tile(priv, descs[j]);
 
             if(HIGHER(descs[j], min_rows[i]))
                 min_rows[i] = (struct row_desc){descs[j].chunk_r, descs[j].tile_r};
@@ -1622,77 +3840,238 @@ void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *o
                 bounds.z + bounds.height/2.0f
             };
 
-            if(C_PointInsideRect2D(center, bot_corners_2d[0], bot_corners_2d[1], 
-                                               bot_corners_2d[2], bot_corners_2d[3])) {
-                priv->chunks[IDX(desc.chunk_r, priv->width, desc.chunk_c)]
-                    .cost_base[desc.tile_r][desc.tile_c] = COST_IMPASSABLE;
-            }
+            if(!C_PointInsideRect2D(center, bot_corners_2d[0], bot_corners_2d[1], 
+                                                bot_corners_2d[2], bot_corners_2d[3]))
+                continue;
+
+            n_cutout_tile(priv, desc);
+        }
+    }
+}
+
+bool N_UpdatePortals(void *nav_private)
+{
+    struct nav_private *priv = nav_private;
+    n_drain_path_requests(priv, false);
+    s_index_misses = 0;
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
+    for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
+            
+        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+        curr_chunk->num_portals = 0;
+    }}
+    
+    n_create_portals(priv);
+    n_portal_paths_clear();
+    N_EnemySeekTickBegin();
+
+    /* Once the portals are placed, every chunk can be processed independently */
+    const size_t nchunks = priv->width * priv->height;
+    struct portal_job pjobs[nchunks];
+    struct job jobs[nchunks];
+
+    for(int i = 0; i < nchunks; i++) {
+        pjobs[i] = (struct portal_job){&priv->chunks[i], false, 0};
+        jobs[i] = (struct job){n_portal_job_run, &pjobs[i]};
+    }
+
+    struct job_counter ctr;
+    Sched_Submit(jobs, nchunks, &ctr);
+    Sched_Wait(&ctr);
+
+    bool ret = true;
+    for(int i = 0; i < nchunks; i++) {
+        ret = ret && pjobs[i].result;
+        s_index_misses += pjobs[i].misses;
+    }
+
+    /* On failure, queries will be made against the full portal graph */
+    N_HG_Build(priv);
+    return ret;
+}
+
+void N_UpdateIslandsField(void *nav_private)
+{
+    struct nav_private *priv = nav_private;
+    n_drain_path_requests(priv, false);
+    n_update_dirty_islands(priv);
+}
+
+bool N_LoadCache(const char *path)
+{
+    n_free_loaded_indices();
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return false;
+
+    /* The travel indices are only valid for the field resolution of the 
+     * build that wrote them */
+    uint32_t hdr[4];
+    if(SDL_RWread(stream, hdr, sizeof(hdr), 1) != 1)
+        goto fail;
+    if(hdr[0] != NAVCACHE_MAGIC || hdr[1] != NAVCACHE_VERSION || hdr[2] != FIELD_RES_R)
+        goto fail;
+
+    for(int i = 0; i < hdr[3]; i++) {
+
+        uint64_t hash;
+        uint32_t num_portals;
+
+        if(SDL_RWread(stream, &hash, sizeof(hash), 1) != 1)
+            goto fail;
+        if(SDL_RWread(stream, &num_portals, sizeof(num_portals), 1) != 1)
+            goto fail;
+        if(num_portals == 0 || num_portals > MAX_PORTALS_PER_CHUNK)
+            goto fail;
+
+        struct travel_index ti = (struct travel_index){.num_portals = num_portals};
+        ti.costs = malloc(num_portals * sizeof(*ti.costs));
+        if(!ti.costs)
+            goto fail;
+
+        if(SDL_RWread(stream, ti.costs, sizeof(*ti.costs), num_portals) != num_portals) {
+            free(ti.costs);
+            goto fail;
+        }
+
+        int ret;
+        khiter_t k = kh_put(tindex, s_loaded_indices, hash, &ret);
+        if(ret == -1) {
+            free(ti.costs);
+            goto fail;
         }
+        if(ret == 0)
+            free(kh_value(s_loaded_indices, k).costs);
+        kh_value(s_loaded_indices, k) = ti;
     }
+
+    SDL_RWclose(stream);
+    return true;
+
+fail:
+    n_free_loaded_indices();
+    SDL_RWclose(stream);
+    return false;
 }
 
-void N_UpdatePortals(void *nav_private)
+bool N_SaveCache(void *nav_private, const char *path)
 {
     struct nav_private *priv = nav_private;
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
-    for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
-            
-        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-        curr_chunk->num_portals = 0;
-    }}
-    
-    n_create_portals(priv);
+    /* Everything we have has been loaded from the cache already */
+    if(s_index_misses == 0)
+        return true;
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
-    for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
-            
-        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-        n_link_chunk_portals(curr_chunk, (struct coord){chunk_r, chunk_c});
-        n_build_portal_travel_index(curr_chunk);
-    }}
+    SDL_RWops *stream = SDL_RWFromFile(path, "wb");
+    if(!stream)
+        return false;
+
+    /* Evicted indices are built again just for the sake of being written */
+    uint32_t nentries = 0;
+    for(int i = 0; i < priv->width * priv->height; i++) {
+        if(priv->chunks[i].num_portals > 0)
+            nentries++;
+    }
+
+    uint32_t hdr[4] = {NAVCACHE_MAGIC, NAVCACHE_VERSION, FIELD_RES_R, nentries};
+    if(SDL_RWwrite(stream, hdr, sizeof(hdr), 1) != 1)
+        goto fail;
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        struct nav_chunk *chunk = &priv->chunks[i];
+        if(chunk->num_portals == 0)
+            continue;
+
+        bool evicted = (chunk->portal_travel_costs == NULL);
+        if(!n_travel_index_resident(chunk))
+            goto fail;
+
+        uint32_t num_portals = chunk->num_portals;
+        bool written = SDL_RWwrite(stream, &chunk->travel_index_hash, sizeof(uint64_t), 1) == 1
+                    && SDL_RWwrite(stream, &num_portals, sizeof(num_portals), 1) == 1
+                    && SDL_RWwrite(stream, chunk->portal_travel_costs, 
+                       sizeof(*chunk->portal_travel_costs), num_portals) == num_portals;
+        if(evicted)
+            n_travel_index_evict(chunk);
+        if(!written)
+            goto fail;
+    }
+
+    SDL_RWclose(stream);
+    s_index_misses = 0;
+    return true;
+
+fail:
+    SDL_RWclose(stream);
+    return false;
 }
 
-void N_UpdateIslandsField(void *nav_private)
+void N_PrecomputeFields(void *nav_private, vec3_t map_pos, size_t ndests, const vec2_t xz_dests[])
 {
-    /* We assign a unique ID to each set of tiles that are mutually connected
-     * (i.e. are on the same 'island'). The tile's 'island ID' can then be 
-     * queried from the 'islands' field using the coordinate. 
-     * To build the field, we treat every tile in the cost field as a node in
-     * a graph, with cardinally adjacent pathable tiles being the 'neighbors'. 
-     * Then we solve an instance of the 'coonected components' problem. 
-     */
-
     struct nav_private *priv = nav_private;
-    uint16_t island_id = 0;
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
-    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+    for(int i = 0; i < ndests; i++) {
 
-        /* Initialize every node as 'unvisited' */
-        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-        memset(curr_chunk->islands, 0xff, sizeof(curr_chunk->islands));
-    }}
+        struct tile_desc dst_desc;
+        if(!M_Tile_DescForPoint2D(res, map_pos, xz_dests[i], &dst_desc))
+            continue;
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
-    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+        const struct nav_chunk *dst_chunk = &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)];
+        uint16_t dst_iid = dst_chunk->islands[dst_desc.tile_r][dst_desc.tile_c];
+        if(dst_iid == ISLAND_NONE)
+            continue;
 
-        struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+        /* Make paths towards the destination from all the surrounding chunks. Each 
+         * path starts from the tile closest to the center of its' chunk, which 
+         * is on the same island as the destination. */
+        for(int dr = -CONFIG_NAV_PRECOMPUTE_RADIUS; dr <= CONFIG_NAV_PRECOMPUTE_RADIUS; dr++) {
+        for(int dc = -CONFIG_NAV_PRECOMPUTE_RADIUS; dc <= CONFIG_NAV_PRECOMPUTE_RADIUS; dc++) {
 
-        for(int tile_r = 0; tile_r < FIELD_RES_R; tile_r++) {
-        for(int tile_c = 0; tile_c < FIELD_RES_C; tile_c++) {
+            int chunk_r = dst_desc.chunk_r + dr;
+            int chunk_c = dst_desc.chunk_c + dc;
 
-            if(curr_chunk->islands[tile_r][tile_c] != ISLAND_NONE)
+            if(chunk_r < 0 || chunk_r >= priv->height)
+                continue;
+            if(chunk_c < 0 || chunk_c >= priv->width)
                 continue;
 
-            if(curr_chunk->cost_base[tile_r][tile_c] == COST_IMPASSABLE)
+            const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+            struct tile_desc src_desc;
+            int best_dist = INT_MAX;
+
+            for(int r = 0; r < FIELD_RES_R; r++) {
+            for(int c = 0; c < FIELD_RES_C; c++) {
+
+                if(chunk->islands[r][c] != dst_iid)
+                    continue;
+
+                int dist = abs(r - FIELD_RES_R/2) + abs(c - FIELD_RES_C/2);
+                if(dist < best_dist) {
+                    best_dist = dist;
+                    src_desc = (struct tile_desc){chunk_r, chunk_c, r, c};
+                }
+            }}
+
+            if(best_dist == INT_MAX)
                 continue;
 
-            struct tile_desc td = {chunk_r, chunk_c, tile_r, tile_c};
-            n_visit_island(priv, island_id, td);
-            island_id++;
+            struct box bounds = M_Tile_Bounds(res, map_pos, src_desc);
+            vec2_t xz_src = (vec2_t){
+                bounds.x - bounds.width/2.0f,
+                bounds.z + bounds.height/2.0f
+            };
+
+            dest_id_t id;
+            N_RequestPath(priv, xz_src, xz_dests[i], map_pos, &id);
         }}
-    }}
+    }
 }
 
 dest_id_t N_DestIDForPos(void *nav_private, vec3_t map_pos, vec2_t xz_pos)
@@ -1713,207 +4092,116 @@ dest_id_t N_DestIDForPos(void *nav_private, vec3_t map_pos, vec2_t xz_pos)
 bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
                    vec3_t map_pos, dest_id_t *out_dest_id)
 {
-    struct nav_private *priv = nav_private;
-    struct map_resolution res = {
-        priv->width, priv->height,
-        FIELD_RES_C, FIELD_RES_R
-    };
-
-    n_update_dirty_local_islands(nav_private);
-
-    /* Convert source and destination positions to tile coordinates */
-    bool result;
-    (void)result;
-
-    struct tile_desc src_desc, dst_desc;
-    result = M_Tile_DescForPoint2D(res, map_pos, xz_src, &src_desc);
-    assert(result);
-    result = M_Tile_DescForPoint2D(res, map_pos, xz_dest, &dst_desc);
-    assert(result);
-
-    dest_id_t ret = n_dest_id(dst_desc);
-
-    /* Handle the case where no path exists between the source and destination 
-     * (i.e. they are on different 'islands'). 
-     */
-    const struct nav_chunk *src_chunk = &priv->chunks[src_desc.chunk_r * priv->width + src_desc.chunk_c];
-    const struct nav_chunk *dst_chunk = &priv->chunks[dst_desc.chunk_r * priv->width + dst_desc.chunk_c];
-    uint16_t src_iid = src_chunk->islands[src_desc.tile_r][src_desc.tile_c];
-    uint16_t dst_iid = dst_chunk->islands[dst_desc.tile_r][dst_desc.tile_c];
-
-    if(src_iid != dst_iid)
-        return false; 
-
-    /* Even if a mapping exists, the actual flow field may have been evicted from
-     * the cache, due to space constraints or invalidation. */
-    ff_id_t id;
-    if(!N_FC_GetDestFFMapping(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, &id)
-    || !N_FC_ContainsFlowField(id)) {
-
-        struct field_target target = (struct field_target){
-            .type = TARGET_TILE,
-            .tile = (struct coord){dst_desc.tile_r, dst_desc.tile_c}
-        };
-
-        struct flow_field ff;
-        id = N_FlowField_ID((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, target);
-
-        if(!N_FC_ContainsFlowField(id)) {
-        
-            struct coord chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
-            N_FlowFieldInit(chunk, priv, &ff);
-            N_FlowFieldUpdate(chunk, priv, target, &ff);
-            N_FC_PutFlowField(id, &ff);
-        }
-
-        N_FC_PutDestFFMapping(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, id);
-    }
-
-    /* Create the LOS field for the destination chunk, if necessary */
-    if(!N_FC_ContainsLOSField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c})) {
-
-        struct LOS_field lf;
-        N_LOSFieldCreate(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, dst_desc, priv, map_pos, &lf, NULL);
-        N_FC_PutLOSField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, &lf);
+    /* The missing fields are farmed out to the worker threads. This thread 
+     * helps out with the jobs while waiting for them to complete. */
+    PERF_ENTER();
+    struct path_request req;
+    n_path_request_init(&req, nav_private, xz_src, xz_dest, map_pos);
+
+    /* Requests for the same destination are often made for many groups
+     * at once. Only the first one from each part of a chunk needs to do 
+     * the search. */
+    bool found;
+    path_ticket_t leader;
+    uint64_t key = n_path_request_key(&req);
+
+    if(n_path_request_coalesce(&req, key, &found, &leader)) {
+        N_FC_NotePathRequest(true);
+        if(found)
+            *out_dest_id = req.dest_id;
+        goto out;
     }
 
-    /* Source and destination positions are in the same chunk, and a path exists
-     * between them. In this case, we only need a single flow field. .
-     */
-    if(src_desc.chunk_r == dst_desc.chunk_r && src_desc.chunk_c == dst_desc.chunk_c
-    && src_chunk->local_islands[src_desc.tile_r][src_desc.tile_c] == src_chunk->local_islands[dst_desc.tile_r][dst_desc.tile_c]) {
+    N_FC_NotePathRequest(false);
+    found = n_path_request_plan(&req);
+    if(found) {
 
-        *out_dest_id = ret;
-        return true;
+        n_path_request_submit(&req);
+        Sched_Wait(&req.ctr);
+        n_path_request_commit(&req);
+        *out_dest_id = req.dest_id;
     }
+    n_path_request_note(key, found, PATH_TICKET_INVALID);
 
-    /* If the source and destination are on the same chunk and, in the absence of blockers,
-     * would be reachable from one another, that means that the destination is blocked in
-     * by blockers. In this case, get as close as possible. 
-     */
-    if((src_desc.chunk_r == dst_desc.chunk_r && src_desc.chunk_c == dst_desc.chunk_c)
-    && n_normally_reachable(src_chunk, 
-        (struct coord){src_desc.tile_r, src_desc.tile_c},
-        (struct coord){dst_desc.tile_r, dst_desc.tile_c})) {
-        
-        *out_dest_id = ret;
-        return true;
-    }
+out:
+    n_path_request_destroy(&req);
+    PERF_RETURN(found);
+}
 
-    const struct portal *dst_port = n_closest_reachable_portal(dst_chunk, 
-        (struct coord){dst_desc.tile_r, dst_desc.tile_c});
+path_ticket_t N_RequestPathAsync(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                                 vec3_t map_pos)
+{
+    ASSERT_IN_MAIN_THREAD();
 
-    if(!dst_port)
-        return false; 
+    struct path_request *req = malloc(sizeof(struct path_request));
+    if(!req)
+        return PATH_TICKET_INVALID;
 
-    float cost;
-    vec_portal_t path;
-    vec_portal_init(&path);
+    n_path_request_init(req, nav_private, xz_src, xz_dest, map_pos);
+    req->ticket = s_next_ticket++;
+    if(s_next_ticket == PATH_TICKET_INVALID)
+        s_next_ticket++;
 
-    bool path_exists = AStar_PortalGraphPath(src_desc, dst_port, priv, &path, &cost);
-    if(!path_exists) {
-        vec_portal_destroy(&path);
-        return false; 
+    if(!vec_preq_push(&s_path_requests, req)) {
+        n_path_request_destroy(req);
+        free(req);
+        return PATH_TICKET_INVALID;
     }
+    return req->ticket;
+}
 
-    struct coord prev_los_coord = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
-
-    /* Traverse the portal path _backwards_ and generate the required fields, if they are not already 
-     * cached. Add the results to the fieldcache. */
-    for(int i = vec_size(&path)-1; i > 0; i--) {
-
-        const struct portal *curr_node = vec_AT(&path, i - 1);
-        const struct portal *next_hop = vec_AT(&path, i);
-
-        /* If the very first hop takes us into another chunk, that means that the 'nearest portal'
-         * to the source borders the 'next' chunk already. In this case, we must remember to
-         * still generate a flow field for the current chunk steering to this portal. */
-        if(i == 1 && (next_hop->chunk.r != src_desc.chunk_r || next_hop->chunk.c != src_desc.chunk_c))
-            next_hop = vec_AT(&path, 0);
-
-        if(curr_node->connected == next_hop)
-            continue;
-
-        /* Since we are moving from 'closest portal' to 'closest portal', it 
-         * may be possible that the very last hop takes us from another portal in the 
-         * destination chunk to the destination portal. This is not needed and will
-         * overwrite the destination flow field made earlier. */
-        if(curr_node->chunk.r == dst_desc.chunk_r 
-        && curr_node->chunk.c == dst_desc.chunk_c
-        && next_hop == dst_port)
-            continue;
-
-        struct coord chunk_coord = curr_node->chunk;
-        struct field_target target = (struct field_target){
-            .type = TARGET_PORTAL,
-            .port = next_hop
-        };
-
-        ff_id_t new_id = N_FlowField_ID(chunk_coord, target);
-        ff_id_t exist_id;
-        struct flow_field ff;
-
-        if(N_FC_GetDestFFMapping(ret, chunk_coord, &exist_id)
-        && N_FC_ContainsFlowField(exist_id)) {
-
-            /* The exact flow field we need has already been made */
-            if(new_id == exist_id)
-                goto ff_exists;
-
-            /* This is the edge case when a path to a particular target takes us through
-             * the same chunk more than once. This can happen if a chunk is divided into
-             * 'islands' by unpathable barriers. */
-            const struct flow_field *exist_ff  = N_FC_FlowFieldAt(exist_id);
-            memcpy(&ff, exist_ff, sizeof(struct flow_field));
-
-            N_FlowFieldUpdate(chunk_coord, priv, target, &ff);
-            /* We set the updated flow field for the new (least recently used) key. Since in 
-             * this case more than one flowfield ID maps to the same field but we only keep 
-             * one of the IDs, it may be possible that the same flowfield will be redundantly 
-             * updated at a later time. However, this is largely inconsequential. */
-            N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
-            N_FC_PutFlowField(new_id, &ff);
-
-            goto ff_exists;
-        }
-
-        N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
-        if(!N_FC_ContainsFlowField(new_id)) {
-        
-            N_FlowFieldInit(chunk_coord, priv, &ff);
-            N_FlowFieldUpdate(chunk_coord, priv, target, &ff);
-            N_FC_PutFlowField(new_id, &ff);
-        }
+path_ticket_t N_RequestGroupPathAsync(void *nav_private, const vec2_t *xz_srcs, size_t nsrcs,
+                                      vec2_t xz_dest, vec3_t map_pos)
+{
+    assert(nsrcs > 0);
 
-    ff_exists:
-        assert(N_FC_ContainsFlowField(new_id));
-        /* Reference field in the cache */
-        (void)N_FC_FlowFieldAt(new_id);
+    path_ticket_t ret = N_RequestPathAsync(nav_private, xz_srcs[0], xz_dest, map_pos);
+    if(ret == PATH_TICKET_INVALID || nsrcs == 1)
+        return ret;
 
-        if(!N_FC_ContainsLOSField(ret, chunk_coord)) {
+    struct path_request *req = vec_AT(&s_path_requests, vec_size(&s_path_requests)-1);
+    assert(req->ticket == ret);
 
-            assert((abs(prev_los_coord.r - chunk_coord.r) + abs(prev_los_coord.c - chunk_coord.c)) == 1);
-            assert(N_FC_ContainsLOSField(ret, prev_los_coord));
+    /* Should we fail to allocate, the other sources will get their fields 
+     * on-demand, same as with a regular request */
+    req->group_srcs = malloc((nsrcs - 1) * sizeof(vec2_t));
+    if(req->group_srcs) {
+        memcpy(req->group_srcs, xz_srcs + 1, (nsrcs - 1) * sizeof(vec2_t));
+        req->ngroup_srcs = nsrcs - 1;
+    }
+    return ret;
+}
 
-            const struct LOS_field *prev_los = N_FC_LOSFieldAt(ret, prev_los_coord);
-            assert(prev_los);
-            assert(prev_los->chunk.r == prev_los_coord.r && prev_los->chunk.c == prev_los_coord.c);
+enum path_status N_PathStatus(path_ticket_t ticket, dest_id_t *out_dest_id)
+{
+    int idx = n_path_request_idx(ticket);
+    if(idx < 0)
+        return PATH_FAILED;
+
+    const struct path_request *req = vec_AT(&s_path_requests, idx);
+    if(req->status == PATH_READY && out_dest_id)
+        *out_dest_id = req->dest_id;
+    return req->status;
+}
 
-            struct LOS_field lf;
-            N_LOSFieldCreate(ret, chunk_coord, dst_desc, priv, map_pos, &lf, prev_los);
-            N_FC_PutLOSField(ret, chunk_coord, &lf);
-        }
+void N_PathRelease(path_ticket_t ticket)
+{
+    int idx = n_path_request_idx(ticket);
+    if(idx < 0)
+        return;
 
-        prev_los_coord = chunk_coord;
-    }
-    vec_portal_destroy(&path);
+    struct path_request *req = vec_AT(&s_path_requests, idx);
+    if(req->status == PATH_PENDING && req->submitted)
+        Sched_Wait(&req->ctr);
 
-    *out_dest_id = ret; 
-    return true;
+    n_path_request_destroy(req);
+    free(req);
+    vec_preq_del(&s_path_requests, idx);
 }
 
 vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
-                                  void *nav_private, vec3_t map_pos)
+                                  void *nav_private, vec3_t map_pos, 
+                                  struct nav_cursor *cursor)
 {
     unsigned dir_idx;
     struct nav_private *priv = nav_private;
@@ -1927,6 +4215,20 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
     bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &tile);
     assert(result);
 
+    /* Units stay in the same chunk for many ticks. Until they leave it or the 
+     * cache changes, the field they're following is used without lookups. */
+    if(cursor
+    && cursor->generation == N_FC_FlowFieldGeneration()
+    && cursor->dest_id == id
+    && cursor->chunk_r == tile.chunk_r
+    && cursor->chunk_c == tile.chunk_c) {
+
+        const struct flow_field *ff = cursor->field;
+        dir_idx = ff->field[tile.tile_r][tile.tile_c].dir_idx;
+        if(dir_idx != FD_NONE)
+            return g_flow_dir_lookup[dir_idx];
+    }
+
     ff_id_t ffid;
     if(!N_FC_GetDestFFMapping(id, (struct coord){tile.chunk_r, tile.chunk_c}, &ffid)) {
 
@@ -1971,9 +4273,10 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
      */
     if(local_iid == ISLAND_NONE) {
 
+        uint64_t start = SDL_GetPerformanceCounter();
         struct flow_field exist_ff = *ff;
         N_FlowFieldUpdateToNearestPathable(chunk, (struct coord){tile.tile_r, tile.tile_c}, &exist_ff);
-        N_FC_PutFlowField(ffid, &exist_ff);
+        N_FC_PutFlowField(ffid, &exist_ff, N_FC_FlowFieldCost(ffid) + N_FC_ElapsedMs(start));
         ff = N_FC_FlowFieldAt(ffid);
         goto ff_found;
     }
@@ -1984,9 +4287,10 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
      *      the frontier was prevented from advancing from the destination
      *      due to blockers).
      */
+    uint64_t start = SDL_GetPerformanceCounter();
     struct flow_field exist_ff = *ff;
     N_FlowFieldUpdateIslandToNearest(local_iid, priv, &exist_ff);
-    N_FC_PutFlowField(ffid, &exist_ff);
+    N_FC_PutFlowField(ffid, &exist_ff, N_FC_FlowFieldCost(ffid) + N_FC_ElapsedMs(start));
 
     /*   4. If the direction is still FD_NONE, that means that the
      *      entity is at its' destination of maximally close to it.
@@ -1997,10 +4301,45 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
 
 ff_found:
     assert(ff);
+    if(cursor) {
+        *cursor = (struct nav_cursor){
+            .dest_id = id,
+            .chunk_r = tile.chunk_r,
+            .chunk_c = tile.chunk_c,
+            .field = ff,
+            .generation = N_FC_FlowFieldGeneration(),
+        };
+    }
     dir_idx = ff->field[tile.tile_r][tile.tile_c].dir_idx;
     return g_flow_dir_lookup[dir_idx];
 }
 
+void N_EnemySeekTickBegin(void)
+{
+    s_chunk_factions_valid = false;
+    kh_clear(emask, s_enemy_portalmasks);
+}
+
+size_t N_UpdateResidency(void *nav_private, const bool *hot)
+{
+    ASSERT_IN_MAIN_THREAD();
+    struct nav_private *priv = nav_private;
+    size_t ret = 0;
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        struct nav_chunk *chunk = &priv->chunks[i];
+        if(hot[i] || !chunk->portal_travel_costs)
+            continue;
+        if(s_nav_frame - chunk->travel_index_used < TRAVEL_INDEX_IDLE_FRAMES)
+            continue;
+
+        n_travel_index_evict(chunk);
+        ret++;
+    }
+    return ret;
+}
+
 vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map_pos, int faction_id)
 {
     struct nav_private *priv = nav_private;
@@ -2025,8 +4364,10 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map
     ff_id_t ffid = N_FlowField_ID(chunk, target);
     struct flow_field ff;
 
-    if(!N_FC_ContainsFlowField(ffid)) {
+    if(!N_FC_ContainsFlowField(ffid) || !n_enemy_field_current(priv, ffid, target)) {
 
+        n_enemy_field_forget(ffid);
+        uint64_t start = SDL_GetPerformanceCounter();
         vec2_t chunk_center = (vec2_t){
             map_pos.x - (chunk.c + 0.5f) * X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH,
             map_pos.z + (chunk.r + 0.5f) * Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT,
@@ -2043,12 +4384,22 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map
 
         /* If there are enemies on this chunk, guide towards them. 
          */
+        struct enemy_seeds seeds;
         if(target_tile.chunk_r == curr_tile.chunk_r
-        && target_tile.chunk_c == curr_tile.chunk_c) {
+        && target_tile.chunk_c == curr_tile.chunk_c
+        && N_FlowFieldEnemySeeds(priv, &target.enemies, &seeds)) {
         
+            struct enemy_field *ef = Mem_Alloc(MEM_TAG_NAV, sizeof(struct enemy_field));
             N_FlowFieldInit(chunk, priv, &ff);
-            N_FlowFieldUpdate(chunk, priv, target, &ff);
-            N_FC_PutFlowField(ffid, &ff);
+
+            if(ef) {
+                ef->checked_frame = s_nav_frame;
+                N_FlowFieldUpdateEnemies(chunk, priv, target, &seeds, &ef->state, &ff);
+                lru_efield_put(&s_enemy_fields, ffid, &ef);
+            }else{
+                N_FlowFieldUpdate(chunk, priv, target, &ff);
+            }
+            N_FC_PutFlowField(ffid, &ff, N_FC_ElapsedMs(start));
             done = true;
         }
 
@@ -2065,7 +4416,7 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map
 
             N_FlowFieldInit(chunk, priv, &ff);
             N_FlowFieldUpdate(chunk, priv, pm_target, &ff);
-            N_FC_PutFlowField(ffid, &ff);
+            N_FC_PutFlowField(ffid, &ff, N_FC_ElapsedMs(start));
             done = true;
         }
 
@@ -2104,7 +4455,7 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map
 
             N_FlowFieldInit(chunk, priv, &ff);
             N_FlowFieldUpdate(chunk, priv, portal_target, &ff);
-            N_FC_PutFlowField(ffid, &ff);
+            N_FC_PutFlowField(ffid, &ff, N_FC_ElapsedMs(start));
 
             vec_portal_destroy(&path);
         }
@@ -2121,9 +4472,10 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, vec3_t map
         const struct nav_chunk *nchunk = &priv->chunks[IDX(curr_tile.chunk_r, priv->width, curr_tile.chunk_c)];
         uint16_t local_iid = nchunk->local_islands[curr_tile.tile_r][curr_tile.tile_c];
 
+        uint64_t start = SDL_GetPerformanceCounter();
         struct flow_field exist_ff = *pff;
         N_FlowFieldUpdateIslandToNearest(local_iid, priv, &exist_ff);
-        N_FC_PutFlowField(ffid, &exist_ff);
+        N_FC_PutFlowField(ffid, &exist_ff, N_FC_FlowFieldCost(ffid) + N_FC_ElapsedMs(start));
 
         dir_idx = exist_ff.field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
     }
@@ -2183,6 +4535,28 @@ bool N_PositionBlocked(vec2_t xz_pos, void *nav_private, vec3_t map_pos)
     return chunk->blockers[tile.tile_r][tile.tile_c] > 0;
 }
 
+void N_ChunkTileStates(void *nav_private, int chunk_r, int chunk_c, uint8_t *out_pathable, 
+                       uint8_t *out_blocked, uint16_t *out_islands)
+{
+    struct nav_private *priv = nav_private;
+    assert(chunk_r >= 0 && chunk_r < priv->height);
+    assert(chunk_c >= 0 && chunk_c < priv->width);
+
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        int idx = IDX(r, FIELD_RES_C, c);
+        if(out_pathable)
+            out_pathable[idx] = (chunk->cost_base[r][c] != COST_IMPASSABLE);
+        if(out_blocked)
+            out_blocked[idx] = (chunk->blockers[r][c] > 0);
+        if(out_islands)
+            out_islands[idx] = chunk->islands[r][c];
+    }}
+}
+
 vec2_t N_ClosestReachableDest(void *nav_private, vec3_t map_pos, vec2_t xz_src, vec2_t xz_dst)
 {
     struct nav_private *priv = nav_private;
@@ -2212,8 +4586,7 @@ vec2_t N_ClosestReachableDest(void *nav_private, vec3_t map_pos, vec2_t xz_src,
     /* Get the worldspace coordinates of the tile's center */
     vec2_t tile_dims = N_TileDims(); 
     struct tile_desc closest_td;
-    int ntd = n_closest_island_tiles(priv, dst_desc, src_iid, true, &closest_td, 1);
-    if(!ntd)
+    if(!n_closest_island_tile(priv, dst_desc, src_iid, &closest_td))
         return xz_src;
      
     vec2_t ret = {
@@ -2243,6 +4616,21 @@ void N_BlockersDecref(vec2_t xz_pos, float range, vec3_t map_pos, void *nav_priv
     n_update_blockers(nav_private, xz_pos, range, map_pos, -1);
 }
 
+void N_BlockersBatchIncref(vec2_t xz_pos, float range, vec3_t map_pos)
+{
+    n_queue_blockers(xz_pos, range, map_pos, +1);
+}
+
+void N_BlockersBatchDecref(vec2_t xz_pos, float range, vec3_t map_pos)
+{
+    n_queue_blockers(xz_pos, range, map_pos, -1);
+}
+
+void N_BlockersFlush(void *nav_private)
+{
+    n_flush_blockers(nav_private);
+}
+
 bool N_IsMaximallyClose(void *nav_private, vec3_t map_pos, 
                         vec2_t xz_pos, vec2_t xz_dest, float tolerance)
 {
@@ -2280,6 +4668,19 @@ bool N_IsMaximallyClose(void *nav_private, vec3_t map_pos,
     return false;
 }
 
+float N_PortalTravelCost(const struct nav_chunk *chunk, int portal_idx, struct coord tile)
+{
+    assert(portal_idx >= 0 && portal_idx < chunk->num_portals);
+
+    if(!n_travel_index_resident(chunk))
+        return FLT_MAX;
+
+    uint16_t cost = chunk->portal_travel_costs[portal_idx][tile.r][tile.c];
+    if(cost == PORTAL_COST_NONE)
+        return FLT_MAX;
+    return cost / PORTAL_COST_SCALE;
+}
+
 bool N_PortalReachableFromTile(const struct portal *port, struct coord tile, const struct nav_chunk *chunk)
 {
     for(int r = port->endpoints[0].r; r <= port->endpoints[1].r; r++) {
@@ -2395,3 +4796,10 @@ int N_TilesUnderCircle(const struct nav_private *priv, vec2_t xz_center, float r
     return ret;
 }
 
+void N_SetPhaseHook(nav_phase_hook_t hook)
+{
+#if CONFIG_NAV_PHASE_TIMES
+    g_nav_phase_hook = hook;
+#endif
+}
+
@@ -36,15 +36,32 @@
 #ifndef NAV_DAT_H
 #define NAV_DAT_H
 
+#include "../config.h"
+#include "../map/public/tile.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
 #define MAX_PORTALS_PER_CHUNK 64
-#define FIELD_RES_R           64
-#define FIELD_RES_C           64
+#define FIELD_RES_R           CONFIG_NAV_FIELD_RES
+#define FIELD_RES_C           CONFIG_NAV_FIELD_RES
+
+#if FIELD_RES_C > 64
+#error "The navigation field rows must fit in 64-bit masks"
+#endif
+
+#if (FIELD_RES_R % TILES_PER_CHUNK_HEIGHT) || (FIELD_RES_C % TILES_PER_CHUNK_WIDTH)
+#error "The navigation field resolution must be a multiple of the chunk tile resolution"
+#endif
 #define COST_IMPASSABLE       0xff
 #define ISLAND_NONE           0xffff
 
+/* Portal travel costs are stored as 16-bit fixed-point values with 
+ * 'PORTAL_COST_SCALE' steps per unit of cost. */
+#define PORTAL_COST_SCALE     (8.0f)
+#define PORTAL_COST_MAX       (0xfffe)
+#define PORTAL_COST_NONE      (0xffff)
+
 struct coord{
     int r, c;
 };
@@ -84,9 +101,32 @@ struct nav_chunk{
     uint8_t         cost_base[FIELD_RES_R][FIELD_RES_C]; 
     /* Holds the cost to travel from every tile to every portal,
      * when the portal is reachable from the tile. This field is 
-     * synchronized with the 'cost_base' field.
+     * synchronized with the 'cost_base' field. It is heap-allocated
+     * and holds exactly 'num_portals' quantized cost fields. Tiles
+     * from which a portal cannot be reached hold 'PORTAL_COST_NONE'.
+     */
+    uint16_t      (*portal_travel_costs)[FIELD_RES_R][FIELD_RES_C];
+    /* Hash of the chunk contents (cost field and portals) that the 
+     * 'portal_travel_costs' were built from. 
+     */
+    uint64_t        travel_index_hash;
+    /* The navigation frame in which the 'portal_travel_costs' were last
+     * needed. The index of a chunk which is away from the camera and from 
+     * any units is freed once it has not been needed for a while, and built 
+     * again on demand. The portals and the distances between them always 
+     * stay resident.
+     */
+    uint32_t        travel_index_used;
+    /* Holds the cost of travelling between the centers of every pair of
+     * portals in the chunk, as a heap-allocated 'num_portals' x 'num_portals'
+     * row-major matrix. Pairs of portals without a path between them hold 
+     * FLT_MAX. The edges between the portals are made from this matrix.
+     */
+    float          *portal_dists;
+    /* Hash of the chunk contents that the 'portal_dists' were built from. 
+     * This is cleared when the chunk is modified by a cutout.
      */
-    float           portal_travel_costs[MAX_PORTALS_PER_CHUNK][FIELD_RES_R][FIELD_RES_C];
+    uint64_t        portal_dists_hash;
     /* Every tile in the 'blockers' holds a reference count for
      * how many stationary entities are currently 'retaining' that 
      * tile by being positioned on it. 'Blocked' tiles are treated 
@@ -37,23 +37,70 @@
 #define NAV_PRIVATE_H
 
 #include "../map/public/tile.h"
+#include "../config.h"
 #include "nav_data.h"
+
+#include <SDL.h>
 #include <stddef.h>
 
 struct portal;
+struct hgraph;
+
+enum nav_phase{
+    NAV_PHASE_ASTAR,
+    NAV_PHASE_INTEGRATION,
+    NAV_PHASE_FLOW,
+    NAV_PHASE_LOS,
+    NAV_PHASE_COUNT,
+};
+
+/* Called with the duration (in milliseconds) of every timed phase. May be 
+ * called from the worker threads. */
+typedef void (*nav_phase_hook_t)(enum nav_phase phase, float ms);
+
+#if CONFIG_NAV_PHASE_TIMES
+
+extern nav_phase_hook_t g_nav_phase_hook;
+
+#define NAV_PHASE_START(_var) \
+    uint64_t _var = SDL_GetPerformanceCounter()
+#define NAV_PHASE_END(_var, _phase) \
+    do{ \
+        if(g_nav_phase_hook) \
+            g_nav_phase_hook((_phase), (SDL_GetPerformanceCounter() - (_var)) * 1000.0f \
+                                     / SDL_GetPerformanceFrequency()); \
+    }while(0)
+
+#else
+
+#define NAV_PHASE_START(_var)       /* no-op */
+#define NAV_PHASE_END(_var, _phase) /* no-op */
+
+#endif
 
 struct nav_private{
     size_t           width, height;
+    /* Coarse summary of the portal graph for long-distance queries */
+    struct hgraph   *hgraph;
+    /* The next unused global island ID and portal component ID, 
+     * allowing the islands and components to be updated in place */
+    uint16_t         next_island_id;
+    int              next_component_id;
     struct nav_chunk chunks[];
 };
 
 bool N_PortalReachableFromTile(const struct portal *port, struct coord tile, 
                                const struct nav_chunk *chunk);
 
+float N_PortalTravelCost(const struct nav_chunk *chunk, int portal_idx, struct coord tile);
+
 int  N_GridNeighbours(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord coord, 
                       struct coord out_neighbours[static 8], float out_costs[static 8]);
 
 int  N_TilesUnderCircle(const struct nav_private *priv, vec2_t xz_center, float radius, 
                         vec3_t map_pos, struct tile_desc *out, int maxout);
 
+/* Has no effect unless CONFIG_NAV_PHASE_TIMES is set */
+void N_SetPhaseHook(nav_phase_hook_t hook);
+
 #endif
@@ -46,6 +46,23 @@ struct obb;
 struct entity;
 
 typedef uint32_t dest_id_t;
+typedef uint32_t path_ticket_t;
+
+/* Remembers the flow field that an entity was last following, so that it can 
+ * be used directly for as long as the entity stays in the same chunk and the 
+ * field cache is unchanged. Zero-initialize before the first use. */
+struct nav_cursor{
+    dest_id_t   dest_id;
+    int         chunk_r, chunk_c;
+    const void *field;
+    uint32_t    generation;
+};
+
+enum path_status{
+    PATH_PENDING,
+    PATH_READY,
+    PATH_FAILED,
+};
 
 struct fc_stats{
     unsigned los_used;
@@ -62,9 +79,52 @@ struct fc_stats{
     unsigned grid_path_used;
     unsigned grid_path_max;
     float    grid_path_hit_rate;
+    /* Total time (in milliseconds) it would have taken to compute the 
+     * entries which were instead found in the cache */
+    float    los_time_saved;
+    float    flow_time_saved;
+    float    grid_path_time_saved;
+    /* The fraction of path requests that were served by the result of an
+     * earlier request for the same destination made during the same tick */
+    unsigned path_requests;
+    float    path_coalesce_ratio;
+    /* Total time (in milliseconds) spent in the per-tick navigation update */
+    double   update_ms;
+};
+
+enum fc_cache{
+    FC_CACHE_LOS,
+    FC_CACHE_FLOW,
+    FC_CACHE_FFID,
+    FC_CACHE_GRID_PATH,
+    FC_CACHE_COUNT,
 };
 
-#define DEST_ID_INVALID (~((uint32_t)0))
+/* The activity of one field cache over a window of the stats history. Only 
+ * the LOS and flow caches get invalidated, and the FFID cache holds no 
+ * computed data. */
+struct fc_cache_window{
+    unsigned hits;
+    unsigned misses;
+    unsigned invalidated;
+    /* Time (in milliseconds) spent computing the entries put into the cache */
+    float    compute_ms;
+};
+
+struct fc_window{
+    struct fc_cache_window caches[FC_CACHE_COUNT];
+};
+
+/* The number of LOS and flow fields computed and invalidated at a chunk */
+struct fc_chunk_stats{
+    int      chunk_r;
+    int      chunk_c;
+    unsigned built;
+    unsigned invalidated;
+};
+
+#define DEST_ID_INVALID     (~((uint32_t)0))
+#define PATH_TICKET_INVALID (0)
 
 /*###########################################################################*/
 /* NAV GENERAL                                                               */
@@ -159,6 +219,16 @@ void      N_RenderNavigationBlockers(void *nav_private, const struct map *map,
 void      N_RenderNavigationPortals(void *nav_private, const struct map *map, 
                                     mat4x4_t *chunk_model, int chunk_r, int chunk_c);
 
+/* ------------------------------------------------------------------------
+ * Debug rendering to show how often the cached fields at the chunk have 
+ * been invalidated. The chunks are shaded from green to red, relative to 
+ * the chunk with the most invalidations. Chunks which never had a field 
+ * computed are left as they are.
+ * ------------------------------------------------------------------------
+ */
+void      N_RenderFieldChurn(void *nav_private, const struct map *map, 
+                             mat4x4_t *chunk_model, int chunk_r, int chunk_c);
+
 /* ------------------------------------------------------------------------
  * Make an impassable region in the cost field, completely covering the 
  * specified OBB.
@@ -169,18 +239,47 @@ void      N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct o
 /* ------------------------------------------------------------------------
  * Update portals and the links between them after there have been 
  * changes to the cost field, as new obstructions could have closed off 
- * paths or removed obstructions could have opened up new ones.
+ * paths or removed obstructions could have opened up new ones. Returns
+ * false if the travel indices of some chunks could not be allocated. These
+ * are then built again on demand.
  * ------------------------------------------------------------------------
  */
-void      N_UpdatePortals(void *nav_private);
+bool      N_UpdatePortals(void *nav_private);
 
 /* ------------------------------------------------------------------------
  * Update the islands (sets of tiles which are reachable from one another)
- * information after there have been changes to the cost field.
+ * information after there have been changes to the cost field. Only the
+ * islands touching the chunks that have been modified since the last
+ * update are recomputed.
  * ------------------------------------------------------------------------
  */
 void      N_UpdateIslandsField(void *nav_private);
 
+/* ------------------------------------------------------------------------
+ * Load the route-independent navigation data (the portal travel index) 
+ * from a file written by 'N_SaveCache'. The loaded data will be used in 
+ * place of building it during subsequent portal updates, for chunks with 
+ * identical contents. Returns false if the file could not be read.
+ * ------------------------------------------------------------------------
+ */
+bool      N_LoadCache(const char *path);
+
+/* ------------------------------------------------------------------------
+ * Write the route-independent navigation data to a file, if any of it had
+ * to be built during the last portal update. 
+ * ------------------------------------------------------------------------
+ */
+bool      N_SaveCache(void *nav_private, const char *path);
+
+/* ------------------------------------------------------------------------
+ * Generate and cache the fields for moving towards each of the specified
+ * destinations from its' surrounding area, so that the first path requests
+ * to these destinations will hit a warm cache.
+ * ------------------------------------------------------------------------
+ */
+void      N_PrecomputeFields(void *nav_private, vec3_t map_pos, 
+                             size_t ndests, const vec2_t xz_dests[]);
+
 /* ------------------------------------------------------------------------
  * Returns a unique ID that is used to associated all flow fields guiding 
  * to this (at tile granularity) position.
@@ -198,13 +297,68 @@ dest_id_t N_DestIDForPos(void *nav_private, vec3_t map_pos, vec2_t xz_pos);
 bool      N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
                         vec3_t map_pos, dest_id_t *out_dest_id);
 
+/* ------------------------------------------------------------------------
+ * Queue up a path request without blocking. The request is planned during
+ * a later 'N_Update' call and its' fields are generated by the worker 
+ * threads, being committed to the cache during a subsequent 'N_Update'.
+ * The returned ticket can be used to poll the status of the request and
+ * must be released with 'N_PathRelease' once the caller is done with it.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t    N_RequestPathAsync(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                                    vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Same as 'N_RequestPathAsync', but the fields are planned for all of the
+ * sources (ex. all the members of a group) to the common destination. The
+ * paths for all the sources are found in a single search, rather than one 
+ * search per source chunk. The first source is the primary one, for which
+ * the status of the request is reported.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t    N_RequestGroupPathAsync(void *nav_private, const vec2_t *xz_srcs, size_t nsrcs,
+                                         vec2_t xz_dest, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Returns the status of an asynchronous path request. When the status is
+ * 'PATH_READY', 'out_dest_id' (if non-NULL) is set to the handle for 
+ * querying the relevant fields. Missing fields (ex. ones that were 
+ * invalidated while the request was in flight) will be generated on-demand.
+ * ------------------------------------------------------------------------
+ */
+enum path_status N_PathStatus(path_ticket_t ticket, dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Free the resources associated with the ticket, cancelling the request if 
+ * it is still pending.
+ * ------------------------------------------------------------------------
+ */
+void             N_PathRelease(path_ticket_t ticket);
+
 /* ------------------------------------------------------------------------
  * Returns the desired velocity for an entity at 'curr_pos' for it to flow
- * towards a particular destination.
+ * towards a particular destination. The 'cursor' of the entity may be NULL.
  * ------------------------------------------------------------------------
  */
 vec2_t    N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
-                                     void *nav_private, vec3_t map_pos);
+                                     void *nav_private, vec3_t map_pos, 
+                                     struct nav_cursor *cursor);
+
+/* ------------------------------------------------------------------------
+ * Forget the per-chunk enemy presence and the enemy seek portal masks 
+ * gathered during the previous movement tick. They are lazily rebuilt
+ * in a single batch by the first enemy seek query.
+ * ------------------------------------------------------------------------
+ */
+void      N_EnemySeekTickBegin(void);
+
+/* ------------------------------------------------------------------------
+ * Free the portal travel indices of the chunks which are not set in the 
+ * row-major 'hot' array and which have not been needed for a while. They
+ * are built again when next needed. Returns the number of evicted indices.
+ * ------------------------------------------------------------------------
+ */
+size_t    N_UpdateResidency(void *nav_private, const bool *hot);
 
 /* ------------------------------------------------------------------------
  * Returns the desired velocity for an entity at 'curr_pos' for it to flow
@@ -227,6 +381,26 @@ bool      N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t
  */
 bool      N_PositionPathable(vec2_t xz_pos, void *nav_private, vec3_t map_pos);
 
+/* ------------------------------------------------------------------------
+ * Returns true if the specified XZ position is occupied by a blocker (ex. 
+ * a stationary entity).
+ * ------------------------------------------------------------------------
+ */
+bool      N_PositionBlocked(vec2_t xz_pos, void *nav_private, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Fills in the state of every navigation tile of a chunk at once, in row-
+ * major order, for analyzing the terrain in bulk. Each of the outputs is
+ * 'CONFIG_NAV_FIELD_RES' squared elements long and may be NULL, in which 
+ * case it is skipped. A tile is pathable and blocked in the same sense as 
+ * for 'N_PositionPathable' and 'N_PositionBlocked'. The island IDs are the 
+ * same for any two tiles that are reachable from one another, disregarding 
+ * the blockers.
+ * ------------------------------------------------------------------------
+ */
+void      N_ChunkTileStates(void *nav_private, int chunk_r, int chunk_c, uint8_t *out_pathable, 
+                            uint8_t *out_blocked, uint16_t *out_islands);
+
 /* ------------------------------------------------------------------------
  * Returns the X and Z dimentions (in OpenGL coordinates) of a single 
  * navigation tile.
@@ -251,6 +425,22 @@ vec2_t    N_ClosestReachableDest(void *nav_private, vec3_t map_pos, vec2_t xz_sr
 void      N_BlockersIncref(vec2_t xz_pos, float range, vec3_t map_pos, void *nav_private);
 void      N_BlockersDecref(vec2_t xz_pos, float range, vec3_t map_pos, void *nav_private);
 
+/* ------------------------------------------------------------------------
+ * Queue a blocker reference count change to be applied with the next flush.
+ * The queued changes are summed up per tile so that each affected tile is 
+ * only touched once with its' net change. The queue is flushed at the start 
+ * of every N_Update call.
+ * ------------------------------------------------------------------------
+ */
+void      N_BlockersBatchIncref(vec2_t xz_pos, float range, vec3_t map_pos);
+void      N_BlockersBatchDecref(vec2_t xz_pos, float range, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Apply all the queued blocker reference count changes.
+ * ------------------------------------------------------------------------
+ */
+void      N_BlockersFlush(void *nav_private);
+
 /* ------------------------------------------------------------------------
  * Returns true if the entity position (xz_pos) is within a 'tolerance' 
  * range of the closest non-blocked tile that is reachable from the
@@ -276,6 +466,23 @@ void      N_FC_ClearStats(void);
  */
 void      N_FC_GetStats(struct fc_stats *out_stats);
 
+/* ------------------------------------------------------------------------
+ * Get the activity of the caches over the last (up to) CONFIG_FC_HISTORY_LEN 
+ * windows of CONFIG_FC_HISTORY_WINDOW navigation updates each, oldest first. 
+ * The history is kept across 'N_FC_ClearStats'. Returns the number of 
+ * windows written.
+ * ------------------------------------------------------------------------
+ */
+size_t    N_FC_GetHistory(size_t maxout, struct fc_window *out);
+
+/* ------------------------------------------------------------------------
+ * Get the per-chunk counters for up to 'maxout' chunks which have had 
+ * fields computed at them since the caches were last reset. Returns the 
+ * number of chunks written.
+ * ------------------------------------------------------------------------
+ */
+size_t    N_FC_GetChunkStats(size_t maxout, struct fc_chunk_stats *out);
+
 /* ------------------------------------------------------------------------
  * Reset the contents of all the caches.
  * ------------------------------------------------------------------------
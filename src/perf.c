@@ -0,0 +1,339 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "perf.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX_THREADS     (32)
+#define RING_SIZE       (1 << 15)
+#define MAX_FRAMES      (1024)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+enum perf_ev_type{
+    PERF_BEGIN,
+    PERF_END,
+};
+
+struct perf_event{
+    const char       *name;
+    uint64_t          ts;
+    enum perf_ev_type type;
+};
+
+struct perf_thread{
+    char              name[32];
+    /* The number of events ever written, modulo 2^32. Only the owning thread 
+     * writes the ring, and it publishes every event by bumping the head after 
+     * it is written out. */
+    SDL_atomic_t      head;
+    /* Set once the ring has wrapped around for the first time */
+    SDL_atomic_t      full;
+    struct perf_event ring[RING_SIZE];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                s_initialized = false;
+static SDL_TLSID           s_tls;
+static SDL_SpinLock        s_threads_lock;
+static SDL_atomic_t        s_nthreads;
+static struct perf_thread *s_threads[MAX_THREADS];
+
+/* The start timestamps of the most recent frames */
+static uint64_t            s_frames[MAX_FRAMES];
+static unsigned long       s_nframes = 0;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static struct perf_thread *perf_register(const char *name)
+{
+    struct perf_thread *ret = NULL;
+    SDL_AtomicLock(&s_threads_lock);
+
+    int idx = SDL_AtomicGet(&s_nthreads);
+    if(idx == MAX_THREADS)
+        goto out;
+
+    ret = malloc(sizeof(struct perf_thread));
+    if(!ret)
+        goto out;
+
+    snprintf(ret->name, sizeof(ret->name), "%s", name);
+    SDL_AtomicSet(&ret->head, 0);
+    SDL_AtomicSet(&ret->full, 0);
+    SDL_TLSSet(s_tls, ret, NULL);
+
+    s_threads[idx] = ret;
+    SDL_AtomicSet(&s_nthreads, idx + 1);
+out:
+    SDL_AtomicUnlock(&s_threads_lock);
+    return ret;
+}
+
+static struct perf_thread *perf_curr_thread(void)
+{
+    if(!s_initialized)
+        return NULL;
+
+    struct perf_thread *ret = SDL_TLSGet(s_tls);
+    if(!ret) {
+        char name[32];
+        snprintf(name, sizeof(name), "thread %lu", SDL_ThreadID());
+        ret = perf_register(name);
+    }
+    return ret;
+}
+
+static void perf_record(const char *name, enum perf_ev_type type)
+{
+    struct perf_thread *thread = perf_curr_thread();
+    if(!thread)
+        return;
+
+    unsigned head = SDL_AtomicGet(&thread->head);
+    thread->ring[head % RING_SIZE] = (struct perf_event){
+        .name = name,
+        .ts = SDL_GetPerformanceCounter(),
+        .type = type,
+    };
+    if(head + 1 == RING_SIZE) {
+        SDL_AtomicSet(&thread->full, 1);
+    }
+    SDL_AtomicSet(&thread->head, head + 1);
+}
+
+static void write_escaped(FILE *file, const char *str)
+{
+    for(; *str; str++) {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', file);
+        fputc(*str, file);
+    }
+}
+
+static double ts_to_us(uint64_t ts, uint64_t base)
+{
+    if(ts < base)
+        return 0.0;
+    return (ts - base) * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+/* Copy out the events that are still intact in the ring of 'thread' and 
+ * were recorded no earlier than 'start'. The writer keeps going during the 
+ * copy, so the oldest events that it may have overwritten in the meantime 
+ * (including the one it may be in the middle of writing) are thrown away 
+ * afterwards. 
+ */
+static size_t snapshot_thread(struct perf_thread *thread, uint64_t start, 
+                              struct perf_event *out)
+{
+    bool full = SDL_AtomicGet(&thread->full);
+    unsigned head = SDL_AtomicGet(&thread->head);
+    unsigned avail = full ? RING_SIZE : head;
+    unsigned first = head - avail;
+
+    for(unsigned i = 0; i < avail; i++) {
+        out[i] = thread->ring[(first + i) % RING_SIZE];
+    }
+
+    size_t nevents = avail;
+    size_t skip = 0;
+
+    if(full) {
+        unsigned new_head = SDL_AtomicGet(&thread->head);
+        skip = MIN((size_t)(new_head - head) + 1, nevents);
+    }
+    while(skip < nevents && out[skip].ts < start)
+        skip++;
+
+    memmove(out, out + skip, (nevents - skip) * sizeof(struct perf_event));
+    return nevents - skip;
+}
+
+static void write_comma(FILE *file, bool *first)
+{
+    if(!*first)
+        fputs(",\n", file);
+    *first = false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Perf_Init(void)
+{
+    s_tls = SDL_TLSCreate();
+    if(!s_tls)
+        return false;
+
+    SDL_AtomicSet(&s_nthreads, 0);
+    s_nframes = 0;
+    /* Nothing gets recorded, or allocated, when tracing is compiled out */
+    s_initialized = CONFIG_PERF_TRACE;
+
+    Perf_RegisterThread("main");
+    return true;
+}
+
+void Perf_Shutdown(void)
+{
+    s_initialized = false;
+    int nthreads = SDL_AtomicGet(&s_nthreads);
+    for(int i = 0; i < nthreads; i++) {
+        free(s_threads[i]);
+        s_threads[i] = NULL;
+    }
+    SDL_AtomicSet(&s_nthreads, 0);
+}
+
+void Perf_RegisterThread(const char *name)
+{
+    if(!s_initialized)
+        return;
+
+    struct perf_thread *thread = SDL_TLSGet(s_tls);
+    if(thread) {
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+        return;
+    }
+    perf_register(name);
+}
+
+void Perf_Push(const char *name)
+{
+    perf_record(name, PERF_BEGIN);
+}
+
+void Perf_Pop(void)
+{
+    perf_record(NULL, PERF_END);
+}
+
+void Perf_BeginFrame(void)
+{
+    s_frames[s_nframes++ % MAX_FRAMES] = SDL_GetPerformanceCounter();
+}
+
+bool Perf_DumpTrace(const char *path, int nframes)
+{
+    if(!s_initialized || s_nframes == 0)
+        return false;
+
+    nframes = MIN(nframes, MAX_FRAMES);
+    nframes = MIN(nframes, s_nframes);
+    if(nframes <= 0)
+        return false;
+
+    uint64_t start = s_frames[(s_nframes - nframes) % MAX_FRAMES];
+    uint64_t end = SDL_GetPerformanceCounter();
+
+    struct perf_event *events = malloc(RING_SIZE * sizeof(struct perf_event));
+    if(!events)
+        goto fail_alloc;
+
+    FILE *file = fopen(path, "w");
+    if(!file)
+        goto fail_file;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    bool first = true;
+
+    int nthreads = SDL_AtomicGet(&s_nthreads);
+    for(int i = 0; i < nthreads; i++) {
+
+        struct perf_thread *thread = s_threads[i];
+
+        write_comma(file, &first);
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+            "\"args\":{\"name\":\"", i);
+        write_escaped(file, thread->name);
+        fputs("\"}}", file);
+
+        size_t nevents = snapshot_thread(thread, start, events);
+        int depth = 0;
+
+        for(int j = 0; j < nevents; j++) {
+
+            const struct perf_event *ev = &events[j];
+            if(ev->type == PERF_END) {
+                /* The matching begin predates the window */
+                if(depth == 0)
+                    continue;
+                depth--;
+                write_comma(file, &first);
+                fprintf(file, "{\"ph\":\"E\",\"pid\":0,\"tid\":%d,\"ts\":%.3f}", 
+                    i, ts_to_us(ev->ts, start));
+            }else{
+                depth++;
+                write_comma(file, &first);
+                fputs("{\"name\":\"", file);
+                write_escaped(file, ev->name);
+                fprintf(file, "\",\"ph\":\"B\",\"pid\":0,\"tid\":%d,\"ts\":%.3f}", 
+                    i, ts_to_us(ev->ts, start));
+            }
+        }
+
+        /* Close any scopes that were still open when the dump was taken */
+        while(depth--) {
+            write_comma(file, &first);
+            fprintf(file, "{\"ph\":\"E\",\"pid\":0,\"tid\":%d,\"ts\":%.3f}", 
+                i, ts_to_us(end, start));
+        }
+    }
+
+    fputs("\n]}\n", file);
+    bool ret = !ferror(file);
+    fclose(file);
+    free(events);
+    return ret;
+
+fail_file:
+    free(events);
+fail_alloc:
+    return false;
+}
+
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include "config.h"
+
+#include <stdbool.h>
+
+/* A lightweight instrumentation layer. Every thread records the begin and 
+ * end timestamps of the marked scopes into a ring buffer of its' own, so 
+ * that recording never takes a lock. A window of the most recent frames 
+ * can be exported in the Chrome trace event format, which is read by 
+ * chrome://tracing and Perfetto. The markers compile to nothing unless 
+ * CONFIG_PERF_TRACE is set. 
+ */
+
+#if CONFIG_PERF_TRACE
+
+/* The scope markers must be balanced on every path out of the scope. The 
+ * returned expression is evaluated after the scope is closed. */
+#define PERF_ENTER()            Perf_Push(__func__)
+#define PERF_PUSH(name)         Perf_Push(name)
+#define PERF_POP()              Perf_Pop()
+#define PERF_RETURN(...)        do{ Perf_Pop(); return (__VA_ARGS__); }while(0)
+#define PERF_RETURN_VOID()      do{ Perf_Pop(); return; }while(0)
+
+#else
+
+#define PERF_ENTER()            /* no-op */
+#define PERF_PUSH(name)         /* no-op */
+#define PERF_POP()              /* no-op */
+#define PERF_RETURN(...)        return (__VA_ARGS__)
+#define PERF_RETURN_VOID()      return
+
+#endif
+
+/* ------------------------------------------------------------------------
+ * Must be called from the main thread, before any other thread is started.
+ * ------------------------------------------------------------------------
+ */
+bool Perf_Init(void);
+void Perf_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Gives a name to the calling thread in the exported traces.
+ * ------------------------------------------------------------------------
+ */
+void Perf_RegisterThread(const char *name);
+
+/* ------------------------------------------------------------------------
+ * Open and close a scope on the calling thread. 'name' must be a string 
+ * with static storage duration.
+ * ------------------------------------------------------------------------
+ */
+void Perf_Push(const char *name);
+void Perf_Pop(void);
+
+/* ------------------------------------------------------------------------
+ * Marks the start of a new frame. Called from the main loop.
+ * ------------------------------------------------------------------------
+ */
+void Perf_BeginFrame(void);
+
+/* ------------------------------------------------------------------------
+ * Writes the events of all threads recorded over the last 'nframes' frames 
+ * (as many as are still held in the ring buffers) to the file at 'path' as
+ * Chrome trace JSON. Must be called from the main thread. Returns false if
+ * the file could not be written.
+ * ------------------------------------------------------------------------
+ */
+bool Perf_DumpTrace(const char *path, int nframes);
+
+#endif
+
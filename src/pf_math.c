@@ -221,6 +221,8 @@ void PFM_Mat4x4_Scale(mat4x4_t *op1, GLfloat scale, mat4x4_t *out)
     }
 }
 
+#if !PFM_SIMD
+
 void PFM_Mat4x4_Mult4x4 (mat4x4_t *op1, mat4x4_t *op2, mat4x4_t *out)
 {
     for(int r = 0; r < 4; r++) {
@@ -241,6 +243,20 @@ void PFM_Mat4x4_Mult4x1(mat4x4_t *op1, vec4_t *op2, vec4_t *out)
     }
 }
 
+void PFM_Mat4x4_Mult4x4Batch(mat4x4_t *op1, size_t n, mat4x4_t *op2s, mat4x4_t *outs)
+{
+    for(size_t i = 0; i < n; i++)
+        PFM_Mat4x4_Mult4x4(op1, &op2s[i], &outs[i]);
+}
+
+void PFM_Mat4x4_Mult4x1Batch(mat4x4_t *op1, size_t n, vec4_t *op2s, vec4_t *outs)
+{
+    for(size_t i = 0; i < n; i++)
+        PFM_Mat4x4_Mult4x1(op1, &op2s[i], &outs[i]);
+}
+
+#endif
+
 void PFM_Mat4x4_Identity(mat4x4_t *out)
 {
     memset(out, 0, sizeof(mat4x4_t));
@@ -393,6 +409,8 @@ void PFM_Mat4x4_MakeLookAt(vec3_t *camera_pos, vec3_t *target_pos,
     PFM_Mat4x4_Mult4x4(&axes, &trans, out);
 }
 
+#if !PFM_SIMD_INVERSE
+
 /* Implementation derived from Mesa 3D implementation */
 void PFM_Mat4x4_Inverse(mat4x4_t *in, mat4x4_t *out)
 {
@@ -521,6 +539,8 @@ void PFM_Mat4x4_Inverse(mat4x4_t *in, mat4x4_t *out)
         out->raw[i] = inv[i] * det;
 }
 
+#endif
+
 void PFM_Mat4x4_Transpose(mat4x4_t *in, mat4x4_t *out)
 {
     for(int r = 0; r < 4; r++) {
@@ -46,6 +46,8 @@
 #endif
 #include <math.h>    /* M_PI definition    */
 
+#include "config.h"
+
 #define DEG_TO_RAD(_deg) ((_deg)*(M_PI/180.0f))
 #define RAD_TO_DEG(_rad) ((_rad)*(180.0f/M_PI))
 
@@ -96,6 +98,13 @@ typedef union mat4x4{
     };
 }mat4x4_t;
 
+#if CONFIG_PF_MATH_SIMD
+#include "pf_math_simd.h"
+#else
+#define PFM_SIMD            (0)
+#define PFM_SIMD_INVERSE    (0)
+#endif
+
 
 /*****************************************************************************/
 /* vec2                                                                      */
@@ -148,9 +157,17 @@ void    PFM_Mat3x3_Identity(mat3x3_t *out);
 /*****************************************************************************/
 
 void    PFM_Mat4x4_Scale   (mat4x4_t *op1, GLfloat scale, mat4x4_t *out);
+void    PFM_Mat4x4_Identity(mat4x4_t *out);
+
+/* With PFM_SIMD, these are the static inline functions in pf_math_simd.h. The 
+ * batch variants multiply each of the 'n' operands in 'op2s' by 'op1'.
+ */
+#if !PFM_SIMD
 void    PFM_Mat4x4_Mult4x4 (mat4x4_t *op1, mat4x4_t *op2, mat4x4_t *out);
 void    PFM_Mat4x4_Mult4x1 (mat4x4_t *op1, vec4_t   *op2, vec4_t   *out);
-void    PFM_Mat4x4_Identity(mat4x4_t *out);
+void    PFM_Mat4x4_Mult4x4Batch(mat4x4_t *op1, size_t n, mat4x4_t *op2s, mat4x4_t *outs);
+void    PFM_Mat4x4_Mult4x1Batch(mat4x4_t *op1, size_t n, vec4_t *op2s, vec4_t *outs);
+#endif
 
 void    PFM_Mat4x4_MakeScale   (GLfloat s1, GLfloat s2, GLfloat s3, mat4x4_t *out);
 void    PFM_Mat4x4_MakeTrans   (GLfloat tx, GLfloat ty, GLfloat tz, mat4x4_t *out);
@@ -159,7 +176,9 @@ void    PFM_Mat4x4_MakeRotY    (GLfloat radians, mat4x4_t *out);
 void    PFM_Mat4x4_MakeRotZ    (GLfloat radians, mat4x4_t *out);
 void    PFM_Mat4x4_RotFromQuat (const quat_t *quat, mat4x4_t *out);
 void    PFM_Mat4x4_RotFromEuler(GLfloat deg_x, GLfloat deg_y, GLfloat deg_z, mat4x4_t *out);
+#if !PFM_SIMD_INVERSE
 void    PFM_Mat4x4_Inverse     (mat4x4_t *in, mat4x4_t *out);
+#endif
 void    PFM_Mat4x4_Transpose   (mat4x4_t *in, mat4x4_t *out);
 
 void    PFM_Mat4x4_MakePerspective(GLfloat fov_radians, GLfloat aspect_ratio, 
@@ -0,0 +1,256 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef PF_MATH_SIMD_H
+#define PF_MATH_SIMD_H
+
+/* The SSE (x86) and NEON (ARM) backend of the hottest pf_math routines. It is 
+ * only included by pf_math.h when CONFIG_PF_MATH_SIMD is set, and defines the 
+ * routines as static inline functions with the same signatures as the scalar 
+ * ones in pf_math.c, which are compiled out. When neither instruction set is 
+ * available, PFM_SIMD is left at 0 and the scalar routines are used. 
+ *
+ * The matrices are column-major, so every column is loaded into a single 
+ * register. Loads and stores are unaligned, as matrices are also kept in 
+ * packed buffers (e.g. the render arguments), but are just as fast when the 
+ * data happens to be aligned. Unlike the scalar routines, these are safe to 
+ * call with the output aliasing one of the operands.
+ */
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+
+#include <xmmintrin.h>
+#include <assert.h>
+
+#define PFM_SIMD            (1)
+/* The block-wise inverse needs arbitrary lane shuffles, so it is SSE-only */
+#define PFM_SIMD_INVERSE    (1)
+
+typedef __m128 pfm_v4_t;
+
+#define PFM_V4_LOAD(_p)             _mm_loadu_ps(_p)
+#define PFM_V4_STORE(_p, _v)        _mm_storeu_ps((_p), (_v))
+#define PFM_V4_SPLAT(_s)            _mm_set1_ps(_s)
+#define PFM_V4_MUL(_a, _b)          _mm_mul_ps((_a), (_b))
+/* _a + _b * _c */
+#define PFM_V4_MADD(_a, _b, _c)     _mm_add_ps((_a), _mm_mul_ps((_b), (_c)))
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define PFM_SIMD            (1)
+#define PFM_SIMD_INVERSE    (0)
+
+typedef float32x4_t pfm_v4_t;
+
+#define PFM_V4_LOAD(_p)             vld1q_f32(_p)
+#define PFM_V4_STORE(_p, _v)        vst1q_f32((_p), (_v))
+#define PFM_V4_SPLAT(_s)            vdupq_n_f32(_s)
+#define PFM_V4_MUL(_a, _b)          vmulq_f32((_a), (_b))
+#define PFM_V4_MADD(_a, _b, _c)     vmlaq_f32((_a), (_b), (_c))
+
+#else
+
+#define PFM_SIMD            (0)
+#define PFM_SIMD_INVERSE    (0)
+
+#endif
+
+#if PFM_SIMD
+
+/*****************************************************************************/
+/* mat4x4                                                                    */
+/*****************************************************************************/
+
+/* Returns 'cols' (held in registers) multiplied by the vector 'v' */
+static inline pfm_v4_t pfm_mat_mult_vec(const pfm_v4_t cols[4], const GLfloat v[4])
+{
+    pfm_v4_t ret = PFM_V4_MUL(cols[0], PFM_V4_SPLAT(v[0]));
+    ret = PFM_V4_MADD(ret, cols[1], PFM_V4_SPLAT(v[1]));
+    ret = PFM_V4_MADD(ret, cols[2], PFM_V4_SPLAT(v[2]));
+    ret = PFM_V4_MADD(ret, cols[3], PFM_V4_SPLAT(v[3]));
+    return ret;
+}
+
+static inline void pfm_mat_load(const mat4x4_t *mat, pfm_v4_t out[4])
+{
+    out[0] = PFM_V4_LOAD(mat->cols[0]);
+    out[1] = PFM_V4_LOAD(mat->cols[1]);
+    out[2] = PFM_V4_LOAD(mat->cols[2]);
+    out[3] = PFM_V4_LOAD(mat->cols[3]);
+}
+
+static inline void PFM_Mat4x4_Mult4x4(mat4x4_t *op1, mat4x4_t *op2, mat4x4_t *out)
+{
+    pfm_v4_t a[4], res[4];
+    pfm_mat_load(op1, a);
+
+    for(int c = 0; c < 4; c++)
+        res[c] = pfm_mat_mult_vec(a, op2->cols[c]);
+    for(int c = 0; c < 4; c++)
+        PFM_V4_STORE(out->cols[c], res[c]);
+}
+
+static inline void PFM_Mat4x4_Mult4x1(mat4x4_t *op1, vec4_t *op2, vec4_t *out)
+{
+    pfm_v4_t a[4];
+    pfm_mat_load(op1, a);
+    PFM_V4_STORE(out->raw, pfm_mat_mult_vec(a, op2->raw));
+}
+
+static inline void PFM_Mat4x4_Mult4x4Batch(mat4x4_t *op1, size_t n, 
+                                           mat4x4_t *op2s, mat4x4_t *outs)
+{
+    pfm_v4_t a[4];
+    pfm_mat_load(op1, a);
+
+    for(size_t i = 0; i < n; i++) {
+        pfm_v4_t res[4];
+        for(int c = 0; c < 4; c++)
+            res[c] = pfm_mat_mult_vec(a, op2s[i].cols[c]);
+        for(int c = 0; c < 4; c++)
+            PFM_V4_STORE(outs[i].cols[c], res[c]);
+    }
+}
+
+static inline void PFM_Mat4x4_Mult4x1Batch(mat4x4_t *op1, size_t n, 
+                                           vec4_t *op2s, vec4_t *outs)
+{
+    pfm_v4_t a[4];
+    pfm_mat_load(op1, a);
+
+    for(size_t i = 0; i < n; i++)
+        PFM_V4_STORE(outs[i].raw, pfm_mat_mult_vec(a, op2s[i].raw));
+}
+
+#if PFM_SIMD_INVERSE
+
+#define PFM_SHUFFLE(_a, _b, _x, _y, _z, _w) \
+    _mm_shuffle_ps((_a), (_b), _MM_SHUFFLE((_w), (_z), (_y), (_x)))
+#define PFM_SWIZZLE(_v, _x, _y, _z, _w) \
+    PFM_SHUFFLE((_v), (_v), _x, _y, _z, _w)
+
+/* The 2x2 matrices below are packed into a single register, row by row. 
+ * As the inverse of the transpose is the transpose of the inverse, the 
+ * same code inverts both row-major and column-major 4x4 matrices. 
+ */
+
+/* A * B */
+static inline __m128 pfm_mat2_mul(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, PFM_SWIZZLE(b, 0, 3, 0, 3)),
+                      _mm_mul_ps(PFM_SWIZZLE(a, 1, 0, 3, 2), PFM_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+/* adj(A) * B */
+static inline __m128 pfm_mat2_adj_mul(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(PFM_SWIZZLE(a, 3, 3, 0, 0), b),
+                      _mm_mul_ps(PFM_SWIZZLE(a, 1, 1, 2, 2), PFM_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+/* A * adj(B) */
+static inline __m128 pfm_mat2_mul_adj(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, PFM_SWIZZLE(b, 3, 0, 3, 0)),
+                      _mm_mul_ps(PFM_SWIZZLE(a, 1, 0, 3, 2), PFM_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+/* Inverse by 2x2 blocks: with M = |A B|, the inverse is 1/|M| * |X Y|, where 
+ *                                 |C D|                        |Z W| 
+ * adj(X) = |D|A - B(adj(D)C),      adj(Y) = |B|C - D adj(adj(A)B), 
+ * adj(Z) = |C|B - A adj(adj(D)C), adj(W) = |A|D - C(adj(A)B) 
+ * and |M| = |A||D| + |B||C| - tr((adj(A)B)(adj(D)C)). 
+ */
+static inline void PFM_Mat4x4_Inverse(mat4x4_t *in, mat4x4_t *out)
+{
+    __m128 c0 = _mm_loadu_ps(in->cols[0]);
+    __m128 c1 = _mm_loadu_ps(in->cols[1]);
+    __m128 c2 = _mm_loadu_ps(in->cols[2]);
+    __m128 c3 = _mm_loadu_ps(in->cols[3]);
+
+    __m128 A = _mm_movelh_ps(c0, c1);
+    __m128 B = _mm_movehl_ps(c1, c0);
+    __m128 C = _mm_movelh_ps(c2, c3);
+    __m128 D = _mm_movehl_ps(c3, c2);
+
+    /* (|A|, |B|, |C|, |D|) */
+    __m128 dets = _mm_sub_ps(
+        _mm_mul_ps(PFM_SHUFFLE(c0, c2, 0, 2, 0, 2), PFM_SHUFFLE(c1, c3, 1, 3, 1, 3)),
+        _mm_mul_ps(PFM_SHUFFLE(c0, c2, 1, 3, 1, 3), PFM_SHUFFLE(c1, c3, 0, 2, 0, 2)));
+    __m128 det_a = PFM_SWIZZLE(dets, 0, 0, 0, 0);
+    __m128 det_b = PFM_SWIZZLE(dets, 1, 1, 1, 1);
+    __m128 det_c = PFM_SWIZZLE(dets, 2, 2, 2, 2);
+    __m128 det_d = PFM_SWIZZLE(dets, 3, 3, 3, 3);
+
+    __m128 d_c = pfm_mat2_adj_mul(D, C);
+    __m128 a_b = pfm_mat2_adj_mul(A, B);
+
+    __m128 x = _mm_sub_ps(_mm_mul_ps(det_d, A), pfm_mat2_mul(B, d_c));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, D), pfm_mat2_mul(C, a_b));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, C), pfm_mat2_mul_adj(D, a_b));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, B), pfm_mat2_mul_adj(A, d_c));
+
+    __m128 tr = _mm_mul_ps(a_b, PFM_SWIZZLE(d_c, 0, 2, 1, 3));
+    tr = _mm_add_ps(tr, PFM_SWIZZLE(tr, 2, 3, 0, 1));
+    tr = _mm_add_ps(tr, PFM_SWIZZLE(tr, 1, 0, 3, 2));
+
+    __m128 det = _mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c));
+    det = _mm_sub_ps(det, tr);
+    assert(_mm_cvtss_f32(det) != 0.0f);
+
+    /* The signs of the adjugates' off-diagonal entries are folded in here */
+    __m128 rdet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+    x = _mm_mul_ps(x, rdet);
+    y = _mm_mul_ps(y, rdet);
+    z = _mm_mul_ps(z, rdet);
+    w = _mm_mul_ps(w, rdet);
+
+    _mm_storeu_ps(out->cols[0], PFM_SHUFFLE(x, y, 3, 1, 3, 1));
+    _mm_storeu_ps(out->cols[1], PFM_SHUFFLE(x, y, 2, 0, 2, 0));
+    _mm_storeu_ps(out->cols[2], PFM_SHUFFLE(z, w, 3, 1, 3, 1));
+    _mm_storeu_ps(out->cols[3], PFM_SHUFFLE(z, w, 2, 0, 2, 0));
+}
+
+#undef PFM_SHUFFLE
+#undef PFM_SWIZZLE
+
+#endif /* PFM_SIMD_INVERSE */
+
+#endif /* PFM_SIMD */
+
+#endif
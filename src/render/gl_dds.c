@@ -0,0 +1,286 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_dds.h"
+#include "gl_assert.h"
+
+#include <SDL.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX(a, b)               ((a) > (b) ? (a) : (b))
+#define FOURCC(a, b, c, d)      ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define DDS_MAGIC               FOURCC('D', 'D', 'S', ' ')
+#define DDS_HEADER_SIZE         (124)
+#define DDS_DX10_HEADER_SIZE    (20)
+
+/* Byte offsets into the file */
+#define OFF_SIZE                (4)
+#define OFF_HEIGHT              (12)
+#define OFF_WIDTH               (16)
+#define OFF_MIP_COUNT           (28)
+#define OFF_PF_FLAGS            (80)
+#define OFF_PF_FOURCC           (84)
+#define OFF_CAPS2               (112)
+#define OFF_DXGI_FORMAT         (128)
+#define OFF_ARRAY_SIZE          (140)
+
+#define DDPF_ALPHAPIXELS        (0x1)
+#define DDPF_FOURCC             (0x4)
+#define DDSCAPS2_CUBEMAP        (0x200)
+#define DDSCAPS2_VOLUME         (0x200000)
+
+#define DXGI_FORMAT_BC1_UNORM       (71)
+#define DXGI_FORMAT_BC1_UNORM_SRGB  (72)
+#define DXGI_FORMAT_BC3_UNORM       (77)
+#define DXGI_FORMAT_BC3_UNORM_SRGB  (78)
+#define DXGI_FORMAT_BC7_UNORM       (98)
+#define DXGI_FORMAT_BC7_UNORM_SRGB  (99)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint32_t read_u32(const unsigned char *data, size_t off)
+{
+    return (uint32_t)data[off]
+        | ((uint32_t)data[off + 1] << 8)
+        | ((uint32_t)data[off + 2] << 16)
+        | ((uint32_t)data[off + 3] << 24);
+}
+
+static unsigned char *read_file(const char *path, size_t *out_size)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return NULL;
+
+    const Sint64 fsize = SDL_RWsize(stream);
+    unsigned char *ret = (fsize > 0) ? malloc(fsize) : NULL;
+    if(!ret) {
+        SDL_RWclose(stream);
+        return NULL;
+    }
+
+    Sint64 read, read_total = 0;
+    while(read_total < fsize) {
+        read = SDL_RWread(stream, ret + read_total, 1, fsize - read_total);
+        if(read == 0)
+            break;
+        read_total += read;
+    }
+    SDL_RWclose(stream);
+
+    if(read_total != fsize) {
+        free(ret);
+        return NULL;
+    }
+    *out_size = fsize;
+    return ret;
+}
+
+static bool format_supported(GLenum format)
+{
+    switch(format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        return GLEW_ARB_texture_compression_bptc;
+    default:
+        return false;
+    }
+}
+
+static size_t block_size(GLenum format)
+{
+    switch(format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return 8;
+    default:
+        return 16;
+    }
+}
+
+static bool parse_format(const unsigned char *data, size_t size, GLenum *out_format, size_t *out_data_off)
+{
+    uint32_t pf_flags = read_u32(data, OFF_PF_FLAGS);
+    if(!(pf_flags & DDPF_FOURCC))
+        return false;
+
+    switch(read_u32(data, OFF_PF_FOURCC)) {
+    case FOURCC('D', 'X', 'T', '1'):
+        *out_format = (pf_flags & DDPF_ALPHAPIXELS) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 
+                                                    : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        *out_data_off = 4 + DDS_HEADER_SIZE;
+        return true;
+    case FOURCC('D', 'X', 'T', '5'):
+        *out_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        *out_data_off = 4 + DDS_HEADER_SIZE;
+        return true;
+    case FOURCC('D', 'X', '1', '0'):
+        break;
+    default:
+        return false;
+    }
+
+    if(size < 4 + DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE)
+        return false;
+    if(read_u32(data, OFF_ARRAY_SIZE) > 1)
+        return false;
+
+    /* The engine doesn't do any gamma-correct sampling, so the sRGB 
+     * variants are treated the same as the linear ones. */
+    switch(read_u32(data, OFF_DXGI_FORMAT)) {
+    case DXGI_FORMAT_BC1_UNORM:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:
+        *out_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        break;
+    case DXGI_FORMAT_BC3_UNORM:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:
+        *out_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        break;
+    case DXGI_FORMAT_BC7_UNORM:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:
+        *out_format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+        break;
+    default:
+        return false;
+    }
+    *out_data_off = 4 + DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE;
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_DDS_CookedPath(const char *path, char *out, size_t maxout)
+{
+    assert(maxout > 0);
+    const char *ext = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    size_t len = (ext && (!slash || ext > slash)) ? (size_t)(ext - path) : strlen(path);
+
+    if(len + sizeof(".dds") > maxout) {
+        out[0] = '\0';
+        return;
+    }
+    memcpy(out, path, len);
+    strcpy(out + len, ".dds");
+}
+
+bool R_DDS_Load(const char *path, struct dds_image *out)
+{
+    size_t size;
+    unsigned char *data = read_file(path, &size);
+    if(!data)
+        goto fail_read;
+
+    if(size < 4 + DDS_HEADER_SIZE
+    || read_u32(data, 0) != DDS_MAGIC
+    || read_u32(data, OFF_SIZE) != DDS_HEADER_SIZE)
+        goto fail_parse;
+
+    if(read_u32(data, OFF_CAPS2) & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+        goto fail_parse;
+
+    GLenum format;
+    size_t off;
+    if(!parse_format(data, size, &format, &off))
+        goto fail_parse;
+    if(!format_supported(format))
+        goto fail_parse;
+
+    int width = read_u32(data, OFF_WIDTH);
+    int height = read_u32(data, OFF_HEIGHT);
+    int num_levels = MAX(read_u32(data, OFF_MIP_COUNT), 1);
+    if(width <= 0 || height <= 0 || num_levels > DDS_MAX_LEVELS)
+        goto fail_parse;
+
+    const size_t bs = block_size(format);
+    for(int i = 0; i < num_levels; i++) {
+
+        size_t level_size = MAX((width + 3) / 4, 1) * MAX((height + 3) / 4, 1) * bs;
+        if(off + level_size > size)
+            goto fail_parse;
+
+        out->levels[i] = (struct dds_level){width, height, off, level_size};
+        off += level_size;
+        width = MAX(width / 2, 1);
+        height = MAX(height / 2, 1);
+    }
+
+    out->format = format;
+    out->num_levels = num_levels;
+    out->data = data;
+    out->data_size = size;
+    return true;
+
+fail_parse:
+    free(data);
+fail_read:
+    return false;
+}
+
+void R_DDS_Free(struct dds_image *img)
+{
+    free(img->data);
+    img->data = NULL;
+}
+
+void R_GL_DDS_Upload2D(const struct dds_image *img, bool from_pbo)
+{
+    for(int i = 0; i < img->num_levels; i++) {
+
+        const struct dds_level *lvl = &img->levels[i];
+        const void *src = from_pbo ? (const void*)lvl->offset 
+                                   : (const void*)(img->data + lvl->offset);
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, img->format, lvl->width, lvl->height, 
+            0, lvl->size, src);
+    }
+    /* The stored chain doesn't have to go all the way down to 1x1 */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img->num_levels - 1);
+    GL_ASSERT_OK();
+}
+
@@ -0,0 +1,91 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef GL_DDS_H
+#define GL_DDS_H
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Loading of block-compressed (BC1, BC3 and BC7) textures with their 
+ * precomputed mip chains, stored in DDS files. The cooked files hold the 
+ * rows of every level bottom-first, same as the images uploaded by the 
+ * stb_image path, so they can be uploaded as-is.
+ */
+
+#define DDS_MAX_LEVELS  (16)
+
+struct dds_level{
+    int    width, height;
+    size_t offset; /* Into the file contents */
+    size_t size;
+};
+
+struct dds_image{
+    GLenum           format;
+    int              num_levels;
+    struct dds_level levels[DDS_MAX_LEVELS];
+    unsigned char   *data;
+    size_t           data_size;
+};
+
+/* ------------------------------------------------------------------------
+ * Writes the path of the cooked counterpart of an image file, which is the 
+ * same path with the extension replaced by '.dds'.
+ * ------------------------------------------------------------------------
+ */
+void R_DDS_CookedPath(const char *path, char *out, size_t maxout);
+
+/* ------------------------------------------------------------------------
+ * Reads and validates a DDS file. Doesn't make any GL calls, so it is safe
+ * to call from any thread. Fails if the format of the file is not one of 
+ * the supported ones or if the current context cannot sample it.
+ * ------------------------------------------------------------------------
+ */
+bool R_DDS_Load(const char *path, struct dds_image *out);
+void R_DDS_Free(struct dds_image *img);
+
+/* ------------------------------------------------------------------------
+ * Specifies all the levels of the texture bound to GL_TEXTURE_2D. With 
+ * 'from_pbo', the data is read from the buffer bound to 
+ * GL_PIXEL_UNPACK_BUFFER, which must hold the file contents at offset 0.
+ * ------------------------------------------------------------------------
+ */
+void R_GL_DDS_Upload2D(const struct dds_image *img, bool from_pbo);
+
+#endif
+
@@ -0,0 +1,265 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_dynres.h"
+#include "gl_perf.h"
+#include "gl_assert.h"
+#include "../config.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi) (MIN(MAX((a), (lo)), (hi)))
+
+/* The timings lag the frames by a couple of frames, so the scale is only 
+ * changed every few frames to give the last change time to show up. */
+#define ADJUST_INTERVAL (8)
+/* The scale goes back up only once the scene is comfortably under budget */
+#define LOW_WATERMARK   (0.8f)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct{
+    bool   enabled;
+    float  budget_ms;
+    float  scale;
+    bool   in_scene;
+    bool   offscreen;
+    int    since_adjust;
+    /* The targets cover the whole window, and only a part of them is 
+     * rendered to, so that they needn't change with the scale. */
+    GLuint FBO;
+    GLuint color_tex;
+    GLuint depth_rb;
+    int    width, height;
+}s_ctx;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void dynres_free_targets(void)
+{
+    glDeleteFramebuffers(1, &s_ctx.FBO);
+    glDeleteTextures(1, &s_ctx.color_tex);
+    glDeleteRenderbuffers(1, &s_ctx.depth_rb);
+
+    s_ctx.FBO = s_ctx.color_tex = s_ctx.depth_rb = 0;
+    s_ctx.width = s_ctx.height = 0;
+}
+
+static bool dynres_make_targets(int width, int height)
+{
+    glGenTextures(1, &s_ctx.color_tex);
+    glBindTexture(GL_TEXTURE_2D, s_ctx.color_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    /* The minimap and the 3D scene both rely on the stencil buffer */
+    glGenRenderbuffers(1, &s_ctx.depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, s_ctx.depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &s_ctx.FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_ctx.FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_ctx.color_tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, s_ctx.depth_rb);
+
+    bool complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if(!complete) {
+        dynres_free_targets();
+        return false;
+    }
+
+    s_ctx.width = width;
+    s_ctx.height = height;
+    GL_ASSERT_OK();
+    return true;
+}
+
+static void dynres_adjust_scale(void)
+{
+    if(++s_ctx.since_adjust < ADJUST_INTERVAL)
+        return;
+
+    float gpu_ms[GPU_PASS_COUNT];
+    R_GL_PerfGetTimings(gpu_ms);
+    float scene_ms = gpu_ms[GPU_PASS_SCENE];
+
+    if(scene_ms <= 0.0f)
+        return;
+    if(scene_ms <= s_ctx.budget_ms && scene_ms >= s_ctx.budget_ms * LOW_WATERMARK)
+        return;
+
+    /* The cost of the scene is taken to be proportional to the number of 
+     * pixels, which is the square of the scale. The target is the middle 
+     * of the band where the scale is left alone. */
+    float target_ms = s_ctx.budget_ms * (1.0f + LOW_WATERMARK) / 2.0f;
+    float scale = s_ctx.scale * sqrtf(target_ms / scene_ms);
+
+    scale = roundf(scale / CONFIG_DYNRES_STEP) * CONFIG_DYNRES_STEP;
+    scale = CLAMP(scale, CONFIG_DYNRES_MIN_SCALE, 1.0f);
+
+    if(scale != s_ctx.scale) {
+        s_ctx.scale = scale;
+        s_ctx.since_adjust = 0;
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_DynresInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    memset(&s_ctx, 0, sizeof(s_ctx));
+    s_ctx.scale = 1.0f;
+    s_ctx.budget_ms = 1000.0f / 60.0f;
+}
+
+void R_GL_DynresShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    dynres_free_targets();
+    memset(&s_ctx, 0, sizeof(s_ctx));
+}
+
+void R_GL_DynresSetEnabled(const bool *on)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(!s_ctx.in_scene);
+
+    s_ctx.enabled = *on;
+    s_ctx.scale = 1.0f;
+    s_ctx.since_adjust = 0;
+
+    if(!s_ctx.enabled) {
+        dynres_free_targets();
+    }
+}
+
+void R_GL_DynresSetBudget(const float *ms)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    s_ctx.budget_ms = *ms;
+    s_ctx.since_adjust = 0;
+}
+
+void R_GL_DynresBeginScene(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(!s_ctx.in_scene);
+
+    s_ctx.in_scene = true;
+    s_ctx.offscreen = false;
+    R_GL_PerfBegin(GPU_PASS_SCENE);
+
+    if(!s_ctx.enabled)
+        return;
+
+    int width, height;
+    Engine_WinDrawableSize(&width, &height);
+
+    if(width != s_ctx.width || height != s_ctx.height) {
+        dynres_free_targets();
+        if(!dynres_make_targets(width, height))
+            return;
+    }
+
+    dynres_adjust_scale();
+    s_ctx.offscreen = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_ctx.FBO);
+    glViewport(0, 0, MAX(width * s_ctx.scale, 1), MAX(height * s_ctx.scale, 1));
+}
+
+void R_GL_DynresEndScene(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_ctx.in_scene)
+        return;
+
+    s_ctx.in_scene = false;
+    R_GL_PerfEnd(GPU_PASS_SCENE);
+
+    if(!s_ctx.offscreen)
+        return;
+
+    int width, height;
+    Engine_WinDrawableSize(&width, &height);
+
+    /* The viewport is the part of the target that the scene covers */
+    int sw = MAX(width * s_ctx.scale, 1);
+    int sh = MAX(height * s_ctx.scale, 1);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s_ctx.FBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, sw, sh, 0, 0, width, height, GL_COLOR_BUFFER_BIT, 
+        sw == width ? GL_NEAREST : GL_LINEAR);
+
+    /* Everything after the scene is drawn at the full resolution */
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    s_ctx.offscreen = false;
+    GL_ASSERT_OK();
+}
+
+float R_GL_DynresScale(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    return s_ctx.enabled ? s_ctx.scale : 1.0f;
+}
+
@@ -0,0 +1,71 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef GL_DYNRES_H
+#define GL_DYNRES_H
+
+#include <stdbool.h>
+
+/* When the dynamic resolution is on, the 3D scene is rendered into an 
+ * offscreen target covering a fraction of the window, and stretched over 
+ * the default framebuffer before the screenspace UI is drawn on top. The 
+ * fraction follows the GPU time of the scene, to keep it within a budget.
+ */
+
+void  R_GL_DynresInit(void);
+void  R_GL_DynresShutdown(void);
+
+void  R_GL_DynresSetEnabled(const bool *on);
+void  R_GL_DynresSetBudget(const float *ms);
+
+/* ------------------------------------------------------------------------
+ * Binds the target that the 3D scene of this frame is rendered into and 
+ * sets the viewport to cover it. 
+ * ------------------------------------------------------------------------
+ */
+void  R_GL_DynresBeginScene(void);
+
+/* ------------------------------------------------------------------------
+ * Upscales the scene to the default framebuffer, which is bound after. 
+ * Does nothing when the scene isn't being rendered.
+ * ------------------------------------------------------------------------
+ */
+void  R_GL_DynresEndScene(void);
+
+/* The fraction of the window's width and height that the scene is rendered at */
+float R_GL_DynresScale(void);
+
+#endif
+
@@ -0,0 +1,174 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_render.h"
+#include "gl_shader.h"
+#include "gl_state.h"
+#include "gl_assert.h"
+#include "gl_uniforms.h"
+#include "public/render.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <assert.h>
+
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_terrain_shaders[] = {
+    "terrain",
+    "terrain-shadowed",
+};
+
+static struct{
+    GLuint tex;
+    int    w, h;
+    vec4_t bounds;
+}s_fog;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void fog_set_uniforms(bool on)
+{
+    for(int i = 0; i < ARR_SIZE(s_terrain_shaders); i++) {
+
+        GLuint shader_prog = R_GL_Shader_GetProgForName(s_terrain_shaders[i]);
+        glUseProgram(shader_prog);
+
+        GLuint loc = glGetUniformLocation(shader_prog, GL_U_FOG_ENABLED);
+        glUniform1i(loc, on);
+
+        if(!on)
+            continue;
+
+        loc = glGetUniformLocation(shader_prog, GL_U_FOG_BOUNDS);
+        glUniform4fv(loc, 1, s_fog.bounds.raw);
+
+        loc = glGetUniformLocation(shader_prog, GL_U_FOG_TEX);
+        glUniform1i(loc, FOG_TUNIT - GL_TEXTURE0);
+    }
+    GL_ASSERT_OK();
+}
+
+static void fog_create_texture(int w, int h)
+{
+    if(s_fog.tex) {
+        glDeleteTextures(1, &s_fog.tex);
+    }
+
+    glGenTextures(1, &s_fog.tex);
+    glBindTexture(GL_TEXTURE_2D, s_fog.tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+
+    /* Filtering smooths out the edges of the tiles */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    /* Sampled as an opaque grey, so that it can be multiplied into the 
+     * colors of the minimap as well */
+    GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+
+    s_fog.w = w;
+    s_fog.h = h;
+    GL_ASSERT_OK();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_FogUpdate(const int *dims, const int *rect, const vec4_t *bounds, const void *texels)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_fog.tex || s_fog.w != dims[0] || s_fog.h != dims[1]) {
+        fog_create_texture(dims[0], dims[1]);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, s_fog.tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect[0], rect[1], rect[2], rect[3], 
+        GL_RED, GL_UNSIGNED_BYTE, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    R_GL_StateBindTexture(FOG_TUNIT, GL_TEXTURE_2D, s_fog.tex);
+    s_fog.bounds = *bounds;
+    fog_set_uniforms(true);
+}
+
+void R_GL_FogDisable(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_fog.tex)
+        return;
+
+    fog_set_uniforms(false);
+    glDeleteTextures(1, &s_fog.tex);
+    memset(&s_fog, 0, sizeof(s_fog));
+    GL_ASSERT_OK();
+}
+
+void R_GL_FogEnableTerrain(bool on)
+{
+    ASSERT_IN_RENDER_THREAD();
+    fog_set_uniforms(on && s_fog.tex);
+}
+
+bool R_GL_FogTexture(GLuint *out)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_fog.tex)
+        return false;
+    *out = s_fog.tex;
+    return true;
+}
+
+vec4_t R_GL_FogBounds(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    return s_fog.bounds;
+}
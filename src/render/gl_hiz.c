@@ -0,0 +1,441 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/render.h"
+#include "gl_shader.h"
+#include "gl_assert.h"
+#include "public/render_ctrl.h"
+#include "../collision.h"
+#include "../config.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+
+#define HIZ_READBACKS   (3)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+/* A grid of maximum depths, covering the viewport it was captured with. 
+ * A texel holds the depth of the furthest pixel of a square block, which 
+ * is (1 << shift) pixels wide. */
+struct hiz_grid{
+    bool     valid;
+    uint32_t epoch;
+    mat4x4_t view_proj;
+    int      vp_w, vp_h;
+    int      w, h;
+    int      shift;
+    float   *depth;
+    size_t   cap;
+};
+
+struct hiz_readback{
+    GLuint   PBO;
+    GLsync   fence;
+    uint32_t epoch;
+    mat4x4_t view_proj;
+    int      vp_w, vp_h;
+    int      w, h;
+    int      shift;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Render thread state */
+static struct{
+    GLuint              depth_tex;
+    GLuint              hiz_tex;
+    GLuint              FBO;
+    GLuint              VAO;
+    int                 vp_w, vp_h;
+    int                 nlevels;
+    struct hiz_readback readbacks[HIZ_READBACKS];
+    int                 next_readback;
+}s_gl;
+
+/* Published by the render thread, under the lock */
+static SDL_SpinLock    s_lock;
+static struct hiz_grid s_published;
+
+/* Main thread state */
+static uint32_t        s_epoch;
+static struct hiz_grid s_local;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool hiz_grid_copy(struct hiz_grid *dst, const struct hiz_grid *src)
+{
+    size_t size = src->w * src->h;
+    if(size > dst->cap) {
+        float *depth = realloc(dst->depth, size * sizeof(float));
+        if(!depth)
+            return false;
+        dst->depth = depth;
+        dst->cap = size;
+    }
+
+    float *depth = dst->depth;
+    size_t cap = dst->cap;
+    *dst = *src;
+    dst->depth = depth;
+    dst->cap = cap;
+
+    if(src->valid) {
+        memcpy(dst->depth, src->depth, size * sizeof(float));
+    }
+    return true;
+}
+
+static void hiz_free_buffers(void)
+{
+    glDeleteTextures(1, &s_gl.depth_tex);
+    glDeleteTextures(1, &s_gl.hiz_tex);
+    s_gl.depth_tex = s_gl.hiz_tex = 0;
+    s_gl.vp_w = s_gl.vp_h = 0;
+}
+
+static void hiz_make_buffers(int w, int h)
+{
+    glGenTextures(1, &s_gl.depth_tex);
+    glBindTexture(GL_TEXTURE_2D, s_gl.depth_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    /* Level 0 of the pyramid is half the size of the viewport. Reduction 
+     * stops at the first level that is narrow enough to be read back. */
+    int lw = (w + 1) / 2, lh = (h + 1) / 2;
+    s_gl.nlevels = 0;
+
+    glGenTextures(1, &s_gl.hiz_tex);
+    glBindTexture(GL_TEXTURE_2D, s_gl.hiz_tex);
+
+    while(true) {
+        glTexImage2D(GL_TEXTURE_2D, s_gl.nlevels++, GL_R32F, lw, lh, 0, GL_RED, GL_FLOAT, NULL);
+        if(lw <= CONFIG_HIZ_MAX_WIDTH)
+            break;
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    s_gl.vp_w = w;
+    s_gl.vp_h = h;
+    GL_ASSERT_OK();
+}
+
+static void hiz_collect(struct hiz_readback *rb)
+{
+    if(!rb->fence)
+        return;
+
+    /* Results which haven't arrived by the time the buffer is needed again 
+     * are thrown away instead of being waited on */
+    GLenum status = glClientWaitSync(rb->fence, 0, 0);
+    glDeleteSync(rb->fence);
+    rb->fence = 0;
+
+    if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->PBO);
+    const float *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 
+        rb->w * rb->h * sizeof(float), GL_MAP_READ_BIT);
+
+    if(data) {
+
+        struct hiz_grid grid = (struct hiz_grid){
+            .valid = true,
+            .epoch = rb->epoch,
+            .view_proj = rb->view_proj,
+            .vp_w = rb->vp_w,
+            .vp_h = rb->vp_h,
+            .w = rb->w,
+            .h = rb->h,
+            .shift = rb->shift,
+            .depth = (float*)data,
+        };
+
+        SDL_AtomicLock(&s_lock);
+        if(!hiz_grid_copy(&s_published, &grid)) {
+            s_published.valid = false;
+        }
+        SDL_AtomicUnlock(&s_lock);
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static bool hiz_occluded(const vec3_t corners[static 8])
+{
+    if(!s_local.valid)
+        return false;
+
+    float x_min = FLT_MAX, x_max = -FLT_MAX;
+    float y_min = FLT_MAX, y_max = -FLT_MAX;
+    float z_min = FLT_MAX;
+
+    for(int i = 0; i < 8; i++) {
+
+        vec4_t pos = (vec4_t){corners[i].x, corners[i].y, corners[i].z, 1.0f};
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1(&s_local.view_proj, &pos, &clip);
+
+        /* The box crosses the near plane */
+        if(clip.w <= 0.0f)
+            return false;
+
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * s_local.vp_w;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * s_local.vp_h;
+        float z = (clip.z / clip.w * 0.5f + 0.5f);
+
+        x_min = MIN(x_min, x); x_max = MAX(x_max, x);
+        y_min = MIN(y_min, y); y_max = MAX(y_max, y);
+        z_min = MIN(z_min, z);
+    }
+
+    if(z_min <= 0.0f)
+        return false;
+
+    /* Boxes which are off-screen are left to the frustum culling */
+    if(x_max < 0.0f || y_max < 0.0f || x_min >= s_local.vp_w || y_min >= s_local.vp_h)
+        return false;
+
+    int tx_min = ((int)MAX(x_min, 0.0f)) >> s_local.shift;
+    int ty_min = ((int)MAX(y_min, 0.0f)) >> s_local.shift;
+    int tx_max = MIN(((int)x_max) >> s_local.shift, s_local.w - 1);
+    int ty_max = MIN(((int)y_max) >> s_local.shift, s_local.h - 1);
+
+    /* The box is hidden only if its' nearest point is behind the furthest 
+     * depth of every texel that it covers */
+    for(int r = ty_min; r <= ty_max; r++) {
+    for(int c = tx_min; c <= tx_max; c++) {
+        if(z_min <= s_local.depth[r * s_local.w + c])
+            return false;
+    }}
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_HiZInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glGenFramebuffers(1, &s_gl.FBO);
+    glGenVertexArrays(1, &s_gl.VAO);
+
+    for(int i = 0; i < HIZ_READBACKS; i++) {
+        glGenBuffers(1, &s_gl.readbacks[i].PBO);
+        s_gl.readbacks[i].fence = 0;
+    }
+    s_gl.next_readback = 0;
+    GL_ASSERT_OK();
+}
+
+void R_GL_HiZShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < HIZ_READBACKS; i++) {
+        if(s_gl.readbacks[i].fence)
+            glDeleteSync(s_gl.readbacks[i].fence);
+        glDeleteBuffers(1, &s_gl.readbacks[i].PBO);
+    }
+    hiz_free_buffers();
+    glDeleteFramebuffers(1, &s_gl.FBO);
+    glDeleteVertexArrays(1, &s_gl.VAO);
+    memset(&s_gl, 0, sizeof(s_gl));
+
+    SDL_AtomicLock(&s_lock);
+    free(s_published.depth);
+    memset(&s_published, 0, sizeof(s_published));
+    SDL_AtomicUnlock(&s_lock);
+}
+
+void R_GL_HiZCapture(const mat4x4_t *view_proj, const uint32_t *epoch)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    struct hiz_readback *rb = &s_gl.readbacks[s_gl.next_readback];
+    s_gl.next_readback = (s_gl.next_readback + 1) % HIZ_READBACKS;
+    hiz_collect(rb);
+
+    GLint viewport[4], draw_fb, read_fb;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fb);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fb);
+
+    /* The scene may be rendered offscreen, at a fraction of the window's 
+     * resolution, so the viewport gives the size of the depth buffer */
+    int w = viewport[2], h = viewport[3];
+    if(w != s_gl.vp_w || h != s_gl.vp_h) {
+        hiz_free_buffers();
+        hiz_make_buffers(w, h);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_fb);
+    glBindTexture(GL_TEXTURE_2D, s_gl.depth_tex);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, h);
+
+    GLuint shader_prog = R_GL_Shader_GetProgForName("hiz-reduce");
+    glUseProgram(shader_prog);
+    glUniform1i(R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_TEXTURE0), 0);
+
+    glBindVertexArray(s_gl.VAO);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_gl.FBO);
+    glDisable(GL_DEPTH_TEST);
+
+    int lw = w, lh = h;
+    for(int i = 0; i < s_gl.nlevels; i++) {
+
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+
+        /* Only the level being reduced can be sampled, so that it does not 
+         * form a feedback loop with the one being rendered to */
+        if(i > 0) {
+            glBindTexture(GL_TEXTURE_2D, s_gl.hiz_tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, i - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, i - 1);
+        }
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_gl.hiz_tex, i);
+        glViewport(0, 0, lw, lh);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    /* The last level is still attached */
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->PBO);
+    glBufferData(GL_PIXEL_PACK_BUFFER, lw * lh * sizeof(float), NULL, GL_STREAM_READ);
+    glReadPixels(0, 0, lw, lh, GL_RED, GL_FLOAT, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->epoch = *epoch;
+    rb->view_proj = *view_proj;
+    rb->vp_w = w;
+    rb->vp_h = h;
+    rb->w = lw;
+    rb->h = lh;
+    rb->shift = s_gl.nlevels;
+
+    glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fb);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fb);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    GL_ASSERT_OK();
+}
+
+uint32_t R_HiZEpoch(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    return s_epoch;
+}
+
+void R_HiZInvalidate(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    s_epoch++;
+    s_local.valid = false;
+}
+
+void R_HiZUpdate(bool enabled)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!enabled) {
+        s_local.valid = false;
+        return;
+    }
+
+    SDL_AtomicLock(&s_lock);
+    if(!hiz_grid_copy(&s_local, &s_published)) {
+        s_local.valid = false;
+    }
+    SDL_AtomicUnlock(&s_lock);
+
+    if(s_local.epoch != s_epoch) {
+        s_local.valid = false;
+    }
+}
+
+bool R_HiZOccludedOBB(const struct obb *obb)
+{
+    ASSERT_IN_MAIN_THREAD();
+    return hiz_occluded(obb->corners);
+}
+
+bool R_HiZOccludedAABB(const struct aabb *aabb)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    const vec3_t corners[8] = {
+        (vec3_t){aabb->x_min, aabb->y_min, aabb->z_min},
+        (vec3_t){aabb->x_min, aabb->y_min, aabb->z_max},
+        (vec3_t){aabb->x_min, aabb->y_max, aabb->z_min},
+        (vec3_t){aabb->x_min, aabb->y_max, aabb->z_max},
+        (vec3_t){aabb->x_max, aabb->y_min, aabb->z_min},
+        (vec3_t){aabb->x_max, aabb->y_min, aabb->z_max},
+        (vec3_t){aabb->x_max, aabb->y_max, aabb->z_min},
+        (vec3_t){aabb->x_max, aabb->y_max, aabb->z_max},
+    };
+    return hiz_occluded(corners);
+}
+
@@ -0,0 +1,363 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_render.h"
+#include "gl_shader.h"
+#include "gl_state.h"
+#include "gl_assert.h"
+#include "gl_uniforms.h"
+#include "public/render.h"
+#include "public/render_ctrl.h"
+#include "../lib/public/vec.h"
+#include "../camera.h"
+#include "../config.h"
+#include "../main.h"
+#include "../mem.h"
+
+#include <GL/glew.h>
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi) (MAX(MIN((a), (hi)), (lo)))
+
+#define GRID_X          (CONFIG_LIGHT_GRID_X)
+#define GRID_Y          (CONFIG_LIGHT_GRID_Y)
+#define GRID_Z          (CONFIG_LIGHT_GRID_Z)
+#define NCLUSTERS       (GRID_X * GRID_Y * GRID_Z)
+#define CLUSTER_IDX(x, y, z) (((z) * GRID_Y + (y)) * GRID_X + (x))
+
+/* The range of clusters touched by a light, inclusive */
+struct light_range{
+    int x0, x1;
+    int y0, y1;
+    int z0, z1;
+};
+
+/* The locations are looked up and the samplers are set the first time 
+ * that each program is used */
+struct lit_prog{
+    GLint prog;
+    GLint params_loc;
+    GLint vp_loc;
+};
+
+VEC_TYPE(lidx, GLuint)
+VEC_IMPL(static inline, lidx, GLuint)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_lit_shaders[] = {
+    "terrain",
+    "terrain-shadowed",
+    "mesh.static.textured-phong",
+    "mesh.static.textured-phong-shadowed",
+    "mesh.animated.textured-phong",
+    "mesh.animated.textured-phong-shadowed",
+    "mesh.static.textured-phong.instanced",
+    "mesh.static.textured-phong-shadowed.instanced",
+    "mesh.animated.textured-phong.instanced",
+    "mesh.animated.textured-phong-shadowed.instanced",
+};
+
+static struct lit_prog  s_progs[ARR_SIZE(s_lit_shaders)];
+
+static struct{
+    GLuint             lights_VBO, lights_tex;
+    GLuint             grid_VBO,   grid_tex;
+    GLuint             index_VBO,  index_tex;
+    /* The offset into 'indices' and the number of lights of every cluster */
+    GLuint             grid[NCLUSTERS][2];
+    vec_lidx_t         indices;
+    struct light_range ranges[CONFIG_MAX_POINT_LIGHTS];
+    /* The sizes of the buffers' data stores, in bytes */
+    size_t             caps[3];
+    /* The number of lights drawn in the previous frame */
+    size_t             nlights;
+}s_lights;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int light_slice(float depth, float scale, float bias)
+{
+    int ret = floorf(logf(MAX(depth, CAM_Z_NEAR_DIST)) * scale + bias);
+    return CLAMP(ret, 0, GRID_Z - 1);
+}
+
+/* Finds the clusters overlapped by the light's bounding box in view space. 
+ * Since the projected extent of the box only grows towards the camera, it 
+ * is bounded by the projections of its' corners at the nearest and the 
+ * farthest depth. */
+static bool light_range(const struct point_light *light, const mat4x4_t *view, 
+                        const mat4x4_t *proj, float scale, float bias, 
+                        struct light_range *out)
+{
+    vec4_t pos = (vec4_t){light->pos.x, light->pos.y, light->pos.z, 1.0f};
+    vec4_t center;
+    PFM_Mat4x4_Mult4x1((mat4x4_t*)view, &pos, &center);
+
+    const float r = light->radius;
+    const float depth = -center.z;
+    if(depth + r < CAM_Z_NEAR_DIST || depth - r > CONFIG_DRAWDIST)
+        return false;
+
+    const float near = MAX(depth - r, CAM_Z_NEAR_DIST);
+    const float far = depth + r;
+    vec2_t min = (vec2_t){ INFINITY,  INFINITY};
+    vec2_t max = (vec2_t){-INFINITY, -INFINITY};
+
+    for(int i = 0; i < 8; i++) {
+
+        vec4_t corner = (vec4_t){
+            center.x + ((i & 1) ? r : -r),
+            center.y + ((i & 2) ? r : -r),
+            -((i & 4) ? far : near),
+            1.0f
+        };
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1((mat4x4_t*)proj, &corner, &clip);
+
+        min.x = MIN(min.x, clip.x / clip.w);
+        min.y = MIN(min.y, clip.y / clip.w);
+        max.x = MAX(max.x, clip.x / clip.w);
+        max.y = MAX(max.y, clip.y / clip.w);
+    }
+
+    if(max.x < -1.0f || min.x > 1.0f || max.y < -1.0f || min.y > 1.0f)
+        return false;
+
+    *out = (struct light_range){
+        .x0 = CLAMP((int)floorf((min.x * 0.5f + 0.5f) * GRID_X), 0, GRID_X - 1),
+        .x1 = CLAMP((int)floorf((max.x * 0.5f + 0.5f) * GRID_X), 0, GRID_X - 1),
+        .y0 = CLAMP((int)floorf((min.y * 0.5f + 0.5f) * GRID_Y), 0, GRID_Y - 1),
+        .y1 = CLAMP((int)floorf((max.y * 0.5f + 0.5f) * GRID_Y), 0, GRID_Y - 1),
+        .z0 = light_slice(near, scale, bias),
+        .z1 = light_slice(far, scale, bias),
+    };
+    return true;
+}
+
+/* Builds the per-cluster lists of lights in two passes: the clusters are 
+ * first sized, then laid out one after another and filled in. */
+static bool lights_bin(const struct point_light *lights, size_t count, 
+                       const mat4x4_t *view, const mat4x4_t *proj, 
+                       float scale, float bias)
+{
+    memset(s_lights.grid, 0, sizeof(s_lights.grid));
+
+    for(size_t i = 0; i < count; i++) {
+
+        struct light_range *range = &s_lights.ranges[i];
+        if(!light_range(&lights[i], view, proj, scale, bias, range)) {
+            *range = (struct light_range){0, -1, 0, -1, 0, -1};
+            continue;
+        }
+
+        for(int z = range->z0; z <= range->z1; z++)
+        for(int y = range->y0; y <= range->y1; y++)
+        for(int x = range->x0; x <= range->x1; x++) {
+            s_lights.grid[CLUSTER_IDX(x, y, z)][1]++;
+        }
+    }
+
+    GLuint total = 0;
+    for(int i = 0; i < NCLUSTERS; i++) {
+        s_lights.grid[i][0] = total;
+        total += s_lights.grid[i][1];
+        s_lights.grid[i][1] = 0;
+    }
+
+    vec_lidx_reset(&s_lights.indices);
+    if(!vec_lidx_resize(&s_lights.indices, MAX(total, 1)))
+        return false;
+    s_lights.indices.size = total;
+
+    for(size_t i = 0; i < count; i++) {
+
+        const struct light_range *range = &s_lights.ranges[i];
+        for(int z = range->z0; z <= range->z1; z++)
+        for(int y = range->y0; y <= range->y1; y++)
+        for(int x = range->x0; x <= range->x1; x++) {
+
+            GLuint *cluster = s_lights.grid[CLUSTER_IDX(x, y, z)];
+            vec_AT(&s_lights.indices, cluster[0] + cluster[1]++) = i;
+        }
+    }
+    return true;
+}
+
+/* Orphans the previous frame's data store of the buffer */
+static void buffer_upload(GLuint VBO, const void *data, size_t size, size_t *cap)
+{
+    size_t alloc = MAX(size, sizeof(GLuint));
+    glBindBuffer(GL_TEXTURE_BUFFER, VBO);
+    glBufferData(GL_TEXTURE_BUFFER, alloc, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+
+    Mem_Track(MEM_TAG_GPU_BUFFERS, (ptrdiff_t)alloc - (ptrdiff_t)*cap);
+    *cap = alloc;
+}
+
+static void lights_upload(const struct point_light *lights, size_t count)
+{
+    buffer_upload(s_lights.lights_VBO, lights, count * sizeof(struct point_light), &s_lights.caps[0]);
+    buffer_upload(s_lights.grid_VBO, s_lights.grid, sizeof(s_lights.grid), &s_lights.caps[1]);
+    buffer_upload(s_lights.index_VBO, s_lights.indices.array, 
+        vec_size(&s_lights.indices) * sizeof(GLuint), &s_lights.caps[2]);
+
+    R_GL_StateBindTexture(LIGHTS_TUNIT, GL_TEXTURE_BUFFER, s_lights.lights_tex);
+    R_GL_StateBindTexture(LIGHT_GRID_TUNIT, GL_TEXTURE_BUFFER, s_lights.grid_tex);
+    R_GL_StateBindTexture(LIGHT_INDEX_TUNIT, GL_TEXTURE_BUFFER, s_lights.index_tex);
+    GL_ASSERT_OK();
+}
+
+static bool lit_prog_init(const char *name, struct lit_prog *out)
+{
+    GLint prog = R_GL_Shader_GetProgForName(name);
+    if(prog <= 0)
+        return false;
+
+    R_GL_StateUseProgram(prog);
+    glUniform1i(glGetUniformLocation(prog, GL_U_LIGHTS), LIGHTS_TUNIT - GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(prog, GL_U_LIGHT_GRID), LIGHT_GRID_TUNIT - GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(prog, GL_U_LIGHT_INDICES), LIGHT_INDEX_TUNIT - GL_TEXTURE0);
+
+    *out = (struct lit_prog){
+        .prog = prog,
+        .params_loc = glGetUniformLocation(prog, GL_U_LIGHT_PARAMS),
+        .vp_loc = glGetUniformLocation(prog, GL_U_LIGHT_GRID_VP),
+    };
+    return true;
+}
+
+static void lights_set_uniforms(const mat4x4_t *view_proj, const vec4_t *params)
+{
+    for(int i = 0; i < ARR_SIZE(s_lit_shaders); i++) {
+
+        struct lit_prog *curr = &s_progs[i];
+        if(!curr->prog && !lit_prog_init(s_lit_shaders[i], curr))
+            continue;
+
+        R_GL_StateUseProgram(curr->prog);
+        glUniform4fv(curr->params_loc, 1, params->raw);
+        glUniformMatrix4fv(curr->vp_loc, 1, GL_FALSE, view_proj->raw);
+    }
+    GL_ASSERT_OK();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_LightsInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    vec_lidx_init(&s_lights.indices);
+
+    GLuint *buffs[] = {&s_lights.lights_VBO, &s_lights.grid_VBO, &s_lights.index_VBO};
+    GLuint *texs[] = {&s_lights.lights_tex, &s_lights.grid_tex, &s_lights.index_tex};
+    GLenum formats[] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+    for(int i = 0; i < ARR_SIZE(buffs); i++) {
+
+        glGenBuffers(1, buffs[i]);
+        glBindBuffer(GL_TEXTURE_BUFFER, *buffs[i]);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint), NULL, GL_STREAM_DRAW);
+        s_lights.caps[i] = sizeof(GLuint);
+
+        glGenTextures(1, texs[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, *texs[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], *buffs[i]);
+    }
+
+    Mem_Track(MEM_TAG_GPU_BUFFERS, (ptrdiff_t)(ARR_SIZE(buffs) * sizeof(GLuint)));
+    GL_ASSERT_OK();
+}
+
+void R_GL_LightsShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    GLuint buffs[] = {s_lights.lights_VBO, s_lights.grid_VBO, s_lights.index_VBO};
+    GLuint texs[] = {s_lights.lights_tex, s_lights.grid_tex, s_lights.index_tex};
+
+    glDeleteTextures(ARR_SIZE(texs), texs);
+    glDeleteBuffers(ARR_SIZE(buffs), buffs);
+    vec_lidx_destroy(&s_lights.indices);
+
+    for(int i = 0; i < ARR_SIZE(s_lights.caps); i++) {
+        Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)s_lights.caps[i]);
+    }
+    memset(&s_lights, 0, sizeof(s_lights));
+    memset(s_progs, 0, sizeof(s_progs));
+}
+
+void R_GL_LightsUpdate(const struct point_light *lights, const size_t *count, 
+                       const mat4x4_t *view, const mat4x4_t *proj)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const size_t nlights = MIN(*count, CONFIG_MAX_POINT_LIGHTS);
+    if(nlights == 0 && s_lights.nlights == 0)
+        return; /* The uniforms are already (or by default) disabled */
+
+    /* The depth slices are spaced exponentially between the camera's near 
+     * and far planes: slice = log(depth) * scale + bias */
+    const float log_ratio = logf((float)CONFIG_DRAWDIST / CAM_Z_NEAR_DIST);
+    const float scale = GRID_Z / log_ratio;
+    const float bias = -GRID_Z * logf(CAM_Z_NEAR_DIST) / log_ratio;
+
+    mat4x4_t view_proj;
+    PFM_Mat4x4_Mult4x4((mat4x4_t*)proj, (mat4x4_t*)view, &view_proj);
+
+    vec4_t params = (vec4_t){scale, bias, 0.0f, 0.0f};
+    if(nlights > 0 && lights_bin(lights, nlights, view, proj, scale, bias)) {
+
+        lights_upload(lights, nlights);
+        params.z = nlights;
+    }
+    s_lights.nlights = params.z;
+
+    lights_set_uniforms(&view_proj, &params);
+}
@@ -43,7 +43,9 @@ struct material{
     GLfloat        ambient_intensity;    
     vec3_t         diffuse_clr;
     vec3_t         specular_clr;
+    /* The texture array holding the image when 'atlas_layer' is not -1 */
     struct texture texture;
+    GLint          atlas_layer;
     char           texname[32];
 };
 
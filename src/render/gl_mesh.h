@@ -36,14 +36,20 @@
 #ifndef GL_MESH_H
 #define GL_MESH_H
 
+#include "gl_vertex.h"
 #include "../pf_math.h"
 
 struct vertex;
 
 struct mesh{
+    enum vert_format format;
     unsigned       num_verts;
     GLuint         VBO;
     GLuint         VAO;
+    /* When 'EBO' is non-zero, the mesh is drawn as 'num_indices' 
+     * indexed vertices instead of 'num_verts' consecutive ones. */
+    unsigned       num_indices;
+    GLuint         EBO;
 };
 
 #endif
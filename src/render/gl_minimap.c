@@ -40,6 +40,8 @@
 #include "gl_uniforms.h"
 #include "gl_assert.h"
 #include "gl_render.h"
+#include "gl_perf.h"
+#include "gl_stream.h"
 #include "render_private.h"
 #include "public/render.h"
 #include "../game/public/game.h"
@@ -62,6 +64,7 @@
 #define ARR_SIZE(a)          (sizeof(a)/sizeof(a[0])) 
 #define MINIMAP_RES          (1024)
 #define MINIMAP_BORDER_CLR   ((vec4_t){65.0f/255.0f, 65.0f/255.0f, 65.0f/255.0f, 1.0f})
+#define MINIMAP_UNIT_PX      (3.0f)
 
 struct coord{
     int r, c;
@@ -167,13 +170,13 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
     GLuint shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored");
     glUseProgram(shader_prog);
 
-    GLuint loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    GLuint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, minimap_model->raw);
 
     vec4_t black = (vec4_t){0.0f, 0.0f, 0.0f, 1.0f};
     vec4_t white = (vec4_t){1.0f, 1.0f, 1.0f, 1.0f};
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, black.raw);
 
     glDrawArrays(GL_LINE_LOOP, 0, 4);
@@ -182,9 +185,9 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
     PFM_Mat4x4_MakeTrans(-1.0f, -1.0f, 0.0f, &one_px_trans);
     PFM_Mat4x4_Mult4x4(&one_px_trans, minimap_model, &new_model);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, new_model.raw);
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, white.raw);
 
     glDrawArrays(GL_LINE_LOOP, 0, 4);
@@ -193,8 +196,60 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
     glDeleteBuffers(1, &VBO);
 }
 
+static void draw_units(const struct map *map, mat4x4_t *minimap_model, float px_scale,
+                       size_t nunits, const struct minimap_unit *units)
+{
+    if(!nunits)
+        return;
+
+    /* The whole set is drawn as points in one call. Every unit is a single 
+     * vertex, at its' world-space XZ position. */
+    nunits = MIN(nunits, CONFIG_STREAM_REGION_SZ / sizeof(struct minimap_unit) - 1);
+
+    GLintptr offset;
+    if(!R_GL_StreamUpload(units, nunits * sizeof(struct minimap_unit), sizeof(struct minimap_unit), &offset))
+        return;
+
+    /* The normalized map coordinates are a linear function of the world 
+     * coordinates, so they are folded into the model matrix */
+    vec2_t norm = M_WorldCoordsToNormMapCoords(map, (vec2_t){1.0f, 1.0f});
+    mat4x4_t world_to_norm, model;
+    PFM_Mat4x4_MakeScale(norm.x, norm.y, 1.0f, &world_to_norm);
+    PFM_Mat4x4_Mult4x4(minimap_model, &world_to_norm, &model);
+
+    GLuint VAO;
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_StreamBuffer());
+
+    /* Attribute 0 - position */
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct minimap_unit), 
+        (void*)offsetof(struct minimap_unit, xz));
+    glEnableVertexAttribArray(0);
+
+    /* Attribute 1 - color */
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(struct minimap_unit), 
+        (void*)offsetof(struct minimap_unit, color));
+    glEnableVertexAttribArray(1);
+
+    GLuint shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored-per-vert");
+    glUseProgram(shader_prog);
+
+    GLuint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
+
+    glPointSize(MAX(MINIMAP_UNIT_PX * px_scale, 1.0f));
+    glDrawArrays(GL_POINTS, offset / sizeof(struct minimap_unit), nunits);
+    glPointSize(1.0f);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(s_ctx.minimap_mesh.VAO);
+    glDeleteVertexArrays(1, &VAO);
+}
+
 static void draw_minimap_terrain(struct render_private *priv, mat4x4_t *chunk_model_mat)
 {
+    const bool resident = (priv->mesh.VAO != 0);
     const bool fval = false;
     R_GL_MapBegin(&fval);
 
@@ -204,12 +259,21 @@ static void draw_minimap_terrain(struct render_private *priv, mat4x4_t *chunk_mo
     vec4_t plane_eq = (vec4_t){0.0f, 1.0f, 0.0f, Y_COORDS_PER_TILE};
     R_GL_SetClipPlane(plane_eq);
 
-    /* Always use 'terrain' shader for rendering to not draw any shadows */
+    /* Always use 'terrain' shader for rendering to not draw any shadows. The 
+     * fog of war is drawn over the baked texture instead. */
     GLuint old_shader_prog = priv->shader_prog;
     priv->shader_prog = R_GL_Shader_GetProgForName("terrain");
+    R_GL_FogEnableTerrain(false);
     R_GL_Draw(priv, chunk_model_mat); 
+    R_GL_FogEnableTerrain(true);
     priv->shader_prog = old_shader_prog;
 
+    /* The chunks which haven't been seen yet are not kept around just for 
+     * the sake of the minimap */
+    if(!resident) {
+        R_GL_Evict(priv);
+    }
+
     R_GL_MapEnd();
     glDisable(GL_CLIP_DISTANCE0);
 }
@@ -311,12 +375,11 @@ static void create_water_texture(const struct map *map)
         .cam = (struct camera*)map_cam,
         .map = map,
         .shadows = false,
-        .cam_vis_stat = {0},
-        .cam_vis_anim = {0},
-        .light_vis_stat = {0},
-        .light_vis_anim = {0},
+        .ents = NULL,
+        .nents = 0,
     };
-    R_GL_DrawWater(&in, &fval, &fval);
+    int ival = 0;
+    R_GL_DrawWater(&in, &fval, &fval, &fval, &ival);
 
     glDeleteFramebuffers(1, &fb);
     GL_ASSERT_OK();
@@ -325,6 +388,40 @@ static void create_water_texture(const struct map *map)
     R_GL_Texture_AddExisting("__minimap_water__", s_ctx.water_texture.id);
 }
 
+/* Darkens the minimap by multiplying the fog of war texture into it. The 
+ * map covers only a part of the minimap quad when it isn't square. */
+static void draw_fog(const struct map *map, mat4x4_t *minimap_model)
+{
+    GLuint fog_tex;
+    if(!R_GL_FogTexture(&fog_tex))
+        return;
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+    float map_w = res.chunk_w * res.tile_w * X_COORDS_PER_TILE;
+    float map_h = res.chunk_h * res.tile_h * Z_COORDS_PER_TILE;
+    float map_dim = MAX(map_w, map_h);
+
+    mat4x4_t scale, model;
+    PFM_Mat4x4_MakeScale(map_w / map_dim, map_h / map_dim, 1.0f, &scale);
+    PFM_Mat4x4_Mult4x4(minimap_model, &scale, &model);
+
+    GLuint shader_prog = R_GL_Shader_GetProgForName("mesh.static.textured");
+    glUseProgram(shader_prog);
+
+    GLuint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
+
+    struct texture tex = (struct texture){fog_tex, GL_TEXTURE0};
+    R_GL_Texture_Activate(&tex, shader_prog);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glDisable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
 static void setup_ortho_view_uniforms(const struct map *map)
 {
     struct map_resolution res;
@@ -453,9 +550,11 @@ void R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate,
 }
 
 void R_GL_MinimapRender(const struct map *map, const struct camera *cam, 
-                        vec2_t *center_pos, const int *side_len_px)
+                        vec2_t *center_pos, const int *side_len_px, 
+                        const size_t *nunits, const struct minimap_unit *units)
 {
     ASSERT_IN_RENDER_THREAD();
+    R_GL_PerfBegin(GPU_PASS_MINIMAP);
 
     int width, height;
     Engine_WinDrawableSize(&width, &height);
@@ -493,10 +592,10 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
     shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored");
     glUseProgram(shader_prog);
 
-    GLuint loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    GLuint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, border_model.raw);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, MINIMAP_BORDER_CLR.raw);
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -511,19 +610,24 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
     shader_prog = R_GL_Shader_GetProgForName("mesh.static.textured");
     glUseProgram(shader_prog);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
 
     R_GL_Texture_Activate(&s_ctx.minimap_texture, shader_prog);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    draw_fog(map, &model);
+
+    /* The units and the box are clipped to the minimap region */
+    glStencilFunc(GL_EQUAL, 1, 0xff);
+    draw_units(map, &model, width / mm_vres.x, *nunits, units);
 
     /* Draw a box around the visible area*/
     if(cam) {
-        glStencilFunc(GL_EQUAL, 1, 0xff);
         draw_cam_frustum(cam, &model, map); 
     }
 
     glDisable(GL_STENCIL_TEST);
+    R_GL_PerfEnd(GPU_PASS_MINIMAP);
     GL_ASSERT_OK();
 }
 
@@ -0,0 +1,269 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/render.h"
+#include "public/render_ctrl.h"
+#include "gl_shader.h"
+#include "gl_assert.h"
+#include "../lib/public/vec.h"
+#include "../config.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define STR2(x)         #x
+#define STR(x)          STR2(x)
+#define NAVFIELD_DEFS   "#define FIELD_RES " STR(CONFIG_NAV_FIELD_RES) "\n"
+
+/* A batch whose fields are being generated by the GPU */
+struct navfield_job{
+    struct nav_gpu_batch *batch;
+    GLuint                tiles_SSBO;
+    GLuint                dirs_SSBO;
+    GLsync                fence;
+    Uint64                start;
+};
+
+VEC_TYPE(nfjob, struct navfield_job)
+VEC_IMPL(static inline, nfjob, struct navfield_job)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Render thread state */
+static GLuint         s_prog;
+static vec_nfjob_t    s_inflight;
+
+/* Set by the render thread once the program is built */
+static SDL_atomic_t   s_supported;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t batch_size(const struct nav_gpu_batch *batch)
+{
+    return batch->nfields * batch->res * batch->res * sizeof(uint32_t);
+}
+
+static void job_release(struct navfield_job *job)
+{
+    glDeleteSync(job->fence);
+    glDeleteBuffers(1, &job->tiles_SSBO);
+    glDeleteBuffers(1, &job->dirs_SSBO);
+}
+
+/* Hand the batch back to its' owner in the specified state. If the owner 
+ * has given up on it in the meantime, it is freed instead. */
+static void batch_finish(struct nav_gpu_batch *batch, enum nav_gpu_state state)
+{
+    if(!SDL_AtomicCAS(&batch->state, NAV_GPU_PENDING, state)) {
+        assert(SDL_AtomicGet(&batch->state) == NAV_GPU_ABANDONED);
+        R_NavFieldBatchFree(batch);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_NavFieldInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    vec_nfjob_init(&s_inflight);
+    SDL_AtomicSet(&s_supported, 0);
+
+    if(!CONFIG_NAV_GPU_FIELDS || !GLEW_VERSION_4_3)
+        return;
+
+    s_prog = R_GL_Shader_BuildCompute("shaders/compute/nav-field.glsl", NAVFIELD_DEFS);
+    if(!s_prog)
+        return;
+
+    SDL_AtomicSet(&s_supported, 1);
+    GL_ASSERT_OK();
+}
+
+void R_GL_NavFieldShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < vec_size(&s_inflight); i++) {
+        struct navfield_job *curr = &vec_AT(&s_inflight, i);
+        job_release(curr);
+        batch_finish(curr->batch, NAV_GPU_FAILED);
+    }
+    vec_nfjob_destroy(&s_inflight);
+
+    if(s_prog)
+        glDeleteProgram(s_prog);
+    s_prog = 0;
+    SDL_AtomicSet(&s_supported, 0);
+}
+
+void R_GL_NavFieldDispatch(struct nav_gpu_batch *batch)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(SDL_AtomicGet(&batch->state) == NAV_GPU_ABANDONED) {
+        R_NavFieldBatchFree(batch);
+        return;
+    }
+
+    if(!s_prog || batch->res != CONFIG_NAV_FIELD_RES || batch->nfields == 0) {
+        batch_finish(batch, NAV_GPU_FAILED);
+        return;
+    }
+
+    struct navfield_job job = (struct navfield_job){
+        .batch = batch,
+        .start = SDL_GetPerformanceCounter()
+    };
+    const size_t size = batch_size(batch);
+
+    glGenBuffers(1, &job.tiles_SSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, job.tiles_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, batch->tiles, GL_STREAM_DRAW);
+
+    glGenBuffers(1, &job.dirs_SSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, job.dirs_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_STREAM_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(s_prog);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, job.tiles_SSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, job.dirs_SSBO);
+    glDispatchCompute(batch->nfields, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glUseProgram(0);
+
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if(!vec_nfjob_push(&s_inflight, job)) {
+        job_release(&job);
+        batch_finish(batch, NAV_GPU_FAILED);
+    }
+    GL_ASSERT_OK();
+}
+
+void R_GL_NavFieldPoll(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = vec_size(&s_inflight)-1; i >= 0; i--) {
+
+        struct navfield_job *curr = &vec_AT(&s_inflight, i);
+        GLenum status = glClientWaitSync(curr->fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        struct nav_gpu_batch *batch = curr->batch;
+        if(SDL_AtomicGet(&batch->state) != NAV_GPU_ABANDONED) {
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, curr->dirs_SSBO);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, batch_size(batch), batch->dirs);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            Uint64 elapsed = SDL_GetPerformanceCounter() - curr->start;
+            batch->gpu_ms = (elapsed * 1000.0) / SDL_GetPerformanceFrequency();
+        }
+
+        job_release(curr);
+        batch_finish(batch, NAV_GPU_DONE);
+        vec_nfjob_del(&s_inflight, i);
+    }
+    GL_ASSERT_OK();
+}
+
+bool R_NavFieldGPUSupported(void)
+{
+    return SDL_AtomicGet(&s_supported);
+}
+
+struct nav_gpu_batch *R_NavFieldBatchAlloc(size_t nfields, int res)
+{
+    struct nav_gpu_batch *ret = malloc(sizeof(struct nav_gpu_batch));
+    if(!ret)
+        goto fail_batch;
+
+    const size_t size = nfields * res * res * sizeof(uint32_t);
+    ret->nfields = nfields;
+    ret->res = res;
+    ret->gpu_ms = 0.0f;
+    SDL_AtomicSet(&ret->state, NAV_GPU_PENDING);
+
+    if(!(ret->tiles = malloc(size)))
+        goto fail_tiles;
+
+    if(!(ret->dirs = malloc(size)))
+        goto fail_dirs;
+
+    return ret;
+
+fail_dirs:
+    free(ret->tiles);
+fail_tiles:
+    free(ret);
+fail_batch:
+    return NULL;
+}
+
+void R_NavFieldBatchFree(struct nav_gpu_batch *batch)
+{
+    free(batch->tiles);
+    free(batch->dirs);
+    free(batch);
+}
+
+enum nav_gpu_state R_NavFieldBatchPoll(struct nav_gpu_batch *batch)
+{
+    return SDL_AtomicGet(&batch->state);
+}
+
+void R_NavFieldBatchAbandon(struct nav_gpu_batch *batch)
+{
+    /* If the render thread is done with it, the batch is ours to free */
+    if(!SDL_AtomicCAS(&batch->state, NAV_GPU_PENDING, NAV_GPU_ABANDONED))
+        R_NavFieldBatchFree(batch);
+}
@@ -0,0 +1,189 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_perf.h"
+#include "gl_assert.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <assert.h>
+
+
+/* The number of frames whose queries can be in flight at once */
+#define PERF_FRAMES     (3)
+#define PERF_MAX_SCOPES (128)
+
+#define SCOPE_NONE      (-1)
+#define SCOPE_DROPPED   (-2)
+
+struct perf_frame{
+    /* Pairs of begin and end timestamps */
+    GLuint        queries[PERF_MAX_SCOPES * 2];
+    enum gpu_pass passes[PERF_MAX_SCOPES];
+    int           nscopes;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct perf_frame s_frames[PERF_FRAMES];
+static int               s_curr;
+/* The scope index of each pass being timed */
+static int               s_open[GPU_PASS_COUNT];
+static float             s_gpu_ms[GPU_PASS_COUNT];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void perf_collect(struct perf_frame *frame)
+{
+    if(frame->nscopes == 0) {
+        memset(s_gpu_ms, 0, sizeof(s_gpu_ms));
+        return;
+    }
+
+    /* The timestamps complete in order, so the last one being available 
+     * means all of them are. */
+    GLint avail = GL_FALSE;
+    glGetQueryObjectiv(frame->queries[frame->nscopes * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &avail);
+    if(!avail)
+        return;
+
+    GLuint64 ns[GPU_PASS_COUNT] = {0};
+    for(int i = 0; i < frame->nscopes; i++) {
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(frame->queries[i * 2 + 0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        if(end > begin)
+            ns[frame->passes[i]] += end - begin;
+    }
+
+    for(int i = 0; i < GPU_PASS_COUNT; i++) {
+        s_gpu_ms[i] = ns[i] / 1000000.0f;
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_PerfInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < PERF_FRAMES; i++) {
+        glGenQueries(PERF_MAX_SCOPES * 2, s_frames[i].queries);
+        s_frames[i].nscopes = 0;
+    }
+    for(int i = 0; i < GPU_PASS_COUNT; i++) {
+        s_open[i] = SCOPE_NONE;
+    }
+    memset(s_gpu_ms, 0, sizeof(s_gpu_ms));
+    s_curr = 0;
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_PerfShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < PERF_FRAMES; i++) {
+        glDeleteQueries(PERF_MAX_SCOPES * 2, s_frames[i].queries);
+    }
+    memset(s_frames, 0, sizeof(s_frames));
+}
+
+void R_GL_PerfBegin(enum gpu_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < GPU_PASS_COUNT);
+    assert(s_open[pass] == SCOPE_NONE);
+
+    struct perf_frame *frame = &s_frames[s_curr];
+    if(frame->nscopes == PERF_MAX_SCOPES) {
+        s_open[pass] = SCOPE_DROPPED;
+        return;
+    }
+
+    int idx = frame->nscopes++;
+    frame->passes[idx] = pass;
+    s_open[pass] = idx;
+    glQueryCounter(frame->queries[idx * 2 + 0], GL_TIMESTAMP);
+}
+
+void R_GL_PerfEnd(enum gpu_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < GPU_PASS_COUNT);
+    assert(s_open[pass] != SCOPE_NONE);
+
+    int idx = s_open[pass];
+    s_open[pass] = SCOPE_NONE;
+    if(idx == SCOPE_DROPPED)
+        return;
+
+    glQueryCounter(s_frames[s_curr].queries[idx * 2 + 1], GL_TIMESTAMP);
+}
+
+void R_GL_PerfEndFrame(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < GPU_PASS_COUNT; i++) {
+        assert(s_open[i] == SCOPE_NONE);
+    }
+
+    /* The next slot holds the oldest frame in flight. If its' results are 
+     * still not in, they are thrown away rather than waited on. */
+    s_curr = (s_curr + 1) % PERF_FRAMES;
+    struct perf_frame *frame = &s_frames[s_curr];
+    perf_collect(frame);
+    frame->nscopes = 0;
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_PerfGetTimings(float out_ms[static GPU_PASS_COUNT])
+{
+    ASSERT_IN_RENDER_THREAD();
+    memcpy(out_ms, s_gpu_ms, sizeof(s_gpu_ms));
+}
+
@@ -41,7 +41,11 @@
 #include "gl_material.h"
 #include "gl_assert.h"
 #include "gl_uniforms.h"
+#include "gl_state.h"
+#include "gl_stream.h"
+#include "gl_dynres.h"
 #include "public/render.h"
+#include "public/render_ctrl.h"
 #include "../entity.h"
 #include "../camera.h"
 #include "../config.h"
@@ -50,6 +54,7 @@
 #include "../ui.h"
 #include "../map/public/map.h"
 #include "../main.h"
+#include "../mem.h"
 
 #include <GL/glew.h>
 
@@ -62,119 +67,170 @@
 #define EPSILON                     (1.0f/1024)
 #define ARR_SIZE(a)                 (sizeof(a)/sizeof(a[0]))
 #define MAX(a, b)                   ((a) > (b) ? (a) : (b))
+#define MIN(a, b)                   ((a) < (b) ? (a) : (b))
+
+#define CIRCLE_SAMPLES              (48)
+#define CIRCLE_VERTS                (CIRCLE_SAMPLES * 2 + 2)
+/* Keeps every upload of the circles' vertices well within a stream region */
+#define CIRCLES_PER_UPLOAD          (128)
+
+#define GLOBALS_UPDATE(field) \
+    r_gl_globals_update(offsetof(struct gl_globals, field), sizeof(s_globals.field))
+
+#if CONFIG_SHADOW_CASCADES > 4
+#error "The cascade splits are passed to the shaders in a single vec4"
+#endif
+
+/* std140 layout of the 'globals' uniform block */
+struct gl_globals{
+    mat4x4_t view;
+    mat4x4_t projection;
+    vec4_t   clip_plane0;
+    vec3_t   view_pos;
+    GLfloat  pad0;
+    vec3_t   ambient_color;
+    GLfloat  pad1;
+    vec3_t   light_color;
+    GLfloat  pad2;
+    vec3_t   light_pos;
+    GLfloat  pad3;
+    /* Only declared by the shadowed programs */
+    mat4x4_t cascade_transforms[CONFIG_SHADOW_CASCADES];
+    GLfloat  cascade_splits[4];
+};
+
+/* std140 layout of an element of the 'materials' array */
+struct gl_material_std140{
+    GLfloat  ambient_intensity;
+    GLint    atlas_layer;
+    GLfloat  pad0[2];
+    vec3_t   diffuse_clr;
+    GLfloat  pad1;
+    vec3_t   specular_clr;
+    GLfloat  pad2;
+};
 
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* CPU-side copy of the 'globals' block contents */
+static struct gl_globals s_globals;
+static GLuint   s_globals_UBO;
+
+/* The per-instance attribute buffers are shared by the VAOs of all meshes 
+ * and are re-specified before every instanced draw call. The skinning 
+ * matrices don't fit in vertex attributes, so they are read from a buffer 
+ * texture instead. Models with their' palettes resident on the GPU only 
+ * stream the references to each instance's palettes. */
+static GLuint   s_inst_model_VBO;
+static GLuint   s_inst_normal_VBO;
+static GLuint   s_palette_buff;
+static GLuint   s_palette_tex;
+static GLint    s_palette_max_texels;
+static GLuint   s_offsets_buff;
+static GLuint   s_offsets_tex;
+/* Used for drawing animated instances with the non-instanced shaders, 
+ * which take the pose and inverse bind pose matrices separately. */
+static mat4x4_t s_identity_joints[MAX_JOINTS];
+
+/* The shapes drawn over the map surface are streamed and drawn through these 
+ * VAOs, which are set up once. One takes bare positions, the other takes 
+ * 'struct colored_vert's. */
+static GLuint   s_overlay_VAO;
+static GLuint   s_overlay_colored_VAO;
+/* The ring of every selection circle, as directions from its' center */
+static vec2_t   s_circle_dirs[CIRCLE_SAMPLES];
+static struct colored_vert s_circle_vbuff[CIRCLES_PER_UPLOAD * CIRCLE_VERTS];
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void r_gl_set_materials(GLuint shader_prog, size_t num_mats, const struct material *mats)
+/* The video memory held by the vertex and index buffers of the mesh */
+static size_t r_gl_mesh_bytes(const struct mesh *mesh)
+{
+    size_t ret = 0;
+    if(mesh->VBO)
+        ret += mesh->num_verts * R_VertSize(mesh->format);
+    if(mesh->EBO)
+        ret += mesh->num_indices * sizeof(GLushort);
+    return ret;
+}
+
+static void r_gl_globals_update(size_t offset, size_t size)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    for(unsigned i = 0; i < num_mats; i++) {
-    
-        const struct material *mat = &mats[i];
-        const size_t nmembers = 3; 
-
-        const struct member_desc{
-            const GLchar *name; 
-            size_t        size;
-            ptrdiff_t     offset;
-        }descs[] = {
-            {"ambient_intensity", 1, offsetof(struct material, ambient_intensity) },
-            {"diffuse_clr",       3, offsetof(struct material, diffuse_clr)       },
-            {"specular_clr",      3, offsetof(struct material, specular_clr)      }
-        };
+    glBindBuffer(GL_UNIFORM_BUFFER, s_globals_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, ((unsigned char*)&s_globals) + offset);
+}
 
-        for(unsigned j = 0; j < nmembers; j++) {
-        
-            char locbuff[64];
-            GLuint loc;
+static void r_gl_bind_materials(const struct render_private *priv)
+{
+    ASSERT_IN_RENDER_THREAD();
 
-            snprintf(locbuff, sizeof(locbuff), "%s[%u].%s", GL_U_MATERIALS, i, descs[j].name);
-            locbuff[sizeof(locbuff)-1] = '\0';
+    if(!priv->mat_UBO)
+        return;
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIALS_UBO_BINDING, priv->mat_UBO);
+}
 
-            loc = glGetUniformLocation(shader_prog, locbuff);
-            switch(descs[j].size) {
-            case 1: glUniform1fv(loc, 1, (void*) ((char*)mat + descs[j].offset) ); break;
-            case 3: glUniform3fv(loc, 1, (void*) ((char*)mat + descs[j].offset) ); break;
-            default: assert(0);
-            }
+static void r_gl_instanced_mat4_attrib(GLuint first_loc)
+{
+    /* A mat4 attribute takes up 4 consecutive locations, one per column */
+    for(int i = 0; i < 4; i++) {
 
-        }
+        glVertexAttribPointer(first_loc + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4x4_t), 
+            (void*)(i * sizeof(vec4_t)));
+        glEnableVertexAttribArray(first_loc + i);
+        glVertexAttribDivisor(first_loc + i, 1);
     }
 }
 
 static void r_gl_set_uniform_mat4x4_array(mat4x4_t *data, size_t count, 
-                                          const char *uname, const char *shader_name)
+                                          enum uniform uniform, const char *shader_name)
 {
     ASSERT_IN_RENDER_THREAD();
     GLuint loc, shader_prog;
 
     shader_prog = R_GL_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    R_GL_StateUseProgram(shader_prog);
 
-    loc = glGetUniformLocation(shader_prog, uname);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, uniform);
     glUniformMatrix4fv(loc, count, GL_FALSE, (void*)data);
 }
 
 static void r_gl_set_uniform_vec4_array(vec4_t *data, size_t count, 
-                                        const char *uname, const char *shader_name)
+                                        enum uniform uniform, const char *shader_name)
 {
     ASSERT_IN_RENDER_THREAD();
     GLuint loc, shader_prog;
 
     shader_prog = R_GL_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    R_GL_StateUseProgram(shader_prog);
 
-    loc = glGetUniformLocation(shader_prog, uname);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, uniform);
     glUniform4fv(loc, count, (void*)data);
 }
 
-static void r_gl_set_mat4(const mat4x4_t *trans, const char *shader_name, const char *uname)
+static void r_gl_set_mat4(const mat4x4_t *trans, const char *shader_name, enum uniform uniform)
 {
     ASSERT_IN_RENDER_THREAD();
     GLuint loc, shader_prog;
 
     shader_prog = R_GL_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    R_GL_StateUseProgram(shader_prog);
 
-    loc = glGetUniformLocation(shader_prog, uname);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, uniform);
     glUniformMatrix4fv(loc, 1, GL_FALSE, trans->raw);
 }
 
-static void r_gl_set_vec3(const vec3_t *vec, const char *shader_name, const char *uname)
-{
-    ASSERT_IN_RENDER_THREAD();
-    GLuint loc, shader_prog;
-
-    shader_prog = R_GL_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
-
-    loc = glGetUniformLocation(shader_prog, uname);
-    glUniform3fv(loc, 1, vec->raw);
-}
-
-static void r_gl_set_vec4(const vec4_t *vec, const char *shader_name, const char *uname)
-{
-    ASSERT_IN_RENDER_THREAD();
-    GLuint loc, shader_prog;
-
-    shader_prog = R_GL_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
-
-    loc = glGetUniformLocation(shader_prog, uname);
-    glUniform4fv(loc, 1, vec->raw);
-}
-
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
-void R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff)
+static void r_gl_init_buffers(struct render_private *priv, const void *vbuff)
 {
-    ASSERT_IN_RENDER_THREAD();
     struct mesh *mesh = &priv->mesh;
 
     glGenVertexArrays(1, &mesh->VAO);
@@ -182,61 +238,28 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
 
     glGenBuffers(1, &mesh->VBO);
     glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, mesh->num_verts * sizeof(struct vertex), vbuff, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh->num_verts * R_VertSize(mesh->format), vbuff, GL_STATIC_DRAW);
+    Mem_Track(MEM_TAG_GPU_BUFFERS, mesh->num_verts * R_VertSize(mesh->format));
 
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, uv));
-    glEnableVertexAttribArray(1);
+    R_GL_VertSetAttribs(mesh->format);
 
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, normal));
-    glEnableVertexAttribArray(2);
+    if(mesh->format != VERT_FORMAT_TERRAIN) {
 
-    /* Attribute 3 - material index */
-    glVertexAttribIPointer(3, 1, GL_INT, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, material_idx));
-    glEnableVertexAttribArray(3);
+        /* Attributes 8-11 - per-instance model matrix */
+        glBindBuffer(GL_ARRAY_BUFFER, s_inst_model_VBO);
+        r_gl_instanced_mat4_attrib(8);
+    }
 
-    if(strstr(shader, "animated")) {
+    if(mesh->format == VERT_FORMAT_ANIM) {
 
-        /* Here, we use 2 attributes to pass in an array of size 6 since we are 
-         * limited to a maximum of 4 components per attribute. */
-
-        /* Attribute 4/5 - joint indices */
-        glVertexAttribPointer(4, 3, GL_INT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, joint_indices));
-        glEnableVertexAttribArray(4);  
-        glVertexAttribPointer(5, 3, GL_INT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, joint_indices) + 3*sizeof(GLuint));
-        glEnableVertexAttribArray(5);
-
-        /* Attribute 6/7 - joint weights */
-        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, weights));
-        glEnableVertexAttribArray(6);  
-        glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, weights) + 3*sizeof(GLfloat));
-        glEnableVertexAttribArray(7);  
-
-    }else if(strstr(shader, "terrain")) {
-
-        /* Attribute 4 - tile texture blend mode */
-        glVertexAttribIPointer(4, 1, GL_INT, sizeof(struct vertex), 
-            (void*)offsetof(struct vertex, blend_mode));
-        glEnableVertexAttribArray(4);
-         
-        /* Attribute 5 - adjacent material indices */
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(struct vertex), 
-            (void*)offsetof(struct vertex, adjacent_mat_indices));
-        glEnableVertexAttribArray(5);
+        /* Attributes 12-15 - per-instance normal matrix */
+        glBindBuffer(GL_ARRAY_BUFFER, s_inst_normal_VBO);
+        r_gl_instanced_mat4_attrib(12);
     }
+}
 
+static void r_gl_init_progs(struct render_private *priv, const char *shader)
+{
     priv->shader_prog = R_GL_Shader_GetProgForName(shader);
 
     if(strstr(shader, "animated")) {
@@ -246,9 +269,157 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
     }
 
     assert(priv->shader_prog != -1 && priv->shader_prog_dp != -1);
+}
+
+void R_GL_Init(struct render_private *priv, const char *shader, const void *vbuff)
+{
+    ASSERT_IN_RENDER_THREAD();
+    struct mesh *mesh = &priv->mesh;
+    assert(mesh->format == R_VertFormatForShader(shader));
+    priv->mat_UBO = 0;
+    priv->anim_buff = 0;
+    priv->anim_tex = 0;
+    priv->cooked_verts = NULL;
+    mesh->EBO = 0;
+
+    r_gl_init_buffers(priv, vbuff);
+    r_gl_init_progs(priv, shader);
     GL_ASSERT_OK();
 }
 
+void R_GL_InitDeferred(struct render_private *priv, const char *shader, const void *vbuff)
+{
+    ASSERT_IN_RENDER_THREAD();
+    struct mesh *mesh = &priv->mesh;
+    assert(mesh->format == R_VertFormatForShader(shader));
+    priv->mat_UBO = 0;
+    priv->anim_buff = 0;
+    priv->anim_tex = 0;
+    priv->cooked_verts = vbuff;
+    mesh->VAO = 0;
+    mesh->VBO = 0;
+    mesh->EBO = 0;
+
+    r_gl_init_progs(priv, shader);
+    GL_ASSERT_OK();
+}
+
+void R_GL_MakeResident(struct render_private *priv, bool write)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!priv->mesh.VAO) {
+
+        assert(priv->cooked_verts);
+        r_gl_init_buffers(priv, priv->cooked_verts);
+
+        if(priv->mesh.num_indices > 0) {
+
+            /* Only the full-detail terrain chunk meshes are indexed */
+            assert(priv->mesh.format == VERT_FORMAT_TERRAIN);
+            size_t ntiles = priv->mesh.num_indices / VERTS_PER_TILE;
+            GLushort *ibuff = malloc(priv->mesh.num_indices * sizeof(GLushort));
+            assert(ibuff);
+
+            for(int i = 0; i < ntiles; i++) {
+                R_TileGetIndices(i, &ibuff[i * VERTS_PER_TILE]);
+            }
+            R_GL_InitIndices(priv, ibuff);
+            free(ibuff);
+        }
+        GL_ASSERT_OK();
+    }
+
+    if(write) {
+        priv->cooked_verts = NULL;
+    }
+}
+
+void R_GL_Evict(struct render_private *priv)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!priv->cooked_verts || !priv->mesh.VAO)
+        return;
+
+    Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)r_gl_mesh_bytes(&priv->mesh));
+    glDeleteVertexArrays(1, &priv->mesh.VAO);
+    glDeleteBuffers(1, &priv->mesh.VBO);
+    if(priv->mesh.EBO) {
+        glDeleteBuffers(1, &priv->mesh.EBO);
+    }
+
+    priv->mesh.VAO = 0;
+    priv->mesh.VBO = 0;
+    priv->mesh.EBO = 0;
+    GL_ASSERT_OK();
+}
+
+static void r_gl_free_buffers(struct render_private *priv)
+{
+    Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)r_gl_mesh_bytes(&priv->mesh));
+    if(priv->mesh.VAO) {
+        glDeleteVertexArrays(1, &priv->mesh.VAO);
+        glDeleteBuffers(1, &priv->mesh.VBO);
+    }
+    if(priv->mesh.EBO) {
+        glDeleteBuffers(1, &priv->mesh.EBO);
+    }
+    if(priv->mat_UBO) {
+        Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)(SHADER_MAX_MATERIALS * sizeof(struct gl_material_std140)));
+        glDeleteBuffers(1, &priv->mat_UBO);
+    }
+    if(priv->anim_tex) {
+        GLint size = 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, priv->anim_buff);
+        glGetBufferParameteriv(GL_TEXTURE_BUFFER, GL_BUFFER_SIZE, &size);
+        Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)size);
+
+        glDeleteTextures(1, &priv->anim_tex);
+        glDeleteBuffers(1, &priv->anim_buff);
+    }
+    GL_ASSERT_OK();
+}
+
+void R_GL_Free(struct render_private *priv)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    /* The decimated meshes live in the same buffer and share the palettes */
+    for(size_t i = 0; i < priv->num_lods; i++) {
+        struct render_private *lod = &priv->lods[i];
+        lod->anim_tex = 0;
+        lod->anim_buff = 0;
+        r_gl_free_buffers(lod);
+    }
+    r_gl_free_buffers(priv);
+    free(priv);
+}
+
+void R_GL_InitIndices(struct render_private *priv, const GLushort *ibuff)
+{
+    ASSERT_IN_RENDER_THREAD();
+    struct mesh *mesh = &priv->mesh;
+    assert(mesh->VAO && !mesh->EBO);
+
+    glBindVertexArray(mesh->VAO);
+    glGenBuffers(1, &mesh->EBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * sizeof(GLushort), ibuff, GL_STATIC_DRAW);
+    Mem_Track(MEM_TAG_GPU_BUFFERS, mesh->num_indices * sizeof(GLushort));
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_DrawMesh(const struct mesh *mesh)
+{
+    if(mesh->EBO) {
+        glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_SHORT, (void*)0);
+    }else{
+        glDrawArrays(GL_TRIANGLES, 0, mesh->num_verts);
+    }
+}
+
 void R_GL_Draw(const void *render_private, mat4x4_t *model)
 {
     ASSERT_IN_RENDER_THREAD();
@@ -256,25 +427,259 @@ void R_GL_Draw(const void *render_private, mat4x4_t *model)
     const struct render_private *priv = render_private;
     GLuint loc;
 
-    glUseProgram(priv->shader_prog);
+    if(!priv->mesh.VAO) {
+        R_GL_MakeResident((struct render_private*)priv, false);
+    }
 
-    loc = glGetUniformLocation(priv->shader_prog, GL_U_MODEL);
+    R_GL_StateUseProgram(priv->shader_prog);
+
+    loc = R_GL_Shader_GetUniformLoc(priv->shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
-    r_gl_set_materials(priv->shader_prog, priv->num_materials, priv->materials);
-    for(int i = 0; i < priv->num_materials; i++) {
-        R_GL_Texture_Activate(&priv->materials[i].texture, priv->shader_prog);
-    }
+    r_gl_bind_materials(priv);
+    R_GL_Texture_ActivateMaterials(priv->materials, priv->num_materials, priv->shader_prog);
     
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_StateBindVAO(priv->mesh.VAO);
+    R_GL_DrawMesh(&priv->mesh);
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_InitMaterials(struct render_private *priv)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    /* The whole block must be backed by the buffer, even if the mesh has 
+     * fewer materials */
+    struct gl_material_std140 mats[SHADER_MAX_MATERIALS] = {0};
+    size_t nmats = MIN(priv->num_materials, SHADER_MAX_MATERIALS);
+
+    for(int i = 0; i < nmats; i++) {
+
+        mats[i].ambient_intensity = priv->materials[i].ambient_intensity;
+        mats[i].atlas_layer = priv->materials[i].atlas_layer;
+        mats[i].diffuse_clr = priv->materials[i].diffuse_clr;
+        mats[i].specular_clr = priv->materials[i].specular_clr;
+    }
+
+    glGenBuffers(1, &priv->mat_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, priv->mat_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(mats), mats, GL_STATIC_DRAW);
+    Mem_Track(MEM_TAG_GPU_BUFFERS, sizeof(mats));
 
     GL_ASSERT_OK();
 }
 
+void R_GL_InitGlobals(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    memset(&s_globals, 0, sizeof(s_globals));
+
+    glGenBuffers(1, &s_globals_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_globals_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(s_globals), &s_globals, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, GLOBALS_UBO_BINDING, s_globals_UBO);
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_GetViewMatAndPos(mat4x4_t *out_view, vec3_t *out_pos)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    *out_view = s_globals.view;
+    *out_pos = s_globals.view_pos;
+}
+
+void R_GL_InitInstancing(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glGenBuffers(1, &s_inst_model_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_inst_model_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+
+    glGenBuffers(1, &s_inst_normal_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_inst_normal_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+
+    glGenBuffers(1, &s_palette_buff);
+    glBindBuffer(GL_TEXTURE_BUFFER, s_palette_buff);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(mat4x4_t) * MAX_JOINTS, NULL, GL_STREAM_DRAW);
+
+    glGenTextures(1, &s_palette_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, s_palette_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, s_palette_buff);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &s_palette_max_texels);
+
+    glGenBuffers(1, &s_offsets_buff);
+    glBindBuffer(GL_TEXTURE_BUFFER, s_offsets_buff);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(struct rcmd_palette_ref), NULL, GL_STREAM_DRAW);
+
+    glGenTextures(1, &s_offsets_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, s_offsets_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, s_offsets_buff);
+
+    for(int i = 0; i < MAX_JOINTS; i++)
+        PFM_Mat4x4_Identity(&s_identity_joints[i]);
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_InitAnimPalettes(struct render_private *priv, const mat4x4_t *palettes, 
+                           const size_t *count)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(*count == 0 || *count * 4 > s_palette_max_texels)
+        return;
+
+    glGenBuffers(1, &priv->anim_buff);
+    glBindBuffer(GL_TEXTURE_BUFFER, priv->anim_buff);
+    glBufferData(GL_TEXTURE_BUFFER, *count * sizeof(mat4x4_t), palettes, GL_STATIC_DRAW);
+    Mem_Track(MEM_TAG_GPU_BUFFERS, *count * sizeof(mat4x4_t));
+
+    glGenTextures(1, &priv->anim_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, priv->anim_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, priv->anim_buff);
+
+    for(size_t i = 0; i < priv->num_lods; i++) {
+        priv->lods[i].anim_buff = priv->anim_buff;
+        priv->lods[i].anim_tex = priv->anim_tex;
+    }
+    GL_ASSERT_OK();
+}
+
+void R_GL_UpdateAnimPalettes(struct render_private *priv, const mat4x4_t *palettes, 
+                             const size_t *offset, const size_t *count)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    /* The palettes are streamed when they didn't fit */
+    if(!priv->anim_buff)
+        return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, priv->anim_buff);
+    glBufferSubData(GL_TEXTURE_BUFFER, *offset * sizeof(mat4x4_t), 
+        *count * sizeof(mat4x4_t), palettes + *offset);
+    GL_ASSERT_OK();
+}
+
+void R_GL_DrawInstances(GLint inst_prog, const struct rcmd_draw_instanced *inst, GLenum mode,
+                        void (*draw_one)(const void *render_private, mat4x4_t *model))
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const struct render_private *priv = inst->render_private;
+    const size_t nj = inst->njoints;
+    const bool baked = inst->palettes && priv->anim_tex;
+    assert(!inst->palettes || (nj > 0 && nj <= MAX_JOINTS));
+
+    if(inst_prog < 0) {
+
+        for(size_t i = 0; i < inst->count; i++) {
+
+            if(inst->palettes) {
+                R_GL_SetAnimUniforms(s_identity_joints, 
+                    (mat4x4_t*)inst->palettes + inst->palette_refs[i].curr, &inst->normals[i], &nj);
+            }
+            draw_one(priv, &inst->models[i]);
+        }
+        return;
+    }
+
+    size_t batch = inst->count;
+    if(inst->palettes) {
+
+        GLint loc;
+        if(!baked) {
+            batch = MIN(batch, s_palette_max_texels / (nj * 4));
+            assert(batch > 0);
+        }
+
+        loc = R_GL_Shader_GetUniformLoc(inst_prog, UNIFORM_ANIM_PALETTE);
+        R_GL_StateBindTexture(ANIM_PALETTE_TUNIT, GL_TEXTURE_BUFFER, baked ? priv->anim_tex : s_palette_tex);
+        glUniform1i(loc, ANIM_PALETTE_TUNIT - GL_TEXTURE0);
+
+        loc = R_GL_Shader_GetUniformLoc(inst_prog, UNIFORM_ANIM_OFFSETS);
+        R_GL_StateBindTexture(ANIM_OFFSETS_TUNIT, GL_TEXTURE_BUFFER, s_offsets_tex);
+        glUniform1i(loc, ANIM_OFFSETS_TUNIT - GL_TEXTURE0);
+
+        loc = R_GL_Shader_GetUniformLoc(inst_prog, UNIFORM_ANIM_BAKED);
+        glUniform1i(loc, baked);
+
+        loc = R_GL_Shader_GetUniformLoc(inst_prog, UNIFORM_ANIM_NJOINTS);
+        glUniform1i(loc, nj);
+    }
+
+    R_GL_StateBindVAO(priv->mesh.VAO);
+    for(size_t first = 0; first < inst->count; first += batch) {
+
+        size_t n = MIN(batch, inst->count - first);
+
+        /* Orphan the previous contents so we don't wait on pending draws */
+        glBindBuffer(GL_ARRAY_BUFFER, s_inst_model_VBO);
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(mat4x4_t), inst->models + first, GL_STREAM_DRAW);
+
+        if(inst->palettes) {
+
+            glBindBuffer(GL_ARRAY_BUFFER, s_inst_normal_VBO);
+            glBufferData(GL_ARRAY_BUFFER, n * sizeof(mat4x4_t), inst->normals + first, GL_STREAM_DRAW);
+
+            if(baked) {
+                glBindBuffer(GL_TEXTURE_BUFFER, s_offsets_buff);
+                glBufferData(GL_TEXTURE_BUFFER, n * sizeof(struct rcmd_palette_ref), 
+                    inst->palette_refs + first, GL_STREAM_DRAW);
+            }else{
+                /* Gather the palettes of the instances, in instance order. 
+                 * These are not blended. */
+                glBindBuffer(GL_TEXTURE_BUFFER, s_palette_buff);
+                glBufferData(GL_TEXTURE_BUFFER, n * nj * sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+                for(size_t i = 0; i < n; i++) {
+                    glBufferSubData(GL_TEXTURE_BUFFER, i * nj * sizeof(mat4x4_t), nj * sizeof(mat4x4_t),
+                        inst->palettes + inst->palette_refs[first + i].curr);
+                }
+            }
+        }
+
+        glDrawArraysInstanced(mode, 0, priv->mesh.num_verts, n);
+    }
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_BindInstanceModels(GLuint VBO)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO ? VBO : s_inst_model_VBO);
+    r_gl_instanced_mat4_attrib(8);
+}
+
+void R_GL_DrawInstanced(const struct rcmd_draw_instanced *inst)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const struct render_private *priv = inst->render_private;
+    if(R_GL_DrawSkinned(priv->shader_prog, inst, true))
+        return;
+
+    GLint prog = R_GL_Shader_GetInstancedProg(priv->shader_prog);
+
+    if(prog >= 0) {
+
+        R_GL_StateUseProgram(prog);
+        r_gl_bind_materials(priv);
+        R_GL_Texture_ActivateMaterials(priv->materials, priv->num_materials, prog);
+    }
+    R_GL_DrawInstances(prog, inst, GL_TRIANGLES, R_GL_Draw);
+}
+
 void R_GL_BeginFrame(void)
 {
     ASSERT_IN_RENDER_THREAD();
+    R_GL_DynresBeginScene();
 
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -287,28 +692,10 @@ void R_GL_SetViewMatAndPos(const mat4x4_t *view, const vec3_t *pos)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "mesh.static.colored",
-        "mesh.static.colored-per-vert",
-        "mesh.static.textured",
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.static.tile-outline",
-        "mesh.static.normals.colored",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-        "mesh.animated.normals.colored",
-        "terrain",
-        "terrain-shadowed",
-        "statusbar",
-        "water"
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-
-        r_gl_set_mat4(view, shaders[i], GL_U_VIEW);
-        r_gl_set_vec3(pos, shaders[i], GL_U_VIEW_POS);
-    }
+    s_globals.view = *view;
+    s_globals.view_pos = *pos;
+    GLOBALS_UPDATE(view);
+    GLOBALS_UPDATE(view_pos);
 
     GL_ASSERT_OK();
 }
@@ -317,25 +704,8 @@ void R_GL_SetProj(const mat4x4_t *proj)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "mesh.static.colored",
-        "mesh.static.colored-per-vert",
-        "mesh.static.textured",
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.static.tile-outline",
-        "mesh.static.normals.colored",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-        "mesh.animated.normals.colored",
-        "terrain",
-        "terrain-shadowed",
-        "statusbar",
-        "water"
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++)
-        r_gl_set_mat4(proj, shaders[i], GL_U_PROJECTION);
+    s_globals.projection = *proj;
+    GLOBALS_UPDATE(projection);
 
     GL_ASSERT_OK();
 }
@@ -344,16 +714,31 @@ void R_GL_SetLightSpaceTrans(const mat4x4_t *trans)
 {
     ASSERT_IN_RENDER_THREAD();
 
+    /* The depth pass shaders don't use the 'globals' block, since they 
+     * must not pick up the clip plane. */
     const char *shaders[] = {
         "mesh.static.depth",
         "mesh.animated.depth",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.animated.textured-phong-shadowed",
-        "terrain-shadowed",
+        "mesh.static.depth.instanced",
+        "mesh.animated.depth.instanced",
     };
 
     for(int i = 0; i < ARR_SIZE(shaders); i++)
-        r_gl_set_mat4(trans, shaders[i], GL_U_LS_TRANS);
+        r_gl_set_mat4(trans, shaders[i], UNIFORM_LS_TRANS);
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_SetShadowCascades(const mat4x4_t *transforms, const float *splits)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++) {
+        s_globals.cascade_transforms[i] = transforms[i];
+        s_globals.cascade_splits[i] = splits[i];
+    }
+    GLOBALS_UPDATE(cascade_transforms);
+    GLOBALS_UPDATE(cascade_splits);
 
     GL_ASSERT_OK();
 }
@@ -366,6 +751,8 @@ void R_GL_SetShadowMap(const GLuint shadow_map_tex_id)
         "mesh.static.textured-phong-shadowed",
         "mesh.animated.textured-phong-shadowed",
         "terrain-shadowed",
+        "mesh.static.textured-phong-shadowed.instanced",
+        "mesh.animated.textured-phong-shadowed.instanced",
     };
 
     for(int i = 0; i < ARR_SIZE(shaders); i++) {
@@ -375,9 +762,9 @@ void R_GL_SetShadowMap(const GLuint shadow_map_tex_id)
         shader_prog = R_GL_Shader_GetProgForName(shaders[i]);
         glUseProgram(shader_prog);
 
-        sampler_loc = glGetUniformLocation(shader_prog, GL_U_SHADOW_MAP);
+        sampler_loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_SHADOW_MAP);
         glActiveTexture(SHADOW_MAP_TUNIT);
-        glBindTexture(GL_TEXTURE_2D, shadow_map_tex_id);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map_tex_id);
         glUniform1i(sampler_loc, SHADOW_MAP_TUNIT - GL_TEXTURE0);
     }
 
@@ -388,17 +775,8 @@ void R_GL_SetClipPlane(const vec4_t plane_eq)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "terrain",
-        "terrain-shadowed",
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++)
-        r_gl_set_vec4(&plane_eq, shaders[i], GL_U_CLIP_PLANE0);
+    s_globals.clip_plane0 = plane_eq;
+    GLOBALS_UPDATE(clip_plane0);
 
     GL_ASSERT_OK();
 }
@@ -417,9 +795,9 @@ void R_GL_SetAnimUniforms(mat4x4_t *inv_bind_poses, mat4x4_t *curr_poses,
 
     for(int i = 0; i < ARR_SIZE(shaders); i++) {
 
-        r_gl_set_uniform_mat4x4_array(inv_bind_poses, *count, GL_U_INV_BIND_MATS, shaders[i]);
-        r_gl_set_uniform_mat4x4_array(curr_poses, *count, GL_U_CURR_POSE_MATS, shaders[i]);
-        r_gl_set_mat4(normal_mat, shaders[i], GL_U_NORMAL_MAT);
+        r_gl_set_uniform_mat4x4_array(inv_bind_poses, *count, UNIFORM_INV_BIND_MATS, shaders[i]);
+        r_gl_set_uniform_mat4x4_array(curr_poses, *count, UNIFORM_CURR_POSE_MATS, shaders[i]);
+        r_gl_set_mat4(normal_mat, shaders[i], UNIFORM_NORMAL_MAT);
     }
 
     GL_ASSERT_OK();
@@ -429,25 +807,8 @@ void R_GL_SetAmbientLightColor(const vec3_t *color)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-        "terrain",
-        "terrain-shadowed",
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-    
-        GLuint loc, shader_prog;
-
-        shader_prog = R_GL_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
-
-        loc = glGetUniformLocation(shader_prog, GL_U_AMBIENT_COLOR);
-        glUniform3fv(loc, 1, color->raw);
-    }
+    s_globals.ambient_color = *color;
+    GLOBALS_UPDATE(ambient_color);
 
     GL_ASSERT_OK();
 }
@@ -456,26 +817,8 @@ void R_GL_SetLightEmitColor(const vec3_t *color)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-        "terrain",
-        "terrain-shadowed",
-        "water",
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-    
-        GLuint loc, shader_prog;
-
-        shader_prog = R_GL_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
-
-        loc = glGetUniformLocation(shader_prog, GL_U_LIGHT_COLOR);
-        glUniform3fv(loc, 1, color->raw);
-    }
+    s_globals.light_color = *color;
+    GLOBALS_UPDATE(light_color);
 
     GL_ASSERT_OK();
 }
@@ -484,26 +827,8 @@ void R_GL_SetLightPos(const vec3_t *pos)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.static.textured-phong-shadowed",
-        "mesh.animated.textured-phong",
-        "mesh.animated.textured-phong-shadowed",
-        "terrain",
-        "terrain-shadowed",
-        "water",
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-
-        GLuint loc, shader_prog;
-    
-        shader_prog = R_GL_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
-
-        loc = glGetUniformLocation(shader_prog, GL_U_LIGHT_POS);
-        glUniform3fv(loc, 1, pos->raw);
-    }
+    s_globals.light_pos = *pos;
+    GLOBALS_UPDATE(light_pos);
 
     GL_ASSERT_OK();
 }
@@ -511,6 +836,7 @@ void R_GL_SetLightPos(const vec3_t *pos)
 void R_GL_SetScreenspaceDrawMode(void)
 {
     ASSERT_IN_RENDER_THREAD();
+    R_GL_DynresEndScene();
 
     int width, height;
     Engine_WinDrawableSize(&width, &height);
@@ -604,10 +930,10 @@ void R_GL_DrawSkeleton(const struct entity *ent, const struct skeleton *skel, co
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, green.raw);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
 
     glPointSize(5.0f);
@@ -648,7 +974,7 @@ void R_GL_DrawOrigin(const void *render_private, mat4x4_t *model)
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
     /* Set line width */
@@ -658,7 +984,7 @@ void R_GL_DrawOrigin(const void *render_private, mat4x4_t *model)
 
     /* Render the 3 axis lines at the origin */
     vbuff[0] = (vec3_t){0.0f, 0.0f, 0.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
 
     for(int i = 0; i < 3; i++) {
 
@@ -717,11 +1043,11 @@ void R_GL_DrawRay(const vec3_t *origin, const vec3_t *dir, mat4x4_t *model,
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
     vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, color4.raw);
 
     GLfloat old_width;
@@ -800,10 +1126,10 @@ void R_GL_DrawOBB(const struct entity *ent)
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, blue.raw);
 
     /* buffer & render */
@@ -858,11 +1184,11 @@ void R_GL_DrawBox2D(const vec2_t *screen_pos, const vec2_t *signed_size,
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
 
     vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, color4.raw);
 
     float old_width;
@@ -885,6 +1211,9 @@ void R_GL_DrawNormals(const void *render_private, mat4x4_t *model, const bool *a
     ASSERT_IN_RENDER_THREAD();
 
     const struct render_private *priv = render_private;
+    if(!priv->mesh.VAO) {
+        R_GL_MakeResident((struct render_private*)priv, false);
+    }
 
     GLuint normals_shader = *anim ? R_GL_Shader_GetProgForName("mesh.animated.normals.colored")
                                   : R_GL_Shader_GetProgForName("mesh.static.normals.colored");
@@ -894,14 +1223,14 @@ void R_GL_DrawNormals(const void *render_private, mat4x4_t *model, const bool *a
     GLuint loc;
     vec4_t yellow = (vec4_t){1.0f, 1.0f, 0.0f, 1.0f};
 
-    loc = glGetUniformLocation(normals_shader, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(normals_shader, UNIFORM_COLOR);
     glUniform4fv(loc, 1, yellow.raw);
 
-    loc = glGetUniformLocation(normals_shader, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(normals_shader, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
     glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_DrawMesh(&priv->mesh);
 }
 
 void R_GL_DumpFBColor_PPM(const char *filename, const int *width, const int *height)
@@ -987,74 +1316,122 @@ void R_GL_DumpFBDepth_PPM(const char *filename, const int *width, const int *hei
     free(data);
 }
 
-void R_GL_DrawSelectionCircle(const vec2_t *xz, const float *radius, const float *width, 
-                              const vec3_t *color, const struct map *map)
+/* Writes the vertices of the triangle strip of the ring, which follows the 
+ * map surface */
+static void r_gl_circle_verts(const struct sel_circle *circle, const struct map *map, 
+                              struct colored_vert *out)
+{
+    const vec4_t color = (vec4_t){circle->color.x, circle->color.y, circle->color.z, 1.0f};
+    const float inner = circle->radius;
+    const float outer = circle->radius + circle->width;
+
+    for(int i = 0; i < CIRCLE_SAMPLES; i++) {
+
+        const vec2_t *dir = &s_circle_dirs[i];
+        vec2_t near = (vec2_t){circle->xz.x + inner * dir->x, circle->xz.z + inner * dir->z};
+        vec2_t far  = (vec2_t){circle->xz.x + outer * dir->x, circle->xz.z + outer * dir->z};
+
+        float height_near = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, near));
+        float height_far  = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, far));
+
+        out[i * 2]     = (struct colored_vert){{near.x, height_near + 0.1f, near.z}, color};
+        out[i * 2 + 1] = (struct colored_vert){{far.x,  height_far  + 0.1f, far.z }, color};
+    }
+    out[CIRCLE_SAMPLES * 2]     = out[0];
+    out[CIRCLE_SAMPLES * 2 + 1] = out[1];
+}
+
+void R_GL_InitOverlays(void)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint VAO, VBO;
-    GLuint shader_prog;
-    GLuint loc;
+    glGenVertexArrays(1, &s_overlay_VAO);
+    glBindVertexArray(s_overlay_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_StreamBuffer());
 
-    const int NUM_SAMPLES = 48;
-    vec3_t vbuff[NUM_SAMPLES * 2 + 2];
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
+    glEnableVertexAttribArray(0);
 
-    for(int i = 0; i < NUM_SAMPLES * 2; i += 2) {
+    glGenVertexArrays(1, &s_overlay_colored_VAO);
+    glBindVertexArray(s_overlay_colored_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_StreamBuffer());
 
-        float theta = (2.0f * M_PI) * ((float)i/NUM_SAMPLES);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, pos));
+    glEnableVertexAttribArray(0);
 
-        float x_near = xz->x + (*radius) * cos(theta);
-        float z_near = xz->z - (*radius) * sin(theta);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, color));
+    glEnableVertexAttribArray(1);
 
-        float x_far = xz->x + (*radius + *width) * cos(theta);
-        float z_far = xz->z - (*radius + *width) * sin(theta);
-    
-        float height_near = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, (vec2_t){x_near, z_near}));
-        float height_far  = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, (vec2_t){x_far,  z_far }));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        vbuff[i]     = (vec3_t){x_near, height_near + 0.1f, z_near};
-        vbuff[i + 1] = (vec3_t){x_far,  height_far + 0.1f,   z_far };
+    for(int i = 0; i < CIRCLE_SAMPLES; i++) {
+        float theta = (2.0f * M_PI) * ((float)i / CIRCLE_SAMPLES);
+        s_circle_dirs[i] = (vec2_t){cos(theta), -sin(theta)};
     }
-    vbuff[NUM_SAMPLES * 2]     = vbuff[0];
-    vbuff[NUM_SAMPLES * 2 + 1] = vbuff[1];
+    GL_ASSERT_OK();
+}
 
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
+void R_GL_OverlaysShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
 
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    glDeleteVertexArrays(1, &s_overlay_VAO);
+    glDeleteVertexArrays(1, &s_overlay_colored_VAO);
+}
 
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+void R_GL_DrawSelectionCircle(const vec2_t *xz, const float *radius, const float *width, 
+                              const vec3_t *color, const struct map *map)
+{
+    const struct sel_circle circle = (struct sel_circle){*xz, *radius, *width, *color};
+    const size_t count = 1;
+    R_GL_DrawSelectionCircles(&circle, &count, map);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
+void R_GL_DrawSelectionCircles(const struct sel_circle *circles, const size_t *count, 
+                               const struct map *map)
+{
+    ASSERT_IN_RENDER_THREAD();
 
-    shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored");
+    if(*count == 0)
+        return;
+
+    mat4x4_t identity;
+    PFM_Mat4x4_Identity(&identity);
+
+    GLuint shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored-per-vert");
     glUseProgram(shader_prog);
 
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    GLuint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
 
-    vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, color4.raw);
+    glBindVertexArray(s_overlay_colored_VAO);
 
-    float old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(*width);
+    for(size_t begin = 0; begin < *count; begin += CIRCLES_PER_UPLOAD) {
 
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, ARR_SIZE(vbuff));
+        const size_t n = MIN(*count - begin, CIRCLES_PER_UPLOAD);
+        for(size_t i = 0; i < n; i++) {
+            r_gl_circle_verts(&circles[begin + i], map, s_circle_vbuff + i * CIRCLE_VERTS);
+        }
 
-    glLineWidth(old_width);
+        GLintptr offset;
+        if(!R_GL_StreamUpload(s_circle_vbuff, n * CIRCLE_VERTS * sizeof(struct colored_vert), 
+            sizeof(struct colored_vert), &offset))
+            break;
 
-    /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+        GLint first[CIRCLES_PER_UPLOAD];
+        GLsizei counts[CIRCLES_PER_UPLOAD];
+        for(size_t i = 0; i < n; i++) {
+            first[i] = offset / sizeof(struct colored_vert) + i * CIRCLE_VERTS;
+            counts[i] = CIRCLE_VERTS;
+        }
+        glMultiDrawArrays(GL_TRIANGLE_STRIP, first, counts, n);
+    }
+
+    glBindVertexArray(0);
+    GL_ASSERT_OK();
 }
 
 void R_GL_DrawLine(vec2_t endpoints[static 2], const float *width, const vec3_t *color, const struct map *map)
@@ -1101,43 +1478,37 @@ void R_GL_DrawLine(vec2_t endpoints[static 2], const float *width, const vec3_t
     PFM_Mat4x4_Identity(&identity);
 
     /* OpenGL setup */
-    GLuint VAO, VBO;
     GLuint shader_prog;
     GLuint loc;
 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLintptr offset;
+    if(!R_GL_StreamUpload(vbuff, ARR_SIZE(vbuff) * sizeof(vec3_t), sizeof(vec3_t), &offset))
+        return;
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
+    glBindVertexArray(s_overlay_VAO);
 
     shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored");
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
 
     vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, color4.raw);
 
     float old_width;
     glGetFloatv(GL_LINE_WIDTH, &old_width);
     glLineWidth(*width);
 
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, ARR_SIZE(vbuff));
+    /* render */
+    glDrawArrays(GL_TRIANGLE_STRIP, offset / sizeof(vec3_t), ARR_SIZE(vbuff));
 
     glLineWidth(old_width);
 
     /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    glBindVertexArray(0);
 }
 
 void R_GL_DrawQuad(vec2_t corners[static 4], const float *width, const vec3_t *color, const struct map *map)
@@ -1162,7 +1533,6 @@ void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, const size_t *
 
     struct colored_vert surf_vbuff[*count * 4 * 3];
     struct colored_vert line_vbuff[*count * 4 * 2];
-    GLuint VAO, VBO;
     GLuint shader_prog;
     GLuint loc;
 
@@ -1234,20 +1604,16 @@ void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, const size_t *
     assert(surf_vbuff_base == surf_vbuff + ARR_SIZE(surf_vbuff));
     assert(line_vbuff_base == line_vbuff + ARR_SIZE(line_vbuff));
 
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
-        (void*)offsetof(struct colored_vert, pos));
-    glEnableVertexAttribArray(0);  
+    GLintptr surf_offset, line_offset;
+    if(!R_GL_StreamUpload(surf_vbuff, ARR_SIZE(surf_vbuff) * sizeof(struct colored_vert), 
+        sizeof(struct colored_vert), &surf_offset))
+        return;
+    if(!R_GL_StreamUpload(line_vbuff, ARR_SIZE(line_vbuff) * sizeof(struct colored_vert), 
+        sizeof(struct colored_vert), &line_offset))
+        return;
 
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
-        (void*)offsetof(struct colored_vert, color));
-    glEnableVertexAttribArray(1);  
+    /* OpenGL setup */
+    glBindVertexArray(s_overlay_colored_VAO);
 
     shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored-per-vert");
     glUseProgram(shader_prog);
@@ -1257,31 +1623,28 @@ void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, const size_t *
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
     vec4_t color4 = (vec4_t){colors[0].x, colors[0].y, colors[0].z, 0.25f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, color4.raw);
 
     /* Render surface */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(surf_vbuff) * sizeof(struct colored_vert), surf_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_TRIANGLES, 0, ARR_SIZE(surf_vbuff));
+    glDrawArrays(GL_TRIANGLES, surf_offset / sizeof(struct colored_vert), ARR_SIZE(surf_vbuff));
 
     /* Render outline */
     GLfloat old_width;
     glGetFloatv(GL_LINE_WIDTH, &old_width);
     glLineWidth(3.0f);
 
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(line_vbuff) * sizeof(struct colored_vert), line_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, ARR_SIZE(line_vbuff));
+    glDrawArrays(GL_LINES, line_offset / sizeof(struct colored_vert), ARR_SIZE(line_vbuff));
     glLineWidth(old_width);
 
     /* cleanup */
     glEnable(GL_CULL_FACE);
     glDisable(GL_BLEND);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    glBindVertexArray(0);
 }
 
 void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_t *count,
@@ -1289,7 +1652,7 @@ void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_
 {
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint VAO, VBO;
+    GLuint VAO;
     GLuint shader_prog;
     GLuint loc;
     vec3_t line_vbuff[*count * 2];
@@ -1329,12 +1692,16 @@ void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_
         point_vbuff[i] = line_vbuff[line_vbuff_idx];
     }
 
+    GLintptr line_offset, point_offset;
+    if(!R_GL_StreamUpload(line_vbuff, ARR_SIZE(line_vbuff) * sizeof(vec3_t), sizeof(vec3_t), &line_offset))
+        return;
+    if(!R_GL_StreamUpload(point_vbuff, ARR_SIZE(point_vbuff) * sizeof(vec3_t), sizeof(vec3_t), &point_offset))
+        return;
+
     /* OpenGL setup */
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_StreamBuffer());
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
     glEnableVertexAttribArray(0);  
@@ -1343,11 +1710,11 @@ void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
     vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, red.raw);
 
     GLfloat old_width;
@@ -1355,17 +1722,14 @@ void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, const size_
     glLineWidth(5.0f);
     glPointSize(10.0f);
 
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(line_vbuff) * sizeof(vec3_t), line_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, ARR_SIZE(line_vbuff));
-
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(point_vbuff) * sizeof(vec3_t), point_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_POINTS, 0, ARR_SIZE(line_vbuff));
+    /* render */
+    glDrawArrays(GL_LINES, line_offset / sizeof(vec3_t), ARR_SIZE(line_vbuff));
+    glDrawArrays(GL_POINTS, point_offset / sizeof(vec3_t), ARR_SIZE(point_vbuff));
 
     /* cleanup */
     glLineWidth(old_width);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
 }
 
 void R_GL_DrawCombinedHRVO(vec2_t *apexes, vec2_t *left_rays, vec2_t *right_rays, 
@@ -1437,11 +1801,11 @@ void R_GL_DrawCombinedHRVO(vec2_t *apexes, vec2_t *left_rays, vec2_t *right_rays
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
 
     vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform4fv(loc, 1, red.raw);
 
     GLfloat old_width;
@@ -46,20 +46,88 @@
 #include <stdbool.h>
 
 
-#define SHADOW_MAP_TUNIT (GL_TEXTURE16)
+#define SHADOW_MAP_TUNIT   (GL_TEXTURE16)
+#define ANIM_PALETTE_TUNIT (GL_TEXTURE17)
+#define ANIM_OFFSETS_TUNIT (GL_TEXTURE18)
+#define FOG_TUNIT          (GL_TEXTURE19)
+#define LIGHTS_TUNIT       (GL_TEXTURE20)
+#define LIGHT_GRID_TUNIT   (GL_TEXTURE21)
+#define LIGHT_INDEX_TUNIT  (GL_TEXTURE22)
+#define MAT_ATLAS_TUNIT    (GL_TEXTURE23)
+#define SPLAT_TUNIT        (GL_TEXTURE24)
 
 struct render_private;
+struct mesh;
 struct vertex;
 struct tile;
 struct tile_desc;
 struct map;
+struct rcmd_draw_instanced;
 
 /* General */
 
-void   R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff);
+/* The vertices must already be packed in the mesh's 'format' */
+void   R_GL_Init(struct render_private *priv, const char *shader, const void *vbuff);
+/* Attaches the 'num_indices' indices to the mesh, which is then drawn with them */
+void   R_GL_InitIndices(struct render_private *priv, const GLushort *ibuff);
+/* Deletes all the buffers of the mesh and frees the 'priv' buffer itself */
+void   R_GL_Free(struct render_private *priv);
+/* Like R_GL_Init, but the buffers are only created from 'vbuff' once the mesh 
+ * is first used, so 'vbuff' is not copied and must outlive the mesh. Terrain 
+ * chunk meshes with indices get them generated at that point. */
+void   R_GL_InitDeferred(struct render_private *priv, const char *shader, const void *vbuff);
+/* Creates the buffers of a deferred mesh, if they don't exist yet. When 'write'
+ * is set, the caller is about to modify them; the mesh then stays resident. */
+void   R_GL_MakeResident(struct render_private *priv, bool write);
+/* Releases the buffers of a deferred mesh which has not been modified since 
+ * it was made resident, to be created again on next use */
+void   R_GL_Evict(struct render_private *priv);
+void   R_GL_DrawMesh(const struct mesh *mesh);
 void   R_GL_GlobalConfig(void);
 void   R_GL_SetViewport(int *x, int *y, int *w, int *h);
 
+/* Uniform buffers */
+
+void   R_GL_InitGlobals(void);
+void   R_GL_GetViewMatAndPos(mat4x4_t *out_view, vec3_t *out_pos);
+/* Uploads the materials of the mesh to its' own uniform buffer, which is 
+ * then bound before every draw. */
+void   R_GL_InitMaterials(struct render_private *priv);
+
+/* Instancing */
+
+void   R_GL_InitInstancing(void);
+/* Uploads the baked skinning matrices of the model to its' own buffer texture. 
+ * Models whose palettes don't fit in a buffer texture keep streaming them. */
+void   R_GL_InitAnimPalettes(struct render_private *priv, const mat4x4_t *palettes, 
+                             const size_t *count);
+void   R_GL_UpdateAnimPalettes(struct render_private *priv, const mat4x4_t *palettes, 
+                               const size_t *offset, const size_t *count);
+/* Issues the instanced draw calls using 'inst_prog', which must already be 
+ * bound, with the primitive 'mode'. When 'inst_prog' is negative, falls back 
+ * to calling 'draw_one' for every instance. */
+void   R_GL_DrawInstances(GLint inst_prog, const struct rcmd_draw_instanced *inst, GLenum mode,
+                          void (*draw_one)(const void *render_private, mat4x4_t *model));
+
+/* Points the per-instance model matrices of the bound mesh at 'VBO', from 
+ * which they are read for the following draws. 0 restores the buffer which 
+ * R_GL_DrawInstances streams them into. */
+void   R_GL_BindInstanceModels(GLuint VBO);
+
+/* Overlays */
+
+/* Sets up the VAOs through which the shapes drawn over the map surface are 
+ * streamed. Must be called after the stream buffer is set up. */
+void   R_GL_InitOverlays(void);
+void   R_GL_OverlaysShutdown(void);
+
+/* Pre-skinning */
+
+/* Draws the instances from the pre-skinned vertex buffer with the static 
+ * counterpart of the skinned 'prog'. Returns false, having drawn nothing, 
+ * if the instances have not been skinned this frame. */
+bool   R_GL_DrawSkinned(GLint prog, const struct rcmd_draw_instanced *inst, bool materials);
+
 /* Shadows */
 
 void   R_GL_InitShadows(void);
@@ -71,4 +139,16 @@ void   R_GL_SetShadowMap(const GLuint shadow_map_tex_id);
 
 void   R_GL_SetClipPlane(vec4_t plane_eq);
 
+/* Fog of war */
+
+/* Turns the terrain darkening off for drawing the terrain which does not 
+ * take part in the game, such as into the minimap. It's only turned back on 
+ * if a fog texture has been uploaded. */
+void   R_GL_FogEnableTerrain(bool on);
+/* Returns false when the fog of war is disabled */
+bool   R_GL_FogTexture(GLuint *out);
+/* The world space extents covered by the fog texture, as (x_max, z_min, 
+ * width, height) */
+vec4_t R_GL_FogBounds(void);
+
 #endif
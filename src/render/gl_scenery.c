@@ -0,0 +1,420 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/render.h"
+#include "public/render_ctrl.h"
+#include "render_private.h"
+#include "gl_render.h"
+#include "gl_shader.h"
+#include "gl_state.h"
+#include "gl_texture.h"
+#include "gl_material.h"
+#include "gl_assert.h"
+#include "gl_uniforms.h"
+#include "../lib/public/vec.h"
+#include "../collision.h"
+#include "../config.h"
+#include "../main.h"
+#include "../mem.h"
+
+#include <GL/glew.h>
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define LOCAL_SIZE      (64)
+#define MIN_SLOTS       (1024)
+
+/* std430 layout of an instance slot in the compute shader */
+struct gpu_instance{
+    mat4x4_t model;
+    vec4_t   sphere;
+    GLint    mesh; /* -1 for an empty slot */
+    GLint    pad[3];
+};
+
+struct draw_cmd{
+    GLuint count;
+    GLuint instance_count;
+    GLuint first;
+    GLuint base_instance;
+};
+
+/* Every distinct mesh gets its' own indirect draw command, and a range of 
+ * the culled models big enough to hold all of its' instances. Meshes are 
+ * never removed, only left without instances. */
+struct scenery_mesh{
+    const struct render_private *priv;
+    size_t                       count;
+    GLuint                       base;
+};
+
+VEC_TYPE(smesh, struct scenery_mesh)
+VEC_IMPL(static inline, smesh, struct scenery_mesh)
+
+VEC_TYPE(sslot, int)
+VEC_IMPL(static inline, sslot, int)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Render thread state */
+static GLuint         s_prog;
+static GLint          s_planes_loc, s_ninst_loc;
+static GLint          s_fog_tex_loc, s_fog_en_loc, s_fog_bounds_loc;
+static GLuint         s_inst_SSBO;
+static GLuint         s_cmd_buff;
+static GLuint         s_models_buff;
+/* The mesh of each slot, mirroring the GPU copy */
+static vec_sslot_t    s_slots;
+static vec_smesh_t    s_meshes;
+static size_t         s_ninstances;
+static bool           s_layout_dirty;
+
+/* Set by the render thread once the program is built */
+static SDL_atomic_t   s_supported;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int mesh_index(const struct render_private *priv)
+{
+    for(int i = 0; i < vec_size(&s_meshes); i++) {
+        if(vec_AT(&s_meshes, i).priv == priv)
+            return i;
+    }
+
+    struct scenery_mesh mesh = (struct scenery_mesh){ .priv = priv };
+    if(!vec_smesh_push(&s_meshes, mesh))
+        return -1;
+    return vec_size(&s_meshes) - 1;
+}
+
+/* Grows the slot buffer to hold at least 'nslots' slots, keeping its' 
+ * contents. The new slots are empty. */
+static bool slots_reserve(size_t nslots)
+{
+    size_t old = vec_size(&s_slots);
+    if(nslots <= old)
+        return true;
+
+    size_t cap = MAX(MAX(old * 2, nslots), MIN_SLOTS);
+    if(!vec_sslot_resize(&s_slots, cap))
+        return false;
+
+    struct gpu_instance *empty = malloc((cap - old) * sizeof(struct gpu_instance));
+    if(!empty)
+        return false;
+    for(size_t i = 0; i < cap - old; i++) {
+        empty[i] = (struct gpu_instance){ .mesh = -1 };
+        vec_AT(&s_slots, old + i) = -1;
+    }
+
+    GLuint SSBO;
+    glGenBuffers(1, &SSBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SSBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, cap * sizeof(struct gpu_instance), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, old * sizeof(struct gpu_instance), 
+        (cap - old) * sizeof(struct gpu_instance), empty);
+    free(empty);
+
+    if(s_inst_SSBO) {
+        glBindBuffer(GL_COPY_READ_BUFFER, s_inst_SSBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 
+            old * sizeof(struct gpu_instance));
+        glDeleteBuffers(1, &s_inst_SSBO);
+    }
+    Mem_Track(MEM_TAG_GPU_BUFFERS, (ptrdiff_t)((cap - old) * sizeof(struct gpu_instance)));
+
+    s_inst_SSBO = SSBO;
+    s_slots.size = cap;
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+/* Lays the ranges of the culled models out one after another */
+static void layout_update(void)
+{
+    GLuint base = 0;
+    for(int i = 0; i < vec_size(&s_meshes); i++) {
+
+        struct scenery_mesh *curr = &vec_AT(&s_meshes, i);
+        curr->base = base;
+        base += curr->count;
+    }
+    s_layout_dirty = false;
+}
+
+static void frustum_planes(const struct frustum *frustum, vec4_t out[static 6])
+{
+    const struct plane *planes[] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                    &frustum->right, &frustum->near, &frustum->far};
+
+    for(int i = 0; i < 6; i++) {
+
+        const struct plane *p = planes[i];
+        out[i] = (vec4_t){
+            p->normal.x, p->normal.y, p->normal.z,
+            -PFM_Vec3_Dot((vec3_t*)&p->normal, (vec3_t*)&p->point)
+        };
+    }
+}
+
+/* Writes the draw commands of all the meshes and culls the instances into 
+ * them */
+static void scenery_cull(const struct frustum *frustum)
+{
+    const size_t nmeshes = vec_size(&s_meshes);
+    struct draw_cmd cmds[nmeshes];
+
+    for(int i = 0; i < nmeshes; i++) {
+
+        const struct scenery_mesh *curr = &vec_AT(&s_meshes, i);
+        cmds[i] = (struct draw_cmd){
+            .count = curr->count ? curr->priv->mesh.num_verts : 0,
+            .instance_count = 0,
+            .first = 0,
+            .base_instance = curr->base,
+        };
+    }
+
+    /* Orphan the previous pass's results so we don't wait on its' draws */
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, s_cmd_buff);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(cmds), cmds, GL_STREAM_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_models_buff);
+    glBufferData(GL_ARRAY_BUFFER, s_ninstances * sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+
+    vec4_t planes[6];
+    frustum_planes(frustum, planes);
+
+    R_GL_StateUseProgram(s_prog);
+    glUniform4fv(s_planes_loc, 6, (GLfloat*)planes);
+    glUniform1ui(s_ninst_loc, vec_size(&s_slots));
+
+    GLuint fog_tex;
+    bool fog = R_GL_FogTexture(&fog_tex);
+    glUniform1i(s_fog_en_loc, fog);
+    if(fog) {
+
+        vec4_t bounds = R_GL_FogBounds();
+        R_GL_StateBindTexture(FOG_TUNIT, GL_TEXTURE_2D, fog_tex);
+        glUniform1i(s_fog_tex_loc, FOG_TUNIT - GL_TEXTURE0);
+        glUniform4fv(s_fog_bounds_loc, 1, bounds.raw);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, s_inst_SSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s_cmd_buff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, s_models_buff);
+
+    glDispatchCompute((vec_size(&s_slots) + LOCAL_SIZE - 1) / LOCAL_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    GL_ASSERT_OK();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_SceneryInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    vec_sslot_init(&s_slots);
+    vec_smesh_init(&s_meshes);
+    s_ninstances = 0;
+    s_layout_dirty = false;
+    SDL_AtomicSet(&s_supported, 0);
+
+    if(!CONFIG_GPU_SCENERY || !GLEW_VERSION_4_3)
+        return;
+
+    s_prog = R_GL_Shader_BuildCompute("shaders/compute/cull-instances.glsl", NULL);
+    if(!s_prog)
+        return;
+
+    s_planes_loc = glGetUniformLocation(s_prog, "frustum_planes");
+    s_ninst_loc = glGetUniformLocation(s_prog, "ninstances");
+    s_fog_tex_loc = glGetUniformLocation(s_prog, GL_U_FOG_TEX);
+    s_fog_en_loc = glGetUniformLocation(s_prog, GL_U_FOG_ENABLED);
+    s_fog_bounds_loc = glGetUniformLocation(s_prog, GL_U_FOG_BOUNDS);
+
+    glGenBuffers(1, &s_cmd_buff);
+    glGenBuffers(1, &s_models_buff);
+
+    SDL_AtomicSet(&s_supported, 1);
+    GL_ASSERT_OK();
+}
+
+void R_GL_SceneryShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_inst_SSBO) {
+        glDeleteBuffers(1, &s_inst_SSBO);
+        Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)(vec_size(&s_slots) * sizeof(struct gpu_instance)));
+    }
+    if(s_prog) {
+        glDeleteBuffers(1, &s_cmd_buff);
+        glDeleteBuffers(1, &s_models_buff);
+        glDeleteProgram(s_prog);
+    }
+
+    vec_sslot_destroy(&s_slots);
+    vec_smesh_destroy(&s_meshes);
+
+    s_inst_SSBO = s_cmd_buff = s_models_buff = s_prog = 0;
+    SDL_AtomicSet(&s_supported, 0);
+}
+
+void R_GL_SceneryUpdate(const struct scenery_update *updates, const size_t *count)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_prog)
+        return;
+
+    for(size_t i = 0; i < *count; i++) {
+
+        const struct scenery_update *upd = &updates[i];
+        if(!slots_reserve(upd->slot + 1))
+            return;
+
+        int *slot_mesh = &vec_AT(&s_slots, upd->slot);
+        int mesh = upd->render_private ? mesh_index(upd->render_private) : -1;
+
+        if(*slot_mesh != mesh) {
+
+            if(*slot_mesh >= 0) {
+                vec_AT(&s_meshes, *slot_mesh).count--;
+                s_ninstances--;
+            }
+            if(mesh >= 0) {
+                vec_AT(&s_meshes, mesh).count++;
+                s_ninstances++;
+            }
+            *slot_mesh = mesh;
+            s_layout_dirty = true;
+        }
+
+        struct gpu_instance inst = (struct gpu_instance){
+            .model = upd->model,
+            .sphere = upd->sphere,
+            .mesh = mesh,
+        };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_inst_SSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, upd->slot * sizeof(struct gpu_instance), 
+            sizeof(inst), &inst);
+    }
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_SceneryClear(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_inst_SSBO)
+        return;
+
+    glDeleteBuffers(1, &s_inst_SSBO);
+    Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)(vec_size(&s_slots) * sizeof(struct gpu_instance)));
+
+    s_inst_SSBO = 0;
+    vec_sslot_reset(&s_slots);
+    vec_smesh_reset(&s_meshes);
+    s_ninstances = 0;
+    s_layout_dirty = false;
+}
+
+void R_GL_SceneryDraw(const struct frustum *frustum, const bool *depth)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_prog || s_ninstances == 0)
+        return;
+
+    if(s_layout_dirty) {
+        layout_update();
+    }
+
+    scenery_cull(frustum);
+
+    for(int i = 0; i < vec_size(&s_meshes); i++) {
+
+        const struct scenery_mesh *curr = &vec_AT(&s_meshes, i);
+        if(curr->count == 0)
+            continue;
+
+        struct render_private *priv = (struct render_private*)curr->priv;
+        GLint prog = R_GL_Shader_GetInstancedProg(*depth ? priv->shader_prog_dp : priv->shader_prog);
+        if(prog < 0)
+            continue;
+
+        if(!priv->mesh.VAO) {
+            R_GL_MakeResident(priv, false);
+        }
+
+        R_GL_StateUseProgram(prog);
+        if(!*depth) {
+
+            if(priv->mat_UBO) {
+                glBindBufferBase(GL_UNIFORM_BUFFER, MATERIALS_UBO_BINDING, priv->mat_UBO);
+            }
+            R_GL_Texture_ActivateMaterials(priv->materials, priv->num_materials, prog);
+        }
+
+        /* The commands of the meshes without any instances in view are 
+         * still issued, and draw nothing */
+        R_GL_StateBindVAO(priv->mesh.VAO);
+        R_GL_BindInstanceModels(s_models_buff);
+        glDrawArraysIndirect(GL_TRIANGLES, (void*)(i * sizeof(struct draw_cmd)));
+        R_GL_BindInstanceModels(0);
+    }
+
+    GL_ASSERT_OK();
+}
+
+bool R_SceneryGPUSupported(void)
+{
+    return SDL_AtomicGet(&s_supported);
+}
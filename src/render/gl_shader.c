@@ -35,17 +35,33 @@
 
 #include "gl_shader.h"
 #include "gl_assert.h"
+#include "gl_uniforms.h"
 #include "../main.h"
+#include "../config.h"
 
 #include <SDL.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 
 #define SHADER_PATH_LEN 128
+#define STR2(x)         #x
+#define STR(x)          STR2(x)
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define INSTANCED_DEFS  "#define INSTANCED 1\n"
+#define SHADOWED_DEFS   "#define SHADOW_CASCADES " STR(CONFIG_SHADOW_CASCADES) "\n"
+#define LIGHT_DEFS      "#define LIGHT_GRID_X " STR(CONFIG_LIGHT_GRID_X) "\n" \
+                        "#define LIGHT_GRID_Y " STR(CONFIG_LIGHT_GRID_Y) "\n" \
+                        "#define LIGHT_GRID_Z " STR(CONFIG_LIGHT_GRID_Z) "\n"
+#define INSTANCED_SUFX  ".instanced"
+#define NUM_STAGES      (3)
+
+#define CACHE_MAGIC      (0x43534650u) /* 'PFSC' */
+#define CACHE_VERSION    (1)
+#define FNV_OFFSET_BASIS (0xcbf29ce484222325ull)
 
 #define MAKE_PATH(buff, base, file) \
     do{                             \
@@ -60,12 +76,97 @@ struct shader_resource{
     const char *vertex_path;
     const char *geo_path;
     const char *frag_path;
+    /* Extra preprocessor definitions, inserted after the '#version' line 
+     * of every stage. May be NULL. */
+    const char *defines;
+    /* Set for the programs needed to draw the first frames. The rest are 
+     * built in the background and waited on when they're first asked for. */
+    bool        early;
+    /* NULL-terminated outputs of the vertex stage to capture with transform 
+     * feedback, interleaved into a single buffer. May be NULL. */
+    const char *const *varyings;
+    /* Resolved once the program is linked */
+    GLint       uniform_locs[UNIFORM_COUNT];
+    /* Identifies the sources of the program in the binary cache */
+    uint64_t    src_hash;
+    /* Set if the program was compiled instead of loaded from the cache */
+    bool        compiled;
+};
+
+/* The binary cache file holds a header followed by 'nentries' entries, each
+ * of which is immediately followed by the program binary. It is only ever 
+ * read back on the same machine, so everything is in native byte order. 
+ */
+struct cache_header{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t driver_hash;
+    uint32_t nentries;
+    uint32_t pad;
+};
+
+struct cache_entry_header{
+    uint64_t src_hash;
+    uint32_t format;
+    uint32_t length;
+};
+
+struct cache_entry{
+    uint64_t    src_hash;
+    GLenum      format;
+    GLsizei     length;
+    const void *binary;
 };
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+static const char *s_uniform_names[UNIFORM_COUNT] = {
+    [UNIFORM_MODEL]          = GL_U_MODEL,
+    [UNIFORM_PROJECTION]     = GL_U_PROJECTION,
+    [UNIFORM_INV_BIND_MATS]  = GL_U_INV_BIND_MATS,
+    [UNIFORM_CURR_POSE_MATS] = GL_U_CURR_POSE_MATS,
+    [UNIFORM_NORMAL_MAT]     = GL_U_NORMAL_MAT,
+    [UNIFORM_ANIM_PALETTE]   = GL_U_ANIM_PALETTE,
+    [UNIFORM_ANIM_NJOINTS]   = GL_U_ANIM_NJOINTS,
+    [UNIFORM_ANIM_OFFSETS]   = GL_U_ANIM_OFFSETS,
+    [UNIFORM_ANIM_BAKED]     = GL_U_ANIM_BAKED,
+    [UNIFORM_LS_TRANS]       = GL_U_LS_TRANS,
+    [UNIFORM_SHADOW_MAP]     = GL_U_SHADOW_MAP,
+    [UNIFORM_COLOR]          = GL_U_COLOR,
+    [UNIFORM_TEX_ARRAY0]     = GL_U_TEX_ARRAY0,
+    [UNIFORM_MAT_ATLAS]      = GL_U_MAT_ATLAS,
+    [UNIFORM_TEXTURE0 + 0]   = GL_U_TEXTURE0,
+    [UNIFORM_TEXTURE0 + 1]   = GL_U_TEXTURE1,
+    [UNIFORM_TEXTURE0 + 2]   = GL_U_TEXTURE2,
+    [UNIFORM_TEXTURE0 + 3]   = GL_U_TEXTURE3,
+    [UNIFORM_TEXTURE0 + 4]   = GL_U_TEXTURE4,
+    [UNIFORM_TEXTURE0 + 5]   = GL_U_TEXTURE5,
+    [UNIFORM_TEXTURE0 + 6]   = GL_U_TEXTURE6,
+    [UNIFORM_TEXTURE0 + 7]   = GL_U_TEXTURE7,
+    [UNIFORM_TEXTURE0 + 8]   = GL_U_TEXTURE8,
+    [UNIFORM_TEXTURE0 + 9]   = GL_U_TEXTURE9,
+    [UNIFORM_TEXTURE0 + 10]  = GL_U_TEXTURE10,
+    [UNIFORM_TEXTURE0 + 11]  = GL_U_TEXTURE11,
+    [UNIFORM_TEXTURE0 + 12]  = GL_U_TEXTURE12,
+    [UNIFORM_TEXTURE0 + 13]  = GL_U_TEXTURE13,
+    [UNIFORM_TEXTURE0 + 14]  = GL_U_TEXTURE14,
+    [UNIFORM_TEXTURE0 + 15]  = GL_U_TEXTURE15,
+};
+
+/* The layout of the pre-skinned vertices, see gl_skin.c */
+static const char *s_preskin_varyings[] = {
+    "VertexToFrag.world_pos",
+    "VertexToFrag.uv",
+    "VertexToFrag.normal",
+    "VertexToFrag.mat_idx",
+    NULL
+};
+
+/* Most consecutive lookups are for the same program */
+static int s_last_res_idx = 0;
+
 /* Shader 'prog_id' will be initialized by R_GL_Shader_InitAll */
 static struct shader_resource s_shaders[] = {
     {
@@ -87,7 +188,8 @@ static struct shader_resource s_shaders[] = {
         .name        = "mesh.static.textured-phong",
         .vertex_path = "shaders/vertex/static.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/textured-phong.glsl"
+        .frag_path   = "shaders/fragment/textured-phong.glsl",
+        .defines     = LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
@@ -101,7 +203,8 @@ static struct shader_resource s_shaders[] = {
         .name        = "mesh.animated.textured-phong",
         .vertex_path = "shaders/vertex/skinned.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/textured-phong.glsl"
+        .frag_path   = "shaders/fragment/textured-phong.glsl",
+        .defines     = LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
@@ -129,14 +232,16 @@ static struct shader_resource s_shaders[] = {
         .name        = "terrain",
         .vertex_path = "shaders/vertex/terrain.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/terrain.glsl"
+        .frag_path   = "shaders/fragment/terrain.glsl",
+        .defines     = LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "terrain-shadowed",
         .vertex_path = "shaders/vertex/terrain-shadowed.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/terrain-shadowed.glsl"
+        .frag_path   = "shaders/fragment/terrain-shadowed.glsl",
+        .defines     = SHADOWED_DEFS LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
@@ -157,14 +262,16 @@ static struct shader_resource s_shaders[] = {
         .name        = "mesh.static.textured-phong-shadowed",
         .vertex_path = "shaders/vertex/static-shadowed.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl"
+        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl",
+        .defines     = SHADOWED_DEFS LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "mesh.animated.textured-phong-shadowed",
         .vertex_path = "shaders/vertex/skinned-shadowed.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl"
+        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl",
+        .defines     = SHADOWED_DEFS LIGHT_DEFS
     },
     {
         .prog_id     = (intptr_t)NULL,
@@ -180,24 +287,102 @@ static struct shader_resource s_shaders[] = {
         .geo_path    = NULL,
         .frag_path   = "shaders/fragment/water.glsl"
     },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "hiz-reduce",
+        .vertex_path = "shaders/vertex/fullscreen.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/hiz-reduce.glsl"
+    },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "ui",
         .vertex_path = "shaders/vertex/ui.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment/ui.glsl"
+        .frag_path   = "shaders/fragment/ui.glsl",
+        .early       = true
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.textured-phong.instanced",
+        .vertex_path = "shaders/vertex/static.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/textured-phong.glsl",
+        .defines     = INSTANCED_DEFS LIGHT_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.textured-phong-shadowed.instanced",
+        .vertex_path = "shaders/vertex/static-shadowed.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl",
+        .defines     = INSTANCED_DEFS SHADOWED_DEFS LIGHT_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.depth.instanced",
+        .vertex_path = "shaders/vertex/depth.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/passthrough.glsl",
+        .defines     = INSTANCED_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.textured-phong.instanced",
+        .vertex_path = "shaders/vertex/skinned.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/textured-phong.glsl",
+        .defines     = INSTANCED_DEFS LIGHT_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.textured-phong-shadowed.instanced",
+        .vertex_path = "shaders/vertex/skinned-shadowed.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/textured-phong-shadowed.glsl",
+        .defines     = INSTANCED_DEFS SHADOWED_DEFS LIGHT_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.depth.instanced",
+        .vertex_path = "shaders/vertex/skinned-depth.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment/passthrough.glsl",
+        .defines     = INSTANCED_DEFS
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.preskin",
+        .vertex_path = "shaders/vertex/skinned.glsl",
+        .geo_path    = NULL,
+        .frag_path   = NULL,
+        .defines     = INSTANCED_DEFS,
+        .varyings    = s_preskin_varyings
     },
 };
 
+static struct{
+    bool               enabled;
+    uint64_t           driver_hash;
+    char               path[512];
+    /* The file contents, which the entries point into */
+    char              *data;
+    size_t             nentries;
+    struct cache_entry entries[ARR_SIZE(s_shaders)];
+}s_cache;
+
+static const char    *s_base_path;
+static SDL_Window    *s_window;
+static SDL_GLContext  s_bg_ctx;
+static SDL_Thread    *s_bg_thread;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-const char *shader_text_load(const char *path)
+static char *shader_file_load(const char *path, const char *mode, size_t *out_size)
 {
-    ASSERT_IN_RENDER_THREAD();
-
-    SDL_RWops *stream = SDL_RWFromFile(path, "r");
+    SDL_RWops *stream = SDL_RWFromFile(path, mode);
     if(!stream){
         return NULL;
     }
@@ -223,22 +408,196 @@ const char *shader_text_load(const char *path)
     SDL_RWclose(stream);
 
     if(read_total != fsize){
+        free(ret);
         return NULL;
     }
 
     out[0] = '\0';
+    if(out_size)
+        *out_size = fsize;
     return ret;
 }
 
-static bool shader_init(const char *text, GLuint *out, GLint type)
+static const char *shader_text_load(const char *path)
 {
-    ASSERT_IN_RENDER_THREAD();
+    return shader_file_load(path, "r", NULL);
+}
+
+static uint64_t shader_hash(uint64_t hash, const char *str)
+{
+    /* 64-bit FNV-1a. The terminator is hashed too, so that the boundaries
+     * between the strings also affect the result. */
+    do{
+        hash ^= (unsigned char)*str;
+        hash *= 0x100000001b3ull;
+    }while(*str++);
+    return hash;
+}
+
+static uint64_t shader_driver_hash(void)
+{
+    uint64_t ret = FNV_OFFSET_BASIS;
+    ret = shader_hash(ret, (const char*)glGetString(GL_VENDOR));
+    ret = shader_hash(ret, (const char*)glGetString(GL_RENDERER));
+    ret = shader_hash(ret, (const char*)glGetString(GL_VERSION));
+    return ret;
+}
+
+static uint64_t shader_source_hash(const struct shader_resource *res, const char *texts[static NUM_STAGES])
+{
+    uint64_t ret = FNV_OFFSET_BASIS;
+    ret = shader_hash(ret, res->name);
+    ret = shader_hash(ret, res->defines ? res->defines : "");
+    for(int i = 0; i < NUM_STAGES; i++) {
+        ret = shader_hash(ret, texts[i] ? texts[i] : "");
+    }
+    return ret;
+}
+
+/* Reads the program binaries saved by a previous run. The whole cache is 
+ * discarded when any part of it doesn't check out, or when it was written 
+ * with a different driver. */
+static void shader_cache_load(void)
+{
+    s_cache.nentries = 0;
+    s_cache.data = NULL;
+
+    if(!s_cache.enabled)
+        return;
+
+    size_t size;
+    char *data = shader_file_load(s_cache.path, "rb", &size);
+    if(!data)
+        return;
+
+    struct cache_header hdr;
+    if(size < sizeof(hdr))
+        goto fail;
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if(hdr.magic != CACHE_MAGIC
+    || hdr.version != CACHE_VERSION
+    || hdr.driver_hash != s_cache.driver_hash
+    || hdr.nentries > ARR_SIZE(s_cache.entries))
+        goto fail;
+
+    size_t off = sizeof(hdr);
+    for(int i = 0; i < hdr.nentries; i++) {
+
+        struct cache_entry_header ehdr;
+        if(off + sizeof(ehdr) > size)
+            goto fail;
+        memcpy(&ehdr, data + off, sizeof(ehdr));
+        off += sizeof(ehdr);
+
+        if(off + ehdr.length > size)
+            goto fail;
+
+        s_cache.entries[i] = (struct cache_entry){
+            .src_hash = ehdr.src_hash,
+            .format   = ehdr.format,
+            .length   = ehdr.length,
+            .binary   = data + off
+        };
+        off += ehdr.length;
+    }
+
+    s_cache.nentries = hdr.nentries;
+    s_cache.data = data;
+    return;
+
+fail:
+    free(data);
+}
+
+static void shader_cache_write(void)
+{
+    SDL_RWops *stream = SDL_RWFromFile(s_cache.path, "wb");
+    if(!stream) {
+        fprintf(stderr, "Could not write the shader cache at: %s\n", s_cache.path);
+        return;
+    }
+
+    struct cache_header hdr = {
+        .magic       = CACHE_MAGIC,
+        .version     = CACHE_VERSION,
+        .driver_hash = s_cache.driver_hash,
+        .nentries    = 0,
+    };
+    GLint lengths[ARR_SIZE(s_shaders)];
+
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(s_shaders[i].prog_id, GL_LINK_STATUS, &linked);
+        lengths[i] = 0;
+        if(linked) {
+            glGetProgramiv(s_shaders[i].prog_id, GL_PROGRAM_BINARY_LENGTH, &lengths[i]);
+        }
+        hdr.nentries += (lengths[i] > 0);
+    }
+    SDL_RWwrite(stream, &hdr, sizeof(hdr), 1);
+
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        if(lengths[i] == 0)
+            continue;
 
+        void *binary = malloc(lengths[i]);
+        if(!binary)
+            goto fail;
+
+        GLenum format;
+        glGetProgramBinary(s_shaders[i].prog_id, lengths[i], NULL, &format, binary);
+
+        struct cache_entry_header ehdr = {
+            .src_hash = s_shaders[i].src_hash,
+            .format   = format,
+            .length   = lengths[i],
+        };
+        SDL_RWwrite(stream, &ehdr, sizeof(ehdr), 1);
+        SDL_RWwrite(stream, binary, lengths[i], 1);
+        free(binary);
+    }
+
+    SDL_RWclose(stream);
+    return;
+
+fail:
+    /* Don't leave a truncated cache behind */
+    hdr.nentries = 0;
+    SDL_RWseek(stream, 0, RW_SEEK_SET);
+    SDL_RWwrite(stream, &hdr, sizeof(hdr), 1);
+    SDL_RWclose(stream);
+}
+
+static void shader_cache_free(void)
+{
+    free(s_cache.data);
+    s_cache.data = NULL;
+    s_cache.nentries = 0;
+}
+
+static bool shader_init(const char *text, const char *defines, GLuint *out, GLint type)
+{
     char info[512];
     GLint success;
 
     *out = glCreateShader(type);
-    glShaderSource(*out, 1, &text, NULL);
+
+    /* The '#version' directive must come before anything else, so the 
+     * definitions are spliced in right after it. */
+    const char *version = strstr(text, "#version");
+    const char *split = version ? strchr(version, '\n') : NULL;
+
+    if(defines && split) {
+
+        const GLchar *strings[] = {text, defines, split + 1};
+        const GLint lengths[] = {split + 1 - text, -1, -1};
+        glShaderSource(*out, ARR_SIZE(strings), strings, lengths);
+    }else{
+        glShaderSource(*out, 1, &text, NULL);
+    }
     glCompileShader(*out);
 
     glGetShaderiv(*out, GL_COMPILE_STATUS, &success);
@@ -252,54 +611,239 @@ static bool shader_init(const char *text, GLuint *out, GLint type)
     return true;
 }
 
-static bool shader_load_and_init(const char *path, GLuint *out, GLint type)
+static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader, const GLuint frag_shader, 
+                             const char *const *varyings, GLint prog)
 {
-    ASSERT_IN_RENDER_THREAD();
+    char info[512];
+    GLint success;
 
-    const char *text = shader_text_load(path);
-    if(!text) {
-        fprintf(stderr, "Could not load shader at: %s\n", path);
-        goto fail;
+    if(s_cache.enabled) {
+        glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     }
-    
-    if(!shader_init(text, out, type)){
-        fprintf(stderr, "Could not compile shader at: %s\n", path);
-        goto fail;
+
+    glAttachShader(prog, vertex_shader);
+
+    if(geo_shader) {
+        glAttachShader(prog, geo_shader); 
+    }
+
+    if(frag_shader) {
+        glAttachShader(prog, frag_shader);
+    }
+
+    if(varyings) {
+        GLsizei count = 0;
+        while(varyings[count])
+            count++;
+        glTransformFeedbackVaryings(prog, count, (const GLchar**)varyings, GL_INTERLEAVED_ATTRIBS);
+    }
+
+    glLinkProgram(prog);
+
+    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+
+    glDetachShader(prog, vertex_shader);
+    if(geo_shader) {
+        glDetachShader(prog, geo_shader); 
+    }
+    if(frag_shader) {
+        glDetachShader(prog, frag_shader);
+    }
+
+    if(!success) {
+
+        glGetProgramInfoLog(prog, sizeof(info), NULL, info);
+        fprintf(stderr, "%s\n", info);
+        return false;
     }
 
-    free((char*)text);
     return true;
+}
 
-fail:
-    free((char*)text);
+static void shader_resolve_uniforms(struct shader_resource *res)
+{
+    for(int i = 0; i < UNIFORM_COUNT; i++) {
+        assert(s_uniform_names[i]);
+        res->uniform_locs[i] = glGetUniformLocation(res->prog_id, s_uniform_names[i]);
+    }
+
+    const struct{
+        const char *name;
+        GLuint      binding;
+    }blocks[] = {
+        {GL_U_GLOBALS_BLOCK, GLOBALS_UBO_BINDING  },
+        {GL_U_MAT_BLOCK,     MATERIALS_UBO_BINDING},
+    };
+
+    for(int i = 0; i < ARR_SIZE(blocks); i++) {
+
+        GLuint idx = glGetUniformBlockIndex(res->prog_id, blocks[i].name);
+        if(idx == GL_INVALID_INDEX)
+            continue;
+        glUniformBlockBinding(res->prog_id, idx, blocks[i].binding);
+    }
+}
+
+static bool shader_load_cached(struct shader_resource *res)
+{
+    for(int i = 0; i < s_cache.nentries; i++) {
+
+        const struct cache_entry *entry = &s_cache.entries[i];
+        if(entry->src_hash != res->src_hash)
+            continue;
+
+        glProgramBinary(res->prog_id, entry->format, entry->binary, entry->length);
+
+        /* The driver may still reject the binary, ex. after an update that 
+         * kept the same version string */
+        GLint success;
+        glGetProgramiv(res->prog_id, GL_LINK_STATUS, &success);
+        return success;
+    }
     return false;
 }
 
-static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader, const GLuint frag_shader, GLint *out)
+/* Links the program from the cached binary if there is a matching one, and 
+ * compiles it from source otherwise. May be called from the background 
+ * compilation thread, so it must only touch 'res'. 
+ */
+static bool shader_build(struct shader_resource *res)
 {
-    ASSERT_IN_RENDER_THREAD();
+    static const GLint types[NUM_STAGES] = {
+        GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER
+    };
+    const char *paths[NUM_STAGES] = {res->vertex_path, res->geo_path, res->frag_path};
+    const char *texts[NUM_STAGES] = {0};
+    GLuint shaders[NUM_STAGES] = {0};
+    bool ret = false;
 
-    char info[512];
-    GLint success;
+    for(int i = 0; i < NUM_STAGES; i++) {
 
-    *out = glCreateProgram();
-    glAttachShader(*out, vertex_shader);
+        if(!paths[i])
+            continue;
 
-    if(geo_shader) {
-        glAttachShader(*out, geo_shader); 
+        char path[512];
+        MAKE_PATH(path, s_base_path, paths[i]);
+        if(!(texts[i] = shader_text_load(path))) {
+            fprintf(stderr, "Could not load shader at: %s\n", path);
+            goto out;
+        }
     }
 
-    glAttachShader(*out, frag_shader);
-    glLinkProgram(*out);
+    res->src_hash = shader_source_hash(res, texts);
+    if(shader_load_cached(res)) {
+        shader_resolve_uniforms(res);
+        ret = true;
+        goto out;
+    }
 
-    glGetProgramiv(*out, GL_LINK_STATUS, &success);
-    if(!success) {
+    for(int i = 0; i < NUM_STAGES; i++) {
 
-        glGetProgramInfoLog(*out, sizeof(info), NULL, info);
-        fprintf(stderr, "%s\n", info);
-        return false;
+        if(!texts[i])
+            continue;
+
+        if(!shader_init(texts[i], res->defines, &shaders[i], types[i])) {
+            fprintf(stderr, "Could not compile shader at: %s\n", paths[i]);
+            goto out;
+        }
+    }
+
+    if(!shader_make_prog(shaders[0], shaders[1], shaders[2], res->varyings, res->prog_id)) {
+        fprintf(stderr, "Failed to make shader program: %s\n", res->name);
+        goto out;
+    }
+
+    shader_resolve_uniforms(res);
+    res->compiled = true;
+    ret = true;
+
+out:
+    for(int i = 0; i < NUM_STAGES; i++) {
+        if(shaders[i])
+            glDeleteShader(shaders[i]);
+        free((char*)texts[i]);
     }
+    return ret;
+}
 
+static bool shader_build_all(bool early)
+{
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        struct shader_resource *res = &s_shaders[i];
+        if(res->early != early)
+            continue;
+        if(!shader_build(res))
+            return false;
+    }
+    return true;
+}
+
+static bool shader_any_compiled(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+        if(s_shaders[i].compiled)
+            return true;
+    }
+    return false;
+}
+
+/* Compiles the programs that aren't needed right away with a context that 
+ * shares objects with the render thread's. The program objects themselves 
+ * are created up front, so their names are known to the render thread. 
+ */
+static int shader_compile_thread(void *arg)
+{
+    SDL_GL_MakeCurrent(s_window, s_bg_ctx);
+
+    bool ret = shader_build_all(false);
+    if(s_cache.enabled && shader_any_compiled()) {
+        shader_cache_write();
+    }
+    shader_cache_free();
+
+    /* Make sure the other context sees the completed programs */
+    glFinish();
+    SDL_GL_MakeCurrent(s_window, NULL);
+    return ret;
+}
+
+static void shader_wait_background(void)
+{
+    if(!s_bg_thread)
+        return;
+
+    int status;
+    SDL_WaitThread(s_bg_thread, &status);
+    s_bg_thread = NULL;
+
+    SDL_GL_DeleteContext(s_bg_ctx);
+    s_bg_ctx = NULL;
+
+    if(!status) {
+        fprintf(stderr, "Failed to build shader programs in the background.\n");
+    }
+    assert(status);
+}
+
+static bool shader_start_background(void)
+{
+    SDL_GLContext curr = SDL_GL_GetCurrentContext();
+
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    s_bg_ctx = SDL_GL_CreateContext(s_window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    SDL_GL_MakeCurrent(s_window, curr);
+
+    if(!s_bg_ctx)
+        return false;
+
+    s_bg_thread = SDL_CreateThread(shader_compile_thread, "shader_compile", NULL);
+    if(!s_bg_thread) {
+        SDL_GL_DeleteContext(s_bg_ctx);
+        s_bg_ctx = NULL;
+        return false;
+    }
     return true;
 }
 
@@ -307,54 +851,52 @@ static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
-bool R_GL_Shader_InitAll(const char *base_path)
+bool R_GL_Shader_InitAll(const char *base_path, SDL_Window *window)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    for(int i = 0; i < ARR_SIZE(s_shaders); i++){
+    s_base_path = base_path;
+    s_window = window;
 
-        struct shader_resource *res = &s_shaders[i];
-        GLuint vertex, geometry = 0, fragment;
-        char path[512];
-    
-        MAKE_PATH(path, base_path, res->vertex_path);
-        if(!shader_load_and_init(path, &vertex, GL_VERTEX_SHADER)) {
-            fprintf(stderr, "Failed to load and init vertex shader.\n");
-            return false;
-        }
+    GLint nformats = 0;
+    if(GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+    }
+    s_cache.enabled = (nformats > 0);
+    s_cache.driver_hash = shader_driver_hash();
+    MAKE_PATH(s_cache.path, base_path, "/" CONFIG_SHADER_CACHE_FILENAME);
+    shader_cache_load();
 
-        if(res->geo_path)
-            MAKE_PATH(path, base_path, res->geo_path);
-        if(res->geo_path && !shader_load_and_init(path, &geometry, GL_GEOMETRY_SHADER)) {
-            fprintf(stderr, "Failed to load and init geometry shader.\n");
-            return false;
-        }
-        assert(!res->geo_path || geometry > 0);
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+        s_shaders[i].prog_id = glCreateProgram();
+        s_shaders[i].compiled = false;
+    }
 
-        MAKE_PATH(path, base_path, res->frag_path);
-        if(!shader_load_and_init(path, &fragment, GL_FRAGMENT_SHADER)) {
-            fprintf(stderr, "Failed to load and init fragment shader.\n");
-            return false;
-        }
+    if(!shader_build_all(true))
+        goto fail;
 
-        if(!shader_make_prog(vertex, geometry, fragment, &res->prog_id)) {
+    if(shader_start_background())
+        return true;
 
-            glDeleteShader(vertex);
-            if(geometry)
-                glDeleteShader(geometry);
-            glDeleteShader(fragment);
-            fprintf(stderr, "Failed to make shader program %d of %d.\n",
-                i + 1, (int)ARR_SIZE(s_shaders));
-            return false;
-        }
+    /* Fall back to building everything up front */
+    if(!shader_build_all(false))
+        goto fail;
 
-        glDeleteShader(vertex);
-        if(geometry)
-            glDeleteShader(geometry);
-        glDeleteShader(fragment);
+    if(s_cache.enabled && shader_any_compiled()) {
+        shader_cache_write();
     }
-
+    shader_cache_free();
     return true;
+
+fail:
+    shader_cache_free();
+    return false;
+}
+
+void R_GL_Shader_Shutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    shader_wait_background();
 }
 
 GLint R_GL_Shader_GetProgForName(const char *name)
@@ -365,10 +907,119 @@ GLint R_GL_Shader_GetProgForName(const char *name)
 
         const struct shader_resource *curr = &s_shaders[i];
 
-        if(!strcmp(curr->name, name))
+        if(!strcmp(curr->name, name)) {
+            if(!curr->early)
+                shader_wait_background();
             return curr->prog_id;
+        }
     }
     
     return -1;
 }
     
+
+GLint R_GL_Shader_GetInstancedProg(GLint prog)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        const struct shader_resource *curr = &s_shaders[i];
+        if(curr->prog_id != prog)
+            continue;
+
+        char name[128];
+        snprintf(name, sizeof(name), "%s%s", curr->name, INSTANCED_SUFX);
+        name[sizeof(name)-1] = '\0';
+        return R_GL_Shader_GetProgForName(name);
+    }
+
+    return -1;
+}
+
+GLint R_GL_Shader_GetStaticProg(GLint prog)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const char prefix[] = "mesh.animated.";
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        const struct shader_resource *curr = &s_shaders[i];
+        if(curr->prog_id != prog)
+            continue;
+        if(strncmp(curr->name, prefix, sizeof(prefix) - 1))
+            return -1;
+
+        char name[128];
+        snprintf(name, sizeof(name), "mesh.static.%s", curr->name + sizeof(prefix) - 1);
+        name[sizeof(name)-1] = '\0';
+        return R_GL_Shader_GetProgForName(name);
+    }
+
+    return -1;
+}
+
+GLuint R_GL_Shader_BuildCompute(const char *path, const char *defines)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    char info[512];
+    GLint success;
+    GLuint shader = 0, prog = 0;
+
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "%s/%s", s_base_path, path);
+    full_path[sizeof(full_path)-1] = '\0';
+
+    char *text = (char*)shader_text_load(full_path);
+    if(!text) {
+        fprintf(stderr, "Could not load shader at: %s\n", full_path);
+        goto fail;
+    }
+
+    if(!shader_init(text, defines, &shader, GL_COMPUTE_SHADER)) {
+        fprintf(stderr, "Failed to compile compute shader: %s\n", full_path);
+        goto fail;
+    }
+
+    prog = glCreateProgram();
+    glAttachShader(prog, shader);
+    glLinkProgram(prog);
+    glDetachShader(prog, shader);
+
+    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+    if(!success) {
+
+        glGetProgramInfoLog(prog, sizeof(info), NULL, info);
+        fprintf(stderr, "%s\n", info);
+        glDeleteProgram(prog);
+        prog = 0;
+    }
+
+fail:
+    if(shader)
+        glDeleteShader(shader);
+    free(text);
+    return prog;
+}
+
+GLint R_GL_Shader_GetUniformLoc(GLint prog, enum uniform uniform)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(uniform >= 0 && uniform < UNIFORM_COUNT);
+
+    if(s_shaders[s_last_res_idx].prog_id == prog)
+        return s_shaders[s_last_res_idx].uniform_locs[uniform];
+
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+
+        if(s_shaders[i].prog_id != prog)
+            continue;
+
+        s_last_res_idx = i;
+        return s_shaders[i].uniform_locs[uniform];
+    }
+
+    return -1;
+}
+
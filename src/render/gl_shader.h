@@ -37,10 +37,59 @@
 #define GL_SHADER_H
 
 #include <GL/glew.h>
+#include <SDL.h>
 
 #include <stdbool.h>
 
-bool  R_GL_Shader_InitAll(const char *base_path);
+/* Must match MAX_MATERIALS in the shaders */
+#define SHADER_MAX_MATERIALS (8)
+#define SHADER_NUM_TEXTURES  (16)
+
+/* Uniform buffer binding points, assigned to the blocks of every program */
+#define GLOBALS_UBO_BINDING   (0)
+#define MATERIALS_UBO_BINDING (1)
+
+/* The uniforms that are set most frequently. Their locations are resolved 
+ * once for every program by R_GL_Shader_InitAll. */
+enum uniform{
+    UNIFORM_MODEL,
+    UNIFORM_PROJECTION,
+    UNIFORM_INV_BIND_MATS,
+    UNIFORM_CURR_POSE_MATS,
+    UNIFORM_NORMAL_MAT,
+    UNIFORM_ANIM_PALETTE,
+    UNIFORM_ANIM_NJOINTS,
+    UNIFORM_ANIM_OFFSETS,
+    UNIFORM_ANIM_BAKED,
+    UNIFORM_LS_TRANS,
+    UNIFORM_SHADOW_MAP,
+    UNIFORM_COLOR,
+    UNIFORM_TEX_ARRAY0,
+    UNIFORM_MAT_ATLAS,
+    /* One for every texture unit, 'texture0' to 'texture15' */
+    UNIFORM_TEXTURE0,
+    UNIFORM_COUNT = UNIFORM_TEXTURE0 + SHADER_NUM_TEXTURES,
+};
+
+/* Programs are linked from the binaries cached by a previous run when the 
+ * driver and the sources are unchanged. Only the programs needed for the 
+ * first frames are built before returning; the rest are built by a thread
+ * with its' own context and waited on when first looked up. */
+bool  R_GL_Shader_InitAll(const char *base_path, SDL_Window *window);
+void  R_GL_Shader_Shutdown(void);
 GLint R_GL_Shader_GetProgForName(const char *name);
+/* Returns the variant of 'prog' that sources the per-instance state from 
+ * instanced vertex attributes, or -1 if there is none. */
+GLint R_GL_Shader_GetInstancedProg(GLint prog);
+/* Returns the static mesh program corresponding to the skinned 'prog', for 
+ * drawing vertices which have already been skinned, or -1 if there is none. */
+GLint R_GL_Shader_GetStaticProg(GLint prog);
+/* Returns the cached location of the uniform, or -1 if the program does 
+ * not use it. Setting a uniform at location -1 is a no-op. */
+GLint R_GL_Shader_GetUniformLoc(GLint prog, enum uniform uniform);
+/* Builds a standalone compute program from the shader at 'path' (relative 
+ * to the base path), with 'defines' spliced in after its' '#version' line.
+ * Requires OpenGL 4.3. Returns 0 on failure. */
+GLuint R_GL_Shader_BuildCompute(const char *path, const char *defines);
 
 #endif
@@ -34,23 +34,32 @@
  */
 
 #include "public/render.h"
+#include "public/render_ctrl.h"
 #include "render_private.h"
 #include "gl_render.h"
 #include "gl_uniforms.h"
 #include "gl_assert.h"
 #include "gl_shader.h"
+#include "gl_state.h"
+#include "gl_perf.h"
 #include "../main.h"
 #include "../pf_math.h"
 #include "../config.h"
 #include "../collision.h"
 #include "../settings.h"
 #include "../game/public/game.h"
+#include "../camera.h"
 
 #include <GL/glew.h>
 #include <assert.h>
+#include <math.h>
 
 
 #define LIGHT_EXTRA_HEIGHT (250.0f)
+#define EPSILON            (1.0f/1024)
+#define ARR_SIZE(a)        (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))
 
 struct shadow_gl_state{
     GLint viewport[4];
@@ -62,6 +71,7 @@ struct shadow_gl_state{
 /*****************************************************************************/
 
 static GLuint         s_depth_map_FBO;
+/* 2D array texture with one layer per cascade */
 static GLuint         s_depth_map_tex;
 static bool           s_depth_pass_active = false;
 static struct shadow_gl_state s_saved;
@@ -70,41 +80,151 @@ static struct shadow_gl_state s_saved;
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void make_light_frustum(vec3_t light_pos, vec3_t cam_pos, vec3_t cam_dir, 
-                               struct frustum *out, mat4x4_t *out_view_mat)
+/* Past the point where the edges of the view frustum reach the ground, 
+ * there is nothing left to receive shadows. So the cascades are only 
+ * spread over the part of the frustum in front of it.
+ */
+static float shadow_distance(const struct frustum *cam_frust, vec3_t cam_pos)
 {
-    float t = cam_pos.y / cam_dir.y;
-    vec3_t cam_ray_ground_isec = (vec3_t){cam_pos.x - t * cam_dir.x, 0.0f, cam_pos.z - t * cam_dir.z};
+    const vec3_t edges[] = {cam_frust->ntl, cam_frust->ntr, cam_frust->nbl, cam_frust->nbr};
+    const float max = MIN(CONFIG_SHADOW_DRAWDIST, CONFIG_DRAWDIST);
+    float ret = CAM_Z_NEAR_DIST * 2.0f;
 
-    vec3_t light_dir = light_pos;
-    PFM_Vec3_Normal(&light_dir, &light_dir);
-    PFM_Vec3_Scale(&light_dir, -1.0f, &light_dir);
+    for(int i = 0; i < ARR_SIZE(edges); i++) {
 
-    vec3_t right = (vec3_t){-1.0f, 0.0f, 0.0f}, up;
-    PFM_Vec3_Cross(&light_dir, &right, &up);
+        float drop = cam_pos.y - edges[i].y;
+        if(cam_pos.y <= 0.0f || drop < EPSILON)
+            return max;
+        ret = MAX(ret, CAM_Z_NEAR_DIST * cam_pos.y / drop);
+    }
+    return MIN(ret, max);
+}
+
+/* The view frustum's near plane corners are at a depth of CAM_Z_NEAR_DIST,
+ * so the slice corners are found by extending the rays through them.
+ */
+static void slice_corners(const struct frustum *cam_frust, vec3_t cam_pos, 
+                          float near, float far, vec3_t out[static 8])
+{
+    const vec3_t edges[] = {cam_frust->ntl, cam_frust->ntr, cam_frust->nbl, cam_frust->nbr};
 
-    t = fabs((cam_pos.y + LIGHT_EXTRA_HEIGHT)/ light_dir.y);
-    vec3_t light_origin, delta;
-    PFM_Vec3_Scale(&light_dir, -t, &delta);
-    PFM_Vec3_Add(&cam_ray_ground_isec, &delta, &light_origin);
+    for(int i = 0; i < ARR_SIZE(edges); i++) {
 
-    vec3_t target;
-    PFM_Vec3_Add(&light_origin, &light_dir, &target);
+        vec3_t ray, tmp, edge = edges[i];
+        PFM_Vec3_Sub(&edge, &cam_pos, &ray);
 
-    /* Since, for shadow mapping, we treat our light source as a directional light, 
-     * we only care about direction of the light rays, not the absolute position of 
-     * the light source. Thus, we render the shadow map from a fixed height, looking 
-     * at the position where the camera ray intersects the ground plane. 
-     */
-    mat4x4_t light_view;
-    PFM_Mat4x4_MakeLookAt(&light_origin, &target, &up, &light_view);
+        PFM_Vec3_Scale(&ray, near / CAM_Z_NEAR_DIST, &tmp);
+        PFM_Vec3_Add(&cam_pos, &tmp, &out[i]);
 
-    if(out) {
-        C_MakeFrustum(light_origin, up, light_dir, 1.0f, M_PI/4.0f, 0.1f, CONFIG_SHADOW_DRAWDIST, out);
+        PFM_Vec3_Scale(&ray, far / CAM_Z_NEAR_DIST, &tmp);
+        PFM_Vec3_Add(&cam_pos, &tmp, &out[i + 4]);
     }
-    if(out_view_mat) {
-        *out_view_mat = light_view;
+}
+
+static void make_box_frustum(vec3_t origin, vec3_t front, vec3_t up, vec3_t right,
+                             float half_width, float near, float far, struct frustum *out)
+{
+    vec3_t nc, fc, tmp;
+    vec3_t up_half, right_half, neg;
+
+    PFM_Vec3_Scale(&front, near, &tmp);
+    PFM_Vec3_Add(&origin, &tmp, &nc);
+    PFM_Vec3_Scale(&front, far, &tmp);
+    PFM_Vec3_Add(&origin, &tmp, &fc);
+
+    PFM_Vec3_Scale(&up, half_width, &up_half);
+    PFM_Vec3_Scale(&right, half_width, &right_half);
+
+    PFM_Vec3_Add(&nc, &up_half, &tmp);
+    PFM_Vec3_Sub(&tmp, &right_half, &out->ntl);
+    PFM_Vec3_Add(&tmp, &right_half, &out->ntr);
+    PFM_Vec3_Sub(&nc, &up_half, &tmp);
+    PFM_Vec3_Sub(&tmp, &right_half, &out->nbl);
+    PFM_Vec3_Add(&tmp, &right_half, &out->nbr);
+
+    PFM_Vec3_Add(&fc, &up_half, &tmp);
+    PFM_Vec3_Sub(&tmp, &right_half, &out->ftl);
+    PFM_Vec3_Add(&tmp, &right_half, &out->ftr);
+    PFM_Vec3_Sub(&fc, &up_half, &tmp);
+    PFM_Vec3_Sub(&tmp, &right_half, &out->fbl);
+    PFM_Vec3_Add(&tmp, &right_half, &out->fbr);
+
+    /* The plane normals point into the box */
+    out->near = (struct plane){nc, front};
+    PFM_Vec3_Scale(&front, -1.0f, &neg);
+    out->far = (struct plane){fc, neg};
+
+    PFM_Vec3_Sub(&nc, &up_half, &tmp);
+    out->bot = (struct plane){tmp, up};
+    PFM_Vec3_Add(&nc, &up_half, &tmp);
+    PFM_Vec3_Scale(&up, -1.0f, &neg);
+    out->top = (struct plane){tmp, neg};
+
+    PFM_Vec3_Sub(&nc, &right_half, &tmp);
+    out->left = (struct plane){tmp, right};
+    PFM_Vec3_Add(&nc, &right_half, &tmp);
+    PFM_Vec3_Scale(&right, -1.0f, &neg);
+    out->right = (struct plane){tmp, neg};
+}
+
+static void make_cascade(vec3_t light_dir, const vec3_t corners[static 8], 
+                         float slack, float split, struct shadow_cascade *out)
+{
+    vec3_t center = (vec3_t){0.0f, 0.0f, 0.0f}, tmp;
+    for(int i = 0; i < 8; i++) {
+        tmp = corners[i];
+        PFM_Vec3_Add(&center, &tmp, &center);
+    }
+    PFM_Vec3_Scale(&center, 1.0f / 8, &center);
+
+    float radius = 0.0f;
+    for(int i = 0; i < 8; i++) {
+        tmp = corners[i];
+        PFM_Vec3_Sub(&tmp, &center, &tmp);
+        radius = MAX(radius, PFM_Vec3_Len(&tmp));
     }
+    /* Keeping the size fixed while the camera only rotates keeps the 
+     * texel grid from changing and the shadow edges from shimmering. */
+    radius = ceilf(radius * (1.0f + slack));
+
+    /* Same basis as 'PFM_Mat4x4_MakeLookAt' builds the view matrix with */
+    vec3_t up, right, back, axis = (vec3_t){-1.0f, 0.0f, 0.0f};
+    PFM_Vec3_Cross(&light_dir, &axis, &up);
+    PFM_Vec3_Normal(&up, &up);
+    PFM_Vec3_Scale(&light_dir, -1.0f, &back);
+    PFM_Vec3_Cross(&back, &up, &right);
+
+    /* Move the center in whole texel increments across the light's view 
+     * plane, for the same reason. */
+    const float texel = (2.0f * radius) / CONFIG_SHADOW_MAP_RES;
+    float cx = PFM_Vec3_Dot(&center, &right);
+    float cy = PFM_Vec3_Dot(&center, &up);
+
+    PFM_Vec3_Scale(&right, floorf(cx / texel) * texel - cx, &tmp);
+    PFM_Vec3_Add(&center, &tmp, &center);
+    PFM_Vec3_Scale(&up, floorf(cy / texel) * texel - cy, &tmp);
+    PFM_Vec3_Add(&center, &tmp, &center);
+
+    /* Since, for shadow mapping, we treat our light source as a directional light, 
+     * we only care about direction of the light rays, not the absolute position of 
+     * the light source. Thus, we render each cascade from a fixed distance above 
+     * its' bounding sphere, so that casters a bit outside it are still captured.
+     */
+    const float near = 0.1f, far = 2.0f * radius + LIGHT_EXTRA_HEIGHT;
+    vec3_t origin, target;
+    PFM_Vec3_Scale(&light_dir, -(radius + LIGHT_EXTRA_HEIGHT), &tmp);
+    PFM_Vec3_Add(&center, &tmp, &origin);
+    PFM_Vec3_Add(&origin, &light_dir, &target);
+
+    mat4x4_t light_view, light_proj;
+    PFM_Mat4x4_MakeLookAt(&origin, &target, &up, &light_view);
+    PFM_Mat4x4_MakeOrthographic(-radius, radius, radius, -radius, near, far, &light_proj);
+    PFM_Mat4x4_Mult4x4(&light_proj, &light_view, &out->light_space_trans);
+
+    make_box_frustum(origin, light_dir, up, right, radius, near, far, &out->frustum);
+    out->center = center;
+    out->radius = radius;
+    out->split = split;
 }
 
 /*****************************************************************************/
@@ -118,50 +238,47 @@ void R_GL_InitShadows(void)
     glGenFramebuffers(1, &s_depth_map_FBO);
     glBindFramebuffer(GL_FRAMEBUFFER, s_depth_map_FBO);
 
+    /* The shaders read the raw depth values, so there is no compare mode */
     glGenTextures(1, &s_depth_map_tex);
-    glBindTexture(GL_TEXTURE_2D, s_depth_map_tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, 
-                 CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES, 
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s_depth_map_tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32, 
+                 CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_CASCADES,
                  0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, s_depth_map_tex, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, s_depth_map_tex, 0, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+
+    /* The layers which are not re-rendered keep their contents, so the 
+     * texture stays bound for the lifetime of the context. */
+    R_GL_SetShadowMap(s_depth_map_tex);
     GL_ASSERT_OK();
 }
 
-void R_GL_DepthPassBegin(const vec3_t *light_pos, const vec3_t *cam_pos, const vec3_t *cam_dir)
+void R_GL_DepthPassBegin(const mat4x4_t *light_space_trans, const int *cascade)
 {
     ASSERT_IN_RENDER_THREAD();
 
     assert(!s_depth_pass_active);
+    assert(*cascade >= 0 && *cascade < CONFIG_SHADOW_CASCADES);
     s_depth_pass_active = true;
+    R_GL_PerfBegin(GPU_PASS_DEPTH);
 
     glGetIntegerv(GL_VIEWPORT, s_saved.viewport);
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, &s_saved.fb);
 
-    mat4x4_t light_proj;
-    PFM_Mat4x4_MakeOrthographic(-CONFIG_SHADOW_FOV, CONFIG_SHADOW_FOV, 
-        CONFIG_SHADOW_FOV, -CONFIG_SHADOW_FOV, 0.1f, CONFIG_SHADOW_DRAWDIST, &light_proj);
-
-    mat4x4_t light_view;
-    make_light_frustum(*light_pos, *cam_pos, *cam_dir, NULL, &light_view);
-
-    mat4x4_t light_space_trans;
-    PFM_Mat4x4_Mult4x4(&light_proj, &light_view, &light_space_trans);
-    R_GL_SetLightSpaceTrans(&light_space_trans);
+    R_GL_SetLightSpaceTrans(light_space_trans);
 
     glViewport(0, 0, CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES);
     glBindFramebuffer(GL_FRAMEBUFFER, s_depth_map_FBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, s_depth_map_tex, 0, *cascade);
     glClear(GL_DEPTH_BUFFER_BIT);
     glCullFace(GL_FRONT);
 
@@ -175,12 +292,11 @@ void R_GL_DepthPassEnd(void)
     assert(s_depth_pass_active);
     s_depth_pass_active = false;
 
-    R_GL_SetShadowMap(s_depth_map_tex);
-
     glViewport(s_saved.viewport[0], s_saved.viewport[1], s_saved.viewport[2], s_saved.viewport[3]);
     glBindFramebuffer(GL_FRAMEBUFFER, s_saved.fb);
     glCullFace(GL_BACK);
 
+    R_GL_PerfEnd(GPU_PASS_DEPTH);
     GL_ASSERT_OK();
 }
 
@@ -192,17 +308,38 @@ void R_GL_RenderDepthMap(const void *render_private, mat4x4_t *model)
     const struct render_private *priv = render_private;
     GLuint loc;
 
-    glUseProgram(priv->shader_prog_dp);
+    if(!priv->mesh.VAO) {
+        R_GL_MakeResident((struct render_private*)priv, false);
+    }
+
+    R_GL_StateUseProgram(priv->shader_prog_dp);
 
-    loc = glGetUniformLocation(priv->shader_prog_dp, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(priv->shader_prog_dp, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
 
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_StateBindVAO(priv->mesh.VAO);
+    R_GL_DrawMesh(&priv->mesh);
 
     GL_ASSERT_OK();
 }
 
+void R_GL_RenderDepthMapInstanced(const struct rcmd_draw_instanced *inst)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_depth_pass_active);
+
+    const struct render_private *priv = inst->render_private;
+    if(R_GL_DrawSkinned(priv->shader_prog_dp, inst, false))
+        return;
+
+    GLint prog = R_GL_Shader_GetInstancedProg(priv->shader_prog_dp);
+
+    if(prog >= 0) {
+        R_GL_StateUseProgram(prog);
+    }
+    R_GL_DrawInstances(prog, inst, GL_TRIANGLES, R_GL_RenderDepthMap);
+}
+
 void R_GL_SetShadowsEnabled(void *render_private, const bool *on)
 {
     struct render_private *priv = render_private;
@@ -224,10 +361,68 @@ void R_GL_SetShadowsEnabled(void *render_private, const bool *on)
         if(priv->shader_prog == from)
             priv->shader_prog = to;
     }
+
+    for(size_t i = 0; i < priv->num_lods; i++) {
+        R_GL_SetShadowsEnabled(&priv->lods[i], on);
+    }
 }
 
-void R_LightFrustum(vec3_t light_pos, vec3_t cam_pos, vec3_t cam_dir, struct frustum *out)
+void R_ShadowCascades(vec3_t light_pos, const struct camera *cam, 
+                      struct shadow_cascade out[static CONFIG_SHADOW_CASCADES])
 {
-    make_light_frustum(light_pos, cam_pos, cam_dir, out, NULL);
+    /* This is computed every frame - only look up the setting once */
+    static const struct sval *s_lambda = NULL;
+    if(!s_lambda) {
+        s_lambda = Settings_Handle("pf.video.shadow_split_lambda");
+        assert(s_lambda);
+    }
+    const float lambda = s_lambda->as_float;
+
+    struct frustum cam_frust;
+    Camera_MakeFrustum(cam, &cam_frust);
+    vec3_t cam_pos = Camera_GetPos(cam);
+
+    vec3_t light_dir = light_pos;
+    PFM_Vec3_Normal(&light_dir, &light_dir);
+    PFM_Vec3_Scale(&light_dir, -1.0f, &light_dir);
+
+    const float near = CAM_Z_NEAR_DIST;
+    const float far = shadow_distance(&cam_frust, cam_pos);
+    float prev = near;
+
+    for(int i = 0; i < CONFIG_SHADOW_CASCADES; i++) {
+
+        /* Blend between logarithmic splits, which keep the texel density 
+         * even in screen space, and uniform ones, which don't give up so 
+         * much of the resolution to the area right in front of the camera. 
+         */
+        float frac = (i + 1) / (float)CONFIG_SHADOW_CASCADES;
+        float log_split = near * powf(far / near, frac);
+        float uni_split = near + (far - near) * frac;
+        float split = lambda * log_split + (1.0f - lambda) * uni_split;
+
+        vec3_t corners[8];
+        slice_corners(&cam_frust, cam_pos, prev, split, corners);
+
+        float slack = (i >= CONFIG_SHADOW_FIRST_CACHED) ? CONFIG_SHADOW_CACHE_SLACK : 0.0f;
+        make_cascade(light_dir, corners, slack, split, &out[i]);
+        prev = split;
+    }
+}
+
+bool R_ShadowCascadeCovers(const struct shadow_cascade *cached, const struct shadow_cascade *fresh)
+{
+    /* Both are padded by the same slack - find the sphere the slice 
+     * actually needs. */
+    float needed = fresh->radius / (1.0f + CONFIG_SHADOW_CACHE_SLACK);
+
+    vec3_t delta, a = cached->center, b = fresh->center;
+    PFM_Vec3_Sub(&a, &b, &delta);
+
+    if(PFM_Vec3_Len(&delta) + needed > cached->radius)
+        return false;
+
+    /* A cascade much larger than the slice wastes the resolution */
+    return (cached->radius <= fresh->radius * (1.0f + CONFIG_SHADOW_CACHE_SLACK));
 }
 
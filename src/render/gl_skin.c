@@ -0,0 +1,287 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/render.h"
+#include "public/render_ctrl.h"
+#include "render_private.h"
+#include "gl_render.h"
+#include "gl_shader.h"
+#include "gl_state.h"
+#include "gl_texture.h"
+#include "gl_material.h"
+#include "gl_assert.h"
+#include "../config.h"
+#include "../main.h"
+#include "../mem.h"
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <limits.h>
+#include <assert.h>
+
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define SKIN_MIN_VERTS  (64 * 1024)
+
+/* The vertices captured from the skinned vertex shader, in the order of 
+ * 's_preskin_varyings' in gl_shader.c. They are in world space, so they are 
+ * drawn with the static mesh programs and an identity model matrix. */
+struct skinned_vert{
+    vec3_t  pos;
+    vec2_t  uv;
+    vec3_t  normal;
+    GLint   material_idx;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool   s_resolved;
+static GLint  s_prog = -1;
+static GLuint s_VBO;
+static GLuint s_VAO;
+/* In vertices. The buffer grows to fit the most vertices skinned in a 
+ * frame, and is orphaned at the start of every frame. */
+static size_t s_cap;
+static size_t s_used;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void skin_bind_attribs(void)
+{
+    R_GL_StateBindVAO(s_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct skinned_vert), 
+        (void*)offsetof(struct skinned_vert, pos));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct skinned_vert), 
+        (void*)offsetof(struct skinned_vert, uv));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct skinned_vert), 
+        (void*)offsetof(struct skinned_vert, normal));
+    glEnableVertexAttribArray(2);
+
+    glVertexAttribIPointer(3, 1, GL_INT, sizeof(struct skinned_vert), 
+        (void*)offsetof(struct skinned_vert, material_idx));
+    glEnableVertexAttribArray(3);
+}
+
+/* Makes room for 'nverts' more vertices, keeping the ones already skinned 
+ * this frame */
+static bool skin_reserve(size_t nverts)
+{
+    if(s_used + nverts <= s_cap)
+        return true;
+    if(s_used + nverts > INT_MAX)
+        return false;
+
+    size_t cap = MAX(MAX(s_cap * 2, s_used + nverts), SKIN_MIN_VERTS);
+    GLuint VBO;
+
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, cap * sizeof(struct skinned_vert), NULL, GL_STREAM_COPY);
+
+    if(s_used > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, s_VBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 
+            s_used * sizeof(struct skinned_vert));
+    }
+
+    if(s_VBO) {
+        glDeleteBuffers(1, &s_VBO);
+    }
+    Mem_Track(MEM_TAG_GPU_BUFFERS, (ptrdiff_t)(cap - s_cap) * sizeof(struct skinned_vert));
+
+    s_VBO = VBO;
+    s_cap = cap;
+    skin_bind_attribs();
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+static GLint skin_prog(void)
+{
+    if(!s_resolved) {
+        s_prog = R_GL_Shader_GetProgForName("mesh.animated.preskin");
+        s_resolved = true;
+    }
+    return s_prog;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_SkinInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glGenVertexArrays(1, &s_VAO);
+    s_cap = 0;
+    s_used = 0;
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_SkinShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_VBO) {
+        glDeleteBuffers(1, &s_VBO);
+        Mem_Track(MEM_TAG_GPU_BUFFERS, -(ptrdiff_t)(s_cap * sizeof(struct skinned_vert)));
+    }
+    glDeleteVertexArrays(1, &s_VAO);
+
+    s_VBO = s_VAO = 0;
+    s_cap = s_used = 0;
+    s_resolved = false;
+    s_prog = -1;
+}
+
+void R_GL_SkinBegin(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    s_used = 0;
+    if(!s_VBO)
+        return;
+
+    /* Orphan the last frame's vertices so we don't wait on pending draws */
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+    glBufferData(GL_ARRAY_BUFFER, s_cap * sizeof(struct skinned_vert), NULL, GL_STREAM_COPY);
+
+    GL_ASSERT_OK();
+}
+
+void R_GL_SkinInstances(const struct rcmd_draw_instanced *inst)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(inst->skin_slots && inst->skin_first);
+
+    const struct render_private *priv = inst->render_private;
+    GLint prog = skin_prog();
+
+    if(!inst->palettes || inst->count == 0 || prog < 0)
+        return;
+
+    /* Leave the instances to the regular skinned programs if they can't be 
+     * drawn from the pre-skinned vertices */
+    if(R_GL_Shader_GetStaticProg(priv->shader_prog) < 0
+    || R_GL_Shader_GetStaticProg(priv->shader_prog_dp) < 0)
+        return;
+
+    if(!priv->mesh.VAO) {
+        R_GL_MakeResident((struct render_private*)priv, false);
+    }
+
+    const size_t nverts = inst->count * priv->mesh.num_verts;
+    if(!skin_reserve(nverts))
+        return;
+
+    R_GL_StateUseProgram(prog);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, s_VBO, 
+        s_used * sizeof(struct skinned_vert), nverts * sizeof(struct skinned_vert));
+
+    /* The instances are captured one after another, even when they are 
+     * split over multiple draws */
+    glBeginTransformFeedback(GL_POINTS);
+    R_GL_DrawInstances(prog, inst, GL_POINTS, NULL);
+    glEndTransformFeedback();
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    for(size_t i = 0; i < inst->count; i++) {
+        inst->skin_first[inst->skin_slots[i]] = s_used + i * priv->mesh.num_verts;
+    }
+    s_used += nverts;
+
+    GL_ASSERT_OK();
+}
+
+bool R_GL_DrawSkinned(GLint prog, const struct rcmd_draw_instanced *inst, bool materials)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!inst->skin_slots || inst->count == 0)
+        return false;
+
+    const struct render_private *priv = inst->render_private;
+    GLint static_prog = R_GL_Shader_GetStaticProg(prog);
+    if(static_prog < 0)
+        return false;
+
+    GLint first[inst->count];
+    GLsizei count[inst->count];
+
+    for(size_t i = 0; i < inst->count; i++) {
+
+        first[i] = inst->skin_first[inst->skin_slots[i]];
+        count[i] = priv->mesh.num_verts;
+        if(first[i] < 0)
+            return false;
+    }
+
+    mat4x4_t identity;
+    PFM_Mat4x4_Identity(&identity);
+
+    R_GL_StateUseProgram(static_prog);
+    GLint loc = R_GL_Shader_GetUniformLoc(static_prog, UNIFORM_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
+
+    if(materials) {
+
+        if(priv->mat_UBO) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, MATERIALS_UBO_BINDING, priv->mat_UBO);
+        }
+        R_GL_Texture_ActivateMaterials(priv->materials, priv->num_materials, static_prog);
+    }
+
+    R_GL_StateBindVAO(s_VAO);
+    glMultiDrawArrays(GL_TRIANGLES, first, count, inst->count);
+
+    GL_ASSERT_OK();
+    return true;
+}
@@ -0,0 +1,163 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_state.h"
+#include "gl_assert.h"
+#include "public/render_ctrl.h"
+#include "../main.h"
+
+#include <stdbool.h>
+#include <assert.h>
+
+
+#define MAX_TRACKED_TUNITS  (32)
+#define STATE_UNKNOWN       (~(GLuint)0)
+
+struct tunit_state{
+    GLenum target;
+    GLuint id;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                s_in_batch = false;
+static GLuint              s_prog;
+static GLuint              s_VAO;
+static GLenum              s_active_tunit;
+static struct tunit_state  s_tunits[MAX_TRACKED_TUNITS];
+
+static unsigned            s_prog_changes, s_prog_changes_skipped;
+static unsigned            s_tex_changes,  s_tex_changes_skipped;
+static unsigned            s_vao_changes,  s_vao_changes_skipped;
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_StateBeginBatch(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(!s_in_batch);
+
+    s_prog = STATE_UNKNOWN;
+    s_VAO = STATE_UNKNOWN;
+    s_active_tunit = STATE_UNKNOWN;
+    for(int i = 0; i < MAX_TRACKED_TUNITS; i++) {
+        s_tunits[i] = (struct tunit_state){STATE_UNKNOWN, STATE_UNKNOWN};
+    }
+    s_in_batch = true;
+}
+
+void R_GL_StateEndBatch(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_in_batch);
+    s_in_batch = false;
+}
+
+void R_GL_StateUseProgram(GLuint prog)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_in_batch && s_prog == prog) {
+        s_prog_changes_skipped++;
+        return;
+    }
+
+    glUseProgram(prog);
+    s_prog = prog;
+    s_prog_changes++;
+}
+
+void R_GL_StateBindVAO(GLuint VAO)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_in_batch && s_VAO == VAO) {
+        s_vao_changes_skipped++;
+        return;
+    }
+
+    glBindVertexArray(VAO);
+    s_VAO = VAO;
+    s_vao_changes++;
+}
+
+void R_GL_StateBindTexture(GLenum tunit, GLenum target, GLuint id)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    size_t idx = tunit - GL_TEXTURE0;
+    if(idx >= MAX_TRACKED_TUNITS) {
+
+        glActiveTexture(tunit);
+        glBindTexture(target, id);
+        s_active_tunit = STATE_UNKNOWN;
+        s_tex_changes++;
+        return;
+    }
+
+    if(s_in_batch && s_tunits[idx].target == target && s_tunits[idx].id == id) {
+        s_tex_changes_skipped++;
+        return;
+    }
+
+    if(!s_in_batch || s_active_tunit != tunit) {
+        glActiveTexture(tunit);
+        s_active_tunit = tunit;
+    }
+    glBindTexture(target, id);
+    s_tunits[idx] = (struct tunit_state){target, id};
+    s_tex_changes++;
+}
+
+void R_GL_StateGetStats(struct render_stats *out)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    out->prog_changes = s_prog_changes;
+    out->prog_changes_skipped = s_prog_changes_skipped;
+    out->tex_changes = s_tex_changes;
+    out->tex_changes_skipped = s_tex_changes_skipped;
+    out->vao_changes = s_vao_changes;
+    out->vao_changes_skipped = s_vao_changes_skipped;
+
+    s_prog_changes = s_prog_changes_skipped = 0;
+    s_tex_changes = s_tex_changes_skipped = 0;
+    s_vao_changes = s_vao_changes_skipped = 0;
+}
+
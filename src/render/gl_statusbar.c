@@ -37,6 +37,7 @@
 #include "gl_shader.h"
 #include "gl_uniforms.h"
 #include "gl_assert.h"
+#include "gl_stream.h"
 #include "../camera.h"
 #include "../pf_math.h"
 #include "../config.h"
@@ -63,17 +64,15 @@ void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc,
     /* Convert the worldspace positions to SDL screenspace positions */
     vec2_t ent_top_pos_ss[*num_ents]; /* Screen-space XY positions of the entity tops. */
 
-    mat4x4_t view, proj;
-    Camera_MakeViewMat(cam, &view); 
-    Camera_MakeProjMat(cam, &proj);
+    mat4x4_t view_proj;
+    Camera_MakeViewProjMat(cam, &view_proj);
 
     for(int i = 0; i < *num_ents; i++) {
     
         vec4_t ent_top_homo = (vec4_t){ent_top_pos_ws[i].x, ent_top_pos_ws[i].y, ent_top_pos_ws[i].z, 1.0f};
 
-        vec4_t clip, tmp;
-        PFM_Mat4x4_Mult4x1(&view, &ent_top_homo, &tmp);
-        PFM_Mat4x4_Mult4x1(&proj, &tmp, &clip);
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1(&view_proj, &ent_top_homo, &clip);
         vec3_t ndc = (vec3_t){clip.x / clip.w, clip.y / clip.w, clip.z / clip.w};
 
         float screen_x = (ndc.x + 1.0f) * width/2.0f;
@@ -110,16 +109,18 @@ void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc,
         corners[2], corners[3], corners[0],
     };
 
+    GLintptr offset;
+    if(!R_GL_StreamUpload(vbuff, ARR_SIZE(vbuff) * sizeof(struct textured_vert), 
+        sizeof(struct textured_vert), &offset))
+        return;
+
     /* OpenGL setup */
-    GLuint VAO, VBO;
+    GLuint VAO;
     GLuint shader_prog;
 
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(struct textured_vert), vbuff, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_StreamBuffer());
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct textured_vert), (void*)0);
     glEnableVertexAttribArray(0);
@@ -156,11 +157,12 @@ void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc,
     }
 
     /* Draw instances */
-    glDrawArraysInstanced(GL_TRIANGLES, 0, ARR_SIZE(vbuff), *num_ents);
+    glDrawArraysInstanced(GL_TRIANGLES, offset / sizeof(struct textured_vert), 
+        ARR_SIZE(vbuff), *num_ents);
     GL_ASSERT_OK();
 
     /* cleanup */
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
 }
 
@@ -0,0 +1,211 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_stream.h"
+#include "gl_assert.h"
+#include "../config.h"
+#include "../main.h"
+
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+
+#define STREAM_REGIONS   (4)
+#define STREAM_SIZE      (STREAM_REGIONS * CONFIG_STREAM_REGION_SZ)
+/* How long to block on a region's fence before forcing a flush */
+#define FENCE_TIMEOUT_NS (1000000)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint         s_buff;
+/* Non-NULL when the buffer is persistently mapped */
+static unsigned char *s_mapped;
+static GLsync         s_fences[STREAM_REGIONS];
+static int            s_region;
+/* The offset of the first free byte within the current region */
+static size_t         s_head;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void stream_wait_region(int idx)
+{
+    if(!s_fences[idx])
+        return;
+
+    GLbitfield flags = 0;
+    while(true) {
+        GLenum status = glClientWaitSync(s_fences[idx], flags, FENCE_TIMEOUT_NS);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            break;
+        assert(status != GL_WAIT_FAILED);
+        if(status == GL_WAIT_FAILED)
+            break;
+        /* Make sure the fence is flushed so that waiting on it terminates */
+        flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    }
+    glDeleteSync(s_fences[idx]);
+    s_fences[idx] = 0;
+}
+
+static void stream_next_region(void)
+{
+    assert(!s_fences[s_region]);
+    s_fences[s_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    s_region = (s_region + 1) % STREAM_REGIONS;
+    s_head = 0;
+    stream_wait_region(s_region);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_StreamInit(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glGenBuffers(1, &s_buff);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s_buff);
+
+    if(GLEW_ARB_buffer_storage) {
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, STREAM_SIZE, NULL, flags);
+        s_mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, STREAM_SIZE, flags);
+        if(!s_mapped)
+            goto fail;
+    }else{
+        glBufferData(GL_COPY_WRITE_BUFFER, STREAM_SIZE, NULL, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    memset(s_fences, 0, sizeof(s_fences));
+    s_region = 0;
+    s_head = 0;
+
+    GL_ASSERT_OK();
+    return true;
+
+fail:
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &s_buff);
+    s_buff = 0;
+    return false;
+}
+
+void R_GL_StreamShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < STREAM_REGIONS; i++) {
+        if(s_fences[i])
+            glDeleteSync(s_fences[i]);
+        s_fences[i] = 0;
+    }
+
+    if(s_mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s_buff);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        s_mapped = NULL;
+    }
+    glDeleteBuffers(1, &s_buff);
+    s_buff = 0;
+}
+
+void R_GL_StreamEndFrame(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_head == 0)
+        return;
+    stream_next_region();
+}
+
+GLuint R_GL_StreamBuffer(void)
+{
+    return s_buff;
+}
+
+bool R_GL_StreamUpload(const void *data, size_t size, size_t align, GLintptr *out_offset)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(align > 0);
+
+    if(size == 0) {
+        *out_offset = 0;
+        return true;
+    }
+
+    if(size + align - 1 > CONFIG_STREAM_REGION_SZ)
+        return false;
+
+    size_t base = s_region * CONFIG_STREAM_REGION_SZ;
+    size_t off = ((base + s_head + align - 1) / align) * align;
+
+    if(off + size > base + CONFIG_STREAM_REGION_SZ) {
+        stream_next_region();
+        base = s_region * CONFIG_STREAM_REGION_SZ;
+        off = ((base + align - 1) / align) * align;
+    }
+    assert(off + size <= base + CONFIG_STREAM_REGION_SZ);
+
+    if(s_mapped) {
+        memcpy(s_mapped + off, data, size);
+    }else{
+        /* The fences already guarantee that this range is not in use */
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s_buff);
+        void *dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, off, size, flags);
+        if(!dst) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return false;
+        }
+        memcpy(dst, data, size);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    s_head = off + size - base;
+    *out_offset = off;
+    return true;
+}
+
@@ -0,0 +1,72 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef GL_STREAM_H
+#define GL_STREAM_H
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* A ring buffer for the vertex and index data of the immediate-style draws, 
+ * which is re-specified every frame. The buffer is split into regions, each 
+ * of which is fenced when the render thread is done filling it, and only 
+ * written to again once the GPU is done reading it. When ARB_buffer_storage 
+ * is available, the buffer is persistently mapped for the lifetime of the 
+ * context. Otherwise, every upload maps its' range unsynchronized.
+ */
+
+bool   R_GL_StreamInit(void);
+void   R_GL_StreamShutdown(void);
+/* Fences the region being filled and moves on to the next one, so that the 
+ * next frame's data does not have to wait on the GPU reading this frame's.
+ */
+void   R_GL_StreamEndFrame(void);
+GLuint R_GL_StreamBuffer(void);
+
+/* ------------------------------------------------------------------------
+ * Copies 'size' bytes to the stream buffer and writes their location in it 
+ * to 'out_offset'. The offset is a multiple of 'align', which does not need 
+ * to be a power of two, so that passing the vertex stride allows addressing 
+ * the data with the 'first' argument of the draw call. The data stays valid 
+ * until the end of the frame. Returns false if the data does not fit in a 
+ * single region.
+ * ------------------------------------------------------------------------
+ */
+bool   R_GL_StreamUpload(const void *data, size_t size, size_t align, GLintptr *out_offset);
+
+#endif
+
@@ -36,7 +36,12 @@
 #include "gl_render.h"
 #include "gl_texture.h"
 #include "gl_shader.h"
+#include "gl_perf.h"
+#include "render_private.h"
 #include "../main.h"
+#include "../config.h"
+
+#include <SDL.h>
 
 #include <assert.h>
 
@@ -63,6 +68,7 @@ void R_GL_MapBegin(const bool *shadows)
 {
     ASSERT_IN_RENDER_THREAD();
     assert(!s_map_ctx_active);
+    R_GL_PerfBegin(GPU_PASS_TERRAIN);
 
     GLuint shader_prog;
     if(*shadows) {
@@ -76,11 +82,40 @@ void R_GL_MapBegin(const bool *shadows)
     s_map_ctx_active = true;
 }
 
+void R_GL_MapPrefetch(void **meshes, const size_t *count)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const Uint64 budget = SDL_GetPerformanceFrequency() * CONFIG_PREFETCH_BUDGET_US / 1000000;
+    const Uint64 start = SDL_GetPerformanceCounter();
+
+    for(int i = 0; i < *count; i++) {
+
+        struct render_private *priv = meshes[i];
+        if(priv->mesh.VAO)
+            continue;
+
+        R_GL_MakeResident(priv, false);
+        if(SDL_GetPerformanceCounter() - start >= budget)
+            break;
+    }
+}
+
+void R_GL_MapEvict(void **meshes, const size_t *count)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < *count; i++) {
+        R_GL_Evict(meshes[i]);
+    }
+}
+
 void R_GL_MapEnd(void)
 {
     ASSERT_IN_RENDER_THREAD();
 
     assert(s_map_ctx_active);
     s_map_ctx_active = false;
+    R_GL_PerfEnd(GPU_PASS_TERRAIN);
 }
 
@@ -35,31 +35,615 @@
 
 #include "gl_texture.h"
 #include "gl_uniforms.h"
+#include "gl_shader.h"
+#include "gl_state.h"
 #include "gl_assert.h"
 #include "gl_material.h"
+#include "gl_render.h"
+#include "gl_dds.h"
 #include "../lib/public/stb_image.h"
 #include "../lib/public/stb_image_resize.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/vec.h"
 #include "../config.h"
 #include "../main.h"
+#include "../sched.h"
+#include "../mem.h"
+
+#include <SDL.h>
 
 #include <string.h>
 #include <assert.h>
 
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 KHASH_MAP_INIT_STR(tex, GLuint)
+KHASH_MAP_INIT_INT(texmem, size_t)
+
+/* A texture whose image is being decoded by a worker thread. The texture 
+ * object is created (holding a placeholder image) as soon as the request is
+ * made, so that the handle can be handed out right away. 
+ */
+struct tex_request{
+    struct job_counter ctr;
+    GLuint             id;
+    int                layer;  /* of the atlas array 'id', or -1 */
+    bool               flip;
+    bool               cancelled;
+    char               paths[2][512];
+    /* Written by the decoding job */
+    bool               is_dds;
+    struct dds_image   dds;
+    unsigned char     *data;
+    int                width, height, nr_channels;
+};
+
+VEC_TYPE(req, struct tex_request*)
+VEC_IMPL(static inline, req, struct tex_request*)
+
+/* A texture array holding material images of the same size, one per layer */
+struct atlas_page{
+    GLuint id;
+    int    width, height;
+    int    num_layers;
+    int    used;
+};
+
+struct atlas_entry{
+    int page;
+    int layer;
+};
+
+VEC_TYPE(page, struct atlas_page)
+VEC_IMPL(static inline, page, struct atlas_page)
+
+KHASH_MAP_INIT_STR(layer, struct atlas_entry)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static khash_t(tex) *s_name_tex_table;
+/* The number of bytes of video memory held by each texture, for the memory 
+ * accounting */
+static khash_t(texmem) *s_tex_mem;
+/* Requests are kept in the order they were made, so that the textures 
+ * become resident in the same order. */
+static vec(req)      s_pending;
+static GLuint        s_upload_PBO;
+/* The material atlas arrays and the layers of the images placed in them */
+static vec(page)     s_atlas_pages;
+static khash_t(layer) *s_name_layer_table;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+/* A full chain of mipmaps adds a third to the size of the base level */
+static size_t r_texture_mipmapped_size(size_t base_size)
+{
+    return base_size + base_size / 3;
+}
+
+static void r_texture_track(GLuint id, size_t bytes)
+{
+    int put_ret;
+    khiter_t k = kh_put(texmem, s_tex_mem, id, &put_ret);
+    if(put_ret == -1)
+        return;
+    if(put_ret != 0)
+        kh_value(s_tex_mem, k) = 0;
+
+    Mem_Track(MEM_TAG_GPU_TEXTURES, (ptrdiff_t)bytes - (ptrdiff_t)kh_value(s_tex_mem, k));
+    kh_value(s_tex_mem, k) = bytes;
+}
+
+static void r_texture_untrack(GLuint id)
+{
+    khiter_t k = kh_get(texmem, s_tex_mem, id);
+    if(k == kh_end(s_tex_mem))
+        return;
+
+    Mem_Track(MEM_TAG_GPU_TEXTURES, -(ptrdiff_t)kh_value(s_tex_mem, k));
+    kh_del(texmem, s_tex_mem, k);
+}
+
+static void r_texture_set_params(void)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+static void r_texture_paths(const char *basedir, const char *name, char out[static 2][512])
+{
+    if(basedir) {
+    
+        assert( strlen(basedir) + strlen(name) < 512 );
+        strcpy(out[0], basedir);
+        strcat(out[0], "/");
+        strcat(out[0], name);
+    }else{
+        out[0][0] = '\0';
+    }
+
+    strcpy(out[1], g_basepath);
+    strcat(out[1], "assets/map_textures/");
+    strcat(out[1], name);
+}
+
+static void r_texture_flip_rows(unsigned char *data, int width, int height, int nr_channels)
+{
+    size_t row_size = width * nr_channels;
+    unsigned char tmp[row_size];
+
+    for(int top = 0, bot = height - 1; top < bot; top++, bot--) {
+
+        unsigned char *top_row = data + top * row_size;
+        unsigned char *bot_row = data + bot * row_size;
+        memcpy(tmp, top_row, row_size);
+        memcpy(top_row, bot_row, row_size);
+        memcpy(bot_row, tmp, row_size);
+    }
+}
+
+static bool r_texture_load_cooked(const char *path, struct dds_image *out)
+{
+    char cooked_path[512];
+    R_DDS_CookedPath(path, cooked_path, sizeof(cooked_path));
+    return R_DDS_Load(cooked_path, out);
+}
+
+/* Runs on a worker thread. The atlas layers are always RGBA and hold the 
+ * image as it is, so it must still have the size that the layer was made 
+ * for. There are no cooked layers, as they would have to share a format. 
+ */
+static void r_texture_decode_layer(struct tex_request *req)
+{
+    const int width = req->width, height = req->height;
+
+    for(int i = 0; i < 2 && !req->data; i++) {
+        if(req->paths[i][0] == '\0')
+            continue;
+        req->data = stbi_load(req->paths[i], &req->width, &req->height, &req->nr_channels, 4);
+    }
+    if(!req->data)
+        return;
+
+    if(req->width != width || req->height != height) {
+        stbi_image_free(req->data);
+        req->data = NULL;
+        return;
+    }
+    req->nr_channels = 4;
+}
+
+/* Runs on a worker thread. The images are decoded with stb_image's global 
+ * vertical flip setting, which is only set once at startup. The ones that 
+ * should not be flipped get flipped back here. The cooked images are stored
+ * flipped, so they are only used for the textures that want that.
+ */
+static void r_texture_decode_job(void *arg)
+{
+    struct tex_request *req = arg;
+    req->data = NULL;
+    req->is_dds = false;
+
+    if(req->layer >= 0) {
+        r_texture_decode_layer(req);
+        return;
+    }
+
+    for(int i = 0; i < 2 && !req->data; i++) {
+        if(req->paths[i][0] == '\0')
+            continue;
+        if(req->flip && r_texture_load_cooked(req->paths[i], &req->dds)) {
+            req->is_dds = true;
+            return;
+        }
+        req->data = stbi_load(req->paths[i], &req->width, &req->height, &req->nr_channels, 0);
+    }
+    if(!req->data)
+        return;
+
+    if(req->nr_channels != 3 && req->nr_channels != 4) {
+        stbi_image_free(req->data);
+        req->data = NULL;
+        return;
+    }
+
+    if(!req->flip) {
+        r_texture_flip_rows(req->data, req->width, req->height, req->nr_channels);
+    }
+}
+
+static void r_texture_upload(struct tex_request *req)
+{
+    if(req->cancelled || !(req->data || req->is_dds))
+        return;
+
+    size_t size = req->is_dds ? req->dds.data_size 
+                              : req->width * req->height * req->nr_channels;
+    const void *src = req->is_dds ? req->dds.data : req->data;
+    GLint format = (req->nr_channels == 3) ? GL_RGB : GL_RGBA;
+
+    /* Orphan the staging buffer so that copying into it doesn't have to 
+     * wait on the previous upload from it. */
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_upload_PBO);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, 
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(!dst) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+    memcpy(dst, src, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glActiveTexture(GL_TEXTURE0);
+
+    if(req->layer >= 0) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, req->id);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, req->layer, req->width, req->height, 1, 
+            GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    }else if(req->is_dds) {
+        glBindTexture(GL_TEXTURE_2D, req->id);
+        R_GL_DDS_Upload2D(&req->dds, true);
+        r_texture_track(req->id, size);
+    }else{
+        glBindTexture(GL_TEXTURE_2D, req->id);
+        GLint old_align;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_align);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        glTexImage2D(GL_TEXTURE_2D, 0, format, req->width, req->height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, old_align);
+        r_texture_track(req->id, r_texture_mipmapped_size(size));
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GL_ASSERT_OK();
+}
+
+static void r_texture_request_free(struct tex_request *req)
+{
+    if(req->is_dds)
+        R_DDS_Free(&req->dds);
+    if(req->data)
+        stbi_image_free(req->data);
+    free(req);
+}
+
+static int r_texture_pending_idx(GLuint id)
+{
+    for(int i = 0; i < vec_size(&s_pending); i++) {
+        struct tex_request *req = vec_AT(&s_pending, i);
+        if(!req->cancelled && req->layer < 0 && req->id == id)
+            return i;
+    }
+    return -1;
+}
+
+/* Blocks until the image of the texture is decoded and uploads it right 
+ * away, for the code which needs the actual contents of the texture. */
+static void r_texture_finish(GLuint id)
+{
+    int idx = r_texture_pending_idx(id);
+    if(idx < 0)
+        return;
+
+    struct tex_request *req = vec_AT(&s_pending, idx);
+    Sched_Wait(&req->ctr);
+    r_texture_upload(req);
+
+    vec_req_del(&s_pending, idx);
+    r_texture_request_free(req);
+}
+
+static bool r_texture_request(const char *basedir, const char *name, bool flip, GLuint *out)
+{
+    struct tex_request *req = malloc(sizeof(struct tex_request));
+    if(!req)
+        return false;
+
+    req->layer = -1;
+    req->flip = flip;
+    req->cancelled = false;
+    req->is_dds = false;
+    req->data = NULL;
+    r_texture_paths(basedir, name, req->paths);
+
+    if(!vec_req_push(&s_pending, req)) {
+        free(req);
+        return false;
+    }
+
+    const GLubyte placeholder[4] = {0xff, 0xff, 0xff, 0xff};
+
+    glActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &req->id);
+    glBindTexture(GL_TEXTURE_2D, req->id);
+    r_texture_set_params();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    r_texture_track(req->id, sizeof(placeholder));
+
+    int put_ret;
+    khiter_t k = kh_put(tex, s_name_tex_table, pf_strdup(name), &put_ret);
+    assert(put_ret != -1 && put_ret != 0);
+    kh_value(s_name_tex_table, k) = req->id;
+
+    Sched_Submit(&(struct job){r_texture_decode_job, req}, 1, &req->ctr);
+
+    *out = req->id;
+    GL_ASSERT_OK();
+    return true;
+}
+
+static bool r_texture_image_size(const char *basedir, const char *name, int *out_w, int *out_h)
+{
+    char paths[2][512];
+    r_texture_paths(basedir, name, paths);
+
+    for(int i = 0; i < 2; i++) {
+        int nr_channels;
+        if(paths[i][0] != '\0' && stbi_info(paths[i], out_w, out_h, &nr_channels))
+            return (nr_channels == 3 || nr_channels == 4);
+    }
+    return false;
+}
+
+/* Returns the index of an atlas page for images of the given size with at 
+ * least 'nlayers' free layers, making a new one if there is none, or -1. */
+static int r_texture_atlas_page(int width, int height, int nlayers)
+{
+    for(int i = 0; i < vec_size(&s_atlas_pages); i++) {
+        const struct atlas_page *page = &vec_AT(&s_atlas_pages, i);
+        if(page->width == width && page->height == height
+        && page->num_layers - page->used >= nlayers)
+            return i;
+    }
+
+    GLint max_layers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    const size_t layer_size = (size_t)width * height * 4;
+    const int num_layers = MIN(max_layers, CONFIG_MATERIAL_ATLAS_BYTES / layer_size);
+    if(num_layers < nlayers)
+        return -1;
+
+    struct atlas_page page = (struct atlas_page){
+        .width = width,
+        .height = height,
+        .num_layers = num_layers,
+        .used = 0,
+    };
+    if(!vec_page_push(&s_atlas_pages, page))
+        return -1;
+    struct atlas_page *ret = &vec_AT(&s_atlas_pages, vec_size(&s_atlas_pages) - 1);
+
+    glActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &ret->id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, ret->id);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, num_layers);
+    r_texture_track(ret->id, layer_size * num_layers);
+
+    /* Same sampling as the standalone textures */
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    GL_ASSERT_OK();
+    return vec_size(&s_atlas_pages) - 1;
+}
+
+/* Like r_texture_request, but the image goes into a layer of an atlas page. 
+ * The layer holds a blank image until then. */
+static bool r_texture_request_layer(const char *basedir, const char *name, 
+                                    const struct atlas_page *page, int layer)
+{
+    struct tex_request *req = malloc(sizeof(struct tex_request));
+    if(!req)
+        return false;
+
+    req->id = page->id;
+    req->layer = layer;
+    req->width = page->width;
+    req->height = page->height;
+    req->flip = true;
+    req->cancelled = false;
+    req->is_dds = false;
+    req->data = NULL;
+    r_texture_paths(basedir, name, req->paths);
+
+    if(!vec_req_push(&s_pending, req)) {
+        free(req);
+        return false;
+    }
+
+    const size_t size = (size_t)page->width * page->height * 4;
+    GLubyte *placeholder = malloc(size);
+    if(placeholder) {
+
+        memset(placeholder, 0xff, size);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, page->id);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, page->width, page->height, 1, 
+            GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        free(placeholder);
+    }
+
+    Sched_Submit(&(struct job){r_texture_decode_job, req}, 1, &req->ctr);
+    GL_ASSERT_OK();
+    return true;
+}
+
+static bool r_texture_seen_before(const struct material *mats, size_t idx)
+{
+    for(size_t i = 0; i < idx; i++) {
+        if(!strcmp(mats[i].texname, mats[idx].texname))
+            return true;
+    }
+    return false;
+}
+
+/* All of a mesh's materials must be in the same page, as only one array is 
+ * bound when drawing it. */
+static bool r_texture_load_layers(const char *basedir, struct material *mats, size_t num_mats)
+{
+    if(num_mats == 0)
+        return false;
+
+    int page_idx = -1;
+    int width = 0, height = 0;
+    int nnew = 0;
+
+    for(size_t i = 0; i < num_mats; i++) {
+
+        int w, h;
+        khiter_t k = kh_get(layer, s_name_layer_table, mats[i].texname);
+
+        if(k != kh_end(s_name_layer_table)) {
+
+            int curr = kh_value(s_name_layer_table, k).page;
+            if(page_idx >= 0 && curr != page_idx)
+                return false;
+            page_idx = curr;
+            w = vec_AT(&s_atlas_pages, curr).width;
+            h = vec_AT(&s_atlas_pages, curr).height;
+        }else{
+            if(!r_texture_image_size(basedir, mats[i].texname, &w, &h))
+                return false;
+            if(!r_texture_seen_before(mats, i))
+                nnew++;
+        }
+
+        if(i > 0 && (w != width || h != height))
+            return false;
+        width = w;
+        height = h;
+    }
+
+    if(page_idx >= 0) {
+        const struct atlas_page *page = &vec_AT(&s_atlas_pages, page_idx);
+        if(page->num_layers - page->used < nnew)
+            return false;
+    }else{
+        page_idx = r_texture_atlas_page(width, height, nnew);
+        if(page_idx < 0)
+            return false;
+    }
+
+    struct atlas_page *page = &vec_AT(&s_atlas_pages, page_idx);
+    for(size_t i = 0; i < num_mats; i++) {
+
+        khiter_t k = kh_get(layer, s_name_layer_table, mats[i].texname);
+        if(k == kh_end(s_name_layer_table)) {
+
+            if(!r_texture_request_layer(basedir, mats[i].texname, page, page->used))
+                return false;
+
+            int put_ret;
+            k = kh_put(layer, s_name_layer_table, pf_strdup(mats[i].texname), &put_ret);
+            assert(put_ret != -1 && put_ret != 0);
+            kh_value(s_name_layer_table, k) = (struct atlas_entry){page_idx, page->used++};
+        }
+
+        mats[i].texture.id = page->id;
+        mats[i].texture.tunit = MAT_ATLAS_TUNIT;
+        mats[i].atlas_layer = kh_value(s_name_layer_table, k).layer;
+    }
+    return true;
+}
+
+/* Builds the map texture array from the cooked images, using the stored 
+ * mip chains starting at the level matching the tile texture resolution. 
+ * Only succeeds if all the textures have a cooked counterpart in the same 
+ * format, since all the layers of the array share one.
+ */
+static bool r_texture_make_array_cooked(const char texnames[][256], size_t num_textures, 
+                                        struct texture_arr *out)
+{
+    if(num_textures == 0)
+        return false;
+
+    bool ret = false;
+    size_t nloaded = 0;
+    int num_levels = DDS_MAX_LEVELS;
+
+    struct dds_image *imgs = malloc(num_textures * sizeof(struct dds_image));
+    int *base_levels = malloc(num_textures * sizeof(int));
+    if(!imgs || !base_levels)
+        goto out;
+
+    for(; nloaded < num_textures; nloaded++) {
+
+        char path[512];
+        strcpy(path, g_basepath);
+        strcat(path, "/assets/map_textures/");
+        strcat(path, texnames[nloaded]);
+
+        struct dds_image *img = &imgs[nloaded];
+        if(!r_texture_load_cooked(path, img))
+            goto out;
+
+        base_levels[nloaded] = -1;
+        for(int i = 0; i < img->num_levels; i++) {
+            if(img->levels[i].width == CONFIG_TILE_TEX_RES 
+            && img->levels[i].height == CONFIG_TILE_TEX_RES) {
+                base_levels[nloaded] = i;
+                break;
+            }
+        }
+
+        if(img->format != imgs[0].format || base_levels[nloaded] < 0) {
+            nloaded++;
+            goto out;
+        }
+        num_levels = MIN(num_levels, img->num_levels - base_levels[nloaded]);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    out->tunit = GL_TEXTURE0;
+    glGenTextures(1, &out->id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, out->id);
+
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, num_levels, imgs[0].format, 
+        CONFIG_TILE_TEX_RES, CONFIG_TILE_TEX_RES, num_textures);
+
+    size_t size = 0;
+    for(int i = 0; i < num_textures; i++) {
+        for(int j = 0; j < num_levels; j++) {
+
+            const struct dds_level *lvl = &imgs[i].levels[base_levels[i] + j];
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, j, 0, 0, i, lvl->width, lvl->height, 1, 
+                imgs[i].format, lvl->size, imgs[i].data + lvl->offset);
+            size += lvl->size;
+        }
+    }
+    r_texture_track(out->id, size);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+
+    GL_ASSERT_OK();
+    ret = true;
+
+out:
+    for(int i = 0; i < nloaded; i++)
+        R_DDS_Free(&imgs[i]);
+    free(imgs);
+    free(base_levels);
+    return ret;
+}
+
 static bool r_texture_gl_init(const char *path, GLuint *out)
 {
     ASSERT_IN_RENDER_THREAD();
@@ -67,6 +651,21 @@ static bool r_texture_gl_init(const char *path, GLuint *out)
     GLuint ret;
     int width, height, nr_channels;
     unsigned char *data;
+    struct dds_image dds;
+
+    if(r_texture_load_cooked(path, &dds)) {
+
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(1, &ret);
+        glBindTexture(GL_TEXTURE_2D, ret);
+        r_texture_set_params();
+        R_GL_DDS_Upload2D(&dds, false);
+        r_texture_track(ret, dds.data_size);
+
+        R_DDS_Free(&dds);
+        *out = ret;
+        return true;
+    }
     
     data = stbi_load(path, &width, &height, &nr_channels, 0);
     if(!data)
@@ -75,11 +674,7 @@ static bool r_texture_gl_init(const char *path, GLuint *out)
     glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &ret);
     glBindTexture(GL_TEXTURE_2D, ret);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    r_texture_set_params();
 
     if(nr_channels != 3 && nr_channels != 4)
         goto fail_format;
@@ -88,6 +683,7 @@ static bool r_texture_gl_init(const char *path, GLuint *out)
                                         GL_RGBA;
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    r_texture_track(ret, r_texture_mipmapped_size(width * height * nr_channels));
 
     stbi_image_free(data);
     *out = ret;
@@ -108,7 +704,87 @@ bool R_GL_Texture_Init(void)
     ASSERT_IN_RENDER_THREAD();
 
     s_name_tex_table = kh_init(tex);
-    return (s_name_tex_table != NULL);
+    if(!s_name_tex_table)
+        return false;
+
+    s_tex_mem = kh_init(texmem);
+    if(!s_tex_mem) {
+        kh_destroy(tex, s_name_tex_table);
+        return false;
+    }
+
+    s_name_layer_table = kh_init(layer);
+    if(!s_name_layer_table) {
+        kh_destroy(texmem, s_tex_mem);
+        kh_destroy(tex, s_name_tex_table);
+        return false;
+    }
+
+    vec_req_init(&s_pending);
+    vec_page_init(&s_atlas_pages);
+    glGenBuffers(1, &s_upload_PBO);
+    return true;
+}
+
+void R_GL_Texture_Shutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < vec_size(&s_pending); i++) {
+        struct tex_request *req = vec_AT(&s_pending, i);
+        Sched_Wait(&req->ctr);
+        r_texture_request_free(req);
+    }
+    vec_req_destroy(&s_pending);
+    glDeleteBuffers(1, &s_upload_PBO);
+
+    for(int i = 0; i < vec_size(&s_atlas_pages); i++) {
+        glDeleteTextures(1, &vec_AT(&s_atlas_pages, i).id);
+    }
+    vec_page_destroy(&s_atlas_pages);
+
+    const char *key;
+    struct atlas_entry entry;
+    kh_foreach(s_name_layer_table, key, entry, {
+        (void)entry;
+        free((void*)key);
+    });
+    kh_destroy(layer, s_name_layer_table);
+
+    GLuint id;
+    size_t bytes;
+    kh_foreach(s_tex_mem, id, bytes, {
+        (void)id;
+        Mem_Track(MEM_TAG_GPU_TEXTURES, -(ptrdiff_t)bytes);
+    });
+    kh_destroy(texmem, s_tex_mem);
+}
+
+void R_GL_Texture_ProcessUploads(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const Uint64 budget = SDL_GetPerformanceFrequency() * CONFIG_TEX_UPLOAD_BUDGET_US / 1000000;
+    const Uint64 start = SDL_GetPerformanceCounter();
+
+    /* At least one texture is uploaded per frame, even if it takes 
+     * longer than the budget. */
+    int i = 0;
+    while(i < vec_size(&s_pending)) {
+
+        struct tex_request *req = vec_AT(&s_pending, i);
+        if(!Sched_Done(&req->ctr)) {
+            i++;
+            continue;
+        }
+
+        r_texture_upload(req);
+        vec_req_del(&s_pending, i);
+        r_texture_request_free(req);
+
+        if(SDL_GetPerformanceCounter() - start >= budget)
+            break;
+    }
 }
 
 bool R_GL_Texture_GetForName(const char *name, GLuint *out)
@@ -129,27 +805,14 @@ bool R_GL_Texture_Load(const char *basedir, const char *name, GLuint *out)
 
     GLuint ret;
     khiter_t k;
-    char texture_path[512], texture_path_maps[512];
+    char paths[2][512];
 
     if((k = kh_get(tex, s_name_tex_table, name)) != kh_end(s_name_tex_table))
         goto fail;
 
-    if(basedir) {
-    
-        assert( strlen(basedir) + strlen(name) < sizeof(texture_path) );
-        strcpy(texture_path, basedir);
-        strcat(texture_path, "/");
-        strcat(texture_path, name);
-    }else{
-        texture_path[0] = '\0';
-    }
-
-    strcpy(texture_path_maps, g_basepath);
-    strcat(texture_path_maps, "assets/map_textures/");
-    strcat(texture_path_maps, name);
-
-    if(!r_texture_gl_init(texture_path, &ret)
-    && !r_texture_gl_init(texture_path_maps, &ret))
+    r_texture_paths(basedir, name, paths);
+    if(!r_texture_gl_init(paths[0], &ret)
+    && !r_texture_gl_init(paths[1], &ret))
         goto fail;
 
     int put_ret;
@@ -188,7 +851,12 @@ void R_GL_Texture_Free(const char *name)
     if((k = kh_get(tex, s_name_tex_table, name)) != kh_end(s_name_tex_table)) {
 
         GLuint id = kh_val(s_name_tex_table, k);
+        int idx = r_texture_pending_idx(id);
+        if(idx >= 0) {
+            vec_AT(&s_pending, idx)->cancelled = true;
+        }
         glDeleteTextures(1, &id);
+        r_texture_untrack(id);
         free((void*)kh_key(s_name_tex_table, k));
         kh_del(tex, s_name_tex_table, k);
     }
@@ -200,30 +868,11 @@ void R_GL_Texture_Activate(const struct texture *text, GLuint shader_prog)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint sampler_loc = 0;
-    switch(text->tunit) {
-    case GL_TEXTURE0:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE0);  break;
-    case GL_TEXTURE1:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE1);  break;
-    case GL_TEXTURE2:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE2);  break;
-    case GL_TEXTURE3:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE3);  break;
-    case GL_TEXTURE4:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE4);  break;
-    case GL_TEXTURE5:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE5);  break;
-    case GL_TEXTURE6:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE6);  break;
-    case GL_TEXTURE7:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE7);  break;
-    case GL_TEXTURE8:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE8);  break;
-    case GL_TEXTURE9:  sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE9);  break;
-    case GL_TEXTURE10: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE10); break;
-    case GL_TEXTURE11: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE11); break;
-    case GL_TEXTURE12: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE12); break;
-    case GL_TEXTURE13: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE13); break;
-    case GL_TEXTURE14: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE14); break;
-    case GL_TEXTURE15: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE15); break;
-
-    default: assert(0);
-    }
-
-    glActiveTexture(text->tunit);
-    glBindTexture(GL_TEXTURE_2D, text->id);
+    assert(text->tunit >= GL_TEXTURE0 && text->tunit < GL_TEXTURE0 + SHADER_NUM_TEXTURES);
+    GLuint sampler_loc = R_GL_Shader_GetUniformLoc(shader_prog, 
+        UNIFORM_TEXTURE0 + (text->tunit - GL_TEXTURE0));
+
+    R_GL_StateBindTexture(text->tunit, GL_TEXTURE_2D, text->id);
     glUniform1i(sampler_loc, text->tunit - GL_TEXTURE0);
 
     GL_ASSERT_OK();
@@ -241,6 +890,7 @@ void R_GL_Texture_MakeArray(const struct material *mats, size_t num_mats,
 
     glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB8, 
         CONFIG_TILE_TEX_RES, CONFIG_TILE_TEX_RES, num_mats);
+    r_texture_track(out->id, CONFIG_TILE_TEX_RES * CONFIG_TILE_TEX_RES * 3 * num_mats);
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
@@ -249,6 +899,7 @@ void R_GL_Texture_MakeArray(const struct material *mats, size_t num_mats,
 
         if(mats[i].texture.id == 0)
             continue;
+        r_texture_finish(mats[i].texture.id);
 
         glBindTexture(GL_TEXTURE_2D, mats[i].texture.id);
 
@@ -280,6 +931,9 @@ bool R_GL_Texture_MakeArrayMap(const char texnames[][256], size_t num_textures,
 {
     ASSERT_IN_RENDER_THREAD();
 
+    if(r_texture_make_array_cooked(texnames, num_textures, out))
+        return true;
+
     glActiveTexture(GL_TEXTURE0);
     out->tunit = GL_TEXTURE0;
     glGenTextures(1, &out->id);
@@ -287,6 +941,7 @@ bool R_GL_Texture_MakeArrayMap(const char texnames[][256], size_t num_textures,
 
     glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB8, 
         CONFIG_TILE_TEX_RES, CONFIG_TILE_TEX_RES, num_textures);
+    r_texture_track(out->id, CONFIG_TILE_TEX_RES * CONFIG_TILE_TEX_RES * 3 * num_textures);
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
@@ -325,6 +980,7 @@ bool R_GL_Texture_MakeArrayMap(const char texnames[][256], size_t num_textures,
 
 fail_load:
     glDeleteTextures(1, &out->id);
+    r_texture_untrack(out->id);
     return false;
 }
 
@@ -332,19 +988,19 @@ void R_GL_Texture_ActivateArray(const struct texture_arr *arr, GLuint shader_pro
 {
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEX_ARRAY0);
-    glActiveTexture(arr->tunit);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, arr->id);
+    GLuint sampler_loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_TEX_ARRAY0);
+    R_GL_StateBindTexture(arr->tunit, GL_TEXTURE_2D_ARRAY, arr->id);
     glUniform1i(sampler_loc, arr->tunit - GL_TEXTURE0);
 
     GL_ASSERT_OK();
 }
 
-void R_GL_Texture_GetSize(GLuint texid, int *out_w, int *out_h)
+void R_GL_Texture_GetSize(const GLuint *texid, int *out_w, int *out_h)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    glBindTexture(GL_TEXTURE_2D, texid);
+    r_texture_finish(*texid);
+    glBindTexture(GL_TEXTURE_2D, *texid);
     glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, out_w);
     glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, out_h);
     GL_ASSERT_OK();
@@ -357,6 +1013,51 @@ void R_GL_Texture_GetOrLoad(const char *basedir, const char *name, GLuint *out)
     if(R_GL_Texture_GetForName(name, out))
         return;
 
-    R_GL_Texture_Load(basedir, name, out);
+    r_texture_request(basedir, name, true, out);
+}
+
+void R_GL_Texture_GetOrLoadUnflipped(const char *basedir, const char *name, GLuint *out)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(R_GL_Texture_GetForName(name, out))
+        return;
+
+    r_texture_request(basedir, name, false, out);
+}
+
+void R_GL_Texture_LoadMaterials(const char *basedir, struct material *mats, 
+                                const size_t *num_mats)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(CONFIG_MATERIAL_ATLAS && r_texture_load_layers(basedir, mats, *num_mats))
+        return;
+
+    for(size_t i = 0; i < *num_mats; i++) {
+        mats[i].atlas_layer = -1;
+        R_GL_Texture_GetOrLoad(basedir, mats[i].texname, &mats[i].texture.id);
+    }
 }
 
+void R_GL_Texture_ActivateMaterials(const struct material *mats, size_t num_mats, 
+                                    GLuint shader_prog)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    /* The atlas sampler must always refer to its' own unit, as samplers of 
+     * different types may not share one */
+    GLint loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MAT_ATLAS);
+    glUniform1i(loc, MAT_ATLAS_TUNIT - GL_TEXTURE0);
+
+    if(num_mats > 0 && mats[0].atlas_layer >= 0) {
+        R_GL_StateBindTexture(MAT_ATLAS_TUNIT, GL_TEXTURE_2D_ARRAY, mats[0].texture.id);
+        GL_ASSERT_OK();
+        return;
+    }
+
+    for(size_t i = 0; i < num_mats; i++) {
+        R_GL_Texture_Activate(&mats[i].texture, shader_prog);
+    }
+    GL_ASSERT_OK();
+}
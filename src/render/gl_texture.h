@@ -52,7 +52,11 @@ struct texture_arr{
 };
 
 bool R_GL_Texture_Init(void);
+void R_GL_Texture_Shutdown(void);
 bool R_GL_Texture_AddExisting(const char *name, GLuint id);
+/* Uploads the textures whose images have finished decoding in the 
+ * background, until CONFIG_TEX_UPLOAD_BUDGET_US is used up. */
+void R_GL_Texture_ProcessUploads(void);
 
 void R_GL_Texture_MakeArray(const struct material *mats, size_t num_mats, 
                             struct texture_arr *out);
@@ -62,6 +66,20 @@ bool R_GL_Texture_MakeArrayMap(const char texnames[][256], size_t num_textures,
 void R_GL_Texture_Activate(const struct texture *text, GLuint shader_prog);
 void R_GL_Texture_ActivateArray(const struct texture_arr *arr, GLuint shader_prog);
 
+/* Places the textures of all the materials into layers of one of the shared 
+ * material atlas arrays when they all have the same size, or else loads each 
+ * of them with R_GL_Texture_GetOrLoad. Either way, the images are only filled 
+ * in once they are decoded. */
+void R_GL_Texture_LoadMaterials(const char *basedir, struct material *mats, 
+                                const size_t *num_mats);
+/* Binds the textures of the materials for drawing with 'shader_prog' */
+void R_GL_Texture_ActivateMaterials(const struct material *mats, size_t num_mats, 
+                                    GLuint shader_prog);
+
+/* The handle is returned right away, but the texture holds a placeholder 
+ * image until its' image is decoded by a worker thread and uploaded. */
 void R_GL_Texture_GetOrLoad(const char *basedir, const char *name, GLuint *out);
+/* Same as above, but the rows of the image are kept in file order */
+void R_GL_Texture_GetOrLoadUnflipped(const char *basedir, const char *name, GLuint *out);
 
 #endif
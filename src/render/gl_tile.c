@@ -55,9 +55,12 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
   
 
 #define ARR_SIZE(a)                 (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)                   ((a) > (b) ? (a) : (b))
+#define MIN(a, b)                   ((a) < (b) ? (a) : (b))
 #define MAG(x, y)                   sqrt(pow(x,2) + pow(y,2))
 #define VEC3_EQUAL(a, b)            (0 == memcmp((a).raw, (b).raw, sizeof((a).raw)))
 
@@ -69,9 +72,8 @@
                                               | (((c) & 0xff) << 8) \
                                               | (((d) & 0xff) << 0) )
 
-#define SAME_INDICES_32(i)          (  ((i) & 0xffff) == (( (i) >> 16) & 0xfffff) \
-                                    && ((i) & 0xff  ) == (( (i) >> 8 ) & 0xff   ) \
-                                    && ((i) & 0xf   ) == (( (i) >> 4 ) & 0xf    ) )
+#define SPLAT_PAIR(a, b)            INDICES_MASK_32(INDICES_MASK_8(a, b), INDICES_MASK_8(a, b), \
+                                                INDICES_MASK_8(a, b), INDICES_MASK_8(a, b))
 
 /* We take the directions to be relative to a normal vector facing outwards
  * from the plane of the face. West is to the right, east is to the left,
@@ -93,10 +95,6 @@ struct tile_adj_info{
     int right_center_idx;
 };
 
-struct tri{
-    struct vertex verts[3];
-};
-
 /* Each top face is made up of 8 triangles, in the following configuration:
  *   +------+------+
  *   |\     |     /|
@@ -107,10 +105,7 @@ struct tri{
  *   |  /   |   \  |
  *   |/     |     \|
  *   +------+------+
- * Each face can be thought of as being made of of 4 "major" triangles,
- * each of which has its' own adjacency info as a flat attribute. The 4 major
- * triangles are the minimal configuration that is necessary for the blending
- * system to work.
+ * Each face can be thought of as being made of of 4 "major" triangles:
  *   +------+------+
  *   |\           /|
  *   |  \   2   /  |
@@ -121,50 +116,81 @@ struct tri{
  *   |/           \|
  *   +------+------+
  * The "major" trinagles can be futher subdivided. The triangles they are divided 
- * into must inherit the flat adjacency attributes and interpolate their positions, 
- * uv coorinates, and normals. In our case, we futher subdivide each of the major
- * triangles into 2 triangles. This is to give an extra vertex on the midpoint 
+ * into interpolate their positions, uv coorinates, and normals. The blending of 
+ * the materials is not affected, as it is looked up in the map's splat texture
+ * by the world position of the fragment. In our case, we futher subdivide each 
+ * of the major triangles into 2 triangles. This is to give an extra vertex on the midpoint 
  * of each edge. When smoothing the normals, this extra point having its' own 
  * normal is essential. Care must be taken to ensure the appropriate winding order
  * for each triangle for backface culling!
+ *
+ * The face is drawn indexed. The two halves of a major triangle share its' center 
+ * and the two triangles touching an edge midpoint share it. The corners are not 
+ * shared, as the two triangles meeting there can have different normals. Flat 
+ * attributes are taken from the first (provoking) vertex of each triangle.
  */
+#define TOP_FACE_VERTS(type)                                                    \
+    struct{                                                                     \
+        /* The corners, one vertex for each of the two triangles touching them */\
+        type se0;                                                               \
+        type se1;                                                               \
+        type sw0;                                                               \
+        type sw1;                                                               \
+        type nw0;                                                               \
+        type nw1;                                                               \
+        type ne0;                                                               \
+        type ne1;                                                               \
+        /* The edge midpoints */                                                \
+        type s;                                                                 \
+        type w;                                                                 \
+        type n;                                                                 \
+        type e;                                                                 \
+        /* The center, one vertex for each major triangle */                    \
+        type center0;                                                           \
+        type center1;                                                           \
+        type center2;                                                           \
+        type center3;                                                           \
+    }
+
 union top_face_vbuff{
-    struct vertex verts[VERTS_PER_TOP_FACE];
-    struct tri tris[VERTS_PER_TOP_FACE/3];
-    struct{
-        /* Tri 0 */
-        struct vertex se0; 
-        struct vertex s0;
-        struct vertex center0;
-        /* Tri 1 */
-        struct vertex center1;
-        struct vertex s1;
-        struct vertex sw0;
-        /* Tri 2 */
-        struct vertex sw1;
-        struct vertex w0;
-        struct vertex center2;
-        /* Tri 3 */
-        struct vertex center3;
-        struct vertex w1;
-        struct vertex nw0;
-        /* Tri 4 */
-        struct vertex nw1;
-        struct vertex n0;
-        struct vertex center4;
-        /* Tri 5 */
-        struct vertex center5;
-        struct vertex n1;
-        struct vertex ne0;
-        /* Tri 6 */
-        struct vertex ne1;
-        struct vertex e0;
-        struct vertex center6;
-        /* Tri 7 */
-        struct vertex center7;
-        struct vertex e1;
-        struct vertex se1;
-    };
+    struct vertex verts[UNIQUE_VERTS_PER_TOP_FACE];
+    TOP_FACE_VERTS(struct vertex);
+};
+
+/* The same face, as laid out in the vertex buffer */
+union top_face_tvbuff{
+    struct terrain_vert verts[UNIQUE_VERTS_PER_TOP_FACE];
+    TOP_FACE_VERTS(struct terrain_vert);
+};
+
+#define SIDE_IDX(idx, corner)   ((idx) * UNIQUE_VERTS_PER_SIDE_FACE \
+                                + offsetof(struct face, corner) / sizeof(struct vertex))
+#define TOP_IDX(vert)           (4 * UNIQUE_VERTS_PER_SIDE_FACE \
+                                + offsetof(union top_face_vbuff, vert) / sizeof(struct vertex))
+#define SIDE_FACE_INDICES(idx) \
+    SIDE_IDX(idx, nw), SIDE_IDX(idx, ne), SIDE_IDX(idx, sw), \
+    SIDE_IDX(idx, se), SIDE_IDX(idx, sw), SIDE_IDX(idx, ne)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The triangles of a single tile, as indices into its' unique vertices */
+static const GLushort s_tile_indices[VERTS_PER_TILE] = {
+    /* Front, back, left and right faces */
+    SIDE_FACE_INDICES(0),
+    SIDE_FACE_INDICES(1),
+    SIDE_FACE_INDICES(2),
+    SIDE_FACE_INDICES(3),
+    /* Top face */
+    TOP_IDX(se0),     TOP_IDX(s), TOP_IDX(center0),
+    TOP_IDX(center0), TOP_IDX(s), TOP_IDX(sw0),
+    TOP_IDX(sw1),     TOP_IDX(w), TOP_IDX(center1),
+    TOP_IDX(center1), TOP_IDX(w), TOP_IDX(nw0),
+    TOP_IDX(nw1),     TOP_IDX(n), TOP_IDX(center2),
+    TOP_IDX(center2), TOP_IDX(n), TOP_IDX(ne0),
+    TOP_IDX(ne1),     TOP_IDX(e), TOP_IDX(center3),
+    TOP_IDX(center3), TOP_IDX(e), TOP_IDX(se1),
 };
 
 /*****************************************************************************/
@@ -312,7 +338,7 @@ static void tile_top_normals(const struct tile *tile, vec3_t out_tri_normals[sta
     PFM_Vec3_Normal(out_tri_normals + 1, out_tri_normals + 1);
 }
 
-static void tile_smooth_normals_corner(struct tile *adj_cw[static 4], struct vertex *inout)
+static void tile_smooth_normals_corner(struct tile *adj_cw[static 4], struct terrain_vert *inout)
 {
     enum{
         ADJ_CW_IDX_TOP_LEFT  = 0,
@@ -353,10 +379,10 @@ static void tile_smooth_normals_corner(struct tile *adj_cw[static 4], struct ver
     }
 
     PFM_Vec3_Normal(&norm_total, &norm_total);
-    inout->normal = norm_total;
+    inout->normal = R_VertPackNormal(norm_total);
 }
 
-static void tile_smooth_normals_edge(struct tile *adj_lrtb[static 4], struct vertex *inout)
+static void tile_smooth_normals_edge(struct tile *adj_lrtb[static 4], struct terrain_vert *inout)
 {
     vec3_t norm_total = {0};
     assert((!!adj_lrtb[0] + !!adj_lrtb[1] + !!adj_lrtb[2] + !!adj_lrtb[3]) <= 2);
@@ -376,7 +402,7 @@ static void tile_smooth_normals_edge(struct tile *adj_lrtb[static 4], struct ver
 
     assert(PFM_Vec3_Len(&norm_total) > 0);
     PFM_Vec3_Normal(&norm_total, &norm_total);
-    inout->normal = norm_total;
+    inout->normal = R_VertPackNormal(norm_total);
 }
 
 static void tile_mat_indices(struct tile_adj_info *inout, bool *out_top_tri_left_aligned)
@@ -426,39 +452,6 @@ static void tile_mat_indices(struct tile_adj_info *inout, bool *out_top_tri_left
     }
 }
 
-/* When all the materials for the tile are the same, we don't have to perform 
- * blending in the shader. This aids performance. */
-enum blend_mode optimal_blendmode(const struct vertex *vert)
-{
-    if(SAME_INDICES_32(vert->adjacent_mat_indices[0])
-    && SAME_INDICES_32(vert->adjacent_mat_indices[1])
-    && vert->adjacent_mat_indices[0] == vert->adjacent_mat_indices[1]
-    && (vert->adjacent_mat_indices[0] & 0xf) == vert->material_idx) {
-    
-        return BLEND_MODE_NOBLEND;
-    }else{
-        return vert->blend_mode; 
-    }
-}
-
-static bool arr_contains(int *array, size_t size, int elem)
-{
-    for(int i = 0; i < size; i++) {
-        if(array[i] == elem) 
-            return true;
-    }
-    return false;
-}
-
-static int arr_indexof(const int *array, size_t size, int elem)
-{
-    for(int i = 0; i < size; i++) {
-        if(array[i] == elem) 
-            return i;
-    }
-    return -1;
-}
-
 static int arr_min(const int array[static 1], size_t size)
 {
     int min = array[0];
@@ -534,6 +527,49 @@ static float tile_min_visible_height(const struct map *map, struct tile_desc til
     return arr_min(heights, ARR_SIZE(heights)) * Y_COORDS_PER_TILE;
 }
 
+/* The highest of the tile corners meeting at the grid point. Taking the 
+ * highest keeps plateaus and cliff tops in place, and the skirts cover 
+ * whatever is opened up below them. */
+static int lod_corner_height(const struct tile *tiles, int r, int c)
+{
+    const int w = TILES_PER_CHUNK_WIDTH, h = TILES_PER_CHUNK_HEIGHT;
+    int ret = INT_MIN;
+
+    if(r < h && c < w)
+        ret = MAX(ret, M_Tile_NWHeight(&tiles[r * w + c]));
+    if(r < h && c > 0)
+        ret = MAX(ret, M_Tile_NEHeight(&tiles[r * w + (c - 1)]));
+    if(r > 0 && c > 0)
+        ret = MAX(ret, M_Tile_SEHeight(&tiles[(r - 1) * w + (c - 1)]));
+    if(r > 0 && c < w)
+        ret = MAX(ret, M_Tile_SWHeight(&tiles[(r - 1) * w + c]));
+
+    assert(ret != INT_MIN);
+    return ret;
+}
+
+/* Emits the triangle wound so that its' front face points along 'facing' */
+static struct vertex *lod_emit_tri(struct vertex *out, struct vertex a, struct vertex b, 
+                                   struct vertex c, int mat_idx, vec3_t facing)
+{
+    vec3_t ab, ac, normal;
+    PFM_Vec3_Sub(&b.pos, &a.pos, &ab);
+    PFM_Vec3_Sub(&c.pos, &a.pos, &ac);
+    PFM_Vec3_Cross(&ab, &ac, &normal);
+    bool flip = PFM_Vec3_Dot(&normal, &facing) < 0.0f;
+
+    out[0] = a;
+    out[1] = flip ? c : b;
+    out[2] = flip ? b : c;
+
+    /* The material index is a flat attribute */
+    for(int i = 0; i < 3; i++) {
+        out[i].material_idx = mat_idx;
+        out[i].blend_mode = BLEND_MODE_NOBLEND;
+    }
+    return out + 3;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -543,22 +579,28 @@ void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivat
 {
     ASSERT_IN_RENDER_THREAD();
 
-    struct vertex vbuff[VERTS_PER_TILE];
+    struct terrain_vert tile_verts[UNIQUE_VERTS_PER_TILE];
+    struct terrain_vert vbuff[VERTS_PER_TILE];
     vec3_t red = (vec3_t){1.0f, 0.0f, 0.0f};
     GLuint VAO, VBO;
     GLuint shader_prog;
     GLuint loc;
 
-    const struct render_private *priv = chunk_rprivate;
-    size_t offset = (in->tile_r * (*tiles_per_chunk_x) + in->tile_c) * VERTS_PER_TILE * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
+    struct render_private *priv = (struct render_private*)chunk_rprivate;
+    R_GL_MakeResident(priv, false);
+    size_t offset = (in->tile_r * (*tiles_per_chunk_x) + in->tile_c) * UNIQUE_VERTS_PER_TILE * sizeof(struct terrain_vert);
+    size_t length = UNIQUE_VERTS_PER_TILE * sizeof(struct terrain_vert);
 
     glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
-    const struct vertex *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_READ_BIT);
+    const struct terrain_vert *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_READ_BIT);
     assert(vert_base);
-    memcpy(vbuff, vert_base, sizeof(vbuff));
+    memcpy(tile_verts, vert_base, sizeof(tile_verts));
     glUnmapBuffer(GL_ARRAY_BUFFER);
 
+    for(int i = 0; i < VERTS_PER_TILE; i++) {
+        vbuff[i] = tile_verts[s_tile_indices[i]];
+    }
+
     /* Additionally, scale the tile selection mesh slightly around its' center. This is so that 
      * it is slightly larger than the actual tile underneath and can be rendered on top of it. */
     const float SCALE_FACTOR = 1.025f;
@@ -584,29 +626,16 @@ void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivat
 
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, uv));
-    glEnableVertexAttribArray(1);
-
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, normal));
-    glEnableVertexAttribArray(2);
+    R_GL_VertSetAttribs(VERT_FORMAT_TERRAIN);
 
     shader_prog = R_GL_Shader_GetProgForName("mesh.static.tile-outline");
     glUseProgram(shader_prog);
 
     /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, final_model.raw);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_COLOR);
     glUniform3fv(loc, 1, red.raw);
 
     /* buffer & render */
@@ -620,13 +649,8 @@ void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivat
     glDeleteBuffers(1, &VBO);
 }
 
-void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+void R_TileGetSplat(const struct map *map, const struct tile_desc *tile, uint32_t out[static 9])
 {
-    ASSERT_IN_RENDER_THREAD();
-
-    const struct render_private *priv = chunk_rprivate;
-    GLuint VBO = priv->mesh.VBO;
-
     struct map_resolution res;
     M_GetResolution(map, &res);
 
@@ -766,100 +790,25 @@ void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const
                                            : INDICES_MASK_8(curr.left_center_idx, left.right_center_idx);
     }
 
-    /* Now, update all triangles of the top face 
-     *
-     * Since 'adjacent_mat_indices' is a flat attribute, we only need to set 
-     * it for the provoking vertex of each triangle.
-     *
-     * The first two 'adjacency_mat_indices' elements hold the 8 surrounding materials for 
-     * the triangle's two non-central vertices. If the vertex is surrounded by only
-     * 2 different materials, for example, then the weighting of each of these 
-     * materials at the vertex is determened by the number of occurences of the 
-     * material's index. The final material is the weighted average of the 8 materials,
-     * which may contain repeated indices.
-     *
-     * The next element holds the materials at the midpoints of the edges of this tile and 
-     * the last one holds the materials for the middle_mask of the tile.
-     */
-    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    struct vertex *tile_verts_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
-    GL_ASSERT_OK();
-    assert(tile_verts_base);
-
-    struct vertex *south_provoking[2] = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 0*3,
-                                         tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 1*3};
-    struct vertex *west_provoking[2]  = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 2*3,
-                                         tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 3*3};
-    struct vertex *north_provoking[2] = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 4*3,
-                                         tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 5*3};
-    struct vertex *east_provoking[2]  = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 6*3,
-                                         tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 7*3};
-
-    for(int i = 0; i < 2; i++) {
-        south_provoking[i]->adjacent_mat_indices[0] = 
-            INDICES_MASK_32(bot.top_left_mask, bot_left.top_right_mask, left.bot_right_mask, curr.bot_left_mask);
-        south_provoking[i]->adjacent_mat_indices[1] = 
-            INDICES_MASK_32(bot_right.top_left_mask, bot.top_right_mask, curr.bot_right_mask, right.bot_left_mask);
-        south_provoking[i]->blend_mode = optimal_blendmode(south_provoking[i]);
-    }
-
-    for(int i = 0; i < 2; i++) {
-        north_provoking[i]->adjacent_mat_indices[0] = 
-            INDICES_MASK_32(curr.top_left_mask, left.top_right_mask, top_left.bot_right_mask, top.bot_left_mask);
-        north_provoking[i]->adjacent_mat_indices[1] = 
-            INDICES_MASK_32(right.top_left_mask, curr.top_right_mask, top.bot_right_mask, top_right.bot_left_mask);
-        north_provoking[i]->blend_mode = optimal_blendmode(north_provoking[i]);
-    }
-
-    for(int i = 0; i < 2; i++) {
-        west_provoking[i]->adjacent_mat_indices[0] = south_provoking[0]->adjacent_mat_indices[0];
-        west_provoking[i]->adjacent_mat_indices[1] = north_provoking[0]->adjacent_mat_indices[0];
-        west_provoking[i]->blend_mode = optimal_blendmode(west_provoking[i]);
-    }
-
-    for(int i = 0; i < 2; i++) {
-        east_provoking[i]->adjacent_mat_indices[0] = south_provoking[0]->adjacent_mat_indices[1];
-        east_provoking[i]->adjacent_mat_indices[1] = north_provoking[0]->adjacent_mat_indices[1];
-        east_provoking[i]->blend_mode = optimal_blendmode(east_provoking[i]);
-    }
-
-    GLuint adj_center_mask = INDICES_MASK_32(
-        INDICES_MASK_8(curr.top_center_idx,     top.bot_center_idx),
-        INDICES_MASK_8(curr.right_center_idx,   right.left_center_idx),
-        INDICES_MASK_8(curr.bot_center_idx,     bot.top_center_idx),
-        INDICES_MASK_8(curr.left_center_idx,    left.right_center_idx)
-    );
-
-    struct vertex *provoking[] = {south_provoking[0], south_provoking[1], north_provoking[0], north_provoking[1], 
-                                  west_provoking[0], west_provoking[1], east_provoking[0], east_provoking[1]};
-    for(int i = 0; i < ARR_SIZE(provoking); i++) {
-
-        provoking[i]->adjacent_mat_indices[2] = adj_center_mask;
-        provoking[i]->adjacent_mat_indices[3] = curr.middle_mask;
-    }
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    GL_ASSERT_OK();
+    /* The reference points of the top face, in row-major order from the 
+     * north-west corner. The corners are surrounded by the 8 triangles of the
+     * 4 tiles touching them, the edge midpoints and the center by 2, which 
+     * are repeated to fill all 8 indices. */
+    out[0] = INDICES_MASK_32(curr.top_left_mask, left.top_right_mask, top_left.bot_right_mask, top.bot_left_mask);
+    out[1] = SPLAT_PAIR(curr.top_center_idx, top.bot_center_idx);
+    out[2] = INDICES_MASK_32(right.top_left_mask, curr.top_right_mask, top.bot_right_mask, top_right.bot_left_mask);
+    out[3] = SPLAT_PAIR(curr.left_center_idx, left.right_center_idx);
+    out[4] = INDICES_MASK_32(curr.middle_mask, curr.middle_mask, curr.middle_mask, curr.middle_mask);
+    out[5] = SPLAT_PAIR(curr.right_center_idx, right.left_center_idx);
+    out[6] = INDICES_MASK_32(bot.top_left_mask, bot_left.top_right_mask, left.bot_right_mask, curr.bot_left_mask);
+    out[7] = SPLAT_PAIR(curr.bot_center_idx, bot.top_center_idx);
+    out[8] = INDICES_MASK_32(bot_right.top_left_mask, bot.top_right_mask, curr.bot_right_mask, right.bot_left_mask);
 }
 
-void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+void R_TilePatchVertsSmooth(const struct map *map, const struct tile_desc *tile, 
+                            struct terrain_vert *tile_verts_base)
 {
-    ASSERT_IN_RENDER_THREAD();
-
-    const struct render_private *priv = chunk_rprivate;
-    GLuint VBO = priv->mesh.VBO;
-
-    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    union top_face_vbuff *tfvb = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
-    GL_ASSERT_OK();
-    assert(tfvb);
-    tfvb = (union top_face_vbuff*)(((struct vertex*)tfvb) + (4 * VERTS_PER_SIDE_FACE));
+    union top_face_tvbuff *tfvb = (union top_face_tvbuff*)(tile_verts_base + (4 * UNIQUE_VERTS_PER_SIDE_FACE));
 
     struct map_resolution res;
     M_GetResolution(map, &res);
@@ -915,29 +864,25 @@ void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, cons
     memset(tiles, 0, sizeof(tiles));
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0, -1)) M_TileForDesc(map, td, &tiles[2]);
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0,  0)) M_TileForDesc(map, td, &tiles[3]);
-    tile_smooth_normals_edge(tiles, &tfvb->n0);
-    tile_smooth_normals_edge(tiles, &tfvb->n1);
+    tile_smooth_normals_edge(tiles, &tfvb->n);
 
     /* Bot edge */
     memset(tiles, 0, sizeof(tiles));
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0,  0)) M_TileForDesc(map, td, &tiles[2]);
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0,  1)) M_TileForDesc(map, td, &tiles[3]);
-    tile_smooth_normals_edge(tiles, &tfvb->s0);
-    tile_smooth_normals_edge(tiles, &tfvb->s1);
+    tile_smooth_normals_edge(tiles, &tfvb->s);
 
     /* Left edge */
     memset(tiles, 0, sizeof(tiles));
     td = *tile; if(M_Tile_RelativeDesc(res, &td, -1,  0)) M_TileForDesc(map, td, &tiles[0]);
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0,  0)) M_TileForDesc(map, td, &tiles[1]);
-    tile_smooth_normals_edge(tiles, &tfvb->w0);
-    tile_smooth_normals_edge(tiles, &tfvb->w1);
+    tile_smooth_normals_edge(tiles, &tfvb->w);
 
     /* Right edge */
     memset(tiles, 0, sizeof(tiles));
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  0,  0)) M_TileForDesc(map, td, &tiles[0]);
     td = *tile; if(M_Tile_RelativeDesc(res, &td,  1,  0)) M_TileForDesc(map, td, &tiles[1]);
-    tile_smooth_normals_edge(tiles, &tfvb->e0);
-    tile_smooth_normals_edge(tiles, &tfvb->e1);
+    tile_smooth_normals_edge(tiles, &tfvb->e);
 
     /* Center */
     vec3_t center_norm = {0};
@@ -945,14 +890,29 @@ void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, cons
     PFM_Vec3_Add(&center_norm, normals + 1, &center_norm);
     PFM_Vec3_Normal(&center_norm, &center_norm);
 
-    tfvb->center0.normal = center_norm;
-    tfvb->center1.normal = center_norm;
-    tfvb->center2.normal = center_norm;
-    tfvb->center3.normal = center_norm;
-    tfvb->center4.normal = center_norm;
-    tfvb->center5.normal = center_norm;
-    tfvb->center6.normal = center_norm;
-    tfvb->center7.normal = center_norm;
+    tfvb->center0.normal = R_VertPackNormal(center_norm);
+    tfvb->center1.normal = R_VertPackNormal(center_norm);
+    tfvb->center2.normal = R_VertPackNormal(center_norm);
+    tfvb->center3.normal = R_VertPackNormal(center_norm);
+}
+
+void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    struct render_private *priv = chunk_rprivate;
+    R_GL_MakeResident(priv, true);
+
+    size_t offset = UNIQUE_VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct terrain_vert);
+    size_t length = UNIQUE_VERTS_PER_TILE * sizeof(struct terrain_vert);
+
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+    struct terrain_vert *tile_verts_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, 
+        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+    GL_ASSERT_OK();
+    assert(tile_verts_base);
+
+    R_TilePatchVertsSmooth(map, tile, tile_verts_base);
 
     glUnmapBuffer(GL_ARRAY_BUFFER);
     GL_ASSERT_OK();
@@ -963,21 +923,24 @@ void R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct t
     ASSERT_IN_RENDER_THREAD();
 
     struct render_private *priv = chunk_rprivate;
+    R_GL_MakeResident(priv, true);
 
     struct tile *tile;
     int ret = M_TileForDesc(map, *desc, &tile);
     assert(ret);
 
-    size_t offset = (desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c) * VERTS_PER_TILE * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
+    struct vertex verts[UNIQUE_VERTS_PER_TILE];
+    R_TileGetVertices(map, *desc, verts);
+
+    size_t offset = (desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c) * UNIQUE_VERTS_PER_TILE * sizeof(struct terrain_vert);
+    size_t length = UNIQUE_VERTS_PER_TILE * sizeof(struct terrain_vert);
     glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
-    struct vertex *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
+    struct terrain_vert *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
     assert(vert_base);
     
-    R_TileGetVertices(map, *desc, vert_base);
+    R_VertPack(VERT_FORMAT_TERRAIN, verts, UNIQUE_VERTS_PER_TILE, vert_base);
     glUnmapBuffer(GL_ARRAY_BUFFER);
 
-    R_GL_TilePatchVertsBlend(chunk_rprivate, map, desc);
     if(tile->blend_normals) {
         R_GL_TilePatchVertsSmooth(chunk_rprivate, map, desc);
     }
@@ -985,6 +948,16 @@ void R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct t
     GL_ASSERT_OK();
 }
 
+void R_GL_TileUpdateBatch(void *chunk_rprivate, const struct map *map, 
+                          const struct tile_desc *descs, const size_t *ndescs)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    for(int i = 0; i < *ndescs; i++) {
+        R_GL_TileUpdate(chunk_rprivate, map, &descs[i]);
+    }
+}
+
 void R_TileGetVertices(const struct map *map, struct tile_desc td, struct vertex *out)
 {
     struct tile *tile;
@@ -1183,19 +1156,11 @@ void R_TileGetVertices(const struct map *map, struct tile_desc td, struct vertex
         &front, &back, &left, &right 
     };
 
+    /* The two triangles of each face are (nw, ne, sw) and (se, sw, ne) */
+    assert(sizeof(struct face) == UNIQUE_VERTS_PER_SIDE_FACE * sizeof(struct vertex));
     for(int i = 0; i < ARR_SIZE(faces); i++) {
 
-        struct face *curr = faces[i];
-
-        /* First triangle */
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 0, &curr->nw, sizeof(struct vertex));
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 1, &curr->ne, sizeof(struct vertex));
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 2, &curr->sw, sizeof(struct vertex));
-
-        /* Second triangle */
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 3, &curr->se, sizeof(struct vertex));
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 4, &curr->sw, sizeof(struct vertex));
-        memcpy(out + (i * VERTS_PER_SIDE_FACE) + 5, &curr->ne, sizeof(struct vertex));
+        memcpy(out + (i * UNIQUE_VERTS_PER_SIDE_FACE), faces[i], sizeof(struct face));
     }
 
     /* Lastly, the top face. Unlike the other five faces, it can have different 
@@ -1285,43 +1250,31 @@ void R_TileGetVertices(const struct map *map, struct tile_desc td, struct vertex
         .material_idx = (top_tri_left_aligned ? tri0_idx : tri1_idx),
     };
 
-    assert(sizeof(union top_face_vbuff) == VERTS_PER_TOP_FACE * sizeof(struct vertex));
-    union top_face_vbuff *tfvb = (union top_face_vbuff*)(out + 4 * VERTS_PER_SIDE_FACE);
+    assert(sizeof(union top_face_vbuff) == UNIQUE_VERTS_PER_TOP_FACE * sizeof(struct vertex));
+    union top_face_vbuff *tfvb = (union top_face_vbuff*)(out + 4 * UNIQUE_VERTS_PER_SIDE_FACE);
     tfvb->se0 = top.se;
-    tfvb->s0 = south_vert;
-    tfvb->center0 = center_vert_tri0;
-    tfvb->center1 = center_vert_tri0;
-    tfvb->s1 = south_vert;
+    tfvb->se1 = top.se;
     tfvb->sw0 = top.sw;
     tfvb->sw1 = top.sw;
-    tfvb->w0 = west_vert;
-    tfvb->center2 = top_tri_left_aligned ? center_vert_tri1 : center_vert_tri0;
-    tfvb->center3 = top_tri_left_aligned ? center_vert_tri1 : center_vert_tri0;
-    tfvb->w1 = west_vert;
     tfvb->nw0 = top.nw;
     tfvb->nw1 = top.nw;
-    tfvb->n0 = north_vert;
-    tfvb->center4 = center_vert_tri1;
-    tfvb->center5 = center_vert_tri1;
-    tfvb->n1 = north_vert;
     tfvb->ne0 = top.ne;
     tfvb->ne1 = top.ne;
-    tfvb->e0 = east_vert;
-    tfvb->center6 = top_tri_left_aligned ? center_vert_tri0 : center_vert_tri1;
-    tfvb->center7 = top_tri_left_aligned ? center_vert_tri0 : center_vert_tri1;
-    tfvb->e1 = east_vert;
-    tfvb->se1 = top.se;
+    tfvb->s = south_vert;
+    tfvb->w = west_vert;
+    tfvb->n = north_vert;
+    tfvb->e = east_vert;
+    tfvb->center0 = center_vert_tri0;
+    tfvb->center1 = top_tri_left_aligned ? center_vert_tri1 : center_vert_tri0;
+    tfvb->center2 = center_vert_tri1;
+    tfvb->center3 = top_tri_left_aligned ? center_vert_tri0 : center_vert_tri1;
 
     /* Give a slight overlap to the triangles of the top face to make sure there 
      * no gap can appear between adjacent triangles due to interpolation errors */
     tfvb->center0.pos.z -= 0.005;
-    tfvb->center1.pos.z -= 0.005;
-    tfvb->center2.pos.x -= 0.005;
-    tfvb->center3.pos.x -= 0.005;
-    tfvb->center4.pos.z += 0.005;
-    tfvb->center5.pos.z += 0.005;
-    tfvb->center6.pos.x += 0.005;
-    tfvb->center7.pos.x += 0.005;
+    tfvb->center1.pos.x -= 0.005;
+    tfvb->center2.pos.z += 0.005;
+    tfvb->center3.pos.x += 0.005;
 
     if(top_tri_left_aligned) {
         tfvb->se0.material_idx = tri0_idx;
@@ -1361,29 +1314,33 @@ void R_TileGetVertices(const struct map *map, struct tile_desc td, struct vertex
         tfvb->se1.normal = top_tri_normals[1];
     }
 
-    for(struct vertex *curr_provoking = out; 
-        curr_provoking < out + (4 * VERTS_PER_SIDE_FACE); 
-        curr_provoking += 3) {
-
-        curr_provoking->blend_mode = BLEND_MODE_NOBLEND;
+    /* The blend mode is a flat attribute. As vertices are shared between 
+     * triangles, it is simply set on all of them. */
+    for(struct vertex *curr = out; curr < out + (4 * UNIQUE_VERTS_PER_SIDE_FACE); curr++) {
+        curr->blend_mode = BLEND_MODE_NOBLEND;
     }
-    for(struct vertex *curr_provoking = out + (4 * VERTS_PER_SIDE_FACE); 
-        curr_provoking < out + VERTS_PER_TILE; 
-        curr_provoking += 3) {
+    for(struct vertex *curr = out + (4 * UNIQUE_VERTS_PER_SIDE_FACE); curr < out + UNIQUE_VERTS_PER_TILE; curr++) {
+        curr->blend_mode = tile->blend_mode;
+    }
+}
 
-        curr_provoking->blend_mode = tile->blend_mode;
+void R_TileGetIndices(int tile_idx, GLushort *out)
+{
+    for(int i = 0; i < VERTS_PER_TILE; i++) {
+        out[i] = tile_idx * UNIQUE_VERTS_PER_TILE + s_tile_indices[i];
     }
 }
 
 int R_TileGetTriMesh(const struct map *map, struct tile_desc *td, mat4x4_t *model, vec3_t out[])
 {
-    struct vertex verts[VERTS_PER_TILE];
+    struct vertex verts[UNIQUE_VERTS_PER_TILE];
     R_TileGetVertices(map, *td, verts);
     int i = 0;
 
-    for(; i < ARR_SIZE(verts); i++) {
+    for(; i < ARR_SIZE(s_tile_indices); i++) {
 
-        vec4_t pos_homo = (vec4_t){verts[i].pos.x, verts[i].pos.y, verts[i].pos.z, 1.0f};
+        const struct vertex *vert = &verts[s_tile_indices[i]];
+        vec4_t pos_homo = (vec4_t){vert->pos.x, vert->pos.y, vert->pos.z, 1.0f};
         vec4_t ws_pos_homo;
         PFM_Mat4x4_Mult4x1(model, &pos_homo, &ws_pos_homo);
 
@@ -1398,3 +1355,133 @@ int R_TileGetTriMesh(const struct map *map, struct tile_desc *td, mat4x4_t *mode
     return i;
 }
 
+void R_TileGetLODVertices(const struct tile *chunk_tiles, int lod, struct vertex *out)
+{
+    assert(lod > 0 && lod <= CHUNK_LODS);
+
+    const int step = LOD_STEP(lod);
+    const int nrows = LOD_ROWS(lod) + 1, ncols = LOD_COLS(lod) + 1;
+    const vec3_t up = (vec3_t){0.0f, 1.0f, 0.0f};
+    struct vertex *base = out;
+
+    struct vertex grid[nrows][ncols];
+    int min_height = INT_MAX;
+
+    for(int r = 0; r < nrows; r++) {
+    for(int c = 0; c < ncols; c++) {
+
+        int height = lod_corner_height(chunk_tiles, r * step, c * step);
+        min_height = MIN(min_height, height);
+
+        grid[r][c] = (struct vertex){
+            .pos    = (vec3_t){
+                0.0f - (c * step * X_COORDS_PER_TILE), 
+                height * Y_COORDS_PER_TILE,
+                0.0f + (r * step * Z_COORDS_PER_TILE)
+            },
+            .uv     = (vec2_t){ c * step, -r * step },
+        };
+    }}
+
+    for(int r = 0; r < nrows; r++) {
+    for(int c = 0; c < ncols; c++) {
+
+        vec3_t across, down, normal;
+        vec3_t west = grid[r][MAX(c - 1, 0)].pos, east = grid[r][MIN(c + 1, ncols - 1)].pos;
+        vec3_t north = grid[MAX(r - 1, 0)][c].pos, south = grid[MIN(r + 1, nrows - 1)][c].pos;
+
+        PFM_Vec3_Sub(&east, &west, &across);
+        PFM_Vec3_Sub(&south, &north, &down);
+        PFM_Vec3_Cross(&across, &down, &normal);
+        if(normal.y < 0.0f) {
+            PFM_Vec3_Scale(&normal, -1.0f, &normal);
+        }
+        PFM_Vec3_Normal(&normal, &normal);
+        grid[r][c].normal = normal;
+    }}
+
+    /* Top faces, two triangles per block of tiles. The block takes the top 
+     * material of its' north-west tile. */
+    for(int r = 0; r < nrows - 1; r++) {
+    for(int c = 0; c < ncols - 1; c++) {
+
+        const struct tile *tile = &chunk_tiles[(r * step) * TILES_PER_CHUNK_WIDTH + (c * step)];
+        struct vertex nw = grid[r][c],     ne = grid[r][c + 1];
+        struct vertex sw = grid[r + 1][c], se = grid[r + 1][c + 1];
+
+        out = lod_emit_tri(out, nw, ne, sw, tile->top_mat_idx, up);
+        out = lod_emit_tri(out, ne, se, sw, tile->top_mat_idx, up);
+    }}
+
+    /* Skirts, each facing out of the chunk across one of its' edges. They go 
+     * down to below the lowest point of the chunk. */
+    const float skirt_bottom = (min_height - 1) * Y_COORDS_PER_TILE;
+    const struct {
+        int r0, c0, dr, dc, len;
+        vec3_t facing;
+    }edges[] = {
+        {0,         0,         0, 1, ncols - 1, (vec3_t){ 0.0f, 0.0f, -1.0f}},
+        {nrows - 1, 0,         0, 1, ncols - 1, (vec3_t){ 0.0f, 0.0f,  1.0f}},
+        {0,         0,         1, 0, nrows - 1, (vec3_t){ 1.0f, 0.0f,  0.0f}},
+        {0,         ncols - 1, 1, 0, nrows - 1, (vec3_t){-1.0f, 0.0f,  0.0f}},
+    };
+
+    for(int i = 0; i < ARR_SIZE(edges); i++) {
+    for(int j = 0; j < edges[i].len; j++) {
+
+        int r = edges[i].r0 + j * edges[i].dr, c = edges[i].c0 + j * edges[i].dc;
+        int tile_r = MIN(r * step, TILES_PER_CHUNK_HEIGHT - 1);
+        int tile_c = MIN(c * step, TILES_PER_CHUNK_WIDTH - 1);
+        const struct tile *tile = &chunk_tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
+
+        struct vertex top0 = grid[r][c];
+        struct vertex top1 = grid[r + edges[i].dr][c + edges[i].dc];
+        struct vertex bot0 = top0, bot1 = top1;
+
+        bot0.pos.y = bot1.pos.y = skirt_bottom;
+        top0.uv = (vec2_t){ j,     top0.pos.y / X_COORDS_PER_TILE };
+        top1.uv = (vec2_t){ j + 1, top1.pos.y / X_COORDS_PER_TILE };
+        bot0.uv = (vec2_t){ j,     skirt_bottom / X_COORDS_PER_TILE };
+        bot1.uv = (vec2_t){ j + 1, skirt_bottom / X_COORDS_PER_TILE };
+
+        out = lod_emit_tri(out, top0, top1, bot0, tile->sides_mat_idx, edges[i].facing);
+        out = lod_emit_tri(out, top1, bot1, bot0, tile->sides_mat_idx, edges[i].facing);
+    }}
+
+    assert(out - base == VERTS_PER_LOD(lod));
+    (void)base;
+}
+
+void R_GL_TileUpdateLODs(void *chunk_rprivate, const struct map *map, const struct tile_desc *desc)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    struct tile *chunk_tiles;
+    int ret = M_TileForDesc(map, (struct tile_desc){desc->chunk_r, desc->chunk_c, 0, 0}, &chunk_tiles);
+    assert(ret);
+
+    /* The first level has the most vertices */
+    struct vertex *verts = malloc(VERTS_PER_LOD(1) * sizeof(struct vertex));
+    if(!verts)
+        return;
+
+    for(int lod = 1; lod <= CHUNK_LODS; lod++) {
+
+        struct render_private *priv = R_ChunkLODPriv(chunk_rprivate, lod);
+        size_t length = VERTS_PER_LOD(lod) * sizeof(struct terrain_vert);
+        R_GL_MakeResident(priv, true);
+        R_TileGetLODVertices(chunk_tiles, lod, verts);
+
+        glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+        struct terrain_vert *vbuff = glMapBufferRange(GL_ARRAY_BUFFER, 0, length, 
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        assert(vbuff);
+
+        R_VertPack(VERT_FORMAT_TERRAIN, verts, VERTS_PER_LOD(lod), vbuff);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    free(verts);
+    GL_ASSERT_OK();
+}
+
@@ -39,11 +39,13 @@
 #include "gl_uniforms.h"
 #include "gl_shader.h"
 #include "gl_render.h"
+#include "gl_perf.h"
 #include "../main.h"
 #include "../lib/public/pf_nuklear.h"
-#include "../lib/public/stb_image.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <GL/glew.h>
 
@@ -52,29 +54,37 @@
 /*****************************************************************************/
 
 static struct render_ui_ctx{
-    GLuint font_tex;
-    GLuint VBO;
-    GLuint EBO;
-    GLuint VAO;
+    GLuint              font_tex;
+    GLuint              VAO;
+    GLuint              VBO;
+    GLuint              IBO;
+    /* The last draw list received. Its' commands are kept in 'cmd_mem' and 
+     * its' vertices and elements in the buffers above, so that it can be 
+     * drawn again for as long as the UI does not change. */
+    bool                cached;
+    struct nk_draw_list cached_dl;
+    struct nk_buffer    cached_cmds;
+    void               *cmd_mem;
+    size_t              cmd_mem_cap;
 }s_ctx;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog)
+static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog, GLintptr ibuff_offset)
 {
     int w, h;
     Engine_WinDrawableSize(&w, &h);
 
     struct nk_vec2i curr_vres = (struct nk_vec2i){w, h};
     const struct nk_draw_command *cmd;
-    const nk_draw_index *offset = NULL;
+    const nk_draw_index *offset = (const nk_draw_index*)ibuff_offset;
 
     mat4x4_t ortho;
     PFM_Mat4x4_MakeOrthographic(0.0f, curr_vres.x, curr_vres.y, 0.0f, -1.0f, 1.0f, &ortho);
 
-    GLuint proj_loc = glGetUniformLocation(shader_prog, GL_U_PROJECTION);
+    GLuint proj_loc = R_GL_Shader_GetUniformLoc(shader_prog, UNIFORM_PROJECTION);
     glUniformMatrix4fv(proj_loc, 1, GL_FALSE, ortho.raw);
 
     for(cmd = nk__draw_list_begin(dl, dl->buffer); cmd; 
@@ -91,21 +101,15 @@ static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog
 
                 PFM_Mat4x4_MakeOrthographic(0.0f, ud->vec2i.x, ud->vec2i.y, 0.0f, -1.0f, 1.0f, &ortho);
                 glUniformMatrix4fv(proj_loc, 1, GL_FALSE, ortho.raw);
-
-                free(ud);
                 continue;
             }
             case NK_COMMAND_IMAGE_TEXPATH: {
 
-                stbi_set_flip_vertically_on_load(false);
-                R_GL_Texture_GetOrLoad(g_basepath, ud->texpath, (GLuint*)&cmd->texture.id);
-                stbi_set_flip_vertically_on_load(true);
+                R_GL_Texture_GetOrLoadUnflipped(g_basepath, ud->texpath, (GLuint*)&cmd->texture.id);
                 break;
             }
             default: assert(0);
             }
-
-            free(ud);
         }
 
         if(!cmd->elem_count) 
@@ -124,6 +128,56 @@ static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog
     }
 }
 
+static void free_cached_userdata(void)
+{
+    if(!s_ctx.cached)
+        return;
+
+    const struct nk_draw_list *dl = &s_ctx.cached_dl;
+    const struct nk_draw_command *cmd;
+
+    for(cmd = nk__draw_list_begin(dl, dl->buffer); cmd; 
+        cmd = nk__draw_list_next(cmd, dl->buffer, dl)) {
+        free(cmd->userdata.ptr);
+    }
+    s_ctx.cached = false;
+}
+
+static bool cache_draw_list(const struct nk_draw_list *dl)
+{
+    /* The userdata of the previous list is owned by the render thread */
+    free_cached_userdata();
+
+    size_t size = dl->buffer->memory.size;
+    if(size > s_ctx.cmd_mem_cap) {
+        void *mem = realloc(s_ctx.cmd_mem, size);
+        if(!mem)
+            return false;
+        s_ctx.cmd_mem = mem;
+        s_ctx.cmd_mem_cap = size;
+    }
+    memcpy(s_ctx.cmd_mem, dl->buffer->memory.ptr, size);
+
+    s_ctx.cached_cmds = *dl->buffer;
+    s_ctx.cached_cmds.memory.ptr = s_ctx.cmd_mem;
+    s_ctx.cached_dl = *dl;
+    s_ctx.cached_dl.buffer = &s_ctx.cached_cmds;
+    s_ctx.cached_dl.vertices = NULL;
+    s_ctx.cached_dl.elements = NULL;
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
+    glBufferData(GL_ARRAY_BUFFER, dl->vertices->allocated, dl->vertices->memory.ptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s_ctx.IBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, dl->elements->allocated, dl->elements->memory.ptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    s_ctx.cached = true;
+    GL_ASSERT_OK();
+    return true;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -138,33 +192,32 @@ void R_GL_UI_Init(void)
 {
     ASSERT_IN_RENDER_THREAD();
 
-    /* buffer setup */
+    /* The vertex and index data stays resident, and is only replaced when 
+     * a different draw list is received. */
+    glGenVertexArrays(1, &s_ctx.VAO);
+    glGenBuffers(1, &s_ctx.VBO);
+    glGenBuffers(1, &s_ctx.IBO);
+
     GLsizei vs = sizeof(struct ui_vert);
     size_t vp = offsetof(struct ui_vert, screen_pos);
     size_t vt = offsetof(struct ui_vert, uv);
     size_t vc = offsetof(struct ui_vert, color);
 
-    glGenBuffers(1, &s_ctx.VBO);
-    glGenBuffers(1, &s_ctx.EBO);
-    glGenVertexArrays(1, &s_ctx.VAO);
-
     glBindVertexArray(s_ctx.VAO);
     glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_ctx.EBO);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_ctx.IBO);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, vs, (void*)vp);
+    glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vs, (void*)vt);
+    glEnableVertexAttribArray(1);
     glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, vs, (void*)vc);
+    glEnableVertexAttribArray(2);
 
     /* unbind context */
     glBindTexture(GL_TEXTURE_2D, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     GL_ASSERT_OK();
 }
@@ -176,9 +229,13 @@ void R_GL_UI_Shutdown(void)
     if(s_ctx.font_tex) {
         glDeleteTextures(1, &s_ctx.font_tex);
     }
-    glDeleteBuffers(1, &s_ctx.VBO);
-    glDeleteBuffers(1, &s_ctx.EBO);
     glDeleteVertexArrays(1, &s_ctx.VAO);
+    glDeleteBuffers(1, &s_ctx.VBO);
+    glDeleteBuffers(1, &s_ctx.IBO);
+
+    free_cached_userdata();
+    free(s_ctx.cmd_mem);
+    memset(&s_ctx, 0, sizeof(s_ctx));
 
     GL_ASSERT_OK();
 }
@@ -186,6 +243,16 @@ void R_GL_UI_Shutdown(void)
 void R_GL_UI_Render(const struct nk_draw_list *dl)
 {
     ASSERT_IN_RENDER_THREAD();
+    R_GL_PerfBegin(GPU_PASS_UI);
+
+    if(dl && !cache_draw_list(dl)) {
+        free_cached_userdata();
+    }
+
+    if(!s_ctx.cached) {
+        R_GL_PerfEnd(GPU_PASS_UI);
+        return;
+    }
 
     /* setup global state */
     glEnable(GL_BLEND);
@@ -204,25 +271,17 @@ void R_GL_UI_Render(const struct nk_draw_list *dl)
     assert(shader_prog);
     glUseProgram(shader_prog);
 
-    /* setup buffers */
-    glBindVertexArray(s_ctx.VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_ctx.EBO);
-
-    glBufferData(GL_ARRAY_BUFFER, dl->vertices->memory.size, dl->vertices->memory.ptr, GL_STREAM_DRAW);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, dl->elements->memory.size, dl->elements->memory.ptr, GL_STREAM_DRAW);
-
     /* iterate over and execute each draw command */
-    exec_draw_commands(dl, shader_prog);
+    glBindVertexArray(s_ctx.VAO);
+    exec_draw_commands(&s_ctx.cached_dl, shader_prog, 0);
 
     /* cleanup state */
     glUseProgram(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glDisable(GL_BLEND);
     glDisable(GL_SCISSOR_TEST);
 
+    R_GL_PerfEnd(GPU_PASS_UI);
     GL_ASSERT_OK();
 }
 
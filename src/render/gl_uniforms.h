@@ -36,6 +36,10 @@
 #ifndef GL_UNIFORMS_H
 #define GL_UNIFORMS_H
 
+/* Uniform blocks */
+#define GL_U_GLOBALS_BLOCK  "globals"
+#define GL_U_MAT_BLOCK      "materials_block"
+
 /* Written by camera once per frame */
 #define GL_U_PROJECTION     "projection"
 #define GL_U_VIEW           "view"
@@ -50,6 +54,12 @@
 #define GL_U_CURR_POSE_MATS "anim_curr_pose_mats"
 #define GL_U_NORMAL_MAT     "anim_normal_mat"
 
+/* Written by render subsystem for every batch of animated instances */
+#define GL_U_ANIM_PALETTE   "anim_palette"
+#define GL_U_ANIM_NJOINTS   "anim_njoints"
+#define GL_U_ANIM_OFFSETS   "anim_offsets"
+#define GL_U_ANIM_BAKED     "anim_baked"
+
 /* 8 texture slots that get set by render subsystem for each entity */
 #define GL_U_TEXTURE0       "texture0"
 #define GL_U_TEXTURE1       "texture1"
@@ -71,6 +81,9 @@
 /* 1 array texture slot */
 #define GL_U_TEX_ARRAY0     "tex_array0"
 
+/* The shared texture array holding the entity's material textures */
+#define GL_U_MAT_ATLAS      "material_atlas"
+
 /* Global light parameters - affect all models */
 #define GL_U_AMBIENT_COLOR  "ambient_color"
 #define GL_U_LIGHT_POS      "light_pos"
@@ -104,4 +117,21 @@
 #define GL_U_CAM_FAR        "cam_far"
 #define GL_U_WATER_TILING   "water_tiling"
 
+/* Used by terrain shaders for the fog of war */
+#define GL_U_FOG_TEX        "fog_tex"
+#define GL_U_FOG_ENABLED    "fog_enabled"
+#define GL_U_FOG_BOUNDS     "fog_bounds"
+
+/* Used by terrain shaders for blending the materials of adjacent tiles */
+#define GL_U_SPLAT_TEX      "splat_tex"
+#define GL_U_SPLAT_ENABLED  "splat_enabled"
+#define GL_U_SPLAT_BOUNDS   "splat_bounds"
+
+/* Used by the lit shaders for the clustered point lights */
+#define GL_U_LIGHTS         "lights"
+#define GL_U_LIGHT_GRID     "light_grid"
+#define GL_U_LIGHT_INDICES  "light_indices"
+#define GL_U_LIGHT_GRID_VP  "light_grid_vp"
+#define GL_U_LIGHT_PARAMS   "light_grid_params"
+
 #endif
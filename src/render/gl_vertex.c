@@ -0,0 +1,320 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gl_vertex.h"
+#include "gl_assert.h"
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define CLAMP(a, min, max)  ((a) < (min) ? (min) : ((a) > (max) ? (max) : (a)))
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static GLubyte pack_unorm8(float f)
+{
+    return (GLubyte)lroundf(CLAMP(f, 0.0f, 1.0f) * 255.0f);
+}
+
+static GLubyte pack_index8(GLint idx)
+{
+    assert(idx >= 0 && idx <= UINT8_MAX);
+    return (GLubyte)idx;
+}
+
+static void set_common_attribs(GLsizei stride, size_t uv_off, size_t normal_off, size_t mat_off)
+{
+    /* Attribute 0 - position */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+
+    /* Attribute 1 - texture coordinates */
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)uv_off);
+    glEnableVertexAttribArray(1);
+
+    /* Attribute 2 - normal. The packed types must be given 4 components, 
+     * the shaders just ignore the last one. */
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)normal_off);
+    glEnableVertexAttribArray(2);
+
+    /* Attribute 3 - material index */
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, stride, (void*)mat_off);
+    glEnableVertexAttribArray(3);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+enum vert_format R_VertFormatForShader(const char *shader)
+{
+    if(strstr(shader, "animated"))
+        return VERT_FORMAT_ANIM;
+    if(strstr(shader, "terrain"))
+        return VERT_FORMAT_TERRAIN;
+    return VERT_FORMAT_STATIC;
+}
+
+size_t R_VertSize(enum vert_format format)
+{
+    switch(format) {
+    case VERT_FORMAT_STATIC:    return sizeof(struct static_vert);
+    case VERT_FORMAT_ANIM:      return sizeof(struct anim_vert);
+    case VERT_FORMAT_TERRAIN:   return sizeof(struct terrain_vert);
+    default: assert(0); return 0;
+    }
+}
+
+GLuint R_VertPackNormal(vec3_t normal)
+{
+    GLuint ret = 0;
+    for(int i = 0; i < 3; i++) {
+        GLint c = lroundf(CLAMP(normal.raw[i], -1.0f, 1.0f) * 511.0f);
+        ret |= ((GLuint)c & 0x3ff) << (i * 10);
+    }
+    return ret;
+}
+
+vec3_t R_VertUnpackNormal(GLuint packed)
+{
+    vec3_t ret;
+    for(int i = 0; i < 3; i++) {
+        GLint c = (packed >> (i * 10)) & 0x3ff;
+        if(c & 0x200)
+            c -= 0x400;
+        ret.raw[i] = fmaxf(c / 511.0f, -1.0f);
+    }
+    return ret;
+}
+
+GLhalf R_VertPackHalf(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    GLhalf sign = (bits >> 16) & 0x8000;
+    int exp = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = bits & 0x7fffff;
+
+    /* Infinity and NaN */
+    if(((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    /* Too large, clamp to infinity */
+    if(exp >= 31)
+        return sign | 0x7c00;
+    /* Too small even for a denormal */
+    if(exp < -10)
+        return sign;
+
+    if(exp <= 0) {
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        GLhalf ret = sign | (mant >> shift);
+        /* Round to nearest. Overflowing into the exponent is correct. */
+        if(mant & (1u << (shift - 1)))
+            ret++;
+        return ret;
+    }
+
+    GLhalf ret = sign | (exp << 10) | (mant >> 13);
+    if(mant & 0x1000)
+        ret++;
+    return ret;
+}
+
+float R_VertUnpackHalf(GLhalf h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+
+    if(exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    }else if(exp == 0) {
+        float ret = ldexpf((float)mant, -24);
+        return sign ? -ret : ret;
+    }else{
+        bits = sign | ((uint32_t)(exp - 15 + 127) << 23) | (mant << 13);
+    }
+
+    float ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+void R_VertPackTerrain(const struct vertex *in, struct terrain_vert *out)
+{
+    *out = (struct terrain_vert){
+        .pos            = in->pos,
+        .uv             = {R_VertPackHalf(in->uv.x), R_VertPackHalf(in->uv.y)},
+        .normal         = R_VertPackNormal(in->normal),
+        .material_idx   = pack_index8(in->material_idx),
+        .blend_mode     = pack_index8(in->blend_mode),
+    };
+}
+
+void R_VertPack(enum vert_format format, const struct vertex *in, size_t count, void *out)
+{
+    for(size_t i = 0; i < count; i++) {
+
+        const struct vertex *v = &in[i];
+        switch(format) {
+        case VERT_FORMAT_STATIC: {
+
+            struct static_vert *sv = (struct static_vert*)out + i;
+            *sv = (struct static_vert){
+                .pos            = v->pos,
+                .uv             = {R_VertPackHalf(v->uv.x), R_VertPackHalf(v->uv.y)},
+                .normal         = R_VertPackNormal(v->normal),
+                .material_idx   = pack_index8(v->material_idx),
+            };
+            break;
+        }
+        case VERT_FORMAT_ANIM: {
+
+            struct anim_vert *av = (struct anim_vert*)out + i;
+            *av = (struct anim_vert){
+                .pos            = v->pos,
+                .uv             = {R_VertPackHalf(v->uv.x), R_VertPackHalf(v->uv.y)},
+                .normal         = R_VertPackNormal(v->normal),
+                .material_idx   = pack_index8(v->material_idx),
+            };
+            for(int j = 0; j < 6; j++) {
+                av->joint_indices[j] = pack_index8(v->joint_indices[j]);
+                av->weights[j] = pack_unorm8(v->weights[j]);
+            }
+            break;
+        }
+        case VERT_FORMAT_TERRAIN:
+            R_VertPackTerrain(v, (struct terrain_vert*)out + i);
+            break;
+        default: assert(0);
+        }
+    }
+}
+
+void R_VertUnpack(enum vert_format format, const void *in, struct vertex *out)
+{
+    /* The leading members are laid out the same way in all formats */
+    const struct static_vert *sv = in;
+    *out = (struct vertex){
+        .pos            = sv->pos,
+        .uv             = (vec2_t){R_VertUnpackHalf(sv->uv[0]), R_VertUnpackHalf(sv->uv[1])},
+        .normal         = R_VertUnpackNormal(sv->normal),
+        .material_idx   = sv->material_idx,
+    };
+
+    switch(format) {
+    case VERT_FORMAT_STATIC:
+        break;
+    case VERT_FORMAT_ANIM: {
+        const struct anim_vert *av = in;
+        for(int j = 0; j < 6; j++) {
+            out->joint_indices[j] = av->joint_indices[j];
+            out->weights[j] = av->weights[j] / 255.0f;
+        }
+        break;
+    }
+    case VERT_FORMAT_TERRAIN: {
+        const struct terrain_vert *tv = in;
+        out->blend_mode = tv->blend_mode;
+        break;
+    }
+    default: assert(0);
+    }
+}
+
+void R_GL_VertSetAttribs(enum vert_format format)
+{
+    switch(format) {
+    case VERT_FORMAT_STATIC:
+        set_common_attribs(sizeof(struct static_vert), 
+            offsetof(struct static_vert, uv), 
+            offsetof(struct static_vert, normal), 
+            offsetof(struct static_vert, material_idx));
+        break;
+
+    case VERT_FORMAT_ANIM: {
+
+        set_common_attribs(sizeof(struct anim_vert), 
+            offsetof(struct anim_vert, uv), 
+            offsetof(struct anim_vert, normal), 
+            offsetof(struct anim_vert, material_idx));
+
+        /* Here, we use 2 attributes to pass in an array of size 6 since we are 
+         * limited to a maximum of 4 components per attribute. */
+
+        /* Attribute 4/5 - joint indices */
+        size_t joints_off = offsetof(struct anim_vert, joint_indices);
+        glVertexAttribPointer(4, 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(struct anim_vert),
+            (void*)joints_off);
+        glEnableVertexAttribArray(4);  
+        glVertexAttribPointer(5, 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(struct anim_vert),
+            (void*)(joints_off + 3));
+        glEnableVertexAttribArray(5);
+
+        /* Attribute 6/7 - joint weights */
+        size_t weights_off = offsetof(struct anim_vert, weights);
+        glVertexAttribPointer(6, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct anim_vert),
+            (void*)weights_off);
+        glEnableVertexAttribArray(6);  
+        glVertexAttribPointer(7, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct anim_vert),
+            (void*)(weights_off + 3));
+        glEnableVertexAttribArray(7);
+        break;
+    }
+    case VERT_FORMAT_TERRAIN:
+
+        set_common_attribs(sizeof(struct terrain_vert), 
+            offsetof(struct terrain_vert, uv), 
+            offsetof(struct terrain_vert, normal), 
+            offsetof(struct terrain_vert, material_idx));
+
+        /* Attribute 4 - tile texture blend mode */
+        glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, sizeof(struct terrain_vert), 
+            (void*)offsetof(struct terrain_vert, blend_mode));
+        glEnableVertexAttribArray(4);
+        break;
+
+    default: assert(0);
+    }
+    GL_ASSERT_OK();
+}
+
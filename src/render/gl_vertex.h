@@ -40,6 +40,10 @@
 #include <stdint.h>
 #include <GL/glew.h>
 
+#include <stddef.h>
+
+/* The full-precision vertex that meshes are built and loaded with. It 
+ * is packed into one of the compact formats below for the GPU. */
 struct vertex{
     vec3_t  pos;
     vec2_t  uv;
@@ -47,9 +51,42 @@ struct vertex{
     GLint   material_idx;
     GLint   joint_indices[6];
     GLfloat weights[6];
-    /* The following attributes are only used for terrain vertices. */
+    /* The following attribute is only used for terrain vertices. The 
+     * materials that are blended are looked up in the map's splat texture. */
     GLint   blend_mode;
-    GLint   adjacent_mat_indices[4];
+};
+
+enum vert_format{
+    VERT_FORMAT_STATIC,
+    VERT_FORMAT_ANIM,
+    VERT_FORMAT_TERRAIN,
+};
+
+/* The UVs are half floats and the normals are signed normalized 
+ * GL_INT_2_10_10_10_REV, leaving the 2-bit 'w' component unused. */
+
+struct static_vert{
+    vec3_t  pos;
+    GLhalf  uv[2];
+    GLuint  normal;
+    GLubyte material_idx;
+};
+
+struct anim_vert{
+    vec3_t  pos;
+    GLhalf  uv[2];
+    GLuint  normal;
+    GLubyte material_idx;
+    GLubyte joint_indices[6];
+    GLubyte weights[6];     /* unsigned normalized */
+};
+
+struct terrain_vert{
+    vec3_t  pos;
+    GLhalf  uv[2];
+    GLuint  normal;
+    GLubyte material_idx;
+    GLubyte blend_mode;
 };
 
 struct colored_vert{
@@ -62,4 +99,22 @@ struct textured_vert{
     vec2_t uv;
 };
 
+enum vert_format R_VertFormatForShader(const char *shader);
+size_t           R_VertSize(enum vert_format format);
+/* Writes 'count' vertices in the specified format to 'out', which must 
+ * have room for (count * R_VertSize(format)) bytes. */
+void             R_VertPack(enum vert_format format, const struct vertex *in, 
+                            size_t count, void *out);
+void             R_VertUnpack(enum vert_format format, const void *in, struct vertex *out);
+void             R_VertPackTerrain(const struct vertex *in, struct terrain_vert *out);
+
+GLuint           R_VertPackNormal(vec3_t normal);
+vec3_t           R_VertUnpackNormal(GLuint packed);
+GLhalf           R_VertPackHalf(float f);
+float            R_VertUnpackHalf(GLhalf h);
+
+/* Sets up the attribute pointers of the currently bound VAO for 
+ * vertices of the format in the currently bound GL_ARRAY_BUFFER */
+void             R_GL_VertSetAttribs(enum vert_format format);
+
 #endif
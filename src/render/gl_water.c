@@ -39,8 +39,10 @@
 #include "gl_vertex.h"
 #include "gl_shader.h"
 #include "gl_assert.h"
+#include "gl_perf.h"
 #include "gl_uniforms.h"
 #include "public/render.h"
+#include "public/render_ctrl.h"
 #include "../game/public/game.h"
 #include "../settings.h"
 #include "../camera.h"
@@ -61,6 +63,19 @@ struct render_water_ctx{
     struct texture normal;
     GLfloat        move_factor;
     uint32_t       prev_frame_tick;
+    /* The refraction and reflection buffers are kept across frames. While 
+     * the camera is still, they may be reused for a number of frames instead 
+     * of re-rendering the scene into them. */
+    int            buff_w, buff_h;
+    GLuint         refract_tex;
+    GLuint         refract_depth;
+    GLuint         reflect_tex;
+    GLuint         reflect_depth_rb;
+    bool           buffs_valid;
+    int            frames_reused;
+    mat4x4_t       prev_view;
+    bool           prev_refraction;
+    bool           prev_reflection;
 };
 
 struct water_gl_state{
@@ -80,6 +95,9 @@ struct water_gl_state{
 #define WAVE_SPEED      (0.015f)
 #define SKY_CLR         ((GLfloat[4]){0.2f, 0.3f, 0.3f, 1.0f})
 
+#define REFRACT_PLANE       ((vec4_t){0.0f, -1.0f, 0.0f, WATER_LVL})
+#define REFLECT_PLANE       ((vec4_t){0.0f,  1.0f, 0.0f, WATER_LVL})
+
 #define REFLECT_TUNIT       GL_TEXTURE2
 #define REFRACT_TUNIT       GL_TEXTURE3
 #define REFRACT_DEPTH_TUNIT GL_TEXTURE4
@@ -94,7 +112,7 @@ static struct render_water_ctx s_ctx;
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void save_gl_state(struct water_gl_state *out, GLuint shader_prog)
+static void save_gl_state(struct water_gl_state *out)
 {
     ASSERT_IN_RENDER_THREAD();
 
@@ -102,11 +120,7 @@ static void save_gl_state(struct water_gl_state *out, GLuint shader_prog)
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, &out->fb);
     glGetFloatv(GL_COLOR_CLEAR_VALUE, out->clear_clr);
 
-    GLuint sampler_loc = glGetUniformLocation(shader_prog, GL_U_VIEW_POS);
-    glGetUniformfv(shader_prog, sampler_loc, out->u_cam_pos.raw);
-
-    sampler_loc = glGetUniformLocation(shader_prog, GL_U_VIEW);
-    glGetUniformfv(shader_prog, sampler_loc, out->u_view.raw);
+    R_GL_GetViewMatAndPos(&out->u_view, &out->u_cam_pos);
 }
 
 static void restore_gl_state(const struct water_gl_state *in)
@@ -119,13 +133,13 @@ static void restore_gl_state(const struct water_gl_state *in)
     R_GL_SetViewMatAndPos(&in->u_view, &in->u_cam_pos);
 }
 
-static int wbuff_width(void)
+static int wbuff_width(bool low_res)
 {
     ASSERT_IN_RENDER_THREAD();
 
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    return viewport[2] / 2.5f;
+    return viewport[2] / (low_res ? 5.0f : 2.5f);
 }
 
 static int wbuff_height(int width)
@@ -171,6 +185,44 @@ static GLuint make_new_depth_tex(int width, int height)
     return ret;
 }
 
+static void free_buffers(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glDeleteTextures(1, &s_ctx.refract_tex);
+    glDeleteTextures(1, &s_ctx.refract_depth);
+    glDeleteTextures(1, &s_ctx.reflect_tex);
+    glDeleteRenderbuffers(1, &s_ctx.reflect_depth_rb);
+
+    s_ctx.refract_tex = s_ctx.refract_depth = 0;
+    s_ctx.reflect_tex = s_ctx.reflect_depth_rb = 0;
+    s_ctx.buff_w = s_ctx.buff_h = 0;
+    s_ctx.buffs_valid = false;
+}
+
+static void make_buffers(int width, int height)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    s_ctx.refract_tex = make_new_tex(width, height);
+    assert(s_ctx.refract_tex > 0);
+
+    s_ctx.refract_depth = make_new_depth_tex(width, height);
+    assert(s_ctx.refract_depth > 0);
+
+    s_ctx.reflect_tex = make_new_tex(width, height);
+    assert(s_ctx.reflect_tex > 0);
+
+    glGenRenderbuffers(1, &s_ctx.reflect_depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, s_ctx.reflect_depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+
+    s_ctx.buff_w = width;
+    s_ctx.buff_h = height;
+    s_ctx.buffs_valid = false;
+    GL_ASSERT_OK();
+}
+
 static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, struct render_input in)
 {
     ASSERT_IN_RENDER_THREAD();
@@ -194,15 +246,15 @@ static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, str
 
     /* Clip everything above the water surface */
     glEnable(GL_CLIP_DISTANCE0);
-    vec4_t plane_eq = (vec4_t){0.0f, -1.0f, 0.0f, WATER_LVL};
-    R_GL_SetClipPlane(plane_eq);
+    R_GL_SetClipPlane(REFRACT_PLANE);
 
     /* Render to the texture */
     glViewport(0, 0, texw, texh);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     if(on) {
-        G_RenderMapAndEntities(in);
+        in.cam_pass = DRAW_PASS_REFRACT;
+        G_RenderMapAndEntitiesClipped(in, REFRACT_PLANE);
     }
 
     /* Clean up framebuffer */
@@ -212,7 +264,7 @@ static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, str
     GL_ASSERT_OK();
 }
 
-static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
+static void render_reflection_tex(GLuint tex, GLuint depth_rb, bool on, struct render_input in)
 {
     ASSERT_IN_RENDER_THREAD();
 
@@ -226,10 +278,6 @@ static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
     glGenFramebuffers(1, &fb);
     glBindFramebuffer(GL_FRAMEBUFFER, fb);
 
-    GLuint depth_rb;
-    glGenRenderbuffers(1, &depth_rb);
-    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, texw, texh);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex, 0);
 
@@ -244,7 +292,6 @@ static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
 
     if(!on) {
 
-        glDeleteRenderbuffers(1, &depth_rb);
         glDeleteFramebuffers(1, &fb);
         GL_ASSERT_OK();
         return; 
@@ -252,13 +299,7 @@ static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
 
     /* Flip camera over the water's surface */
     DECL_CAMERA_STACK(cam);
-    memset(cam, 0, sizeof(cam));
-    vec3_t cam_pos = Camera_GetPos(in.cam);
-    vec3_t cam_dir = Camera_GetDir(in.cam);
-    cam_pos.y -= (cam_pos.y - WATER_LVL) * 2.0f;
-    cam_dir.y *= -1.0f;
-    Camera_SetPos((struct camera*)cam, cam_pos);
-    Camera_SetDir((struct camera*)cam, cam_dir);
+    R_WaterReflectionCam(in.cam, (struct camera*)cam);
     Camera_TickFinishPerspective((struct camera*)cam);
 
     /* Face culling is problematic when we're looking from below - changing 
@@ -267,14 +308,15 @@ static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
 
     /* Clip everything below the water surface */
     glEnable(GL_CLIP_DISTANCE0);
-    vec4_t plane_eq = (vec4_t){0.0f, 1.0f, 0.0f, WATER_LVL};
-    R_GL_SetClipPlane(plane_eq);
+    R_GL_SetClipPlane(REFLECT_PLANE);
 
-    /* Render to the texture */
-    G_RenderMapAndEntities(in);
+    /* Render to the texture. The entities were culled against the 
+     * reflected camera's frustum. */
+    in.cam = (struct camera*)cam;
+    in.cam_pass = DRAW_PASS_REFLECT;
+    G_RenderMapAndEntitiesClipped(in, REFLECT_PLANE);
 
     /* Clean up framebuffer */
-    glDeleteRenderbuffers(1, &depth_rb);
     glDeleteFramebuffers(1, &fb);
     glDisable(GL_CLIP_DISTANCE0);
     glEnable(GL_CULL_FACE);
@@ -448,42 +490,58 @@ void R_GL_WaterShutdown(void)
 
     R_GL_Texture_Free(DUDV_PATH);
     R_GL_Texture_Free(NORM_PATH);
+    free_buffers();
 
     glDeleteBuffers(1, &s_ctx.surface.VAO);
     glDeleteBuffers(1, &s_ctx.surface.VBO);
     memset(&s_ctx, 0, sizeof(s_ctx));
 }
 
-void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const bool *reflection)
+void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const bool *reflection,
+                    const bool *low_res, const int *reuse_frames)
 {
     ASSERT_IN_RENDER_THREAD();
-
-    GLuint shader_prog = R_GL_Shader_GetProgForName("water");
-    glUseProgram(shader_prog);
+    R_GL_PerfBegin(GPU_PASS_WATER);
 
     struct water_gl_state state;
-    save_gl_state(&state, shader_prog);
+    save_gl_state(&state);
 
-    int w = wbuff_width();
+    int w = wbuff_width(*low_res);
     int h = wbuff_height(w);
 
-    GLuint refract_tex = make_new_tex(w, h);
-    assert(refract_tex > 0);
-
-    GLuint refract_depth = make_new_depth_tex(w, h);
-    assert(refract_depth > 0);
-
-    render_refraction_tex(refract_tex, refract_depth, *refraction, *in);
+    if(w != s_ctx.buff_w || h != s_ctx.buff_h) {
+        free_buffers();
+        make_buffers(w, h);
+    }
 
-    GLuint reflect_tex = make_new_tex(w, h);
-    assert(reflect_tex > 0);
-    render_reflection_tex(reflect_tex, *reflection, *in);
+    bool stale = !s_ctx.buffs_valid
+              || (*refraction != s_ctx.prev_refraction)
+              || (*reflection != s_ctx.prev_reflection)
+              || (s_ctx.frames_reused >= *reuse_frames)
+              || memcmp(&state.u_view, &s_ctx.prev_view, sizeof(mat4x4_t));
+
+    if(stale) {
+
+        render_refraction_tex(s_ctx.refract_tex, s_ctx.refract_depth, *refraction, *in);
+        render_reflection_tex(s_ctx.reflect_tex, s_ctx.reflect_depth_rb, *reflection, *in);
+        restore_gl_state(&state);
+
+        s_ctx.buffs_valid = true;
+        s_ctx.frames_reused = 0;
+        s_ctx.prev_view = state.u_view;
+        s_ctx.prev_refraction = *refraction;
+        s_ctx.prev_reflection = *reflection;
+    }else{
+        s_ctx.frames_reused++;
+    }
 
-    restore_gl_state(&state);
+    /* The passes leave their own programs bound */
+    GLuint shader_prog = R_GL_Shader_GetProgForName("water");
+    glUseProgram(shader_prog);
 
     setup_map_uniforms(shader_prog);
     setup_cam_uniforms(shader_prog);
-    setup_texture_uniforms(shader_prog, refract_tex, refract_depth, reflect_tex);
+    setup_texture_uniforms(shader_prog, s_ctx.refract_tex, s_ctx.refract_depth, s_ctx.reflect_tex);
     setup_model_mat(shader_prog, in->map);
     setup_move_factor(shader_prog);
     setup_tiling_uniforms(shader_prog, in->map);
@@ -498,10 +556,25 @@ void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
 
-    glDeleteTextures(1, &refract_tex);
-    glDeleteTextures(1, &refract_depth);
-    glDeleteTextures(1, &reflect_tex);
-
+    R_GL_PerfEnd(GPU_PASS_WATER);
     GL_ASSERT_OK();
 }
 
+void R_WaterClipPlanes(vec4_t *out_refract, vec4_t *out_reflect)
+{
+    *out_refract = REFRACT_PLANE;
+    *out_reflect = REFLECT_PLANE;
+}
+
+void R_WaterReflectionCam(const struct camera *cam, struct camera *out)
+{
+    vec3_t pos = Camera_GetPos(cam);
+    vec3_t dir = Camera_GetDir(cam);
+    pos.y -= (pos.y - WATER_LVL) * 2.0f;
+    dir.y *= -1.0f;
+
+    memset(out, 0, g_sizeof_camera);
+    Camera_SetPos(out, pos);
+    Camera_SetDir(out, dir);
+}
+
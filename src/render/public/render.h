@@ -41,6 +41,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <SDL.h> /* for SDL_RWops */
 
@@ -54,6 +55,10 @@ struct camera;
 struct frustum;
 struct render_input;
 struct nk_draw_list;
+struct rcmd_draw_instanced;
+struct nav_gpu_batch;
+struct scenery_update;
+struct point_light;
 
 enum render_pass{
     RENDER_PASS_DEPTH,
@@ -66,6 +71,20 @@ struct ui_vert{
     uint8_t color[4];
 };
 
+/* A unit drawn as a dot on the minimap. The color is in the range [0, 1]. */
+struct minimap_unit{
+    vec2_t  xz;
+    vec3_t  color;
+};
+
+/* A ring drawn over the map surface, ex. around a selected entity */
+struct sel_circle{
+    vec2_t  xz;
+    float   radius;
+    float   width;
+    vec3_t  color;
+};
+
 #define VERTS_PER_SIDE_FACE (6)
 #define VERTS_PER_TOP_FACE  (24)
 #define VERTS_PER_TILE      (4 * VERTS_PER_SIDE_FACE + VERTS_PER_TOP_FACE)
@@ -111,6 +130,14 @@ void R_GL_Texture_GetSize(const GLuint *texid, int *out_w, int *out_h);
  */
 void   R_GL_Draw(const void *render_private, mat4x4_t *model);
 
+/* ---------------------------------------------------------------------------
+ * Draw all the instances of a mesh, sourcing the per-instance model matrices 
+ * (and skinning matrices, for animated meshes) from instance buffers. This 
+ * takes as few draw calls as the buffer size limits allow.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DrawInstanced(const struct rcmd_draw_instanced *inst);
+
 /* ---------------------------------------------------------------------------
  * Clear the draw buffer and set up the global OpenGL state at the beginning 
  * of the frame.
@@ -228,6 +255,13 @@ void   R_GL_DumpFBDepth_PPM(const char *filename, const int *width, const int *h
 void   R_GL_DrawSelectionCircle(const vec2_t *xz, const float *radius, const float *width, 
                                 const vec3_t *color, const struct map *map);
 
+/* ---------------------------------------------------------------------------
+ * Render 'count' selection circles over the map surface, all at once.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DrawSelectionCircles(const struct sel_circle *circles, const size_t *count, 
+                                 const struct map *map);
+
 /* ---------------------------------------------------------------------------
  * Render a line over the map surface.
  * ---------------------------------------------------------------------------
@@ -307,6 +341,21 @@ void   R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rpriv
  */
 void   R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct tile_desc *desc);
 
+/* ---------------------------------------------------------------------------
+ * Same as calling 'R_GL_TileUpdate' on each of the chunk's tiles in 'descs',
+ * in one go. The descriptors must be distinct.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TileUpdateBatch(void *chunk_rprivate, const struct map *map, 
+                            const struct tile_desc *descs, const size_t *ndescs);
+
+/* ---------------------------------------------------------------------------
+ * Rebuild the decimated meshes of the chunk containing the tile, after some
+ * of its' tiles were updated.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TileUpdateLODs(void *chunk_rprivate, const struct map *map, const struct tile_desc *desc);
+
 /*###########################################################################*/
 /* RENDER MINIMAP                                                            */
 /*###########################################################################*/
@@ -321,7 +370,8 @@ void  R_GL_MinimapBake(const struct map *map, void **chunk_rprivates,
 
 /* ---------------------------------------------------------------------------
  * Update a chunk-sized region of the minimap texture with up-to-date mesh 
- * data.
+ * data. The updates are coalesced so that this runs at most once per chunk 
+ * per frame.
  * ---------------------------------------------------------------------------
  */
 void  R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate, 
@@ -331,11 +381,13 @@ void  R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate,
  * Render the minimap centered at the specified (virtual) screenscape coordinate.
  * The map's virtual minimap resolution will be used. This function will also 
  * render a box over the minimap that indicates the region currently visible by 
- * the specified camera. If camera is NULL, no box is drawn.
+ * the specified camera. If camera is NULL, no box is drawn. The 'units' are 
+ * drawn as dots on top of the terrain, all in a single draw call.
  * ---------------------------------------------------------------------------
  */
 void  R_GL_MinimapRender(const struct map *map, const struct camera *cam, 
-                         vec2_t *center_pos, const int *side_len_px);
+                         vec2_t *center_pos, const int *side_len_px, 
+                         const size_t *nunits, const struct minimap_unit *units);
 
 /* ---------------------------------------------------------------------------
  * Free the memory allocated by 'R_GL_MinimapBake'.
@@ -344,13 +396,15 @@ void  R_GL_MinimapRender(const struct map *map, const struct camera *cam,
 void  R_GL_MinimapFree(void);
 
 /* ---------------------------------------------------------------------------
- * Patch the vertices for a particular tile to have adjacency information
- * about the neighboring tiles, to be used for smooth blending.
- * Tiles which border tiles with different materials will get blending
- * 'turned on' by setting a vertex attribute.
+ * Writes the materials blended at the 9 reference points of the tile's top 
+ * face (the corners, the edge midpoints and the center, in row-major order 
+ * from the corner at the tile's top-left neighbour) as 8 packed 4-bit 
+ * material indices, each weighing 1/8. They depend on the adjacent tiles.
+ * Neighbouring tiles share the points on their common edge. Only reads the 
+ * map, so it may be called from any thread.
  * ---------------------------------------------------------------------------
  */
-void  R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile);
+void  R_TileGetSplat(const struct map *map, const struct tile_desc *tile, uint32_t out[static 9]);
 
 /* ---------------------------------------------------------------------------
  * Updated a tile's verticies to be the average of all normals at that location,
@@ -382,17 +436,34 @@ void  R_GL_MapBegin(const bool *shadows);
  */
 void  R_GL_MapEnd(void);
 
+/* ---------------------------------------------------------------------------
+ * Makes the deferred chunk meshes resident ahead of their first draw, until 
+ * CONFIG_PREFETCH_BUDGET_US is used up. The rest are left to be created on 
+ * demand.
+ * ---------------------------------------------------------------------------
+ */
+void  R_GL_MapPrefetch(void **meshes, const size_t *count);
+
+/* ---------------------------------------------------------------------------
+ * Releases the GPU buffers of the deferred chunk meshes, which get created
+ * again from the cooked vertices if they are drawn again. Meshes which have 
+ * been modified since they were created are left alone.
+ * ---------------------------------------------------------------------------
+ */
+void  R_GL_MapEvict(void **meshes, const size_t *count);
+
 /*###########################################################################*/
 /* RENDER SHADOWS                                                            */
 /*###########################################################################*/
 
 /* ---------------------------------------------------------------------------
- * Set up the rendering context for the depth pass. This _must_ be called
- * before any calls to 'R_GL_RenderDepthMap'. Afterwards, there _must_ be 
- * a matching call to 'R_GL_DepthPassEnd'.
+ * Set up the rendering context for the depth pass into the layer of the 
+ * shadow map of the specified cascade. This _must_ be called before any 
+ * calls to 'R_GL_RenderDepthMap'. Afterwards, there _must_ be a matching 
+ * call to 'R_GL_DepthPassEnd'.
  * ---------------------------------------------------------------------------
  */
-void R_GL_DepthPassBegin(const vec3_t *light_pos, const vec3_t *cam_pos, const vec3_t *cam_dir);
+void R_GL_DepthPassBegin(const mat4x4_t *light_space_trans, const int *cascade);
 
 /* ---------------------------------------------------------------------------
  * Set up the rendering context for normal rendering. This _must_ be called
@@ -409,11 +480,18 @@ void R_GL_DepthPassEnd(void);
 void R_GL_RenderDepthMap(const void *render_private, mat4x4_t *model);
 
 /* ---------------------------------------------------------------------------
- * Return the frustum of the light source used for rendering the shadow map.
- * An up-to-date frustum is generated during 'R_GL_DepthPassBegin'
+ * Instanced version of 'R_GL_RenderDepthMap'. See 'R_GL_DrawInstanced'.
  * ---------------------------------------------------------------------------
  */
-void R_GL_GetLightFrustum(struct frustum *out);
+void R_GL_RenderDepthMapInstanced(const struct rcmd_draw_instanced *inst);
+
+/* ---------------------------------------------------------------------------
+ * Set the CONFIG_SHADOW_CASCADES light space transforms and split depths used 
+ * for sampling the shadow map on the 'regular' render pass. A cascade that 
+ * was not re-rendered this frame keeps the transform of its' last depth pass.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SetShadowCascades(const mat4x4_t *transforms, const float *splits);
 
 /* ---------------------------------------------------------------------------
  * Disable or enable shadows for a particular renderable object.
@@ -438,10 +516,223 @@ void R_GL_WaterInit(void);
 void R_GL_WaterShutdown(void);
 
 /* ---------------------------------------------------------------------------
- * Renders the water layer for the given map.
+ * Renders the water layer for the given map. The refraction and reflection 
+ * textures are rendered at a lower resolution when 'low_res' is set. While 
+ * the camera is still, they are reused for up to 'reuse_frames' frames.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const bool *reflection,
+                    const bool *low_res, const int *reuse_frames);
+
+
+/*###########################################################################*/
+/* RENDER FOG OF WAR                                                         */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Uploads the 'rect' (x, y, width, height) of the fog of war texture, which 
+ * holds one texel per map tile and is 'dims' (width, height) texels in size. 
+ * The texels are tightly packed rows of the rect, giving the brightness of 
+ * the tile from 0 to 255. 'bounds' are the X and Z of the map's corner at 
+ * tile (0, 0), then the map's extent along the negative X and positive Z 
+ * axes. The terrain and the minimap are darkened from then on.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_FogUpdate(const int *dims, const int *rect, const vec4_t *bounds, const void *texels);
+
+/* ---------------------------------------------------------------------------
+ * Frees the fog of war texture and stops darkening the terrain.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_FogDisable(void);
+
+
+/*###########################################################################*/
+/* RENDER TERRAIN SPLAT                                                      */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Uploads the 'rect' (x, y, width, height) of the map's splat texture, which 
+ * is 'dims' (width, height) texels in size. There are 2 texels per tile 
+ * along each axis, plus one, holding the output of R_TileGetSplat for the 
+ * tile at (row, col) at texels (2*col .. 2*col+2, 2*row .. 2*row+2). The 
+ * texels are tightly packed rows of the rect. 'bounds' are as for 
+ * R_GL_FogUpdate. The terrain blends its' materials from then on.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SplatUpdate(const int *dims, const int *rect, const vec4_t *bounds, const void *texels);
+
+/* ---------------------------------------------------------------------------
+ * Frees the splat texture. The terrain is drawn with the materials of its' 
+ * vertices only.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SplatDisable(void);
+
+
+/*###########################################################################*/
+/* RENDER OCCLUSION                                                          */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Initialize the resources for reducing and reading back the depth buffer.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_HiZInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Free all resources claimed by 'R_GL_HiZInit'
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_HiZShutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Reduces the depth buffer of the scene rendered so far into a coarse grid 
+ * of maximum depths and starts reading it back without stalling. Earlier 
+ * readbacks which have arrived by now are published for the occlusion tests 
+ * in 'render_ctrl.h'. 'view_proj' is the camera's view-projection matrix and 
+ * 'epoch' is the value returned by 'R_HiZEpoch' when the command was pushed.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_HiZCapture(const mat4x4_t *view_proj, const uint32_t *epoch);
+
+
+/*###########################################################################*/
+/* RENDER NAV FIELDS                                                         */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Build the compute program for generating navigation flow fields, if the
+ * context supports OpenGL 4.3. Otherwise, 'R_NavFieldGPUSupported' will 
+ * return false and the fields will only be built on the CPU.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Free all resources claimed by 'R_GL_NavFieldInit'. Batches still in flight
+ * are failed.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldShutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Upload the inputs of the batch and dispatch one workgroup for each of its' 
+ * fields. The results are read back without stalling by a later 
+ * 'R_GL_NavFieldPoll'.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldDispatch(struct nav_gpu_batch *batch);
+
+/* ---------------------------------------------------------------------------
+ * Read back the results of all the dispatched batches which have completed.
+ * Called by the render thread at the start of every frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldPoll(void);
+
+
+/*###########################################################################*/
+/* RENDER SKINNING                                                           */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Initialize the buffer which the animated meshes drawn in more than one 
+ * pass are skinned into once per frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SkinInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Free all resources claimed by 'R_GL_SkinInit'
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SkinShutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Discard the vertices skinned in the previous frame. Must come before any 
+ * 'R_GL_SkinInstances' of the frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SkinBegin(void);
+
+/* ---------------------------------------------------------------------------
+ * Skin the animated instances into the pre-skinned buffer with transform 
+ * feedback, and write where each one starts into 'skin_first'. The later 
+ * instanced draws of the frame which refer to the same slots then draw the 
+ * skinned vertices with the static mesh programs, in any pass. Instances 
+ * which could not be skinned are left at -1.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SkinInstances(const struct rcmd_draw_instanced *inst);
+
+
+/*###########################################################################*/
+/* RENDER SCENERY                                                            */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Build the compute program for culling the scenery instances, if the 
+ * context supports OpenGL 4.3. Otherwise, 'R_SceneryGPUSupported' will 
+ * return false and the scenery is drawn like all the other entities.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SceneryInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Free all resources claimed by 'R_GL_SceneryInit'
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SceneryShutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Write the changed instances into the buffer which holds the transforms 
+ * and bounds of all the scenery between frames.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SceneryUpdate(const struct scenery_update *updates, const size_t *count);
+
+/* ---------------------------------------------------------------------------
+ * Empty all the instance slots.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SceneryClear(void);
+
+/* ---------------------------------------------------------------------------
+ * Cull the scenery instances against the frustum with a compute shader, 
+ * which writes the instanced draw command of each mesh, and draw them 
+ * indirectly. When 'depth' is set, they are drawn into the current shadow 
+ * map cascade instead.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SceneryDraw(const struct frustum *frustum, const bool *depth);
+
+
+/*###########################################################################*/
+/* RENDER LIGHTS                                                             */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Create the buffers which hold the point lights and the clusters they are 
+ * binned into.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_LightsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Free all resources claimed by 'R_GL_LightsInit'
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_LightsShutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Bin the point lights into the clusters of the view frustum given by the 
+ * view and projection matrices, and upload them for the lit shaders. Must 
+ * be called every frame, before anything lit is drawn.
  * ---------------------------------------------------------------------------
  */
-void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const bool *reflection);
+void R_GL_LightsUpdate(const struct point_light *lights, const size_t *count, 
+                       const mat4x4_t *view, const mat4x4_t *proj);
 
 
 /*###########################################################################*/
@@ -462,7 +753,8 @@ void R_GL_UI_Shutdown(void);
 
 /* ---------------------------------------------------------------------------
  * Render the UI from the draw commands generated by the nukear calls during
- * a single simulation tick.
+ * a single simulation tick. The draw list is kept, and a NULL 'dl' draws the 
+ * last one received again without uploading anything.
  * ---------------------------------------------------------------------------
  */
 void R_GL_UI_Render(const struct nk_draw_list *dl);
@@ -37,9 +37,12 @@
 #define RENDER_AL_H
 
 #include <stdio.h>
+#include "../../pf_math.h"
+
 #include <SDL_rwops.h>
 
 struct pfobj_hdr;
+struct pfobj_bin_material;
 struct map;
 struct tile;
 
@@ -50,6 +53,75 @@ struct tile;
  */
 void  *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header, SDL_RWops *stream);
 
+/* ---------------------------------------------------------------------------
+ * Consumes the vertices and the materials of the model from the stream and 
+ * writes them out in the layout of a binary PF Object, without setting up 
+ * anything for rendering. 'out_verts' must have room for 'num_verts' 
+ * vertices of 'R_AL_VertSize' bytes. No engine state is touched, so this
+ * may be called from any thread.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_AL_ParseStream(const struct pfobj_hdr *header, SDL_RWops *stream,
+                        struct pfobj_bin_material *out_mats, void *out_verts);
+
+/* ---------------------------------------------------------------------------
+ * Returns the size of a single packed vertex of the model.
+ * ---------------------------------------------------------------------------
+ */
+size_t R_AL_VertSize(const struct pfobj_hdr *header);
+
+/* ---------------------------------------------------------------------------
+ * Like R_AL_PrivFromStream, but takes the sections of a binary PF Object 
+ * that is already in memory. The vertices are uploaded without conversion,
+ * so NULL is returned when 'vert_size' does not match the vertex format of
+ * the model. The data is copied and need not outlive the call.
+ * ---------------------------------------------------------------------------
+ */
+void  *R_AL_PrivFromBinary(const char *base_path, const struct pfobj_hdr *header, 
+                           const struct pfobj_bin_material *mats, 
+                           const void *verts, size_t vert_size);
+
+/* ---------------------------------------------------------------------------
+ * Releases all the resources of a model context created by one of the above.
+ * This is deferred to the render thread, after all the previously queued 
+ * commands, so the context need only be out of use by the time those run.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_FreePrivate(void *render_private);
+
+/* ---------------------------------------------------------------------------
+ * Makes the 'count' baked skinning matrices of all the animation frames of 
+ * the model resident on the GPU, so that the animated instances need only 
+ * refer to them by offset. 'palettes' is not copied and must stay valid for 
+ * as long as the model is in use. It may be NULL, in which case the space is
+ * only reserved, to be filled in with 'R_AL_UpdateAnimPalettes'.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_InitAnimPalettes(void *render_private, const mat4x4_t *palettes, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Uploads the 'count' matrices of 'palettes' starting at 'offset', after they 
+ * have been baked. The same rules as for 'R_AL_InitAnimPalettes' apply.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_UpdateAnimPalettes(void *render_private, const mat4x4_t *palettes, 
+                               size_t offset, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * The number of decimated meshes generated for the model when it was loaded.
+ * Reads only what is fixed at load time, so it may be called from any thread.
+ * ---------------------------------------------------------------------------
+ */
+size_t R_AL_NumLODs(const void *render_private);
+
+/* ---------------------------------------------------------------------------
+ * Returns the render private of the model's decimated mesh of level 'lod' 
+ * (with 0 being the model itself), which can be drawn in place of the 
+ * model's own. 'lod' must not exceed R_AL_NumLODs.
+ * ---------------------------------------------------------------------------
+ */
+void  *R_AL_LODPriv(void *render_private, int lod);
+
 /* ---------------------------------------------------------------------------
  * Dumps private render data in PF Object format.
  * ---------------------------------------------------------------------------
@@ -64,15 +136,36 @@ void   R_AL_DumpPrivate(FILE *stream, void *priv_data);
 size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t num_mats);
 
 /* ---------------------------------------------------------------------------
- * Initialize private render buff for a PFChunk of the map. 
- *
- * This function will build the vertices and their vertices from the data
- * already parsed into the 'tiles'.
+ * The size (in bytes) of the buffer taken by the cooked vertices of all the 
+ * meshes of a PFChunk.
+ * ---------------------------------------------------------------------------
+ */
+size_t R_AL_ChunkCookedSize(void);
+
+/* ---------------------------------------------------------------------------
+ * Builds the final vertices of all the meshes of the PFChunk from the tiles
+ * (which must be those of the chunk at 'chunk_r' and 'chunk_c' of the map), 
+ * including the smoothing of the normals with the adjacent tiles. Other 
+ * chunks' tiles must already be set, as the edges depend on them.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_AL_CookChunk(const struct map *map, int chunk_r, int chunk_c, 
+                      const struct tile *tiles, void *out);
+
+/* ---------------------------------------------------------------------------
+ * Initialize private render buff for a PFChunk of the map from vertices made
+ * by R_AL_CookChunk. The vertices are not copied: they are uploaded when 
+ * each mesh is first drawn, and so must outlive the chunk.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_InitPrivFromCooked(const void *cooked, void *priv_buff);
+
+/* ---------------------------------------------------------------------------
+ * Returns the render private of the decimated mesh of level 'lod' (starting 
+ * at 1), stored within the render private buffer of a PFChunk.
  * ---------------------------------------------------------------------------
  */
-bool   R_AL_InitPrivFromTiles(const struct map *map, int chunk_r, int chunk_c,
-                              const struct tile *tiles, size_t width, size_t height,
-                              void *priv_buff, const char *basedir);
+void  *R_AL_ChunkLODPriv(void *chunk_rprivate, int lod);
 
 #endif
 
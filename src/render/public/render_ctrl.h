@@ -38,17 +38,51 @@
 
 #include "../../lib/public/queue.h"
 #include "../../lib/public/stalloc.h"
+#include "../../pf_math.h"
+#include "../../collision.h"
+#include "../../config.h"
 
 #include <stddef.h>
 
 #include <SDL_mutex.h>
 #include <SDL_thread.h>
+#include <SDL_atomic.h>
 
 
 struct frustum;
+struct camera;
 struct tile_desc;
 struct map;
 
+enum nav_gpu_state{
+    NAV_GPU_PENDING,
+    NAV_GPU_DONE,
+    /* The fields could not be generated - they must be built on the CPU */
+    NAV_GPU_FAILED,
+    /* The owner no longer wants the results. The batch is freed by the 
+     * render thread once the GPU is done with it. */
+    NAV_GPU_ABANDONED,
+};
+
+/* A set of navigation flow fields generated by a compute shader. Every field 
+ * is 'res' by 'res' tiles, in row-major order. The batch is allocated with 
+ * 'R_NavFieldBatchAlloc' and handed to the render thread with an 
+ * 'R_GL_NavFieldDispatch' command. Once 'state' is no longer pending, the 
+ * owner may read the results and must free it with 'R_NavFieldBatchFree'. */
+struct nav_gpu_batch{
+    size_t        nfields;
+    int           res;
+    /* Per tile: the cost of stepping onto the tile in the low 8 bits (0xff 
+     * for tiles which can't be entered) and bit 8 set for the target tiles */
+    uint32_t     *tiles;
+    /* Per tile: the 'enum flow_dir' of the tile, or 0xff if the tile was
+     * not reached. Written by the render thread. */
+    uint32_t     *dirs;
+    /* Time between the dispatch and the results arriving */
+    float         gpu_ms;
+    SDL_atomic_t  state;
+};
+
 enum render_info{
     RENDER_INFO_VENDOR,
     RENDER_INFO_RENDERER,
@@ -56,6 +90,60 @@ enum render_info{
     RENDER_INFO_SL_VERSION,
 };
 
+/* The render passes which are timed on the GPU */
+enum gpu_pass{
+    GPU_PASS_SCENE,
+    GPU_PASS_DEPTH,
+    GPU_PASS_TERRAIN,
+    GPU_PASS_WATER,
+    GPU_PASS_MINIMAP,
+    GPU_PASS_UI,
+    GPU_PASS_COUNT,
+};
+
+/* Counters for the last frame processed by the render thread. Consecutive 
+ * draw commands are sorted by their state and executed as a batch, during 
+ * which redundant program, texture and VAO binds are skipped. */
+struct render_stats{
+    unsigned batches;
+    unsigned batched_cmds;
+    unsigned prog_changes;
+    unsigned prog_changes_skipped;
+    unsigned tex_changes;
+    unsigned tex_changes_skipped;
+    unsigned vao_changes;
+    unsigned vao_changes_skipped;
+    /* The GPU time spent in each pass, in milliseconds. The timings are read 
+     * back without stalling, so they lag the counters by a couple of frames. 
+     * A pass nested in another (i.e. the terrain drawn for the water's 
+     * reflection) is counted towards both. The scene covers all of the 3D 
+     * passes. */
+    float    gpu_ms[GPU_PASS_COUNT];
+    /* The fraction of the window's resolution the scene was rendered at */
+    float    render_scale;
+    /* The number of commands in the workspace, the time (in milliseconds) 
+     * the render thread sat idle waiting for it to be handed off, and the 
+     * time spent executing its' commands and presenting the frame */
+    unsigned cmds;
+    float    idle_ms;
+    float    exec_ms;
+    float    swap_ms;
+};
+
+/* One slice of the camera's view frustum, covered by a layer of the 
+ * shadow map. */
+struct shadow_cascade{
+    /* Projects world-space positions into the cascade's shadow map layer */
+    mat4x4_t       light_space_trans;
+    /* The world-space volume rendered into the layer */
+    struct frustum frustum;
+    /* The bounding sphere of the slice, which the volume is fitted to */
+    vec3_t         center;
+    float          radius;
+    /* The view-space depth of the far end of the slice */
+    float          split;
+};
+
 struct render_init_arg{
     SDL_Window *in_window;
     int         in_width; 
@@ -67,30 +155,109 @@ struct render_sync_state{
     /* The render thread owns the data pointed to by 'arg' until
      * signalling the first 'done'. */
     struct render_init_arg *arg;
-    /* The start flag is set by the main thread when the render
-     * thread is allowed to start processing commands.
-     * The quit flag is set by the main thread when the render 
-     * thread should exit. */
-    bool       start;
-    bool       quit;
-    SDL_mutex *sq_lock;
-    SDL_cond  *sq_cond;
-    /* The done flag is set by the render thread when it is done 
-     * procesing commands for the current frame. */
-    bool       done;
-    SDL_mutex *done_lock;
-    SDL_cond  *done_cond;
+    /* Posted by the main thread once for every workspace that is handed 
+     * off to the render thread, as well as for the render thread to 
+     * initialize the context or to exit. The quit flag is set by the main 
+     * thread when the render thread should exit. */
+    SDL_sem      *ready;
+    SDL_atomic_t  quit;
+    /* Posted by the render thread when it is done processing the 
+     * commands of a workspace. */
+    SDL_sem      *done;
     /* Flag to specify if the framebuffer should be presented on
      * the screen after all commands are executed */
-    bool       swap_buffers;
+    bool          swap_buffers;
 };
 
 #define MAX_ARGS 8
 
+/* The hottest commands are recorded with their arguments inline, instead of 
+ * as pointers to separate copies on the workspace's memstack. All other 
+ * commands are RCMD_GENERIC, which is the default when 'type' is omitted. 
+ */
+enum rcmd_type{
+    RCMD_GENERIC = 0,
+    RCMD_DRAW,              /* R_GL_Draw */
+    RCMD_RENDER_DEPTH_MAP,  /* R_GL_RenderDepthMap */
+    RCMD_SET_ANIM_UNIFORMS, /* R_GL_SetAnimUniforms */
+    RCMD_DRAW_INSTANCED,    /* R_GL_DrawInstanced */
+    RCMD_RENDER_DEPTH_MAP_INSTANCED, /* R_GL_RenderDepthMapInstanced */
+};
+
+struct rcmd_draw{
+    const void *render_private;
+    mat4x4_t    model;
+};
+
+struct rcmd_anim_uniforms{
+    mat4x4_t   *inv_bind_poses; /* static, use shallow copy */
+    mat4x4_t   *curr_poses;     /* 'count' matrices, pushed with R_PushArg */
+    mat4x4_t    normal;
+    size_t      count;
+};
+
+/* Refers to the palettes of the two frames an instance is blended between 
+ * by the index of their' first matrix. The layout matches the integer 
+ * texels that the skinned shaders read it from. */
+struct rcmd_palette_ref{
+    int     curr;
+    int     next;
+    float   blend;  /* weight of the 'next' palette */
+    int     pad;
+};
+
+/* All instances share the same 'render_private'. The arrays are pushed 
+ * with R_PushArg, except for 'palettes', which holds the baked skinning 
+ * matrices of all the animation frames of the model. For static meshes, 
+ * 'normals', 'palettes' and 'palette_refs' are NULL. 
+ *
+ * Animated instances which have been skinned by 'R_GL_SkinInstances' earlier 
+ * in the frame have 'skin_slots' set. Their vertices are then drawn from the 
+ * pre-skinned buffer, starting at 'skin_first[skin_slots[i]]'. A negative 
+ * entry means the instance was not skinned, and it is drawn as usual. */
+struct rcmd_draw_instanced{
+    const void              *render_private;
+    mat4x4_t                *models;       /* 'count' matrices */
+    mat4x4_t                *normals;      /* 'count' matrices */
+    const mat4x4_t          *palettes;     /* static, use shallow copy */
+    struct rcmd_palette_ref *palette_refs; /* 'count' references into 'palettes' */
+    size_t                   count;
+    size_t                   njoints;
+    int                     *skin_slots;   /* 'count' indices into 'skin_first' */
+    int                     *skin_first;   /* shared by all the passes of the frame */
+};
+
+/* Sets the instance in 'slot' of the scenery which is kept on the GPU and 
+ * drawn with R_GL_SceneryDraw. A NULL 'render_private' empties the slot. */
+struct scenery_update{
+    uint32_t    slot;
+    const void *render_private;
+    mat4x4_t    model;
+    vec4_t      sphere; /* the bounding sphere, with the radius in 'w' */
+};
+
+/* The layout matches the two texels per light which the lit shaders read 
+ * it from. The light falls off to nothing at 'radius'. */
+struct point_light{
+    vec3_t      pos;
+    float       radius;
+    vec3_t      color;
+    float       pad;
+};
+
 struct rcmd{
-    void (*func)();
-    size_t nargs;
-    void *args[MAX_ARGS];
+    union{
+        struct{
+            void (*func)();
+            size_t nargs;
+            void *args[MAX_ARGS];
+        };
+        struct rcmd_draw          as_draw;           /* RCMD_DRAW, RCMD_RENDER_DEPTH_MAP */
+        struct rcmd_anim_uniforms as_anim_uniforms;  /* RCMD_SET_ANIM_UNIFORMS */
+        struct rcmd_draw_instanced as_draw_instanced; /* RCMD_DRAW_INSTANCED, 
+                                                       * RCMD_RENDER_DEPTH_MAP_INSTANCED */
+    };
+    enum rcmd_type type;
 };
 
 QUEUE_TYPE(rcmd, struct rcmd)
@@ -101,12 +268,18 @@ struct render_workspace{
      * with the commands */
     struct memstack   args;
     queue_rcmd_t      commands;
+    /* The size of the memblocks of 'args', as last reported to the memory 
+     * accounting */
+    size_t            tracked_bytes;
 };
 
 
 bool        R_Init(const char *base_path);
 SDL_Thread *R_Run(struct render_sync_state *rstate);
 
+/* Returns uninitialized memory with the same lifetime as R_PushArg copies, 
+ * for arguments that are cheaper to build in place. */
+void       *R_AllocArg(size_t size);
 void       *R_PushArg(const void *src, size_t size);
 void        R_PushCmd(struct rcmd cmd);
 
@@ -115,9 +288,36 @@ void        R_DestroyWS(struct render_workspace *ws);
 void        R_ClearWS(struct render_workspace *ws);
 
 const char *R_GetInfo(enum render_info attr);
+void        R_GetStats(struct render_stats *out);
 
 /* Shadows */
-void        R_LightFrustum(vec3_t light_pos, vec3_t cam_pos, vec3_t cam_dir, struct frustum *out);
+void        R_ShadowCascades(vec3_t light_pos, const struct camera *cam, 
+                             struct shadow_cascade out[static CONFIG_SHADOW_CASCADES]);
+bool        R_ShadowCascadeCovers(const struct shadow_cascade *cached, const struct shadow_cascade *fresh);
+
+/* Water */
+void        R_WaterClipPlanes(vec4_t *out_refract, vec4_t *out_reflect);
+void        R_WaterReflectionCam(const struct camera *cam, struct camera *out);
+
+/* Occlusion - the boxes are tested against the depth buffer of a recent frame, 
+ * as seen from that frame's camera. R_HiZUpdate picks up the latest results. */
+uint32_t    R_HiZEpoch(void);
+void        R_HiZInvalidate(void);
+void        R_HiZUpdate(bool enabled);
+bool        R_HiZOccludedOBB(const struct obb *obb);
+bool        R_HiZOccludedAABB(const struct aabb *aabb);
+
+/* Scenery - only usable when 'R_SceneryGPUSupported' returns true */
+bool        R_SceneryGPUSupported(void);
+
+/* Navigation fields - only usable when 'R_NavFieldGPUSupported' returns true */
+bool        R_NavFieldGPUSupported(void);
+struct nav_gpu_batch *R_NavFieldBatchAlloc(size_t nfields, int res);
+void        R_NavFieldBatchFree(struct nav_gpu_batch *batch);
+/* Returns the current state of the batch */
+enum nav_gpu_state R_NavFieldBatchPoll(struct nav_gpu_batch *batch);
+/* Gives up the batch. It must not be accessed after this call. */
+void        R_NavFieldBatchAbandon(struct nav_gpu_batch *batch);
 
 /* Tile */
 int         R_TileGetTriMesh(const struct map *map, struct tile_desc *td, mat4x4_t *model, vec3_t out[]);
@@ -39,13 +39,24 @@
 #include "gl_texture.h"
 #include "gl_render.h"
 #include "gl_assert.h"
+#include "gl_state.h"
+#include "gl_stream.h"
+#include "gl_perf.h"
+#include "gl_dynres.h"
+#include "gl_material.h"
+#include "render_private.h"
 #include "../settings.h"
 #include "../main.h"
 #include "../ui.h"
+#include "../perf.h"
+#include "../mem.h"
 #include "../game/public/game.h"
+#include "../lib/public/vec.h"
 
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include <SDL.h>
 #include <GL/glew.h>
@@ -55,6 +66,27 @@
 #define EPSILON     (1.0f/1024)
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
+/* Layout of the 64-bit sort key, from the most significant bits:
+ *     [63:60] pass (command type)
+ *     [59:44] shader program
+ *     [43:28] texture set (the first material's texture)
+ *     [27:12] VAO
+ *     [11:0]  unused
+ * Ties are broken by submission order, so the sort is stable.
+ */
+#define KEY_FIELD(val, shift, bits) ((((uint64_t)(val)) & ((1ull << (bits)) - 1)) << (shift))
+
+struct sort_entry{
+    uint64_t key;
+    size_t   idx;
+};
+
+VEC_TYPE(rcmd, struct rcmd)
+VEC_IMPL(static inline, rcmd, struct rcmd)
+
+VEC_TYPE(sort, struct sort_entry)
+VEC_IMPL(static inline, sort, struct sort_entry)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -67,6 +99,18 @@ char                 s_info_renderer[128];
 char                 s_info_version[128];
 char                 s_info_sl_version[128];
 
+/* Render thread only. Holds the current run of sortable draw commands. */
+static vec(rcmd)     s_batch;
+static vec(sort)     s_batch_keys;
+static unsigned      s_batches, s_batched_cmds;
+/* Render thread only. The handoff timings of the current frame. */
+static unsigned      s_ncmds;
+static float         s_idle_ms, s_exec_ms, s_swap_ms;
+
+/* Published by the render thread at the end of every frame */
+static SDL_SpinLock        s_stats_lock;
+static struct render_stats s_stats;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -192,11 +236,51 @@ static void vsync_commit(const struct sval *new_val)
     });
 }
 
+static void dynres_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_DynresSetEnabled,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_bool, sizeof(int)) }
+    });
+}
+
+static bool gpu_budget_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_FLOAT && new_val->as_float > 0.0f);
+}
+
+static void gpu_budget_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_DynresSetBudget,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_float, sizeof(float)) }
+    });
+}
+
 static bool int_val_validate(const struct sval *new_val)
 {
     return (new_val->type == ST_TYPE_INT);
 }
 
+static bool water_reuse_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_INT && new_val->as_int >= 0);
+}
+
+static bool split_lambda_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_FLOAT 
+         && new_val->as_float >= 0.0f 
+         && new_val->as_float <= 1.0f);
+}
+
+static bool lod_dist_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_FLOAT && new_val->as_float >= 0.0f);
+}
+
 static void render_set_logmask(int *mask)
 {
     if(!GLEW_KHR_debug)
@@ -223,29 +307,13 @@ static void debug_logmask_commit(const struct sval *new_val)
 
 static bool render_wait_cmd(struct render_sync_state *rstate)
 {
-    SDL_LockMutex(rstate->sq_lock);
-    while(!rstate->start && !rstate->quit)
-        SDL_CondWait(rstate->sq_cond, rstate->sq_lock);
-
-    if(rstate->quit) {
-
-        rstate->quit = false;
-        SDL_UnlockMutex(rstate->sq_lock);
-        return true;
-    }
-    
-    assert(rstate->start == true);
-    rstate->start = false;
-    SDL_UnlockMutex(rstate->sq_lock);
-    return false;
+    SDL_SemWait(rstate->ready);
+    return SDL_AtomicGet(&rstate->quit);
 }
 
 static void render_signal_done(struct render_sync_state *rstate)
 {
-    SDL_LockMutex(rstate->done_lock);
-    rstate->done = true;
-    SDL_CondSignal(rstate->done_cond);
-    SDL_UnlockMutex(rstate->done_lock);
+    SDL_SemPost(rstate->done);
 }
 
 static const char *source_str(GLenum source)
@@ -341,7 +409,7 @@ static void render_init_ctx(struct render_init_arg *arg)
     R_GL_SetViewport(&vp[0], &vp[1], &vp[2], &vp[3]);
     R_GL_GlobalConfig();
 
-    if(!R_GL_Shader_InitAll(g_basepath)) {
+    if(!R_GL_Shader_InitAll(g_basepath, arg->in_window)) {
         arg->out_success = false;
         return;
     }
@@ -352,6 +420,25 @@ static void render_init_ctx(struct render_init_arg *arg)
     }
 
     R_GL_InitShadows();
+    R_GL_InitInstancing();
+    R_GL_InitGlobals();
+
+    if(!R_GL_StreamInit()) {
+        fprintf(stderr, "Failed to initialize the stream buffer\n");
+        arg->out_success = false;
+        return;
+    }
+    R_GL_InitOverlays();
+    R_GL_PerfInit();
+    R_GL_HiZInit();
+    R_GL_DynresInit();
+    R_GL_NavFieldInit();
+    R_GL_SkinInit();
+    R_GL_SceneryInit();
+    R_GL_LightsInit();
+
+    vec_rcmd_init(&s_batch);
+    vec_sort_init(&s_batch_keys);
 
     strncpy(s_info_vendor,     (const char*)glGetString(GL_VENDOR),   ARR_SIZE(s_info_vendor)-1);
     strncpy(s_info_renderer,   (const char*)glGetString(GL_RENDERER), ARR_SIZE(s_info_renderer)-1);
@@ -363,11 +450,48 @@ static void render_init_ctx(struct render_init_arg *arg)
 
 static void render_destroy_ctx(void)
 {
+    vec_rcmd_destroy(&s_batch);
+    vec_sort_destroy(&s_batch_keys);
+    R_GL_LightsShutdown();
+    R_GL_SceneryShutdown();
+    R_GL_SkinShutdown();
+    R_GL_NavFieldShutdown();
+    R_GL_DynresShutdown();
+    R_GL_FogDisable();
+    R_GL_SplatDisable();
+    R_GL_HiZShutdown();
+    R_GL_PerfShutdown();
+    R_GL_OverlaysShutdown();
+    R_GL_StreamShutdown();
+    R_GL_Texture_Shutdown();
+    R_GL_Shader_Shutdown();
     SDL_GL_DeleteContext(s_context);
 }
 
 static void render_dispatch_cmd(struct rcmd cmd)
 {
+    switch(cmd.type) {
+    case RCMD_DRAW:
+        R_GL_Draw(cmd.as_draw.render_private, &cmd.as_draw.model);
+        return;
+    case RCMD_RENDER_DEPTH_MAP:
+        R_GL_RenderDepthMap(cmd.as_draw.render_private, &cmd.as_draw.model);
+        return;
+    case RCMD_SET_ANIM_UNIFORMS:
+        R_GL_SetAnimUniforms(cmd.as_anim_uniforms.inv_bind_poses, cmd.as_anim_uniforms.curr_poses, 
+            &cmd.as_anim_uniforms.normal, &cmd.as_anim_uniforms.count);
+        return;
+    case RCMD_DRAW_INSTANCED:
+        R_GL_DrawInstanced(&cmd.as_draw_instanced);
+        return;
+    case RCMD_RENDER_DEPTH_MAP_INSTANCED:
+        R_GL_RenderDepthMapInstanced(&cmd.as_draw_instanced);
+        return;
+    case RCMD_GENERIC:
+        break;
+    default: assert(0);
+    }
+
     switch(cmd.nargs) {
     case 0:
         ((void(*)(void)) cmd.func)();
@@ -456,21 +580,152 @@ static void render_dispatch_cmd(struct rcmd cmd)
     }
 }
 
+static bool render_cmd_sortable(const struct rcmd *cmd)
+{
+    /* Opaque draws that don't depend on any state set by the commands that 
+     * come before them, besides the surrounding pass setup */
+    switch(cmd->type) {
+    case RCMD_DRAW:
+    case RCMD_RENDER_DEPTH_MAP:
+    case RCMD_DRAW_INSTANCED:
+    case RCMD_RENDER_DEPTH_MAP_INSTANCED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static uint64_t render_sort_key(const struct rcmd *cmd)
+{
+    const struct render_private *priv;
+    GLuint prog;
+
+    switch(cmd->type) {
+    case RCMD_DRAW:
+        priv = cmd->as_draw.render_private;
+        prog = priv->shader_prog;
+        break;
+    case RCMD_RENDER_DEPTH_MAP:
+        priv = cmd->as_draw.render_private;
+        prog = priv->shader_prog_dp;
+        break;
+    case RCMD_DRAW_INSTANCED:
+        priv = cmd->as_draw_instanced.render_private;
+        prog = priv->shader_prog;
+        break;
+    case RCMD_RENDER_DEPTH_MAP_INSTANCED:
+        priv = cmd->as_draw_instanced.render_private;
+        prog = priv->shader_prog_dp;
+        break;
+    default: assert(0); return 0;
+    }
+
+    GLuint tex = priv->num_materials > 0 ? priv->materials[0].texture.id : 0;
+
+    return KEY_FIELD(cmd->type,       60, 4)
+         | KEY_FIELD(prog,            44, 16)
+         | KEY_FIELD(tex,             28, 16)
+         | KEY_FIELD(priv->mesh.VAO,  12, 16);
+}
+
+static int render_compare_entries(const void *a, const void *b)
+{
+    const struct sort_entry *ea = a, *eb = b;
+
+    if(ea->key != eb->key)
+        return ea->key < eb->key ? -1 : 1;
+    return ea->idx < eb->idx ? -1 : (ea->idx > eb->idx);
+}
+
+static void render_flush_batch(void)
+{
+    size_t ncmds = vec_size(&s_batch);
+    if(ncmds == 0)
+        return;
+
+    vec_sort_reset(&s_batch_keys);
+    if(s_batch_keys.capacity < ncmds && !vec_sort_resize(&s_batch_keys, ncmds)) {
+
+        /* Fall back to submission order */
+        for(int i = 0; i < ncmds; i++) {
+            render_dispatch_cmd(vec_AT(&s_batch, i));
+            GL_ASSERT_OK();
+        }
+        vec_rcmd_reset(&s_batch);
+        return;
+    }
+
+    for(int i = 0; i < ncmds; i++) {
+        vec_sort_push(&s_batch_keys, (struct sort_entry){
+            .key = render_sort_key(&vec_AT(&s_batch, i)), 
+            .idx = i
+        });
+    }
+    qsort(s_batch_keys.array, ncmds, sizeof(struct sort_entry), render_compare_entries);
+
+    R_GL_StateBeginBatch();
+    for(int i = 0; i < ncmds; i++) {
+        render_dispatch_cmd(vec_AT(&s_batch, vec_AT(&s_batch_keys, i).idx));
+        GL_ASSERT_OK();
+    }
+    R_GL_StateEndBatch();
+
+    s_batches++;
+    s_batched_cmds += ncmds;
+    vec_rcmd_reset(&s_batch);
+}
+
+static void render_publish_stats(void)
+{
+    struct render_stats stats;
+    R_GL_StateGetStats(&stats);
+    R_GL_PerfGetTimings(stats.gpu_ms);
+    stats.render_scale = R_GL_DynresScale();
+    stats.batches = s_batches;
+    stats.batched_cmds = s_batched_cmds;
+    stats.cmds = s_ncmds;
+    stats.idle_ms = s_idle_ms;
+    stats.exec_ms = s_exec_ms;
+    stats.swap_ms = s_swap_ms;
+    s_batches = s_batched_cmds = 0;
+
+    SDL_AtomicLock(&s_stats_lock);
+    s_stats = stats;
+    SDL_AtomicUnlock(&s_stats_lock);
+}
+
+static float render_elapsed_ms(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
 static void render_process_cmds(queue_rcmd_t *cmds)
 {
+    PERF_ENTER();
+    s_ncmds = queue_size(*cmds);
     while(queue_size(*cmds) > 0) {
 
         struct rcmd curr;
         queue_rcmd_pop(cmds, &curr);
+
+        if(render_cmd_sortable(&curr) && vec_rcmd_push(&s_batch, curr))
+            continue;
+
+        render_flush_batch();
         render_dispatch_cmd(curr);
         GL_ASSERT_OK();
     }
+    render_flush_batch();
+    R_GL_DynresEndScene();
+    R_GL_PerfEndFrame();
+    PERF_RETURN_VOID();
 }
 
 static int render(void *data)
 {
     struct render_sync_state *rstate = data; 
     SDL_Window *window = rstate->arg->in_window; /* cache window ptr */
+    Perf_RegisterThread("render");
 
     bool quit = render_wait_cmd(rstate);
     assert(!quit);
@@ -480,14 +735,28 @@ static int render(void *data)
 
     while(true) {
     
+        uint64_t start = SDL_GetPerformanceCounter();
         quit = render_wait_cmd(rstate);
         if(quit)
             break;
+        s_idle_ms = render_elapsed_ms(start);
 
+        start = SDL_GetPerformanceCounter();
+        R_GL_Texture_ProcessUploads();
+        R_GL_NavFieldPoll();
         render_process_cmds(&G_GetRenderWS()->commands);
+        R_GL_StreamEndFrame();
+        s_exec_ms = render_elapsed_ms(start);
+
+        /* With vsync on, or when the GPU has fallen behind, the driver 
+         * blocks here */
+        start = SDL_GetPerformanceCounter();
         if(rstate->swap_buffers)
             SDL_GL_SwapWindow(window);
+        s_swap_ms = render_elapsed_ms(start);
 
+        render_publish_stats();
+        G_ReleaseRenderWS();
         render_signal_done(rstate);
     }
 
@@ -495,6 +764,13 @@ static int render(void *data)
     return 0;
 }
 
+static void r_ws_track_mem(struct render_workspace *ws)
+{
+    size_t bytes = ws->args.stats.nblocks * sizeof(struct st_mem);
+    Mem_Track(MEM_TAG_RENDER_WS, (ptrdiff_t)bytes - (ptrdiff_t)ws->tracked_bytes);
+    ws->tracked_bytes = bytes;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -505,7 +781,7 @@ bool R_Init(const char *base_path)
     (void)status;
 
     SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
+    Engine_DesktopRes(&dm.w, &dm.h);
 
     status = Settings_Create((struct setting){
         .name = "pf.video.aspect_ratio",
@@ -603,6 +879,91 @@ bool R_Init(const char *base_path)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.video.water_low_res",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false 
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.water_reuse_frames",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 0 
+        },
+        .prio = 0,
+        .validate = water_reuse_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.occlusion_culling",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = true 
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.shadow_split_lambda",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 0.75f
+        },
+        .prio = 0,
+        .validate = split_lambda_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.dynamic_resolution",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false 
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = dynres_commit,
+    });
+    assert(status == SS_OKAY);
+
+    /* The GPU time that the 3D scene is kept under by the dynamic resolution */
+    status = Settings_Create((struct setting){
+        .name = "pf.video.gpu_budget_ms",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 12.0f
+        },
+        .prio = 0,
+        .validate = gpu_budget_validate,
+        .commit = gpu_budget_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.terrain_lod_distance",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 384.0f
+        },
+        .prio = 0,
+        .validate = lod_dist_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.debug.render_log_mask",
         .val = (struct sval) {
@@ -623,11 +984,16 @@ SDL_Thread *R_Run(struct render_sync_state *rstate)
     return SDL_CreateThread(render, "render", rstate);
 }
 
-void *R_PushArg(const void *src, size_t size)
+void *R_AllocArg(size_t size)
 {
     struct render_workspace *ws = (SDL_ThreadID() == g_render_thread_id) ? G_GetRenderWS() 
                                                                          : G_GetSimWS();
-    void *ret = stalloc(&ws->args, size);
+    return stalloc(&ws->args, size);
+}
+
+void *R_PushArg(const void *src, size_t size)
+{
+    void *ret = R_AllocArg(size);
     if(!ret)
         return ret;
 
@@ -645,6 +1011,10 @@ void R_PushCmd(struct rcmd cmd)
         return;
     }
 
+    /* There is nobody to execute the commands in headless mode */
+    if(g_headless)
+        return;
+
     struct render_workspace *ws = G_GetSimWS();
     queue_rcmd_push(&ws->commands, &cmd);
 }
@@ -657,6 +1027,8 @@ bool R_InitWS(struct render_workspace *ws)
     if(!queue_rcmd_init(&ws->commands, 2048))
         goto fail_queue;
 
+    ws->tracked_bytes = 0;
+    r_ws_track_mem(ws);
     return true;
 
 fail_queue:
@@ -669,12 +1041,23 @@ void R_DestroyWS(struct render_workspace *ws)
 {
     queue_rcmd_destroy(&ws->commands);
     stalloc_destroy(&ws->args);
+    r_ws_track_mem(ws);
 }
 
 void R_ClearWS(struct render_workspace *ws)
 {
+    /* Account for the memblocks the last frame needed before any get trimmed */
+    r_ws_track_mem(ws);
     queue_rcmd_clear(&ws->commands);
     stalloc_clear(&ws->args);
+    r_ws_track_mem(ws);
+}
+
+void R_GetStats(struct render_stats *out)
+{
+    SDL_AtomicLock(&s_stats_lock);
+    *out = s_stats;
+    SDL_AtomicUnlock(&s_stats_lock);
 }
 
 const char *R_GetInfo(enum render_info attr)
@@ -35,6 +35,7 @@
 
 #include "public/render.h"
 #include "public/render_ctrl.h"
+#include "public/render_al.h"
 #include "render_private.h"
 #include "gl_vertex.h"
 #include "gl_material.h"
@@ -46,6 +47,7 @@
 #include "../map/public/tile.h"
 #include "../settings.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/khash.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -55,6 +57,16 @@
 #define STR(a) #a
 
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define ALIGNED(size, to)  (((size) + (to) - 1) / (to) * (to))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+
+KHASH_MAP_INIT_INT64(lod_cell, int)
+
+struct lod_cluster{
+    vec3_t sum;
+    int    count;
+};
 
 
 /*****************************************************************************/
@@ -114,7 +126,20 @@ fail:
     return false;
 }
 
-static bool al_read_material(SDL_RWops *stream, const char *basedir, struct material *out, bool *out_null)
+static void al_load_textures(const char *basedir, struct material *mats, size_t num_mats)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_Texture_LoadMaterials,
+        .nargs = 3,
+        .args = {
+            R_PushArg(basedir, strlen(basedir) + 1),
+            mats,
+            R_PushArg(&num_mats, sizeof(num_mats)),
+        },
+    });
+}
+
+static bool al_read_material(SDL_RWops *stream, struct pfobj_bin_material *out, bool *out_null)
 {
     char line[MAX_LINE_LEN];
 
@@ -130,15 +155,15 @@ static bool al_read_material(SDL_RWops *stream, const char *basedir, struct mate
     }
 
     READ_LINE(stream, line, fail);
-    if(!sscanf(line, " ambient %f", &out->ambient_intensity))
+    if(!sscanf(line, " ambient %f", &out->ambient))
         goto fail;
 
     READ_LINE(stream, line, fail);
-    if(!sscanf(line, " diffuse %f %f %f", &out->diffuse_clr.x, &out->diffuse_clr.y, &out->diffuse_clr.z))
+    if(!sscanf(line, " diffuse %f %f %f", &out->diffuse[0], &out->diffuse[1], &out->diffuse[2]))
         goto fail;
 
     READ_LINE(stream, line, fail);
-    if(!sscanf(line, " specular %f %f %f", &out->specular_clr.x, &out->specular_clr.y, &out->specular_clr.z))
+    if(!sscanf(line, " specular %f %f %f", &out->specular[0], &out->specular[1], &out->specular[2]))
         goto fail;
 
     READ_LINE(stream, line, fail);
@@ -146,28 +171,178 @@ static bool al_read_material(SDL_RWops *stream, const char *basedir, struct mate
         goto fail;
     out->texname[sizeof(out->texname)-1] = '\0';
 
+    *out_null = false;
+    return true;
+
+fail:
+    return false;
+}
+
+static enum vert_format al_format_for_header(const struct pfobj_hdr *header)
+{
+    return (header->num_as > 0) ? VERT_FORMAT_ANIM : VERT_FORMAT_STATIC;
+}
+
+static const char *al_shader_for_header(const struct pfobj_hdr *header)
+{
+    struct sval sh_setting;
+    ss_e status = Settings_Get("pf.video.shadows_enabled", &sh_setting);
+    assert(status == SS_OKAY);
+
+    if(sh_setting.as_bool) {
+        return (header->num_as > 0) ? "mesh.animated.textured-phong-shadowed" 
+                                    : "mesh.static.textured-phong-shadowed";
+    }else{
+        return (header->num_as > 0) ? "mesh.animated.textured-phong" 
+                                    : "mesh.static.textured-phong";
+    }
+}
+
+static void al_push_init(struct render_private *priv, const char *shader, 
+                         const void *pbuff, size_t pbuff_sz)
+{
     R_PushCmd((struct rcmd){
-        .func = R_GL_Texture_GetOrLoad,
+        .func = R_GL_Init,
         .nargs = 3,
         .args = {
-            R_PushArg(basedir, strlen(basedir) + 1),
-            R_PushArg(out->texname, strlen(out->texname) + 1),
-            &out->texture.id,
+            priv,
+            (void*)shader,
+            R_PushArg(pbuff, pbuff_sz),
         },
     });
 
-    *out_null = false;
-    return true;
+    R_PushCmd((struct rcmd){
+        .func = R_GL_InitMaterials,
+        .nargs = 1,
+        .args = { priv },
+    });
+}
 
-fail:
-    return false;
+/* Vertex clustering: every vertex is moved to the mean position of all the 
+ * vertices in its' cell of a grid of 'res' cells along the longest side of 
+ * the mesh, and the triangles which collapse as a result are dropped. The 
+ * corners of the remaining ones keep all their' other attributes, which is 
+ * possible since every packed vertex format starts with the position. 
+ * Returns the number of vertices written to 'out'. */
+static size_t al_decimate(const void *verts, size_t nverts, size_t vsize, int res, void *out)
+{
+    size_t ret = 0;
+    vec3_t min = *(const vec3_t*)verts, max = min;
+
+    for(size_t i = 1; i < nverts; i++) {
+        const vec3_t *pos = (const vec3_t*)((const char*)verts + i * vsize);
+        for(int j = 0; j < 3; j++) {
+            min.raw[j] = MIN(min.raw[j], pos->raw[j]);
+            max.raw[j] = MAX(max.raw[j], pos->raw[j]);
+        }
+    }
+
+    float extent = MAX(max.x - min.x, MAX(max.y - min.y, max.z - min.z));
+    if(extent <= 0.0f)
+        return 0;
+    const float cell_len = extent / res;
+
+    khash_t(lod_cell) *cells = kh_init(lod_cell);
+    if(!cells)
+        goto fail_cells;
+
+    struct lod_cluster *clusters = malloc(nverts * sizeof(struct lod_cluster));
+    if(!clusters)
+        goto fail_clusters;
+
+    int *vert_clusters = malloc(nverts * sizeof(int));
+    if(!vert_clusters)
+        goto fail_vert_clusters;
+
+    int nclusters = 0;
+    for(size_t i = 0; i < nverts; i++) {
+
+        const vec3_t *pos = (const vec3_t*)((const char*)verts + i * vsize);
+        uint64_t key = 0;
+        for(int j = 0; j < 3; j++) {
+            uint64_t idx = MIN((pos->raw[j] - min.raw[j]) / cell_len, res);
+            key = (key << 21) | idx;
+        }
+
+        int status;
+        khiter_t k = kh_put(lod_cell, cells, key, &status);
+        if(status == -1)
+            goto fail_put;
+        if(status != 0) {
+            kh_value(cells, k) = nclusters;
+            clusters[nclusters++] = (struct lod_cluster){ {{0.0f}}, 0 };
+        }
+
+        struct lod_cluster *cl = &clusters[kh_value(cells, k)];
+        PFM_Vec3_Add(&cl->sum, (vec3_t*)pos, &cl->sum);
+        cl->count++;
+        vert_clusters[i] = kh_value(cells, k);
+    }
+
+    for(size_t i = 0; i + 2 < nverts; i += 3) {
+
+        const int *tri = &vert_clusters[i];
+        if(tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+            continue;
+
+        for(int j = 0; j < 3; j++) {
+
+            const struct lod_cluster *cl = &clusters[tri[j]];
+            char *dst = (char*)out + ret * vsize;
+            memcpy(dst, (const char*)verts + (i + j) * vsize, vsize);
+            PFM_Vec3_Scale((vec3_t*)&cl->sum, 1.0f / cl->count, (vec3_t*)dst);
+            ret++;
+        }
+    }
+
+fail_put:
+    free(vert_clusters);
+fail_vert_clusters:
+    free(clusters);
+fail_clusters:
+    kh_destroy(lod_cell, cells);
+fail_cells:
+    return ret;
 }
 
-size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
+/* Writes out the vertices of each decimated mesh worth keeping, from the 
+ * most detailed down, to malloc'd buffers. Returns their' number. */
+static size_t al_make_lods(const void *verts, size_t nverts, size_t vsize,
+                           void *out_verts[], size_t out_counts[])
 {
     size_t ret = 0;
+    if(nverts < CONFIG_ENTITY_LOD_MIN_VERTS)
+        return 0;
+
+    size_t prev = nverts;
+    int res = CONFIG_ENTITY_LOD_GRID;
+
+    for(int i = 0; i < CONFIG_ENTITY_LODS && res >= 2; i++, res /= 2) {
+
+        void *buff = malloc(nverts * vsize);
+        if(!buff)
+            break;
+
+        /* Not worth the extra draw state unless it makes a dent */
+        size_t count = al_decimate(verts, nverts, vsize, res, buff);
+        if(count == 0 || count > prev * 3 / 4) {
+            free(buff);
+            continue;
+        }
+
+        out_verts[ret] = buff;
+        out_counts[ret] = count;
+        prev = count;
+        ret++;
+    }
+    return ret;
+}
 
-    ret += sizeof(struct render_private);
+size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header, size_t num_lods)
+{
+    size_t ret = 0;
+
+    ret += sizeof(struct render_private) * (1 + num_lods);
     ret += header->num_materials * sizeof(struct material);
 
     return ret;
@@ -183,6 +358,8 @@ size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
  *  +---------------------------------+ <-- base
  *  | struct render_private[1]        |
  *  +---------------------------------+
+ *  | struct render_private[num_lods] |
+ *  +---------------------------------+
  *  | struct material[num_materials]  |
  *  +---------------------------------+
  *
@@ -190,19 +367,43 @@ size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
 
 void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header, SDL_RWops *stream)
 {
-    struct render_private *priv = malloc(al_priv_buffsize_from_header(header));
-    if(!priv)
-        goto fail_alloc_priv;
+    void *ret = NULL;
+    const size_t vert_size = R_AL_VertSize(header);
+
+    struct pfobj_bin_material *mats = malloc(MAX(header->num_materials, 1) * sizeof(*mats));
+    if(!mats)
+        goto fail_alloc_mats;
+
+    void *pbuff = malloc(MAX(header->num_verts, 1) * vert_size);
+    if(!pbuff)
+        goto fail_alloc_pbuff;
+
+    if(!R_AL_ParseStream(header, stream, mats, pbuff))
+        goto fail_parse;
+
+    ret = R_AL_PrivFromBinary(base_path, header, mats, pbuff, vert_size);
+
+fail_parse:
+    free(pbuff);
+fail_alloc_pbuff:
+    free(mats);
+fail_alloc_mats:
+    return ret;
+}
 
+size_t R_AL_VertSize(const struct pfobj_hdr *header)
+{
+    return R_VertSize(al_format_for_header(header));
+}
+
+bool R_AL_ParseStream(const struct pfobj_hdr *header, SDL_RWops *stream,
+                      struct pfobj_bin_material *out_mats, void *out_verts)
+{
     size_t vbuff_sz = header->num_verts * sizeof(struct vertex);
-    struct vertex *vbuff = malloc(vbuff_sz);
+    struct vertex *vbuff = malloc(MAX(vbuff_sz, 1));
     if(!vbuff)
         goto fail_alloc_vbuff;
 
-    priv->mesh.num_verts = header->num_verts;
-    priv->num_materials = header->num_materials;
-    priv->materials = (void*)(priv + 1);
-
     for(int i = 0; i < header->num_verts; i++) {
         if(!al_read_vertex(stream, &vbuff[i]))
             goto fail_parse;
@@ -211,57 +412,132 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
     for(int i = 0; i < header->num_materials; i++) {
 
         bool null;
-        priv->materials[i].texture.tunit = GL_TEXTURE0 + i;
-        priv->materials[i].texture.id = -1;
-        if(!al_read_material(stream, base_path, &priv->materials[i], &null)) 
+        if(!al_read_material(stream, &out_mats[i], &null)) 
             goto fail_parse;
         assert(!null);
     }
 
-    struct sval sh_setting;
-    ss_e status = Settings_Get("pf.video.shadows_enabled", &sh_setting);
-    assert(status == SS_OKAY);
+    R_VertPack(al_format_for_header(header), vbuff, header->num_verts, out_verts);
+    free(vbuff);
+    return true;
 
-    const char *shader;
-    if(sh_setting.as_bool) {
-        shader = (header->num_as > 0) ? "mesh.animated.textured-phong-shadowed" 
-                                      : "mesh.static.textured-phong-shadowed";
-    }else{
-        shader = (header->num_as > 0) ? "mesh.animated.textured-phong" 
-                                      : "mesh.static.textured-phong";
+fail_parse:
+    free(vbuff);
+fail_alloc_vbuff:
+    return false;
+}
+
+void *R_AL_PrivFromBinary(const char *base_path, const struct pfobj_hdr *header, 
+                          const struct pfobj_bin_material *mats, 
+                          const void *verts, size_t vert_size)
+{
+    /* The vertices are uploaded as they are, so they must have been cooked 
+     * for the same vertex format as the one the shader expects. */
+    const char *shader = al_shader_for_header(header);
+    enum vert_format format = R_VertFormatForShader(shader);
+    if(vert_size != R_VertSize(format))
+        return NULL;
+
+    void *lod_verts[MAX(CONFIG_ENTITY_LODS, 1)];
+    size_t lod_counts[MAX(CONFIG_ENTITY_LODS, 1)];
+    size_t num_lods = al_make_lods(verts, header->num_verts, vert_size, lod_verts, lod_counts);
+
+    struct render_private *priv = malloc(al_priv_buffsize_from_header(header, num_lods));
+    if(!priv)
+        goto out;
+
+    priv->mesh.num_verts = header->num_verts;
+    priv->mesh.format = format;
+    priv->num_materials = header->num_materials;
+    priv->materials = (void*)(priv + 1 + num_lods);
+    priv->num_lods = num_lods;
+    priv->lods = num_lods ? priv + 1 : NULL;
+
+    for(int i = 0; i < header->num_materials; i++) {
+
+        struct material *mat = &priv->materials[i];
+        mat->texture.tunit = GL_TEXTURE0 + i;
+        mat->texture.id = -1;
+        mat->atlas_layer = -1;
+        mat->ambient_intensity = mats[i].ambient;
+        mat->diffuse_clr = (vec3_t){mats[i].diffuse[0], mats[i].diffuse[1], mats[i].diffuse[2]};
+        mat->specular_clr = (vec3_t){mats[i].specular[0], mats[i].specular[1], mats[i].specular[2]};
+
+        memcpy(mat->texname, mats[i].texname, sizeof(mat->texname));
+        mat->texname[sizeof(mat->texname)-1] = '\0';
     }
+    al_load_textures(base_path, priv->materials, priv->num_materials);
 
+    al_push_init(priv, shader, verts, header->num_verts * vert_size);
+
+    for(size_t i = 0; i < num_lods; i++) {
+
+        struct render_private *lod = &priv->lods[i];
+        lod->mesh.num_verts = lod_counts[i];
+        lod->mesh.format = format;
+        lod->num_materials = priv->num_materials;
+        lod->materials = priv->materials;
+        lod->num_lods = 0;
+        lod->lods = NULL;
+        al_push_init(lod, shader, lod_verts[i], lod_counts[i] * vert_size);
+    }
+
+out:
+    for(size_t i = 0; i < num_lods; i++)
+        free(lod_verts[i]);
+    return priv;
+}
+
+void R_AL_InitAnimPalettes(void *render_private, const mat4x4_t *palettes, size_t count)
+{
     R_PushCmd((struct rcmd){
-        .func = R_GL_Init,
+        .func = R_GL_InitAnimPalettes,
         .nargs = 3,
         .args = {
-            priv,
-            (void*)shader,
-            R_PushArg(vbuff, vbuff_sz),
+            render_private,
+            (void*)palettes,
+            R_PushArg(&count, sizeof(count)),
         },
     });
+}
 
-    free(vbuff);
-    return priv;
+void R_AL_UpdateAnimPalettes(void *render_private, const mat4x4_t *palettes, 
+                             size_t offset, size_t count)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_UpdateAnimPalettes,
+        .nargs = 4,
+        .args = {
+            render_private,
+            (void*)palettes,
+            R_PushArg(&offset, sizeof(offset)),
+            R_PushArg(&count, sizeof(count)),
+        },
+    });
+}
 
-fail_parse:
-    free(vbuff);
-fail_alloc_vbuff:
-    free(priv);
-fail_alloc_priv:
-    return NULL;
+void R_AL_FreePrivate(void *render_private)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_Free,
+        .nargs = 1,
+        .args = { render_private },
+    });
 }
 
 void R_AL_DumpPrivate(FILE *stream, void *priv_data)
 {
     struct render_private *priv = priv_data;
-    struct vertex *vbuff = glMapNamedBuffer(priv->mesh.VBO, GL_READ_ONLY);
+    const char *vbuff = glMapNamedBuffer(priv->mesh.VBO, GL_READ_ONLY);
     assert(vbuff);
+    size_t vsize = R_VertSize(priv->mesh.format);
 
     /* Write verticies */
     for(int i = 0; i < priv->mesh.num_verts; i++) {
 
-        struct vertex *v = &vbuff[i];
+        struct vertex vert;
+        R_VertUnpack(priv->mesh.format, vbuff + i * vsize, &vert);
+        struct vertex *v = &vert;
 
         fprintf(stream, "v %.6f %.6f %.6f\n", v->pos.x, v->pos.y, v->pos.z); 
         fprintf(stream, "vt %.6f %.6f \n", v->uv.x, v->uv.y); 
@@ -304,59 +580,146 @@ size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t
 {
     size_t ret = 0;
 
-    ret += sizeof(struct render_private);
+    ret += sizeof(struct render_private) * (1 + CHUNK_LODS);
     ret += sizeof(struct material) * num_mats;
 
     return ret;
 }
 
-bool R_AL_InitPrivFromTiles(const struct map *map, int chunk_r, int chunk_c,
-                            const struct tile *tiles, size_t width, size_t height,
-                            void *priv_buff, const char *basedir)
-{
-    ASSERT_IN_MAIN_THREAD();
+/*
+ * Cooked chunk vertices layout:
+ *
+ *  +---------------------------------+ <-- base
+ *  | struct terrain_vert[...]        |
+ *  |    (full detail, indexed)       |
+ *  +---------------------------------+ <-- 16-byte aligned
+ *  | struct terrain_vert[...] (LOD 1)|
+ *  +---------------------------------+ <-- 16-byte aligned
+ *  | ...                             |
+ *  +---------------------------------+
+ *
+ */
 
-    size_t num_verts = VERTS_PER_TILE * (width * height);
+static size_t al_chunk_verts_off(int lod)
+{
+    size_t ret = 0;
+    for(int i = 0; i < lod; i++) {
+        size_t nverts = (i == 0) ? UNIQUE_VERTS_PER_TILE * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT
+                                 : VERTS_PER_LOD(i);
+        ret += ALIGNED(nverts * sizeof(struct terrain_vert), 16);
+    }
+    return ret;
+}
 
-    struct render_private *priv = priv_buff;
-    char *unused_base = (char*)priv_buff + sizeof(struct render_private);
-    size_t vbuff_sz = num_verts * sizeof(struct vertex);
+size_t R_AL_ChunkCookedSize(void)
+{
+    return al_chunk_verts_off(CHUNK_LODS + 1);
+}
 
-    struct vertex *vbuff = malloc(vbuff_sz);
+bool R_AL_CookChunk(const struct map *map, int chunk_r, int chunk_c, 
+                    const struct tile *tiles, void *out)
+{
+    const size_t width = TILES_PER_CHUNK_WIDTH;
+    const size_t height = TILES_PER_CHUNK_HEIGHT;
+    const size_t num_verts = UNIQUE_VERTS_PER_TILE * (width * height);
+    /* The indices are 16-bit */
+    assert(num_verts <= (1 << 16));
+    assert(VERTS_PER_LOD(1) <= num_verts);
+
+    struct vertex *vbuff = malloc(num_verts * sizeof(struct vertex));
     if(!vbuff)
-        goto fail_alloc;
-
-    priv->mesh.num_verts = num_verts;
-    priv->materials = (void*)unused_base;
-    priv->num_materials = 0;
+        return false;
 
     for(int r = 0; r < height; r++) {
     for(int c = 0; c < width;  c++) {
 
-        struct vertex *vert_base = &vbuff[ (r * width + c) * VERTS_PER_TILE ];
+        struct vertex *vert_base = &vbuff[ (r * width + c) * UNIQUE_VERTS_PER_TILE ];
         struct tile_desc td = (struct tile_desc){chunk_r, chunk_c, r, c};
         R_TileGetVertices(map, td, vert_base);
     }}
 
+    struct terrain_vert *pbuff = out;
+    R_VertPack(VERT_FORMAT_TERRAIN, vbuff, num_verts, pbuff);
+
+    /* The smoothing with the adjacent tiles is done once all the vertices of 
+     * the chunk have been packed */
+    for(int r = 0; r < height; r++) {
+    for(int c = 0; c < width;  c++) {
+
+        if(!tiles[r * width + c].blend_normals)
+            continue;
+
+        struct terrain_vert *tile_verts = &pbuff[ (r * width + c) * UNIQUE_VERTS_PER_TILE ];
+        struct tile_desc td = (struct tile_desc){chunk_r, chunk_c, r, c};
+        R_TilePatchVertsSmooth(map, &td, tile_verts);
+    }}
+
+    for(int lod = 1; lod <= CHUNK_LODS; lod++) {
+
+        R_TileGetLODVertices(tiles, lod, vbuff);
+        R_VertPack(VERT_FORMAT_TERRAIN, vbuff, VERTS_PER_LOD(lod), (char*)out + al_chunk_verts_off(lod));
+    }
+
+    free(vbuff);
+    return true;
+}
+
+void R_AL_InitPrivFromCooked(const void *cooked, void *priv_buff)
+{
+    ASSERT_IN_MAIN_THREAD();
+
     struct sval sh_setting;
     ss_e status = Settings_Get("pf.video.shadows_enabled", &sh_setting);
     assert(status == SS_OKAY);
-
     const char *shader = sh_setting.as_bool ? "terrain-shadowed" : "terrain";
-    R_PushCmd((struct rcmd){
-        .func = R_GL_Init,
-        .nargs = 3,
-        .args = {
-            priv,
-            (void*)shader,
-            R_PushArg(vbuff, vbuff_sz),
-        },
-    });
 
-    free(vbuff);
-    return true;
+    /* The decimated meshes share the materials of the full-resolution one */
+    for(int lod = 0; lod <= CHUNK_LODS; lod++) {
+
+        struct render_private *priv = (lod == 0) ? priv_buff : R_ChunkLODPriv(priv_buff, lod);
+        const size_t ntiles = TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT;
+
+        priv->mesh.format = VERT_FORMAT_TERRAIN;
+        priv->mesh.num_verts = (lod == 0) ? UNIQUE_VERTS_PER_TILE * ntiles : VERTS_PER_LOD(lod);
+        priv->mesh.num_indices = (lod == 0) ? VERTS_PER_TILE * ntiles : 0;
+        priv->materials = (lod == 0) ? (void*)((char*)priv_buff 
+                        + sizeof(struct render_private) * (1 + CHUNK_LODS)) : NULL;
+        priv->num_materials = 0;
+        priv->num_lods = 0;
+        priv->lods = NULL;
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_InitDeferred,
+            .nargs = 3,
+            .args = {
+                priv,
+                (void*)shader,
+                (char*)cooked + al_chunk_verts_off(lod),
+            },
+        });
+    }
+}
 
-fail_alloc:
-    return false;
+struct render_private *R_ChunkLODPriv(void *chunk_rprivate, int lod)
+{
+    assert(lod > 0 && lod <= CHUNK_LODS);
+    return (struct render_private*)chunk_rprivate + lod;
+}
+
+void *R_AL_ChunkLODPriv(void *chunk_rprivate, int lod)
+{
+    return R_ChunkLODPriv(chunk_rprivate, lod);
+}
+
+size_t R_AL_NumLODs(const void *render_private)
+{
+    const struct render_private *priv = render_private;
+    return priv->num_lods;
 }
 
+void *R_AL_LODPriv(void *render_private, int lod)
+{
+    struct render_private *priv = render_private;
+    assert(lod >= 0 && lod <= priv->num_lods);
+    return (lod == 0) ? priv : &priv->lods[lod - 1];
+}
@@ -40,6 +40,7 @@
 #include "../map/public/tile.h"
 
 struct vertex;
+struct terrain_vert;
 struct map;
 
 struct render_private{
@@ -48,9 +49,48 @@ struct render_private{
     struct material    *materials;
     GLuint              shader_prog;
     GLuint              shader_prog_dp; /* for the depth pass */
+    GLuint              mat_UBO;        /* 'materials' uniform block, 0 if unused */
+    /* The baked skinning matrices of all the animation frames, 0 if unused */
+    GLuint              anim_buff;
+    GLuint              anim_tex;
+    /* Vertices which are uploaded when the mesh is first used, at which 
+     * point the buffers are created. NULL once the GPU copy has diverged 
+     * from them, or if the mesh was uploaded right away. */
+    const void         *cooked_verts;
+    /* The decimated meshes of an entity's model, from the most detailed 
+     * down. They directly follow its' own render private and share its' 
+     * materials and baked palettes. */
+    size_t                 num_lods;
+    struct render_private *lods;
 };
 
+/* Terrain chunks are drawn indexed, with each tile owning a fixed range of 
+ * the vertex buffer. The 'VERTS_PER_TILE' triangle vertices of a tile refer 
+ * to these unique ones. */
+#define UNIQUE_VERTS_PER_SIDE_FACE  (4)
+#define UNIQUE_VERTS_PER_TOP_FACE   (16)
+#define UNIQUE_VERTS_PER_TILE       (4 * UNIQUE_VERTS_PER_SIDE_FACE + UNIQUE_VERTS_PER_TOP_FACE)
+
+/* The decimated chunk meshes are a heightfield with one quad per block of 
+ * tiles, plus a skirt hanging down from each edge of the chunk to hide the 
+ * cracks where they meet chunks of a different level of detail. */
+#define LOD_STEP(lod)       (1 << (lod))
+#define LOD_COLS(lod)       (TILES_PER_CHUNK_WIDTH  / LOD_STEP(lod))
+#define LOD_ROWS(lod)       (TILES_PER_CHUNK_HEIGHT / LOD_STEP(lod))
+#define VERTS_PER_LOD(lod)  (6 * LOD_COLS(lod) * LOD_ROWS(lod) + 12 * (LOD_COLS(lod) + LOD_ROWS(lod)))
+
 /* Tile */
+/* Writes the UNIQUE_VERTS_PER_TILE vertices of the tile */
 void R_TileGetVertices(const struct map *map, struct tile_desc td, struct vertex *out);
+/* Writes the VERTS_PER_TILE indices of the tile, whose vertices start 
+ * at (tile_idx * UNIQUE_VERTS_PER_TILE) */
+void R_TileGetIndices(int tile_idx, GLushort *out);
+void R_TileGetLODVertices(const struct tile *chunk_tiles, int lod, struct vertex *out);
+/* Set the smoothed normals of the tile's packed vertices, which depend on 
+ * the adjacent tiles */
+void R_TilePatchVertsSmooth(const struct map *map, const struct tile_desc *tile, 
+                            struct terrain_vert *tile_verts_base);
+/* The render privates of a chunk's decimated meshes directly follow its' own */
+struct render_private *R_ChunkLODPriv(void *chunk_rprivate, int lod);
 
 #endif
@@ -0,0 +1,301 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "sched.h"
+#include "config.h"
+#include "main.h"
+#include "perf.h"
+#include "lib/public/queue.h"
+
+#include <assert.h>
+
+
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+
+struct queued_job{
+    struct job          job;
+    struct job_counter *ctr;
+};
+
+struct parallel_for{
+    /* The first element of the next range to be claimed */
+    SDL_atomic_t next;
+    size_t       n;
+    size_t       grain;
+    range_func_t func;
+    void        *arg;
+};
+
+QUEUE_TYPE(job, struct queued_job)
+QUEUE_IMPL(static, job, struct queued_job)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static SDL_Thread  *s_workers[CONFIG_SCHED_MAX_WORKERS];
+static size_t       s_nworkers = 0;
+
+/* Protects the job queue and the 'quit' flag. The 'work' condition is 
+ * signalled when new jobs are queued, and the 'done' condition is 
+ * broadcast every time a batch of jobs is completed. 
+ */
+static SDL_mutex   *s_lock;
+static SDL_cond    *s_work_cond;
+static SDL_cond    *s_done_cond;
+static queue(job)   s_queue;
+static bool         s_quit = false;
+/* Incremented for as long as the main thread is waiting on a parallel-for */
+static SDL_atomic_t s_main_blocked;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void sched_run_job(struct queued_job *qj)
+{
+    PERF_PUSH("job");
+    qj->job.func(qj->job.arg);
+    PERF_POP();
+
+    if(SDL_AtomicAdd(&qj->ctr->remaining, -1) == 1) {
+        SDL_LockMutex(s_lock);
+        SDL_CondBroadcast(s_done_cond);
+        SDL_UnlockMutex(s_lock);
+    }
+}
+
+static void sched_parallel_for_job(void *arg)
+{
+    struct parallel_for *pf = arg;
+
+    while(true) {
+
+        size_t begin = SDL_AtomicAdd(&pf->next, pf->grain);
+        if(begin >= pf->n)
+            break;
+        pf->func(begin, MIN(begin + pf->grain, pf->n), pf->arg);
+    }
+}
+
+static int sched_worker_main(void *arg)
+{
+    (void)arg;
+    Perf_RegisterThread("worker");
+
+    while(true) {
+
+        struct queued_job qj;
+
+        SDL_LockMutex(s_lock);
+        while(queue_size(s_queue) == 0 && !s_quit)
+            SDL_CondWait(s_work_cond, s_lock);
+
+        if(queue_size(s_queue) == 0) {
+            assert(s_quit);
+            SDL_UnlockMutex(s_lock);
+            break;
+        }
+
+        queue_job_pop(&s_queue, &qj);
+        SDL_UnlockMutex(s_lock);
+
+        sched_run_job(&qj);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Sched_Init(void)
+{
+    if(!queue_job_init(&s_queue, 256))
+        goto fail_queue;
+
+    if(NULL == (s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+
+    if(NULL == (s_work_cond = SDL_CreateCond()))
+        goto fail_work_cond;
+
+    if(NULL == (s_done_cond = SDL_CreateCond()))
+        goto fail_done_cond;
+
+    /* Leave one core for the main thread and another for the render thread */
+    int ncores = SDL_GetCPUCount();
+    size_t target = MIN(MAX(ncores - 2, 1), CONFIG_SCHED_MAX_WORKERS);
+
+    s_quit = false;
+    s_nworkers = 0;
+    for(int i = 0; i < target; i++) {
+
+        SDL_Thread *thread = SDL_CreateThread(sched_worker_main, "worker", NULL);
+        if(!thread)
+            break;
+        s_workers[s_nworkers++] = thread;
+    }
+    return true;
+
+fail_done_cond:
+    SDL_DestroyCond(s_work_cond);
+fail_work_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    queue_job_destroy(&s_queue);
+fail_queue:
+    return false;
+}
+
+void Sched_Shutdown(void)
+{
+    SDL_LockMutex(s_lock);
+    s_quit = true;
+    SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+
+    for(int i = 0; i < s_nworkers; i++) {
+        SDL_WaitThread(s_workers[i], NULL);
+    }
+    s_nworkers = 0;
+
+    SDL_DestroyCond(s_done_cond);
+    SDL_DestroyCond(s_work_cond);
+    SDL_DestroyMutex(s_lock);
+    queue_job_destroy(&s_queue);
+}
+
+void Sched_Submit(const struct job *jobs, size_t njobs, struct job_counter *ctr)
+{
+    SDL_AtomicSet(&ctr->remaining, njobs);
+    if(njobs == 0)
+        return;
+
+    size_t nqueued = 0;
+    if(s_nworkers > 0) {
+
+        SDL_LockMutex(s_lock);
+        for(; nqueued < njobs; nqueued++) {
+
+            struct queued_job qj = (struct queued_job){jobs[nqueued], ctr};
+            if(!queue_job_push(&s_queue, &qj))
+                break;
+        }
+        SDL_CondBroadcast(s_work_cond);
+        SDL_UnlockMutex(s_lock);
+    }
+
+    /* Anything that couldn't be handed off gets run synchronously */
+    for(int i = nqueued; i < njobs; i++) {
+
+        struct queued_job qj = (struct queued_job){jobs[i], ctr};
+        sched_run_job(&qj);
+    }
+}
+
+void Sched_Wait(struct job_counter *ctr)
+{
+    SDL_LockMutex(s_lock);
+    while(SDL_AtomicGet(&ctr->remaining) > 0) {
+
+        struct queued_job qj;
+        if(queue_job_pop(&s_queue, &qj)) {
+
+            SDL_UnlockMutex(s_lock);
+            sched_run_job(&qj);
+            SDL_LockMutex(s_lock);
+            continue;
+        }
+        SDL_CondWait(s_done_cond, s_lock);
+    }
+    SDL_UnlockMutex(s_lock);
+}
+
+void Sched_ParallelFor(size_t n, size_t grain, range_func_t func, void *arg)
+{
+    if(n == 0)
+        return;
+
+    grain = MAX(grain, 1);
+    size_t nranges = (n + grain - 1) / grain;
+    size_t njobs = MIN(s_nworkers + 1, nranges);
+
+    if(njobs == 1) {
+        func(0, n, arg);
+        return;
+    }
+
+    struct parallel_for pf = (struct parallel_for){
+        .n = n,
+        .grain = grain,
+        .func = func,
+        .arg = arg,
+    };
+    SDL_AtomicSet(&pf.next, 0);
+
+    struct job jobs[njobs];
+    for(int i = 0; i < njobs; i++) {
+        jobs[i] = (struct job){sched_parallel_for_job, &pf};
+    }
+
+    bool main = (SDL_ThreadID() == g_main_thread_id);
+    if(main)
+        SDL_AtomicAdd(&s_main_blocked, 1);
+
+    struct job_counter ctr;
+    Sched_Submit(jobs, njobs, &ctr);
+    Sched_Wait(&ctr);
+
+    if(main)
+        SDL_AtomicAdd(&s_main_blocked, -1);
+}
+
+bool Sched_MainThreadBlocked(void)
+{
+    return (SDL_AtomicGet(&s_main_blocked) > 0);
+}
+
+bool Sched_Done(struct job_counter *ctr)
+{
+    return (SDL_AtomicGet(&ctr->remaining) == 0);
+}
+
+size_t Sched_NumWorkers(void)
+{
+    return s_nworkers;
+}
+
@@ -0,0 +1,120 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <SDL.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* A simple pool of worker threads for offloading independent, CPU-bound
+ * work from the main thread. Jobs must not touch any state that is not
+ * safe to access concurrently with the main thread (ex. caches, the 
+ * event system, the Python interpreter). 
+ */
+
+typedef void (*job_func_t)(void *arg);
+/* Processes the elements in the range [begin, end) */
+typedef void (*range_func_t)(size_t begin, size_t end, void *arg);
+
+struct job{
+    job_func_t func;
+    void      *arg;
+};
+
+/* Tracks the completion of a batch of jobs. Owned by the submitter. */
+struct job_counter{
+    SDL_atomic_t remaining;
+};
+
+/* ------------------------------------------------------------------------
+ * Start up the worker threads.
+ * ------------------------------------------------------------------------
+ */
+bool   Sched_Init(void);
+
+/* ------------------------------------------------------------------------
+ * Stop and join all worker threads. Pending jobs are run to completion.
+ * ------------------------------------------------------------------------
+ */
+void   Sched_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Queue up 'njobs' jobs for execution by the worker threads. The 'jobs'
+ * array may be freed after the call returns, but the job arguments must 
+ * remain valid until the counter reaches zero. If there are no workers 
+ * or the queue is full, the jobs are executed on the calling thread.
+ * ------------------------------------------------------------------------
+ */
+void   Sched_Submit(const struct job *jobs, size_t njobs, struct job_counter *ctr);
+
+/* ------------------------------------------------------------------------
+ * Block until all the jobs associated with the counter have completed.
+ * The calling thread will help execute queued jobs while it waits.
+ * ------------------------------------------------------------------------
+ */
+void   Sched_Wait(struct job_counter *ctr);
+
+/* ------------------------------------------------------------------------
+ * Returns true if all the jobs associated with the counter have completed.
+ * ------------------------------------------------------------------------
+ */
+bool   Sched_Done(struct job_counter *ctr);
+
+/* ------------------------------------------------------------------------
+ * Invoke 'func' over the range [0, n), split into ranges of 'grain' 
+ * elements, and wait for it to be done. The workers and the caller all 
+ * keep claiming the next unprocessed range until there are none left, so 
+ * an uneven workload is balanced out between them. 
+ * ------------------------------------------------------------------------
+ */
+void   Sched_ParallelFor(size_t n, size_t grain, range_func_t func, void *arg);
+
+/* ------------------------------------------------------------------------
+ * Returns true if the main thread is blocked waiting on a parallel-for. 
+ * While it is, the jobs may read (but not write) the main thread's state.
+ * ------------------------------------------------------------------------
+ */
+bool   Sched_MainThreadBlocked(void);
+
+/* ------------------------------------------------------------------------
+ * Returns the number of worker threads (not including the caller).
+ * ------------------------------------------------------------------------
+ */
+size_t Sched_NumWorkers(void);
+
+#endif
+
@@ -39,6 +39,7 @@
 #include "../../scene.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 /* 'Handle' type to let the rest of the engine hold on to scripting objects 
@@ -55,18 +56,32 @@ struct nk_context;
 bool            S_Init(char *progname, const char *base_path, struct nk_context *ctx);
 void            S_Shutdown(void);
 bool            S_RunFile(const char *path);
+/* Release the interpreter lock around long blocking waits on the main thread, 
+ * so that the AI script workers get to run. No scripting calls may be made 
+ * in between. */
+void            S_BeginAllowThreads(void);
+void            S_EndAllowThreads(void);
 
-void            S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, 
+/* The time taken by each handler is accounted to the (callable, event) pair */
+void            S_RunEventHandler(int event, script_opaque_t callable, script_opaque_t user_arg, 
                                   void *event_arg);
+/* The total time spent in event handlers so far, in performance counter units */
+uint64_t        S_EventHandlerTicks(void);
 
 /* Decrement reference count for Python objects. 
  * No-op in the case of a NULL-pointer passed in */
 void            S_Release(script_opaque_t obj);
 script_opaque_t S_WrapEngineEventArg(int eventnum, void *arg);
+/* Builds a tuple of (entity, arg) pairs. The references to the args are 
+ * stolen. Entities which no longer exist are given as None. */
+script_opaque_t S_BuildEventBatch(size_t nevents, const uint32_t *uids, script_opaque_t *args);
 /* Returns 'arg' if this is not a weakref object. Otherwise, return a borrowed
  * reference extracted from the weakref. */
 script_opaque_t S_UnwrapIfWeakref(script_opaque_t arg);
 bool            S_ObjectsEqual(script_opaque_t a, script_opaque_t b);
+/* Sends a global event with the argument decoded from a replay recording of 
+ * an event sent by a script. Returns false if the argument is malformed. */
+bool            S_NotifyEncodedEvent(int event, const void *data, size_t size);
 
 /*###########################################################################*/
 /* SCRIPT UI                                                                 */
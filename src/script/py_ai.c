@@ -0,0 +1,535 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "py_ai.h"
+#include "../game/public/game.h"
+#include "../lib/public/vec.h"
+#include "../entity.h"
+#include "../event.h"
+#include "../main.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX_WORKERS     (MAX_FACTIONS)
+#define RECORD_FORMAT   "<IiffiI"
+
+/* The layout of one entity in the world snapshot, which the scripts unpack 
+ * with the 'struct' module using RECORD_FORMAT */
+struct ai_record{
+    uint32_t uid;
+    int32_t  faction_id;
+    float    x, z;
+    int32_t  hp;
+    uint32_t flags;
+};
+
+enum ai_order_type{
+    AI_ORDER_MOVE,
+    AI_ORDER_STOP,
+    AI_ORDER_STANCE,
+};
+
+struct ai_order{
+    enum ai_order_type type;
+    uint32_t           uid;
+    vec2_t             xz;
+    int                stance;
+};
+
+struct ai_snapshot{
+    uint32_t          tick;
+    size_t            count;
+    size_t            cap;
+    struct ai_record *records;
+};
+
+VEC_TYPE(order, struct ai_order)
+VEC_IMPL(static inline, order, struct ai_order)
+
+/* The snapshots are triple-buffered: the main thread writes to 'write', then 
+ * swaps it with 'ready'. The worker swaps 'ready' with the one it reads from, 
+ * so that neither side waits on the other to finish using a buffer. */
+struct ai_worker{
+    bool               in_use;
+    int                faction_id;
+    char               path[512];
+    SDL_Thread        *thread;
+    SDL_mutex         *lock;
+    SDL_cond          *cond;
+    bool               quit;
+    bool               fresh;
+    struct ai_snapshot snapshots[3];
+    int                write, ready, read;
+    /* Filled by the worker and drained by the main thread, under the lock */
+    vec_order_t        orders;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct ai_worker s_workers[MAX_WORKERS];
+static uint32_t         s_tick;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void ai_push_order(struct ai_worker *worker, struct ai_order order)
+{
+    SDL_LockMutex(worker->lock);
+    vec_order_push(&worker->orders, order);
+    SDL_UnlockMutex(worker->lock);
+}
+
+static struct ai_worker *ai_worker_for_self(PyObject *self)
+{
+    return PyCapsule_GetPointer(self, "pfai.worker");
+}
+
+static PyObject *PyAI_move(PyObject *self, PyObject *args)
+{
+    unsigned int uid;
+    float x, z;
+
+    if(!PyArg_ParseTuple(args, "I(ff)", &uid, &x, &z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an entity UID and a tuple of two floats.");
+        return NULL;
+    }
+
+    ai_push_order(ai_worker_for_self(self), (struct ai_order){
+        .type = AI_ORDER_MOVE,
+        .uid = uid,
+        .xz = (vec2_t){x, z},
+    });
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyAI_stop(PyObject *self, PyObject *args)
+{
+    unsigned int uid;
+
+    if(!PyArg_ParseTuple(args, "I", &uid)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an entity UID.");
+        return NULL;
+    }
+
+    ai_push_order(ai_worker_for_self(self), (struct ai_order){
+        .type = AI_ORDER_STOP,
+        .uid = uid,
+    });
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyAI_set_stance(PyObject *self, PyObject *args)
+{
+    unsigned int uid;
+    int stance;
+
+    if(!PyArg_ParseTuple(args, "Ii", &uid, &stance)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an entity UID and an integer.");
+        return NULL;
+    }
+
+    if(stance != COMBAT_STANCE_AGGRESSIVE
+    && stance != COMBAT_STANCE_HOLD_POSITION
+    && stance != COMBAT_STANCE_NO_ENGAGEMENT) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid stance.");
+        return NULL;
+    }
+
+    ai_push_order(ai_worker_for_self(self), (struct ai_order){
+        .type = AI_ORDER_STANCE,
+        .uid = uid,
+        .stance = stance,
+    });
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pfai_methods[] = {
+
+    {"move",
+    (PyCFunction)PyAI_move, METH_VARARGS,
+    "Orders the entity with the specified UID to move to the (X, Z) position. The order is "
+    "issued at the start of the next frame."},
+
+    {"stop",
+    (PyCFunction)PyAI_stop, METH_VARARGS,
+    "Orders the entity with the specified UID to stop."},
+
+    {"set_stance",
+    (PyCFunction)PyAI_set_stance, METH_VARARGS,
+    "Sets the combat stance of the entity with the specified UID."},
+
+    {NULL}  /* Sentinel */
+};
+
+static bool ai_init_module(struct ai_worker *worker)
+{
+    PyObject *self = PyCapsule_New(worker, "pfai.worker", NULL);
+    if(!self)
+        return false;
+
+    PyObject *module = Py_InitModule4("pfai", pfai_methods, 
+        "Orders and world state for the AI scripts running in a worker.", self, PYTHON_API_VERSION);
+    Py_DECREF(self);
+    if(!module)
+        return false;
+
+    PyModule_AddIntConstant(module, "COMBAT_STANCE_AGGRESSIVE", COMBAT_STANCE_AGGRESSIVE);
+    PyModule_AddIntConstant(module, "COMBAT_STANCE_HOLD_POSITION", COMBAT_STANCE_HOLD_POSITION);
+    PyModule_AddIntConstant(module, "COMBAT_STANCE_NO_ENGAGEMENT", COMBAT_STANCE_NO_ENGAGEMENT);
+    PyModule_AddIntConstant(module, "FACTION_ID", worker->faction_id);
+    PyModule_AddStringConstant(module, "RECORD_FORMAT", RECORD_FORMAT);
+    PyModule_AddIntConstant(module, "RECORD_SIZE", sizeof(struct ai_record));
+    return true;
+}
+
+static bool ai_sys_path_add_dir(const char *path)
+{
+    char dir[512];
+    strcpy(dir, path);
+
+    char *end = strrchr(dir, '/');
+    if(!end)
+        return true;
+    *end = '\0';
+
+    PyObject *sys_path = PySys_GetObject("path");
+    PyObject *str = PyString_FromString(dir);
+    bool ret = str && (0 == PyList_Append(sys_path, str));
+    Py_XDECREF(str);
+    return ret;
+}
+
+/* Runs the script, which must define a 'plan(tick, snapshot)' function. The 
+ * snapshot is an immutable string of packed records, one per entity. */
+static PyObject *ai_load_script(struct ai_worker *worker)
+{
+    if(!ai_init_module(worker) || !ai_sys_path_add_dir(worker->path))
+        return NULL;
+
+    FILE *file = fopen(worker->path, "r");
+    if(!file) {
+        fprintf(stderr, "AI worker: could not open script: %s\n", worker->path);
+        return NULL;
+    }
+
+    PyObject *globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+    PyObject *result = PyRun_File(file, worker->path, Py_file_input, globals, globals);
+    fclose(file);
+
+    if(!result) {
+        PyErr_Print();
+        return NULL;
+    }
+    Py_DECREF(result);
+
+    PyObject *plan = PyDict_GetItemString(globals, "plan");
+    if(!plan || !PyCallable_Check(plan)) {
+        fprintf(stderr, "AI worker: script does not define a 'plan' function: %s\n", worker->path);
+        return NULL;
+    }
+    Py_INCREF(plan);
+    return plan;
+}
+
+/* Returns false when the worker is told to quit. Called without the GIL. */
+static bool ai_wait_snapshot(struct ai_worker *worker)
+{
+    SDL_LockMutex(worker->lock);
+    while(!worker->quit && !worker->fresh) {
+        SDL_CondWait(worker->cond, worker->lock);
+    }
+
+    bool ret = !worker->quit;
+    if(ret) {
+        int tmp = worker->read;
+        worker->read = worker->ready;
+        worker->ready = tmp;
+        worker->fresh = false;
+    }
+    SDL_UnlockMutex(worker->lock);
+    return ret;
+}
+
+static int ai_thread_func(void *arg)
+{
+    struct ai_worker *worker = arg;
+
+    PyEval_AcquireLock();
+    PyThreadState *tstate = Py_NewInterpreter();
+    if(!tstate) {
+        PyEval_ReleaseLock();
+        return -1;
+    }
+
+    PyObject *plan = ai_load_script(worker);
+    while(plan) {
+
+        bool proceed;
+        Py_BEGIN_ALLOW_THREADS
+        proceed = ai_wait_snapshot(worker);
+        Py_END_ALLOW_THREADS
+
+        if(!proceed)
+            break;
+
+        const struct ai_snapshot *snap = &worker->snapshots[worker->read];
+        PyObject *result = PyObject_CallFunction(plan, "Is#", snap->tick, 
+            (const char*)snap->records, (int)(snap->count * sizeof(struct ai_record)));
+
+        /* An exception only takes down this worker's plan for this frame */
+        if(!result) {
+            PyErr_Print();
+        }
+        Py_XDECREF(result);
+    }
+
+    Py_XDECREF(plan);
+    Py_EndInterpreter(tstate);
+    PyEval_ReleaseLock();
+    return 0;
+}
+
+static void ai_issue_orders(struct ai_worker *worker, vec_order_t *orders)
+{
+    for(int i = 0; i < vec_size(orders); i++) {
+
+        const struct ai_order *order = &vec_AT(orders, i);
+        struct entity *ent = G_EntityForUID(order->uid);
+
+        /* The workers are isolated to the entities of their own faction */
+        if(!ent || ent->faction_id != worker->faction_id)
+            continue;
+        if(ent->flags & ENTITY_FLAG_ZOMBIE)
+            continue;
+
+        switch(order->type) {
+        case AI_ORDER_MOVE:
+            if(!(ent->flags & ENTITY_FLAG_STATIC))
+                G_Replay_CmdMove(ent, order->xz);
+            break;
+        case AI_ORDER_STOP:
+            G_Replay_CmdStop(ent);
+            break;
+        case AI_ORDER_STANCE:
+            if(ent->flags & ENTITY_FLAG_COMBATABLE)
+                G_Replay_CmdStance(ent, order->stance);
+            break;
+        default: assert(0);
+        }
+    }
+}
+
+static bool ai_fill_snapshot(struct ai_snapshot *snap, const vec_pentity_t *ents)
+{
+    size_t count = vec_size(ents);
+    if(count > snap->cap) {
+        void *records = realloc(snap->records, count * sizeof(struct ai_record));
+        if(!records)
+            return false;
+        snap->records = records;
+        snap->cap = count;
+    }
+
+    size_t nout = 0;
+    for(int i = 0; i < count; i++) {
+
+        const struct entity *ent = vec_AT(ents, i);
+        if(ent->flags & ENTITY_FLAG_ZOMBIE)
+            continue;
+
+        vec2_t pos = G_Pos_GetXZ(ent->uid);
+        snap->records[nout++] = (struct ai_record){
+            .uid = ent->uid,
+            .faction_id = ent->faction_id,
+            .x = pos.x,
+            .z = pos.z,
+            .hp = (ent->flags & ENTITY_FLAG_COMBATABLE) ? G_Combat_GetCurrentHP(ent) : 0,
+            .flags = ent->flags,
+        };
+    }
+    snap->count = nout;
+    snap->tick = s_tick;
+    return true;
+}
+
+static void on_update_start(void *user, void *event)
+{
+    const vec_pentity_t *ents = G_GetActiveEntities();
+    vec_order_t orders;
+    vec_order_init(&orders);
+
+    for(int i = 0; i < MAX_WORKERS; i++) {
+
+        struct ai_worker *worker = &s_workers[i];
+        if(!worker->in_use)
+            continue;
+
+        SDL_LockMutex(worker->lock);
+        vec_order_t tmp = worker->orders;
+        worker->orders = orders;
+        orders = tmp;
+        SDL_UnlockMutex(worker->lock);
+
+        ai_issue_orders(worker, &orders);
+        vec_order_reset(&orders);
+
+        struct ai_snapshot *snap = &worker->snapshots[worker->write];
+        if(!ai_fill_snapshot(snap, ents))
+            continue;
+
+        SDL_LockMutex(worker->lock);
+        int tmp_idx = worker->ready;
+        worker->ready = worker->write;
+        worker->write = tmp_idx;
+        worker->fresh = true;
+        SDL_CondSignal(worker->cond);
+        SDL_UnlockMutex(worker->lock);
+    }
+
+    vec_order_destroy(&orders);
+    s_tick++;
+}
+
+static void ai_worker_free(struct ai_worker *worker)
+{
+    for(int i = 0; i < 3; i++) {
+        free(worker->snapshots[i].records);
+    }
+    vec_order_destroy(&worker->orders);
+    if(worker->cond)
+        SDL_DestroyCond(worker->cond);
+    if(worker->lock)
+        SDL_DestroyMutex(worker->lock);
+    memset(worker, 0, sizeof(*worker));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_AI_Init(void)
+{
+    memset(s_workers, 0, sizeof(s_workers));
+    s_tick = 0;
+    return E_Global_Register(EVENT_UPDATE_START, on_update_start, NULL, G_RUNNING);
+}
+
+void S_AI_Shutdown(void)
+{
+    for(int i = 0; i < MAX_WORKERS; i++) {
+        if(s_workers[i].in_use)
+            S_AI_Stop(i);
+    }
+    E_Global_Unregister(EVENT_UPDATE_START, on_update_start);
+}
+
+int S_AI_Spawn(const char *path, int faction_id)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(strlen(path) >= sizeof(s_workers[0].path)) {
+        PyErr_SetString(PyExc_RuntimeError, "The script path is too long.");
+        return -1;
+    }
+
+    int id = -1;
+    for(int i = 0; i < MAX_WORKERS; i++) {
+        if(!s_workers[i].in_use) {
+            id = i;
+            break;
+        }
+    }
+
+    if(id < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Too many AI workers.");
+        return -1;
+    }
+
+    struct ai_worker *worker = &s_workers[id];
+    worker->faction_id = faction_id;
+    strcpy(worker->path, path);
+    worker->write = 0;
+    worker->ready = 1;
+    worker->read = 2;
+    vec_order_init(&worker->orders);
+
+    worker->lock = SDL_CreateMutex();
+    worker->cond = SDL_CreateCond();
+    if(!worker->lock || !worker->cond)
+        goto fail;
+
+    worker->thread = SDL_CreateThread(ai_thread_func, "ai_worker", worker);
+    if(!worker->thread)
+        goto fail;
+
+    worker->in_use = true;
+    return id;
+
+fail:
+    ai_worker_free(worker);
+    PyErr_SetString(PyExc_RuntimeError, "Could not start the AI worker thread.");
+    return -1;
+}
+
+bool S_AI_Stop(int id)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(id < 0 || id >= MAX_WORKERS || !s_workers[id].in_use)
+        return false;
+
+    struct ai_worker *worker = &s_workers[id];
+    SDL_LockMutex(worker->lock);
+    worker->quit = true;
+    SDL_CondSignal(worker->cond);
+    SDL_UnlockMutex(worker->lock);
+
+    /* The worker needs the GIL to tear down its' interpreter */
+    Py_BEGIN_ALLOW_THREADS
+    SDL_WaitThread(worker->thread, NULL);
+    Py_END_ALLOW_THREADS
+
+    ai_worker_free(worker);
+    return true;
+}
+
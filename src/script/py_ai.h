@@ -0,0 +1,56 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PY_AI_H
+#define PY_AI_H
+
+#include <Python.h> /* must be first */
+
+#include <stdbool.h>
+
+/* AI workers run a script in their own sub-interpreter, on their own thread. 
+ * Once per frame, at the start of the update, the orders that the workers 
+ * queued up are issued and a new snapshot of the world is published to them. 
+ * The workers only get to run while the main thread has released the GIL. */
+bool S_AI_Init(void);
+void S_AI_Shutdown(void);
+
+/* Returns the ID of the new worker, which only controls the entities of 
+ * 'faction_id', or -1 on failure, with a Python exception set. */
+int  S_AI_Spawn(const char *path, int faction_id);
+bool S_AI_Stop(int id);
+
+#endif
+
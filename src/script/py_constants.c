@@ -34,6 +34,7 @@
  */
 
 #include "py_constants.h"
+#include "py_save.h"
 #include "../lib/public/pf_nuklear.h"
 #include "../event.h"
 #include "../config.h"
@@ -43,6 +44,7 @@
 #include "../anim/public/anim.h"
 #include "../main.h"
 #include "../ui.h"
+#include "../asset_load.h"
 
 #include <SDL.h>
 
@@ -427,6 +429,7 @@ static void s_expose_event_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, EVENT_ATTACK_START);
     PY_EXPOSE_ENUM(module, EVENT_ATTACK_END);
     PY_EXPOSE_ENUM(module, EVENT_ENTITY_DEATH);
+    PY_EXPOSE_ENUM(module, EVENT_PROJECTILE_HITS);
     PY_EXPOSE_ENUM(module, EVENT_ENGINE_LAST);
 }
 
@@ -448,6 +451,7 @@ static void s_expose_map_constants(PyObject *module)
 
     PY_EXPOSE_ENUM(module, TILES_PER_CHUNK_WIDTH);
     PY_EXPOSE_ENUM(module, TILES_PER_CHUNK_HEIGHT);
+    PyModule_AddIntConstant(module, "NAV_TILES_PER_CHUNK", CONFIG_NAV_FIELD_RES);
 
     PY_EXPOSE_ENUM(module, BLEND_MODE_NOBLEND);
     PY_EXPOSE_ENUM(module, BLEND_MODE_BLUR);
@@ -468,6 +472,10 @@ static void s_expose_game_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, G_RUNNING);
     PY_EXPOSE_ENUM(module, G_PAUSED_FULL);
     PY_EXPOSE_ENUM(module, G_PAUSED_UI_RUNNING);
+
+    PY_EXPOSE_ENUM(module, MOVE_CROWD_AUTO);
+    PY_EXPOSE_ENUM(module, MOVE_CROWD_ALWAYS);
+    PY_EXPOSE_ENUM(module, MOVE_CROWD_NEVER);
 }
 
 static void s_expose_anim_constants(PyObject *module)
@@ -484,6 +492,21 @@ static void s_expose_engine_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, PF_WF_WINDOW);
 }
 
+static void s_expose_asset_constants(PyObject *module)
+{
+    PY_EXPOSE_ENUM(module, AL_PENDING);
+    PY_EXPOSE_ENUM(module, AL_READY);
+    PY_EXPOSE_ENUM(module, AL_FAILED);
+}
+
+static void s_expose_save_constants(PyObject *module)
+{
+    PY_EXPOSE_ENUM(module, SAVE_IDLE);
+    PY_EXPOSE_ENUM(module, SAVE_IN_PROGRESS);
+    PY_EXPOSE_ENUM(module, SAVE_SUCCEEDED);
+    PY_EXPOSE_ENUM(module, SAVE_FAILED);
+}
+
 static void s_expose_ui_constants(PyObject *module)
 {
     PY_EXPOSE_ENUM(module, ANCHOR_X_LEFT);
@@ -511,5 +534,7 @@ void S_Constants_Expose(PyObject *module)
     s_expose_anim_constants(module);
     s_expose_engine_constants(module);
     s_expose_ui_constants(module);
+    s_expose_asset_constants(module);
+    s_expose_save_constants(module);
 }
 
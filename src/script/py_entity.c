@@ -43,6 +43,32 @@
 #include "../lib/public/khash.h"
 
 #include <assert.h>
+#include <string.h>
+
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+/* The most entities returned by a single spatial query */
+#define MAX_QUERY_ENTS  (4096)
+#define PICKLE_VERSION  (1)
+
+/* The native part of a pickled entity. The saved UID is only used to 
+ * match the entity up with the native sections of a save - the entity is 
+ * recreated with a new one. */
+struct ent_record{
+    uint32_t          uid;
+    uint32_t          flags;
+    char              name[32];
+    char              basedir[64];
+    char              filename[32];
+    vec3_t            scale;
+    quat_t            rotation;
+    float             selection_radius;
+    float             max_speed;
+    int32_t           faction_id;
+    float             vision_range;
+    int32_t           max_hp;
+    struct anim_saved anim;
+};
 
 typedef struct {
     PyObject_HEAD
@@ -79,6 +105,8 @@ static PyObject *PyEntity_get_speed(PyEntityObject *self, void *closure);
 static int       PyEntity_set_speed(PyEntityObject *self, PyObject *value, void *closure);
 static PyObject *PyEntity_get_faction_id(PyEntityObject *self, void *closure);
 static int       PyEntity_set_faction_id(PyEntityObject *self, PyObject *value, void *closure);
+static PyObject *PyEntity_get_vision_range(PyEntityObject *self, void *closure);
+static int       PyEntity_set_vision_range(PyEntityObject *self, PyObject *value, void *closure);
 static PyObject *PyEntity_activate(PyEntityObject *self);
 static PyObject *PyEntity_deactivate(PyEntityObject *self);
 static PyObject *PyEntity_register(PyEntityObject *self, PyObject *args);
@@ -88,6 +116,7 @@ static PyObject *PyEntity_select(PyEntityObject *self);
 static PyObject *PyEntity_deselect(PyEntityObject *self);
 static PyObject *PyEntity_stop(PyEntityObject *self);
 static PyObject *PyEntity_move(PyEntityObject *self, PyObject *args);
+static PyObject *PyEntity_set_crowd_mode(PyEntityObject *self, PyObject *args);
 
 static int       PyAnimEntity_init(PyAnimEntityObject *self, PyObject *args, PyObject *kwds);
 static PyObject *PyAnimEntity_del(PyAnimEntityObject *self);
@@ -157,6 +186,12 @@ static PyMethodDef PyEntity_methods[] = {
     (PyCFunction)PyEntity_move, METH_VARARGS,
     "Issues a 'move' order to the entity at the XZ position specified by the argument."},
 
+    {"set_crowd_mode", 
+    (PyCFunction)PyEntity_set_crowd_mode, METH_VARARGS,
+    "Selects how the members of the group that the entity is currently moving with avoid "
+    "collisions: one of MOVE_CROWD_AUTO, MOVE_CROWD_ALWAYS or MOVE_CROWD_NEVER. The setting "
+    "lasts until the group arrives or is disbanded."},
+
     {NULL}  /* Sentinel */
 };
 
@@ -197,6 +232,11 @@ static PyGetSetDef PyEntity_getset[] = {
     (getter)PyEntity_get_faction_id, (setter)PyEntity_set_faction_id,
     "Index of the faction that the entity belongs to.",
     NULL},
+    {"vision_range",
+    (getter)PyEntity_get_vision_range, (setter)PyEntity_set_vision_range,
+    "Radius (in OpenGL coordinates) around the entity that is revealed to its' faction in the "
+    "fog of war. 0 for entities without vision.",
+    NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -384,6 +424,89 @@ static PyObject *PyEntity_del(PyEntityObject *self)
     return s_super_del((PyObject*)self, &PyEntity_type);
 }
 
+/* The combat stats of inactive entities are kept in their' dictionary, from 
+ * where they are restored on activation. */
+static void s_load_combat_stats(PyEntityObject *self)
+{
+    if(!(self->ent->flags & ENTITY_FLAG_COMBATABLE))
+        return;
+
+    PyObject *obj = PyDict_GetItemString(self->dict, "base_dmg");
+    assert(obj && PyInt_Check(obj));
+    G_Combat_SetBaseDamage(self->ent, PyInt_AS_LONG(obj));
+
+    obj = PyDict_GetItemString(self->dict, "base_armour");
+    assert(obj && PyFloat_Check(obj));
+    G_Combat_SetBaseArmour(self->ent, PyFloat_AS_DOUBLE(obj));
+}
+
+static void s_store_combat_stats(const struct entity *ent, PyObject *dict)
+{
+    PyObject *damage = PyInt_FromLong(G_Combat_GetBaseDamage(ent));
+    PyObject *armour = PyFloat_FromDouble(G_Combat_GetBaseArmour(ent));
+    PyDict_SetItemString(dict, "base_dmg", damage);
+    PyDict_SetItemString(dict, "base_armour", armour);
+    Py_XDECREF(damage);
+    Py_XDECREF(armour);
+}
+
+/* Wraps a copy of the template's entity in a new object of the template's 
+ * type. The copy gets shallow copies of the template's dictionaries - its' 
+ * __init__ is not run. */
+static PyEntityObject *s_wrap_copy(PyEntityObject *tmpl, struct entity *ent, vec3_t pos)
+{
+    PyObject *dict = PyDict_Copy(tmpl->dict);
+    if(!dict)
+        return NULL;
+
+    if(tmpl->active && (tmpl->ent->flags & ENTITY_FLAG_COMBATABLE))
+        s_store_combat_stats(tmpl->ent, dict);
+
+    PyObject *pos_obj = Py_BuildValue("(fff)", pos.x, pos.y, pos.z);
+    if(!pos_obj || PyDict_SetItemString(dict, "pos", pos_obj) < 0) {
+        Py_XDECREF(pos_obj);
+        Py_DECREF(dict);
+        return NULL;
+    }
+    Py_DECREF(pos_obj);
+
+    /* Instances of Python subclasses also carry their' attributes in a 
+     * __dict__ of their own */
+    PyObject *attrs = NULL;
+    PyObject **tmpl_attrs = _PyObject_GetDictPtr((PyObject*)tmpl);
+    if(tmpl_attrs && *tmpl_attrs) {
+        attrs = PyDict_Copy(*tmpl_attrs);
+        if(!attrs) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+
+    PyTypeObject *type = Py_TYPE(tmpl);
+    PyEntityObject *ret = (PyEntityObject*)type->tp_alloc(type, 0);
+    if(!ret) {
+        Py_XDECREF(attrs);
+        Py_DECREF(dict);
+        return NULL;
+    }
+
+    PyObject **ret_attrs = _PyObject_GetDictPtr((PyObject*)ret);
+    if(ret_attrs)
+        *ret_attrs = attrs;
+
+    ret->ent = ent;
+    ret->dict = dict;
+    ret->active = false;
+
+    int status;
+    khiter_t k = kh_put(PyObject, s_uid_pyobj_table, ent->uid, &status);
+    assert(status != -1 && status != 0);
+    kh_value(s_uid_pyobj_table, k) = (PyObject*)ret;
+    ent->script_obj = ret;
+
+    return ret;
+}
+
 static PyObject *PyEntity_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
     PyObject *dict = PyDict_New();
@@ -438,6 +561,7 @@ static PyObject *PyEntity_new(PyTypeObject *type, PyObject *args, PyObject *kwds
     khiter_t k = kh_put(PyObject, s_uid_pyobj_table, ent->uid, &ret);
     assert(ret != -1 && ret != 0);
     kh_value(s_uid_pyobj_table, k) = (PyObject*)self;
+    ent->script_obj = self;
 
     return (PyObject*)self;
 }
@@ -450,6 +574,7 @@ static void PyEntity_dealloc(PyEntityObject *self)
     khiter_t k = kh_get(PyObject, s_uid_pyobj_table, self->ent->uid);
     assert(k != kh_end(s_uid_pyobj_table));
     kh_del(PyObject, s_uid_pyobj_table, k);
+    self->ent->script_obj = NULL;
 
     G_RemoveEntity(self->ent);
     G_SafeFree(self->ent);
@@ -524,6 +649,8 @@ static int PyEntity_set_scale(PyEntityObject *self, PyObject *value, void *closu
         &self->ent->scale.raw[0], &self->ent->scale.raw[1], &self->ent->scale.raw[2]))
         return -1;
 
+    Entity_InvalidateModel(self->ent);
+    G_Scenery_Update(self->ent);
     return 0;
 }
 
@@ -545,6 +672,8 @@ static int PyEntity_set_rotation(PyEntityObject *self, PyObject *value, void *cl
         &self->ent->rotation.raw[2], &self->ent->rotation.raw[3]))
         return -1;
 
+    Entity_InvalidateModel(self->ent);
+    G_Scenery_Update(self->ent);
     return 0;
 }
 
@@ -569,6 +698,7 @@ static int PyEntity_set_selectable(PyEntityObject *self, PyObject *value, void *
         self->ent->flags &= ~ENTITY_FLAG_SELECTABLE;
     }
 
+    G_Scenery_Update(self->ent);
     return 0;
 }
 
@@ -625,7 +755,23 @@ static int PyEntity_set_faction_id(PyEntityObject *self, PyObject *value, void *
         return -1;
     }
 
-    self->ent->faction_id = PyInt_AS_LONG(value);
+    G_SetFactionID(self->ent, PyInt_AS_LONG(value));
+    return 0;
+}
+
+static PyObject *PyEntity_get_vision_range(PyEntityObject *self, void *closure)
+{
+    return Py_BuildValue("f", self->ent->vision_range);
+}
+
+static int PyEntity_set_vision_range(PyEntityObject *self, PyObject *value, void *closure)
+{
+    if(!PyFloat_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a float.");
+        return -1;
+    }
+
+    G_SetVisionRange(self->ent, PyFloat_AsDouble(value));
     return 0;
 }
 
@@ -642,17 +788,7 @@ static PyObject *PyEntity_activate(PyEntityObject *self)
     int ret = PyArg_ParseTuple(entry, "fff", &pos.x, &pos.y, &pos.z);
     assert(ret);
     G_AddEntity(self->ent, pos);
-
-    if(self->ent->flags & ENTITY_FLAG_COMBATABLE) {
-
-        PyObject *obj = PyDict_GetItemString(self->dict, "base_dmg");
-        assert(obj && PyInt_Check(obj));
-        G_Combat_SetBaseDamage(self->ent, PyInt_AS_LONG(obj));
-
-        obj = PyDict_GetItemString(self->dict, "base_armour");
-        assert(obj && PyFloat_Check(obj));
-        G_Combat_SetBaseArmour(self->ent, PyFloat_AS_DOUBLE(obj));
-    }
+    s_load_combat_stats(self);
 
     Py_RETURN_NONE;
 }
@@ -756,7 +892,7 @@ static PyObject *PyEntity_deselect(PyEntityObject *self)
 static PyObject *PyEntity_stop(PyEntityObject *self)
 {
     assert(self->ent);
-    G_StopEntity(self->ent);
+    G_Replay_CmdStop(self->ent);
     Py_RETURN_NONE;
 }
 
@@ -774,7 +910,27 @@ static PyObject *PyEntity_move(PyEntityObject *self, PyObject *args)
         return NULL;
     }
 
-    G_Move_SetDest(self->ent, xz_pos);
+    G_Replay_CmdMove(self->ent, xz_pos);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyEntity_set_crowd_mode(PyEntityObject *self, PyObject *args)
+{
+    int mode;
+
+    if(!PyArg_ParseTuple(args, "i", &mode)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    if(mode != MOVE_CROWD_AUTO && mode != MOVE_CROWD_ALWAYS && mode != MOVE_CROWD_NEVER) {
+        PyErr_SetString(PyExc_ValueError, "Invalid crowd mode.");
+        return NULL;
+    }
+
+    assert(self->ent);
+    if(!(self->ent->flags & ENTITY_FLAG_STATIC))
+        G_Move_SetCrowdMode(self->ent, mode);
     Py_RETURN_NONE;
 }
 
@@ -783,10 +939,10 @@ static PyObject *PyCombatableEntity_hold_position(PyCombatableEntityObject *self
     assert(self->super.ent);
 
     if(!(self->super.ent->flags & ENTITY_FLAG_STATIC))
-        G_StopEntity(self->super.ent);
+        G_Replay_CmdStop(self->super.ent);
 
     assert(self->super.ent->flags & ENTITY_FLAG_COMBATABLE);
-    G_Combat_SetStance(self->super.ent, COMBAT_STANCE_HOLD_POSITION);
+    G_Replay_CmdStance(self->super.ent, COMBAT_STANCE_HOLD_POSITION);
     Py_RETURN_NONE;
 }
 
@@ -805,10 +961,10 @@ static PyObject *PyCombatableEntity_attack(PyCombatableEntityObject *self, PyObj
     }
 
     assert(self->super.ent->flags & ENTITY_FLAG_COMBATABLE);
-    G_Combat_SetStance(self->super.ent, COMBAT_STANCE_AGGRESSIVE);
+    G_Replay_CmdStance(self->super.ent, COMBAT_STANCE_AGGRESSIVE);
 
     if(!(self->super.ent->flags & ENTITY_FLAG_STATIC))
-        G_Move_SetDest(self->super.ent, xz_pos);
+        G_Replay_CmdMove(self->super.ent, xz_pos);
 
     Py_RETURN_NONE;
 }
@@ -1093,6 +1249,117 @@ static PyObject *s_new_custom_class(const char *name, const vec_attr_t *construc
     return ret;
 }
 
+typedef bool (*bulk_fill_t)(PyEntityObject *ent, void *out);
+
+static bool s_fill_pos(PyEntityObject *ent, void *out)
+{
+    float *pos = out;
+    if(ent->active) {
+        vec3_t curr = G_Pos_Get(ent->ent->uid);
+        memcpy(pos, curr.raw, sizeof(curr.raw));
+        return true;
+    }
+
+    PyObject *tuple = PyDict_GetItemString(ent->dict, "pos");
+    if(!tuple) {
+        pos[0] = pos[1] = pos[2] = 0.0f;
+        return true;
+    }
+    return PyArg_ParseTuple(tuple, "fff", &pos[0], &pos[1], &pos[2]);
+}
+
+static bool s_fill_rotation(PyEntityObject *ent, void *out)
+{
+    memcpy(out, ent->ent->rotation.raw, sizeof(ent->ent->rotation.raw));
+    return true;
+}
+
+static bool s_fill_hp(PyEntityObject *ent, void *out)
+{
+    int *hp = out;
+    /* Inactive entities have no combat state to read from */
+    *hp = (ent->active && (ent->ent->flags & ENTITY_FLAG_COMBATABLE)) 
+        ? G_Combat_GetCurrentHP(ent->ent) : -1;
+    return true;
+}
+
+static PyObject *s_array_from_buff(const char *typecode, const char *buff, size_t size)
+{
+    PyObject *ret = NULL;
+    PyObject *mod = PyImport_ImportModule("array");
+    if(!mod)
+        goto fail_import;
+
+    ret = PyObject_CallMethod(mod, "array", "s", typecode);
+    if(!ret)
+        goto fail_array;
+
+    PyObject *result = PyObject_CallMethod(ret, "fromstring", "s#", buff, (int)size);
+    if(!result) {
+        Py_CLEAR(ret);
+        goto fail_array;
+    }
+    Py_DECREF(result);
+
+fail_array:
+    Py_DECREF(mod);
+fail_import:
+    return ret;
+}
+
+/* Fills a contiguous buffer with 'stride' bytes for every entity in the 
+ * sequence, and returns it as an 'array.array' of the specified type. */
+static PyObject *s_bulk_array(PyObject *ents, const char *typecode, size_t stride, bulk_fill_t fill)
+{
+    PyObject *ret = NULL;
+    PyObject *seq = PySequence_Fast(ents, "Argument must be a sequence of entities.");
+    if(!seq)
+        goto fail_seq;
+
+    Py_ssize_t nents = PySequence_Fast_GET_SIZE(seq);
+    char *buff = PyMem_Malloc(nents * stride + 1);
+    if(!buff) {
+        PyErr_NoMemory();
+        goto fail_alloc;
+    }
+
+    for(int i = 0; i < nents; i++) {
+
+        PyObject *curr = PySequence_Fast_GET_ITEM(seq, i);
+        if(!PyObject_IsInstance(curr, (PyObject*)&PyEntity_type)) {
+            PyErr_SetString(PyExc_TypeError, "Argument must be a sequence of entities.");
+            goto fail_fill;
+        }
+        if(!fill((PyEntityObject*)curr, buff + i * stride))
+            goto fail_fill;
+    }
+
+    ret = s_array_from_buff(typecode, buff, nents * stride);
+
+fail_fill:
+    PyMem_Free(buff);
+fail_alloc:
+    Py_DECREF(seq);
+fail_seq:
+    return ret;
+}
+
+static PyObject *s_list_from_ents(struct entity **ents, size_t nents)
+{
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < nents; i++) {
+        PyObject *ent = S_Entity_ObjForEnt(ents[i]);
+        if(ent && PyList_Append(ret, ent) < 0) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+    }
+    return ret;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -1126,6 +1393,18 @@ void S_Entity_Shutdown(void)
     kh_destroy(PyObject, s_uid_pyobj_table);
 }
 
+PyObject *S_Entity_ObjForEnt(const struct entity *ent)
+{
+    return ent->script_obj;
+}
+
+struct entity *S_Entity_EntForObj(PyObject *obj)
+{
+    if(!PyObject_IsInstance(obj, (PyObject*)&PyEntity_type))
+        return NULL;
+    return ((PyEntityObject*)obj)->ent;
+}
+
 PyObject *S_Entity_ObjForUID(uint32_t uid)
 {
     khiter_t k = kh_get(PyObject, s_uid_pyobj_table, uid);
@@ -1195,6 +1474,10 @@ script_opaque_t S_Entity_ObjFromAtts(const char *path, const char *name,
     && (k = kh_get(attr, attr_table, "faction_id")) != kh_end(attr_table))
         PyObject_SetAttrString(ret, "faction_id", s_obj_from_attr(&kh_value(attr_table, k)));
 
+    if(PyObject_HasAttrString(ret, "vision_range") 
+    && (k = kh_get(attr, attr_table, "vision_range")) != kh_end(attr_table))
+        PyObject_SetAttrString(ret, "vision_range", s_obj_from_attr(&kh_value(attr_table, k)));
+
     if(PyObject_HasAttrString(ret, "activate")) {
         PyObject *result = PyObject_CallMethod(ret, "activate", "");
         Py_XDECREF(result);
@@ -1224,3 +1507,253 @@ PyObject *S_Entity_GetAllList(void)
     return ret;
 }
 
+PyObject *S_Entity_Spawn(PyObject *tmpl, PyObject *positions)
+{
+    if(!PyObject_IsInstance(tmpl, (PyObject*)&PyEntity_type)) {
+        PyErr_SetString(PyExc_TypeError, "First argument must be a pf.Entity instance.");
+        return NULL;
+    }
+    PyEntityObject *tmpl_obj = (PyEntityObject*)tmpl;
+    PyObject *ret = NULL;
+
+    PyObject *seq = PySequence_Fast(positions, "Second argument must be a sequence of (X, Y, Z) tuples.");
+    if(!seq)
+        goto fail_seq;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    vec3_t *pos = PyMem_Malloc(count * sizeof(vec3_t) + 1);
+    struct entity **ents = PyMem_Malloc(count * sizeof(struct entity*) + 1);
+    if(!pos || !ents) {
+        PyErr_NoMemory();
+        goto fail_alloc;
+    }
+
+    for(int i = 0; i < count; i++) {
+        PyObject *curr = PySequence_Fast_GET_ITEM(seq, i);
+        if(!PyTuple_Check(curr)
+        || !PyArg_ParseTuple(curr, "fff", &pos[i].x, &pos[i].y, &pos[i].z)) {
+            PyErr_SetString(PyExc_TypeError, "Second argument must be a sequence of (X, Y, Z) tuples.");
+            goto fail_alloc;
+        }
+    }
+
+    ret = PyList_New(count);
+    if(!ret)
+        goto fail_alloc;
+
+    size_t nallocd = AL_EntitiesFromTemplate(tmpl_obj->ent, count, ents);
+    size_t nwrapped = 0;
+    if(nallocd < count) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to allocate the new entities.");
+        goto fail_ents;
+    }
+
+    for(; nwrapped < count; nwrapped++) {
+        PyEntityObject *curr = s_wrap_copy(tmpl_obj, ents[nwrapped], pos[nwrapped]);
+        if(!curr)
+            goto fail_ents;
+        PyList_SET_ITEM(ret, nwrapped, (PyObject*)curr);
+    }
+
+    /* The entities that did make it into the game are removed again when 
+     * their' objects are freed */
+    size_t nadded = G_AddEntities(ents, pos, count);
+    if(nadded < count) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to add the new entities to the game.");
+        goto fail_ents;
+    }
+
+    for(int i = 0; i < nadded; i++) {
+
+        PyEntityObject *curr = (PyEntityObject*)PyList_GET_ITEM(ret, i);
+        curr->active = true;
+        s_load_combat_stats(curr);
+    }
+
+    PyMem_Free(ents);
+    PyMem_Free(pos);
+    Py_DECREF(seq);
+    return ret;
+
+fail_ents:
+    /* The wrapped entities go with their' objects */
+    for(size_t i = nwrapped; i < nallocd; i++)
+        AL_EntityFree(ents[i]);
+    Py_CLEAR(ret);
+fail_alloc:
+    PyMem_Free(ents);
+    PyMem_Free(pos);
+    Py_DECREF(seq);
+fail_seq:
+    return ret;
+}
+
+PyObject *S_Entity_PickleState(PyObject *obj)
+{
+    assert(PyObject_IsInstance(obj, (PyObject*)&PyEntity_type));
+    PyEntityObject *self = (PyEntityObject*)obj;
+    const struct entity *ent = self->ent;
+
+    struct ent_record rec;
+    memset(&rec, 0, sizeof(rec));
+
+    rec.uid = ent->uid;
+    rec.flags = ent->flags;
+    strncpy(rec.name, ent->name, sizeof(rec.name) - 1);
+    strncpy(rec.basedir, ent->basedir, sizeof(rec.basedir) - 1);
+    strncpy(rec.filename, ent->filename, sizeof(rec.filename) - 1);
+    rec.scale = ent->scale;
+    rec.rotation = ent->rotation;
+    rec.selection_radius = ent->selection_radius;
+    rec.max_speed = ent->max_speed;
+    rec.faction_id = ent->faction_id;
+    rec.vision_range = ent->vision_range;
+    rec.max_hp = ent->max_hp;
+
+    if(ent->flags & ENTITY_FLAG_ANIMATED)
+        A_SaveCtx(ent, &rec.anim);
+
+    /* The dictionary of an active entity is brought up to date the same 
+     * way as if it were deactivated */
+    PyObject *dict = PyDict_Copy(self->dict);
+    if(!dict)
+        return NULL;
+
+    if(self->active) {
+
+        vec3_t pos = G_Pos_Get(ent->uid);
+        PyObject *pos_obj = Py_BuildValue("(fff)", pos.x, pos.y, pos.z);
+        if(!pos_obj || PyDict_SetItemString(dict, "pos", pos_obj) < 0) {
+            Py_XDECREF(pos_obj);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(pos_obj);
+
+        if(ent->flags & ENTITY_FLAG_COMBATABLE)
+            s_store_combat_stats(ent, dict);
+    }
+
+    PyObject *ret = Py_BuildValue("(is#OO)", PICKLE_VERSION, (char*)&rec, (int)sizeof(rec), 
+        self->active ? Py_True : Py_False, dict);
+    Py_DECREF(dict);
+    return ret;
+}
+
+PyObject *S_Entity_UnpickleState(PyTypeObject *type, PyObject *state)
+{
+    int version;
+    const char *buff;
+    int size;
+    PyObject *active, *dict;
+
+    if(!PyType_IsSubtype(type, &PyEntity_type)) {
+        PyErr_SetString(PyExc_TypeError, "Expecting a subtype of pf.Entity.");
+        return NULL;
+    }
+
+    if(!PyTuple_Check(state)
+    || !PyArg_ParseTuple(state, "is#OO!", &version, &buff, &size, &active, &PyDict_Type, &dict)
+    || version != PICKLE_VERSION
+    || size != sizeof(struct ent_record)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unexpected pf.Entity pickle state.");
+        return NULL;
+    }
+
+    struct ent_record rec;
+    memcpy(&rec, buff, sizeof(rec));
+    rec.name[sizeof(rec.name) - 1] = '\0';
+    rec.basedir[sizeof(rec.basedir) - 1] = '\0';
+    rec.filename[sizeof(rec.filename) - 1] = '\0';
+
+    vec3_t pos = (vec3_t){0.0f, 0.0f, 0.0f};
+    PyObject *pos_obj = PyDict_GetItemString(dict, "pos");
+    if(!pos_obj || !PyTuple_Check(pos_obj) 
+    || !PyArg_ParseTuple(pos_obj, "fff", &pos.x, &pos.y, &pos.z)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unexpected pf.Entity pickle state.");
+        return NULL;
+    }
+
+    struct entity *ent = AL_EntityFromPFObj(rec.basedir, rec.filename, rec.name);
+    if(!ent) {
+        PyErr_Format(PyExc_RuntimeError, "Unable to load the entity [%s/%s].", rec.basedir, rec.filename);
+        return NULL;
+    }
+
+    ent->flags = rec.flags;
+    ent->scale = rec.scale;
+    ent->rotation = rec.rotation;
+    ent->selection_radius = rec.selection_radius;
+    ent->max_speed = rec.max_speed;
+    ent->faction_id = rec.faction_id;
+    ent->vision_range = rec.vision_range;
+    ent->max_hp = rec.max_hp;
+    Entity_InvalidateModel(ent);
+
+    if((ent->flags & ENTITY_FLAG_ANIMATED) && !A_RestoreCtx(ent, &rec.anim)) {
+        PyErr_Format(PyExc_RuntimeError, "Invalid animation state for entity [%s].", rec.name);
+        AL_EntityFree(ent);
+        return NULL;
+    }
+
+    PyObject *dict_copy = PyDict_Copy(dict);
+    if(!dict_copy) {
+        AL_EntityFree(ent);
+        return NULL;
+    }
+
+    PyEntityObject *self = (PyEntityObject*)type->tp_alloc(type, 0);
+    if(!self) {
+        Py_DECREF(dict_copy);
+        AL_EntityFree(ent);
+        return NULL;
+    }
+
+    self->ent = ent;
+    self->dict = dict_copy;
+    self->active = PyObject_IsTrue(active);
+
+    int status;
+    khiter_t k = kh_put(PyObject, s_uid_pyobj_table, ent->uid, &status);
+    assert(status != -1 && status != 0);
+    kh_value(s_uid_pyobj_table, k) = (PyObject*)self;
+    ent->script_obj = self;
+
+    /* While a save is being loaded, the entities are added to the simulation 
+     * all at once, after they have all been unpickled */
+    if(self->active && !G_LoadDeferEntity(rec.uid, ent, pos)) {
+        G_AddEntity(ent, pos);
+        s_load_combat_stats(self);
+    }
+
+    return (PyObject*)self;
+}
+
+PyObject *S_Entity_GetPositions(PyObject *ents)
+{
+    return s_bulk_array(ents, "f", sizeof(vec3_t), s_fill_pos);
+}
+
+PyObject *S_Entity_GetRotations(PyObject *ents)
+{
+    return s_bulk_array(ents, "f", sizeof(quat_t), s_fill_rotation);
+}
+
+PyObject *S_Entity_GetHPs(PyObject *ents)
+{
+    return s_bulk_array(ents, "i", sizeof(int), s_fill_hp);
+}
+
+PyObject *S_Entity_InRect(vec2_t xz_min, vec2_t xz_max)
+{
+    struct entity *ents[MAX_QUERY_ENTS];
+    int nents = G_Pos_EntsInRect(xz_min, xz_max, ents, ARR_SIZE(ents));
+    return s_list_from_ents(ents, nents);
+}
+
+PyObject *S_Entity_InCircle(vec2_t xz_point, float range)
+{
+    struct entity *ents[MAX_QUERY_ENTS];
+    int nents = G_Pos_EntsInCircle(xz_point, range, ents, ARR_SIZE(ents));
+    return s_list_from_ents(ents, nents);
+}
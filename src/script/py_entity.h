@@ -40,12 +40,45 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "../pf_math.h"
+
+struct entity;
+
 bool      S_Entity_Init(void);
 void      S_Entity_Shutdown(void);
 void      S_Entity_PyRegister(PyObject *module);
 PyObject *S_Entity_ObjForUID(uint32_t uid);
+/* Same as S_Entity_ObjForUID, without the table lookup. Borrowed reference. */
+PyObject *S_Entity_ObjForEnt(const struct entity *ent);
+/* Returns NULL if the object is not a pf.Entity instance */
+struct entity *S_Entity_EntForObj(PyObject *obj);
 /* Returned list has a stolen reference to each object */
 PyObject *S_Entity_GetAllList(void);
 
+/* Returns a new list of copies of the template entity, one at each of the 
+ * (X, Y, Z) positions, which are activated together. The copies are of the 
+ * template's type, but their' __init__ is not run. */
+PyObject *S_Entity_Spawn(PyObject *tmpl, PyObject *positions);
+
+/* The state of an entity for the pickler: a tuple of the native entity 
+ * record, whether the entity is active, and a copy of its' private 
+ * dictionary. New reference. */
+PyObject *S_Entity_PickleState(PyObject *obj);
+/* Recreates an entity of the given type from the pickled state, without 
+ * running its' __init__. New reference. */
+PyObject *S_Entity_UnpickleState(PyTypeObject *type, PyObject *state);
+
+/* Each of these returns an 'array.array' holding the attribute of every 
+ * entity in the sequence, packed one after another. Positions are 3 floats, 
+ * rotations are 4 floats (a quaternion) and hitpoints are a single int, 
+ * which is -1 for entities that are not combatable. */
+PyObject *S_Entity_GetPositions(PyObject *ents);
+PyObject *S_Entity_GetRotations(PyObject *ents);
+PyObject *S_Entity_GetHPs(PyObject *ents);
+
+/* Return new lists of the entities in the specified area */
+PyObject *S_Entity_InRect(vec2_t xz_min, vec2_t xz_max);
+PyObject *S_Entity_InCircle(vec2_t xz_point, float range);
+
 #endif
 
@@ -0,0 +1,228 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "py_lazy.h"
+#include "py_pickle.h"
+#include "../lib/public/SDL_vec_rwops.h"
+
+#include <SDL.h>
+#include <assert.h>
+
+
+typedef struct {
+    PyObject_HEAD
+    /* The wrapped subgraph, once it is loaded */
+    PyObject *obj;
+    /* The pickled subgraph, until it is loaded */
+    PyObject *pickled;
+}PyLazySectionObject;
+
+static PyObject *PyLazySection_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
+static void      PyLazySection_dealloc(PyLazySectionObject *self);
+static int       PyLazySection_traverse(PyLazySectionObject *self, visitproc visit, void *arg);
+static int       PyLazySection_clear(PyLazySectionObject *self);
+static PyObject *PyLazySection_call(PyLazySectionObject *self, PyObject *args, PyObject *kwds);
+static PyObject *PyLazySection_get_loaded(PyLazySectionObject *self, void *closure);
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static PyGetSetDef PyLazySection_getset[] = {
+    {"loaded",
+    (getter)PyLazySection_get_loaded, NULL,
+    "Whether the wrapped object has been unpickled yet.",
+    NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject PyLazySection_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.LazySection",
+    .tp_basicsize   = sizeof(PyLazySectionObject),
+    .tp_dealloc     = (destructor)PyLazySection_dealloc,
+    .tp_call        = (ternaryfunc)PyLazySection_call,
+    .tp_flags       = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_doc         = "Wrapper around an object which is pickled as a separate section of the "
+                      "stream, and is only unpickled once the wrapper is first called. Calling "
+                      "the wrapper returns the object. The wrapped object should not share "
+                      "references with the rest of the pickled graph - they will be copies once "
+                      "unpickled.",
+    .tp_traverse    = (traverseproc)PyLazySection_traverse,
+    .tp_clear       = (inquiry)PyLazySection_clear,
+    .tp_getset      = PyLazySection_getset,
+    .tp_new         = PyLazySection_new,
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static PyObject *PyLazySection_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PyObject *obj;
+    if(!PyArg_ParseTuple(args, "O", &obj)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be the object to wrap.");
+        return NULL;
+    }
+
+    PyLazySectionObject *self = (PyLazySectionObject*)type->tp_alloc(type, 0);
+    if(!self)
+        return NULL;
+
+    Py_INCREF(obj);
+    self->obj = obj;
+    self->pickled = NULL;
+    return (PyObject*)self;
+}
+
+static void PyLazySection_dealloc(PyLazySectionObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    PyLazySection_clear(self);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int PyLazySection_traverse(PyLazySectionObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->obj);
+    return 0;
+}
+
+static int PyLazySection_clear(PyLazySectionObject *self)
+{
+    Py_CLEAR(self->obj);
+    Py_CLEAR(self->pickled);
+    return 0;
+}
+
+static PyObject *PyLazySection_call(PyLazySectionObject *self, PyObject *args, PyObject *kwds)
+{
+    if(self->obj) {
+        Py_INCREF(self->obj);
+        return self->obj;
+    }
+
+    assert(self->pickled);
+    SDL_RWops *cmops = SDL_RWFromConstMem(PyString_AS_STRING(self->pickled), 
+        PyString_GET_SIZE(self->pickled));
+    if(!cmops)
+        return PyErr_NoMemory();
+
+    PyObject *obj = S_UnpickleObjgraph(cmops);
+    SDL_RWclose(cmops);
+    if(!obj) {
+        assert(PyErr_Occurred());
+        return NULL;
+    }
+
+    self->obj = obj;
+    Py_CLEAR(self->pickled);
+
+    Py_INCREF(self->obj);
+    return self->obj;
+}
+
+static PyObject *PyLazySection_get_loaded(PyLazySectionObject *self, void *closure)
+{
+    if(self->obj)
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void S_Lazy_PyRegister(PyObject *module)
+{
+    if(PyType_Ready(&PyLazySection_type) < 0)
+        return;
+    Py_INCREF(&PyLazySection_type);
+    PyModule_AddObject(module, "LazySection", (PyObject*)&PyLazySection_type);
+}
+
+bool S_Lazy_Check(PyObject *obj)
+{
+    return PyObject_TypeCheck(obj, &PyLazySection_type);
+}
+
+PyObject *S_Lazy_GetPickled(PyObject *lazy)
+{
+    assert(S_Lazy_Check(lazy));
+    PyLazySectionObject *self = (PyLazySectionObject*)lazy;
+
+    if(self->pickled) {
+        Py_INCREF(self->pickled);
+        return self->pickled;
+    }
+
+    SDL_RWops *vops = PFSDL_VectorRWOps();
+    if(!vops)
+        return PyErr_NoMemory();
+
+    if(!S_PickleObjgraph(self->obj, vops)) {
+        SDL_RWclose(vops);
+        return NULL;
+    }
+
+    Sint64 size = SDL_RWsize(vops);
+    PyObject *ret = PyString_FromStringAndSize(NULL, size);
+    if(ret) {
+        SDL_RWseek(vops, 0, RW_SEEK_SET);
+        if(size > 0 && SDL_RWread(vops, PyString_AS_STRING(ret), size, 1) != 1) {
+            PyErr_SetString(PyExc_IOError, "Error reading back the pickled section");
+            Py_CLEAR(ret);
+        }
+    }
+    SDL_RWclose(vops);
+    return ret;
+}
+
+PyObject *S_Lazy_FromPickled(PyObject *pickled)
+{
+    assert(PyString_Check(pickled));
+
+    PyLazySectionObject *ret = PyObject_GC_New(PyLazySectionObject, &PyLazySection_type);
+    if(!ret)
+        return NULL;
+
+    Py_INCREF(pickled);
+    ret->obj = NULL;
+    ret->pickled = pickled;
+    PyObject_GC_Track(ret);
+    return (PyObject*)ret;
+}
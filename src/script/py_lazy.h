@@ -0,0 +1,56 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PY_LAZY_H
+#define PY_LAZY_H
+
+#include <Python.h> /* must be first */
+
+#include <stdbool.h>
+
+void      S_Lazy_PyRegister(PyObject *module);
+
+/* A pf.LazySection holds a subgraph which is pickled as its' own, separate 
+ * stream. On unpickling, the stream is kept as-is and only unpickled the 
+ * first time the section is called. */
+bool      S_Lazy_Check(PyObject *obj);
+/* Returns a new reference to the pickled stream of the section's subgraph. 
+ * A section which has not been loaded yet gives back the stream it was 
+ * created with. */
+PyObject *S_Lazy_GetPickled(PyObject *lazy);
+/* Returns a new, unloaded section for the pickled stream (a string) */
+PyObject *S_Lazy_FromPickled(PyObject *pickled);
+
+#endif
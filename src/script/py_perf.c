@@ -0,0 +1,213 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "py_perf.h"
+#include "../lib/public/khash.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX_NAME_LEN (128)
+
+struct handler_stats{
+    char          name[MAX_NAME_LEN];
+    int           event;
+    unsigned long calls;
+    uint64_t      total;
+    uint64_t      max;
+};
+
+KHASH_MAP_INIT_INT64(stats, struct handler_stats)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static khash_t(stats) *s_stats_table;
+static uint64_t        s_total_ticks;
+/* Handlers may run other handlers by sending immediate events */
+static int             s_depth;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t perf_key(PyObject *callable, int event)
+{
+    /* Objects are 16-byte aligned and user-space addresses fit in 47 bits, 
+     * leaving the top bits of the key for the event type. */
+    return (((uint64_t)(uintptr_t)callable) >> 4) | (((uint64_t)event) << 43);
+}
+
+static const char *attr_str(PyObject *obj, const char *attr, PyObject **out)
+{
+    *out = PyObject_GetAttrString(obj, attr);
+    if(*out && PyString_Check(*out))
+        return PyString_AS_STRING(*out);
+    PyErr_Clear();
+    return NULL;
+}
+
+/* Writes 'module.Class.name' for methods and 'module.name' for functions. 
+ * Any other callable is identified by its' repr. */
+static void callable_name(PyObject *callable, char *out, size_t size)
+{
+    PyObject *mod = NULL, *cls = NULL, *name = NULL;
+    const char *modstr = attr_str(callable, "__module__", &mod);
+    const char *namestr = attr_str(callable, "__name__", &name);
+    const char *clsstr = NULL;
+
+    if(PyMethod_Check(callable) && PyMethod_GET_CLASS(callable))
+        clsstr = attr_str(PyMethod_GET_CLASS(callable), "__name__", &cls);
+
+    if(namestr) {
+        snprintf(out, size, "%s%s%s%s%s", 
+            modstr ? modstr : "", modstr ? "." : "",
+            clsstr ? clsstr : "", clsstr ? "." : "",
+            namestr);
+    }else{
+        PyObject *repr = PyObject_Repr(callable);
+        snprintf(out, size, "%s", repr ? PyString_AS_STRING(repr) : "<unknown>");
+        Py_XDECREF(repr);
+        PyErr_Clear();
+    }
+    out[size-1] = '\0';
+
+    Py_XDECREF(mod);
+    Py_XDECREF(cls);
+    Py_XDECREF(name);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_Perf_Init(void)
+{
+    s_stats_table = kh_init(stats);
+    s_total_ticks = 0;
+    s_depth = 0;
+    return (s_stats_table != NULL);
+}
+
+void S_Perf_Shutdown(void)
+{
+    kh_destroy(stats, s_stats_table);
+}
+
+uint64_t S_Perf_Enter(PyObject *callable, int event)
+{
+    s_depth++;
+
+    uint64_t key = perf_key(callable, event);
+    khiter_t k = kh_get(stats, s_stats_table, key);
+    if(k != kh_end(s_stats_table))
+        return key;
+
+    int ret;
+    k = kh_put(stats, s_stats_table, key, &ret);
+    if(ret == -1)
+        return key;
+
+    struct handler_stats *hs = &kh_value(s_stats_table, k);
+    callable_name(callable, hs->name, sizeof(hs->name));
+    hs->event = event;
+    hs->calls = 0;
+    hs->total = 0;
+    hs->max = 0;
+    return key;
+}
+
+void S_Perf_Exit(uint64_t key, uint64_t ticks)
+{
+    assert(s_depth > 0);
+    if(--s_depth == 0)
+        s_total_ticks += ticks;
+
+    /* The entry may be gone if the stats were reset by the handler */
+    khiter_t k = kh_get(stats, s_stats_table, key);
+    if(k == kh_end(s_stats_table))
+        return;
+
+    struct handler_stats *hs = &kh_value(s_stats_table, k);
+    hs->calls++;
+    hs->total += ticks;
+    if(ticks > hs->max)
+        hs->max = ticks;
+}
+
+uint64_t S_Perf_TotalTicks(void)
+{
+    return s_total_ticks;
+}
+
+PyObject *S_Perf_GetStats(void)
+{
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    const double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+    uint64_t key;
+    struct handler_stats hs;
+
+    kh_foreach(s_stats_table, key, hs, {
+        (void)key;
+        PyObject *dict = Py_BuildValue("{s:s, s:i, s:k, s:d, s:d}",
+            "name",     hs.name,
+            "event",    hs.event,
+            "calls",    hs.calls,
+            "total_ms", hs.total * ms_per_tick,
+            "max_ms",   hs.max * ms_per_tick);
+        if(!dict || 0 != PyList_Append(ret, dict)) {
+            Py_XDECREF(dict);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(dict);
+    });
+
+    return ret;
+}
+
+void S_Perf_Reset(void)
+{
+    kh_clear(stats, s_stats_table);
+}
+
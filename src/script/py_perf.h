@@ -0,0 +1,60 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PY_PERF_H
+#define PY_PERF_H
+
+#include <Python.h> /* must be first */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool      S_Perf_Init(void);
+void      S_Perf_Shutdown(void);
+
+/* Bracket a call of the callable as the handler of the event. The callable 
+ * is not touched by S_Perf_Exit, so the handler is free to release it. 
+ * 'ticks' is the duration of the call, in performance counter units. */
+uint64_t  S_Perf_Enter(PyObject *callable, int event);
+void      S_Perf_Exit(uint64_t key, uint64_t ticks);
+/* The total time spent in all handlers, in performance counter units. The 
+ * time of handlers run from within other handlers is only counted once. */
+uint64_t  S_Perf_TotalTicks(void);
+/* Returns a new list holding a dictionary for every (handler, event) pair */
+PyObject *S_Perf_GetStats(void);
+void      S_Perf_Reset(void);
+
+#endif
+
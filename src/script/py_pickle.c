@@ -37,6 +37,8 @@
 
 #include "py_pickle.h"
 #include "py_traverse.h"
+#include "py_entity.h"
+#include "py_lazy.h"
 #include "private_types.h"
 #include "../lib/public/vec.h"
 #include "../asset_load.h"
@@ -204,15 +206,40 @@ typedef void *mod_ty; //symtable.h wants this
 #define PF_FIELDNAMEITER '$' /* Push a fieldnameiterator from top 4 TOS items */
 #define PF_FORMATITER   '%' /* Push a formatteriterator from top 3 TOS items */
 #define PF_EXCEPTION    '^' 
+#define PF_ENTITY       '&' /* Push a pf.Entity of the type on TOS, recreated from the state on TOS1 */
+#define PF_LAZY         '*' /* Push a pf.LazySection from the size-prefixed raw stream following the opcode */
 
 #define EXC_START_MAGIC ((void*)0x1234)
 #define EXC_END_MAGIC   ((void*)0x4321)
 
-struct memo_entry{
-    int idx;
+/* A framed stream starts with a header holding this magic. None of the 
+ * opcodes are outside of the ASCII range, so a raw opcode stream can never 
+ * be mistaken for a framed one. The opcode stream is cut into frames of
+ * at most FRAME_SIZE bytes, each of which is compressed on its' own. */
+#define FRAME_MAGIC     "\x89PFK"
+#define FRAME_VERSION   (1)
+#define FRAME_SIZE      (256 * 1024)
+#define FRAME_ZLIB_LVL  (3)
+#define FRAME_FLAG_COMPRESSED (1 << 0)
+#define SDL_RWOPS_FRAME (0xfffe)
+
+/* The pickling memo is an open-addressing table keyed on the object address. 
+ * An empty slot has a NULL 'obj'. Entries are never removed, so lookups can 
+ * use simple linear probing. */
+struct memo_slot{
     PyObject *obj;
+    int       idx;
+};
+
+struct memo_table{
+    size_t            size;
+    size_t            cap;  /* Always a power of 2 */
+    struct memo_slot *slots;
 };
 
+#define MEMO_MIN_CAP    (1024)
+#define MEMO_MAX_LOAD   (0.7f)
+
 VEC_TYPE(pobj, PyObject*)
 VEC_IMPL(static inline, pobj, PyObject*)
 
@@ -222,10 +249,8 @@ VEC_IMPL(static inline, int, int)
 VEC_TYPE(char, char)
 VEC_IMPL(static inline, char, char)
 
-KHASH_MAP_INIT_INT64(memo, struct memo_entry)
-
 struct pickle_ctx{
-    khash_t(memo) *memo;
+    struct memo_table memo;
     /* Any objects newly created during serialization must 
      * get pushed onto this buffer, to be decref'd during context
      * destruction. We wish to pickle them using the normal flow,
@@ -243,6 +268,32 @@ struct unpickle_ctx{
     bool           stop;
 };
 
+struct frame_hdr{
+    char     magic[4];
+    uint32_t version;
+    uint32_t frame_size;
+    uint32_t flags;
+};
+
+/* Every frame is preceded by the size of its' contents, and the size they 
+ * take up in the stream. When these are equal, the frame is stored as-is.
+ * The last frame is empty. */
+struct frame_desc{
+    uint32_t raw_size;
+    uint32_t stored_size;
+};
+
+struct frame_ctx{
+    SDL_RWops     *stream;
+    PyObject      *zfunc;
+    bool           compress;
+    bool           eof;
+    size_t         size;
+    size_t         pos;
+    size_t         total;
+    unsigned char  buff[FRAME_SIZE];
+};
+
 typedef int (*pickle_func_t)(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *stream);
 typedef int (*unpickle_func_t)(struct unpickle_ctx *ctx, SDL_RWops *stream);
 
@@ -258,6 +309,7 @@ static bool memo_contains(const struct pickle_ctx *ctx, PyObject *obj);
 static int memo_idx(const struct pickle_ctx *ctx, PyObject *obj);
 static bool emit_get(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
 static bool emit_put(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
+static bool unpickle_memo_reserve(struct unpickle_ctx *ctx, size_t size);
 
 /* Pickling functions */
 static int type_pickle        (struct pickle_ctx *, PyObject *, SDL_RWops *);
@@ -338,6 +390,8 @@ static int set_iter_pickle    (struct pickle_ctx *, PyObject *, SDL_RWops *);
 static int tuple_iter_pickle  (struct pickle_ctx *, PyObject *, SDL_RWops *);
 static int newclass_instance_pickle(struct pickle_ctx *, PyObject *, SDL_RWops *);
 static int placeholder_inst_pickle(struct pickle_ctx *, PyObject *, SDL_RWops *);
+static int entity_pickle(struct pickle_ctx *, PyObject *, SDL_RWops *);
+static int lazy_section_pickle(struct pickle_ctx *, PyObject *, SDL_RWops *);
 static int exception_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
 
 /* Unpickling functions */
@@ -427,6 +481,8 @@ static int op_ext_setiter   (struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_fieldnameiter(struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_formatiter(struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_exception (struct unpickle_ctx *, SDL_RWops *);
+static int op_ext_entity    (struct unpickle_ctx *, SDL_RWops *);
+static int op_ext_lazy      (struct unpickle_ctx *, SDL_RWops *);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -631,14 +687,20 @@ static struct pickle_entry s_type_dispatch_table[] = {
 /* An 'empty' user-defined type that acts as a placeholder */
 static PyObject *s_placeholder_type = NULL;
 
+/* The number of objects memoized by the last pickling. Session saves are 
+ * taken repeatedly of a graph which changes slowly, so this is used as the 
+ * estimate for sizing the memo table of the next pickling up front. */
+static size_t s_memo_hint = 0;
+
 /* The permafrost engine built-in types: defer handling of these for now */
 static struct pickle_entry s_pf_dispatch_table[] = {
-    {.type = NULL, /* PyEntity_type */      .picklefunc = placeholder_inst_pickle      },
-    {.type = NULL, /* PyAnimEntity_type */  .picklefunc = placeholder_inst_pickle      },
-    {.type = NULL, /* PyCombatableEntity_type */ .picklefunc = placeholder_inst_pickle },
+    {.type = NULL, /* PyEntity_type */      .picklefunc = entity_pickle                },
+    {.type = NULL, /* PyAnimEntity_type */  .picklefunc = entity_pickle                },
+    {.type = NULL, /* PyCombatableEntity_type */ .picklefunc = entity_pickle           },
     {.type = NULL, /* PyTile_type */        .picklefunc = placeholder_inst_pickle      },
     {.type = NULL, /* PyWindow_type */      .picklefunc = placeholder_inst_pickle      },
     {.type = NULL, /* PyUIButtonStyle_type */ .picklefunc = placeholder_inst_pickle    },
+    {.type = NULL, /* PyLazySection_type */ .picklefunc = lazy_section_pickle          },
 };
 
 static unpickle_func_t s_op_dispatch_table[256] = {
@@ -734,6 +796,8 @@ static unpickle_func_t s_ext_op_dispatch_table[256] = {
     [PF_FIELDNAMEITER] = op_ext_fieldnameiter,
     [PF_FORMATITER] = op_ext_formatiter,
     [PF_EXCEPTION] = op_ext_exception,
+    [PF_ENTITY] = op_ext_entity,
+    [PF_LAZY] = op_ext_lazy,
 };
 
 /* Standard modules not imported on initialization which also contain C builtins */
@@ -775,6 +839,11 @@ static bool type_is_builtin(PyObject *type)
     return false;
 }
 
+static bool is_entity(PyObject *obj)
+{
+    return PyObject_TypeCheck(obj, s_pf_dispatch_table[0].type);
+}
+
 static int dispatch_idx_for_picklefunc(pickle_func_t pf)
 {
     for(int i = 0; i < ARR_SIZE(s_type_dispatch_table); i++) {
@@ -1150,6 +1219,7 @@ static void load_engine_builtin_types(void)
     s_pf_dispatch_table[3].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "Tile");
     s_pf_dispatch_table[4].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "Window");
     s_pf_dispatch_table[5].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "UIButtonStyle");
+    s_pf_dispatch_table[6].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "LazySection");
 
     for(int i = 0; i < ARR_SIZE(s_pf_dispatch_table); i++)
         assert(s_pf_dispatch_table[i].type);
@@ -3327,6 +3397,54 @@ fail:
     return -1;
 }
 
+/* Entities are recreated from their' native state, rather than having 
+ * their' attributes set one at a time. Only the instance dictionary is 
+ * pickled as attributes. */
+static int entity_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+{
+    TRACE_PICKLE(obj);
+
+    PyObject *state = S_Entity_PickleState(obj);
+    CHK_TRUE(state, fail);
+    vec_pobj_push(&ctx->to_free, state);
+
+    CHK_TRUE(pickle_obj(ctx, state, rw), fail);
+    CHK_TRUE(pickle_obj(ctx, (PyObject*)obj->ob_type, rw), fail);
+
+    const char ops[] = {PF_EXTEND, PF_ENTITY};
+    CHK_TRUE(rw->write(rw, ops, ARR_SIZE(ops), 1), fail);
+    return 0;
+
+fail:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+    return -1;
+}
+
+/* The section's subgraph is written as a separate raw stream, so that the 
+ * unpickler can step over it without interpreting any of its' opcodes. A 
+ * section that was never loaded is written back out without being touched. */
+static int lazy_section_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+{
+    TRACE_PICKLE(obj);
+
+    PyObject *pickled = S_Lazy_GetPickled(obj);
+    CHK_TRUE(pickled, fail);
+    vec_pobj_push(&ctx->to_free, pickled);
+
+    uint64_t size = PyString_GET_SIZE(pickled);
+    const char ops[] = {PF_EXTEND, PF_LAZY};
+    CHK_TRUE(rw->write(rw, ops, ARR_SIZE(ops), 1), fail);
+    CHK_TRUE(rw->write(rw, &size, sizeof(size), 1), fail);
+    if(size > 0) {
+        CHK_TRUE(rw->write(rw, PyString_AS_STRING(pickled), size, 1), fail);
+    }
+    return 0;
+
+fail:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+    return -1;
+}
+
 static int op_int(struct unpickle_ctx *ctx, SDL_RWops *rw)
 {
     TRACE_OP(INT, ctx);
@@ -3452,10 +3570,20 @@ static int op_put(struct unpickle_ctx *ctx, SDL_RWops *rw)
         return -1;
     }
 
-    vec_pobj_resize(&ctx->memo, idx + 1);
-    ctx->memo.size = idx + 1;    
+    if(idx < 0) {
+        SET_RUNTIME_EXC("Bad index in pickle stream: [offset: %ld]", (long)rw->seek(rw, RW_SEEK_CUR, 0));
+        return -1;
+    }
+
+    if(!unpickle_memo_reserve(ctx, idx + 1)) {
+        SET_EXC(PyExc_MemoryError, "Memo table allocation");
+        return -1;
+    }
+
+    /* The memo references everything in it */
+    Py_XDECREF(vec_AT(&ctx->memo, idx));
     vec_AT(&ctx->memo, idx) = TOP(&ctx->stack);
-    Py_INCREF(vec_AT(&ctx->memo, idx)); /* The memo references everything in it */
+    Py_INCREF(vec_AT(&ctx->memo, idx));
     return 0;
 
 fail:
@@ -3463,8 +3591,6 @@ fail:
     return -1;
 }
 
-bool gotten[32768];
-
 static int op_get(struct unpickle_ctx *ctx, SDL_RWops *rw)
 {
     TRACE_OP(GET, ctx);
@@ -3479,12 +3605,11 @@ static int op_get(struct unpickle_ctx *ctx, SDL_RWops *rw)
         return -1;
     }
 
-    if(vec_size(&ctx->memo) <= idx) {
+    if(idx < 0 || vec_size(&ctx->memo) <= idx || !vec_AT(&ctx->memo, idx)) {
         SET_RUNTIME_EXC("No memo entry for index: %d", idx);
         return -1;
     }
 
-    gotten[idx] = true;
     vec_pobj_push(&ctx->stack, vec_AT(&ctx->memo, idx));
     Py_INCREF(TOP(&ctx->stack));
 
@@ -4224,7 +4349,9 @@ static int op_ext_setattrs(struct unpickle_ctx *ctx, SDL_RWops *rw)
     }
 
     PyObject *const obj = vec_AT(&ctx->stack, mark - 1);
-    del_extra_attrs(obj, &vec_AT(&ctx->stack, mark), nitems);
+    /* Entities are recreated with only their' pickled attributes */
+    if(!is_entity(obj))
+        del_extra_attrs(obj, &vec_AT(&ctx->stack, mark), nitems);
 
     for(int i = 0; i < nitems; i++) {
     
@@ -5556,6 +5683,69 @@ fail_underflow:
     return ret;
 }
 
+static int op_ext_entity(struct unpickle_ctx *ctx, SDL_RWops *rw)
+{
+    TRACE_OP(PF_ENTITY, ctx);
+    int ret = -1;
+
+    if(vec_size(&ctx->stack) < 2) {
+        SET_RUNTIME_EXC("Stack underflow");
+        goto fail_underflow;
+    }
+    PyObject *type = vec_pobj_pop(&ctx->stack);
+    PyObject *state = vec_pobj_pop(&ctx->stack);
+
+    if(!PyType_Check(type)) {
+        SET_RUNTIME_EXC("PF_ENTITY: Expecting type on TOS");
+        goto fail_typecheck;
+    }
+
+    PyObject *retval = S_Entity_UnpickleState((PyTypeObject*)type, state);
+    CHK_TRUE(retval, fail_typecheck);
+
+    vec_pobj_push(&ctx->stack, retval);
+    ret = 0;
+
+fail_typecheck:
+    Py_DECREF(type);
+    Py_DECREF(state);
+fail_underflow:
+    return ret;
+}
+
+static int op_ext_lazy(struct unpickle_ctx *ctx, SDL_RWops *rw)
+{
+    TRACE_OP(PF_LAZY, ctx);
+
+    uint64_t size;
+    CHK_TRUE(rw->read(rw, &size, sizeof(size), 1), fail_read);
+    if(size > PY_SSIZE_T_MAX) {
+        SET_RUNTIME_EXC("PF_LAZY: Invalid section size");
+        return -1;
+    }
+
+    PyObject *pickled = PyString_FromStringAndSize(NULL, size);
+    if(!pickled)
+        return -1;
+
+    if(size > 0 && !rw->read(rw, PyString_AS_STRING(pickled), size, 1)) {
+        Py_DECREF(pickled);
+        goto fail_read;
+    }
+
+    PyObject *ret = S_Lazy_FromPickled(pickled);
+    Py_DECREF(pickled);
+    if(!ret)
+        return -1;
+
+    vec_pobj_push(&ctx->stack, ret);
+    return 0;
+
+fail_read:
+    DEFAULT_ERR(PyExc_IOError, "Error reading from pickle stream");
+    return -1;
+}
+
 static int op_ext_emptyinst(struct unpickle_ctx *ctx, SDL_RWops *rw)
 {
     TRACE_OP(PF_EMPTYINST, ctx);
@@ -6248,14 +6438,72 @@ static pickle_func_t picklefunc_for_type(PyObject *obj)
     return NULL;
 }
 
+static size_t memo_cap_for(size_t nobjs)
+{
+    size_t ret = MEMO_MIN_CAP;
+    while(ret * MEMO_MAX_LOAD < nobjs)
+        ret *= 2;
+    return ret;
+}
+
+static inline size_t memo_hash(PyObject *obj, size_t cap)
+{
+    /* Objects are at least 16-byte aligned, so the low bits carry no 
+     * information. Fibonacci hashing spreads the rest over the table. */
+    uint64_t h = ((uint64_t)(uintptr_t)obj >> 4) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 32)) & (cap - 1);
+}
+
+static struct memo_slot *memo_find(const struct memo_table *memo, PyObject *obj)
+{
+    size_t i = memo_hash(obj, memo->cap);
+    while(memo->slots[i].obj && memo->slots[i].obj != obj) {
+        i = (i + 1) & (memo->cap - 1);
+    }
+    return &memo->slots[i];
+}
+
+static bool memo_init(struct memo_table *memo, size_t nobjs)
+{
+    memo->size = 0;
+    memo->cap = memo_cap_for(nobjs);
+    memo->slots = calloc(memo->cap, sizeof(struct memo_slot));
+    return (memo->slots != NULL);
+}
+
+static void memo_destroy(struct memo_table *memo)
+{
+    free(memo->slots);
+}
+
+static bool memo_grow(struct memo_table *memo)
+{
+    struct memo_table grown = *memo;
+    grown.cap = memo->cap * 2;
+    grown.slots = calloc(grown.cap, sizeof(struct memo_slot));
+    if(!grown.slots)
+        return false;
+
+    for(size_t i = 0; i < memo->cap; i++) {
+        if(!memo->slots[i].obj)
+            continue;
+        *memo_find(&grown, memo->slots[i].obj) = memo->slots[i];
+    }
+
+    free(memo->slots);
+    *memo = grown;
+    return true;
+}
+
 static bool pickle_ctx_init(struct pickle_ctx *ctx)
 {
-    if(NULL == (ctx->memo = kh_init(memo))) {
+    vec_pobj_init(&ctx->to_free);
+
+    if(!memo_init(&ctx->memo, s_memo_hint)) {
         SET_EXC(PyExc_MemoryError, "Memo table allocation");
         goto fail_memo;
     }
 
-    vec_pobj_init(&ctx->to_free);
     return true;
 
 fail_memo:
@@ -6269,7 +6517,7 @@ static void pickle_ctx_destroy(struct pickle_ctx *ctx)
     }
 
     vec_pobj_destroy(&ctx->to_free);
-    kh_destroy(memo, ctx->memo);
+    memo_destroy(&ctx->memo);
 }
 
 static bool unpickle_ctx_init(struct unpickle_ctx *ctx)
@@ -6284,7 +6532,7 @@ static bool unpickle_ctx_init(struct unpickle_ctx *ctx)
 static void unpickle_ctx_destroy(struct unpickle_ctx *ctx)
 {
     for(int i = 0; i < vec_size(&ctx->memo); i++) {
-        Py_DECREF(vec_AT(&ctx->memo, i));    
+        Py_XDECREF(vec_AT(&ctx->memo, i));    
     }
     
     vec_int_destroy(&ctx->mark_stack);
@@ -6292,31 +6540,53 @@ static void unpickle_ctx_destroy(struct unpickle_ctx *ctx)
     vec_pobj_destroy(&ctx->stack);
 }
 
-static bool memo_contains(const struct pickle_ctx *ctx, PyObject *obj)
+static bool unpickle_memo_reserve(struct unpickle_ctx *ctx, size_t size)
 {
-    uintptr_t id = (uintptr_t)obj;
-    khiter_t k = kh_get(memo, ctx->memo, id);
-    if(k != kh_end(ctx->memo))
+    /* The memo is addressed directly by the index in the stream. The pickler 
+     * hands out indices densely, so the array grows geometrically, with any
+     * skipped slots left empty. */
+    if(size <= vec_size(&ctx->memo))
         return true;
-    return false;
+
+    if(size > ctx->memo.capacity) {
+        size_t cap = ctx->memo.capacity ? ctx->memo.capacity : MEMO_MIN_CAP;
+        while(cap < size)
+            cap *= 2;
+        if(!vec_pobj_resize(&ctx->memo, cap))
+            return false;
+    }
+
+    memset(ctx->memo.array + vec_size(&ctx->memo), 0, 
+        (size - vec_size(&ctx->memo)) * sizeof(PyObject*));
+    ctx->memo.size = size;
+    return true;
+}
+
+static bool memo_contains(const struct pickle_ctx *ctx, PyObject *obj)
+{
+    return (memo_find(&ctx->memo, obj)->obj == obj);
 }
 
 static int memo_idx(const struct pickle_ctx *ctx, PyObject *obj)
 {
-    uintptr_t id = (uintptr_t)obj;
-    khiter_t k = kh_get(memo, ctx->memo, id);
-    assert(kh_exist(ctx->memo, k));
-    return kh_value(ctx->memo, k).idx;
+    struct memo_slot *slot = memo_find(&ctx->memo, obj);
+    assert(slot->obj == obj);
+    return slot->idx;
 }
 
 static void memoize(struct pickle_ctx *ctx, PyObject *obj)
 {
-    int ret;
-    int idx = kh_size(ctx->memo);
+    if((ctx->memo.size + 1) > ctx->memo.cap * MEMO_MAX_LOAD) {
+        /* On allocation failure, keep filling the current table. It 
+         * only stops working once it is completely full. */
+        bool grown = memo_grow(&ctx->memo);
+        assert(grown || ctx->memo.size + 1 < ctx->memo.cap);
+        (void)grown;
+    }
 
-    khiter_t k = kh_put(memo, ctx->memo, (uintptr_t)obj, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(ctx->memo, k) = (struct memo_entry){idx, obj};
+    struct memo_slot *slot = memo_find(&ctx->memo, obj);
+    assert(slot->obj == NULL);
+    *slot = (struct memo_slot){obj, ctx->memo.size++};
 }
 
 static bool emit_get(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
@@ -6342,7 +6612,15 @@ static bool pickle_attrs(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
     const char mark = MARK;
     CHK_TRUE(rw->write(rw, &mark, 1, 1), fail);
 
-    PyObject *ndw_attrs = nonderived_writable_attrs(obj);
+    /* The getset attributes of entities are part of their' native state */
+    PyObject *ndw_attrs;
+    if(is_entity(obj)) {
+        PyObject **dictptr = _PyObject_GetDictPtr(obj);
+        ndw_attrs = (dictptr && *dictptr) ? PyDict_Copy(*dictptr) : PyDict_New();
+    }else{
+        ndw_attrs = nonderived_writable_attrs(obj);
+    }
+    CHK_TRUE(ndw_attrs, fail);
     vec_pobj_push(&ctx->to_free, ndw_attrs);
 
     PyObject *key, *value;
@@ -6402,7 +6680,10 @@ static bool pickle_obj(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *stream)
     /* It's not one of the known builtins */
     if(NULL == pf) {
 
-        if(obj->ob_type->tp_flags & Py_TPFLAGS_HEAPTYPE) {
+        /* Script-defined subclasses of the engine's entity types */
+        if(is_entity(obj)) {
+            pf = entity_pickle;
+        }else if(obj->ob_type->tp_flags & Py_TPFLAGS_HEAPTYPE) {
             pf = newclass_instance_pickle;
         }else{
             SET_RUNTIME_EXC("Cannot pickle object of type:%s", obj->ob_type->tp_name);
@@ -6439,6 +6720,257 @@ fail:
     return false;
 }
 
+static PyObject *zlib_func(const char *name)
+{
+    PyObject *zlib = PyImport_ImportModule("zlib");
+    if(!zlib)
+        return NULL;
+
+    PyObject *ret = PyObject_GetAttrString(zlib, name);
+    Py_DECREF(zlib);
+    return ret;
+}
+
+static bool frame_flush(struct frame_ctx *fctx)
+{
+    struct frame_desc desc = (struct frame_desc){fctx->size, fctx->size};
+    const void *data = fctx->buff;
+    PyObject *zipped = NULL;
+
+    if(fctx->compress && fctx->size > 0) {
+
+        zipped = PyObject_CallFunction(fctx->zfunc, "s#i", 
+            (char*)fctx->buff, (int)fctx->size, FRAME_ZLIB_LVL);
+        if(!zipped || !PyString_Check(zipped)) {
+            DEFAULT_ERR(PyExc_RuntimeError, "Unexpected zlib result type");
+            goto fail;
+        }
+
+        /* Incompressible frames are stored as-is */
+        if(PyString_GET_SIZE(zipped) < fctx->size) {
+            desc.stored_size = PyString_GET_SIZE(zipped);
+            data = PyString_AS_STRING(zipped);
+        }
+    }
+
+    CHK_TRUE(SDL_RWwrite(fctx->stream, &desc, sizeof(desc), 1), fail_write);
+    if(desc.stored_size) {
+        CHK_TRUE(SDL_RWwrite(fctx->stream, data, desc.stored_size, 1), fail_write);
+    }
+
+    Py_XDECREF(zipped);
+    fctx->size = 0;
+    return true;
+
+fail_write:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+fail:
+    Py_XDECREF(zipped);
+    return false;
+}
+
+static bool frame_load(struct frame_ctx *fctx)
+{
+    struct frame_desc desc;
+    PyObject *zipped = NULL, *raw = NULL;
+
+    CHK_TRUE(SDL_RWread(fctx->stream, &desc, sizeof(desc), 1), fail_read);
+    if(desc.raw_size > FRAME_SIZE || desc.stored_size > desc.raw_size) {
+        SET_RUNTIME_EXC("Bad frame in pickle stream");
+        goto fail;
+    }
+
+    fctx->pos = 0;
+    fctx->size = desc.raw_size;
+    fctx->eof = (desc.raw_size == 0);
+
+    if(desc.stored_size == desc.raw_size) {
+        if(desc.raw_size) {
+            CHK_TRUE(SDL_RWread(fctx->stream, fctx->buff, desc.raw_size, 1), fail_read);
+        }
+        return true;
+    }
+
+    if(!fctx->zfunc) {
+        SET_RUNTIME_EXC("Compressed frame in uncompressed pickle stream");
+        goto fail;
+    }
+
+    CHK_TRUE(zipped = PyString_FromStringAndSize(NULL, desc.stored_size), fail);
+    CHK_TRUE(SDL_RWread(fctx->stream, PyString_AS_STRING(zipped), desc.stored_size, 1), fail_read);
+
+    /* Pass in the final size, so that the output buffer never has to grow */
+    raw = PyObject_CallFunction(fctx->zfunc, "Oii", zipped, 15, (int)desc.raw_size);
+    if(!raw || !PyString_Check(raw) || PyString_GET_SIZE(raw) != desc.raw_size) {
+        DEFAULT_ERR(PyExc_RuntimeError, "Bad frame in pickle stream");
+        goto fail;
+    }
+
+    memcpy(fctx->buff, PyString_AS_STRING(raw), desc.raw_size);
+    Py_DECREF(raw);
+    Py_DECREF(zipped);
+    return true;
+
+fail_read:
+    DEFAULT_ERR(PyExc_IOError, "Error reading from pickle stream");
+fail:
+    Py_XDECREF(raw);
+    Py_XDECREF(zipped);
+    return false;
+}
+
+static Sint64 rw_frame_size(SDL_RWops *ctx)
+{
+    return -1;
+}
+
+static Sint64 rw_frame_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    assert(ctx->type == SDL_RWOPS_FRAME);
+    struct frame_ctx *fctx = ctx->hidden.unknown.data1;
+
+    /* Frames can only be walked in order, so only telling the
+     * position in the opcode stream is supported */
+    if(whence != RW_SEEK_CUR || offset != 0)
+        return SDL_SetError("rw_frame_seek: Framed pickle streams are not seekable");
+    return fctx->total;
+}
+
+static size_t rw_frame_write(SDL_RWops *ctx, const void *ptr, size_t size, size_t num)
+{
+    assert(ctx->type == SDL_RWOPS_FRAME);
+    struct frame_ctx *fctx = ctx->hidden.unknown.data1;
+    const unsigned char *src = ptr;
+    size_t left = size * num;
+
+    while(left > 0) {
+
+        size_t chunk = MIN(left, FRAME_SIZE - fctx->size);
+        memcpy(fctx->buff + fctx->size, src, chunk);
+        fctx->size += chunk;
+        fctx->total += chunk;
+        src += chunk;
+        left -= chunk;
+
+        if(fctx->size == FRAME_SIZE && !frame_flush(fctx))
+            return 0;
+    }
+    return num;
+}
+
+static size_t rw_frame_read(SDL_RWops *ctx, void *ptr, size_t size, size_t num)
+{
+    assert(ctx->type == SDL_RWOPS_FRAME);
+    struct frame_ctx *fctx = ctx->hidden.unknown.data1;
+    unsigned char *dst = ptr;
+    size_t left = size * num;
+
+    while(left > 0) {
+
+        if(fctx->pos == fctx->size) {
+            if(fctx->eof || !frame_load(fctx))
+                return 0;
+            continue;
+        }
+
+        size_t chunk = MIN(left, fctx->size - fctx->pos);
+        memcpy(dst, fctx->buff + fctx->pos, chunk);
+        fctx->pos += chunk;
+        fctx->total += chunk;
+        dst += chunk;
+        left -= chunk;
+    }
+    return num;
+}
+
+static int rw_frame_close(SDL_RWops *ctx)
+{
+    assert(ctx->type == SDL_RWOPS_FRAME);
+    struct frame_ctx *fctx = ctx->hidden.unknown.data1;
+    Py_XDECREF(fctx->zfunc);
+    free(ctx);
+    return 0;
+}
+
+/* Returns an RWops which frames (or unframes) the data written to (or read 
+ * from) it, to (or from) the underlying stream. The underlying stream is 
+ * not closed along with the frame RWops. */
+static SDL_RWops *frame_rwops(SDL_RWops *stream, bool write, bool compress)
+{
+    SDL_RWops *ret = malloc(sizeof(SDL_RWops) + sizeof(struct frame_ctx));
+    if(!ret) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    struct frame_ctx *fctx = (struct frame_ctx*)(ret + 1);
+    fctx->stream = stream;
+    fctx->zfunc = NULL;
+    fctx->compress = compress;
+    fctx->eof = false;
+    fctx->size = 0;
+    fctx->pos = 0;
+    fctx->total = 0;
+
+    if(compress && !(fctx->zfunc = zlib_func(write ? "compress" : "decompress"))) {
+        free(ret);
+        return NULL;
+    }
+
+    ret->size = rw_frame_size;
+    ret->seek = rw_frame_seek;
+    ret->read = rw_frame_read;
+    ret->write = rw_frame_write;
+    ret->close = rw_frame_close;
+    ret->type = SDL_RWOPS_FRAME;
+    ret->hidden.unknown.data1 = fctx;
+    return ret;
+}
+
+static PyObject *unpickle_opstream(SDL_RWops *stream)
+{
+    struct unpickle_ctx ctx;
+    unpickle_ctx_init(&ctx);
+
+    while(!ctx.stop) {
+    
+        unsigned char op;
+        bool xtend = false;
+
+        CHK_TRUE(stream->read(stream, &op, 1, 1), err);
+
+        if(op == PF_EXTEND) {
+
+            CHK_TRUE(stream->read(stream, &op, 1, 1), err);
+            xtend =true;
+        }
+
+        unpickle_func_t upf = xtend ? s_ext_op_dispatch_table[op]
+                                    : s_op_dispatch_table[op];
+        if(!upf) {
+            SET_RUNTIME_EXC("Bad %sopcode %c[%d]", (xtend ? "extended " : ""), op, (int)op);
+            goto err;
+        }
+        CHK_TRUE(upf(&ctx, stream) == 0, err);
+    }
+
+    if(vec_size(&ctx.stack) != 1) {
+        SET_RUNTIME_EXC("Unexpected stack size [%u] after 'STOP'", (unsigned)vec_size(&ctx.stack));
+        goto err;
+    }
+
+    PyObject *ret = vec_pobj_pop(&ctx.stack);
+    unpickle_ctx_destroy(&ctx);
+
+    assert(!PyErr_Occurred());
+    return ret;
+
+err:
+    DEFAULT_ERR(PyExc_IOError, "Error reading from pickle stream");
+    unpickle_ctx_destroy(&ctx);
+    return NULL;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -6512,6 +7044,7 @@ bool S_PickleObjgraph(PyObject *obj, SDL_RWops *stream)
     char term[] = {STOP, '\0'};
     CHK_TRUE(stream->write(stream, term, 1, ARR_SIZE(term)), err_write);
 
+    s_memo_hint = ctx.memo.size;
     pickle_ctx_destroy(&ctx);
     return true;
 
@@ -6523,47 +7056,73 @@ err:
     return false;
 }
 
-PyObject *S_UnpickleObjgraph(SDL_RWops *stream)
+bool S_PickleObjgraphFramed(PyObject *obj, SDL_RWops *stream, bool compress)
 {
-    struct unpickle_ctx ctx;
-    unpickle_ctx_init(&ctx);
+    struct frame_hdr hdr = (struct frame_hdr){
+        .version = FRAME_VERSION,
+        .frame_size = FRAME_SIZE,
+        .flags = compress ? FRAME_FLAG_COMPRESSED : 0,
+    };
+    memcpy(hdr.magic, FRAME_MAGIC, sizeof(hdr.magic));
+    CHK_TRUE(SDL_RWwrite(stream, &hdr, sizeof(hdr), 1), fail_write);
 
-    while(!ctx.stop) {
-    
-        unsigned char op;
-        bool xtend = false;
+    SDL_RWops *frames = frame_rwops(stream, true, compress);
+    if(!frames)
+        goto fail;
 
-        CHK_TRUE(stream->read(stream, &op, 1, 1), err);
+    if(!S_PickleObjgraph(obj, frames))
+        goto fail_pickle;
 
-        if(op == PF_EXTEND) {
+    /* Write out the last partial frame, followed by the empty one */
+    CHK_TRUE(frame_flush(frames->hidden.unknown.data1), fail_pickle);
+    CHK_TRUE(frame_flush(frames->hidden.unknown.data1), fail_pickle);
 
-            CHK_TRUE(stream->read(stream, &op, 1, 1), err);
-            xtend =true;
-        }
+    frames->close(frames);
+    return true;
 
-        unpickle_func_t upf = xtend ? s_ext_op_dispatch_table[op]
-                                    : s_op_dispatch_table[op];
-        if(!upf) {
-            SET_RUNTIME_EXC("Bad %sopcode %c[%d]", (xtend ? "extended " : ""), op, (int)op);
-            goto err;
+fail_pickle:
+    frames->close(frames);
+fail_write:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+fail:
+    assert(PyErr_Occurred());
+    return false;
+}
+
+PyObject *S_UnpickleObjgraph(SDL_RWops *stream)
+{
+    struct frame_hdr hdr;
+    Sint64 start = stream->seek(stream, 0, RW_SEEK_CUR);
+
+    if(!stream->read(stream, hdr.magic, sizeof(hdr.magic), 1)
+    || 0 != memcmp(hdr.magic, FRAME_MAGIC, sizeof(hdr.magic))) {
+
+        /* This is a raw opcode stream */
+        if(start < 0 || stream->seek(stream, start, RW_SEEK_SET) < 0) {
+            SET_EXC(PyExc_IOError, "Pickle stream is not seekable");
+            return NULL;
         }
-        CHK_TRUE(upf(&ctx, stream) == 0, err);
+        return unpickle_opstream(stream);
     }
 
-    if(vec_size(&ctx.stack) != 1) {
-        SET_RUNTIME_EXC("Unexpected stack size [%u] after 'STOP'", (unsigned)vec_size(&ctx.stack));
-        goto err;
+    CHK_TRUE(stream->read(stream, ((char*)&hdr) + sizeof(hdr.magic), 
+        sizeof(hdr) - sizeof(hdr.magic), 1), fail_read);
+
+    if(hdr.version != FRAME_VERSION || hdr.frame_size > FRAME_SIZE) {
+        SET_RUNTIME_EXC("Unsupported framed pickle stream [version: %u]", (unsigned)hdr.version);
+        return NULL;
     }
 
-    PyObject *ret = vec_pobj_pop(&ctx.stack);
-    unpickle_ctx_destroy(&ctx);
+    SDL_RWops *frames = frame_rwops(stream, false, !!(hdr.flags & FRAME_FLAG_COMPRESSED));
+    if(!frames)
+        return NULL;
 
-    assert(!PyErr_Occurred());
+    PyObject *ret = unpickle_opstream(frames);
+    frames->close(frames);
     return ret;
 
-err:
+fail_read:
     DEFAULT_ERR(PyExc_IOError, "Error reading from pickle stream");
-    unpickle_ctx_destroy(&ctx);
     return NULL;
 }
 
@@ -47,6 +47,9 @@ bool S_Pickle_Init(PyObject *module);
 void S_Pickle_Shutdown(void);
 
 bool S_PickleObjgraph(PyObject *obj, SDL_RWops *stream);
+/* Writes the opcode stream in a container of fixed-size frames, each of 
+ * which is optionally compressed. S_UnpickleObjgraph reads either format. */
+bool S_PickleObjgraphFramed(PyObject *obj, SDL_RWops *stream, bool compress);
 /* Returns a new reference */
 PyObject *S_UnpickleObjgraph(SDL_RWops *stream);
 
@@ -0,0 +1,731 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "py_save.h"
+#include "py_pickle.h"
+#include "../lib/public/SDL_vec_rwops.h"
+#include "../lib/public/khash.h"
+#include "../game/public/game.h"
+#include "../main.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
+
+
+#define SAVE_MAGIC              "PFSV"
+#define SAVE_VERSION            (2)
+#define SAVE_FLAG_COMPRESSED    (1 << 0)
+#define SAVE_FLAG_DELTA         (1 << 1)
+
+/* The pickle streams are split into chunks at the positions picked out by 
+ * a rolling hash of the content, so that inserting or removing some bytes 
+ * only changes the chunks around the edit, and not all the ones after it. 
+ * The average chunk is about CHUNK_MIN + CHUNK_MASK + 1 bytes. */
+#define CHUNK_MIN               (512)
+#define CHUNK_MAX               (16384)
+#define CHUNK_MASK              (0x7ff)
+
+#define DELTA_OP_COPY           (0)
+#define DELTA_OP_DATA           (1)
+#define DELTA_OP_END            (0xff)
+
+/* How long shutdown waits on an outstanding save before killing it */
+#define SHUTDOWN_WAIT_MS        (5000)
+
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+
+/* The body of a save is the size of the native simulation state, the native 
+ * state itself, and then the pickled object graph of the session. */
+struct save_hdr{
+    char     magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+    /* The size of the body, once decompressed */
+    uint64_t raw_size;
+};
+
+struct buff{
+    char   *data;
+    size_t  size;
+};
+
+struct chunk_ref{
+    uint64_t offset;
+    uint32_t size;
+};
+
+KHASH_MAP_INIT_INT64(chunk, struct chunk_ref)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static enum save_status s_status = SAVE_IDLE;
+#if !defined(_WIN32)
+static pid_t            s_child = -1;
+#endif
+static uint32_t         s_gear[256];
+static bool             s_gear_init = false;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void save_gear_init(void)
+{
+    if(s_gear_init)
+        return;
+
+    /* The table must be the same every time, for the chunks of different 
+     * saves to line up */
+    uint32_t x = 0x2545f491;
+    for(int i = 0; i < 256; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        s_gear[i] = x;
+    }
+    s_gear_init = true;
+}
+
+static uint64_t save_hash(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static size_t save_chunk_size(const char *data, size_t size)
+{
+    if(size <= CHUNK_MIN)
+        return size;
+
+    uint32_t hash = 0;
+    size_t max = MIN(size, CHUNK_MAX);
+
+    for(size_t i = 0; i < max; i++) {
+        hash = (hash << 1) + s_gear[(unsigned char)data[i]];
+        if(i >= CHUNK_MIN && (hash & CHUNK_MASK) == 0)
+            return i + 1;
+    }
+    return max;
+}
+
+static void save_write_u64(SDL_RWops *rw, uint64_t val)
+{
+    SDL_RWwrite(rw, &val, sizeof(val), 1);
+}
+
+static uint64_t save_read_u64(SDL_RWops *rw)
+{
+    uint64_t val = 0;
+    SDL_RWread(rw, &val, sizeof(val), 1);
+    return val;
+}
+
+static bool save_buff_from_rwops(SDL_RWops *rw, struct buff *out)
+{
+    out->size = rw->size(rw);
+    out->data = malloc(out->size ? out->size : 1);
+    if(!out->data)
+        return false;
+
+    rw->seek(rw, 0, RW_SEEK_SET);
+    if(out->size && SDL_RWread(rw, out->data, out->size, 1) != 1) {
+        free(out->data);
+        return false;
+    }
+    return true;
+}
+
+/* 'func' is 'compress' or 'decompress' */
+static bool save_zlib(char *func, const struct buff *in, struct buff *out)
+{
+    bool ret = false;
+    PyObject *zlib = NULL, *str = NULL, *result = NULL;
+
+    if(!(zlib = PyImport_ImportModule("zlib")))
+        goto out;
+    if(!(str = PyString_FromStringAndSize(in->data, in->size)))
+        goto out;
+    if(!(result = PyObject_CallMethod(zlib, func, "O", str)))
+        goto out;
+    if(!PyString_Check(result)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unexpected zlib result type.");
+        goto out;
+    }
+
+    out->size = PyString_GET_SIZE(result);
+    out->data = malloc(out->size ? out->size : 1);
+    if(!out->data) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    memcpy(out->data, PyString_AS_STRING(result), out->size);
+    ret = true;
+
+out:
+    Py_XDECREF(result);
+    Py_XDECREF(str);
+    Py_XDECREF(zlib);
+    return ret;
+}
+
+/* Reads the body of a save, decompressing it if needed */
+static bool save_read_body(const char *path, uint32_t *out_flags, struct buff *out)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream) {
+        PyErr_Format(PyExc_IOError, "Could not open save file [%s]", path);
+        return false;
+    }
+
+    struct save_hdr hdr;
+    if(SDL_RWread(stream, &hdr, sizeof(hdr), 1) != 1
+    || memcmp(hdr.magic, SAVE_MAGIC, sizeof(hdr.magic))
+    || hdr.version != SAVE_VERSION) {
+        PyErr_Format(PyExc_IOError, "[%s] is not a save file of a supported version", path);
+        goto fail;
+    }
+
+    uint32_t flags = hdr.flags;
+    uint64_t raw_size = hdr.raw_size;
+    int64_t begin = stream->seek(stream, 0, RW_SEEK_CUR);
+    int64_t end = stream->seek(stream, 0, RW_SEEK_END);
+    stream->seek(stream, begin, RW_SEEK_SET);
+
+    struct buff body = (struct buff){ .size = end - begin };
+    if(!(body.data = malloc(body.size ? body.size : 1))) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    if(body.size && SDL_RWread(stream, body.data, body.size, 1) != 1) {
+        PyErr_Format(PyExc_IOError, "Could not read save file [%s]", path);
+        free(body.data);
+        goto fail;
+    }
+    SDL_RWclose(stream);
+
+    if(flags & SAVE_FLAG_COMPRESSED) {
+
+        struct buff raw;
+        bool ok = save_zlib("decompress", &body, &raw);
+        free(body.data);
+        if(!ok)
+            return false;
+        body = raw;
+    }
+
+    if(body.size != raw_size) {
+        PyErr_Format(PyExc_IOError, "Corrupted save file [%s]", path);
+        free(body.data);
+        return false;
+    }
+
+    *out_flags = flags;
+    *out = body;
+    return true;
+
+fail:
+    SDL_RWclose(stream);
+    return false;
+}
+
+/* Returns the pickle stream of a full save */
+static bool save_read_full(const char *path, struct buff *out)
+{
+    uint32_t flags;
+    if(!save_read_body(path, &flags, out))
+        return false;
+
+    if(flags & SAVE_FLAG_DELTA) {
+        PyErr_Format(PyExc_IOError, "The base save [%s] must be a full save", path);
+        free(out->data);
+        return false;
+    }
+    return true;
+}
+
+/* The delta is the path of the base save, its' size and hash, and then the 
+ * list of ops rebuilding the new stream out of ranges of the base and new data. 
+ */
+static bool save_make_delta(const struct buff *stream, const char *base, struct buff *out)
+{
+    struct buff base_stream;
+    if(!save_read_full(base, &base_stream))
+        return false;
+
+    bool ret = false;
+    SDL_RWops *vops = NULL;
+    khash_t(chunk) *index = kh_init(chunk);
+    if(!index) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for(size_t off = 0; off < base_stream.size;) {
+
+        size_t size = save_chunk_size(base_stream.data + off, base_stream.size - off);
+        int status;
+        khiter_t k = kh_put(chunk, index, save_hash(base_stream.data + off, size), &status);
+        if(status == -1) {
+            PyErr_NoMemory();
+            goto out;
+        }
+        if(status != 0)
+            kh_val(index, k) = (struct chunk_ref){off, size};
+        off += size;
+    }
+
+    vops = PFSDL_VectorRWOps();
+    save_write_u64(vops, strlen(base));
+    SDL_RWwrite(vops, base, strlen(base), 1);
+    save_write_u64(vops, base_stream.size);
+    save_write_u64(vops, save_hash(base_stream.data, base_stream.size));
+
+    /* Runs of new data and adjacent base ranges are merged into single ops */
+    size_t data_begin = 0, data_size = 0;
+    uint64_t copy_begin = 0, copy_size = 0;
+
+    for(size_t off = 0; off <= stream->size;) {
+
+        size_t size = 0;
+        khiter_t k = kh_end(index);
+        if(off < stream->size) {
+            size = save_chunk_size(stream->data + off, stream->size - off);
+            k = kh_get(chunk, index, save_hash(stream->data + off, size));
+        }
+
+        bool match = (k != kh_end(index))
+                  && kh_val(index, k).size == size
+                  && !memcmp(base_stream.data + kh_val(index, k).offset, stream->data + off, size);
+
+        if((!match || off == stream->size) && copy_size) {
+            SDL_RWwrite(vops, &(uint8_t){DELTA_OP_COPY}, 1, 1);
+            save_write_u64(vops, copy_begin);
+            save_write_u64(vops, copy_size);
+            copy_size = 0;
+        }
+        if((match || off == stream->size) && data_size) {
+            SDL_RWwrite(vops, &(uint8_t){DELTA_OP_DATA}, 1, 1);
+            save_write_u64(vops, data_size);
+            SDL_RWwrite(vops, stream->data + data_begin, data_size, 1);
+            data_size = 0;
+        }
+        if(off == stream->size)
+            break;
+
+        if(match) {
+            uint64_t chunk_off = kh_val(index, k).offset;
+            if(copy_size && copy_begin + copy_size == chunk_off) {
+                copy_size += size;
+            }else{
+                if(copy_size) {
+                    SDL_RWwrite(vops, &(uint8_t){DELTA_OP_COPY}, 1, 1);
+                    save_write_u64(vops, copy_begin);
+                    save_write_u64(vops, copy_size);
+                }
+                copy_begin = chunk_off;
+                copy_size = size;
+            }
+        }else{
+            if(!data_size)
+                data_begin = off;
+            data_size += size;
+        }
+        off += size;
+    }
+    SDL_RWwrite(vops, &(uint8_t){DELTA_OP_END}, 1, 1);
+
+    if(!save_buff_from_rwops(vops, out)) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    ret = true;
+
+out:
+    if(vops)
+        SDL_RWclose(vops);
+    if(index)
+        kh_destroy(chunk, index);
+    free(base_stream.data);
+    return ret;
+}
+
+static bool save_apply_delta(const struct buff *delta, struct buff *out)
+{
+    bool ret = false;
+    struct buff base_stream = (struct buff){0};
+    SDL_RWops *vops = NULL;
+    SDL_RWops *in = SDL_RWFromConstMem(delta->data, delta->size);
+    if(!in) {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    char base[512];
+    uint64_t pathlen = save_read_u64(in);
+    if(pathlen >= sizeof(base) || (pathlen && SDL_RWread(in, base, pathlen, 1) != 1))
+        goto fail_corrupt;
+    base[pathlen] = '\0';
+
+    uint64_t base_size = save_read_u64(in);
+    uint64_t base_hash = save_read_u64(in);
+
+    if(!save_read_full(base, &base_stream))
+        goto out;
+
+    if(base_stream.size != base_size || save_hash(base_stream.data, base_stream.size) != base_hash) {
+        PyErr_Format(PyExc_IOError, "The base save [%s] has changed since the delta was made", base);
+        goto out;
+    }
+
+    vops = PFSDL_VectorRWOps();
+    while(true) {
+
+        uint8_t op;
+        if(SDL_RWread(in, &op, 1, 1) != 1)
+            goto fail_corrupt;
+        if(op == DELTA_OP_END)
+            break;
+
+        uint64_t a = save_read_u64(in);
+        if(op == DELTA_OP_COPY) {
+
+            /* The offsets come from the file - check them without wrapping */
+            uint64_t size = save_read_u64(in);
+            if(a > base_stream.size || size > base_stream.size - a)
+                goto fail_corrupt;
+            SDL_RWwrite(vops, base_stream.data + a, size, 1);
+
+        }else if(op == DELTA_OP_DATA) {
+
+            int64_t pos = in->seek(in, 0, RW_SEEK_CUR);
+            if(pos < 0 || pos > delta->size || a > delta->size - pos)
+                goto fail_corrupt;
+            SDL_RWwrite(vops, delta->data + pos, a, 1);
+            in->seek(in, a, RW_SEEK_CUR);
+
+        }else{
+            goto fail_corrupt;
+        }
+    }
+
+    if(!save_buff_from_rwops(vops, out)) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    ret = true;
+    goto out;
+
+fail_corrupt:
+    PyErr_SetString(PyExc_IOError, "Corrupted delta save");
+out:
+    if(vops)
+        SDL_RWclose(vops);
+    SDL_RWclose(in);
+    free(base_stream.data);
+    return ret;
+}
+
+/* Writes the size-prefixed native state of the simulation */
+static bool save_native_state(SDL_RWops *out)
+{
+    struct buff native;
+    SDL_RWops *vops = PFSDL_VectorRWOps();
+    bool ok = G_SaveState(vops) && save_buff_from_rwops(vops, &native);
+    SDL_RWclose(vops);
+
+    if(!ok) {
+        PyErr_SetString(PyExc_IOError, "Could not save the simulation state");
+        return false;
+    }
+
+    save_write_u64(out, native.size);
+    if(native.size)
+        SDL_RWwrite(out, native.data, native.size, 1);
+    free(native.data);
+    return true;
+}
+
+/* Does all the work of a save. When the platform supports it, this is called 
+ * in a forked copy of the process, which gets a copy-on-write snapshot of the 
+ * object graph and may take as long as it likes. */
+static bool save_write(PyObject *obj, const char *path, const char *base, bool compress)
+{
+    bool ret = false;
+    uint32_t flags = 0;
+    struct buff stream = {0}, body = {0};
+
+    SDL_RWops *vops = PFSDL_VectorRWOps();
+    if(!save_native_state(vops) || !S_PickleObjgraph(obj, vops)) {
+        SDL_RWclose(vops);
+        return false;
+    }
+    bool ok = save_buff_from_rwops(vops, &stream);
+    SDL_RWclose(vops);
+    if(!ok) {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    body = stream; 
+    stream.data = NULL;
+
+    if(base) {
+        struct buff delta;
+        if(!save_make_delta(&body, base, &delta))
+            goto out;
+        free(body.data);
+        body = delta;
+        flags |= SAVE_FLAG_DELTA;
+    }
+
+    uint64_t raw_size = body.size;
+    if(compress) {
+        struct buff packed;
+        if(!save_zlib("compress", &body, &packed))
+            goto out;
+        free(body.data);
+        body = packed;
+        flags |= SAVE_FLAG_COMPRESSED;
+    }
+
+    char tmp[512];
+    if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) {
+        PyErr_SetString(PyExc_IOError, "Save file path is too long");
+        goto out;
+    }
+
+    SDL_RWops *file = SDL_RWFromFile(tmp, "wb");
+    if(!file) {
+        PyErr_Format(PyExc_IOError, "Could not open [%s] for writing", tmp);
+        goto out;
+    }
+
+    struct save_hdr hdr = (struct save_hdr){
+        .magic = SAVE_MAGIC,
+        .version = SAVE_VERSION,
+        .flags = flags,
+        .raw_size = raw_size,
+    };
+    ok = (SDL_RWwrite(file, &hdr, sizeof(hdr), 1) == 1)
+      && (body.size == 0 || SDL_RWwrite(file, body.data, body.size, 1) == 1);
+    SDL_RWclose(file);
+
+    if(!ok) {
+        PyErr_Format(PyExc_IOError, "Could not write [%s]", tmp);
+        remove(tmp);
+        goto out;
+    }
+
+#if defined(_WIN32)
+    remove(path);
+#endif
+    if(0 != rename(tmp, path)) {
+        PyErr_Format(PyExc_IOError, "Could not replace [%s]", path);
+        remove(tmp);
+        goto out;
+    }
+    ret = true;
+
+out:
+    free(body.data);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void S_Save_Shutdown(void)
+{
+#if !defined(_WIN32)
+    if(s_child > 0) {
+
+        /* A wedged child must not hang the engine on its' way out */
+        uint32_t start = SDL_GetTicks();
+        pid_t ret;
+        while(0 == (ret = waitpid(s_child, NULL, WNOHANG))
+           && SDL_GetTicks() - start < SHUTDOWN_WAIT_MS) {
+            SDL_Delay(10);
+        }
+
+        if(ret == 0) {
+            fprintf(stderr, "Killing the save process that did not finish in time.\n");
+            kill(s_child, SIGKILL);
+            waitpid(s_child, NULL, 0);
+        }
+        s_child = -1;
+    }
+#endif
+    s_status = SAVE_IDLE;
+}
+
+bool S_Save_Begin(PyObject *obj, const char *path, const char *base, bool compress)
+{
+    ASSERT_IN_MAIN_THREAD();
+    save_gear_init();
+
+    if(S_Save_Poll() == SAVE_IN_PROGRESS) {
+        PyErr_SetString(PyExc_RuntimeError, "A save is already in progress.");
+        return false;
+    }
+
+#if !defined(_WIN32)
+    /* The child writes the engine's native state (positions, movement and 
+     * combat) followed by the pickled script state, then leaves. The native 
+     * state is only ever changed by the main thread, which is the one that 
+     * forked from a script, never in the middle of one of its updates. So 
+     * the child gets a consistent copy of it. Writing it only reads the 
+     * tables and allocates with malloc, which is safe after a fork. The interpreter's locks may have been held by the 
+     * threads that were not forked, so they are reset before anything else. */
+    fflush(NULL);
+    pid_t pid = fork();
+    if(pid == 0) {
+        PyOS_AfterFork();
+        bool ok = save_write(obj, path, base, compress);
+        if(!ok)
+            PyErr_Print();
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if(pid > 0) {
+        s_child = pid;
+        s_status = SAVE_IN_PROGRESS;
+        return true;
+    }
+    /* If we could not fork, fall through to saving in place */
+#endif
+
+    bool ret = save_write(obj, path, base, compress);
+    s_status = ret ? SAVE_SUCCEEDED : SAVE_FAILED;
+    return ret;
+}
+
+enum save_status S_Save_Poll(void)
+{
+#if !defined(_WIN32)
+    if(s_child > 0) {
+
+        int wstatus;
+        pid_t ret = waitpid(s_child, &wstatus, WNOHANG);
+        if(ret == 0)
+            return SAVE_IN_PROGRESS;
+
+        s_status = (ret == s_child && WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS)
+                 ? SAVE_SUCCEEDED : SAVE_FAILED;
+        s_child = -1;
+    }
+#endif
+
+    enum save_status ret = s_status;
+    s_status = SAVE_IDLE;
+    return ret;
+}
+
+PyObject *S_Save_Load(const char *path)
+{
+    uint32_t flags;
+    struct buff body;
+    if(!save_read_body(path, &flags, &body))
+        return NULL;
+
+    if(flags & SAVE_FLAG_DELTA) {
+
+        struct buff stream;
+        bool ok = save_apply_delta(&body, &stream);
+        free(body.data);
+        if(!ok)
+            return NULL;
+        body = stream;
+    }
+
+    uint64_t native_size = 0;
+    if(body.size >= sizeof(native_size))
+        memcpy(&native_size, body.data, sizeof(native_size));
+
+    if(body.size < sizeof(native_size) || native_size > body.size - sizeof(native_size)) {
+        PyErr_Format(PyExc_IOError, "Corrupted save file [%s]", path);
+        free(body.data);
+        return NULL;
+    }
+
+    const char *native = body.data + sizeof(native_size);
+    const char *pickle = native + native_size;
+    size_t pickle_size = body.size - sizeof(native_size) - native_size;
+
+    SDL_RWops *cmops = SDL_RWFromConstMem(pickle, pickle_size);
+    SDL_RWops *nops = SDL_RWFromConstMem(native, native_size);
+    if(!cmops || !nops || !G_LoadBegin()) {
+        if(cmops)
+            SDL_RWclose(cmops);
+        if(nops)
+            SDL_RWclose(nops);
+        free(body.data);
+        return PyErr_NoMemory();
+    }
+
+    /* The entities are recreated by the unpickler, and then get the rest of 
+     * their' state from the native sections */
+    PyObject *ret = S_UnpickleObjgraph(cmops);
+    if(ret && !G_LoadState(nops)) {
+        PyErr_Format(PyExc_IOError, "Could not load the simulation state of [%s]", path);
+        Py_CLEAR(ret);
+    }
+    G_LoadEnd();
+
+    SDL_RWclose(nops);
+    SDL_RWclose(cmops);
+    free(body.data);
+    return ret;
+}
+
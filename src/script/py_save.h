@@ -0,0 +1,66 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2020 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PY_SAVE_H
+#define PY_SAVE_H
+
+#include <Python.h> /* must be first */
+
+#include <stdbool.h>
+
+enum save_status{
+    SAVE_IDLE,
+    SAVE_IN_PROGRESS,
+    SAVE_SUCCEEDED,
+    SAVE_FAILED,
+};
+
+/* Waits for a save that is still being written */
+void             S_Save_Shutdown(void);
+
+/* Starts writing the pickled object graph to 'path' without blocking the 
+ * caller, where the platform allows for it. When 'base' is not NULL, only 
+ * the parts of the graph's pickle that differ from the (full) save at 'base' 
+ * are written. On failure, a Python exception is set. */
+bool             S_Save_Begin(PyObject *obj, const char *path, const char *base, bool compress);
+/* Returns the status of the last save. A finished save is reported once, 
+ * after which the status is SAVE_IDLE. */
+enum save_status S_Save_Poll(void);
+
+/* Reads back a full or delta save. Returns a new reference. */
+PyObject        *S_Save_Load(const char *path);
+
+#endif
+
@@ -47,10 +47,31 @@
 #include "../ui.h"
 
 #include <assert.h>
+#include <string.h>
 
 #define TO_VEC2T(_nk_vec2i) ((vec2_t){_nk_vec2i.x, _nk_vec2i.y})
 #define TO_VEC2I(_pf_vec2t) ((struct nk_vec2i){_pf_vec2t.x, _pf_vec2t.y})
 
+/* The draw commands emitted by the last 'update' call of a retained window,
+ * along with the panel state needed to close the window after replaying 
+ * them. The copy is only valid for as long as the inputs that shaped it 
+ * (bounds, scroll offsets and style) remain the same. */
+struct win_cache {
+    bool                    valid;
+    void                   *cmds;
+    size_t                  size;
+    size_t                  cap;
+    nk_size                 origin; /* Buffer offset the commands were recorded at */
+    nk_size                 last;   /* Offset of the last command, relative to origin */
+    struct nk_rect          bounds;
+    struct nk_scroll        scroll;
+    struct nk_style_window  style;
+    struct nk_rect          clip;
+    float                   at_x, at_y, max_x;
+    float                   footer_height;
+    struct nk_row_layout    row;
+};
+
 typedef struct {
     PyObject_HEAD
     const char             *name;
@@ -63,6 +84,13 @@ typedef struct {
      * not equal to this window's virtual resolution, the window bounds
      * will be transformed according to the resize mask. */
     struct nk_vec2i         virt_res;
+    /* A retained window only has its 'update' method invoked when it is
+     * marked dirty or when it is receiving mouse input. On other frames, 
+     * the commands recorded during the last 'update' are replayed. */
+    bool                    retained;
+    bool                    dirty;
+    bool                    hovered;
+    struct win_cache        cache;
 }PyWindowObject;
 
 VEC_TYPE(win, PyWindowObject*)
@@ -90,6 +118,7 @@ static PyObject *PyWindow_show(PyWindowObject *self);
 static PyObject *PyWindow_hide(PyWindowObject *self);
 static PyObject *PyWindow_update(PyWindowObject *self);
 static PyObject *PyWindow_on_hide(PyWindowObject *self);
+static PyObject *PyWindow_mark_dirty(PyWindowObject *self);
 static PyObject *PyWindow_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
 static void      PyWindow_dealloc(PyWindowObject *self);
 
@@ -120,6 +149,8 @@ static PyObject *PyWindow_get_closed(PyWindowObject *self, void *closure);
 static PyObject *PyWindow_get_hidden(PyWindowObject *self, void *closure);
 static PyObject *PyWindow_get_interactive(PyWindowObject *self, void *closure);
 static int       PyWindow_set_interactive(PyWindowObject *self, PyObject *value, void *closure);
+static PyObject *PyWindow_get_retained(PyWindowObject *self, void *closure);
+static int       PyWindow_set_retained(PyWindowObject *self, PyObject *value, void *closure);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -212,6 +243,11 @@ static PyMethodDef PyWindow_methods[] = {
     (PyCFunction)PyWindow_on_hide, METH_NOARGS,
     "Callback that gets invoked when the user hides the window with the close button."},
 
+    {"mark_dirty", 
+    (PyCFunction)PyWindow_mark_dirty, METH_NOARGS,
+    "Force the 'update' method of a retained window to be invoked on the next frame. "
+    "Should be called whenever the state shown by the window changes."},
+
     {NULL}  /* Sentinel */
 };
 
@@ -291,6 +327,13 @@ static PyGetSetDef PyWindow_getset[] = {
     (setter)PyWindow_set_interactive,
     "A read-write bool to enable or disable user interactivity for this window.",
     NULL},
+    {"retained",
+    (getter)PyWindow_get_retained, 
+    (setter)PyWindow_set_retained,
+    "A read-write bool to enable or disable retained mode for this window. A retained window "
+    "will re-draw the contents produced by its last 'update' call until it is hovered, clicked "
+    "or explicitly marked dirty.",
+    NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -731,6 +774,12 @@ static PyObject *PyWindow_on_hide(PyWindowObject *self)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyWindow_mark_dirty(PyWindowObject *self)
+{
+    self->dirty = true;
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyWindow_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
     PyObject *self = type->tp_alloc(type, 0);
@@ -745,6 +794,7 @@ static void PyWindow_dealloc(PyWindowObject *self)
     vec_win_del(&s_active_windows, idx);
 
     nk_window_close(s_nk_ctx, self->name);
+    free(self->cache.cmds);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -987,6 +1037,127 @@ static int PyWindow_set_interactive(PyWindowObject *self, PyObject *value, void
     return 0;
 }
 
+static PyObject *PyWindow_get_retained(PyWindowObject *self, void *closure)
+{
+    if(self->retained)
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static int PyWindow_set_retained(PyWindowObject *self, PyObject *value, void *closure)
+{
+    self->retained = PyObject_IsTrue(value);
+    self->cache.valid = false;
+    return 0;
+}
+
+static bool win_can_replay(PyWindowObject *win, struct nk_window *nkwin)
+{
+    const struct nk_input *in = &s_nk_ctx->input;
+
+    /* A window must be rebuilt for one more frame after the mouse leaves it 
+     * so that widgets drop their 'hovered' look. */
+    bool was_hovered = win->hovered;
+    win->hovered = !(win->flags & NK_WINDOW_NOT_INTERACTIVE)
+                && (nk_input_is_mouse_hovering_rect(in, nkwin->bounds)
+                ||  nk_input_any_mouse_click_in_rect(in, nkwin->bounds));
+
+    if(!win->retained || win->dirty || !win->cache.valid)
+        return false;
+    if(win->hovered || was_hovered)
+        return false;
+    if(memcmp(&win->cache.bounds, &nkwin->bounds, sizeof(struct nk_rect))
+    || memcmp(&win->cache.scroll, &nkwin->scrollbar, sizeof(struct nk_scroll))
+    || memcmp(&win->cache.style, &win->style, sizeof(struct nk_style_window)))
+        return false;
+    return true;
+}
+
+static void win_cache_record(PyWindowObject *win, struct nk_window *nkwin, nk_size begin)
+{
+    struct win_cache *cache = &win->cache;
+    const struct nk_command_buffer *buff = &nkwin->buffer;
+    cache->valid = false;
+
+    /* Popups and active text fields need to see every frame's input and 
+     * can't be frozen. */
+    if(nkwin->popup.active || nkwin->popup.buf.active 
+    || nkwin->edit.active || nkwin->property.active)
+        return;
+
+    const nk_byte *base = nk_buffer_memory(buff->base);
+    nk_size off = begin;
+    while(off < buff->end) {
+        const struct nk_command *cmd = (const struct nk_command*)(base + off);
+        if(cmd->next <= off || cmd->next > buff->end)
+            return;
+        off = cmd->next;
+    }
+
+    size_t size = buff->end - begin;
+    if(size > cache->cap) {
+        void *cmds = realloc(cache->cmds, size);
+        if(!cmds)
+            return;
+        cache->cmds = cmds;
+        cache->cap = size;
+    }
+    memcpy(cache->cmds, base + begin, size);
+
+    const struct nk_panel *layout = nkwin->layout;
+    cache->size = size;
+    cache->origin = begin;
+    cache->last = size ? buff->last - begin : 0;
+    cache->bounds = nkwin->bounds;
+    cache->scroll = nkwin->scrollbar;
+    cache->style = win->style;
+    cache->clip = buff->clip;
+    cache->at_x = layout->at_x;
+    cache->at_y = layout->at_y;
+    cache->max_x = layout->max_x;
+    cache->footer_height = layout->footer_height;
+    cache->row = layout->row;
+    cache->valid = true;
+}
+
+static bool win_cache_replay(PyWindowObject *win, struct nk_window *nkwin)
+{
+    const struct win_cache *cache = &win->cache;
+    struct nk_command_buffer *buff = &nkwin->buffer;
+
+    if(cache->size) {
+
+        nk_size prev = buff->base->allocated;
+        nk_buffer_push(buff->base, NK_BUFFER_FRONT, cache->cmds, cache->size, 
+            NK_ALIGNOF(struct nk_command));
+        if(buff->base->allocated == prev)
+            return false;
+
+        /* The 'next' links are absolute offsets into the context memory. Rebase 
+         * them to where the copy ended up. */
+        nk_size dst = buff->base->allocated - cache->size;
+        nk_byte *base = nk_buffer_memory(buff->base);
+        nk_size off = dst;
+        while(off < dst + cache->size) {
+            struct nk_command *cmd = (struct nk_command*)(base + off);
+            cmd->next = cmd->next - cache->origin + dst;
+            off = cmd->next;
+        }
+        buff->last = dst + cache->last;
+        buff->end = dst + cache->size;
+    }
+
+    struct nk_panel *layout = nkwin->layout;
+    buff->clip = cache->clip;
+    layout->at_x = cache->at_x;
+    layout->at_y = cache->at_y;
+    layout->max_x = cache->max_x;
+    layout->footer_height = cache->footer_height;
+    layout->row = cache->row;
+    return true;
+}
+
 static void call_critfail(PyObject *obj, char *method_name)
 {
     PyObject *ret = PyObject_CallMethod(obj, method_name, NULL);
@@ -1018,7 +1189,17 @@ static void active_windows_update(void *user, void *event)
         if(nk_begin_with_vres(s_nk_ctx, win->name, 
             nk_rect(adj_bounds.x, adj_bounds.y, adj_bounds.w, adj_bounds.h), win->flags, adj_vres)) {
 
-            call_critfail((PyObject*)win, "update");
+            struct nk_window *nkwin = s_nk_ctx->current;
+            if(!win_can_replay(win, nkwin) || !win_cache_replay(win, nkwin)) {
+
+                nk_size begin = nkwin->buffer.end;
+                win->dirty = false;
+                call_critfail((PyObject*)win, "update");
+                if(win->retained)
+                    win_cache_record(win, nkwin, begin);
+            }
+        }else{
+            win->cache.valid = false;
         }
 
         if(s_nk_ctx->current->flags & NK_WINDOW_HIDDEN && !(win->flags & NK_WINDOW_HIDDEN)) {
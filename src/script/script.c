@@ -40,6 +40,10 @@
 #include "py_tile.h"
 #include "py_constants.h"
 #include "py_pickle.h"
+#include "py_save.h"
+#include "py_perf.h"
+#include "py_ai.h"
+#include "py_lazy.h"
 #include "public/script.h"
 #include "../entity.h"
 #include "../game/public/game.h"
@@ -51,9 +55,12 @@
 #include "../event.h"
 #include "../config.h"
 #include "../scene.h"
+#include "../asset_load.h"
 #include "../settings.h"
 #include "../main.h"
 #include "../ui.h"
+#include "../perf.h"
+#include "../mem.h"
 #include "../lib/public/SDL_vec_rwops.h"
 
 #include <SDL.h>
@@ -66,20 +73,45 @@ static PyObject *PyPf_new_game_string(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_ambient_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args);
+static PyObject *PyPf_add_point_light(PyObject *self, PyObject *args);
+static PyObject *PyPf_remove_point_light(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_point_light_pos(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_point_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_load_scene(PyObject *self, PyObject *args);
+static PyObject *PyPf_precompute_nav_fields(PyObject *self, PyObject *args);
+static PyObject *PyPf_load_entity_async(PyObject *self, PyObject *args);
+static PyObject *PyPf_entity_load_status(PyObject *self, PyObject *args);
+static PyObject *PyPf_release_entity_load(PyObject *self, PyObject *args);
+static PyObject *PyPf_unload_entity(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_register_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_register_ui_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_register_batched_event_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_unregister_batched_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_global_event(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_activate_camera(PyObject *self, PyObject *args);
 static PyObject *PyPf_prev_frame_ms(PyObject *self);
 static PyObject *PyPf_get_resolution(PyObject *self);
 static PyObject *PyPf_get_native_resolution(PyObject *self);
+static PyObject *PyPf_is_headless(PyObject *self);
 static PyObject *PyPf_get_basedir(PyObject *self);
 static PyObject *PyPf_get_render_info(PyObject *self);
 static PyObject *PyPf_get_nav_perfstats(PyObject *self);
+static PyObject *PyPf_get_nav_perfstats_history(PyObject *self);
+static PyObject *PyPf_get_nav_chunk_stats(PyObject *self);
+static PyObject *PyPf_get_move_perfstats(PyObject *self);
+static PyObject *PyPf_get_combat_perfstats(PyObject *self);
+static PyObject *PyPf_get_event_perfstats(PyObject *self);
+static PyObject *PyPf_get_sim_perfstats(PyObject *self);
+static PyObject *PyPf_get_script_perfstats(PyObject *self);
+static PyObject *PyPf_reset_script_perfstats(PyObject *self);
+static PyObject *PyPf_set_script_tick_budget(PyObject *self, PyObject *args);
+static PyObject *PyPf_perf_dump_trace(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_render_perfstats(PyObject *self);
+static PyObject *PyPf_get_mem_stats(PyObject *self);
+static PyObject *PyPf_set_mem_budget(PyObject *self, PyObject *args);
 static PyObject *PyPf_get_mouse_pos(PyObject *self);
 static PyObject *PyPf_mouse_over_ui(PyObject *self);
 
@@ -87,6 +119,17 @@ static PyObject *PyPf_enable_unit_selection(PyObject *self);
 static PyObject *PyPf_disable_unit_selection(PyObject *self);
 static PyObject *PyPf_clear_unit_selection(PyObject *self);
 static PyObject *PyPf_get_unit_selection(PyObject *self);
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_rotations(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_hps(PyObject *self, PyObject *args);
+static PyObject *PyPf_entities_in_rect(PyObject *self, PyObject *args);
+static PyObject *PyPf_entities_in_circle(PyObject *self, PyObject *args);
+static PyObject *PyPf_spawn_entities(PyObject *self, PyObject *args);
+static PyObject *PyPf_launch_projectile(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_lockstep_host(PyObject *self, PyObject *args);
+static PyObject *PyPf_lockstep_join(PyObject *self, PyObject *args);
+static PyObject *PyPf_lockstep_stop(PyObject *self);
+static PyObject *PyPf_lockstep_status(PyObject *self);
 
 static PyObject *PyPf_get_factions_list(PyObject *self);
 static PyObject *PyPf_add_faction(PyObject *self, PyObject *args);
@@ -94,8 +137,65 @@ static PyObject *PyPf_remove_faction(PyObject *self, PyObject *args);
 static PyObject *PyPf_update_faction(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_faction_controllable(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_diplomacy_state(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_fog_of_war_factions(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_fog_of_war_factions(PyObject *self);
+static PyObject *PyPf_fog_visible(PyObject *self, PyObject *args);
+static PyObject *PyPf_fog_explored(PyObject *self, PyObject *args);
+static PyObject *PyPf_spawn_ai_worker(PyObject *self, PyObject *args);
+static PyObject *PyPf_stop_ai_worker(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_update_tile(PyObject *self, PyObject *args);
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args);
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+
+    if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list))
+        return NULL; /* exception already set */
+
+    size_t ntiles = PyList_Size(list);
+    struct tile_desc *descs = malloc(ntiles * sizeof(struct tile_desc) + 1);
+    struct tile *tiles = malloc(ntiles * sizeof(struct tile) + 1);
+    if(!descs || !tiles) {
+        free(descs);
+        free(tiles);
+        return PyErr_NoMemory();
+    }
+
+    for(int i = 0; i < ntiles; i++) {
+
+        PyObject *tuple = PyList_GetItem(list, i);
+        PyObject *tile_obj;
+        const struct tile *tile;
+        struct tile_desc *desc = &descs[i];
+
+        if(!PyTuple_Check(tuple) 
+        || !PyArg_ParseTuple(tuple, "(ii)(ii)O", &desc->chunk_r, &desc->chunk_c, 
+            &desc->tile_r, &desc->tile_c, &tile_obj)
+        || NULL == (tile = S_Tile_GetTile(tile_obj))) {
+
+            PyErr_SetString(PyExc_TypeError, 
+                "Argument must be a list of ((chunk_r, chunk_c), (tile_r, tile_c), pf.Tile) tuples.");
+            goto fail;
+        }
+        tiles[i] = *tile;
+    }
+
+    if(!G_UpdateTiles(ntiles, descs, tiles)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not update tiles.");
+        goto fail;
+    }
+
+    free(descs);
+    free(tiles);
+    Py_RETURN_NONE;
+
+fail:
+    free(descs);
+    free(tiles);
+    return NULL;
+}
+
 static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args);
 static PyObject *PyPf_get_minimap_position(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_minimap_position(PyObject *self, PyObject *args);
@@ -105,6 +205,8 @@ static PyObject *PyPf_set_minimap_size(PyObject *self, PyObject *args);
 static PyObject *PyPf_mouse_over_minimap(PyObject *self);
 static PyObject *PyPf_map_height_at_point(PyObject *self, PyObject *args);
 static PyObject *PyPf_map_pos_under_cursor(PyObject *self);
+static PyObject *PyPf_map_chunk_tiles(PyObject *self, PyObject *args);
+static PyObject *PyPf_map_chunk_nav_tiles(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_move_on_left_click(PyObject *self);
 static PyObject *PyPf_set_attack_on_left_click(PyObject *self);
 
@@ -120,11 +222,51 @@ static PyObject *PyPf_multiply_quaternions(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_pickle_object(PyObject *self, PyObject *args);
 static PyObject *PyPf_unpickle_object(PyObject *self, PyObject *args);
+static PyObject *PyPf_save_object_async(PyObject *self, PyObject *args);
+static PyObject *PyPf_save_status(PyObject *self);
+static PyObject *PyPf_load_saved_object(PyObject *self, PyObject *args);
+
+static size_t    s_encode_event_arg(PyObject *arg, unsigned char *out, size_t maxout);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+/* Prebuilt event args for the engine events which can have only a small set 
+ * of values. These are immutable, so a single instance is shared by all the 
+ * events with the same value. */
+#define MAX_CACHED_INT_ARG  (SDL_NUM_SCANCODES)
+#define MAX_CACHED_BUTTON   (8)
+
+static PyObject *s_int_args[MAX_CACHED_INT_ARG];
+static PyObject *s_button_args[MAX_CACHED_BUTTON][2];
+
+/* The main thread's state while it has released the interpreter lock */
+static PyThreadState *s_saved_tstate;
+
+/* When present, the zip of precompiled scripts produced by 'make scripts_bundle'
+ * takes precedence over the loose files in the scripts directory. It mirrors 
+ * the layout of the scripts directory, so that every directory that gets added 
+ * to sys.path has a counterpart inside the bundle. */
+#define SCRIPT_BUNDLE_NAME  "scripts.zip"
+
+static char           s_bundle_path[512];
+
+/* The entities which projectiles have been drawn with */
+static PyObject      *s_proj_models;
+
+/* The arguments of the global events sent by scripts are encoded as a 
+ * type tag followed by the value, to be recorded in replays. */
+#define MAX_ENCODED_ARG     (512)
+
+enum arg_tag{
+    ARG_TAG_NONE = 0,
+    ARG_TAG_BOOL,
+    ARG_TAG_INT,
+    ARG_TAG_FLOAT,
+    ARG_TAG_STRING,
+};
+
 static PyMethodDef pf_module_methods[] = {
 
     {"new_game", 
@@ -150,10 +292,54 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_set_emit_light_pos, METH_VARARGS,
     "Sets the position (in XYZ worldspace coordinates)"},
 
+    {"add_point_light", 
+    (PyCFunction)PyPf_add_point_light, METH_VARARGS,
+    "Adds a point light at the specified position (in XYZ worldspace coordinates), with the "
+    "specified color (as an RGB multiplier) and radius. Returns the integer ID of the light. "
+    "All point lights are removed when a new map is loaded."},
+
+    {"remove_point_light", 
+    (PyCFunction)PyPf_remove_point_light, METH_VARARGS,
+    "Removes the point light with the specified ID."},
+
+    {"set_point_light_pos", 
+    (PyCFunction)PyPf_set_point_light_pos, METH_VARARGS,
+    "Moves the point light with the specified ID to the specified XYZ worldspace position."},
+
+    {"set_point_light_color", 
+    (PyCFunction)PyPf_set_point_light_color, METH_VARARGS,
+    "Sets the color (specified as an RGB multiplier) of the point light with the specified ID."},
+
     {"load_scene", 
     (PyCFunction)PyPf_load_scene, METH_VARARGS,
     "Import list of entities from a PFSCENE file (specified as a path string)."},
 
+    {"precompute_nav_fields", 
+    (PyCFunction)PyPf_precompute_nav_fields, METH_VARARGS,
+    "Generate and cache the navigation data for reaching each of the specified (X, Z) "
+    "destinations ahead of time, so that the first movement orders to them don't stall."},
+
+    {"load_entity_async", 
+    (PyCFunction)PyPf_load_entity_async, METH_VARARGS,
+    "Start loading the model for the specified directory path and PFOBJ filename (the same as "
+    "the first two arguments of the pf.Entity constructor) in the background, so that creating "
+    "the first entity from it does not stall. Returns a ticket for querying the status of the "
+    "load with 'entity_load_status', which must be released with 'release_entity_load'."},
+
+    {"entity_load_status", 
+    (PyCFunction)PyPf_entity_load_status, METH_VARARGS,
+    "Returns the status of the load for the ticket: pf.AL_PENDING, pf.AL_READY or pf.AL_FAILED."},
+
+    {"release_entity_load", 
+    (PyCFunction)PyPf_release_entity_load, METH_VARARGS,
+    "Release a ticket returned by 'load_entity_async'. A load that is still in progress is "
+    "completed in the background."},
+
+    {"unload_entity", 
+    (PyCFunction)PyPf_unload_entity, METH_VARARGS,
+    "Drop the cached model for the specified PFOBJ filename. Its' resources are freed once all "
+    "the entities using it are gone. Returns False if the model was not loaded."},
+
     {"register_event_handler", 
     (PyCFunction)PyPf_register_event_handler, METH_VARARGS,
     "Adds a script event handler to be called when the specified global event occurs. "
@@ -169,6 +355,18 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_unregister_event_handler, METH_VARARGS,
     "Removes a script event handler added by 'register_event_handler'."},
 
+    {"register_batched_event_handler", 
+    (PyCFunction)PyPf_register_batched_event_handler, METH_VARARGS,
+    "Adds a script event handler to be called once per tick with all the events of the "
+    "specified type that were delivered to entities during the tick. In place of the "
+    "event argument, the handler is passed a tuple of (entity, arg) pairs. The entity is "
+    "None if it has been deleted within the tick. This cuts down on the number of calls "
+    "for events that are sent to many entities at once."},
+
+    {"unregister_batched_event_handler", 
+    (PyCFunction)PyPf_unregister_batched_event_handler, METH_VARARGS,
+    "Removes a script event handler added by 'register_batched_event_handler'."},
+
     {"global_event", 
     (PyCFunction)PyPf_global_event, METH_VARARGS,
     "Broadcast a global event so all handlers can get invoked. Any weakref argument is "
@@ -194,6 +392,11 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_get_native_resolution, METH_NOARGS,
     "Returns the native resolution of the active monitor."},
 
+    {"is_headless", 
+    (PyCFunction)PyPf_is_headless, METH_NOARGS,
+    "Returns True if the engine was started with the '--headless' flag, in which case "
+    "nothing is rendered and the simulation runs as fast as possible or at a fixed rate."},
+
     {"get_basedir", 
     (PyCFunction)PyPf_get_basedir, METH_NOARGS,
     "Get the path to the top-level game resource folder (parent of 'assets')."},
@@ -207,6 +410,83 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_get_nav_perfstats, METH_NOARGS,
     "Returns a dictionary holding various performance couners for the navigation subsystem."},
 
+    {"get_nav_perfstats_history", 
+    (PyCFunction)PyPf_get_nav_perfstats_history, METH_NOARGS,
+    "Returns a list of the recent windows of the field cache activity, oldest first. Each window "
+    "maps the cache names ('los', 'flow', 'ffid' and 'grid_path') to a dictionary of the 'hits', "
+    "'misses', 'invalidated' and 'compute_ms' during the window."},
+
+    {"get_nav_chunk_stats", 
+    (PyCFunction)PyPf_get_nav_chunk_stats, METH_NOARGS,
+    "Returns a dictionary mapping the (row, column) coordinates of the chunks which have had "
+    "navigation fields computed at them to a tuple of the number of fields built and the number "
+    "of fields invalidated there."},
+
+    {"get_move_perfstats", 
+    (PyCFunction)PyPf_get_move_perfstats, METH_NOARGS,
+    "Returns a dictionary holding various performance couners for the movement subsystem."},
+
+    {"get_combat_perfstats", 
+    (PyCFunction)PyPf_get_combat_perfstats, METH_NOARGS,
+    "Returns a dictionary holding various performance couners for the combat subsystem."},
+
+    {"get_event_perfstats", 
+    (PyCFunction)PyPf_get_event_perfstats, METH_NOARGS,
+    "Returns a dictionary holding the capacity and high water mark of the event queue, as "
+    "well as the number of events that were queued, filtered out for having no entity handlers, "
+    "dropped on overflow, and the number of times the queue was resized."},
+
+    {"get_script_perfstats", 
+    (PyCFunction)PyPf_get_script_perfstats, METH_NOARGS,
+    "Returns a dictionary holding the time spent in script event handlers during the last tick, the "
+    "number of events deferred for going over the tick budget, and a list of the call count, total "
+    "and maximum time of every handler, for each event type it handled."},
+
+    {"reset_script_perfstats", 
+    (PyCFunction)PyPf_reset_script_perfstats, METH_NOARGS,
+    "Clear the per-handler timings returned by 'get_script_perfstats'."},
+
+    {"set_script_tick_budget", 
+    (PyCFunction)PyPf_set_script_tick_budget, METH_VARARGS,
+    "Set the most time (in milliseconds) script event handlers may take up in a tick, after which "
+    "the remaining events sent by scripts to entities are handled in the next tick. 0 disables the budget."},
+
+    {"perf_dump_trace", 
+    (PyCFunction)PyPf_perf_dump_trace, METH_VARARGS,
+    "Write the profiler markers recorded by all threads over the last N frames (optional "
+    "second argument) to the specified file as Chrome trace JSON, which can be opened with "
+    "chrome://tracing or Perfetto."},
+
+    {"get_sim_perfstats", 
+    (PyCFunction)PyPf_get_sim_perfstats, METH_NOARGS,
+    "Returns a dictionary holding the number of fixed-rate simulation ticks run in all and "
+    "during the last frame, as well as the number of frames which fell behind by more than the "
+    "maximum number of ticks per frame and the number of ticks that were skipped as a result."},
+
+    {"get_render_perfstats", 
+    (PyCFunction)PyPf_get_render_perfstats, METH_NOARGS,
+    "Returns a dictionary holding the allocation counters of the per-frame render command "
+    "buffers, in bytes and memory blocks, as well as the draw batching and state change "
+    "counters of the last rendered frame. The 'gpu_ms' entry maps the names of the timed "
+    "render passes to the GPU time spent in them, in milliseconds. The 'render_scale' entry "
+    "holds the fraction of the window resolution that the scene is rendered at. The handoff "
+    "between the threads is covered by the number of commands in the last frame, the time the "
+    "main thread spent blocked on the render thread ('main_wait_ms'), and the time the render "
+    "thread spent idle, executing commands and presenting the frame ('render_idle_ms', "
+    "'render_exec_ms' and 'render_swap_ms')."},
+
+    {"get_mem_stats", 
+    (PyCFunction)PyPf_get_mem_stats, METH_NOARGS,
+    "Returns a dictionary mapping the name of each subsystem to a dictionary holding the number "
+    "of bytes it currently holds ('live'), the most bytes it has held at once ('peak'), its' "
+    "budget ('budget', 0 if it has none) and the number of allocations it has made ('allocs')."},
+
+    {"set_mem_budget", 
+    (PyCFunction)PyPf_set_mem_budget, METH_VARARGS,
+    "Takes the name of a subsystem (as returned by 'get_mem_stats') and a number of bytes. A "
+    "warning is printed whenever the memory held by the subsystem exceeds the budget. A budget "
+    "of 0 removes it."},
+
     {"get_mouse_pos", 
     (PyCFunction)PyPf_get_mouse_pos, METH_NOARGS,
     "Get the (x, y) cursor position on the screen."},
@@ -231,6 +511,67 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_get_unit_selection, METH_NOARGS,
     "Returns a list of objects currently selected by the player."},
 
+    {"get_positions", 
+    (PyCFunction)PyPf_get_positions, METH_VARARGS,
+    "Returns a flat 'array.array' of floats holding the (X, Y, Z) position of every entity in the "
+    "argument sequence, in order."},
+
+    {"get_rotations", 
+    (PyCFunction)PyPf_get_rotations, METH_VARARGS,
+    "Returns a flat 'array.array' of floats holding the (X, Y, Z, W) rotation quaternion of every entity "
+    "in the argument sequence, in order."},
+
+    {"get_hps", 
+    (PyCFunction)PyPf_get_hps, METH_VARARGS,
+    "Returns an 'array.array' of ints holding the current hitpoints of every entity in the argument "
+    "sequence, in order. Entities which are not combatable have -1 hitpoints."},
+
+    {"entities_in_rect", 
+    (PyCFunction)PyPf_entities_in_rect, METH_VARARGS,
+    "Returns a list of the entities with positions inside the rectangle specified by the minimum "
+    "and maximum (X, Z) corners."},
+
+    {"entities_in_circle", 
+    (PyCFunction)PyPf_entities_in_circle, METH_VARARGS,
+    "Returns a list of the entities with positions inside the circle specified by the (X, Z) "
+    "center point and the radius."},
+
+    {"spawn_entities", 
+    (PyCFunction)PyPf_spawn_entities, METH_VARARGS,
+    "Makes copies of the template entity (first argument) at each of the (X, Y, Z) positions in the "
+    "sequence (second argument) and activates them all at once. The copies are of the template's type "
+    "and share its' attributes, but their' __init__ is not called. Returns the list of new entities."},
+
+    {"launch_projectile", 
+    (PyCFunction)PyPf_launch_projectile, METH_VARARGS | METH_KEYWORDS,
+    "Launches a projectile which is simulated and drawn by the engine. Takes the entity whose mesh "
+    "the projectile is drawn with (pointing its' +Z axis along the direction of flight), the (X, Y, Z) "
+    "position and velocity, the damage and the faction ID, and optionally the 'shooter' entity, the "
+    "'radius' and the 'lifetime' (in seconds). The projectile is affected by gravity and deals its' "
+    "damage to the first hostile combatable entity in its' path. The hits of each tick are "
+    "delivered in a single EVENT_PROJECTILE_HITS event. Returns the ID of the projectile."},
+
+    {"lockstep_host", 
+    (PyCFunction)PyPf_lockstep_host, METH_VARARGS,
+    "Hosts a lockstep multiplayer match for the given number of players (including the host) on "
+    "the given TCP port. From now on, the player's commands are sent to all the peers and issued "
+    "by all of them on the same tick, instead of being issued right away. The simulation is held "
+    "back until all the players have joined. All the players must start from the same state, "
+    "such as right after loading the same map."},
+
+    {"lockstep_join", 
+    (PyCFunction)PyPf_lockstep_join, METH_VARARGS,
+    "Joins the lockstep multiplayer match hosted at the given address and TCP port."},
+
+    {"lockstep_stop", 
+    (PyCFunction)PyPf_lockstep_stop, METH_NOARGS,
+    "Leaves the lockstep multiplayer match, if there is one. The simulation carries on locally."},
+
+    {"lockstep_status", 
+    (PyCFunction)PyPf_lockstep_status, METH_NOARGS,
+    "Returns a dictionary describing the current lockstep multiplayer match. The 'desync' flag is "
+    "set when the hash of the simulation state of some peer differed from ours."},
+
     {"get_factions_list",
     (PyCFunction)PyPf_get_factions_list, METH_NOARGS,
     "Returns a list of descriptors (dictionaries) for each faction in the game."},
@@ -257,10 +598,47 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_set_diplomacy_state, METH_VARARGS,
     "Symmetrically sets the diplomacy state between two distinct factions (passed in as IDs)."},
 
+    {"set_fog_of_war_factions",
+    (PyCFunction)PyPf_set_fog_of_war_factions, METH_VARARGS,
+    "Takes a list of the IDs of the player's factions. Their combined view is drawn over the map "
+    "and the entities of other factions outside of it are hidden. An empty list disables the "
+    "fog of war."},
+
+    {"get_fog_of_war_factions",
+    (PyCFunction)PyPf_get_fog_of_war_factions, METH_NOARGS,
+    "Returns the list of the IDs of the factions whose view is shown to the player."},
+
+    {"fog_visible",
+    (PyCFunction)PyPf_fog_visible, METH_VARARGS,
+    "Returns true if the specified XZ coordinate is currently in view of an entity of the faction "
+    "with the specified ID."},
+
+    {"fog_explored",
+    (PyCFunction)PyPf_fog_explored, METH_VARARGS,
+    "Returns true if the specified XZ coordinate has been in view of an entity of the faction "
+    "with the specified ID at some point."},
+
+    {"spawn_ai_worker",
+    (PyCFunction)PyPf_spawn_ai_worker, METH_VARARGS,
+    "Runs the script at the specified path in an isolated interpreter on its' own thread, "
+    "controlling the entities of the faction with the specified ID. The script must define a "
+    "'plan(tick, snapshot)' function, which is called with a packed snapshot of the world every "
+    "frame, and issues its' orders through the 'pfai' module. Returns the ID of the worker."},
+
+    {"stop_ai_worker",
+    (PyCFunction)PyPf_stop_ai_worker, METH_VARARGS,
+    "Stops the AI worker with the specified ID and waits for it to exit."},
+
     {"update_tile", 
     (PyCFunction)PyPf_update_tile, METH_VARARGS,
     "Update the map tile at the specified coordinates to the new value."},
 
+    {"update_tiles", 
+    (PyCFunction)PyPf_update_tiles, METH_VARARGS,
+    "Update many map tiles at once. Takes a list of ((chunk_r, chunk_c), (tile_r, tile_c), pf.Tile) "
+    "tuples. This is much faster than calling update_tile for each of them, as the render data "
+    "of the affected chunks is rebuilt only once."},
+
     {"set_map_highlight_size", 
     (PyCFunction)PyPf_set_map_highlight_size, METH_VARARGS,
     "Determines how many tiles around the currently hovered tile are highlighted. (0 = none, "
@@ -300,6 +678,22 @@ static PyMethodDef pf_module_methods[] = {
     "Returns the XYZ coordinate of the point of the map underneath the cursor. Returns 'None' if "
     "the cursor is not over the map."},
 
+    {"map_chunk_tiles",
+    (PyCFunction)PyPf_map_chunk_tiles, METH_VARARGS,
+    "Takes a (chunk_r, chunk_c) tuple and two writable buffers (ex. bytearrays), either of which "
+    "may be None. The first is filled with the height of each tile of the chunk (mean of the corner "
+    "heights) as 32-bit floats and the second with the top material index of each tile as 32-bit "
+    "integers, both in row-major order. The buffers must have room for "
+    "TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH elements."},
+
+    {"map_chunk_nav_tiles",
+    (PyCFunction)PyPf_map_chunk_nav_tiles, METH_VARARGS,
+    "Takes a (chunk_r, chunk_c) tuple and three writable buffers (ex. bytearrays), any of which "
+    "may be None. These are filled with the state of each navigation tile of the chunk, in "
+    "row-major order: whether it's pathable (8-bit), whether it's occupied by a blocker (8-bit) "
+    "and the 16-bit ID of the island of tiles reachable from it, disregarding the blockers. The "
+    "buffers must have room for NAV_TILES_PER_CHUNK * NAV_TILES_PER_CHUNK elements."},
+
     {"set_move_on_left_click",
     (PyCFunction)PyPf_set_move_on_left_click, METH_NOARGS,
     "Set the cursor to target mode. The next left click will issue a move command to the location "
@@ -345,13 +739,33 @@ static PyMethodDef pf_module_methods[] = {
 
     {"pickle_object",
     (PyCFunction)PyPf_pickle_object, METH_VARARGS,
-    "Returns an ASCII string holding the serialized representation of the object graph."},
+    "Returns an ASCII string holding the serialized representation of the object graph. If the optional "
+    "'compress' argument is true, the representation is written as a framed and compressed binary string "
+    "instead."},
 
     {"unpickle_object",
     (PyCFunction)PyPf_unpickle_object, METH_VARARGS,
     "Returns a new reference to an object built from its' serialized representation. The argument string must "
     "an earlier return value of 'pf.pickle_object'."},
 
+    {"save_object_async",
+    (PyCFunction)PyPf_save_object_async, METH_VARARGS,
+    "Writes the serialized object graph to the file at the specified path, without stalling the game "
+    "(where the platform allows for it). The graph is captured as it is at the time of the call. Takes "
+    "an optional path of an earlier full save, in which case only the parts that changed since then "
+    "are written, and an optional flag (True by default) to compress the file. Use 'pf.save_status' "
+    "to find out when the save is done."},
+
+    {"save_status",
+    (PyCFunction)PyPf_save_status, METH_NOARGS,
+    "Returns pf.SAVE_IN_PROGRESS while a save started by 'pf.save_object_async' is being written. "
+    "Once it is done, returns pf.SAVE_SUCCEEDED or pf.SAVE_FAILED once, and pf.SAVE_IDLE after that."},
+
+    {"load_saved_object",
+    (PyCFunction)PyPf_load_saved_object, METH_VARARGS,
+    "Returns a new object built from a file written by 'pf.save_object_async'. Delta saves need the "
+    "full save they were made against to still be in place."},
+
     {NULL}  /* Sentinel */
 };
 
@@ -445,6 +859,99 @@ static PyObject *PyPf_load_scene(PyObject *self, PyObject *args)
     return S_Entity_GetAllList();
 }
 
+static PyObject *PyPf_precompute_nav_fields(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+
+    if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list))
+        return NULL; /* exception already set */
+
+    size_t ndests = PyList_Size(list);
+    vec2_t *dests = malloc(ndests * sizeof(vec2_t) + 1);
+    if(!dests)
+        return PyErr_NoMemory();
+
+    for(int i = 0; i < ndests; i++) {
+
+        PyObject *tuple = PyList_GetItem(list, i);
+        if(!PyTuple_Check(tuple) 
+        || !PyArg_ParseTuple(tuple, "ff", &dests[i].raw[0], &dests[i].raw[1])) {
+
+            PyErr_SetString(PyExc_TypeError, "Argument must be a list of (X, Z) tuples.");
+            free(dests);
+            return NULL;
+        }
+    }
+
+    G_PrecomputeNavFields(ndests, dests);
+    free(dests);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_load_entity_async(PyObject *self, PyObject *args)
+{
+    const char *dirpath, *filename;
+
+    if(!PyArg_ParseTuple(args, "ss", &dirpath, &filename)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two strings.");
+        return NULL;
+    }
+
+    extern const char *g_basepath;
+    char entity_path[512];
+    if(strlen(g_basepath) + strlen(dirpath) >= sizeof(entity_path)) {
+        PyErr_SetString(PyExc_RuntimeError, "The directory path is too long.");
+        return NULL;
+    }
+    strcpy(entity_path, g_basepath);
+    strcat(entity_path, dirpath);
+
+    al_ticket_t ticket = AL_EntityLoadAsync(entity_path, filename);
+    if(ticket == AL_TICKET_INVALID) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to start loading the specified model.");
+        return NULL;
+    }
+    return Py_BuildValue("I", ticket);
+}
+
+static PyObject *PyPf_entity_load_status(PyObject *self, PyObject *args)
+{
+    unsigned int ticket;
+
+    if(!PyArg_ParseTuple(args, "I", &ticket)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+    return Py_BuildValue("i", AL_LoadStatus(ticket));
+}
+
+static PyObject *PyPf_release_entity_load(PyObject *self, PyObject *args)
+{
+    unsigned int ticket;
+
+    if(!PyArg_ParseTuple(args, "I", &ticket)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+    AL_LoadRelease(ticket);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_unload_entity(PyObject *self, PyObject *args)
+{
+    const char *filename;
+
+    if(!PyArg_ParseTuple(args, "s", &filename)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(AL_EntityUnload(filename))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
 static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args)
 {
     PyObject *tuple;
@@ -460,6 +967,80 @@ static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_add_point_light(PyObject *self, PyObject *args)
+{
+    vec3_t pos, color;
+    float radius;
+
+    if(!PyArg_ParseTuple(args, "(fff)(fff)f", &pos.x, &pos.y, &pos.z, 
+        &color.x, &color.y, &color.z, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two tuples of 3 floats and a float.");
+        return NULL;
+    }
+
+    if(radius <= 0.0f) {
+        PyErr_SetString(PyExc_ValueError, "The radius must be positive.");
+        return NULL;
+    }
+
+    uint32_t id = G_Light_AddPoint(pos, color, radius);
+    if(!id) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to add the point light.");
+        return NULL;
+    }
+    return PyInt_FromLong(id);
+}
+
+static PyObject *PyPf_remove_point_light(PyObject *self, PyObject *args)
+{
+    unsigned int id;
+
+    if(!PyArg_ParseTuple(args, "I", &id)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    if(!G_Light_Remove(id)) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid point light ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_point_light_pos(PyObject *self, PyObject *args)
+{
+    unsigned int id;
+    vec3_t pos;
+
+    if(!PyArg_ParseTuple(args, "I(fff)", &id, &pos.x, &pos.y, &pos.z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer and a tuple of 3 floats.");
+        return NULL;
+    }
+
+    if(!G_Light_SetPos(id, pos)) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid point light ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_point_light_color(PyObject *self, PyObject *args)
+{
+    unsigned int id;
+    vec3_t color;
+
+    if(!PyArg_ParseTuple(args, "I(fff)", &id, &color.x, &color.y, &color.z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer and a tuple of 3 floats.");
+        return NULL;
+    }
+
+    if(!G_Light_SetColor(id, color)) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid point light ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject *register_handler(PyObject *self, PyObject *args, int simmask)
 {
     enum eventtype event;
@@ -516,6 +1097,55 @@ static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_register_batched_event_handler(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *callable, *user_arg;
+
+    if(!PyArg_ParseTuple(args, "iOO", &event, &callable, &user_arg)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and two objects.");
+        return NULL;
+    }
+
+    if(!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Second argument must be callable.");
+        return NULL;
+    }
+
+    Py_INCREF(callable);
+    Py_INCREF(user_arg);
+
+    if(!E_Entity_ScriptRegisterBatched(event, callable, user_arg, G_RUNNING)) {
+        Py_DECREF(callable);
+        Py_DECREF(user_arg);
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_unregister_batched_event_handler(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *callable;
+
+    if(!PyArg_ParseTuple(args, "iO", &event, &callable)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
+        return NULL;
+    }
+
+    if(!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Second argument must be callable.");
+        return NULL;
+    }
+
+    bool ret = E_Entity_ScriptUnregisterBatched(event, callable);
+    if(!ret) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not unregister the specified event handler.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyPf_global_event(PyObject *self, PyObject *args)
 {
     enum eventtype event;
@@ -526,6 +1156,15 @@ static PyObject *PyPf_global_event(PyObject *self, PyObject *args)
         return NULL;
     }
 
+    /* While a replay is playing, the recorded events take the place of the 
+     * live ones. In a lockstep match, the events are sent to all the peers 
+     * and delivered on the turn they are issued at. Events with arguments 
+     * that cannot be encoded are always sent right away. */
+    unsigned char encoded[MAX_ENCODED_ARG];
+    size_t size = s_encode_event_arg(arg, encoded, sizeof(encoded));
+    if(size && !G_Replay_CmdScriptEvent(event, encoded, size))
+        Py_RETURN_NONE;
+
     Py_INCREF(arg);
 
     E_Global_Notify(event, arg, ES_SCRIPT);
@@ -563,9 +1202,16 @@ static PyObject *PyPf_get_resolution(PyObject *self)
 
 static PyObject *PyPf_get_native_resolution(PyObject *self)
 {
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-    return Py_BuildValue("(i, i)", dm.w, dm.h);
+    int w, h;
+    Engine_DesktopRes(&w, &h);
+    return Py_BuildValue("(i, i)", w, h);
+}
+
+static PyObject *PyPf_is_headless(PyObject *self)
+{
+    if(g_headless)
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
 }
 
 static PyObject *PyPf_get_basedir(PyObject *self)
@@ -616,11 +1262,365 @@ static PyObject *PyPf_get_nav_perfstats(PyObject *self)
     rval |= PyDict_SetItemString(ret, "grid_path_used",     Py_BuildValue("i", stats.grid_path_used));
     rval |= PyDict_SetItemString(ret, "grid_path_max",      Py_BuildValue("i", stats.grid_path_max));
     rval |= PyDict_SetItemString(ret, "grid_path_hit_rate", Py_BuildValue("f", stats.grid_path_hit_rate));
+    rval |= PyDict_SetItemString(ret, "los_time_saved",     Py_BuildValue("f", stats.los_time_saved));
+    rval |= PyDict_SetItemString(ret, "flow_time_saved",    Py_BuildValue("f", stats.flow_time_saved));
+    rval |= PyDict_SetItemString(ret, "grid_path_time_saved", Py_BuildValue("f", stats.grid_path_time_saved));
+    rval |= PyDict_SetItemString(ret, "path_requests",      Py_BuildValue("i", stats.path_requests));
+    rval |= PyDict_SetItemString(ret, "path_coalesce_ratio", Py_BuildValue("f", stats.path_coalesce_ratio));
+    rval |= PyDict_SetItemString(ret, "update_ms",          Py_BuildValue("d", stats.update_ms));
+    assert(0 == rval);
+
+    return ret;
+}
+
+static PyObject *PyPf_get_nav_perfstats_history(PyObject *self)
+{
+    struct fc_window windows[CONFIG_FC_HISTORY_LEN];
+    size_t nwindows = N_FC_GetHistory(CONFIG_FC_HISTORY_LEN, windows);
+    const char *names[FC_CACHE_COUNT] = {
+        [FC_CACHE_LOS]       = "los",
+        [FC_CACHE_FLOW]      = "flow",
+        [FC_CACHE_FFID]      = "ffid",
+        [FC_CACHE_GRID_PATH] = "grid_path",
+    };
+
+    PyObject *ret = PyList_New(nwindows);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < nwindows; i++) {
+
+        PyObject *window = PyDict_New();
+        if(!window)
+            goto fail;
+        PyList_SET_ITEM(ret, i, window);
+
+        for(int j = 0; j < FC_CACHE_COUNT; j++) {
+
+            const struct fc_cache_window *curr = &windows[i].caches[j];
+            PyObject *cache = Py_BuildValue("{s:I, s:I, s:I, s:f}", 
+                "hits",         curr->hits, 
+                "misses",       curr->misses, 
+                "invalidated",  curr->invalidated, 
+                "compute_ms",   curr->compute_ms);
+            if(!cache)
+                goto fail;
+
+            int rval = PyDict_SetItemString(window, names[j], cache);
+            Py_DECREF(cache);
+            if(rval)
+                goto fail;
+        }
+    }
+    return ret;
+
+fail:
+    Py_DECREF(ret);
+    return NULL;
+}
+
+static PyObject *PyPf_get_nav_chunk_stats(PyObject *self)
+{
+    size_t maxout = 1024;
+    struct fc_chunk_stats *stats = malloc(maxout * sizeof(struct fc_chunk_stats));
+    if(!stats)
+        return PyErr_NoMemory();
+
+    size_t nstats;
+    while((nstats = N_FC_GetChunkStats(maxout, stats)) == maxout) {
+
+        maxout *= 2;
+        struct fc_chunk_stats *bigger = realloc(stats, maxout * sizeof(struct fc_chunk_stats));
+        if(!bigger) {
+            free(stats);
+            return PyErr_NoMemory();
+        }
+        stats = bigger;
+    }
+
+    PyObject *ret = PyDict_New();
+    if(!ret)
+        goto fail_dict;
+
+    for(int i = 0; i < nstats; i++) {
+
+        PyObject *key = Py_BuildValue("(i,i)", stats[i].chunk_r, stats[i].chunk_c);
+        PyObject *val = Py_BuildValue("(I,I)", stats[i].built, stats[i].invalidated);
+        int rval = (key && val) ? PyDict_SetItem(ret, key, val) : -1;
+        Py_XDECREF(key);
+        Py_XDECREF(val);
+        if(rval)
+            goto fail_item;
+    }
+
+    free(stats);
+    return ret;
+
+fail_item:
+    Py_DECREF(ret);
+fail_dict:
+    free(stats);
+    return NULL;
+}
+
+static PyObject *PyPf_get_move_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    struct move_stats stats;
+    G_Move_GetStats(&stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "clearpath_computed",   Py_BuildValue("k", stats.cp_computed));
+    rval |= PyDict_SetItemString(ret, "clearpath_skipped",    Py_BuildValue("k", stats.cp_skipped));
+    rval |= PyDict_SetItemString(ret, "clearpath_scratch_hwm", Py_BuildValue("n", (Py_ssize_t)stats.cp_scratch_high_water));
+    rval |= PyDict_SetItemString(ret, "lod_reduced",          Py_BuildValue("I", stats.lod_reduced));
+    rval |= PyDict_SetItemString(ret, "lod_blob",             Py_BuildValue("I", stats.lod_blob));
+    rval |= PyDict_SetItemString(ret, "crowd_steered",        Py_BuildValue("k", stats.crowd_steered));
+    rval |= PyDict_SetItemString(ret, "tick_ms",              Py_BuildValue("d", stats.tick_ms));
+    rval |= PyDict_SetItemString(ret, "clearpath_ms",         Py_BuildValue("d", stats.clearpath_ms));
+    assert(0 == rval);
+
+    return ret;
+}
+
+static PyObject *PyPf_get_combat_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    struct combat_stats stats;
+    G_Combat_GetStats(&stats);
+    struct proj_stats proj_stats;
+    G_Proj_GetStats(&proj_stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "tick_ms",              Py_BuildValue("d", stats.tick_ms));
+    rval |= PyDict_SetItemString(ret, "projectiles_live",     Py_BuildValue("n", (Py_ssize_t)proj_stats.live));
+    rval |= PyDict_SetItemString(ret, "projectiles_launched", Py_BuildValue("k", proj_stats.launched));
+    rval |= PyDict_SetItemString(ret, "projectile_hits",      Py_BuildValue("k", proj_stats.hits));
+    rval |= PyDict_SetItemString(ret, "projectile_tick_ms",   Py_BuildValue("d", proj_stats.tick_ms));
+    assert(0 == rval);
+
+    return ret;
+}
+
+static PyObject *PyPf_get_event_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    struct event_stats stats;
+    E_GetStats(&stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "capacity",   Py_BuildValue("n", (Py_ssize_t)stats.capacity));
+    rval |= PyDict_SetItemString(ret, "high_water", Py_BuildValue("n", (Py_ssize_t)stats.high_water));
+    rval |= PyDict_SetItemString(ret, "last_tick",  Py_BuildValue("n", (Py_ssize_t)stats.last_tick));
+    rval |= PyDict_SetItemString(ret, "queued",     Py_BuildValue("k", stats.queued));
+    rval |= PyDict_SetItemString(ret, "filtered",   Py_BuildValue("k", stats.filtered));
+    rval |= PyDict_SetItemString(ret, "dropped",    Py_BuildValue("k", stats.dropped));
+    rval |= PyDict_SetItemString(ret, "resized",    Py_BuildValue("k", stats.resized));
     assert(0 == rval);
 
     return ret;
 }
 
+static PyObject *PyPf_get_script_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    PyObject *handlers = S_Perf_GetStats();
+    if(!handlers) {
+        Py_DECREF(ret);
+        return NULL;
+    }
+
+    struct event_stats stats;
+    E_GetStats(&stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "last_tick_ms", Py_BuildValue("f", stats.script_ms));
+    rval |= PyDict_SetItemString(ret, "deferred",     Py_BuildValue("k", stats.deferred));
+    rval |= PyDict_SetItemString(ret, "handlers",     handlers);
+    assert(0 == rval);
+
+    Py_DECREF(handlers);
+    return ret;
+}
+
+static PyObject *PyPf_reset_script_perfstats(PyObject *self)
+{
+    S_Perf_Reset();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_script_tick_budget(PyObject *self, PyObject *args)
+{
+    float ms;
+    if(!PyArg_ParseTuple(args, "f", &ms) || ms < 0.0f) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a non-negative float.");
+        return NULL;
+    }
+
+    E_SetScriptBudget(ms);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_perf_dump_trace(PyObject *self, PyObject *args)
+{
+    const char *path;
+    int nframes = CONFIG_PERF_DUMP_FRAMES;
+
+    if(!PyArg_ParseTuple(args, "s|i", &path, &nframes) || nframes <= 0) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string and an optional positive integer.");
+        return NULL;
+    }
+
+    if(!Perf_DumpTrace(path, nframes)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to write the trace to the specified file.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_get_sim_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    struct timer_stats stats;
+    G_Timer_GetStats(&stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "ticks",            Py_BuildValue("K", stats.ticks));
+    rval |= PyDict_SetItemString(ret, "last_frame_ticks", Py_BuildValue("I", stats.last_frame_ticks));
+    rval |= PyDict_SetItemString(ret, "overrun_frames",   Py_BuildValue("k", stats.overrun_frames));
+    rval |= PyDict_SetItemString(ret, "dropped_ticks",    Py_BuildValue("K", stats.dropped_ticks));
+    assert(0 == rval);
+
+    return ret;
+}
+
+static PyObject *PyPf_get_render_perfstats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    struct memstack_stats stats;
+    G_GetWSStats(&stats);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "frame_bytes",      Py_BuildValue("n", (Py_ssize_t)stats.last_bytes));
+    rval |= PyDict_SetItemString(ret, "high_water_bytes", Py_BuildValue("n", (Py_ssize_t)stats.high_water));
+    rval |= PyDict_SetItemString(ret, "blocks",           Py_BuildValue("n", (Py_ssize_t)stats.nblocks));
+    rval |= PyDict_SetItemString(ret, "oversized",        Py_BuildValue("n", (Py_ssize_t)stats.noversized));
+    rval |= PyDict_SetItemString(ret, "trimmed_blocks",   Py_BuildValue("n", (Py_ssize_t)stats.ntrimmed));
+
+    struct render_stats rstats;
+    R_GetStats(&rstats);
+
+    rval |= PyDict_SetItemString(ret, "batches",              Py_BuildValue("I", rstats.batches));
+    rval |= PyDict_SetItemString(ret, "batched_cmds",         Py_BuildValue("I", rstats.batched_cmds));
+    rval |= PyDict_SetItemString(ret, "prog_changes",         Py_BuildValue("I", rstats.prog_changes));
+    rval |= PyDict_SetItemString(ret, "prog_changes_skipped", Py_BuildValue("I", rstats.prog_changes_skipped));
+    rval |= PyDict_SetItemString(ret, "tex_changes",          Py_BuildValue("I", rstats.tex_changes));
+    rval |= PyDict_SetItemString(ret, "tex_changes_skipped",  Py_BuildValue("I", rstats.tex_changes_skipped));
+    rval |= PyDict_SetItemString(ret, "vao_changes",          Py_BuildValue("I", rstats.vao_changes));
+    rval |= PyDict_SetItemString(ret, "vao_changes_skipped",  Py_BuildValue("I", rstats.vao_changes_skipped));
+
+    PyObject *gpu_ms = PyDict_New();
+    if(!gpu_ms) {
+        Py_DECREF(ret);
+        return NULL;
+    }
+
+    rval |= PyDict_SetItemString(gpu_ms, "scene",   PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_SCENE]));
+    rval |= PyDict_SetItemString(gpu_ms, "depth",   PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_DEPTH]));
+    rval |= PyDict_SetItemString(gpu_ms, "terrain", PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_TERRAIN]));
+    rval |= PyDict_SetItemString(gpu_ms, "water",   PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_WATER]));
+    rval |= PyDict_SetItemString(gpu_ms, "minimap", PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_MINIMAP]));
+    rval |= PyDict_SetItemString(gpu_ms, "ui",      PyFloat_FromDouble(rstats.gpu_ms[GPU_PASS_UI]));
+    rval |= PyDict_SetItemString(ret, "gpu_ms", gpu_ms);
+    Py_DECREF(gpu_ms);
+    rval |= PyDict_SetItemString(ret, "render_scale", PyFloat_FromDouble(rstats.render_scale));
+
+    rval |= PyDict_SetItemString(ret, "cmds",           Py_BuildValue("I", rstats.cmds));
+    rval |= PyDict_SetItemString(ret, "main_wait_ms",   PyFloat_FromDouble(g_last_render_wait_ms));
+    rval |= PyDict_SetItemString(ret, "render_idle_ms", PyFloat_FromDouble(rstats.idle_ms));
+    rval |= PyDict_SetItemString(ret, "render_exec_ms", PyFloat_FromDouble(rstats.exec_ms));
+    rval |= PyDict_SetItemString(ret, "render_swap_ms", PyFloat_FromDouble(rstats.swap_ms));
+    assert(0 == rval);
+
+    return ret;
+}
+
+static PyObject *PyPf_get_mem_stats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        return NULL;
+    }
+
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+
+        struct mem_stats stats;
+        Mem_GetStats(i, &stats);
+
+        PyObject *tag = PyDict_New();
+        if(!tag) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+
+        int rval = 0;
+        rval |= PyDict_SetItemString(tag, "live",   Py_BuildValue("n", (Py_ssize_t)stats.live));
+        rval |= PyDict_SetItemString(tag, "peak",   Py_BuildValue("n", (Py_ssize_t)stats.peak));
+        rval |= PyDict_SetItemString(tag, "budget", Py_BuildValue("n", (Py_ssize_t)stats.budget));
+        rval |= PyDict_SetItemString(tag, "allocs", Py_BuildValue("k", stats.nallocs));
+        rval |= PyDict_SetItemString(ret, Mem_TagName(i), tag);
+        assert(0 == rval);
+        Py_DECREF(tag);
+    }
+
+    return ret;
+}
+
+static PyObject *PyPf_set_mem_budget(PyObject *self, PyObject *args)
+{
+    const char *name;
+    Py_ssize_t bytes;
+
+    if(!PyArg_ParseTuple(args, "sn", &name, &bytes) || bytes < 0) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string and a non-negative integer.");
+        return NULL;
+    }
+
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+        if(0 == strcmp(name, Mem_TagName(i))) {
+            Mem_SetBudget(i, bytes);
+            Py_RETURN_NONE;
+        }
+    }
+
+    PyErr_SetString(PyExc_RuntimeError, "Unknown subsystem name.");
+    return NULL;
+}
+
 static PyObject *PyPf_get_mouse_pos(PyObject *self)
 {
     int mouse_x, mouse_y;
@@ -651,28 +1651,208 @@ static PyObject *PyPf_disable_unit_selection(PyObject *self)
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_clear_unit_selection(PyObject *self)
+static PyObject *PyPf_clear_unit_selection(PyObject *self)
+{
+    G_Sel_Clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_get_unit_selection(PyObject *self)
+{
+    enum selection_type sel_type;
+    const vec_pentity_t *sel = G_Sel_Get(&sel_type);
+
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < vec_size(sel); i++) {
+        PyObject *ent = S_Entity_ObjForEnt(vec_AT(sel, i));
+        if(ent) {
+            PyList_Append(ret, ent);
+        }
+    }
+
+    return ret;
+}
+
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args)
+{
+    PyObject *ents;
+    if(!PyArg_ParseTuple(args, "O", &ents)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a sequence of entities.");
+        return NULL;
+    }
+    return S_Entity_GetPositions(ents);
+}
+
+static PyObject *PyPf_get_rotations(PyObject *self, PyObject *args)
+{
+    PyObject *ents;
+    if(!PyArg_ParseTuple(args, "O", &ents)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a sequence of entities.");
+        return NULL;
+    }
+    return S_Entity_GetRotations(ents);
+}
+
+static PyObject *PyPf_get_hps(PyObject *self, PyObject *args)
+{
+    PyObject *ents;
+    if(!PyArg_ParseTuple(args, "O", &ents)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a sequence of entities.");
+        return NULL;
+    }
+    return S_Entity_GetHPs(ents);
+}
+
+static PyObject *PyPf_entities_in_rect(PyObject *self, PyObject *args)
+{
+    vec2_t xz_min, xz_max;
+    if(!PyArg_ParseTuple(args, "(ff)(ff)", &xz_min.x, &xz_min.z, &xz_max.x, &xz_max.z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two tuples of two floats.");
+        return NULL;
+    }
+    return S_Entity_InRect(xz_min, xz_max);
+}
+
+static PyObject *PyPf_entities_in_circle(PyObject *self, PyObject *args)
+{
+    vec2_t xz_point;
+    float range;
+
+    if(!PyArg_ParseTuple(args, "(ff)f", &xz_point.x, &xz_point.z, &range)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a tuple of two floats and a float.");
+        return NULL;
+    }
+    return S_Entity_InCircle(xz_point, range);
+}
+
+static PyObject *PyPf_spawn_entities(PyObject *self, PyObject *args)
+{
+    PyObject *tmpl, *positions;
+
+    if(!PyArg_ParseTuple(args, "OO", &tmpl, &positions)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an entity and a sequence of (X, Y, Z) tuples.");
+        return NULL;
+    }
+    return S_Entity_Spawn(tmpl, positions);
+}
+
+static PyObject *PyPf_launch_projectile(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"model", "pos", "velocity", "damage", "faction_id", 
+                             "shooter", "radius", "lifetime", NULL};
+    PyObject *model, *shooter = Py_None;
+    struct proj_desc desc = (struct proj_desc){
+        .shooter = PROJ_NO_SHOOTER,
+        .radius = 0.1f,
+        .lifetime = 5.0f,
+    };
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O(fff)(fff)ii|Off", kwlist, &model, 
+        &desc.pos.x, &desc.pos.y, &desc.pos.z, &desc.vel.x, &desc.vel.y, &desc.vel.z,
+        &desc.damage, &desc.faction_id, &shooter, &desc.radius, &desc.lifetime)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an entity, two tuples of 3 floats, two integers "
+            "and optionally an entity or None and two floats.");
+        return NULL;
+    }
+
+    if(!(desc.model = S_Entity_EntForObj(model))) {
+        PyErr_SetString(PyExc_TypeError, "The 'model' argument must be a pf.Entity instance.");
+        return NULL;
+    }
+
+    if(shooter != Py_None) {
+        const struct entity *ent = S_Entity_EntForObj(shooter);
+        if(!ent) {
+            PyErr_SetString(PyExc_TypeError, "The 'shooter' argument must be a pf.Entity instance or None.");
+            return NULL;
+        }
+        desc.shooter = ent->uid;
+    }
+
+    /* The model's mesh is drawn for as long as there are projectiles using 
+     * it, so the entity is kept alive for the rest of the session. */
+    if(!s_proj_models && !(s_proj_models = PyList_New(0)))
+        return NULL;
+    int contains = PySequence_Contains(s_proj_models, model);
+    if(contains < 0 || (!contains && 0 != PyList_Append(s_proj_models, model)))
+        return NULL;
+
+    uint32_t id = G_Proj_Launch(&desc);
+    if(!id) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to launch the projectile.");
+        return NULL;
+    }
+    return Py_BuildValue("I", id);
+}
+
+static PyObject *PyPf_lockstep_host(PyObject *self, PyObject *args)
+{
+    unsigned short port;
+    int nplayers;
+
+    if(!PyArg_ParseTuple(args, "Hi", &port, &nplayers)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a port number and an integer.");
+        return NULL;
+    }
+
+    if(!G_Lockstep_Host(port, nplayers)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not host the lockstep match.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_lockstep_join(PyObject *self, PyObject *args)
+{
+    const char *host;
+    unsigned short port;
+
+    if(!PyArg_ParseTuple(args, "sH", &host, &port)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an address string and a port number.");
+        return NULL;
+    }
+
+    if(!G_Lockstep_Join(host, port)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not join the lockstep match.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_lockstep_stop(PyObject *self)
 {
-    G_Sel_Clear();
+    G_Lockstep_Stop();
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_get_unit_selection(PyObject *self)
+static PyObject *PyPf_lockstep_status(PyObject *self)
 {
-    enum selection_type sel_type;
-    const vec_pentity_t *sel = G_Sel_Get(&sel_type);
-
-    PyObject *ret = PyList_New(0);
-    if(!ret)
+    PyObject *ret = PyDict_New();
+    if(!ret) {
         return NULL;
-
-    for(int i = 0; i < vec_size(sel); i++) {
-        PyObject *ent = S_Entity_ObjForUID(vec_AT(sel, i)->uid);
-        if(ent) {
-            PyList_Append(ret, ent);
-        }
     }
 
+    struct lockstep_status status;
+    G_Lockstep_GetStatus(&status);
+
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "active",         PyBool_FromLong(status.active));
+    rval |= PyDict_SetItemString(ret, "running",        PyBool_FromLong(status.running));
+    rval |= PyDict_SetItemString(ret, "peer_id",        Py_BuildValue("i", status.peer_id));
+    rval |= PyDict_SetItemString(ret, "num_peers",      Py_BuildValue("i", status.npeers));
+    rval |= PyDict_SetItemString(ret, "turn",           Py_BuildValue("I", (unsigned)status.turn));
+    rval |= PyDict_SetItemString(ret, "input_delay",    Py_BuildValue("i", status.input_delay));
+    rval |= PyDict_SetItemString(ret, "turn_ticks",     Py_BuildValue("i", status.turn_ticks));
+    rval |= PyDict_SetItemString(ret, "stalled_frames", Py_BuildValue("k", status.stalled_frames));
+    rval |= PyDict_SetItemString(ret, "bytes_sent",     Py_BuildValue("K", (unsigned long long)status.bytes_sent));
+    rval |= PyDict_SetItemString(ret, "bytes_received", Py_BuildValue("K", (unsigned long long)status.bytes_received));
+    rval |= PyDict_SetItemString(ret, "desync",         PyBool_FromLong(status.desync));
+    rval |= PyDict_SetItemString(ret, "desync_turn",    Py_BuildValue("I", (unsigned)status.desync_turn));
+    assert(0 == rval);
+
     return ret;
 }
 
@@ -817,6 +1997,128 @@ static PyObject *PyPf_set_diplomacy_state(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_set_fog_of_war_factions(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+
+    if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of integers.");
+        return NULL;
+    }
+
+    uint16_t mask = 0;
+    for(int i = 0; i < PyList_Size(list); i++) {
+
+        PyObject *item = PyList_GET_ITEM(list, i);
+        if(!PyInt_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "Argument must be a list of integers.");
+            return NULL;
+        }
+
+        long faction_id = PyInt_AS_LONG(item);
+        if(faction_id < 0 || faction_id >= MAX_FACTIONS) {
+            PyErr_SetString(PyExc_RuntimeError, "Invalid faction ID.");
+            return NULL;
+        }
+        mask |= (1u << faction_id);
+    }
+
+    G_Fog_SetPlayerFactions(mask);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_get_fog_of_war_factions(PyObject *self)
+{
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    uint16_t mask = G_Fog_GetPlayerFactions();
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+
+        if(!(mask & (1u << i)))
+            continue;
+
+        PyObject *faction_id = PyInt_FromLong(i);
+        if(!faction_id || PyList_Append(ret, faction_id) < 0) {
+            Py_XDECREF(faction_id);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(faction_id);
+    }
+    return ret;
+}
+
+static PyObject *PyPf_fog_visible(PyObject *self, PyObject *args)
+{
+    int faction_id;
+    float x, z;
+
+    if(!PyArg_ParseTuple(args, "i(ff)", &faction_id, &x, &z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer and a tuple of two floats.");
+        return NULL;
+    }
+
+    if(G_Fog_Visible(faction_id, (vec2_t){x, z}))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_fog_explored(PyObject *self, PyObject *args)
+{
+    int faction_id;
+    float x, z;
+
+    if(!PyArg_ParseTuple(args, "i(ff)", &faction_id, &x, &z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer and a tuple of two floats.");
+        return NULL;
+    }
+
+    if(G_Fog_Explored(faction_id, (vec2_t){x, z}))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_spawn_ai_worker(PyObject *self, PyObject *args)
+{
+    const char *path;
+    int faction_id;
+
+    if(!PyArg_ParseTuple(args, "si", &path, &faction_id)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string and an integer.");
+        return NULL;
+    }
+
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid faction ID.");
+        return NULL;
+    }
+
+    int id = S_AI_Spawn(path, faction_id);
+    if(id < 0)
+        return NULL; /* exception already set */
+    return PyInt_FromLong(id);
+}
+
+static PyObject *PyPf_stop_ai_worker(PyObject *self, PyObject *args)
+{
+    int id;
+
+    if(!PyArg_ParseTuple(args, "i", &id)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    if(!S_AI_Stop(id)) {
+        PyErr_SetString(PyExc_RuntimeError, "Invalid AI worker ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyPf_update_tile(PyObject *self, PyObject *args)
 {
     struct tile_desc desc;
@@ -951,6 +2253,110 @@ static PyObject *PyPf_map_pos_under_cursor(PyObject *self)
         Py_RETURN_NONE;
 }
 
+/* 'None' is let through, with a NULL 'buf' */
+static bool s_get_out_buffer(PyObject *obj, size_t size, Py_buffer *out)
+{
+    if(obj == Py_None) {
+        out->obj = NULL;
+        out->buf = NULL;
+        return true;
+    }
+
+    if(0 != PyObject_GetBuffer(obj, out, PyBUF_WRITABLE))
+        return false; /* exception already set */
+
+    if(out->len < size) {
+        PyErr_Format(PyExc_ValueError, "The buffer must be at least %zu bytes long.", size);
+        PyBuffer_Release(out);
+        return false;
+    }
+    return true;
+}
+
+static void s_release_out_buffer(Py_buffer *buff)
+{
+    if(buff->buf)
+        PyBuffer_Release(buff);
+}
+
+static PyObject *PyPf_map_chunk_tiles(PyObject *self, PyObject *args)
+{
+    int chunk_r, chunk_c;
+    PyObject *heights_obj, *mats_obj;
+
+    if(!PyArg_ParseTuple(args, "(ii)OO", &chunk_r, &chunk_c, &heights_obj, &mats_obj)) {
+        PyErr_SetString(PyExc_TypeError, 
+            "Arguments must be a tuple of two integers and two writable buffers or None.");
+        return NULL;
+    }
+
+    const size_t ntiles = TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH;
+    Py_buffer heights, mats;
+
+    if(!s_get_out_buffer(heights_obj, ntiles * sizeof(float), &heights))
+        goto fail_heights;
+    if(!s_get_out_buffer(mats_obj, ntiles * sizeof(int32_t), &mats))
+        goto fail_mats;
+
+    if(!G_MapChunkTileData(chunk_r, chunk_c, heights.buf, mats.buf)) {
+        PyErr_SetString(PyExc_RuntimeError, "The chunk is not within the bounds of the map.");
+        goto fail_query;
+    }
+
+    s_release_out_buffer(&mats);
+    s_release_out_buffer(&heights);
+    Py_RETURN_NONE;
+
+fail_query:
+    s_release_out_buffer(&mats);
+fail_mats:
+    s_release_out_buffer(&heights);
+fail_heights:
+    return NULL;
+}
+
+static PyObject *PyPf_map_chunk_nav_tiles(PyObject *self, PyObject *args)
+{
+    int chunk_r, chunk_c;
+    PyObject *pathable_obj, *blocked_obj, *islands_obj;
+
+    if(!PyArg_ParseTuple(args, "(ii)OOO", &chunk_r, &chunk_c, 
+        &pathable_obj, &blocked_obj, &islands_obj)) {
+        PyErr_SetString(PyExc_TypeError, 
+            "Arguments must be a tuple of two integers and three writable buffers or None.");
+        return NULL;
+    }
+
+    const size_t ntiles = CONFIG_NAV_FIELD_RES * CONFIG_NAV_FIELD_RES;
+    Py_buffer pathable, blocked, islands;
+
+    if(!s_get_out_buffer(pathable_obj, ntiles * sizeof(uint8_t), &pathable))
+        goto fail_pathable;
+    if(!s_get_out_buffer(blocked_obj, ntiles * sizeof(uint8_t), &blocked))
+        goto fail_blocked;
+    if(!s_get_out_buffer(islands_obj, ntiles * sizeof(uint16_t), &islands))
+        goto fail_islands;
+
+    if(!G_MapChunkTileStates(chunk_r, chunk_c, pathable.buf, blocked.buf, islands.buf)) {
+        PyErr_SetString(PyExc_RuntimeError, "The chunk is not within the bounds of the map.");
+        goto fail_query;
+    }
+
+    s_release_out_buffer(&islands);
+    s_release_out_buffer(&blocked);
+    s_release_out_buffer(&pathable);
+    Py_RETURN_NONE;
+
+fail_query:
+    s_release_out_buffer(&islands);
+fail_islands:
+    s_release_out_buffer(&blocked);
+fail_blocked:
+    s_release_out_buffer(&pathable);
+fail_pathable:
+    return NULL;
+}
+
 static PyObject *PyPf_set_move_on_left_click(PyObject *self)
 {
     G_Move_SetMoveOnLeftClick();
@@ -1165,22 +2571,26 @@ static PyObject *PyPf_multiply_quaternions(PyObject *self, PyObject *args)
 static PyObject *PyPf_pickle_object(PyObject *self, PyObject *args)
 {
     PyObject *obj;
-    if(!PyArg_ParseTuple(args, "O", &obj)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a single object.");
+    int compress = false;
+
+    if(!PyArg_ParseTuple(args, "O|i", &obj, &compress)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an object and an optional integer.");
         return NULL;
     }
 
     SDL_RWops *vops = PFSDL_VectorRWOps();
-    bool success = S_PickleObjgraph(obj, vops);
+    bool success = compress ? S_PickleObjgraphFramed(obj, vops, true)
+                            : S_PickleObjgraph(obj, vops);
     if(!success) {
         assert(PyErr_Occurred());
         vops->close(vops);
         return NULL;
     }
 
+    /* The raw opcode stream is terminated by a NULL byte which is not part of the string */
     PyObject *ret = PyString_FromString("");
     assert(ret);
-    if(_PyString_Resize(&ret, vops->size(vops)-1) < 0) {
+    if(_PyString_Resize(&ret, vops->size(vops) - (compress ? 0 : 1)) < 0) {
         vops->close(vops);
         return NULL;
     }
@@ -1215,6 +2625,39 @@ static PyObject *PyPf_unpickle_object(PyObject *self, PyObject *args)
     return ret;
 }
 
+static PyObject *PyPf_save_object_async(PyObject *self, PyObject *args)
+{
+    PyObject *obj;
+    const char *path, *base = NULL;
+    int compress = true;
+
+    if(!PyArg_ParseTuple(args, "Os|zi", &obj, &path, &base, &compress)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an object, a string and optionally a string (or None) and a bool.");
+        return NULL;
+    }
+
+    if(!S_Save_Begin(obj, path, base, compress)) {
+        assert(PyErr_Occurred());
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_save_status(PyObject *self)
+{
+    return Py_BuildValue("i", S_Save_Poll());
+}
+
+static PyObject *PyPf_load_saved_object(PyObject *self, PyObject *args)
+{
+    const char *path;
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+    return S_Save_Load(path);
+}
+
 static bool s_sys_path_add_dir(const char *filename)
 {
     if(strlen(filename) >= 512)
@@ -1240,6 +2683,64 @@ static bool s_sys_path_add_dir(const char *filename)
     return true;
 }
 
+static bool s_sys_path_add_bundle(void)
+{
+    extern const char *g_basepath;
+    if(strlen(g_basepath) + strlen("/" SCRIPT_BUNDLE_NAME) >= sizeof(s_bundle_path))
+        return false;
+
+    strcpy(s_bundle_path, g_basepath);
+    strcat(s_bundle_path, "/" SCRIPT_BUNDLE_NAME);
+
+    FILE *bundle = fopen(s_bundle_path, "rb");
+    if(!bundle) {
+        s_bundle_path[0] = '\0';
+        return true;
+    }
+    fclose(bundle);
+
+    PyObject *entry = Py_BuildValue("s", s_bundle_path);
+    int ret = PyList_Insert(PySys_GetObject("path"), 0, entry);
+    Py_DECREF(entry);
+    return (ret == 0);
+}
+
+/* Add the directory inside the bundle that corresponds to the directory of the
+ * script file, if it is under the scripts directory. zipimport accepts paths
+ * of the form 'archive.zip/subdir'. */
+static bool s_sys_path_add_bundle_dir(const char *filename)
+{
+    if(!strlen(s_bundle_path))
+        return true;
+
+    const char *rel = NULL;
+    for(const char *curr = strstr(filename, "scripts/"); curr; curr = strstr(curr + 1, "scripts/")) {
+        if(curr == filename || *(curr - 1) == '/')
+            rel = curr + strlen("scripts/");
+    }
+    if(!rel)
+        return true;
+
+    const char *end = strrchr(rel, '/');
+    if(!end)
+        return true;
+
+    char path[512];
+    size_t rel_len = end - rel;
+    if(strlen(s_bundle_path) + 1 + rel_len >= sizeof(path))
+        return false;
+
+    strcpy(path, s_bundle_path);
+    strcat(path, "/");
+    strncat(path, rel, rel_len);
+
+    /* Right after the bundle root, so that it's found before the loose files */
+    PyObject *entry = Py_BuildValue("s", path);
+    int ret = PyList_Insert(PySys_GetObject("path"), 1, entry);
+    Py_DECREF(entry);
+    return (ret == 0);
+}
+
 /* Due to indeterminate order of object deletion in 'Py_Finalize', there may 
  * be issues with destructor calls of any remaining entities. This will flood
  * stderr with ugly warnings, which we cannot do anything about. We elect 
@@ -1293,6 +2794,117 @@ static void s_gc_all_ents(void)
     Py_DECREF(list);
 }
 
+static PyObject *s_int_arg(int val)
+{
+    if(val < 0 || val >= MAX_CACHED_INT_ARG)
+        return Py_BuildValue("(i)", val);
+
+    if(!s_int_args[val])
+        s_int_args[val] = Py_BuildValue("(i)", val);
+    Py_XINCREF(s_int_args[val]);
+    return s_int_args[val];
+}
+
+static PyObject *s_button_arg(int button, int state)
+{
+    if(button < 0 || button >= MAX_CACHED_BUTTON || (state != SDL_PRESSED && state != SDL_RELEASED))
+        return Py_BuildValue("(i, i)", button, state);
+
+    PyObject **slot = &s_button_args[button][state == SDL_PRESSED];
+    if(!*slot)
+        *slot = Py_BuildValue("(i, i)", button, state);
+    Py_XINCREF(*slot);
+    return *slot;
+}
+
+/* Returns the number of bytes written, or 0 if the argument is not of one 
+ * of the supported types. */
+static size_t s_encode_event_arg(PyObject *arg, unsigned char *out, size_t maxout)
+{
+    assert(maxout >= 1 + sizeof(double));
+
+    if(arg == Py_None) {
+        out[0] = ARG_TAG_NONE;
+        return 1;
+    }
+
+    if(PyBool_Check(arg)) {
+        out[0] = ARG_TAG_BOOL;
+        out[1] = (arg == Py_True);
+        return 2;
+    }
+
+    if(PyInt_Check(arg)) {
+        int64_t val = PyInt_AS_LONG(arg);
+        out[0] = ARG_TAG_INT;
+        memcpy(out + 1, &val, sizeof(val));
+        return 1 + sizeof(val);
+    }
+
+    if(PyFloat_Check(arg)) {
+        double val = PyFloat_AS_DOUBLE(arg);
+        out[0] = ARG_TAG_FLOAT;
+        memcpy(out + 1, &val, sizeof(val));
+        return 1 + sizeof(val);
+    }
+
+    if(PyString_Check(arg)) {
+        size_t len = PyString_GET_SIZE(arg);
+        if(1 + len > maxout)
+            return 0;
+        out[0] = ARG_TAG_STRING;
+        memcpy(out + 1, PyString_AS_STRING(arg), len);
+        return 1 + len;
+    }
+
+    return 0;
+}
+
+static PyObject *s_decode_event_arg(const unsigned char *data, size_t size)
+{
+    int64_t ival;
+    double fval;
+
+    if(size < 1)
+        return NULL;
+
+    switch(data[0]) {
+    case ARG_TAG_NONE:
+        if(size != 1)
+            return NULL;
+        Py_RETURN_NONE;
+    case ARG_TAG_BOOL:
+        if(size != 2)
+            return NULL;
+        return PyBool_FromLong(data[1]);
+    case ARG_TAG_INT:
+        if(size != 1 + sizeof(ival))
+            return NULL;
+        memcpy(&ival, data + 1, sizeof(ival));
+        return PyInt_FromLong(ival);
+    case ARG_TAG_FLOAT:
+        if(size != 1 + sizeof(fval))
+            return NULL;
+        memcpy(&fval, data + 1, sizeof(fval));
+        return PyFloat_FromDouble(fval);
+    case ARG_TAG_STRING:
+        return PyString_FromStringAndSize((const char*)data + 1, size - 1);
+    default:
+        return NULL;
+    }
+}
+
+static void s_release_cached_args(void)
+{
+    for(int i = 0; i < MAX_CACHED_INT_ARG; i++) {
+        Py_CLEAR(s_int_args[i]);
+    }
+    for(int i = 0; i < MAX_CACHED_BUTTON; i++) {
+        Py_CLEAR(s_button_args[i][0]);
+        Py_CLEAR(s_button_args[i][1]);
+    }
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -1307,6 +2919,7 @@ PyMODINIT_FUNC initpf(void)
     S_Entity_PyRegister(module);
     S_UI_PyRegister(module);
     S_Tile_PyRegister(module);
+    S_Lazy_PyRegister(module);
     S_Constants_Expose(module); 
 }
 
@@ -1314,17 +2927,24 @@ bool S_Init(char *progname, const char *base_path, struct nk_context *ctx)
 {
     Py_SetProgramName(progname);
     Py_Initialize();
+    PyEval_InitThreads();
 
     if(!S_UI_Init(ctx))
         return false;
     if(!S_Entity_Init())
         return false;
+    if(!S_Perf_Init())
+        return false;
+    if(!S_AI_Init())
+        return false;
 
     char script_dir[512];
     strcpy(script_dir, g_basepath);
     strcat(script_dir, "/scripts");
     if(0 != PyList_Append(PySys_GetObject("path"), Py_BuildValue("s", script_dir)))
         return false;
+    if(!s_sys_path_add_bundle())
+        return false;
 
     initpf();
 
@@ -1340,13 +2960,32 @@ bool S_Init(char *progname, const char *base_path, struct nk_context *ctx)
 
 void S_Shutdown(void)
 {
+    S_AI_Shutdown();
+    S_Save_Shutdown();
     s_gc_all_ents();
+    s_release_cached_args();
     Py_Finalize();
     S_Pickle_Shutdown();
+    S_Perf_Shutdown();
     S_Entity_Shutdown();
     S_UI_Shutdown();
 }
 
+void S_BeginAllowThreads(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_saved_tstate);
+    s_saved_tstate = PyEval_SaveThread();
+}
+
+void S_EndAllowThreads(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_saved_tstate);
+    PyEval_RestoreThread(s_saved_tstate);
+    s_saved_tstate = NULL;
+}
+
 bool S_RunFile(const char *path)
 {
     FILE *script = fopen(path, "r");
@@ -1357,6 +2996,8 @@ bool S_RunFile(const char *path)
      * We add it manually to sys.path ourselves. */
     if(!s_sys_path_add_dir(path))
         return false;
+    if(!s_sys_path_add_bundle_dir(path))
+        return false;
 
     PyObject *PyFileObject = PyFile_FromString((char*)path, "r");
     PyRun_SimpleFile(PyFile_AsFile(PyFileObject), path);
@@ -1365,7 +3006,7 @@ bool S_RunFile(const char *path)
     return true;
 }
 
-void S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, script_opaque_t event_arg)
+void S_RunEventHandler(int event, script_opaque_t callable, script_opaque_t user_arg, script_opaque_t event_arg)
 {
     PyObject *args, *ret;
 
@@ -1381,7 +3022,11 @@ void S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, scrip
     PyTuple_SetItem(args, 0, user_arg);
     PyTuple_SetItem(args, 1, event_arg);
 
+    uint64_t key = S_Perf_Enter(callable, event);
+    uint64_t start = SDL_GetPerformanceCounter();
+
     ret = PyObject_CallObject(callable, args);
+    S_Perf_Exit(key, SDL_GetPerformanceCounter() - start);
     Py_DECREF(args);
 
     Py_XDECREF(ret);
@@ -1391,6 +3036,11 @@ void S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, scrip
     }
 }
 
+uint64_t S_EventHandlerTicks(void)
+{
+    return S_Perf_TotalTicks();
+}
+
 void S_Release(script_opaque_t obj)
 {
     Py_XDECREF(obj);
@@ -1401,8 +3051,7 @@ script_opaque_t S_WrapEngineEventArg(int eventnum, void *arg)
     switch(eventnum) {
     case SDL_KEYDOWN:
     case SDL_KEYUP:
-        return Py_BuildValue("(i)", 
-            ((SDL_Event*)arg)->key.keysym.scancode);
+        return s_int_arg(((SDL_Event*)arg)->key.keysym.scancode);
 
     case SDL_MOUSEMOTION:
         return Py_BuildValue("(i,i), (i,i)",
@@ -1412,14 +3061,8 @@ script_opaque_t S_WrapEngineEventArg(int eventnum, void *arg)
             ((SDL_Event*)arg)->motion.xrel);
 
     case SDL_MOUSEBUTTONDOWN:
-        return Py_BuildValue("(i, i)",
-            ((SDL_Event*)arg)->button.button,
-            ((SDL_Event*)arg)->button.state);
-
     case SDL_MOUSEBUTTONUP:
-        return Py_BuildValue("(i, i)",
-            ((SDL_Event*)arg)->button.button,
-            ((SDL_Event*)arg)->button.state);
+        return s_button_arg(((SDL_Event*)arg)->button.button, ((SDL_Event*)arg)->button.state);
 
     case SDL_MOUSEWHEEL:
     {
@@ -1438,13 +3081,70 @@ script_opaque_t S_WrapEngineEventArg(int eventnum, void *arg)
             ((struct tile_desc*)arg)->tile_c);
 
     case EVENT_GAME_SIMSTATE_CHANGED:
-        return Py_BuildValue("(i)", (intptr_t)arg);
+        return s_int_arg((intptr_t)arg);
+
+    case EVENT_PROJECTILE_HITS:
+    {
+        const struct proj_hits *phits = arg;
+        PyObject *ret = PyTuple_New(phits->nhits);
+        if(!ret) {
+            PyErr_Print();
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t i = 0; i < phits->nhits; i++) {
+
+            const struct proj_hit *hit = &phits->hits[i];
+            PyObject *target = S_Entity_ObjForUID(hit->target);
+            PyObject *shooter = (hit->shooter != PROJ_NO_SHOOTER) ? S_Entity_ObjForUID(hit->shooter) : NULL;
+
+            PyObject *tuple = Py_BuildValue("(OOi(fff))", 
+                target ? target : Py_None, 
+                shooter ? shooter : Py_None,
+                hit->damage, hit->pos.x, hit->pos.y, hit->pos.z);
+            if(!tuple) {
+                PyErr_Print();
+                exit(EXIT_FAILURE);
+            }
+            PyTuple_SET_ITEM(ret, i, tuple);
+        }
+        return ret;
+    }
 
     default:
         Py_RETURN_NONE;
     }
 }
 
+script_opaque_t S_BuildEventBatch(size_t nevents, const uint32_t *uids, script_opaque_t *args)
+{
+    PyObject *ret = PyTuple_New(nevents);
+    if(!ret) {
+        PyErr_Print();
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < nevents; i++) {
+
+        PyObject *ent = S_Entity_ObjForUID(uids[i]);
+        if(!ent)
+            ent = Py_None;
+
+        PyObject *pair = PyTuple_New(2);
+        if(!pair) {
+            PyErr_Print();
+            exit(EXIT_FAILURE);
+        }
+
+        /* PyTuple_SetItem steals references. The arg reference is ours to give. */
+        Py_INCREF(ent);
+        PyTuple_SET_ITEM(pair, 0, ent);
+        PyTuple_SET_ITEM(pair, 1, (PyObject*)args[i]);
+        PyTuple_SET_ITEM(ret, i, pair);
+    }
+    return ret;
+}
+
 script_opaque_t S_UnwrapIfWeakref(script_opaque_t arg)
 {
     assert(arg);
@@ -1459,3 +3159,15 @@ bool S_ObjectsEqual(script_opaque_t a, script_opaque_t b)
     return (1 == PyObject_RichCompareBool(a, b, Py_EQ));
 }
 
+bool S_NotifyEncodedEvent(int event, const void *data, size_t size)
+{
+    PyObject *arg = s_decode_event_arg(data, size);
+    if(!arg) {
+        PyErr_Clear();
+        return false;
+    }
+
+    E_Global_Notify(event, arg, ES_SCRIPT);
+    return true;
+}
+
@@ -40,6 +40,7 @@
 #include "main.h"
 #include "lib/public/khash.h"
 #include "lib/public/pf_string.h"
+#include "lib/public/vec.h"
 
 #include <SDL.h>
 #include <string.h>
@@ -56,12 +57,31 @@ struct named_val{
 
 KHASH_MAP_INIT_STR(setting, struct setting)
 
+struct sett_listener{
+    void (*on_change)(const struct sval *new_val, void *user);
+    void  *user;
+};
+
+VEC_TYPE(listener, struct sett_listener)
+VEC_IMPL(static inline, listener, struct sett_listener)
+
+/* The interned copy of a setting's value that the handles point to */
+struct sett_handle{
+    struct sval      val;
+    vec_listener_t   listeners;
+};
+
+KHASH_MAP_INIT_STR(handle, struct sett_handle*)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static khash_t(setting) *s_settings_table;
 static char              s_settings_filepath[512];
+/* Only the settings that handles were taken for or that have listeners 
+ * are interned. The handles are never freed before shutdown. */
+static khash_t(handle)  *s_handle_table;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -130,6 +150,59 @@ fail:
     return false;
 }
 
+static struct sett_handle *handle_get(const char *name, bool create)
+{
+    khiter_t k = kh_get(handle, s_handle_table, name);
+    if(k != kh_end(s_handle_table))
+        return kh_value(s_handle_table, k);
+
+    if(!create)
+        return NULL;
+
+    struct sett_handle *ret = calloc(1, sizeof(struct sett_handle));
+    if(!ret)
+        return NULL;
+    vec_listener_init(&ret->listeners);
+
+    const char *key = pf_strdup(name);
+    if(!key)
+        goto fail_key;
+
+    int put_status;
+    k = kh_put(handle, s_handle_table, key, &put_status);
+    if(put_status == -1)
+        goto fail_put;
+
+    struct sval curr;
+    if(Settings_Get(name, &curr) == SS_OKAY) {
+        ret->val = curr;
+    }
+
+    kh_value(s_handle_table, k) = ret;
+    return ret;
+
+fail_put:
+    free((char*)key);
+fail_key:
+    vec_listener_destroy(&ret->listeners);
+    free(ret);
+    return NULL;
+}
+
+/* Called after every change of a setting's value */
+static void handle_update(const char *name, const struct sval *new_val)
+{
+    struct sett_handle *handle = handle_get(name, false);
+    if(!handle)
+        return;
+
+    handle->val = *new_val;
+    for(int i = 0; i < vec_size(&handle->listeners); i++) {
+        const struct sett_listener *curr = &vec_AT(&handle->listeners, i);
+        curr->on_change(&handle->val, curr->user);
+    }
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -142,6 +215,12 @@ ss_e Settings_Init(void)
     if(!s_settings_table)
         return SS_BADALLOC;
 
+    s_handle_table = kh_init(handle);
+    if(!s_handle_table) {
+        kh_destroy(setting, s_settings_table);
+        return SS_BADALLOC;
+    }
+
     extern const char *g_basepath;
     strcpy(s_settings_filepath, g_basepath);
     strcat(s_settings_filepath, "/");
@@ -162,6 +241,14 @@ void Settings_Shutdown(void)
         free((char*)key);
     });
     kh_destroy(setting, s_settings_table);
+
+    struct sett_handle *handle;
+    kh_foreach(s_handle_table, key, handle, {
+        vec_listener_destroy(&handle->listeners);
+        free(handle);
+        free((char*)key);
+    });
+    kh_destroy(handle, s_handle_table);
 }
 
 ss_e Settings_Create(struct setting sett)
@@ -193,6 +280,7 @@ ss_e Settings_Create(struct setting sett)
     if(sett.commit)
         sett.commit(&sett.val);
 
+    handle_update(sett.name, &sett.val);
     return SS_OKAY;
 }
 
@@ -206,6 +294,11 @@ ss_e Settings_Delete(const char *name)
 
     free((char*)kh_key(s_settings_table, k));
     kh_del(setting, s_settings_table, k);
+
+    struct sett_handle *handle = handle_get(name, false);
+    if(handle) {
+        memset(&handle->val, 0, sizeof(handle->val));
+    }
     return SS_OKAY; 
 }
 
@@ -237,7 +330,8 @@ ss_e Settings_Set(const char *name, const struct sval *new_val)
 
     if(sett->commit)
         sett->commit(new_val);
-        
+
+    handle_update(name, new_val);
     return SS_OKAY;
 }
 
@@ -254,10 +348,51 @@ ss_e Settings_SetNoValidate(const char *name, const struct sval *new_val)
 
     if(sett->commit)
         sett->commit(new_val);
-        
+
+    handle_update(name, new_val);
     return SS_OKAY;
 }
 
+const struct sval *Settings_Handle(const char *name)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct sett_handle *handle = handle_get(name, true);
+    return handle ? &handle->val : NULL;
+}
+
+ss_e Settings_AddListener(const char *name, 
+                          void (*on_change)(const struct sval *new_val, void *user), void *user)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct sett_handle *handle = handle_get(name, true);
+    if(!handle)
+        return SS_BADALLOC;
+
+    if(!vec_listener_push(&handle->listeners, (struct sett_listener){on_change, user}))
+        return SS_BADALLOC;
+    return SS_OKAY;
+}
+
+ss_e Settings_RemoveListener(const char *name, 
+                             void (*on_change)(const struct sval *new_val, void *user))
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct sett_handle *handle = handle_get(name, false);
+    if(!handle)
+        return SS_NO_SETTING;
+
+    for(int i = 0; i < vec_size(&handle->listeners); i++) {
+        if(vec_AT(&handle->listeners, i).on_change == on_change) {
+            vec_listener_del(&handle->listeners, i);
+            return SS_OKAY;
+        }
+    }
+    return SS_NO_SETTING;
+}
+
 ss_e Settings_SaveToFile(void)
 {
     ASSERT_IN_MAIN_THREAD();
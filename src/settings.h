@@ -98,6 +98,22 @@ ss_e Settings_Get(const char *name, struct sval *out);
 ss_e Settings_Set(const char *name, const struct sval *new_val);
 ss_e Settings_SetNoValidate(const char *name, const struct sval *new_val);
 
+/* Returns a stable pointer to the value of a setting, which can then be read 
+ * (i.e. every frame) without any lookups. The pointer stays valid until 
+ * Settings_Shutdown, including across the setting being deleted and created 
+ * again. A setting which doesn't exist reads as a zeroed value. Returns NULL 
+ * only when out of memory. */
+const struct sval *Settings_Handle(const char *name);
+
+/* Registers a function to be called with the new value every time that the 
+ * setting changes, after it's been committed. This allows subsystems to cache 
+ * state derived from the setting's value. The setting doesn't need to exist 
+ * yet. */
+ss_e Settings_AddListener(const char *name, 
+                          void (*on_change)(const struct sval *new_val, void *user), void *user);
+ss_e Settings_RemoveListener(const char *name, 
+                             void (*on_change)(const struct sval *new_val, void *user));
+
 ss_e Settings_SaveToFile(void);
 ss_e Settings_LoadFromFile(void);
 const char *Settings_GetFile(void);
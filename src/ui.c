@@ -37,6 +37,7 @@
 #include "config.h"
 #include "event.h"
 #include "main.h"
+#include "perf.h"
 
 #include "lib/public/pf_nuklear.h"
 #include "render/public/render.h"
@@ -69,6 +70,10 @@ static struct nk_context            s_ctx;
 static struct nk_font_atlas         s_atlas;
 static struct nk_draw_null_texture  s_null;
 static vec_td_t                     s_curr_frame_labels;
+/* The hash of the command buffer that the render thread's cached draw 
+ * list was converted from */
+static bool                         s_sent_valid;
+static uint64_t                     s_sent_hash;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -231,6 +236,32 @@ static void *push_draw_list(const struct nk_draw_list *dl)
     return st_dl;
 }
 
+static uint64_t ui_fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t ui_cmds_hash(void)
+{
+    uint64_t ret = 0xcbf29ce484222325ULL;
+    const struct nk_command *cmd;
+
+    /* The order in which the windows' commands are drawn follows the window 
+     * stack rather than the layout of the buffer, so it is hashed too. With 
+     * the pool allocator, the front of the buffer holds only the commands. */
+    nk_foreach(cmd, &s_ctx) {
+        nk_size offset = (const nk_byte*)cmd - (const nk_byte*)s_ctx.memory.memory.ptr;
+        ret = ui_fnv1a(ret, &offset, sizeof(offset));
+    }
+    ret = ui_fnv1a(ret, s_ctx.memory.memory.ptr, s_ctx.memory.allocated);
+    return ret;
+}
+
 static void ui_init_font_stash(struct nk_context *ctx)
 {
     char font_path[256];
@@ -260,7 +291,9 @@ static void ui_init_font_stash(struct nk_context *ctx)
 
     Engine_FlushRenderWorkQueue();
 
-    nk_font_atlas_end(&s_atlas, nk_handle_id(R_UI_GetFontTexID()), &s_null);
+    /* No texture gets created in headless mode */
+    int tex = g_headless ? 0 : R_UI_GetFontTexID();
+    nk_font_atlas_end(&s_atlas, nk_handle_id(tex), &s_null);
     nk_style_set_font(ctx, &s_atlas.default_font->handle);
 }
 
@@ -294,9 +327,9 @@ static struct nk_vec2i ui_get_drawable_size(void)
 
 static struct nk_vec2i ui_get_screen_size(void)
 {
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-    return (struct nk_vec2i){dm.w, dm.h};
+    int w, h;
+    Engine_DesktopRes(&w, &h);
+    return (struct nk_vec2i){w, h};
 }
 
 /*****************************************************************************/
@@ -317,6 +350,7 @@ bool UI_Init(const char *basedir, SDL_Window *win)
     ui_init_font_stash(&s_ctx);
 
     vec_td_init(&s_curr_frame_labels);
+    s_sent_valid = false;
     E_Global_Register(EVENT_UPDATE_UI, on_update_ui, NULL, G_RUNNING | G_PAUSED_UI_RUNNING);
 
     return true;
@@ -346,9 +380,32 @@ void UI_InputEnd(void)
 
 void UI_Render(void)
 {
+    PERF_ENTER();
     struct nk_buffer cmds, vbuf, ebuf;
     const enum nk_anti_aliasing aa = NK_ANTI_ALIASING_ON;
 
+    /* When nothing has changed since the last frame, the render thread 
+     * draws the list that it already has */
+    assert(s_ctx.use_pool);
+
+    /* Nothing is drawn, but the commands of the frame are still consumed */
+    if(g_headless) {
+        nk_clear(&s_ctx);
+        PERF_RETURN_VOID();
+    }
+    uint64_t hash = ui_cmds_hash();
+
+    if(s_sent_valid && hash == s_sent_hash) {
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_UI_Render,
+            .nargs = 1,
+            .args = { NULL },
+        });
+        nk_clear(&s_ctx);
+        PERF_RETURN_VOID();
+    }
+
     void *vbuff = stalloc(&G_GetSimWS()->args, MAX_VERTEX_MEMORY);
     void *ebuff = stalloc(&G_GetSimWS()->args, MAX_ELEMENT_MEMORY);
     assert(vbuff && ebuff);
@@ -387,9 +444,12 @@ void UI_Render(void)
             push_draw_list(&s_ctx.draw_list),
         },
     });
+    s_sent_valid = true;
+    s_sent_hash = hash;
 
     nk_buffer_free(&cmds);
     nk_clear(&s_ctx);
+    PERF_RETURN_VOID();
 }
 
 void UI_HandleEvent(SDL_Event *evt)